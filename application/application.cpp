@@ -22,6 +22,9 @@
 
 #include "application.hpp"
 #include "thread_group.hpp"
+#include "startup_profiler.hpp"
+#include "timer.hpp"
+#include <stdlib.h>
 #ifdef HAVE_GRANITE_AUDIO
 #include "audio_mixer.hpp"
 #endif
@@ -33,10 +36,41 @@ namespace Granite
 {
 Application::Application()
 {
+	if (const char *env = getenv("GRANITE_PIPELINED_FRAMES"))
+		pipelined_frames = strtoul(env, nullptr, 0) != 0;
+	if (const char *env = getenv("GRANITE_LOW_LATENCY"))
+		application_wsi.set_low_latency_mode(strtoul(env, nullptr, 0) != 0);
+	if (const char *env = getenv("GRANITE_PRESENT_THREAD"))
+		application_wsi.set_present_thread(strtoul(env, nullptr, 0) != 0);
+}
+
+void Application::set_pipelined_frames(bool enable)
+{
+	if (!enable)
+		wait_for_pipelined_simulation();
+	pipelined_frames = enable;
+}
+
+void Application::simulate_frame(double, double)
+{
+}
+
+void Application::publish_simulation()
+{
+}
+
+void Application::wait_for_pipelined_simulation()
+{
+	if (pending_simulation)
+	{
+		pending_simulation->wait();
+		pending_simulation.reset();
+	}
 }
 
 bool Application::init_wsi(std::unique_ptr<WSIPlatform> new_platform)
 {
+	Util::ScopedStartupPhase phase("wsi");
 	platform = move(new_platform);
 	application_wsi.set_platform(platform.get());
 
@@ -57,11 +91,11 @@ bool Application::init_wsi(std::unique_ptr<WSIPlatform> new_platform)
 bool Application::poll()
 {
 	auto &wsi = get_wsi();
-	if (!get_platform().alive(wsi))
-		return false;
-
-	if (requested_shutdown)
+	if (!get_platform().alive(wsi) || requested_shutdown)
+	{
+		wait_for_pipelined_simulation();
 		return false;
+	}
 
 	auto *fs = GRANITE_FILESYSTEM();
 	auto *em = GRANITE_EVENT_MANAGER();
@@ -98,8 +132,52 @@ bool Application::poll()
 
 void Application::run_frame()
 {
+	if (!first_frame_done && !first_frame_start)
+		first_frame_start = Util::get_current_time_nsecs();
+
+	// Starts the frame just in time, input is sampled in begin_frame().
+	application_wsi.begin_low_latency_frame();
 	application_wsi.begin_frame();
-	render_frame(application_wsi.get_smooth_frame_time(), application_wsi.get_smooth_elapsed_time());
+#ifdef GRANITE_VULKAN_FILESYSTEM
+	application_wsi.get_device().get_texture_manager().update_residency();
+#endif
+	double frame_time = application_wsi.get_smooth_frame_time();
+	double elapsed_time = application_wsi.get_smooth_elapsed_time();
+
+	// Simulating ahead would sample input a frame early, which defeats low latency mode.
+	if (pipelined_frames && !application_wsi.get_low_latency_mode())
+	{
+		// Simulation for this frame was kicked off while the previous frame was recorded.
+		if (pending_simulation)
+			wait_for_pipelined_simulation();
+		else
+			simulate_frame(frame_time, elapsed_time);
+		publish_simulation();
+
+		auto *group = GRANITE_THREAD_GROUP();
+		// Suspendable, so the simulation can wait on tasks of its own without holding a worker.
+		pending_simulation = group->create_suspendable_task([this, frame_time, elapsed_time]() {
+			simulate_frame(frame_time, elapsed_time + frame_time);
+		});
+		pending_simulation->set_desc("simulate-frame");
+		pending_simulation->flush();
+	}
+	else
+	{
+		wait_for_pipelined_simulation();
+		simulate_frame(frame_time, elapsed_time);
+		publish_simulation();
+	}
+
+	render_frame(frame_time, elapsed_time);
 	application_wsi.end_frame();
+
+	if (!first_frame_done)
+	{
+		// Cold start ends once the first frame is submitted.
+		first_frame_done = true;
+		Util::record_startup_phase("first-frame", first_frame_start, Util::get_current_time_nsecs());
+		Util::end_startup(GRANITE_THREAD_GROUP()->get_timeline_trace_file());
+	}
 }
 }
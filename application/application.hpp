@@ -24,6 +24,7 @@
 #include "wsi.hpp"
 #include "application_wsi_events.hpp"
 #include "input.hpp"
+#include "thread_group.hpp"
 
 namespace Granite
 {
@@ -68,16 +69,70 @@ public:
 	bool poll();
 	void run_frame();
 
+	// Opt-in pipelined frame execution, also enabled with GRANITE_PIPELINED_FRAMES=1.
+	// simulate_frame() for frame N + 1 runs on the thread group while render_frame() for frame N
+	// records and submits. The next frame is simulated with the current smoothed frame time as a prediction.
+	// Ignored while WSI low latency mode is enabled (GRANITE_LOW_LATENCY=1), since that samples input just in time.
+	void set_pipelined_frames(bool enable);
+	bool get_pipelined_frames() const
+	{
+		return pipelined_frames;
+	}
+
+	// Waits for an in-flight simulate_frame(). Platform runners call this before destroying the application.
+	// Subclasses must also call it at the start of their own destructor, since a pending simulation
+	// still uses their members, which are gone by the time ~Application() runs.
+	void wait_for_pipelined_simulation();
+
 protected:
 	void request_shutdown()
 	{
 		requested_shutdown = true;
 	}
 
+	// With pipelining, this runs concurrently with render_frame() and must only write to state
+	// which render_frame() does not read, e.g. the write side of a FrameSnapshot.
+	// It runs as a suspendable task, so it may wait for tasks it spawns.
+	virtual void simulate_frame(double frame_time, double elapsed_time);
+
+	// Called on the main thread between the simulation of a frame completing and render_frame(),
+	// also when frames are not pipelined. Swap snapshots here.
+	virtual void publish_simulation();
+
 private:
 	std::unique_ptr<Vulkan::WSIPlatform> platform;
 	Vulkan::WSI application_wsi;
 	bool requested_shutdown = false;
+	bool pipelined_frames = false;
+	bool first_frame_done = false;
+	int64_t first_frame_start = 0;
+	TaskGroupHandle pending_simulation;
+};
+
+// Double-buffered state for pipelined frames. The simulation writes, rendering reads,
+// and swap() is called from Application::publish_simulation().
+template <typename T>
+class FrameSnapshot
+{
+public:
+	T &write()
+	{
+		return snapshots[write_index];
+	}
+
+	const T &read() const
+	{
+		return snapshots[write_index ^ 1];
+	}
+
+	void swap()
+	{
+		write_index ^= 1;
+	}
+
+private:
+	T snapshots[2];
+	unsigned write_index = 0;
 };
 
 int application_main(Application *(*create_application)(int, char **), int argc, char **argv);
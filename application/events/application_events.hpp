@@ -77,4 +77,46 @@ private:
 	double frame_time;
 	double elapsed_time;
 };
+
+enum class ThermalStatus
+{
+	Unknown,
+	None,
+	Light,
+	Moderate,
+	Severe,
+	Critical,
+	Emergency,
+	Shutdown
+};
+
+// Sent by platforms which can observe device temperature, currently Android 11+.
+// Headroom is the OS forecast of how close the device is to throttling. It is 0 when cool
+// and reaches 1 where severe throttling starts, NaN if unknown.
+// Quality scaling should kick in well before 1, e.g. DynamicResolutionController::set_thermal_headroom(),
+// or a lower RenderGraph::set_frame_time_budget() so optional passes are dropped.
+class ThermalStateEvent : public Granite::Event
+{
+public:
+	GRANITE_EVENT_TYPE_DECL(ThermalStateEvent)
+
+	ThermalStateEvent(ThermalStatus status_, float headroom_)
+		: status(status_), headroom(headroom_)
+	{
+	}
+
+	ThermalStatus get_status() const
+	{
+		return status;
+	}
+
+	float get_headroom() const
+	{
+		return headroom;
+	}
+
+private:
+	ThermalStatus status;
+	float headroom;
+};
 }
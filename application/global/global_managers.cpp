@@ -22,7 +22,10 @@
 
 #include "global_managers.hpp"
 #include "logging.hpp"
+#include "startup_profiler.hpp"
 #include <thread>
+#include <mutex>
+#include <atomic>
 #include <assert.h>
 #include <stdlib.h>
 
@@ -48,6 +51,15 @@ struct GlobalManagers
 
 static thread_local GlobalManagers global_managers;
 
+// Heavy managers which are only created once someone asks for them.
+// Shared by all thread contexts since worker contexts are copied before anything is created.
+static struct
+{
+	std::mutex lock;
+	std::atomic<PhysicsSystemInterface *> physics;
+	Factory *factory;
+} lazy_managers;
+
 GlobalManagersHandle create_thread_context()
 {
 	return GlobalManagersHandle(new GlobalManagers(global_managers));
@@ -130,9 +142,25 @@ void install_audio_system(Audio::BackendInterface *backend, Audio::MixerInterfac
 
 PhysicsSystemInterface *physics()
 {
-	if (!global_managers.physics)
+	if (global_managers.physics)
+		return global_managers.physics;
+
+	auto *lazy_physics = lazy_managers.physics.load(std::memory_order_acquire);
+	if (lazy_physics)
+		return lazy_physics;
+
+	std::lock_guard<std::mutex> holder{lazy_managers.lock};
+	lazy_physics = lazy_managers.physics.load(std::memory_order_relaxed);
+	if (!lazy_physics && lazy_managers.factory)
+	{
+		Util::ScopedStartupPhase phase("physics");
+		lazy_physics = lazy_managers.factory->create_physics_system();
+		lazy_managers.physics.store(lazy_physics, std::memory_order_release);
+	}
+
+	if (!lazy_physics)
 		LOGE("Physics system was not initialized.\n");
-	return global_managers.physics;
+	return lazy_physics;
 }
 
 void init(Factory &factory, ManagerFeatureFlags flags, unsigned max_threads)
@@ -140,6 +168,30 @@ void init(Factory &factory, ManagerFeatureFlags flags, unsigned max_threads)
 	assert(!global_managers.factory || global_managers.factory == &factory);
 	global_managers.factory = &factory;
 
+	if (const char *env = getenv("GRANITE_LOG_RATE_LIMIT"))
+		Util::set_log_rate_limit(strtoul(env, nullptr, 0));
+	if (const char *env = getenv("GRANITE_ASYNC_LOGGING"))
+		Util::set_async_logging(strtoul(env, nullptr, 0) != 0);
+
+	Util::ScopedStartupPhase init_phase("global-managers");
+
+	// Opening the audio device can take a long time and doesn't depend on anything else,
+	// so do it while the other managers are created.
+	// global_managers is thread local, so the audio thread only fills in these.
+	std::thread audio_thread;
+	auto *audio_mixer = global_managers.audio_mixer;
+	auto *audio_backend = global_managers.audio_backend;
+	if ((flags & MANAGER_FEATURE_AUDIO_BIT) && (!audio_mixer || !audio_backend))
+	{
+		audio_thread = std::thread([&]() {
+			Util::ScopedStartupPhase phase("audio");
+			if (!audio_mixer)
+				audio_mixer = factory.create_audio_mixer();
+			if (!audio_backend)
+				audio_backend = factory.create_audio_backend(audio_mixer, 44100.0f, 2);
+		});
+	}
+
 	if (flags & MANAGER_FEATURE_EVENT_BIT)
 	{
 		if (!global_managers.event_manager)
@@ -149,7 +201,10 @@ void init(Factory &factory, ManagerFeatureFlags flags, unsigned max_threads)
 	if (flags & MANAGER_FEATURE_FILESYSTEM_BIT)
 	{
 		if (!global_managers.filesystem)
+		{
+			Util::ScopedStartupPhase phase("filesystem");
 			global_managers.filesystem = factory.create_filesystem();
+		}
 	}
 
 	bool kick_threads = false;
@@ -171,7 +226,10 @@ void init(Factory &factory, ManagerFeatureFlags flags, unsigned max_threads)
 	if (flags & MANAGER_FEATURE_COMMON_RENDERER_DATA_BIT)
 	{
 		if (!global_managers.common_renderer_data)
+		{
+			Util::ScopedStartupPhase phase("common-renderer-data");
 			global_managers.common_renderer_data = factory.create_common_renderer_data();
+		}
 	}
 
 	if (flags & MANAGER_FEATURE_LOGGING_BIT)
@@ -181,18 +239,15 @@ void init(Factory &factory, ManagerFeatureFlags flags, unsigned max_threads)
 		Util::set_thread_logging_interface(global_managers.logging);
 	}
 
+	// Bullet world setup is not free, and most applications never touch physics.
 	if (flags & MANAGER_FEATURE_PHYSICS_BIT)
-	{
-		if (!global_managers.physics)
-			global_managers.physics = factory.create_physics_system();
-	}
+		lazy_managers.factory = &factory;
 
-	if (flags & MANAGER_FEATURE_AUDIO_BIT)
+	if (audio_thread.joinable())
 	{
-		if (!global_managers.audio_mixer)
-			global_managers.audio_mixer = factory.create_audio_mixer();
-		if (!global_managers.audio_backend)
-			global_managers.audio_backend = factory.create_audio_backend(global_managers.audio_mixer, 44100.0f, 2);
+		audio_thread.join();
+		global_managers.audio_mixer = audio_mixer;
+		global_managers.audio_backend = audio_backend;
 	}
 
 	// Kick threads after all global managers are set up.
@@ -204,6 +259,7 @@ void init(Factory &factory, ManagerFeatureFlags flags, unsigned max_threads)
 		if (const char *env = getenv("GRANITE_NUM_WORKER_THREADS"))
 			cpu_threads = strtoul(env, nullptr, 0);
 
+		Util::ScopedStartupPhase phase("thread-group");
 		global_managers.thread_group->start(cpu_threads,
 		                                    [ctx = std::shared_ptr<GlobalManagers>(create_thread_context())] {
 			                                    set_thread_context(*ctx);
@@ -222,6 +278,8 @@ void deinit()
 	delete global_managers.audio_backend;
 	delete global_managers.audio_mixer;
 	delete global_managers.physics;
+	delete lazy_managers.physics.exchange(nullptr);
+	lazy_managers.factory = nullptr;
 	delete global_managers.common_renderer_data;
 	delete global_managers.ui_manager;
 	delete global_managers.thread_group;
@@ -240,6 +298,7 @@ void deinit()
 	global_managers.logging = nullptr;
 
 	global_managers.factory = nullptr;
+	Util::set_async_logging(false);
 }
 
 void start_audio_system()
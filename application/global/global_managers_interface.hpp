@@ -24,6 +24,7 @@
 
 #include <functional>
 #include <string>
+#include <stdint.h>
 #include "logging.hpp"
 
 namespace Util
@@ -42,6 +43,8 @@ class FilesystemInterface
 public:
 	virtual ~FilesystemInterface() = default;
 	virtual bool load_text_file(const std::string &path, std::string &str) = 0;
+	// Modification time in the same unit FileStat uses.
+	virtual bool get_last_modified(const std::string &path, uint64_t &timestamp) = 0;
 };
 
 class ThreadGroupInterface
@@ -25,8 +25,11 @@
 #include "input_linux.hpp"
 #include "unstable_remove_if.hpp"
 #include "logging.hpp"
+#include "thread_name.hpp"
 #include <stdexcept>
+#include <algorithm>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -34,9 +37,11 @@
 #include <linux/kd.h>
 #include <poll.h>
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include <termio.h>
 #include <limits.h>
+#include <time.h>
 
 using namespace std;
 
@@ -265,8 +270,14 @@ bool LinuxInputManager::add_device(int fd, DeviceType type, const char *devnode,
 		test_bit(ABS_RZ, absbit, &dev->joystate.axis_rz);
 	}
 
+	// Timestamps on the same clock as the frame timing.
+	int clock_id = CLOCK_MONOTONIC;
+	if (ioctl(fd, EVIOCSCLOCKID, &clock_id) < 0)
+		LOGW("Failed to set monotonic clock for %s.\n", devnode);
+
 	dev->fd = fd;
-	event.data.ptr = dev.get();
+	dev->id = ++device_id_counter;
+	event.data.u64 = dev->id;
 	event.events = EPOLLIN;
 
 	if (type == DeviceType::Joystick)
@@ -275,6 +286,8 @@ bool LinuxInputManager::add_device(int fd, DeviceType type, const char *devnode,
 		setup_joypad_remapper(fd, dev->joystate.index);
 	}
 
+	// The input thread can see the FD as soon as it's added.
+	lock_guard<mutex> holder{device_lock};
 	if (epoll_ctl(queue_fd, EPOLL_CTL_ADD, fd, &event) < 0)
 	{
 		LOGE("Failed to add FD to epoll.\n");
@@ -357,6 +370,132 @@ void LinuxInputManager::handle_hotplug()
 	udev_device_unref(dev);
 }
 
+LinuxInputManager::Device *LinuxInputManager::find_device(uint64_t id) const
+{
+	for (auto &dev : devices)
+		if (dev->id == id)
+			return dev.get();
+	return nullptr;
+}
+
+template <typename Func>
+void LinuxInputManager::read_device_events(Device &device, const Func &func)
+{
+	struct input_event input_events[32];
+	ssize_t len;
+	while ((len = read(device.fd, input_events, sizeof(input_events))) > 0)
+	{
+		len /= sizeof(input_events[0]);
+		for (ssize_t j = 0; j < len; j++)
+			func(input_events[j]);
+	}
+}
+
+void LinuxInputManager::dispatch_event(Device &device, const input_event &e)
+{
+#ifdef input_event_sec
+	last_event_timestamp_ns = int64_t(e.input_event_sec) * 1000000000ll + int64_t(e.input_event_usec) * 1000ll;
+#else
+	last_event_timestamp_ns = int64_t(e.time.tv_sec) * 1000000000ll + int64_t(e.time.tv_usec) * 1000ll;
+#endif
+	(this->*device.callback)(device, e);
+}
+
+void LinuxInputManager::get_unpolled_mouse_motion(double &x, double &y) const
+{
+	x = double(unpolled_rel_x.load(memory_order_relaxed));
+	y = double(unpolled_rel_y.load(memory_order_relaxed));
+}
+
+void LinuxInputManager::input_thread_loop()
+{
+	Util::set_current_thread_name("linux-input");
+
+	epoll_event events[32];
+	for (;;)
+	{
+		int ret = epoll_wait(queue_fd, events, 32, -1);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			LOGE("epoll_wait failed in input thread.\n");
+			break;
+		}
+
+		lock_guard<mutex> holder{device_lock};
+		for (int i = 0; i < ret; i++)
+		{
+			// Shutdown.
+			if (events[i].data.u64 == 0)
+				return;
+
+			if ((events[i].events & EPOLLIN) == 0)
+				continue;
+
+			auto *device = find_device(events[i].data.u64);
+			if (!device)
+				continue;
+
+			read_device_events(*device, [&](const input_event &e) {
+				if (!event_queue.write_and_move({ device->id, e }))
+				{
+					// Drop rather than stall the thread, the next poll catches up on state anyway.
+					if (!event_queue_overflow.exchange(true, memory_order_relaxed))
+						LOGW("Linux input queue overflowed, dropping events.\n");
+					return;
+				}
+
+				if (device->type == DeviceType::Mouse && e.type == EV_REL)
+				{
+					if (e.code == REL_X)
+						unpolled_rel_x.fetch_add(e.value, memory_order_relaxed);
+					else if (e.code == REL_Y)
+						unpolled_rel_y.fetch_add(e.value, memory_order_relaxed);
+				}
+			});
+		}
+	}
+}
+
+bool LinuxInputManager::start_input_thread()
+{
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0)
+	{
+		LOGE("Failed to create eventfd.\n");
+		return false;
+	}
+
+	epoll_event event = {};
+	event.data.u64 = 0;
+	event.events = EPOLLIN;
+	if (epoll_ctl(queue_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0)
+	{
+		LOGE("Failed to add eventfd to epoll.\n");
+		return false;
+	}
+
+	event_queue.reset(4096);
+	input_thread = thread(&LinuxInputManager::input_thread_loop, this);
+	return true;
+}
+
+void LinuxInputManager::stop_input_thread()
+{
+	if (input_thread.joinable())
+	{
+		uint64_t value = 1;
+		if (write(wake_fd, &value, sizeof(value)) != sizeof(value))
+			LOGE("Failed to wake up input thread.\n");
+		input_thread.join();
+	}
+
+	if (wake_fd >= 0)
+		close(wake_fd);
+	wake_fd = -1;
+}
+
 bool LinuxInputManager::poll()
 {
 	if (queue_fd < 0)
@@ -365,6 +504,37 @@ bool LinuxInputManager::poll()
 	while (hotplug_available())
 		handle_hotplug();
 
+	if (input_thread.joinable())
+	{
+		// Devices are only removed on this thread, so lookups are safe without the lock.
+		QueuedEvent queued[64];
+		size_t count;
+		while ((count = std::min<size_t>(event_queue.read_avail(), 64)) != 0)
+		{
+			event_queue.read_and_move(queued, count);
+			for (size_t i = 0; i < count; i++)
+			{
+				auto &e = queued[i].event;
+				auto *device = find_device(queued[i].device_id);
+				if (!device)
+					continue;
+
+				if (device->type == DeviceType::Mouse && e.type == EV_REL)
+				{
+					if (e.code == REL_X)
+						unpolled_rel_x.fetch_sub(e.value, memory_order_relaxed);
+					else if (e.code == REL_Y)
+						unpolled_rel_y.fetch_sub(e.value, memory_order_relaxed);
+				}
+
+				dispatch_event(*device, e);
+			}
+		}
+
+		event_queue_overflow.store(false, memory_order_relaxed);
+		return true;
+	}
+
 	int ret;
 	epoll_event events[32];
 	while ((ret = epoll_wait(queue_fd, events, 32, 0)) > 0)
@@ -373,16 +543,13 @@ bool LinuxInputManager::poll()
 		{
 			if (events[i].events & EPOLLIN)
 			{
-				struct input_event input_events[32];
-				auto &device = *static_cast<Device *>(events[i].data.ptr);
+				auto *device = find_device(events[i].data.u64);
+				if (!device)
+					continue;
 
-				ssize_t len;
-				while ((len = read(device.fd, input_events, 32)) > 0)
-				{
-					len /= sizeof(input_events[0]);
-					for (ssize_t j = 0; j < len; j++)
-						(this->*device.callback)(device, input_events[j]);
-				}
+				read_device_events(*device, [&](const input_event &e) {
+					dispatch_event(*device, e);
+				});
 			}
 		}
 	}
@@ -392,6 +559,8 @@ bool LinuxInputManager::poll()
 
 void LinuxInputManager::remove_device(const char *devnode)
 {
+	// Closing the FD removes it from epoll, the input thread must not be reading from it.
+	lock_guard<mutex> holder{device_lock};
 	auto itr = Util::unstable_remove_if(begin(devices), end(devices), [=](const unique_ptr<Device> &dev) {
 		return dev->devnode == devnode;
 	});
@@ -670,11 +839,18 @@ bool LinuxInputManager::init(LinuxInputManagerFlags flags_, InputTracker *tracke
 		return false;
 	}
 
+	if ((flags & LINUX_INPUT_MANAGER_THREADED_BIT) && !start_input_thread())
+	{
+		LOGE("Failed to start input thread.\n");
+		return false;
+	}
+
 	return true;
 }
 
 LinuxInputManager::~LinuxInputManager()
 {
+	stop_input_thread();
 	if (udev_monitor)
 		udev_monitor_unref(udev_monitor);
 	if (udev)
@@ -27,7 +27,11 @@
 #include <functional>
 #include <vector>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "input.hpp"
+#include "message_queue.hpp"
 
 namespace Granite
 {
@@ -36,7 +40,9 @@ enum LinuxInputManagerFlagBits
 	LINUX_INPUT_MANAGER_KEYBOARD_BIT = 1 << 0,
 	LINUX_INPUT_MANAGER_MOUSE_BIT = 1 << 1,
 	LINUX_INPUT_MANAGER_TOUCHPAD_BIT = 1 << 2,
-	LINUX_INPUT_MANAGER_JOYPAD_BIT = 1 << 3
+	LINUX_INPUT_MANAGER_JOYPAD_BIT = 1 << 3,
+	// Read events on a dedicated thread as they arrive. poll() then only drains the queue.
+	LINUX_INPUT_MANAGER_THREADED_BIT = 1 << 4
 };
 using LinuxInputManagerFlags = uint32_t;
 
@@ -48,6 +54,16 @@ public:
 	~LinuxInputManager();
 	bool poll();
 
+	// CLOCK_MONOTONIC kernel timestamp of the newest event which poll() has dispatched.
+	int64_t get_last_event_timestamp_ns() const
+	{
+		return last_event_timestamp_ns;
+	}
+
+	// Relative mouse motion which the input thread has read, but poll() has not dispatched yet.
+	// Late-latching consumers can add this to the tracked state just before recording.
+	void get_unpolled_mouse_motion(double &x, double &y) const;
+
 	LinuxInputManager(LinuxInputManager &&) = delete;
 	void operator=(const LinuxInputManager &) = delete;
 
@@ -57,6 +73,8 @@ private:
 	struct udev *udev = nullptr;
 	struct udev_monitor *udev_monitor = nullptr;
 	int queue_fd = -1;
+	int wake_fd = -1;
+	int64_t last_event_timestamp_ns = 0;
 
 	enum class DeviceType
 	{
@@ -84,6 +102,7 @@ private:
 	{
 		~Device();
 		int fd = -1;
+		uint64_t id = 0;
 		InputCallback callback = nullptr;
 		DeviceType type;
 		std::string devnode;
@@ -91,6 +110,29 @@ private:
 		InputTracker *tracker = nullptr;
 	};
 	std::vector<std::unique_ptr<Device>> devices;
+	uint64_t device_id_counter = 0;
+	Device *find_device(uint64_t id) const;
+
+	template <typename Func>
+	void read_device_events(Device &device, const Func &func);
+	void dispatch_event(Device &device, const input_event &e);
+
+	struct QueuedEvent
+	{
+		uint64_t device_id;
+		input_event event;
+	};
+
+	// The input thread only reads, devices are added and removed on the polling thread under the lock.
+	std::mutex device_lock;
+	std::thread input_thread;
+	Util::LockFreeRingBuffer<QueuedEvent> event_queue;
+	std::atomic_int64_t unpolled_rel_x{0};
+	std::atomic_int64_t unpolled_rel_y{0};
+	std::atomic_bool event_queue_overflow{false};
+	bool start_input_thread();
+	void stop_input_thread();
+	void input_thread_loop();
 
 	bool open_devices(DeviceType type, InputCallback callback);
 	bool add_device(int fd, DeviceType type, const char *devnode, InputCallback callback);
@@ -28,8 +28,13 @@
 #include "application_wsi.hpp"
 #include "context.hpp"
 #include "string_helpers.hpp"
+#include "timer.hpp"
 #include <jni.h>
 #include <android/sensor.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
 
 #include "android.hpp"
 #include "os_filesystem.hpp"
@@ -102,6 +107,206 @@ struct JNI
 static GlobalState global_state;
 static JNI jni;
 
+// ADPF (API 33) and thermal (API 30, headroom API 31) are newer than the API level we build for,
+// so they are looked up at runtime.
+struct APerformanceHintManager;
+struct APerformanceHintSession;
+struct AThermalManager;
+
+struct Performance
+{
+	void *libandroid;
+
+	APerformanceHintManager *(*APerformanceHint_getManager)();
+	APerformanceHintSession *(*APerformanceHint_createSession)(APerformanceHintManager *, const int32_t *, size_t, int64_t);
+	int (*APerformanceHint_updateTargetWorkDuration)(APerformanceHintSession *, int64_t);
+	int (*APerformanceHint_reportActualWorkDuration)(APerformanceHintSession *, int64_t);
+	void (*APerformanceHint_closeSession)(APerformanceHintSession *);
+
+	AThermalManager *(*AThermal_acquireManager)();
+	void (*AThermal_releaseManager)(AThermalManager *);
+	int (*AThermal_getCurrentThermalStatus)(AThermalManager *);
+	int (*AThermal_registerThermalStatusListener)(AThermalManager *, void (*)(void *, int), void *);
+	int (*AThermal_unregisterThermalStatusListener)(AThermalManager *, void (*)(void *, int), void *);
+	float (*AThermal_getThermalHeadroom)(AThermalManager *, int);
+
+	APerformanceHintSession *session;
+	int64_t target_duration_ns;
+	uint64_t frame_begin_ns;
+
+	AThermalManager *thermal;
+	uint64_t last_thermal_poll_ns;
+	ThermalStatus reported_status;
+	float reported_headroom;
+};
+static Performance performance;
+// Written from a binder thread.
+static std::atomic_int thermal_status;
+
+static void on_thermal_status_changed(void *, int status)
+{
+	thermal_status.store(status, std::memory_order_relaxed);
+}
+
+template <typename Func>
+static void load_libandroid_symbol(Func &func, const char *name)
+{
+	func = reinterpret_cast<Func>(dlsym(performance.libandroid, name));
+}
+
+static void init_performance()
+{
+	performance = {};
+	performance.reported_status = ThermalStatus::Unknown;
+	performance.reported_headroom = NAN;
+	thermal_status.store(-1, std::memory_order_relaxed);
+
+	performance.libandroid = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+	if (!performance.libandroid)
+		return;
+
+#define LOAD(sym) load_libandroid_symbol(performance.sym, #sym)
+	LOAD(APerformanceHint_getManager);
+	LOAD(APerformanceHint_createSession);
+	LOAD(APerformanceHint_updateTargetWorkDuration);
+	LOAD(APerformanceHint_reportActualWorkDuration);
+	LOAD(APerformanceHint_closeSession);
+	LOAD(AThermal_acquireManager);
+	LOAD(AThermal_releaseManager);
+	LOAD(AThermal_getCurrentThermalStatus);
+	LOAD(AThermal_registerThermalStatusListener);
+	LOAD(AThermal_unregisterThermalStatusListener);
+	LOAD(AThermal_getThermalHeadroom);
+#undef LOAD
+
+	if (performance.AThermal_acquireManager && performance.AThermal_releaseManager &&
+	    performance.AThermal_getCurrentThermalStatus)
+	{
+		performance.thermal = performance.AThermal_acquireManager();
+		if (performance.thermal)
+		{
+			thermal_status.store(performance.AThermal_getCurrentThermalStatus(performance.thermal),
+			                     std::memory_order_relaxed);
+			if (performance.AThermal_registerThermalStatusListener)
+			{
+				performance.AThermal_registerThermalStatusListener(performance.thermal,
+				                                                   on_thermal_status_changed, nullptr);
+			}
+		}
+	}
+
+	LOGI("Performance hints: %s, thermal status: %s, thermal headroom: %s.\n",
+	     performance.APerformanceHint_getManager ? "yes" : "no",
+	     performance.thermal ? "yes" : "no",
+	     performance.thermal && performance.AThermal_getThermalHeadroom ? "yes" : "no");
+}
+
+static void deinit_performance()
+{
+	if (performance.session)
+		performance.APerformanceHint_closeSession(performance.session);
+
+	if (performance.thermal)
+	{
+		if (performance.AThermal_unregisterThermalStatusListener)
+		{
+			performance.AThermal_unregisterThermalStatusListener(performance.thermal,
+			                                                     on_thermal_status_changed, nullptr);
+		}
+		performance.AThermal_releaseManager(performance.thermal);
+	}
+
+	if (performance.libandroid)
+		dlclose(performance.libandroid);
+	performance = {};
+}
+
+static void report_frame_work_duration(double refresh_interval)
+{
+	if (!performance.frame_begin_ns)
+		return;
+
+	auto duration = int64_t(Util::get_current_time_nsecs() - performance.frame_begin_ns);
+	performance.frame_begin_ns = 0;
+
+	if (!performance.APerformanceHint_getManager || !performance.APerformanceHint_createSession ||
+	    !performance.APerformanceHint_updateTargetWorkDuration ||
+	    !performance.APerformanceHint_reportActualWorkDuration ||
+	    !performance.APerformanceHint_closeSession)
+	{
+		return;
+	}
+
+	// The work of a frame has to fit within a refresh interval.
+	auto target = int64_t((refresh_interval > 0.0 ? refresh_interval : 1.0 / 60.0) * 1e9);
+
+	if (!performance.session)
+	{
+		auto *manager = performance.APerformanceHint_getManager();
+		if (!manager)
+		{
+			performance.APerformanceHint_getManager = nullptr;
+			return;
+		}
+
+		// Frame work is recorded on the main thread. Thread group workers are not part of the session.
+		int32_t tid = gettid();
+		performance.session = performance.APerformanceHint_createSession(manager, &tid, 1, target);
+		if (!performance.session)
+		{
+			LOGW("Failed to create performance hint session.\n");
+			performance.APerformanceHint_getManager = nullptr;
+			return;
+		}
+		performance.target_duration_ns = target;
+	}
+	else if (target != performance.target_duration_ns)
+	{
+		performance.APerformanceHint_updateTargetWorkDuration(performance.session, target);
+		performance.target_duration_ns = target;
+	}
+
+	// Frames which span a pause or a swapchain rebuild would only confuse the governor.
+	if (duration > 0 && duration < 4 * target)
+		performance.APerformanceHint_reportActualWorkDuration(performance.session, duration);
+}
+
+static void poll_thermal_state()
+{
+	if (!performance.thermal)
+		return;
+
+	// Headroom queries are rate limited by the OS to about once a second.
+	auto now = Util::get_current_time_nsecs();
+	if (performance.last_thermal_poll_ns && now - performance.last_thermal_poll_ns < 1000000000ull)
+		return;
+	performance.last_thermal_poll_ns = now;
+
+	int raw_status = thermal_status.load(std::memory_order_relaxed);
+	auto status = raw_status >= 0 && raw_status <= 6 ? ThermalStatus(raw_status + 1) : ThermalStatus::Unknown;
+
+	// Forecast a few seconds ahead so there is time to scale down before throttling starts.
+	float headroom = NAN;
+	if (performance.AThermal_getThermalHeadroom)
+		headroom = performance.AThermal_getThermalHeadroom(performance.thermal, 5);
+
+	bool headroom_changed = std::isnan(headroom) != std::isnan(performance.reported_headroom) ||
+	                        std::fabs(headroom - performance.reported_headroom) >= 0.05f;
+
+	if (status == performance.reported_status && !headroom_changed)
+		return;
+
+	if (status != performance.reported_status)
+		LOGI("Thermal status changed to %d, headroom %.3f.\n", raw_status, headroom);
+
+	performance.reported_status = status;
+	performance.reported_headroom = headroom;
+
+	auto *em = GRANITE_EVENT_MANAGER();
+	if (em)
+		em->dispatch_inline(ThermalStateEvent{status, headroom});
+}
+
 static void on_content_rect_changed(ANativeActivity *, const ARect *rect)
 {
 	global_state.base_width = rect->right - rect->left;
@@ -208,6 +413,7 @@ struct WSIPlatformAndroid : Granite::GraniteWSIPlatform
 	void update_orientation();
 	bool alive(Vulkan::WSI &wsi) override;
 	void poll_input() override;
+	void event_frame_tick(double frame, double elapsed) override;
 
 	vector<const char *> get_instance_extensions() override
 	{
@@ -739,6 +945,13 @@ void WSIPlatformAndroid::poll_input()
 	get_input_tracker().dispatch_current_state(get_frame_timer().get_frame_time());
 }
 
+void WSIPlatformAndroid::event_frame_tick(double frame, double elapsed)
+{
+	// The frame's CPU work starts once the swapchain image is acquired.
+	performance.frame_begin_ns = Util::get_current_time_nsecs();
+	Granite::GraniteWSIPlatform::event_frame_tick(frame, elapsed);
+}
+
 bool WSIPlatformAndroid::alive(Vulkan::WSI &wsi)
 {
 	auto &state = *static_cast<WSIPlatformAndroid *>(global_state.app->userData);
@@ -747,6 +960,10 @@ bool WSIPlatformAndroid::alive(Vulkan::WSI &wsi)
 	android_poll_source *source;
 	state.app_wsi = &wsi;
 
+	// alive() is called right after the previous frame was presented.
+	report_frame_work_duration(wsi.get_estimated_refresh_interval());
+	poll_thermal_state();
+
 	if (global_state.app->destroyRequested)
 		return false;
 
@@ -935,6 +1152,7 @@ void android_main(android_app *app)
 
 	init_jni();
 	Global::init();
+	init_performance();
 
 	LOGI("Starting Granite!\n");
 
@@ -975,6 +1193,7 @@ void android_main(android_app *app)
 			if (app->destroyRequested)
 			{
 				GRANITE_EVENT_MANAGER()->dequeue_all_latched(ApplicationLifecycleEvent::get_type_id());
+				deinit_performance();
 				Global::deinit();
 				deinit_jni();
 				return;
@@ -1065,7 +1284,10 @@ void android_main(android_app *app)
 
 					wait_for_complete_teardown(global_state.app);
 
+					if (app_handle)
+						app_handle->wait_for_pipelined_simulation();
 					app_handle.reset();
+					deinit_performance();
 					Global::deinit();
 					deinit_jni();
 					return;
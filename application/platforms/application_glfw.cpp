@@ -673,6 +673,7 @@ int application_main(Application *(*create_application)(int, char **), int argc,
 
 		int ret = platform_handle->run_async_loop(app.get());
 
+		app->wait_for_pipelined_simulation();
 		app.reset();
 		Granite::Global::deinit();
 		return ret;
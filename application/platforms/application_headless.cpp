@@ -32,10 +32,16 @@
 #include "os_filesystem.hpp"
 #include "rapidjson_wrapper.hpp"
 #include <limits.h>
+#include <algorithm>
 #include <cmath>
 #include "thread_group.hpp"
 #include "global_managers_init.hpp"
 #include "thread_latch.hpp"
+#include "string_helpers.hpp"
+#include "frame_dump.hpp"
+#include "startup_profiler.hpp"
+#include "texture_files.hpp"
+#include "utils/image_utils.hpp"
 
 #ifdef HAVE_GRANITE_FFMPEG
 #include "ffmpeg.hpp"
@@ -46,11 +52,21 @@
 #include "audio_mixer.hpp"
 #endif
 
+#ifdef HAVE_GRANITE_NETWORK
+#include "telemetry.hpp"
+#include <stdexcept>
+#include <string.h>
+#endif
+
 using namespace rapidjson;
 
 #ifdef _WIN32
 #include <windows.h>
 #include <shellapi.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <sys/wait.h>
 #endif
 
 using namespace std;
@@ -153,6 +169,8 @@ public:
 	{
 		for (auto &thread : worker_threads)
 			thread->wait();
+		if (frame_dumper)
+			frame_dumper->wait();
 
 		auto *em = GRANITE_EVENT_MANAGER();
 		if (em)
@@ -179,9 +197,17 @@ public:
 		get_input_tracker().dispatch_current_state(get_frame_timer().get_frame_time());
 	}
 
-	void enable_png_readback(string base_path)
+	void enable_png_readback(string base_path, FrameDumpFormat format, unsigned max_in_flight)
 	{
 		png_readback = std::move(base_path);
+		frame_dumper.reset(new FrameDumper(GRANITE_THREAD_GROUP(), format, max_in_flight));
+		dump_extension = get_frame_dump_extension(format);
+	}
+
+	// The last frame is compared against this image on the GPU, see compare_next_frame().
+	void enable_image_reference(string path)
+	{
+		image_reference_path = std::move(path);
 	}
 
 	void enable_video_encode(string path)
@@ -287,6 +313,13 @@ public:
 
 		auto info = ImageCreateInfo::render_target(width, height, VK_FORMAT_R8G8B8A8_SRGB);
 		info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+#ifdef HAVE_GRANITE_FFMPEG
+		// Lets VideoEncoder convert to YUV on the GPU.
+		if (!video_encode_path.empty())
+			info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+#endif
+		if (!image_reference_path.empty())
+			info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
 		info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 
 		BufferCreateInfo readback = {};
@@ -336,6 +369,26 @@ public:
 		}
 #endif
 
+		// resolve_compare() reports the failure if the reference cannot be used.
+		if (!image_reference_path.empty())
+		{
+			auto tex = load_texture_from_file(*GRANITE_FILESYSTEM(), image_reference_path);
+			auto &layout = tex.get_layout();
+			if (tex.empty())
+				LOGE("Failed to load reference image %s.\n", image_reference_path.c_str());
+			else if (layout.get_width() != width || layout.get_height() != height)
+			{
+				LOGE("Reference image is %ux%u, but rendering at %ux%u.\n",
+				     layout.get_width(), layout.get_height(), width, height);
+			}
+			else
+			{
+				auto staging = device.create_image_staging_buffer(layout);
+				reference_image = device.create_image_from_staging_buffer(
+						ImageCreateInfo::immutable_image(layout), &staging);
+			}
+		}
+
 		wsi.init_external_swapchain(swapchain_images);
 		return true;
 	}
@@ -345,10 +398,22 @@ public:
 		time_step = t;
 	}
 
+	// Render every stride'th frame starting at offset, e.g. one slice of a multi-GPU farm.
+	void set_frame_distribution(unsigned offset, unsigned stride)
+	{
+		frames = offset;
+		frame_stride = stride;
+	}
+
 	void begin_frame()
 	{
 		auto &wsi = app->get_wsi();
-		wsi.set_external_frame(frame_index, acquire_semaphore[frame_index], time_step);
+
+		// Advance the timer over the frames other workers render so elapsed time matches a single GPU run.
+		double frame_time = time_step * double(first_frame ? frames + 1 : frame_stride);
+		first_frame = false;
+
+		wsi.set_external_frame(frame_index, acquire_semaphore[frame_index], frame_time);
 		acquire_semaphore[frame_index].reset();
 		worker_threads[frame_index]->wait();
 	}
@@ -361,7 +426,24 @@ public:
 
 		if (release_semaphore && release_semaphore->get_semaphore() != VK_NULL_HANDLE)
 		{
-			if (next_readback_cb || !png_readback.empty())
+			if (compare_frame && reference_image)
+			{
+				OwnershipTransferInfo transfer_info = {};
+				transfer_info.old_queue = CommandBuffer::Type::AsyncGraphics;
+				transfer_info.new_queue = CommandBuffer::Type::Generic;
+				transfer_info.old_image_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+				transfer_info.new_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				transfer_info.dst_pipeline_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+				transfer_info.dst_access = VK_ACCESS_SHADER_READ_BIT;
+				auto cmd = request_command_buffer_with_ownership_transfer(device, *swapchain_images[frame_index],
+				                                                          transfer_info, release_semaphore);
+
+				compare_readback = compare_images_on_gpu(*cmd, swapchain_images[frame_index]->get_view(),
+				                                         reference_image->get_view());
+				device.submit(cmd, &compare_readback.fence, 1, &acquire_semaphore[frame_index]);
+				compare_frame = false;
+			}
+			else if (next_readback_cb || !png_readback.empty())
 			{
 				OwnershipTransferInfo transfer_info = {};
 				transfer_info.old_queue = CommandBuffer::Type::AsyncGraphics;
@@ -421,7 +503,7 @@ public:
 
 		release_semaphore.reset();
 		frame_index = (frame_index + 1) % SwapchainImages;
-		frames++;
+		frames += frame_stride;
 	}
 
 	void set_next_readback(const std::string &path)
@@ -443,10 +525,45 @@ public:
 		};
 	}
 
+	void compare_next_frame()
+	{
+		compare_frame = true;
+	}
+
+	// Returns false if the frame could not be compared or PSNR is below threshold.
+	bool resolve_compare(double threshold)
+	{
+		ImageCompareResult result;
+		if (!resolve_image_compare(app->get_wsi().get_device(), compare_readback, result))
+		{
+			LOGE("Failed to compare against %s.\n", image_reference_path.c_str());
+			return false;
+		}
+
+		LOGI("Reference %s | PSNR: %.3f dB, MSE: %.3f, max error: %u\n",
+		     image_reference_path.c_str(), result.psnr, result.mse, result.max_error);
+
+		if (threshold >= 0.0 && result.psnr < threshold)
+		{
+			// Point at the worst tile to speed up triage.
+			auto worst = size_t(std::max_element(result.tile_mse.begin(), result.tile_mse.end()) - result.tile_mse.begin());
+			LOGE("PSNR is too low, worst %u px tile at (%u, %u) with MSE %.3f.\n",
+			     unsigned(ImageCompareReadback::TileSize),
+			     unsigned(worst % result.tiles_x) * ImageCompareReadback::TileSize,
+			     unsigned(worst / result.tiles_x) * ImageCompareReadback::TileSize,
+			     result.tile_mse[worst]);
+			return false;
+		}
+
+		return true;
+	}
+
 	void wait_threads()
 	{
 		for (auto &thread : worker_threads)
 			thread->wait();
+		if (frame_dumper)
+			frame_dumper->wait();
 #ifdef HAVE_GRANITE_FFMPEG
 		encoder.drain();
 #endif
@@ -458,9 +575,17 @@ private:
 	unsigned frames = 0;
 	unsigned max_frames = UINT_MAX;
 	unsigned frame_index = 0;
+	unsigned frame_stride = 1;
+	bool first_frame = true;
 	double time_step = 0.01;
 	string png_readback;
+	const char *dump_extension = "png";
+	unique_ptr<FrameDumper> frame_dumper;
 	string video_encode_path;
+	string image_reference_path;
+	ImageHandle reference_image;
+	ImageCompareReadback compare_readback;
+	bool compare_frame = false;
 	enum { SwapchainImages = 4 };
 
 	vector<ImageHandle> swapchain_images;
@@ -485,16 +610,16 @@ private:
 
 		LOGI("Dumping frame: %u (index: %u)\n", frame, index);
 
-		auto *ptr = static_cast<uint32_t *>(device.map_host_buffer(*readback_buffers[index], MEMORY_ACCESS_READ_WRITE_BIT));
+		// Copy out so the readback buffer can be reused right away, encoding happens on the thread group.
+		auto pixels = frame_dumper->acquire_buffer(width * height);
+		auto *ptr = static_cast<const uint32_t *>(device.map_host_buffer(*readback_buffers[index], MEMORY_ACCESS_READ_BIT));
 		for (unsigned i = 0; i < width * height; i++)
-			ptr[i] |= 0xff000000u;
+			pixels[i] = ptr[i] | 0xff000000u;
+		device.unmap_host_buffer(*readback_buffers[index], MEMORY_ACCESS_READ_BIT);
 
 		char buffer[64];
-		sprintf(buffer, "_%05u.png", frame);
-		auto path = png_readback + buffer;
-		if (!stbi_write_png(path.c_str(), width, height, 4, ptr, width * 4))
-			LOGE("Failed to write PNG to disk.\n");
-		device.unmap_host_buffer(*readback_buffers[index], MEMORY_ACCESS_READ_WRITE_BIT);
+		sprintf(buffer, "_%05u.%s", frame, dump_extension);
+		frame_dumper->push_frame(png_readback + buffer, width, height, std::move(pixels));
 	}
 
 	Application *app = nullptr;
@@ -503,10 +628,287 @@ private:
 
 static void print_help()
 {
-	LOGI("[--png-path <path>] [--stat <output.json>]\n"
+	LOGI("[--png-path <path>] [--frame-format <png|png-fast|qoi|ppm>] [--frame-encode-queue <frames>] [--stat <output.json>]\n"
 	     "[--fs-assets <path>] [--fs-cache <path>] [--fs-builtin <path>]\n"
-	     "[--video-encode-path <path>]\n"
-	     "[--png-reference-path <path>] [--frames <frames>] [--width <width>] [--height <height>] [--time-step <step>].\n");
+	     "[--video-encode-path <path>] [--pass-counters <counter,counter,...>]\n"
+	     "[--png-reference-path <path>] [--frames <frames>] [--width <width>] [--height <height>] [--time-step <step>]\n"
+	     "[--gpus <count, 0 for all>] [--warmup-frames <frames>] [--replay-frame <iterations>]\n"
+	     "[--stat-reference <reference.json>] [--stat-threshold <percent>].\n"
+	     "[--image-reference <path>] [--image-reference-threshold <dB>] [--telemetry <port>].\n"
+	     "With --stat-reference, exits with 2 if frame time percentiles or pass timings regress beyond the threshold.\n"
+	     "With --image-reference, one more frame is compared on the GPU, exits with 3 if PSNR is below the threshold.\n"
+	     "With --replay-frame, the frame after warm-up is captured and submitted again back to back, and GPU time\n"
+	     "per frame and per timestamped pass is reported instead of running frames.\n"
+	     "With --telemetry, per-frame stats are served to telemetry-collector on the given port.\n");
+}
+
+// Captures the next frame and resubmits its command buffers, so timings are free of CPU recording bubbles.
+static bool run_frame_replay(Granite::WSIPlatformHeadless &platform, Granite::Application &app,
+                             unsigned iterations, const string &stat_path)
+{
+	auto &device = app.get_wsi().get_device();
+	if (!app.poll())
+		return false;
+
+	device.begin_frame_capture();
+	platform.begin_frame();
+	app.run_frame();
+	device.end_frame_capture();
+	platform.end_frame();
+
+	FrameReplayReport report;
+	if (!device.replay_frame_capture(iterations, report))
+		return false;
+
+	LOGI("Replayed frame %u times, GPU time: average %.3f ms, min %.3f ms\n",
+	     report.iterations, report.frame_gpu_ms, report.min_frame_gpu_ms);
+	for (auto &pass : report.passes)
+		LOGI("  %s: %.3f ms\n", pass.tag.c_str(), pass.gpu_ms);
+
+	if (stat_path.empty())
+		return true;
+
+	Document doc;
+	doc.SetObject();
+	auto &allocator = doc.GetAllocator();
+	doc.AddMember("replayIterations", report.iterations, allocator);
+	doc.AddMember("gpu", StringRef(app.get_wsi().get_context().get_gpu_props().deviceName), allocator);
+	doc.AddMember("driverVersion", app.get_wsi().get_context().get_gpu_props().driverVersion, allocator);
+	doc.AddMember("frameGpuTimeMs", report.frame_gpu_ms, allocator);
+	doc.AddMember("minFrameGpuTimeMs", report.min_frame_gpu_ms, allocator);
+
+	Value pass_objs(kObjectType);
+	for (auto &pass : report.passes)
+		pass_objs.AddMember(Value(pass.tag.c_str(), allocator), pass.gpu_ms, allocator);
+	doc.AddMember("passGpuTimeMs", pass_objs, allocator);
+
+	StringBuffer buffer;
+	PrettyWriter<StringBuffer> writer(buffer);
+	doc.Accept(writer);
+	if (!GRANITE_FILESYSTEM()->write_string_to_file(stat_path, buffer.GetString()))
+		LOGE("Failed to write stat file to disk.\n");
+	return true;
+}
+
+// Nearest rank, sorts values in place.
+static double compute_percentile(vector<double> &values, double percentile)
+{
+	if (values.empty())
+		return 0.0;
+	sort(values.begin(), values.end());
+	auto rank = size_t(std::ceil(percentile * double(values.size())));
+	return values[rank ? rank - 1 : 0];
+}
+
+static Value build_percentiles(vector<double> &values, Document::AllocatorType &allocator)
+{
+	double total = 0.0;
+	for (auto v : values)
+		total += v;
+
+	Value obj(kObjectType);
+	obj.AddMember("avg", values.empty() ? 0.0 : total / double(values.size()), allocator);
+	obj.AddMember("p50", compute_percentile(values, 0.50), allocator);
+	obj.AddMember("p95", compute_percentile(values, 0.95), allocator);
+	obj.AddMember("p99", compute_percentile(values, 0.99), allocator);
+	obj.AddMember("max", values.empty() ? 0.0 : values.back(), allocator);
+	return obj;
+}
+
+static bool check_regression(const char *what, double value, double reference, double threshold)
+{
+	// Tiny timings are all noise.
+	if (reference <= 0.0 || value <= reference * (1.0 + threshold) || value - reference < 1.0)
+		return false;
+
+	LOGE("Regression in %s: %.3f us -> %.3f us (%+.2f %%).\n", what, reference, value,
+	     100.0 * (value - reference) / reference);
+	return true;
+}
+
+// Compares frame time percentiles and per-pass GPU timings of two stat files.
+static bool compare_stats(const Document &doc, const string &reference_path, double threshold)
+{
+	string json;
+	if (!GRANITE_FILESYSTEM()->read_file_to_string(reference_path, json))
+	{
+		LOGE("Failed to read reference stat file %s.\n", reference_path.c_str());
+		return false;
+	}
+
+	Document reference;
+	reference.Parse(json.c_str());
+	if (reference.HasParseError() || !reference.IsObject())
+	{
+		LOGE("Failed to parse reference stat file %s.\n", reference_path.c_str());
+		return false;
+	}
+
+	bool regressed = false;
+	if (doc.HasMember("frameTimeUs") && reference.HasMember("frameTimeUs"))
+	{
+		auto &cur = doc["frameTimeUs"];
+		auto &ref = reference["frameTimeUs"];
+		for (const char *p : { "p50", "p95", "p99" })
+		{
+			if (cur.HasMember(p) && ref.HasMember(p))
+			{
+				string what = string("frame time ") + p;
+				regressed |= check_regression(what.c_str(), cur[p].GetDouble(), ref[p].GetDouble(), threshold);
+			}
+		}
+	}
+
+	if (doc.HasMember("performance") && reference.HasMember("performance"))
+	{
+		auto &ref_perf = reference["performance"];
+		for (auto itr = doc["performance"].MemberBegin(); itr != doc["performance"].MemberEnd(); ++itr)
+		{
+			if (!ref_perf.HasMember(itr->name))
+				continue;
+			auto &ref = ref_perf[itr->name];
+			if (!ref.HasMember("timePerFrameContextUs"))
+				continue;
+
+			string what = string("pass ") + itr->name.GetString();
+			regressed |= check_regression(what.c_str(), itr->value["timePerFrameContextUs"].GetDouble(),
+			                              ref["timePerFrameContextUs"].GetDouble(), threshold);
+		}
+	}
+
+	if (!regressed)
+		LOGI("No regressions against %s.\n", reference_path.c_str());
+	return !regressed;
+}
+
+static unsigned count_physical_devices()
+{
+	if (!Context::init_loader(nullptr))
+		return 0;
+
+	VkInstanceCreateInfo info = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO };
+	VkApplicationInfo app_info = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+	app_info.apiVersion = VK_API_VERSION_1_1;
+	info.pApplicationInfo = &app_info;
+
+	VkInstance instance = VK_NULL_HANDLE;
+	if (vkCreateInstance(&info, nullptr, &instance) != VK_SUCCESS)
+		return 0;
+	volkLoadInstance(instance);
+
+	uint32_t count = 0;
+	vkEnumeratePhysicalDevices(instance, &count, nullptr);
+	vkDestroyInstance(instance, nullptr);
+	return count;
+}
+
+// Every Device shares the process wide managers (events, filesystem, threads),
+// so each GPU gets its own process which only renders its slice of the frames.
+// Frame N is still dumped as <png-path>_N.<ext>, so output stays ordered.
+static int run_render_farm(const vector<string> &original_args, unsigned gpus)
+{
+	if (gpus == 0)
+		gpus = count_physical_devices();
+
+	if (gpus == 0)
+	{
+		LOGE("Found no physical devices.\n");
+		return 1;
+	}
+
+	LOGI("Distributing frames across %u GPUs.\n", gpus);
+
+	auto executable = Path::get_executable_path();
+#ifdef _WIN32
+	vector<intptr_t> children;
+#else
+	vector<pid_t> children;
+#endif
+
+	for (unsigned i = 0; i < gpus; i++)
+	{
+		vector<string> child_args;
+		child_args.push_back(executable);
+
+		for (size_t j = 1; j < original_args.size(); j++)
+		{
+			auto &arg = original_args[j];
+			bool has_value = j + 1 < original_args.size();
+
+			if (arg == "--gpus" && has_value)
+				j++;
+			else if (arg == "--png-reference-path" && has_value)
+			{
+				if (i == 0)
+					LOGW("--png-reference-path is ignored when rendering on multiple GPUs.\n");
+				j++;
+			}
+			else if ((arg == "--stat-reference" || arg == "--stat-threshold" ||
+			          arg == "--image-reference" || arg == "--image-reference-threshold") && has_value)
+			{
+				if (i == 0)
+					LOGW("%s is ignored when rendering on multiple GPUs.\n", arg.c_str());
+				j++;
+			}
+			else if (arg == "--stat" && has_value)
+			{
+				child_args.push_back(arg);
+				child_args.push_back(original_args[++j] + ".gpu" + to_string(i));
+			}
+			else
+				child_args.push_back(arg);
+		}
+
+		child_args.push_back("--frame-offset");
+		child_args.push_back(to_string(i));
+		child_args.push_back("--frame-stride");
+		child_args.push_back(to_string(gpus));
+
+		vector<char *> child_argv;
+		for (auto &arg : child_args)
+			child_argv.push_back(const_cast<char *>(arg.c_str()));
+		child_argv.push_back(nullptr);
+
+		auto index = to_string(i);
+#ifdef _WIN32
+		_putenv_s("GRANITE_VULKAN_DEVICE_INDEX", index.c_str());
+		intptr_t child = _spawnv(_P_NOWAIT, executable.c_str(), child_argv.data());
+		if (child == -1)
+		{
+			LOGE("Failed to spawn worker for GPU %u.\n", i);
+			continue;
+		}
+#else
+		pid_t child = fork();
+		if (child == 0)
+		{
+			setenv("GRANITE_VULKAN_DEVICE_INDEX", index.c_str(), 1);
+			execv(executable.c_str(), child_argv.data());
+			_exit(1);
+		}
+		else if (child < 0)
+		{
+			LOGE("Failed to spawn worker for GPU %u.\n", i);
+			continue;
+		}
+#endif
+		children.push_back(child);
+	}
+
+	int exit_code = children.size() == gpus ? 0 : 1;
+	for (auto &child : children)
+	{
+		int status = 0;
+#ifdef _WIN32
+		if (_cwait(&status, child, _WAIT_CHILD) == -1 || status != 0)
+			exit_code = 1;
+#else
+		if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			exit_code = 1;
+#endif
+	}
+
+	return exit_code;
 }
 
 namespace Granite
@@ -519,16 +921,29 @@ int application_main_headless(Application *(*create_application)(int, char **),
 	struct Args
 	{
 		string png_path;
+		string frame_format = "png";
 		string video_encode_path;
 		string png_reference_path;
+		string image_reference;
 		string stat;
+		string stat_reference;
 		string assets;
 		string cache;
 		string builtin;
+		string pass_counters;
 		unsigned max_frames = UINT_MAX;
+		unsigned gpus = 1;
+		unsigned frame_offset = 0;
+		unsigned frame_stride = 1;
 		unsigned width = 1280;
 		unsigned height = 720;
+		unsigned warmup_frames = 1;
+		unsigned frame_encode_queue = 0;
+		unsigned replay_iterations = 0;
+		unsigned telemetry_port = 0;
 		double time_step = 0.01;
+		double stat_threshold = 5.0;
+		double image_reference_threshold = -1.0;
 	} args;
 
 	CLICallbacks cbs;
@@ -537,12 +952,25 @@ int application_main_headless(Application *(*create_application)(int, char **),
 	cbs.add("--height", [&](CLIParser &parser) { args.height = parser.next_uint(); });
 	cbs.add("--time-step", [&](CLIParser &parser) { args.time_step = parser.next_double(); });
 	cbs.add("--png-path", [&](CLIParser &parser) { args.png_path = parser.next_string(); });
+	cbs.add("--frame-format", [&](CLIParser &parser) { args.frame_format = parser.next_string(); });
+	cbs.add("--frame-encode-queue", [&](CLIParser &parser) { args.frame_encode_queue = parser.next_uint(); });
 	cbs.add("--png-reference-path", [&](CLIParser &parser) { args.png_reference_path = parser.next_string(); });
 	cbs.add("--video-encode-path", [&](CLIParser &parser) { args.video_encode_path = parser.next_string(); });
 	cbs.add("--fs-assets", [&](CLIParser &parser) { args.assets = parser.next_string(); });
 	cbs.add("--fs-builtin", [&](CLIParser &parser) { args.builtin = parser.next_string(); });
 	cbs.add("--fs-cache", [&](CLIParser &parser) { args.cache = parser.next_string(); });
 	cbs.add("--stat", [&](CLIParser &parser) { args.stat = parser.next_string(); });
+	cbs.add("--stat-reference", [&](CLIParser &parser) { args.stat_reference = parser.next_string(); });
+	cbs.add("--stat-threshold", [&](CLIParser &parser) { args.stat_threshold = parser.next_double(); });
+	cbs.add("--image-reference", [&](CLIParser &parser) { args.image_reference = parser.next_string(); });
+	cbs.add("--image-reference-threshold", [&](CLIParser &parser) { args.image_reference_threshold = parser.next_double(); });
+	cbs.add("--warmup-frames", [&](CLIParser &parser) { args.warmup_frames = parser.next_uint(); });
+	cbs.add("--replay-frame", [&](CLIParser &parser) { args.replay_iterations = parser.next_uint(); });
+	cbs.add("--pass-counters", [&](CLIParser &parser) { args.pass_counters = parser.next_string(); });
+	cbs.add("--gpus", [&](CLIParser &parser) { args.gpus = parser.next_uint(); });
+	cbs.add("--frame-offset", [&](CLIParser &parser) { args.frame_offset = parser.next_uint(); });
+	cbs.add("--frame-stride", [&](CLIParser &parser) { args.frame_stride = parser.next_uint(); });
+	cbs.add("--telemetry", [&](CLIParser &parser) { args.telemetry_port = parser.next_uint(); });
 	cbs.add("--help", [](CLIParser &parser)
 	{
 		print_help();
@@ -551,8 +979,32 @@ int application_main_headless(Application *(*create_application)(int, char **),
 	cbs.error_handler = [&]() { print_help(); };
 	int exit_code;
 
+	// Parsing filters argv, keep the original arguments around for farm workers.
+	vector<string> original_args(argv, argv + argc);
+
 	if (!Util::parse_cli_filtered(std::move(cbs), argc, argv, exit_code))
 		return exit_code;
+	exit_code = 0;
+
+	if (args.gpus != 1)
+	{
+		if (!args.video_encode_path.empty())
+		{
+			LOGE("Video encode is not supported when rendering on multiple GPUs.\n");
+			return 1;
+		}
+		return run_render_farm(original_args, args.gpus);
+	}
+
+	if (args.frame_stride == 0)
+		args.frame_stride = 1;
+
+	FrameDumpFormat frame_format;
+	if (!parse_frame_dump_format(args.frame_format, frame_format))
+	{
+		LOGE("Unknown frame format \"%s\".\n", args.frame_format.c_str());
+		return 1;
+	}
 
 	Granite::Global::init(Granite::Global::MANAGER_FEATURE_DEFAULT_BITS);
 
@@ -577,19 +1029,40 @@ int application_main_headless(Application *(*create_application)(int, char **),
 			return 1;
 
 		if (!args.png_path.empty())
-			p->enable_png_readback(args.png_path);
+		{
+			// Enough frames to keep every worker busy, without holding an unbounded number of frames in memory.
+			unsigned encode_queue = args.frame_encode_queue;
+			if (!encode_queue)
+				encode_queue = 2 * std::max(GRANITE_THREAD_GROUP()->get_num_threads(), 1u);
+			p->enable_png_readback(args.png_path, frame_format, encode_queue);
+		}
 		if (!args.video_encode_path.empty())
 			p->enable_video_encode(args.video_encode_path);
+		if (!args.image_reference.empty())
+			p->enable_image_reference(args.image_reference);
 		p->set_max_frames(args.max_frames);
 		p->set_time_step(args.time_step);
+		p->set_frame_distribution(args.frame_offset, args.frame_stride);
 		p->init_headless(app.get());
 
+		bool pass_counters = false;
+		if (!args.pass_counters.empty())
+		{
+			auto &device = app->get_wsi().get_device();
+			if (device.acquire_profiling())
+			{
+				pass_counters = device.init_performance_region_counters(Util::split_no_empty(args.pass_counters, ","));
+				if (!pass_counters)
+					device.release_profiling();
+			}
+		}
+
 #ifdef HAVE_GRANITE_AUDIO
 		Global::start_audio_system();
 #endif
 
-		// Run warm-up frame.
-		if (app->poll())
+		// Run warm-up frames, so that pipeline compilation and streaming don't end up in the stats.
+		for (unsigned i = 0; i < args.warmup_frames && app->poll(); i++)
 		{
 			p->begin_frame();
 			app->run_frame();
@@ -599,21 +1072,165 @@ int application_main_headless(Application *(*create_application)(int, char **),
 		p->wait_threads();
 		app->get_wsi().get_device().wait_idle();
 		app->get_wsi().get_device().timestamp_log_reset();
+		app->get_wsi().get_device().performance_region_log_reset();
+
+		auto &device = app->get_wsi().get_device();
+
+		if (args.replay_iterations)
+		{
+			if (!run_frame_replay(*p, *app, args.replay_iterations, args.stat))
+				exit_code = 1;
+
+			p->wait_threads();
+			app->wait_for_pipelined_simulation();
+			if (pass_counters)
+				device.release_profiling();
+#ifdef HAVE_GRANITE_AUDIO
+			Global::stop_audio_system();
+#endif
+			app.reset();
+			Granite::Global::deinit();
+			return exit_code;
+		}
+
+#ifdef HAVE_GRANITE_NETWORK
+		unique_ptr<TelemetryServer> telemetry;
+		if (args.telemetry_port)
+		{
+			try
+			{
+				telemetry = make_unique<TelemetryServer>(app->get_wsi().get_context().get_gpu_props().deviceName,
+				                                         uint16_t(args.telemetry_port));
+				LOGI("Serving telemetry on port %u.\n", args.telemetry_port);
+			}
+			catch (const std::exception &e)
+			{
+				LOGE("Failed to start telemetry server: %s\n", e.what());
+			}
+		}
+
+		if (telemetry)
+			GRANITE_THREAD_GROUP()->set_task_statistics_enabled(true);
+		std::vector<TaskStatistics> task_stats;
+		std::vector<TelemetryTaskStats> telemetry_tasks;
+		double last_gpu_time = 0.0;
+#else
+		if (args.telemetry_port)
+			LOGW("Telemetry is not supported in this build.\n");
+#endif
 
 		LOGI("=== Begin run ===\n");
 
+		bool collect_stats = !args.stat.empty() || !args.stat_reference.empty();
+
+		// Frame time is the interval between frames, which includes waiting for the GPU once we are GPU bound.
+		// CPU time only covers recording and submitting the frame.
+		vector<double> frame_times, cpu_times, submissions;
+		VkDeviceSize peak_device_usage = 0;
+		VkDeviceSize peak_tracked_usage = 0;
+
 		auto start_time = get_current_time_nsecs();
+		auto last_time = start_time;
 		unsigned rendered_frames = 0;
 		while (app->poll())
 		{
+			auto submission_count = device.get_queue_submission_count();
+			auto frame_start_time = get_current_time_nsecs();
 			p->begin_frame();
 			app->run_frame();
 			p->end_frame();
+			auto frame_end_time = get_current_time_nsecs();
+
 			if (!args.video_encode_path.empty() || !args.png_path.empty())
 			{
 				LOGI("   Queued frame %u (Total time = %.3f ms).\n", rendered_frames,
-				     1e-6 * double(get_current_time_nsecs() - start_time));
+				     1e-6 * double(frame_end_time - start_time));
+			}
+
+			if (collect_stats)
+			{
+				frame_times.push_back(1e-3 * double(frame_end_time - last_time));
+				cpu_times.push_back(1e-3 * double(frame_end_time - frame_start_time));
+				submissions.push_back(double(device.get_queue_submission_count() - submission_count));
+
+				HeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+				device.get_memory_budget(budgets);
+				VkDeviceSize device_usage = 0;
+				VkDeviceSize tracked_usage = 0;
+				for (uint32_t i = 0; i < device.get_memory_properties().memoryHeapCount; i++)
+				{
+					device_usage += budgets[i].device_usage;
+					tracked_usage += budgets[i].tracked_usage;
+				}
+				peak_device_usage = std::max(peak_device_usage, device_usage);
+				peak_tracked_usage = std::max(peak_tracked_usage, tracked_usage);
+			}
+
+#ifdef HAVE_GRANITE_NETWORK
+			// GPU time and task statistics are deltas, so sample them even while nobody is watching.
+			float gpu_time_ms = 0.0f;
+			if (telemetry)
+			{
+				double gpu_time = 0.0;
+				device.timestamp_log([&](const std::string &, const TimestampIntervalReport &report) {
+					if (report.device_timebase)
+						gpu_time += report.total_time;
+				});
+				gpu_time_ms = float(1e3 * (gpu_time - last_gpu_time));
+				last_gpu_time = gpu_time;
+				GRANITE_THREAD_GROUP()->get_task_statistics(task_stats, true);
+			}
+
+			if (telemetry && telemetry->has_clients())
+			{
+				TelemetryFrameStats stats = {};
+				stats.frame_index = rendered_frames;
+				stats.timestamp_ns = frame_end_time;
+				stats.frame_time_ms = float(1e-6 * double(frame_end_time - last_time));
+				stats.cpu_time_ms = float(1e-6 * double(frame_end_time - frame_start_time));
+				stats.submissions = uint32_t(device.get_queue_submission_count() - submission_count);
+
+				HeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+				device.get_memory_budget(budgets);
+				for (uint32_t i = 0; i < device.get_memory_properties().memoryHeapCount; i++)
+				{
+					stats.device_memory_usage += budgets[i].device_usage;
+					stats.device_memory_budget += budgets[i].budget_size;
+				}
+				stats.gpu_time_ms = gpu_time_ms;
+				telemetry->push_frame(stats);
+
+				AllocationTagStats tag_stats[ecast(AllocationTag::Count)];
+				TelemetryMemoryTagStats telemetry_tags[ecast(AllocationTag::Count)] = {};
+				device.get_allocation_tag_stats(tag_stats);
+				for (unsigned i = 0; i < ecast(AllocationTag::Count); i++)
+				{
+					auto &tag = telemetry_tags[i];
+					strncpy(tag.tag, allocation_tag_to_string(AllocationTag(i)), sizeof(tag.tag) - 1);
+					tag.live_count = tag_stats[i].live_count;
+					tag.peak_count = tag_stats[i].peak_count;
+					tag.live_size = tag_stats[i].live_size;
+					tag.peak_size = tag_stats[i].peak_size;
+				}
+				telemetry->push_memory_tags(telemetry_tags, ecast(AllocationTag::Count));
+
+				telemetry_tasks.clear();
+				for (auto &task : task_stats)
+				{
+					TelemetryTaskStats t = {};
+					strncpy(t.desc, task.desc.c_str(), sizeof(t.desc) - 1);
+					t.count = uint32_t(task.count);
+					t.p50_us = uint32_t(task.p50_ns / 1000);
+					t.p99_us = uint32_t(task.p99_ns / 1000);
+					t.max_us = uint32_t(task.max_ns / 1000);
+					t.total_ns = task.total_ns;
+					telemetry_tasks.push_back(t);
+				}
+				telemetry->push_tasks(telemetry_tasks.data(), uint32_t(telemetry_tasks.size()));
 			}
+#endif
+
+			last_time = frame_end_time;
 			rendered_frames++;
 		}
 
@@ -634,21 +1251,78 @@ int application_main_headless(Application *(*create_application)(int, char **),
 		});
 		app->get_wsi().get_device().timestamp_log_reset();
 
+		struct CounterReport
+		{
+			std::string region;
+			std::string counter;
+			double average;
+		};
+		std::vector<CounterReport> counter_reports;
+		if (pass_counters)
+		{
+			app->get_wsi().get_device().performance_region_log([&](const std::string &region, const PerformanceCounterReport &report) {
+				counter_reports.push_back({ region, report.desc->name, report.average });
+			});
+			app->get_wsi().get_device().performance_region_log();
+		}
+
 		if (rendered_frames)
 		{
 			double usec = 1e-3 * double(end_time - start_time) / rendered_frames;
 			LOGI("Average frame time: %.3f usec\n", usec);
 
-			if (!args.stat.empty())
+			if (collect_stats)
 			{
 				Document doc;
 				doc.SetObject();
 				auto &allocator = doc.GetAllocator();
 
 				doc.AddMember("averageFrameTimeUs", usec, allocator);
+				doc.AddMember("frames", rendered_frames, allocator);
 				doc.AddMember("gpu", StringRef(app->get_wsi().get_context().get_gpu_props().deviceName), allocator);
 				doc.AddMember("driverVersion", app->get_wsi().get_context().get_gpu_props().driverVersion, allocator);
 
+				auto frame_time_obj = build_percentiles(frame_times, allocator);
+				LOGI("Frame time: p50 %.3f usec, p95 %.3f usec, p99 %.3f usec, max %.3f usec\n",
+				     frame_time_obj["p50"].GetDouble(), frame_time_obj["p95"].GetDouble(),
+				     frame_time_obj["p99"].GetDouble(), frame_time_obj["max"].GetDouble());
+				doc.AddMember("frameTimeUs", frame_time_obj, allocator);
+				doc.AddMember("cpuFrameTimeUs", build_percentiles(cpu_times, allocator), allocator);
+				doc.AddMember("queueSubmissionsPerFrame", build_percentiles(submissions, allocator), allocator);
+
+				Value memory_obj(kObjectType);
+				memory_obj.AddMember("peakDeviceUsageMiB", double(peak_device_usage) / double(1024 * 1024), allocator);
+				memory_obj.AddMember("peakTrackedUsageMiB", double(peak_tracked_usage) / double(1024 * 1024), allocator);
+
+				// Live is what is still allocated at the end of the run, peak is over the whole run.
+				AllocationTagStats tag_stats[ecast(AllocationTag::Count)];
+				device.get_allocation_tag_stats(tag_stats);
+				Value tag_objs(kObjectType);
+				for (unsigned i = 0; i < ecast(AllocationTag::Count); i++)
+				{
+					auto &tag = tag_stats[i];
+					Value tag_obj(kObjectType);
+					tag_obj.AddMember("liveMiB", double(tag.live_size) / double(1024 * 1024), allocator);
+					tag_obj.AddMember("peakMiB", double(tag.peak_size) / double(1024 * 1024), allocator);
+					tag_obj.AddMember("liveCount", tag.live_count, allocator);
+					tag_obj.AddMember("peakCount", tag.peak_count, allocator);
+					tag_objs.AddMember(StringRef(allocation_tag_to_string(AllocationTag(i))), tag_obj, allocator);
+				}
+				memory_obj.AddMember("tags", tag_objs, allocator);
+				doc.AddMember("memory", memory_obj, allocator);
+
+				auto startup_phases = Util::get_startup_phases();
+				if (!startup_phases.empty())
+				{
+					Value startup_obj(kObjectType);
+					for (auto &phase : startup_phases)
+					{
+						startup_obj.AddMember(Value(phase.name.c_str(), allocator),
+						                      1e-3 * double(phase.end_ns - phase.start_ns), allocator);
+					}
+					doc.AddMember("startupUs", startup_obj, allocator);
+				}
+
 				if (!reports.empty())
 				{
 					Value report_objs(kObjectType);
@@ -663,12 +1337,33 @@ int application_main_headless(Application *(*create_application)(int, char **),
 					doc.AddMember("performance", report_objs, allocator);
 				}
 
-				StringBuffer buffer;
-				PrettyWriter<StringBuffer> writer(buffer);
-				doc.Accept(writer);
+				if (!counter_reports.empty())
+				{
+					Value region_objs(kObjectType);
+					for (auto &rep : counter_reports)
+					{
+						if (!region_objs.HasMember(rep.region.c_str()))
+							region_objs.AddMember(StringRef(rep.region), Value(kObjectType), allocator);
+						region_objs[rep.region.c_str()].AddMember(StringRef(rep.counter), rep.average, allocator);
+					}
+					doc.AddMember("passCounters", region_objs, allocator);
+				}
 
-				if (!GRANITE_FILESYSTEM()->write_string_to_file(args.stat, buffer.GetString()))
-					LOGE("Failed to write stat file to disk.\n");
+				if (!args.stat.empty())
+				{
+					StringBuffer buffer;
+					PrettyWriter<StringBuffer> writer(buffer);
+					doc.Accept(writer);
+
+					if (!GRANITE_FILESYSTEM()->write_string_to_file(args.stat, buffer.GetString()))
+						LOGE("Failed to write stat file to disk.\n");
+				}
+
+				if (!args.stat_reference.empty() &&
+				    !compare_stats(doc, args.stat_reference, 0.01 * args.stat_threshold))
+				{
+					exit_code = 2;
+				}
 			}
 		}
 
@@ -680,7 +1375,20 @@ int application_main_headless(Application *(*create_application)(int, char **),
 			p->end_frame();
 		}
 
+		if (!args.image_reference.empty())
+		{
+			p->compare_next_frame();
+			p->begin_frame();
+			app->run_frame();
+			p->end_frame();
+			if (!p->resolve_compare(args.image_reference_threshold))
+				exit_code = 3;
+		}
+
 		p->wait_threads();
+		app->wait_for_pipelined_simulation();
+		if (pass_counters)
+			app->get_wsi().get_device().release_profiling();
 
 #ifdef HAVE_GRANITE_AUDIO
 		Global::stop_audio_system();
@@ -688,7 +1396,7 @@ int application_main_headless(Application *(*create_application)(int, char **),
 
 		app.reset();
 		Granite::Global::deinit();
-		return 0;
+		return exit_code;
 	}
 	else
 		return 1;
@@ -29,6 +29,7 @@
 #include "application_wsi.hpp"
 #include "vulkan_headers.hpp"
 #include "global_managers_init.hpp"
+#include "timer.hpp"
 #include <string.h>
 
 #ifndef _WIN32
@@ -125,12 +126,17 @@ public:
 #endif
 
 #ifdef HAVE_LINUX_INPUT
-		if (!input_manager.init(
+		LinuxInputManagerFlags input_flags =
 				LINUX_INPUT_MANAGER_JOYPAD_BIT |
 				LINUX_INPUT_MANAGER_KEYBOARD_BIT |
 				LINUX_INPUT_MANAGER_MOUSE_BIT |
-				LINUX_INPUT_MANAGER_TOUCHPAD_BIT,
-				&get_input_tracker()))
+				LINUX_INPUT_MANAGER_TOUCHPAD_BIT;
+
+		const char *input_thread = getenv("GRANITE_INPUT_THREAD");
+		if (input_thread && strtoul(input_thread, nullptr, 0) != 0)
+			input_flags |= LINUX_INPUT_MANAGER_THREADED_BIT;
+
+		if (!input_manager.init(input_flags, &get_input_tracker()))
 		{
 			LOGI("Failed to initialize input manager.\n");
 		}
@@ -231,6 +237,11 @@ public:
 			if (best_mode == VK_NULL_HANDLE)
 				continue;
 
+			vblank_display = display;
+			for (auto &mode : modes)
+				if (mode.displayMode == best_mode)
+					refresh_rate_mhz = mode.parameters.refreshRate;
+
 			for (unsigned i = 0; i < plane_count; i++)
 			{
 				uint32_t supported_count = 0;
@@ -313,6 +324,42 @@ out:
 		return surface;
 	}
 
+	void event_device_created(Device *device_) override
+	{
+		GraniteWSIPlatform::event_device_created(device_);
+		device = device_;
+	}
+
+	void event_device_destroyed() override
+	{
+		GraniteWSIPlatform::event_device_destroyed();
+		device = nullptr;
+	}
+
+	// There is no compositor in the way, so the first pixel out event is the real vblank.
+	bool wait_vblank(uint64_t &timestamp, uint64_t &refresh_interval) override
+	{
+		if (!device || !device->get_device_features().supports_display_control ||
+		    vblank_display == VK_NULL_HANDLE || !refresh_rate_mhz)
+		{
+			return false;
+		}
+
+		auto &table = device->get_device_table();
+		VkDisplayEventInfoEXT event_info = { VK_STRUCTURE_TYPE_DISPLAY_EVENT_INFO_EXT };
+		event_info.displayEvent = VK_DISPLAY_EVENT_TYPE_FIRST_PIXEL_OUT_EXT;
+		VkFence fence = VK_NULL_HANDLE;
+		if (table.vkRegisterDisplayEventEXT(device->get_device(), vblank_display, &event_info, nullptr, &fence) != VK_SUCCESS)
+			return false;
+
+		VkResult result = table.vkWaitForFences(device->get_device(), 1, &fence, VK_TRUE, 100 * 1000 * 1000);
+		timestamp = Util::get_current_time_nsecs();
+		table.vkDestroyFence(device->get_device(), fence, nullptr);
+
+		refresh_interval = 1000000000000ull / refresh_rate_mhz;
+		return result == VK_SUCCESS;
+	}
+
 	uint32_t get_surface_width() override
 	{
 		return width;
@@ -343,6 +390,10 @@ private:
 #endif
 	bool is_alive = true;
 
+	Device *device = nullptr;
+	VkDisplayKHR vblank_display = VK_NULL_HANDLE;
+	uint32_t refresh_rate_mhz = 0;
+
 #ifdef HAVE_LINUX_INPUT
 	LinuxInputManager input_manager;
 #endif
@@ -371,10 +422,26 @@ int application_main(Application *(*create_application)(int, char **), int argc,
 		if (!app->init_wsi(move(platform)))
 			return 1;
 
+		// Starts frames just in time for vblank, with at most one frame queued up ahead of the display.
+		const char *low_latency = getenv("GRANITE_KHR_DISPLAY_LOW_LATENCY");
+		if (low_latency && strtoul(low_latency, nullptr, 0) != 0)
+		{
+			auto &wsi = app->get_wsi();
+			wsi.set_present_mode(PresentMode::UnlockedNoTearing);
+			wsi.set_low_latency_mode(true);
+
+			unsigned frame_latency = 1;
+			if (const char *env = getenv("GRANITE_KHR_DISPLAY_FRAME_LATENCY"))
+				frame_latency = unsigned(strtoul(env, nullptr, 0));
+			wsi.set_present_frame_latency(frame_latency);
+			LOGI("KHR_display low latency mode, frame latency %u.\n", wsi.get_present_frame_latency());
+		}
+
 		Granite::Global::start_audio_system();
 		while (app->poll())
 			app->run_frame();
 		Granite::Global::stop_audio_system();
+		app->wait_for_pipelined_simulation();
 		app.reset();
 		Granite::Global::deinit();
 		return 0;
@@ -395,6 +395,8 @@ RETRO_API bool retro_load_game_special(unsigned, const struct retro_game_info *,
 
 RETRO_API void retro_unload_game(void)
 {
+	if (app)
+		app->wait_for_pipelined_simulation();
 	libretro_unload_game();
 	delete app;
 	app = nullptr;
@@ -25,6 +25,7 @@
 #include "application_events.hpp"
 #include "thread_group.hpp"
 #include "context.hpp"
+#include <algorithm>
 
 namespace Granite
 {
@@ -32,17 +33,30 @@ retro_log_printf_t libretro_log;
 static retro_hw_render_interface_vulkan *vulkan_interface;
 static retro_hw_render_context_negotiation_interface_vulkan vulkan_negotiation;
 static std::unique_ptr<Vulkan::Context> vulkan_context;
-static Vulkan::ImageViewHandle swapchain_unorm_view;
-static Vulkan::ImageHandle swapchain_image;
-static retro_vulkan_image swapchain_image_info;
 static bool can_dupe = false;
 static std::string application_name;
 static unsigned application_version;
 
+// The frontend samples our images directly. With more than one, frame N + 1 is rendered
+// while the frontend still composites frame N.
+static constexpr unsigned MaxSwapchainImages = 3;
+struct SwapchainImage
+{
+	Vulkan::ImageHandle image;
+	Vulkan::ImageViewHandle unorm_view;
+	retro_vulkan_image info;
+	// Signalled by the frontend once it is done with the image. A later signal implies the earlier ones.
+	Vulkan::Semaphore frontend_release;
+	// The frontend waits on this before sampling. Kept until the image is rendered to again.
+	Vulkan::Semaphore frontend_acquire;
+};
+static SwapchainImage swapchain_images[MaxSwapchainImages];
+static unsigned num_swapchain_images;
+
 static unsigned swapchain_width;
 static unsigned swapchain_height;
 static unsigned swapchain_frame_index;
-static Vulkan::Semaphore acquire_semaphore;
+static unsigned presented_frame_index;
 
 static VkApplicationInfo vulkan_app = {
 	VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -107,64 +121,90 @@ void libretro_begin_frame(Vulkan::WSI &wsi, retro_usec_t frame_time)
 {
 	// Setup the external frame.
 	vulkan_interface->wait_sync_index(vulkan_interface->handle);
-	wsi.set_external_frame(swapchain_frame_index, acquire_semaphore, frame_time * 1e-6);
-	acquire_semaphore.reset();
 
-	swapchain_frame_index ^= 1;
+	// Keep our reference, if nothing is rendered this frame, the semaphore is not waited on
+	// and still guards the image next time.
+	auto &image = swapchain_images[swapchain_frame_index];
+	wsi.set_external_frame(swapchain_frame_index, image.frontend_release, frame_time * 1e-6);
+}
+
+static void clear_swapchain_image(Vulkan::Device &device, const Vulkan::Image &image)
+{
+	auto cmd = device.request_command_buffer();
+	cmd->image_barrier(image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                   VK_ACCESS_TRANSFER_WRITE_BIT);
+	cmd->clear_image(image, {});
+	cmd->image_barrier(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	device.submit(cmd);
 }
 
 void libretro_end_frame(retro_video_refresh_t video_cb, Vulkan::WSI &wsi)
 {
+	auto &device = wsi.get_device();
+	auto &current = swapchain_images[swapchain_frame_index];
+
+	// A submission waited on it, so the handle is gone.
+	if (current.frontend_release && current.frontend_release->get_semaphore() == VK_NULL_HANDLE)
+		current.frontend_release.reset();
+
 	// Present to libretro frontend.
-	auto signal_semaphore = wsi.get_device().request_legacy_semaphore();
+	auto signal_semaphore = device.request_legacy_semaphore();
 	vulkan_interface->set_signal_semaphore(vulkan_interface->handle,
 	                                       signal_semaphore->get_semaphore());
 	signal_semaphore->signal_external();
 
-	acquire_semaphore = wsi.consume_external_release_semaphore();
-	if (acquire_semaphore && acquire_semaphore->get_semaphore() != VK_NULL_HANDLE)
+	auto release_semaphore = wsi.consume_external_release_semaphore();
+	bool rendered = release_semaphore && release_semaphore->get_semaphore() != VK_NULL_HANDLE;
+
+	if (rendered || !can_dupe)
 	{
-		vulkan_interface->set_image(vulkan_interface->handle,
-		                            &swapchain_image_info,
-		                            1, &acquire_semaphore->get_semaphore(),
-		                            VK_QUEUE_FAMILY_IGNORED);
+		if (rendered)
+		{
+			vulkan_interface->set_image(vulkan_interface->handle,
+			                            &current.info,
+			                            1, &release_semaphore->get_semaphore(),
+			                            VK_QUEUE_FAMILY_IGNORED);
+		}
+		else
+		{
+			// Need something to show ... Just clear the image to black and present that.
+			// This should only happen if we don't render to swapchain the very first frame,
+			// so performance doesn't really matter.
+			clear_swapchain_image(device, *current.image);
+			vulkan_interface->set_image(vulkan_interface->handle,
+			                            &current.info,
+			                            0, nullptr,
+			                            VK_QUEUE_FAMILY_IGNORED);
+		}
 
 		video_cb(RETRO_HW_FRAME_BUFFER_VALID, swapchain_width, swapchain_height, 0);
 		can_dupe = true;
+
+		// The frontend consumed the previous acquire before it signalled the release we just waited on,
+		// so it can be recycled rather than destroyed.
+		if (current.frontend_acquire)
+			current.frontend_acquire->wait_external();
+		current.frontend_acquire = std::move(release_semaphore);
+		current.frontend_release = std::move(signal_semaphore);
+
+		presented_frame_index = swapchain_frame_index;
+		swapchain_frame_index = (swapchain_frame_index + 1) % num_swapchain_images;
 	}
 	else
 	{
+		// The frontend shows the last image again, which it has to be done with before we render to it.
+		auto &presented = swapchain_images[presented_frame_index];
 		vulkan_interface->set_image(vulkan_interface->handle,
-		                            &swapchain_image_info,
+		                            &presented.info,
 		                            0, nullptr,
 		                            VK_QUEUE_FAMILY_IGNORED);
-
-		if (!can_dupe)
-		{
-			// Need something to show ... Just clear the image to black and present that.
-			// This should only happen if we don't render to swapchain the very first frame,
-			// so performance doesn't really matter.
-			auto &device = wsi.get_device();
-			auto cmd = device.request_command_buffer();
-			cmd->image_barrier(*swapchain_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT,
-			                   VK_ACCESS_TRANSFER_WRITE_BIT);
-			cmd->clear_image(*swapchain_image, {});
-			cmd->image_barrier(*swapchain_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
-			                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
-			device.submit(cmd);
-			video_cb(RETRO_HW_FRAME_BUFFER_VALID, swapchain_width, swapchain_height, 0);
-			can_dupe = true;
-		}
-		else
-		{
-			video_cb(nullptr, swapchain_width, swapchain_height, 0);
-		}
+		video_cb(nullptr, swapchain_width, swapchain_height, 0);
+		presented.frontend_release = std::move(signal_semaphore);
 	}
-
-	acquire_semaphore = signal_semaphore;
 }
 
 bool libretro_context_reset(retro_hw_render_interface_vulkan *vulkan, Vulkan::WSI &wsi)
@@ -186,7 +226,11 @@ bool libretro_context_reset(retro_hw_render_interface_vulkan *vulkan, Vulkan::WS
 		                                vulkan->unlock_queue(vulkan->handle);
 	                                });
 
-	const unsigned num_swapchain_images = 2;
+	// One image per frontend sync index, the frontend has that many frames in flight.
+	num_swapchain_images = 0;
+	for (uint32_t mask = vulkan->get_sync_index_mask(vulkan->handle); mask; mask &= mask - 1)
+		num_swapchain_images++;
+	num_swapchain_images = std::max(2u, std::min(num_swapchain_images, MaxSwapchainImages));
 
 	Vulkan::ImageCreateInfo info = Vulkan::ImageCreateInfo::render_target(swapchain_width, swapchain_height,
 	                                                                      VK_FORMAT_R8G8B8A8_SRGB);
@@ -194,46 +238,52 @@ bool libretro_context_reset(retro_hw_render_interface_vulkan *vulkan, Vulkan::WS
 	info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
 	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-	swapchain_image = wsi.get_device().create_image(info, nullptr);
-	swapchain_image->set_swapchain_layout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	can_dupe = false;
-
-	Vulkan::ImageViewCreateInfo view_info;
-	view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
-	view_info.image = swapchain_image.get();
-	swapchain_unorm_view = wsi.get_device().create_image_view(view_info);
-
 	std::vector<Vulkan::ImageHandle> images;
 	for (unsigned i = 0; i < num_swapchain_images; i++)
-		images.push_back(swapchain_image);
+	{
+		auto &image = swapchain_images[i];
+		image = {};
+		image.image = wsi.get_device().create_image(info, nullptr);
+		image.image->set_swapchain_layout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		Vulkan::ImageViewCreateInfo view_info;
+		view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+		view_info.image = image.image.get();
+		image.unorm_view = wsi.get_device().create_image_view(view_info);
+
+		// Setup the swapchain image info for the frontend.
+		image.info.image_view = image.unorm_view->get_view();
+		image.info.image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		image.info.create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		image.info.create_info.image = image.image->get_image();
+		image.info.create_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+		image.info.create_info.components.r = VK_COMPONENT_SWIZZLE_R;
+		image.info.create_info.components.g = VK_COMPONENT_SWIZZLE_G;
+		image.info.create_info.components.b = VK_COMPONENT_SWIZZLE_B;
+		image.info.create_info.components.a = VK_COMPONENT_SWIZZLE_A;
+		image.info.create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		image.info.create_info.subresourceRange.levelCount = 1;
+		image.info.create_info.subresourceRange.layerCount = 1;
+		image.info.create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+
+		images.push_back(image.image);
+	}
+	can_dupe = false;
 
-	wsi.get_device().init_frame_contexts(2);
+	wsi.get_device().init_frame_contexts(num_swapchain_images);
 	if (!wsi.init_external_swapchain(std::move(images)))
 		return false;
 
-	// Setup the swapchain image info for the frontend.
-	swapchain_image_info.image_view = swapchain_unorm_view->get_view();
-	swapchain_image_info.image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	swapchain_image_info.create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	swapchain_image_info.create_info.image = swapchain_unorm_view->get_image().get_image();
-	swapchain_image_info.create_info.format = VK_FORMAT_R8G8B8A8_UNORM;
-	swapchain_image_info.create_info.components.r = VK_COMPONENT_SWIZZLE_R;
-	swapchain_image_info.create_info.components.g = VK_COMPONENT_SWIZZLE_G;
-	swapchain_image_info.create_info.components.b = VK_COMPONENT_SWIZZLE_B;
-	swapchain_image_info.create_info.components.a = VK_COMPONENT_SWIZZLE_A;
-	swapchain_image_info.create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	swapchain_image_info.create_info.subresourceRange.levelCount = 1;
-	swapchain_image_info.create_info.subresourceRange.layerCount = 1;
-	swapchain_image_info.create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	swapchain_frame_index = 0;
+	presented_frame_index = 0;
 	return true;
 }
 
 void libretro_context_destroy(Vulkan::WSI *wsi)
 {
-	swapchain_unorm_view.reset();
-	swapchain_image.reset();
-	acquire_semaphore.reset();
+	for (auto &image : swapchain_images)
+		image = {};
+	num_swapchain_images = 0;
 
 	if (wsi)
 		wsi->deinit_external();
@@ -0,0 +1,300 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frame_dump.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include "stb_image_write.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace Granite
+{
+bool parse_frame_dump_format(const std::string &str, FrameDumpFormat &format)
+{
+	if (str == "png")
+		format = FrameDumpFormat::PNG;
+	else if (str == "png-fast")
+		format = FrameDumpFormat::PNGFast;
+	else if (str == "qoi")
+		format = FrameDumpFormat::QOI;
+	else if (str == "ppm")
+		format = FrameDumpFormat::PPM;
+	else
+		return false;
+
+	return true;
+}
+
+const char *get_frame_dump_extension(FrameDumpFormat format)
+{
+	switch (format)
+	{
+	case FrameDumpFormat::QOI:
+		return "qoi";
+	case FrameDumpFormat::PPM:
+		return "ppm";
+	default:
+		return "png";
+	}
+}
+
+static void append_data(void *context, void *data, int size)
+{
+	auto *encoded = static_cast<std::vector<uint8_t> *>(context);
+	auto *bytes = static_cast<const uint8_t *>(data);
+	encoded->insert(encoded->end(), bytes, bytes + size);
+}
+
+static void write_be32(std::vector<uint8_t> &out, uint32_t v)
+{
+	out.push_back(uint8_t(v >> 24));
+	out.push_back(uint8_t(v >> 16));
+	out.push_back(uint8_t(v >> 8));
+	out.push_back(uint8_t(v));
+}
+
+// Reference: https://qoiformat.org/qoi-specification.pdf
+static void encode_qoi(std::vector<uint8_t> &out, const uint32_t *pixels, unsigned width, unsigned height)
+{
+	size_t count = size_t(width) * height;
+	// Worst case is QOI_OP_RGBA for every pixel.
+	out.reserve(14 + count * 5 + 8);
+
+	out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+	write_be32(out, width);
+	write_be32(out, height);
+	out.push_back(4);
+	out.push_back(0);
+
+	uint32_t index[64] = {};
+	uint32_t prev = 0xff000000u;
+	unsigned run = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t px = pixels[i];
+		if (px == prev)
+		{
+			if (++run == 62 || i + 1 == count)
+			{
+				out.push_back(uint8_t(0xc0 | (run - 1)));
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run)
+		{
+			out.push_back(uint8_t(0xc0 | (run - 1)));
+			run = 0;
+		}
+
+		int r = int(px & 0xff), g = int((px >> 8) & 0xff), b = int((px >> 16) & 0xff), a = int(px >> 24);
+		unsigned hash = unsigned(r * 3 + g * 5 + b * 7 + a * 11) & 63;
+
+		if (index[hash] == px)
+		{
+			out.push_back(uint8_t(hash));
+		}
+		else
+		{
+			index[hash] = px;
+
+			if (a == int(prev >> 24))
+			{
+				// Differences wrap around, as in the reference encoder.
+				int vr = int8_t(uint8_t(r - int(prev & 0xff)));
+				int vg = int8_t(uint8_t(g - int((prev >> 8) & 0xff)));
+				int vb = int8_t(uint8_t(b - int((prev >> 16) & 0xff)));
+				int vg_r = vr - vg;
+				int vg_b = vb - vg;
+
+				if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1)
+				{
+					out.push_back(uint8_t(0x40 | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2)));
+				}
+				else if (vg_r >= -8 && vg_r <= 7 && vg >= -32 && vg <= 31 && vg_b >= -8 && vg_b <= 7)
+				{
+					out.push_back(uint8_t(0x80 | (vg + 32)));
+					out.push_back(uint8_t(((vg_r + 8) << 4) | (vg_b + 8)));
+				}
+				else
+				{
+					out.insert(out.end(), { 0xfe, uint8_t(r), uint8_t(g), uint8_t(b) });
+				}
+			}
+			else
+			{
+				out.insert(out.end(), { 0xff, uint8_t(r), uint8_t(g), uint8_t(b), uint8_t(a) });
+			}
+		}
+
+		prev = px;
+	}
+
+	out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+}
+
+static void encode_ppm(std::vector<uint8_t> &out, const uint32_t *pixels, unsigned width, unsigned height)
+{
+	char header[64];
+	int len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+	size_t count = size_t(width) * height;
+	out.resize(size_t(len) + count * 3);
+	memcpy(out.data(), header, size_t(len));
+
+	uint8_t *rgb = out.data() + len;
+	for (size_t i = 0; i < count; i++, rgb += 3)
+	{
+		rgb[0] = uint8_t(pixels[i]);
+		rgb[1] = uint8_t(pixels[i] >> 8);
+		rgb[2] = uint8_t(pixels[i] >> 16);
+	}
+}
+
+FrameDumper::FrameDumper(ThreadGroup *group_, FrameDumpFormat format_, unsigned max_in_flight_)
+	: group(group_), format(format_), max_in_flight(max_in_flight_ ? max_in_flight_ : 1)
+{
+	// Trying every filter per row and a strong deflate search is what makes stb slow.
+	if (format == FrameDumpFormat::PNGFast)
+	{
+		stbi_write_png_compression_level = 1;
+		stbi_write_force_png_filter = 4;
+	}
+}
+
+FrameDumper::~FrameDumper()
+{
+	wait();
+}
+
+std::vector<uint32_t> FrameDumper::acquire_buffer(size_t count)
+{
+	std::vector<uint32_t> buffer;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (!free_buffers.empty())
+		{
+			buffer = std::move(free_buffers.back());
+			free_buffers.pop_back();
+		}
+	}
+	buffer.resize(count);
+	return buffer;
+}
+
+void FrameDumper::push_frame(std::string path, unsigned width, unsigned height, std::vector<uint32_t> pixels)
+{
+	std::unique_ptr<Job> job(new Job);
+	job->path = std::move(path);
+	job->width = width;
+	job->height = height;
+	job->pixels = std::move(pixels);
+
+	{
+		std::unique_lock<std::mutex> holder{lock};
+		cond.wait(holder, [this]() { return in_flight < max_in_flight; });
+		in_flight++;
+		job->sequence = next_sequence++;
+	}
+
+	if (!group)
+	{
+		encode(*job);
+		complete(std::move(job));
+		return;
+	}
+
+	// std::function must be copyable.
+	auto *raw_job = job.release();
+	auto task = group->create_task([this, raw_job]() {
+		std::unique_ptr<Job> owned(raw_job);
+		encode(*owned);
+		complete(std::move(owned));
+	});
+	task->set_desc("headless-frame-encode");
+	task->set_priority(TaskPriority::Background);
+}
+
+void FrameDumper::encode(Job &job) const
+{
+	switch (format)
+	{
+	case FrameDumpFormat::PNG:
+	case FrameDumpFormat::PNGFast:
+		if (!stbi_write_png_to_func(append_data, &job.encoded, int(job.width), int(job.height), 4,
+		                            job.pixels.data(), int(job.width * 4)))
+			job.encoded.clear();
+		break;
+
+	case FrameDumpFormat::QOI:
+		encode_qoi(job.encoded, job.pixels.data(), job.width, job.height);
+		break;
+
+	case FrameDumpFormat::PPM:
+		encode_ppm(job.encoded, job.pixels.data(), job.width, job.height);
+		break;
+	}
+}
+
+void FrameDumper::complete(std::unique_ptr<Job> job)
+{
+	std::unique_lock<std::mutex> holder{lock};
+	ready[job->sequence] = std::move(job);
+
+	// Whoever completes the next frame in order writes it, and anything queued up behind it.
+	if (writing)
+		return;
+	writing = true;
+
+	while (!ready.empty() && ready.begin()->first == next_write)
+	{
+		auto next = std::move(ready.begin()->second);
+		ready.erase(ready.begin());
+		holder.unlock();
+
+		FILE *file = nullptr;
+		if (!next->encoded.empty())
+			file = fopen(next->path.c_str(), "wb");
+
+		if (!file || fwrite(next->encoded.data(), 1, next->encoded.size(), file) != next->encoded.size())
+			LOGE("Failed to write %s to disk.\n", next->path.c_str());
+		if (file)
+			fclose(file);
+
+		holder.lock();
+		next_write++;
+		free_buffers.push_back(std::move(next->pixels));
+		in_flight--;
+		cond.notify_all();
+	}
+
+	writing = false;
+}
+
+void FrameDumper::wait()
+{
+	std::unique_lock<std::mutex> holder{lock};
+	cond.wait(holder, [this]() { return in_flight == 0; });
+}
+}
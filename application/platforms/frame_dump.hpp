@@ -0,0 +1,94 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+namespace Granite
+{
+class ThreadGroup;
+
+enum class FrameDumpFormat
+{
+	PNG,
+	// Cheapest deflate settings in stb, files are somewhat larger.
+	PNGFast,
+	QOI,
+	// Binary PPM, no compression at all.
+	PPM
+};
+
+bool parse_frame_dump_format(const std::string &str, FrameDumpFormat &format);
+const char *get_frame_dump_extension(FrameDumpFormat format);
+
+// Encodes RGBA8 frames on the thread group so rendering never waits for compression.
+// Frames are encoded in parallel, but files are written in submission order.
+// At most max_in_flight frames are held in memory, push_frame() blocks beyond that.
+class FrameDumper
+{
+public:
+	FrameDumper(ThreadGroup *group, FrameDumpFormat format, unsigned max_in_flight);
+	~FrameDumper();
+
+	FrameDumper(const FrameDumper &) = delete;
+	void operator=(const FrameDumper &) = delete;
+
+	// Recycles pixel storage from frames which have been written.
+	std::vector<uint32_t> acquire_buffer(size_t count);
+	void push_frame(std::string path, unsigned width, unsigned height, std::vector<uint32_t> pixels);
+	void wait();
+
+private:
+	struct Job
+	{
+		uint64_t sequence;
+		std::string path;
+		unsigned width;
+		unsigned height;
+		std::vector<uint32_t> pixels;
+		std::vector<uint8_t> encoded;
+	};
+
+	ThreadGroup *group;
+	FrameDumpFormat format;
+	unsigned max_in_flight;
+
+	std::mutex lock;
+	std::condition_variable cond;
+	unsigned in_flight = 0;
+	uint64_t next_sequence = 0;
+	uint64_t next_write = 0;
+	bool writing = false;
+	std::map<uint64_t, std::unique_ptr<Job>> ready;
+	std::vector<std::vector<uint32_t>> free_buffers;
+
+	void encode(Job &job) const;
+	void complete(std::unique_ptr<Job> job);
+};
+}
@@ -30,7 +30,14 @@
 #include "thread_group.hpp"
 #include "utils/image_utils.hpp"
 #include "ocean.hpp"
+#include "gpu_scene.hpp"
+#include "impostor.hpp"
+#include "compute_skinning.hpp"
+#include "occlusion_culling.hpp"
+#include "static_shadow_geometry.hpp"
 #include <float.h>
+#include <algorithm>
+#include <unordered_set>
 #include <stdexcept>
 
 using namespace std;
@@ -195,6 +202,22 @@ void SceneViewerApplication::read_config(const std::string &path)
 	if (doc.HasMember("ssao"))
 		config.ssao = doc["ssao"].GetBool();
 
+	if (doc.HasMember("recordVariantUsage"))
+		config.record_variant_usage = doc["recordVariantUsage"].GetBool();
+
+	if (doc.HasMember("ssaoQuality"))
+	{
+		auto *quality = doc["ssaoQuality"].GetString();
+		if (strcmp(quality, "full") == 0)
+			config.ssao_tier = AmbientOcclusionTier::Full;
+		else if (strcmp(quality, "half") == 0)
+			config.ssao_tier = AmbientOcclusionTier::HalfTemporal;
+		else if (strcmp(quality, "quarter") == 0)
+			config.ssao_tier = AmbientOcclusionTier::QuarterTemporal;
+		else
+			throw invalid_argument("Invalid ssaoQuality option.");
+	}
+
 	if (doc.HasMember("debugProbes"))
 		config.debug_probes = doc["debugProbes"].GetBool();
 
@@ -207,6 +230,15 @@ void SceneViewerApplication::read_config(const std::string &path)
 	if (doc.HasMember("directionalLightShadowsVSM"))
 		config.directional_light_shadows_vsm = doc["directionalLightShadowsVSM"].GetBool();
 
+	if (doc.HasMember("directionalLightShadowsParallelCascades"))
+		config.directional_light_shadows_parallel_cascades = doc["directionalLightShadowsParallelCascades"].GetBool();
+
+	if (doc.HasMember("directionalLightShadowsFarCascadeInterval"))
+		config.directional_light_shadows_far_cascade_interval = doc["directionalLightShadowsFarCascadeInterval"].GetUint();
+
+	if (doc.HasMember("directionalLightShadowsVirtual"))
+		config.directional_light_shadows_virtual = doc["directionalLightShadowsVirtual"].GetBool();
+
 	if (doc.HasMember("PCFKernelWide"))
 	{
 		bool wide = doc["PCFKernelWide"].GetBool();
@@ -220,6 +252,24 @@ void SceneViewerApplication::read_config(const std::string &path)
 		config.clustered_lights = doc["clusteredLights"].GetBool();
 	if (doc.HasMember("clusteredLightsBindless"))
 		config.clustered_lights_bindless = doc["clusteredLightsBindless"].GetBool();
+	if (doc.HasMember("bindlessMaterials"))
+		config.bindless_materials = doc["bindlessMaterials"].GetBool();
+	if (doc.HasMember("meshletCulling"))
+		config.meshlet_culling = doc["meshletCulling"].GetBool();
+	if (doc.HasMember("lodPixelError"))
+		config.lod_pixel_error = doc["lodPixelError"].GetFloat();
+	if (doc.HasMember("impostorDistance"))
+		config.impostor_distance = doc["impostorDistance"].GetFloat();
+	if (doc.HasMember("computeSkinning"))
+		config.compute_skinning = doc["computeSkinning"].GetBool();
+	if (doc.HasMember("animationLOD"))
+		config.animation_lod = doc["animationLOD"].GetBool();
+	if (doc.HasMember("gpuDrivenOpaque"))
+		config.gpu_driven_opaque = doc["gpuDrivenOpaque"].GetBool();
+	if (doc.HasMember("occlusionCulling"))
+		config.occlusion_culling = doc["occlusionCulling"].GetBool();
+	if (doc.HasMember("staticShadowBake"))
+		config.static_shadow_bake = doc["staticShadowBake"].GetBool();
 	if (doc.HasMember("clusteredLightsShadows"))
 		config.clustered_lights_shadows = doc["clusteredLightsShadows"].GetBool();
 	if (doc.HasMember("clusteredLightsShadowsResolution"))
@@ -230,12 +280,18 @@ void SceneViewerApplication::read_config(const std::string &path)
 		config.hdr_bloom = doc["hdrBloom"].GetBool();
 	if (doc.HasMember("hdrBloomDynamicExposure"))
 		config.hdr_bloom_dynamic_exposure = doc["hdrBloomDynamicExposure"].GetBool();
+	if (doc.HasMember("hdrBloomSinglePass"))
+		config.hdr_bloom_single_pass = doc["hdrBloomSinglePass"].GetBool();
 	if (doc.HasMember("showUi"))
 		config.show_ui = doc["showUi"].GetBool();
 	if (doc.HasMember("forwardDepthPrepass"))
 		config.forward_depth_prepass = doc["forwardDepthPrepass"].GetBool();
+	if (doc.HasMember("orderIndependentTransparency"))
+		config.order_independent_transparency = doc["orderIndependentTransparency"].GetBool();
 	if (doc.HasMember("deferredClusteredStencilCulling"))
 		config.deferred_clustered_stencil_culling = doc["deferredClusteredStencilCulling"].GetBool();
+	if (doc.HasMember("deferredTiledLights"))
+		config.deferred_tiled_lights = doc["deferredTiledLights"].GetBool();
 
 	if (doc.HasMember("shadowMapResolution"))
 		config.shadow_map_resolution = doc["shadowMapResolution"].GetFloat();
@@ -257,13 +313,30 @@ void SceneViewerApplication::read_config(const std::string &path)
 	if (doc.HasMember("resolutionScaleSharpen"))
 		config.resolution_scale_sharpen = doc["resolutionScaleSharpen"].GetBool();
 
+	if (doc.HasMember("dynamicResolution"))
+		config.dynamic_resolution = doc["dynamicResolution"].GetBool();
+	if (doc.HasMember("dynamicResolutionTargetMs"))
+		config.dynamic_resolution_target_ms = doc["dynamicResolutionTargetMs"].GetFloat();
+	if (doc.HasMember("dynamicResolutionMinScale"))
+		config.dynamic_resolution_min_scale = doc["dynamicResolutionMinScale"].GetFloat();
+
 	if (doc.HasMember("lodBias"))
 		config.lod_bias = doc["lodBias"].GetFloat();
 
 	if (doc.HasMember("volumetricFog"))
 		config.volumetric_fog = doc["volumetricFog"].GetBool();
+	if (doc.HasMember("volumetricFogTemporalRate"))
+		config.volumetric_fog_temporal_rate = doc["volumetricFogTemporalRate"].GetUint();
 	if (doc.HasMember("volumetricDiffuse"))
 		config.volumetric_diffuse = doc["volumetricDiffuse"].GetBool();
+	if (doc.HasMember("volumetricDiffuseProbeBudget"))
+		config.volumetric_diffuse_probe_budget = doc["volumetricDiffuseProbeBudget"].GetUint();
+	if (doc.HasMember("volumetricDiffusePriorityDistance"))
+		config.volumetric_diffuse_priority_distance = doc["volumetricDiffusePriorityDistance"].GetFloat();
+	if (doc.HasMember("volumetricDiffuseSkyFacesPerFrame"))
+		config.volumetric_diffuse_sky_faces_per_frame = doc["volumetricDiffuseSkyFacesPerFrame"].GetUint();
+	if (doc.HasMember("volumetricDiffuseSkyBlendFrames"))
+		config.volumetric_diffuse_sky_blend_frames = doc["volumetricDiffuseSkyBlendFrames"].GetUint();
 }
 
 SceneViewerApplication::SceneViewerApplication(const std::string &path, const std::string &config_path,
@@ -271,15 +344,109 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 	: cli_config(cli_config_)
 {
 	renderer_suite.set_default_renderers();
-	if (!renderer_suite.load_variant_cache("assets://renderer_suite_variants.json"))
+	// A merged usage recording only warms the variants which were actually drawn.
+	if (!renderer_suite.load_variant_cache("assets://renderer_suite_variant_usage.json") &&
+	    !renderer_suite.load_variant_cache("assets://renderer_suite_variants.bin") &&
+	    !renderer_suite.load_variant_cache("cache://renderer_suite_variants.bin") &&
+	    !renderer_suite.load_variant_cache("assets://renderer_suite_variants.json"))
+	{
 		renderer_suite.load_variant_cache("cache://renderer_suite_variants.json");
+	}
 
 	if (!config_path.empty())
 		read_config(config_path);
 	if (!quirks_path.empty())
 		read_quirks(quirks_path);
-	renderer_suite_config.cascaded_directional_shadows = config.directional_light_cascaded_shadows;
+	if (config.record_variant_usage)
+		renderer_suite.set_variant_usage_recording(true);
+
+	// Reduced rate cascades need each cascade in its own render pass.
+	if (config.directional_light_shadows_far_cascade_interval > 1)
+		config.directional_light_shadows_parallel_cascades = true;
+	if (config.directional_light_shadows_far_cascade_interval == 0)
+		config.directional_light_shadows_far_cascade_interval = 1;
+	if (!config.directional_light_cascaded_shadows)
+		config.directional_light_shadows_parallel_cascades = false;
+
+	if (config.directional_light_shadows_parallel_cascades && config.directional_light_shadows_vsm)
+	{
+		LOGW("Parallel shadow cascades are not supported with VSM, falling back to multiview.\n");
+		config.directional_light_shadows_parallel_cascades = false;
+	}
+
+	// Temporal upscaling reconstructs the backbuffer resolution from 50-67% of it.
+	if (config.postaa_type == PostAAType::TAA_Upscale && config.resolution_scale >= 1.0f)
+		config.resolution_scale = 2.0f / 3.0f;
+
+	if (config.dynamic_resolution)
+	{
+		bool temporal = config.postaa_type == PostAAType::TAA_Low ||
+		                config.postaa_type == PostAAType::TAA_Medium ||
+		                config.postaa_type == PostAAType::TAA_High ||
+		                config.postaa_type == PostAAType::TAA_Upscale ||
+		                config.postaa_type == PostAAType::SMAA_Ultra_T2X ||
+		                config.postaa_type == PostAAType::FXAA_2Phase;
+
+		// The upscaler runs on the HDR target, and history or screen space inputs do not know about the render area.
+		if (!config.hdr_bloom || temporal)
+		{
+			LOGW("Dynamic resolution requires HDR bloom and a non-temporal post AA, disabling.\n");
+			config.dynamic_resolution = false;
+		}
+		else
+		{
+			if (config.ssao)
+				LOGW("SSAO is not supported with dynamic resolution, disabling.\n");
+			config.ssao = false;
+			if (config.directional_light_shadows_virtual)
+				LOGW("Virtual shadow maps are not supported with dynamic resolution, disabling.\n");
+			config.directional_light_shadows_virtual = false;
+
+			DynamicResolutionOptions opts;
+			opts.target_frame_time_ms = config.dynamic_resolution_target_ms;
+			opts.min_scale = config.dynamic_resolution_min_scale;
+			dynamic_resolution.set_options(opts);
+		}
+	}
+
+	if (config.order_independent_transparency && config.renderer_type == RendererType::GeneralForward && config.msaa > 1)
+	{
+		LOGW("Order independent transparency is not supported with MSAA, falling back to sorted transparency.\n");
+		config.order_independent_transparency = false;
+	}
+
+	if (config.directional_light_shadows_virtual && (config.directional_light_shadows_vsm || config.msaa > 1))
+	{
+		LOGW("Virtual shadow maps are not supported with VSM or MSAA, falling back to regular shadow maps.\n");
+		config.directional_light_shadows_virtual = false;
+	}
+
+	// The virtual shadow map covers the whole scene at once.
+	if (config.directional_light_shadows_virtual)
+	{
+		config.directional_light_cascaded_shadows = false;
+		config.directional_light_shadows_parallel_cascades = false;
+	}
+
+	// Parallel cascades render each layer with its own context, so the depth renderer must not use multiview.
+	renderer_suite_config.cascaded_directional_shadows = config.directional_light_cascaded_shadows &&
+	                                                     !config.directional_light_shadows_parallel_cascades;
 	renderer_suite_config.directional_light_vsm = config.directional_light_shadows_vsm;
+	renderer_suite_config.order_independent_transparency = config.order_independent_transparency;
+
+	// Replays what the previous load of this scene read, and records this load for the next one.
+	if (const char *env = getenv("GRANITE_ACCESS_TRACE"))
+	{
+		access_trace_frames = unsigned(strtoul(env, nullptr, 0));
+		if (access_trace_frames)
+		{
+			Util::Hasher h;
+			h.string(path);
+			auto trace_path = "cache://access_traces/" + std::to_string(h.get()) + ".trace";
+			GRANITE_FILESYSTEM()->prefetch_access_trace(trace_path);
+			GRANITE_FILESYSTEM()->begin_access_trace(trace_path);
+		}
+	}
 
 	scene_loader.load_scene(path);
 	read_lights();
@@ -301,6 +468,21 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 		//scene.get_root_node()->add_child(std::move(node));
 	}
 
+	if (config.gpu_driven_opaque)
+		GPUScene::add_to_scene(scene_loader.get_scene());
+
+	if (config.impostor_distance > 0.0f)
+		ImpostorManager::add_to_scene(scene_loader.get_scene());
+
+	if (config.compute_skinning)
+		ComputeSkinning::add_to_scene(scene_loader.get_scene());
+
+	if (config.occlusion_culling)
+		OcclusionCulling::add_to_scene(scene_loader.get_scene());
+
+	if (config.static_shadow_bake)
+		bake_static_shadow_geometry(scene_loader.get_scene());
+
 	if (false)
 	{
 		auto &scene = scene_loader.get_scene();
@@ -342,7 +524,17 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 
 	animation_system = scene_loader.consume_animation_system();
 	context.set_lighting_parameters(&lighting);
+	context.set_order_independent_transparency(config.order_independent_transparency);
 	fallback_depth_context.set_lighting_parameters(&fallback_lighting);
+	// Shadow contexts render back faces, so only cull against the frustum there.
+	if (config.meshlet_culling)
+	{
+		context.set_meshlet_culling(MESHLET_CULLING_FRUSTUM_BIT | MESHLET_CULLING_BACKFACE_BIT);
+		depth_context.set_meshlet_culling(MESHLET_CULLING_FRUSTUM_BIT);
+		fallback_depth_context.set_meshlet_culling(MESHLET_CULLING_FRUSTUM_BIT);
+		for (auto &cascade_context : cascade_depth_contexts)
+			cascade_context.set_meshlet_culling(MESHLET_CULLING_FRUSTUM_BIT);
+	}
 	cam.set_depth_range(0.1f, 1000.0f);
 
 	// Create a dummy background if there isn't any background.
@@ -426,6 +618,7 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 		volumetric_fog = make_unique<VolumetricFog>();
 		volumetric_fog->set_resolution(160, 92, 64);
 		volumetric_fog->set_z_range(80.0f);
+		volumetric_fog->set_temporal_update_rate(config.volumetric_fog_temporal_rate);
 		lighting.volumetric_fog = volumetric_fog.get();
 		auto entity = scene_loader.get_scene().create_entity();
 		auto *rp = entity->allocate_component<RenderPassComponent>();
@@ -466,6 +659,10 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 		update->refresh = volumetric_diffuse.get();
 
 		volumetric_diffuse->set_fallback_render_context(&fallback_depth_context);
+		volumetric_diffuse->set_probe_update_budget(config.volumetric_diffuse_probe_budget,
+		                                            config.volumetric_diffuse_priority_distance);
+		volumetric_diffuse->set_sky_update_budget(config.volumetric_diffuse_sky_faces_per_frame,
+		                                          config.volumetric_diffuse_sky_blend_frames);
 	}
 
 	if (cluster)
@@ -485,7 +682,8 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 
 	context.set_camera(*selected_camera);
 
-	graph.enable_timestamps(cli_config.timestamp);
+	// Dynamic resolution is driven by the pass timestamps.
+	graph.enable_timestamps(cli_config.timestamp || config.dynamic_resolution);
 
 	if (config.rescale_scene)
 		rescale_scene(10.0f);
@@ -494,6 +692,7 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 	                             SwapchainParameterEvent);
 	EVENT_MANAGER_REGISTER_LATCH(SceneViewerApplication, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 	EVENT_MANAGER_REGISTER(SceneViewerApplication, on_key_down, KeyboardEvent);
+	EVENT_MANAGER_REGISTER(SceneViewerApplication, on_thermal_state, ThermalStateEvent);
 }
 
 void SceneViewerApplication::export_lights()
@@ -512,9 +711,12 @@ void SceneViewerApplication::export_cameras()
 
 SceneViewerApplication::~SceneViewerApplication()
 {
+	wait_for_pipelined_simulation();
 	export_lights();
 	export_cameras();
-	renderer_suite.save_variant_cache("cache://renderer_suite_variants.json");
+	renderer_suite.save_variant_cache("cache://renderer_suite_variants.bin");
+	if (config.record_variant_usage)
+		renderer_suite.save_variant_usage("cache://renderer_suite_variant_usage.json");
 }
 
 void SceneViewerApplication::loop_animations()
@@ -545,11 +747,36 @@ void SceneViewerApplication::on_device_created(const DeviceCreatedEvent &device)
 	graph.set_device(&device.get_device());
 	context.set_device(&device.get_device());
 	fallback_depth_context.set_device(&device.get_device());
+	for (auto &cascade_context : cascade_depth_contexts)
+		cascade_context.set_device(&device.get_device());
+
+	if (config.bindless_materials && device.get_device().get_device_features().supports_descriptor_indexing)
+	{
+		material_heap = make_unique<MaterialHeap>();
+		context.set_material_heap(material_heap.get());
+		depth_context.set_material_heap(material_heap.get());
+		fallback_depth_context.set_material_heap(material_heap.get());
+		for (auto &cascade_context : cascade_depth_contexts)
+			cascade_context.set_material_heap(material_heap.get());
+	}
 }
 
 void SceneViewerApplication::on_device_destroyed(const DeviceCreatedEvent &)
 {
 	graph.set_device(nullptr);
+	context.set_material_heap(nullptr);
+	depth_context.set_material_heap(nullptr);
+	fallback_depth_context.set_material_heap(nullptr);
+	for (auto &cascade_context : cascade_depth_contexts)
+		cascade_context.set_material_heap(nullptr);
+	material_heap.reset();
+}
+
+bool SceneViewerApplication::on_thermal_state(const ThermalStateEvent &e)
+{
+	if (config.dynamic_resolution)
+		dynamic_resolution.set_thermal_headroom(e.get_headroom());
+	return true;
 }
 
 bool SceneViewerApplication::on_key_down(const KeyboardEvent &e)
@@ -657,6 +884,19 @@ bool SceneViewerApplication::on_key_down(const KeyboardEvent &e)
 		break;
 	}
 
+	case Key::G:
+	{
+		show_gpu_profiler = !show_gpu_profiler;
+		get_wsi().get_device().set_gpu_scopes_enabled(show_gpu_profiler || hud.enabled);
+		break;
+	}
+
+	case Key::H:
+	{
+		set_performance_hud_enabled(!hud.enabled);
+		break;
+	}
+
 	default:
 		break;
 	}
@@ -767,6 +1007,12 @@ void SceneViewerApplication::add_mv_pass(const std::string &tag, const std::stri
 	mv_pass.set_render_pass_interface(std::move(renderer));
 }
 
+void SceneViewerApplication::add_dynamic_render_area(RenderPass &pass)
+{
+	if (config.dynamic_resolution)
+		pass.set_get_render_area([this](VkRect2D *area) { return dynamic_resolution.get_render_area(area); });
+}
+
 void SceneViewerApplication::add_main_pass_forward(Device &device, const std::string &tag)
 {
 	AttachmentInfo color, depth;
@@ -783,6 +1029,7 @@ void SceneViewerApplication::add_main_pass_forward(Device &device, const std::st
 	{
 		auto &prepass_depth = graph.add_pass(tagcat("depth-transient", tag), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
 		prepass_depth.set_depth_stencil_output(tagcat("depth-transient", tag), depth);
+		add_dynamic_render_area(prepass_depth);
 		auto renderer = Util::make_handle<RenderPassSceneRenderer>();
 		RenderPassSceneRenderer::Setup setup = {};
 		setup.scene = &scene_loader.get_scene();
@@ -794,7 +1041,8 @@ void SceneViewerApplication::add_main_pass_forward(Device &device, const std::st
 		// TODO: Find a good way to let the prepass renderer share renderer with opaque / transparent passes.
 		prepass_depth.set_render_pass_interface(std::move(renderer));
 		scene_loader.get_scene().add_render_pass_dependencies(graph, prepass_depth, RenderPassCreator::GEOMETRY_BIT);
-		setup_ffx_cacao(graph, context, tagcat("ssao-output", tag), tagcat("depth-transient", tag), "");
+		setup_ffx_cacao(graph, context, tagcat("ssao-output", tag), tagcat("depth-transient", tag), "",
+		                config.ssao_tier);
 	}
 
 	bool supports_32bpp =
@@ -813,7 +1061,10 @@ void SceneViewerApplication::add_main_pass_forward(Device &device, const std::st
 	auto resolved = color;
 	resolved.samples = 1;
 
+	bool oit = config.order_independent_transparency;
+
 	auto &lighting_pass = graph.add_pass(tagcat("lighting", tag), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	add_dynamic_render_area(lighting_pass);
 
 	if (color.samples > 1)
 	{
@@ -821,7 +1072,7 @@ void SceneViewerApplication::add_main_pass_forward(Device &device, const std::st
 		lighting_pass.add_resolve_output(tagcat("HDR", tag), resolved);
 	}
 	else
-		lighting_pass.add_color_output(tagcat("HDR", tag), color);
+		lighting_pass.add_color_output(tagcat(oit ? "HDR-opaque" : "HDR", tag), color);
 
 	if (use_ssao)
 	{
@@ -841,7 +1092,9 @@ void SceneViewerApplication::add_main_pass_forward(Device &device, const std::st
 	setup.deferred_lights = &deferred_lights;
 	setup.context = &context;
 	setup.suite = &renderer_suite;
-	setup.flags = SCENE_RENDERER_FORWARD_OPAQUE_BIT | SCENE_RENDERER_FORWARD_TRANSPARENT_BIT | config.pcf_flags;
+	setup.flags = SCENE_RENDERER_FORWARD_OPAQUE_BIT | config.pcf_flags;
+	if (!oit)
+		setup.flags |= SCENE_RENDERER_FORWARD_TRANSPARENT_BIT;
 	if (config.forward_depth_prepass && !use_ssao)
 		setup.flags |= SCENE_RENDERER_FORWARD_Z_PREPASS_BIT;
 	else if (config.forward_depth_prepass)
@@ -861,6 +1114,9 @@ void SceneViewerApplication::add_main_pass_forward(Device &device, const std::st
 	                                                      RenderPassCreator::LIGHTING_BIT |
 	                                                      RenderPassCreator::GEOMETRY_BIT |
 	                                                      RenderPassCreator::MATERIAL_BIT);
+
+	if (oit)
+		add_transparent_pass_oit(tag, resolved);
 }
 
 void SceneViewerApplication::add_main_pass_deferred(Device &device, const std::string &tag)
@@ -895,6 +1151,7 @@ void SceneViewerApplication::add_main_pass_deferred(Device &device, const std::s
 	gbuffer.add_color_output(tagcat("normal", tag), normal);
 	gbuffer.add_color_output(tagcat("pbr", tag), pbr);
 	gbuffer.set_depth_stencil_output(tagcat("depth-transient", tag), depth);
+	add_dynamic_render_area(gbuffer);
 
 	{
 		auto renderer = Util::make_handle<RenderPassSceneRenderer>();
@@ -904,7 +1161,7 @@ void SceneViewerApplication::add_main_pass_deferred(Device &device, const std::s
 		setup.context = &context;
 		setup.suite = &renderer_suite;
 		setup.flags = SCENE_RENDERER_DEFERRED_GBUFFER_BIT;
-		if (!config.clustered_lights && config.deferred_clustered_stencil_culling)
+		if (!config.clustered_lights && !config.deferred_tiled_lights && config.deferred_clustered_stencil_culling)
 			setup.flags |= SCENE_RENDERER_DEFERRED_GBUFFER_LIGHT_PREPASS_BIT;
 		if (config.debug_probes)
 			setup.flags |= SCENE_RENDERER_DEBUG_PROBES_BIT;
@@ -917,17 +1174,29 @@ void SceneViewerApplication::add_main_pass_deferred(Device &device, const std::s
 	if (config.ssao)
 	{
 		setup_ffx_cacao(graph, context, tagcat("ssao-output", tag), tagcat("depth-transient", tag),
-		                tagcat("normal", tag));
+		                tagcat("normal", tag), config.ssao_tier);
+	}
+
+	bool tiled_lights = !config.clustered_lights && config.deferred_tiled_lights;
+	if (tiled_lights)
+	{
+		deferred_lights.add_tiled_compute_pass(graph, context, tagcat("albedo", tag), tagcat("normal", tag),
+		                                       tagcat("pbr", tag), tagcat("depth-transient", tag),
+		                                       tagcat("tiled-lights", tag));
 	}
 
 	auto &lighting_pass = graph.add_pass(tagcat("lighting", tag), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
-	lighting_pass.add_color_output(tagcat("HDR", tag), emissive, tagcat("emissive", tag));
+	add_dynamic_render_area(lighting_pass);
+	bool oit = config.order_independent_transparency;
+	lighting_pass.add_color_output(tagcat(oit ? "HDR-opaque" : "HDR", tag), emissive, tagcat("emissive", tag));
 	lighting_pass.add_attachment_input(tagcat("albedo", tag));
 	lighting_pass.add_attachment_input(tagcat("normal", tag));
 	lighting_pass.add_attachment_input(tagcat("pbr", tag));
 	lighting_pass.add_attachment_input(tagcat("depth-transient", tag));
 	lighting_pass.set_depth_stencil_input(tagcat("depth-transient", tag));
 	lighting_pass.add_fake_resource_write_alias(tagcat("depth-transient", tag), tagcat("depth", tag));
+	if (tiled_lights)
+		lighting_pass.add_texture_input(tagcat("tiled-lights", tag));
 
 	{
 		auto renderer = Util::make_handle<RenderPassSceneRenderer>();
@@ -936,7 +1205,9 @@ void SceneViewerApplication::add_main_pass_deferred(Device &device, const std::s
 		setup.deferred_lights = &deferred_lights;
 		setup.context = &context;
 		setup.suite = &renderer_suite;
-		setup.flags = SCENE_RENDERER_DEFERRED_LIGHTING_BIT | SCENE_RENDERER_FORWARD_TRANSPARENT_BIT | config.pcf_flags;
+		setup.flags = SCENE_RENDERER_DEFERRED_LIGHTING_BIT | config.pcf_flags;
+		if (!oit)
+			setup.flags |= SCENE_RENDERER_FORWARD_TRANSPARENT_BIT;
 		if (config.clustered_lights)
 			setup.flags |= SCENE_RENDERER_DEFERRED_CLUSTER_BIT;
 		renderer->init(setup);
@@ -958,6 +1229,66 @@ void SceneViewerApplication::add_main_pass_deferred(Device &device, const std::s
 	                                                      RenderPassCreator::MATERIAL_BIT);
 	scene_loader.get_scene().add_render_pass_dependencies(graph, lighting_pass,
 	                                                      RenderPassCreator::LIGHTING_BIT);
+
+	if (oit)
+		add_transparent_pass_oit(tag, emissive);
+}
+
+void SceneViewerApplication::add_transparent_pass_oit(const std::string &tag, const AttachmentInfo &hdr)
+{
+	// Accumulates transparent surfaces in any order, then composites them over the opaque HDR result.
+	auto accum = hdr;
+	accum.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	accum.samples = 1;
+	auto weight = accum;
+	weight.format = VK_FORMAT_R16_SFLOAT;
+
+	auto &oit_pass = graph.add_pass(tagcat("transparent-oit", tag), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	add_dynamic_render_area(oit_pass);
+	oit_pass.add_color_output(tagcat("oit-accum", tag), accum);
+	oit_pass.add_color_output(tagcat("oit-weight", tag), weight);
+	oit_pass.set_depth_stencil_input(tagcat("depth", tag));
+
+	{
+		auto renderer = Util::make_handle<RenderPassSceneRenderer>();
+		RenderPassSceneRenderer::Setup setup = {};
+		setup.scene = &scene_loader.get_scene();
+		setup.deferred_lights = &deferred_lights;
+		setup.context = &context;
+		setup.suite = &renderer_suite;
+		setup.flags = SCENE_RENDERER_FORWARD_TRANSPARENT_BIT | config.pcf_flags;
+		renderer->init(setup);
+
+		// Revealage in alpha starts out at 1, weights in the second target at 0.
+		VkClearColorValue clear_value = {};
+		clear_value.float32[3] = 1.0f;
+		renderer->set_clear_color(clear_value);
+
+		oit_pass.set_render_pass_interface(std::move(renderer));
+	}
+
+	if (config.directional_light_shadows)
+		oit_pass.add_texture_input("shadow-main");
+	scene_loader.get_scene().add_render_pass_dependencies(graph, oit_pass,
+	                                                      RenderPassCreator::LIGHTING_BIT |
+	                                                      RenderPassCreator::GEOMETRY_BIT |
+	                                                      RenderPassCreator::MATERIAL_BIT);
+
+	auto &composite = graph.add_pass(tagcat("transparent-oit-composite", tag), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	add_dynamic_render_area(composite);
+	composite.add_color_output(tagcat("HDR", tag), hdr, tagcat("HDR-opaque", tag));
+	auto *accum_res = &composite.add_texture_input(tagcat("oit-accum", tag));
+	auto *weight_res = &composite.add_texture_input(tagcat("oit-weight", tag));
+	composite.set_build_render_pass([this, accum_res, weight_res](CommandBuffer &cmd) {
+		cmd.set_texture(0, 0, graph.get_physical_texture_resource(*accum_res), StockSampler::NearestClamp);
+		cmd.set_texture(0, 1, graph.get_physical_texture_resource(*weight_res), StockSampler::NearestClamp);
+		CommandBufferUtil::setup_fullscreen_quad(cmd, "builtin://shaders/quad.vert",
+		                                         "builtin://shaders/post/oit_composite.frag");
+		cmd.set_blend_enable(true);
+		cmd.set_blend_factors(VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA);
+		cmd.set_blend_op(VK_BLEND_OP_ADD);
+		CommandBufferUtil::draw_fullscreen_quad(cmd);
+	});
 }
 
 void SceneViewerApplication::add_main_pass(Device &device, const std::string &tag)
@@ -999,8 +1330,22 @@ void SceneViewerApplication::add_shadow_pass_fallback(Vulkan::Device &, const st
 	shadowpass.set_render_pass_interface(std::move(handle));
 }
 
-void SceneViewerApplication::add_shadow_pass(Device &, const std::string &tag)
+void SceneViewerApplication::add_shadow_pass(Device &device, const std::string &tag)
 {
+	virtual_shadows.reset();
+	if (config.directional_light_shadows_virtual)
+	{
+		auto handle = Util::make_handle<VirtualShadowMap>();
+		if (handle->init(device, &scene_loader.get_scene(), &renderer_suite, {}))
+		{
+			handle->add_render_passes(graph, "depth-main", tagcat("shadow", tag));
+			virtual_shadows = std::move(handle);
+			return;
+		}
+
+		LOGE("Failed to create virtual shadow map, falling back to regular shadow maps.\n");
+	}
+
 	AttachmentInfo shadowmap;
 	shadowmap.format = VK_FORMAT_D16_UNORM;
 	shadowmap.samples = config.directional_light_shadows_vsm ? 4 : 1;
@@ -1011,6 +1356,11 @@ void SceneViewerApplication::add_shadow_pass(Device &, const std::string &tag)
 	if (config.directional_light_cascaded_shadows)
 		shadowmap.layers = NumShadowCascades;
 
+	bool preserve_cascades = config.directional_light_shadows_parallel_cascades &&
+	                         config.directional_light_shadows_far_cascade_interval > 1;
+	if (preserve_cascades)
+		shadowmap.flags |= ATTACHMENT_INFO_PRESERVE_BIT;
+
 	auto &shadowpass = graph.add_pass(tagcat("shadow", tag), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
 
 	if (config.directional_light_shadows_vsm)
@@ -1065,6 +1415,23 @@ void SceneViewerApplication::add_shadow_pass(Device &, const std::string &tag)
 		shadowpass.set_depth_stencil_output(tagcat("shadow", tag), shadowmap);
 	}
 
+	shadow_cascades_renderer.reset();
+	if (config.directional_light_shadows_parallel_cascades)
+	{
+		RenderPassShadowCascadesRenderer::Setup setup = {};
+		setup.scene = &scene_loader.get_scene();
+		setup.suite = &renderer_suite;
+		setup.flags = SCENE_RENDERER_DEPTH_BIT | SCENE_RENDERER_DEPTH_DYNAMIC_BIT | SCENE_RENDERER_CACHED_VISIBILITY_BIT;
+		setup.contexts = cascade_depth_contexts;
+		setup.preserve_contents = preserve_cascades;
+
+		shadow_cascades_renderer = Util::make_handle<RenderPassShadowCascadesRenderer>();
+		shadow_cascades_renderer->init(setup);
+		shadowpass.set_render_pass_interface(shadow_cascades_renderer);
+		cached_cascade_valid_mask = 0;
+		return;
+	}
+
 	Util::IntrusivePtr<RenderPassSceneRenderer> handle;
 	RenderPassSceneRenderer::Setup setup = {};
 	setup.scene = &scene_loader.get_scene();
@@ -1074,7 +1441,7 @@ void SceneViewerApplication::add_shadow_pass(Device &, const std::string &tag)
 		setup.flags |= SCENE_RENDERER_SHADOW_VSM_BIT;
 
 	setup.context = &depth_context;
-	setup.flags |= SCENE_RENDERER_DEPTH_DYNAMIC_BIT;
+	setup.flags |= SCENE_RENDERER_DEPTH_DYNAMIC_BIT | SCENE_RENDERER_CACHED_VISIBILITY_BIT;
 
 	handle = Util::make_handle<RenderPassSceneRenderer>();
 	handle->init(setup);
@@ -1119,23 +1486,35 @@ void SceneViewerApplication::on_swapchain_changed(const SwapchainParameterEvent
 	add_main_pass(swap.get_device(), "main");
 	if (config.postaa_type == PostAAType::TAA_Low ||
 	    config.postaa_type == PostAAType::TAA_Medium ||
-	    config.postaa_type == PostAAType::TAA_High)
+	    config.postaa_type == PostAAType::TAA_High ||
+	    config.postaa_type == PostAAType::TAA_Upscale)
 	{
 		add_mv_pass("main", "depth-main");
 	}
 
+	bool temporal_upscaled = false;
+
 	if (config.hdr_bloom)
 	{
+		const char *hdr_source = "HDR-main";
+		if (config.dynamic_resolution)
+		{
+			setup_dynamic_resolution_upscaling(graph, dynamic_resolution, hdr_source, "HDR-dynamic");
+			hdr_source = "HDR-dynamic";
+		}
+
 		bool resolved = setup_before_post_chain_antialiasing(config.postaa_type, graph, jitter, config.resolution_scale,
-		                                                     "HDR-main", "depth-main", "mv-main", "HDR-resolved");
+		                                                     hdr_source, "depth-main", "mv-main", "HDR-resolved");
+		temporal_upscaled = resolved && config.postaa_type == PostAAType::TAA_Upscale;
 
 		HDROptions opts;
 		opts.dynamic_exposure = config.hdr_bloom_dynamic_exposure;
+		opts.single_pass_bloom = config.hdr_bloom_single_pass;
 
 		if (ImplementationQuirks::get().use_async_compute_post)
-			setup_hdr_postprocess_compute(graph, resolved ? "HDR-resolved" : "HDR-main", "tonemapped", opts);
+			setup_hdr_postprocess_compute(graph, resolved ? "HDR-resolved" : hdr_source, "tonemapped", opts);
 		else
-			setup_hdr_postprocess(graph, resolved ? "HDR-resolved" : "HDR-main", "tonemapped", opts);
+			setup_hdr_postprocess(graph, resolved ? "HDR-resolved" : hdr_source, "tonemapped", opts);
 	}
 
 	if (setup_after_post_chain_antialiasing(config.postaa_type, graph, jitter, config.resolution_scale,
@@ -1144,7 +1523,7 @@ void SceneViewerApplication::on_swapchain_changed(const SwapchainParameterEvent
 		ui_source = "post-aa-output";
 	}
 
-	if (config.resolution_scale < 1.0f &&
+	if (config.resolution_scale < 1.0f && !temporal_upscaled &&
 	    setup_after_post_chain_upscaling(graph, ui_source, "post-scale-output",
 	                                     config.resolution_scale_sharpen))
 	{
@@ -1229,6 +1608,24 @@ void SceneViewerApplication::setup_shadow_map()
 		mat4 cascade_transforms[NumShadowCascades];
 		AABB combined_aabb(vec3(FLT_MAX), vec3(-FLT_MAX));
 
+		// Far cascades can be refreshed at a reduced rate. In the frames in between, they are sampled
+		// with the transform they were rendered with, and are padded so the camera can move a bit
+		// before the cached cascade no longer covers its slice.
+		constexpr int FIRST_CACHED_CASCADE = 2;
+		constexpr float CACHED_CASCADE_PADDING = 1.1f;
+		const unsigned cascade_interval = config.directional_light_shadows_far_cascade_interval;
+		const bool cache_cascades = shadow_cascades_renderer && cascade_interval > 1;
+		uint32_t refresh_mask = 0;
+
+		if (cached_cascade_shadows != lighting.shadows ||
+		    any(notEqual(cached_cascade_direction, selected_directional->direction)))
+		{
+			cached_cascade_valid_mask = 0;
+			cached_cascade_shadows = lighting.shadows;
+			cached_cascade_direction = selected_directional->direction;
+		}
+		cascade_frame_count++;
+
 		for (int i = 0; i < NumShadowCascades; i++)
 		{
 			float cascade_cutoffs_lo;
@@ -1244,6 +1641,36 @@ void SceneViewerApplication::setup_shadow_map()
 			vec2 center_xy = (view * vec4(sphere.xyz(), 1.0f)).xy();
 			sphere.w *= 1.01f;
 
+			bool cached = cache_cascades && i >= FIRST_CACHED_CASCADE;
+			float slice_radius = sphere.w;
+			if (cached)
+				sphere.w *= CACHED_CASCADE_PADDING;
+
+			bool refresh = true;
+			auto &cache = cached_cascades[i];
+			if (cached && (cached_cascade_valid_mask & (1u << i)) != 0)
+			{
+				// The bounding sphere radius jitters slightly as the camera rotates.
+				// Keep the cached radius so the texel grid stays the same across refreshes.
+				if (muglm::abs(cache.radius - sphere.w) <= 1e-3f * sphere.w)
+					sphere.w = cache.radius;
+
+				bool covered = sphere.w == cache.radius &&
+				               all(lessThanEqual(abs(center_xy - cache.center) + vec2(slice_radius), vec2(cache.radius)));
+				bool scheduled = ((cascade_frame_count + unsigned(i)) % cascade_interval) == 0;
+				refresh = !covered || scheduled;
+			}
+
+			if (!refresh)
+			{
+				cascade_transforms[i] = cache.transform;
+				lighting.shadow.transforms[i] =
+						translate(vec3(0.5f, 0.5f, 0.0f)) *
+						scale(vec3(0.5f, 0.5f, 1.0f)) *
+						cascade_transforms[i];
+				continue;
+			}
+
 			vec2 texel_size = vec2(2.0f * sphere.w) * vec2(1.0f / lighting.shadows->get_image().get_create_info().width,
 			                                               1.0f / lighting.shadows->get_image().get_create_info().height);
 
@@ -1257,16 +1684,36 @@ void SceneViewerApplication::setup_shadow_map()
 
 			mat4 proj = ortho(ortho_range);
 			cascade_transforms[i] = proj * view;
+			cascade_depth_contexts[i].set_camera(proj, view);
+
+			cache.transform = cascade_transforms[i];
+			cache.center = center_xy;
+			cache.radius = sphere.w;
+			cached_cascade_valid_mask |= 1u << i;
+			refresh_mask |= 1u << i;
+
 			lighting.shadow.transforms[i] =
 					translate(vec3(0.5f, 0.5f, 0.0f)) *
 					scale(vec3(0.5f, 0.5f, 1.0f)) *
 					cascade_transforms[i];
 		}
 
-		depth_context.set_shadow_cascades(cascade_transforms);
-
-		mat4 proj = ortho(combined_aabb);
-		depth_context.set_camera(proj, view);
+		if (shadow_cascades_renderer)
+		{
+			shadow_cascades_renderer->set_refresh_mask(refresh_mask);
+		}
+		else
+		{
+			depth_context.set_shadow_cascades(cascade_transforms);
+			mat4 proj = ortho(combined_aabb);
+			depth_context.set_camera(proj, view);
+		}
+	}
+	else if (virtual_shadows)
+	{
+		virtual_shadows->set_light(view, ortho_range_depth);
+		virtual_shadows->begin_frame(depth_context, context);
+		lighting.shadow.transforms[0] = virtual_shadows->get_shadow_transform();
 	}
 	else
 	{
@@ -1279,13 +1726,30 @@ void SceneViewerApplication::setup_shadow_map()
 	}
 }
 
-void SceneViewerApplication::update_scene(TaskComposer &composer, double frame_time, double elapsed_time)
+void SceneViewerApplication::simulate_frame(double frame_time, double elapsed_time)
+{
+	// With pipelined frames this runs while the previous frame renders.
+	// Poses are kept in the animation system until publish_simulation().
+	TaskComposer composer(*GRANITE_THREAD_GROUP());
+	animation_system->simulate_poses(composer, frame_time, elapsed_time);
+	composer.get_outgoing_task()->wait();
+}
+
+void SceneViewerApplication::publish_simulation()
+{
+	if (config.animation_lod)
+		animation_system->set_lod_view(context.get_render_parameters().camera_position, context.get_visibility_frustum());
+	animation_system->commit_poses();
+}
+
+void SceneViewerApplication::update_scene(TaskComposer &composer, double, double)
 {
 	auto &scene = scene_loader.get_scene();
 
-	animation_system->animate(composer, frame_time, elapsed_time);
+	// Transform propagation is not pipelined. Renderables point straight at node world transforms,
+	// so the transform tree is updated here from the poses published in publish_simulation().
 	scene.update_transform_tree(composer);
-	Threaded::scene_update_cached_transforms(scene, composer, 64);
+	Threaded::scene_update_cached_transforms(scene, composer);
 
 	// Perform updates which depend on node transforms.
 	auto &updates = composer.begin_pipeline_stage();
@@ -1303,7 +1767,10 @@ void SceneViewerApplication::update_scene(TaskComposer &composer, double frame_t
 		if (lighting.shadows)
 		{
 			if (need_update)
+			{
 				update_shadow_scene_aabb();
+				cached_cascade_valid_mask = 0;
+			}
 			setup_shadow_map();
 		}
 	});
@@ -1376,9 +1843,298 @@ void SceneViewerApplication::render_ui(CommandBuffer &cmd)
 		                          color, alignment, 1.0f);
 	}
 
+	if (show_gpu_profiler)
+		render_gpu_profiler(cmd);
+	if (hud.enabled)
+		render_performance_hud(cmd);
+
 	flat_renderer.flush(cmd, vec3(0.0f), vec3(cmd.get_viewport().width, cmd.get_viewport().height, 1.0f));
 }
 
+void SceneViewerApplication::render_gpu_profiler(CommandBuffer &cmd)
+{
+	auto &device = cmd.get_device();
+	device.get_gpu_scope_events(gpu_scope_events);
+	if (gpu_scope_events.empty())
+		return;
+
+	static const char *queue_names[QUEUE_INDEX_COUNT] = { "Graphics", "Compute", "Transfer", "Decode" };
+	auto &font = GRANITE_UI_MANAGER()->get_font(UI::FontSize::Normal);
+	const float row_height = 15.0f;
+	const float label_width = 70.0f;
+
+	unsigned rows[QUEUE_INDEX_COUNT] = {};
+	double frame_ms = 0.0;
+	for (auto &event : gpu_scope_events)
+	{
+		rows[event.queue] = std::max(rows[event.queue], event.depth + 1);
+		frame_ms = std::max(frame_ms, event.end_ms);
+	}
+
+	unsigned total_rows = 0;
+	for (auto &r : rows)
+		total_rows += r;
+
+	float width = std::min(cmd.get_viewport().width - 10.0f, 1000.0f);
+	float graph_width = width - label_width;
+	float ms_to_pixels = frame_ms > 0.0 ? float(double(graph_width) / frame_ms) : 0.0f;
+	float height = float(total_rows) * row_height;
+	vec2 base(5.0f, cmd.get_viewport().height - 5.0f - height);
+
+	// Flame graph, one band of rows per queue, nested scopes stack downwards.
+	flat_renderer.render_quad(vec3(base, 0.9f), vec2(width, height), vec4(0.0f, 0.0f, 0.0f, 0.6f));
+
+	float queue_y[QUEUE_INDEX_COUNT];
+	float y = base.y;
+	for (unsigned i = 0; i < QUEUE_INDEX_COUNT; i++)
+	{
+		queue_y[i] = y;
+		if (rows[i])
+		{
+			flat_renderer.render_text(font, queue_names[i], vec3(base.x, y, 0.0f), vec2(label_width, row_height),
+			                          vec4(1.0f), Font::Alignment::TopLeft, 1.0f);
+		}
+		y += float(rows[i]) * row_height;
+	}
+
+	for (auto &event : gpu_scope_events)
+	{
+		vec2 offset(base.x + label_width + float(event.start_ms) * ms_to_pixels,
+		            queue_y[event.queue] + float(event.depth) * row_height);
+		vec2 size(std::max(float(event.end_ms - event.start_ms) * ms_to_pixels, 1.0f), row_height - 1.0f);
+
+		Util::Hasher h;
+		h.string(event.name);
+		auto hash = h.get();
+		vec4 color(0.4f + 0.5f * float(hash & 0xff) / 255.0f,
+		           0.4f + 0.5f * float((hash >> 8) & 0xff) / 255.0f,
+		           0.4f + 0.5f * float((hash >> 16) & 0xff) / 255.0f, 0.9f);
+		flat_renderer.render_quad(vec3(offset, 0.5f), size, color);
+
+		if (size.x > 20.0f)
+		{
+			flat_renderer.push_scissor(offset, size);
+			flat_renderer.render_text(font, event.name.c_str(), vec3(offset + vec2(2.0f, 0.0f), 0.0f), size,
+			                          vec4(0.0f, 0.0f, 0.0f, 1.0f), Font::Alignment::TopLeft, 1.0f);
+			flat_renderer.pop_scissor();
+		}
+	}
+
+	// Rolling statistics, one line per unique scope.
+	y = base.y - row_height;
+	unordered_set<Util::Hash> seen;
+	for (auto itr = gpu_scope_events.rbegin(); itr != gpu_scope_events.rend(); ++itr)
+	{
+		Util::Hasher h;
+		h.u32(itr->queue);
+		h.string(itr->name);
+		if (!seen.insert(h.get()).second)
+			continue;
+
+		char text[256];
+		snprintf(text, sizeof(text), "%s: avg %.3f ms, p99 %.3f ms, max %.3f ms",
+		         itr->name.c_str(), itr->statistics.avg_ms, itr->statistics.p99_ms, itr->statistics.max_ms);
+		flat_renderer.render_text(font, text, vec3(base.x, y, 0.0f), vec2(width, row_height),
+		                          vec4(1.0f, 1.0f, 0.0f, 1.0f), Font::Alignment::TopLeft, 1.0f);
+		y -= row_height;
+		if (y < 0.0f)
+			break;
+	}
+}
+
+void SceneViewerApplication::set_performance_hud_enabled(bool enable)
+{
+	auto &device = get_wsi().get_device();
+	auto *group = GRANITE_THREAD_GROUP();
+
+	if (enable)
+	{
+		hud = {};
+		hud.enabled = true;
+		hud.task_statistics_were_enabled = group->get_task_statistics_enabled();
+		hud.last_device_stats = device.get_statistics();
+		group->set_task_statistics_enabled(true);
+		// Drop whatever accumulated before the HUD was shown.
+		group->get_task_statistics(hud.task_stats, true);
+		// Pass telemetry turns on GPU scopes as needed.
+		graph.enable_pass_telemetry(true);
+	}
+	else
+	{
+		hud.enabled = false;
+		group->set_task_statistics_enabled(hud.task_statistics_were_enabled);
+		graph.enable_pass_telemetry(false);
+		device.set_gpu_scopes_enabled(show_gpu_profiler);
+	}
+}
+
+void SceneViewerApplication::update_performance_hud()
+{
+	auto stats = get_wsi().get_device().get_statistics();
+	auto &delta = hud.frame_device_stats;
+	delta.queue_submissions = stats.queue_submissions - hud.last_device_stats.queue_submissions;
+	delta.draws = stats.draws - hud.last_device_stats.draws;
+	delta.dispatches = stats.dispatches - hud.last_device_stats.dispatches;
+	delta.pipeline_compiles = stats.pipeline_compiles - hud.last_device_stats.pipeline_compiles;
+	delta.descriptor_set_allocations = stats.descriptor_set_allocations - hud.last_device_stats.descriptor_set_allocations;
+	hud.last_device_stats = stats;
+
+	GRANITE_THREAD_GROUP()->get_task_statistics(hud.task_stats, true);
+	uint64_t cpu_ns = 0;
+	for (auto &task : hud.task_stats)
+		cpu_ns += task.total_ns;
+
+	// Pass timings are already smoothed over previous frames.
+	graph.get_pass_timings(hud.pass_timings);
+	sort(begin(hud.pass_timings), end(hud.pass_timings), [](const auto &a, const auto &b) {
+		return a.second.gpu_ms > b.second.gpu_ms;
+	});
+	double gpu_ms = 0.0;
+	for (auto &pass : hud.pass_timings)
+		if (!pass.second.pruned)
+			gpu_ms += pass.second.gpu_ms;
+
+	unsigned index = hud.frame_index++ & FrameWindowSizeMask;
+	hud.frame_ms[index] = last_frame_times[(last_frame_index - 1) & FrameWindowSizeMask] * 1000.0f;
+	hud.cpu_ms[index] = float(1e-6 * double(cpu_ns));
+	hud.gpu_ms[index] = float(gpu_ms);
+	hud.draws[index] = float(delta.draws);
+}
+
+// Bar graph of the rolling history, oldest to the left. Returns the height used.
+float SceneViewerApplication::render_hud_graph(const char *label, const float *values, const char *unit,
+                                               vec2 offset, float width)
+{
+	auto &font = GRANITE_UI_MANAGER()->get_font(UI::FontSize::Normal);
+	const float row_height = 15.0f;
+	const float graph_height = 30.0f;
+
+	unsigned count = std::min<unsigned>(hud.frame_index, FrameWindowSize);
+	float max_value = 0.0f;
+	for (unsigned i = 0; i < count; i++)
+		max_value = std::max(max_value, values[i]);
+	float current = count ? values[(hud.frame_index - 1) & FrameWindowSizeMask] : 0.0f;
+
+	char text[256];
+	snprintf(text, sizeof(text), "%s: %.2f %s (max %.2f)", label, current, unit, max_value);
+	flat_renderer.render_text(font, text, vec3(offset, 0.0f), vec2(width, row_height),
+	                          vec4(1.0f, 1.0f, 0.0f, 1.0f), Font::Alignment::TopLeft, 1.0f);
+
+	float bar_width = width / float(FrameWindowSize);
+	float scale = max_value > 0.0f ? graph_height / max_value : 0.0f;
+	vec2 base = offset + vec2(0.0f, row_height);
+	for (unsigned i = 0; i < count; i++)
+	{
+		// Newest frame ends up in the rightmost slot.
+		unsigned slot = FrameWindowSize - count + i;
+		float value = values[(hud.frame_index - count + i) & FrameWindowSizeMask];
+		float height = std::max(value * scale, 1.0f);
+		flat_renderer.render_quad(vec3(base.x + float(slot) * bar_width, base.y + graph_height - height, 0.5f),
+		                          vec2(std::max(bar_width - 1.0f, 1.0f), height),
+		                          vec4(0.3f, 0.8f, 0.3f, 0.9f));
+	}
+
+	return row_height + graph_height + 5.0f;
+}
+
+void SceneViewerApplication::render_performance_hud(CommandBuffer &cmd)
+{
+	auto &device = cmd.get_device();
+	auto &font = GRANITE_UI_MANAGER()->get_font(UI::FontSize::Normal);
+	const float row_height = 15.0f;
+	const unsigned max_rows = 8;
+	const vec4 text_color(1.0f);
+
+	float width = std::min(cmd.get_viewport().width * 0.4f, 450.0f);
+	vec2 base(5.0f, 5.0f);
+	vec2 offset = base;
+	char text[256];
+
+	offset.y += render_hud_graph("Frame", hud.frame_ms, "ms", offset, width);
+	offset.y += render_hud_graph("CPU tasks", hud.cpu_ms, "ms", offset, width);
+	offset.y += render_hud_graph("GPU passes", hud.gpu_ms, "ms", offset, width);
+	offset.y += render_hud_graph("Draws", hud.draws, "", offset, width);
+
+	auto &stats = hud.frame_device_stats;
+	snprintf(text, sizeof(text), "Draws: %u, dispatches: %u, submits: %u",
+	         unsigned(stats.draws), unsigned(stats.dispatches), unsigned(stats.queue_submissions));
+	flat_renderer.render_text(font, text, vec3(offset, 0.0f), vec2(width, row_height),
+	                          text_color, Font::Alignment::TopLeft, 1.0f);
+	offset.y += row_height;
+	snprintf(text, sizeof(text), "Pipeline compiles: %u, descriptor sets: %u",
+	         unsigned(stats.pipeline_compiles), unsigned(stats.descriptor_set_allocations));
+	// Compiles in steady state are hitches, make them stand out.
+	flat_renderer.render_text(font, text, vec3(offset, 0.0f), vec2(width, row_height),
+	                          stats.pipeline_compiles ? vec4(1.0f, 0.3f, 0.3f, 1.0f) : text_color,
+	                          Font::Alignment::TopLeft, 1.0f);
+	offset.y += 2.0f * row_height;
+
+	// Task statistics are sorted by total time already.
+	flat_renderer.render_text(font, "CPU task groups (total, p99 wait):", vec3(offset, 0.0f),
+	                          vec2(width, row_height), text_color, Font::Alignment::TopLeft, 1.0f);
+	offset.y += row_height;
+	for (size_t i = 0, n = std::min<size_t>(hud.task_stats.size(), max_rows); i < n; i++)
+	{
+		auto &task = hud.task_stats[i];
+		snprintf(text, sizeof(text), "  %s: %.3f ms x%u, %.3f ms", task.desc.c_str(),
+		         1e-6 * double(task.total_ns), unsigned(task.count), 1e-6 * double(task.p99_wait_ns));
+		flat_renderer.render_text(font, text, vec3(offset, 0.0f), vec2(width, row_height),
+		                          text_color, Font::Alignment::TopLeft, 1.0f);
+		offset.y += row_height;
+	}
+	offset.y += row_height;
+
+	flat_renderer.render_text(font, "GPU passes (GPU, CPU record):", vec3(offset, 0.0f),
+	                          vec2(width, row_height), text_color, Font::Alignment::TopLeft, 1.0f);
+	offset.y += row_height;
+	for (size_t i = 0, n = std::min<size_t>(hud.pass_timings.size(), max_rows); i < n; i++)
+	{
+		auto &pass = hud.pass_timings[i];
+		snprintf(text, sizeof(text), "  %s: %.3f ms, %.3f ms%s", pass.first.c_str(),
+		         pass.second.gpu_ms, pass.second.cpu_ms, pass.second.pruned ? " (pruned)" : "");
+		flat_renderer.render_text(font, text, vec3(offset, 0.0f), vec2(width, row_height),
+		                          text_color, Font::Alignment::TopLeft, 1.0f);
+		offset.y += row_height;
+	}
+	offset.y += row_height;
+
+	// Usage against budget per heap, red when over.
+	HeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+	device.get_memory_budget(budgets);
+	for (uint32_t i = 0; i < device.get_memory_properties().memoryHeapCount; i++)
+	{
+		auto &budget = budgets[i];
+		float fraction = budget.budget_size ? float(double(budget.device_usage) / double(budget.budget_size)) : 0.0f;
+		snprintf(text, sizeof(text), "Heap #%u: %.1f / %.1f MiB", i,
+		         double(budget.device_usage) / double(1024 * 1024),
+		         double(budget.budget_size) / double(1024 * 1024));
+		flat_renderer.render_quad(vec3(offset, 0.5f), vec2(width * std::min(fraction, 1.0f), row_height - 1.0f),
+		                          fraction > 1.0f ? vec4(0.8f, 0.2f, 0.2f, 0.9f) : vec4(0.2f, 0.4f, 0.8f, 0.9f));
+		flat_renderer.render_text(font, text, vec3(offset + vec2(2.0f, 0.0f), 0.0f), vec2(width, row_height),
+		                          text_color, Font::Alignment::TopLeft, 1.0f);
+		offset.y += row_height;
+	}
+	offset.y += row_height;
+
+	AllocationTagStats tag_stats[Util::ecast(AllocationTag::Count)];
+	device.get_allocation_tag_stats(tag_stats);
+	for (unsigned i = 0; i < Util::ecast(AllocationTag::Count); i++)
+	{
+		auto &tag = tag_stats[i];
+		if (!tag.peak_count)
+			continue;
+		snprintf(text, sizeof(text), "  %s: %.1f MiB x%u (peak %.1f MiB)", allocation_tag_to_string(AllocationTag(i)),
+		         double(tag.live_size) / double(1024 * 1024), tag.live_count,
+		         double(tag.peak_size) / double(1024 * 1024));
+		flat_renderer.render_text(font, text, vec3(offset, 0.0f), vec2(width, row_height),
+		                          text_color, Font::Alignment::TopLeft, 1.0f);
+		offset.y += row_height;
+	}
+
+	flat_renderer.render_quad(vec3(base - vec2(2.0f), 0.9f), vec2(width, offset.y - base.y) + vec2(4.0f),
+	                          vec4(0.0f, 0.0f, 0.0f, 0.6f));
+}
+
 void SceneViewerApplication::render_scene(TaskComposer &composer)
 {
 	auto &wsi = get_wsi();
@@ -1390,6 +2146,7 @@ void SceneViewerApplication::render_frame(double frame_time, double elapsed_time
 {
 	auto *file = GRANITE_THREAD_GROUP()->get_timeline_trace_file();
 	TaskComposer composer(*GRANITE_THREAD_GROUP());
+	composer.set_priority(TaskPriority::High);
 
 	Util::TimelineTraceFile::Event *e = nullptr;
 
@@ -1399,8 +2156,26 @@ void SceneViewerApplication::render_frame(double frame_time, double elapsed_time
 
 	last_frame_times[last_frame_index++ & FrameWindowSizeMask] = float(frame_time);
 
+	// Textures and shaders keep streaming in for a while after the scene itself has loaded.
+	if (access_trace_frames && --access_trace_frames == 0)
+		GRANITE_FILESYSTEM()->end_access_trace();
+
+	if (material_heap)
+		material_heap->update(device);
+
+	LodSelection lod_selection;
+	lod_selection.pixel_error = config.lod_pixel_error;
+	lod_selection.viewport_height = float(device.get_swapchain_view().get_view_height());
+	lod_selection.frame_index = last_frame_index;
+	lod_selection.impostor_distance = config.impostor_distance;
+	context.set_lod_selection(lod_selection);
+
+	if (config.dynamic_resolution)
+		dynamic_resolution.update(device, graph);
+
 	graph.setup_attachments(device, &device.get_swapchain_view());
 	lighting.shadows = graph.maybe_get_physical_texture_resource(shadows);
+	lighting.shadow_page_table = virtual_shadows ? virtual_shadows->get_page_table() : nullptr;
 	lighting.ambient_occlusion = graph.maybe_get_physical_texture_resource(ssao_output);
 
 	renderer_suite.update_mesh_rendering_options(context, renderer_suite_config);
@@ -1434,6 +2209,9 @@ void SceneViewerApplication::render_frame(double frame_time, double elapsed_time
 	if (e)
 		file->end_event(e);
 
+	if (hud.enabled)
+		update_performance_hud();
+
 	get_wsi().get_device().promote_read_write_caches_to_read_only();
 }
 
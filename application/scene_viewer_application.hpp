@@ -29,6 +29,7 @@
 #include "renderer.hpp"
 #include "timer.hpp"
 #include "event.hpp"
+#include "application_events.hpp"
 #include "font.hpp"
 #include "ui_manager.hpp"
 #include "render_graph.hpp"
@@ -38,9 +39,13 @@
 #include "lights/volumetric_fog.hpp"
 #include "lights/deferred_lights.hpp"
 #include "lights/volumetric_diffuse.hpp"
+#include "lights/virtual_shadow_map.hpp"
 #include "camera_export.hpp"
 #include "post/aa.hpp"
 #include "post/temporal.hpp"
+#include "post/dynamic_resolution.hpp"
+#include "post/ssao.hpp"
+#include "material_heap.hpp"
 
 namespace Granite
 {
@@ -64,12 +69,15 @@ public:
 	void loop_animations();
 
 protected:
+	void simulate_frame(double frame_time, double elapsed_time) override;
+	void publish_simulation() override;
 	void update_scene(TaskComposer &composer, double frame_time, double elapsed_time);
 	void render_scene(TaskComposer &composer);
 
 	RenderContext context;
 	RenderContext depth_context;
 	RenderContext fallback_depth_context;
+	RenderContext cascade_depth_contexts[NumShadowCascades];
 
 	RendererSuite renderer_suite;
 	RendererSuite::Config renderer_suite_config;
@@ -89,11 +97,31 @@ protected:
 	void on_swapchain_changed(const Vulkan::SwapchainParameterEvent &e);
 	void on_swapchain_destroyed(const Vulkan::SwapchainParameterEvent &e);
 	bool on_key_down(const KeyboardEvent &e);
+	bool on_thermal_state(const ThermalStateEvent &e);
 	RenderGraph graph;
 
 	bool need_shadow_map_update = true;
 	AABB shadow_scene_aabb;
 
+	// Far cascades which are refreshed at a reduced rate keep their last transform.
+	struct CachedCascade
+	{
+		mat4 transform;
+		vec2 center;
+		float radius;
+	};
+	CachedCascade cached_cascades[NumShadowCascades];
+	uint32_t cached_cascade_valid_mask = 0;
+	uint32_t cascade_frame_count = 0;
+	// Frames left until the filesystem access trace of the scene load is saved.
+	unsigned access_trace_frames = 0;
+	const Vulkan::ImageView *cached_cascade_shadows = nullptr;
+	vec3 cached_cascade_direction = vec3(0.0f);
+	Util::IntrusivePtr<RenderPassShadowCascadesRenderer> shadow_cascades_renderer;
+	Util::IntrusivePtr<VirtualShadowMap> virtual_shadows;
+	DynamicResolutionController dynamic_resolution;
+
+	std::unique_ptr<MaterialHeap> material_heap;
 	std::unique_ptr<LightClusterer> cluster;
 	std::unique_ptr<VolumetricFog> volumetric_fog;
 	std::unique_ptr<VolumetricDiffuseLightManager> volumetric_diffuse;
@@ -103,13 +131,18 @@ protected:
 	void setup_shadow_map();
 	void update_shadow_scene_aabb();
 	void render_ui(Vulkan::CommandBuffer &cmd);
+	void render_gpu_profiler(Vulkan::CommandBuffer &cmd);
+	std::vector<Vulkan::GpuScopeEvent> gpu_scope_events;
+	bool show_gpu_profiler = false;
 
 	void add_main_pass(Vulkan::Device &device, const std::string &tag);
 	void add_main_pass_forward(Vulkan::Device &device, const std::string &tag);
 	void add_main_pass_deferred(Vulkan::Device &device, const std::string &tag);
+	void add_transparent_pass_oit(const std::string &tag, const AttachmentInfo &hdr);
 	void add_mv_pass(const std::string &tag, const std::string &depth);
 
 	void add_shadow_pass(Vulkan::Device &device, const std::string &tag);
+	void add_dynamic_render_area(RenderPass &pass);
 	void add_shadow_pass_fallback(Vulkan::Device &device, const std::string &tag);
 
 	std::vector<RecordedCamera> recorded_cameras;
@@ -135,22 +168,47 @@ private:
 		bool directional_light_shadows = true;
 		bool directional_light_cascaded_shadows = true;
 		bool directional_light_shadows_vsm = false;
+		bool directional_light_shadows_parallel_cascades = false;
+		unsigned directional_light_shadows_far_cascade_interval = 1;
+		bool directional_light_shadows_virtual = false;
+		bool dynamic_resolution = false;
+		float dynamic_resolution_target_ms = 16.0f;
+		float dynamic_resolution_min_scale = 0.5f;
 		bool clustered_lights = true;
 		bool clustered_lights_bindless = true;
 		bool clustered_lights_shadows = true;
 		bool clustered_lights_shadows_vsm = false;
 		bool hdr_bloom = true;
 		bool hdr_bloom_dynamic_exposure = true;
+		bool hdr_bloom_single_pass = false;
 		bool forward_depth_prepass = true;
 		bool deferred_clustered_stencil_culling = true;
+		bool deferred_tiled_lights = false;
 		bool rt_fp16 = false;
 		bool rescale_scene = false;
 		bool show_ui = true;
 		bool volumetric_fog = false;
 		bool volumetric_fog_regions = true;
+		unsigned volumetric_fog_temporal_rate = 1;
 		bool volumetric_diffuse = false;
+		unsigned volumetric_diffuse_probe_budget = 0;
+		float volumetric_diffuse_priority_distance = 16.0f;
+		unsigned volumetric_diffuse_sky_faces_per_frame = 0;
+		unsigned volumetric_diffuse_sky_blend_frames = 0;
 		bool ssao = true;
+		bool order_independent_transparency = false;
+		AmbientOcclusionTier ssao_tier = AmbientOcclusionTier::Full;
 		bool debug_probes = false;
+		bool bindless_materials = false;
+		bool meshlet_culling = false;
+		float lod_pixel_error = 1.0f;
+		float impostor_distance = 0.0f;
+		bool compute_skinning = false;
+		bool animation_lod = false;
+		bool gpu_driven_opaque = false;
+		bool occlusion_culling = false;
+		bool static_shadow_bake = false;
+		bool record_variant_usage = false;
 		PostAAType postaa_type = PostAAType::None;
 	};
 	Config config;
@@ -163,6 +221,29 @@ private:
 	float last_frame_times[FrameWindowSize] = {};
 	unsigned last_frame_index = 0;
 
+	// On-screen performance overlay, toggled with H. Sampled once per frame.
+	struct PerformanceHUD
+	{
+		bool enabled = false;
+		bool task_statistics_were_enabled = false;
+		Vulkan::DeviceStatistics last_device_stats;
+		Vulkan::DeviceStatistics frame_device_stats;
+		std::vector<TaskStatistics> task_stats;
+		std::vector<std::pair<std::string, RenderGraph::PassTiming>> pass_timings;
+
+		// Rolling history, indexed with frame_index & FrameWindowSizeMask.
+		float frame_ms[FrameWindowSize] = {};
+		float cpu_ms[FrameWindowSize] = {};
+		float gpu_ms[FrameWindowSize] = {};
+		float draws[FrameWindowSize] = {};
+		unsigned frame_index = 0;
+	};
+	PerformanceHUD hud;
+	void set_performance_hud_enabled(bool enable);
+	void update_performance_hud();
+	void render_performance_hud(Vulkan::CommandBuffer &cmd);
+	float render_hud_graph(const char *label, const float *values, const char *unit, vec2 offset, float width);
+
 	TemporalJitter jitter;
 	void capture_environment_probe();
 
@@ -5,6 +5,10 @@ precision highp int;
 #include "inc/render_target.h"
 #include "inc/two_component_normal.h"
 
+#if defined(VARIANT_BIT_1) && VARIANT_BIT_1
+#define GROUND_QUADTREE
+#endif
+
 #if defined(VARIANT_BIT_0) && VARIANT_BIT_0
 #define BANDLIMITED_PIXEL
 #include "inc/bandlimited_pixel_filter.h"
@@ -21,7 +25,13 @@ layout(push_constant, std430) uniform Constants
 
 layout(location = 1) in highp vec2 vUV;
 
+#ifdef GROUND_QUADTREE
+layout(location = 2) in highp vec2 vTileUV;
+layout(location = 3) flat in uint vLayer;
+layout(set = 2, binding = 1) uniform mediump sampler2DArray uNormalsTerrain;
+#else
 layout(set = 2, binding = 1) uniform mediump sampler2D uNormalsTerrain;
+#endif
 layout(set = 2, binding = 2) uniform mediump sampler2D uOcclusionTerrain;
 layout(set = 2, binding = 4) uniform mediump sampler2DArray uBaseColor;
 layout(set = 2, binding = 5) uniform mediump sampler2D uSplatMap;
@@ -68,7 +78,11 @@ void main()
         types.w * texture(uBaseColor, vec3(uv, 3.0)).rgb;
 #endif
 
+#ifdef GROUND_QUADTREE
+    mediump vec3 terrain = two_component_normal(texture(uNormalsTerrain, vec3(vTileUV, float(vLayer))).xy * 2.0 - 1.0);
+#else
     mediump vec3 terrain = two_component_normal(texture(uNormalsTerrain, vUV).xy * 2.0 - 1.0);
+#endif
     terrain.xy += types.w * 0.5 * (texture(uDeepRoughNormals, uv).xy * 2.0 - 1.0);
     mediump vec3 normal = normalize(mat3(registers.Normal) * terrain.xzy); // Normal is +Y, Bitangent is +Z.
 
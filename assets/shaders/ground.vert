@@ -1,14 +1,48 @@
 #version 450
 #include "inc/render_parameters.h"
 
+#if defined(VARIANT_BIT_1) && VARIANT_BIT_1
+#define GROUND_QUADTREE
+#endif
+
 layout(location = 0) in uvec4 aPosition;
+#ifndef GROUND_QUADTREE
 layout(location = 1) in vec4 aLODWeights;
+#endif
 
 #ifndef RENDERER_DEPTH
 layout(location = 0) out highp vec3 vPos;
 layout(location = 1) out highp vec2 vUV;
+#ifdef GROUND_QUADTREE
+layout(location = 2) out highp vec2 vTileUV;
+layout(location = 3) flat out uint vLayer;
+#endif
 #endif
 
+#ifdef GROUND_QUADTREE
+layout(set = 2, binding = 0) uniform sampler2DArray uHeightTiles;
+
+// Selected by shaders/ground/select_patches.comp.
+struct QuadtreePatch
+{
+    vec2 Offset;
+    float Size;
+    uint Layer;
+};
+
+layout(set = 3, binding = 0, std430) readonly buffer Patches
+{
+    QuadtreePatch data[];
+} patches;
+
+layout(std140, set = 3, binding = 2) uniform QuadtreeData
+{
+    vec2 uTileUVScaleBias;
+    float uInvPatchResolution;
+    float uHeightScale;
+    float uSkirtDepth;
+};
+#else
 layout(set = 2, binding = 0) uniform sampler2D uHeightmap;
 layout(set = 2, binding = 3) uniform sampler2D uLodMap;
 
@@ -24,6 +58,7 @@ layout(set = 3, binding = 0, std140) uniform Patches
 {
     PatchData data[512];
 } patches;
+#endif
 
 layout(std140, set = 3, binding = 1) uniform GroundData
 {
@@ -39,6 +74,31 @@ layout(push_constant, std430) uniform Constants
     mat4 Normal;
 } registers;
 
+#ifdef GROUND_QUADTREE
+void main()
+{
+    QuadtreePatch p = patches.data[gl_InstanceIndex];
+    vec2 local = vec2(aPosition.xy) * uInvPatchResolution;
+    vec2 pos = p.Offset + local * p.Size;
+    vec2 tile_uv = local * uTileUVScaleBias.x + uTileUVScaleBias.y;
+
+    float height = clamp(textureLod(uHeightTiles, vec3(tile_uv, float(p.Layer)), 0.0).x, -1.0, 1.0) * uHeightScale;
+    // Skirt vertices hang below the edge in proportion to the patch size.
+    height -= float(aPosition.z) * uSkirtDepth * p.Size;
+
+#ifndef RENDERER_DEPTH
+    vUV = pos * uInvHeightmapSize + uUVShift;
+    vTileUV = tile_uv;
+    vLayer = p.Layer;
+#endif
+
+    vec4 world = registers.Model * vec4(pos.x, height, pos.y, 1.0);
+#ifndef RENDERER_DEPTH
+    vPos = world.xyz;
+#endif
+    gl_Position = global.view_projection * world;
+}
+#else
 vec2 warp_position()
 {
     float vlod = dot(aLODWeights, patches.data[gl_InstanceIndex].LODs);
@@ -91,3 +151,4 @@ void main()
 #endif
     gl_Position = global.view_projection * world;
 }
+#endif
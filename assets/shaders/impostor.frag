@@ -0,0 +1,65 @@
+#version 450
+precision highp float;
+precision highp int;
+
+layout(location = 0) in highp vec2 vUV;
+layout(location = 1) flat in highp vec4 vFrame;
+#ifndef RENDERER_DEPTH
+layout(location = 2) in highp vec3 vPos;
+layout(location = 3) flat in mediump vec3 vRight;
+layout(location = 4) flat in mediump vec3 vUp;
+layout(location = 5) flat in mediump vec3 vForward;
+
+#include "inc/render_target.h"
+
+layout(set = 2, binding = 0) uniform mediump sampler2D uEmissive;
+layout(set = 2, binding = 2) uniform mediump sampler2D uNormal;
+layout(set = 2, binding = 3) uniform mediump sampler2D uPBR;
+#endif
+layout(set = 2, binding = 1) uniform mediump sampler2D uBaseColor;
+
+layout(std430, push_constant) uniform Registers
+{
+    // Size of one frame in atlas UV.
+    float frame_uv_size;
+    float frames_per_side;
+} registers;
+
+void main()
+{
+    // Blend the four frames around the view direction, they all share the quad UV.
+    vec2 frame = clamp(floor(vFrame.xy), vec2(0.0), vec2(registers.frames_per_side - 2.0));
+    vec2 weight = clamp(vFrame.xy - frame, vec2(0.0), vec2(1.0));
+    vec2 uv00 = vFrame.zw + (frame + vUV) * registers.frame_uv_size;
+    vec2 uv10 = uv00 + vec2(registers.frame_uv_size, 0.0);
+    vec2 uv01 = uv00 + vec2(0.0, registers.frame_uv_size);
+    vec2 uv11 = uv00 + vec2(registers.frame_uv_size);
+    vec4 w = vec4((1.0 - weight.x) * (1.0 - weight.y), weight.x * (1.0 - weight.y),
+                  (1.0 - weight.x) * weight.y, weight.x * weight.y);
+
+    // Base color alpha is cleared to zero before baking, covered texels hold the ambient term.
+    mediump vec4 base_color =
+        w.x * texture(uBaseColor, uv00) + w.y * texture(uBaseColor, uv10) +
+        w.z * texture(uBaseColor, uv01) + w.w * texture(uBaseColor, uv11);
+    if (base_color.a < 0.5)
+        discard;
+
+#ifndef RENDERER_DEPTH
+    mediump vec3 emissive =
+        w.x * texture(uEmissive, uv00).rgb + w.y * texture(uEmissive, uv10).rgb +
+        w.z * texture(uEmissive, uv01).rgb + w.w * texture(uEmissive, uv11).rgb;
+    mediump vec3 frame_normal =
+        w.x * texture(uNormal, uv00).xyz + w.y * texture(uNormal, uv10).xyz +
+        w.z * texture(uNormal, uv01).xyz + w.w * texture(uNormal, uv11).xyz;
+    mediump vec2 pbr =
+        w.x * texture(uPBR, uv00).xy + w.y * texture(uPBR, uv10).xy +
+        w.z * texture(uPBR, uv01).xy + w.w * texture(uPBR, uv11).xy;
+
+    // Normals are baked relative to the frame, which is aligned with the quad.
+    frame_normal = frame_normal * 2.0 - 1.0;
+    mediump vec3 normal = normalize(frame_normal.x * vRight + frame_normal.y * vUp + frame_normal.z * vForward);
+
+    // The ambient term is spent on coverage.
+    emit_render_target(emissive, vec4(base_color.rgb, 1.0), normal, pbr.x, pbr.y, 1.0, vPos);
+#endif
+}
@@ -0,0 +1,36 @@
+#version 450
+#include "inc/render_parameters.h"
+
+// Camera facing quads for ImpostorManager, see ImpostorQuad.
+layout(location = 0) in vec2 QuadCoord;
+layout(location = 1) in vec4 Center;
+layout(location = 2) in vec4 Right;
+layout(location = 3) in vec4 Up;
+layout(location = 4) in vec4 Frame;
+
+layout(location = 0) out highp vec2 vUV;
+layout(location = 1) flat out highp vec4 vFrame;
+#ifndef RENDERER_DEPTH
+layout(location = 2) out highp vec3 vPos;
+layout(location = 3) flat out mediump vec3 vRight;
+layout(location = 4) flat out mediump vec3 vUp;
+layout(location = 5) flat out mediump vec3 vForward;
+#endif
+
+invariant gl_Position;
+
+void main()
+{
+    vec3 pos = Center.xyz + QuadCoord.x * Right.xyz + QuadCoord.y * Up.xyz;
+    gl_Position = global.view_projection * vec4(pos, 1.0);
+
+    // Baked frames use a Y flipped orthographic projection.
+    vUV = QuadCoord * vec2(0.5, -0.5) + 0.5;
+    vFrame = Frame;
+#ifndef RENDERER_DEPTH
+    vPos = pos;
+    vRight = normalize(Right.xyz);
+    vUp = normalize(Up.xyz);
+    vForward = normalize(cross(Right.xyz, Up.xyz));
+#endif
+}
@@ -0,0 +1,37 @@
+#ifndef BINDLESS_MATERIAL_H_
+#define BINDLESS_MATERIAL_H_
+
+// Materials from Granite::MaterialHeap.
+// Mirrors Granite::BindlessMaterialInfo.
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct BindlessMaterial
+{
+	vec4 base_color;
+	vec4 emissive;
+	float roughness;
+	float metallic;
+	float normal_scale;
+	uint textures[5];
+};
+
+layout(set = 2, binding = 0) uniform texture2D uMaterialTextures[];
+layout(set = 3, binding = 4) uniform sampler uMaterialSampler;
+
+layout(std430, set = 3, binding = 5) readonly buffer BindlessMaterials
+{
+	BindlessMaterial data[];
+} bindless_materials;
+
+layout(std430, push_constant) uniform BindlessMaterialRegisters
+{
+	uint material_index;
+} bindless_material_registers;
+
+// The index is uniform for the draw, so no nonuniformEXT is needed.
+#define bindless_material bindless_materials.data[bindless_material_registers.material_index]
+#define bindless_material_texture(index) \
+	sampler2D(uMaterialTextures[bindless_material.textures[index]], uMaterialSampler)
+
+#endif
@@ -29,5 +29,6 @@
 #define BINDING_GLOBAL_GEOMETRY_SAMPLER 16
 
 #define BINDING_GLOBAL_VOLUMETRIC_DIFFUSE_FALLBACK_VOLUME 17
+#define BINDING_GLOBAL_DIRECTIONAL_SHADOW_PAGES 18
 
 #endif
\ No newline at end of file
@@ -34,6 +34,9 @@ void emit_render_target(mediump vec3 emissive, mediump vec4 base_color, mediump
 }
 #elif defined(RENDERER_FORWARD)
 layout(location = 0) out mediump vec4 Color;
+#ifdef OIT_WEIGHTED_BLENDED
+layout(location = 1) out mediump float OITWeight;
+#endif
 #include "render_parameters.h"
 #include "../lights/lighting.h"
 #include "../lights/fog.h"
@@ -71,7 +74,15 @@ void emit_render_target(mediump vec3 emissive, mediump vec4 base_color, mediump
     lighting *= exp2(-refraction.falloff * distance);
 #endif
 
+#ifdef OIT_WEIGHTED_BLENDED
+    // Weighted blended OIT, McGuire and Bavoil. Nearby surfaces get larger weights.
+    float view_z = dot(pos - global.camera_position, global.camera_front);
+    float weight = base_color.a * clamp(10.0 / (1e-5 + pow(view_z / 5.0, 2.0) + pow(view_z / 200.0, 6.0)), 1e-2, 3e3);
+    Color = vec4(lighting * weight, base_color.a);
+    OITWeight = weight;
+#else
     Color = vec4(lighting, base_color.a);
+#endif
 }
 #endif
 
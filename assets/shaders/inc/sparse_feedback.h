@@ -0,0 +1,48 @@
+#ifndef SPARSE_FEEDBACK_H_
+#define SPARSE_FEEDBACK_H_
+
+// Page requests for Granite::SparseTexture.
+// Define SPARSE_FEEDBACK_SET and SPARSE_FEEDBACK_BINDING before including,
+// and bind SparseTexture::get_feedback_buffer() there.
+
+#define SPARSE_FEEDBACK_MAX_LEVELS 16
+
+layout(std430, set = SPARSE_FEEDBACK_SET, binding = SPARSE_FEEDBACK_BINDING) buffer SparseFeedback
+{
+	uint num_levels;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+	// x: first page index, y: pages in X, z: pages in Y.
+	uvec4 levels[SPARSE_FEEDBACK_MAX_LEVELS];
+	uint bits[];
+} sparse_feedback;
+
+void sparse_feedback_request(vec2 uv, float lod)
+{
+	int level = max(int(lod), 0);
+
+	// The mip tail is always resident.
+	if (level >= int(sparse_feedback.num_levels))
+		return;
+
+	uvec4 info = sparse_feedback.levels[level];
+	uvec2 page = min(uvec2(clamp(uv, vec2(0.0), vec2(1.0)) * vec2(info.yz)), info.yz - 1u);
+	uint index = info.x + page.y * info.y + page.x;
+	uint mask = 1u << (index & 31u);
+
+	// Most pages are requested by many pixels, avoid the atomic when we can.
+	if ((sparse_feedback.bits[index >> 5u] & mask) == 0u)
+		atomicOr(sparse_feedback.bits[index >> 5u], mask);
+}
+
+// The residency map holds the finest resident level per level 0 page.
+// Sampling with a clamped LOD never touches pages which are not resident.
+float sparse_clamp_lod(usampler2D residency_map, vec2 uv, float lod)
+{
+	ivec2 size = textureSize(residency_map, 0);
+	ivec2 coord = clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1);
+	return max(lod, float(texelFetch(residency_map, coord, 0).x));
+}
+
+#endif
@@ -53,6 +53,8 @@ struct ClustererBindlessTransforms
 	mat4 model[CLUSTERER_MAX_LIGHTS];
 	uint type_mask[CLUSTERER_MAX_LIGHTS / 32];
 	BindlessDecalTransform decals[CLUSTERER_MAX_DECALS];
+	// Decals sharing a texture share one descriptor.
+	uint decal_texture_index[CLUSTERER_MAX_DECALS];
 };
 #else
 struct PointShadowData
@@ -25,7 +25,7 @@ layout(set = 0, binding = BINDING_GLOBAL_BRDF_TABLE) uniform mediump sampler2D u
 #error "Must define SHADOW_NUM_CASCADES."
 #endif
 
-#if !defined(DIRECTIONAL_SHADOW_PCF) && !defined(DIRECTIONAL_SHADOW_VSM)
+#if !defined(DIRECTIONAL_SHADOW_PCF) && !defined(DIRECTIONAL_SHADOW_VSM) && !defined(DIRECTIONAL_SHADOW_VIRTUAL)
 #define DIRECTIONAL_SHADOW_PCF
 #endif
 
@@ -114,6 +114,40 @@ mediump float get_directional_shadow_term(
 }
 #endif
 
+#ifdef DIRECTIONAL_SHADOW_VIRTUAL
+#include "virtual_shadow.h"
+layout(set = 0, binding = BINDING_GLOBAL_DIRECTIONAL_SHADOW) uniform mediump sampler2DShadow uShadowmap;
+layout(std430, set = 0, binding = BINDING_GLOBAL_DIRECTIONAL_SHADOW_PAGES) readonly buffer VirtualShadowPages
+{
+	uint virtual_shadow_pages[];
+};
+
+mediump float get_directional_shadow_term(
+		vec3 light_world_pos,
+		vec3 light_camera_pos,
+		mediump vec3 light_camera_front,
+		mediump vec3 light_direction)
+{
+	vec3 clip = (SHADOW_TRANSFORMS[0] * vec4(light_world_pos, 1.0)).xyz;
+	if (any(lessThan(clip.xy, vec2(0.0))) || any(greaterThan(clip.xy, vec2(1.0))))
+		return 1.0;
+
+	// Pages which are not resident yet are treated as lit.
+	uint entry = virtual_shadow_pages[virtual_shadow_page_index(clip.xy)];
+	if (entry == 0u)
+		return 1.0;
+
+	uint slot = entry - 1u;
+	uint slots_per_side = uint(textureSize(uShadowmap, 0).x) / VIRTUAL_SHADOW_PAGE_SIZE;
+	vec2 page_texel = fract(clip.xy * float(VIRTUAL_SHADOW_PAGES_PER_SIDE)) * float(VIRTUAL_SHADOW_PAGE_SIZE);
+	// Never filter across into a neighbor slot.
+	page_texel = clamp(page_texel, vec2(0.5), vec2(float(VIRTUAL_SHADOW_PAGE_SIZE) - 0.5));
+	vec2 atlas_texel = vec2(uvec2(slot % slots_per_side, slot / slots_per_side) * VIRTUAL_SHADOW_PAGE_SIZE) + page_texel;
+	vec2 uv = atlas_texel / vec2(textureSize(uShadowmap, 0));
+	return texture(uShadowmap, vec3(uv, clip.z));
+}
+#endif
+
 #ifdef DIRECTIONAL_SHADOW_PCF
 #ifdef SHADOW_CASCADES
 layout(set = 0, binding = BINDING_GLOBAL_DIRECTIONAL_SHADOW) uniform /* should be mediump, Mali r19 workaround */ sampler2DArrayShadow uShadowmap;
@@ -0,0 +1,10 @@
+#version 450
+
+// Adds the result of tiled_deferred.comp to the lighting pass.
+layout(set = 0, binding = 0) uniform mediump sampler2D uLighting;
+layout(location = 0) out mediump vec3 FragColor;
+
+void main()
+{
+    FragColor = texelFetch(uLighting, ivec2(gl_FragCoord.xy), 0).rgb;
+}
@@ -0,0 +1,14 @@
+#ifndef VIRTUAL_SHADOW_H_
+#define VIRTUAL_SHADOW_H_
+
+// Must match Granite::VirtualShadowMap.
+#define VIRTUAL_SHADOW_PAGE_SIZE 128u
+#define VIRTUAL_SHADOW_PAGES_PER_SIDE 128u
+
+uint virtual_shadow_page_index(vec2 uv)
+{
+    uvec2 page = min(uvec2(uv * float(VIRTUAL_SHADOW_PAGES_PER_SIDE)), uvec2(VIRTUAL_SHADOW_PAGES_PER_SIDE - 1u));
+    return page.y * VIRTUAL_SHADOW_PAGES_PER_SIDE + page.x;
+}
+
+#endif
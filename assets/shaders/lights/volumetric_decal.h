@@ -70,7 +70,7 @@ void apply_volumetric_decals(inout mediump vec4 base_color,
 			mediump vec4 decal_color;
 			// Ideally, quad any.
 			if (subgroupAny(in_range))
-				decal_color = texture(nonuniformEXT(sampler2D(TexDecals[cluster.decals_texture_offset + index], LinearGeometrySampler)), uvw.xy + 0.5);
+				decal_color = texture(nonuniformEXT(sampler2D(TexDecals[cluster.decals_texture_offset + cluster_transforms.decal_texture_index[index]], LinearGeometrySampler)), uvw.xy + 0.5);
 
 			if (in_range)
 				base_color = mix(base_color, decal_color, decal_color.a);
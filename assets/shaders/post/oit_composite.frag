@@ -0,0 +1,16 @@
+#version 450
+layout(location = 0) out vec4 FragColor;
+layout(set = 0, binding = 0) uniform sampler2D uAccum;
+layout(set = 0, binding = 1) uniform sampler2D uWeight;
+
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(uAccum, coord, 0);
+    float revealage = accum.a;
+    if (revealage >= 1.0)
+        discard;
+
+    float weight = texelFetch(uWeight, coord, 0).x;
+    FragColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);
+}
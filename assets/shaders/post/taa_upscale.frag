@@ -0,0 +1,109 @@
+#version 450
+precision highp float;
+precision highp int;
+
+#define REPROJECTION_CUBIC_HISTORY 1
+#define REPROJECTION_CLAMP_METHOD REPROJECTION_CLAMP_METHOD_AABB
+#define NEIGHBOR_METHOD NEIGHBOR_METHOD_VARIANCE
+#define NEAREST_METHOD NEAREST_METHOD_3x3
+
+layout(set = 0, binding = 0) uniform mediump sampler2D CurrentFrame;
+#if REPROJECTION_HISTORY
+layout(set = 0, binding = 1) uniform sampler2D CurrentDepth;
+layout(set = 0, binding = 2) uniform sampler2D MVs;
+layout(set = 0, binding = 3) uniform mediump sampler2D PreviousFrame;
+layout(set = 0, binding = 4) uniform sampler2D PreviousDepth;
+#endif
+
+#include "reprojection.h"
+
+layout(std430, push_constant) uniform Registers
+{
+    mat4 reproj;
+    vec4 rt_metrics;
+    vec4 input_metrics;
+    vec4 inv_z_transform;
+    vec2 jitter_uv;
+    float upscale_ratio;
+} registers;
+
+layout(location = 0) in vec2 vUV;
+layout(location = 0) out mediump vec3 Color;
+layout(location = 1) out mediump vec3 HistoryColor;
+
+float linearize_depth(float z)
+{
+    vec2 zw = z * registers.inv_z_transform.xy + registers.inv_z_transform.zw;
+    return -zw.x / zw.y;
+}
+
+void main()
+{
+    // The input was rendered with a jittered projection, find the input sample closest to this output pixel.
+    vec2 input_pos = (vUV + registers.jitter_uv) * registers.input_metrics.zw;
+    vec2 input_texel = floor(input_pos);
+    vec2 input_uv = (input_texel + 0.5) * registers.input_metrics.xy;
+    vec2 sample_offset = (input_pos - input_texel - 0.5) * registers.upscale_ratio;
+    mediump float sample_weight = exp(-2.0 * dot(sample_offset, sample_offset));
+
+    mediump vec3 current = SAMPLE_CURRENT(CurrentFrame, input_uv, 0, 0);
+    mediump vec3 current_filtered = SAMPLE_CURRENT(CurrentFrame, vUV + registers.jitter_uv, 0, 0);
+
+#if REPROJECTION_HISTORY
+    vec3 MV_d = sample_nearest_velocity(CurrentDepth, MVs, input_uv, registers.input_metrics.xy);
+    vec2 oldUV;
+
+    vec4 clip = vec4(2.0 * vUV - 1.0, MV_d.z, 1.0);
+    vec4 reproj_pos = registers.reproj * clip;
+    bool camera_motion = all(equal(MV_d.xy, vec2(0.0)));
+
+    if (camera_motion)
+    {
+        // Closest depth sample did not have explicit motion, reproject from camera.
+        oldUV = reproj_pos.xy / reproj_pos.w;
+        MV_d.xy = vUV - oldUV;
+    }
+    else
+        oldUV = vUV - MV_d.xy;
+
+    bool disoccluded = any(notEqual(clamp(oldUV, vec2(0.0), vec2(1.0)), oldUV));
+
+    // If last frame had something clearly in front of where this surface was, the history belongs to another surface.
+    // Only static geometry can be tested, we do not know the previous depth of moving objects.
+    if (camera_motion && !disoccluded)
+    {
+        float expected_depth = linearize_depth(reproj_pos.z / reproj_pos.w);
+        float previous_depth = linearize_depth(textureLod(PreviousDepth, oldUV, 0.0).x);
+        disoccluded = previous_depth < 0.95 * expected_depth;
+    }
+
+    #if REPROJECTION_CUBIC_HISTORY
+        mediump vec3 history_color = sample_catmull_rom(PreviousFrame, oldUV, registers.rt_metrics);
+    #else
+        mediump vec3 history_color = textureLod(PreviousFrame, oldUV, 0.0).rgb;
+    #endif
+
+    mediump float MV_length = length(MV_d.xy);
+    mediump float MV_fast = min(MV_length * 50.0, 1.0);
+    mediump float gamma = mix(1.5, 0.5, MV_fast);
+
+    history_color = clamp(history_color, vec3(0.0, -1.0, -1.0), vec3(1.0));
+    history_color = clamp_history_box(history_color, CurrentFrame, input_uv, current, gamma);
+
+    // An output pixel only gets a close input sample every few frames, so weigh the new sample by how close it is.
+    mediump float lerp_factor = (1.0 + 2.0 * MV_fast) / 16.0;
+    mediump float blend = clamp(lerp_factor * sample_weight * registers.upscale_ratio * registers.upscale_ratio, 0.0, 1.0);
+
+    mediump vec3 out_color;
+    if (disoccluded)
+        out_color = current_filtered;
+    else
+        out_color = mix(history_color, current, blend);
+
+    HistoryColor = out_color;
+    Color = TAAToHDRColorSpace(out_color);
+#else
+    Color = TAAToHDRColorSpace(current_filtered);
+    HistoryColor = current_filtered;
+#endif
+}
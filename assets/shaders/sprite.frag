@@ -104,6 +104,12 @@ void main()
         color = vec4(1.0, 1.0, 1.0, color.r);
     #endif
 
+    #if defined(VARIANT_BIT_6) && VARIANT_BIT_6
+        // Signed distance field glyphs, the outline is at 0.5.
+        mediump float edge_width = max(fwidth(color.r), 1.0 / 255.0);
+        color = vec4(1.0, 1.0, 1.0, smoothstep(0.5 - edge_width, 0.5 + edge_width, color.r));
+    #endif
+
     #if defined(ALPHA_TEST)
         if (color.a < 0.5)
             discard;
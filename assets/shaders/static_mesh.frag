@@ -42,6 +42,15 @@ layout(location = 3) in mediump vec4 vTangent;
 layout(location = 4) in mediump vec4 vColor;
 #endif
 
+#if defined(BINDLESS_MATERIAL)
+#include "inc/bindless_material.h"
+#define uBaseColormap bindless_material_texture(0)
+#define uNormalmap bindless_material_texture(1)
+#define uMetallicRoughnessmap bindless_material_texture(2)
+#define uOcclusionMap bindless_material_texture(3)
+#define uEmissiveMap bindless_material_texture(4)
+#define registers bindless_material
+#else
 #if defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP
 layout(set = 2, binding = 0) uniform mediump sampler2D uBaseColormap;
 #endif
@@ -70,6 +79,7 @@ layout(std430, push_constant) uniform Constants
     float metallic;
     float normal_scale;
 } registers;
+#endif
 
 #include "inc/render_target.h"
 
@@ -52,7 +52,12 @@ layout(location = 4) in mediump uvec4 BoneIndices;
 layout(location = 5) in mediump vec4 BoneWeights;
 #endif
 
-#if HAVE_BONE_INDEX && HAVE_BONE_WEIGHT
+#if defined(CACHED_SKINNING)
+// Vertices were already skinned to world space by ComputeSkinning.
+#if defined(RENDERER_MOTION_VECTOR)
+layout(location = 7) in highp vec3 PrevPosition;
+#endif
+#elif HAVE_BONE_INDEX && HAVE_BONE_WEIGHT
 layout(std140, set = 3, binding = 1) uniform BonesWorld
 {
     mat4 CurrentBoneWorldTransforms[256];
@@ -70,22 +75,40 @@ struct StaticMeshInfo
     mat4 Model;
 };
 
+#if defined(INDIRECT_INSTANCES) || defined(STORAGE_INSTANCES)
+// With INDIRECT_INSTANCES, gl_InstanceIndex is the instance index baked into firstInstance by GPU culling.
+// With STORAGE_INSTANCES, a single draw reads all of its instances from a transient storage buffer.
+layout(set = 3, binding = 0, std430) readonly buffer PerVertexData
+{
+    StaticMeshInfo CurrentInfos[];
+};
+#else
 layout(set = 3, binding = 0, std140) uniform PerVertexData
 {
     StaticMeshInfo CurrentInfos[256];
 };
+#endif
 
 #if defined(RENDERER_MOTION_VECTOR)
+#if defined(STORAGE_INSTANCES)
+layout(set = 3, binding = 2, std430) readonly buffer PerVertexDataPrev
+{
+    StaticMeshInfo PrevInfos[];
+};
+#else
 layout(set = 3, binding = 2, std140) uniform PerVertexDataPrev
 {
     StaticMeshInfo PrevInfos[256];
 };
 #endif
 #endif
+#endif
 
 invariant gl_Position;
 
-#if HAVE_BONE_INDEX && HAVE_BONE_WEIGHT
+#if defined(CACHED_SKINNING)
+#define MODEL_VIEW_TRANSFORM(prefix) mat4x3(1.0)
+#elif HAVE_BONE_INDEX && HAVE_BONE_WEIGHT
 #define MODEL_VIEW_TRANSFORM(prefix) \
     mat4x3( \
         prefix##BoneWorldTransforms[BoneIndices.x][0].xyz * BoneWeights.x + \
@@ -119,7 +142,11 @@ void main()
     vec3 World = WorldTransform * vec4(Position, 1.0);
 
 #if defined(RENDERER_MOTION_VECTOR)
+#if defined(CACHED_SKINNING)
+    vec3 OldWorld = PrevPosition;
+#else
     vec3 OldWorld = MODEL_VIEW_TRANSFORM(Prev) * vec4(Position, 1.0);
+#endif
     vOldClip = (global.unjittered_prev_view_projection * vec4(OldWorld, 1.0)).xyw;
     vNewClip = (global.unjittered_view_projection * vec4(World, 1.0)).xyw;
 #endif
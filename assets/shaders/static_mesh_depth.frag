@@ -17,8 +17,13 @@ layout(location = 1) in highp vec2 vUV;
 #endif
 
 #if (defined(HAVE_BASECOLORMAP) && HAVE_BASECOLORMAP) && defined(ALPHA_TEST)
+#if defined(BINDLESS_MATERIAL)
+#include "inc/bindless_material.h"
+#define uBaseColormap bindless_material_texture(0)
+#else
 layout(set = 2, binding = 0) uniform mediump sampler2D uBaseColormap;
 #endif
+#endif
 
 #if defined(ALPHA_TEST_ALPHA_TO_COVERAGE)
 layout(location = 0) out highp vec4 FragColor;
@@ -69,6 +69,11 @@ void Backend::heartbeat()
 {
 }
 
+bool Backend::get_stats(BackendStats &)
+{
+	return false;
+}
+
 bool Backend::get_buffer_status(size_t &, size_t &, uint32_t &)
 {
 	return false;
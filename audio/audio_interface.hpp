@@ -44,6 +44,22 @@ public:
 	virtual void set_latency_usec(uint32_t usec) = 0;
 };
 
+struct BackendStats
+{
+	enum { NumHistogramBuckets = 16 };
+
+	uint64_t num_callbacks = 0;
+	uint64_t num_underruns = 0;
+	// Callbacks which took more than 75% of the audio they rendered.
+	uint64_t num_late_callbacks = 0;
+	uint32_t buffer_frames = 0;
+	uint32_t max_callback_usec = 0;
+	bool adaptive = false;
+
+	// Bucket i counts callbacks which took [2^i, 2^(i + 1)) microseconds, the last bucket is open-ended.
+	uint64_t callback_usec_histogram[NumHistogramBuckets] = {};
+};
+
 class Backend : public BackendInterface
 {
 public:
@@ -67,6 +83,9 @@ public:
 	// Call periodically, used for automatic recovery for backends which need it.
 	virtual void heartbeat();
 
+	// Callback timing and underruns. Returns false if the backend does not track them.
+	virtual bool get_stats(BackendStats &stats);
+
 protected:
 	BackendCallback *callback = nullptr;
 };
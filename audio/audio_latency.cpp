@@ -0,0 +1,155 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_latency.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+namespace Granite
+{
+namespace Audio
+{
+void LatencyController::init(float sample_rate_, uint32_t min_frames_, uint32_t max_frames_,
+                             uint32_t default_frames, uint32_t granularity_)
+{
+	sample_rate = sample_rate_;
+	granularity = std::max(granularity_, 1u);
+	min_frames = align(min_frames_);
+	max_frames = std::max(min_frames, max_frames_);
+
+	const char *env = getenv("GRANITE_AUDIO_ADAPTIVE_LATENCY");
+	adaptive = env && strtoul(env, nullptr, 0) != 0;
+
+	uint32_t frames = adaptive ? min_frames : std::min(std::max(default_frames, min_frames), max_frames);
+	buffer_frames.store(frames, std::memory_order_relaxed);
+	if (adaptive)
+		LOGI("Audio: adaptive latency, starting at %u frames.\n", frames);
+
+	num_callbacks.store(0, std::memory_order_relaxed);
+	num_underruns.store(0, std::memory_order_relaxed);
+	num_late_callbacks.store(0, std::memory_order_relaxed);
+	max_callback_usec.store(0, std::memory_order_relaxed);
+	for (auto &h : histogram)
+		h.store(0, std::memory_order_relaxed);
+
+	stable_frames = 0;
+	// Wait a few seconds of clean playback before trying to shrink.
+	stable_frames_to_shrink = uint64_t(sample_rate * 5.0f);
+	last_bad_frames = 0;
+	pending_grow = false;
+}
+
+uint32_t LatencyController::align(uint32_t frames) const noexcept
+{
+	return ((frames + granularity - 1) / granularity) * granularity;
+}
+
+void LatencyController::begin_callback() noexcept
+{
+	callback_start_ns = Util::get_current_time_nsecs();
+}
+
+void LatencyController::end_callback(size_t num_frames) noexcept
+{
+	auto usec = uint32_t((Util::get_current_time_nsecs() - callback_start_ns) / 1000);
+
+	unsigned bucket = 0;
+	while (bucket + 1 < BackendStats::NumHistogramBuckets && (usec >> (bucket + 1)) != 0)
+		bucket++;
+	histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+	num_callbacks.fetch_add(1, std::memory_order_relaxed);
+
+	if (usec > max_callback_usec.load(std::memory_order_relaxed))
+		max_callback_usec.store(usec, std::memory_order_relaxed);
+
+	// Close to the deadline, a small hiccup would underrun.
+	double budget_usec = double(num_frames) * 1e6 / double(sample_rate);
+	if (double(usec) > 0.75 * budget_usec)
+	{
+		num_late_callbacks.fetch_add(1, std::memory_order_relaxed);
+		pending_grow = true;
+	}
+	else
+		stable_frames += num_frames;
+}
+
+void LatencyController::record_underruns(uint32_t count) noexcept
+{
+	if (!count)
+		return;
+	num_underruns.fetch_add(count, std::memory_order_relaxed);
+	pending_grow = true;
+}
+
+bool LatencyController::update(uint32_t &new_frames) noexcept
+{
+	if (!adaptive)
+	{
+		pending_grow = false;
+		return false;
+	}
+
+	uint32_t frames = buffer_frames.load(std::memory_order_relaxed);
+	uint32_t target = frames;
+
+	if (pending_grow)
+	{
+		last_bad_frames = std::max(last_bad_frames, frames);
+		target = std::min(align(frames + std::max(frames / 2, granularity)), max_frames);
+		stable_frames = 0;
+		pending_grow = false;
+	}
+	else if (stable_frames >= stable_frames_to_shrink)
+	{
+		// Don't go back down to a size which has already failed.
+		uint32_t floor_frames = last_bad_frames ? align(last_bad_frames + granularity) : min_frames;
+		floor_frames = std::max(floor_frames, min_frames);
+		uint32_t shrink = std::max(frames / 8u, granularity);
+		if (frames > floor_frames)
+			target = std::max(align(frames - std::min(shrink, frames)), floor_frames);
+		stable_frames = 0;
+	}
+
+	if (target == frames)
+		return false;
+
+	buffer_frames.store(target, std::memory_order_relaxed);
+	new_frames = target;
+	return true;
+}
+
+void LatencyController::get_stats(BackendStats &stats) const
+{
+	stats.num_callbacks = num_callbacks.load(std::memory_order_relaxed);
+	stats.num_underruns = num_underruns.load(std::memory_order_relaxed);
+	stats.num_late_callbacks = num_late_callbacks.load(std::memory_order_relaxed);
+	stats.buffer_frames = buffer_frames.load(std::memory_order_relaxed);
+	stats.max_callback_usec = max_callback_usec.load(std::memory_order_relaxed);
+	stats.adaptive = adaptive;
+	for (unsigned i = 0; i < BackendStats::NumHistogramBuckets; i++)
+		stats.callback_usec_histogram[i] = histogram[i].load(std::memory_order_relaxed);
+}
+}
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_interface.hpp"
+#include <atomic>
+#include <stdint.h>
+
+namespace Granite
+{
+namespace Audio
+{
+// Shared buffer sizing for the backends.
+// In adaptive mode (GRANITE_AUDIO_ADAPTIVE_LATENCY=1) the buffer starts at the device minimum,
+// grows on underruns or late callbacks and slowly shrinks back after a stable period.
+// Otherwise the default size is kept and only statistics are gathered.
+class LatencyController
+{
+public:
+	// Sizes are in frames. Buffer sizes are kept a multiple of granularity.
+	void init(float sample_rate, uint32_t min_frames, uint32_t max_frames,
+	          uint32_t default_frames, uint32_t granularity);
+
+	bool is_adaptive() const
+	{
+		return adaptive;
+	}
+
+	uint32_t get_buffer_frames() const
+	{
+		return buffer_frames.load(std::memory_order_relaxed);
+	}
+
+	// Audio thread. Brackets the work done for one backend callback.
+	void begin_callback() noexcept;
+	void end_callback(size_t num_frames) noexcept;
+	void record_underruns(uint32_t count) noexcept;
+
+	// Audio thread. Returns true if the backend should resize its buffer to new_frames.
+	bool update(uint32_t &new_frames) noexcept;
+
+	// Any thread.
+	void get_stats(BackendStats &stats) const;
+
+private:
+	bool adaptive = false;
+	float sample_rate = 0.0f;
+	uint32_t min_frames = 0;
+	uint32_t max_frames = 0;
+	uint32_t granularity = 1;
+
+	std::atomic<uint32_t> buffer_frames;
+	std::atomic<uint64_t> num_callbacks;
+	std::atomic<uint64_t> num_underruns;
+	std::atomic<uint64_t> num_late_callbacks;
+	std::atomic<uint32_t> max_callback_usec;
+	std::atomic<uint64_t> histogram[BackendStats::NumHistogramBuckets];
+
+	// Owned by the audio thread.
+	int64_t callback_start_ns = 0;
+	uint64_t stable_frames = 0;
+	uint64_t stable_frames_to_shrink = 0;
+	uint32_t last_bad_frames = 0;
+	bool pending_grow = false;
+
+	uint32_t align(uint32_t frames) const noexcept;
+};
+}
+}
@@ -27,7 +27,9 @@
 #include "logging.hpp"
 #include "bitops.hpp"
 #include <string.h>
+#include <stdlib.h>
 #include <cmath>
+#include <algorithm>
 
 using namespace std;
 
@@ -46,12 +48,26 @@ void MixerStream::install_message_queue(StreamID id, Util::LockFreeMessageQueue
 	message_queue = queue;
 }
 
+size_t MixerStream::skip_samples(float *const *scratch, size_t num_frames) noexcept
+{
+	const float gains[Backend::MaxAudioChannels] = {};
+	return accumulate_samples(scratch, gains, num_frames);
+}
+
 void Mixer::set_backend_parameters(float sample_rate_, unsigned channels_, size_t max_num_samples_)
 {
 	max_num_samples = max_num_samples_;
 	sample_rate = sample_rate_;
 	num_channels = channels_;
 	inv_sample_rate = 1.0 / sample_rate;
+
+	for (auto &buffer : skip_buffer)
+		buffer.clear();
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		skip_buffer[c].resize(max_num_samples);
+		skip_channels[c] = skip_buffer[c].data();
+	}
 }
 
 void Mixer::on_backend_start()
@@ -102,9 +118,19 @@ Mixer::Mixer()
 		pan = f32_to_u32(0.0f);
 	for (auto &gain : gain_linear)
 		gain = f32_to_u32(1.0f);
+	for (auto &att : attenuation)
+		att = f32_to_u32(1.0f);
 	for (auto &active : active_channel_mask)
 		active = 0;
 	latency = 0;
+
+	unsigned max_voices = DefaultMaxMixedVoices;
+	if (const char *env = getenv("GRANITE_AUDIO_MAX_VOICES"))
+	{
+		max_voices = unsigned(strtoul(env, nullptr, 0));
+		LOGI("Mixing at most %u voices.\n", max_voices);
+	}
+	max_mixed_voices = max_voices;
 }
 
 void Mixer::on_backend_stop()
@@ -197,68 +223,102 @@ void Mixer::update_stream_play_cursor(unsigned index, double new_latency) noexce
 		stream_adjusted_play_cursors_usec[index].store(t_usec, memory_order_release);
 }
 
+size_t Mixer::mix_voice(float *const *channels, unsigned index, size_t num_frames) noexcept
+{
+	float gains[Backend::MaxAudioChannels];
+	float gain = u32_to_f32(gain_linear[index].load(memory_order_relaxed)) *
+	             u32_to_f32(attenuation[index].load(memory_order_relaxed));
+	float pan = u32_to_f32(panning[index].load(memory_order_relaxed));
+
+	if (num_channels != 2)
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			gains[c] = gain;
+	}
+	else
+	{
+		gains[0] = gain * saturate(1.0f - pan);
+		gains[1] = gain * saturate(1.0f + pan);
+	}
+
+#ifdef AUDIO_MIXER_DEBUG
+	auto start_time = Util::get_current_time_nsecs();
+#endif
+
+	size_t got = mixer_streams[index]->accumulate_samples(channels, gains, num_frames);
+
+#ifdef AUDIO_MIXER_DEBUG
+	auto end_time = Util::get_current_time_nsecs();
+	emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[index]->get_stream_id(),
+	                                                          1e-9 * (end_time - start_time), got);
+#endif
+
+	return got;
+}
+
 void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 {
 	for (unsigned c = 0; c < num_channels; c++)
 		memset(channels[c], 0, num_frames * sizeof(float));
-	float gains[Backend::MaxAudioChannels];
 
 	auto current_latency = double(latency.load(memory_order_acquire)) * 1e-6;
 
+	// Gather every playing voice and how audible it is.
 	constexpr unsigned iter = MaxSources / 32;
+	unsigned num_voices = 0;
 	for (unsigned i = 0; i < iter; i++)
 	{
 		uint32_t active_mask = active_channel_mask[i].load(memory_order_acquire);
-		if (!active_mask)
-			continue;
-
-		uint32_t dead_mask = 0;
-
 		Util::for_each_bit(active_mask, [&](unsigned bit) {
 			unsigned index = bit + 32 * i;
 			if (!stream_playing[index].load(memory_order_acquire))
 				return;
 
-			float gain = u32_to_f32(gain_linear[index].load(memory_order_relaxed));
-			float pan = u32_to_f32(panning[index].load(memory_order_relaxed));
-
-			if (num_channels != 2)
-			{
-				for (unsigned c = 0; c < num_channels; c++)
-					gains[c] = gain;
-			}
-			else
-			{
-				gains[0] = gain * saturate(1.0f - pan);
-				gains[1] = gain * saturate(1.0f + pan);
-			}
-
-#ifdef AUDIO_MIXER_DEBUG
-			auto start_time = Util::get_current_time_nsecs();
-#endif
-
-			size_t got = mixer_streams[index]->accumulate_samples(channels, gains, num_frames);
+			float audibility = u32_to_f32(gain_linear[index].load(memory_order_relaxed)) *
+			                   u32_to_f32(attenuation[index].load(memory_order_relaxed));
+			// Bias towards voices which were mixed last time, so voices close in audibility do not flap.
+			if (stream_mixed[index])
+				audibility *= 2.0f;
+			voices[num_voices++] = { audibility, index };
+		});
+	}
 
-#ifdef AUDIO_MIXER_DEBUG
-			auto end_time = Util::get_current_time_nsecs();
-			emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[index]->get_stream_id(),
-			                                                          1e-9 * (end_time - start_time), got);
+	unsigned num_mixed = std::min(num_voices, max_mixed_voices.load(memory_order_relaxed));
+	if (num_mixed < num_voices)
+	{
+		std::nth_element(voices, voices + num_mixed, voices + num_voices, [](const Voice &a, const Voice &b) {
+			return a.audibility > b.audibility;
+		});
+	}
 
-#endif
+	uint32_t dead_masks[iter] = {};
+	for (unsigned i = 0; i < num_voices; i++)
+	{
+		unsigned index = voices[i].index;
 
-			stream_raw_play_cursors[index] += got;
-			update_stream_play_cursor(index, current_latency);
+		// Silent voices are never worth decoding.
+		bool mixed = i < num_mixed && voices[i].audibility > 0.0f;
+		size_t got;
+		if (mixed)
+			got = mix_voice(channels, index, num_frames);
+		else
+			got = mixer_streams[index]->skip_samples(skip_channels, num_frames);
+		stream_mixed[index] = mixed;
 
-			if (got < num_frames)
-			{
-				dead_mask |= 1u << bit;
-				emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, bit + 32 * i);
-			}
-		});
+		stream_raw_play_cursors[index] += got;
+		update_stream_play_cursor(index, current_latency);
 
-		active_channel_mask[i].fetch_and(~dead_mask, memory_order_release);
+		if (got < num_frames)
+		{
+			dead_masks[index / 32] |= 1u << (index & 31);
+			emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, index);
+		}
 	}
 
+	for (unsigned i = 0; i < iter; i++)
+		if (dead_masks[i])
+			active_channel_mask[i].fetch_and(~dead_masks[i], memory_order_release);
+
 #ifdef AUDIO_MIXER_DEBUG
 	// Pump audio data to the event queue, so applications can monitor the audio backend visually :3
 	for (unsigned c = 0; c < num_channels; c++)
@@ -320,6 +380,8 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 		stream_adjusted_play_cursors_usec[index].store(0, memory_order_relaxed);
 		gain_linear[index].store(f32_to_u32(std::pow(10.0f, initial_gain_db / 20.0f)), memory_order_relaxed);
 		panning[index].store(f32_to_u32(initial_panning), memory_order_relaxed);
+		attenuation[index].store(f32_to_u32(1.0f), memory_order_relaxed);
+		stream_mixed[index] = false;
 		stream_playing[index].store(start_playing, memory_order_relaxed);
 
 		// Kick mixer thread.
@@ -389,6 +451,21 @@ void Mixer::set_stream_mixer_parameters(StreamID id, float new_gain_db, float ne
 	panning[index].store(f32_to_u32(new_panning), memory_order_release);
 }
 
+void Mixer::set_stream_attenuation(StreamID id, float new_attenuation)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id))
+		return;
+
+	unsigned index = get_stream_index(id);
+	attenuation[index].store(f32_to_u32(new_attenuation), memory_order_release);
+}
+
+void Mixer::set_max_mixed_voices(unsigned count)
+{
+	max_mixed_voices.store(count, memory_order_relaxed);
+}
+
 void Mixer::event_start(EventManagerInterface &iface)
 {
 	static_cast<EventManager &>(iface).enqueue_latched<MixerStartEvent>(*this);
@@ -59,6 +59,11 @@ public:
 	// Must increment.
 	virtual size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept = 0;
 
+	// Advances the stream without producing audio, used when the mixer virtualizes a voice.
+	// Returns frames skipped like accumulate_samples. scratch holds at least num_frames per channel.
+	// The default implementation decodes into scratch with zero gain.
+	virtual size_t skip_samples(float * const *scratch, size_t num_frames) noexcept;
+
 	virtual unsigned get_num_channels() const = 0;
 	virtual float get_sample_rate() const = 0;
 
@@ -101,6 +106,14 @@ public:
 	// Panning is -1 (left), 0 (center), 1 (right).
 	void set_stream_mixer_parameters(StreamID id, float new_gain_db, float new_panning);
 
+	// Linear attenuation on top of gain, e.g. from distance or occlusion.
+	// Gain times attenuation decides which voices are audible enough to be mixed.
+	void set_stream_attenuation(StreamID id, float new_attenuation);
+
+	// Only the N most audible playing streams are decoded and mixed, the rest only advance their cursors.
+	// Defaults to 64, can be overridden with GRANITE_AUDIO_MAX_VOICES.
+	void set_max_mixed_voices(unsigned count);
+
 	// Returns latency-adjusted play cursor in seconds from add_mixer_stream.
 	// The play cursor monotonically increases.
 	// Returns a negative number if the stream no longer exists.
@@ -126,19 +139,32 @@ public:
 	void set_latency_usec(uint32_t usec) override;
 
 private:
-	enum { MaxSources = 128 };
+	enum { MaxSources = 4096, DefaultMaxMixedVoices = 64 };
 	std::atomic<uint32_t> active_channel_mask[MaxSources / 32];
 	MixerStream *mixer_streams[MaxSources] = {};
 
 	// Actually float, bitcasted.
 	std::atomic<uint32_t> panning[MaxSources];
 	std::atomic<uint32_t> gain_linear[MaxSources];
+	std::atomic<uint32_t> attenuation[MaxSources];
 	std::atomic<uint32_t> latency;
 	std::atomic<bool> stream_playing[MaxSources];
 
 	uint64_t stream_raw_play_cursors[MaxSources];
 	std::atomic<uint64_t> stream_adjusted_play_cursors_usec[MaxSources];
 
+	// Owned by the mixer thread.
+	struct Voice
+	{
+		float audibility;
+		unsigned index;
+	};
+	Voice voices[MaxSources];
+	bool stream_mixed[MaxSources] = {};
+	std::atomic<uint32_t> max_mixed_voices;
+	std::vector<float> skip_buffer[Backend::MaxAudioChannels];
+	float *skip_channels[Backend::MaxAudioChannels] = {};
+
 	uint64_t stream_generation[MaxSources] = {};
 	std::mutex non_critical_lock;
 
@@ -154,6 +180,7 @@ private:
 	bool is_active = false;
 
 	void update_stream_play_cursor(unsigned index, double new_latency) noexcept;
+	size_t mix_voice(float * const *channels, unsigned index, size_t num_frames) noexcept;
 
 	Util::LockFreeMessageQueue message_queue;
 
@@ -21,6 +21,7 @@
  */
 
 #include "audio_oboe.hpp"
+#include "audio_latency.hpp"
 #include "dsp/dsp.hpp"
 #include "logging.hpp"
 #include "oboe/Oboe.h"
@@ -78,6 +79,7 @@ struct OboeBackend final : Backend, oboe::AudioStreamCallback
 
 	bool get_buffer_status(size_t &write_avail, size_t &max_write_avail, uint32_t &latency_usec) override;
 	size_t write_frames_interleaved(const float *data, size_t num_frames, bool blocking) override;
+	bool get_stats(BackendStats &stats) override;
 
 	oboe::AudioStream *stream = nullptr;
 	std::vector<float> mix_buffers[Backend::MaxAudioChannels];
@@ -93,6 +95,7 @@ struct OboeBackend final : Backend, oboe::AudioStreamCallback
 
 	double last_latency = 0.0;
 	uint32_t last_latency_usec = 0;
+	LatencyController latency_controller;
 
 	oboe::DataCallbackResult onAudioReady(oboe::AudioStream *oboe_stream,
 	                                      void *audio_data,
@@ -193,20 +196,17 @@ bool OboeBackend::init(float, unsigned channels)
 	num_channels = unsigned(stream->getChannelCount());
 	format = stream->getFormat();
 
-	// Aim for roughly 50ms latency.
-	const auto align = [](int32_t a, int32_t b) {
-		return ((a + b - 1) / b) * b;
-	};
-	auto target_frames = int32_t(sample_rate * 0.050f);
+	// Aim for roughly 50ms latency, and at least two bursts.
+	// Adaptive mode starts from a single burst like Oboe's own latency tuner.
 	int32_t frames_per_burst = stream->getFramesPerBurst();
 	LOGI("Oboe: Frames per burst: %d.\n", frames_per_burst);
-	target_frames = align(target_frames, frames_per_burst);
-	// Aim for at least two bursts.
-	target_frames = std::max(target_frames, frames_per_burst * 2);
-
 	auto max_frames = stream->getBufferCapacityInFrames();
 	LOGI("Oboe: Max frames: %d.\n", max_frames);
-	target_frames = std::min(target_frames, max_frames);
+
+	latency_controller.init(sample_rate, uint32_t(frames_per_burst), uint32_t(max_frames),
+	                        std::max(uint32_t(sample_rate * 0.050f), uint32_t(frames_per_burst * 2)),
+	                        uint32_t(frames_per_burst));
+	auto target_frames = int32_t(latency_controller.get_buffer_frames());
 	LOGI("Oboe: Aiming for %d frames.\n", target_frames);
 	auto result = stream->setBufferSizeInFrames(target_frames);
 	if (!result)
@@ -273,6 +273,7 @@ void OboeBackend::update_xrun(oboe::AudioStream *s)
 		if (underrun_count > old_underrun_count)
 		{
 			LOGW("Oboe: observed %d new underruns.", underrun_count - old_underrun_count);
+			latency_controller.record_underruns(uint32_t(underrun_count - old_underrun_count));
 			old_underrun_count = underrun_count;
 		}
 	}
@@ -346,6 +347,9 @@ oboe::DataCallbackResult OboeBackend::onAudioReady(
 	} u;
 	u.data = audio_data;
 
+	latency_controller.begin_callback();
+	auto total_frames = size_t(num_frames);
+
 	// Ideally we'll only run this loop once, but you never know ...
 	while (num_frames)
 	{
@@ -381,9 +385,22 @@ oboe::DataCallbackResult OboeBackend::onAudioReady(
 		num_frames -= to_render;
 	}
 
+	latency_controller.end_callback(total_frames);
+
+	// Oboe allows resizing the buffer from the data callback.
+	uint32_t new_frames;
+	if (latency_controller.update(new_frames))
+		oboe_stream->setBufferSizeInFrames(int32_t(new_frames));
+
 	return oboe::DataCallbackResult::Continue;
 }
 
+bool OboeBackend::get_stats(BackendStats &stats)
+{
+	latency_controller.get_stats(stats);
+	return true;
+}
+
 // Called periodically from the main loop, just in case we need to recover from a device lost.
 void OboeBackend::heartbeat()
 {
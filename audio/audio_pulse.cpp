@@ -21,6 +21,7 @@
  */
 
 #include "audio_pulse.hpp"
+#include "audio_latency.hpp"
 #include <pulse/pulseaudio.h>
 #include "dsp/dsp.hpp"
 #include "logging.hpp"
@@ -48,6 +49,7 @@ struct Pulse final : Backend
 
 	bool get_buffer_status(size_t &write_avail, size_t &write_avail_frames, uint32_t &latency_usec) override;
 	size_t write_frames_interleaved(const float *data, size_t frames, bool blocking) override;
+	bool get_stats(BackendStats &stats) override;
 
 	const char *get_backend_name() override
 	{
@@ -74,8 +76,10 @@ struct Pulse final : Backend
 	int success = -1;
 	bool has_success = false;
 	bool is_active = false;
+	LatencyController latency_controller;
 
 	void update_buffer_attr(const pa_buffer_attr &attr) noexcept;
+	void request_buffer_frames(pa_stream *s, uint32_t frames) noexcept;
 	size_t to_frames(size_t size) const noexcept;
 };
 
@@ -123,6 +127,12 @@ static void stream_state_cb(pa_stream *, void *data)
 	pa_threaded_mainloop_signal(pa->mainloop, 0);
 }
 
+static void stream_underflow_cb(pa_stream *, void *data)
+{
+	auto *pa = static_cast<Pulse *>(data);
+	pa->latency_controller.record_underruns(1);
+}
+
 static void stream_buffer_attr_cb(pa_stream *s, void *data)
 {
 	auto *pa = static_cast<Pulse *>(data);
@@ -196,6 +206,9 @@ static void stream_request_cb(pa_stream *s, size_t length, void *data)
 
 	if (pa->is_active)
 	{
+		pa->latency_controller.begin_callback();
+		size_t total_frames = out_frames;
+
 		while (out_frames != 0)
 		{
 			size_t to_write = std::min<size_t>(out_frames, MAX_NUM_SAMPLES);
@@ -214,6 +227,8 @@ static void stream_request_cb(pa_stream *s, size_t length, void *data)
 						*out_interleaved++ = mix_channels[c][f];
 			}
 		}
+
+		pa->latency_controller.end_callback(total_frames);
 	}
 	else
 		memset(out_interleaved, 0, sizeof(float) * channels * out_frames);
@@ -233,6 +248,23 @@ static void stream_request_cb(pa_stream *s, size_t length, void *data)
 		latency_usec = 0;
 
 	cb->set_latency_usec(uint32_t(latency_usec));
+
+	uint32_t new_frames;
+	if (pa->latency_controller.update(new_frames))
+		pa->request_buffer_frames(s, new_frames);
+}
+
+void Pulse::request_buffer_frames(pa_stream *s, uint32_t frames) noexcept
+{
+	// We're on the mainloop thread, so this is safe without taking the lock.
+	pa_buffer_attr attr = {};
+	attr.maxlength = -1u;
+	attr.tlength = uint32_t(frames * channels * sizeof(float));
+	attr.prebuf = -1u;
+	attr.minreq = -1u;
+	attr.fragsize = -1u;
+	if (auto *op = pa_stream_set_buffer_attr(s, &attr, nullptr, nullptr))
+		pa_operation_unref(op);
 }
 
 size_t Pulse::to_frames(size_t size) const noexcept
@@ -294,10 +326,15 @@ bool Pulse::init(float sample_rate_, unsigned channels_)
 	pa_stream_set_state_callback(stream, stream_state_cb, this);
 	pa_stream_set_write_callback(stream, stream_request_cb, this);
 	pa_stream_set_buffer_attr_callback(stream, stream_buffer_attr_cb, this);
+	pa_stream_set_underflow_callback(stream, stream_underflow_cb, this);
+
+	// 50 ms by default. Adaptive mode starts from two mixer blocks, capping at 200 ms.
+	latency_controller.init(sample_rate_, 2 * MAX_NUM_SAMPLES, uint32_t(sample_rate_ * 0.2f),
+	                        uint32_t(sample_rate_ * 0.05f), MAX_NUM_SAMPLES / 4);
 
 	pa_buffer_attr buffer_attr = {};
 	buffer_attr.maxlength = -1u;
-	buffer_attr.tlength = pa_usec_to_bytes(50000, &spec);
+	buffer_attr.tlength = uint32_t(latency_controller.get_buffer_frames() * channels_ * sizeof(float));
 	buffer_attr.prebuf = -1u;
 	buffer_attr.minreq = -1u;
 	buffer_attr.fragsize = -1u;
@@ -406,6 +443,12 @@ bool Pulse::get_buffer_status(size_t &write_avail, size_t &max_write_avail, uint
 	return true;
 }
 
+bool Pulse::get_stats(BackendStats &stats)
+{
+	latency_controller.get_stats(stats);
+	return true;
+}
+
 Backend *create_pulse_backend(BackendCallback *callback, float sample_rate, unsigned channels)
 {
 	auto *backend = new Pulse(callback);
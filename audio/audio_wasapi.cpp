@@ -32,6 +32,7 @@
 #include <mmdeviceapi.h>
 #include <avrt.h>
 #include "audio_interface.hpp"
+#include "audio_latency.hpp"
 #include "dsp/dsp.hpp"
 #include "logging.hpp"
 
@@ -65,6 +66,7 @@ struct WASAPIBackend final : Backend
 
 	bool get_buffer_status(size_t &write_avail, size_t &write_avail_frames, uint32_t &latency_usec) override;
 	size_t write_frames_interleaved(const float *data, size_t frames, bool blocking) override;
+	bool get_stats(BackendStats &stats) override;
 
 	const char *get_backend_name() override
 	{
@@ -96,6 +98,11 @@ struct WASAPIBackend final : Backend
 	bool is_active = false;
 	HANDLE audio_event = nullptr;
 
+	// The shared mode buffer cannot be resized after Initialize(),
+	// so it is allocated for the worst case and we only keep target_frames of it filled.
+	LatencyController latency_controller;
+	UINT32 target_frames = 0;
+
 	bool kick_start() noexcept;
 
 	bool get_write_avail(UINT32 &avail) noexcept;
@@ -181,8 +188,9 @@ bool WASAPIBackend::init(float, unsigned channels)
 
 	format->nChannels = WORD(channels);
 
-	const double target_latency = 0.050;
-	auto reference_time = seconds_to_reference_time(target_latency);
+	// Room for the largest buffer adaptive mode may grow to.
+	const double max_latency = 0.200;
+	auto reference_time = seconds_to_reference_time(max_latency);
 
 	if (FAILED(pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED,
 	                                    AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
@@ -211,6 +219,18 @@ bool WASAPIBackend::init(float, unsigned channels)
 		return false;
 	}
 
+	// We are woken up once per device period, so at least two periods must be queued.
+	REFERENCE_TIME default_period = 0;
+	if (FAILED(pAudioClient->GetDevicePeriod(&default_period, nullptr)))
+		default_period = seconds_to_reference_time(0.010);
+	auto period_frames = uint32_t(reference_time_to_seconds(default_period) * get_sample_rate() + 0.5);
+	period_frames = std::max(period_frames, 1u);
+
+	latency_controller.init(get_sample_rate(), 2 * period_frames, buffer_frames,
+	                        uint32_t(get_sample_rate() * 0.050f), period_frames / 2);
+	target_frames = latency_controller.get_buffer_frames();
+	buffer_latency_us = get_latency_usec();
+
 	if (callback)
 	{
 		callback->set_latency_usec(buffer_latency_us);
@@ -229,7 +249,7 @@ uint32_t WASAPIBackend::get_latency_usec() noexcept
 	}
 
 	double server_latency = reference_time_to_seconds(latency);
-	server_latency += double(buffer_frames) / get_sample_rate();
+	server_latency += double(target_frames) / get_sample_rate();
 	return uint32_t(server_latency * 1e6);
 }
 
@@ -274,14 +294,16 @@ bool WASAPIBackend::stop()
 
 bool WASAPIBackend::kick_start() noexcept
 {
+	// Only prefill what we intend to keep queued.
+	UINT32 prefill_frames = callback ? target_frames : buffer_frames;
 	BYTE *interleaved = nullptr;
-	if (FAILED(pRenderClient->GetBuffer(buffer_frames, &interleaved)))
+	if (FAILED(pRenderClient->GetBuffer(prefill_frames, &interleaved)))
 	{
 		LOGE("WASAPI: Failed to get buffer (start).\n");
 		return false;
 	}
 
-	if (FAILED(pRenderClient->ReleaseBuffer(buffer_frames, AUDCLNT_BUFFERFLAGS_SILENT)))
+	if (FAILED(pRenderClient->ReleaseBuffer(prefill_frames, AUDCLNT_BUFFERFLAGS_SILENT)))
 	{
 		LOGE("WASAPI: Failed to release buffer (start).\n");
 		return false;
@@ -374,7 +396,12 @@ bool WASAPIBackend::get_write_avail(UINT32 &avail) noexcept
 		return false;
 	}
 
-	avail = buffer_frames - padding;
+	UINT32 limit = callback ? target_frames : buffer_frames;
+	avail = padding < limit ? limit - padding : 0;
+
+	// Woken up with nothing queued, the device ran dry.
+	if (callback && padding == 0 && is_active)
+		latency_controller.record_underruns(1);
 	return true;
 }
 
@@ -440,6 +467,7 @@ void WASAPIBackend::thread_runner() noexcept
 		}
 
 		UINT32 to_release = write_avail;
+		latency_controller.begin_callback();
 
 		while (write_avail != 0)
 		{
@@ -465,6 +493,16 @@ void WASAPIBackend::thread_runner() noexcept
 			LOGE("WASAPI: Failed to release buffer.\n");
 			break;
 		}
+
+		latency_controller.end_callback(to_release);
+
+		uint32_t new_frames;
+		if (latency_controller.update(new_frames))
+		{
+			target_frames = new_frames;
+			buffer_latency_us = get_latency_usec();
+			callback->set_latency_usec(buffer_latency_us);
+		}
 	}
 
 	if (audio_task)
@@ -483,6 +521,12 @@ void WASAPIBackend::thread_runner() noexcept
 	}
 }
 
+bool WASAPIBackend::get_stats(BackendStats &stats)
+{
+	latency_controller.get_stats(stats);
+	return true;
+}
+
 Backend *create_wasapi_backend(BackendCallback *callback, float sample_rate, unsigned channels)
 {
 	auto *backend = new WASAPIBackend(callback);
@@ -0,0 +1,337 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_convolution.hpp"
+#include "dsp/dsp.hpp"
+#include "fft.h"
+#include "simd_headers.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+namespace Granite
+{
+namespace Audio
+{
+namespace DSP
+{
+// accum[i] += a[i] * b[i]
+static void complex_multiply_accumulate(std::complex<float> * __restrict accum,
+                                        const std::complex<float> * __restrict a,
+                                        const std::complex<float> * __restrict b,
+                                        unsigned count) noexcept
+{
+	unsigned i = 0;
+	auto *acc = reinterpret_cast<float *>(accum);
+	auto *fa = reinterpret_cast<const float *>(a);
+	auto *fb = reinterpret_cast<const float *>(b);
+
+#if defined(__SSE__)
+	// The imaginary products need (-, +) in each complex pair, flip the sign of the even lanes.
+	const __m128 sign = _mm_castsi128_ps(_mm_set_epi32(0, int(0x80000000u), 0, int(0x80000000u)));
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128 va = _mm_load_ps(fa + 2 * i);
+		__m128 vb = _mm_load_ps(fb + 2 * i);
+		__m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 a_swap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 prod = _mm_add_ps(_mm_mul_ps(va, b_re), _mm_xor_ps(_mm_mul_ps(a_swap, b_im), sign));
+		_mm_store_ps(acc + 2 * i, _mm_add_ps(_mm_load_ps(acc + 2 * i), prod));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4x2_t va = vld2q_f32(fa + 2 * i);
+		float32x4x2_t vb = vld2q_f32(fb + 2 * i);
+		float32x4x2_t vacc = vld2q_f32(acc + 2 * i);
+		vacc.val[0] = vmlaq_f32(vacc.val[0], va.val[0], vb.val[0]);
+		vacc.val[0] = vmlsq_f32(vacc.val[0], va.val[1], vb.val[1]);
+		vacc.val[1] = vmlaq_f32(vacc.val[1], va.val[0], vb.val[1]);
+		vacc.val[1] = vmlaq_f32(vacc.val[1], va.val[1], vb.val[0]);
+		vst2q_f32(acc + 2 * i, vacc);
+	}
+#endif
+
+	for (; i < count; i++)
+		accum[i] += a[i] * b[i];
+}
+
+static std::complex<float> *allocate_complex(size_t count)
+{
+	return static_cast<std::complex<float> *>(mufft_calloc(count * sizeof(std::complex<float>)));
+}
+
+static float *allocate_float(size_t count)
+{
+	return static_cast<float *>(mufft_calloc(count * sizeof(float)));
+}
+
+PartitionedConvolver::~PartitionedConvolver()
+{
+	if (forward)
+		mufft_free_plan_1d(forward);
+	if (inverse)
+		mufft_free_plan_1d(inverse);
+	mufft_free(filter_spectra);
+	mufft_free(delay_line);
+	mufft_free(accum);
+	mufft_free(window);
+	mufft_free(time_output);
+}
+
+bool PartitionedConvolver::init(const float *const *impulse_responses, unsigned num_outputs_,
+                                size_t ir_length, unsigned block_size_)
+{
+	if (block_size_ < 16 || (block_size_ & (block_size_ - 1)) != 0 || !ir_length || !num_outputs_)
+		return false;
+
+	block_size = block_size_;
+	num_outputs = num_outputs_;
+	num_partitions = unsigned((ir_length + block_size - 1) / block_size);
+
+	// The real FFT has block_size + 1 bins. Pad to an even count so every spectrum stays aligned for SIMD.
+	unsigned fft_size = block_size * 2;
+	num_bins = (block_size + 2) & ~1u;
+
+	forward = mufft_create_plan_1d_r2c(fft_size, MUFFT_FLAG_CPU_ANY);
+	inverse = mufft_create_plan_1d_c2r(fft_size, MUFFT_FLAG_CPU_ANY);
+	if (!forward || !inverse)
+		return false;
+
+	filter_spectra = allocate_complex(size_t(num_outputs) * num_partitions * num_bins);
+	delay_line = allocate_complex(size_t(num_partitions) * num_bins);
+	accum = allocate_complex(num_bins);
+	window = allocate_float(fft_size);
+	time_output = allocate_float(fft_size);
+	if (!filter_spectra || !delay_line || !accum || !window || !time_output)
+		return false;
+
+	// Fold the inverse FFT normalization into the filter.
+	const float normalization = 1.0f / float(fft_size);
+
+	for (unsigned o = 0; o < num_outputs; o++)
+	{
+		for (unsigned p = 0; p < num_partitions; p++)
+		{
+			size_t offset = size_t(p) * block_size;
+			size_t count = std::min<size_t>(block_size, ir_length - offset);
+
+			memset(window, 0, fft_size * sizeof(float));
+			for (size_t i = 0; i < count; i++)
+				window[i] = impulse_responses[o][offset + i] * normalization;
+
+			mufft_execute_plan_1d(forward, filter_spectra + (size_t(o) * num_partitions + p) * num_bins, window);
+		}
+	}
+
+	memset(window, 0, fft_size * sizeof(float));
+	return true;
+}
+
+void PartitionedConvolver::process_block(float *const *outputs, const float *input) noexcept
+{
+	// Overlap-save, the window holds the previous and the current block.
+	memcpy(window, window + block_size, block_size * sizeof(float));
+	memcpy(window + block_size, input, block_size * sizeof(float));
+	mufft_execute_plan_1d(forward, delay_line + size_t(fdl_index) * num_bins, window);
+
+	for (unsigned o = 0; o < num_outputs; o++)
+	{
+		memset(accum, 0, num_bins * sizeof(*accum));
+
+		// Partition p of the filter applies to the input block from p blocks ago.
+		const std::complex<float> *filter = filter_spectra + size_t(o) * num_partitions * num_bins;
+		unsigned index = fdl_index;
+		for (unsigned p = 0; p < num_partitions; p++)
+		{
+			complex_multiply_accumulate(accum, delay_line + size_t(index) * num_bins,
+			                            filter + size_t(p) * num_bins, num_bins);
+			index = index ? index - 1 : num_partitions - 1;
+		}
+
+		// The first half is circular aliasing, the second half is the linear convolution.
+		mufft_execute_plan_1d(inverse, time_output, accum);
+		memcpy(outputs[o], time_output + block_size, block_size * sizeof(float));
+	}
+
+	fdl_index = fdl_index + 1 < num_partitions ? fdl_index + 1 : 0;
+}
+
+class ConvolutionStream : public MixerStream
+{
+public:
+	~ConvolutionStream() override
+	{
+		if (source)
+			source->dispose();
+	}
+
+	bool init(MixerStream *source_, const float *const *impulse_responses, unsigned num_impulse_responses,
+	          size_t ir_length, unsigned block_size_)
+	{
+		source = source_;
+		input_channels = source->get_num_channels();
+		num_channels = num_impulse_responses;
+		block_size = block_size_;
+
+		if (num_channels > Backend::MaxAudioChannels)
+			return false;
+
+		// Spatialize a mono source, or filter every channel on its own.
+		if (input_channels == 1)
+		{
+			convolvers.emplace_back(new PartitionedConvolver);
+			if (!convolvers.back()->init(impulse_responses, num_channels, ir_length, block_size))
+				return false;
+		}
+		else if (input_channels == num_channels)
+		{
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				convolvers.emplace_back(new PartitionedConvolver);
+				if (!convolvers.back()->init(impulse_responses + c, 1, ir_length, block_size))
+					return false;
+			}
+		}
+		else
+		{
+			LOGE("Convolution needs a mono source or one impulse response per channel.\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	void setup(float mixer_output_rate, unsigned, size_t) override
+	{
+		source->setup(mixer_output_rate, input_channels, block_size);
+
+		for (unsigned c = 0; c < input_channels; c++)
+		{
+			input_buffers[c].resize(block_size);
+			input_ptrs[c] = input_buffers[c].data();
+		}
+
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			output_buffers[c].resize(block_size);
+			output_ptrs[c] = output_buffers[c].data();
+		}
+
+		current_read = block_size;
+	}
+
+	// Must increment.
+	size_t accumulate_samples(float *const *channels, const float *gain, size_t num_frames) noexcept override
+	{
+		size_t ret = 0;
+
+		while (num_frames)
+		{
+			if (current_read < block_size)
+			{
+				size_t to_read = std::min<size_t>(num_frames, block_size - current_read);
+				for (unsigned c = 0; c < num_channels; c++)
+					DSP::accumulate_channel(channels[c] + ret, output_ptrs[c] + current_read, gain[c], to_read);
+
+				num_frames -= to_read;
+				current_read += to_read;
+				ret += to_read;
+			}
+			else
+			{
+				// Once the source has ended, keep going until the tail of the impulse response has rung out.
+				if (source_ended && !tail_blocks)
+					break;
+
+				for (unsigned c = 0; c < input_channels; c++)
+					memset(input_ptrs[c], 0, block_size * sizeof(float));
+
+				if (source_ended)
+					tail_blocks--;
+				else if (source->accumulate_samples(input_ptrs, unity_gains, block_size) < block_size)
+				{
+					source_ended = true;
+					tail_blocks = convolvers.front()->get_num_partitions();
+				}
+
+				if (input_channels == 1)
+					convolvers.front()->process_block(output_ptrs, input_ptrs[0]);
+				else
+					for (unsigned c = 0; c < num_channels; c++)
+						convolvers[c]->process_block(output_ptrs + c, input_ptrs[c]);
+
+				current_read = 0;
+			}
+		}
+
+		return ret;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return source->get_sample_rate();
+	}
+
+private:
+	MixerStream *source = nullptr;
+	std::vector<std::unique_ptr<PartitionedConvolver>> convolvers;
+	unsigned input_channels = 0;
+	unsigned num_channels = 0;
+	unsigned block_size = 0;
+	size_t current_read = 0;
+	unsigned tail_blocks = 0;
+	bool source_ended = false;
+
+	std::vector<float> input_buffers[Backend::MaxAudioChannels];
+	std::vector<float> output_buffers[Backend::MaxAudioChannels];
+	float *input_ptrs[Backend::MaxAudioChannels] = {};
+	float *output_ptrs[Backend::MaxAudioChannels] = {};
+	const float unity_gains[Backend::MaxAudioChannels] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+};
+
+MixerStream *create_convolution_stream(MixerStream *source,
+                                       const float *const *impulse_responses, unsigned num_impulse_responses,
+                                       size_t ir_length, unsigned block_size)
+{
+	if (!source)
+		return nullptr;
+
+	auto *conv = new ConvolutionStream;
+	if (!conv->init(source, impulse_responses, num_impulse_responses, ir_length, block_size))
+	{
+		delete conv;
+		return nullptr;
+	}
+	else
+		return conv;
+}
+}
+}
+}
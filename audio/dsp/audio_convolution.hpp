@@ -0,0 +1,92 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_mixer.hpp"
+#include <complex>
+#include <vector>
+
+struct mufft_plan_1d;
+
+namespace Granite
+{
+namespace Audio
+{
+namespace DSP
+{
+// Uniformly partitioned overlap-save convolution.
+// The impulse response is split into block sized partitions which are transformed once up front.
+// Every block of input costs one forward FFT, a complex multiply-accumulate per partition,
+// and one inverse FFT per output, independent of how the work is spread over the partitions.
+// One input feeds num_outputs impulse responses, e.g. left and right ear for HRTF.
+class PartitionedConvolver
+{
+public:
+	PartitionedConvolver() = default;
+	~PartitionedConvolver();
+	PartitionedConvolver(const PartitionedConvolver &) = delete;
+	void operator=(const PartitionedConvolver &) = delete;
+
+	// block_size must be a power of two of at least 16.
+	bool init(const float * const *impulse_responses, unsigned num_outputs, size_t ir_length, unsigned block_size);
+
+	// Consumes block_size input samples and overwrites block_size samples in every output.
+	void process_block(float * const *outputs, const float *input) noexcept;
+
+	unsigned get_block_size() const
+	{
+		return block_size;
+	}
+
+	unsigned get_num_partitions() const
+	{
+		return num_partitions;
+	}
+
+private:
+	mufft_plan_1d *forward = nullptr;
+	mufft_plan_1d *inverse = nullptr;
+	unsigned block_size = 0;
+	unsigned num_bins = 0;
+	unsigned num_partitions = 0;
+	unsigned num_outputs = 0;
+	unsigned fdl_index = 0;
+
+	// Impulse response spectra, [output][partition][bin].
+	std::complex<float> *filter_spectra = nullptr;
+	// Spectra of the most recent input blocks, a ring of num_partitions.
+	std::complex<float> *delay_line = nullptr;
+	std::complex<float> *accum = nullptr;
+	float *window = nullptr;
+	float *time_output = nullptr;
+};
+
+// Convolves source with one impulse response per channel, e.g. for reverb.
+// If source is mono, it is instead spread to one output channel per impulse response, e.g. for HRTF.
+// Impulse responses must be at the sample rate of source. Adds block_size frames of latency.
+MixerStream *create_convolution_stream(MixerStream *source,
+                                       const float * const *impulse_responses, unsigned num_impulse_responses,
+                                       size_t ir_length, unsigned block_size = 256);
+}
+}
+}
@@ -89,6 +89,7 @@
  */
 
 #include "simd_headers.hpp"
+#include "simd_batch.hpp"
 #include "sinc_resampler.hpp"
 #include "aligned_alloc.hpp"
 #include "dsp.hpp"
@@ -96,6 +97,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define SINC_RESAMPLER_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
 #ifndef PI
 #define PI 3.14159265359
 #endif
@@ -148,7 +159,8 @@ void SincResampler::init_table_kaiser(double cutoff, unsigned phase_count, unsig
 	}
 }
 
-SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
+SincResampler::SincResampler(float out_rate, float in_rate, Quality quality, unsigned channels)
+	: num_channels(channels)
 {
 	double cutoff;
 	unsigned sidelobes;
@@ -194,7 +206,7 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 	if (bandwidth_mod < 1.0f)
 	{
 		cutoff *= bandwidth_mod;
-		taps = unsigned(ceil(float(taps) / bandwidth_mod));
+		taps = unsigned(::ceil(float(taps) / bandwidth_mod));
 	}
 
 	/* Be SIMD-friendly. */
@@ -202,7 +214,10 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 
 	unsigned phase_elems = ((1u << phase_bits) * taps);
 	phase_elems = phase_elems * 2;
-	unsigned elems = phase_elems + 2 * taps;
+	window_stride = 2 * taps;
+	unsigned elems = phase_elems + window_stride * num_channels;
+	// aligned_alloc wants the size to be a multiple of the alignment.
+	elems = (elems + 31) & ~31u;
 
 	main_buffer = static_cast<float *>(Util::memalign_calloc(128, sizeof(float) * elems));
 	if (!main_buffer)
@@ -213,12 +228,19 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 
 	init_table_kaiser(cutoff, 1u << phase_bits, taps, kaiser_beta);
 	set_sample_rate_ratio(bandwidth_mod);
+
+#ifdef SINC_RESAMPLER_AVX2
+	if (SIMD::get_batch_isa() >= SIMD::BatchISA::AVX2)
+		kernel = sinc_kernel_avx2;
+	else
+#endif
+		kernel = sinc_kernel_generic;
 }
 
 void SincResampler::set_sample_rate_ratio(float ratio) noexcept
 {
 	phases = 1u << (phase_bits + subphase_bits);
-	fixed_ratio = uint32_t(round(float(phases) / ratio));
+	fixed_ratio = uint32_t(::round(float(phases) / ratio));
 }
 
 SincResampler::~SincResampler()
@@ -249,103 +271,227 @@ size_t SincResampler::get_maximum_output_for_input_frames(size_t in_frames) cons
 	return size_t(max_output_time);
 }
 
-template <bool accumulate>
-inline void SincResampler::process(float *output) const noexcept
+struct SincResampler::KernelArgs
 {
-	const float *buffer = window_buffer + ptr;
-	unsigned num_taps = taps;
-	unsigned phase = time >> subphase_bits;
+	const float *window;
+	unsigned window_stride;
+	unsigned num_channels;
+	const float *phase_table;
+	const float *delta_table;
+	float delta;
+	unsigned taps;
+};
+
+// Every channel sees the same filter phase, so the interpolated filter is computed once
+// per block of taps and applied to up to 4 channels.
+#ifdef __SSE__
+static inline float horizontal_add(__m128 v)
+{
+	v = _mm_add_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 2, 3)), v);
+	v = _mm_add_ss(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), v);
+	return _mm_cvtss_f32(v);
+}
 
-	const float *sample_phase_table = phase_table + phase * num_taps * 2;
-	const float *delta_table = sample_phase_table + num_taps;
+template <unsigned N>
+static inline void sinc_kernel_channels(float *results, const float *window,
+                                        const SincResampler::KernelArgs &args) noexcept
+{
+	__m128 sums[N];
+	for (auto &sum : sums)
+		sum = _mm_setzero_ps();
 
-#ifdef __SSE__
-	__m128 sum = _mm_setzero_ps();
-	__m128 delta = _mm_set1_ps(float(time & subphase_mask) * subphase_mod);
-	for (unsigned i = 0; i < num_taps; i += 4)
+	__m128 delta = _mm_set1_ps(args.delta);
+	for (unsigned i = 0; i < args.taps; i += 4)
 	{
-		__m128 buf = _mm_loadu_ps(buffer + i);
-		__m128 deltas = _mm_load_ps(delta_table + i);
-		__m128 _sinc  = _mm_add_ps(_mm_load_ps(sample_phase_table + i), _mm_mul_ps(deltas, delta));
-		sum = _mm_add_ps(sum, _mm_mul_ps(buf, _sinc));
+		__m128 deltas = _mm_load_ps(args.delta_table + i);
+		__m128 _sinc = _mm_add_ps(_mm_load_ps(args.phase_table + i), _mm_mul_ps(deltas, delta));
+		for (unsigned c = 0; c < N; c++)
+		{
+			__m128 buf = _mm_loadu_ps(window + c * args.window_stride + i);
+			sums[c] = _mm_add_ps(sums[c], _mm_mul_ps(buf, _sinc));
+		}
 	}
 
-	// Horizontal add.
-	sum = _mm_add_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 2, 3)), sum);
-	sum = _mm_add_ss(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)), sum);
-
-	if (accumulate)
-		_mm_store_ss(output, _mm_add_ss(_mm_load_ss(output), sum));
-	else
-		_mm_store_ss(output, sum);
+	for (unsigned c = 0; c < N; c++)
+		results[c] = horizontal_add(sums[c]);
+}
 #elif defined(__ARM_NEON)
-	float delta = float(time & subphase_mask) * subphase_mod;
-	float32x4_t sum = vdupq_n_f32(0.0f);
-	for (unsigned i = 0; i < taps; i += 4)
+template <unsigned N>
+static inline void sinc_kernel_channels(float *results, const float *window,
+                                        const SincResampler::KernelArgs &args) noexcept
+{
+	float32x4_t sums[N];
+	for (auto &sum : sums)
+		sum = vdupq_n_f32(0.0f);
+
+	for (unsigned i = 0; i < args.taps; i += 4)
+	{
+		float32x4_t _phases = vld1q_f32(args.phase_table + i);
+		float32x4_t deltas = vld1q_f32(args.delta_table + i);
+		float32x4_t _sinc = vmlaq_n_f32(_phases, deltas, args.delta);
+		for (unsigned c = 0; c < N; c++)
+		{
+			float32x4_t buf = vld1q_f32(window + c * args.window_stride + i);
+			sums[c] = vmlaq_f32(sums[c], buf, _sinc);
+		}
+	}
+
+	for (unsigned c = 0; c < N; c++)
+	{
+		float32x2_t half = vadd_f32(vget_low_f32(sums[c]), vget_high_f32(sums[c]));
+		results[c] = vget_lane_f32(vpadd_f32(half, half), 0);
+	}
+}
+#else
+template <unsigned N>
+static inline void sinc_kernel_channels(float *results, const float *window,
+                                        const SincResampler::KernelArgs &args) noexcept
+{
+	float sums[N] = {};
+	for (unsigned i = 0; i < args.taps; i++)
 	{
-		float32x4_t _phases = vld1q_f32(phase_table + i);
-		float32x4_t deltas = vld1q_f32(delta_table + i);
-		float32x4_t buf = vld1q_f32(buffer + i);
-		float32x4_t _sinc = vmlaq_n_f32(_phases, deltas, delta);
-		sum = vmlaq_f32(sum, buf, _sinc);
+		float sinc_val = args.phase_table[i] + args.delta_table[i] * args.delta;
+		for (unsigned c = 0; c < N; c++)
+			sums[c] += window[c * args.window_stride + i] * sinc_val;
 	}
 
-	float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
-	float32x2_t res = vpadd_f32(half, half);
+	for (unsigned c = 0; c < N; c++)
+		results[c] = sums[c];
+}
+#endif
 
-	if (accumulate)
+void SincResampler::sinc_kernel_generic(float *results, const KernelArgs &args) noexcept
+{
+	unsigned c = 0;
+	for (; c + 4 <= args.num_channels; c += 4)
+		sinc_kernel_channels<4>(results + c, args.window + c * args.window_stride, args);
+	if (c + 2 <= args.num_channels)
 	{
-		float32x2_t o = vld1_dup_f32(output);
-		res = vadd_f32(o, res);
-		vst1_lane_f32(output, res, 0);
+		sinc_kernel_channels<2>(results + c, args.window + c * args.window_stride, args);
+		c += 2;
 	}
-	else
-		vst1_lane_f32(output, res, 0);
-#else
-	float delta = float(time & subphase_mask) * subphase_mod;
-	float sum = 0.0f;
-	for (unsigned i = 0; i < taps; i++)
+	if (c < args.num_channels)
+		sinc_kernel_channels<1>(results + c, args.window + c * args.window_stride, args);
+}
+
+#ifdef SINC_RESAMPLER_AVX2
+template <unsigned N>
+static TARGET_AVX2 inline void sinc_kernel_channels_avx2(float *results, const float *window,
+                                                         const SincResampler::KernelArgs &args) noexcept
+{
+	__m256 sums[N];
+	for (auto &sum : sums)
+		sum = _mm256_setzero_ps();
+
+	__m256 delta = _mm256_set1_ps(args.delta);
+	unsigned i = 0;
+	for (; i + 8 <= args.taps; i += 8)
 	{
-		float sinc_val = phase_table[i] + delta_table[i] * delta;
-		sum += buffer[i] * sinc_val;
+		__m256 _sinc = _mm256_fmadd_ps(_mm256_loadu_ps(args.delta_table + i), delta,
+		                               _mm256_loadu_ps(args.phase_table + i));
+		for (unsigned c = 0; c < N; c++)
+			sums[c] = _mm256_fmadd_ps(_mm256_loadu_ps(window + c * args.window_stride + i), _sinc, sums[c]);
 	}
 
-	if (accumulate)
-		*output += sum;
-	else
-		*output = sum;
+	__m128 tail[N];
+	for (unsigned c = 0; c < N; c++)
+		tail[c] = _mm_add_ps(_mm256_castps256_ps128(sums[c]), _mm256_extractf128_ps(sums[c], 1));
+
+	// Taps are only padded to 4.
+	if (i < args.taps)
+	{
+		__m128 _sinc = _mm_fmadd_ps(_mm_load_ps(args.delta_table + i), _mm256_castps256_ps128(delta),
+		                            _mm_load_ps(args.phase_table + i));
+		for (unsigned c = 0; c < N; c++)
+			tail[c] = _mm_fmadd_ps(_mm_loadu_ps(window + c * args.window_stride + i), _sinc, tail[c]);
+	}
+
+	for (unsigned c = 0; c < N; c++)
+	{
+		__m128 v = _mm_add_ps(_mm_shuffle_ps(tail[c], tail[c], _MM_SHUFFLE(2, 3, 2, 3)), tail[c]);
+		v = _mm_add_ss(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), v);
+		results[c] = _mm_cvtss_f32(v);
+	}
+}
+
+TARGET_AVX2 void SincResampler::sinc_kernel_avx2(float *results, const KernelArgs &args) noexcept
+{
+	unsigned c = 0;
+	for (; c + 4 <= args.num_channels; c += 4)
+		sinc_kernel_channels_avx2<4>(results + c, args.window + c * args.window_stride, args);
+	if (c + 2 <= args.num_channels)
+	{
+		sinc_kernel_channels_avx2<2>(results + c, args.window + c * args.window_stride, args);
+		c += 2;
+	}
+	if (c < args.num_channels)
+		sinc_kernel_channels_avx2<1>(results + c, args.window + c * args.window_stride, args);
+}
 #endif
+
+template <bool accumulate>
+inline void SincResampler::process(float *const *outputs, size_t offset) const noexcept
+{
+	unsigned phase = time >> subphase_bits;
+
+	KernelArgs args;
+	args.window = window_buffer + ptr;
+	args.window_stride = window_stride;
+	args.num_channels = num_channels;
+	args.phase_table = phase_table + phase * taps * 2;
+	args.delta_table = args.phase_table + taps;
+	args.delta = float(time & subphase_mask) * subphase_mod;
+	args.taps = taps;
+
+	float results[MaxChannels];
+	kernel(results, args);
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		if (accumulate)
+			outputs[c][offset] += results[c];
+		else
+			outputs[c][offset] = results[c];
+	}
+}
+
+inline void SincResampler::push_input(const float *const *inputs, size_t offset) noexcept
+{
+	// Push in reverse to make filter more obvious.
+	if (!ptr)
+		ptr = taps;
+	ptr--;
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		const float v = inputs[c][offset];
+		float *window = window_buffer + c * window_stride;
+		window[ptr + taps] = v;
+		window[ptr] = v;
+	}
 }
 
 template <bool accumulate>
-inline size_t SincResampler::process_input(float *output, const float *input, size_t in_frames) noexcept
+inline size_t SincResampler::process_input(float *const *outputs, const float *const *inputs, size_t in_frames) noexcept
 {
 	uint32_t ratio = fixed_ratio;
 	size_t rendered_frames = 0;
+	size_t consumed_frames = 0;
 
-	while (in_frames)
+	while (consumed_frames < in_frames)
 	{
 		// Drain inputs.
-		while (in_frames && time >= phases)
+		while (consumed_frames < in_frames && time >= phases)
 		{
-			// Push in reverse to make filter more obvious.
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			const float v = *input;
-			window_buffer[ptr + taps] = v;
-			window_buffer[ptr] = v;
+			push_input(inputs, consumed_frames);
 			time -= phases;
-			in_frames--;
-			input++;
+			consumed_frames++;
 		}
 
 		// Pump out samples.
 		while (time < phases)
 		{
-			process<accumulate>(output);
-			output++;
+			process<accumulate>(outputs, rendered_frames);
 			time += ratio;
 			rendered_frames++;
 		}
@@ -355,33 +501,26 @@ inline size_t SincResampler::process_input(float *output, const float *input, si
 }
 
 template <bool accumulate>
-inline size_t SincResampler::process_output(float *output, const float *input, size_t out_frames) noexcept
+inline size_t SincResampler::process_output(float *const *outputs, const float *const *inputs, size_t out_frames) noexcept
 {
 	uint32_t ratio = fixed_ratio;
 	size_t consumed_frames = 0;
+	size_t rendered_frames = 0;
 
-	while (out_frames)
+	while (rendered_frames < out_frames)
 	{
 		// Pump out samples.
-		while (out_frames && time < phases)
+		while (rendered_frames < out_frames && time < phases)
 		{
-			process<accumulate>(output);
-			output++;
-			out_frames--;
+			process<accumulate>(outputs, rendered_frames);
+			rendered_frames++;
 			time += ratio;
 		}
 
 		// Drain inputs.
 		while (time >= phases)
 		{
-			// Push in reverse to make filter more obvious.
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			const float v = input[consumed_frames];
-			window_buffer[ptr + taps] = v;
-			window_buffer[ptr] = v;
+			push_input(inputs, consumed_frames);
 			consumed_frames++;
 			time -= phases;
 		}
@@ -392,22 +531,46 @@ inline size_t SincResampler::process_output(float *output, const float *input, s
 
 size_t SincResampler::process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept
 {
-	return process_output<false>(outputs, inputs, out_frames);
+	return process_output<false>(&outputs, &inputs, out_frames);
 }
 
 size_t SincResampler::process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept
 {
-	return process_input<false>(outputs, inputs, in_frames);
+	return process_input<false>(&outputs, &inputs, in_frames);
 }
 
 size_t SincResampler::process_and_accumulate_output_frames(float *outputs, const float *inputs,
                                                            size_t out_frames) noexcept
 {
-	return process_output<true>(outputs, inputs, out_frames);
+	return process_output<true>(&outputs, &inputs, out_frames);
 }
 
 size_t SincResampler::process_and_accumulate_input_frames(float *outputs, const float *inputs,
                                                           size_t in_frames) noexcept
+{
+	return process_input<true>(&outputs, &inputs, in_frames);
+}
+
+size_t SincResampler::process_output_frames(float *const *outputs, const float *const *inputs,
+                                            size_t out_frames) noexcept
+{
+	return process_output<false>(outputs, inputs, out_frames);
+}
+
+size_t SincResampler::process_input_frames(float *const *outputs, const float *const *inputs,
+                                           size_t in_frames) noexcept
+{
+	return process_input<false>(outputs, inputs, in_frames);
+}
+
+size_t SincResampler::process_and_accumulate_output_frames(float *const *outputs, const float *const *inputs,
+                                                           size_t out_frames) noexcept
+{
+	return process_output<true>(outputs, inputs, out_frames);
+}
+
+size_t SincResampler::process_and_accumulate_input_frames(float *const *outputs, const float *const *inputs,
+                                                          size_t in_frames) noexcept
 {
 	return process_input<true>(outputs, inputs, in_frames);
 }
@@ -41,7 +41,11 @@ public:
 		Medium,
 		High
 	};
-	SincResampler(float out_rate, float in_rate, Quality quality);
+	enum { MaxChannels = 8 };
+
+	// With multiple channels, use the planar overloads which take one pointer per channel.
+	// All channels share the filter phase, so the interpolated filter is only computed once.
+	SincResampler(float out_rate, float in_rate, Quality quality, unsigned channels = 1);
 	~SincResampler();
 
 	size_t process_and_accumulate_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
@@ -49,6 +53,11 @@ public:
 	size_t process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
 	size_t process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept;
 
+	size_t process_and_accumulate_output_frames(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+	size_t process_and_accumulate_input_frames(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
+	size_t process_output_frames(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+	size_t process_input_frames(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
+
 	void operator=(const SincResampler &) = delete;
 	SincResampler(const SincResampler &) = delete;
 
@@ -58,6 +67,8 @@ public:
 
 	void set_sample_rate_ratio(float ratio) noexcept;
 
+	struct KernelArgs;
+
 private:
 	unsigned phase_bits = 0;
 	unsigned subphase_bits = 0;
@@ -68,6 +79,8 @@ private:
 	uint32_t fixed_ratio = 0;
 	uint32_t phases = 0;
 	float subphase_mod = 0.0f;
+	unsigned num_channels = 1;
+	unsigned window_stride = 0;
 
 	float *main_buffer = nullptr;
 	float *phase_table = nullptr;
@@ -75,12 +88,18 @@ private:
 
 	void init_table_kaiser(double cutoff, unsigned phase_count, unsigned num_taps, double beta);
 
+	// Computes one output sample for every channel, picked at runtime.
+	void (*kernel)(float *results, const KernelArgs &args) noexcept = nullptr;
+	static void sinc_kernel_generic(float *results, const KernelArgs &args) noexcept;
+	static void sinc_kernel_avx2(float *results, const KernelArgs &args) noexcept;
+
 	template <bool accumulate>
-	inline void process(float *output) const noexcept;
+	inline void process(float * const *outputs, size_t offset) const noexcept;
+	inline void push_input(const float * const *inputs, size_t offset) noexcept;
 	template <bool accumulate>
-	inline size_t process_output(float *outputs, const float *inputs, size_t out_frames) noexcept;
+	inline size_t process_output(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
 	template <bool accumulate>
-	inline size_t process_input(float *outputs, const float *inputs, size_t in_frames) noexcept;
+	inline size_t process_input(float * const *outputs, const float * const *inputs, size_t in_frames) noexcept;
 };
 }
 }
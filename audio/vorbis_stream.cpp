@@ -19,14 +19,22 @@
  * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
-
 #include "vorbis_stream.hpp"
 #include "filesystem.hpp"
 #include "dsp/dsp.hpp"
 #include "stb_vorbis.h"
 #include "logging.hpp"
+#include "intrusive.hpp"
+#include "lru_cache.hpp"
+#include "hash.hpp"
+#include "thread_name.hpp"
 #include <string.h>
+#include <stdlib.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
 
 using namespace std;
 
@@ -34,12 +42,55 @@ namespace Granite
 {
 namespace Audio
 {
+static stb_vorbis *open_vorbis_file(File &file)
+{
+	if (file.get_size() == 0)
+		return nullptr;
+	void *mapped = file.map();
+	if (!mapped)
+		return nullptr;
+
+	int error;
+	stb_vorbis *vorbis = stb_vorbis_open_memory(static_cast<const unsigned char *>(mapped), int(file.get_size()),
+	                                            &error, nullptr);
+	if (!vorbis)
+		LOGE("Failed to load Vorbis file, error: %d\n", error);
+	return vorbis;
+}
+
+struct VorbisStream;
+
+// Decodes every streamed Vorbis file ahead of the mixer, so the audio thread only copies PCM.
+class VorbisDecodeThread
+{
+public:
+	~VorbisDecodeThread();
+	void register_stream(VorbisStream *stream);
+	void unregister_stream(VorbisStream *stream);
+
+private:
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<VorbisStream *> streams;
+	std::thread thread;
+	bool dead = false;
+
+	void looper();
+};
+
+static VorbisDecodeThread &get_decode_thread()
+{
+	static VorbisDecodeThread decode_thread;
+	return decode_thread;
+}
+
 struct VorbisStream : MixerStream
 {
 	~VorbisStream();
 	bool init(const string &path);
 
 	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
@@ -51,17 +102,9 @@ struct VorbisStream : MixerStream
 		return num_channels;
 	}
 
-	void setup(float, unsigned, size_t num_frames) override
-	{
-		for (auto &mix : mix_buffer)
-			mix.clear();
-
-		for (unsigned c = 0; c < num_channels; c++)
-		{
-			mix_buffer[c].resize(num_frames);
-			mix_channels[c] = mix_buffer[c].data();
-		}
-	}
+	void start_decode_ahead();
+	// Called from the decode thread. Returns false if the ring is full or the stream has ended.
+	bool decode_ahead();
 
 	stb_vorbis *file = nullptr;
 	unique_ptr<File> filesystem_file;
@@ -70,120 +113,316 @@ struct VorbisStream : MixerStream
 	unsigned num_channels = 0;
 	bool looping = false;
 
-	std::vector<float> mix_buffer[Backend::MaxAudioChannels];
-	float *mix_channels[Backend::MaxAudioChannels] = {};
+	// Single producer, single consumer. The decode thread writes, the mixer reads.
+	enum { RingFrames = 16 * 1024, DecodeChunkFrames = 1024 };
+	std::vector<float> ring[Backend::MaxAudioChannels];
+	std::atomic<uint64_t> write_count;
+	std::atomic<uint64_t> read_count;
+	std::atomic<bool> end_of_stream;
+	uint64_t loop_start_count = 0;
+	bool registered = false;
+
+	float decode_buffer[Backend::MaxAudioChannels][DecodeChunkFrames];
+
+	size_t consume(float * const *channels, const float *gains, size_t num_frames) noexcept;
 };
 
-struct DecodedVorbisStream : MixerStream
+VorbisDecodeThread::~VorbisDecodeThread()
 {
-	bool init(const string &path);
+	{
+		lock_guard<mutex> holder{lock};
+		dead = true;
+		cond.notify_one();
+	}
+
+	if (thread.joinable())
+		thread.join();
+}
+
+void VorbisDecodeThread::register_stream(VorbisStream *stream)
+{
+	lock_guard<mutex> holder{lock};
+	streams.push_back(stream);
+	if (!thread.joinable())
+		thread = std::thread(&VorbisDecodeThread::looper, this);
+	cond.notify_one();
+}
+
+void VorbisDecodeThread::unregister_stream(VorbisStream *stream)
+{
+	// The looper decodes with the lock held, so the stream is not in use once we get here.
+	lock_guard<mutex> holder{lock};
+	auto itr = find(begin(streams), end(streams), stream);
+	if (itr != end(streams))
+	{
+		*itr = streams.back();
+		streams.pop_back();
+	}
+}
+
+void VorbisDecodeThread::looper()
+{
+	Util::set_current_thread_name("vorbis-decode");
+
+	unique_lock<mutex> holder{lock};
+	while (!dead)
+	{
+		bool progress = false;
+		for (auto *stream : streams)
+			progress = stream->decode_ahead() || progress;
+
+		// The mixer cannot signal us without risking a block in the audio thread, so poll.
+		// A full ring lasts far longer than the poll interval.
+		if (!progress)
+			cond.wait_for(holder, chrono::milliseconds(10));
+	}
+}
 
+struct DecodedAudio : Util::ThreadSafeIntrusivePtrEnabled<DecodedAudio>
+{
+	std::vector<float> channels[Backend::MaxAudioChannels];
+	size_t num_frames = 0;
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+};
+using DecodedAudioHandle = Util::IntrusivePtr<DecodedAudio>;
+
+struct DecodedVorbisStream : MixerStream
+{
 	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
-		return sample_rate;
+		return audio->sample_rate;
 	}
 
 	unsigned get_num_channels() const override
 	{
-		return num_channels;
+		return audio->num_channels;
 	}
 
-	std::vector<float> decoded_audio[Backend::MaxAudioChannels];
+	// Shared with the cache and other streams playing the same file.
+	DecodedAudioHandle audio;
 	size_t offset = 0;
-	float sample_rate = 0.0f;
-	unsigned num_channels = 0;
 	bool looping = false;
 };
 
+// Decoded PCM keyed by path. Streams hold references, so pruning never frees audio which is still playing.
+class DecodedAudioCache
+{
+public:
+	DecodedAudioCache()
+	{
+		uint64_t size_mib = 64;
+		if (const char *env = getenv("GRANITE_AUDIO_DECODED_CACHE_MIB"))
+			size_mib = strtoull(env, nullptr, 0);
+		cache.set_total_cost(size_mib * 1024 * 1024);
+	}
+
+	DecodedAudioHandle request(const string &path);
+
+	void set_size(uint64_t size)
+	{
+		cache.set_total_cost(size);
+		cache.prune();
+	}
+
+private:
+	Util::ConcurrentLRUCache<DecodedAudioHandle> cache;
+};
+
+static DecodedAudioCache &get_decoded_audio_cache()
+{
+	static DecodedAudioCache decoded_cache;
+	return decoded_cache;
+}
+
+static DecodedAudioHandle decode_vorbis_file(const string &path)
+{
+	auto filesystem_file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
+	if (!filesystem_file)
+		return {};
+
+	stb_vorbis *file = open_vorbis_file(*filesystem_file);
+	if (!file)
+		return {};
+
+	auto audio = Util::make_handle<DecodedAudio>();
+	auto info = stb_vorbis_get_info(file);
+	audio->sample_rate = info.sample_rate;
+	audio->num_channels = unsigned(info.channels);
+
+	float block[Backend::MaxAudioChannels][256];
+	float *mix_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < audio->num_channels; c++)
+		mix_channels[c] = block[c];
+
+	int ret;
+	while ((ret = stb_vorbis_get_samples_float(file, int(audio->num_channels), mix_channels, 256)) > 0)
+		for (unsigned c = 0; c < audio->num_channels; c++)
+			audio->channels[c].insert(end(audio->channels[c]), mix_channels[c], mix_channels[c] + ret);
+
+	stb_vorbis_close(file);
+	if (ret < 0)
+		return {};
+
+	audio->num_frames = audio->channels[0].size();
+	return audio;
+}
+
+DecodedAudioHandle DecodedAudioCache::request(const string &path)
+{
+	Util::Hasher h;
+	h.string(path);
+	uint64_t cookie = h.get();
+
+	DecodedAudioHandle audio;
+	if (cache.find_and_mark_as_recent(cookie, audio))
+		return audio;
+
+	// Decode outside the lock. If two threads race on the same path, the last one wins the cache entry.
+	audio = decode_vorbis_file(path);
+	if (!audio)
+		return {};
+
+	cache.insert(cookie, audio, audio->num_frames * audio->num_channels * sizeof(float));
+	return audio;
+}
+
 bool VorbisStream::init(const string &path)
 {
 	filesystem_file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
 	if (!filesystem_file)
 		return false;
 
-	if (filesystem_file->get_size() == 0)
-		return false;
-	void *mapped = filesystem_file->map();
-	if (!mapped)
-		return false;
-
-	int error;
-	file = stb_vorbis_open_memory(static_cast<const unsigned char *>(mapped), int(filesystem_file->get_size()),
-	                              &error, nullptr);
+	file = open_vorbis_file(*filesystem_file);
 	if (!file)
-	{
-		LOGE("Failed to load Vorbis file, error: %d\n", error);
 		return false;
-	}
 
 	auto info = stb_vorbis_get_info(file);
 	sample_rate = info.sample_rate;
 	num_channels = unsigned(info.channels);
 
+	for (unsigned c = 0; c < num_channels; c++)
+		ring[c].resize(RingFrames);
+	write_count.store(0, memory_order_relaxed);
+	read_count.store(0, memory_order_relaxed);
+	end_of_stream.store(false, memory_order_relaxed);
 	return true;
 }
 
-bool DecodedVorbisStream::init(const string &path)
+void VorbisStream::start_decode_ahead()
 {
-	auto filesystem_file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
-	if (!filesystem_file)
-		return false;
+	// Fill the ring up front so playback does not start with an underrun.
+	while (decode_ahead())
+	{
+	}
 
-	if (filesystem_file->get_size() == 0)
+	get_decode_thread().register_stream(this);
+	registered = true;
+}
+
+bool VorbisStream::decode_ahead()
+{
+	if (end_of_stream.load(memory_order_relaxed))
 		return false;
-	void *mapped = filesystem_file->map();
-	if (!mapped)
+
+	uint64_t write = write_count.load(memory_order_relaxed);
+	uint64_t read = read_count.load(memory_order_acquire);
+	size_t writable = RingFrames - size_t(write - read);
+	if (writable < DecodeChunkFrames)
 		return false;
 
-	int error;
-	stb_vorbis *file = stb_vorbis_open_memory(static_cast<const unsigned char *>(mapped),
-	                                          int(filesystem_file->get_size()),
-	                                          &error, nullptr);
-	if (!file)
+	float *decode_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_channels; c++)
+		decode_channels[c] = decode_buffer[c];
+
+	int ret = stb_vorbis_get_samples_float(file, int(num_channels), decode_channels, DecodeChunkFrames);
+	if (ret <= 0)
 	{
-		LOGE("Failed to load Vorbis file, error: %d\n", error);
+		// Don't spin on a looping file without audio.
+		if (ret == 0 && looping && write != loop_start_count)
+		{
+			stb_vorbis_seek_start(file);
+			loop_start_count = write;
+			return true;
+		}
+
+		end_of_stream.store(true, memory_order_release);
 		return false;
 	}
 
-	auto info = stb_vorbis_get_info(file);
-	sample_rate = info.sample_rate;
-	num_channels = unsigned(info.channels);
-
-	float block[Backend::MaxAudioChannels][256];
-	float *mix_channels[Backend::MaxAudioChannels];
+	size_t offset = size_t(write & (RingFrames - 1));
+	size_t first = std::min<size_t>(size_t(ret), RingFrames - offset);
 	for (unsigned c = 0; c < num_channels; c++)
-		mix_channels[c] = block[c];
+	{
+		memcpy(ring[c].data() + offset, decode_buffer[c], first * sizeof(float));
+		memcpy(ring[c].data(), decode_buffer[c] + first, (size_t(ret) - first) * sizeof(float));
+	}
 
-	int ret;
-	while ((ret = stb_vorbis_get_samples_float(file, int(num_channels), mix_channels, 256)) > 0)
+	write_count.store(write + uint64_t(ret), memory_order_release);
+	return true;
+}
+
+size_t VorbisStream::consume(float *const *channels, const float *gains, size_t num_frames) noexcept
+{
+	// Observe end of stream before the write count, so the count is final if the stream has ended.
+	bool ended = end_of_stream.load(memory_order_acquire);
+	uint64_t write = write_count.load(memory_order_acquire);
+	uint64_t read = read_count.load(memory_order_relaxed);
+	size_t to_read = std::min<size_t>(num_frames, size_t(write - read));
+
+	if (channels)
+	{
+		size_t offset = size_t(read & (RingFrames - 1));
+		size_t first = std::min<size_t>(to_read, RingFrames - offset);
 		for (unsigned c = 0; c < num_channels; c++)
-			decoded_audio[c].insert(end(decoded_audio[c]), mix_channels[c], mix_channels[c] + ret);
+		{
+			DSP::accumulate_channel(channels[c], ring[c].data() + offset, gains[c], first);
+			DSP::accumulate_channel(channels[c] + first, ring[c].data(), gains[c], to_read - first);
+		}
+	}
 
-	if (ret < 0)
-		goto error;
+	read_count.store(read + to_read, memory_order_release);
 
-	stb_vorbis_close(file);
-	return true;
+	// On underrun the rest is silence, the decoder will catch up.
+	if (ended && to_read < num_frames)
+		return to_read;
+	else
+		return num_frames;
+}
 
-error:
-	stb_vorbis_close(file);
-	return false;
+size_t VorbisStream::accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept
+{
+	return consume(channels, gains, num_frames);
+}
+
+size_t VorbisStream::skip_samples(float *const *, size_t num_frames) noexcept
+{
+	return consume(nullptr, nullptr, num_frames);
+}
+
+VorbisStream::~VorbisStream()
+{
+	if (registered)
+		get_decode_thread().unregister_stream(this);
+	if (file)
+		stb_vorbis_close(file);
 }
 
 size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
 {
-	size_t to_write = std::min(decoded_audio[0].size() - offset, num_frames);
+	size_t to_write = std::min(audio->num_frames - offset, num_frames);
 
-	for (unsigned c = 0; c < num_channels; c++)
-		DSP::accumulate_channel(channels[c], decoded_audio[c].data() + offset, gains[c], to_write);
+	for (unsigned c = 0; c < audio->num_channels; c++)
+		DSP::accumulate_channel(channels[c], audio->channels[c].data() + offset, gains[c], to_write);
 
 	offset += to_write;
 
-	if (offset >= decoded_audio[0].size())
+	if (offset >= audio->num_frames)
 	{
-		if (looping)
+		if (looping && audio->num_frames)
 			offset = 0;
 		else
 			return to_write;
@@ -193,7 +432,7 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 	if (spill_to_write)
 	{
 		float *modified_channels[Backend::MaxAudioChannels];
-		for (unsigned c = 0; c < num_channels; c++)
+		for (unsigned c = 0; c < audio->num_channels; c++)
 			modified_channels[c] = channels[c] + to_write;
 
 		return accumulate_samples(modified_channels, gains, spill_to_write) + to_write;
@@ -202,31 +441,24 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 		return to_write;
 }
 
-size_t VorbisStream::accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept
+size_t DecodedVorbisStream::skip_samples(float *const *, size_t num_frames) noexcept
 {
-	auto actual_frames = stb_vorbis_get_samples_float(file, num_channels, mix_channels, int(num_frames));
-	if (actual_frames < 0)
-		return 0;
-
-	for (unsigned c = 0; c < num_channels; c++)
-		DSP::accumulate_channel(channels[c], mix_channels[c], gains[c], size_t(actual_frames));
-
-	if (looping && size_t(actual_frames) < num_frames)
+	size_t skipped = 0;
+	while (skipped < num_frames && audio->num_frames)
 	{
-		stb_vorbis_seek_start(file);
-		float *moved_channels[Backend::MaxAudioChannels];
-		for (unsigned c = 0; c < num_channels; c++)
-			moved_channels[c] = channels[c] + actual_frames;
+		size_t to_skip = std::min(audio->num_frames - offset, num_frames - skipped);
+		offset += to_skip;
+		skipped += to_skip;
 
-		actual_frames += accumulate_samples(moved_channels, gains, num_frames - actual_frames);
+		if (offset >= audio->num_frames)
+		{
+			if (!looping)
+				break;
+			offset = 0;
+		}
 	}
-	return size_t(actual_frames);
-}
 
-VorbisStream::~VorbisStream()
-{
-	if (file)
-		stb_vorbis_close(file);
+	return skipped;
 }
 
 MixerStream *create_vorbis_stream(const string &path, bool looping)
@@ -239,20 +471,25 @@ MixerStream *create_vorbis_stream(const string &path, bool looping)
 	}
 
 	vorbis->looping = looping;
+	vorbis->start_decode_ahead();
 	return vorbis;
 }
 
 MixerStream *create_decoded_vorbis_stream(const string &path, bool looping)
 {
-	auto vorbis = new DecodedVorbisStream;
-	if (!vorbis->init(path))
-	{
-		vorbis->dispose();
+	auto audio = get_decoded_audio_cache().request(path);
+	if (!audio)
 		return nullptr;
-	}
 
+	auto vorbis = new DecodedVorbisStream;
+	vorbis->audio = std::move(audio);
 	vorbis->looping = looping;
 	return vorbis;
 }
+
+void set_decoded_vorbis_cache_size(uint64_t size)
+{
+	get_decoded_audio_cache().set_size(size);
+}
+}
 }
-}
\ No newline at end of file
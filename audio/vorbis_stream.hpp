@@ -29,7 +29,15 @@ namespace Granite
 {
 namespace Audio
 {
+// Decoded ahead of the mixer on a background thread. Meant for long files such as music.
 MixerStream *create_vorbis_stream(const std::string &path, bool looping = false);
+
+// Fully decoded up front. The PCM is shared through a cache keyed by path,
+// so a sound effect fired many times is only decoded once.
 MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping = false);
+
+// LRU bound in bytes for decoded PCM no longer in use. 64 MiB by default,
+// or GRANITE_AUDIO_DECODED_CACHE_MIB.
+void set_decoded_vorbis_cache_size(uint64_t size);
 }
 }
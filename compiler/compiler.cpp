@@ -25,6 +25,7 @@
 #include "path_utils.hpp"
 #include "logging.hpp"
 #include "string_helpers.hpp"
+#include "thread_group.hpp"
 
 #include "spirv-tools/libspirv.hpp"
 
@@ -105,11 +106,52 @@ void GLSLCompiler::set_include_directories(const std::vector<std::string> *inclu
 	include_directories = include_directories_;
 }
 
+bool GLSLIncludeCache::load_text_file(FilesystemInterface &iface, const std::string &path, std::string &source)
+{
+	uint64_t last_modified;
+	if (!iface.get_last_modified(path, last_modified))
+	{
+		// Cannot validate entries, so do not cache.
+		return iface.load_text_file(path, source);
+	}
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		auto itr = entries.find(path);
+		if (itr != entries.end() && itr->second.last_modified == last_modified)
+		{
+			source = itr->second.source;
+			return true;
+		}
+	}
+
+	if (!iface.load_text_file(path, source))
+		return false;
+
+	std::lock_guard<std::mutex> holder{lock};
+	entries[path] = { last_modified, source };
+	return true;
+}
+
+void GLSLIncludeCache::clear()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	entries.clear();
+}
+
+bool GLSLCompiler::load_include(const string &path, string &included_source)
+{
+	if (include_cache)
+		return include_cache->load_text_file(iface, path, included_source);
+	else
+		return iface.load_text_file(path, included_source);
+}
+
 bool GLSLCompiler::find_include_path(const string &source_path_, const string &include_path,
                                      string &included_path, string &included_source)
 {
 	auto relpath = Path::relpath(source_path_, include_path);
-	if (iface.load_text_file(relpath, included_source))
+	if (load_include(relpath, included_source))
 	{
 		included_path = relpath;
 		return true;
@@ -120,7 +162,7 @@ bool GLSLCompiler::find_include_path(const string &source_path_, const string &i
 		for (auto &include_dir : *include_directories)
 		{
 			auto path = Path::join(include_dir, include_path);
-			if (iface.load_text_file(path, included_source))
+			if (load_include(path, included_source))
 			{
 				included_path = path;
 				return true;
@@ -244,6 +286,27 @@ Util::Hash GLSLCompiler::get_source_hash() const
 	return h.get();
 }
 
+Util::Hash GLSLCompiler::get_compile_hash(const vector<pair<string, int>> *defines) const
+{
+	Util::Hasher h(get_source_hash());
+	// The bundled SPIRV-Tools is updated together with shaderc and glslang.
+	h.string(spvSoftwareVersionDetailsString());
+	h.u32(uint32_t(stage));
+	h.u32(uint32_t(target));
+	h.u32(uint32_t(optimization));
+	h.u32(uint32_t(strip));
+	if (defines)
+	{
+		h.u32(uint32_t(defines->size()));
+		for (auto &define : *defines)
+		{
+			h.string(define.first);
+			h.s32(define.second);
+		}
+	}
+	return h.get();
+}
+
 vector<uint32_t> GLSLCompiler::compile(std::string &error_message, const vector<pair<string, int>> *defines) const
 {
 	shaderc::Compiler compiler;
@@ -362,4 +425,58 @@ vector<uint32_t> GLSLCompiler::compile(std::string &error_message, const vector<
 
 	return compiled_spirv;
 }
+
+bool compile_batch(ThreadGroup *group, GLSLCompileJob *jobs, size_t count)
+{
+	// Map every job to the first job with the same output.
+	std::vector<size_t> unique_index(count);
+	std::vector<size_t> unique_jobs;
+	std::unordered_map<Util::Hash, size_t> hash_to_job;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto hash = jobs[i].compiler->get_compile_hash(jobs[i].defines);
+		auto itr = hash_to_job.find(hash);
+		if (itr == hash_to_job.end())
+		{
+			hash_to_job[hash] = i;
+			unique_index[i] = i;
+			unique_jobs.push_back(i);
+		}
+		else
+			unique_index[i] = itr->second;
+	}
+
+	auto compile_job = [jobs](size_t index) {
+		auto &job = jobs[index];
+		job.spirv = job.compiler->compile(job.error_message, job.defines);
+	};
+
+	if (group)
+	{
+		auto task = group->create_task();
+		task->set_desc("glsl-compile-batch");
+		for (auto index : unique_jobs)
+			task->enqueue_task([compile_job, index]() { compile_job(index); });
+		task->flush();
+		task->wait();
+	}
+	else
+	{
+		for (auto index : unique_jobs)
+			compile_job(index);
+	}
+
+	bool ret = true;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (unique_index[i] != i)
+		{
+			jobs[i].spirv = jobs[unique_index[i]].spirv;
+			jobs[i].error_message = jobs[unique_index[i]].error_message;
+		}
+		if (jobs[i].spirv.empty())
+			ret = false;
+	}
+	return ret;
+}
 }
@@ -25,6 +25,8 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
+#include <mutex>
 #include <stdint.h>
 #include "small_vector.hpp"
 #include "global_managers.hpp"
@@ -49,6 +51,26 @@ enum class Target
 	Vulkan11
 };
 
+class ThreadGroup;
+
+// Include files shared between compilers on any thread. Entries are revalidated against
+// the modification time, so edits are picked up for hot reload.
+class GLSLIncludeCache
+{
+public:
+	bool load_text_file(FilesystemInterface &iface, const std::string &path, std::string &source);
+	void clear();
+
+private:
+	struct Entry
+	{
+		uint64_t last_modified;
+		std::string source;
+	};
+	std::mutex lock;
+	std::unordered_map<std::string, Entry> entries;
+};
+
 class GLSLCompiler
 {
 public:
@@ -72,10 +94,17 @@ public:
 
 	void set_include_directories(const std::vector<std::string> *include_directories);
 
+	void set_include_cache(GLSLIncludeCache *cache)
+	{
+		include_cache = cache;
+	}
+
 	bool set_source_from_file(const std::string &path);
 	bool set_source_from_file_multistage(const std::string &path);
 	bool preprocess();
 	Util::Hash get_source_hash() const;
+	// Identifies the output of compile() with these defines.
+	Util::Hash get_compile_hash(const std::vector<std::pair<std::string, int>> *defines) const;
 
 	std::vector<uint32_t> compile(std::string &error_message, const std::vector<std::pair<std::string, int>> *defines = nullptr) const;
 
@@ -111,6 +140,7 @@ private:
 	std::string source;
 	std::string source_path;
 	const std::vector<std::string> *include_directories = nullptr;
+	GLSLIncludeCache *include_cache = nullptr;
 	Stage stage = Stage::Unknown;
 
 	std::unordered_set<std::string> dependencies;
@@ -135,5 +165,18 @@ private:
 
 	bool find_include_path(const std::string &source_path, const std::string &include_path,
 	                       std::string &included_path, std::string &included_source);
+	bool load_include(const std::string &path, std::string &included_source);
 };
+
+struct GLSLCompileJob
+{
+	const GLSLCompiler *compiler;
+	const std::vector<std::pair<std::string, int>> *defines;
+	std::vector<uint32_t> spirv;
+	std::string error_message;
+};
+
+// Compiles jobs concurrently on the thread group, or serially if it is null.
+// Jobs with the same compile hash are only compiled once. Returns false if any job failed.
+bool compile_batch(ThreadGroup *group, GLSLCompileJob *jobs, size_t count);
 }
@@ -34,12 +34,24 @@ Entity *EntityPool::create_entity()
 	return entity;
 }
 
-void EntityPool::free_component(Entity &entity, ComponentType id, ComponentNode *component)
+void EntityPool::create_entities(Entity **new_entities, size_t count)
+{
+	entities.reserve(entities.size() + count);
+	for (size_t i = 0; i < count; i++)
+		new_entities[i] = create_entity();
+}
+
+void EntityPool::free_component_storage(ComponentType id, ComponentNode *component)
 {
 	auto *c = component_types.find(id);
 	assert(c);
 	c->free_component(component->get());
 	component_nodes.free(component);
+}
+
+void EntityPool::free_component(Entity &entity, ComponentType id, ComponentNode *component)
+{
+	free_component_storage(id, component);
 
 	auto *component_groups = component_to_groups.find(id);
 	if (component_groups)
@@ -76,6 +88,62 @@ void EntityPool::delete_entity(Entity *entity)
 	entity_pool.free(entity);
 }
 
+void EntityPool::delete_entities(Entity *const *deleted_entities, size_t count)
+{
+	// Every group which holds any of the entities is compacted exactly once.
+	std::vector<ComponentType> component_ids;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto *entity = deleted_entities[i];
+		assert(!entity->batch_deleted);
+		entity->batch_deleted = true;
+		for (auto &component : entity->get_components())
+			component_ids.push_back(component.get_hash());
+	}
+
+	std::sort(component_ids.begin(), component_ids.end());
+	component_ids.erase(std::unique(component_ids.begin(), component_ids.end()), component_ids.end());
+
+	std::vector<EntityGroupBase *> affected_groups;
+	for (auto id : component_ids)
+	{
+		auto *component_groups = component_to_groups.find(id);
+		if (!component_groups)
+			continue;
+		for (auto &group : *component_groups)
+		{
+			auto *g = groups.find(group.get_hash());
+			if (g)
+				affected_groups.push_back(g);
+		}
+	}
+
+	std::sort(affected_groups.begin(), affected_groups.end());
+	affected_groups.erase(std::unique(affected_groups.begin(), affected_groups.end()), affected_groups.end());
+	for (auto *group : affected_groups)
+		group->remove_batch_deleted_entities();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		auto *entity = deleted_entities[i];
+		auto &list = entity->get_components().inner_list();
+		auto itr = list.begin();
+		while (itr != list.end())
+		{
+			auto *component = itr.get();
+			itr = list.erase(itr);
+			free_component_storage(component->get_hash(), component);
+		}
+
+		auto offset = entity->pool_offset;
+		assert(offset < entities.size());
+		entities[offset] = entities.back();
+		entities[offset]->pool_offset = offset;
+		entities.pop_back();
+		entity_pool.free(entity);
+	}
+}
+
 EntityPool::~EntityPool()
 {
 	{
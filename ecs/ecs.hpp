@@ -26,7 +26,11 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <new>
+#include <atomic>
 #include "object_pool.hpp"
+#include "aligned_alloc.hpp"
+#include "bitops.hpp"
 #include "intrusive.hpp"
 #include "intrusive_hash_map.hpp"
 #include "compile_time_hash.hpp"
@@ -116,7 +120,10 @@ class EntityGroupBase : public Util::IntrusiveHashMapEnabled<EntityGroupBase>
 public:
 	virtual ~EntityGroupBase() = default;
 	virtual void add_entity(Entity &entity) = 0;
+	virtual void add_entities(Entity *const *entities, size_t count) = 0;
 	virtual void remove_entity(const Entity &entity) = 0;
+	// Removes every entity which is part of an ongoing EntityPool::delete_entities() in one pass.
+	virtual void remove_batch_deleted_entities() = 0;
 	virtual void reset() = 0;
 };
 
@@ -175,6 +182,9 @@ public:
 	template <typename T>
 	void free_component();
 
+	template <typename T>
+	void mark_changed();
+
 	ComponentHashMap &get_components()
 	{
 		return components;
@@ -197,12 +207,18 @@ public:
 		return ret;
 	}
 
+	bool is_batch_deleted() const
+	{
+		return batch_deleted;
+	}
+
 private:
 	EntityPool *pool;
 	Util::Hash hash;
 	size_t pool_offset = 0;
 	ComponentHashMap components;
 	bool marked = false;
+	bool batch_deleted = false;
 };
 
 template <typename... Ts>
@@ -219,6 +235,14 @@ public:
 		}
 	}
 
+	void add_entities(Entity *const *new_entities, size_t count) override final
+	{
+		groups.reserve(groups.size() + count);
+		entities.reserve(entities.size() + count);
+		for (size_t i = 0; i < count; i++)
+			add_entity(*new_entities[i]);
+	}
+
 	void remove_entity(const Entity &entity) override final
 	{
 		size_t offset;
@@ -234,6 +258,32 @@ public:
 		}
 	}
 
+	void remove_batch_deleted_entities() override final
+	{
+		// Compact in place, which also keeps the order of the remaining entities.
+		size_t write_offset = 0;
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			auto *entity = entities[i];
+			if (entity->is_batch_deleted())
+			{
+				entity_to_index.erase(entity->get_hash());
+				continue;
+			}
+
+			if (write_offset != i)
+			{
+				entities[write_offset] = entity;
+				groups[write_offset] = groups[i];
+				entity_to_index[entity->get_hash()].get() = write_offset;
+			}
+			write_offset++;
+		}
+
+		entities.resize(write_offset);
+		groups.resize(write_offset);
+	}
+
 	const ComponentGroupVector<Ts...> &get_groups() const
 	{
 		return groups;
@@ -292,10 +342,132 @@ public:
 	virtual void free_component(ComponentBase *component) = 0;
 };
 
+// Components of one type live in fixed-size chunks, and allocation always picks the lowest free slot.
+// Live components stay densely packed in address order, so walking a group mostly streams through memory.
+// Components never move once allocated, since entities and groups hold on to raw pointers.
+template <typename T>
+class ComponentChunkPool
+{
+public:
+	enum { ChunkSize = 256, MaskWords = ChunkSize / 32 };
+
+	ComponentChunkPool() = default;
+	void operator=(const ComponentChunkPool &) = delete;
+	ComponentChunkPool(const ComponentChunkPool &) = delete;
+
+	template <typename... Ts>
+	T *allocate(Ts&&... ts)
+	{
+		while (first_free_chunk < chunks.size() && chunks[first_free_chunk].num_free == 0)
+			first_free_chunk++;
+
+		if (first_free_chunk == chunks.size())
+			add_chunk();
+
+		auto &chunk = chunks[first_free_chunk];
+		unsigned word = 0;
+		while (chunk.free_mask[word] == 0)
+			word++;
+
+		unsigned bit = trailing_zeroes(chunk.free_mask[word]);
+		chunk.free_mask[word] &= ~(1u << bit);
+		chunk.num_free--;
+
+		unsigned slot = word * 32 + bit;
+		chunk.versions[slot] = 0;
+		T *ptr = chunk.memory.get() + slot;
+		return new (ptr) T(std::forward<Ts>(ts)...);
+	}
+
+	void free(T *ptr)
+	{
+		size_t index, slot;
+		locate(ptr, index, slot);
+		auto &chunk = chunks[index];
+
+		ptr->~T();
+		chunk.free_mask[slot / 32] |= 1u << (slot & 31);
+		chunk.num_free++;
+		first_free_chunk = std::min(first_free_chunk, index);
+	}
+
+	// Versions are stored next to the chunk, so stamping a component does not touch its cache line.
+	void set_version(const T *ptr, uint64_t version)
+	{
+		size_t index, slot;
+		locate(ptr, index, slot);
+		chunks[index].versions[slot] = version;
+	}
+
+	uint64_t get_version(const T *ptr) const
+	{
+		size_t index, slot;
+		locate(ptr, index, slot);
+		return chunks[index].versions[slot];
+	}
+
+private:
+	struct MallocDeleter
+	{
+		void operator()(T *ptr)
+		{
+			Util::memalign_free(ptr);
+		}
+	};
+
+	struct Chunk
+	{
+		std::unique_ptr<T, MallocDeleter> memory;
+		std::unique_ptr<uint64_t[]> versions;
+		uint32_t free_mask[MaskWords];
+		unsigned num_free;
+	};
+
+	std::vector<Chunk> chunks;
+	std::vector<size_t> chunk_order;
+	size_t first_free_chunk = 0;
+
+	void locate(const T *ptr, size_t &index, size_t &slot) const
+	{
+		// Chunks are sorted by address, find the last one which starts at or before ptr.
+		auto itr = std::upper_bound(chunk_order.begin(), chunk_order.end(), ptr,
+		                            [this](const T *p, size_t i) {
+			                            return p < chunks[i].memory.get();
+		                            });
+		assert(itr != chunk_order.begin());
+		index = *(itr - 1);
+		slot = size_t(ptr - chunks[index].memory.get());
+		assert(slot < ChunkSize);
+	}
+
+	void add_chunk()
+	{
+		auto *ptr = static_cast<T *>(Util::memalign_alloc(std::max(size_t(64), alignof(T)), ChunkSize * sizeof(T)));
+		if (!ptr)
+			throw std::bad_alloc();
+
+		Chunk chunk;
+		chunk.memory.reset(ptr);
+		chunk.versions.reset(new uint64_t[ChunkSize]);
+		for (auto &mask : chunk.free_mask)
+			mask = ~0u;
+		chunk.num_free = ChunkSize;
+
+		size_t index = chunks.size();
+		chunks.push_back(std::move(chunk));
+
+		auto itr = std::upper_bound(chunk_order.begin(), chunk_order.end(), ptr,
+		                            [this](const T *p, size_t i) {
+			                            return p < chunks[i].memory.get();
+		                            });
+		chunk_order.insert(itr, index);
+	}
+};
+
 template <typename T>
 struct ComponentAllocator : public ComponentAllocatorBase
 {
-	Util::ObjectPool<T> pool;
+	ComponentChunkPool<T> pool;
 
 	void free_component(ComponentBase *component) override final
 	{
@@ -354,15 +526,7 @@ public:
 	T *allocate_component(Entity &entity, Ts&&... ts)
 	{
 		ComponentType id = ComponentIDMapping::get_id<T>();
-		auto *t = component_types.find(id);
-		if (!t)
-		{
-			t = new ComponentAllocator<T>();
-			t->set_hash(id);
-			component_types.insert_yield(t);
-		}
-
-		auto *allocator = static_cast<ComponentAllocator<T> *>(t);
+		auto *allocator = get_or_create_allocator<T>();
 		auto *existing = entity.components.find(id);
 
 		if (existing)
@@ -371,11 +535,14 @@ public:
 			// In-place modify. Destroy old data, and in-place construct.
 			// Do not need to fiddle with data structures internally.
 			comp->~T();
-			return new (comp) T(std::forward<Ts>(ts)...);
+			comp = new (comp) T(std::forward<Ts>(ts)...);
+			allocator->pool.set_version(comp, next_change_version());
+			return comp;
 		}
 		else
 		{
 			auto *comp = allocator->pool.allocate(std::forward<Ts>(ts)...);
+			allocator->pool.set_version(comp, next_change_version());
 			auto *node = component_nodes.allocate(comp);
 			node->set_hash(id);
 			entity.components.insert_replace(node);
@@ -389,6 +556,78 @@ public:
 		}
 	}
 
+	// Bulk variants which update each affected group once per batch rather than once per entity.
+	void create_entities(Entity **new_entities, size_t count);
+	void delete_entities(Entity *const *deleted_entities, size_t count);
+
+	// Constructs T from a copy of ts on every entity, or reconstructs it in place if it already exists.
+	template <typename T, typename... Ts>
+	void allocate_components(Entity *const *new_entities, size_t count, const Ts &... ts)
+	{
+		ComponentType id = ComponentIDMapping::get_id<T>();
+		auto *allocator = get_or_create_allocator<T>();
+		std::vector<Entity *> added;
+		added.reserve(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			auto &entity = *new_entities[i];
+			auto *existing = entity.components.find(id);
+			if (existing)
+			{
+				auto *comp = static_cast<T *>(existing->get());
+				comp->~T();
+				comp = new (comp) T(ts...);
+				allocator->pool.set_version(comp, next_change_version());
+			}
+			else
+			{
+				auto *comp = allocator->pool.allocate(ts...);
+				allocator->pool.set_version(comp, next_change_version());
+				auto *node = component_nodes.allocate(comp);
+				node->set_hash(id);
+				entity.components.insert_replace(node);
+				added.push_back(&entity);
+			}
+		}
+
+		auto *component_groups = component_to_groups.find(id);
+		if (component_groups && !added.empty())
+			for (auto &group : *component_groups)
+				groups.find(group.get_hash())->add_entities(added.data(), added.size());
+	}
+
+	// Change tracking. Allocating a component or calling mark_changed() stamps it with a new version.
+	// To consume changes, snapshot get_change_version() first, query with the previous snapshot,
+	// then keep the new snapshot for the next query. mark_changed() may be called concurrently.
+	uint64_t get_change_version() const
+	{
+		return change_version.load(std::memory_order_relaxed);
+	}
+
+	template <typename T>
+	void mark_changed(const T *component)
+	{
+		get_allocator<T>()->pool.set_version(component, next_change_version());
+	}
+
+	template <typename T>
+	uint64_t get_component_version(const T *component)
+	{
+		return get_allocator<T>()->pool.get_version(component);
+	}
+
+	// Appends the elements of group whose component T changed after version to changed.
+	template <typename T, typename... Ts>
+	void get_changed_since(const ComponentGroupVector<Ts...> &group, uint64_t version,
+	                       ComponentGroupVector<Ts...> &changed)
+	{
+		auto *allocator = get_allocator<T>();
+		for (auto &element : group)
+			if (allocator->pool.get_version(get_component<T>(element)) > version)
+				changed.push_back(element);
+	}
+
 	void free_component(Entity &entity, ComponentType id, ComponentNode *component);
 	void reset_groups();
 	void reset_groups_for_component_type(ComponentType id);
@@ -401,6 +640,36 @@ private:
 	ComponentGroupHashMap component_to_groups;
 	std::vector<Entity *> entities;
 	uint64_t cookie = 0;
+	std::atomic<uint64_t> change_version{0};
+
+	uint64_t next_change_version()
+	{
+		return change_version.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	template <typename T>
+	ComponentAllocator<T> *get_or_create_allocator()
+	{
+		ComponentType id = ComponentIDMapping::get_id<T>();
+		auto *t = component_types.find(id);
+		if (!t)
+		{
+			t = new ComponentAllocator<T>();
+			t->set_hash(id);
+			component_types.insert_yield(t);
+		}
+		return static_cast<ComponentAllocator<T> *>(t);
+	}
+
+	void free_component_storage(ComponentType id, ComponentNode *component);
+
+	template <typename T>
+	ComponentAllocator<T> *get_allocator()
+	{
+		auto *t = component_types.find(ComponentIDMapping::get_id<T>());
+		assert(t);
+		return static_cast<ComponentAllocator<T> *>(t);
+	}
 
 	template <typename... Us>
 	struct GroupRegisters;
@@ -441,6 +710,14 @@ T *Entity::allocate_component(Ts&&... ts)
 	return pool->allocate_component<T>(*this, std::forward<Ts>(ts)...);
 }
 
+template <typename T>
+void Entity::mark_changed()
+{
+	auto *t = get_component<T>();
+	if (t)
+		pool->mark_changed(t);
+}
+
 template <typename T>
 void Entity::free_component()
 {
@@ -0,0 +1,79 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "ecs.hpp"
+#include "task_composer.hpp"
+#include <memory>
+#include <vector>
+
+namespace Granite
+{
+// Parallel iteration over the elements of a component group, or any vector such as get_component_entities().
+// Each call begins a new pipeline stage on composer and splits the elements into contiguous ranges.
+// The elements must not be added to or removed from until the stage has completed,
+// i.e. do not create or free components belonging to the group from within func.
+
+// Calls func(element) for every element. grain is the minimum number of elements per task, 0 for default.
+template <typename T, typename Func>
+TaskGroup &for_each_parallel(TaskComposer &composer, const std::vector<T> &elements, Func &&func, size_t grain = 0)
+{
+	return composer.parallel_for(elements.size(), grain,
+	                             [&elements, func](size_t begin, size_t end) {
+		                             for (size_t i = begin; i < end; i++)
+			                             func(elements[i]);
+	                             });
+}
+
+// Calls func(accumulator, element) with one default constructed accumulator per task.
+// A second pipeline stage then calls merge(*result, accumulator) for each task in order.
+// *result must remain valid until the second stage completes.
+template <typename Acc, typename T, typename Func, typename Merge>
+void for_each_parallel(TaskComposer &composer, const std::vector<T> &elements, Acc *result,
+                       Func &&func, Merge &&merge, size_t grain = 0)
+{
+	size_t count = elements.size();
+	unsigned num_tasks = composer.compute_parallel_for_tasks(count, grain);
+	auto accumulators = std::make_shared<std::vector<Acc>>(num_tasks);
+
+	auto &stage = composer.begin_pipeline_stage();
+	stage.set_desc("ecs-for-each-parallel");
+	for (unsigned i = 0; i < num_tasks; i++)
+	{
+		size_t begin = (count * i) / num_tasks;
+		size_t end = (count * (i + 1)) / num_tasks;
+		stage.enqueue_task([&elements, func, accumulators, begin, end, i]() {
+			auto &acc = (*accumulators)[i];
+			for (size_t j = begin; j < end; j++)
+				func(acc, elements[j]);
+		});
+	}
+
+	auto &merge_stage = composer.begin_pipeline_stage();
+	merge_stage.set_desc("ecs-for-each-parallel-merge");
+	merge_stage.enqueue_task([merge, accumulators, result]() {
+		for (auto &acc : *accumulators)
+			merge(*result, acc);
+	});
+}
+}
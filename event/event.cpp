@@ -42,31 +42,78 @@ EventManager::~EventManager()
 	}
 }
 
+void EventManager::enqueue_posted_events()
+{
+	auto *node = posted_events.exchange(nullptr, memory_order_acquire);
+
+	// The list is in reverse posting order.
+	PostedEventBase *ordered = nullptr;
+	while (node)
+	{
+		auto *next = node->next;
+		node->next = ordered;
+		ordered = node;
+		node = next;
+	}
+
+	while (ordered)
+	{
+		auto *next = ordered->next;
+		ordered->enqueue(*this);
+		delete ordered;
+		ordered = next;
+	}
+}
+
 void EventManager::dispatch()
 {
+	enqueue_posted_events();
+
 	for (auto &event_type : events)
 	{
-		auto &handlers = event_type.handlers;
-		auto &queued_events = event_type.queued_events;
-		auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) {
-			for (auto &event : queued_events)
-			{
-				if (!handler.mem_fn(handler.handler, *event))
+		if (!event_type.queue)
+			continue;
+
+		auto &queue = *event_type.queue;
+		size_t count = queue.begin_dispatch();
+		if (count)
+		{
+			auto &handlers = event_type.handlers;
+			auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) {
+				for (size_t i = 0; i < count; i++)
 				{
-					handler.unregister_key->release_manager_reference();
-					return true;
+					if (!handler.mem_fn(handler.handler, queue.get_dispatch_event(i)))
+					{
+						handler.unregister_key->release_manager_reference();
+						return true;
+					}
 				}
-			}
-			return false;
-		});
+				return false;
+			});
+			handlers.erase(itr, end(handlers));
 
-		handlers.erase(itr, end(handlers));
-		queued_events.clear();
+			dispatch_events(event_type, queue.get_dispatch_event(0), count);
+		}
+		queue.end_dispatch();
 	}
 }
 
-void EventManager::dispatch_event(std::vector<Handler> &handlers, const Event &e)
+void EventManager::dispatch_events(EventTypeData &event_type, const Event &first, size_t count)
+{
+	auto &handlers = event_type.batch_handlers;
+	auto itr = remove_if(begin(handlers), end(handlers), [&](const BatchHandler &handler) -> bool {
+		bool to_remove = !handler.mem_fn(handler.handler, first, count);
+		if (to_remove)
+			handler.unregister_key->release_manager_reference();
+		return to_remove;
+	});
+
+	handlers.erase(itr, end(handlers));
+}
+
+void EventManager::dispatch_event(EventTypeData &event_type, const Event &e)
 {
+	auto &handlers = event_type.handlers;
 	auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) -> bool {
 		bool to_remove = !handler.mem_fn(handler.handler, e);
 		if (to_remove)
@@ -75,6 +122,7 @@ void EventManager::dispatch_event(std::vector<Handler> &handlers, const Event &e
 	});
 
 	handlers.erase(itr, end(handlers));
+	dispatch_events(event_type, e, 1);
 }
 
 void EventManager::dispatch_up_events(std::vector<std::unique_ptr<Event>> &up_events, const LatchHandler &handler)
@@ -99,6 +147,8 @@ void EventManager::EventTypeData::flush_recursive_handlers()
 {
 	handlers.insert(end(handlers), begin(recursive_handlers), end(recursive_handlers));
 	recursive_handlers.clear();
+	batch_handlers.insert(end(batch_handlers), begin(recursive_batch_handlers), end(recursive_batch_handlers));
+	recursive_batch_handlers.clear();
 }
 
 void EventManager::dispatch_up_event(LatchEventTypeData &event_type, const Event &event)
@@ -135,6 +185,20 @@ void EventManager::unregister_handler(EventHandler *handler)
 
 		if (itr != end(event_type.handlers))
 			event_type.handlers.erase(itr, end(event_type.handlers));
+
+		auto batch_itr = remove_if(begin(event_type.batch_handlers), end(event_type.batch_handlers),
+		                           [&](const BatchHandler &h) -> bool {
+			                           bool to_remove = h.unregister_key == handler;
+			                           if (to_remove)
+				                           h.unregister_key->release_manager_reference();
+			                           return to_remove;
+		                           });
+
+		if (batch_itr != end(event_type.batch_handlers) && event_type.dispatching)
+			throw logic_error("Unregistering handlers while dispatching events.");
+
+		if (batch_itr != end(event_type.batch_handlers))
+			event_type.batch_handlers.erase(batch_itr, end(event_type.batch_handlers));
 	}
 }
 
@@ -26,12 +26,15 @@
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <atomic>
 #include "compile_time_hash.hpp"
 #include "intrusive_hash_map.hpp"
 #include "global_managers.hpp"
 
 #define EVENT_MANAGER_REGISTER(clazz, member, event) \
 	GRANITE_EVENT_MANAGER()->register_handler<clazz, event, &clazz::member>(this)
+#define EVENT_MANAGER_REGISTER_BATCH(clazz, member, event) \
+	GRANITE_EVENT_MANAGER()->register_batch_handler<clazz, event, &clazz::member>(this)
 #define EVENT_MANAGER_REGISTER_LATCH(clazz, up_event, down_event, event) \
 	GRANITE_EVENT_MANAGER()->register_latch_handler<clazz, event, &clazz::up_event, &clazz::down_event>(this)
 
@@ -45,6 +48,13 @@ Return member_function_invoker(void *object, const Event &e)
 	return (static_cast<T *>(object)->*callback)(static_cast<const EventType &>(e));
 }
 
+// Events delivered together are contiguous in memory, first is the first of count events.
+template <typename T, typename EventType, bool (T::*callback)(const EventType *events, size_t count)>
+bool member_function_batch_invoker(void *object, const Event &first, size_t count)
+{
+	return (static_cast<T *>(object)->*callback)(&static_cast<const EventType &>(first), count);
+}
+
 #define GRANITE_EVENT_TYPE_HASH(x) ::Util::compile_time_fnv1(#x)
 using EventType = uint64_t;
 
@@ -112,14 +122,29 @@ private:
 class EventManager final : public EventManagerInterface
 {
 public:
+	// Events are stored by value in a contiguous queue per type, and delivered in dispatch().
+	// Only call from the thread which calls dispatch(), other threads must use post().
 	template<typename T, typename... P>
 	void enqueue(P&&... p)
 	{
 		static constexpr auto type = T::get_type_id();
 		auto &l = events[type];
+		if (!l.queue)
+			l.queue.reset(new EventQueue<T>());
+		static_cast<EventQueue<T> *>(l.queue.get())->pending.emplace_back(std::forward<P>(p)...);
+	}
 
-		auto ptr = std::unique_ptr<Event>(new T(std::forward<P>(p)...));
-		l.queued_events.emplace_back(std::move(ptr));
+	// Thread-safe and lock-free. The event is moved into the regular queue at the start of the next dispatch().
+	template<typename T, typename... P>
+	void post(P&&... p)
+	{
+		auto *node = new PostedEvent<T>(std::forward<P>(p)...);
+		node->next = posted_events.load(std::memory_order_relaxed);
+		while (!posted_events.compare_exchange_weak(node->next, node,
+		                                            std::memory_order_release,
+		                                            std::memory_order_relaxed))
+		{
+		}
 	}
 
 	template<typename T, typename... P>
@@ -150,14 +175,14 @@ public:
 	{
 		static constexpr auto type = T::get_type_id();
 		auto &l = events[type];
-		dispatch_event(l.handlers, t);
+		dispatch_event(l, t);
 	}
 
 	void dispatch_inline(const Event &e)
 	{
 		assert(e.get_type_id() != 0);
 		auto &l = events[e.get_type_id()];
-		dispatch_event(l.handlers, e);
+		dispatch_event(l, e);
 	}
 
 	void dispatch();
@@ -174,6 +199,21 @@ public:
 			l.handlers.push_back({ member_function_invoker<bool, T, EventType, mem_fn>, handler, handler });
 	}
 
+	// The handler receives every event of a type queued since the last dispatch() in one call.
+	// Inline dispatches are delivered as a single event.
+	template<typename T, typename EventType, bool (T::*mem_fn)(const EventType *, size_t)>
+	void register_batch_handler(T *handler)
+	{
+		handler->add_manager_reference(this);
+		static constexpr auto type_id = EventType::get_type_id();
+		auto &l = events[type_id];
+		BatchHandler h{ member_function_batch_invoker<T, EventType, mem_fn>, handler, handler };
+		if (l.dispatching)
+			l.recursive_batch_handlers.push_back(h);
+		else
+			l.batch_handlers.push_back(h);
+	}
+
 	void unregister_handler(EventHandler *handler);
 
 	template<typename T, typename EventType, void (T::*up_fn)(const EventType &), void (T::*down_fn)(const EventType &)>
@@ -208,6 +248,13 @@ private:
 		EventHandler *unregister_key;
 	};
 
+	struct BatchHandler
+	{
+		bool (*mem_fn)(void *object, const Event &first, size_t count);
+		void *handler;
+		EventHandler *unregister_key;
+	};
+
 	struct LatchHandler
 	{
 		void (*up_fn)(void *object, const Event &event);
@@ -216,11 +263,69 @@ private:
 		EventHandler *unregister_key;
 	};
 
+	struct EventQueueBase
+	{
+		virtual ~EventQueueBase() = default;
+		// Moves pending events to the dispatch list, so handlers can safely enqueue more.
+		virtual size_t begin_dispatch() = 0;
+		virtual const Event &get_dispatch_event(size_t index) const = 0;
+		virtual void end_dispatch() = 0;
+	};
+
+	template <typename T>
+	struct EventQueue : EventQueueBase
+	{
+		std::vector<T> pending;
+		std::vector<T> dispatching;
+
+		size_t begin_dispatch() override
+		{
+			std::swap(pending, dispatching);
+			return dispatching.size();
+		}
+
+		const Event &get_dispatch_event(size_t index) const override
+		{
+			return dispatching[index];
+		}
+
+		void end_dispatch() override
+		{
+			dispatching.clear();
+		}
+	};
+
+	struct PostedEventBase
+	{
+		virtual ~PostedEventBase() = default;
+		virtual void enqueue(EventManager &manager) = 0;
+		PostedEventBase *next = nullptr;
+	};
+
+	template <typename T>
+	struct PostedEvent : PostedEventBase
+	{
+		template <typename... P>
+		explicit PostedEvent(P&&... p)
+			: event(std::forward<P>(p)...)
+		{
+		}
+
+		void enqueue(EventManager &manager) override
+		{
+			manager.enqueue<T>(std::move(event));
+		}
+
+		T event;
+	};
+
 	struct EventTypeData : Util::IntrusiveHashMapEnabled<EventTypeData>
 	{
-		std::vector<std::unique_ptr<Event>> queued_events;
+		std::unique_ptr<EventQueueBase> queue;
 		std::vector<Handler> handlers;
 		std::vector<Handler> recursive_handlers;
+		std::vector<BatchHandler> batch_handlers;
+		std::vector<BatchHandler> recursive_batch_handlers;
 		bool enqueueing = false;
 		bool dispatching = false;
 
@@ -238,7 +343,9 @@ private:
 		void flush_recursive_handlers();
 	};
 
-	void dispatch_event(std::vector<Handler> &handlers, const Event &e);
+	void dispatch_event(EventTypeData &event_type, const Event &e);
+	void dispatch_events(EventTypeData &event_type, const Event &first, size_t count);
+	void enqueue_posted_events();
 	void dispatch_up_events(std::vector<std::unique_ptr<Event>> &events, const LatchHandler &handler);
 	void dispatch_down_events(std::vector<std::unique_ptr<Event>> &events, const LatchHandler &handler);
 	void dispatch_up_event(LatchEventTypeData &event_type, const Event &event);
@@ -247,5 +354,6 @@ private:
 	Util::IntrusiveHashMap<EventTypeData> events;
 	Util::IntrusiveHashMap<LatchEventTypeData> latched_events;
 	uint64_t cookie_counter = 0;
+	std::atomic<PostedEventBase *> posted_events{nullptr};
 };
 }
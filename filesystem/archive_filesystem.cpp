@@ -0,0 +1,316 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "archive_filesystem.hpp"
+#include "path_utils.hpp"
+#include "logging.hpp"
+#include "hash.hpp"
+#include "lz4.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <string.h>
+
+namespace Granite
+{
+namespace Archive
+{
+uint64_t hash_path(const std::string &canonical_path)
+{
+	Util::Hasher h;
+	h.string(canonical_path);
+	return h.get();
+}
+}
+
+// Owns the decompressed payload of an LZ4 entry.
+struct ArchiveDecompressedFile : File
+{
+	void *map() override
+	{
+		return data.data();
+	}
+
+	void *map_write(size_t) override
+	{
+		return nullptr;
+	}
+
+	bool reopen() override
+	{
+		return true;
+	}
+
+	void unmap() override
+	{
+	}
+
+	size_t get_size() override
+	{
+		return data.size();
+	}
+
+	std::vector<uint8_t> data;
+};
+
+ArchiveFilesystem::ArchiveFilesystem(std::unique_ptr<File> file_)
+	: file(std::move(file_))
+{
+	if (!file)
+		throw std::runtime_error("No archive file.");
+	parse();
+}
+
+static bool range_is_valid(const Archive::Range &range, uint64_t file_size)
+{
+	return range.offset <= file_size && range.size <= file_size - range.offset;
+}
+
+void ArchiveFilesystem::parse()
+{
+	uint64_t file_size = file->get_size();
+	if (file_size < sizeof(Archive::Header))
+		throw std::runtime_error("Archive too small.");
+
+	mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		throw std::runtime_error("Failed to map archive.");
+
+	Archive::Header header;
+	memcpy(&header, mapped, sizeof(header));
+	if (header.magic != Archive::Magic)
+		throw std::runtime_error("Invalid archive magic.");
+	if (header.version != Archive::Version)
+		throw std::runtime_error("Unsupported archive version.");
+	if (header.bucket_bits > 31)
+		throw std::range_error("Archive bucket count out of range.");
+
+	if (!range_is_valid(header.entries, file_size) ||
+	    !range_is_valid(header.buckets, file_size) ||
+	    !range_is_valid(header.strings, file_size))
+		throw std::range_error("Archive table out of range.");
+
+	if (header.entries.size != uint64_t(header.entry_count) * sizeof(Archive::Entry) ||
+	    header.buckets.size != ((uint64_t(1) << header.bucket_bits) + 1) * sizeof(uint32_t))
+		throw std::range_error("Archive table size mismatch.");
+
+	// The tables are mapped in place.
+	if ((header.entries.offset & (alignof(Archive::Entry) - 1)) != 0 ||
+	    (header.buckets.offset & (alignof(uint32_t) - 1)) != 0)
+		throw std::runtime_error("Archive tables are misaligned.");
+
+	entries = reinterpret_cast<const Archive::Entry *>(mapped + header.entries.offset);
+	buckets = reinterpret_cast<const uint32_t *>(mapped + header.buckets.offset);
+	strings = reinterpret_cast<const char *>(mapped + header.strings.offset);
+	entry_count = header.entry_count;
+	bucket_bits = header.bucket_bits;
+
+	// Validate once here so lookups can trust the index.
+	uint32_t num_buckets = 1u << bucket_bits;
+	for (uint32_t i = 0; i < num_buckets; i++)
+		if (buckets[i] > buckets[i + 1] || buckets[i + 1] > entry_count)
+			throw std::range_error("Archive bucket out of range.");
+
+	for (uint32_t i = 0; i < entry_count; i++)
+	{
+		auto &entry = entries[i];
+		if (!range_is_valid(entry.data, file_size))
+			throw std::range_error("Archive entry out of range.");
+		if (uint64_t(entry.path_offset) + entry.path_length > header.strings.size)
+			throw std::range_error("Archive path out of range.");
+		if (entry.parent != Archive::InvalidIndex && entry.parent >= entry_count)
+			throw std::range_error("Archive parent out of range.");
+		if (entry.compression != Archive::Compression::None && entry.compression != Archive::Compression::LZ4)
+			throw std::runtime_error("Unknown archive compression.");
+		if (entry.compression == Archive::Compression::None && entry.data.size != entry.uncompressed_size)
+			throw std::runtime_error("Archive entry size mismatch.");
+	}
+}
+
+const Archive::Entry *ArchiveFilesystem::find_entry(const std::string &path) const
+{
+	uint64_t hash = Archive::hash_path(path);
+	uint32_t bucket = Archive::get_bucket(hash, bucket_bits);
+
+	for (uint32_t i = buckets[bucket]; i < buckets[bucket + 1]; i++)
+	{
+		auto &entry = entries[i];
+		if (entry.hash > hash)
+			break;
+
+		if (entry.hash == hash && entry.path_length == path.size() &&
+		    memcmp(strings + entry.path_offset, path.data(), path.size()) == 0)
+		{
+			return &entry;
+		}
+	}
+
+	return nullptr;
+}
+
+std::vector<ListEntry> ArchiveFilesystem::list(const std::string &path)
+{
+	auto canon_path = Path::canonicalize_path(path);
+	uint32_t parent = Archive::InvalidIndex;
+
+	if (!canon_path.empty())
+	{
+		auto *dir = find_entry(canon_path);
+		if (!dir || (dir->flags & Archive::ENTRY_DIRECTORY_BIT) == 0)
+			return {};
+		parent = uint32_t(dir - entries);
+	}
+
+	// Listing is rare compared to lookups, a linear pass over the parent links is fine.
+	std::vector<ListEntry> result;
+	for (uint32_t i = 0; i < entry_count; i++)
+	{
+		auto &entry = entries[i];
+		if (entry.parent != parent)
+			continue;
+
+		std::string entry_path(strings + entry.path_offset, entry.path_length);
+		result.push_back({ Path::join(path, Path::basename(entry_path)),
+		                   (entry.flags & Archive::ENTRY_DIRECTORY_BIT) != 0 ? PathType::Directory : PathType::File });
+	}
+	return result;
+}
+
+bool ArchiveFilesystem::stat(const std::string &path, FileStat &stat)
+{
+	auto canon_path = Path::canonicalize_path(path);
+	stat.last_modified = 0;
+
+	if (canon_path.empty())
+	{
+		stat.size = 0;
+		stat.type = PathType::Directory;
+		return true;
+	}
+
+	auto *entry = find_entry(canon_path);
+	if (!entry)
+		return false;
+
+	if ((entry->flags & Archive::ENTRY_DIRECTORY_BIT) != 0)
+	{
+		stat.size = 0;
+		stat.type = PathType::Directory;
+	}
+	else
+	{
+		stat.size = entry->uncompressed_size;
+		stat.type = PathType::File;
+	}
+	return true;
+}
+
+std::unique_ptr<File> ArchiveFilesystem::open(const std::string &path, FileMode mode)
+{
+	if (mode != FileMode::ReadOnly)
+		return {};
+
+	auto *entry = find_entry(Path::canonicalize_path(path));
+	if (!entry || (entry->flags & Archive::ENTRY_DIRECTORY_BIT) != 0)
+		return {};
+
+	if (entry->compression == Archive::Compression::None)
+		return std::make_unique<ConstantMemoryFile>(mapped + entry->data.offset, entry->data.size);
+
+	if (entry->uncompressed_size > std::numeric_limits<size_t>::max())
+		return {};
+
+	auto decompressed = std::make_unique<ArchiveDecompressedFile>();
+	decompressed->data.resize(entry->uncompressed_size);
+	if (!Util::lz4_decompress(mapped + entry->data.offset, entry->data.size,
+	                          decompressed->data.data(), decompressed->data.size()))
+	{
+		LOGE("Failed to decompress %s from archive.\n", path.c_str());
+		return {};
+	}
+
+	return decompressed;
+}
+
+bool ArchiveFilesystem::read_entry(const Archive::Entry &entry, uint64_t offset, void *data, size_t size,
+                                   size_t &read_size) const
+{
+	read_size = 0;
+	if (offset >= entry.uncompressed_size || !size)
+		return true;
+
+	read_size = size_t(std::min<uint64_t>(size, entry.uncompressed_size - offset));
+
+	if (entry.compression == Archive::Compression::None)
+	{
+		memcpy(data, mapped + entry.data.offset + offset, read_size);
+		return true;
+	}
+
+	// LZ4 blocks cannot be decoded from the middle, decode straight into the destination when we can.
+	if (offset == 0 && read_size == entry.uncompressed_size)
+		return Util::lz4_decompress(mapped + entry.data.offset, entry.data.size, data, read_size);
+
+	std::vector<uint8_t> scratch(entry.uncompressed_size);
+	if (!Util::lz4_decompress(mapped + entry.data.offset, entry.data.size, scratch.data(), scratch.size()))
+		return false;
+	memcpy(data, scratch.data() + offset, read_size);
+	return true;
+}
+
+bool ArchiveFilesystem::read_batch(FileReadRequest *requests, size_t count)
+{
+	bool success = true;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &req = requests[i];
+		req.read_size = 0;
+		auto *entry = find_entry(Path::canonicalize_path(req.path));
+		req.success = entry && (entry->flags & Archive::ENTRY_DIRECTORY_BIT) == 0 &&
+		              read_entry(*entry, req.offset, req.data, req.size, req.read_size);
+		if (!req.success)
+		{
+			req.read_size = 0;
+			success = false;
+		}
+	}
+	return success;
+}
+
+FileNotifyHandle ArchiveFilesystem::install_notification(const std::string &, std::function<void (const FileNotifyInfo &)>)
+{
+	return -1;
+}
+
+void ArchiveFilesystem::uninstall_notification(FileNotifyHandle)
+{
+}
+
+void ArchiveFilesystem::poll_notifications()
+{
+}
+
+int ArchiveFilesystem::get_notification_fd() const
+{
+	return -1;
+}
+}
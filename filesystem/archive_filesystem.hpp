@@ -0,0 +1,135 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "filesystem.hpp"
+#include <stdint.h>
+
+namespace Granite
+{
+// Read-only asset archive, written by tools/build_archive.cpp (.gpak).
+// Entries are sorted by the 64-bit hash of their canonical path and bucketed by the top
+// bucket_bits of the hash, so a lookup touches one bucket of the mapped index and never makes a syscall.
+// Directories are entries as well, so list() and stat() do not need a tree.
+// File payloads are aligned to DataAlignment and are either stored or LZ4 compressed.
+// The file is little endian.
+namespace Archive
+{
+enum : uint32_t
+{
+	Magic = 0x4b504147, // "GAPK"
+	Version = 1,
+	DataAlignment = 4096,
+	InvalidIndex = ~0u
+};
+
+enum : uint32_t
+{
+	ENTRY_DIRECTORY_BIT = 1 << 0
+};
+
+enum class Compression : uint32_t
+{
+	None = 0,
+	LZ4 = 1
+};
+
+// Byte range from the start of the file.
+struct Range
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct Header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t bucket_bits;
+	// Entry[entry_count], sorted by hash.
+	Range entries;
+	// uint32_t[(1 << bucket_bits) + 1], first entry of each bucket.
+	Range buckets;
+	Range strings;
+};
+
+struct Entry
+{
+	uint64_t hash;
+	// Stored payload, compressed or not.
+	Range data;
+	uint64_t uncompressed_size;
+	uint32_t path_offset;
+	uint32_t path_length;
+	// Entry index of the parent directory, InvalidIndex for the archive root.
+	uint32_t parent;
+	uint32_t flags;
+	Compression compression;
+	uint32_t padding;
+};
+
+uint64_t hash_path(const std::string &canonical_path);
+
+static inline uint32_t get_bucket(uint64_t hash, uint32_t bucket_bits)
+{
+	return bucket_bits ? uint32_t(hash >> (64 - bucket_bits)) : 0;
+}
+}
+
+class ArchiveFilesystem : public FilesystemBackend
+{
+public:
+	// Throws if the archive is malformed.
+	explicit ArchiveFilesystem(std::unique_ptr<File> file);
+
+	std::vector<ListEntry> list(const std::string &path) override;
+
+	std::unique_ptr<File> open(const std::string &path, FileMode mode) override;
+
+	bool stat(const std::string &path, FileStat &stat) override;
+
+	FileNotifyHandle install_notification(const std::string &path, std::function<void(const FileNotifyInfo &)> func) override;
+
+	void uninstall_notification(FileNotifyHandle handle) override;
+
+	void poll_notifications() override;
+
+	int get_notification_fd() const override;
+
+	bool read_batch(FileReadRequest *requests, size_t count) override;
+
+private:
+	std::unique_ptr<File> file;
+	const uint8_t *mapped = nullptr;
+	const Archive::Entry *entries = nullptr;
+	const uint32_t *buckets = nullptr;
+	const char *strings = nullptr;
+	uint32_t entry_count = 0;
+	uint32_t bucket_bits = 0;
+
+	void parse();
+	const Archive::Entry *find_entry(const std::string &path) const;
+	bool read_entry(const Archive::Entry &entry, uint64_t offset, void *data, size_t size, size_t &read_size) const;
+};
+}
@@ -26,6 +26,7 @@
 #include "os_filesystem.hpp"
 #include "string_helpers.hpp"
 #include <algorithm>
+#include <chrono>
 #include <stdlib.h>
 #include <string.h>
 
@@ -131,6 +132,140 @@ StdioFile::~StdioFile()
 	}
 }
 
+bool FilesystemBackend::read_batch(FileReadRequest *requests, size_t count)
+{
+	bool success = true;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &req = requests[i];
+		req.read_size = 0;
+		req.success = false;
+
+		auto file = open(req.path, FileMode::ReadOnly);
+		if (!file)
+		{
+			success = false;
+			continue;
+		}
+
+		size_t file_size = file->get_size();
+		if (req.offset < file_size && req.size)
+		{
+			auto *mapped = static_cast<const uint8_t *>(file->map());
+			if (!mapped)
+			{
+				success = false;
+				continue;
+			}
+
+			req.read_size = std::min<size_t>(req.size, file_size - req.offset);
+			memcpy(req.data, mapped + req.offset, req.read_size);
+		}
+		req.success = true;
+	}
+
+	return success;
+}
+
+void FilesystemBackend::prefetch(const std::string &, uint64_t, uint64_t)
+{
+}
+
+void FilesystemBackend::read_async(FileReadRequest request, FileReadCallback callback)
+{
+	if (io_queue)
+	{
+		io_queue->enqueue(this, move(request), move(callback));
+	}
+	else
+	{
+		read_batch(&request, 1);
+		if (callback)
+			callback(request);
+	}
+}
+
+static uint64_t get_notify_time_ns()
+{
+	return uint64_t(chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void FileNotifyCoalescer::set_debounce_ms(unsigned ms)
+{
+	debounce_ns = uint64_t(ms) * 1000 * 1000;
+}
+
+void FileNotifyCoalescer::push(FileNotifyInfo info)
+{
+	auto key = to_string(info.handle) + ":" + info.path;
+	auto now = get_notify_time_ns();
+
+	auto itr = pending.find(key);
+	if (itr == pending.end())
+	{
+		pending[key] = { move(info), now, order++ };
+		return;
+	}
+
+	auto &p = itr->second;
+	p.last_event_ns = now;
+
+	auto prev = p.info.type;
+	auto type = info.type;
+
+	if (prev == FileNotifyType::FileCreated && type == FileNotifyType::FileDeleted)
+	{
+		// A temporary file nobody needs to hear about.
+		pending.erase(itr);
+	}
+	else if (prev == FileNotifyType::FileDeleted && type == FileNotifyType::FileCreated)
+	{
+		// Save by rename, the file was replaced.
+		p.info.type = FileNotifyType::FileChanged;
+	}
+	else if (!(prev == FileNotifyType::FileCreated && type == FileNotifyType::FileChanged))
+		p.info.type = type;
+}
+
+void FileNotifyCoalescer::flush(const std::function<void (const FileNotifyInfo &)> &func)
+{
+	if (pending.empty())
+		return;
+
+	auto now = get_notify_time_ns();
+	vector<Pending> ready;
+
+	for (auto itr = pending.begin(); itr != pending.end(); )
+	{
+		if (now - itr->second.last_event_ns >= debounce_ns)
+		{
+			ready.push_back(move(itr->second));
+			itr = pending.erase(itr);
+		}
+		else
+			++itr;
+	}
+
+	sort(ready.begin(), ready.end(), [](const Pending &a, const Pending &b) {
+		return a.order < b.order;
+	});
+
+	for (auto &p : ready)
+		func(p.info);
+}
+
+void FileNotifyCoalescer::drop_handle(FileNotifyHandle handle)
+{
+	for (auto itr = pending.begin(); itr != pending.end(); )
+	{
+		if (itr->second.info.handle == handle)
+			itr = pending.erase(itr);
+		else
+			++itr;
+	}
+}
+
 vector<ListEntry> FilesystemBackend::walk(const std::string &path)
 {
 	auto entries = list(path);
@@ -152,6 +287,13 @@ vector<ListEntry> FilesystemBackend::walk(const std::string &path)
 
 Filesystem::Filesystem()
 {
+	unsigned io_threads = 2;
+	if (const char *env = getenv("GRANITE_FILESYSTEM_IO_THREADS"))
+		io_threads = unsigned(strtoul(env, nullptr, 0));
+	io_queue = make_unique<FileIOQueue>(io_threads);
+	if (const char *env = getenv("GRANITE_FILESYSTEM_NOTIFY_DEBOUNCE_MS"))
+		notify_debounce_ms = unsigned(strtoul(env, nullptr, 0));
+
 	register_protocol("file", unique_ptr<FilesystemBackend>(new OSFilesystem(".")));
 	register_protocol("memory", unique_ptr<FilesystemBackend>(new ScratchFilesystem));
 
@@ -214,7 +356,13 @@ void Filesystem::setup_default_filesystem(Filesystem *filesystem, const char *de
 
 void Filesystem::register_protocol(const std::string &proto, std::unique_ptr<FilesystemBackend> fs)
 {
+	// Async reads may still reference a backend we are about to replace.
+	if (protocols.count(proto))
+		io_queue->wait_idle();
+
 	fs->set_protocol(proto);
+	fs->set_io_queue(io_queue.get());
+	fs->set_notification_debounce_ms(notify_debounce_ms);
 	protocols[proto] = move(fs);
 }
 
@@ -284,6 +432,174 @@ bool Filesystem::write_buffer_to_file(const std::string &path, const void *data,
 	return true;
 }
 
+bool Filesystem::read_batch(FileReadRequest *requests, size_t count)
+{
+	bool success = true;
+	vector<FileReadRequest> backend_requests;
+
+	// Hand each run of requests with the same protocol to its backend in one go.
+	size_t i = 0;
+	while (i < count)
+	{
+		auto protocol = Path::protocol_split(requests[i].path).first;
+		size_t end = i;
+		backend_requests.clear();
+
+		for (; end < count; end++)
+		{
+			auto paths = Path::protocol_split(requests[end].path);
+			if (paths.first != protocol)
+				break;
+
+			record_access(requests[end].path, requests[end].offset, requests[end].size);
+			FileReadRequest req = requests[end];
+			req.path = move(paths.second);
+			backend_requests.push_back(move(req));
+		}
+
+		auto *backend = get_backend(protocol);
+		if (!backend || !backend->read_batch(backend_requests.data(), backend_requests.size()))
+			success = false;
+
+		for (size_t j = i; j < end; j++)
+		{
+			requests[j].read_size = backend ? backend_requests[j - i].read_size : 0;
+			requests[j].success = backend && backend_requests[j - i].success;
+		}
+
+		i = end;
+	}
+
+	return success;
+}
+
+void Filesystem::read_async(FileReadRequest request, FileReadCallback callback)
+{
+	auto paths = Path::protocol_split(request.path);
+	auto *backend = get_backend(paths.first);
+	if (!backend)
+	{
+		request.read_size = 0;
+		request.success = false;
+		if (callback)
+			callback(request);
+		return;
+	}
+
+	record_access(request.path, request.offset, request.size);
+	auto full_path = move(request.path);
+	request.path = move(paths.second);
+	backend->read_async(move(request), [full_path = move(full_path), callback = move(callback)](FileReadRequest &req) {
+		req.path = full_path;
+		if (callback)
+			callback(req);
+	});
+}
+
+void Filesystem::read_async(const std::string &path, uint64_t offset, void *data, size_t size, FileReadCallback callback)
+{
+	FileReadRequest request;
+	request.path = path;
+	request.offset = offset;
+	request.data = data;
+	request.size = size;
+	read_async(move(request), move(callback));
+}
+
+void Filesystem::wait_async_reads()
+{
+	io_queue->wait_idle();
+}
+
+Filesystem::~Filesystem()
+{
+	if (prefetch_thread.joinable())
+		prefetch_thread.join();
+}
+
+void Filesystem::record_access(const std::string &path, uint64_t offset, uint64_t size)
+{
+	std::lock_guard<std::mutex> holder{access_trace.lock};
+	if (!access_trace.active)
+		return;
+
+	auto key = path + '@' + std::to_string(offset) + ':' + std::to_string(size);
+	if (access_trace.seen.insert(move(key)).second)
+		access_trace.entries.push_back({ path, offset, size });
+}
+
+void Filesystem::begin_access_trace(const std::string &trace_path)
+{
+	std::lock_guard<std::mutex> holder{access_trace.lock};
+	access_trace.path = trace_path;
+	access_trace.entries.clear();
+	access_trace.seen.clear();
+	access_trace.active = true;
+}
+
+void Filesystem::end_access_trace()
+{
+	std::string trace_path;
+	std::vector<AccessTraceEntry> entries;
+	{
+		std::lock_guard<std::mutex> holder{access_trace.lock};
+		if (!access_trace.active)
+			return;
+		access_trace.active = false;
+		trace_path = move(access_trace.path);
+		entries = move(access_trace.entries);
+		access_trace.seen.clear();
+	}
+
+	// One "offset size path" line per range, paths go last since they may contain spaces.
+	std::string str = "# granite-access-trace 1\n";
+	for (auto &entry : entries)
+		str += std::to_string(entry.offset) + ' ' + std::to_string(entry.size) + ' ' + entry.path + '\n';
+
+	if (write_string_to_file(trace_path, str))
+		LOGI("Recorded %zu accesses to %s.\n", entries.size(), trace_path.c_str());
+	else
+		LOGW("Failed to write access trace to %s.\n", trace_path.c_str());
+}
+
+bool Filesystem::prefetch_access_trace(const std::string &trace_path)
+{
+	std::string str;
+	if (!read_file_to_string(trace_path, str))
+		return false;
+
+	std::vector<AccessTraceEntry> entries;
+	auto lines = Util::split_no_empty(str, "\n");
+	for (auto &line : lines)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		char *end = nullptr;
+		uint64_t offset = strtoull(line.c_str(), &end, 0);
+		if (!end || *end != ' ')
+			continue;
+		uint64_t size = strtoull(end + 1, &end, 0);
+		if (!end || *end != ' ')
+			continue;
+		entries.push_back({ end + 1, offset, size });
+	}
+
+	if (prefetch_thread.joinable())
+		prefetch_thread.join();
+
+	LOGI("Prefetching %zu accesses from %s.\n", entries.size(), trace_path.c_str());
+	prefetch_thread = std::thread([this, entries = move(entries)]() {
+		for (auto &entry : entries)
+		{
+			auto paths = Path::protocol_split(entry.path);
+			if (auto *backend = get_backend(paths.first))
+				backend->prefetch(paths.second, entry.offset, entry.size);
+		}
+	});
+	return true;
+}
+
 bool Filesystem::write_string_to_file(const std::string &path, const std::string &str)
 {
 	return write_buffer_to_file(path, str.data(), str.size());
@@ -297,6 +613,8 @@ std::unique_ptr<File> Filesystem::open(const std::string &path, FileMode mode)
 		return {};
 
 	auto file = backend->open(paths.second, mode);
+	if (file && mode == FileMode::ReadOnly)
+		record_access(path, 0, 0);
 	return file;
 }
 
@@ -320,6 +638,13 @@ bool Filesystem::stat(const std::string &path, FileStat &stat)
 	return backend->stat(paths.second, stat);
 }
 
+void Filesystem::set_notification_debounce_ms(unsigned ms)
+{
+	notify_debounce_ms = ms;
+	for (auto &proto : protocols)
+		proto.second->set_notification_debounce_ms(ms);
+}
+
 void Filesystem::poll_notifications()
 {
 	for (auto &proto : protocols)
@@ -331,6 +656,15 @@ bool Filesystem::load_text_file(const std::string &path, std::string &str)
 	return read_file_to_string(path, str);
 }
 
+bool Filesystem::get_last_modified(const std::string &path, uint64_t &timestamp)
+{
+	FileStat s;
+	if (!stat(path, s) || s.type != PathType::File)
+		return false;
+	timestamp = s.last_modified;
+	return true;
+}
+
 int ScratchFilesystem::get_notification_fd() const
 {
 	return -1;
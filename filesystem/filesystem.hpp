@@ -26,8 +26,12 @@
 #include <memory>
 #include <unordered_map>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 #include <stdio.h>
 #include "global_managers.hpp"
+#include "io_queue.hpp"
 
 namespace Granite
 {
@@ -83,6 +87,32 @@ struct FileNotifyInfo
 	FileNotifyHandle handle;
 };
 
+// Collapses bursts of raw notifications, e.g. from an editor save or a git checkout.
+// Notifications for the same handle and path are merged, and are only delivered once
+// the path has been quiet for the debounce window.
+class FileNotifyCoalescer
+{
+public:
+	void push(FileNotifyInfo info);
+
+	// Delivers everything which has settled, in the order it was first seen.
+	void flush(const std::function<void (const FileNotifyInfo &)> &func);
+
+	void drop_handle(FileNotifyHandle handle);
+	void set_debounce_ms(unsigned ms);
+
+private:
+	struct Pending
+	{
+		FileNotifyInfo info;
+		uint64_t last_event_ns;
+		uint64_t order;
+	};
+	std::unordered_map<std::string, Pending> pending;
+	uint64_t debounce_ns = 100 * 1000 * 1000;
+	uint64_t order = 0;
+};
+
 enum class FileMode
 {
 	ReadOnly,
@@ -91,6 +121,19 @@ enum class FileMode
 	WriteOnlyTransactional
 };
 
+// One read of a batch, into memory owned by the caller.
+struct FileReadRequest
+{
+	std::string path;
+	uint64_t offset = 0;
+	void *data = nullptr;
+	size_t size = 0;
+
+	// Written on completion. Reads past the end of the file are short.
+	size_t read_size = 0;
+	bool success = false;
+};
+
 class StdioFile : public File
 {
 public:
@@ -144,19 +187,45 @@ public:
 		return "";
 	}
 
+	// Reads a batch of files, or ranges of files, into caller provided buffers.
+	// Returns true if every request succeeded. The default goes through open() and map().
+	virtual bool read_batch(FileReadRequest *requests, size_t count);
+
+	// Reads into request.data and calls callback from an arbitrary thread once done.
+	// The default queues the read on the owning Filesystem's I/O threads.
+	// Backends with native async I/O can override this.
+	virtual void read_async(FileReadRequest request, FileReadCallback callback);
+
+	// Hints that a range is about to be read so it can be brought into memory ahead of time.
+	// A size of 0 covers the rest of the file. The default does nothing.
+	virtual void prefetch(const std::string &path, uint64_t offset, uint64_t size);
+
 	void set_protocol(const std::string &proto)
 	{
 		protocol = proto;
 	}
 
+	void set_io_queue(FileIOQueue *queue)
+	{
+		io_queue = queue;
+	}
+
+	void set_notification_debounce_ms(unsigned ms)
+	{
+		notify_coalescer.set_debounce_ms(ms);
+	}
+
 protected:
 	std::string protocol;
+	FileIOQueue *io_queue = nullptr;
+	FileNotifyCoalescer notify_coalescer;
 };
 
 class Filesystem final : public FilesystemInterface
 {
 public:
 	Filesystem();
+	~Filesystem() override;
 
 	void register_protocol(const std::string &proto, std::unique_ptr<FilesystemBackend> fs);
 
@@ -173,11 +242,32 @@ public:
 	bool read_file_to_string(const std::string &path, std::string &str);
 	bool write_string_to_file(const std::string &path, const std::string &str);
 	bool write_buffer_to_file(const std::string &path, const void *data, size_t size);
+	// Paths may use any protocol. Backends which support it keep many reads in flight at once.
+	bool read_batch(FileReadRequest *requests, size_t count);
+
+	// The callback sees request.path as passed in. It runs on an I/O thread,
+	// so it should hand off heavy work rather than do it in place.
+	void read_async(FileReadRequest request, FileReadCallback callback);
+	void read_async(const std::string &path, uint64_t offset, void *data, size_t size, FileReadCallback callback);
+	void wait_async_reads();
 
 	bool stat(const std::string &path, FileStat &stat);
 
+	// Records the paths and ranges read through open(), read_batch() and read_async()
+	// until end_access_trace(), which saves them to trace_path in the order they were first read.
+	void begin_access_trace(const std::string &trace_path);
+	void end_access_trace();
+
+	// Hints every range of a recorded trace to its backend in recorded order, from a background thread,
+	// so data is in memory by the time a loader discovers it needs it. Returns false if there is no trace.
+	bool prefetch_access_trace(const std::string &trace_path);
+
 	void poll_notifications();
 
+	// Applies to every registered backend, and backends registered later.
+	// Defaults to 100 ms, or GRANITE_FILESYSTEM_NOTIFY_DEBOUNCE_MS.
+	void set_notification_debounce_ms(unsigned ms);
+
 	const std::unordered_map<std::string, std::unique_ptr<FilesystemBackend>> &get_protocols() const
 	{
 		return protocols;
@@ -187,8 +277,31 @@ public:
 
 private:
 	std::unordered_map<std::string, std::unique_ptr<FilesystemBackend>> protocols;
+	// Declared after protocols so pending reads complete before backends are destroyed.
+	std::unique_ptr<FileIOQueue> io_queue;
+	unsigned notify_debounce_ms = 100;
+
+	struct AccessTraceEntry
+	{
+		std::string path;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct
+	{
+		std::mutex lock;
+		std::string path;
+		std::vector<AccessTraceEntry> entries;
+		std::unordered_set<std::string> seen;
+		bool active = false;
+	} access_trace;
+	std::thread prefetch_thread;
+
+	void record_access(const std::string &path, uint64_t offset, uint64_t size);
 
 	bool load_text_file(const std::string &path, std::string &str) override;
+	bool get_last_modified(const std::string &path, uint64_t &timestamp) override;
 };
 
 class ScratchFilesystem : public FilesystemBackend
@@ -0,0 +1,128 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "io_queue.hpp"
+#include "filesystem.hpp"
+
+namespace Granite
+{
+FileIOQueue::FileIOQueue(unsigned num_threads_)
+	: num_threads(num_threads_ ? num_threads_ : 1)
+{
+}
+
+FileIOQueue::~FileIOQueue()
+{
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		dead = true;
+	}
+	cond.notify_all();
+
+	// Pending jobs are drained before the threads exit, so their callbacks always run.
+	for (auto &thread : threads)
+		thread.join();
+}
+
+void FileIOQueue::start_threads()
+{
+	// Threads are only spun up once somebody does async I/O.
+	threads.reserve(num_threads);
+	for (unsigned i = 0; i < num_threads; i++)
+		threads.emplace_back(&FileIOQueue::thread_loop, this);
+}
+
+void FileIOQueue::enqueue(FilesystemBackend *backend, FileReadRequest request, FileReadCallback callback)
+{
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (threads.empty())
+			start_threads();
+		jobs.push_back({ backend, std::move(request.path), request.offset, request.data, request.size,
+		                 std::move(callback) });
+	}
+	cond.notify_one();
+}
+
+void FileIOQueue::wait_idle()
+{
+	std::unique_lock<std::mutex> holder{lock};
+	idle_cond.wait(holder, [this]() { return jobs.empty() && active == 0; });
+}
+
+void FileIOQueue::thread_loop()
+{
+	std::vector<Job> batch;
+	std::vector<FileReadRequest> requests;
+
+	for (;;)
+	{
+		batch.clear();
+
+		{
+			std::unique_lock<std::mutex> holder{lock};
+			cond.wait(holder, [this]() { return dead || !jobs.empty(); });
+			if (jobs.empty())
+				break;
+
+			// Take everything queued for the same backend, up to the batch limit.
+			auto *backend = jobs.front().backend;
+			for (auto itr = jobs.begin(); itr != jobs.end() && batch.size() < MaxBatchSize; )
+			{
+				if (itr->backend == backend)
+				{
+					batch.push_back(std::move(*itr));
+					itr = jobs.erase(itr);
+				}
+				else
+					++itr;
+			}
+			active++;
+		}
+
+		requests.resize(batch.size());
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			auto &req = requests[i];
+			req.path = batch[i].path;
+			req.offset = batch[i].offset;
+			req.data = batch[i].data;
+			req.size = batch[i].size;
+			req.read_size = 0;
+			req.success = false;
+		}
+
+		batch.front().backend->read_batch(requests.data(), requests.size());
+
+		for (size_t i = 0; i < batch.size(); i++)
+			if (batch[i].callback)
+				batch[i].callback(requests[i]);
+
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			active--;
+			if (jobs.empty() && active == 0)
+				idle_cond.notify_all();
+		}
+	}
+}
+}
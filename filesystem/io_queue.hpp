@@ -0,0 +1,84 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Granite
+{
+class FilesystemBackend;
+struct FileReadRequest;
+using FileReadCallback = std::function<void (FileReadRequest &)>;
+
+// Dedicated I/O threads for FilesystemBackend::read_async().
+// Reads block here rather than on compute workers. Each thread drains whatever is queued for one
+// backend at a time and issues it as a single read_batch(), so backends with native batching
+// keep many reads in flight.
+class FileIOQueue
+{
+public:
+	explicit FileIOQueue(unsigned num_threads);
+	~FileIOQueue();
+
+	FileIOQueue(const FileIOQueue &) = delete;
+	void operator=(const FileIOQueue &) = delete;
+
+	void enqueue(FilesystemBackend *backend, FileReadRequest request, FileReadCallback callback);
+
+	// Blocks until everything enqueued so far has completed.
+	void wait_idle();
+
+	enum { MaxBatchSize = 64 };
+
+private:
+	struct Job
+	{
+		FilesystemBackend *backend;
+		std::string path;
+		uint64_t offset;
+		void *data;
+		size_t size;
+		FileReadCallback callback;
+	};
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::condition_variable idle_cond;
+	std::deque<Job> jobs;
+	std::vector<std::thread> threads;
+	unsigned num_threads;
+	unsigned active = 0;
+	bool dead = false;
+
+	void start_threads();
+	void thread_loop();
+};
+}
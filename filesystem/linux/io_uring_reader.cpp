@@ -0,0 +1,317 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "io_uring_reader.hpp"
+#include "path_utils.hpp"
+#include "logging.hpp"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+namespace Granite
+{
+static int io_uring_setup(unsigned entries, io_uring_params *params)
+{
+	return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static unsigned *ring_ptr(void *ring, uint32_t offset)
+{
+	return reinterpret_cast<unsigned *>(static_cast<uint8_t *>(ring) + offset);
+}
+
+IoUringReader::~IoUringReader()
+{
+	teardown();
+}
+
+void IoUringReader::teardown()
+{
+	if (sqes)
+		munmap(sqes, sqes_size);
+	if (cq_ring && cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_size);
+	if (sq_ring)
+		munmap(sq_ring, sq_ring_size);
+	if (ring_fd >= 0)
+		close(ring_fd);
+
+	sqes = nullptr;
+	cq_ring = nullptr;
+	sq_ring = nullptr;
+	ring_fd = -1;
+}
+
+bool IoUringReader::init(unsigned queue_depth)
+{
+	io_uring_params params = {};
+	ring_fd = io_uring_setup(queue_depth, &params);
+	if (ring_fd < 0)
+	{
+		LOGW("io_uring_setup failed (errno %d), falling back to blocking reads.\n", errno);
+		return false;
+	}
+
+	entries = params.sq_entries;
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+	// Newer kernels share one mapping between the two rings.
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap)
+		sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+	sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	               ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+	{
+		sq_ring = nullptr;
+		teardown();
+		return false;
+	}
+
+	if (single_mmap)
+		cq_ring = sq_ring;
+	else
+	{
+		cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		               ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+		{
+			cq_ring = nullptr;
+			teardown();
+			return false;
+		}
+	}
+
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqe_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                     ring_fd, IORING_OFF_SQES);
+	if (sqe_ptr == MAP_FAILED)
+	{
+		teardown();
+		return false;
+	}
+	sqes = static_cast<io_uring_sqe *>(sqe_ptr);
+
+	sq_head = ring_ptr(sq_ring, params.sq_off.head);
+	sq_tail = ring_ptr(sq_ring, params.sq_off.tail);
+	sq_mask = ring_ptr(sq_ring, params.sq_off.ring_mask);
+	sq_array = ring_ptr(sq_ring, params.sq_off.array);
+	cq_head = ring_ptr(cq_ring, params.cq_off.head);
+	cq_tail = ring_ptr(cq_ring, params.cq_off.tail);
+	cq_mask = ring_ptr(cq_ring, params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe *>(static_cast<uint8_t *>(cq_ring) + params.cq_off.cqes);
+
+	slots.resize(entries);
+	return true;
+}
+
+void IoUringReader::queue_read(unsigned slot_index)
+{
+	auto &slot = slots[slot_index];
+	slot.iov.iov_base = static_cast<uint8_t *>(slot.request->data) + slot.completed;
+	slot.iov.iov_len = slot.request->size - slot.completed;
+
+	unsigned tail = *sq_tail;
+	unsigned index = tail & *sq_mask;
+	auto &sqe = sqes[index];
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_READV;
+	sqe.fd = slot.fd;
+	sqe.off = slot.request->offset + slot.completed;
+	sqe.addr = reinterpret_cast<uintptr_t>(&slot.iov);
+	sqe.len = 1;
+	sqe.user_data = slot_index;
+	sq_array[index] = index;
+
+	// The kernel must observe the SQE before the new tail.
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+bool IoUringReader::submit_and_wait(unsigned to_submit, unsigned min_complete)
+{
+	while (to_submit || min_complete)
+	{
+		int ret = io_uring_enter(ring_fd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			LOGE("io_uring_enter failed (errno %d).\n", errno);
+			return false;
+		}
+
+		to_submit -= std::min<unsigned>(to_submit, unsigned(ret));
+		// Completions are reaped by the caller, only submission needs a retry.
+		min_complete = 0;
+	}
+	return true;
+}
+
+void IoUringReader::abort_batch()
+{
+	// The ring is in an unknown state, drop it and let the caller fall back to blocking reads.
+	teardown();
+	for (auto &slot : slots)
+		if (slot.request)
+			close(slot.fd);
+	slots.clear();
+}
+
+static bool is_direct_candidate(const FileReadRequest &req)
+{
+	return req.size >= IoUringReader::DirectMinSize &&
+	       (req.offset & (IoUringReader::DirectAlignment - 1)) == 0 &&
+	       (req.size & (IoUringReader::DirectAlignment - 1)) == 0 &&
+	       (reinterpret_cast<uintptr_t>(req.data) & (IoUringReader::DirectAlignment - 1)) == 0;
+}
+
+bool IoUringReader::read_batch(const std::string &base, FileReadRequest *requests, size_t count)
+{
+	if (ring_fd < 0)
+		return false;
+
+	bool success = true;
+	size_t next_request = 0;
+	unsigned in_flight = 0;
+
+	free_slots.clear();
+	for (unsigned i = entries; i; i--)
+		free_slots.push_back(i - 1);
+
+	while (next_request < count || in_flight)
+	{
+		// Fill the queue. Opens are synchronous, reads are not.
+		unsigned queued = 0;
+		while (next_request < count && !free_slots.empty())
+		{
+			auto &req = requests[next_request++];
+			req.read_size = 0;
+			req.success = false;
+
+			auto path = Path::join(base, req.path);
+			bool direct = is_direct_candidate(req);
+			int fd = direct ? ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT) : -1;
+
+			// Not every filesystem supports O_DIRECT.
+			if (fd < 0)
+			{
+				direct = false;
+				fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			}
+
+			if (fd < 0)
+			{
+				success = false;
+				continue;
+			}
+
+			if (!req.size)
+			{
+				req.success = true;
+				close(fd);
+				continue;
+			}
+
+			unsigned slot_index = free_slots.back();
+			free_slots.pop_back();
+			slots[slot_index] = { &req, fd, direct, 0, {} };
+			queue_read(slot_index);
+			queued++;
+			in_flight++;
+		}
+
+		if (!submit_and_wait(queued, in_flight))
+		{
+			abort_batch();
+			return false;
+		}
+
+		unsigned head = *cq_head;
+		unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		unsigned resubmit = 0;
+
+		for (; head != tail; head++)
+		{
+			auto &cqe = cqes[head & *cq_mask];
+			unsigned slot_index = unsigned(cqe.user_data);
+			auto &slot = slots[slot_index];
+			auto &req = *slot.request;
+			bool done = true;
+
+			if (cqe.res == -EAGAIN || cqe.res == -EINTR)
+				done = false;
+			else if (cqe.res < 0)
+			{
+				LOGE("Failed to read %s (error %d).\n", req.path.c_str(), -cqe.res);
+				success = false;
+			}
+			else
+			{
+				slot.completed += size_t(cqe.res);
+				// A short read which is not at EOF is continued. O_DIRECT reads are only short at EOF.
+				done = cqe.res == 0 || slot.direct || slot.completed >= req.size;
+				if (done)
+				{
+					req.read_size = slot.completed;
+					req.success = true;
+				}
+			}
+
+			if (done)
+			{
+				close(slot.fd);
+				slot.request = nullptr;
+				slot.fd = -1;
+				free_slots.push_back(slot_index);
+				in_flight--;
+			}
+			else
+			{
+				queue_read(slot_index);
+				resubmit++;
+			}
+		}
+
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+		if (resubmit && !submit_and_wait(resubmit, 0))
+		{
+			abort_batch();
+			return false;
+		}
+	}
+
+	return success;
+}
+}
@@ -0,0 +1,92 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "../filesystem.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace Granite
+{
+// Minimal io_uring ring driven through raw syscalls, used by OSFilesystem::read_batch.
+// Keeps up to queue_depth reads in flight and is not thread-safe.
+class IoUringReader
+{
+public:
+	IoUringReader() = default;
+	~IoUringReader();
+	IoUringReader(const IoUringReader &) = delete;
+	void operator=(const IoUringReader &) = delete;
+
+	bool init(unsigned queue_depth);
+	bool read_batch(const std::string &base, FileReadRequest *requests, size_t count);
+
+	bool is_alive() const
+	{
+		return ring_fd >= 0;
+	}
+
+	// Reads at least this large, with offset, size and pointer aligned, bypass the page cache.
+	enum { DirectAlignment = 4096, DirectMinSize = 256 * 1024 };
+
+private:
+	int ring_fd = -1;
+	unsigned entries = 0;
+
+	void *sq_ring = nullptr;
+	void *cq_ring = nullptr;
+	size_t sq_ring_size = 0;
+	size_t cq_ring_size = 0;
+	io_uring_sqe *sqes = nullptr;
+	size_t sqes_size = 0;
+
+	unsigned *sq_head = nullptr;
+	unsigned *sq_tail = nullptr;
+	unsigned *sq_mask = nullptr;
+	unsigned *sq_array = nullptr;
+	unsigned *cq_head = nullptr;
+	unsigned *cq_tail = nullptr;
+	unsigned *cq_mask = nullptr;
+	io_uring_cqe *cqes = nullptr;
+
+	struct Slot
+	{
+		FileReadRequest *request;
+		int fd;
+		bool direct;
+		size_t completed;
+		struct iovec iov;
+	};
+	std::vector<Slot> slots;
+	std::vector<unsigned> free_slots;
+
+	void queue_read(unsigned slot);
+	bool submit_and_wait(unsigned to_submit, unsigned min_complete);
+	void teardown();
+	void abort_batch();
+};
+}
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <dirent.h>
 #include <string.h>
 #include <fcntl.h>
@@ -39,6 +40,10 @@
 #include <sys/inotify.h>
 #endif
 
+#ifdef GRANITE_FILESYSTEM_IO_URING
+#include "io_uring_reader.hpp"
+#endif
+
 using namespace std;
 
 namespace Granite
@@ -244,6 +249,52 @@ string OSFilesystem::get_filesystem_path(const string &path)
 	return Path::join(base, path);
 }
 
+bool OSFilesystem::read_batch(FileReadRequest *requests, size_t count)
+{
+#ifdef GRANITE_FILESYSTEM_IO_URING
+	// Rings are not thread-safe, so give every thread its own.
+	struct Reader
+	{
+		IoUringReader reader;
+		bool valid = false;
+		bool initialized = false;
+	};
+	static thread_local Reader reader;
+
+	if (!reader.initialized)
+	{
+		reader.initialized = true;
+		const char *env = getenv("GRANITE_IO_URING");
+		if (!env || strtol(env, nullptr, 0) != 0)
+			reader.valid = reader.reader.init(64);
+	}
+
+	if (reader.valid)
+	{
+		if (reader.reader.read_batch(base, requests, count))
+			return true;
+
+		// Some requests failed on a healthy ring, blocking reads will not fix that.
+		// If the ring itself died, retry the whole batch the blocking way.
+		if (reader.reader.is_alive())
+			return false;
+		reader.valid = false;
+	}
+#endif
+	return FilesystemBackend::read_batch(requests, count);
+}
+
+void OSFilesystem::prefetch(const std::string &path, uint64_t offset, uint64_t size)
+{
+	int fd = ::open(Path::join(base, path).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	// Kicks off readahead into the page cache without waiting for it.
+	posix_fadvise(fd, off_t(offset), off_t(size), POSIX_FADV_WILLNEED);
+	::close(fd);
+}
+
 int OSFilesystem::get_notification_fd() const
 {
 	return notify_fd;
@@ -290,19 +341,31 @@ void OSFilesystem::poll_notifications()
 
 			for (auto &func : itr->second.funcs)
 			{
-				if (func.func)
+				if (itr->second.directory)
 				{
-					if (itr->second.directory)
-					{
-						auto notify_path = protocol + "://" + Path::join(func.path, current->name);
-						func.func({ move(notify_path), type, func.virtual_handle });
-					}
-					else
-						func.func({ protocol + "://" + func.path, type, func.virtual_handle });
+					auto notify_path = protocol + "://" + Path::join(func.path, current->name);
+					notify_coalescer.push({ move(notify_path), type, func.virtual_handle });
 				}
+				else
+					notify_coalescer.push({ protocol + "://" + func.path, type, func.virtual_handle });
 			}
 		}
 	}
+
+	// Handlers may have been uninstalled while a notification was settling.
+	notify_coalescer.flush([this](const FileNotifyInfo &info) {
+		auto real = virtual_to_real.find(info.handle);
+		if (real == end(virtual_to_real))
+			return;
+
+		auto itr = handlers.find(static_cast<int>(real->second));
+		if (itr == end(handlers))
+			return;
+
+		for (auto &func : itr->second.funcs)
+			if (func.virtual_handle == info.handle && func.func)
+				func.func(info);
+	});
 #endif
 }
 
@@ -342,6 +405,7 @@ void OSFilesystem::uninstall_notification(FileNotifyHandle handle)
 	}
 
 	itr->second.funcs.erase(handler_instance);
+	notify_coalescer.drop_handle(handle);
 
 	if (itr->second.funcs.empty())
 	{
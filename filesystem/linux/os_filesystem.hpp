@@ -60,6 +60,8 @@ public:
 	void poll_notifications() override;
 	int get_notification_fd() const override;
 	std::string get_filesystem_path(const std::string &path) override;
+	bool read_batch(FileReadRequest *requests, size_t count) override;
+	void prefetch(const std::string &path, uint64_t offset, uint64_t size) override;
 
 private:
 	std::string base;
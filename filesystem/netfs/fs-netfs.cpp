@@ -21,9 +21,15 @@
  */
 
 #include "fs-netfs.hpp"
+#include "os_filesystem.hpp"
 #include "path_utils.hpp"
 #include "logging.hpp"
+#include "hash.hpp"
+#include "lz4.hpp"
+#include <algorithm>
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <queue>
 
 #define HOST_IP "localhost"
@@ -281,6 +287,18 @@ struct FSReadCommand : LooperHandler
 		state = WriteCommand;
 	}
 
+	FSReadCommand(NetFSCommand command, const vector<uint8_t> &chunk, unique_ptr<Socket> socket_)
+		: LooperHandler(move(socket_))
+	{
+		reply_builder.begin();
+		reply_builder.add_u32(command);
+		reply_builder.add_u32(NETFS_BEGIN_CHUNK_REQUEST);
+		reply_builder.add_u64(chunk.size());
+		reply_builder.add_buffer(chunk);
+		command_writer.start(reply_builder.get_buffer());
+		state = WriteCommand;
+	}
+
 	bool write_command(Looper &looper)
 	{
 		auto ret = command_writer.process(*socket);
@@ -358,32 +376,45 @@ struct FSReadCommand : LooperHandler
 	virtual void parse_reply() = 0;
 };
 
-struct FSReader : FSReadCommand
+struct FSRangeReader : FSReadCommand
 {
-	FSReader(const string &path, unique_ptr<Socket> socket_)
-		: FSReadCommand(path, NETFS_READ_FILE, move(socket_))
+	FSRangeReader(const vector<uint8_t> &chunk, unique_ptr<Socket> socket_)
+		: FSReadCommand(NETFS_READ_FILE_RANGE, chunk, move(socket_))
 	{
 	}
 
-	~FSReader()
+	~FSRangeReader()
 	{
 		if (!got_reply)
 			result.set_exception(make_exception_ptr(runtime_error("file read")));
 	}
 
+	enum { HeaderSize = 4 + 8 + 8 + 8 };
+
 	void parse_reply() override
 	{
+		if (reply_builder.get_buffer().size() < HeaderSize)
+			return;
+
+		NetFSReadReply reply;
+		reply.flags = reply_builder.read_u32();
+		reply.hash = reply_builder.read_u64();
+		reply.file_size = reply_builder.read_u64();
+		reply.uncompressed_size = reply_builder.read_u64();
+		reply.payload = reply_builder.consume_buffer();
+		reply.payload.erase(reply.payload.begin(), reply.payload.begin() + HeaderSize);
+
 		got_reply = true;
 		try
 		{
-			result.set_value(reply_builder.consume_buffer());
+			result.set_value(move(reply));
 		}
 		catch (...)
 		{
 		}
 	}
 
-	promise<vector<uint8_t>> result;
+	promise<NetFSReadReply> result;
 	bool got_reply = false;
 };
 
@@ -596,9 +627,212 @@ struct FSWriteCommand : LooperHandler
 
 NetworkFilesystem::NetworkFilesystem()
 {
+	if (const char *env = getenv("GRANITE_NETFS_CACHE"))
+		set_cache_directory(env);
+	if (const char *env = getenv("GRANITE_NETFS_COMPRESS"))
+		compress = strtoul(env, nullptr, 0) != 0;
+
 	looper_thread = thread(&NetworkFilesystem::looper_entry, this);
 }
 
+void NetworkFilesystem::set_cache_directory(const std::string &path)
+{
+	cache = make_unique<OSFilesystem>(path);
+}
+
+void NetworkFilesystem::set_compression_enabled(bool enable)
+{
+	compress = enable;
+}
+
+struct NetFSCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint64_t size;
+};
+static const uint32_t NetFSCacheMagic = 0x4346534e; // "NSFC"
+static const uint32_t NetFSCacheVersion = 1;
+
+static string get_cache_entry_path(const string &path)
+{
+	Util::Hasher h;
+	h.string(path);
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.netfs", static_cast<unsigned long long>(h.get()));
+	return name;
+}
+
+uint64_t NetworkFilesystem::load_cache_entry(NetworkRead &read)
+{
+	if (!cache)
+		return 0;
+
+	auto file = cache->open(get_cache_entry_path(read.path), FileMode::ReadOnly);
+	if (!file || file->get_size() < sizeof(NetFSCacheHeader))
+		return 0;
+
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		return 0;
+
+	NetFSCacheHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	if (header.magic != NetFSCacheMagic || header.version != NetFSCacheVersion ||
+	    header.size != file->get_size() - sizeof(header))
+		return 0;
+
+	read.cached_data = mapped + sizeof(header);
+	read.cached_size = size_t(header.size);
+	read.cached_file = move(file);
+	return header.hash;
+}
+
+void NetworkFilesystem::write_cache_entry(const std::string &path, uint64_t hash, const void *data, size_t size)
+{
+	if (!cache)
+		return;
+
+	auto file = cache->open(get_cache_entry_path(path), FileMode::WriteOnlyTransactional);
+	if (!file)
+		return;
+
+	auto *mapped = static_cast<uint8_t *>(file->map_write(sizeof(NetFSCacheHeader) + size));
+	if (!mapped)
+		return;
+
+	NetFSCacheHeader header = { NetFSCacheMagic, NetFSCacheVersion, hash, size };
+	memcpy(mapped, &header, sizeof(header));
+	if (size)
+		memcpy(mapped + sizeof(header), data, size);
+	file->unmap();
+}
+
+NetworkRead NetworkFilesystem::begin_read(const std::string &path, uint64_t offset, uint64_t size)
+{
+	NetworkRead read;
+	read.path = path;
+	read.offset = offset;
+	read.size = size;
+
+	uint64_t cached_hash = load_cache_entry(read);
+
+	auto socket = Socket::connect(HOST_IP, 7070);
+	if (!socket)
+		return read;
+
+	ReplyBuilder chunk;
+	chunk.add_string(path);
+	chunk.add_u64(offset);
+	chunk.add_u64(size);
+	chunk.add_u32(compress ? NETFS_READ_COMPRESS_BIT : 0);
+	chunk.add_u64(cached_hash);
+
+	auto *handler = new FSRangeReader(chunk.get_buffer(), move(socket));
+	read.reply = handler->result.get_future();
+	read.valid = true;
+
+	// Capture-by-move would be nice here.
+	looper.run_in_looper([handler, this]() {
+		looper.register_handler(EVENT_OUT, unique_ptr<FSRangeReader>(handler));
+	});
+
+	return read;
+}
+
+bool NetworkFilesystem::finish_read(NetworkRead &read, std::vector<uint8_t> &storage, const uint8_t *&data, size_t &size)
+{
+	if (!read.valid)
+		return false;
+
+	NetFSReadReply reply;
+	try
+	{
+		reply = read.reply.get();
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	if ((reply.flags & NETFS_READ_REPLY_NOT_MODIFIED_BIT) != 0)
+	{
+		if (!read.cached_file)
+			return false;
+
+		if (read.offset >= read.cached_size)
+		{
+			data = nullptr;
+			size = 0;
+		}
+		else
+		{
+			data = read.cached_data + read.offset;
+			size = size_t(std::min<uint64_t>(read.size, read.cached_size - read.offset));
+		}
+		return true;
+	}
+
+	if ((reply.flags & NETFS_READ_REPLY_COMPRESSED_BIT) != 0)
+	{
+		storage.resize(reply.uncompressed_size);
+		if (!Util::lz4_decompress(reply.payload.data(), reply.payload.size(), storage.data(), storage.size()))
+		{
+			LOGE("Failed to decompress %s.\n", read.path.c_str());
+			return false;
+		}
+	}
+	else
+		storage = move(reply.payload);
+
+	data = storage.data();
+	size = storage.size();
+
+	// Ranged reads are not cached, there is nothing to validate them against later.
+	if (read.offset == 0 && size == reply.file_size)
+		write_cache_entry(read.path, reply.hash, data, size);
+
+	return true;
+}
+
+bool NetworkFilesystem::read_batch(FileReadRequest *requests, size_t count)
+{
+	vector<NetworkRead> reads(count);
+	vector<uint8_t> storage;
+	bool success = true;
+	size_t started = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		// Keep the pipe full, every read has its own connection in the looper.
+		for (; started < count && started < i + MaxInFlight; started++)
+		{
+			auto &req = requests[started];
+			reads[started] = begin_read(protocol + "://" + req.path, req.offset, req.size);
+		}
+
+		auto &req = requests[i];
+		const uint8_t *data = nullptr;
+		size_t size = 0;
+
+		req.read_size = 0;
+		req.success = finish_read(reads[i], storage, data, size);
+		if (req.success && size)
+		{
+			memcpy(req.data, data, size);
+			req.read_size = size;
+		}
+		else if (!req.success)
+			success = false;
+
+		// Drop the cache mapping as soon as we are done with it.
+		reads[i] = {};
+	}
+
+	return success;
+}
+
 void NetworkFilesystem::looper_entry()
 {
 	while (looper.wait_idle(-1) >= 0);
@@ -631,6 +865,7 @@ void NetworkFilesystem::uninstall_notification(FileNotifyHandle handle)
 	if (itr == end(handlers))
 		return;
 	handlers.erase(itr);
+	notify_coalescer.drop_handle(handle);
 
 	auto *value = new promise<FileNotifyHandle>;
 	auto result = value->get_future();
@@ -663,11 +898,13 @@ void NetworkFilesystem::poll_notifications()
 	}
 
 	for (auto &notification : tmp_pending)
-	{
-		auto &func = handlers[notification.handle];
-		if (func)
-			func(notification);
-	}
+		notify_coalescer.push(move(notification));
+
+	notify_coalescer.flush([this](const FileNotifyInfo &info) {
+		auto itr = handlers.find(info.handle);
+		if (itr != end(handlers) && itr->second)
+			itr->second(info);
+	});
 }
 
 FileNotifyHandle NetworkFilesystem::install_notification(const std::string &path,
@@ -727,10 +964,10 @@ NetworkFile::~NetworkFile()
 	unmap();
 }
 
-NetworkFile *NetworkFile::open(Granite::Looper &looper, const std::string &path, Granite::FileMode mode)
+NetworkFile *NetworkFile::open(NetworkFilesystem &fs, const std::string &path, Granite::FileMode mode)
 {
 	auto *file = new NetworkFile;
-	if (!file->init(looper, path, mode))
+	if (!file->init(fs, path, mode))
 	{
 		delete file;
 		return nullptr;
@@ -739,11 +976,12 @@ NetworkFile *NetworkFile::open(Granite::Looper &looper, const std::string &path,
 		return file;
 }
 
-bool NetworkFile::init(Looper &looper_, const std::string &path_, FileMode mode_)
+bool NetworkFile::init(NetworkFilesystem &fs_, const std::string &path_, FileMode mode_)
 {
 	path = path_;
 	mode = mode_;
-	looper = &looper_;
+	fs = &fs_;
+	looper = &fs_.looper;
 
 	if (mode == FileMode::ReadWrite)
 	{
@@ -796,18 +1034,30 @@ bool NetworkFile::reopen()
 	if (mode == FileMode::ReadOnly)
 	{
 		has_buffer = false;
-		auto socket = Socket::connect(HOST_IP, 7070);
-		if (!socket)
-			return false;
+		pending = fs->begin_read(path, 0, NETFS_READ_WHOLE_FILE);
+		return pending.valid;
+	}
+	return true;
+}
 
-		auto *handler = new FSReader(path, move(socket));
-		future = handler->result.get_future();
+bool NetworkFile::resolve()
+{
+	if (has_buffer)
+		return true;
 
-		// Capture-by-move would be nice here.
-		looper->run_in_looper([handler, this]() {
-			looper->register_handler(EVENT_OUT, unique_ptr<FSReader>(handler));
-		});
-	}
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	bool ret = fs->finish_read(pending, buffer, data, size);
+
+	// Not modified, the data lives in the cache mapping.
+	if (ret && data != buffer.data())
+		buffer.assign(data, data + size);
+
+	pending = {};
+	if (!ret)
+		return false;
+
+	has_buffer = true;
 	return true;
 }
 
@@ -821,42 +1071,22 @@ void *NetworkFile::map_write(size_t size)
 
 void *NetworkFile::map()
 {
-	try
-	{
-		if (!has_buffer)
-		{
-			buffer = future.get();
-			has_buffer = true;
-		}
-		return buffer.empty() ? nullptr : buffer.data();
-	}
-	catch (...)
-	{
+	if (!resolve())
 		return nullptr;
-	}
+	return buffer.empty() ? nullptr : buffer.data();
 }
 
 size_t NetworkFile::get_size()
 {
-	try
-	{
-		if (!has_buffer)
-		{
-			buffer = future.get();
-			has_buffer = true;
-		}
-		return buffer.size();
-	}
-	catch (...)
-	{
+	if (!resolve())
 		return 0;
-	}
+	return buffer.size();
 }
 
 unique_ptr<File> NetworkFilesystem::open(const std::string &path, FileMode mode)
 {
 	auto joined = protocol + "://" + path;
-	return unique_ptr<File>(NetworkFile::open(looper, move(joined), mode));
+	return unique_ptr<File>(NetworkFile::open(*this, move(joined), mode));
 }
 
 bool NetworkFilesystem::stat(const std::string &path, FileStat &stat)
@@ -31,11 +31,33 @@
 
 namespace Granite
 {
-struct FSReader;
+struct NetFSReadReply
+{
+	uint32_t flags = 0;
+	uint64_t hash = 0;
+	uint64_t file_size = 0;
+	uint64_t uncompressed_size = 0;
+	std::vector<uint8_t> payload;
+};
+
+// A NETFS_READ_FILE_RANGE request in flight, along with the cached copy it is validated against.
+struct NetworkRead
+{
+	std::string path;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	std::future<NetFSReadReply> reply;
+	std::unique_ptr<File> cached_file;
+	const uint8_t *cached_data = nullptr;
+	size_t cached_size = 0;
+	bool valid = false;
+};
+
+class NetworkFilesystem;
 class NetworkFile : public File
 {
 public:
-	static NetworkFile *open(Looper &looper, const std::string &path, FileMode mode);
+	static NetworkFile *open(NetworkFilesystem &fs, const std::string &path, FileMode mode);
 	~NetworkFile();
 	void *map() override;
 	void *map_write(size_t size) override;
@@ -45,11 +67,13 @@ public:
 
 private:
 	NetworkFile() = default;
-	bool init(Looper &looper, const std::string &path, FileMode mode);
+	bool init(NetworkFilesystem &fs, const std::string &path, FileMode mode);
+	bool resolve();
 	std::string path;
 	FileMode mode;
+	NetworkFilesystem *fs = nullptr;
 	Looper *looper = nullptr;
-	std::future<std::vector<uint8_t>> future;
+	NetworkRead pending;
 	std::vector<uint8_t> buffer;
 	bool has_buffer = false;
 	bool need_flush = false;
@@ -76,7 +100,17 @@ public:
 		return -1;
 	}
 
+	// Up to MaxInFlight ranged reads are pipelined over separate connections.
+	bool read_batch(FileReadRequest *requests, size_t count) override;
+
+	// Whole-file reads are kept here and revalidated by content hash, so only changed files transfer.
+	void set_cache_directory(const std::string &path);
+	void set_compression_enabled(bool enable);
+
+	enum { MaxInFlight = 16 };
+
 private:
+	friend class NetworkFile;
 	std::thread looper_thread;
 	Looper looper;
 	void looper_entry();
@@ -88,5 +122,13 @@ private:
 
 	void setup_notification();
 	void signal_notification(const FileNotifyInfo &info);
+
+	std::unique_ptr<FilesystemBackend> cache;
+	bool compress = true;
+
+	NetworkRead begin_read(const std::string &path, uint64_t offset, uint64_t size);
+	bool finish_read(NetworkRead &read, std::vector<uint8_t> &storage, const uint8_t *&data, size_t &size);
+	uint64_t load_cache_entry(NetworkRead &read);
+	void write_cache_entry(const std::string &path, uint64_t hash, const void *data, size_t size);
 };
 }
@@ -270,21 +270,18 @@ void OSFilesystem::poll_notifications()
 			case FILE_ACTION_ADDED:
 			case FILE_ACTION_RENAMED_NEW_NAME:
 				notify.type = FileNotifyType::FileCreated;
-				if (handler.second.func)
-					handler.second.func(notify);
+				notify_coalescer.push(move(notify));
 				break;
 
 			case FILE_ACTION_REMOVED:
 			case FILE_ACTION_RENAMED_OLD_NAME:
 				notify.type = FileNotifyType::FileDeleted;
-				if (handler.second.func)
-					handler.second.func(notify);
+				notify_coalescer.push(move(notify));
 				break;
 
 			case FILE_ACTION_MODIFIED:
 				notify.type = FileNotifyType::FileChanged;
-				if (handler.second.func)
-					handler.second.func(notify);
+				notify_coalescer.push(move(notify));
 				break;
 
 			default:
@@ -297,6 +294,12 @@ void OSFilesystem::poll_notifications()
 
 		kick_async(handler.second);
 	}
+
+	notify_coalescer.flush([this](const FileNotifyInfo &info) {
+		auto itr = handlers.find(info.handle);
+		if (itr != end(handlers) && itr->second.func)
+			itr->second.func(info);
+	});
 }
 
 void OSFilesystem::uninstall_notification(FileNotifyHandle id)
@@ -308,6 +311,7 @@ void OSFilesystem::uninstall_notification(FileNotifyHandle id)
 		CloseHandle(itr->second.handle);
 		CloseHandle(itr->second.event);
 		handlers.erase(itr);
+		notify_coalescer.drop_handle(id);
 	}
 }
 
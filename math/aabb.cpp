@@ -21,7 +21,10 @@
  */
 
 #include "aabb.hpp"
+#include "simd.hpp"
+#include "simd_batch.hpp"
 #include <float.h>
+#include <algorithm>
 
 namespace Granite
 {
@@ -53,4 +56,51 @@ void AABB::expand(const AABB &aabb)
 	maximum.v3 = max(maximum.v3, aabb.maximum.v3);
 }
 
+void AABB::transform_batch(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count)
+{
+	SIMD::transform_aabbs(output, aabbs, transforms, count);
+}
+
+void AABBBatch::resize(size_t count_)
+{
+	count = count_;
+	size_t padded = count + SIMD::FrustumCullBatchSize;
+	for (auto *v : { &lo_x, &lo_y, &lo_z, &hi_x, &hi_y, &hi_z })
+		v->resize(padded);
+}
+
+void AABBBatch::set(size_t index, const AABB &aabb)
+{
+	auto &lo = aabb.get_minimum();
+	auto &hi = aabb.get_maximum();
+	lo_x[index] = lo.x;
+	lo_y[index] = lo.y;
+	lo_z[index] = lo.z;
+	hi_x[index] = hi.x;
+	hi_y[index] = hi.y;
+	hi_z[index] = hi.z;
+}
+
+AABB AABBBatch::get(size_t index) const
+{
+	return AABB(vec3(lo_x[index], lo_y[index], lo_z[index]),
+	            vec3(hi_x[index], hi_y[index], hi_z[index]));
+}
+
+void AABBBatch::assign_transformed(const AABB *aabbs, const mat4 *transforms, size_t count_)
+{
+	resize(count_);
+
+	// Transform in small blocks which stay in L1 before scattering to the arrays.
+	constexpr size_t BlockSize = 64;
+	AABB block[BlockSize];
+	for (size_t base = 0; base < count_; base += BlockSize)
+	{
+		size_t to_transform = std::min(BlockSize, count_ - base);
+		SIMD::transform_aabbs(block, aabbs + base, transforms + base, to_transform);
+		for (size_t i = 0; i < to_transform; i++)
+			set(base + i, block[i]);
+	}
+}
+
 }
\ No newline at end of file
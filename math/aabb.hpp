@@ -24,6 +24,8 @@
 
 #include "math.hpp"
 #include "muglm/muglm_impl.hpp"
+#include <stddef.h>
+#include <vector>
 
 namespace Granite
 {
@@ -41,6 +43,9 @@ public:
 	vec3 get_coord(float dx, float dy, float dz) const;
 	AABB transform(const mat4 &m) const;
 
+	// output[i] = aabbs[i] transformed by transforms[i], using the widest SIMD path available.
+	static void transform_batch(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count);
+
 	void expand(const AABB &aabb);
 
 	const vec3 &get_minimum() const
@@ -98,4 +103,19 @@ private:
 		vec4 v4;
 	} minimum, maximum;
 };
+
+// Bounding boxes in structure-of-arrays layout, for Frustum::cull().
+// Arrays are padded so a full SIMD batch can be read from any index.
+struct AABBBatch
+{
+	std::vector<float> lo_x, lo_y, lo_z, hi_x, hi_y, hi_z;
+	size_t count = 0;
+
+	void resize(size_t count);
+	void set(size_t index, const AABB &aabb);
+	AABB get(size_t index) const;
+
+	// Resizes to count, and stores aabbs[i] transformed by transforms[i] in slot i.
+	void assign_transformed(const AABB *aabbs, const mat4 *transforms, size_t count);
+};
 }
\ No newline at end of file
@@ -21,10 +21,57 @@
  */
 
 #include "frustum.hpp"
+#include "simd.hpp"
+#include "simd_batch.hpp"
+#include <algorithm>
 
 namespace Granite
 {
 
+size_t Frustum::cull(const AABBBatch &boxes, uint32_t *indices) const
+{
+	SIMD::AABBArrays arrays = {
+		boxes.lo_x.data(), boxes.lo_y.data(), boxes.lo_z.data(),
+		boxes.hi_x.data(), boxes.hi_y.data(), boxes.hi_z.data(),
+	};
+
+	size_t num_visible = 0;
+	for (size_t i = 0; i < boxes.count; i += SIMD::FrustumCullBatchSize)
+	{
+		uint32_t mask = SIMD::frustum_cull_batch(arrays, i, planes);
+		size_t batch_count = std::min<size_t>(SIMD::FrustumCullBatchSize, boxes.count - i);
+
+		// Branchless compaction, the slot is overwritten unless the box survives.
+		for (size_t j = 0; j < batch_count; j++)
+		{
+			indices[num_visible] = uint32_t(i + j);
+			num_visible += (mask >> j) & 1u;
+		}
+	}
+
+	return num_visible;
+}
+
+size_t Frustum::cull(const AABB *aabbs, size_t count, uint32_t *indices) const
+{
+	constexpr size_t BlockSize = 256;
+	uint8_t visible[BlockSize];
+	size_t num_visible = 0;
+
+	for (size_t base = 0; base < count; base += BlockSize)
+	{
+		size_t to_cull = std::min(BlockSize, count - base);
+		SIMD::frustum_cull_aabbs(visible, aabbs + base, to_cull, planes);
+		for (size_t j = 0; j < to_cull; j++)
+		{
+			indices[num_visible] = uint32_t(base + j);
+			num_visible += visible[j];
+		}
+	}
+
+	return num_visible;
+}
+
 // For reference, should always use SIMD-version.
 bool Frustum::intersects_slow(const AABB &aabb) const
 {
@@ -143,4 +190,27 @@ void Frustum::build_planes(const mat4 &inv_view_projection_)
 		if (dot(center, p) < 0.0f)
 			p = -p;
 }
+void Frustum::build_planes_enclosing(const mat4 *inv_view_projections, unsigned count)
+{
+	build_planes(inv_view_projections[0]);
+
+	// Push each plane out past every corner of every frustum.
+	// The result contains their convex hull, so culling against it is conservative.
+	for (unsigned i = 0; i < count; i++)
+	{
+		for (unsigned corner = 0; corner < 8; corner++)
+		{
+			vec4 clip(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : 0.0f, 1.0f);
+			vec4 world = inv_view_projections[i] * clip;
+			world /= world.w;
+
+			for (auto &p : planes)
+			{
+				float d = dot(world, p);
+				if (d < 0.0f)
+					p.w -= d;
+			}
+		}
+	}
+}
 }
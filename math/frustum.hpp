@@ -31,9 +31,17 @@ class Frustum
 {
 public:
 	void build_planes(const mat4& inv_view_projection);
+	// Planes of the first frustum, moved out until the frustum encloses all of them.
+	// get_coord() still refers to the first frustum.
+	void build_planes_enclosing(const mat4 *inv_view_projections, unsigned count);
 	bool intersects_sphere(const AABB &aabb) const;
 	bool intersects_slow(const AABB &aabb) const;
 
+	// Writes the indices of the boxes which intersect the frustum to indices in ascending order,
+	// and returns how many there are. indices must have room for one entry per box.
+	size_t cull(const AABBBatch &boxes, uint32_t *indices) const;
+	size_t cull(const AABB *aabbs, size_t count, uint32_t *indices) const;
+
 	vec3 get_coord(float dx, float dy, float dz) const;
 
 	static vec4 get_bounding_sphere(const mat4 &inv_projection, const mat4 &inv_view);
@@ -21,6 +21,8 @@
  */
 
 #include "interpolation.hpp"
+#include "muglm/muglm_impl.hpp"
+#include <algorithm>
 
 namespace Granite
 {
@@ -42,4 +44,75 @@ float catmull_rom_spline_gradient(float c0, float c1, float c2, float c3, float
 	       (c0 - (2.5f * c1) + (2.0f * c2) - (0.5f * c3)) * 2.0f * phase +
 	       ((-0.5f * c0) + (1.5f * c1) - (1.5f * c2) + (0.5f * c3)) * 3.0f * phase2;
 }
+
+// Beyond roughly 25 degrees the angular error of nlerp becomes visible.
+static constexpr float NlerpMinCosTheta = 0.976f;
+
+void nlerp_batch(quat *output, const quat *a, const quat *b, float phase, size_t count)
+{
+	constexpr size_t Lanes = 4;
+	for (size_t base = 0; base < count; base += Lanes)
+	{
+		size_t num_lanes = std::min(Lanes, count - base);
+		float qa[4][Lanes] = {}, qb[4][Lanes] = {};
+		for (size_t i = 0; i < num_lanes; i++)
+		{
+			for (unsigned c = 0; c < 4; c++)
+			{
+				qa[c][i] = a[base + i].as_vec4()[c];
+				qb[c][i] = b[base + i].as_vec4()[c];
+			}
+		}
+
+		float cos_theta[Lanes];
+		for (size_t i = 0; i < Lanes; i++)
+			cos_theta[i] = qa[0][i] * qb[0][i] + qa[1][i] * qb[1][i] + qa[2][i] * qb[2][i] + qa[3][i] * qb[3][i];
+
+		// Flip b to take the shortest path.
+		float sign[Lanes];
+		for (size_t i = 0; i < Lanes; i++)
+		{
+			sign[i] = cos_theta[i] < 0.0f ? -1.0f : 1.0f;
+			cos_theta[i] *= sign[i];
+		}
+
+		float q[4][Lanes];
+		float length2[Lanes] = {};
+		for (unsigned c = 0; c < 4; c++)
+		{
+			for (size_t i = 0; i < Lanes; i++)
+			{
+				q[c][i] = qa[c][i] + (qb[c][i] * sign[i] - qa[c][i]) * phase;
+				length2[i] += q[c][i] * q[c][i];
+			}
+		}
+
+		for (size_t i = 0; i < Lanes; i++)
+			length2[i] = length2[i] > 0.0f ? 1.0f / muglm::sqrt(length2[i]) : 0.0f;
+
+		for (size_t i = 0; i < num_lanes; i++)
+		{
+			if (cos_theta[i] < NlerpMinCosTheta)
+			{
+				output[base + i] = slerp(a[base + i], b[base + i], phase);
+			}
+			else
+			{
+				output[base + i] = quat(vec4(q[0][i], q[1][i], q[2][i], q[3][i]) * length2[i]);
+			}
+		}
+	}
+}
+
+void mix_batch(vec3 *output, const vec3 *a, const vec3 *b, float phase, size_t count)
+{
+	// vec3 arrays are plain floats back to back, so this is one flat loop.
+	static_assert(sizeof(vec3) == 3 * sizeof(float), "Unexpected vec3 layout.");
+	auto *out = output[0].data;
+	auto *pa = a[0].data;
+	auto *pb = b[0].data;
+	size_t num_floats = 3 * count;
+	for (size_t i = 0; i < num_floats; i++)
+		out[i] = pa[i] + (pb[i] - pa[i]) * phase;
+}
 }
\ No newline at end of file
@@ -22,8 +22,19 @@
 
 #pragma once
 
+#include "math.hpp"
+#include <stddef.h>
+
 namespace Granite
 {
 float catmull_rom_spline(float c0, float c1, float c2, float c3, float phase);
 float catmull_rom_spline_gradient(float c0, float c1, float c2, float c3, float phase);
+
+// Batched interpolation over arrays, written as fixed 4-lane loops over transposed data so they vectorize.
+// output may alias a or b.
+
+// Shortest path normalized lerp. Lanes where a and b are further apart than nlerp
+// approximates well fall back to slerp.
+void nlerp_batch(quat *output, const quat *a, const quat *b, float phase, size_t count);
+void mix_batch(vec3 *output, const vec3 *a, const vec3 *b, float phase, size_t count);
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 
 #include "math.hpp"
 #include "image.hpp"
+#include "buffer.hpp"
 #include "lights/light_info.hpp"
 #include "limits.hpp"
 
@@ -176,6 +177,7 @@ struct ClustererBindlessTransforms
 	mat4 model[CLUSTERER_MAX_LIGHTS_BINDLESS];
 	uint32_t type_mask[CLUSTERER_MAX_LIGHTS_BINDLESS / 32];
 	BindlessDecalTransform decals[CLUSTERER_MAX_DECALS_BINDLESS];
+	uint32_t decal_texture_index[CLUSTERER_MAX_DECALS_BINDLESS];
 };
 
 struct ClustererGlobalTransforms
@@ -208,6 +210,8 @@ struct LightingParameters
 	RefractionParameters refraction;
 
 	Vulkan::ImageView *shadows = nullptr;
+	// Set when shadows is a virtual shadow map atlas, see VirtualShadowMap::get_page_table().
+	const Vulkan::Buffer *shadow_page_table = nullptr;
 	Vulkan::ImageView *ambient_occlusion = nullptr;
 	const LightClusterer *cluster = nullptr;
 	const VolumetricFog *volumetric_fog = nullptr;
@@ -104,6 +104,84 @@ static inline bool frustum_cull(const AABB &aabb, const vec4 *planes)
 #endif
 }
 
+// Bounding boxes in structure-of-arrays layout for frustum_cull_batch().
+struct AABBArrays
+{
+	const float *lo_x, *lo_y, *lo_z;
+	const float *hi_x, *hi_y, *hi_z;
+};
+
+#if defined(__AVX__)
+enum { FrustumCullBatchSize = 8 };
+#else
+enum { FrustumCullBatchSize = 4 };
+#endif
+
+// Culls FrustumCullBatchSize boxes starting at index, and returns a bit per box which intersects the frustum.
+// Arrays must be readable up to index + FrustumCullBatchSize.
+static inline uint32_t frustum_cull_batch(const AABBArrays &boxes, size_t index, const vec4 *planes)
+{
+	// The plane decides whether the min or max corner is furthest along its normal,
+	// so the selection is uniform across boxes.
+#if defined(__AVX__)
+	__m256 sign = _mm256_setzero_ps();
+	for (unsigned i = 0; i < 6; i++)
+	{
+		auto &p = planes[i];
+		__m256 x = _mm256_loadu_ps((p.x > 0.0f ? boxes.hi_x : boxes.lo_x) + index);
+		__m256 y = _mm256_loadu_ps((p.y > 0.0f ? boxes.hi_y : boxes.lo_y) + index);
+		__m256 z = _mm256_loadu_ps((p.z > 0.0f ? boxes.hi_z : boxes.lo_z) + index);
+		__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.x), x),
+		                                      _mm256_mul_ps(_mm256_set1_ps(p.y), y)),
+		                        _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.z), z),
+		                                      _mm256_set1_ps(p.w)));
+		sign = _mm256_or_ps(sign, d);
+	}
+	// Sets bit if the sign bit is set for any plane.
+	return ~uint32_t(_mm256_movemask_ps(sign)) & 0xffu;
+#elif defined(__SSE__)
+	__m128 sign = _mm_setzero_ps();
+	for (unsigned i = 0; i < 6; i++)
+	{
+		auto &p = planes[i];
+		__m128 x = _mm_loadu_ps((p.x > 0.0f ? boxes.hi_x : boxes.lo_x) + index);
+		__m128 y = _mm_loadu_ps((p.y > 0.0f ? boxes.hi_y : boxes.lo_y) + index);
+		__m128 z = _mm_loadu_ps((p.z > 0.0f ? boxes.hi_z : boxes.lo_z) + index);
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), x),
+		                                 _mm_mul_ps(_mm_set1_ps(p.y), y)),
+		                      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z), z),
+		                                 _mm_set1_ps(p.w)));
+		sign = _mm_or_ps(sign, d);
+	}
+	return ~uint32_t(_mm_movemask_ps(sign)) & 0xfu;
+#elif defined(__ARM_NEON)
+	uint32x4_t sign = vdupq_n_u32(0);
+	for (unsigned i = 0; i < 6; i++)
+	{
+		auto &p = planes[i];
+		float32x4_t x = vld1q_f32((p.x > 0.0f ? boxes.hi_x : boxes.lo_x) + index);
+		float32x4_t y = vld1q_f32((p.y > 0.0f ? boxes.hi_y : boxes.lo_y) + index);
+		float32x4_t z = vld1q_f32((p.z > 0.0f ? boxes.hi_z : boxes.lo_z) + index);
+		float32x4_t d = vmlaq_n_f32(vdupq_n_f32(p.w), x, p.x);
+		d = vmlaq_n_f32(d, y, p.y);
+		d = vmlaq_n_f32(d, z, p.z);
+		sign = vorrq_u32(sign, vshrq_n_u32(vreinterpretq_u32_f32(d), 31));
+	}
+
+	static const uint32_t lane_bits[4] = { 1, 2, 4, 8 };
+	uint32x4_t bits = vmulq_u32(sign, vld1q_u32(lane_bits));
+#if defined(__aarch64__)
+	uint32_t mask = vaddvq_u32(bits);
+#else
+	uint32x2_t half = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+	uint32_t mask = vget_lane_u32(vpadd_u32(half, half), 0);
+#endif
+	return ~mask & 0xfu;
+#else
+#error "Implement me."
+#endif
+}
+
 static inline void mul(vec4 &c, const mat4 &a, const vec4 &b)
 {
 #if defined(__SSE__)
@@ -367,5 +445,129 @@ static inline void convert_quaternion_with_scale(vec4 *cols, const quat &q, cons
 	cols[2] = vec4(m[2] * scale.z, 0.0f);
 #endif
 }
+
+// Builds four TRS model matrices at once, lanes hold one transform each.
+static inline void compute_model_transforms4(mat4 *models, const quat *rot, const vec3 *scale, const vec3 *trans)
+{
+#if defined(__SSE__)
+	__m128 x = _mm_loadu_ps(rot[0].as_vec4().data);
+	__m128 y = _mm_loadu_ps(rot[1].as_vec4().data);
+	__m128 z = _mm_loadu_ps(rot[2].as_vec4().data);
+	__m128 w = _mm_loadu_ps(rot[3].as_vec4().data);
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 xx = _mm_mul_ps(x, x);
+	__m128 yy = _mm_mul_ps(y, y);
+	__m128 zz = _mm_mul_ps(z, z);
+	__m128 xy = _mm_mul_ps(x, y);
+	__m128 xz = _mm_mul_ps(x, z);
+	__m128 yz = _mm_mul_ps(y, z);
+	__m128 wx = _mm_mul_ps(w, x);
+	__m128 wy = _mm_mul_ps(w, y);
+	__m128 wz = _mm_mul_ps(w, z);
+
+	__m128 sx = _mm_set_ps(scale[3].x, scale[2].x, scale[1].x, scale[0].x);
+	__m128 sy = _mm_set_ps(scale[3].y, scale[2].y, scale[1].y, scale[0].y);
+	__m128 sz = _mm_set_ps(scale[3].z, scale[2].z, scale[1].z, scale[0].z);
+
+	__m128 m00 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+	__m128 m01 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+	__m128 m02 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+	__m128 m03 = _mm_setzero_ps();
+
+	__m128 m10 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+	__m128 m11 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+	__m128 m12 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+	__m128 m13 = _mm_setzero_ps();
+
+	__m128 m20 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+	__m128 m21 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+	__m128 m22 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+	__m128 m23 = _mm_setzero_ps();
+
+	__m128 m30 = _mm_set_ps(trans[3].x, trans[2].x, trans[1].x, trans[0].x);
+	__m128 m31 = _mm_set_ps(trans[3].y, trans[2].y, trans[1].y, trans[0].y);
+	__m128 m32 = _mm_set_ps(trans[3].z, trans[2].z, trans[1].z, trans[0].z);
+	__m128 m33 = one;
+
+	_MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+	_MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+	_MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+	_MM_TRANSPOSE4_PS(m30, m31, m32, m33);
+
+#define STORE_MODEL(i, r0, r1, r2, r3) \
+	_mm_storeu_ps(models[i][0].data, r0); \
+	_mm_storeu_ps(models[i][1].data, r1); \
+	_mm_storeu_ps(models[i][2].data, r2); \
+	_mm_storeu_ps(models[i][3].data, r3)
+	STORE_MODEL(0, m00, m10, m20, m30);
+	STORE_MODEL(1, m01, m11, m21, m31);
+	STORE_MODEL(2, m02, m12, m22, m32);
+	STORE_MODEL(3, m03, m13, m23, m33);
+#undef STORE_MODEL
+#elif defined(__ARM_NEON)
+	float32x4x4_t q = vld4q_f32(rot[0].as_vec4().data);
+	float32x4x3_t s = vld3q_f32(scale[0].data);
+	float32x4x3_t t = vld3q_f32(trans[0].data);
+
+	float32x4_t one = vdupq_n_f32(1.0f);
+	float32x4_t zero = vdupq_n_f32(0.0f);
+	float32x4_t x = q.val[0];
+	float32x4_t y = q.val[1];
+	float32x4_t z = q.val[2];
+	float32x4_t w = q.val[3];
+	float32x4_t xx = vmulq_f32(x, x);
+	float32x4_t yy = vmulq_f32(y, y);
+	float32x4_t zz = vmulq_f32(z, z);
+	float32x4_t xy = vmulq_f32(x, y);
+	float32x4_t xz = vmulq_f32(x, z);
+	float32x4_t yz = vmulq_f32(y, z);
+	float32x4_t wx = vmulq_f32(w, x);
+	float32x4_t wy = vmulq_f32(w, y);
+	float32x4_t wz = vmulq_f32(w, z);
+
+	float32x4x4_t col0, col1, col2, col3;
+	col0.val[0] = vmulq_f32(vmlsq_n_f32(one, vaddq_f32(yy, zz), 2.0f), s.val[0]);
+	col0.val[1] = vmulq_f32(vmulq_n_f32(vaddq_f32(xy, wz), 2.0f), s.val[0]);
+	col0.val[2] = vmulq_f32(vmulq_n_f32(vsubq_f32(xz, wy), 2.0f), s.val[0]);
+	col0.val[3] = zero;
+
+	col1.val[0] = vmulq_f32(vmulq_n_f32(vsubq_f32(xy, wz), 2.0f), s.val[1]);
+	col1.val[1] = vmulq_f32(vmlsq_n_f32(one, vaddq_f32(xx, zz), 2.0f), s.val[1]);
+	col1.val[2] = vmulq_f32(vmulq_n_f32(vaddq_f32(yz, wx), 2.0f), s.val[1]);
+	col1.val[3] = zero;
+
+	col2.val[0] = vmulq_f32(vmulq_n_f32(vaddq_f32(xz, wy), 2.0f), s.val[2]);
+	col2.val[1] = vmulq_f32(vmulq_n_f32(vsubq_f32(yz, wx), 2.0f), s.val[2]);
+	col2.val[2] = vmulq_f32(vmlsq_n_f32(one, vaddq_f32(xx, yy), 2.0f), s.val[2]);
+	col2.val[3] = zero;
+
+	col3.val[0] = t.val[0];
+	col3.val[1] = t.val[1];
+	col3.val[2] = t.val[2];
+	col3.val[3] = one;
+
+	// Interleaving stores give us one column of every model.
+	vec4 cols[4][4];
+	vst4q_f32(cols[0][0].data, col0);
+	vst4q_f32(cols[1][0].data, col1);
+	vst4q_f32(cols[2][0].data, col2);
+	vst4q_f32(cols[3][0].data, col3);
+	for (unsigned i = 0; i < 4; i++)
+		for (unsigned c = 0; c < 4; c++)
+			models[i][c] = cols[c][i];
+#else
+	for (unsigned i = 0; i < 4; i++)
+	{
+		mat3 m = muglm::mat3_cast(rot[i]);
+		models[i][0] = vec4(m[0] * scale[i].x, 0.0f);
+		models[i][1] = vec4(m[1] * scale[i].y, 0.0f);
+		models[i][2] = vec4(m[2] * scale[i].z, 0.0f);
+		models[i][3] = vec4(trans[i], 1.0f);
+	}
+#endif
+}
 }
 }
\ No newline at end of file
@@ -0,0 +1,506 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simd_batch.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_BATCH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx2,fma,avx512f")))
+#endif
+#endif
+
+namespace Granite
+{
+namespace SIMD
+{
+// The wide kernels load an AABB as 8 consecutive floats, minimum first.
+static_assert(sizeof(AABB) == 8 * sizeof(float), "Unexpected AABB layout.");
+
+static void transform_aabbs_generic(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		transform_aabb(output[i], aabbs[i], transforms[i]);
+}
+
+static size_t frustum_cull_aabbs_generic(uint8_t *visible, const AABB *aabbs, size_t count, const vec4 *planes)
+{
+	size_t num_visible = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		bool v = frustum_cull(aabbs[i], planes);
+		visible[i] = uint8_t(v);
+		num_visible += v;
+	}
+	return num_visible;
+}
+
+static void mul_matrices_generic(mat4 *output, const mat4 *a, const mat4 *b, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		mat4 tmp;
+		mul(tmp, a[i], b[i]);
+		output[i] = tmp;
+	}
+}
+
+static void transform_points_generic(vec4 *output, const mat4 &m, const vec4 *points, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		vec4 tmp;
+		mul(tmp, m, points[i]);
+		output[i] = tmp;
+	}
+}
+
+#ifdef SIMD_BATCH_X86
+// One box per iteration as [lo | hi]. For every column, the lower half picks the corner
+// which minimizes the result and the upper half the corner which maximizes it.
+TARGET_AVX2 static void transform_aabbs_avx2(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	for (size_t i = 0; i < count; i++)
+	{
+		const float *m = transforms[i][0].data;
+		__m256 box = _mm256_loadu_ps(aabbs[i].get_minimum4().data);
+		__m256 swapped = _mm256_permute2f128_ps(box, box, 0x01);
+		__m256 result = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(m + 12));
+
+#define TRANSFORM_COLUMN(k) { \
+	__m256 col = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(m + 4 * k)); \
+	__m256 corner = _mm256_blendv_ps(_mm256_shuffle_ps(swapped, swapped, _MM_SHUFFLE(k, k, k, k)), \
+	                                 _mm256_shuffle_ps(box, box, _MM_SHUFFLE(k, k, k, k)), \
+	                                 _mm256_cmp_ps(col, zero, _CMP_GT_OQ)); \
+	result = _mm256_fmadd_ps(col, corner, result); }
+		TRANSFORM_COLUMN(0);
+		TRANSFORM_COLUMN(1);
+		TRANSFORM_COLUMN(2);
+#undef TRANSFORM_COLUMN
+
+		_mm256_storeu_ps(output[i].get_minimum4().data, result);
+	}
+}
+
+// Two boxes per iteration, same scheme as the AVX2 path.
+TARGET_AVX512 static void transform_aabbs_avx512(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count)
+{
+	const __m512 zero = _mm512_setzero_ps();
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		const float *m0 = transforms[i][0].data;
+		const float *m1 = transforms[i + 1][0].data;
+		__m512 box = _mm512_loadu_ps(aabbs[i].get_minimum4().data);
+		__m512 swapped = _mm512_shuffle_f32x4(box, box, _MM_SHUFFLE(2, 3, 0, 1));
+
+#define LOAD_COLUMNS(k) _mm512_shuffle_f32x4(_mm512_castps128_ps512(_mm_loadu_ps(m0 + 4 * k)), \
+                                             _mm512_castps128_ps512(_mm_loadu_ps(m1 + 4 * k)), \
+                                             _MM_SHUFFLE(0, 0, 0, 0))
+		__m512 result = LOAD_COLUMNS(3);
+
+#define TRANSFORM_COLUMN(k) { \
+	__m512 col = LOAD_COLUMNS(k); \
+	__m512 corner = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(col, zero, _CMP_GT_OQ), \
+	                                     _mm512_permute_ps(swapped, _MM_SHUFFLE(k, k, k, k)), \
+	                                     _mm512_permute_ps(box, _MM_SHUFFLE(k, k, k, k))); \
+	result = _mm512_fmadd_ps(col, corner, result); }
+		TRANSFORM_COLUMN(0);
+		TRANSFORM_COLUMN(1);
+		TRANSFORM_COLUMN(2);
+#undef TRANSFORM_COLUMN
+#undef LOAD_COLUMNS
+
+		_mm512_storeu_ps(output[i].get_minimum4().data, result);
+	}
+
+	transform_aabbs_avx2(output + i, aabbs + i, transforms + i, count - i);
+}
+
+// Transposes the minimum or maximum of 8 boxes into x, y and z registers.
+#define TRANSPOSE_BOXES_AVX2(base, offset, x, y, z) { \
+	__m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 0 * 8 + offset)), _mm_loadu_ps(base + 4 * 8 + offset), 1); \
+	__m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 1 * 8 + offset)), _mm_loadu_ps(base + 5 * 8 + offset), 1); \
+	__m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 2 * 8 + offset)), _mm_loadu_ps(base + 6 * 8 + offset), 1); \
+	__m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 3 * 8 + offset)), _mm_loadu_ps(base + 7 * 8 + offset), 1); \
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1); \
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1); \
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3); \
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3); \
+	x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)); \
+	y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)); \
+	z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)); }
+
+// Same plane math as frustum_cull_batch(), so results match it exactly.
+TARGET_AVX2 static size_t frustum_cull_aabbs_avx2(uint8_t *visible, const AABB *aabbs, size_t count, const vec4 *planes)
+{
+	size_t num_visible = 0;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const float *base = aabbs[i].get_minimum4().data;
+		__m256 lo_x, lo_y, lo_z, hi_x, hi_y, hi_z;
+		TRANSPOSE_BOXES_AVX2(base, 0, lo_x, lo_y, lo_z);
+		TRANSPOSE_BOXES_AVX2(base, 4, hi_x, hi_y, hi_z);
+
+		__m256 sign = _mm256_setzero_ps();
+		for (unsigned p = 0; p < 6; p++)
+		{
+			auto &plane = planes[p];
+			__m256 x = plane.x > 0.0f ? hi_x : lo_x;
+			__m256 y = plane.y > 0.0f ? hi_y : lo_y;
+			__m256 z = plane.z > 0.0f ? hi_z : lo_z;
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), x),
+			                                       _mm256_mul_ps(_mm256_set1_ps(plane.y), y)),
+			                         _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), z),
+			                                       _mm256_set1_ps(plane.w)));
+			sign = _mm256_or_ps(sign, d);
+		}
+
+		uint32_t mask = ~uint32_t(_mm256_movemask_ps(sign)) & 0xffu;
+		for (unsigned j = 0; j < 8; j++)
+		{
+			visible[i + j] = uint8_t((mask >> j) & 1u);
+			num_visible += visible[i + j];
+		}
+	}
+
+	return num_visible + frustum_cull_aabbs_generic(visible + i, aabbs + i, count - i, planes);
+}
+
+TARGET_AVX512 static size_t frustum_cull_aabbs_avx512(uint8_t *visible, const AABB *aabbs, size_t count, const vec4 *planes)
+{
+	size_t num_visible = 0;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const float *base = aabbs[i].get_minimum4().data;
+		__m512 lo[3], hi[3];
+
+		// Lane l of register j holds box 4 * l + j, which transposes to boxes in order.
+		for (unsigned half = 0; half < 2; half++)
+		{
+			__m512 r[4];
+			for (unsigned j = 0; j < 4; j++)
+			{
+				__m512 v = _mm512_castps128_ps512(_mm_loadu_ps(base + (j + 0) * 8 + 4 * half));
+				v = _mm512_insertf32x4(v, _mm_loadu_ps(base + (j + 4) * 8 + 4 * half), 1);
+				v = _mm512_insertf32x4(v, _mm_loadu_ps(base + (j + 8) * 8 + 4 * half), 2);
+				r[j] = _mm512_insertf32x4(v, _mm_loadu_ps(base + (j + 12) * 8 + 4 * half), 3);
+			}
+
+			__m512 t0 = _mm512_unpacklo_ps(r[0], r[1]);
+			__m512 t1 = _mm512_unpackhi_ps(r[0], r[1]);
+			__m512 t2 = _mm512_unpacklo_ps(r[2], r[3]);
+			__m512 t3 = _mm512_unpackhi_ps(r[2], r[3]);
+			__m512 *out = half ? hi : lo;
+			out[0] = _mm512_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+			out[1] = _mm512_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+			out[2] = _mm512_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		}
+
+		__m512i sign = _mm512_setzero_si512();
+		for (unsigned p = 0; p < 6; p++)
+		{
+			auto &plane = planes[p];
+			__m512 x = plane.x > 0.0f ? hi[0] : lo[0];
+			__m512 y = plane.y > 0.0f ? hi[1] : lo[1];
+			__m512 z = plane.z > 0.0f ? hi[2] : lo[2];
+			__m512 d = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(plane.x), x),
+			                                       _mm512_mul_ps(_mm512_set1_ps(plane.y), y)),
+			                         _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(plane.z), z),
+			                                       _mm512_set1_ps(plane.w)));
+			sign = _mm512_or_si512(sign, _mm512_castps_si512(d));
+		}
+
+		// Sign bit set means negative as an integer.
+		uint32_t mask = ~uint32_t(_mm512_cmplt_epi32_mask(sign, _mm512_setzero_si512())) & 0xffffu;
+		for (unsigned j = 0; j < 16; j++)
+		{
+			visible[i + j] = uint8_t((mask >> j) & 1u);
+			num_visible += visible[i + j];
+		}
+	}
+
+	return num_visible + frustum_cull_aabbs_avx2(visible + i, aabbs + i, count - i, planes);
+}
+
+// Two columns of the output per register.
+TARGET_AVX2 static void mul_matrices_avx2(mat4 *output, const mat4 *a, const mat4 *b, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const float *pa = a[i][0].data;
+		const float *pb = b[i][0].data;
+		__m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(pa + 0));
+		__m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(pa + 4));
+		__m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(pa + 8));
+		__m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(pa + 12));
+		__m256 b01 = _mm256_loadu_ps(pb);
+		__m256 b23 = _mm256_loadu_ps(pb + 8);
+
+#define MUL_COLUMNS(bv) \
+	_mm256_fmadd_ps(a3, _mm256_shuffle_ps(bv, bv, _MM_SHUFFLE(3, 3, 3, 3)), \
+	_mm256_fmadd_ps(a2, _mm256_shuffle_ps(bv, bv, _MM_SHUFFLE(2, 2, 2, 2)), \
+	_mm256_fmadd_ps(a1, _mm256_shuffle_ps(bv, bv, _MM_SHUFFLE(1, 1, 1, 1)), \
+	_mm256_mul_ps(a0, _mm256_shuffle_ps(bv, bv, _MM_SHUFFLE(0, 0, 0, 0))))))
+		__m256 c01 = MUL_COLUMNS(b01);
+		__m256 c23 = MUL_COLUMNS(b23);
+#undef MUL_COLUMNS
+
+		float *pc = output[i][0].data;
+		_mm256_storeu_ps(pc, c01);
+		_mm256_storeu_ps(pc + 8, c23);
+	}
+}
+
+// The whole output matrix in one register.
+TARGET_AVX512 static void mul_matrices_avx512(mat4 *output, const mat4 *a, const mat4 *b, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const float *pa = a[i][0].data;
+		__m512 a0 = _mm512_broadcast_f32x4(_mm_loadu_ps(pa + 0));
+		__m512 a1 = _mm512_broadcast_f32x4(_mm_loadu_ps(pa + 4));
+		__m512 a2 = _mm512_broadcast_f32x4(_mm_loadu_ps(pa + 8));
+		__m512 a3 = _mm512_broadcast_f32x4(_mm_loadu_ps(pa + 12));
+		__m512 bv = _mm512_loadu_ps(b[i][0].data);
+
+		__m512 c = _mm512_mul_ps(a0, _mm512_permute_ps(bv, _MM_SHUFFLE(0, 0, 0, 0)));
+		c = _mm512_fmadd_ps(a1, _mm512_permute_ps(bv, _MM_SHUFFLE(1, 1, 1, 1)), c);
+		c = _mm512_fmadd_ps(a2, _mm512_permute_ps(bv, _MM_SHUFFLE(2, 2, 2, 2)), c);
+		c = _mm512_fmadd_ps(a3, _mm512_permute_ps(bv, _MM_SHUFFLE(3, 3, 3, 3)), c);
+		_mm512_storeu_ps(output[i][0].data, c);
+	}
+}
+
+TARGET_AVX2 static void transform_points_avx2(vec4 *output, const mat4 &m, const vec4 *points, size_t count)
+{
+	__m256 m0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(m[0].data));
+	__m256 m1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(m[1].data));
+	__m256 m2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(m[2].data));
+	__m256 m3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(m[3].data));
+
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m256 v = _mm256_loadu_ps(points[i].data);
+		__m256 r = _mm256_mul_ps(m0, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+		r = _mm256_fmadd_ps(m1, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), r);
+		r = _mm256_fmadd_ps(m2, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), r);
+		r = _mm256_fmadd_ps(m3, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), r);
+		_mm256_storeu_ps(output[i].data, r);
+	}
+
+	transform_points_generic(output + i, m, points + i, count - i);
+}
+
+TARGET_AVX512 static void transform_points_avx512(vec4 *output, const mat4 &m, const vec4 *points, size_t count)
+{
+	__m512 m0 = _mm512_broadcast_f32x4(_mm_loadu_ps(m[0].data));
+	__m512 m1 = _mm512_broadcast_f32x4(_mm_loadu_ps(m[1].data));
+	__m512 m2 = _mm512_broadcast_f32x4(_mm_loadu_ps(m[2].data));
+	__m512 m3 = _mm512_broadcast_f32x4(_mm_loadu_ps(m[3].data));
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m512 v = _mm512_loadu_ps(points[i].data);
+		__m512 r = _mm512_mul_ps(m0, _mm512_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0)));
+		r = _mm512_fmadd_ps(m1, _mm512_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1)), r);
+		r = _mm512_fmadd_ps(m2, _mm512_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2)), r);
+		r = _mm512_fmadd_ps(m3, _mm512_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3)), r);
+		_mm512_storeu_ps(output[i].data, r);
+	}
+
+	transform_points_avx2(output + i, m, points + i, count - i);
+}
+
+static BatchISA detect_batch_isa()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return BatchISA::Generic;
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	if (!osxsave || !fma)
+		return BatchISA::Generic;
+
+	// The OS must save YMM state, and ZMM plus opmask state for AVX-512.
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+	bool avx512 = avx2 && (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+#else
+	__builtin_cpu_init();
+	bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	bool avx512 = avx2 && __builtin_cpu_supports("avx512f");
+#endif
+
+	if (avx512)
+		return BatchISA::AVX512;
+	else if (avx2)
+		return BatchISA::AVX2;
+	else
+		return BatchISA::Generic;
+}
+#else
+static BatchISA detect_batch_isa()
+{
+	return BatchISA::Generic;
+}
+#endif
+
+static BatchISA &get_supported_isa()
+{
+	static BatchISA isa = detect_batch_isa();
+	return isa;
+}
+
+static BatchISA select_batch_isa()
+{
+	BatchISA isa = get_supported_isa();
+	const char *env = getenv("GRANITE_SIMD_ISA");
+	if (env)
+	{
+		if (strcmp(env, "generic") == 0)
+			isa = BatchISA::Generic;
+		else if (strcmp(env, "avx2") == 0 && isa == BatchISA::AVX512)
+			isa = BatchISA::AVX2;
+	}
+	return isa;
+}
+
+static BatchISA &current_isa()
+{
+	static BatchISA isa = select_batch_isa();
+	return isa;
+}
+
+BatchISA get_batch_isa()
+{
+	return current_isa();
+}
+
+void set_batch_isa(BatchISA isa)
+{
+	current_isa() = std::min(isa, get_supported_isa());
+}
+
+const char *get_batch_isa_name(BatchISA isa)
+{
+	switch (isa)
+	{
+	case BatchISA::AVX2:
+		return "avx2";
+	case BatchISA::AVX512:
+		return "avx512";
+	default:
+		return "generic";
+	}
+}
+
+void transform_aabbs(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count)
+{
+	switch (current_isa())
+	{
+#ifdef SIMD_BATCH_X86
+	case BatchISA::AVX512:
+		transform_aabbs_avx512(output, aabbs, transforms, count);
+		break;
+	case BatchISA::AVX2:
+		transform_aabbs_avx2(output, aabbs, transforms, count);
+		break;
+#endif
+	default:
+		transform_aabbs_generic(output, aabbs, transforms, count);
+		break;
+	}
+}
+
+size_t frustum_cull_aabbs(uint8_t *visible, const AABB *aabbs, size_t count, const vec4 *planes)
+{
+	switch (current_isa())
+	{
+#ifdef SIMD_BATCH_X86
+	case BatchISA::AVX512:
+		return frustum_cull_aabbs_avx512(visible, aabbs, count, planes);
+	case BatchISA::AVX2:
+		return frustum_cull_aabbs_avx2(visible, aabbs, count, planes);
+#endif
+	default:
+		return frustum_cull_aabbs_generic(visible, aabbs, count, planes);
+	}
+}
+
+void mul_matrices(mat4 *output, const mat4 *a, const mat4 *b, size_t count)
+{
+	switch (current_isa())
+	{
+#ifdef SIMD_BATCH_X86
+	case BatchISA::AVX512:
+		mul_matrices_avx512(output, a, b, count);
+		break;
+	case BatchISA::AVX2:
+		mul_matrices_avx2(output, a, b, count);
+		break;
+#endif
+	default:
+		mul_matrices_generic(output, a, b, count);
+		break;
+	}
+}
+
+void transform_points(vec4 *output, const mat4 &m, const vec4 *points, size_t count)
+{
+	switch (current_isa())
+	{
+#ifdef SIMD_BATCH_X86
+	case BatchISA::AVX512:
+		transform_points_avx512(output, m, points, count);
+		break;
+	case BatchISA::AVX2:
+		transform_points_avx2(output, m, points, count);
+		break;
+#endif
+	default:
+		transform_points_generic(output, m, points, count);
+		break;
+	}
+}
+}
+}
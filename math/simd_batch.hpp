@@ -0,0 +1,63 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "aabb.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Granite
+{
+namespace SIMD
+{
+// Wide batch kernels. On x86-64 the widest ISA the CPU supports is picked at runtime,
+// so a binary built for baseline SSE still uses AVX2 or AVX-512 where available.
+// GRANITE_SIMD_ISA=generic|avx2|avx512 caps the selection.
+// Generic uses the compile-time SSE or NEON paths from simd.hpp.
+enum class BatchISA
+{
+	Generic,
+	AVX2,
+	AVX512
+};
+
+BatchISA get_batch_isa();
+const char *get_batch_isa_name(BatchISA isa);
+
+// Clamped to what the CPU supports. Not thread-safe against concurrent batch calls, meant for tests.
+void set_batch_isa(BatchISA isa);
+
+// output[i] = bounds of aabbs[i] transformed by transforms[i]. output may alias aabbs.
+void transform_aabbs(AABB *output, const AABB *aabbs, const mat4 *transforms, size_t count);
+
+// visible[i] = 1 if aabbs[i] intersects the 6 planes, 0 otherwise. Returns the number of visible boxes.
+size_t frustum_cull_aabbs(uint8_t *visible, const AABB *aabbs, size_t count, const vec4 *planes);
+
+// output[i] = a[i] * b[i]. output may alias a or b.
+void mul_matrices(mat4 *output, const mat4 *a, const mat4 *b, size_t count);
+
+// output[i] = m * points[i]. output may alias points.
+void transform_points(vec4 *output, const mat4 &m, const vec4 *points, size_t count);
+}
+}
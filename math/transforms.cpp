@@ -106,6 +106,20 @@ void compute_model_transform(mat4 &world, vec3 s, quat rot, vec3 trans, const ma
 	SIMD::mul(world, parent, model);
 }
 
+void compute_model_transforms(mat4 *models, const quat *rotations, const vec3 *scales, const vec3 *translations,
+                              size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		SIMD::compute_model_transforms4(models + i, rotations + i, scales + i, translations + i);
+
+	for (; i < count; i++)
+	{
+		models[i][3] = vec4(translations[i], 1.0f);
+		SIMD::convert_quaternion_with_scale(&models[i][0], rotations[i], scales[i]);
+	}
+}
+
 void compute_normal_transform(mat4 &normal, const mat4 &world)
 {
 	normal = mat4(transpose(inverse(mat3(world))));
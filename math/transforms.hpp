@@ -23,6 +23,7 @@
 #pragma once
 
 #include "math.hpp"
+#include <stddef.h>
 #include <vector>
 
 namespace Granite
@@ -37,6 +38,10 @@ bool compute_plane_refraction(mat4 &projection, mat4 &view, vec3 camera_pos, vec
 
 void compute_model_transform(mat4 &world, vec3 scale, quat rotation, vec3 translation, const mat4 &parent);
 
+// models[i] = T * R * S for count local transforms, converted four at a time.
+void compute_model_transforms(mat4 *models, const quat *rotations, const vec3 *scales, const vec3 *translations,
+                              size_t count);
+
 void compute_normal_transform(mat4 &normal, const mat4 &world);
 
 quat rotate_vector(vec3 from, vec3 to);
@@ -43,7 +43,8 @@ LooperHandler::LooperHandler(std::unique_ptr<Socket> socket_)
 {
 }
 
-Looper::Looper()
+Looper::Looper(bool edge_triggered_)
+	: edge_triggered(edge_triggered_)
 {
 #ifdef __linux__
 	fd = epoll_create1(0);
@@ -77,7 +78,7 @@ Looper::~Looper()
 #endif
 }
 
-bool Looper::modify_handler(EventFlags events, LooperHandler &handler)
+int Looper::translate_events(EventFlags events) const
 {
 #ifdef __linux__
 	int flags = 0;
@@ -85,10 +86,20 @@ bool Looper::modify_handler(EventFlags events, LooperHandler &handler)
 		flags |= EPOLLIN;
 	if (events & EVENT_OUT)
 		flags |= EPOLLOUT;
-	flags |= EPOLLHUP | EPOLLERR;
+	if (edge_triggered)
+		flags |= EPOLLET;
+	return flags;
+#else
+	(void)events;
+	return 0;
+#endif
+}
 
+bool Looper::modify_handler(EventFlags events, LooperHandler &handler)
+{
+#ifdef __linux__
 	epoll_event event = {};
-	event.events = flags;
+	event.events = translate_events(events) | EPOLLHUP | EPOLLERR;
 	event.data.ptr = &handler;
 	if (epoll_ctl(fd, EPOLL_CTL_MOD, handler.get_socket().get_fd(), &event) < 0)
 		return false;
@@ -102,14 +113,8 @@ bool Looper::modify_handler(EventFlags events, LooperHandler &handler)
 bool Looper::register_handler(EventFlags events, unique_ptr<LooperHandler> handler)
 {
 #ifdef __linux__
-	int flags = 0;
-	if (events & EVENT_IN)
-		flags |= EPOLLIN;
-	if (events & EVENT_OUT)
-		flags |= EPOLLOUT;
-
 	epoll_event event = {};
-	event.events = flags;
+	event.events = translate_events(events);
 	event.data.ptr = handler.get();
 	if (epoll_ctl(fd, EPOLL_CTL_ADD, handler->get_socket().get_fd(), &event) < 0)
 		return false;
@@ -122,6 +127,30 @@ bool Looper::register_handler(EventFlags events, unique_ptr<LooperHandler> handl
 #endif
 }
 
+void Looper::transfer_handler(LooperHandler &handler, Looper &target, EventFlags events)
+{
+#ifdef __linux__
+	auto &sock = handler.get_socket();
+	auto itr = handlers.find(sock.get_fd());
+	if (itr == end(handlers))
+		return;
+
+	epoll_ctl(fd, EPOLL_CTL_DEL, sock.get_fd(), nullptr);
+	sock.set_parent_looper(nullptr);
+	auto *ptr = itr->second.release();
+	handlers.erase(itr);
+
+	// Capture-by-move would be nice here.
+	target.run_in_looper([ptr, &target, events]() {
+		target.register_handler(events, unique_ptr<LooperHandler>(ptr));
+	});
+#else
+	(void)handler;
+	(void)target;
+	(void)events;
+#endif
+}
+
 void Looper::unregister_handler(Socket &sock)
 {
 #ifdef __linux__
@@ -210,12 +239,36 @@ int Looper::wait_idle(int timeout)
 				flags |= EVENT_ERROR;
 
 			//fprintf(stderr, "Handling event (0x%x)!\n", events[i].events);
-			auto done = !handler->handle(*this, flags);
-			if (done)
+			auto &socket = handler->get_socket();
+			bool done = false;
+
+			if (edge_triggered)
 			{
-				auto &socket = handler->get_socket();
-				unregister_handler(socket);
+				// No more events until the socket would block, so keep going until then.
+				// Cap it to stay fair, re-arming makes epoll report the fd again if it is still ready.
+				socket.consume_would_block();
+				unsigned iterations = 0;
+				for (;;)
+				{
+					done = !handler->handle(*this, flags);
+					if (done || socket.get_parent_looper() != this || socket.consume_would_block())
+						break;
+
+					if (++iterations >= 64)
+					{
+						epoll_event event = {};
+						event.events = events[i].events | EPOLLET;
+						event.data.ptr = handler;
+						epoll_ctl(fd, EPOLL_CTL_MOD, socket.get_fd(), &event);
+						break;
+					}
+				}
 			}
+			else
+				done = !handler->handle(*this, flags);
+
+			if (done)
+				unregister_handler(socket);
 		}
 	}
 
@@ -237,4 +290,35 @@ int Looper::wait(int timeout)
 #endif
 }
 
+LooperPool::LooperPool(unsigned num_loopers)
+{
+	if (!num_loopers)
+		num_loopers = 1;
+
+	for (unsigned i = 0; i < num_loopers; i++)
+		loopers.emplace_back(new Looper(true));
+
+	for (auto &looper : loopers)
+	{
+		auto *l = looper.get();
+		threads.emplace_back([l]() {
+			while (l->wait_idle(-1) >= 0);
+		});
+	}
+}
+
+LooperPool::~LooperPool()
+{
+	for (auto &looper : loopers)
+		looper->kill();
+	for (auto &thread : threads)
+		thread.join();
+}
+
+Looper &LooperPool::next()
+{
+	auto &looper = *loopers[index];
+	index = (index + 1) % loopers.size();
+	return looper;
+}
 }
@@ -45,7 +45,28 @@ enum NetFSCommand
 	NETFS_UNREGISTER_NOTIFICATION = 8,
 	NETFS_BEGIN_CHUNK_REQUEST = 9,
 	NETFS_BEGIN_CHUNK_REPLY = 10,
-	NETFS_BEGIN_CHUNK_NOTIFICATION = 11
+	NETFS_BEGIN_CHUNK_NOTIFICATION = 11,
+	NETFS_READ_FILE_RANGE = 12
+};
+
+// NETFS_READ_FILE_RANGE request chunk:
+//   string path, u64 offset, u64 size (NETFS_READ_WHOLE_FILE for all of it), u32 flags,
+//   u64 content hash of the copy the client has cached, 0 if none.
+// Reply chunk:
+//   u32 reply flags, u64 content hash, u64 file size, u64 uncompressed payload size, payload.
+// If the hashes match, the reply has NETFS_READ_REPLY_NOT_MODIFIED_BIT set and no payload.
+static const uint64_t NETFS_READ_WHOLE_FILE = ~0ull;
+
+enum NetFSReadFlagBits
+{
+	NETFS_READ_COMPRESS_BIT = 1 << 0
+};
+
+enum NetFSReadReplyFlagBits
+{
+	// Payload is an LZ4 block.
+	NETFS_READ_REPLY_COMPRESSED_BIT = 1 << 0,
+	NETFS_READ_REPLY_NOT_MODIFIED_BIT = 1 << 1
 };
 
 enum NetFSError
@@ -25,14 +25,63 @@
 #include "netfs.hpp"
 #include "filesystem.hpp"
 #include "event.hpp"
+#include "hash.hpp"
+#include "lz4.hpp"
 #include <unordered_set>
 #include <queue>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <stdlib.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace Granite;
 using namespace std;
 
 struct FSHandler;
 
+// Hashing a large asset for every ranged read is wasteful, so remember hashes until the file changes.
+struct ContentHash
+{
+	uint64_t last_modified;
+	uint64_t size;
+	Util::Hash hash;
+};
+static unordered_map<string, ContentHash> content_hashes;
+static mutex content_hash_lock;
+
+static Util::Hash get_content_hash(const string &path, const void *data, size_t size)
+{
+	FileStat s;
+	bool has_stat = Global::filesystem()->stat(path, s);
+
+	{
+		lock_guard<mutex> holder{content_hash_lock};
+		auto itr = content_hashes.find(path);
+		if (has_stat && itr != content_hashes.end() &&
+		    itr->second.last_modified == s.last_modified && itr->second.size == size)
+		{
+			return itr->second.hash;
+		}
+	}
+
+	Util::Hasher h;
+	h.u64(size);
+	h.data(static_cast<const uint8_t *>(data), size);
+
+	// 0 means "nothing cached" on the wire.
+	auto hash = h.get() ? h.get() : 1;
+	if (has_stat)
+	{
+		lock_guard<mutex> holder{content_hash_lock};
+		content_hashes[path] = { s.last_modified, uint64_t(size), hash };
+	}
+	return hash;
+}
+
 struct FilesystemHandler : LooperHandler
 {
 	FilesystemHandler(unique_ptr<Socket> socket_, FilesystemBackend &backend_)
@@ -119,8 +168,8 @@ struct NotificationSystem : EventHandler
 
 struct FSHandler : LooperHandler
 {
-	FSHandler(NotificationSystem &notify_system_, unique_ptr<Socket> socket_)
-		: LooperHandler(move(socket_)), notify_system(notify_system_)
+	FSHandler(NotificationSystem &notify_system_, LooperPool *pool_, unique_ptr<Socket> socket_)
+		: LooperHandler(move(socket_)), notify_system(notify_system_), pool(pool_)
 	{
 		reply_builder.begin(4);
 		command_reader.start(reply_builder.get_buffer());
@@ -129,6 +178,11 @@ struct FSHandler : LooperHandler
 
 	~FSHandler()
 	{
+#ifdef __linux__
+		if (sendfile_fd >= 0)
+			close(sendfile_fd);
+#endif
+
 		if (is_notify_fs)
 		{
 			LOGE("Tearing down Notification system ...\n");
@@ -165,7 +219,7 @@ struct FSHandler : LooperHandler
 		reply.writer.start(reply.builder.get_buffer());
 	}
 
-	bool parse_command(Looper &)
+	bool parse_command(Looper &looper)
 	{
 		command_id = reply_builder.read_u32();
 
@@ -177,12 +231,18 @@ struct FSHandler : LooperHandler
 		case NETFS_WALK:
 		case NETFS_LIST:
 		case NETFS_READ_FILE:
+		case NETFS_READ_FILE_RANGE:
 		case NETFS_WRITE_FILE:
 		case NETFS_STAT:
 		case NETFS_NOTIFICATION:
 			state = ReadChunkSize;
 			reply_builder.begin(3 * sizeof(uint32_t));
 			command_reader.start(reply_builder.get_buffer());
+
+			// Notifications share state with the main looper and stay there.
+			// Everything else is a one-shot request which can be served from any looper.
+			if (pool && command_id != NETFS_NOTIFICATION)
+				looper.transfer_handler(*this, pool->next(), EVENT_IN);
 			return true;
 
 		default:
@@ -298,12 +358,26 @@ struct FSHandler : LooperHandler
 		return true;
 	}
 
+	// Only files which live on the OS filesystem can be sent without going through a mapping.
+	void open_sendfile(const string &path)
+	{
+#ifdef __linux__
+		auto os_path = Global::filesystem()->get_filesystem_path(path);
+		if (!os_path.empty())
+			sendfile_fd = ::open(os_path.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+		(void)path;
+#endif
+	}
+
 	bool begin_read_file(const string &arg)
 	{
 		file = Global::filesystem()->open(arg);
 		mapped = nullptr;
 		if (file)
 			mapped = file->map();
+		if (mapped)
+			open_sendfile(arg);
 
 		reply_builder.begin();
 		if (mapped)
@@ -322,6 +396,76 @@ struct FSHandler : LooperHandler
 		return true;
 	}
 
+	bool begin_read_file_range()
+	{
+		auto path = reply_builder.read_string();
+		uint64_t offset = reply_builder.read_u64();
+		uint64_t size = reply_builder.read_u64();
+		uint32_t flags = reply_builder.read_u32();
+		uint64_t cached_hash = reply_builder.read_u64();
+
+		file = Global::filesystem()->open(path);
+		mapped = nullptr;
+		payload = nullptr;
+		payload_size = 0;
+
+		size_t file_size = file ? file->get_size() : 0;
+		if (file && file_size)
+			mapped = file->map();
+
+		reply_builder.begin();
+		reply_builder.add_u32(NETFS_BEGIN_CHUNK_REPLY);
+
+		if (!file || (file_size && !mapped))
+		{
+			reply_builder.add_u32(NETFS_ERROR_IO);
+			reply_builder.add_u64(0);
+			command_writer.start(reply_builder.get_buffer());
+			return true;
+		}
+
+		auto hash = get_content_hash(path, mapped, file_size);
+		uint32_t reply_flags = 0;
+
+		if (cached_hash == hash)
+		{
+			reply_flags |= NETFS_READ_REPLY_NOT_MODIFIED_BIT;
+		}
+		else if (offset < file_size)
+		{
+			payload = static_cast<const uint8_t *>(mapped) + offset;
+			payload_size = size_t(std::min<uint64_t>(size, file_size - offset));
+			sendfile_offset = offset;
+		}
+
+		uint64_t uncompressed_size = payload_size;
+
+		// Only worth it if it actually saves bandwidth.
+		if ((flags & NETFS_READ_COMPRESS_BIT) != 0 && payload_size)
+		{
+			compressed.resize(Util::lz4_compress_bound(payload_size));
+			size_t compressed_size = Util::lz4_compress(payload, payload_size, compressed.data(), compressed.size());
+			if (compressed_size && compressed_size < payload_size - payload_size / 8)
+			{
+				payload = compressed.data();
+				payload_size = compressed_size;
+				reply_flags |= NETFS_READ_REPLY_COMPRESSED_BIT;
+			}
+		}
+
+		if (payload_size && (reply_flags & NETFS_READ_REPLY_COMPRESSED_BIT) == 0)
+			open_sendfile(path);
+
+		reply_builder.add_u32(NETFS_ERROR_OK);
+		reply_builder.add_u64(4 + 8 + 8 + 8 + payload_size);
+		reply_builder.add_u32(reply_flags);
+		reply_builder.add_u64(hash);
+		reply_builder.add_u64(file_size);
+		reply_builder.add_u64(uncompressed_size);
+		command_writer.start(reply_builder.get_buffer());
+		return true;
+	}
+
 	void write_string_list(const vector<ListEntry> &list)
 	{
 		reply_builder.begin();
@@ -401,6 +545,14 @@ struct FSHandler : LooperHandler
 		auto ret = command_reader.process(*socket);
 		if (command_reader.complete())
 		{
+			// The only request with a structured chunk rather than a plain path.
+			if (command_id == NETFS_READ_FILE_RANGE)
+			{
+				looper.modify_handler(EVENT_OUT, *this);
+				state = WriteReplyChunk;
+				return begin_read_file_range();
+			}
+
 			auto str = reply_builder.read_string_implicit_count();
 
 			switch (command_id)
@@ -468,7 +620,14 @@ struct FSHandler : LooperHandler
 			switch (command_id)
 			{
 			case NETFS_READ_FILE:
-				if (mapped)
+				if (mapped && sendfile_fd >= 0)
+				{
+					sendfile_offset = 0;
+					sendfile_end = file->get_size();
+					state = WriteReplyFile;
+					return true;
+				}
+				else if (mapped)
 				{
 					command_writer.start(mapped, file->get_size());
 					state = WriteReplyData;
@@ -477,6 +636,22 @@ struct FSHandler : LooperHandler
 				else
 					return false;
 
+			case NETFS_READ_FILE_RANGE:
+				if (payload_size && sendfile_fd >= 0)
+				{
+					sendfile_end = sendfile_offset + payload_size;
+					state = WriteReplyFile;
+					return true;
+				}
+				else if (payload_size)
+				{
+					command_writer.start(payload, payload_size);
+					state = WriteReplyData;
+					return true;
+				}
+				else
+					return false;
+
 			case NETFS_WRITE_FILE:
 				if (file && mapped)
 					file->unmap();
@@ -490,6 +665,17 @@ struct FSHandler : LooperHandler
 		return (ret > 0) || (ret == Socket::ErrorWouldBlock);
 	}
 
+	bool write_reply_file(Looper &)
+	{
+		// Stay well within the int return value.
+		size_t to_send = size_t(std::min<uint64_t>(sendfile_end - sendfile_offset, 1u << 30));
+		auto ret = socket->sendfile(sendfile_fd, sendfile_offset, to_send);
+		if (sendfile_offset >= sendfile_end)
+			return false;
+
+		return (ret > 0) || (ret == Socket::ErrorWouldBlock);
+	}
+
 	bool write_reply_data(Looper &)
 	{
 		auto ret = command_writer.process(*socket);
@@ -634,6 +820,8 @@ struct FSHandler : LooperHandler
 			return write_reply_chunk(looper);
 		else if (state == WriteReplyData)
 			return write_reply_data(looper);
+		else if (state == WriteReplyFile)
+			return write_reply_file(looper);
 		else if (state == NotificationLoop)
 			return notification_loop(looper, flags);
 		else if (state == NotificationLoopRegister)
@@ -653,12 +841,14 @@ struct FSHandler : LooperHandler
 		ReadChunkData2,
 		WriteReplyChunk,
 		WriteReplyData,
+		WriteReplyFile,
 		NotificationLoop,
 		NotificationLoopRegister,
 		NotificationLoopUnregister
 	};
 
 	NotificationSystem &notify_system;
+	LooperPool *pool;
 	State state = ReadCommand;
 	SocketReader command_reader;
 	SocketWriter command_writer;
@@ -675,6 +865,12 @@ struct FSHandler : LooperHandler
 
 	unique_ptr<File> file;
 	void *mapped = nullptr;
+	const void *payload = nullptr;
+	size_t payload_size = 0;
+	vector<uint8_t> compressed;
+	int sendfile_fd = -1;
+	uint64_t sendfile_offset = 0;
+	uint64_t sendfile_end = 0;
 
 	bool is_notify_fs = false;
 };
@@ -711,8 +907,8 @@ void FilesystemHandler::uninstall_all_notifications(FSHandler *handler)
 
 struct ListenerHandler : TCPListener
 {
-	ListenerHandler(NotificationSystem &notify_system_, uint16_t port)
-		: TCPListener(port), notify_system(notify_system_)
+	ListenerHandler(NotificationSystem &notify_system_, LooperPool *pool_, uint16_t port)
+		: TCPListener(port), notify_system(notify_system_), pool(pool_)
 	{
 	}
 
@@ -720,18 +916,28 @@ struct ListenerHandler : TCPListener
 	{
 		auto client = accept();
 		if (client)
-			looper.register_handler(EVENT_IN, unique_ptr<FSHandler>(new FSHandler(notify_system, move(client))));
+			looper.register_handler(EVENT_IN, unique_ptr<FSHandler>(new FSHandler(notify_system, pool, move(client))));
 		return true;
 	}
 
 	NotificationSystem &notify_system;
+	LooperPool *pool;
 };
 
 int main()
 {
+	// GRANITE_NETFS_LOOPERS=0 serves everything from the main looper.
+	unsigned num_loopers = std::thread::hardware_concurrency();
+	if (const char *env = getenv("GRANITE_NETFS_LOOPERS"))
+		num_loopers = unsigned(strtoul(env, nullptr, 0));
+
+	unique_ptr<LooperPool> pool;
+	if (num_loopers)
+		pool.reset(new LooperPool(num_loopers));
+
 	Looper looper;
 	auto notify = unique_ptr<NotificationSystem>(new NotificationSystem(looper));
-	auto listener = unique_ptr<LooperHandler>(new ListenerHandler(*notify, 7070));
+	auto listener = unique_ptr<LooperHandler>(new ListenerHandler(*notify, pool.get(), 7070));
 
 	looper.register_handler(EVENT_IN, move(listener));
 	while (looper.wait(-1) >= 0);
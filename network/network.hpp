@@ -28,6 +28,7 @@
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <thread>
 
 namespace Granite
 {
@@ -105,6 +106,17 @@ public:
 
 	int write(const void *data, size_t size);
 	int read(void *data, size_t size);
+	// Sends straight from a file descriptor without a round trip through user space.
+	int sendfile(int file_fd, uint64_t &offset, size_t size);
+
+	// Set whenever read(), write() or sendfile() returned ErrorWouldBlock.
+	// Edge-triggered loopers keep calling a handler until this is seen.
+	bool consume_would_block()
+	{
+		bool ret = would_block;
+		would_block = false;
+		return ret;
+	}
 
 	enum Error
 	{
@@ -118,6 +130,7 @@ private:
 	Looper *looper = nullptr;
 	int fd;
 	bool owned;
+	bool would_block = false;
 };
 
 class SocketGlobal
@@ -159,7 +172,9 @@ protected:
 class Looper
 {
 public:
-	Looper();
+	// In edge-triggered mode, handlers are called until their socket would block,
+	// so they must not leave readable data or writable space behind without trying.
+	explicit Looper(bool edge_triggered = false);
 	~Looper();
 
 	Looper(Looper &&) = delete;
@@ -168,6 +183,11 @@ public:
 	bool modify_handler(EventFlags events, LooperHandler &handler);
 	bool register_handler(EventFlags events, std::unique_ptr<LooperHandler> handler);
 	void unregister_handler(Socket &sock);
+
+	// Moves a handler to another looper, which may run on another thread.
+	// Must be called from this looper's thread, typically as the last thing handle() does.
+	void transfer_handler(LooperHandler &handler, Looper &target, EventFlags events);
+
 	int wait(int timeout = -1);
 	int wait_idle(int timeout = -1);
 	void run_in_looper(std::function<void ()> func);
@@ -183,6 +203,32 @@ private:
 	void handle_deferred_funcs();
 
 	bool dead = false;
+	bool edge_triggered = false;
+	int translate_events(EventFlags events) const;
+};
+
+// A set of edge-triggered loopers, each on its own thread. Connections are spread across them.
+class LooperPool
+{
+public:
+	explicit LooperPool(unsigned num_loopers);
+	~LooperPool();
+
+	LooperPool(LooperPool &&) = delete;
+	void operator=(LooperPool &&) = delete;
+
+	// Round robin, only call from one thread.
+	Looper &next();
+
+	unsigned get_num_loopers() const
+	{
+		return unsigned(loopers.size());
+	}
+
+private:
+	std::vector<std::unique_ptr<Looper>> loopers;
+	std::vector<std::thread> threads;
+	unsigned index = 0;
 };
 
 class TCPListener : public LooperHandler
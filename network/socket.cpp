@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/sendfile.h>
 #endif
 
 using namespace std;
@@ -147,7 +148,10 @@ int Socket::read(void *data, size_t size)
 	if (ret < 0)
 	{
 		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			would_block = true;
 			return ErrorWouldBlock;
+		}
 		else
 			return ErrorIO;
 	}
@@ -164,7 +168,10 @@ int Socket::write(const void *data, size_t size)
 	if (ret < 0)
 	{
 		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			would_block = true;
 			return ErrorWouldBlock;
+		}
 		else
 			return ErrorIO;
 	}
@@ -173,4 +180,29 @@ int Socket::write(const void *data, size_t size)
 	return -1;
 #endif
 }
+
+int Socket::sendfile(int file_fd, uint64_t &offset, size_t size)
+{
+#ifdef __linux__
+	off_t off = off_t(offset);
+	auto ret = ::sendfile(fd, file_fd, &off, size);
+	if (ret < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			would_block = true;
+			return ErrorWouldBlock;
+		}
+		else
+			return ErrorIO;
+	}
+	offset = uint64_t(off);
+	return int(ret);
+#else
+	(void)file_fd;
+	(void)offset;
+	(void)size;
+	return ErrorIO;
+#endif
+}
 }
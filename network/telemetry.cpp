@@ -0,0 +1,213 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "telemetry.hpp"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+namespace Granite
+{
+// A collector which is this far behind is not reading, stop queueing for it.
+static constexpr size_t MaxPendingBytes = 256 * 1024;
+
+struct TelemetryClientHandler : LooperHandler
+{
+	TelemetryClientHandler(TelemetryServer &server_, unique_ptr<Socket> socket_)
+		: LooperHandler(move(socket_)), server(server_)
+	{
+		server.add_client(this);
+	}
+
+	~TelemetryClientHandler() override
+	{
+		server.remove_client(this);
+	}
+
+	bool enqueue(Looper &looper, const vector<uint8_t> &packet)
+	{
+		if (pending.size() - offset + packet.size() > MaxPendingBytes)
+			return false;
+
+		bool was_idle = offset == pending.size();
+		if (was_idle)
+		{
+			pending.clear();
+			offset = 0;
+		}
+
+		pending.insert(pending.end(), packet.begin(), packet.end());
+		if (was_idle)
+			looper.modify_handler(EVENT_IN | EVENT_OUT, *this);
+		return true;
+	}
+
+	bool handle(Looper &looper, EventFlags flags) override
+	{
+		if (flags & (EVENT_HANGUP | EVENT_ERROR))
+			return false;
+
+		// Collectors never send anything, so readable means closed.
+		if (flags & EVENT_IN)
+		{
+			uint8_t dummy[64];
+			int ret = socket->read(dummy, sizeof(dummy));
+			if (ret == 0 || ret == Socket::ErrorIO)
+				return false;
+		}
+
+		if (flags & EVENT_OUT)
+		{
+			while (offset < pending.size())
+			{
+				int ret = socket->write(pending.data() + offset, pending.size() - offset);
+				if (ret == Socket::ErrorWouldBlock)
+					return true;
+				else if (ret <= 0)
+					return false;
+				offset += size_t(ret);
+			}
+
+			looper.modify_handler(EVENT_IN, *this);
+		}
+
+		return true;
+	}
+
+	TelemetryServer &server;
+	vector<uint8_t> pending;
+	size_t offset = 0;
+};
+
+struct TelemetryListenerHandler : TCPListener
+{
+	TelemetryListenerHandler(TelemetryServer &server_, uint16_t port)
+		: TCPListener(port), server(server_)
+	{
+	}
+
+	bool handle(Looper &looper, EventFlags) override
+	{
+		auto client = accept();
+		if (!client)
+			return true;
+
+		auto *handler = new TelemetryClientHandler(server, move(client));
+		if (!looper.register_handler(EVENT_IN, unique_ptr<LooperHandler>(handler)))
+			return true;
+
+		TelemetryPacketHeader header = { TELEMETRY_HELLO, uint32_t(sizeof(server.hello)) };
+		vector<uint8_t> packet(sizeof(header) + sizeof(server.hello));
+		memcpy(packet.data(), &header, sizeof(header));
+		memcpy(packet.data() + sizeof(header), &server.hello, sizeof(server.hello));
+		handler->enqueue(looper, packet);
+		return true;
+	}
+
+	TelemetryServer &server;
+};
+
+TelemetryServer::TelemetryServer(const char *device_name, uint16_t port)
+	: num_clients(0), dropped_packets(0)
+{
+	hello.magic = TELEMETRY_MAGIC;
+	hello.version = TELEMETRY_VERSION;
+	if (device_name)
+		strncpy(hello.device_name, device_name, sizeof(hello.device_name) - 1);
+
+	looper.register_handler(EVENT_IN, unique_ptr<LooperHandler>(new TelemetryListenerHandler(*this, port)));
+	thread = std::thread([this]() {
+		while (looper.wait_idle(-1) >= 0);
+	});
+}
+
+TelemetryServer::~TelemetryServer()
+{
+	looper.kill();
+	if (thread.joinable())
+		thread.join();
+}
+
+void TelemetryServer::add_client(TelemetryClientHandler *client)
+{
+	clients.push_back(client);
+	num_clients.store(unsigned(clients.size()), memory_order_relaxed);
+}
+
+void TelemetryServer::remove_client(TelemetryClientHandler *client)
+{
+	auto itr = find(clients.begin(), clients.end(), client);
+	if (itr != clients.end())
+		clients.erase(itr);
+	num_clients.store(unsigned(clients.size()), memory_order_relaxed);
+}
+
+void TelemetryServer::broadcast(const shared_ptr<vector<uint8_t>> &packet)
+{
+	for (auto *client : clients)
+		if (!client->enqueue(looper, *packet))
+			dropped_packets.fetch_add(1, memory_order_relaxed);
+}
+
+void TelemetryServer::push_packet(TelemetryPacketType type, const void *data, size_t size)
+{
+	if (!has_clients())
+		return;
+
+	TelemetryPacketHeader header = { uint32_t(type), uint32_t(size) };
+	auto packet = make_shared<vector<uint8_t>>(sizeof(header) + size);
+	memcpy(packet->data(), &header, sizeof(header));
+	memcpy(packet->data() + sizeof(header), data, size);
+	looper.run_in_looper([this, packet]() { broadcast(packet); });
+}
+
+void TelemetryServer::push_array_packet(TelemetryPacketType type, const void *data, uint32_t count, size_t stride)
+{
+	if (!has_clients())
+		return;
+
+	size_t size = sizeof(count) + count * stride;
+	TelemetryPacketHeader header = { uint32_t(type), uint32_t(size) };
+	auto packet = make_shared<vector<uint8_t>>(sizeof(header) + size);
+	memcpy(packet->data(), &header, sizeof(header));
+	memcpy(packet->data() + sizeof(header), &count, sizeof(count));
+	if (count)
+		memcpy(packet->data() + sizeof(header) + sizeof(count), data, count * stride);
+	looper.run_in_looper([this, packet]() { broadcast(packet); });
+}
+
+void TelemetryServer::push_frame(const TelemetryFrameStats &stats)
+{
+	push_packet(TELEMETRY_FRAME, &stats, sizeof(stats));
+}
+
+void TelemetryServer::push_memory_tags(const TelemetryMemoryTagStats *tags, uint32_t count)
+{
+	push_array_packet(TELEMETRY_MEMORY_TAGS, tags, count, sizeof(*tags));
+}
+
+void TelemetryServer::push_tasks(const TelemetryTaskStats *tasks, uint32_t count)
+{
+	push_array_packet(TELEMETRY_TASKS, tasks, count, sizeof(*tasks));
+}
+}
@@ -0,0 +1,152 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "network.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Granite
+{
+// Compact binary telemetry stream, consumed by tools/telemetry_collector.
+// Every packet is a TelemetryPacketHeader followed by size bytes of payload, all little-endian.
+static const uint32_t TELEMETRY_MAGIC = 0x4d4c4554; // TELM
+static const uint32_t TELEMETRY_VERSION = 1;
+static const uint16_t TELEMETRY_DEFAULT_PORT = 7071;
+
+enum TelemetryPacketType
+{
+	// TelemetryHello, sent once on connect.
+	TELEMETRY_HELLO = 1,
+	// TelemetryFrameStats.
+	TELEMETRY_FRAME = 2,
+	// u32 count, then count TelemetryMemoryTagStats.
+	TELEMETRY_MEMORY_TAGS = 3,
+	// u32 count, then count TelemetryTaskStats.
+	TELEMETRY_TASKS = 4
+};
+
+struct TelemetryPacketHeader
+{
+	uint32_t type;
+	uint32_t size;
+};
+
+struct TelemetryHello
+{
+	uint32_t magic;
+	uint32_t version;
+	char device_name[64];
+};
+
+struct TelemetryFrameStats
+{
+	uint64_t frame_index;
+	// Producer clock, only meaningful as a delta.
+	uint64_t timestamp_ns;
+	float frame_time_ms;
+	float cpu_time_ms;
+	float gpu_time_ms;
+	uint32_t submissions;
+	uint64_t device_memory_usage;
+	uint64_t device_memory_budget;
+};
+
+struct TelemetryMemoryTagStats
+{
+	char tag[24];
+	uint32_t live_count;
+	uint32_t peak_count;
+	uint64_t live_size;
+	uint64_t peak_size;
+};
+
+struct TelemetryTaskStats
+{
+	char desc[48];
+	uint32_t count;
+	uint32_t p50_us;
+	uint32_t p99_us;
+	uint32_t max_us;
+	uint64_t total_ns;
+};
+
+static_assert(sizeof(TelemetryHello) == 72, "Unexpected padding in telemetry packet.");
+static_assert(sizeof(TelemetryFrameStats) == 48, "Unexpected padding in telemetry packet.");
+static_assert(sizeof(TelemetryMemoryTagStats) == 48, "Unexpected padding in telemetry packet.");
+static_assert(sizeof(TelemetryTaskStats) == 72, "Unexpected padding in telemetry packet.");
+
+struct TelemetryClientHandler;
+
+// Serves the telemetry stream to any number of collectors from its own looper thread.
+// Pushing is cheap: packets are encoded on the caller's thread and queued to the looper.
+// Collectors which cannot keep up lose packets rather than stalling the producer.
+class TelemetryServer
+{
+public:
+	// Throws if the port cannot be bound, like TCPListener.
+	explicit TelemetryServer(const char *device_name, uint16_t port = TELEMETRY_DEFAULT_PORT);
+	~TelemetryServer();
+
+	TelemetryServer(TelemetryServer &&) = delete;
+	void operator=(TelemetryServer &&) = delete;
+
+	void push_frame(const TelemetryFrameStats &stats);
+	void push_memory_tags(const TelemetryMemoryTagStats *tags, uint32_t count);
+	void push_tasks(const TelemetryTaskStats *tasks, uint32_t count);
+
+	// Skip gathering stats entirely while nobody is watching.
+	bool has_clients() const
+	{
+		return num_clients.load(std::memory_order_relaxed) != 0;
+	}
+
+	uint64_t get_dropped_packets() const
+	{
+		return dropped_packets.load(std::memory_order_relaxed);
+	}
+
+private:
+	friend struct TelemetryClientHandler;
+	friend struct TelemetryListenerHandler;
+
+	TelemetryHello hello = {};
+
+	// Only touched on the looper thread. Outlives the looper, which removes clients as it is destroyed.
+	std::vector<TelemetryClientHandler *> clients;
+	std::atomic_uint num_clients;
+	std::atomic<uint64_t> dropped_packets;
+
+	Looper looper;
+	std::thread thread;
+
+	void push_packet(TelemetryPacketType type, const void *data, size_t size);
+	void push_array_packet(TelemetryPacketType type, const void *data, uint32_t count, size_t stride);
+	void broadcast(const std::shared_ptr<std::vector<uint8_t>> &packet);
+	void add_client(TelemetryClientHandler *client);
+	void remove_client(TelemetryClientHandler *client);
+};
+}
@@ -25,6 +25,26 @@
 #include <btBulletCollisionCommon.h>
 #include <BulletCollision/CollisionDispatch/btGhostObject.h>
 #include <BulletDynamics/Character/btKinematicCharacterController.h>
+#if BT_THREADSAFE
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <LinearMath/btThreads.h>
+#endif
+#include "logging.hpp"
+#include "thread_name.hpp"
+#include "task_composer.hpp"
+#include "global_managers.hpp"
+#include "filesystem.hpp"
+#include "hash.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -52,6 +72,128 @@ static quat convert(const btQuaternion &q)
 	return { q.w(), q.x(), q.y(), q.z() };
 }
 
+// Bullet is stepped on a dedicated thread so it runs in parallel with rendering.
+// Bullet's task scheduler must be installed by, and only driven from, the thread with Bullet thread index 0,
+// so the same thread owns it for the lifetime of the process.
+class PhysicsStepThread
+{
+public:
+	PhysicsStepThread();
+	~PhysicsStepThread();
+
+	uint64_t submit(std::function<void ()> func);
+	void wait(uint64_t ticket);
+
+	bool is_multithreaded() const
+	{
+		return multithreaded;
+	}
+
+private:
+	std::mutex lock;
+	std::condition_variable cond;
+	std::deque<std::function<void ()>> queue;
+	std::thread thread;
+	uint64_t submitted = 0;
+	uint64_t completed = 0;
+	bool ready = false;
+	bool dead = false;
+	bool multithreaded = false;
+
+	void init_task_scheduler();
+	void looper();
+};
+
+static PhysicsStepThread &get_step_thread()
+{
+	static PhysicsStepThread step_thread;
+	return step_thread;
+}
+
+PhysicsStepThread::PhysicsStepThread()
+{
+	thread = std::thread(&PhysicsStepThread::looper, this);
+	unique_lock<mutex> holder{lock};
+	cond.wait(holder, [this]() { return ready; });
+}
+
+PhysicsStepThread::~PhysicsStepThread()
+{
+	{
+		lock_guard<mutex> holder{lock};
+		dead = true;
+		cond.notify_all();
+	}
+
+	if (thread.joinable())
+		thread.join();
+}
+
+uint64_t PhysicsStepThread::submit(std::function<void ()> func)
+{
+	lock_guard<mutex> holder{lock};
+	queue.push_back(move(func));
+	cond.notify_all();
+	return ++submitted;
+}
+
+void PhysicsStepThread::wait(uint64_t ticket)
+{
+	unique_lock<mutex> holder{lock};
+	cond.wait(holder, [this, ticket]() { return completed >= ticket; });
+}
+
+void PhysicsStepThread::init_task_scheduler()
+{
+#if BT_THREADSAFE
+	unsigned num_threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	const char *env = getenv("GRANITE_PHYSICS_THREADS");
+	if (env)
+		num_threads = unsigned(strtoul(env, nullptr, 0));
+
+	if (num_threads <= 1)
+		return;
+
+	auto *scheduler = btCreateDefaultTaskScheduler();
+	if (!scheduler)
+	{
+		LOGW("Bullet task scheduler is not available, stepping on one thread.\n");
+		return;
+	}
+
+	num_threads = std::min(num_threads, unsigned(scheduler->getMaxNumThreads()));
+	scheduler->setNumThreads(int(num_threads));
+	btSetTaskScheduler(scheduler);
+	multithreaded = true;
+	LOGI("Stepping Bullet with %u threads.\n", num_threads);
+#endif
+}
+
+void PhysicsStepThread::looper()
+{
+	Util::set_current_thread_name("physics-step");
+	init_task_scheduler();
+
+	unique_lock<mutex> holder{lock};
+	ready = true;
+	cond.notify_all();
+
+	for (;;)
+	{
+		cond.wait(holder, [this]() { return dead || !queue.empty(); });
+		if (queue.empty())
+			break;
+
+		auto func = move(queue.front());
+		queue.pop_front();
+		holder.unlock();
+		func();
+		holder.lock();
+		completed++;
+		cond.notify_all();
+	}
+}
+
 struct PhysicsHandle
 {
 	Scene::Node *node = nullptr;
@@ -60,6 +202,16 @@ struct PhysicsHandle
 	Entity *entity = nullptr;
 	PhysicsSystem::InteractionType type = PhysicsSystem::InteractionType::Ghost;
 	bool copy_transform_from_node = false;
+	bool copy_transform_to_node = false;
+
+	// Transforms of the last two fixed ticks, nodes receive a blend of the two.
+	vec3 prev_translation = vec3(0.0f);
+	vec3 translation = vec3(0.0f);
+	quat prev_rotation = quat(1.0f, 0.0f, 0.0f, 0.0f);
+	quat rotation = quat(1.0f, 0.0f, 0.0f, 0.0f);
+	// moving: the last tick changed the transform. node_dirty: the node does not hold the latest blend yet.
+	bool moving = false;
+	bool node_dirty = false;
 
 	~PhysicsHandle()
 	{
@@ -91,6 +243,41 @@ static void tick_callback_wrapper(btDynamicsWorld *world, btScalar time_step)
 
 void PhysicsSystem::tick_callback(float)
 {
+	// Runs on the step thread, so collisions are only recorded here and dispatched in end_iterate().
+	for (auto *handle : handles)
+	{
+		if (!handle->copy_transform_to_node)
+			continue;
+
+		// Sleeping bodies keep their transform, so settle on the last tick and leave the node alone after that.
+		if (!handle->bt_object->isActive())
+		{
+			if (handle->moving)
+			{
+				handle->prev_translation = handle->translation;
+				handle->prev_rotation = handle->rotation;
+				handle->moving = false;
+			}
+			continue;
+		}
+
+		auto &t = handle->bt_object->getWorldTransform();
+		vec3 translation = convert(t.getOrigin());
+		quat rotation = convert(t.getRotation());
+		bool moved = any(notEqual(translation, handle->translation)) ||
+		             any(notEqual(rotation.as_vec4(), handle->rotation.as_vec4()));
+
+		if (moved || handle->moving)
+		{
+			handle->prev_translation = handle->translation;
+			handle->prev_rotation = handle->rotation;
+			handle->translation = translation;
+			handle->rotation = rotation;
+			handle->node_dirty = true;
+		}
+		handle->moving = moved;
+	}
+
 	auto *collision_dispatcher = world->getDispatcher();
 	int num_manifolds = collision_dispatcher->getNumManifolds();
 	for (int i = 0; i < num_manifolds; i++)
@@ -112,39 +299,30 @@ void PhysicsSystem::tick_callback(float)
 			}
 		}
 	}
-
-	auto *em = GRANITE_EVENT_MANAGER();
-	if (em)
-		for (auto &collision : new_collision_buffer)
-			em->dispatch_inline(collision);
-	new_collision_buffer.clear();
 }
 
-RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3 &dir, float t,
-                                                   InteractionTypeFlags flags)
+static void set_ray_filter_mask(btCollisionWorld::ClosestRayResultCallback &cb,
+                                PhysicsSystem::InteractionTypeFlags flags)
 {
-	vec3 to = from + dir * t;
-	btVector3 ray_from_world = convert(from);
-	btVector3 ray_to_world = convert(to);
-	btCollisionWorld::ClosestRayResultCallback cb(ray_from_world, ray_to_world);
-
+	using Flags = PhysicsSystem::InteractionTypeFlagBits;
 	cb.m_collisionFilterMask = 0;
-	if (flags == INTERACTION_TYPE_ALL_BITS)
+	if (flags == Flags::INTERACTION_TYPE_ALL_BITS)
 		cb.m_collisionFilterMask = btBroadphaseProxy::AllFilter;
 	else
 	{
-		if (flags & INTERACTION_TYPE_STATIC_BIT)
+		if (flags & Flags::INTERACTION_TYPE_STATIC_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::StaticFilter;
-		if (flags & INTERACTION_TYPE_DYNAMIC_BIT)
+		if (flags & Flags::INTERACTION_TYPE_DYNAMIC_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::DefaultFilter;
-		if (flags & INTERACTION_TYPE_INVISIBLE_BIT)
+		if (flags & Flags::INTERACTION_TYPE_INVISIBLE_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::SensorTrigger;
-		if (flags & INTERACTION_TYPE_KINEMATIC_BIT)
+		if (flags & Flags::INTERACTION_TYPE_KINEMATIC_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::CharacterFilter;
 	}
+}
 
-	world->rayTest(ray_from_world, ray_to_world, cb);
-
+static RaycastResult get_ray_result(const btCollisionWorld::ClosestRayResultCallback &cb, float t)
+{
 	RaycastResult result = {};
 	if (cb.hasHit())
 	{
@@ -167,14 +345,149 @@ RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3
 	return result;
 }
 
+RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3 &dir, float t,
+                                                   InteractionTypeFlags flags)
+{
+	wait_for_step();
+	vec3 to = from + dir * t;
+	btVector3 ray_from_world = convert(from);
+	btVector3 ray_to_world = convert(to);
+	btCollisionWorld::ClosestRayResultCallback cb(ray_from_world, ray_to_world);
+	set_ray_filter_mask(cb, flags);
+	world->rayTest(ray_from_world, ray_to_world, cb);
+	return get_ray_result(cb, t);
+}
+
+// Same as btSingleRayCallback in btCollisionWorld::rayTest(), but the traversal stack is owned
+// by the caller. btDbvtBroadphase::rayTest() shares one stack, so it cannot run on several threads.
+struct BatchRayTester : btDbvt::ICollide
+{
+	BatchRayTester(btCollisionWorld::ClosestRayResultCallback &cb_, const btVector3 &from, const btVector3 &to)
+		: cb(cb_)
+	{
+		from_trans.setIdentity();
+		from_trans.setOrigin(from);
+		to_trans.setIdentity();
+		to_trans.setOrigin(to);
+	}
+
+	void Process(const btDbvtNode *leaf)
+	{
+		if (cb.m_closestHitFraction == btScalar(0.0f))
+			return;
+
+		auto *proxy = static_cast<const btBroadphaseProxy *>(leaf->data);
+		auto *object = static_cast<const btCollisionObject *>(proxy->m_clientObject);
+		if (cb.needsCollision(object->getBroadphaseHandle()))
+		{
+			btCollisionWorld::rayTestSingle(from_trans, to_trans, object, object->getCollisionShape(),
+			                                object->getWorldTransform(), cb);
+		}
+	}
+
+	btCollisionWorld::ClosestRayResultCallback &cb;
+	btTransform from_trans;
+	btTransform to_trans;
+};
+
+void PhysicsSystem::trace_rays(const RaycastQuery *queries, RaycastResult *results, size_t begin, size_t end) const
+{
+	btAlignedObjectArray<const btDbvtNode *> stack;
+	const btVector3 zero(0.0f, 0.0f, 0.0f);
+
+	for (size_t i = begin; i < end; i++)
+	{
+		auto &query = queries[i];
+		results[i] = {};
+		if (!(query.length > 0.0f))
+			continue;
+
+		btVector3 ray_from_world = convert(query.from);
+		btVector3 ray_to_world = convert(query.from + query.dir * query.length);
+		btCollisionWorld::ClosestRayResultCallback cb(ray_from_world, ray_to_world);
+		set_ray_filter_mask(cb, query.mask);
+
+		btVector3 ray_dir = (ray_to_world - ray_from_world).normalized();
+		btVector3 inv_dir(ray_dir.x() == 0.0f ? btScalar(BT_LARGE_FLOAT) : 1.0f / ray_dir.x(),
+		                  ray_dir.y() == 0.0f ? btScalar(BT_LARGE_FLOAT) : 1.0f / ray_dir.y(),
+		                  ray_dir.z() == 0.0f ? btScalar(BT_LARGE_FLOAT) : 1.0f / ray_dir.z());
+		unsigned signs[3] = { inv_dir.x() < 0.0f, inv_dir.y() < 0.0f, inv_dir.z() < 0.0f };
+		btScalar lambda_max = ray_dir.dot(ray_to_world - ray_from_world);
+
+		BatchRayTester tester(cb, ray_from_world, ray_to_world);
+		for (auto &set : broadphase->m_sets)
+		{
+			set.rayTestInternal(set.m_root, ray_from_world, ray_to_world, inv_dir, signs, lambda_max,
+			                    zero, zero, stack, tester);
+		}
+
+		results[i] = get_ray_result(cb, query.length);
+	}
+}
+
+// Each task traces a few dozen rays, which is well above the task overhead.
+static constexpr size_t RayBatchGrain = 64;
+
+void PhysicsSystem::query_closest_hit_rays(const RaycastQuery *queries, RaycastResult *results, size_t count)
+{
+	wait_for_step();
+
+	auto *group = GRANITE_THREAD_GROUP();
+	bool parallel = group && count > RayBatchGrain &&
+	                (!ThreadGroup::current_thread_is_worker() || ThreadGroup::current_task_is_suspendable());
+
+	if (parallel)
+	{
+		TaskComposer composer(*group);
+		composer.set_priority(TaskPriority::High);
+		composer.parallel_for(count, RayBatchGrain, [this, queries, results](size_t begin, size_t end) {
+			trace_rays(queries, results, begin, end);
+		});
+		composer.get_outgoing_task()->wait();
+	}
+	else
+		trace_rays(queries, results, 0, count);
+}
+
+void PhysicsSystem::query_closest_hit_rays_async(TaskComposer &composer,
+                                                 const RaycastQuery *queries, RaycastResult *results, size_t count,
+                                                 TaskSignal *signal)
+{
+	wait_for_step();
+
+	ray_tasks_submitted += composer.compute_parallel_for_tasks(count, RayBatchGrain);
+	auto &stage = composer.parallel_for(count, RayBatchGrain, [this, queries, results](size_t begin, size_t end) {
+		trace_rays(queries, results, begin, end);
+		ray_task_signal.signal_increment();
+	});
+	stage.set_desc("physics-raycast-batch");
+	if (signal)
+		stage.set_fence_counter_signal(signal);
+}
+
 PhysicsSystem::PhysicsSystem()
 {
 	collision_config = make_unique<btDefaultCollisionConfiguration>();
-	dispatcher = make_unique<btCollisionDispatcher>(collision_config.get());
 	broadphase = make_unique<btDbvtBroadphase>();
-	solver = make_unique<btSequentialImpulseConstraintSolver>();
-	world = make_unique<btDiscreteDynamicsWorld>(dispatcher.get(), broadphase.get(),
-	                                             solver.get(), collision_config.get());
+
+#if BT_THREADSAFE
+	if (get_step_thread().is_multithreaded())
+	{
+		dispatcher = make_unique<btCollisionDispatcherMt>(collision_config.get());
+		auto pool = make_unique<btConstraintSolverPoolMt>(BT_MAX_THREAD_COUNT);
+		solver = make_unique<btSequentialImpulseConstraintSolverMt>();
+		world = make_unique<btDiscreteDynamicsWorldMt>(dispatcher.get(), broadphase.get(), pool.get(),
+		                                               solver.get(), collision_config.get());
+		solver_pool = move(pool);
+	}
+	else
+#endif
+	{
+		dispatcher = make_unique<btCollisionDispatcher>(collision_config.get());
+		solver = make_unique<btSequentialImpulseConstraintSolver>();
+		world = make_unique<btDiscreteDynamicsWorld>(dispatcher.get(), broadphase.get(),
+		                                             solver.get(), collision_config.get());
+	}
 
 	world->setGravity(btVector3(0.0f, -9.81f, 0.0f));
 	world->setInternalTickCallback(tick_callback_wrapper, this);
@@ -201,17 +514,24 @@ struct KinematicCharacter::Impl : btKinematicCharacterController
 
 	void updateAction(btCollisionWorld *collision_world, btScalar delta_time) override
 	{
+		// Runs on the step thread, the node is written in PhysicsSystem::end_iterate().
 		btKinematicCharacterController::updateAction(collision_world, delta_time);
-		if (node)
-		{
-			node->transform.translation = convert(m_currentPosition);
-			node->transform.rotation = convert(m_currentOrientation);
-			node->invalidate_cached_transform();
-		}
+		prev_translation = translation;
+		prev_rotation = rotation;
+		translation = convert(m_currentPosition);
+		rotation = convert(m_currentOrientation);
 	}
 
 	~Impl() override
 	{
+		if (system)
+		{
+			system->wait_for_idle();
+			auto itr = find(begin(system->characters), end(system->characters), this);
+			if (itr != end(system->characters))
+				system->characters.erase(itr);
+		}
+
 		if (world && ghost)
 			world->removeCollisionObject(ghost);
 		if (world)
@@ -223,8 +543,14 @@ struct KinematicCharacter::Impl : btKinematicCharacterController
 	btPairCachingGhostObject *ghost;
 	btConvexShape *shape;
 	btDynamicsWorld *world = nullptr;
+	PhysicsSystem *system = nullptr;
 	Scene::NodeHandle node;
 	float tick = 0.0f;
+
+	vec3 prev_translation = vec3(0.0f);
+	vec3 translation = vec3(0.0f);
+	quat prev_rotation = quat(1.0f, 0.0f, 0.0f, 0.0f);
+	quat rotation = quat(1.0f, 0.0f, 0.0f, 0.0f);
 };
 
 KinematicCharacter::KinematicCharacter(btDynamicsWorld *world, Scene::NodeHandle node)
@@ -246,7 +572,13 @@ KinematicCharacter::KinematicCharacter(btDynamicsWorld *world, Scene::NodeHandle
 	impl->world = world;
 	impl->node = node;
 	impl->tick = PHYSICS_TICK;
+	impl->prev_translation = impl->translation = node->transform.translation;
+	impl->prev_rotation = impl->rotation = node->transform.rotation;
 	world->addAction(impl.get());
+
+	impl->system = static_cast<PhysicsSystem *>(world->getWorldUserInfo());
+	if (impl->system)
+		impl->system->characters.push_back(impl.get());
 }
 
 KinematicCharacter &KinematicCharacter::operator=(KinematicCharacter &&other) noexcept
@@ -257,16 +589,22 @@ KinematicCharacter &KinematicCharacter::operator=(KinematicCharacter &&other) no
 
 void KinematicCharacter::set_move_velocity(const vec3 &v)
 {
+	if (impl->system)
+		impl->system->wait_for_step();
 	impl->setWalkDirection(convert(v * impl->tick));
 }
 
 bool KinematicCharacter::is_grounded()
 {
+	if (impl->system)
+		impl->system->wait_for_step();
 	return impl->onGround();
 }
 
 void KinematicCharacter::jump(const vec3 &v)
 {
+	if (impl->system)
+		impl->system->wait_for_step();
 	impl->jump(convert(v));
 }
 
@@ -285,12 +623,14 @@ KinematicCharacter::~KinematicCharacter()
 
 KinematicCharacter PhysicsSystem::add_kinematic_character(Scene::NodeHandle node)
 {
+	wait_for_idle();
 	KinematicCharacter character(world.get(), node);
 	return character;
 }
 
 PhysicsSystem::~PhysicsSystem()
 {
+	wait_for_idle();
 	for (int i = world->getNumCollisionObjects() - 1; i >= 0; i--)
 	{
 		auto *obj = world->getCollisionObjectArray()[i];
@@ -301,8 +641,37 @@ PhysicsSystem::~PhysicsSystem()
 		handle_pool.free(handle);
 }
 
+void PhysicsSystem::wait_for_step()
+{
+	if (step_ticket)
+	{
+		get_step_thread().wait(step_ticket);
+		step_ticket = 0;
+	}
+}
+
+void PhysicsSystem::wait_for_idle()
+{
+	wait_for_step();
+	if (ray_tasks_submitted)
+		ray_task_signal.wait_until_at_least(ray_tasks_submitted);
+}
+
 void PhysicsSystem::iterate(double frame_time)
 {
+	begin_iterate(frame_time);
+	end_iterate();
+}
+
+void PhysicsSystem::step(float frame_time)
+{
+	world->stepSimulation(frame_time, 20, PHYSICS_TICK);
+}
+
+void PhysicsSystem::begin_iterate(double frame_time)
+{
+	wait_for_idle();
+
 	// System which applies forces to objects every iteration.
 	if (forces)
 	{
@@ -361,39 +730,61 @@ void PhysicsSystem::iterate(double frame_time)
 		}
 	}
 
-	world->stepSimulation(btScalar(frame_time), 20, PHYSICS_TICK);
+	// Mirrors the accumulator in btDiscreteDynamicsWorld::stepSimulation(), the remainder is the
+	// phase between the last two ticks.
+	float step_time = float(frame_time);
+	local_time += step_time;
+	if (local_time >= PHYSICS_TICK)
+		local_time -= float(int(local_time / PHYSICS_TICK)) * PHYSICS_TICK;
+
+	step_ticket = get_step_thread().submit([this, step_time]() {
+		step(step_time);
+	});
+}
+
+void PhysicsSystem::end_iterate()
+{
+	wait_for_step();
+
+	auto *em = GRANITE_EVENT_MANAGER();
+	if (em)
+		for (auto &collision : new_collision_buffer)
+			em->dispatch_inline(collision);
+	new_collision_buffer.clear();
 
 	// Update node transforms from physics engine.
+	float phase = clamp(local_time / PHYSICS_TICK, 0.0f, 1.0f);
 	for (auto *handle : handles)
 	{
-		if (!handle->node || handle->copy_transform_from_node)
+		// Resting bodies would otherwise invalidate their nodes every frame, which defeats transform
+		// and static shadow caching downstream.
+		if (!handle->node_dirty)
 			continue;
 
-		auto *obj = handle->bt_object;
-		auto *ghost = btPairCachingGhostObject::upcast(obj);
-		if (ghost)
-			continue;
-
-		auto *body = btRigidBody::upcast(obj);
-		btTransform t;
-		if (body && body->getMotionState())
-			body->getMotionState()->getWorldTransform(t);
-		else
-			t = obj->getWorldTransform();
-
-		auto rot = t.getRotation();
 		auto &transform = handle->node->transform;
-		transform.rotation.x = rot.x();
-		transform.rotation.y = rot.y();
-		transform.rotation.z = rot.z();
-		transform.rotation.w = rot.w();
+		if (handle->moving)
+		{
+			transform.translation = mix(handle->prev_translation, handle->translation, phase);
+			transform.rotation = slerp(handle->prev_rotation, handle->rotation, phase);
+		}
+		else
+		{
+			transform.translation = handle->translation;
+			transform.rotation = handle->rotation;
+			handle->node_dirty = false;
+		}
+		handle->node->invalidate_cached_transform();
+	}
 
-		auto orig = t.getOrigin();
-		transform.translation.x = orig.x();
-		transform.translation.y = orig.y();
-		transform.translation.z = orig.z();
+	for (auto *character : characters)
+	{
+		if (!character->node)
+			continue;
 
-		handle->node->invalidate_cached_transform();
+		auto &transform = character->node->transform;
+		transform.translation = mix(character->prev_translation, character->translation, phase);
+		transform.rotation = slerp(character->prev_rotation, character->rotation, phase);
+		character->node->invalidate_cached_transform();
 	}
 }
 
@@ -414,6 +805,7 @@ void PhysicsSystem::set_handle_parent(PhysicsHandle *handle, Entity *entity)
 
 void PhysicsSystem::remove_body(PhysicsHandle *handle)
 {
+	wait_for_idle();
 	auto *obj = handle->bt_object;
 	btRigidBody *body = btRigidBody::upcast(obj);
 
@@ -435,8 +827,125 @@ void PhysicsSystem::remove_body(PhysicsHandle *handle)
 		handles.erase(itr);
 }
 
+namespace
+{
+struct BvhCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	Util::Hash hash;
+	uint64_t size;
+};
+}
+
+static constexpr uint32_t BvhCacheMagic = 0x48564247; // GBVH
+static constexpr uint32_t BvhCacheVersion = 1;
+
+static Util::Hash hash_collision_mesh(const PhysicsSystem::CollisionMesh &mesh)
+{
+	Util::Hasher h;
+	h.u32(BT_BULLET_VERSION);
+	h.u32(uint32_t(sizeof(btScalar)));
+	h.u32(mesh.num_triangles);
+	h.u32(mesh.num_vertices);
+
+	auto *indices = reinterpret_cast<const uint8_t *>(mesh.indices);
+	for (unsigned i = 0; i < mesh.num_triangles; i++)
+		h.data(reinterpret_cast<const uint32_t *>(indices + i * mesh.index_stride_triangle), 3 * sizeof(uint32_t));
+
+	auto *positions = reinterpret_cast<const uint8_t *>(mesh.positions);
+	for (unsigned i = 0; i < mesh.num_vertices; i++)
+		h.data(reinterpret_cast<const float *>(positions + i * mesh.position_stride), 3 * sizeof(float));
+
+	// Quantization is relative to the AABB.
+	const vec3 &lo = mesh.aabb.get_minimum();
+	const vec3 &hi = mesh.aabb.get_maximum();
+	for (unsigned i = 0; i < 3; i++)
+	{
+		h.f32(lo[i]);
+		h.f32(hi[i]);
+	}
+
+	return h.get();
+}
+
+static std::string get_bvh_cache_path(Util::Hash hash)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "cache://physics_bvh_%016llx.bin", static_cast<unsigned long long>(hash));
+	return path;
+}
+
+static btOptimizedBvh *load_cached_bvh(const std::string &path, Util::Hash hash)
+{
+	auto file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
+	if (!file)
+		return nullptr;
+
+	size_t size = file->get_size();
+	if (size < sizeof(BvhCacheHeader))
+		return nullptr;
+
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		return nullptr;
+
+	BvhCacheHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	if (header.magic != BvhCacheMagic || header.version != BvhCacheVersion || header.hash != hash ||
+	    header.size != size - sizeof(header))
+	{
+		LOGW("Stale BVH cache in %s, rebuilding.\n", path.c_str());
+		return nullptr;
+	}
+
+	// The BVH is patched in place, so it needs its own aligned copy which outlives the shape.
+	void *buffer = btAlignedAlloc(header.size, 16);
+	memcpy(buffer, mapped + sizeof(header), header.size);
+	auto *bvh = btOptimizedBvh::deSerializeInPlace(buffer, unsigned(header.size), false);
+	if (!bvh)
+	{
+		LOGW("Failed to deserialize BVH from %s.\n", path.c_str());
+		btAlignedFree(buffer);
+	}
+	return bvh;
+}
+
+static void save_cached_bvh(const std::string &path, Util::Hash hash, const btOptimizedBvh &bvh)
+{
+	unsigned size = bvh.calculateSerializeBufferSize();
+	void *buffer = btAlignedAlloc(size, 16);
+	if (!bvh.serializeInPlace(buffer, size, false))
+	{
+		LOGE("Failed to serialize BVH.\n");
+		btAlignedFree(buffer);
+		return;
+	}
+
+	auto file = GRANITE_FILESYSTEM()->open(path, FileMode::WriteOnlyTransactional);
+	auto *mapped = file ? static_cast<uint8_t *>(file->map_write(sizeof(BvhCacheHeader) + size)) : nullptr;
+	if (mapped)
+	{
+		const BvhCacheHeader header = { BvhCacheMagic, BvhCacheVersion, hash, size };
+		memcpy(mapped, &header, sizeof(header));
+		memcpy(mapped + sizeof(header), buffer, size);
+	}
+	else
+		LOGE("Failed to write BVH cache to %s.\n", path.c_str());
+
+	btAlignedFree(buffer);
+}
+
+void PhysicsSystem::SerializedBvhDeleter::operator()(btOptimizedBvh *bvh)
+{
+	// deSerializeInPlace constructs the BVH at the start of the buffer.
+	bvh->~btOptimizedBvh();
+	btAlignedFree(bvh);
+}
+
 unsigned PhysicsSystem::register_collision_mesh(const CollisionMesh &mesh)
 {
+	wait_for_step();
 	static_assert(sizeof(int) == sizeof(uint32_t), "You're on a really weird platform.");
 	auto *index_vertex_array = new btTriangleIndexVertexArray(mesh.num_triangles,
 	                                                          const_cast<int *>(reinterpret_cast<const int *>(mesh.indices)),
@@ -447,8 +956,31 @@ unsigned PhysicsSystem::register_collision_mesh(const CollisionMesh &mesh)
 	const vec3 &lo = mesh.aabb.get_minimum();
 	const vec3 &hi = mesh.aabb.get_maximum();
 	index_vertex_array->setPremadeAabb(convert(lo), convert(hi));
-	const bool quantized_aabb_compression = false;
-	auto *shape = new btBvhTriangleMeshShape(index_vertex_array, quantized_aabb_compression);
+	const bool quantized_aabb_compression = true;
+
+	btBvhTriangleMeshShape *shape = nullptr;
+	std::string cache_path;
+	Util::Hash hash = 0;
+
+	if (mesh.cache_bvh && GRANITE_FILESYSTEM())
+	{
+		hash = hash_collision_mesh(mesh);
+		cache_path = get_bvh_cache_path(hash);
+		if (auto *bvh = load_cached_bvh(cache_path, hash))
+		{
+			shape = new btBvhTriangleMeshShape(index_vertex_array, quantized_aabb_compression, false);
+			shape->setOptimizedBvh(bvh);
+			serialized_bvhs.emplace_back(bvh);
+		}
+	}
+
+	if (!shape)
+	{
+		shape = new btBvhTriangleMeshShape(index_vertex_array, quantized_aabb_compression);
+		if (!cache_path.empty())
+			save_cached_bvh(cache_path, hash, *shape->getOptimizedBvh());
+	}
+
 	shape->setMargin(mesh.margin);
 
 	auto index = unsigned(mesh_collision_shapes.size());
@@ -459,6 +991,8 @@ unsigned PhysicsSystem::register_collision_mesh(const CollisionMesh &mesh)
 
 PhysicsHandle *PhysicsSystem::add_shape(Scene::Node *node, const MaterialInfo &info, btCollisionShape *shape)
 {
+	wait_for_idle();
+
 	btTransform t;
 	t.setIdentity();
 
@@ -547,9 +1081,16 @@ PhysicsHandle *PhysicsSystem::add_shape(Scene::Node *node, const MaterialInfo &i
 		handle->node = node;
 		handle->bt_object = body;
 		handle->bt_shape = shape;
+		handle->copy_transform_to_node = node != nullptr && info.type == InteractionType::Dynamic;
 		handles.push_back(handle);
 	}
 
+	if (node)
+	{
+		handle->prev_translation = handle->translation = node->transform.translation;
+		handle->prev_rotation = handle->rotation = node->transform.rotation;
+	}
+
 	handle->type = info.type;
 	return handle;
 }
@@ -733,6 +1274,7 @@ PhysicsHandle *PhysicsSystem::add_capsule(Scene::Node *node, float height, float
 
 void PhysicsSystem::set_linear_velocity(PhysicsHandle *handle, const vec3 &v)
 {
+	wait_for_step();
 	auto *body = btRigidBody::upcast(handle->bt_object);
 	if (body)
 		body->setLinearVelocity(convert(v));
@@ -740,6 +1282,7 @@ void PhysicsSystem::set_linear_velocity(PhysicsHandle *handle, const vec3 &v)
 
 void PhysicsSystem::set_angular_velocity(PhysicsHandle *handle, const vec3 &v)
 {
+	wait_for_step();
 	auto *body = btRigidBody::upcast(handle->bt_object);
 	if (body)
 		body->setAngularVelocity(convert(v));
@@ -747,6 +1290,7 @@ void PhysicsSystem::set_angular_velocity(PhysicsHandle *handle, const vec3 &v)
 
 void PhysicsSystem::apply_force(PhysicsHandle *handle, const vec3 &v)
 {
+	wait_for_step();
 	auto *body = btRigidBody::upcast(handle->bt_object);
 	if (body)
 	{
@@ -757,6 +1301,7 @@ void PhysicsSystem::apply_force(PhysicsHandle *handle, const vec3 &v)
 
 void PhysicsSystem::apply_force(PhysicsHandle *handle, const vec3 &v, const vec3 &world_pos)
 {
+	wait_for_step();
 	auto *body = btRigidBody::upcast(handle->bt_object);
 	if (body)
 	{
@@ -787,6 +1332,7 @@ PhysicsHandle *PhysicsSystem::add_infinite_plane(const vec4 &plane, const Materi
 
 void PhysicsSystem::apply_impulse(PhysicsHandle *handle, const vec3 &impulse, const vec3 &world_position)
 {
+	wait_for_step();
 	auto *body = btRigidBody::upcast(handle->bt_object);
 	if (body)
 	{
@@ -797,6 +1343,7 @@ void PhysicsSystem::apply_impulse(PhysicsHandle *handle, const vec3 &impulse, co
 
 void PhysicsSystem::add_point_constraint(PhysicsHandle *handle, const vec3 &local_pivot)
 {
+	wait_for_step();
 	auto *body = btRigidBody::upcast(handle->bt_object);
 	if (!body)
 		return;
@@ -810,6 +1357,7 @@ void PhysicsSystem::add_point_constraint(PhysicsHandle *handle0, PhysicsHandle *
                                          const vec3 &local_pivot0, const vec3 &local_pivot1,
                                          bool skip_collision)
 {
+	wait_for_step();
 	auto *body0 = btRigidBody::upcast(handle0->bt_object);
 	auto *body1 = btRigidBody::upcast(handle1->bt_object);
 	if (!body0 || !body1)
@@ -847,6 +1395,7 @@ struct TriggerContactResultCallback : btCollisionWorld::ContactResultCallback
 bool PhysicsSystem::get_overlapping_objects(PhysicsHandle *handle, vector<PhysicsHandle *> &other,
                                             OverlapMethod method)
 {
+	wait_for_step();
 	other.clear();
 	auto *ghost = btPairCachingGhostObject::upcast(handle->bt_object);
 	if (!ghost)
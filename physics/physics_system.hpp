@@ -27,15 +27,17 @@
 #include "math.hpp"
 #include "ecs.hpp"
 #include "global_managers_interface.hpp"
+#include "thread_group.hpp"
 #include <memory>
 
 class btDefaultCollisionConfiguration;
 class btCollisionDispatcher;
 struct btDbvtBroadphase;
-class btSequentialImpulseConstraintSolver;
+class btConstraintSolver;
 class btDiscreteDynamicsWorld;
 class btCollisionShape;
 class btBvhTriangleMeshShape;
+class btOptimizedBvh;
 class btTriangleIndexVertexArray;
 class btGhostPairCallback;
 class btDynamicsWorld;
@@ -43,6 +45,8 @@ class btDynamicsWorld;
 namespace Granite
 {
 struct PhysicsHandle;
+class PhysicsSystem;
+class TaskComposer;
 
 struct PhysicsComponent : ComponentBase
 {
@@ -79,6 +83,7 @@ public:
 	void jump(const vec3 &v);
 
 private:
+	friend class PhysicsSystem;
 	struct Impl;
 	std::unique_ptr<Impl> impl;
 };
@@ -183,6 +188,10 @@ public:
 		AABB aabb = {};
 
 		float margin = 0.1f;
+
+		// The quantized BVH is stored in cache:// keyed by a hash of the mesh data,
+		// so later loads deserialize it in place rather than rebuilding it.
+		bool cache_bvh = true;
 	};
 
 	unsigned register_collision_mesh(const CollisionMesh &mesh);
@@ -240,6 +249,14 @@ public:
 
 	void apply_impulse(PhysicsHandle *handle, const vec3 &impulse, const vec3 &world_position);
 	void iterate(double frame_time);
+
+	// iterate() split in two so the step can run on the physics thread in parallel with rendering.
+	// begin_iterate() consumes forces and node transforms, then kicks the fixed ticks.
+	// end_iterate() waits for them, dispatches CollisionEvents and writes node transforms
+	// interpolated between the last two ticks. Other calls in between wait for the step.
+	void begin_iterate(double frame_time);
+	void end_iterate();
+
 	void tick_callback(float tick_time);
 
 	enum InteractionTypeFlagBits
@@ -255,6 +272,25 @@ public:
 	RaycastResult query_closest_hit_ray(const vec3 &from, const vec3 &dir, float length,
 	                                    InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS);
 
+	struct RaycastQuery
+	{
+		vec3 from;
+		vec3 dir;
+		float length;
+		InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS;
+	};
+
+	// results[i] receives the closest hit of queries[i]. The batch is split across the thread group.
+	void query_closest_hit_rays(const RaycastQuery *queries, RaycastResult *results, size_t count);
+
+	// Same, but enqueued as a new pipeline stage of composer. queries and results must remain valid
+	// until the stage completes, and signal, if not null, is incremented when it does.
+	// Calls which modify the world, including begin_iterate(), wait for outstanding batches,
+	// so the composer must be flushed before then.
+	void query_closest_hit_rays_async(TaskComposer &composer,
+	                                  const RaycastQuery *queries, RaycastResult *results, size_t count,
+	                                  TaskSignal *signal = nullptr);
+
 	void add_point_constraint(PhysicsHandle *handle, const vec3 &local_pivot);
 	void add_point_constraint(PhysicsHandle *handle0, PhysicsHandle *handle1,
 	                          const vec3 &local_pivot0, const vec3 &local_pivot1,
@@ -270,17 +306,38 @@ public:
 	                             OverlapMethod method = OverlapMethod::Nearphase);
 
 private:
+	friend class KinematicCharacter;
 	std::unique_ptr<btDefaultCollisionConfiguration> collision_config;
 	std::unique_ptr<btCollisionDispatcher> dispatcher;
 	std::unique_ptr<btDbvtBroadphase> broadphase;
-	std::unique_ptr<btSequentialImpulseConstraintSolver> solver;
+	std::unique_ptr<btConstraintSolver> solver;
+	std::unique_ptr<btConstraintSolver> solver_pool;
 	std::unique_ptr<btDiscreteDynamicsWorld> world;
 
+	uint64_t step_ticket = 0;
+	float local_time = 0.0f;
+	void step(float frame_time);
+	void wait_for_step();
+
+	// Ray batches only read the world, so they run as long as nothing modifies it.
+	TaskSignal ray_task_signal;
+	uint64_t ray_tasks_submitted = 0;
+	void trace_rays(const RaycastQuery *queries, RaycastResult *results, size_t begin, size_t end) const;
+	void wait_for_idle();
+	std::vector<KinematicCharacter::Impl *> characters;
+
 	Util::ObjectPool<PhysicsHandle> handle_pool;
 	std::vector<PhysicsHandle *> handles;
 
 	PhysicsHandle *add_shape(Scene::Node *node, const MaterialInfo &info, btCollisionShape *shape);
 	std::vector<CollisionEvent> new_collision_buffer;
+
+	// Deserialized BVHs live in their cache blob and are not owned by the shape.
+	struct SerializedBvhDeleter
+	{
+		void operator()(btOptimizedBvh *bvh);
+	};
+	std::vector<std::unique_ptr<btOptimizedBvh, SerializedBvhDeleter>> serialized_bvhs;
 	std::vector<std::unique_ptr<btBvhTriangleMeshShape>> mesh_collision_shapes;
 	std::vector<std::unique_ptr<btTriangleIndexVertexArray>> index_vertex_arrays;
 	std::unique_ptr<btGhostPairCallback> ghost_callback;
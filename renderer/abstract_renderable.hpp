@@ -32,6 +32,13 @@ class RenderContext;
 class ShaderSuite;
 struct RenderInfoComponent;
 struct SpriteTransformInfo;
+struct StaticMesh;
+struct SkinnedMesh;
+
+namespace SceneFormats
+{
+struct CollisionMesh;
+}
 
 enum class DrawPipeline : unsigned
 {
@@ -49,7 +56,11 @@ enum class DrawPipelineCoverage : unsigned
 enum RenderableFlagBits
 {
 	RENDERABLE_FORCE_VISIBLE_BIT = 1 << 0,
-	RENDERABLE_IMPLICIT_MOTION_BIT = 1 << 1
+	RENDERABLE_IMPLICIT_MOTION_BIT = 1 << 1,
+	// Instances are culled and drawn indirectly by GPUScene.
+	RENDERABLE_GPU_DRIVEN_BIT = 1 << 2,
+	// Always rasterized into the OcclusionBuffer if visible, regardless of screen size.
+	RENDERABLE_OCCLUDER_BIT = 1 << 3
 };
 using RenderableFlags = uint32_t;
 
@@ -89,6 +100,32 @@ public:
 		return DrawPipeline::Opaque;
 	}
 
+	// Non-null if instances can be drawn from indirect commands with a per-instance transform buffer.
+	virtual const StaticMesh *get_indirect_mesh() const
+	{
+		return nullptr;
+	}
+
+	// Non-null if instances can be skinned ahead of time, see ComputeSkinning.
+	virtual const SkinnedMesh *get_skinned_mesh() const
+	{
+		return nullptr;
+	}
+
+	// Non-null if instances can be rasterized into an OcclusionBuffer.
+	// A triangle list in object space, with counter-clockwise front faces.
+	virtual const SceneFormats::CollisionMesh *get_occluder_mesh() const
+	{
+		return nullptr;
+	}
+
+	// True if static instances can be merged into shared shadow geometry, see bake_static_shadow_geometry().
+	// Fills in a triangle list in object space, with two-sided triangles duplicated in reverse.
+	virtual bool get_shadow_caster_mesh(SceneFormats::CollisionMesh &) const
+	{
+		return false;
+	}
+
 	RenderableFlags flags = 0;
 };
 using AbstractRenderableHandle = Util::IntrusivePtr<AbstractRenderable>;
@@ -22,11 +22,100 @@
 
 #include "animation_system.hpp"
 #include "task_composer.hpp"
+#include "simd_headers.hpp"
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 namespace Granite
 {
+// Four tracks at a time, the sampler is written once against these.
+#if defined(__SSE2__) || defined(_M_X64)
+using Lanes = __m128;
+
+static inline Lanes lanes_load_snorm16(const int16_t *v)
+{
+	__m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v));
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+}
+
+static inline Lanes lanes_load_unorm16(const uint16_t *v)
+{
+	__m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v));
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+}
+
+static inline Lanes lanes_load(const float *v) { return _mm_loadu_ps(v); }
+static inline void lanes_store(float *v, Lanes a) { _mm_storeu_ps(v, a); }
+static inline Lanes lanes_splat(float v) { return _mm_set1_ps(v); }
+static inline Lanes lanes_add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanes_inv_sqrt(Lanes v) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(v)); }
+#elif defined(__ARM_NEON)
+using Lanes = float32x4_t;
+
+static inline Lanes lanes_load_snorm16(const int16_t *v) { return vcvtq_f32_s32(vmovl_s16(vld1_s16(v))); }
+static inline Lanes lanes_load_unorm16(const uint16_t *v) { return vcvtq_f32_u32(vmovl_u16(vld1_u16(v))); }
+static inline Lanes lanes_load(const float *v) { return vld1q_f32(v); }
+static inline void lanes_store(float *v, Lanes a) { vst1q_f32(v, a); }
+static inline Lanes lanes_splat(float v) { return vdupq_n_f32(v); }
+static inline Lanes lanes_add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+static inline Lanes lanes_sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+static inline Lanes lanes_mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+
+static inline Lanes lanes_inv_sqrt(Lanes v)
+{
+	// Two Newton-Raphson iterations are plenty for 16-bit input.
+	Lanes e = vrsqrteq_f32(v);
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+	return e;
+}
+#else
+struct Lanes
+{
+	float v[4];
+};
+
+template <typename T>
+static inline Lanes lanes_load_int(const T *v)
+{
+	return {{ float(v[0]), float(v[1]), float(v[2]), float(v[3]) }};
+}
+
+static inline Lanes lanes_load_snorm16(const int16_t *v) { return lanes_load_int(v); }
+static inline Lanes lanes_load_unorm16(const uint16_t *v) { return lanes_load_int(v); }
+static inline Lanes lanes_load(const float *v) { return lanes_load_int(v); }
+static inline Lanes lanes_splat(float v) { return {{ v, v, v, v }}; }
+
+static inline void lanes_store(float *v, const Lanes &a)
+{
+	for (unsigned i = 0; i < 4; i++)
+		v[i] = a.v[i];
+}
+
+#define LANES_OP(name, op) \
+static inline Lanes name(const Lanes &a, const Lanes &b) \
+{ \
+	return {{ a.v[0] op b.v[0], a.v[1] op b.v[1], a.v[2] op b.v[2], a.v[3] op b.v[3] }}; \
+}
+LANES_OP(lanes_add, +)
+LANES_OP(lanes_sub, -)
+LANES_OP(lanes_mul, *)
+#undef LANES_OP
+
+static inline Lanes lanes_inv_sqrt(const Lanes &a)
+{
+	return {{ 1.0f / muglm::sqrt(a.v[0]), 1.0f / muglm::sqrt(a.v[1]),
+	          1.0f / muglm::sqrt(a.v[2]), 1.0f / muglm::sqrt(a.v[3]) }};
+}
+#endif
+
 template <typename T, typename Op>
 static void resample_channel(T *resampled, size_t count, const SceneFormats::AnimationChannel &channel, const Op &op, float inv_frame_rate)
 {
@@ -54,18 +143,6 @@ unsigned AnimationUnrolled::find_or_allocate_index(uint32_t node_index)
 	}
 }
 
-void AnimationUnrolled::reserve_num_clips(unsigned count)
-{
-	if (count > key_frames_rotation.size())
-	{
-		key_frames_rotation.resize(count);
-		key_frames_translation.resize(count);
-		key_frames_scale.resize(count);
-		multi_node_indices.resize(count);
-		channel_mask.resize(count);
-	}
-}
-
 unsigned AnimationUnrolled::get_num_channels() const
 {
 	return channel_mask.size();
@@ -102,24 +179,244 @@ void AnimationUnrolled::animate(Transform *const *transforms, unsigned num_trans
 	int hi = muglm::min(lo + 1, int(num_samples) - 1);
 	float l = sample - low_sample;
 
-	for (unsigned i = 0; i < num_transforms; i++)
+	for (auto &c : constant_rotations)
+		transforms[c.channel]->rotation = c.value;
+	for (auto &c : constant_translations)
+		transforms[c.channel]->translation = c.value;
+	for (auto &c : constant_scales)
+		transforms[c.channel]->scale = c.value;
+
+	sample_rotations(transforms, unsigned(lo), unsigned(hi), l);
+	sample_vectors(transforms, unsigned(lo), unsigned(hi), l);
+}
+
+void AnimationUnrolled::copy_animated_channels(Transform *const *transforms, const Transform *values,
+                                               unsigned num_transforms) const
+{
+	if (num_transforms != get_num_channels())
+		throw std::logic_error("Incorrect number of transforms.");
+
+	for (unsigned channel = 0; channel < num_transforms; channel++)
 	{
-		auto *t = transforms[i];
-		animate_single(*t, i, lo, hi, l);
+		auto mask = channel_mask[channel];
+		if (mask & ROTATION_BIT)
+			transforms[channel]->rotation = values[channel].rotation;
+		if (mask & TRANSLATION_BIT)
+			transforms[channel]->translation = values[channel].translation;
+		if (mask & SCALE_BIT)
+			transforms[channel]->scale = values[channel].scale;
 	}
 }
 
-void AnimationUnrolled::animate_single(Transform &t, unsigned channel, int lo, int hi, float l) const
+void AnimationUnrolled::sample_rotations(Transform *const *transforms, unsigned lo, unsigned hi, float l) const
 {
 	// The animations should be resampled at such a high rate in runtime (e.g. 60 fps)
 	// that doing slerp for rotation is irrelevant.
-	auto mask = channel_mask[channel];
-	if (mask & ROTATION_BIT)
-		t.rotation = normalize(quat(mix(key_frames_rotation[channel][lo].as_vec4(), key_frames_rotation[channel][hi].as_vec4(), l)));
-	if (mask & TRANSLATION_BIT)
-		t.translation = mix(key_frames_translation[channel][lo], key_frames_translation[channel][hi], l);
-	if (mask & SCALE_BIT)
-		t.scale = mix(key_frames_scale[channel][lo], key_frames_scale[channel][hi], l);
+	auto num_tracks = unsigned(rotation_track_channels.size());
+	unsigned num_groups = (num_tracks + TrackGroupSize - 1) / TrackGroupSize;
+	constexpr unsigned group_stride = 4 * TrackGroupSize;
+	const int16_t *lo_samples = rotation_samples.data() + size_t(lo) * num_groups * group_stride;
+	const int16_t *hi_samples = rotation_samples.data() + size_t(hi) * num_groups * group_stride;
+	Lanes phase = lanes_splat(l);
+
+	for (unsigned group = 0; group < num_groups; group++)
+	{
+		Lanes q[4];
+		Lanes dot = lanes_splat(0.0f);
+		for (unsigned c = 0; c < 4; c++)
+		{
+			Lanes a = lanes_load_snorm16(lo_samples + c * TrackGroupSize);
+			Lanes b = lanes_load_snorm16(hi_samples + c * TrackGroupSize);
+			q[c] = lanes_add(a, lanes_mul(lanes_sub(b, a), phase));
+			dot = lanes_add(dot, lanes_mul(q[c], q[c]));
+		}
+
+		Lanes inv_length = lanes_inv_sqrt(dot);
+		float result[4][TrackGroupSize];
+		for (unsigned c = 0; c < 4; c++)
+			lanes_store(result[c], lanes_mul(q[c], inv_length));
+
+		unsigned base_track = group * TrackGroupSize;
+		unsigned count = muglm::min(unsigned(TrackGroupSize), num_tracks - base_track);
+		for (unsigned i = 0; i < count; i++)
+		{
+			transforms[rotation_track_channels[base_track + i]]->rotation =
+					quat(vec4(result[0][i], result[1][i], result[2][i], result[3][i]));
+		}
+
+		lo_samples += group_stride;
+		hi_samples += group_stride;
+	}
+}
+
+void AnimationUnrolled::sample_vectors(Transform *const *transforms, unsigned lo, unsigned hi, float l) const
+{
+	auto num_tracks = unsigned(vector_track_channels.size());
+	unsigned num_groups = (num_tracks + TrackGroupSize - 1) / TrackGroupSize;
+	constexpr unsigned group_stride = 3 * TrackGroupSize;
+	const uint16_t *lo_samples = vector_samples.data() + size_t(lo) * num_groups * group_stride;
+	const uint16_t *hi_samples = vector_samples.data() + size_t(hi) * num_groups * group_stride;
+	const float *base = vector_base.data();
+	const float *range = vector_range.data();
+	Lanes phase = lanes_splat(l);
+
+	for (unsigned group = 0; group < num_groups; group++)
+	{
+		float result[3][TrackGroupSize];
+		for (unsigned c = 0; c < 3; c++)
+		{
+			Lanes a = lanes_load_unorm16(lo_samples + c * TrackGroupSize);
+			Lanes b = lanes_load_unorm16(hi_samples + c * TrackGroupSize);
+			Lanes v = lanes_add(a, lanes_mul(lanes_sub(b, a), phase));
+			v = lanes_add(lanes_load(base + c * TrackGroupSize), lanes_mul(v, lanes_load(range + c * TrackGroupSize)));
+			lanes_store(result[c], v);
+		}
+
+		unsigned base_track = group * TrackGroupSize;
+		unsigned count = muglm::min(unsigned(TrackGroupSize), num_tracks - base_track);
+		for (unsigned i = 0; i < count; i++)
+		{
+			unsigned track = base_track + i;
+			auto &t = *transforms[vector_track_channels[track]];
+			vec3 value(result[0][i], result[1][i], result[2][i]);
+			if (track < num_translation_tracks)
+				t.translation = value;
+			else
+				t.scale = value;
+		}
+
+		lo_samples += group_stride;
+		hi_samples += group_stride;
+		base += group_stride;
+		range += group_stride;
+	}
+}
+
+static bool rotation_track_is_constant(const vector<quat> &track)
+{
+	// Anything closer than half a quantization step would decode to the same value anyway.
+	constexpr float epsilon = 0.5f / 32767.0f;
+	for (auto &q : track)
+		if (any(greaterThan(abs(q.as_vec4() - track.front().as_vec4()), vec4(epsilon))))
+			return false;
+	return true;
+}
+
+static bool vector_track_is_constant(const vector<vec3> &track)
+{
+	vec3 lo = track.front();
+	vec3 hi = track.front();
+	for (auto &v : track)
+	{
+		lo = min(lo, v);
+		hi = max(hi, v);
+	}
+
+	vec3 magnitude = max(abs(lo), abs(hi));
+	float epsilon = 1e-6f * muglm::max(1.0f, muglm::max(magnitude.x, muglm::max(magnitude.y, magnitude.z)));
+	return all(lessThanEqual(hi - lo, vec3(epsilon)));
+}
+
+void AnimationUnrolled::compress(const vector<vector<quat>> &rotations,
+                                 const vector<vector<vec3>> &translations,
+                                 const vector<vector<vec3>> &scales)
+{
+	vector<uint32_t> scale_track_channels;
+
+	for (unsigned channel = 0; channel < get_num_channels(); channel++)
+	{
+		auto mask = channel_mask[channel];
+
+		if (mask & ROTATION_BIT)
+		{
+			if (rotation_track_is_constant(rotations[channel]))
+				constant_rotations.push_back({ channel, rotations[channel].front() });
+			else
+				rotation_track_channels.push_back(channel);
+		}
+
+		if (mask & TRANSLATION_BIT)
+		{
+			if (vector_track_is_constant(translations[channel]))
+				constant_translations.push_back({ channel, translations[channel].front() });
+			else
+				vector_track_channels.push_back(channel);
+		}
+
+		if (mask & SCALE_BIT)
+		{
+			if (vector_track_is_constant(scales[channel]))
+				constant_scales.push_back({ channel, scales[channel].front() });
+			else
+				scale_track_channels.push_back(channel);
+		}
+	}
+
+	num_translation_tracks = unsigned(vector_track_channels.size());
+	vector_track_channels.insert(end(vector_track_channels), begin(scale_track_channels), end(scale_track_channels));
+
+	auto num_rotation_tracks = unsigned(rotation_track_channels.size());
+	unsigned num_rotation_groups = (num_rotation_tracks + TrackGroupSize - 1) / TrackGroupSize;
+	unsigned num_rotation_lanes = num_rotation_groups * TrackGroupSize;
+	rotation_samples.resize(size_t(num_samples) * num_rotation_lanes * 4);
+
+	for (unsigned s = 0; s < num_samples; s++)
+	{
+		for (unsigned lane = 0; lane < num_rotation_lanes; lane++)
+		{
+			unsigned group = lane / TrackGroupSize;
+			int16_t *samples = rotation_samples.data() +
+			                   (size_t(s) * num_rotation_groups + group) * 4 * TrackGroupSize +
+			                   lane % TrackGroupSize;
+
+			// Padding lanes decode as identity.
+			vec4 q = lane < num_rotation_tracks ?
+			         rotations[rotation_track_channels[lane]][s].as_vec4() : vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+			for (unsigned c = 0; c < 4; c++)
+				samples[c * TrackGroupSize] = int16_t(muglm::round(clamp(q[c], -1.0f, 1.0f) * 32767.0f));
+		}
+	}
+
+	auto num_vector_tracks = unsigned(vector_track_channels.size());
+	unsigned num_vector_groups = (num_vector_tracks + TrackGroupSize - 1) / TrackGroupSize;
+	unsigned num_vector_lanes = num_vector_groups * TrackGroupSize;
+	vector_samples.resize(size_t(num_samples) * num_vector_lanes * 3);
+	vector_base.resize(num_vector_lanes * 3);
+	vector_range.resize(num_vector_lanes * 3);
+
+	for (unsigned lane = 0; lane < num_vector_tracks; lane++)
+	{
+		unsigned channel = vector_track_channels[lane];
+		auto &track = lane < num_translation_tracks ? translations[channel] : scales[channel];
+
+		vec3 lo = track.front();
+		vec3 hi = track.front();
+		for (auto &v : track)
+		{
+			lo = min(lo, v);
+			hi = max(hi, v);
+		}
+
+		vec3 range = hi - lo;
+		vec3 inv_range = vec3(65535.0f) / max(range, vec3(std::numeric_limits<float>::min()));
+
+		unsigned group = lane / TrackGroupSize;
+		unsigned offset = group * 3 * TrackGroupSize + lane % TrackGroupSize;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			vector_base[offset + c * TrackGroupSize] = lo[c];
+			vector_range[offset + c * TrackGroupSize] = range[c] / 65535.0f;
+		}
+
+		for (unsigned s = 0; s < num_samples; s++)
+		{
+			uint16_t *samples = vector_samples.data() + size_t(s) * num_vector_lanes * 3 + offset;
+			vec3 normalized = clamp((track[s] - lo) * inv_range, vec3(0.0f), vec3(65535.0f));
+			for (unsigned c = 0; c < 3; c++)
+				samples[c * TrackGroupSize] = uint16_t(muglm::round(normalized[c]));
+		}
+	}
 }
 
 AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate)
@@ -127,11 +424,12 @@ AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, f
 	frame_rate = key_frame_rate;
 	inv_frame_rate = 1.0f / key_frame_rate;
 	size_t size = animation.channels.size();
-	key_frames_rotation.reserve(size);
-	key_frames_translation.reserve(size);
-	key_frames_translation.reserve(size);
 	multi_node_indices.reserve(size);
-	channel_mask.resize(size);
+
+	// Resampled tracks are only kept around until they are compressed.
+	vector<vector<quat>> key_frames_rotation;
+	vector<vector<vec3>> key_frames_translation;
+	vector<vector<vec3>> key_frames_scale;
 
 	float total_length = 0.0f;
 	for (auto &c : animation.channels)
@@ -159,7 +457,14 @@ AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, f
 			index = find_or_allocate_index(c.node_index);
 		}
 
-		reserve_num_clips(index + 1);
+		if (index >= key_frames_rotation.size())
+		{
+			key_frames_rotation.resize(index + 1);
+			key_frames_translation.resize(index + 1);
+			key_frames_scale.resize(index + 1);
+			multi_node_indices.resize(index + 1);
+			channel_mask.resize(index + 1);
+		}
 
 		switch (c.type)
 		{
@@ -227,6 +532,8 @@ AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, f
 			break;
 		}
 	}
+
+	compress(key_frames_rotation, key_frames_translation, key_frames_scale);
 }
 
 AnimationID AnimationSystem::get_animation_id_from_name(const string &name) const
@@ -258,6 +565,7 @@ bool AnimationSystem::animation_is_running(AnimationStateID id) const
 
 void AnimationSystem::stop_animation(AnimationStateID id)
 {
+	auto holder = lock_states();
 	auto *state = animation_state_pool.maybe_get(id);
 	if (!state)
 		return;
@@ -277,6 +585,7 @@ AnimationID AnimationSystem::register_animation(const std::string &name,
 AnimationStateID AnimationSystem::start_animation(Scene::Node &node, Granite::AnimationID animation_id,
                                                   double start_time)
 {
+	auto holder = lock_states();
 	auto *animation = animation_pool.maybe_get(animation_id);
 	if (!animation)
 	{
@@ -391,6 +700,7 @@ void AnimationSystem::set_fixed_pose_multi(Scene::NodeHandle *nodes, unsigned nu
 AnimationStateID AnimationSystem::start_animation_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
                                                         AnimationID animation_id, double start_time)
 {
+	auto holder = lock_states();
 	auto *animation = animation_pool.maybe_get(animation_id);
 	if (!animation)
 	{
@@ -431,6 +741,7 @@ AnimationStateID AnimationSystem::start_animation_multi(Scene::NodeHandle *nodes
 
 void AnimationSystem::set_completion_callback(AnimationStateID id, function<void()> cb)
 {
+	auto holder = lock_states();
 	auto *state = animation_state_pool.maybe_get(id);
 	if (state)
 		state->cb = move(cb);
@@ -438,6 +749,7 @@ void AnimationSystem::set_completion_callback(AnimationStateID id, function<void
 
 void AnimationSystem::set_repeating(Granite::AnimationStateID id, bool repeat)
 {
+	auto holder = lock_states();
 	auto *state = animation_state_pool.maybe_get(id);
 	if (state)
 		state->repeating = repeat;
@@ -445,16 +757,17 @@ void AnimationSystem::set_repeating(Granite::AnimationStateID id, bool repeat)
 
 void AnimationSystem::set_relative_timing(Granite::AnimationStateID id, bool enable)
 {
+	auto holder = lock_states();
 	auto *state = animation_state_pool.maybe_get(id);
 	if (state)
 		state->relative_timing = enable;
 }
 
-void AnimationSystem::update(AnimationState *anim, double frame_time, double elapsed_time)
+bool AnimationSystem::advance(AnimationState *anim, double frame_time, double elapsed_time,
+                              double &offset, bool &complete, bool cached_bounds)
 {
-	bool complete = false;
+	complete = false;
 
-	double offset;
 	if (anim->relative_timing)
 	{
 		anim->start_time += frame_time;
@@ -471,6 +784,20 @@ void AnimationSystem::update(AnimationState *anim, double frame_time, double ela
 	if (anim->repeating)
 		offset = mod(offset, double(anim->animation.get_length()));
 
+	// The final pose is always evaluated, so completion is not affected by LOD.
+	if (!complete && !should_update(*anim, cached_bounds))
+		return false;
+	anim->posed = true;
+	return true;
+}
+
+void AnimationSystem::update(AnimationState *anim, double frame_time, double elapsed_time)
+{
+	double offset;
+	bool complete;
+	if (!advance(anim, frame_time, elapsed_time, offset, complete, false))
+		return;
+
 	if (anim->animation.is_skinned())
 	{
 		auto *node = anim->skinned_node;
@@ -488,6 +815,111 @@ void AnimationSystem::update(AnimationState *anim, double frame_time, double ela
 		garbage_collect_animations.push(anim);
 }
 
+void AnimationSystem::simulate_pose(AnimationState *anim, double frame_time, double elapsed_time)
+{
+	double offset;
+	bool complete;
+	if (!advance(anim, frame_time, elapsed_time, offset, complete, true))
+		return;
+
+	// Only animated components are committed, so the pose never needs to read the nodes.
+	if (anim->pose.empty())
+	{
+		anim->pose.resize(anim->animation.get_num_channels());
+		anim->pose_transforms.reserve(anim->pose.size());
+		for (auto &transform : anim->pose)
+			anim->pose_transforms.push_back(&transform);
+	}
+
+	anim->animation.animate(anim->pose_transforms.data(), anim->pose_transforms.size(), float(offset));
+	anim->pose_pending = true;
+	anim->complete_pending = complete;
+}
+
+void AnimationSystem::set_lod_view(const vec3 &camera_position, const Frustum &frustum)
+{
+	auto holder = lock_states();
+	lod_camera_position = camera_position;
+	lod_frustum = frustum;
+	lod_enable = true;
+}
+
+void AnimationSystem::disable_lod()
+{
+	auto holder = lock_states();
+	lod_enable = false;
+}
+
+void AnimationSystem::set_lod_options(const AnimationLODOptions &options)
+{
+	auto holder = lock_states();
+	lod_options = options;
+}
+
+void AnimationSystem::compute_lod_bounds(const AnimationState &state, vec3 &lo, vec3 &hi) const
+{
+	lo = vec3(numeric_limits<float>::max());
+	hi = vec3(-numeric_limits<float>::max());
+
+	if (state.skinned_node)
+	{
+		for (auto &bone : state.skinned_node->get_skin()->cached_skin_transform.bone_world_transforms)
+		{
+			lo = min(lo, bone[3].xyz());
+			hi = max(hi, bone[3].xyz());
+		}
+	}
+	else
+	{
+		for (auto *node : state.channel_nodes)
+		{
+			lo = min(lo, node->cached_transform.world_transform[3].xyz());
+			hi = max(hi, node->cached_transform.world_transform[3].xyz());
+		}
+	}
+}
+
+bool AnimationSystem::should_update(const AnimationState &state, bool cached_bounds) const
+{
+	// Pose at least once, or throttled states would start out in bind pose.
+	if (!lod_enable || !state.posed)
+		return true;
+
+	// The scene may be updated concurrently with simulate_poses(), which uses bounds from commit_poses() instead.
+	vec3 lo, hi;
+	if (cached_bounds)
+	{
+		lo = state.lod_lo;
+		hi = state.lod_hi;
+	}
+	else
+		compute_lod_bounds(state, lo, hi);
+
+	// Transforms have not been computed yet.
+	if (any(greaterThan(lo, hi)))
+		return true;
+
+	AABB aabb(lo - vec3(lod_options.bounds_padding), hi + vec3(lod_options.bounds_padding));
+	if (lod_options.skip_invisible && !lod_frustum.intersects_sphere(aabb))
+		return false;
+
+	float distance = muglm::max(length(aabb.get_center() - lod_camera_position), 0.001f);
+	float screen_size = aabb.get_radius() / distance;
+
+	uint64_t rate;
+	if (screen_size >= lod_options.full_rate_screen_size)
+		return true;
+	else if (screen_size >= lod_options.half_rate_screen_size)
+		rate = 2;
+	else if (screen_size >= lod_options.quarter_rate_screen_size)
+		rate = 4;
+	else
+		rate = 8;
+
+	// Stagger the states so throttled updates are spread evenly over frames.
+	return ((frame_count + state.id) & (rate - 1)) == 0;
+}
+
 void AnimationSystem::garbage_collect()
 {
 	// Cleanup task.
@@ -506,6 +938,8 @@ void AnimationSystem::garbage_collect()
 
 void AnimationSystem::animate(double frame_time, double elapsed_time)
 {
+	frame_count++;
+
 	// TODO: Run multithreaded.
 	for (auto *anim : active_animation)
 		update(anim, frame_time, elapsed_time);
@@ -515,6 +949,8 @@ void AnimationSystem::animate(double frame_time, double elapsed_time)
 
 void AnimationSystem::animate(TaskComposer &composer, double frame_time, double elapsed_time)
 {
+	frame_count++;
+
 	auto &group = composer.begin_pipeline_stage();
 	group.set_desc("animation-update");
 	size_t count = active_animation.size();
@@ -539,6 +975,85 @@ void AnimationSystem::animate(TaskComposer &composer, double frame_time, double
 	});
 }
 
+std::unique_lock<std::mutex> AnimationSystem::lock_states()
+{
+	std::unique_lock<std::mutex> holder{simulate_lock};
+	simulate_cond.wait(holder, [this]() { return !simulating; });
+	return holder;
+}
+
+void AnimationSystem::simulate_poses(TaskComposer &composer, double frame_time, double elapsed_time)
+{
+	{
+		auto holder = lock_states();
+		simulating = true;
+	}
+
+	frame_count++;
+
+	auto &group = composer.begin_pipeline_stage();
+	group.set_desc("animation-simulate");
+	size_t count = active_animation.size();
+	constexpr size_t per_batch = 32;
+	for (size_t i = 0; i < count; i += per_batch)
+	{
+		group.enqueue_task([=]() {
+			auto itr = active_animation.begin() + i;
+			auto end_itr = itr + std::min(per_batch, count - i);
+			while (itr != end_itr)
+			{
+				simulate_pose(*itr, frame_time, elapsed_time);
+				++itr;
+			}
+		});
+	}
+
+	auto &done = composer.begin_pipeline_stage();
+	done.set_desc("animation-simulate-done");
+	done.enqueue_task([this]() {
+		std::lock_guard<std::mutex> holder{simulate_lock};
+		simulating = false;
+		simulate_cond.notify_all();
+	});
+}
+
+void AnimationSystem::commit_poses()
+{
+	// Not held further, since completion callbacks may start new animations.
+	lock_states();
+
+	for (auto *anim : active_animation)
+	{
+		if (anim->pose_pending)
+		{
+			if (anim->animation.is_skinned())
+			{
+				auto *node = anim->skinned_node;
+				auto &skin = node->get_skin()->skin;
+				anim->animation.copy_animated_channels(skin.data(), anim->pose.data(), skin.size());
+				node->invalidate_cached_transform();
+			}
+			else
+			{
+				anim->animation.copy_animated_channels(anim->channel_transforms.data(), anim->pose.data(),
+				                                       anim->channel_transforms.size());
+				for (auto *node : anim->channel_nodes)
+					node->invalidate_cached_transform();
+			}
+			anim->pose_pending = false;
+		}
+
+		// World transforms are those of the last rendered frame, like set_lod_view().
+		if (lod_enable)
+			compute_lod_bounds(*anim, anim->lod_lo, anim->lod_hi);
+
+		if (anim->complete_pending)
+			garbage_collect_animations.push(anim);
+	}
+
+	garbage_collect();
+}
+
 AnimationSystem::AnimationState::AnimationState(const AnimationUnrolled &anim,
                                                 Util::SmallVector<Transform *> channel_transforms_,
                                                 Util::SmallVector<Scene::Node *> channel_nodes_,
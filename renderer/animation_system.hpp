@@ -29,6 +29,9 @@
 #include "unordered_array.hpp"
 #include "small_vector.hpp"
 #include "atomic_append_buffer.hpp"
+#include <limits>
+#include <mutex>
+#include <condition_variable>
 #include <vector>
 
 namespace Granite
@@ -38,6 +41,8 @@ class AnimationUnrolled : public Util::IntrusiveHashMapEnabled<AnimationUnrolled
 public:
 	AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate);
 	void animate(Transform * const *transforms, unsigned num_transforms, float offset_time) const;
+	// Copies only the components animate() writes, so other components of the targets are left alone.
+	void copy_animated_channels(Transform * const *transforms, const Transform *values, unsigned num_transforms) const;
 
 	unsigned get_num_channels() const;
 
@@ -55,9 +60,42 @@ private:
 		SCALE_BIT = 1 << 2
 	};
 
-	std::vector<std::vector<quat>> key_frames_rotation;
-	std::vector<std::vector<vec3>> key_frames_translation;
-	std::vector<std::vector<vec3>> key_frames_scale;
+	// Clips are stored compressed, sample-major and as structure-of-arrays over tracks,
+	// so a sample of every channel is a few contiguous cache lines.
+	// Tracks are grouped 4 by 4, padding lanes hold identity data which is never written back.
+	// Rotations are 16-bit snorm, the scale is irrelevant since we normalize after interpolation.
+	// Translations and scales are 16-bit unorm, range-reduced to per-track base and range.
+	enum { TrackGroupSize = 4 };
+
+	struct ConstantRotation
+	{
+		uint32_t channel;
+		quat value;
+	};
+
+	struct ConstantVector
+	{
+		uint32_t channel;
+		vec3 value;
+	};
+
+	std::vector<ConstantRotation> constant_rotations;
+	std::vector<ConstantVector> constant_translations;
+	std::vector<ConstantVector> constant_scales;
+
+	// [sample][group][component][lane]
+	std::vector<int16_t> rotation_samples;
+	std::vector<uint16_t> vector_samples;
+	std::vector<uint32_t> rotation_track_channels;
+
+	// Translation tracks come first, then scale tracks.
+	std::vector<uint32_t> vector_track_channels;
+	unsigned num_translation_tracks = 0;
+
+	// [group][component][lane], range is pre-scaled to decode unorm16 directly.
+	std::vector<float> vector_base;
+	std::vector<float> vector_range;
+
 	std::vector<uint8_t> channel_mask;
 
 	std::vector<uint32_t> multi_node_indices;
@@ -70,20 +108,48 @@ private:
 	Util::Hash skin_compat = 0;
 	bool skinning = false;
 
-	void reserve_num_clips(unsigned count);
 	unsigned find_or_allocate_index(uint32_t node_index);
 
-	void animate_single(Transform &transform, unsigned channel, int lo, int hi, float l) const;
+	void compress(const std::vector<std::vector<quat>> &rotations,
+	              const std::vector<std::vector<vec3>> &translations,
+	              const std::vector<std::vector<vec3>> &scales);
+	void sample_rotations(Transform *const *transforms, unsigned lo, unsigned hi, float l) const;
+	void sample_vectors(Transform *const *transforms, unsigned lo, unsigned hi, float l) const;
 };
 
 using AnimationID = Util::GenerationalHandleID;
 using AnimationStateID = Util::GenerationalHandleID;
 
+// Screen size is the bounding sphere radius of the animated joints or nodes over the distance to the camera.
+// Animations below a size update at a fraction of the frame rate, staggered across states.
+struct AnimationLODOptions
+{
+	float full_rate_screen_size = 0.1f;
+	float half_rate_screen_size = 0.05f;
+	float quarter_rate_screen_size = 0.025f;
+
+	// Joints and nodes are points, pad them to cover the skinned geometry.
+	float bounds_padding = 0.5f;
+	bool skip_invisible = true;
+};
+
 class AnimationSystem
 {
 public:
+	// Animation LOD is driven by the view of the previous frame, since poses are computed before the camera moves.
+	void set_lod_view(const vec3 &camera_position, const Frustum &frustum);
+	void disable_lod();
+	void set_lod_options(const AnimationLODOptions &options);
+
 	void animate(double frame_time, double elapsed_time);
 	void animate(TaskComposer &composer, double frame_time, double elapsed_time);
+
+	// Split animation for pipelined frames. simulate_poses() poses into a copy owned by each animation state
+	// and never writes to the scene, so it can run while the previous frame reads it.
+	// commit_poses() writes the animated components to the nodes, and runs completion callbacks.
+	// Entry points which change animation states or LOD wait for simulate_poses() to complete.
+	void simulate_poses(TaskComposer &composer, double frame_time, double elapsed_time);
+	void commit_poses();
 	void set_fixed_pose(Scene::Node &node, AnimationID id, float offset) const;
 	void set_fixed_pose_multi(Scene::NodeHandle *nodes, unsigned num_nodes, AnimationID id, float offset) const;
 
@@ -121,17 +187,43 @@ private:
 		double start_time = 0.0;
 		bool repeating = false;
 		bool relative_timing = false;
+		bool posed = false;
+
+		// Used by simulate_poses() and commit_poses().
+		Util::SmallVector<Transform> pose;
+		Util::SmallVector<Transform *> pose_transforms;
+		vec3 lod_lo = vec3(std::numeric_limits<float>::max());
+		vec3 lod_hi = vec3(-std::numeric_limits<float>::max());
+		bool pose_pending = false;
+		bool complete_pending = false;
 
 		std::function<void ()> cb;
 	};
 
+	AnimationLODOptions lod_options;
+	vec3 lod_camera_position = vec3(0.0f);
+	Frustum lod_frustum;
+	bool lod_enable = false;
+	uint64_t frame_count = 0;
+
 	Util::GenerationalHandlePool<AnimationUnrolled> animation_pool;
 	Util::IntrusiveHashMap<Util::IntrusivePODWrapper<AnimationID>> animation_map;
 	Util::GenerationalHandlePool<AnimationState> animation_state_pool;
 	Util::IntrusiveUnorderedArray<AnimationState> active_animation;
 	Util::AtomicAppendBuffer<AnimationState *> garbage_collect_animations;
 
+	// Held while animation states change, simulating is set while simulate_poses() tasks run.
+	std::mutex simulate_lock;
+	std::condition_variable simulate_cond;
+	bool simulating = false;
+	std::unique_lock<std::mutex> lock_states();
+
 	void update(AnimationState *state, double frame_time, double elapsed_time);
+	void simulate_pose(AnimationState *state, double frame_time, double elapsed_time);
+	bool advance(AnimationState *state, double frame_time, double elapsed_time,
+	             double &offset, bool &complete, bool cached_bounds);
+	bool should_update(const AnimationState &state, bool cached_bounds) const;
+	void compute_lod_bounds(const AnimationState &state, vec3 &lo, vec3 &hi) const;
 	void garbage_collect();
 };
 }
\ No newline at end of file
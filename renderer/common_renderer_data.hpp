@@ -28,6 +28,7 @@
 #include "application_wsi_events.hpp"
 #include "application_events.hpp"
 #include "global_managers_interface.hpp"
+#include "geometry_pool.hpp"
 
 namespace Vulkan
 {
@@ -85,5 +86,6 @@ public:
 	LightMesh light_mesh;
 	PersistentFrameEvent frame_tick;
 	BRDFTables brdf_tables;
+	GeometryPool geometry_pool;
 };
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "compute_skinning.hpp"
+#include "device.hpp"
+#include "render_graph.hpp"
+#include <algorithm>
+#include <string.h>
+
+using namespace Util;
+
+namespace Granite
+{
+// Satisfies any minStorageBufferOffsetAlignment.
+static constexpr VkDeviceSize SubAllocationAlignment = 256;
+static constexpr unsigned MaxBones = 256;
+
+ComputeSkinning::ComputeSkinning(const ComputeSkinningConfig &config_)
+	: config(config_)
+{
+}
+
+ComputeSkinning::Handles ComputeSkinning::add_to_scene(Scene &scene, const ComputeSkinningConfig &config)
+{
+	Handles handles;
+	handles.entity = scene.create_entity();
+
+	auto skinning = Util::make_handle<ComputeSkinning>(config);
+
+	auto *update_component = handles.entity->allocate_component<PerFrameUpdateComponent>();
+	update_component->refresh = skinning.get();
+
+	auto *rp = handles.entity->allocate_component<RenderPassComponent>();
+	rp->creator = skinning.get();
+
+	auto *renderable = handles.entity->allocate_component<RenderableComponent>();
+	renderable->renderable = skinning;
+
+	handles.skinning = skinning.get();
+	return handles;
+}
+
+unsigned ComputeSkinning::get_instance_count() const
+{
+	return unsigned(instances.size());
+}
+
+VkDeviceSize ComputeSkinning::get_used_size() const
+{
+	return used_size;
+}
+
+static bool attribute_is_aligned(const MeshAttributeLayout &layout)
+{
+	return (layout.offset & 3) == 0;
+}
+
+bool ComputeSkinning::mesh_is_supported(const SkinnedMesh &mesh)
+{
+	if (!mesh.vbo_position || !mesh.vbo_attributes || mesh.vertex_offset != 0)
+		return false;
+
+	constexpr VkBufferUsageFlags storage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	if ((mesh.vbo_position->get_create_info().usage & storage) == 0 ||
+	    (mesh.vbo_attributes->get_create_info().usage & storage) == 0)
+	{
+		return false;
+	}
+
+	if ((mesh.position_stride & 3) != 0 || (mesh.attribute_stride & 3) != 0)
+		return false;
+
+	auto &position = mesh.attributes[ecast(MeshAttribute::Position)];
+	auto &normal = mesh.attributes[ecast(MeshAttribute::Normal)];
+	auto &tangent = mesh.attributes[ecast(MeshAttribute::Tangent)];
+	auto &indices = mesh.attributes[ecast(MeshAttribute::BoneIndex)];
+	auto &weights = mesh.attributes[ecast(MeshAttribute::BoneWeights)];
+
+	if (position.format != VK_FORMAT_R32G32B32_SFLOAT && position.format != VK_FORMAT_R32G32B32A32_SFLOAT)
+		return false;
+	if (indices.format != VK_FORMAT_R8G8B8A8_UINT || weights.format != VK_FORMAT_R16G16B16A16_UNORM)
+		return false;
+	if (normal.format != VK_FORMAT_UNDEFINED && normal.format != VK_FORMAT_R32G32B32_SFLOAT)
+		return false;
+	if (tangent.format != VK_FORMAT_UNDEFINED && tangent.format != VK_FORMAT_R32G32B32A32_SFLOAT)
+		return false;
+
+	return attribute_is_aligned(position) && attribute_is_aligned(normal) && attribute_is_aligned(tangent) &&
+	       attribute_is_aligned(indices) && attribute_is_aligned(weights);
+}
+
+void ComputeSkinning::refresh(const RenderContext &, TaskComposer &)
+{
+	instances.clear();
+	used_size = 0;
+
+	if (!scene)
+		return;
+
+	auto &group = scene->get_entity_pool().get_component_group<RenderInfoComponent, RenderableComponent>();
+	std::vector<RenderInfoComponent *> skinned_infos;
+
+	for (auto &o : group)
+	{
+		auto *info = get_component<RenderInfoComponent>(o);
+		info->skinned_vertices = nullptr;
+
+		// The first frame after the graph is baked has nowhere to write to.
+		if (!vertices_buffer || !info->skin_transform)
+			continue;
+
+		auto *mesh = get_component<RenderableComponent>(o)->renderable->get_skinned_mesh();
+		if (!mesh || !mesh_is_supported(*mesh) || info->skin_transform->bone_world_transforms.size() > MaxBones)
+			continue;
+
+		auto num_vertices = uint32_t(std::min(mesh->vbo_position->get_create_info().size / mesh->position_stride,
+		                                      mesh->vbo_attributes->get_create_info().size / mesh->attribute_stride));
+
+		VkDeviceSize position_size = (num_vertices * 3 * sizeof(float) + SubAllocationAlignment - 1) &
+		                             ~(SubAllocationAlignment - 1);
+		VkDeviceSize attribute_size = (VkDeviceSize(num_vertices) * mesh->attribute_stride + SubAllocationAlignment - 1) &
+		                              ~(SubAllocationAlignment - 1);
+		if (used_size + 2 * position_size + attribute_size > config.buffer_size)
+			continue;
+
+		Instance instance = {};
+		instance.info = info;
+		instance.mesh = mesh;
+		instance.num_vertices = num_vertices;
+		instance.cache.buffer = vertices_buffer;
+		instance.cache.position_offset = used_size;
+		instance.cache.prev_position_offset = used_size + position_size;
+		instance.cache.attribute_offset = used_size + 2 * position_size;
+		used_size += 2 * position_size + attribute_size;
+
+		instances.push_back(instance);
+		skinned_infos.push_back(info);
+	}
+
+	for (size_t i = 0; i < instances.size(); i++)
+		skinned_infos[i]->skinned_vertices = &instances[i].cache;
+}
+
+void ComputeSkinning::skin_instances(Vulkan::CommandBuffer &cmd)
+{
+	if (instances.empty())
+		return;
+
+	// Last frame's draws may still read the vertices we are about to overwrite.
+	cmd.barrier(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	cmd.set_program("builtin://shaders/skinning.comp");
+
+	const auto attribute_word = [](const MeshAttributeLayout &layout) -> uint32_t {
+		return layout.format != VK_FORMAT_UNDEFINED ? layout.offset / 4 : ~0u;
+	};
+
+	for (auto &instance : instances)
+	{
+		auto &mesh = *instance.mesh;
+		auto &bones = instance.info->skin_transform->bone_world_transforms;
+		auto *prev_bones = &bones;
+		if (instance.info->prev_skin_transform &&
+		    instance.info->prev_skin_transform->bone_world_transforms.size() == bones.size())
+		{
+			prev_bones = &instance.info->prev_skin_transform->bone_world_transforms;
+		}
+
+		auto num_bones = unsigned(bones.size());
+		memcpy(cmd.allocate_typed_constant_data<mat4>(1, 0, num_bones), bones.data(), num_bones * sizeof(mat4));
+		memcpy(cmd.allocate_typed_constant_data<mat4>(1, 1, num_bones), prev_bones->data(), num_bones * sizeof(mat4));
+
+		VkDeviceSize position_size = instance.num_vertices * 3 * sizeof(float);
+		cmd.set_storage_buffer(0, 0, *mesh.vbo_position);
+		cmd.set_storage_buffer(0, 1, *mesh.vbo_attributes);
+		cmd.set_storage_buffer(0, 2, *vertices_buffer, instance.cache.position_offset, position_size);
+		cmd.set_storage_buffer(0, 3, *vertices_buffer, instance.cache.prev_position_offset, position_size);
+		cmd.set_storage_buffer(0, 4, *vertices_buffer, instance.cache.attribute_offset,
+		                       VkDeviceSize(instance.num_vertices) * mesh.attribute_stride);
+
+		struct Push
+		{
+			uint32_t num_vertices;
+			uint32_t position_stride;
+			uint32_t position_offset;
+			uint32_t attribute_stride;
+			uint32_t normal_offset;
+			uint32_t tangent_offset;
+			uint32_t bone_index_offset;
+			uint32_t bone_weight_offset;
+		} push = {};
+
+		push.num_vertices = instance.num_vertices;
+		push.position_stride = mesh.position_stride / 4;
+		push.position_offset = mesh.attributes[ecast(MeshAttribute::Position)].offset / 4;
+		push.attribute_stride = mesh.attribute_stride / 4;
+		push.normal_offset = attribute_word(mesh.attributes[ecast(MeshAttribute::Normal)]);
+		push.tangent_offset = attribute_word(mesh.attributes[ecast(MeshAttribute::Tangent)]);
+		push.bone_index_offset = attribute_word(mesh.attributes[ecast(MeshAttribute::BoneIndex)]);
+		push.bone_weight_offset = attribute_word(mesh.attributes[ecast(MeshAttribute::BoneWeights)]);
+		cmd.push_constants(&push, 0, sizeof(push));
+
+		cmd.dispatch((instance.num_vertices + 63) / 64, 1, 1);
+	}
+}
+
+void ComputeSkinning::get_render_info(const RenderContext &, const RenderInfoComponent *, RenderQueue &) const
+{
+}
+
+void ComputeSkinning::add_render_passes(RenderGraph &graph_)
+{
+	graph = &graph_;
+	device = &graph_.get_device();
+	vertices_buffer = nullptr;
+
+	auto &pass = graph_.add_pass("compute-skinning", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+
+	BufferInfo info;
+	info.size = config.buffer_size;
+	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	vertices = &pass.add_storage_output("skinned-vertices", info);
+
+	pass.set_build_render_pass([this](Vulkan::CommandBuffer &cmd) {
+		skin_instances(cmd);
+	});
+}
+
+void ComputeSkinning::set_base_renderer(const RendererSuite *)
+{
+}
+
+void ComputeSkinning::set_base_render_context(const RenderContext *)
+{
+}
+
+void ComputeSkinning::setup_render_pass_dependencies(RenderGraph &, RenderPass &target,
+                                                     RenderPassCreator::DependencyFlags dep_flags)
+{
+	if ((dep_flags & (RenderPassCreator::GEOMETRY_BIT | RenderPassCreator::MATERIAL_BIT)) != 0)
+		target.add_vertex_buffer_input("skinned-vertices");
+}
+
+void ComputeSkinning::setup_render_pass_dependencies(RenderGraph &)
+{
+}
+
+void ComputeSkinning::setup_render_pass_resources(RenderGraph &graph_)
+{
+	vertices_buffer = &graph_.get_physical_buffer_resource(*vertices);
+	for (auto &instance : instances)
+		instance.cache.buffer = vertices_buffer;
+}
+
+void ComputeSkinning::set_scene(Scene *scene_)
+{
+	scene = scene_;
+}
+}
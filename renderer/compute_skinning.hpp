@@ -0,0 +1,101 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "abstract_renderable.hpp"
+#include "scene.hpp"
+#include "mesh.hpp"
+#include <vector>
+
+namespace Granite
+{
+class RenderBufferResource;
+
+struct ComputeSkinningConfig
+{
+	// Capacity of the per-frame vertex buffer.
+	// Instances which do not fit keep skinning in the vertex shader.
+	VkDeviceSize buffer_size = 64 * 1024 * 1024;
+};
+
+// Skins every supported SkinnedMesh instance once per frame in a compute pass,
+// writing world space positions, previous positions and rotated attributes to a buffer.
+// Depth, shadow, G-buffer and motion vector passes then all draw from that buffer
+// rather than skinning again in their vertex shaders.
+// Meshes qualify if their bone data is laid out like the glTF loader writes it,
+// and their vertex buffers were created with storage buffer usage.
+// RenderInfoComponent::skinned_vertices points into this object, so it must live as long as the scene.
+class ComputeSkinning : public AbstractRenderable,
+                        public PerFrameRefreshable,
+                        public RenderPassCreator
+{
+public:
+	explicit ComputeSkinning(const ComputeSkinningConfig &config);
+
+	struct Handles
+	{
+		Entity *entity;
+		ComputeSkinning *skinning;
+	};
+	static Handles add_to_scene(Scene &scene, const ComputeSkinningConfig &config = {});
+
+	unsigned get_instance_count() const;
+	VkDeviceSize get_used_size() const;
+
+	static bool mesh_is_supported(const SkinnedMesh &mesh);
+
+private:
+	ComputeSkinningConfig config;
+
+	struct Instance
+	{
+		const RenderInfoComponent *info;
+		const SkinnedMesh *mesh;
+		uint32_t num_vertices;
+		SkinnedVertexCache cache;
+	};
+	std::vector<Instance> instances;
+	VkDeviceSize used_size = 0;
+
+	Vulkan::Device *device = nullptr;
+	Scene *scene = nullptr;
+	RenderGraph *graph = nullptr;
+	RenderBufferResource *vertices = nullptr;
+	const Vulkan::Buffer *vertices_buffer = nullptr;
+
+	void skin_instances(Vulkan::CommandBuffer &cmd);
+
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                     RenderQueue &queue) const override;
+	void refresh(const RenderContext &context, TaskComposer &composer) override;
+
+	void add_render_passes(RenderGraph &graph) override;
+	void set_base_renderer(const RendererSuite *suite) override;
+	void set_base_render_context(const RenderContext *context) override;
+	void setup_render_pass_dependencies(RenderGraph &graph, RenderPass &target,
+	                                    RenderPassCreator::DependencyFlags dep_flags) override;
+	void setup_render_pass_dependencies(RenderGraph &graph) override;
+	void setup_render_pass_resources(RenderGraph &graph) override;
+	void set_scene(Scene *scene) override;
+};
+}
@@ -51,15 +51,6 @@ struct Triangle
 	vec4 vertices[3];
 };
 
-struct TriangleSetup
-{
-	vec3 base;
-	vec3 dx;
-	vec3 dy;
-	vec2 lo;
-	vec2 hi;
-};
-
 static float cross_2d(const vec2 &a, const vec2 &b)
 {
 	return a.x * b.y - a.y * b.x;
@@ -98,6 +89,11 @@ static bool setup_triangle(TriangleSetup &setup, const Triangle &tri, CullMode c
 	setup.lo = lo;
 	setup.hi = hi;
 
+	// Each edge function is the barycentric weight of the opposing vertex.
+	vec3 depth(tri.vertices[2].z, tri.vertices[0].z, tri.vertices[1].z);
+	setup.depth = vec3(dot(setup.base, depth), dot(setup.dx, depth), dot(setup.dy, depth));
+	setup.max_depth = max(max(depth.x, depth.y), depth.z);
+
 	return true;
 }
 
@@ -350,6 +346,126 @@ void rasterize_conservative_triangles(std::vector<uvec2> &coverage,
 	}
 }
 
+void setup_depth_triangles(std::vector<TriangleSetup> &setups,
+                           const vec4 *clip_positions,
+                           const unsigned *indices, unsigned num_indices,
+                           CullMode cull)
+{
+	for (unsigned index = 0; index < num_indices; index += 3)
+	{
+		Triangle prim = {
+			clip_positions[indices[index + 0]],
+			clip_positions[indices[index + 1]],
+			clip_positions[indices[index + 2]],
+		};
+
+		// Geometry in front of the near plane is never drawn, so it cannot occlude anything.
+		// This also keeps W positive for the divide.
+		unsigned clip_code = get_clip_code_low(prim.vertices[0].z, prim.vertices[1].z, prim.vertices[2].z, 0.0f);
+		Triangle clipped_near[2];
+		unsigned clipped_count = clip_component(clipped_near, prim, 2, 0.0f, clip_code);
+
+		for (unsigned i = 0; i < clipped_count; i++)
+		{
+			TriangleSetup tmp[2];
+			unsigned count = setup_clipped_triangles_clipped_w(tmp, clipped_near[i], cull);
+			setups.insert(setups.end(), tmp, tmp + count);
+		}
+	}
+}
+
+void rasterize_depth_triangle(float *depth, uvec2 resolution, const TriangleSetup &setup, uvec2 lo, uvec2 hi)
+{
+	vec2 fresolution = vec2(resolution);
+	vec2 inv_resolution = 1.0f / fresolution;
+
+	// Pixels whose centers can be inside the triangle.
+	ivec2 start = ivec2(muglm::ceil(setup.lo * fresolution - 0.5f));
+	ivec2 end = ivec2(muglm::floor(setup.hi * fresolution - 0.5f));
+	start = max(start, ivec2(lo));
+	end = min(end, ivec2(hi) - 1);
+	if (start.x > end.x || start.y > end.y)
+		return;
+
+	// Pixels left of the triangle fail the edge test, so rows can start on a SIMD boundary.
+	start.x &= ~3;
+
+	const vec3 step_x = setup.dx * inv_resolution.x;
+	const vec3 step_y = setup.dy * inv_resolution.y;
+	const float depth_step_x = setup.depth.y * inv_resolution.x;
+	const float depth_step_y = setup.depth.z * inv_resolution.y;
+	const float depth_slack = 0.5f * (muglm::abs(depth_step_x) + muglm::abs(depth_step_y));
+
+	vec2 center = (vec2(start) + 0.5f) * inv_resolution;
+	vec3 row_edges = setup.base + setup.dx * center.x + setup.dy * center.y;
+	float row_depth = setup.depth.x + setup.depth.y * center.x + setup.depth.z * center.y + depth_slack;
+
+	for (int y = start.y; y <= end.y; y++, row_edges += step_y, row_depth += depth_step_y)
+	{
+		float *row = depth + y * resolution.x;
+
+#if defined(__SSE__)
+		const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 max_depth = _mm_set1_ps(setup.max_depth);
+		__m128 e0 = _mm_add_ps(_mm_set1_ps(row_edges.x), _mm_mul_ps(lanes, _mm_set1_ps(step_x.x)));
+		__m128 e1 = _mm_add_ps(_mm_set1_ps(row_edges.y), _mm_mul_ps(lanes, _mm_set1_ps(step_x.y)));
+		__m128 e2 = _mm_add_ps(_mm_set1_ps(row_edges.z), _mm_mul_ps(lanes, _mm_set1_ps(step_x.z)));
+		__m128 z = _mm_add_ps(_mm_set1_ps(row_depth), _mm_mul_ps(lanes, _mm_set1_ps(depth_step_x)));
+		const __m128 e0_step = _mm_set1_ps(4.0f * step_x.x);
+		const __m128 e1_step = _mm_set1_ps(4.0f * step_x.y);
+		const __m128 e2_step = _mm_set1_ps(4.0f * step_x.z);
+		const __m128 z_step = _mm_set1_ps(4.0f * depth_step_x);
+
+		for (int x = start.x; x <= end.x; x += 4)
+		{
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)),
+			                           _mm_cmpgt_ps(e2, zero));
+			__m128 old = _mm_loadu_ps(row + x);
+			__m128 nearest = _mm_min_ps(old, _mm_min_ps(z, max_depth));
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+
+			e0 = _mm_add_ps(e0, e0_step);
+			e1 = _mm_add_ps(e1, e1_step);
+			e2 = _mm_add_ps(e2, e2_step);
+			z = _mm_add_ps(z, z_step);
+		}
+#elif defined(__ARM_NEON)
+		static const float lane_values[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+		const float32x4_t lanes = vld1q_f32(lane_values);
+		const float32x4_t zero = vdupq_n_f32(0.0f);
+		const float32x4_t max_depth = vdupq_n_f32(setup.max_depth);
+		float32x4_t e0 = vmlaq_f32(vdupq_n_f32(row_edges.x), lanes, vdupq_n_f32(step_x.x));
+		float32x4_t e1 = vmlaq_f32(vdupq_n_f32(row_edges.y), lanes, vdupq_n_f32(step_x.y));
+		float32x4_t e2 = vmlaq_f32(vdupq_n_f32(row_edges.z), lanes, vdupq_n_f32(step_x.z));
+		float32x4_t z = vmlaq_f32(vdupq_n_f32(row_depth), lanes, vdupq_n_f32(depth_step_x));
+		const float32x4_t e0_step = vdupq_n_f32(4.0f * step_x.x);
+		const float32x4_t e1_step = vdupq_n_f32(4.0f * step_x.y);
+		const float32x4_t e2_step = vdupq_n_f32(4.0f * step_x.z);
+		const float32x4_t z_step = vdupq_n_f32(4.0f * depth_step_x);
+
+		for (int x = start.x; x <= end.x; x += 4)
+		{
+			uint32x4_t inside = vandq_u32(vandq_u32(vcgtq_f32(e0, zero), vcgtq_f32(e1, zero)), vcgtq_f32(e2, zero));
+			float32x4_t old = vld1q_f32(row + x);
+			float32x4_t nearest = vminq_f32(old, vminq_f32(z, max_depth));
+			vst1q_f32(row + x, vbslq_f32(inside, nearest, old));
+
+			e0 = vaddq_f32(e0, e0_step);
+			e1 = vaddq_f32(e1, e1_step);
+			e2 = vaddq_f32(e2, e2_step);
+			z = vaddq_f32(z, z_step);
+		}
+#else
+		vec3 edges = row_edges;
+		float z = row_depth;
+		for (int x = start.x; x <= end.x; x++, edges += step_x, z += depth_step_x)
+			if (all(greaterThan(edges, vec3(0.0f))))
+				row[x] = min(row[x], min(z, setup.max_depth));
+#endif
+	}
+}
+
 void transform_vertices(vec4 *clip_position, const vec4 *positions, unsigned num_positions, const mat4 &mvp)
 {
 	for (unsigned i = 0; i < num_positions; i++)
@@ -36,11 +36,37 @@ enum class CullMode
 	Both
 };
 
+// A triangle in [0, 1] screen coordinates, where depth is NDC Z.
+struct TriangleSetup
+{
+	// Edge functions as base + dx * x + dy * y, all positive inside the triangle.
+	vec3 base;
+	vec3 dx;
+	vec3 dy;
+	// Depth plane as (base, dx, dy).
+	vec3 depth;
+	float max_depth;
+	vec2 lo;
+	vec2 hi;
+};
+
 void rasterize_conservative_triangles(std::vector<uvec2> &coverage,
                                       const vec4 *clip_positions,
                                       const unsigned *indices, unsigned num_indices,
                                       uvec2 resolution, CullMode cull);
 
+// Appends screen space triangles, clipped against the near and far planes.
+void setup_depth_triangles(std::vector<TriangleSetup> &setups,
+                           const vec4 *clip_positions,
+                           const unsigned *indices, unsigned num_indices,
+                           CullMode cull);
+
+// Rasterizes into the [lo, hi) pixel rectangle of a row-major depth buffer, keeping the nearest depth.
+// Pixels are covered by their centers, and the depth written is the farthest the triangle reaches
+// within the pixel, so the result never occludes more than the triangle does.
+// The buffer width and lo.x must be multiples of 4.
+void rasterize_depth_triangle(float *depth, uvec2 resolution, const TriangleSetup &setup, uvec2 lo, uvec2 hi);
+
 void transform_vertices(vec4 *clip_position, const vec4 *positions, unsigned num_positions, const mat4 &mvp);
 }
 }
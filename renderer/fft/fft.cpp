@@ -71,6 +71,7 @@ struct FFT::Impl
 	Options options;
 
 	BufferHandle twiddle_buffer;
+	unsigned twiddle_count = 0;
 	BufferHandle tmp_buffer;
 	BufferHandle output_tmp_buffer;
 	std::vector<Iteration> iterations;
@@ -480,7 +481,22 @@ void FFT::Impl::init_twiddle_buffer()
 		max_n = options.Nz;
 
 	int dir = mode_to_direction(options.mode);
+
+	// Twiddles of smaller transforms are a prefix of the larger table.
+	auto *source = options.twiddle_source ? options.twiddle_source->impl.get() : nullptr;
+	options.twiddle_source = nullptr;
+	if (source && source->twiddle_buffer && source->device == device &&
+	    mode_to_direction(source->options.mode) == dir &&
+	    source->options.data_type == options.data_type &&
+	    source->twiddle_count >= max_n)
+	{
+		twiddle_buffer = source->twiddle_buffer;
+		twiddle_count = source->twiddle_count;
+		return;
+	}
+
 	twiddle_buffer = build_twiddle_buffer(*device, dir, int(max_n), options.data_type);
+	twiddle_count = max_n;
 }
 
 void FFT::Impl::init_tmp_buffer()
@@ -731,4 +747,27 @@ unsigned FFT::get_num_iterations() const
 		return 0;
 	return unsigned(impl->iterations.size());
 }
+
+void FFT::execute_batched(CommandBuffer &cmd, const Batch *batches, size_t count)
+{
+	unsigned num_iterations = 0;
+	for (size_t i = 0; i < count; i++)
+		num_iterations = std::max(num_iterations, batches[i].fft->get_num_iterations());
+
+	for (unsigned iteration = 0; iteration < num_iterations; iteration++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			auto &batch = batches[i];
+			if (iteration < batch.fft->get_num_iterations())
+				batch.fft->execute_iteration(cmd, batch.dst, batch.src, iteration);
+		}
+
+		if (iteration + 1 < num_iterations)
+		{
+			cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		}
+	}
+}
 }
\ No newline at end of file
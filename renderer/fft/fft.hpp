@@ -63,6 +63,9 @@ public:
 		DataType data_type = DataType::FP32;
 		// If Ny or Nz are larger than 1 and dimensions is smaller than 2 or 3 respectively, we get batched FFTs.
 		unsigned dimensions = 1;
+		// Reuse the twiddle buffer of an already planned FFT if it has the same direction and data type,
+		// and covers at least as many twiddle factors. Otherwise, a new buffer is built.
+		const FFT *twiddle_source = nullptr;
 	};
 
 	struct BufferResource
@@ -104,6 +107,15 @@ public:
 	unsigned get_num_iterations() const;
 	void release();
 
+	// Independent transforms of any size, interleaved so that each stage only needs one barrier.
+	struct Batch
+	{
+		FFT *fft;
+		Resource dst;
+		Resource src;
+	};
+	static void execute_batched(Vulkan::CommandBuffer &cmd, const Batch *batches, size_t count);
+
 private:
 	struct Impl;
 	std::unique_ptr<Impl> impl;
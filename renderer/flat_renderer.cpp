@@ -25,6 +25,7 @@
 #include "event.hpp"
 #include "sprite.hpp"
 #include <float.h>
+#include <string.h>
 
 using namespace Vulkan;
 using namespace std;
@@ -76,10 +77,133 @@ void FlatRenderer::on_device_destroyed(const DeviceCreatedEvent &)
 {
 }
 
+void FlatRenderer::set_immediate_batching(bool enable)
+{
+	immediate_batching = enable;
+}
+
 void FlatRenderer::begin()
 {
 	queue.reset();
 	queue.set_shader_suites(suite);
+	if (device)
+		queue.set_frame_arena(&device->get_frame_arena());
+	immediate_batches.clear();
+	for (auto &harvested : immediate_harvested)
+		harvested = 0;
+}
+
+void FlatRenderer::begin_recording(RenderQueue &recording)
+{
+	recording.reset();
+	recording.set_shader_suites(suite);
+	target = &recording;
+}
+
+void FlatRenderer::end_recording()
+{
+	target = &queue;
+}
+
+void FlatRenderer::push_recording(const RenderQueue &recording)
+{
+	queue.combine_render_info(recording);
+	harvest_immediate();
+}
+
+void FlatRenderer::harvest_immediate()
+{
+	if (!immediate_batching || target != &queue)
+		return;
+
+	for (unsigned i = 0; i < ecast(Queue::Count); i++)
+	{
+		auto type = Queue(i);
+		auto &data = queue.get_queue_data(type);
+		auto &harvested = immediate_harvested[i];
+
+		for (; harvested < data.size(); harvested++)
+		{
+			// The render queue dedups render infos, so a matching pointer means identical state.
+			// Anything pushed to another queue since would have started a new batch.
+			if (!immediate_batches.empty())
+			{
+				auto &last = immediate_batches.back();
+				auto &last_data = data[last.first];
+				if (last.queue == type &&
+				    last_data.render == data[harvested].render &&
+				    last_data.render_info == data[harvested].render_info)
+				{
+					last.count++;
+					continue;
+				}
+			}
+
+			immediate_batches.push_back({ type, harvested, 1 });
+		}
+	}
+}
+
+void FlatRenderer::flush_immediate(Vulkan::CommandBuffer &cmd)
+{
+	CommandBufferSavedState opaque_state, transparent_state;
+	cmd.set_opaque_sprite_state();
+	cmd.save_state(COMMAND_BUFFER_SAVED_SCISSOR_BIT | COMMAND_BUFFER_SAVED_VIEWPORT_BIT | COMMAND_BUFFER_SAVED_RENDER_STATE_BIT, opaque_state);
+	cmd.set_transparent_sprite_state();
+	cmd.save_state(COMMAND_BUFFER_SAVED_SCISSOR_BIT | COMMAND_BUFFER_SAVED_VIEWPORT_BIT | COMMAND_BUFFER_SAVED_RENDER_STATE_BIT, transparent_state);
+
+	size_t count = immediate_batches.size();
+	size_t i = 0;
+	while (i < count)
+	{
+		auto *data = queue.get_queue_data(immediate_batches[i].queue).data();
+
+		if (data[immediate_batches[i].first].render != RenderFunctions::sprite_render)
+		{
+			auto &batch = immediate_batches[i];
+			cmd.restore_state(batch.queue == Queue::Transparent ? transparent_state : opaque_state);
+			data[batch.first].render(cmd, data + batch.first, batch.count);
+			i++;
+			continue;
+		}
+
+		// Other render functions may rebind the instance buffer, so pack each run of sprite batches separately.
+		size_t end = i;
+		unsigned total_quads = 0;
+		for (; end < count; end++)
+		{
+			auto &batch = immediate_batches[end];
+			auto *batch_data = queue.get_queue_data(batch.queue).data() + batch.first;
+			if (batch_data->render != RenderFunctions::sprite_render)
+				break;
+			for (unsigned j = 0; j < batch.count; j++)
+				total_quads += static_cast<const SpriteInstanceInfo *>(batch_data[j].instance_data)->count;
+		}
+
+		auto *quads = static_cast<QuadData *>(
+			cmd.allocate_vertex_data(1, total_quads * sizeof(QuadData),
+			                         sizeof(QuadData), VK_VERTEX_INPUT_RATE_INSTANCE));
+
+		unsigned first_quad = 0;
+		for (; i < end; i++)
+		{
+			auto &batch = immediate_batches[i];
+			auto *batch_data = queue.get_queue_data(batch.queue).data() + batch.first;
+
+			unsigned num_quads = 0;
+			for (unsigned j = 0; j < batch.count; j++)
+			{
+				auto &instance_info = *static_cast<const SpriteInstanceInfo *>(batch_data[j].instance_data);
+				memcpy(quads + first_quad + num_quads, instance_info.quads, instance_info.count * sizeof(QuadData));
+				num_quads += instance_info.count;
+			}
+
+			cmd.restore_state(batch.queue == Queue::Transparent ? transparent_state : opaque_state);
+			RenderFunctions::sprite_render_instances(
+				cmd, *static_cast<const SpriteRenderInfo *>(batch_data->render_info), first_quad, num_quads);
+			first_quad += num_quads;
+		}
+	}
 }
 
 void FlatRenderer::flush(Vulkan::CommandBuffer &cmd, const vec3 &camera_pos, const vec3 &camera_size)
@@ -100,6 +224,12 @@ void FlatRenderer::flush(Vulkan::CommandBuffer &cmd, const vec3 &camera_pos, con
 	global->pos_offset_pixels[2] = -camera_pos.z;
 	global->pos_offset_pixels[3] = 0.0f;
 
+	if (immediate_batching)
+	{
+		flush_immediate(cmd);
+		return;
+	}
+
 	queue.sort();
 
 	cmd.set_opaque_sprite_state();
@@ -125,8 +255,8 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 	SpriteRenderInfo sprite;
 	build_scissor(sprite.clip_quad, offset.xy(), offset.xy() + size);
 
-	auto *quads = queue.allocate_one<QuadData>();
-	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
+	auto *quads = target->allocate_one<QuadData>();
+	auto *instance_data = target->allocate_one<SpriteInstanceInfo>();
 	instance_data->quads = quads;
 	instance_data->count = 1;
 
@@ -151,7 +281,7 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 	auto instance_key = h.get();
 	auto sorting_key = RenderInfo::get_sprite_sort_key(type, pipe_hash, h.get(), offset.z);
 
-	auto *sprite_data = queue.push<SpriteRenderInfo>(type, instance_key, sorting_key, RenderFunctions::sprite_render, instance_data);
+	auto *sprite_data = target->push<SpriteRenderInfo>(type, instance_key, sorting_key, RenderFunctions::sprite_render, instance_data);
 
 	if (sprite_data)
 	{
@@ -191,6 +321,7 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 	quads->rotation[1] = 0.0f;
 	quads->rotation[2] = 0.0f;
 	quads->rotation[3] = 1.0f;
+	harvest_immediate();
 }
 
 void FlatRenderer::render_textured_quad(const ImageView &view,
@@ -203,6 +334,50 @@ void FlatRenderer::render_textured_quad(const ImageView &view,
 	render_quad(&view, layer, sampler, offset, size, tex_offset, tex_size, color, pipeline);
 }
 
+void FlatRenderer::render_static_quads(const ImageView &view, const Buffer &quads,
+                                       unsigned first_quad, unsigned num_quads, float layer,
+                                       DrawPipeline pipeline, Vulkan::StockSampler sampler)
+{
+	if (!num_quads)
+		return;
+
+	auto type = pipeline == DrawPipeline::AlphaBlend ? Queue::Transparent : Queue::Opaque;
+	bool layered = view.get_create_info().view_type == VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+
+	auto *instance_data = target->allocate_one<StaticSpriteInstanceInfo>();
+	instance_data->quads = &quads;
+	instance_data->first_quad = first_quad;
+	instance_data->count = num_quads;
+
+	SpriteRenderInfo sprite;
+	sprite.textures[0] = &view;
+	sprite.sampler = sampler;
+
+	Hasher h;
+	h.string("static-quad");
+	h.s32(ecast(pipeline));
+	auto pipe_hash = h.get();
+	h.u64(view.get_cookie());
+	h.s32(ecast(sampler));
+	h.s32(layered);
+	auto instance_key = h.get();
+	auto sorting_key = RenderInfo::get_sprite_sort_key(type, pipe_hash, h.get(), layer);
+
+	auto *sprite_data = target->push<SpriteRenderInfo>(type, instance_key, sorting_key,
+	                                                   RenderFunctions::sprite_render_static, instance_data);
+
+	if (sprite_data)
+	{
+		sprite.program = suite[ecast(RenderableType::Sprite)].get_program(
+				pipeline,
+				MESH_ATTRIBUTE_POSITION_BIT | MESH_ATTRIBUTE_VERTEX_COLOR_BIT | MESH_ATTRIBUTE_UV_BIT,
+				MATERIAL_TEXTURE_BASE_COLOR_BIT, layered ? Sprite::ARRAY_TEXTURE_BIT : 0);
+		*sprite_data = sprite;
+	}
+
+	harvest_immediate();
+}
+
 void FlatRenderer::render_quad(const vec3 &offset, const vec2 &size, const vec4 &color)
 {
 	if (color.w <= 0.0f)
@@ -231,10 +406,10 @@ void FlatRenderer::render_line_strip(const vec2 *offset, float layer, unsigned c
 	auto transparent = color.w < 1.0f;
 	LineStripInfo strip;
 
-	auto *lines = queue.allocate_one<LineInfo>();
+	auto *lines = target->allocate_one<LineInfo>();
 	lines->count = count;
-	lines->positions = queue.allocate_many<vec3>(count);
-	lines->colors = queue.allocate_many<vec4>(count);
+	lines->positions = target->allocate_many<vec3>(count);
+	lines->colors = target->allocate_many<vec4>(count);
 
 	vec2 minimum(FLT_MAX);
 	vec2 maximum(-FLT_MAX);
@@ -262,7 +437,7 @@ void FlatRenderer::render_line_strip(const vec2 *offset, float layer, unsigned c
 	auto instance_key = h.get();
 	auto sorting_key = RenderInfo::get_sprite_sort_key(transparent ? Queue::Transparent : Queue::Opaque, pipe_hash, h.get(), layer);
 
-	LineStripInfo *strip_data = queue.push<LineStripInfo>(transparent ? Queue::Transparent : Queue::Opaque,
+	LineStripInfo *strip_data = target->push<LineStripInfo>(transparent ? Queue::Transparent : Queue::Opaque,
 	                                                      instance_key, sorting_key, RenderFunctions::line_strip_render,
 	                                                      lines);
 	if (strip_data)
@@ -273,6 +448,8 @@ void FlatRenderer::render_line_strip(const vec2 *offset, float layer, unsigned c
 
 		*strip_data = strip;
 	}
+
+	harvest_immediate();
 }
 
 void FlatRenderer::render_text(const Font &font, const char *text, const vec3 &offset, const vec2 &size, const vec4 &color,
@@ -280,20 +457,25 @@ void FlatRenderer::render_text(const Font &font, const char *text, const vec3 &o
 {
 	if (color.w <= 0.0f)
 		return;
-	font.render_text(queue, text, offset, size,
+	font.render_text(*target, text, offset, size,
 	                 scissor_stack.back().offset, scissor_stack.back().size,
 	                 color, alignment, scale);
+	harvest_immediate();
 }
 
 void FlatRenderer::push_sprite(const SpriteInfo &info)
 {
-	info.sprite->get_sprite_render_info(info.transform, queue);
+	info.sprite->get_sprite_render_info(info.transform, *target);
+	harvest_immediate();
 }
 
 void FlatRenderer::push_sprites(const SpriteList &visible)
 {
 	for (auto &vis : visible)
-		vis.sprite->get_sprite_render_info(vis.transform, queue);
+	{
+		vis.sprite->get_sprite_render_info(vis.transform, *target);
+		harvest_immediate();
+	}
 }
 
 }
@@ -87,6 +87,13 @@ public:
 	                          Vulkan::StockSampler sampler = Vulkan::StockSampler::LinearClamp,
 	                          unsigned layer = 0);
 
+	// Draws num_quads QuadData entries from a persistent vertex buffer in one go.
+	// Positions are in the same space as render_textured_quad(), layer is only used for sorting.
+	void render_static_quads(const Vulkan::ImageView &view, const Vulkan::Buffer &quads,
+	                         unsigned first_quad, unsigned num_quads, float layer,
+	                         DrawPipeline pipeline,
+	                         Vulkan::StockSampler sampler = Vulkan::StockSampler::NearestClamp);
+
 	void render_text(const Font &font, const char *text,
 	                 const vec3 &offset, const vec2 &size,
 	                 const vec4 &color = vec4(1.0f),
@@ -99,12 +106,25 @@ public:
 	void push_scissor(const vec2 &offset, const vec2 &size);
 	void pop_scissor();
 
+	// Draws in submission order instead of sorting, and only breaks batches on render state changes.
+	// All quads between two line strips share one instance buffer. Depth testing still applies,
+	// so transparent quads must be submitted back to front. Must not change between begin() and flush().
+	void set_immediate_batching(bool enable);
+
+	// Redirects everything pushed until end_recording() into a separate queue.
+	// The recording stays valid until it is recorded again, and can be pushed in any later frame,
+	// as long as the textures and fonts it references are kept alive.
+	void begin_recording(RenderQueue &recording);
+	void end_recording();
+	void push_recording(const RenderQueue &recording);
+
 private:
 	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
 	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
 	Vulkan::Device *device = nullptr;
 	const ShaderSuiteResolver *resolver = nullptr;
 	RenderQueue queue;
+	RenderQueue *target = &queue;
 	ShaderSuite suite[Util::ecast(RenderableType::Count)];
 
 	struct Scissor
@@ -119,5 +139,18 @@ private:
 	                 DrawPipeline pipeline);
 
 	void build_scissor(ivec4 &clip, const vec2 &minimum, const vec2 &maximum) const;
+
+	struct ImmediateBatch
+	{
+		Queue queue;
+		size_t first;
+		unsigned count;
+	};
+	std::vector<ImmediateBatch> immediate_batches;
+	size_t immediate_harvested[Util::ecast(Queue::Count)] = {};
+	bool immediate_batching = false;
+
+	void harvest_immediate();
+	void flush_immediate(Vulkan::CommandBuffer &cmd);
 };
 }
\ No newline at end of file
@@ -26,6 +26,7 @@
 #include "filesystem.hpp"
 #include "device.hpp"
 #include "sprite.hpp"
+#include "sdf_glyph_cache.hpp"
 #include <string.h>
 #include <float.h>
 
@@ -86,10 +87,186 @@ Font::Font(const std::string &path, unsigned size)
 	EVENT_MANAGER_REGISTER_LATCH(Font, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 }
 
-vec2 Font::get_text_geometry(const char *text, float) const
+Font::Font(SDFGlyphCache &cache, unsigned size)
+	: font_height(size), sdf_cache(&cache)
+{
+}
+
+static uint32_t decode_utf8(const char *&text)
+{
+	auto c = uint8_t(*text++);
+	if (c < 0x80)
+		return c;
+
+	unsigned extra = c >= 0xf0 ? 3 : (c >= 0xe0 ? 2 : (c >= 0xc0 ? 1 : 0));
+	if (!extra)
+		return 0xfffd;
+
+	uint32_t codepoint = c & (0x3fu >> extra);
+	for (unsigned i = 0; i < extra; i++)
+	{
+		auto cont = uint8_t(*text);
+		if ((cont & 0xc0) != 0x80)
+			return 0xfffd;
+		codepoint = (codepoint << 6) | (cont & 0x3f);
+		text++;
+	}
+
+	return codepoint;
+}
+
+vec2 Font::get_text_geometry_sdf(const char *text, float scale) const
+{
+	float pixel_size = float(font_height) * scale;
+	float glyph_scale = pixel_size / float(SDFGlyphCache::BaseSize);
+
+	float pen = 0.0f;
+	float maximum = 0.0f;
+	float lines = pixel_size;
+	uint32_t prev = 0;
+
+	while (*text)
+	{
+		uint32_t codepoint = decode_utf8(text);
+		if (codepoint == '\n')
+		{
+			lines += pixel_size;
+			pen = 0.0f;
+			prev = 0;
+		}
+		else if (codepoint >= 32)
+		{
+			if (prev)
+				pen += sdf_cache->get_kerning(prev, codepoint) * glyph_scale;
+			pen += sdf_cache->get_advance(codepoint) * glyph_scale;
+			maximum = max(maximum, pen);
+			prev = codepoint;
+		}
+	}
+
+	return ceil(vec2(maximum, lines));
+}
+
+void Font::render_text_sdf(RenderQueue &queue, const char *text, const vec3 &offset, const vec2 &size,
+                           const vec2 &clip_offset, const vec2 &clip_size,
+                           const vec4 &color, Alignment alignment, float scale) const
+{
+	auto *view = sdf_cache->get_view();
+	if (!view)
+		return;
+
+	float pixel_size = float(font_height) * scale;
+	float glyph_scale = pixel_size / float(SDFGlyphCache::BaseSize);
+	vec2 geometry = get_text_geometry_sdf(text, scale);
+	vec2 alignment_offset = get_aligned_offset(alignment, geometry, size);
+
+	SpriteRenderInfo sprite;
+	sprite.textures[0] = view;
+	sprite.sampler = StockSampler::LinearClamp;
+
+	// At most one quad per byte.
+	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
+	auto *quads = queue.allocate_many<QuadData>(strlen(text));
+	instance_data->quads = quads;
+	instance_data->count = 0;
+
+	vec2 off = offset.xy() + alignment_offset;
+	off.y += pixel_size;
+	vec2 cached = off;
+	uint32_t prev = 0;
+
+	vec2 min_rect = vec2(FLT_MAX);
+	vec2 max_rect = vec2(-FLT_MAX);
+
+	while (*text)
+	{
+		uint32_t codepoint = decode_utf8(text);
+		if (codepoint == '\n')
+		{
+			cached.y += pixel_size;
+			off = cached;
+			prev = 0;
+			continue;
+		}
+		else if (codepoint < 32)
+			continue;
+
+		if (prev)
+			off.x += sdf_cache->get_kerning(prev, codepoint) * glyph_scale;
+		prev = codepoint;
+
+		if (auto *glyph = sdf_cache->request_glyph(codepoint))
+		{
+			vec2 pos = off + vec2(glyph->offset) * glyph_scale;
+			vec2 extent = vec2(glyph->size) * glyph_scale;
+			ivec2 cell = sdf_cache->get_cell_offset(glyph->cell);
+
+			auto &quad = quads[instance_data->count++];
+			quantize_color(quad.color, color);
+			quad.rotation[0] = 1.0f;
+			quad.rotation[1] = 0.0f;
+			quad.rotation[2] = 0.0f;
+			quad.rotation[3] = 1.0f;
+			quad.layer = offset.z;
+			quad.pos_off_x = pos.x;
+			quad.pos_off_y = pos.y;
+			quad.pos_scale_x = extent.x;
+			quad.pos_scale_y = extent.y;
+			quad.tex_off_x = float(cell.x);
+			quad.tex_off_y = float(cell.y);
+			quad.tex_scale_x = float(glyph->size.x);
+			quad.tex_scale_y = float(glyph->size.y);
+
+			min_rect = min(min_rect, pos);
+			max_rect = max(max_rect, pos + extent);
+		}
+
+		off.x += sdf_cache->get_advance(codepoint) * glyph_scale;
+	}
+
+	if (!instance_data->count)
+		return;
+
+	sdf_cache->flush_uploads();
+
+	if (any(lessThan(min_rect, clip_offset)) || any(greaterThan(max_rect, clip_offset + clip_size)))
+		sprite.clip_quad = ivec4(ivec2(clip_offset), ivec2(clip_size));
+
+	Hasher hasher;
+	hasher.string("font-sdf");
+	hasher.pointer(sprite.textures[0]);
+	hasher.s32(ecast(sprite.sampler));
+	hasher.s32(sprite.clip_quad.x);
+	hasher.s32(sprite.clip_quad.y);
+	hasher.s32(sprite.clip_quad.z);
+	hasher.s32(sprite.clip_quad.w);
+	auto instance_key = hasher.get();
+	auto sorting_key = RenderInfo::get_sprite_sort_key(Queue::Transparent, hasher.get(), hasher.get(), offset.z);
+
+	auto *sprite_data = queue.push<SpriteRenderInfo>(Queue::Transparent,
+	                                                 instance_key, sorting_key,
+	                                                 RenderFunctions::sprite_render,
+	                                                 instance_data);
+
+	if (sprite_data)
+	{
+		sprite.program = queue.get_shader_suites()[ecast(RenderableType::Sprite)].get_program(DrawPipeline::AlphaBlend,
+		                                                                                      MESH_ATTRIBUTE_UV_BIT |
+		                                                                                      MESH_ATTRIBUTE_POSITION_BIT |
+		                                                                                      MESH_ATTRIBUTE_VERTEX_COLOR_BIT,
+		                                                                                      MATERIAL_TEXTURE_BASE_COLOR_BIT,
+		                                                                                      Sprite::SDF_TEXTURE_BIT);
+
+		*sprite_data = sprite;
+	}
+}
+
+vec2 Font::get_text_geometry(const char *text, float scale) const
 {
 	if (!*text)
 		return vec2(0);
+	if (sdf_cache)
+		return get_text_geometry_sdf(text, scale);
 
 	vec2 off = vec2(0.0f);
 	off.y += font_height;
@@ -173,6 +350,12 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 	if (!*text)
 		return;
 
+	if (sdf_cache)
+	{
+		render_text_sdf(queue, text, offset, size, clip_offset, clip_size, color, alignment, scale);
+		return;
+	}
+
 	vec2 geometry = get_text_geometry(text, scale);
 	vec2 alignment_offset = get_aligned_offset(alignment, geometry, size);
 
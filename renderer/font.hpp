@@ -29,10 +29,15 @@
 
 namespace Granite
 {
+class SDFGlyphCache;
+
 class Font : public EventHandler
 {
 public:
 	Font(const std::string &path, unsigned size);
+	// Lays out text with glyphs from a shared cache instead of baking an atlas for this size.
+	// Any codepoint in the font can be rendered, text is decoded as UTF-8.
+	Font(SDFGlyphCache &cache, unsigned size);
 	~Font();
 
 	enum class Alignment
@@ -69,5 +74,12 @@ private:
 	std::vector<uint8_t> bitmap;
 	unsigned width = 0, height = 0;
 	unsigned font_height = 0;
+
+	SDFGlyphCache *sdf_cache = nullptr;
+	void render_text_sdf(RenderQueue &queue, const char *text,
+	                     const vec3 &offset, const vec2 &size,
+	                     const vec2 &clip_offset, const vec2 &clip_size,
+	                     const vec4 &color, Alignment alignment, float scale) const;
+	vec2 get_text_geometry_sdf(const char *text, float scale) const;
 };
 }
\ No newline at end of file
@@ -28,6 +28,9 @@
 #include <algorithm>
 #include "rapidjson_wrapper.hpp"
 #include "muglm/matrix_helper.hpp"
+#include "thread_group.hpp"
+#include "meshoptimizer.h"
+#include <exception>
 
 using namespace std;
 using namespace rapidjson;
@@ -36,9 +39,19 @@ using namespace Util;
 
 namespace GLTF
 {
+Parser::Buffer::Buffer(std::vector<uint8_t> owned_data)
+	: owned(move(owned_data)), ptr(owned.data()), length(owned.size())
+{
+}
+
+Parser::Buffer::Buffer(std::shared_ptr<File> file, const uint8_t *data, size_t size)
+	: mapping(move(file)), ptr(data), length(size)
+{
+}
+
 Parser::Buffer Parser::read_buffer(const string &path, uint64_t length)
 {
-	auto file = GRANITE_FILESYSTEM()->open(path);
+	shared_ptr<File> file = GRANITE_FILESYSTEM()->open(path);
 	if (!file)
 		throw runtime_error("Failed to open GLTF buffer.");
 
@@ -49,14 +62,12 @@ Parser::Buffer Parser::read_buffer(const string &path, uint64_t length)
 	if (!mapped)
 		throw runtime_error("Failed to map file.");
 
-	Buffer buf(length);
-	memcpy(buf.data(), mapped, length);
-	return buf;
+	return Buffer(move(file), static_cast<const uint8_t *>(mapped), length);
 }
 
 Parser::Buffer Parser::read_base64(const char *data, uint64_t length)
 {
-	Buffer buf(length);
+	vector<uint8_t> buf(length);
 	auto *ptr = buf.data();
 
 	const auto base64_index = [](char c) -> uint32_t {
@@ -117,7 +128,7 @@ Parser::Buffer Parser::read_base64(const char *data, uint64_t length)
 		i += outbytes;
 	}
 
-	return buf;
+	return Buffer(move(buf));
 }
 
 Parser::Parser(const std::string &path)
@@ -125,7 +136,7 @@ Parser::Parser(const std::string &path)
 	string json;
 
 	{
-		auto file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
+		shared_ptr<File> file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
 		if (!file)
 			throw runtime_error("Failed to load GLTF file.");
 
@@ -176,9 +187,8 @@ Parser::Parser(const std::string &path)
 							"Header error, binary chunk and JSON chunk lengths do not match up with GLB size.");
 
 				// The first buffer in the JSON must be this embedded buffer.
-				Buffer buffer(reinterpret_cast<const uint8_t *>(words),
-				              reinterpret_cast<const uint8_t *>(words) + binary_length);
-				json_buffers.push_back(move(buffer));
+				// It is used in place, the mapping lives until parsing is done.
+				json_buffers.emplace_back(file, reinterpret_cast<const uint8_t *>(words), binary_length);
 			}
 		}
 		else
@@ -624,6 +634,11 @@ void Parser::parse(const string &original_path, const string &json)
 
 		if (!uri)
 		{
+			// EXT_meshopt_compression views decode into buffers of their own,
+			// so the fallback only needs to keep the buffer indices in place.
+			if (buf.HasMember("extensions") && buf["extensions"].HasMember("EXT_meshopt_compression"))
+				json_buffers.emplace_back(vector<uint8_t>());
+
 			//if (length != json_buffers.front().size())
 			//	throw logic_error("Baked GLB buffer size must match the provided size in the header.");
 			return;
@@ -641,16 +656,64 @@ void Parser::parse(const string &original_path, const string &json)
 		}
 	};
 
+	const auto add_compressed_view = [&](const Value &meshopt, uint32_t view_index, uint32_t length) {
+		CompressedView compressed = {};
+		compressed.view = view_index;
+		compressed.buffer_index = meshopt["buffer"].GetUint();
+		compressed.offset = meshopt.HasMember("byteOffset") ? meshopt["byteOffset"].GetUint() : 0u;
+		compressed.length = meshopt["byteLength"].GetUint();
+		compressed.stride = meshopt["byteStride"].GetUint();
+		compressed.count = meshopt["count"].GetUint();
+
+		if (compressed.buffer_index >= json_buffers.size() ||
+		    compressed.offset + compressed.length > json_buffers[compressed.buffer_index].size())
+			throw logic_error("Compressed buffer view is out of range.");
+		if (uint64_t(compressed.stride) * compressed.count != length)
+			throw logic_error("Compressed buffer view size mismatch.");
+
+		const char *mode = meshopt["mode"].GetString();
+		if (strcmp(mode, "ATTRIBUTES") == 0)
+			compressed.mode = CompressedView::Mode::Attributes;
+		else if (strcmp(mode, "TRIANGLES") == 0)
+			compressed.mode = CompressedView::Mode::Triangles;
+		else if (strcmp(mode, "INDICES") == 0)
+			compressed.mode = CompressedView::Mode::Indices;
+		else
+			throw logic_error("Unrecognized meshopt compression mode.");
+
+		const char *filter = meshopt.HasMember("filter") ? meshopt["filter"].GetString() : "NONE";
+		if (strcmp(filter, "NONE") == 0)
+			compressed.filter = CompressedView::Filter::None;
+		else if (strcmp(filter, "OCTAHEDRAL") == 0)
+			compressed.filter = CompressedView::Filter::Octahedral;
+		else if (strcmp(filter, "QUATERNION") == 0)
+			compressed.filter = CompressedView::Filter::Quaternion;
+		else if (strcmp(filter, "EXPONENTIAL") == 0)
+			compressed.filter = CompressedView::Filter::Exponential;
+		else
+			throw logic_error("Unrecognized meshopt compression filter.");
+
+		json_compressed_views.push_back(compressed);
+	};
+
 	const auto add_view = [&](const Value &view) {
 		auto &buf = view["buffer"];
 		auto buffer_index = buf.GetUint();
 		auto offset = view.HasMember("byteOffset") ? view["byteOffset"].GetUint() : 0u;
 		auto length = view["byteLength"].GetUint();
+		auto stride = view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u;
+
+		if (view.HasMember("extensions") && view["extensions"].HasMember("EXT_meshopt_compression"))
+		{
+			// Points at the decoded buffer once decode_compressed_views() is done.
+			add_compressed_view(view["extensions"]["EXT_meshopt_compression"], uint32_t(json_views.size()), length);
+			json_views.push_back({ buffer_index, 0, length, stride });
+			return;
+		}
 
 		if (offset + length > json_buffers[buffer_index].size())
 			throw logic_error("Buffer view is out of range.");
 
-		auto stride = view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u;
 		json_views.push_back({buffer_index, offset, length, stride});
 	};
 
@@ -747,6 +810,12 @@ void Parser::parse(const string &original_path, const string &json)
 			auto &extras = primitive["extras"];
 			if (extras.HasMember("primitiveRestart"))
 				attr.primitive_restart = extras["primitiveRestart"].GetBool();
+			if (extras.HasMember("lods"))
+			{
+				auto &lods = extras["lods"];
+				for (auto itr = lods.Begin(); itr != lods.End(); ++itr)
+					attr.lods.push_back({ (*itr)["indices"].GetUint(), (*itr)["error"].GetFloat() });
+			}
 		}
 
 		auto &attrs = primitive["attributes"];
@@ -1340,6 +1409,7 @@ void Parser::parse(const string &original_path, const string &json)
 		iterate_elements(doc["buffers"], add_buffer);
 	if (doc.HasMember("bufferViews"))
 		iterate_elements(doc["bufferViews"], add_view);
+	decode_compressed_views();
 	if (doc.HasMember("images"))
 		iterate_elements(doc["images"], add_image);
 	if (doc.HasMember("samplers"))
@@ -1531,6 +1601,9 @@ void Parser::parse(const string &original_path, const string &json)
 
 	if (doc.HasMember("scene"))
 		default_scene_index = doc["scene"].GetUint();
+
+	// Everything has been extracted at this point, release the file mappings and decoded buffers.
+	json_buffers.clear();
 }
 
 static uint32_t padded_type_size(uint32_t type_size)
@@ -1542,9 +1615,8 @@ static uint32_t padded_type_size(uint32_t type_size)
 		return type_size;
 }
 
-void Parser::build_primitive(const MeshData::AttributeData &prim)
+void Parser::build_primitive(const MeshData::AttributeData &prim, Mesh &mesh) const
 {
-	Mesh mesh;
 	mesh.topology = prim.topology;
 	mesh.primitive_restart = prim.primitive_restart;
 	mesh.has_material = prim.has_material;
@@ -1727,6 +1799,11 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 				memcpy(&output[mesh.attribute_layout[i].offset + output_stride * v], weights, sizeof(weights));
 			}
 		}
+		else if (attr.stride == type_size && output_stride == type_size)
+		{
+			// The accessor already matches the output stream, e.g. tightly packed positions.
+			memcpy(output.data(), &buffer[view.offset + attr.offset], size_t(vertex_count) * type_size);
+		}
 		else
 		{
 			for (uint32_t v = 0; v < vertex_count; v++)
@@ -1760,6 +1837,12 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 				*outdata = uint16_t((*indata == 0xff) ? 0xffff : *indata);
 			}
 		}
+		else if (type_size == 2 && indices.stride == 2)
+		{
+			mesh.indices.resize(sizeof(uint16_t) * index_count);
+			mesh.index_type = VK_INDEX_TYPE_UINT16;
+			memcpy(mesh.indices.data(), &buffer[offset], mesh.indices.size());
+		}
 		else if (type_size == 2)
 		{
 			mesh.indices.resize(sizeof(uint16_t) * index_count);
@@ -1782,6 +1865,12 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 				*outdata = uint16_t(*indata);
 			}
 		}
+		else if (indices.stride == 4)
+		{
+			mesh.indices.resize(sizeof(uint32_t) * index_count);
+			mesh.index_type = VK_INDEX_TYPE_UINT32;
+			memcpy(mesh.indices.data(), &buffer[offset], mesh.indices.size());
+		}
 		else
 		{
 			mesh.indices.resize(sizeof(uint32_t) * index_count);
@@ -1794,32 +1883,202 @@ void Parser::build_primitive(const MeshData::AttributeData &prim)
 			}
 		}
 		mesh.count = index_count;
+
+		// LODs are appended after the full index range with the same index type.
+		for (auto &lod : prim.lods)
+		{
+			auto &lod_indices = json_accessors[lod.accessor_index];
+			auto &lod_view = json_views[lod_indices.view];
+			auto &lod_buffer = json_buffers[lod_view.buffer_index];
+			auto lod_type_size = type_stride(lod_indices.type);
+			auto lod_offset = lod_view.offset + lod_indices.offset;
+
+			MeshLod mesh_lod;
+			mesh_lod.count = lod_indices.count;
+			mesh_lod.error = lod.error;
+
+			if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+			{
+				mesh_lod.offset = uint32_t(mesh.indices.size() / sizeof(uint16_t));
+				mesh.indices.resize(mesh.indices.size() + sizeof(uint16_t) * mesh_lod.count);
+			}
+			else
+			{
+				mesh_lod.offset = uint32_t(mesh.indices.size() / sizeof(uint32_t));
+				mesh.indices.resize(mesh.indices.size() + sizeof(uint32_t) * mesh_lod.count);
+			}
+
+			for (uint32_t i = 0; i < mesh_lod.count; i++)
+			{
+				const uint8_t *indata = &lod_buffer[lod_indices.stride * i + lod_offset];
+				uint32_t index;
+				if (lod_type_size == 1)
+					index = *indata;
+				else if (lod_type_size == 2)
+					index = *reinterpret_cast<const uint16_t *>(indata);
+				else
+					index = *reinterpret_cast<const uint32_t *>(indata);
+
+				if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+					reinterpret_cast<uint16_t *>(mesh.indices.data())[mesh_lod.offset + i] = uint16_t(index);
+				else
+					reinterpret_cast<uint32_t *>(mesh.indices.data())[mesh_lod.offset + i] = index;
+			}
+
+			mesh.lods.push_back(mesh_lod);
+		}
 	}
 
 	if (rebuild_normals)
 		mesh_recompute_normals(mesh);
 	if (rebuild_tangents)
 		mesh_recompute_tangents(mesh);
+}
 
-	meshes.push_back(move(mesh));
+void Parser::decode_compressed_view(const CompressedView &view, const uint8_t *data, vector<uint8_t> &decoded)
+{
+	decoded.resize(size_t(view.stride) * view.count);
+
+	int ret;
+	switch (view.mode)
+	{
+	case CompressedView::Mode::Attributes:
+		ret = meshopt_decodeVertexBuffer(decoded.data(), view.count, view.stride, data, view.length);
+		break;
+	case CompressedView::Mode::Triangles:
+		ret = meshopt_decodeIndexBuffer(decoded.data(), view.count, view.stride, data, view.length);
+		break;
+	default:
+		ret = meshopt_decodeIndexSequence(decoded.data(), view.count, view.stride, data, view.length);
+		break;
+	}
+
+	if (ret != 0)
+		throw logic_error("Failed to decode meshopt compressed buffer view.");
+
+	switch (view.filter)
+	{
+	case CompressedView::Filter::Octahedral:
+		meshopt_decodeFilterOct(decoded.data(), view.count, view.stride);
+		break;
+	case CompressedView::Filter::Quaternion:
+		meshopt_decodeFilterQuat(decoded.data(), view.count, view.stride);
+		break;
+	case CompressedView::Filter::Exponential:
+		meshopt_decodeFilterExp(decoded.data(), view.count, view.stride);
+		break;
+	default:
+		break;
+	}
+}
+
+void Parser::decode_compressed_views()
+{
+	if (json_compressed_views.empty())
+		return;
+
+	std::vector<std::vector<uint8_t>> decoded(json_compressed_views.size());
+
+	// Same rules as build_meshes(), the codecs run at GB/s, so only go wide for larger scenes.
+	auto *group = GRANITE_THREAD_GROUP();
+	bool parallel = group && json_compressed_views.size() > 1 &&
+	                (!ThreadGroup::current_thread_is_worker() || ThreadGroup::current_task_is_suspendable());
+
+	if (parallel)
+	{
+		std::vector<std::exception_ptr> errors(json_compressed_views.size());
+		auto task = group->create_task();
+		task->set_desc("gltf-decode-meshopt");
+		for (size_t i = 0; i < json_compressed_views.size(); i++)
+		{
+			task->enqueue_task([this, &decoded, &errors, i]() {
+				try
+				{
+					auto &view = json_compressed_views[i];
+					decode_compressed_view(view, json_buffers[view.buffer_index].data() + view.offset, decoded[i]);
+				}
+				catch (...)
+				{
+					errors[i] = std::current_exception();
+				}
+			});
+		}
+		task->wait();
+
+		for (auto &error : errors)
+			if (error)
+				std::rethrow_exception(error);
+	}
+	else
+	{
+		for (size_t i = 0; i < json_compressed_views.size(); i++)
+		{
+			auto &view = json_compressed_views[i];
+			decode_compressed_view(view, json_buffers[view.buffer_index].data() + view.offset, decoded[i]);
+		}
+	}
+
+	for (size_t i = 0; i < json_compressed_views.size(); i++)
+	{
+		auto &view = json_views[json_compressed_views[i].view];
+		view.buffer_index = uint32_t(json_buffers.size());
+		view.offset = 0;
+		json_buffers.emplace_back(move(decoded[i]));
+	}
+	json_compressed_views.clear();
 }
 
 void Parser::build_meshes()
 {
 	mesh_index_to_primitives.resize(json_meshes.size());
-	uint32_t primitive_count = 0;
+	std::vector<const MeshData::AttributeData *> primitives;
 	uint32_t mesh_count = 0;
 
 	for (auto &mesh : json_meshes)
 	{
 		for (auto &prim : mesh.primitives)
 		{
-			mesh_index_to_primitives[mesh_count].push_back(primitive_count);
-			build_primitive(prim);
-			primitive_count++;
+			mesh_index_to_primitives[mesh_count].push_back(uint32_t(primitives.size()));
+			primitives.push_back(&prim);
 		}
 		mesh_count++;
 	}
+
+	meshes.resize(primitives.size());
+
+	// Waiting on a worker thread which cannot suspend would stall it, so only go wide from outside the group.
+	auto *group = GRANITE_THREAD_GROUP();
+	bool parallel = group && primitives.size() > 1 &&
+	                (!ThreadGroup::current_thread_is_worker() || ThreadGroup::current_task_is_suspendable());
+
+	if (!parallel)
+	{
+		for (size_t i = 0; i < primitives.size(); i++)
+			build_primitive(*primitives[i], meshes[i]);
+		return;
+	}
+
+	std::vector<std::exception_ptr> errors(primitives.size());
+	auto task = group->create_task();
+	task->set_desc("gltf-build-meshes");
+	for (size_t i = 0; i < primitives.size(); i++)
+	{
+		task->enqueue_task([this, &primitives, &errors, i]() {
+			try
+			{
+				build_primitive(*primitives[i], meshes[i]);
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+	task->wait();
+
+	for (auto &error : errors)
+		if (error)
+			std::rethrow_exception(error);
 }
 
 }
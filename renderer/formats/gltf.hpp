@@ -24,9 +24,15 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include "math.hpp"
 #include "scene_formats.hpp"
 
+namespace Granite
+{
+class File;
+}
+
 namespace GLTF
 {
 using namespace Granite;
@@ -108,7 +114,34 @@ public:
 	}
 
 private:
-	using Buffer = std::vector<uint8_t>;
+	// Either owns its bytes (base64 URIs), or points straight into a mapped GLB or .bin file.
+	class Buffer
+	{
+	public:
+		explicit Buffer(std::vector<uint8_t> owned_data);
+		Buffer(std::shared_ptr<Granite::File> file, const uint8_t *data, size_t size);
+
+		const uint8_t *data() const
+		{
+			return ptr;
+		}
+
+		size_t size() const
+		{
+			return length;
+		}
+
+		const uint8_t &operator[](size_t index) const
+		{
+			return ptr[index];
+		}
+
+	private:
+		std::vector<uint8_t> owned;
+		std::shared_ptr<Granite::File> mapping;
+		const uint8_t *ptr = nullptr;
+		size_t length = 0;
+	};
 
 	struct BufferView
 	{
@@ -118,6 +151,34 @@ private:
 		uint32_t stride;
 	};
 
+	// EXT_meshopt_compression views, decoded into their own buffers once all views are parsed.
+	struct CompressedView
+	{
+		enum class Mode
+		{
+			Attributes,
+			Triangles,
+			Indices
+		};
+
+		enum class Filter
+		{
+			None,
+			Octahedral,
+			Quaternion,
+			Exponential
+		};
+
+		uint32_t view;
+		uint32_t buffer_index;
+		uint32_t offset;
+		uint32_t length;
+		uint32_t stride;
+		uint32_t count;
+		Mode mode;
+		Filter filter;
+	};
+
 	struct Accessor
 	{
 		uint32_t view;
@@ -147,6 +208,12 @@ private:
 			};
 			Buffer attributes[Util::ecast(Granite::MeshAttribute::Count)] = {};
 			Buffer index_buffer;
+			struct Lod
+			{
+				uint32_t accessor_index;
+				float error;
+			};
+			std::vector<Lod> lods;
 			uint32_t material_index;
 			VkPrimitiveTopology topology;
 			bool has_material;
@@ -174,6 +241,7 @@ private:
 
 	std::vector<Buffer> json_buffers;
 	std::vector<BufferView> json_views;
+	std::vector<CompressedView> json_compressed_views;
 	std::vector<Accessor> json_accessors;
 	std::vector<MeshData> json_meshes;
 	std::vector<MaterialInfo::Texture> json_images;
@@ -194,7 +262,9 @@ private:
 	uint32_t default_scene_index = 0;
 
 	void build_meshes();
-	void build_primitive(const MeshData::AttributeData &prim);
+	void decode_compressed_views();
+	static void decode_compressed_view(const CompressedView &view, const uint8_t *data, std::vector<uint8_t> &decoded);
+	void build_primitive(const MeshData::AttributeData &prim, Mesh &mesh) const;
 
 	void extract_attribute(std::vector<float> &attributes, const Accessor &accessor);
 	void extract_attribute(std::vector<vec3> &attributes, const Accessor &accessor);
@@ -0,0 +1,262 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "native_scene.hpp"
+#include "filesystem.hpp"
+#include <stdexcept>
+#include <string.h>
+
+using namespace std;
+
+namespace Granite
+{
+namespace SceneFormats
+{
+using namespace NativeScene;
+
+struct NativeSceneReader
+{
+	const uint8_t *data;
+	size_t size;
+
+	void check_range(const Range &range, uint64_t alignment) const
+	{
+		if (range.offset > size || range.size > size - range.offset)
+			throw logic_error("Native scene range is out of bounds.");
+		if (range.offset & (alignment - 1))
+			throw logic_error("Native scene range is misaligned.");
+	}
+
+	template <typename T>
+	vector<T> read_table(const Range &range) const
+	{
+		check_range(range, BlobAlignment);
+		if (range.size % sizeof(T))
+			throw logic_error("Native scene table size mismatch.");
+		vector<T> table(range.size / sizeof(T));
+		if (!table.empty())
+			memcpy(table.data(), data + range.offset, range.size);
+		return table;
+	}
+
+	void read_blob(vector<uint8_t> &blob, const Range &range) const
+	{
+		check_range(range, BlobAlignment);
+		blob.resize(range.size);
+		if (range.size)
+			memcpy(blob.data(), data + range.offset, range.size);
+	}
+
+	string read_string(const Range &strings, const StringRef &ref) const
+	{
+		if (ref.offset > strings.size || ref.length > strings.size - ref.offset)
+			throw logic_error("Native scene string is out of bounds.");
+		auto *str = reinterpret_cast<const char *>(data + strings.offset + ref.offset);
+		return string(str, str + ref.length);
+	}
+};
+
+static void read_pool(vector<uint32_t> &out, const vector<uint32_t> &pool, uint32_t first, uint32_t count)
+{
+	if (first > pool.size() || count > pool.size() - first)
+		throw logic_error("Native scene node indices are out of bounds.");
+	out.assign(pool.begin() + first, pool.begin() + first + count);
+}
+
+NativeSceneParser::NativeSceneParser(const string &path)
+{
+	auto file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
+	if (!file)
+		throw runtime_error("Failed to open native scene.");
+
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		throw runtime_error("Failed to map native scene.");
+
+	NativeSceneReader reader = { mapped, file->get_size() };
+
+	Header header;
+	if (reader.size < sizeof(header))
+		throw logic_error("Native scene is too small.");
+	memcpy(&header, mapped, sizeof(header));
+
+	if (header.magic != Magic)
+		throw logic_error("Not a native scene.");
+	if (header.version != Version)
+		throw logic_error("Native scene version mismatch, re-export the scene.");
+
+	reader.check_range(header.strings, 1);
+
+	// Texture payloads are handed to the texture manager through memory:// files, like GLB buffer views.
+	auto texture_table = reader.read_table<TextureEntry>(header.textures);
+	vector<string> texture_paths;
+	texture_paths.reserve(texture_table.size());
+	for (auto &tex : texture_table)
+	{
+		auto texture_path = reader.read_string(header.strings, tex.path);
+		if (tex.payload.size)
+		{
+			reader.check_range(tex.payload, TextureAlignment);
+			auto memory_path = "memory://" + path + "_texture_" + to_string(texture_paths.size());
+
+			auto memory_file = GRANITE_FILESYSTEM()->open(memory_path, FileMode::WriteOnly);
+			if (!memory_file)
+				throw runtime_error("Failed to open memory file.");
+
+			void *payload = memory_file->map_write(tex.payload.size);
+			if (!payload)
+				throw runtime_error("Failed to map memory file.");
+			memcpy(payload, mapped + tex.payload.offset, tex.payload.size);
+			texture_path = move(memory_path);
+		}
+		texture_paths.push_back(move(texture_path));
+	}
+
+	const auto resolve_texture = [&](uint32_t index) -> MaterialInfo::Texture {
+		if (index == InvalidIndex)
+			return {};
+		if (index >= texture_paths.size())
+			throw logic_error("Native scene texture index is out of bounds.");
+		return MaterialInfo::Texture(texture_paths[index]);
+	};
+
+	for (auto &entry : reader.read_table<MaterialEntry>(header.materials))
+	{
+		MaterialInfo info;
+		info.base_color = resolve_texture(entry.base_color);
+		info.normal = resolve_texture(entry.normal);
+		info.metallic_roughness = resolve_texture(entry.metallic_roughness);
+		info.occlusion = resolve_texture(entry.occlusion);
+		info.emissive = resolve_texture(entry.emissive);
+		info.uniform_base_color = vec4(entry.uniform_base_color[0], entry.uniform_base_color[1],
+		                               entry.uniform_base_color[2], entry.uniform_base_color[3]);
+		info.uniform_emissive_color = vec3(entry.uniform_emissive_color[0], entry.uniform_emissive_color[1],
+		                                   entry.uniform_emissive_color[2]);
+		info.uniform_metallic = entry.uniform_metallic;
+		info.uniform_roughness = entry.uniform_roughness;
+		info.normal_scale = entry.normal_scale;
+		info.pipeline = DrawPipeline(entry.pipeline);
+		info.sampler = Vulkan::StockSampler(entry.sampler);
+		info.two_sided = (entry.flags & MATERIAL_TWO_SIDED_BIT) != 0;
+		info.bandlimited_pixel = (entry.flags & MATERIAL_BANDLIMITED_PIXEL_BIT) != 0;
+		materials.push_back(move(info));
+	}
+
+	auto mesh_table = reader.read_table<MeshEntry>(header.meshes);
+	meshes.resize(mesh_table.size());
+	for (size_t i = 0; i < mesh_table.size(); i++)
+	{
+		auto &entry = mesh_table[i];
+		auto &mesh = meshes[i];
+
+		reader.read_blob(mesh.positions, entry.positions);
+		reader.read_blob(mesh.attributes, entry.attributes);
+		reader.read_blob(mesh.indices, entry.indices);
+		mesh.meshlets = reader.read_table<Meshlet>(entry.meshlets);
+		mesh.lods = reader.read_table<MeshLod>(entry.lods);
+
+		mesh.position_stride = entry.position_stride;
+		mesh.attribute_stride = entry.attribute_stride;
+		for (uint32_t attr = 0; attr < Util::ecast(MeshAttribute::Count); attr++)
+		{
+			mesh.attribute_layout[attr].format = VkFormat(entry.attribute_formats[attr]);
+			mesh.attribute_layout[attr].offset = entry.attribute_offsets[attr];
+		}
+
+		mesh.index_type = VkIndexType(entry.index_type);
+		mesh.topology = VkPrimitiveTopology(entry.topology);
+		mesh.material_index = entry.material_index;
+		mesh.has_material = (entry.flags & MESH_HAS_MATERIAL_BIT) != 0;
+		mesh.primitive_restart = (entry.flags & MESH_PRIMITIVE_RESTART_BIT) != 0;
+		mesh.static_aabb = AABB(vec3(entry.aabb_min[0], entry.aabb_min[1], entry.aabb_min[2]),
+		                        vec3(entry.aabb_max[0], entry.aabb_max[1], entry.aabb_max[2]));
+		mesh.count = entry.count;
+
+		if (mesh.has_material && mesh.material_index >= materials.size())
+			throw logic_error("Native scene material index is out of bounds.");
+	}
+
+	auto node_pool = reader.read_table<uint32_t>(header.node_indices);
+	auto node_table = reader.read_table<NodeEntry>(header.nodes);
+	nodes.resize(node_table.size());
+	for (size_t i = 0; i < node_table.size(); i++)
+	{
+		auto &entry = node_table[i];
+		auto &node = nodes[i];
+		node.transform.scale = vec3(entry.scale[0], entry.scale[1], entry.scale[2]);
+		node.transform.rotation = quat(entry.rotation[3], entry.rotation[0], entry.rotation[1], entry.rotation[2]);
+		node.transform.translation = vec3(entry.translation[0], entry.translation[1], entry.translation[2]);
+		read_pool(node.children, node_pool, entry.first_child, entry.child_count);
+		read_pool(node.meshes, node_pool, entry.first_mesh, entry.mesh_count);
+
+		for (auto child : node.children)
+			if (child >= node_table.size())
+				throw logic_error("Native scene child index is out of bounds.");
+		for (auto mesh : node.meshes)
+			if (mesh >= meshes.size())
+				throw logic_error("Native scene mesh index is out of bounds.");
+	}
+
+	for (auto &entry : reader.read_table<LightEntry>(header.lights))
+	{
+		LightInfo light;
+		light.name = reader.read_string(header.strings, entry.name);
+		light.node_index = entry.node_index;
+		light.type = LightInfo::Type(entry.type);
+		light.attached_to_node = (entry.flags & ATTACHED_TO_NODE_BIT) != 0;
+		light.inner_cone = entry.inner_cone;
+		light.outer_cone = entry.outer_cone;
+		light.color = vec3(entry.color[0], entry.color[1], entry.color[2]);
+		light.range = entry.range;
+		if (light.attached_to_node && light.node_index >= nodes.size())
+			throw logic_error("Native scene light node is out of bounds.");
+		lights.push_back(move(light));
+	}
+
+	for (auto &entry : reader.read_table<CameraEntry>(header.cameras))
+	{
+		CameraInfo camera;
+		camera.name = reader.read_string(header.strings, entry.name);
+		camera.node_index = entry.node_index;
+		camera.type = CameraInfo::Type(entry.type);
+		camera.attached_to_node = (entry.flags & ATTACHED_TO_NODE_BIT) != 0;
+		camera.aspect_ratio = entry.aspect_ratio;
+		camera.znear = entry.znear;
+		camera.zfar = entry.zfar;
+		camera.yfov = entry.yfov;
+		camera.xmag = entry.xmag;
+		camera.ymag = entry.ymag;
+		if (camera.attached_to_node && camera.node_index >= nodes.size())
+			throw logic_error("Native scene camera node is out of bounds.");
+		cameras.push_back(move(camera));
+	}
+
+	SceneNodes scene;
+	scene.name = reader.read_string(header.strings, header.scene_name);
+	scene.node_indices = reader.read_table<uint32_t>(header.scene_nodes);
+	for (auto index : scene.node_indices)
+		if (index >= nodes.size())
+			throw logic_error("Native scene root node is out of bounds.");
+	scenes.push_back(move(scene));
+}
+}
+}
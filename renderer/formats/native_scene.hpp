@@ -0,0 +1,236 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "scene_formats.hpp"
+
+namespace Granite
+{
+namespace SceneFormats
+{
+// Native scene container, written by export_scene_to_native() in scene-export and loaded by SceneLoader (.gscene).
+// Meshes are stored exactly as SceneFormats::Mesh holds them, including meshlets and LODs,
+// so loading is a matter of validating ranges and copying blobs, no parsing or conversion.
+// The file is little endian. Blobs are aligned to BlobAlignment and texture payloads to TextureAlignment.
+// Skins and animations are not supported.
+namespace NativeScene
+{
+enum : uint32_t
+{
+	Magic = 0x4e435347, // "GSCN"
+	Version = 1,
+	BlobAlignment = 16,
+	TextureAlignment = 64 * 1024,
+	InvalidIndex = ~0u
+};
+
+enum : uint32_t
+{
+	MESH_HAS_MATERIAL_BIT = 1 << 0,
+	MESH_PRIMITIVE_RESTART_BIT = 1 << 1,
+	MATERIAL_TWO_SIDED_BIT = 1 << 0,
+	MATERIAL_BANDLIMITED_PIXEL_BIT = 1 << 1,
+	ATTACHED_TO_NODE_BIT = 1 << 0
+};
+
+// Byte range from the start of the file. Tables are arrays of the matching entry type.
+struct Range
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct StringRef
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct Header
+{
+	uint32_t magic;
+	uint32_t version;
+	Range meshes;
+	Range materials;
+	Range textures;
+	Range nodes;
+	// uint32_t pool which nodes index into for children and meshes.
+	Range node_indices;
+	Range lights;
+	Range cameras;
+	// uint32_t root nodes of the scene.
+	Range scene_nodes;
+	Range strings;
+	StringRef scene_name;
+};
+
+struct MeshEntry
+{
+	Range positions;
+	Range attributes;
+	Range indices;
+	Range meshlets;
+	Range lods;
+	uint32_t attribute_formats[Util::ecast(MeshAttribute::Count)];
+	uint32_t attribute_offsets[Util::ecast(MeshAttribute::Count)];
+	uint32_t position_stride;
+	uint32_t attribute_stride;
+	uint32_t index_type;
+	uint32_t topology;
+	uint32_t material_index;
+	uint32_t count;
+	uint32_t flags;
+	float aabb_min[3];
+	float aabb_max[3];
+	uint32_t padding;
+};
+
+// Textures are indices into the texture table, or InvalidIndex.
+struct MaterialEntry
+{
+	uint32_t base_color;
+	uint32_t normal;
+	uint32_t metallic_roughness;
+	uint32_t occlusion;
+	uint32_t emissive;
+	float uniform_base_color[4];
+	float uniform_emissive_color[3];
+	float uniform_metallic;
+	float uniform_roughness;
+	float normal_scale;
+	uint32_t pipeline;
+	uint32_t sampler;
+	uint32_t flags;
+};
+
+// An empty payload means the texture is loaded from path as usual.
+struct TextureEntry
+{
+	StringRef path;
+	Range payload;
+};
+
+struct NodeEntry
+{
+	float scale[3];
+	float rotation[4];
+	float translation[3];
+	uint32_t first_child;
+	uint32_t child_count;
+	uint32_t first_mesh;
+	uint32_t mesh_count;
+};
+
+struct LightEntry
+{
+	StringRef name;
+	uint32_t node_index;
+	uint32_t type;
+	uint32_t flags;
+	float inner_cone;
+	float outer_cone;
+	float color[3];
+	float range;
+};
+
+struct CameraEntry
+{
+	StringRef name;
+	uint32_t node_index;
+	uint32_t type;
+	uint32_t flags;
+	float aspect_ratio;
+	float znear;
+	float zfar;
+	float yfov;
+	float xmag;
+	float ymag;
+};
+}
+
+// Loads a .gscene file. Embedded texture payloads are exposed as memory:// files which the materials point to.
+class NativeSceneParser
+{
+public:
+	explicit NativeSceneParser(const std::string &path);
+
+	const std::vector<Mesh> &get_meshes() const
+	{
+		return meshes;
+	}
+
+	const std::vector<MaterialInfo> &get_materials() const
+	{
+		return materials;
+	}
+
+	const std::vector<Node> &get_nodes() const
+	{
+		return nodes;
+	}
+
+	const std::vector<LightInfo> &get_lights() const
+	{
+		return lights;
+	}
+
+	const std::vector<CameraInfo> &get_cameras() const
+	{
+		return cameras;
+	}
+
+	const std::vector<Skin> &get_skins() const
+	{
+		return skins;
+	}
+
+	const std::vector<Animation> &get_animations() const
+	{
+		return animations;
+	}
+
+	const std::vector<SceneNodes> &get_scenes() const
+	{
+		return scenes;
+	}
+
+	uint32_t get_default_scene() const
+	{
+		return 0;
+	}
+
+private:
+	std::vector<Mesh> meshes;
+	std::vector<MaterialInfo> materials;
+	std::vector<Node> nodes;
+	std::vector<LightInfo> lights;
+	std::vector<CameraInfo> cameras;
+	std::vector<Skin> skins;
+	std::vector<Animation> animations;
+	std::vector<SceneNodes> scenes;
+};
+}
+}
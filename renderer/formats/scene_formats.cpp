@@ -237,6 +237,8 @@ void mesh_deduplicate_vertices(Mesh &mesh)
 	for (size_t i = 0; i < count; i++)
 		reinterpret_cast<uint32_t *>(mesh.indices.data())[i] = index_buffer[i];
 	mesh.count = unsigned(index_buffer.size());
+	// LODs reference the old vertices.
+	mesh.lods.clear();
 }
 
 Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify)
@@ -324,6 +326,180 @@ Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify)
 	return optimized;
 }
 
+static size_t mesh_index_size(const Mesh &mesh)
+{
+	return mesh.index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Returns the full index range as 32-bit indices, or a trivial index buffer for unindexed meshes.
+static vector<uint32_t> mesh_unpack_indices(const Mesh &mesh)
+{
+	vector<uint32_t> index_buffer(mesh.count);
+	if (mesh.indices.empty())
+	{
+		for (uint32_t i = 0; i < mesh.count; i++)
+			index_buffer[i] = i;
+	}
+	else if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+	{
+		auto *indices = reinterpret_cast<const uint16_t *>(mesh.indices.data());
+		for (uint32_t i = 0; i < mesh.count; i++)
+			index_buffer[i] = indices[i];
+	}
+	else
+		memcpy(index_buffer.data(), mesh.indices.data(), mesh.count * sizeof(uint32_t));
+
+	return index_buffer;
+}
+
+bool mesh_build_meshlets(Mesh &mesh)
+{
+	if (mesh.topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST || mesh.primitive_restart)
+		return false;
+
+	auto &position = mesh.attribute_layout[ecast(MeshAttribute::Position)];
+	if (position.format != VK_FORMAT_R32G32B32_SFLOAT && position.format != VK_FORMAT_R32G32B32A32_SFLOAT)
+		return false;
+
+	size_t vertex_count = mesh.positions.size() / mesh.position_stride;
+	auto index_buffer = mesh_unpack_indices(mesh);
+
+	// LODs live past the full index range, keep them around.
+	vector<uint8_t> lod_indices;
+	if (!mesh.lods.empty())
+		lod_indices.assign(mesh.indices.begin() + mesh.count * mesh_index_size(mesh), mesh.indices.end());
+
+	constexpr size_t max_vertices = 64;
+	constexpr size_t max_triangles = 124;
+	constexpr float cone_weight = 0.25f;
+
+	size_t max_meshlets = meshopt_buildMeshletsBound(index_buffer.size(), max_vertices, max_triangles);
+	vector<meshopt_Meshlet> meshlets(max_meshlets);
+	vector<unsigned> meshlet_vertices(max_meshlets * max_vertices);
+	vector<unsigned char> meshlet_triangles(max_meshlets * max_triangles * 3);
+
+	auto *positions = reinterpret_cast<const float *>(mesh.positions.data() + position.offset);
+	size_t meshlet_count = meshopt_buildMeshlets(meshlets.data(), meshlet_vertices.data(), meshlet_triangles.data(),
+	                                             index_buffer.data(), index_buffer.size(),
+	                                             positions, vertex_count, mesh.position_stride,
+	                                             max_vertices, max_triangles, cone_weight);
+
+	vector<uint32_t> meshlet_indices;
+	meshlet_indices.reserve(index_buffer.size());
+	mesh.meshlets.clear();
+	mesh.meshlets.reserve(meshlet_count);
+
+	for (size_t i = 0; i < meshlet_count; i++)
+	{
+		auto &m = meshlets[i];
+		auto bounds = meshopt_computeMeshletBounds(&meshlet_vertices[m.vertex_offset],
+		                                           &meshlet_triangles[m.triangle_offset],
+		                                           m.triangle_count, positions, vertex_count,
+		                                           mesh.position_stride);
+
+		Meshlet meshlet = {};
+		meshlet.index_offset = uint32_t(meshlet_indices.size());
+		meshlet.index_count = m.triangle_count * 3;
+		meshlet.center = vec3(bounds.center[0], bounds.center[1], bounds.center[2]);
+		meshlet.radius = bounds.radius;
+		meshlet.cone_axis = vec3(bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2]);
+		meshlet.cone_cutoff = bounds.cone_cutoff;
+		mesh.meshlets.push_back(meshlet);
+
+		for (unsigned j = 0; j < m.triangle_count * 3; j++)
+			meshlet_indices.push_back(meshlet_vertices[m.vertex_offset + meshlet_triangles[m.triangle_offset + j]]);
+	}
+
+	// Keep the index type, the vertices are untouched.
+	if (mesh.indices.empty())
+		mesh.index_type = vertex_count <= 0xffff ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+	{
+		mesh.indices.resize(meshlet_indices.size() * sizeof(uint16_t));
+		auto *indices = reinterpret_cast<uint16_t *>(mesh.indices.data());
+		for (size_t i = 0; i < meshlet_indices.size(); i++)
+			indices[i] = uint16_t(meshlet_indices[i]);
+	}
+	else
+	{
+		mesh.indices.resize(meshlet_indices.size() * sizeof(uint32_t));
+		memcpy(mesh.indices.data(), meshlet_indices.data(), meshlet_indices.size() * sizeof(uint32_t));
+	}
+
+	int32_t lod_delta = int32_t(meshlet_indices.size()) - int32_t(mesh.count);
+	mesh.indices.insert(mesh.indices.end(), lod_indices.begin(), lod_indices.end());
+	for (auto &lod : mesh.lods)
+		lod.offset += lod_delta;
+
+	mesh.count = uint32_t(meshlet_indices.size());
+	return true;
+}
+
+bool mesh_build_lods(Mesh &mesh, unsigned max_lods, float reduction)
+{
+	if (mesh.topology != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST || mesh.primitive_restart || mesh.indices.empty())
+		return false;
+
+	auto &position = mesh.attribute_layout[ecast(MeshAttribute::Position)];
+	if (position.format != VK_FORMAT_R32G32B32_SFLOAT && position.format != VK_FORMAT_R32G32B32A32_SFLOAT)
+		return false;
+
+	size_t vertex_count = mesh.positions.size() / mesh.position_stride;
+	auto index_buffer = mesh_unpack_indices(mesh);
+	auto *positions = reinterpret_cast<const float *>(mesh.positions.data() + position.offset);
+
+	size_t index_size = mesh_index_size(mesh);
+	mesh.indices.resize(mesh.count * index_size);
+	mesh.lods.clear();
+
+	// Errors from the simplifier are relative to the mesh extent.
+	float scale = meshopt_simplifyScale(positions, vertex_count, mesh.position_stride);
+	float target_error = 0.01f;
+	size_t target_count = index_buffer.size();
+	size_t last_count = index_buffer.size();
+	vector<uint32_t> lod(index_buffer.size());
+
+	for (unsigned i = 0; i < max_lods; i++)
+	{
+		target_count = size_t(float(target_count) * reduction) / 3 * 3;
+		if (target_count < 3)
+			break;
+
+		// Always simplify the full mesh so errors do not accumulate through the chain.
+		size_t lod_count = meshopt_simplify(lod.data(), index_buffer.data(), index_buffer.size(),
+		                                    positions, vertex_count, mesh.position_stride,
+		                                    target_count, target_error);
+
+		// The error bound stopped the simplifier early, a coarser level would not be worth it.
+		if (lod_count == 0 || float(lod_count) > 0.9f * float(last_count))
+			break;
+
+		meshopt_optimizeVertexCache(lod.data(), lod.data(), lod_count, vertex_count);
+
+		MeshLod mesh_lod;
+		mesh_lod.offset = uint32_t(mesh.indices.size() / index_size);
+		mesh_lod.count = uint32_t(lod_count);
+		mesh_lod.error = target_error * scale;
+		mesh.lods.push_back(mesh_lod);
+
+		mesh.indices.resize(mesh.indices.size() + lod_count * index_size);
+		if (mesh.index_type == VK_INDEX_TYPE_UINT16)
+		{
+			auto *indices = reinterpret_cast<uint16_t *>(mesh.indices.data()) + mesh_lod.offset;
+			for (size_t j = 0; j < lod_count; j++)
+				indices[j] = uint16_t(lod[j]);
+		}
+		else
+			memcpy(mesh.indices.data() + mesh_lod.offset * index_size, lod.data(), lod_count * sizeof(uint32_t));
+
+		last_count = lod_count;
+		target_error *= 2.0f;
+	}
+
+	return !mesh.lods.empty();
+}
+
 bool mesh_recompute_tangents(Mesh &mesh)
 {
 	if (mesh.attribute_layout[ecast(MeshAttribute::Tangent)].format != VK_FORMAT_R32G32B32A32_SFLOAT)
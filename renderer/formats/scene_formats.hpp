@@ -253,6 +253,12 @@ struct Mesh
 	// AABB
 	Granite::AABB static_aabb;
 
+	// Optional, see mesh_build_meshlets().
+	std::vector<Meshlet> meshlets;
+
+	// Optional, see mesh_build_lods(). The indices follow the full index range.
+	std::vector<MeshLod> lods;
+
 	uint32_t count = 0;
 };
 
@@ -284,6 +290,12 @@ bool extract_collision_mesh(CollisionMesh &collision_mesh, const Mesh &mesh);
 
 void mesh_deduplicate_vertices(Mesh &mesh);
 Mesh mesh_optimize_index_buffer(const Mesh &mesh, bool stripify);
+// Splits a triangle list into meshlets with culling bounds, and reorders the index buffer to match.
+// Requires 32-bit float positions.
+bool mesh_build_meshlets(Mesh &mesh);
+// Appends up to max_lods simplified index ranges, each with about reduction times the triangles of the previous one.
+// Requires an indexed triangle list with 32-bit float positions.
+bool mesh_build_lods(Mesh &mesh, unsigned max_lods = 4, float reduction = 0.5f);
 std::unordered_set<uint32_t> build_used_nodes_in_scene(const SceneNodes &scene, const std::vector<Node> &nodes);
 }
 }
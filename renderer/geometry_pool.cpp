@@ -0,0 +1,254 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "geometry_pool.hpp"
+#include "device.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace Granite
+{
+GeometryPool::RangeAllocator::RangeAllocator(uint32_t capacity)
+{
+	free_ranges[0] = capacity;
+}
+
+bool GeometryPool::RangeAllocator::allocate(uint32_t count, uint32_t &offset)
+{
+	for (auto itr = free_ranges.begin(); itr != free_ranges.end(); ++itr)
+	{
+		if (itr->second < count)
+			continue;
+
+		offset = itr->first;
+		uint32_t remaining = itr->second - count;
+		free_ranges.erase(itr);
+		if (remaining)
+			free_ranges[offset + count] = remaining;
+		return true;
+	}
+
+	return false;
+}
+
+void GeometryPool::RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+	auto next = free_ranges.lower_bound(offset);
+	if (next != free_ranges.end() && offset + count == next->first)
+	{
+		count += next->second;
+		next = free_ranges.erase(next);
+	}
+
+	if (next != free_ranges.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += count;
+			return;
+		}
+	}
+
+	free_ranges[offset] = count;
+}
+
+GeometryPool::GeometryPool()
+{
+	EVENT_MANAGER_REGISTER_LATCH(GeometryPool, on_device_created, on_device_destroyed, Vulkan::DeviceCreatedEvent);
+}
+
+void GeometryPool::on_device_created(const Vulkan::DeviceCreatedEvent &)
+{
+}
+
+void GeometryPool::on_device_destroyed(const Vulkan::DeviceCreatedEvent &)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	vertex_blocks.clear();
+	index_blocks.clear();
+	generation++;
+}
+
+static Vulkan::BufferHandle create_block_buffer(Vulkan::Device &device, VkBufferUsageFlags usage, VkDeviceSize size)
+{
+	Vulkan::BufferCreateInfo info = {};
+	info.domain = Vulkan::BufferDomain::Device;
+	info.usage = usage;
+	info.size = size;
+	info.tag = Vulkan::AllocationTag::Mesh;
+	return device.create_buffer(info);
+}
+
+int GeometryPool::allocate_vertices(Vulkan::Device &device, uint32_t position_stride, uint32_t attribute_stride,
+                                    uint32_t count, uint32_t &offset)
+{
+	for (size_t i = 0; i < vertex_blocks.size(); i++)
+	{
+		auto &block = *vertex_blocks[i];
+		if (block.position_stride == position_stride && block.attribute_stride == attribute_stride &&
+		    block.ranges.allocate(count, offset))
+		{
+			return int(i);
+		}
+	}
+
+	uint32_t capacity = std::max<uint32_t>(count, VertexBlockSize);
+	auto positions = create_block_buffer(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	                                     VkDeviceSize(capacity) * position_stride);
+	if (!positions)
+		return -1;
+
+	Vulkan::BufferHandle attributes;
+	if (attribute_stride)
+	{
+		attributes = create_block_buffer(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		                                 VkDeviceSize(capacity) * attribute_stride);
+		if (!attributes)
+			return -1;
+	}
+
+	vertex_blocks.emplace_back(new VertexBlock{ position_stride, attribute_stride,
+	                                            std::move(positions), std::move(attributes),
+	                                            RangeAllocator(capacity) });
+	vertex_blocks.back()->ranges.allocate(count, offset);
+	return int(vertex_blocks.size() - 1);
+}
+
+int GeometryPool::allocate_indices(Vulkan::Device &device, VkIndexType index_type, uint32_t count, uint32_t &offset)
+{
+	for (size_t i = 0; i < index_blocks.size(); i++)
+	{
+		auto &block = *index_blocks[i];
+		if (block.index_type == index_type && block.ranges.allocate(count, offset))
+			return int(i);
+	}
+
+	uint32_t capacity = std::max<uint32_t>(count, IndexBlockSize);
+	auto indices = create_block_buffer(device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	                                   VkDeviceSize(capacity) * (index_type == VK_INDEX_TYPE_UINT32 ? 4 : 2));
+	if (!indices)
+		return -1;
+
+	index_blocks.emplace_back(new IndexBlock{ index_type, std::move(indices), RangeAllocator(capacity) });
+	index_blocks.back()->ranges.allocate(count, offset);
+	return int(index_blocks.size() - 1);
+}
+
+bool GeometryPool::allocate(Vulkan::Device &device, const SceneFormats::Mesh &mesh, Allocation &allocation)
+{
+	if (!mesh.position_stride || mesh.positions.empty())
+		return false;
+	if (!mesh.indices.empty() && mesh.index_type != VK_INDEX_TYPE_UINT16 && mesh.index_type != VK_INDEX_TYPE_UINT32)
+		return false;
+
+	uint32_t index_size = mesh.index_type == VK_INDEX_TYPE_UINT32 ? 4 : 2;
+	uint32_t num_vertices = uint32_t(mesh.positions.size() / mesh.position_stride);
+	uint32_t num_indices = uint32_t(mesh.indices.size() / index_size);
+
+	uint32_t vertex_offset = 0;
+	uint32_t index_offset = 0;
+	const VertexBlock *vertex_block = nullptr;
+	const IndexBlock *index_block = nullptr;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		int vertex_index = allocate_vertices(device, mesh.position_stride, mesh.attribute_stride,
+		                                     num_vertices, vertex_offset);
+		if (vertex_index < 0)
+			return false;
+
+		int index_index = -1;
+		if (num_indices)
+		{
+			index_index = allocate_indices(device, mesh.index_type, num_indices, index_offset);
+			if (index_index < 0)
+			{
+				vertex_blocks[vertex_index]->ranges.free(vertex_offset, num_vertices);
+				return false;
+			}
+			index_block = index_blocks[index_index].get();
+		}
+
+		vertex_block = vertex_blocks[vertex_index].get();
+
+		allocation.vbo_position = vertex_block->positions;
+		allocation.vbo_attributes = vertex_block->attributes;
+		allocation.ibo = index_block ? index_block->indices : Vulkan::BufferHandle{};
+		allocation.vertex_offset = int32_t(vertex_offset);
+		allocation.ibo_offset = index_offset;
+		allocation.generation = generation;
+		allocation.vertex_block = vertex_index;
+		allocation.index_block = index_index;
+		allocation.num_vertices = num_vertices;
+		allocation.num_indices = num_indices;
+	}
+
+	// The ranges are ours now, so the upload does not need the lock.
+	auto cmd = device.request_command_buffer();
+	// Freed ranges may still be read by earlier submissions.
+	cmd->barrier(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	memcpy(cmd->update_buffer(*allocation.vbo_position, VkDeviceSize(vertex_offset) * mesh.position_stride,
+	                          mesh.positions.size()),
+	       mesh.positions.data(), mesh.positions.size());
+
+	if (allocation.vbo_attributes && !mesh.attributes.empty())
+	{
+		memcpy(cmd->update_buffer(*allocation.vbo_attributes, VkDeviceSize(vertex_offset) * mesh.attribute_stride,
+		                          mesh.attributes.size()),
+		       mesh.attributes.data(), mesh.attributes.size());
+	}
+
+	if (allocation.ibo)
+	{
+		memcpy(cmd->update_buffer(*allocation.ibo, VkDeviceSize(index_offset) * index_size, mesh.indices.size()),
+		       mesh.indices.data(), mesh.indices.size());
+	}
+
+	cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+	             VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
+	device.submit(cmd);
+	return true;
+}
+
+void GeometryPool::free(Allocation &allocation)
+{
+	if (allocation.vertex_block < 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+
+		// The blocks went away with the device.
+		if (allocation.generation == generation)
+		{
+			vertex_blocks[allocation.vertex_block]->ranges.free(uint32_t(allocation.vertex_offset),
+			                                                    allocation.num_vertices);
+			if (allocation.index_block >= 0)
+				index_blocks[allocation.index_block]->ranges.free(allocation.ibo_offset, allocation.num_indices);
+		}
+	}
+
+	allocation = {};
+}
+}
@@ -0,0 +1,105 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "buffer.hpp"
+#include "event.hpp"
+#include "application_wsi_events.hpp"
+#include "scene_formats.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Granite
+{
+// Suballocates static mesh geometry from a few large buffers. Meshes with the same vertex strides
+// share vertex buffers, and meshes with the same index type share index buffers,
+// so consecutive draws do not rebind them. Meshes are located with vertex_offset and ibo_offset.
+// Thread-safe.
+class GeometryPool : public EventHandler
+{
+public:
+	GeometryPool();
+
+	struct Allocation
+	{
+		Vulkan::BufferHandle vbo_position;
+		Vulkan::BufferHandle vbo_attributes;
+		Vulkan::BufferHandle ibo;
+		int32_t vertex_offset = 0;
+		uint32_t ibo_offset = 0;
+
+		uint32_t generation = 0;
+		int vertex_block = -1;
+		int index_block = -1;
+		uint32_t num_vertices = 0;
+		uint32_t num_indices = 0;
+	};
+
+	// Uploads the mesh. Returns false if the mesh should get dedicated buffers instead.
+	bool allocate(Vulkan::Device &device, const SceneFormats::Mesh &mesh, Allocation &allocation);
+	void free(Allocation &allocation);
+
+	// In vertices and indices. Larger meshes get a block of their own.
+	enum { VertexBlockSize = 256 * 1024, IndexBlockSize = 1024 * 1024 };
+
+private:
+	// First fit, free ranges are keyed by offset and coalesced.
+	struct RangeAllocator
+	{
+		explicit RangeAllocator(uint32_t capacity);
+		bool allocate(uint32_t count, uint32_t &offset);
+		void free(uint32_t offset, uint32_t count);
+		std::map<uint32_t, uint32_t> free_ranges;
+	};
+
+	struct VertexBlock
+	{
+		uint32_t position_stride;
+		uint32_t attribute_stride;
+		Vulkan::BufferHandle positions;
+		Vulkan::BufferHandle attributes;
+		RangeAllocator ranges;
+	};
+
+	struct IndexBlock
+	{
+		VkIndexType index_type;
+		Vulkan::BufferHandle indices;
+		RangeAllocator ranges;
+	};
+
+	std::mutex lock;
+	std::vector<std::unique_ptr<VertexBlock>> vertex_blocks;
+	std::vector<std::unique_ptr<IndexBlock>> index_blocks;
+	uint32_t generation = 0;
+
+	int allocate_vertices(Vulkan::Device &device, uint32_t position_stride, uint32_t attribute_stride,
+	                      uint32_t count, uint32_t &offset);
+	int allocate_indices(Vulkan::Device &device, VkIndexType index_type, uint32_t count, uint32_t &offset);
+
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+};
+}
@@ -0,0 +1,652 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "gpu_scene.hpp"
+#include "mesh.hpp"
+#include "device.hpp"
+#include "render_context.hpp"
+#include "render_graph.hpp"
+#include "simd.hpp"
+#include "bitops.hpp"
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
+
+namespace Granite
+{
+GPUScene::GPUScene(const GPUSceneConfig &config_)
+	: config(config_)
+{
+}
+
+GPUScene::~GPUScene()
+{
+	release_batches();
+}
+
+GPUScene::Handles GPUScene::add_to_scene(Scene &scene, const GPUSceneConfig &config)
+{
+	Handles handles;
+	handles.entity = scene.create_entity();
+
+	auto gpu_scene = Util::make_handle<GPUScene>(config);
+
+	auto *update_component = handles.entity->allocate_component<PerFrameUpdateComponent>();
+	update_component->refresh = gpu_scene.get();
+
+	auto *rp = handles.entity->allocate_component<RenderPassComponent>();
+	rp->creator = gpu_scene.get();
+
+	auto *renderable = handles.entity->allocate_component<RenderableComponent>();
+	renderable->renderable = gpu_scene;
+
+	handles.entity->allocate_component<OpaqueFloatingComponent>();
+	handles.gpu_scene = gpu_scene.get();
+
+	return handles;
+}
+
+unsigned GPUScene::get_instance_count() const
+{
+	return unsigned(tracked.size());
+}
+
+unsigned GPUScene::get_batch_count() const
+{
+	return unsigned(batches.size());
+}
+
+static const ComponentGroupVector<RenderInfoComponent, RenderableComponent,
+                                  CachedSpatialTransformTimestampComponent, OpaqueComponent> &
+get_opaque_group(Scene &scene)
+{
+	return scene.get_entity_pool().get_component_group<RenderInfoComponent, RenderableComponent,
+	                                                   CachedSpatialTransformTimestampComponent, OpaqueComponent>();
+}
+
+static bool device_supports_indirect_instances(Vulkan::Device &device)
+{
+	auto &features = device.get_device_features();
+	return features.supports_draw_indirect_count &&
+	       features.enabled_features.multiDrawIndirect &&
+	       features.enabled_features.drawIndirectFirstInstance;
+}
+
+bool GPUScene::needs_rebuild() const
+{
+	auto &opaque = get_opaque_group(*scene);
+	if (opaque.size() != tracked_opaque.size())
+		return true;
+
+	for (size_t i = 0; i < opaque.size(); i++)
+		if (get_component<RenderInfoComponent>(opaque[i]) != tracked_opaque[i])
+			return true;
+
+	return false;
+}
+
+void GPUScene::release_batches()
+{
+	for (auto &batch : batches)
+		batch.renderable->flags &= ~RENDERABLE_GPU_DRIVEN_BIT;
+
+	batches.clear();
+	tracked.clear();
+	tracked_opaque.clear();
+	dirty_instances.clear();
+	transforms.clear();
+	bounds.clear();
+	transform_buffer.reset();
+	instance_buffer.reset();
+	batch_buffer.reset();
+	direct_buffers.clear();
+}
+
+void GPUScene::rebuild()
+{
+	release_batches();
+
+	auto &opaque = get_opaque_group(*scene);
+	tracked_opaque.reserve(opaque.size());
+
+	std::vector<Batch> candidates;
+	std::vector<std::vector<TrackedInstance>> candidate_instances;
+	std::vector<bool> rejected;
+	std::unordered_map<const AbstractRenderable *, unsigned> candidate_indices;
+
+	for (auto &o : opaque)
+	{
+		auto *info = get_component<RenderInfoComponent>(o);
+		auto &renderable = get_component<RenderableComponent>(o)->renderable;
+		tracked_opaque.push_back(info);
+
+		unsigned index;
+		auto itr = candidate_indices.find(renderable.get());
+		if (itr == candidate_indices.end())
+		{
+			index = unsigned(candidates.size());
+			candidate_indices[renderable.get()] = index;
+			candidates.push_back({ renderable, renderable->get_indirect_mesh(), 0, 0 });
+			candidate_instances.emplace_back();
+			rejected.push_back(false);
+		}
+		else
+			index = itr->second;
+
+		// The GPU-driven flag lives on the shared renderable, so every instance of a mesh must qualify.
+		if (!candidates[index].mesh || !info->transform || info->skin_transform ||
+		    (renderable->flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0)
+		{
+			rejected[index] = true;
+		}
+		else
+		{
+			auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
+			candidate_instances[index].push_back({ info, timestamp, timestamp->last_timestamp });
+		}
+	}
+
+	if (!device_supports_indirect_instances(*device))
+		return;
+
+	std::vector<GPUBatch> gpu_batches;
+
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		auto &instances = candidate_instances[i];
+		if (rejected[i] || instances.empty())
+			continue;
+		if (tracked.size() + instances.size() > config.max_instances || batches.size() >= config.max_batches)
+			continue;
+
+		auto batch = candidates[i];
+		batch.first_instance = uint32_t(tracked.size());
+		batch.instance_count = uint32_t(instances.size());
+
+		GPUBatch gpu_batch = {};
+		gpu_batch.index_count = batch.mesh->count;
+		gpu_batch.first_index = batch.mesh->ibo_offset;
+		gpu_batch.vertex_offset = batch.mesh->vertex_offset;
+		gpu_batch.command_offset = batch.first_instance;
+		gpu_batches.push_back(gpu_batch);
+
+		for (auto &instance : instances)
+		{
+			tracked.push_back(instance);
+			transforms.push_back(instance.info->transform->world_transform);
+			bounds.push_back({ instance.info->world_aabb.get_minimum(), uint32_t(batches.size()),
+			                   instance.info->world_aabb.get_maximum(), 0 });
+		}
+
+		batch.renderable->flags |= RENDERABLE_GPU_DRIVEN_BIT;
+		batches.push_back(std::move(batch));
+	}
+
+	if (batches.empty())
+		return;
+
+	Vulkan::BufferCreateInfo info = {};
+	info.domain = Vulkan::BufferDomain::Device;
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	if (!create_direct_instance_buffers())
+	{
+		info.size = transforms.size() * sizeof(mat4);
+		transform_buffer = device->create_buffer(info, transforms.data());
+		info.size = bounds.size() * sizeof(GPUInstance);
+		instance_buffer = device->create_buffer(info, bounds.data());
+	}
+
+	info.size = gpu_batches.size() * sizeof(GPUBatch);
+	batch_buffer = device->create_buffer(info, gpu_batches.data());
+
+	LOGI("GPUScene: %u instances in %u batches are GPU-driven.\n",
+	     unsigned(tracked.size()), unsigned(batches.size()));
+}
+
+void GPUScene::update_dirty_instances()
+{
+	for (size_t i = 0; i < tracked.size(); i++)
+	{
+		auto &instance = tracked[i];
+		if (instance.timestamp->last_timestamp == instance.last_timestamp)
+			continue;
+
+		instance.last_timestamp = instance.timestamp->last_timestamp;
+		transforms[i] = instance.info->transform->world_transform;
+		bounds[i].lo = instance.info->world_aabb.get_minimum();
+		bounds[i].hi = instance.info->world_aabb.get_maximum();
+		dirty_instances.push_back(uint32_t(i));
+	}
+}
+
+void GPUScene::refresh(const RenderContext &, TaskComposer &)
+{
+	if (!scene || !device)
+		return;
+
+	if (needs_rebuild())
+		rebuild();
+	else
+		update_dirty_instances();
+
+	if (!direct_buffers.empty())
+		write_direct_instances();
+}
+
+bool GPUScene::create_direct_instance_buffers()
+{
+	direct_buffers.clear();
+	if (!device->supports_resizable_bar())
+		return false;
+
+	Vulkan::BufferCreateInfo info = {};
+	info.domain = Vulkan::BufferDomain::LinkedDeviceHostReBAR;
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	direct_buffers.resize(device->get_num_frame_contexts());
+	for (auto &direct : direct_buffers)
+	{
+		info.size = transforms.size() * sizeof(mat4);
+		direct.transforms = device->create_buffer(info, transforms.data());
+		info.size = bounds.size() * sizeof(GPUInstance);
+		direct.bounds = device->create_buffer(info, bounds.data());
+
+		// Out of ReBAR budget, stage the updates instead.
+		if (!direct.transforms || !direct.bounds ||
+		    direct.transforms->get_create_info().domain != Vulkan::BufferDomain::LinkedDeviceHostReBAR ||
+		    direct.bounds->get_create_info().domain != Vulkan::BufferDomain::LinkedDeviceHostReBAR)
+		{
+			direct_buffers.clear();
+			return false;
+		}
+	}
+
+	transform_buffer = direct_buffers.front().transforms;
+	instance_buffer = direct_buffers.front().bounds;
+	return true;
+}
+
+void GPUScene::write_direct_instances()
+{
+	// The frame context count changed, so a copy might still be in flight.
+	if (direct_buffers.size() != device->get_num_frame_contexts())
+	{
+		dirty_instances.clear();
+		if (!create_direct_instance_buffers())
+		{
+			Vulkan::BufferCreateInfo info = {};
+			info.domain = Vulkan::BufferDomain::Device;
+			info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			info.size = transforms.size() * sizeof(mat4);
+			transform_buffer = device->create_buffer(info, transforms.data());
+			info.size = bounds.size() * sizeof(GPUInstance);
+			instance_buffer = device->create_buffer(info, bounds.data());
+			return;
+		}
+	}
+
+	for (auto &direct : direct_buffers)
+		direct.pending.insert(direct.pending.end(), dirty_instances.begin(), dirty_instances.end());
+	dirty_instances.clear();
+
+	// The fence for this frame context has been waited for, so its copy is no longer read by the GPU.
+	auto &direct = direct_buffers[device->get_current_frame_context()];
+	if (!direct.pending.empty())
+	{
+		std::sort(direct.pending.begin(), direct.pending.end());
+		direct.pending.erase(std::unique(direct.pending.begin(), direct.pending.end()), direct.pending.end());
+
+		auto *mapped_transforms = static_cast<mat4 *>(
+				device->map_host_buffer(*direct.transforms, Vulkan::MEMORY_ACCESS_WRITE_BIT));
+		auto *mapped_bounds = static_cast<GPUInstance *>(
+				device->map_host_buffer(*direct.bounds, Vulkan::MEMORY_ACCESS_WRITE_BIT));
+
+		for (uint32_t index : direct.pending)
+		{
+			mapped_transforms[index] = transforms[index];
+			mapped_bounds[index] = bounds[index];
+		}
+
+		device->unmap_host_buffer(*direct.transforms, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+		device->unmap_host_buffer(*direct.bounds, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+		direct.pending.clear();
+	}
+
+	transform_buffer = direct.transforms;
+	instance_buffer = direct.bounds;
+}
+
+void GPUScene::upload_dirty_instances(Vulkan::CommandBuffer &cmd)
+{
+	if (dirty_instances.empty())
+		return;
+
+	std::sort(dirty_instances.begin(), dirty_instances.end());
+	dirty_instances.erase(std::unique(dirty_instances.begin(), dirty_instances.end()), dirty_instances.end());
+
+	std::vector<mat4> staging_transforms;
+	std::vector<GPUInstance> staging_bounds;
+	std::vector<VkBufferCopy> transform_copies;
+	std::vector<VkBufferCopy> bounds_copies;
+	staging_transforms.reserve(dirty_instances.size());
+	staging_bounds.reserve(dirty_instances.size());
+
+	for (size_t i = 0; i < dirty_instances.size(); i++)
+	{
+		uint32_t index = dirty_instances[i];
+
+		// Merge runs of dirty instances into one copy.
+		if (i == 0 || dirty_instances[i - 1] + 1 != index)
+		{
+			transform_copies.push_back({ staging_transforms.size() * sizeof(mat4), index * sizeof(mat4), 0 });
+			bounds_copies.push_back({ staging_bounds.size() * sizeof(GPUInstance), index * sizeof(GPUInstance), 0 });
+		}
+
+		transform_copies.back().size += sizeof(mat4);
+		bounds_copies.back().size += sizeof(GPUInstance);
+		staging_transforms.push_back(transforms[index]);
+		staging_bounds.push_back(bounds[index]);
+	}
+
+	Vulkan::BufferCreateInfo info = {};
+	info.domain = Vulkan::BufferDomain::Host;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	info.size = staging_transforms.size() * sizeof(mat4);
+	auto transform_staging = device->create_buffer(info, staging_transforms.data());
+	info.size = staging_bounds.size() * sizeof(GPUInstance);
+	auto bounds_staging = device->create_buffer(info, staging_bounds.data());
+
+	cmd.copy_buffer(*transform_buffer, *transform_staging, transform_copies.data(), transform_copies.size());
+	cmd.copy_buffer(*instance_buffer, *bounds_staging, bounds_copies.data(), bounds_copies.size());
+	dirty_instances.clear();
+}
+
+void GPUScene::cull_instances(Vulkan::CommandBuffer &cmd)
+{
+	auto &commands_physical = graph->get_physical_buffer_resource(*commands);
+	auto &counts_physical = graph->get_physical_buffer_resource(*counts);
+
+	// Last frame's draws may still read the buffers we are about to overwrite.
+	cmd.barrier(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	cmd.fill_buffer(counts_physical, 0);
+	upload_dirty_instances(cmd);
+
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+	            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	if (tracked.empty() || !context)
+		return;
+
+	bool occlusion = build_hiz(cmd);
+
+	cmd.set_storage_buffer(0, 0, *instance_buffer);
+	cmd.set_storage_buffer(0, 1, *batch_buffer);
+	cmd.set_storage_buffer(0, 2, commands_physical);
+	cmd.set_storage_buffer(0, 3, counts_physical);
+	memcpy(cmd.allocate_typed_constant_data<vec4>(1, 0, 6),
+	       context->get_visibility_frustum().get_planes(), 6 * sizeof(vec4));
+
+	if (occlusion)
+	{
+		auto &hiz_physical = graph->get_physical_texture_resource(*hiz);
+		auto &create_info = hiz_physical.get_image().get_create_info();
+		cmd.set_texture(0, 4, hiz_physical, Vulkan::StockSampler::NearestClamp);
+
+		struct Occlusion
+		{
+			mat4 prev_view_projection;
+			vec2 hiz_resolution;
+			float hiz_max_lod;
+		};
+		auto *occ = cmd.allocate_typed_constant_data<Occlusion>(1, 1, 1);
+		occ->prev_view_projection = prev_view_projection;
+		occ->hiz_resolution = vec2(float(create_info.width), float(create_info.height));
+		occ->hiz_max_lod = float(create_info.levels - 1);
+	}
+
+	uint32_t num_instances = uint32_t(tracked.size());
+	cmd.push_constants(&num_instances, 0, sizeof(num_instances));
+	cmd.set_program("builtin://shaders/gpu_scene/cull.comp", {{ "OCCLUSION", int(occlusion) }});
+	cmd.dispatch((num_instances + 63) / 64, 1, 1);
+
+	// The depth this frame renders is what next frame's commands are tested against.
+	auto &params = context->get_render_parameters();
+	prev_view_projection = params.view_projection;
+	prev_inv_projection = params.inv_projection;
+	// Only a perspective projection maps clip W to the linear depth we reduce to.
+	has_prev_frame = params.projection[3].w == 0.0f;
+}
+
+bool GPUScene::build_hiz(Vulkan::CommandBuffer &cmd)
+{
+	if (!depth_history || !hiz || !has_prev_frame)
+		return false;
+
+	// No history on the first frame after a graph rebake.
+	auto *history = graph->get_physical_history_texture_resource(*depth_history);
+	if (!history)
+		return false;
+
+	auto &hiz_physical = graph->get_physical_texture_resource(*hiz);
+	if (hiz_views.empty())
+	{
+		auto &create_info = hiz_physical.get_image().get_create_info();
+		VK_ASSERT(create_info.levels <= MaxSPDMips);
+
+		Vulkan::ImageViewCreateInfo info = {};
+		info.image = &hiz_physical.get_image();
+		info.format = VK_FORMAT_R32_SFLOAT;
+		info.view_type = VK_IMAGE_VIEW_TYPE_2D;
+		info.levels = 1;
+		info.layers = 1;
+
+		hiz_views.reserve(create_info.levels);
+		for (unsigned i = 0; i < create_info.levels; i++)
+		{
+			info.base_level = i;
+			hiz_views.push_back(device->create_image_view(info));
+			hiz_mips[i] = hiz_views.back().get();
+		}
+	}
+
+	mat2 inv_zw = mat2(prev_inv_projection[2].zw(), prev_inv_projection[3].zw());
+
+	SPDInfo info = {};
+	info.input = history;
+	info.output_mips = hiz_mips;
+	info.num_mips = unsigned(hiz_views.size());
+	info.counter_buffer = &graph->get_physical_buffer_resource(*hiz_counter);
+	info.num_components = 1;
+	info.z_transform = &inv_zw;
+	info.z_reduce_max = true;
+	emit_single_pass_downsample(cmd, info);
+
+	cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	return true;
+}
+
+void GPUScene::push_indirect(const RenderContext &context_, RenderQueue &queue) const
+{
+	for (auto &batch : batches)
+	{
+		StaticMeshIndirectInfo indirect = {};
+		indirect.transforms = transform_buffer.get();
+		indirect.commands = commands_buffer;
+		indirect.count = counts_buffer;
+		indirect.commands_offset = batch.first_instance * uint32_t(sizeof(VkDrawIndexedIndirectCommand));
+		indirect.count_offset = uint32_t(&batch - batches.data()) * uint32_t(sizeof(uint32_t));
+		indirect.max_draws = batch.instance_count;
+		batch.mesh->get_indirect_render_info(context_, indirect, queue);
+	}
+}
+
+void GPUScene::push_fallback(const RenderContext &context_, RenderQueue &queue, bool depth) const
+{
+	// Commands are only culled against the base context, other views cull on the CPU as usual.
+	auto *planes = context_.get_visibility_frustum().get_planes();
+	for (auto &batch : batches)
+	{
+		for (uint32_t i = 0; i < batch.instance_count; i++)
+		{
+			auto *info = tracked[batch.first_instance + i].info;
+			if (!SIMD::frustum_cull(info->world_aabb, planes))
+				continue;
+
+			if (depth)
+				batch.renderable->get_depth_render_info(context_, info, queue);
+			else
+				batch.renderable->get_render_info(context_, info, queue);
+		}
+	}
+}
+
+void GPUScene::get_render_info(const RenderContext &context_, const RenderInfoComponent *,
+                               RenderQueue &queue) const
+{
+	if (&context_ == context && commands_buffer)
+		push_indirect(context_, queue);
+	else
+		push_fallback(context_, queue, false);
+}
+
+void GPUScene::get_depth_render_info(const RenderContext &context_, const RenderInfoComponent *,
+                                     RenderQueue &queue) const
+{
+	if (&context_ == context && commands_buffer)
+		push_indirect(context_, queue);
+	else
+		push_fallback(context_, queue, true);
+}
+
+void GPUScene::get_motion_vector_render_info(const RenderContext &, const RenderInfoComponent *,
+                                             RenderQueue &) const
+{
+	// Moving instances are picked up by the regular motion vector gather.
+}
+
+void GPUScene::add_render_passes(RenderGraph &graph_)
+{
+	graph = &graph_;
+	device = &graph_.get_device();
+	commands_buffer = nullptr;
+	counts_buffer = nullptr;
+	occlusion_depth.clear();
+	depth_history = nullptr;
+	hiz = nullptr;
+	hiz_counter = nullptr;
+	hiz_views.clear();
+	has_prev_frame = false;
+
+	auto &cull = graph_.add_pass("gpu-scene-cull", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	cull_pass = &cull;
+
+	BufferInfo commands_info;
+	commands_info.size = config.max_instances * sizeof(VkDrawIndexedIndirectCommand);
+	commands = &cull.add_storage_output("gpu-scene-commands", commands_info);
+
+	BufferInfo counts_info;
+	counts_info.size = config.max_batches * sizeof(uint32_t);
+	counts_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	counts = &cull.add_storage_output("gpu-scene-counts", counts_info);
+
+	cull.set_build_render_pass([this](Vulkan::CommandBuffer &cmd) {
+		cull_instances(cmd);
+	});
+}
+
+void GPUScene::set_base_renderer(const RendererSuite *)
+{
+}
+
+void GPUScene::set_base_render_context(const RenderContext *context_)
+{
+	context = context_;
+}
+
+void GPUScene::setup_render_pass_dependencies(RenderGraph &, RenderPass &target,
+                                              RenderPassCreator::DependencyFlags dep_flags)
+{
+	if ((dep_flags & RenderPassCreator::GEOMETRY_BIT) != 0)
+	{
+		target.add_indirect_buffer_input("gpu-scene-commands");
+		target.add_indirect_buffer_input("gpu-scene-counts");
+
+		// The first single sampled depth we feed is what occlusion is tested against.
+		auto *depth = target.get_depth_stencil_output();
+		if (!depth)
+			depth = target.get_depth_stencil_input();
+		if (config.occlusion_culling && occlusion_depth.empty() && depth &&
+		    depth->get_attachment_info().samples <= 1)
+		{
+			occlusion_depth = depth->get_name();
+		}
+	}
+}
+
+void GPUScene::setup_render_pass_dependencies(RenderGraph &graph_)
+{
+	if (occlusion_depth.empty())
+		return;
+
+	if (!supports_single_pass_downsample(*device, VK_FORMAT_R32_SFLOAT))
+	{
+		LOGW("GPUScene: single pass downsample is not supported, disabling occlusion culling.\n");
+		return;
+	}
+
+	depth_history = &cull_pass->add_history_input(occlusion_depth);
+
+	AttachmentInfo att;
+	att.format = VK_FORMAT_R32_SFLOAT;
+	att.size_class = SizeClass::InputRelative;
+	att.size_relative_name = occlusion_depth;
+	att.aux_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	// Stop at 2x1 or 1x2, like the regular depth hierarchy.
+	auto dim = graph_.get_resource_dimensions(*depth_history);
+	att.levels = std::min(Util::floor_log2(std::min(dim.width, dim.height)) + 1, unsigned(MaxSPDMips));
+	hiz = &cull_pass->add_storage_texture_output("gpu-scene-hiz", att);
+
+	BufferInfo counter_info;
+	counter_info.size = 4;
+	counter_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	hiz_counter = &cull_pass->add_storage_output("gpu-scene-hiz-counter", counter_info);
+}
+
+void GPUScene::setup_render_pass_resources(RenderGraph &graph_)
+{
+	commands_buffer = &graph_.get_physical_buffer_resource(*commands);
+	counts_buffer = &graph_.get_physical_buffer_resource(*counts);
+}
+
+void GPUScene::set_scene(Scene *scene_)
+{
+	scene = scene_;
+}
+}
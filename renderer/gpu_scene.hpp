@@ -0,0 +1,183 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "abstract_renderable.hpp"
+#include "scene.hpp"
+#include "buffer.hpp"
+#include "image.hpp"
+#include "post/spd.hpp"
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+class RenderBufferResource;
+class RenderTextureResource;
+class RenderPass;
+
+struct GPUSceneConfig
+{
+	// Capacity of the compacted command buffer.
+	// Meshes which do not fit stay on the regular CPU culled path.
+	unsigned max_instances = 128 * 1024;
+	unsigned max_batches = 4096;
+
+	// Also reject instances hidden behind the previous frame's depth.
+	bool occlusion_culling = true;
+};
+
+// Moves opaque static mesh instances to persistent GPU buffers.
+// A compute pass frustum culls them against the base render context and compacts
+// the visible ones into indirect commands, drawn with one indirect count draw per mesh.
+// With occlusion culling, the previous frame's depth is reduced to a max linear depth pyramid,
+// and instance bounds are tested against it with last frame's camera. Newly disoccluded
+// instances therefore show up one frame late.
+// Adopted meshes get RENDERABLE_GPU_DRIVEN_BIT, which RenderPassSceneRenderer skips
+// when gathering opaque renderables. Other render contexts fall back to CPU culling.
+class GPUScene : public AbstractRenderable,
+                 public PerFrameRefreshable,
+                 public RenderPassCreator
+{
+public:
+	explicit GPUScene(const GPUSceneConfig &config);
+	~GPUScene() override;
+
+	struct Handles
+	{
+		Entity *entity;
+		GPUScene *gpu_scene;
+	};
+	static Handles add_to_scene(Scene &scene, const GPUSceneConfig &config = {});
+
+	unsigned get_instance_count() const;
+	unsigned get_batch_count() const;
+
+private:
+	GPUSceneConfig config;
+
+	// Instances of a batch are contiguous, and so are their compacted commands.
+	struct Batch
+	{
+		AbstractRenderableHandle renderable;
+		const StaticMesh *mesh;
+		uint32_t first_instance;
+		uint32_t instance_count;
+	};
+
+	// Mirrors the structs in shaders/gpu_scene/cull.comp.
+	struct GPUInstance
+	{
+		vec3 lo;
+		uint32_t batch;
+		vec3 hi;
+		uint32_t padding;
+	};
+
+	struct GPUBatch
+	{
+		uint32_t index_count;
+		uint32_t first_index;
+		int32_t vertex_offset;
+		uint32_t command_offset;
+	};
+
+	struct TrackedInstance
+	{
+		const RenderInfoComponent *info;
+		const CachedSpatialTransformTimestampComponent *timestamp;
+		uint32_t last_timestamp;
+	};
+
+	std::vector<Batch> batches;
+	std::vector<TrackedInstance> tracked;
+	std::vector<const RenderInfoComponent *> tracked_opaque;
+	std::vector<uint32_t> dirty_instances;
+	std::vector<mat4> transforms;
+	std::vector<GPUInstance> bounds;
+
+	Vulkan::BufferHandle transform_buffer;
+	Vulkan::BufferHandle instance_buffer;
+	Vulkan::BufferHandle batch_buffer;
+
+	// With resizable BAR, each frame context gets its own copy of the instance data which the CPU writes directly.
+	struct DirectInstanceBuffers
+	{
+		Vulkan::BufferHandle transforms;
+		Vulkan::BufferHandle bounds;
+		std::vector<uint32_t> pending;
+	};
+	std::vector<DirectInstanceBuffers> direct_buffers;
+
+	Vulkan::Device *device = nullptr;
+	Scene *scene = nullptr;
+	const RenderContext *context = nullptr;
+	RenderGraph *graph = nullptr;
+	RenderBufferResource *commands = nullptr;
+	RenderBufferResource *counts = nullptr;
+	const Vulkan::Buffer *commands_buffer = nullptr;
+	const Vulkan::Buffer *counts_buffer = nullptr;
+
+	RenderPass *cull_pass = nullptr;
+	std::string occlusion_depth;
+	RenderTextureResource *depth_history = nullptr;
+	RenderTextureResource *hiz = nullptr;
+	RenderBufferResource *hiz_counter = nullptr;
+	std::vector<Vulkan::ImageViewHandle> hiz_views;
+	const Vulkan::ImageView *hiz_mips[MaxSPDMips] = {};
+	mat4 prev_view_projection;
+	mat4 prev_inv_projection;
+	bool has_prev_frame = false;
+
+	bool needs_rebuild() const;
+	void rebuild();
+	void release_batches();
+	void update_dirty_instances();
+	void upload_dirty_instances(Vulkan::CommandBuffer &cmd);
+	bool create_direct_instance_buffers();
+	void write_direct_instances();
+	void cull_instances(Vulkan::CommandBuffer &cmd);
+	bool build_hiz(Vulkan::CommandBuffer &cmd);
+
+	void push_fallback(const RenderContext &context, RenderQueue &queue, bool depth) const;
+	void push_indirect(const RenderContext &context, RenderQueue &queue) const;
+
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                     RenderQueue &queue) const override;
+	void get_depth_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                           RenderQueue &queue) const override;
+	void get_motion_vector_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                                   RenderQueue &queue) const override;
+
+	void refresh(const RenderContext &context, TaskComposer &composer) override;
+
+	void add_render_passes(RenderGraph &graph) override;
+	void set_base_renderer(const RendererSuite *suite) override;
+	void set_base_render_context(const RenderContext *context) override;
+	void setup_render_pass_dependencies(RenderGraph &graph, RenderPass &target,
+	                                    RenderPassCreator::DependencyFlags dep_flags) override;
+	void setup_render_pass_dependencies(RenderGraph &graph) override;
+	void setup_render_pass_resources(RenderGraph &graph) override;
+	void set_scene(Scene *scene) override;
+};
+}
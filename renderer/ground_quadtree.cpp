@@ -0,0 +1,866 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ground_quadtree.hpp"
+#include "device.hpp"
+#include "renderer.hpp"
+#include "render_context.hpp"
+#include "render_graph.hpp"
+#include "memory_mapped_texture.hpp"
+#include "filesystem.hpp"
+#include "path_utils.hpp"
+#include "string_helpers.hpp"
+#include "muglm/matrix_helper.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace Granite
+{
+// Node slots are stored for every node of the tree, which bounds the depth.
+static constexpr unsigned MaxQuadtreeLevels = 10;
+static constexpr unsigned MaxPatchResolution = 64;
+static constexpr uint32_t LevelArgsOffset = 32;
+
+// Mirrors assets/shaders/ground.vert and ground.frag.
+enum GroundVariantFlagBits : uint32_t
+{
+	GROUND_VARIANT_BANDLIMITED_PIXEL_BIT = 1 << 0,
+	GROUND_VARIANT_QUADTREE_BIT = 1 << 1
+};
+
+struct QuadtreeVertex
+{
+	uint8_t pos[4];
+};
+
+// Mirrors assets/shaders/ground/select_patches.comp.
+struct QuadtreePatch
+{
+	vec2 offset;
+	float size;
+	uint32_t layer;
+};
+
+struct QuadtreeParameters
+{
+	vec4 frustum[6];
+	vec3 camera_position;
+	float lod_distance;
+	vec3 world_offset;
+	float world_size;
+	vec2 height_range;
+	uint32_t num_levels;
+	uint32_t max_nodes;
+	uint32_t max_patches;
+	uint32_t index_count;
+};
+
+struct QuadtreeGroundData
+{
+	vec2 inv_world_size;
+	vec2 uv_shift;
+	vec2 uv_tiling_scale;
+	vec2 tangent_scale;
+	vec4 texture_info;
+};
+
+struct QuadtreeTileData
+{
+	vec2 tile_uv_scale_bias;
+	float inv_patch_resolution;
+	float height_scale;
+	float skirt_depth;
+};
+
+struct QuadtreeRenderInfo
+{
+	Vulkan::Program *program;
+
+	const Vulkan::Buffer *vbo;
+	const Vulkan::Buffer *ibo;
+	const Vulkan::Buffer *patches;
+	const Vulkan::Buffer *indirect;
+
+	const Vulkan::ImageView *heights;
+	const Vulkan::ImageView *normals;
+	const Vulkan::ImageView *occlusion;
+	const Vulkan::ImageView *base_color;
+	const Vulkan::ImageView *splatmap;
+	const Vulkan::ImageView *normals_fine;
+
+	mat4 push[2];
+	QuadtreeGroundData ground_data;
+	QuadtreeTileData tile_data;
+};
+
+static uint32_t level_offset(unsigned level)
+{
+	return ((1u << (2 * level)) - 1u) / 3u;
+}
+
+static uint32_t node_index(unsigned level, unsigned x, unsigned z)
+{
+	return level_offset(level) + z * (1u << level) + x;
+}
+
+namespace RenderFunctions
+{
+static void ground_quadtree_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned)
+{
+	// There is only ever one draw per quadtree.
+	auto &info = *static_cast<const QuadtreeRenderInfo *>(infos->render_info);
+
+	cmd.set_program(info.program);
+	cmd.set_primitive_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+	cmd.set_primitive_restart(true);
+
+	cmd.set_index_buffer(*info.ibo, 0, VK_INDEX_TYPE_UINT16);
+	cmd.set_vertex_binding(0, *info.vbo, 0, sizeof(QuadtreeVertex), VK_VERTEX_INPUT_RATE_VERTEX);
+	cmd.set_vertex_attrib(0, 0, VK_FORMAT_R8G8B8A8_UINT, offsetof(QuadtreeVertex, pos));
+
+	auto &device = cmd.get_device();
+	cmd.set_texture(2, 0, *info.heights, device.get_stock_sampler(Vulkan::StockSampler::LinearClamp));
+	cmd.set_texture(2, 1, *info.normals, device.get_stock_sampler(Vulkan::StockSampler::LinearClamp));
+	cmd.set_texture(2, 2, *info.occlusion, device.get_stock_sampler(Vulkan::StockSampler::LinearClamp));
+	cmd.set_texture(2, 4, *info.base_color, device.get_stock_sampler(Vulkan::StockSampler::TrilinearWrap));
+	cmd.set_texture(2, 5, *info.splatmap, device.get_stock_sampler(Vulkan::StockSampler::LinearClamp));
+	cmd.set_texture(2, 6, *info.normals_fine, device.get_stock_sampler(Vulkan::StockSampler::TrilinearWrap));
+
+	cmd.set_storage_buffer(3, 0, *info.patches);
+	*cmd.allocate_typed_constant_data<QuadtreeGroundData>(3, 1, 1) = info.ground_data;
+	*cmd.allocate_typed_constant_data<QuadtreeTileData>(3, 2, 1) = info.tile_data;
+	cmd.push_constants(info.push, 0, sizeof(info.push));
+
+	cmd.draw_indexed_indirect(*info.indirect, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+}
+}
+
+GroundQuadtree::GroundQuadtree(const GroundQuadtreeInfo &info_, Scene::NodeHandle node_)
+	: info(info_), node(std::move(node_))
+{
+	info.num_levels = clamp(info.num_levels, 1u, MaxQuadtreeLevels);
+	info.resident_levels = clamp(info.resident_levels, 1u, info.num_levels);
+	info.patch_resolution = clamp(info.patch_resolution, 2u, MaxPatchResolution);
+	info.max_loads_per_frame = std::max(info.max_loads_per_frame, 1u);
+	info.max_patches = std::max(info.max_patches, 1u);
+	num_nodes = level_offset(info.num_levels);
+
+	// Splitting a node needs four free slots on top of the pinned levels.
+	unsigned min_tiles = level_offset(info.resident_levels) + 4;
+	if (info.max_resident_tiles < min_tiles)
+	{
+		LOGW("GroundQuadtree: %u resident tiles are too few, using %u.\n", info.max_resident_tiles, min_tiles);
+		info.max_resident_tiles = min_tiles;
+	}
+
+	// Node lists are bound at offsets in one buffer, and split nodes allocate four entries at a time.
+	max_nodes = (std::max(info.max_patches, 4u) + 63u) & ~63u;
+
+	EVENT_MANAGER_REGISTER_LATCH(GroundQuadtree, on_device_created, on_device_destroyed, Vulkan::DeviceCreatedEvent);
+}
+
+GroundQuadtree::~GroundQuadtree()
+{
+}
+
+GroundQuadtree::Handles GroundQuadtree::add_to_scene(Scene &scene, const GroundQuadtreeInfo &info,
+                                                     Scene::NodeHandle node)
+{
+	Handles handles;
+	handles.entity = scene.create_entity();
+
+	auto ground = Util::make_handle<GroundQuadtree>(info, std::move(node));
+
+	auto *update_component = handles.entity->allocate_component<PerFrameUpdateComponent>();
+	update_component->refresh = ground.get();
+
+	auto *rp = handles.entity->allocate_component<RenderPassComponent>();
+	rp->creator = ground.get();
+
+	auto *renderable = handles.entity->allocate_component<RenderableComponent>();
+	renderable->renderable = ground;
+
+	handles.entity->allocate_component<OpaqueFloatingComponent>();
+	handles.ground = ground.get();
+
+	return handles;
+}
+
+unsigned GroundQuadtree::get_num_resident_tiles() const
+{
+	return info.max_resident_tiles - unsigned(free_slots.size() + retired_slots.size());
+}
+
+void GroundQuadtree::on_device_created(const Vulkan::DeviceCreatedEvent &e)
+{
+	device = &e.get_device();
+
+	uploader.reset(new Vulkan::AsyncUploader(device));
+	if (!uploader->init())
+	{
+		LOGW("GroundQuadtree: async uploads are not supported, streaming on the graphics queue.\n");
+		uploader.reset();
+	}
+
+	auto &textures = device->get_texture_manager();
+	occlusion = textures.request_texture(info.occlusionmap);
+	base_color = textures.request_texture(info.base_color);
+	splatmap = textures.request_texture(info.splatmap);
+	normals_fine = textures.request_texture(info.normalmap_fine);
+
+	build_patch_mesh();
+
+	Vulkan::BufferCreateInfo buffer_info = {};
+	buffer_info.domain = Vulkan::BufferDomain::Device;
+	buffer_info.size = num_nodes * sizeof(uint32_t);
+	buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	slots.assign(num_nodes, ~0u);
+	node_slots = device->create_buffer(buffer_info, slots.data());
+
+	if (!init_tile_arrays())
+	{
+		height_tiles.reset();
+		normal_tiles.reset();
+	}
+}
+
+void GroundQuadtree::on_device_destroyed(const Vulkan::DeviceCreatedEvent &)
+{
+	uploader.reset();
+	height_tiles.reset();
+	normal_tiles.reset();
+	node_slots.reset();
+	vbo.reset();
+	ibo.reset();
+	occlusion = nullptr;
+	base_color = nullptr;
+	splatmap = nullptr;
+	normals_fine = nullptr;
+
+	slots.clear();
+	dirty_nodes.clear();
+	tiles.clear();
+	pending_nodes.clear();
+	free_slots.clear();
+	retired_slots.clear();
+	device = nullptr;
+}
+
+void GroundQuadtree::build_patch_mesh()
+{
+	unsigned res = info.patch_resolution;
+	unsigned size_1 = res + 1;
+
+	std::vector<QuadtreeVertex> vertices;
+	std::vector<uint16_t> indices;
+	vertices.reserve(size_1 * (size_1 + 4));
+
+	for (unsigned z = 0; z <= res; z++)
+		for (unsigned x = 0; x <= res; x++)
+			vertices.push_back({{ uint8_t(x), uint8_t(z), 0, 0 }});
+
+	for (unsigned z = 0; z < res; z++)
+	{
+		for (unsigned x = 0; x <= res; x++)
+		{
+			indices.push_back(uint16_t(z * size_1 + x));
+			indices.push_back(uint16_t((z + 1) * size_1 + x));
+		}
+		indices.push_back(0xffffu);
+	}
+
+	// Skirts hang down from the edges so cracks towards coarser neighbors are filled.
+	// Each edge is walked such that its skirt faces outwards with the same winding as the grid.
+	const auto add_skirt = [&](int x, int z, int dx, int dz) {
+		for (unsigned i = 0; i <= res; i++, x += dx, z += dz)
+		{
+			indices.push_back(uint16_t(vertices.size()));
+			vertices.push_back({{ uint8_t(x), uint8_t(z), 1, 0 }});
+			indices.push_back(uint16_t(z * size_1 + x));
+		}
+		indices.push_back(0xffffu);
+	};
+
+	int ires = int(res);
+	add_skirt(0, 0, 1, 0);
+	add_skirt(ires, ires, -1, 0);
+	add_skirt(ires, 0, 0, 1);
+	add_skirt(0, ires, 0, -1);
+
+	Vulkan::BufferCreateInfo buffer_info = {};
+	buffer_info.domain = Vulkan::BufferDomain::Device;
+	buffer_info.size = vertices.size() * sizeof(QuadtreeVertex);
+	buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	vbo = device->create_buffer(buffer_info, vertices.data());
+
+	buffer_info.size = indices.size() * sizeof(uint16_t);
+	buffer_info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	ibo = device->create_buffer(buffer_info, indices.data());
+	index_count = unsigned(indices.size());
+}
+
+static std::string tile_path(const std::string &directory, const char *type, unsigned level, unsigned x, unsigned z)
+{
+	return Path::join(directory, Util::join(type, "_", level, "_", x, "_", z, ".gtx"));
+}
+
+bool GroundQuadtree::init_tile_arrays()
+{
+	// The root tiles decide the formats of the arrays.
+	Vulkan::MemoryMappedTexture root_height, root_normal;
+	if (!root_height.map_read(*GRANITE_FILESYSTEM(), tile_path(info.tile_directory, "height", 0, 0, 0)) ||
+	    !root_normal.map_read(*GRANITE_FILESYSTEM(), tile_path(info.tile_directory, "normal", 0, 0, 0)))
+	{
+		LOGE("GroundQuadtree: failed to read root tiles from %s.\n", info.tile_directory.c_str());
+		return false;
+	}
+
+	height_format = root_height.get_layout().get_format();
+	normal_format = root_normal.get_layout().get_format();
+
+	unsigned max_layers = device->get_gpu_properties().limits.maxImageArrayLayers;
+	if (info.max_resident_tiles > max_layers)
+	{
+		LOGW("GroundQuadtree: clamping resident tiles to %u array layers.\n", max_layers);
+		info.max_resident_tiles = max_layers;
+	}
+
+	auto image_info = Vulkan::ImageCreateInfo::immutable_2d_image(
+			info.tile_resolution, info.tile_resolution, height_format);
+	image_info.layers = info.max_resident_tiles;
+	image_info.levels = 1;
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_info.initial_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	if (uploader)
+		image_info.misc = Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+		                  Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT;
+
+	height_tiles = device->create_image(image_info);
+	image_info.format = normal_format;
+	normal_tiles = device->create_image(image_info);
+	if (!height_tiles || !normal_tiles)
+	{
+		LOGE("GroundQuadtree: failed to create tile arrays.\n");
+		return false;
+	}
+
+	free_slots.clear();
+	for (unsigned i = info.max_resident_tiles; i; i--)
+		free_slots.push_back(i - 1);
+
+	// The coarsest levels are always resident, so the tree never has holes.
+	uint64_t last_ticket = 0;
+	for (unsigned level = 0; level < info.resident_levels; level++)
+	{
+		for (unsigned z = 0; z < (1u << level); z++)
+		{
+			for (unsigned x = 0; x < (1u << level); x++)
+			{
+				uint32_t slot = free_slots.back();
+				uint64_t ticket = 0;
+				if (!load_tile(level, x, z, slot, &ticket))
+					return false;
+				free_slots.pop_back();
+
+				uint32_t index = node_index(level, x, z);
+				auto &tile = tiles[index];
+				tile.slot = slot;
+				tile.level = level;
+				slots[index] = slot;
+				dirty_nodes.push_back(index);
+				last_ticket = std::max(last_ticket, ticket);
+			}
+		}
+	}
+
+	if (uploader && last_ticket)
+		uploader->wait(last_ticket, Vulkan::CommandBuffer::Type::Generic,
+		               VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	return true;
+}
+
+bool GroundQuadtree::upload_layer(const Vulkan::ImageHandle &image, uint32_t layer, const void *data,
+                                  uint64_t *ticket)
+{
+	VkImageSubresourceLayers subresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, layer, 1 };
+	VkExtent3D extent = { info.tile_resolution, info.tile_resolution, 1 };
+
+	if (uploader)
+	{
+		*ticket = uploader->upload_image(image, subresource, {}, extent, data,
+		                                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		return *ticket != 0;
+	}
+
+	// Without an uploader, the tile is usable as soon as the graphics queue gets to it.
+	*ticket = 0;
+	auto cmd = device->request_command_buffer();
+
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.image = image->get_image();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, layer, 1 };
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	cmd->image_barriers(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 1, &barrier);
+
+	size_t size = Vulkan::TextureFormatLayout::format_block_size(image->get_format(), VK_IMAGE_ASPECT_COLOR_BIT) *
+	              extent.width * extent.height;
+	memcpy(cmd->update_image(*image, {}, extent, 0, 0, subresource), data, size);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	cmd->image_barriers(VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	                    1, &barrier);
+	device->submit(cmd);
+	return true;
+}
+
+bool GroundQuadtree::load_tile(unsigned level, unsigned x, unsigned z, uint32_t slot, uint64_t *ticket)
+{
+	auto height_path = tile_path(info.tile_directory, "height", level, x, z);
+	auto normal_path = tile_path(info.tile_directory, "normal", level, x, z);
+
+	Vulkan::MemoryMappedTexture height, normal;
+	if (!height.map_read(*GRANITE_FILESYSTEM(), height_path) ||
+	    !normal.map_read(*GRANITE_FILESYSTEM(), normal_path))
+	{
+		LOGE("GroundQuadtree: failed to read tile %s.\n", height_path.c_str());
+		return false;
+	}
+
+	auto &height_layout = height.get_layout();
+	auto &normal_layout = normal.get_layout();
+	if (height_layout.get_format() != height_format || normal_layout.get_format() != normal_format ||
+	    height_layout.get_width() != info.tile_resolution || height_layout.get_height() != info.tile_resolution ||
+	    normal_layout.get_width() != info.tile_resolution || normal_layout.get_height() != info.tile_resolution)
+	{
+		LOGE("GroundQuadtree: tile %s does not match the root tile format or size.\n", height_path.c_str());
+		return false;
+	}
+
+	// Tickets complete in order, so the normal tile's ticket covers both.
+	uint64_t height_ticket;
+	if (!upload_layer(height_tiles, slot, height_layout.data(), &height_ticket) ||
+	    !upload_layer(normal_tiles, slot, normal_layout.data(), ticket))
+	{
+		LOGE("GroundQuadtree: failed to upload tile %s.\n", height_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool GroundQuadtree::allocate_slot(uint32_t *slot)
+{
+	if (!free_slots.empty())
+	{
+		*slot = free_slots.back();
+		free_slots.pop_back();
+		return true;
+	}
+
+	// Evict the tile which has been unwanted for the longest time.
+	// Its slot may still be sampled by frames in flight, so it is only reused after they complete.
+	auto victim = tiles.end();
+	for (auto itr = tiles.begin(); itr != tiles.end(); ++itr)
+	{
+		auto &tile = itr->second;
+		if (tile.pending || tile.failed || tile.level < info.resident_levels || tile.last_wanted == frame)
+			continue;
+		if (victim == tiles.end() || tile.last_wanted < victim->second.last_wanted)
+			victim = itr;
+	}
+
+	if (victim != tiles.end())
+	{
+		slots[victim->first] = ~0u;
+		dirty_nodes.push_back(victim->first);
+		retired_slots.push_back({ victim->second.slot, frame });
+		tiles.erase(victim);
+	}
+
+	return false;
+}
+
+void GroundQuadtree::gather_requests(const vec3 &camera)
+{
+	requests.clear();
+
+	struct Entry
+	{
+		unsigned level, x, z;
+		float distance;
+	};
+	std::vector<Entry> stack;
+	stack.push_back({ 0, 0, 0, 0.0f });
+
+	while (!stack.empty())
+	{
+		auto entry = stack.back();
+		stack.pop_back();
+
+		auto itr = tiles.find(node_index(entry.level, entry.x, entry.z));
+		if (itr == tiles.end())
+		{
+			requests.push_back({ entry.level, entry.x, entry.z, entry.distance });
+			continue;
+		}
+
+		auto &tile = itr->second;
+		tile.last_wanted = frame;
+		if (tile.pending || tile.failed || entry.level + 1 >= info.num_levels)
+			continue;
+
+		// Same split criterion as the GPU, except for frustum culling, so turning around does not pop.
+		float size = info.world_size / float(1u << entry.level);
+		vec3 lo = vec3(float(entry.x) * size, -info.height_scale, float(entry.z) * size);
+		vec3 hi = vec3(lo.x + size, info.height_scale, lo.z + size);
+		float dist = distance(camera, clamp(camera, lo, hi));
+		if (dist >= info.lod_distance * size)
+			continue;
+
+		for (unsigned i = 0; i < 4; i++)
+			stack.push_back({ entry.level + 1, 2 * entry.x + (i & 1), 2 * entry.z + (i >> 1), dist });
+	}
+
+	// Fill in coarse levels first, they are what everything else falls back to.
+	std::sort(requests.begin(), requests.end(), [](const Request &a, const Request &b) {
+		if (a.level != b.level)
+			return a.level < b.level;
+		return a.distance < b.distance;
+	});
+}
+
+void GroundQuadtree::complete_uploads()
+{
+	uint64_t last_ticket = 0;
+
+	auto itr = std::remove_if(pending_nodes.begin(), pending_nodes.end(), [&](uint32_t index) {
+		auto &tile = tiles[index];
+		if (tile.ticket && !uploader->is_complete(tile.ticket))
+			return false;
+
+		last_ticket = std::max(last_ticket, tile.ticket);
+		tile.pending = false;
+		slots[index] = tile.slot;
+		dirty_nodes.push_back(index);
+		return true;
+	});
+	pending_nodes.erase(itr, pending_nodes.end());
+
+	// The uploads are done, but the graphics queue still needs to synchronize with them.
+	if (last_ticket)
+		uploader->wait(last_ticket, Vulkan::CommandBuffer::Type::Generic,
+		               VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+void GroundQuadtree::stream_tiles()
+{
+	unsigned num_contexts = device->get_num_frame_contexts();
+	auto itr = std::remove_if(retired_slots.begin(), retired_slots.end(), [&](const RetiredSlot &retired) {
+		if (retired.frame + num_contexts >= frame)
+			return false;
+		free_slots.push_back(retired.slot);
+		return true;
+	});
+	retired_slots.erase(itr, retired_slots.end());
+
+	for (auto &req : requests)
+	{
+		if (pending_nodes.size() >= info.max_loads_per_frame)
+			break;
+
+		uint32_t slot;
+		if (!allocate_slot(&slot))
+			break;
+
+		uint32_t index = node_index(req.level, req.x, req.z);
+		auto &tile = tiles[index];
+		tile.level = req.level;
+		tile.last_wanted = frame;
+
+		if (!load_tile(req.level, req.x, req.z, slot, &tile.ticket))
+		{
+			tile.failed = true;
+			free_slots.push_back(slot);
+			continue;
+		}
+
+		tile.slot = slot;
+		tile.pending = true;
+		pending_nodes.push_back(index);
+	}
+}
+
+void GroundQuadtree::refresh(const RenderContext &context_, TaskComposer &)
+{
+	if (node)
+		world_offset = node->cached_transform.world_transform[3].xyz();
+	else
+		world_offset = vec3(0.0f);
+
+	if (!device || !height_tiles)
+		return;
+
+	frame++;
+	if (uploader)
+		uploader->begin_frame();
+
+	complete_uploads();
+	gather_requests(context_.get_render_parameters().camera_position - world_offset);
+	stream_tiles();
+}
+
+void GroundQuadtree::upload_node_slots(Vulkan::CommandBuffer &cmd)
+{
+	if (dirty_nodes.empty())
+		return;
+
+	std::sort(dirty_nodes.begin(), dirty_nodes.end());
+	dirty_nodes.erase(std::unique(dirty_nodes.begin(), dirty_nodes.end()), dirty_nodes.end());
+
+	// Past a point, one big copy is cheaper than many small ones.
+	if (dirty_nodes.size() > 64)
+	{
+		memcpy(cmd.update_buffer(*node_slots, 0, slots.size() * sizeof(uint32_t)),
+		       slots.data(), slots.size() * sizeof(uint32_t));
+	}
+	else
+	{
+		for (uint32_t index : dirty_nodes)
+			*static_cast<uint32_t *>(cmd.update_buffer(*node_slots, index * sizeof(uint32_t), sizeof(uint32_t))) =
+					slots[index];
+	}
+
+	dirty_nodes.clear();
+}
+
+void GroundQuadtree::select_patches(Vulkan::CommandBuffer &cmd)
+{
+	auto &nodes_physical = graph->get_physical_buffer_resource(*nodes);
+	auto &patches_physical = graph->get_physical_buffer_resource(*patches);
+	auto &indirect_physical = graph->get_physical_buffer_resource(*indirect);
+
+	// Last frame's selection read the node slots, and its draw read the indirect buffer.
+	cmd.barrier(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	cmd.fill_buffer(indirect_physical, 0);
+	if (node_slots)
+		upload_node_slots(cmd);
+
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	// Zero instances are drawn until the tree is usable.
+	if (!context || !height_tiles)
+		return;
+
+	QuadtreeParameters params = {};
+	memcpy(params.frustum, context->get_visibility_frustum().get_planes(), sizeof(params.frustum));
+	params.camera_position = context->get_render_parameters().camera_position;
+	params.lod_distance = info.lod_distance;
+	params.world_offset = world_offset;
+	params.world_size = info.world_size;
+	params.height_range = vec2(-info.height_scale, info.height_scale);
+	params.num_levels = info.num_levels;
+	params.max_nodes = max_nodes;
+	params.max_patches = info.max_patches;
+	params.index_count = index_count;
+	*cmd.allocate_typed_constant_data<QuadtreeParameters>(1, 0, 1) = params;
+
+	cmd.set_program("builtin://shaders/ground/select_patches.comp");
+	cmd.set_storage_buffer(0, 0, *node_slots);
+	cmd.set_storage_buffer(0, 3, indirect_physical);
+	cmd.set_storage_buffer(0, 4, patches_physical);
+
+	VkDeviceSize list_size = max_nodes * sizeof(uint32_t);
+	for (unsigned level = 0; level < info.num_levels; level++)
+	{
+		cmd.set_storage_buffer(0, 1, nodes_physical, (level & 1) * list_size, list_size);
+		cmd.set_storage_buffer(0, 2, nodes_physical, ((level + 1) & 1) * list_size, list_size);
+
+		struct Push
+		{
+			uint32_t level;
+			uint32_t level_offset;
+		} push = { level, level_offset(level) };
+		cmd.push_constants(&push, 0, sizeof(push));
+
+		if (level == 0)
+			cmd.dispatch(1, 1, 1);
+		else
+			cmd.dispatch_indirect(indirect_physical, LevelArgsOffset + level * sizeof(uvec4));
+
+		if (level + 1 < info.num_levels)
+		{
+			cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+			            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+			            VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+		}
+	}
+}
+
+void GroundQuadtree::get_render_info(const RenderContext &context_, const RenderInfoComponent *,
+                                     RenderQueue &queue) const
+{
+	if (!graph || !height_tiles || !patches || !indirect)
+		return;
+
+	auto &patches_physical = graph->get_physical_buffer_resource(*patches);
+	auto &indirect_physical = graph->get_physical_buffer_resource(*indirect);
+
+	auto occlusion_image = occlusion->get_image();
+	auto base_color_image = base_color->get_image();
+	auto splatmap_image = splatmap->get_image();
+	auto normals_fine_image = normals_fine->get_image();
+
+	Util::Hasher hasher;
+	hasher.string("ground-quadtree");
+	auto pipe_hash = hasher.get();
+	hasher.s32(info.bandlimited_pixel);
+	vec3 center = world_offset + vec3(0.5f * info.world_size, 0.0f, 0.5f * info.world_size);
+	auto sorting_key = RenderInfo::get_sort_key(context_, Queue::Opaque, pipe_hash, hasher.get(),
+	                                            center, StaticLayer::Last);
+
+	hasher.u64(height_tiles->get_cookie());
+	hasher.u64(normal_tiles->get_cookie());
+	hasher.u64(occlusion_image->get_cookie());
+	hasher.u64(base_color_image->get_cookie());
+	hasher.u64(splatmap_image->get_cookie());
+	hasher.u64(normals_fine_image->get_cookie());
+	hasher.u64(patches_physical.get_cookie());
+	hasher.u64(indirect_physical.get_cookie());
+	auto instance_key = hasher.get();
+
+	// Patches are selected for the base context only. Other views draw the same selection.
+	auto *render_info = queue.push<QuadtreeRenderInfo>(Queue::Opaque, instance_key, sorting_key,
+	                                                   RenderFunctions::ground_quadtree_render, nullptr);
+	if (!render_info)
+		return;
+
+	uint32_t flags = GROUND_VARIANT_QUADTREE_BIT;
+	if (info.bandlimited_pixel)
+		flags |= GROUND_VARIANT_BANDLIMITED_PIXEL_BIT;
+
+	render_info->program = queue.get_shader_suites()[Util::ecast(RenderableType::Ground)].get_program(
+			DrawPipeline::Opaque, MESH_ATTRIBUTE_POSITION_BIT, MATERIAL_TEXTURE_BASE_COLOR_BIT, flags);
+
+	render_info->vbo = vbo.get();
+	render_info->ibo = ibo.get();
+	render_info->patches = &patches_physical;
+	render_info->indirect = &indirect_physical;
+
+	render_info->heights = &height_tiles->get_view();
+	render_info->normals = &normal_tiles->get_view();
+	render_info->occlusion = &occlusion_image->get_view();
+	render_info->base_color = &base_color_image->get_view();
+	render_info->splatmap = &splatmap_image->get_view();
+	render_info->normals_fine = &normals_fine_image->get_view();
+
+	// Only translation is honored, so normals need no transform.
+	render_info->push[0] = translate(world_offset);
+	render_info->push[1] = mat4(1.0f);
+
+	auto &ground_data = render_info->ground_data;
+	ground_data.inv_world_size = vec2(1.0f / info.world_size);
+	ground_data.uv_shift = vec2(0.0f);
+	ground_data.uv_tiling_scale = info.tiling_factor;
+	// Find something concrete to put here, same as Ground.
+	ground_data.tangent_scale = vec2(1.0f / 10.0f);
+	ground_data.texture_info.x = float(base_color_image->get_width(0));
+	ground_data.texture_info.y = float(base_color_image->get_height(0));
+	ground_data.texture_info.z = 1.0f / ground_data.texture_info.x;
+	ground_data.texture_info.w = 1.0f / ground_data.texture_info.y;
+
+	// Texel centers at the tile edges line up with the patch edges.
+	auto &tile_data = render_info->tile_data;
+	float res = float(info.tile_resolution);
+	tile_data.tile_uv_scale_bias = vec2((res - 1.0f) / res, 0.5f / res);
+	tile_data.inv_patch_resolution = 1.0f / float(info.patch_resolution);
+	tile_data.height_scale = info.height_scale;
+	tile_data.skirt_depth = 0.05f;
+}
+
+void GroundQuadtree::add_render_passes(RenderGraph &graph_)
+{
+	graph = &graph_;
+
+	auto &select = graph_.add_pass("ground-quadtree-select", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+
+	BufferInfo nodes_info;
+	nodes_info.size = 2 * max_nodes * sizeof(uint32_t);
+	nodes = &select.add_storage_output("ground-quadtree-nodes", nodes_info);
+
+	BufferInfo patches_info;
+	patches_info.size = info.max_patches * sizeof(QuadtreePatch);
+	patches = &select.add_storage_output("ground-quadtree-patches", patches_info);
+
+	BufferInfo indirect_info;
+	indirect_info.size = LevelArgsOffset + MaxQuadtreeLevels * sizeof(uvec4);
+	indirect_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	indirect = &select.add_storage_output("ground-quadtree-indirect", indirect_info);
+
+	select.set_build_render_pass([this](Vulkan::CommandBuffer &cmd) {
+		select_patches(cmd);
+	});
+}
+
+void GroundQuadtree::set_base_renderer(const RendererSuite *)
+{
+}
+
+void GroundQuadtree::set_base_render_context(const RenderContext *context_)
+{
+	context = context_;
+}
+
+void GroundQuadtree::setup_render_pass_dependencies(RenderGraph &, RenderPass &target,
+                                                    RenderPassCreator::DependencyFlags dep_flags)
+{
+	if ((dep_flags & RenderPassCreator::GEOMETRY_BIT) != 0)
+	{
+		target.add_indirect_buffer_input("ground-quadtree-indirect");
+		target.add_storage_read_only_input("ground-quadtree-patches", VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+	}
+}
+
+void GroundQuadtree::setup_render_pass_dependencies(RenderGraph &)
+{
+}
+
+void GroundQuadtree::setup_render_pass_resources(RenderGraph &)
+{
+}
+
+void GroundQuadtree::set_scene(Scene *)
+{
+}
+}
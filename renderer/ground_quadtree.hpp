@@ -0,0 +1,197 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "abstract_renderable.hpp"
+#include "scene.hpp"
+#include "application_wsi_events.hpp"
+#include "async_uploader.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Granite
+{
+class RenderBufferResource;
+class RenderPass;
+
+struct GroundQuadtreeInfo
+{
+	// Tiles are read from <tile_directory>/height_<level>_<x>_<z>.gtx and normal_<level>_<x>_<z>.gtx.
+	// Level 0 is one tile covering the whole terrain, level N has 2^N x 2^N tiles.
+	// Tiles are tile_resolution texels square, and neighbor tiles share their edge texels.
+	// Heights are in [-1, 1], normals are two component and generated for the final world scale.
+	std::string tile_directory;
+	unsigned num_levels = 8;
+	unsigned tile_resolution = 257;
+
+	// Levels below this are loaded up front and never evicted.
+	unsigned resident_levels = 2;
+	// Layers of the height and normal tile arrays, which bounds memory use.
+	unsigned max_resident_tiles = 512;
+	unsigned max_loads_per_frame = 8;
+
+	// The terrain spans [0, world_size] in X and Z, relative to the node.
+	float world_size = 8192.0f;
+	float height_scale = 512.0f;
+
+	// Nodes split when the camera is closer than lod_distance times their size.
+	float lod_distance = 2.0f;
+	// Quads along a patch edge, at most 64.
+	unsigned patch_resolution = 32;
+	unsigned max_patches = 16 * 1024;
+
+	// Regular Ground material textures, which are stretched over the whole terrain.
+	std::string occlusionmap;
+	std::string base_color;
+	std::string splatmap;
+	std::string normalmap_fine;
+	vec2 tiling_factor = vec2(1.0f);
+	bool bandlimited_pixel = false;
+};
+
+// Ground for terrains which do not fit in memory.
+// Height and normal tiles of a quadtree stream in around the camera through AsyncUploader,
+// into texture arrays of fixed size. Tiles nobody asked for lately are evicted when the arrays are full.
+// A compute pass walks the resident part of the quadtree one level at a time,
+// frustum culls nodes against the base render context and emits the leaves as patches,
+// which are drawn with one indirect draw. Skirts hide cracks between patches of different levels.
+// The node only honors final translation, like Ocean.
+class GroundQuadtree : public AbstractRenderable,
+                       public PerFrameRefreshable,
+                       public RenderPassCreator,
+                       public EventHandler
+{
+public:
+	GroundQuadtree(const GroundQuadtreeInfo &info, Scene::NodeHandle node);
+	~GroundQuadtree() override;
+
+	struct Handles
+	{
+		Entity *entity;
+		GroundQuadtree *ground;
+	};
+	static Handles add_to_scene(Scene &scene, const GroundQuadtreeInfo &info, Scene::NodeHandle node = {});
+
+	unsigned get_num_resident_tiles() const;
+
+private:
+	GroundQuadtreeInfo info;
+	Scene::NodeHandle node;
+
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+
+	Vulkan::Device *device = nullptr;
+	std::unique_ptr<Vulkan::AsyncUploader> uploader;
+	Vulkan::ImageHandle height_tiles;
+	Vulkan::ImageHandle normal_tiles;
+	Vulkan::BufferHandle node_slots;
+	Vulkan::BufferHandle vbo;
+	Vulkan::BufferHandle ibo;
+	unsigned index_count = 0;
+
+	Vulkan::Texture *occlusion = nullptr;
+	Vulkan::Texture *base_color = nullptr;
+	Vulkan::Texture *splatmap = nullptr;
+	Vulkan::Texture *normals_fine = nullptr;
+
+	struct Tile
+	{
+		uint32_t slot = ~0u;
+		unsigned level = 0;
+		uint64_t ticket = 0;
+		uint64_t last_wanted = 0;
+		bool pending = false;
+		// Missing or broken tiles are not retried, and are treated as leaves.
+		bool failed = false;
+	};
+
+	struct RetiredSlot
+	{
+		uint32_t slot;
+		uint64_t frame;
+	};
+
+	struct Request
+	{
+		unsigned level;
+		unsigned x;
+		unsigned z;
+		float distance;
+	};
+
+	// Array layer of every node, ~0u when not resident. Mirrored by node_slots.
+	std::vector<uint32_t> slots;
+	std::vector<uint32_t> dirty_nodes;
+	std::unordered_map<uint32_t, Tile> tiles;
+	std::vector<uint32_t> pending_nodes;
+	std::vector<uint32_t> free_slots;
+	std::vector<RetiredSlot> retired_slots;
+	std::vector<Request> requests;
+	uint64_t frame = 0;
+	unsigned num_nodes = 0;
+	VkFormat height_format = VK_FORMAT_UNDEFINED;
+	VkFormat normal_format = VK_FORMAT_UNDEFINED;
+
+	vec3 world_offset = vec3(0.0f);
+
+	bool init_tile_arrays();
+	void build_patch_mesh();
+	bool upload_layer(const Vulkan::ImageHandle &image, uint32_t layer, const void *data, uint64_t *ticket);
+	bool load_tile(unsigned level, unsigned x, unsigned z, uint32_t slot, uint64_t *ticket);
+	bool allocate_slot(uint32_t *slot);
+	void gather_requests(const vec3 &camera);
+	void complete_uploads();
+	void stream_tiles();
+	void upload_node_slots(Vulkan::CommandBuffer &cmd);
+	void select_patches(Vulkan::CommandBuffer &cmd);
+
+	const RenderContext *context = nullptr;
+	RenderGraph *graph = nullptr;
+	RenderBufferResource *nodes = nullptr;
+	RenderBufferResource *patches = nullptr;
+	RenderBufferResource *indirect = nullptr;
+	unsigned max_nodes = 0;
+
+	void refresh(const RenderContext &context, TaskComposer &composer) override;
+
+	bool has_static_aabb() const override
+	{
+		return false;
+	}
+
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                     RenderQueue &queue) const override;
+
+	void add_render_passes(RenderGraph &graph) override;
+	void set_base_renderer(const RendererSuite *suite) override;
+	void set_base_render_context(const RenderContext *context) override;
+	void setup_render_pass_dependencies(RenderGraph &graph, RenderPass &target,
+	                                    RenderPassCreator::DependencyFlags dep_flags) override;
+	void setup_render_pass_dependencies(RenderGraph &graph) override;
+	void setup_render_pass_resources(RenderGraph &graph) override;
+	void set_scene(Scene *scene) override;
+};
+}
@@ -0,0 +1,487 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "impostor.hpp"
+#include "mesh.hpp"
+#include "device.hpp"
+#include "renderer.hpp"
+#include "render_graph.hpp"
+#include "muglm/matrix_helper.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+using namespace Util;
+
+namespace Granite
+{
+namespace RenderFunctions
+{
+void impostor_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances)
+{
+	auto &info = *static_cast<const ImpostorRenderInfo *>(infos[0].render_info);
+	cmd.set_program(info.program);
+
+	for (unsigned i = 0; i < 4; i++)
+		cmd.set_texture(2, i, *info.views[i], Vulkan::StockSampler::LinearClamp);
+
+	struct Push
+	{
+		float frame_uv_size;
+		float frames_per_side;
+	} push = { info.frame_uv_size, info.frames_per_side };
+	cmd.push_constants(&push, 0, sizeof(push));
+
+	cmd.set_cull_mode(VK_CULL_MODE_NONE);
+	cmd.set_primitive_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+	Vulkan::CommandBufferUtil::set_quad_vertex_state(cmd);
+
+	auto *quads = static_cast<ImpostorQuad *>(
+		cmd.allocate_vertex_data(1, instances * sizeof(ImpostorQuad),
+		                         sizeof(ImpostorQuad), VK_VERTEX_INPUT_RATE_INSTANCE));
+	for (unsigned i = 0; i < instances; i++)
+		quads[i] = *static_cast<const ImpostorQuad *>(infos[i].instance_data);
+
+	cmd.set_vertex_attrib(1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(ImpostorQuad, center));
+	cmd.set_vertex_attrib(2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(ImpostorQuad, right));
+	cmd.set_vertex_attrib(3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(ImpostorQuad, up));
+	cmd.set_vertex_attrib(4, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(ImpostorQuad, frame));
+	cmd.draw(4, instances);
+}
+}
+
+static float sign_not_zero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Full sphere octahedral mapping, [-1, 1] on both axes.
+static vec2 oct_encode(const vec3 &n)
+{
+	vec2 p = n.xy() / (muglm::abs(n.x) + muglm::abs(n.y) + muglm::abs(n.z));
+	if (n.z < 0.0f)
+		p = vec2((1.0f - muglm::abs(p.y)) * sign_not_zero(p.x), (1.0f - muglm::abs(p.x)) * sign_not_zero(p.y));
+	return p;
+}
+
+static vec3 oct_decode(const vec2 &p)
+{
+	vec3 n(p.x, p.y, 1.0f - muglm::abs(p.x) - muglm::abs(p.y));
+	if (n.z < 0.0f)
+		n = vec3((1.0f - muglm::abs(p.y)) * sign_not_zero(p.x), (1.0f - muglm::abs(p.x)) * sign_not_zero(p.y), n.z);
+	return normalize(n);
+}
+
+static const char *atlas_names[4] = {
+	"impostor-emissive", "impostor-albedo", "impostor-normal", "impostor-pbr",
+};
+
+bool Impostor::is_active(const RenderContext &context, const RenderInfoComponent *transform) const
+{
+	auto &selection = context.get_lod_selection();
+	if (!ready || selection.impostor_distance <= 0.0f)
+		return false;
+
+	vec3 d = transform->world_aabb.get_center() - context.get_render_parameters().camera_position;
+	return dot(d, d) >= selection.impostor_distance * selection.impostor_distance;
+}
+
+void Impostor::get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+                               RenderQueue &queue) const
+{
+	auto &m = transform->transform->world_transform;
+	vec3 camera = (inverse(m) * vec4(context.get_render_parameters().camera_position, 1.0f)).xyz();
+	vec3 direction = normalize(camera - center);
+	vec3 right, up;
+	ImpostorManager::get_frame_basis(direction, right, up);
+
+	mat3 m3(m[0].xyz(), m[1].xyz(), m[2].xyz());
+	auto *quad = queue.allocate_one<ImpostorQuad>();
+	quad->center = m * vec4(center, 1.0f);
+	quad->right = vec4(m3 * (right * radius), 0.0f);
+	quad->up = vec4(m3 * (up * radius), 0.0f);
+	quad->frame = vec4(manager->get_frame_coord(direction), tile_offset);
+
+	// All impostors of a manager share the atlas, so they draw as one batch.
+	auto type = emissive ? Queue::OpaqueEmissive : Queue::Opaque;
+	Hasher h;
+	h.pointer(manager);
+	h.u32(emissive);
+	auto instance_key = h.get();
+	auto sorting_key = RenderInfo::get_sort_key(context, type, instance_key, instance_key,
+	                                            transform->world_aabb.get_center());
+
+	auto *info = queue.push<ImpostorRenderInfo>(type, instance_key, sorting_key,
+	                                            RenderFunctions::impostor_render, quad);
+
+	if (info)
+	{
+		*info = manager->get_atlas_info();
+		auto &suite = queue.get_shader_suites()[ecast(RenderableType::Impostor)];
+		info->program = suite.get_program(DrawPipeline::AlphaTest, 0, emissive ? MATERIAL_EMISSIVE_BIT : 0);
+	}
+}
+
+ImpostorManager::ImpostorManager(const ImpostorOptions &options_)
+	: options(options_)
+{
+	options.frames_per_side = std::max(options.frames_per_side, 2u);
+	if (get_tiles_per_side() == 0)
+	{
+		LOGE("Impostor atlas of %u pixels cannot fit %u frames of %u pixels.\n",
+		     options.atlas_resolution, options.frames_per_side, options.frame_resolution);
+	}
+}
+
+ImpostorManager::~ImpostorManager()
+{
+	release_entries();
+}
+
+ImpostorManager::Handles ImpostorManager::add_to_scene(Scene &scene, const ImpostorOptions &options)
+{
+	Handles handles;
+	handles.entity = scene.create_entity();
+
+	auto manager = Util::make_handle<ImpostorManager>(options);
+
+	auto *update_component = handles.entity->allocate_component<PerFrameUpdateComponent>();
+	update_component->refresh = manager.get();
+
+	auto *rp = handles.entity->allocate_component<RenderPassComponent>();
+	rp->creator = manager.get();
+
+	auto *renderable = handles.entity->allocate_component<RenderableComponent>();
+	renderable->renderable = manager;
+
+	handles.manager = manager.get();
+	return handles;
+}
+
+unsigned ImpostorManager::get_impostor_count() const
+{
+	return unsigned(entries.size());
+}
+
+unsigned ImpostorManager::get_ready_count() const
+{
+	return unsigned(std::count_if(entries.begin(), entries.end(), [](const Entry &entry) {
+		return entry.impostor->ready;
+	}));
+}
+
+unsigned ImpostorManager::get_tile_resolution() const
+{
+	return options.frame_resolution * options.frames_per_side;
+}
+
+unsigned ImpostorManager::get_tiles_per_side() const
+{
+	return options.atlas_resolution / get_tile_resolution();
+}
+
+vec2 ImpostorManager::get_frame_coord(const vec3 &direction) const
+{
+	return (oct_encode(direction) * 0.5f + 0.5f) * float(options.frames_per_side - 1);
+}
+
+void ImpostorManager::get_frame_basis(const vec3 &direction, vec3 &right, vec3 &up)
+{
+	vec3 up_ref = muglm::abs(direction.y) > 0.999f ? vec3(0.0f, 0.0f, 1.0f) : vec3(0.0f, 1.0f, 0.0f);
+	right = normalize(cross(up_ref, direction));
+	up = cross(direction, right);
+}
+
+static const ComponentGroupVector<RenderInfoComponent, RenderableComponent, OpaqueComponent> &
+get_opaque_group(Scene &scene)
+{
+	return scene.get_entity_pool().get_component_group<RenderInfoComponent, RenderableComponent, OpaqueComponent>();
+}
+
+void ImpostorManager::release_entries()
+{
+	for (auto &entry : entries)
+		entry.mesh->impostor = nullptr;
+	entries.clear();
+	baking = -1;
+	baked = -1;
+}
+
+void ImpostorManager::scan()
+{
+	release_entries();
+
+	auto &opaque = get_opaque_group(*scene);
+	scanned_opaque_count = opaque.size();
+
+	struct Candidate
+	{
+		AbstractRenderableHandle renderable;
+		StaticMesh *mesh;
+		unsigned instances;
+	};
+	std::vector<Candidate> candidates;
+	std::unordered_map<const AbstractRenderable *, unsigned> candidate_indices;
+
+	for (auto &o : opaque)
+	{
+		auto *info = get_component<RenderInfoComponent>(o);
+		auto &renderable = get_component<RenderableComponent>(o)->renderable;
+
+		// Only plain static meshes, i.e. indexed and not blended, see StaticMesh::get_indirect_mesh().
+		if (!info->transform || info->skin_transform || renderable->get_indirect_mesh() != renderable.get())
+			continue;
+
+		auto itr = candidate_indices.find(renderable.get());
+		if (itr == candidate_indices.end())
+		{
+			auto *mesh = static_cast<StaticMesh *>(renderable.get());
+			if (mesh->impostor || mesh->static_aabb.get_radius() <= 0.0f)
+				continue;
+			candidate_indices[renderable.get()] = unsigned(candidates.size());
+			candidates.push_back({ renderable, mesh, 1 });
+		}
+		else
+			candidates[itr->second].instances++;
+	}
+
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.instances > b.instances;
+	});
+
+	unsigned tiles = get_tiles_per_side();
+	float tile_uv_size = float(get_tile_resolution()) / float(options.atlas_resolution);
+
+	for (auto &candidate : candidates)
+	{
+		if (entries.size() >= tiles * tiles || candidate.instances < options.min_instances)
+			break;
+
+		unsigned index = unsigned(entries.size());
+		auto impostor = std::make_unique<Impostor>();
+		impostor->manager = this;
+		impostor->center = candidate.mesh->static_aabb.get_center();
+		impostor->radius = candidate.mesh->static_aabb.get_radius();
+		impostor->tile_offset = vec2(float(index % tiles), float(index / tiles)) * tile_uv_size;
+		impostor->emissive = candidate.mesh->material->needs_emissive;
+		candidate.mesh->impostor = impostor.get();
+		entries.push_back({ candidate.renderable, candidate.mesh, std::move(impostor) });
+	}
+}
+
+void ImpostorManager::refresh(const RenderContext &, TaskComposer &)
+{
+	if (!scene || !device)
+		return;
+
+	if (get_opaque_group(*scene).size() != scanned_opaque_count)
+		scan();
+
+	// The tile baked last frame is written before anything of this frame samples it.
+	if (baked >= 0)
+		entries[baked].impostor->ready = true;
+	baked = -1;
+	baking = -1;
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (!entries[i].impostor->ready)
+		{
+			baking = int(i);
+			break;
+		}
+	}
+}
+
+void ImpostorManager::bake(Vulkan::CommandBuffer &cmd)
+{
+	if (baking < 0)
+		return;
+
+	auto &entry = entries[baking];
+	auto &impostor = *entry.impostor;
+	unsigned tiles = get_tiles_per_side();
+	unsigned tile_resolution = get_tile_resolution();
+	unsigned frame_resolution = options.frame_resolution;
+	unsigned x0 = (unsigned(baking) % tiles) * tile_resolution;
+	unsigned y0 = (unsigned(baking) / tiles) * tile_resolution;
+
+	// Atlases are preserved, so clear out whatever the tile held before.
+	VkClearRect rect = {};
+	rect.rect.offset = { int(x0), int(y0) };
+	rect.rect.extent = { tile_resolution, tile_resolution };
+	rect.layerCount = 1;
+	VkClearValue value = {};
+	for (unsigned i = 0; i < 4; i++)
+		cmd.clear_quad(i, rect, value);
+
+	float r = impostor.radius;
+	bake_context.set_camera(ortho(-r, r, -r, r, r, 3.0f * r), translate(vec3(0.0f, 0.0f, -2.0f * r)));
+	bake_info.transform = &bake_transform;
+
+	auto &renderer = suite->get_renderer(RendererSuite::Type::Deferred);
+	unsigned n = options.frames_per_side;
+
+	for (unsigned y = 0; y < n; y++)
+	{
+		for (unsigned x = 0; x < n; x++)
+		{
+			// Rotate the mesh so the frame's view direction points towards the camera.
+			vec3 direction = oct_decode(vec2(float(x), float(y)) * (2.0f / float(n - 1)) - 1.0f);
+			vec3 right, up;
+			get_frame_basis(direction, right, up);
+			bake_transform.world_transform = mat4(transpose(mat3(right, up, direction))) * translate(-impostor.center);
+			bake_info.world_aabb = entry.mesh->static_aabb.transform(bake_transform.world_transform);
+
+			VkViewport vp = {};
+			vp.x = float(x0 + x * frame_resolution);
+			vp.y = float(y0 + y * frame_resolution);
+			vp.width = float(frame_resolution);
+			vp.height = float(frame_resolution);
+			vp.maxDepth = 1.0f;
+			cmd.set_viewport(vp);
+
+			VkRect2D scissor = {};
+			scissor.offset = { int(vp.x), int(vp.y) };
+			scissor.extent = { frame_resolution, frame_resolution };
+			cmd.set_scissor(scissor);
+
+			renderer.begin(bake_queue);
+			entry.mesh->get_render_info(bake_context, &bake_info, bake_queue);
+			renderer.flush(cmd, bake_queue, bake_context);
+		}
+	}
+
+	baked = baking;
+}
+
+void ImpostorManager::get_render_info(const RenderContext &, const RenderInfoComponent *, RenderQueue &) const
+{
+}
+
+void ImpostorManager::add_render_passes(RenderGraph &graph)
+{
+	device = &graph.get_device();
+	bake_context.set_device(device);
+
+	// The atlases are new, everything needs to be baked again.
+	for (auto &entry : entries)
+		entry.impostor->ready = false;
+	baking = -1;
+	baked = -1;
+
+	AttachmentInfo info;
+	info.size_class = SizeClass::Absolute;
+	info.size_x = float(options.atlas_resolution);
+	info.size_y = float(options.atlas_resolution);
+	info.flags |= ATTACHMENT_INFO_PRESERVE_BIT;
+
+	AttachmentInfo emissive = info;
+	AttachmentInfo albedo = info;
+	AttachmentInfo normal = info;
+	AttachmentInfo pbr = info;
+	AttachmentInfo depth = info;
+	emissive.format = device->image_format_is_supported(VK_FORMAT_B10G11R11_UFLOAT_PACK32,
+	                                                    VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) ?
+	                  VK_FORMAT_B10G11R11_UFLOAT_PACK32 : VK_FORMAT_R16G16B16A16_SFLOAT;
+	albedo.format = VK_FORMAT_R8G8B8A8_SRGB;
+	normal.format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+	pbr.format = VK_FORMAT_R8G8_UNORM;
+	depth.format = device->get_default_depth_format();
+	depth.flags &= ~ATTACHMENT_INFO_PRESERVE_BIT;
+
+	auto &pass = graph.add_pass("impostor-bake", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	atlas[0] = &pass.add_color_output(atlas_names[0], emissive);
+	atlas[1] = &pass.add_color_output(atlas_names[1], albedo);
+	atlas[2] = &pass.add_color_output(atlas_names[2], normal);
+	atlas[3] = &pass.add_color_output(atlas_names[3], pbr);
+	pass.set_depth_stencil_output("impostor-depth", depth);
+
+	pass.set_get_render_area([this](VkRect2D *area) {
+		// Nothing to bake, keep the pass as cheap as possible.
+		if (baking < 0)
+		{
+			*area = { { 0, 0 }, { 1, 1 } };
+			return true;
+		}
+
+		unsigned tiles = get_tiles_per_side();
+		unsigned tile_resolution = get_tile_resolution();
+		area->offset.x = int((unsigned(baking) % tiles) * tile_resolution);
+		area->offset.y = int((unsigned(baking) / tiles) * tile_resolution);
+		area->extent = { tile_resolution, tile_resolution };
+		return true;
+	});
+
+	pass.set_get_clear_color([](unsigned, VkClearColorValue *) {
+		return false;
+	});
+
+	pass.set_get_clear_depth_stencil([](VkClearDepthStencilValue *value) {
+		if (value)
+			*value = { 1.0f, 0u };
+		return true;
+	});
+
+	pass.set_build_render_pass([this](Vulkan::CommandBuffer &cmd) {
+		bake(cmd);
+	});
+
+	atlas_info.frame_uv_size = float(options.frame_resolution) / float(options.atlas_resolution);
+	atlas_info.frames_per_side = float(options.frames_per_side);
+}
+
+void ImpostorManager::set_base_renderer(const RendererSuite *suite_)
+{
+	suite = suite_;
+}
+
+void ImpostorManager::set_base_render_context(const RenderContext *)
+{
+}
+
+void ImpostorManager::setup_render_pass_dependencies(RenderGraph &, RenderPass &target,
+                                                     RenderPassCreator::DependencyFlags dep_flags)
+{
+	if ((dep_flags & (RenderPassCreator::GEOMETRY_BIT | RenderPassCreator::MATERIAL_BIT)) == 0)
+		return;
+
+	for (auto *name : atlas_names)
+		target.add_texture_input(name);
+}
+
+void ImpostorManager::setup_render_pass_dependencies(RenderGraph &)
+{
+}
+
+void ImpostorManager::setup_render_pass_resources(RenderGraph &graph)
+{
+	for (unsigned i = 0; i < 4; i++)
+		atlas_info.views[i] = &graph.get_physical_texture_resource(*atlas[i]);
+}
+
+void ImpostorManager::set_scene(Scene *scene_)
+{
+	scene = scene_;
+	scanned_opaque_count = 0;
+	release_entries();
+}
+}
@@ -0,0 +1,168 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "abstract_renderable.hpp"
+#include "render_context.hpp"
+#include "render_queue.hpp"
+#include "scene.hpp"
+#include "image.hpp"
+#include <memory>
+#include <vector>
+
+namespace Granite
+{
+class RenderTextureResource;
+class ImpostorManager;
+
+namespace RenderFunctions
+{
+void impostor_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances);
+}
+
+// Mirrors the instance attributes in shaders/impostor.vert.
+struct ImpostorQuad
+{
+	vec4 center;
+	vec4 right;
+	vec4 up;
+	// xy: continuous frame coordinate of the view direction, zw: atlas UV of the first frame.
+	vec4 frame;
+};
+
+struct ImpostorRenderInfo
+{
+	// Emissive, base color, normal and PBR atlases.
+	const Vulkan::ImageView *views[4] = {};
+	Vulkan::Program *program = nullptr;
+	float frame_uv_size = 0.0f;
+	float frames_per_side = 0.0f;
+};
+
+// A mesh baked from a grid of octahedral view directions into one tile of the impostor atlas.
+struct Impostor
+{
+	const ImpostorManager *manager = nullptr;
+	// Bounding sphere of the mesh in object space.
+	vec3 center = vec3(0.0f);
+	float radius = 0.0f;
+	vec2 tile_offset = vec2(0.0f);
+	bool emissive = false;
+	bool ready = false;
+
+	bool is_active(const RenderContext &context, const RenderInfoComponent *transform) const;
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform, RenderQueue &queue) const;
+};
+
+struct ImpostorOptions
+{
+	unsigned atlas_resolution = 2048;
+	unsigned frame_resolution = 64;
+	// View directions along each axis of the octahedral grid.
+	unsigned frames_per_side = 8;
+	// Meshes with fewer instances do not get an impostor.
+	unsigned min_instances = 1;
+};
+
+// Bakes impostors for the most instanced opaque static meshes in the scene, one mesh per frame.
+// Atlases are G-buffer layouts, so impostors are lit like any other opaque surface.
+// StaticMesh uses the impostor instead of the mesh when the render context sets
+// LodSelection::impostor_distance. Impostors do not render motion vectors,
+// and GPU driven meshes are never replaced since they bypass StaticMesh::get_render_info().
+class ImpostorManager : public AbstractRenderable,
+                        public PerFrameRefreshable,
+                        public RenderPassCreator
+{
+public:
+	explicit ImpostorManager(const ImpostorOptions &options);
+	~ImpostorManager() override;
+
+	struct Handles
+	{
+		Entity *entity;
+		ImpostorManager *manager;
+	};
+	static Handles add_to_scene(Scene &scene, const ImpostorOptions &options = {});
+
+	unsigned get_impostor_count() const;
+	unsigned get_ready_count() const;
+
+	const ImpostorOptions &get_options() const
+	{
+		return options;
+	}
+
+	const ImpostorRenderInfo &get_atlas_info() const
+	{
+		return atlas_info;
+	}
+
+	// Continuous octahedral frame coordinate of an object space direction, and the basis of its quad.
+	vec2 get_frame_coord(const vec3 &direction) const;
+	static void get_frame_basis(const vec3 &direction, vec3 &right, vec3 &up);
+
+private:
+	ImpostorOptions options;
+
+	struct Entry
+	{
+		AbstractRenderableHandle renderable;
+		StaticMesh *mesh;
+		std::unique_ptr<Impostor> impostor;
+	};
+	std::vector<Entry> entries;
+	size_t scanned_opaque_count = 0;
+	int baking = -1;
+	int baked = -1;
+
+	Vulkan::Device *device = nullptr;
+	Scene *scene = nullptr;
+	const RendererSuite *suite = nullptr;
+	RenderTextureResource *atlas[4] = {};
+	ImpostorRenderInfo atlas_info;
+
+	RenderContext bake_context;
+	CachedTransform bake_transform;
+	RenderInfoComponent bake_info;
+	RenderQueue bake_queue;
+
+	unsigned get_tiles_per_side() const;
+	unsigned get_tile_resolution() const;
+	void release_entries();
+	void scan();
+	void bake(Vulkan::CommandBuffer &cmd);
+
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                     RenderQueue &queue) const override;
+	void refresh(const RenderContext &context, TaskComposer &composer) override;
+
+	void add_render_passes(RenderGraph &graph) override;
+	void set_base_renderer(const RendererSuite *suite) override;
+	void set_base_render_context(const RenderContext *context) override;
+	void setup_render_pass_dependencies(RenderGraph &graph, RenderPass &target,
+	                                    RenderPassCreator::DependencyFlags dep_flags) override;
+	void setup_render_pass_dependencies(RenderGraph &graph) override;
+	void setup_render_pass_resources(RenderGraph &graph) override;
+	void set_scene(Scene *scene) override;
+};
+}
@@ -0,0 +1,468 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cluster_binning.hpp"
+#include "render_context.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "lights.hpp"
+#include "cpu_rasterizer.hpp"
+#include "task_composer.hpp"
+#include "simd_headers.hpp"
+#include <limits>
+#include <string.h>
+
+namespace Granite
+{
+namespace ClusterBinning
+{
+static vec2 project_sphere_flat(float view_xy, float view_z, float radius)
+{
+	// Goal here is to deal with the intersection problem in 2D.
+	// Camera forms a cone with the sphere.
+	// We want to intersect that cone with the near plane.
+	// To do that we find minimum and maximum angles in 2D, rotate the direction vector,
+	// and project down to plane.
+
+	float len = length(vec2(view_xy, view_z));
+	float sin_xy = radius / len;
+
+	if (sin_xy < 0.999f)
+	{
+		// Find half-angles for the cone, and turn it into a 2x2 rotation matrix.
+		float cos_xy = muglm::sqrt(1.0f - sin_xy * sin_xy);
+
+		// Rotate half-angles in each direction.
+		vec2 rot_lo = mat2(vec2(cos_xy, +sin_xy), vec2(-sin_xy, cos_xy)) * vec2(view_xy, view_z);
+		vec2 rot_hi = mat2(vec2(cos_xy, -sin_xy), vec2(+sin_xy, cos_xy)) * vec2(view_xy, view_z);
+
+		// Clip to some sensible ranges.
+		if (rot_lo.y <= 0.0f)
+		{
+			rot_lo.x = -1.0f;
+			rot_lo.y = 0.0f;
+		}
+
+		if (rot_hi.y <= 0.0f)
+		{
+			rot_hi.x = +1.0f;
+			rot_hi.y = 0.0f;
+		}
+
+		return vec2(rot_lo.x / rot_lo.y, rot_hi.x / rot_hi.y);
+	}
+	else
+		return vec2(-std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
+}
+
+struct ProjectedResult
+{
+	vec4 ranges;
+	vec4 transformed_ranges;
+	mat2 clip_transform;
+	bool ellipsis;
+};
+
+
+static ProjectedResult project_sphere(const RenderContext &context,
+                                      const vec3 &pos, float radius)
+{
+	ProjectedResult result;
+	vec3 view = (context.get_render_parameters().view * vec4(pos, 1.0f)).xyz();
+
+	// Work in projection space.
+	view.y = -view.y;
+	view.z = -view.z;
+
+	result.ranges = vec4(project_sphere_flat(view.x, view.z, radius),
+	                     project_sphere_flat(view.y, view.z, radius));
+
+	// Need to rotate view space on the Z-axis so the ellipsis will
+	// have its major axes orthogonal with X/Y.
+	float xy_length = length(vec2(view.x, view.y));
+
+	if (xy_length < 0.0001f)
+	{
+		result.clip_transform = mat2(1.0f);
+	}
+	else
+	{
+		float inv_xy_length = 1.0f / muglm::max(xy_length, 0.0000001f);
+		result.clip_transform = mat2(vec2(view.x, -view.y) * inv_xy_length,
+		                             vec2(view.y, view.x) * inv_xy_length);
+	}
+
+	vec2 transformed_xy = result.clip_transform * vec2(view.x, view.y);
+
+	result.transformed_ranges = vec4(project_sphere_flat(transformed_xy.x, view.z, radius),
+	                                 project_sphere_flat(transformed_xy.y, view.z, radius));
+
+	result.ellipsis =
+			result.transformed_ranges.x > -std::numeric_limits<float>::infinity() &&
+			result.transformed_ranges.y < std::numeric_limits<float>::infinity() &&
+			result.transformed_ranges.z > -std::numeric_limits<float>::infinity() &&
+			result.transformed_ranges.w < std::numeric_limits<float>::infinity();
+
+	return result;
+}
+
+static void set_all_tiles(const ClusterBinningInput &input, uint32_t *masks, unsigned words_per_tile,
+                          unsigned index, uvec4 tiles)
+{
+	for (unsigned y = tiles.z; y <= tiles.w; y++)
+	{
+		for (unsigned x = tiles.x; x <= tiles.y; x++)
+		{
+			unsigned linear_coord = y * input.resolution_x + x;
+			masks[linear_coord * words_per_tile + (index >> 5)] |= 1u << (index & 31);
+		}
+	}
+}
+
+static void bin_spot_light(const ClusterBinningInput &input, uint32_t *masks, unsigned words_per_tile,
+                           unsigned index, std::vector<uvec2> &coverage)
+{
+	auto &params = input.context->get_render_parameters();
+
+	Rasterizer::CullMode cull;
+	vec2 range = spot_light_z_range(*input.context, input.models[index]);
+	if (range.x <= params.z_near && range.y >= params.z_far)
+		cull = Rasterizer::CullMode::Both;
+	else if (range.x <= params.z_near)
+		cull = Rasterizer::CullMode::Back;
+	else
+		cull = Rasterizer::CullMode::Front;
+
+	if (cull == Rasterizer::CullMode::Both)
+	{
+		set_all_tiles(input, masks, words_per_tile, index,
+		              uvec4(0, input.resolution_x - 1, 0, input.resolution_y - 1));
+		return;
+	}
+
+	auto mvp = params.view_projection * input.models[index];
+	const vec4 spot_points[5] = {
+			vec4(0.0f, 0.0f, 0.0f, 1.0f),
+			vec4(+1.0f, +1.0f, -1.0f, 1.0f),
+			vec4(-1.0f, +1.0f, -1.0f, 1.0f),
+			vec4(-1.0f, -1.0f, -1.0f, 1.0f),
+			vec4(+1.0f, -1.0f, -1.0f, 1.0f),
+	};
+	vec4 clip[5];
+	Rasterizer::transform_vertices(clip, spot_points, 5, mvp);
+	coverage.clear();
+
+	static const unsigned indices[6 * 3] = {
+			0, 1, 2,
+			0, 2, 3,
+			0, 3, 4,
+			0, 4, 1,
+			2, 1, 3,
+			4, 3, 1,
+	};
+
+	Rasterizer::rasterize_conservative_triangles(coverage, clip,
+	                                             indices, sizeof(indices) / sizeof(indices[0]),
+	                                             uvec2(input.resolution_x, input.resolution_y),
+	                                             cull);
+
+	for (auto &cov : coverage)
+	{
+		unsigned linear_coord = cov.y * input.resolution_x + cov.x;
+		masks[linear_coord * words_per_tile + (index >> 5)] |= 1u << (index & 31);
+	}
+}
+
+// The ellipsis distance is affine in the tile grid, so evaluate it once per tile corner,
+// four corners at a time, and accept a tile when all of its corners are inside.
+static void test_grid_row(uint8_t *inside, unsigned count, float first_x,
+                          vec2 row_base, vec2 step_x, float min_sq_dist)
+{
+	unsigned i = 0;
+
+#if defined(__SSE__)
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 base_x = _mm_set1_ps(row_base.x);
+	const __m128 base_y = _mm_set1_ps(row_base.y);
+	const __m128 step_xx = _mm_set1_ps(step_x.x);
+	const __m128 step_xy = _mm_set1_ps(step_x.y);
+	const __m128 threshold = _mm_set1_ps(min_sq_dist);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 gx = _mm_add_ps(_mm_set1_ps(first_x + float(i)), lanes);
+		__m128 dx = _mm_add_ps(base_x, _mm_mul_ps(gx, step_xx));
+		__m128 dy = _mm_add_ps(base_y, _mm_mul_ps(gx, step_xy));
+		__m128 sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(sq, threshold));
+		inside[i + 0] = (mask & 1) ? 0xff : 0;
+		inside[i + 1] = (mask & 2) ? 0xff : 0;
+		inside[i + 2] = (mask & 4) ? 0xff : 0;
+		inside[i + 3] = (mask & 8) ? 0xff : 0;
+	}
+#elif defined(__ARM_NEON)
+	static const float lane_values[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	const float32x4_t lanes = vld1q_f32(lane_values);
+	const float32x4_t base_x = vdupq_n_f32(row_base.x);
+	const float32x4_t base_y = vdupq_n_f32(row_base.y);
+	const float32x4_t threshold = vdupq_n_f32(min_sq_dist);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t gx = vaddq_f32(vdupq_n_f32(first_x + float(i)), lanes);
+		float32x4_t dx = vmlaq_n_f32(base_x, gx, step_x.x);
+		float32x4_t dy = vmlaq_n_f32(base_y, gx, step_x.y);
+		float32x4_t sq = vmlaq_f32(vmulq_f32(dx, dx), dy, dy);
+		uint16x4_t lt = vmovn_u32(vcltq_f32(sq, threshold));
+		uint8x8_t lt8 = vmovn_u16(vcombine_u16(lt, lt));
+		vst1_lane_u32(reinterpret_cast<uint32_t *>(inside + i), vreinterpret_u32_u8(lt8), 0);
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		float gx = first_x + float(i);
+		vec2 d = row_base + gx * step_x;
+		inside[i] = dot(d, d) < min_sq_dist ? 0xff : 0;
+	}
+}
+
+static void bin_point_light(const ClusterBinningInput &input, uint32_t *masks, unsigned words_per_tile,
+                            unsigned index, std::vector<uint8_t> &scratch)
+{
+	auto &params = input.context->get_render_parameters();
+	vec2 inv_resolution = 1.0f / vec2(input.resolution_x, input.resolution_y);
+	vec2 clip_scale = vec2(params.inv_projection[0][0], -params.inv_projection[1][1]);
+
+	auto &pos = input.lights[index].position;
+	float radius = 1.0f / input.lights[index].inv_radius;
+
+	auto projection = project_sphere(*input.context, pos, radius);
+	auto &ranges = projection.ranges;
+	auto &transformed_ranges = projection.transformed_ranges;
+	auto &clip_transform = projection.clip_transform;
+
+	// Compute screen-space BB for projected sphere.
+	ranges = ranges *
+	         vec4(params.projection[0][0], params.projection[0][0],
+	              -params.projection[1][1], -params.projection[1][1]) *
+	         0.5f + 0.5f;
+
+	ranges *= vec4(input.resolution_x, input.resolution_x, input.resolution_y, input.resolution_y);
+	ranges = clamp(ranges, vec4(0.0f), vec4(input.resolution_x, input.resolution_x - 1,
+	                                        input.resolution_y, input.resolution_y - 1));
+
+	uvec4 uranges(ranges);
+
+	if (!projection.ellipsis)
+	{
+		set_all_tiles(input, masks, words_per_tile, index, uranges);
+		return;
+	}
+
+	if (uranges.x > uranges.y || uranges.z > uranges.w)
+		return;
+
+	vec2 intersection_center = 0.5f * (transformed_ranges.xz() + transformed_ranges.yw());
+	vec2 intersection_radius = transformed_ranges.yw() - intersection_center;
+	vec2 inv_intersection_radius = 1.0f / intersection_radius;
+
+	// Distance to the ellipsis center at tile grid point (x, y) is base + x * step_x + y * step_y.
+	vec2 clip_step = 2.0f * inv_resolution * clip_scale;
+	vec2 step_x = clip_transform[0] * clip_step.x * inv_intersection_radius;
+	vec2 step_y = clip_transform[1] * clip_step.y * inv_intersection_radius;
+	vec2 base = (clip_transform * -clip_scale - intersection_center) * inv_intersection_radius;
+
+	// Same for every tile, since the grid is affine.
+	float max_diag = muglm::max(length(step_x + step_y), length(step_x - step_y));
+	float min_sq_dist = (1.0f + max_diag) * (1.0f + max_diag);
+
+	unsigned grid_width = uranges.y - uranges.x + 2;
+	scratch.resize(2 * grid_width);
+	uint8_t *rows[2] = { scratch.data(), scratch.data() + grid_width };
+
+	test_grid_row(rows[0], grid_width, float(uranges.x), base + float(uranges.z) * step_y, step_x, min_sq_dist);
+
+	for (unsigned y = uranges.z; y <= uranges.w; y++)
+	{
+		test_grid_row(rows[1], grid_width, float(uranges.x), base + float(y + 1) * step_y, step_x, min_sq_dist);
+
+		for (unsigned x = 0; x + 1 < grid_width; x++)
+		{
+			if (rows[0][x] & rows[0][x + 1] & rows[1][x] & rows[1][x + 1])
+			{
+				unsigned linear_coord = y * input.resolution_x + x + uranges.x;
+				masks[linear_coord * words_per_tile + (index >> 5)] |= 1u << (index & 31);
+			}
+		}
+
+		std::swap(rows[0], rows[1]);
+	}
+}
+
+static bool light_is_point(const ClusterBinningInput &input, unsigned index)
+{
+	return (input.type_mask[index >> 5] & (1u << (index & 31))) != 0;
+}
+
+void prepare_output(const ClusterBinningInput &input, ClusterBinningOutput &output)
+{
+	unsigned words_per_tile = (input.num_lights + 31) / 32;
+	output.bitmask.resize(size_t(words_per_tile) * input.resolution_x * input.resolution_y);
+	output.z_ranges.resize(input.resolution_z);
+	output.light_slices.resize(input.num_lights);
+}
+
+void compute_light_slices(const ClusterBinningInput &input, ClusterBinningOutput &output,
+                          unsigned first_light, unsigned num_lights)
+{
+	float z_scale = float(input.resolution_z) / input.context->get_render_parameters().z_far;
+
+	for (unsigned i = first_light; i < first_light + num_lights; i++)
+	{
+		vec2 range;
+		if (light_is_point(input, i))
+			range = point_light_z_range(*input.context, input.lights[i].position, 1.0f / input.lights[i].inv_radius);
+		else
+			range = spot_light_z_range(*input.context, input.models[i]);
+
+		range *= z_scale;
+		if (range.y < 0.0f)
+		{
+			// Empty range.
+			output.light_slices[i] = uvec2(1, 0);
+			continue;
+		}
+
+		range.x = muglm::max(range.x, 0.0f);
+		uvec2 urange(range);
+		urange.y = muglm::min(urange.y, input.resolution_z - 1);
+		output.light_slices[i] = urange;
+	}
+}
+
+void bin_z_slices(const ClusterBinningInput &input, ClusterBinningOutput &output,
+                  unsigned first_slice, unsigned num_slices)
+{
+	if (num_slices == 0)
+		return;
+
+	unsigned last_slice = first_slice + num_slices - 1;
+	for (unsigned z = first_slice; z <= last_slice; z++)
+		output.z_ranges[z] = uvec2(~0u, 0u);
+
+	// Lights are visited in index order, so the first hit is the lowest index.
+	for (unsigned i = 0; i < input.num_lights; i++)
+	{
+		uvec2 slices = output.light_slices[i];
+		unsigned lo = muglm::max(slices.x, first_slice);
+		unsigned hi = muglm::min(slices.y, last_slice);
+		for (unsigned z = lo; z <= hi; z++)
+		{
+			auto &range = output.z_ranges[z];
+			range.x = muglm::min(range.x, i);
+			range.y = i;
+		}
+	}
+}
+
+void bin_tile_masks(const ClusterBinningInput &input, ClusterBinningOutput &output,
+                    unsigned first_word, unsigned num_words)
+{
+	if (num_words == 0)
+		return;
+
+	unsigned words_per_tile = (input.num_lights + 31) / 32;
+	unsigned num_tiles = input.resolution_x * input.resolution_y;
+	uint32_t *masks = output.bitmask.data();
+
+	for (unsigned tile = 0; tile < num_tiles; tile++)
+		memset(masks + tile * words_per_tile + first_word, 0, num_words * sizeof(uint32_t));
+
+	std::vector<uvec2> coverage;
+	std::vector<uint8_t> scratch;
+
+	unsigned first_light = first_word * 32;
+	unsigned end_light = muglm::min((first_word + num_words) * 32, input.num_lights);
+
+	for (unsigned i = first_light; i < end_light; i++)
+	{
+		if (light_is_point(input, i))
+			bin_point_light(input, masks, words_per_tile, i, scratch);
+		else
+			bin_spot_light(input, masks, words_per_tile, i, coverage);
+	}
+}
+
+void bin_lights(const ClusterBinningInput &input, ClusterBinningOutput &output)
+{
+	prepare_output(input, output);
+	compute_light_slices(input, output, 0, input.num_lights);
+	bin_z_slices(input, output, 0, input.resolution_z);
+	bin_tile_masks(input, output, 0, (input.num_lights + 31) / 32);
+}
+
+void compose_bin_lights(TaskComposer &composer, const ClusterBinningInput &input,
+                        ClusterBinningOutput &output, unsigned num_tasks)
+{
+	num_tasks = muglm::max(num_tasks, 1u);
+
+	{
+		auto &group = composer.begin_pipeline_stage();
+		group.set_desc("cluster-binning-prepare");
+		group.enqueue_task([&input, &output]() {
+			prepare_output(input, output);
+		});
+	}
+
+	{
+		auto &group = composer.begin_pipeline_stage();
+		group.set_desc("cluster-binning-lights");
+		for (unsigned i = 0; i < num_tasks; i++)
+		{
+			group.enqueue_task([&input, &output, i, num_tasks]() {
+				unsigned first_light = (input.num_lights * i) / num_tasks;
+				unsigned end_light = (input.num_lights * (i + 1)) / num_tasks;
+				compute_light_slices(input, output, first_light, end_light - first_light);
+
+				unsigned num_words = (input.num_lights + 31) / 32;
+				unsigned first_word = (num_words * i) / num_tasks;
+				unsigned end_word = (num_words * (i + 1)) / num_tasks;
+				bin_tile_masks(input, output, first_word, end_word - first_word);
+			});
+		}
+	}
+
+	{
+		auto &group = composer.begin_pipeline_stage();
+		group.set_desc("cluster-binning-z-slices");
+		for (unsigned i = 0; i < num_tasks; i++)
+		{
+			group.enqueue_task([&input, &output, i, num_tasks]() {
+				unsigned first_slice = (input.resolution_z * i) / num_tasks;
+				unsigned end_slice = (input.resolution_z * (i + 1)) / num_tasks;
+				bin_z_slices(input, output, first_slice, end_slice - first_slice);
+			});
+		}
+	}
+}
+}
+}
@@ -0,0 +1,79 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "light_info.hpp"
+#include <vector>
+
+namespace Granite
+{
+class RenderContext;
+class TaskComposer;
+
+// CPU fallback for bindless light binning.
+// Produces the same tile bitmask and Z-slice ranges as clusterer_bindless_binning.comp.
+struct ClusterBinningInput
+{
+	const RenderContext *context = nullptr;
+	const PositionalFragmentInfo *lights = nullptr;
+	// Spot light cone volumes.
+	const mat4 *models = nullptr;
+	// One bit per light, set for point lights.
+	const uint32_t *type_mask = nullptr;
+	unsigned num_lights = 0;
+	unsigned resolution_x = 0;
+	unsigned resolution_y = 0;
+	unsigned resolution_z = 0;
+};
+
+struct ClusterBinningOutput
+{
+	// (num_lights + 31) / 32 words per tile, resolution_x * resolution_y tiles.
+	std::vector<uint32_t> bitmask;
+	// Lowest and highest light index per Z-slice, (~0u, 0) if no light touches the slice.
+	std::vector<uvec2> z_ranges;
+	// Per light range of Z-slices.
+	std::vector<uvec2> light_slices;
+};
+
+namespace ClusterBinning
+{
+void prepare_output(const ClusterBinningInput &input, ClusterBinningOutput &output);
+void compute_light_slices(const ClusterBinningInput &input, ClusterBinningOutput &output,
+                          unsigned first_light, unsigned num_lights);
+void bin_z_slices(const ClusterBinningInput &input, ClusterBinningOutput &output,
+                  unsigned first_slice, unsigned num_slices);
+// Lights [32 * first_word, 32 * (first_word + num_words)) only touch their own words in each tile,
+// so disjoint word ranges can be binned concurrently.
+void bin_tile_masks(const ClusterBinningInput &input, ClusterBinningOutput &output,
+                    unsigned first_word, unsigned num_words);
+
+void bin_lights(const ClusterBinningInput &input, ClusterBinningOutput &output);
+
+// Splits the tile masks by light words and the Z ranges by Z-slice over num_tasks tasks per stage.
+// input is read when the stages run, so it can be filled in by an earlier stage.
+void compose_bin_lights(TaskComposer &composer, const ClusterBinningInput &input,
+                        ClusterBinningOutput &output, unsigned num_tasks);
+}
+}
@@ -29,7 +29,6 @@
 #include "quirks.hpp"
 #include "muglm/matrix_helper.hpp"
 #include "thread_group.hpp"
-#include "cpu_rasterizer.hpp"
 #include "simd.hpp"
 #include <string.h>
 
@@ -282,6 +281,16 @@ const mat4 &LightClusterer::get_cluster_transform() const
 	return legacy.cluster_transform;
 }
 
+template <typename T>
+static void swap_atlas_slots_legacy(T &type, unsigned a, unsigned b)
+{
+	swap(type.cookie[a], type.cookie[b]);
+	swap(type.shadow_transforms[a], type.shadow_transforms[b]);
+	swap(type.shadow_hashes[a], type.shadow_hashes[b]);
+	swap(type.tiers[a], type.tiers[b]);
+	swap(type.index_remap[a], type.index_remap[b]);
+}
+
 template <typename T>
 static uint32_t reassign_indices_legacy(T &type)
 {
@@ -300,9 +309,7 @@ static uint32_t reassign_indices_legacy(T &type)
 			if (i != unsigned(index))
 			{
 				// Reuse the shadow data from the atlas.
-				swap(type.cookie[i], type.cookie[index]);
-				swap(type.shadow_transforms[i], type.shadow_transforms[index]);
-				swap(type.index_remap[i], type.index_remap[index]);
+				swap_atlas_slots_legacy(type, i, unsigned(index));
 			}
 		}
 
@@ -317,9 +324,7 @@ static uint32_t reassign_indices_legacy(T &type)
 				if (i != unsigned(index))
 				{
 					// Reuse the shadow data from the atlas.
-					swap(type.cookie[i], type.cookie[index]);
-					swap(type.shadow_transforms[i], type.shadow_transforms[index]);
-					swap(type.index_remap[i], type.index_remap[index]);
+					swap_atlas_slots_legacy(type, i, unsigned(index));
 				}
 			}
 		}
@@ -340,6 +345,7 @@ void LightClusterer::setup_scratch_buffers_vsm(Vulkan::Device &device)
 	auto image_info = ImageCreateInfo::render_target(shadow_resolution, shadow_resolution, VK_FORMAT_R32G32_SFLOAT);
 	image_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 	image_info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.tag = AllocationTag::Shadow;
 	if (!scratch_vsm_rt)
 		scratch_vsm_rt = device.create_image(image_info, nullptr);
 	if (!scratch_vsm_down)
@@ -482,13 +488,46 @@ void LightClusterer::render_shadow(Vulkan::CommandBuffer &cmd, const RenderConte
 	}
 }
 
-void LightClusterer::render_shadow_legacy(Vulkan::CommandBuffer &cmd, const RenderContext &depth_context, VisibilityList &visible,
-                                          unsigned off_x, unsigned off_y, unsigned res_x, unsigned res_y,
-                                          const Vulkan::ImageView &rt, unsigned layer, Renderer::RendererFlushFlags flags)
+static Util::Hash gather_shadow_casters_legacy(const Scene &scene, const Frustum &frustum, VisibilityList &visible)
 {
 	visible.clear();
-	scene->gather_visible_static_shadow_renderables(depth_context.get_visibility_frustum(), visible);
+	scene.gather_visible_static_shadow_renderables(frustum, visible);
 
+	// Order independent, same as Threaded::scene_gather_static_shadow_renderables.
+	Util::Hash hash = 0;
+	for (auto &v : visible)
+		hash ^= v.transform_hash;
+	return hash;
+}
+
+static void compute_spot_render_transform(const PositionalFragmentInfo &light, float xy_range, mat4 &proj, mat4 &view)
+{
+	float range = tan(xy_range);
+	view = mat4_cast(look_at_arbitrary_up(light.direction)) * translate(-light.position);
+	proj = projection(range * 2.0f, 1.0f, 0.005f / light.inv_radius, 1.0f / light.inv_radius);
+}
+
+// Spot lights which cover little of the screen or are dim render to a quarter or a sixteenth of their atlas slot.
+// Going back to a finer tier requires some margin so a light on the boundary does not re-render every frame.
+static unsigned select_spot_shadow_tier(float importance, unsigned current_tier)
+{
+	static const float thresholds[] = { 0.25f, 0.0625f };
+	unsigned tier = 0;
+	for (unsigned t = 0; t < 2; t++)
+	{
+		float threshold = thresholds[t];
+		if (current_tier > t)
+			threshold *= 1.25f;
+		if (importance < threshold)
+			tier = t + 1;
+	}
+	return tier;
+}
+
+void LightClusterer::render_shadow_legacy(Vulkan::CommandBuffer &cmd, const RenderContext &depth_context, const VisibilityList &visible,
+                                          unsigned off_x, unsigned off_y, unsigned res_x, unsigned res_y,
+                                          const Vulkan::ImageView &rt, unsigned layer, Renderer::RendererFlushFlags flags)
+{
 	auto &depth_renderer = get_shadow_renderer();
 	depth_renderer.begin(internal_queue);
 	internal_queue.push_depth_renderables(depth_context, visible.data(), visible.size());
@@ -507,7 +546,36 @@ void LightClusterer::render_atlas_point(const RenderContext &context_)
 	if (!legacy.points.atlas || force_update_shadows)
 		partial_mask = ~0u;
 
-	if (partial_mask == 0 && legacy.points.atlas && !force_update_shadows)
+	RenderContext depth_context;
+	if (legacy.shadow_visibility.size() < 6 * legacy.points.count)
+		legacy.shadow_visibility.resize(6 * legacy.points.count);
+
+	// A slot only needs to re-render if the light or any caster within its volume changed.
+	for (unsigned i = 0; i < legacy.points.count; i++)
+	{
+		Util::Hasher hasher;
+		hasher.u64(legacy.points.light_hashes[i]);
+
+		for (unsigned face = 0; face < 6; face++)
+		{
+			mat4 view, proj;
+			compute_cube_render_transform(legacy.points.lights[i].position, face, proj, view,
+			                              0.005f / legacy.points.lights[i].inv_radius,
+			                              1.0f / legacy.points.lights[i].inv_radius);
+			depth_context.set_camera(proj, view);
+			hasher.u64(gather_shadow_casters_legacy(*scene, depth_context.get_visibility_frustum(),
+			                                        legacy.shadow_visibility[6 * i + face]));
+		}
+
+		auto hash = hasher.get();
+		if (hash != legacy.points.shadow_hashes[i])
+		{
+			legacy.points.shadow_hashes[i] = hash;
+			partial_mask |= 1u << i;
+		}
+	}
+
+	if (partial_mask == 0 && legacy.points.atlas)
 		return;
 
 	bool partial_update = partial_mask != ~0u;
@@ -527,6 +595,7 @@ void LightClusterer::render_atlas_point(const RenderContext &context_)
 			info.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 		else
 			info.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		info.tag = AllocationTag::Shadow;
 
 		legacy.points.atlas = device.create_image(info, nullptr);
 	}
@@ -591,9 +660,6 @@ void LightClusterer::render_atlas_point(const RenderContext &context_)
 		                   VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT);
 	}
 
-	RenderContext depth_context;
-	VisibilityList visible;
-
 	for (unsigned i = 0; i < legacy.points.count; i++)
 	{
 		if ((partial_mask & (1u << i)) == 0)
@@ -618,7 +684,7 @@ void LightClusterer::render_atlas_point(const RenderContext &context_)
 				legacy.points.handles[i]->set_shadow_info(&legacy.points.atlas->get_view(), legacy.points.shadow_transforms[i]);
 			}
 
-			render_shadow_legacy(*cmd, depth_context, visible,
+			render_shadow_legacy(*cmd, depth_context, legacy.shadow_visibility[6 * i + face],
 			                     0, 0, shadow_resolution, shadow_resolution,
 			                     legacy.points.atlas->get_view(),
 			                     6 * remapped + face,
@@ -760,6 +826,7 @@ void LightClusterer::begin_bindless_barriers(Vulkan::CommandBuffer &cmd)
 			}
 			info.usage = vsm ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 			info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+			info.tag = AllocationTag::Shadow;
 			image = cmd.get_device().create_image(info, nullptr);
 		}
 
@@ -983,12 +1050,42 @@ void LightClusterer::render_bindless_point(Vulkan::Device &device, unsigned inde
 void LightClusterer::render_atlas_spot(const RenderContext &context_)
 {
 	bool vsm = shadow_type == ShadowType::VSM;
-	uint32_t partial_mask = reassign_indices_legacy(legacy.spots);
+	uint32_t new_slots = reassign_indices_legacy(legacy.spots);
+	uint32_t partial_mask = new_slots;
 
 	if (!legacy.spots.atlas || force_update_shadows)
 		partial_mask = ~0u;
 
-	if (partial_mask == 0 && legacy.spots.atlas && !force_update_shadows)
+	RenderContext depth_context;
+	if (legacy.shadow_visibility.size() < legacy.spots.count)
+		legacy.shadow_visibility.resize(legacy.spots.count);
+
+	// A slot only needs to re-render if the light, any caster within its volume or its resolution tier changed.
+	for (unsigned i = 0; i < legacy.spots.count; i++)
+	{
+		bool new_slot = (new_slots & (1u << i)) != 0;
+		unsigned tier = select_spot_shadow_tier(legacy.spots.importances[i], new_slot ? 0 : legacy.spots.tiers[i]);
+		legacy.spots.tiers[i] = uint8_t(tier);
+
+		mat4 view, proj;
+		compute_spot_render_transform(legacy.spots.lights[i], legacy.spots.handles[i]->get_xy_range(), proj, view);
+		depth_context.set_camera(proj, view);
+
+		Util::Hasher hasher;
+		hasher.u64(legacy.spots.light_hashes[i]);
+		hasher.u32(tier);
+		hasher.u64(gather_shadow_casters_legacy(*scene, depth_context.get_visibility_frustum(),
+		                                        legacy.shadow_visibility[i]));
+
+		auto hash = hasher.get();
+		if (hash != legacy.spots.shadow_hashes[i])
+		{
+			legacy.spots.shadow_hashes[i] = hash;
+			partial_mask |= 1u << i;
+		}
+	}
+
+	if (partial_mask == 0 && legacy.spots.atlas)
 		return;
 
 	auto &device = context_.get_device();
@@ -1005,6 +1102,7 @@ void LightClusterer::render_atlas_spot(const RenderContext &context_)
 			info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 		else
 			info.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		info.tag = AllocationTag::Shadow;
 		legacy.spots.atlas = device.create_image(info, nullptr);
 
 		// Make sure we have a cleared atlas so we don't spuriously filter against NaN.
@@ -1036,9 +1134,6 @@ void LightClusterer::render_atlas_spot(const RenderContext &context_)
 		                   stages, access);
 	}
 
-	RenderContext depth_context;
-	VisibilityList visible;
-
 	for (unsigned i = 0; i < legacy.spots.count; i++)
 	{
 		if ((partial_mask & (1u << i)) == 0)
@@ -1046,19 +1141,17 @@ void LightClusterer::render_atlas_spot(const RenderContext &context_)
 
 		LOGI("Rendering shadow for spot light %u (%p)\n", i, static_cast<void *>(legacy.spots.handles[i]));
 
-		float range = tan(legacy.spots.handles[i]->get_xy_range());
-		mat4 view = mat4_cast(look_at_arbitrary_up(legacy.spots.lights[i].direction)) *
-		            translate(-legacy.spots.lights[i].position);
-		mat4 proj = projection(range * 2.0f, 1.0f,
-		                       0.005f / legacy.spots.lights[i].inv_radius,
-		                       1.0f / legacy.spots.lights[i].inv_radius);
+		mat4 view, proj;
+		compute_spot_render_transform(legacy.spots.lights[i], legacy.spots.handles[i]->get_xy_range(), proj, view);
 
 		unsigned remapped = legacy.spots.index_remap[i];
+		unsigned tier = legacy.spots.tiers[i];
+		unsigned resolution = shadow_resolution >> tier;
 
 		// Carve out the atlas region where the spot light shadows live.
 		legacy.spots.shadow_transforms[i] =
 				translate(vec3(float(remapped & 7) / 8.0f, float(remapped >> 3) / 4.0f, 0.0f)) *
-				scale(vec3(1.0f / 8.0f, 1.0f / 4.0f, 1.0f)) *
+				scale(vec3(1.0f / float(8u << tier), 1.0f / float(4u << tier), 1.0f)) *
 				translate(vec3(0.5f, 0.5f, 0.0f)) *
 				scale(vec3(0.5f, 0.5f, 1.0f)) *
 				proj * view;
@@ -1067,9 +1160,9 @@ void LightClusterer::render_atlas_spot(const RenderContext &context_)
 
 		depth_context.set_camera(proj, view);
 
-		render_shadow_legacy(*cmd, depth_context, visible,
+		render_shadow_legacy(*cmd, depth_context, legacy.shadow_visibility[i],
 		                     shadow_resolution * (remapped & 7), shadow_resolution * (remapped >> 3),
-		                     shadow_resolution, shadow_resolution,
+		                     resolution, resolution,
 		                     legacy.spots.atlas->get_view(), 0, Renderer::DEPTH_BIAS_BIT);
 	}
 
@@ -1091,6 +1184,15 @@ void LightClusterer::render_atlas_spot(const RenderContext &context_)
 	device.submit(cmd);
 }
 
+static Util::Hash hash_light_legacy(const PositionalLightInfo &light, const PositionalFragmentInfo &info, float xy_range)
+{
+	Util::Hasher hasher;
+	hasher.u64(light.transform_hash);
+	hasher.f32(info.inv_radius);
+	hasher.f32(xy_range);
+	return hasher.get();
+}
+
 void LightClusterer::refresh_legacy(const RenderContext& context_)
 {
 	legacy.points.count = 0;
@@ -1107,8 +1209,11 @@ void LightClusterer::refresh_legacy(const RenderContext& context_)
 			spot.set_shadow_info(nullptr, {});
 			if (legacy.spots.count < max_spot_lights)
 			{
-				legacy.spots.lights[legacy.spots.count] = spot.get_shader_info(transform->transform->world_transform);
+				auto &info = legacy.spots.lights[legacy.spots.count];
+				info = spot.get_shader_info(transform->transform->world_transform);
 				legacy.spots.handles[legacy.spots.count] = &spot;
+				legacy.spots.light_hashes[legacy.spots.count] = hash_light_legacy(light, info, spot.get_xy_range());
+				legacy.spots.importances[legacy.spots.count] = light.importance;
 				legacy.spots.count++;
 			}
 		}
@@ -1118,8 +1223,10 @@ void LightClusterer::refresh_legacy(const RenderContext& context_)
 			point.set_shadow_info(nullptr, {});
 			if (legacy.points.count < max_point_lights)
 			{
-				legacy.points.lights[legacy.points.count] = point.get_shader_info(transform->transform->world_transform);
+				auto &info = legacy.points.lights[legacy.points.count];
+				info = point.get_shader_info(transform->transform->world_transform);
 				legacy.points.handles[legacy.points.count] = &point;
+				legacy.points.light_hashes[legacy.points.count] = hash_light_legacy(light, info, 0.0f);
 				legacy.points.count++;
 			}
 		}
@@ -1317,6 +1424,8 @@ void LightClusterer::refresh_bindless_prepare(const RenderContext &context_)
 
 	bindless.parameters.num_decals = std::min<uint32_t>(visible_decals.size(), CLUSTERER_MAX_DECALS_BINDLESS);
 	bindless.parameters.num_decals_32 = (bindless.parameters.num_decals + 31) / 32;
+	bindless.decal_views.clear();
+	bindless.decal_view_to_index.clear();
 	if (enable_volumetric_decals)
 	{
 		for (uint32_t i = 0; i < bindless.parameters.num_decals; i++)
@@ -1325,6 +1434,19 @@ void LightClusterer::refresh_bindless_prepare(const RenderContext &context_)
 			auto &region = bindless.transforms.decals[i];
 			for (unsigned j = 0; j < 3; j++)
 				region.world_to_texture[j] = decal.decal->world_to_texture[j];
+
+			// Large decal counts tend to reuse a handful of textures.
+			auto *view = decal.decal->decal.get_decal_view();
+			auto itr = bindless.decal_view_to_index.find(view);
+			if (itr == bindless.decal_view_to_index.end())
+			{
+				auto index = uint32_t(bindless.decal_views.size());
+				bindless.decal_view_to_index[view] = index;
+				bindless.decal_views.push_back(view);
+				bindless.transforms.decal_texture_index[i] = index;
+			}
+			else
+				bindless.transforms.decal_texture_index[i] = itr->second;
 		}
 	}
 }
@@ -1396,9 +1518,30 @@ void LightClusterer::refresh_bindless(const RenderContext &context_, TaskCompose
 			refresh_bindless_prepare(context_);
 			if (enable_shadows)
 				bindless.shadow_task_handles.reserve(bindless.parameters.num_lights + bindless.global_transforms.num_lights);
+
+			auto &input = bindless.cpu_binning_input;
+			input.context = &context_;
+			input.lights = bindless.transforms.lights;
+			input.models = bindless.transforms.model;
+			input.type_mask = bindless.transforms.type_mask;
+			input.num_lights = bindless.parameters.num_lights;
+			input.resolution_x = resolution_x;
+			input.resolution_y = resolution_y;
+			input.resolution_z = resolution_z;
 		});
 	}
 
+	// CPU binning runs alongside the shadow map work and only has to be done by the end of refresh.
+	TaskGroupHandle binning_task;
+	if (ImplementationQuirks::get().clustering_force_cpu)
+	{
+		TaskComposer binning_composer(thread_group);
+		binning_composer.set_incoming_task(composer.get_pipeline_stage_dependency());
+		ClusterBinning::compose_bin_lights(binning_composer, bindless.cpu_binning_input, bindless.cpu_binning,
+		                                   thread_group.get_num_threads());
+		binning_task = binning_composer.get_outgoing_task();
+	}
+
 	if (enable_shadows)
 	{
 		auto &group = composer.begin_pipeline_stage();
@@ -1471,6 +1614,8 @@ void LightClusterer::refresh_bindless(const RenderContext &context_, TaskCompose
 	// Submit barriers from COLOR/DEPTH -> SHADER_READ_ONLY
 	{
 		auto &group = composer.begin_pipeline_stage();
+		if (binning_task)
+			thread_group.add_dependency(group, *binning_task);
 		group.enqueue_task([this, &device]() {
 			if (enable_shadows)
 			{
@@ -1510,7 +1655,7 @@ void LightClusterer::refresh(const RenderContext &context_, TaskComposer &incomi
 
 	// Gather lights in parallel.
 	Threaded::scene_gather_positional_light_renderables_sorted(*scene, composer, context_,
-	                                                           light_sort_caches, MaxTasks);
+	                                                           light_sort_caches, MaxTasks, min_light_importance);
 
 	composer.get_group().enqueue_task([this, &context_]() {
 		visible_diffuse_lights.clear();
@@ -1638,6 +1783,10 @@ void LightClusterer::update_bindless_data(Vulkan::CommandBuffer &cmd)
 		memcpy(cmd.update_buffer(*bindless.transforms_buffer, offsetof(ClustererBindlessTransforms, decals),
 		                         bindless.parameters.num_decals * sizeof(bindless.transforms.decals[0])),
 		       bindless.transforms.decals, bindless.parameters.num_decals * sizeof(bindless.transforms.decals[0]));
+		memcpy(cmd.update_buffer(*bindless.transforms_buffer, offsetof(ClustererBindlessTransforms, decal_texture_index),
+		                         bindless.parameters.num_decals * sizeof(bindless.transforms.decal_texture_index[0])),
+		       bindless.transforms.decal_texture_index,
+		       bindless.parameters.num_decals * sizeof(bindless.transforms.decal_texture_index[0]));
 	}
 }
 
@@ -1679,8 +1828,8 @@ void LightClusterer::update_bindless_descriptors(Vulkan::Device &device)
 	if (enable_volumetric_decals)
 	{
 		bindless.parameters.decals_texture_offset = bindless.allocator.get_next_offset();
-		for (unsigned i = 0; i < bindless.parameters.num_decals; i++)
-			bindless.allocator.push(*visible_decals[i].decal->decal.get_decal_view());
+		for (auto *view : bindless.decal_views)
+			bindless.allocator.push(*view);
 	}
 
 	bindless.desc_set = bindless.allocator.commit(device);
@@ -1823,304 +1972,6 @@ void LightClusterer::update_bindless_range_buffer_decal_gpu(Vulkan::CommandBuffe
 	update_bindless_range_buffer_gpu(cmd, *bindless.range_buffer_decal, bindless.volume_index_range);
 }
 
-void LightClusterer::update_bindless_range_buffer_cpu(Vulkan::CommandBuffer &cmd)
-{
-	uint32_t count = bindless.parameters.num_lights;
-
-	bindless.volume_index_range.resize(resolution_z);
-	for (auto &range : bindless.volume_index_range)
-		range = uvec2(0xffffffff, 0);
-
-	// PERF: We can certainly be smarter here with some scan algorithm trickery.
-	const auto apply_range = [&](unsigned index, vec2 range) {
-		range = range * (float(resolution_z) / context->get_render_parameters().z_far);
-		if (range.y < 0.0f)
-			return;
-		range.x = muglm::max(range.x, 0.0f);
-
-		uvec2 urange(range);
-		urange.y = muglm::min(urange.y, resolution_z - 1);
-
-		for (unsigned x = urange.x; x <= urange.y; x++)
-		{
-			auto &index_range = bindless.volume_index_range[x];
-			index_range.x = muglm::min(index_range.x, index);
-			index_range.y = muglm::max(index_range.y, index);
-		}
-	};
-
-	for (unsigned i = 0; i < count; i++)
-	{
-		vec2 range;
-		if (bindless_light_is_point(i))
-		{
-			range = point_light_z_range(*context, bindless.transforms.lights[i].position,
-			                            1.0f / bindless.transforms.lights[i].inv_radius);
-		}
-		else
-			range = spot_light_z_range(*context, bindless.transforms.model[i]);
-
-		apply_range(i, range);
-	}
-
-	auto *ranges = static_cast<uvec2 *>(cmd.update_buffer(*bindless.range_buffer, 0, bindless.range_buffer->get_create_info().size));
-	memcpy(ranges, bindless.volume_index_range.data(), resolution_z * sizeof(ivec2));
-}
-
-static vec2 project_sphere_flat(float view_xy, float view_z, float radius)
-{
-	// Goal here is to deal with the intersection problem in 2D.
-	// Camera forms a cone with the sphere.
-	// We want to intersect that cone with the near plane.
-	// To do that we find minimum and maximum angles in 2D, rotate the direction vector,
-	// and project down to plane.
-
-	float len = length(vec2(view_xy, view_z));
-	float sin_xy = radius / len;
-
-	if (sin_xy < 0.999f)
-	{
-		// Find half-angles for the cone, and turn it into a 2x2 rotation matrix.
-		float cos_xy = muglm::sqrt(1.0f - sin_xy * sin_xy);
-
-		// Rotate half-angles in each direction.
-		vec2 rot_lo = mat2(vec2(cos_xy, +sin_xy), vec2(-sin_xy, cos_xy)) * vec2(view_xy, view_z);
-		vec2 rot_hi = mat2(vec2(cos_xy, -sin_xy), vec2(+sin_xy, cos_xy)) * vec2(view_xy, view_z);
-
-		// Clip to some sensible ranges.
-		if (rot_lo.y <= 0.0f)
-		{
-			rot_lo.x = -1.0f;
-			rot_lo.y = 0.0f;
-		}
-
-		if (rot_hi.y <= 0.0f)
-		{
-			rot_hi.x = +1.0f;
-			rot_hi.y = 0.0f;
-		}
-
-		return vec2(rot_lo.x / rot_lo.y, rot_hi.x / rot_hi.y);
-	}
-	else
-		return vec2(-std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
-}
-
-struct ProjectedResult
-{
-	vec4 ranges;
-	vec4 transformed_ranges;
-	mat2 clip_transform;
-	bool ellipsis;
-};
-
-static ProjectedResult project_sphere(const RenderContext &context,
-                                      const vec3 &pos, float radius)
-{
-	ProjectedResult result;
-	vec3 view = (context.get_render_parameters().view * vec4(pos, 1.0f)).xyz();
-
-	// Work in projection space.
-	view.y = -view.y;
-	view.z = -view.z;
-
-	result.ranges = vec4(project_sphere_flat(view.x, view.z, radius),
-	                     project_sphere_flat(view.y, view.z, radius));
-
-	// Need to rotate view space on the Z-axis so the ellipsis will
-	// have its major axes orthogonal with X/Y.
-	float xy_length = length(vec2(view.x, view.y));
-
-	if (xy_length < 0.0001f)
-	{
-		result.clip_transform = mat2(1.0f);
-	}
-	else
-	{
-		float inv_xy_length = 1.0f / muglm::max(xy_length, 0.0000001f);
-		result.clip_transform = mat2(vec2(view.x, -view.y) * inv_xy_length,
-		                             vec2(view.y, view.x) * inv_xy_length);
-	}
-
-	vec2 transformed_xy = result.clip_transform * vec2(view.x, view.y);
-
-	result.transformed_ranges = vec4(project_sphere_flat(transformed_xy.x, view.z, radius),
-	                                 project_sphere_flat(transformed_xy.y, view.z, radius));
-
-	result.ellipsis =
-			result.transformed_ranges.x > -std::numeric_limits<float>::infinity() &&
-			result.transformed_ranges.y < std::numeric_limits<float>::infinity() &&
-			result.transformed_ranges.z > -std::numeric_limits<float>::infinity() &&
-			result.transformed_ranges.w < std::numeric_limits<float>::infinity();
-
-	return result;
-}
-
-void LightClusterer::update_bindless_mask_buffer_spot(uint32_t *masks, unsigned index)
-{
-	vector<uvec2> coverage;
-
-	Rasterizer::CullMode cull;
-	vec2 range = spot_light_z_range(*context, bindless.transforms.model[index]);
-	if (range.x <= context->get_render_parameters().z_near && range.y >= context->get_render_parameters().z_far)
-		cull = Rasterizer::CullMode::Both;
-	else if (range.x <= context->get_render_parameters().z_near)
-		cull = Rasterizer::CullMode::Back;
-	else
-		cull = Rasterizer::CullMode::Front;
-
-	if (cull != Rasterizer::CullMode::Both)
-	{
-		auto mvp = context->get_render_parameters().view_projection * bindless.transforms.model[index];
-		const vec4 spot_points[5] = {
-				vec4(0.0f, 0.0f, 0.0f, 1.0f),
-				vec4(+1.0f, +1.0f, -1.0f, 1.0f),
-				vec4(-1.0f, +1.0f, -1.0f, 1.0f),
-				vec4(-1.0f, -1.0f, -1.0f, 1.0f),
-				vec4(+1.0f, -1.0f, -1.0f, 1.0f),
-		};
-		vec4 clip[5];
-		Rasterizer::transform_vertices(clip, spot_points, 5, mvp);
-		coverage.clear();
-
-		static const unsigned indices[6 * 3] = {
-				0, 1, 2,
-				0, 2, 3,
-				0, 3, 4,
-				0, 4, 1,
-				2, 1, 3,
-				4, 3, 1,
-		};
-
-		Rasterizer::rasterize_conservative_triangles(coverage, clip,
-		                                             indices, sizeof(indices) / sizeof(indices[0]),
-		                                             uvec2(resolution_x, resolution_y),
-		                                             cull);
-
-		for (auto &cov : coverage)
-		{
-			unsigned linear_coord = cov.y * resolution_x + cov.x;
-			auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-			tile_list[index >> 5] |= 1u << (index & 31);
-		}
-	}
-	else
-	{
-		for (unsigned y = 0; y < resolution_y; y++)
-		{
-			for (unsigned x = 0; x < resolution_x; x++)
-			{
-				unsigned linear_coord = y * resolution_x + x;
-				auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-				tile_list[index >> 5] |= 1u << (index & 31);
-			}
-		}
-	}
-}
-
-void LightClusterer::update_bindless_mask_buffer_point(uint32_t *masks, unsigned index)
-{
-	vec2 inv_resolution = 1.0f / vec2(resolution_x, resolution_y);
-	vec2 clip_scale = vec2(context->get_render_parameters().inv_projection[0][0],
-	                       -context->get_render_parameters().inv_projection[1][1]);
-
-	auto &pos = bindless.transforms.lights[index].position;
-	float radius = 1.0f / bindless.transforms.lights[index].inv_radius;
-
-	auto projection = project_sphere(*context, pos, radius);
-	auto &ranges = projection.ranges;
-	auto &transformed_ranges = projection.transformed_ranges;
-	auto &clip_transform = projection.clip_transform;
-	auto &ellipsis = projection.ellipsis;
-
-	// Compute screen-space BB for projected sphere.
-	ranges = ranges *
-	         vec4(context->get_render_parameters().projection[0][0],
-	              context->get_render_parameters().projection[0][0],
-	              -context->get_render_parameters().projection[1][1],
-	              -context->get_render_parameters().projection[1][1]) *
-	         0.5f + 0.5f;
-
-	ranges *= vec4(resolution_x, resolution_x, resolution_y, resolution_y);
-	ranges = clamp(ranges, vec4(0.0f), vec4(resolution_x, resolution_x - 1,
-	                                        resolution_y, resolution_y - 1));
-
-	uvec4 uranges(ranges);
-
-	if (ellipsis)
-	{
-		vec2 intersection_center = 0.5f * (transformed_ranges.xz() + transformed_ranges.yw());
-		vec2 intersection_radius = transformed_ranges.yw() - intersection_center;
-
-		vec2 inv_intersection_radius = 1.0f / intersection_radius;
-
-		for (unsigned y = uranges.z; y <= uranges.w; y++)
-		{
-			for (unsigned x = uranges.x; x <= uranges.y; x++)
-			{
-				vec2 clip_lo = 2.0f * vec2(x, y) * inv_resolution - 1.0f;
-				vec2 clip_hi = clip_lo + 2.0f * inv_resolution;
-				clip_lo *= clip_scale;
-				clip_hi *= clip_scale;
-
-				vec2 dist_00 = clip_transform * vec2(clip_lo.x, clip_lo.y) - intersection_center;
-				vec2 dist_01 = clip_transform * vec2(clip_lo.x, clip_hi.y) - intersection_center;
-				vec2 dist_10 = clip_transform * vec2(clip_hi.x, clip_lo.y) - intersection_center;
-				vec2 dist_11 = clip_transform * vec2(clip_hi.x, clip_hi.y) - intersection_center;
-
-				dist_00 *= inv_intersection_radius;
-				dist_01 *= inv_intersection_radius;
-				dist_10 *= inv_intersection_radius;
-				dist_11 *= inv_intersection_radius;
-
-				float max_diag = muglm::max(distance(dist_00, dist_11), distance(dist_01, dist_10));
-				float min_sq_dist = (1.0f + max_diag) * (1.0f + max_diag);
-
-				if (dot(dist_00, dist_00) < min_sq_dist &&
-				    dot(dist_01, dist_01) < min_sq_dist &&
-				    dot(dist_10, dist_10) < min_sq_dist &&
-				    dot(dist_11, dist_11) < min_sq_dist)
-				{
-					unsigned linear_coord = y * resolution_x + x;
-					auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-					tile_list[index >> 5] |= 1u << (index & 31);
-				}
-			}
-		}
-	}
-	else
-	{
-		for (unsigned y = uranges.z; y <= uranges.w; y++)
-		{
-			for (unsigned x = uranges.x; x <= uranges.y; x++)
-			{
-				unsigned linear_coord = y * resolution_x + x;
-				auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-				tile_list[index >> 5] |= 1u << (index & 31);
-			}
-		}
-	}
-}
-
-void LightClusterer::update_bindless_mask_buffer_cpu(Vulkan::CommandBuffer &cmd)
-{
-	uint32_t local_count = bindless.parameters.num_lights;
-	if (local_count == 0)
-		return;
-
-	size_t size = bindless.parameters.num_lights_32 * sizeof(uint32_t) * resolution_x * resolution_y;
-	auto *masks = static_cast<uint32_t *>(cmd.update_buffer(*bindless.bitmask_buffer, 0, size));
-	memset(masks, 0, size);
-
-	for (unsigned i = 0; i < local_count; i++)
-	{
-		if (bindless_light_is_point(i))
-			update_bindless_mask_buffer_point(masks, i);
-		else
-			update_bindless_mask_buffer_spot(masks, i);
-	}
-}
-
 void LightClusterer::update_bindless_mask_buffer_decal_gpu(Vulkan::CommandBuffer &cmd)
 {
 	uint32_t count = bindless.parameters.num_decals;
@@ -2297,8 +2148,16 @@ void LightClusterer::update_bindless_mask_buffer_gpu(Vulkan::CommandBuffer &cmd)
 void LightClusterer::build_cluster_bindless_cpu(Vulkan::CommandBuffer &cmd)
 {
 	update_bindless_data(cmd);
-	update_bindless_range_buffer_cpu(cmd);
-	update_bindless_mask_buffer_cpu(cmd);
+
+	// Binning already ran on the worker threads during refresh.
+	auto *ranges = static_cast<uvec2 *>(cmd.update_buffer(*bindless.range_buffer, 0, bindless.range_buffer->get_create_info().size));
+	memcpy(ranges, bindless.cpu_binning.z_ranges.data(), resolution_z * sizeof(uvec2));
+
+	if (bindless.parameters.num_lights == 0)
+		return;
+
+	size_t size = bindless.cpu_binning.bitmask.size() * sizeof(uint32_t);
+	memcpy(cmd.update_buffer(*bindless.bitmask_buffer, 0, size), bindless.cpu_binning.bitmask.data(), size);
 }
 
 void LightClusterer::build_cluster_bindless_gpu(Vulkan::CommandBuffer &cmd)
@@ -2360,6 +2219,7 @@ void LightClusterer::build_cluster_cpu(Vulkan::CommandBuffer &cmd, Vulkan::Image
 
 	auto &workers = *GRANITE_THREAD_GROUP();
 	auto task = workers.create_task();
+	auto *arena = &cmd.get_device().get_frame_arena();
 
 	// Naive and simple multithreading :)
 	// Pre-compute useful data structures before we go wide ...
@@ -2412,7 +2272,7 @@ void LightClusterer::build_cluster_cpu(Vulkan::CommandBuffer &cmd, Vulkan::Image
 				uint32_t cached_point_mask = 0;
 				uvec4 cached_node = uvec4(0);
 
-				vector<uint32_t> tmp_list_buffer;
+				Util::FrameVector<uint32_t> tmp_list_buffer{Util::FrameArenaAllocator<uint32_t>(arena)};
 				vector<uvec4> image_base;
 				if (ImplementationQuirks::get().clustering_list_iteration)
 					image_base.resize(ClusterPrepassDownsample * res_x * res_y);
@@ -23,6 +23,7 @@
 #pragma once
 
 #include "lights.hpp"
+#include "cluster_binning.hpp"
 #include "render_components.hpp"
 #include "event.hpp"
 #include "shader_manager.hpp"
@@ -32,6 +33,7 @@
 #include "render_context.hpp"
 #include "render_graph.hpp"
 #include "descriptor_set.hpp"
+#include <unordered_map>
 
 namespace Granite
 {
@@ -122,6 +124,12 @@ public:
 		max_point_lights = count;
 	}
 
+	// Lights whose screen coverage times intensity is below this are not rendered at all.
+	void set_min_light_importance(float importance)
+	{
+		min_light_importance = importance;
+	}
+
 private:
 	void add_render_passes(RenderGraph &graph) override;
 	void add_render_passes_legacy(RenderGraph &graph);
@@ -157,6 +165,7 @@ private:
 	unsigned shadow_resolution = 512;
 	unsigned max_spot_lights = MaxLights;
 	unsigned max_point_lights = MaxLights;
+	float min_light_importance = 0.0f;
 	void build_cluster(Vulkan::CommandBuffer &cmd, Vulkan::ImageView &view, const Vulkan::ImageView *pre_culled);
 	void build_cluster_cpu(Vulkan::CommandBuffer &cmd, Vulkan::ImageView &view);
 	void build_cluster_bindless_cpu(Vulkan::CommandBuffer &cmd);
@@ -173,6 +182,9 @@ private:
 			PointTransform shadow_transforms[MaxLights] = {};
 			vec4 model_transforms[MaxLights] = {};
 			unsigned cookie[MaxLights] = {};
+			Util::Hash light_hashes[MaxLights] = {};
+			Util::Hash shadow_hashes[MaxLights] = {};
+			uint8_t tiers[MaxLights] = {};
 			unsigned count = 0;
 			uint8_t index_remap[MaxLights];
 			Vulkan::ImageHandle atlas;
@@ -184,11 +196,18 @@ private:
 			SpotLight *handles[MaxLights] = {};
 			mat4 shadow_transforms[MaxLights] = {};
 			unsigned cookie[MaxLights] = {};
+			Util::Hash light_hashes[MaxLights] = {};
+			Util::Hash shadow_hashes[MaxLights] = {};
+			float importances[MaxLights] = {};
+			uint8_t tiers[MaxLights] = {};
 			unsigned count = 0;
 			uint8_t index_remap[MaxLights];
 			Vulkan::ImageHandle atlas;
 		} spots;
 
+		// Static casters per atlas slot, gathered once per frame for hashing and rendering.
+		std::vector<VisibilityList> shadow_visibility;
+
 		Vulkan::BufferHandle cluster_list;
 		Vulkan::ShaderProgramVariant *inherit_variant = nullptr;
 		Vulkan::ShaderProgramVariant *cull_variant = nullptr;
@@ -243,7 +262,7 @@ private:
 
 	void render_shadow_legacy(Vulkan::CommandBuffer &cmd,
 	                          const RenderContext &context,
-	                          VisibilityList &visibility,
+	                          const VisibilityList &visibility,
 	                          unsigned off_x, unsigned off_y,
 	                          unsigned res_x, unsigned res_y,
 	                          const Vulkan::ImageView &rt, unsigned layer,
@@ -296,22 +315,23 @@ private:
 
 		std::vector<uvec2> volume_index_range;
 
+		ClusterBinningInput cpu_binning_input;
+		ClusterBinningOutput cpu_binning;
+
 		std::vector<VkImageMemoryBarrier> shadow_barriers;
 		std::vector<const Vulkan::Image *> shadow_images;
 		std::vector<ShadowTaskHandle> shadow_task_handles;
 		std::vector<Util::Hash> light_transform_hashes;
+		std::vector<const Vulkan::ImageView *> decal_views;
+		std::unordered_map<const Vulkan::ImageView *, uint32_t> decal_view_to_index;
 	} bindless;
 
 	void update_bindless_descriptors(Vulkan::Device &device);
 	void update_bindless_data(Vulkan::CommandBuffer &cmd);
-	void update_bindless_range_buffer_cpu(Vulkan::CommandBuffer &cmd);
 	void update_bindless_range_buffer_gpu(Vulkan::CommandBuffer &cmd);
 	void update_bindless_range_buffer_decal_gpu(Vulkan::CommandBuffer &cmd);
-	void update_bindless_mask_buffer_cpu(Vulkan::CommandBuffer &cmd);
 	void update_bindless_mask_buffer_gpu(Vulkan::CommandBuffer &cmd);
 	void update_bindless_mask_buffer_decal_gpu(Vulkan::CommandBuffer &cmd);
-	void update_bindless_mask_buffer_spot(uint32_t *masks, unsigned index);
-	void update_bindless_mask_buffer_point(uint32_t *masks, unsigned index);
 	void begin_bindless_barriers(Vulkan::CommandBuffer &cmd);
 	void end_bindless_barriers(Vulkan::CommandBuffer &cmd);
 
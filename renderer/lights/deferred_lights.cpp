@@ -26,11 +26,18 @@
 #include "lights.hpp"
 #include <algorithm>
 #include <float.h>
+#include <string.h>
 
 namespace Granite
 {
 void DeferredLights::refresh(const RenderContext &context, TaskComposer &)
 {
+	if (tiled_output)
+	{
+		refresh_tiled(context);
+		return;
+	}
+
 	if (!enable_clustered_stencil)
 		return;
 
@@ -80,6 +87,99 @@ void DeferredLights::refresh(const RenderContext &context, TaskComposer &)
 	}
 }
 
+void DeferredLights::refresh_tiled(const RenderContext &context)
+{
+	visible.clear();
+	scene->gather_visible_positional_lights(context.get_visibility_frustum(), visible);
+
+	tiled_lights.clear();
+	tiled_type_mask.clear();
+	tiled_type_mask.resize(MaxTiledLights / 32);
+
+	for (auto &light : visible)
+	{
+		if (tiled_lights.size() >= MaxTiledLights)
+		{
+			LOGW("Too many lights for tiled deferred, dropping %u.\n", unsigned(visible.size() - MaxTiledLights));
+			break;
+		}
+
+		auto &l = *static_cast<const PositionalLight *>(light.renderable);
+		auto &transform = light.transform->transform->world_transform;
+		auto index = unsigned(tiled_lights.size());
+
+		if (l.get_type() == PositionalLight::Type::Point)
+		{
+			tiled_lights.push_back(static_cast<const PointLight &>(l).get_shader_info(transform));
+			tiled_type_mask[index >> 5] |= 1u << (index & 31u);
+		}
+		else
+			tiled_lights.push_back(static_cast<const SpotLight &>(l).get_shader_info(transform));
+	}
+}
+
+void DeferredLights::add_tiled_compute_pass(RenderGraph &graph, const RenderContext &context,
+                                            const std::string &base_color, const std::string &normal,
+                                            const std::string &pbr, const std::string &depth,
+                                            const std::string &output)
+{
+	AttachmentInfo info;
+	info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	info.size_class = SizeClass::InputRelative;
+	info.size_relative_name = depth;
+
+	auto &pass = graph.add_pass(output, RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &base_color_res = pass.add_texture_input(base_color);
+	auto &normal_res = pass.add_texture_input(normal);
+	auto &pbr_res = pass.add_texture_input(pbr);
+	auto &depth_res = pass.add_texture_input(depth);
+	tiled_output = &pass.add_storage_texture_output(output, info);
+	tiled_graph = &graph;
+
+	pass.set_build_render_pass([&, this](Vulkan::CommandBuffer &cmd) {
+		build_tiled_pass(cmd, context, base_color_res, normal_res, pbr_res, depth_res);
+	});
+}
+
+void DeferredLights::build_tiled_pass(Vulkan::CommandBuffer &cmd, const RenderContext &context,
+                                      const RenderTextureResource &base_color, const RenderTextureResource &normal,
+                                      const RenderTextureResource &pbr, const RenderTextureResource &depth)
+{
+	auto &output = tiled_graph->get_physical_texture_resource(*tiled_output);
+	cmd.set_texture(0, 0, tiled_graph->get_physical_texture_resource(base_color), Vulkan::StockSampler::NearestClamp);
+	cmd.set_texture(0, 1, tiled_graph->get_physical_texture_resource(normal), Vulkan::StockSampler::NearestClamp);
+	cmd.set_texture(0, 2, tiled_graph->get_physical_texture_resource(pbr), Vulkan::StockSampler::NearestClamp);
+	cmd.set_texture(0, 3, tiled_graph->get_physical_texture_resource(depth), Vulkan::StockSampler::NearestClamp);
+	cmd.set_storage_texture(0, 4, output);
+
+	// Empty lists still need a valid binding.
+	unsigned count = unsigned(tiled_lights.size());
+	auto *lights = cmd.allocate_typed_storage_data<PositionalFragmentInfo>(0, 5, std::max(count, 1u));
+	if (count)
+		memcpy(lights, tiled_lights.data(), count * sizeof(PositionalFragmentInfo));
+	auto *type_mask = cmd.allocate_typed_storage_data<uint32_t>(0, 6, (std::max(count, 1u) + 31) / 32);
+	memcpy(type_mask, tiled_type_mask.data(), ((std::max(count, 1u) + 31) / 32) * sizeof(uint32_t));
+
+	cmd.set_program("builtin://shaders/lights/tiled_deferred.comp");
+
+	struct Registers
+	{
+		mat4 inverse_view_projection;
+		vec3 camera_pos;
+		int32_t num_lights;
+		uvec2 resolution;
+		vec2 inv_resolution;
+	} push;
+
+	push.inverse_view_projection = context.get_render_parameters().inv_view_projection;
+	push.camera_pos = context.get_render_parameters().camera_position;
+	push.num_lights = int32_t(count);
+	push.resolution = uvec2(output.get_image().get_width(), output.get_image().get_height());
+	push.inv_resolution = vec2(1.0f) / vec2(push.resolution);
+	cmd.push_constants(&push, 0, sizeof(push));
+	cmd.dispatch((push.resolution.x + 15) / 16, (push.resolution.y + 15) / 16, 1);
+}
+
 void DeferredLights::set_scene(Scene *scene_)
 {
 	scene = scene_;
@@ -116,6 +216,19 @@ void DeferredLights::render_prepass_lights(Vulkan::CommandBuffer &cmd, RenderQue
 
 void DeferredLights::render_lights(Vulkan::CommandBuffer &cmd, RenderQueue &queue, const RenderContext &context)
 {
+	if (tiled_output)
+	{
+		auto &lighting = tiled_graph->get_physical_texture_resource(*tiled_output);
+		cmd.set_quad_state();
+		cmd.set_blend_enable(true);
+		cmd.set_blend_factors(VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE);
+		cmd.set_blend_op(VK_BLEND_OP_ADD);
+		cmd.set_texture(0, 0, lighting, Vulkan::StockSampler::NearestClamp);
+		Vulkan::CommandBufferUtil::draw_fullscreen_quad(cmd, "builtin://shaders/quad.vert",
+		                                                "builtin://shaders/lights/tiled_deferred_composite.frag");
+		return;
+	}
+
 	auto &deferred_renderer = renderer_suite->get_renderer(RendererSuite::Type::Deferred);
 
 	if (enable_clustered_stencil)
@@ -25,6 +25,8 @@
 #include "scene.hpp"
 #include "render_context.hpp"
 #include "renderer.hpp"
+#include "render_graph.hpp"
+#include "light_info.hpp"
 #include <vector>
 
 namespace Granite
@@ -39,6 +41,13 @@ public:
 		enable_clustered_stencil = state;
 	}
 
+	// Shades positional lights in a compute pass which culls them per 16x16 tile against G-buffer depth.
+	// The lighting pass must read output as a texture, render_lights() then adds it in one fullscreen draw.
+	void add_tiled_compute_pass(RenderGraph &graph, const RenderContext &context,
+	                            const std::string &base_color, const std::string &normal,
+	                            const std::string &pbr, const std::string &depth,
+	                            const std::string &output);
+
 	void render_prepass_lights(Vulkan::CommandBuffer &cmd, RenderQueue &queue, const RenderContext &context);
 	void render_lights(Vulkan::CommandBuffer &cmd, RenderQueue &queue, const RenderContext &context);
 
@@ -53,6 +62,16 @@ private:
 	VisibilityList clusters[NumClusters];
 	bool enable_clustered_stencil = false;
 
+	enum { MaxTiledLights = 4096 };
+	RenderGraph *tiled_graph = nullptr;
+	RenderTextureResource *tiled_output = nullptr;
+	std::vector<PositionalFragmentInfo> tiled_lights;
+	std::vector<uint32_t> tiled_type_mask;
+	void refresh_tiled(const RenderContext &context);
+	void build_tiled_pass(Vulkan::CommandBuffer &cmd, const RenderContext &context,
+	                      const RenderTextureResource &base_color, const RenderTextureResource &normal,
+	                      const RenderTextureResource &pbr, const RenderTextureResource &depth);
+
 	void refresh(const RenderContext &context, TaskComposer &composer) override;
 };
 }
\ No newline at end of file
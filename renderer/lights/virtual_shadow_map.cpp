@@ -0,0 +1,490 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "virtual_shadow_map.hpp"
+#include "scene.hpp"
+#include "task_composer.hpp"
+#include "transforms.hpp"
+#include "device.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace Granite
+{
+bool VirtualShadowMap::init(Vulkan::Device &device_, Scene *scene_, const RendererSuite *suite_,
+                            const VirtualShadowMapOptions &options_)
+{
+	device = &device_;
+	scene = scene_;
+	suite = suite_;
+	options = options_;
+
+	if (options.physical_resolution < PageSize || (options.physical_resolution % PageSize) != 0)
+	{
+		LOGE("Virtual shadow map physical resolution must be a multiple of %u.\n", unsigned(PageSize));
+		return false;
+	}
+
+	slots_per_side = options.physical_resolution / PageSize;
+	unsigned num_slots = slots_per_side * slots_per_side;
+
+	pages.clear();
+	pages.resize(NumPages);
+	slot_owners.assign(num_slots, -1);
+	free_slots.clear();
+	for (unsigned i = num_slots; i; i--)
+		free_slots.push_back(i - 1);
+	page_table.assign(NumPages, 0);
+	scratch_hashes.assign(NumPages, 0);
+	render_index.assign(NumPages, -1);
+	renders.reset(new PageRender[options.max_page_renders_per_frame]);
+	num_renders = 0;
+	has_rendered_light = false;
+	has_last_view_projection = false;
+	frame = 0;
+
+	Vulkan::BufferCreateInfo info;
+	info.domain = Vulkan::BufferDomain::CachedHost;
+	info.size = (NumPages / 32) * sizeof(uint32_t);
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	info.tag = Vulkan::AllocationTag::Shadow;
+
+	unsigned num_contexts = device->get_num_frame_contexts();
+	readbacks.clear();
+	for (unsigned i = 0; i < num_contexts; i++)
+		readbacks.push_back(device->create_buffer(info));
+	readback_valid.assign(num_contexts, false);
+
+	info.domain = Vulkan::BufferDomain::Host;
+	info.size = NumPages * sizeof(uint32_t);
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	page_tables.clear();
+	for (unsigned i = 0; i < num_contexts; i++)
+		page_tables.push_back(device->create_buffer(info, page_table.data()));
+
+	for (auto &readback : readbacks)
+		if (!readback)
+			return false;
+	for (auto &table : page_tables)
+		if (!table)
+			return false;
+
+	return true;
+}
+
+void VirtualShadowMap::add_render_passes(RenderGraph &graph, const std::string &depth, const std::string &output)
+{
+	BufferInfo requests_info;
+	requests_info.size = (NumPages / 32) * sizeof(uint32_t);
+	requests_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+	                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+	                      VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	auto &feedback = graph.add_pass(output + "-feedback", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &requests = feedback.add_storage_output(output + "-requests", requests_info);
+	auto &depth_history = feedback.add_history_input(depth);
+	feedback.set_build_render_pass([&, this](Vulkan::CommandBuffer &cmd) {
+		record_feedback(cmd, graph.get_physical_history_texture_resource(depth_history),
+		                graph.get_physical_buffer_resource(requests));
+	});
+
+	AttachmentInfo atlas;
+	atlas.format = VK_FORMAT_D16_UNORM;
+	atlas.size_class = SizeClass::Absolute;
+	atlas.size_x = float(options.physical_resolution);
+	atlas.size_y = float(options.physical_resolution);
+	atlas.flags |= ATTACHMENT_INFO_PRESERVE_BIT;
+
+	auto &page_pass = graph.add_pass(output, RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	// Only orders the page pass after the feedback pass, the requests are consumed on the CPU.
+	page_pass.add_storage_read_only_input(output + "-requests");
+	page_pass.set_depth_stencil_output(output, atlas);
+	page_pass.set_render_pass_interface(reference_from_this());
+}
+
+void VirtualShadowMap::set_light(const mat4 &view, const AABB &range)
+{
+	light_view = view;
+	light_range = range;
+	shadow_transform = translate(vec3(0.5f, 0.5f, 0.0f)) * scale(vec3(0.5f, 0.5f, 1.0f)) * ortho(range) * view;
+}
+
+void VirtualShadowMap::begin_frame(const RenderContext &base, const RenderContext &camera)
+{
+	base_context = &base;
+
+	// The feedback pass of this frame reads the depth rendered last frame.
+	if (has_last_view_projection)
+		feedback_inv_view_projection = inverse(last_view_projection);
+	else
+		feedback_inv_view_projection = camera.get_render_parameters().inv_view_projection;
+	last_view_projection = camera.get_render_parameters().view_projection;
+	has_last_view_projection = true;
+}
+
+const mat4 &VirtualShadowMap::get_shadow_transform() const
+{
+	return shadow_transform;
+}
+
+const Vulkan::Buffer *VirtualShadowMap::get_page_table() const
+{
+	if (page_tables.empty())
+		return nullptr;
+	return page_tables[device->get_current_frame_context()].get();
+}
+
+unsigned VirtualShadowMap::get_num_resident_pages() const
+{
+	return unsigned(slot_owners.size() - free_slots.size());
+}
+
+bool VirtualShadowMap::get_clear_depth_stencil(VkClearDepthStencilValue *) const
+{
+	// Pages which are not rendered this frame are loaded, rendered pages are cleared in build_render_pass().
+	return false;
+}
+
+void VirtualShadowMap::get_page_rect(unsigned page, unsigned &x, unsigned &y) const
+{
+	int slot = pages[page].slot;
+	x = (unsigned(slot) % slots_per_side) * PageSize;
+	y = (unsigned(slot) / slots_per_side) * PageSize;
+}
+
+void VirtualShadowMap::request_page(unsigned x, unsigned y)
+{
+	// Neighbors are requested as well, so pages are likely to be resident before the camera reaches them.
+	unsigned x0 = x ? x - 1 : x;
+	unsigned y0 = y ? y - 1 : y;
+	unsigned x1 = std::min<unsigned>(x + 1, PagesPerSide - 1);
+	unsigned y1 = std::min<unsigned>(y + 1, PagesPerSide - 1);
+	for (unsigned py = y0; py <= y1; py++)
+		for (unsigned px = x0; px <= x1; px++)
+			pages[py * PagesPerSide + px].last_requested = frame;
+}
+
+void VirtualShadowMap::consume_feedback(unsigned context)
+{
+	auto *bits = static_cast<const uint32_t *>(
+			device->map_host_buffer(*readbacks[context], Vulkan::MEMORY_ACCESS_READ_BIT));
+	if (!bits)
+		return;
+
+	for (unsigned word = 0; word < NumPages / 32; word++)
+	{
+		uint32_t mask = bits[word];
+		Util::for_each_bit(mask, [&](unsigned bit) {
+			unsigned page = word * 32 + bit;
+			request_page(page % PagesPerSide, page / PagesPerSide);
+		});
+	}
+
+	device->unmap_host_buffer(*readbacks[context], Vulkan::MEMORY_ACCESS_READ_BIT);
+}
+
+bool VirtualShadowMap::allocate_slot(unsigned page)
+{
+	int slot = -1;
+	if (!free_slots.empty())
+	{
+		slot = int(free_slots.back());
+		free_slots.pop_back();
+	}
+	else
+	{
+		// Evict the least recently requested page, but never one which was requested in the latest feedback.
+		uint64_t oldest = frame;
+		for (size_t i = 0; i < slot_owners.size(); i++)
+		{
+			auto &owner = pages[slot_owners[i]];
+			if (owner.last_requested < oldest)
+			{
+				oldest = owner.last_requested;
+				slot = int(i);
+			}
+		}
+
+		if (slot < 0)
+			return false;
+
+		auto &evicted = pages[slot_owners[slot]];
+		page_table[slot_owners[slot]] = 0;
+		evicted.slot = -1;
+		evicted.valid = false;
+	}
+
+	slot_owners[slot] = int(page);
+	pages[page].slot = slot;
+	pages[page].valid = false;
+	return true;
+}
+
+void VirtualShadowMap::select_pages()
+{
+	for (unsigned i = 0; i < num_renders; i++)
+		render_index[renders[i].page] = -1;
+	num_renders = 0;
+
+	// Anything which changes the light space mapping invalidates every page.
+	bool light_changed = !has_rendered_light ||
+	                     memcmp(&rendered_view, &light_view, sizeof(mat4)) != 0 ||
+	                     any(notEqual(rendered_range.get_minimum(), light_range.get_minimum())) ||
+	                     any(notEqual(rendered_range.get_maximum(), light_range.get_maximum()));
+
+	if (light_changed)
+	{
+		for (auto &page : pages)
+			page.valid = false;
+		std::fill(page_table.begin(), page_table.end(), 0u);
+		rendered_view = light_view;
+		rendered_range = light_range;
+		has_rendered_light = true;
+	}
+
+	// Gather every caster in the light range once, and hash them into the pages they overlap.
+	casters.clear();
+	unbounded_casters.clear();
+	RenderContext range_context;
+	range_context.set_camera(ortho(light_range), light_view);
+	scene->gather_visible_dynamic_shadow_renderables(range_context.get_visibility_frustum(), casters);
+
+	const auto page_range = [this](const RenderableInfo &info, uvec2 &lo, uvec2 &hi) {
+		AABB aabb = info.transform->world_aabb.transform(shadow_transform);
+		vec2 lo_coord = clamp(aabb.get_minimum().xy() * float(PagesPerSide), vec2(0.0f), vec2(PagesPerSide - 1));
+		vec2 hi_coord = clamp(aabb.get_maximum().xy() * float(PagesPerSide), vec2(0.0f), vec2(PagesPerSide - 1));
+		lo = uvec2(lo_coord);
+		hi = uvec2(hi_coord);
+	};
+
+	for (unsigned i = 0; i < slot_owners.size(); i++)
+		if (slot_owners[i] >= 0)
+			scratch_hashes[slot_owners[i]] = 0;
+
+	auto itr = std::remove_if(casters.begin(), casters.end(), [&](const RenderableInfo &info) {
+		if (!info.transform)
+		{
+			unbounded_casters.push_back(info);
+			return true;
+		}
+
+		uvec2 lo, hi;
+		page_range(info, lo, hi);
+		for (unsigned y = lo.y; y <= hi.y; y++)
+			for (unsigned x = lo.x; x <= hi.x; x++)
+				if (pages[y * PagesPerSide + x].slot >= 0)
+					scratch_hashes[y * PagesPerSide + x] ^= info.transform_hash;
+		return false;
+	});
+	casters.erase(itr, casters.end());
+
+	const auto add_render = [this](unsigned page) {
+		render_index[page] = int(num_renders);
+		renders[num_renders].page = page;
+		num_renders++;
+	};
+
+	// Requested pages without content come first, and may need a slot.
+	for (unsigned page = 0; page < NumPages && num_renders < options.max_page_renders_per_frame; page++)
+	{
+		auto &p = pages[page];
+		if (p.last_requested != frame || p.valid)
+			continue;
+
+		if (p.slot < 0)
+		{
+			if (!allocate_slot(page))
+				break;
+
+			// The hashes were computed before this page had a slot.
+			scratch_hashes[page] = 0;
+			for (auto &info : casters)
+			{
+				uvec2 lo, hi;
+				page_range(info, lo, hi);
+				unsigned x = page % PagesPerSide;
+				unsigned y = page / PagesPerSide;
+				if (x >= lo.x && x <= hi.x && y >= lo.y && y <= hi.y)
+					scratch_hashes[page] ^= info.transform_hash;
+			}
+		}
+
+		add_render(page);
+	}
+
+	// Then resident pages whose casters moved.
+	for (unsigned i = 0; i < slot_owners.size() && num_renders < options.max_page_renders_per_frame; i++)
+	{
+		int page = slot_owners[i];
+		if (page < 0 || render_index[page] >= 0 || !pages[page].valid)
+			continue;
+		if (scratch_hashes[page] != pages[page].hash)
+			add_render(unsigned(page));
+	}
+
+	for (unsigned i = 0; i < num_renders; i++)
+	{
+		auto &render = renders[i];
+		auto &page = pages[render.page];
+		page.hash = scratch_hashes[render.page];
+		page.valid = true;
+		page_table[render.page] = uint32_t(page.slot + 1);
+
+		unsigned x = render.page % PagesPerSide;
+		unsigned y = render.page / PagesPerSide;
+		vec3 lo = light_range.get_minimum();
+		vec3 hi = light_range.get_maximum();
+		vec2 page_lo = mix(lo.xy(), hi.xy(), vec2(x, y) / float(PagesPerSide));
+		vec2 page_hi = mix(lo.xy(), hi.xy(), vec2(x + 1, y + 1) / float(PagesPerSide));
+
+		if (base_context)
+			render.context = *base_context;
+		render.context.set_camera(ortho(AABB(vec3(page_lo, lo.z), vec3(page_hi, hi.z))), light_view);
+		render.visible = unbounded_casters;
+	}
+
+	// Bin the casters into the pages which are rendered.
+	if (num_renders)
+	{
+		for (auto &info : casters)
+		{
+			uvec2 lo, hi;
+			page_range(info, lo, hi);
+			for (unsigned y = lo.y; y <= hi.y; y++)
+			{
+				for (unsigned x = lo.x; x <= hi.x; x++)
+				{
+					int index = render_index[y * PagesPerSide + x];
+					if (index >= 0)
+						renders[index].visible.push_back(info);
+				}
+			}
+		}
+	}
+
+	// Pages which were evicted are no longer in the table either.
+	memcpy(device->map_host_buffer(*page_tables[device->get_current_frame_context()], Vulkan::MEMORY_ACCESS_WRITE_BIT),
+	       page_table.data(), page_table.size() * sizeof(uint32_t));
+	device->unmap_host_buffer(*page_tables[device->get_current_frame_context()], Vulkan::MEMORY_ACCESS_WRITE_BIT);
+}
+
+void VirtualShadowMap::enqueue_prepare_render_pass(TaskComposer &composer)
+{
+	{
+		auto &group = composer.begin_pipeline_stage();
+		group.set_desc("virtual-shadow-map-pages");
+		group.enqueue_task([this]() {
+			frame++;
+			unsigned context = device->get_current_frame_context();
+			if (readback_valid[context])
+			{
+				consume_feedback(context);
+				readback_valid[context] = false;
+			}
+
+			select_pages();
+
+			auto &renderer = suite->get_renderer(RendererSuite::Type::ShadowDepthDirectionalPCF);
+			for (unsigned i = 0; i < num_renders; i++)
+				renderer.begin(renders[i].queue);
+		});
+	}
+
+	composer.parallel_for(options.max_page_renders_per_frame, 1, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end && i < num_renders; i++)
+		{
+			auto &render = renders[i];
+			render.queue.push_depth_renderables(render.context, render.visible.data(), render.visible.size());
+			render.queue.sort();
+		}
+	}).set_desc("virtual-shadow-map-push");
+}
+
+void VirtualShadowMap::build_render_pass(Vulkan::CommandBuffer &cmd)
+{
+	auto &renderer = suite->get_renderer(RendererSuite::Type::ShadowDepthDirectionalPCF);
+
+	for (unsigned i = 0; i < num_renders; i++)
+	{
+		auto &render = renders[i];
+		unsigned x, y;
+		get_page_rect(render.page, x, y);
+
+		VkClearRect rect = {};
+		rect.rect.offset = { int(x), int(y) };
+		rect.rect.extent = { PageSize, PageSize };
+		rect.layerCount = 1;
+		VkClearValue value = {};
+		value.depthStencil = { 1.0f, 0u };
+		cmd.clear_quad(0, rect, value, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+		cmd.set_viewport({ float(x), float(y), float(PageSize), float(PageSize), 0.0f, 1.0f });
+		cmd.set_scissor(rect.rect);
+		renderer.flush(cmd, render.queue, render.context, Renderer::DEPTH_BIAS_BIT | Renderer::SKIP_SORTING_BIT);
+	}
+}
+
+void VirtualShadowMap::record_feedback(Vulkan::CommandBuffer &cmd, const Vulkan::ImageView *depth,
+                                       const Vulkan::Buffer &requests)
+{
+	unsigned context = device->get_current_frame_context();
+
+	// The copy of last frame's requests must be done before clearing.
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	cmd.fill_buffer(requests, 0);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	if (depth)
+	{
+		struct Parameters
+		{
+			mat4 inv_view_projection;
+			mat4 shadow_transform;
+			uvec2 resolution;
+			vec2 inv_resolution;
+		};
+
+		unsigned width = depth->get_image().get_width();
+		unsigned height = depth->get_image().get_height();
+
+		auto *params = cmd.allocate_typed_constant_data<Parameters>(1, 0, 1);
+		params->inv_view_projection = feedback_inv_view_projection;
+		params->shadow_transform = shadow_transform;
+		params->resolution = uvec2(width, height);
+		params->inv_resolution = vec2(1.0f / float(width), 1.0f / float(height));
+
+		cmd.set_program("builtin://shaders/lights/virtual_shadow_feedback.comp");
+		cmd.set_texture(0, 0, *depth, Vulkan::StockSampler::NearestClamp);
+		cmd.set_storage_buffer(0, 1, requests);
+		cmd.dispatch((width + 7) / 8, (height + 7) / 8, 1);
+	}
+
+	cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	cmd.copy_buffer(*readbacks[context], 0, requests, 0, readbacks[context]->get_create_info().size);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+	readback_valid[context] = true;
+}
+}
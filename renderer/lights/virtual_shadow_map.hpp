@@ -0,0 +1,142 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "render_graph.hpp"
+#include "render_context.hpp"
+#include "render_queue.hpp"
+#include "renderer.hpp"
+#include "aabb.hpp"
+#include <memory>
+#include <vector>
+
+namespace Granite
+{
+class Scene;
+
+struct VirtualShadowMapOptions
+{
+	// Size of the physical page atlas, must be a multiple of VirtualShadowMap::PageSize.
+	unsigned physical_resolution = 4096;
+	// Pages rendered per frame, newly requested pages first.
+	unsigned max_page_renders_per_frame = 64;
+};
+
+// Page based shadow map for a directional light, with a 16k x 16k virtual resolution over the light's range.
+// Last frame's depth buffer marks the pages which are needed. The requests are read back, and requested pages
+// get a slot in a physical depth atlas. The least recently requested pages are evicted when the atlas is full.
+// A page is only rendered when it gets a slot, or when the transform hashes of the casters overlapping it change,
+// so pages with static casters stay cached across frames.
+// Lighting samples the atlas through the page table, see DIRECTIONAL_SHADOW_VIRTUAL in lights/lighting_resources.h.
+class VirtualShadowMap : public RenderPassInterface
+{
+public:
+	enum
+	{
+		VirtualResolution = 16384,
+		PageSize = 128,
+		PagesPerSide = VirtualResolution / PageSize,
+		NumPages = PagesPerSide * PagesPerSide
+	};
+
+	bool init(Vulkan::Device &device, Scene *scene, const RendererSuite *suite, const VirtualShadowMapOptions &options);
+
+	// Adds a compute pass which marks pages from the history of depth, and the page pass which renders to output.
+	void add_render_passes(RenderGraph &graph, const std::string &depth, const std::string &output);
+
+	// Call every frame before the prepare tasks of the render graph run.
+	// view and range are the light view and the light space range covered by the virtual map.
+	// base provides the material heap and meshlet culling options for the page contexts.
+	// camera is the context last frame's depth will be reprojected with next frame.
+	void set_light(const mat4 &view, const AABB &range);
+	void begin_frame(const RenderContext &base, const RenderContext &camera);
+
+	// Maps world space to virtual texture coordinates and depth. Use as shadow transform 0.
+	const mat4 &get_shadow_transform() const;
+	// One uint per virtual page, 0 if not resident, otherwise atlas slot + 1.
+	const Vulkan::Buffer *get_page_table() const;
+	unsigned get_num_resident_pages() const;
+
+	bool get_clear_depth_stencil(VkClearDepthStencilValue *value) const override;
+	void enqueue_prepare_render_pass(TaskComposer &composer) override;
+	void build_render_pass(Vulkan::CommandBuffer &cmd) override;
+
+private:
+	Vulkan::Device *device = nullptr;
+	Scene *scene = nullptr;
+	const RendererSuite *suite = nullptr;
+	VirtualShadowMapOptions options;
+	unsigned slots_per_side = 0;
+
+	std::vector<Vulkan::BufferHandle> readbacks;
+	std::vector<bool> readback_valid;
+	std::vector<Vulkan::BufferHandle> page_tables;
+
+	struct Page
+	{
+		int slot = -1;
+		uint64_t last_requested = 0;
+		Util::Hash hash = 0;
+		bool valid = false;
+	};
+	std::vector<Page> pages;
+	std::vector<int> slot_owners;
+	std::vector<unsigned> free_slots;
+	std::vector<uint32_t> page_table;
+	std::vector<Util::Hash> scratch_hashes;
+	std::vector<int> render_index;
+	uint64_t frame = 0;
+
+	mat4 light_view;
+	AABB light_range;
+	mat4 shadow_transform;
+	mat4 rendered_view;
+	AABB rendered_range;
+	bool has_rendered_light = false;
+
+	const RenderContext *base_context = nullptr;
+	mat4 feedback_inv_view_projection;
+	mat4 last_view_projection;
+	bool has_last_view_projection = false;
+
+	VisibilityList casters;
+	VisibilityList unbounded_casters;
+
+	struct PageRender
+	{
+		unsigned page;
+		RenderContext context;
+		VisibilityList visible;
+		RenderQueue queue;
+	};
+	std::unique_ptr<PageRender[]> renders;
+	unsigned num_renders = 0;
+
+	void consume_feedback(unsigned context);
+	void request_page(unsigned x, unsigned y);
+	bool allocate_slot(unsigned page);
+	void select_pages();
+	void record_feedback(Vulkan::CommandBuffer &cmd, const Vulkan::ImageView *depth, const Vulkan::Buffer &requests);
+	void get_page_rect(unsigned page, unsigned &x, unsigned &y) const;
+};
+}
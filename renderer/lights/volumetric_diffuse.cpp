@@ -78,6 +78,13 @@ void VolumetricDiffuseLightManager::on_device_created(const Vulkan::DeviceCreate
 	view.view_type = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
 	sky_light_2d_array = device.create_image_view(view);
 
+	sky_light_next = device.create_image(info);
+	sky_light_next->set_layout(Vulkan::Layout::General);
+	device.set_name(*sky_light_next, "sky-light-next");
+	view.image = sky_light_next.get();
+	sky_light_next_2d_array = device.create_image_view(view);
+	sky_valid = false;
+
 	Vulkan::BufferCreateInfo buf_info = {};
 	buf_info.size = sizeof(uint16_t) * 4 * 6;
 	buf_info.usage = VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT;
@@ -94,6 +101,8 @@ void VolumetricDiffuseLightManager::on_device_destroyed(const Vulkan::DeviceCrea
 {
 	sky_light.reset();
 	sky_light_2d_array.reset();
+	sky_light_next.reset();
+	sky_light_next_2d_array.reset();
 	fallback_volume.reset();
 	fallback_volume_view.reset();
 }
@@ -527,9 +536,10 @@ TaskGroupHandle VolumetricDiffuseLightManager::create_probe_gbuffer(TaskComposer
 	atomics_info.size = 16;
 	atomics_info.domain = Vulkan::BufferDomain::Device;
 
+	// High priority probes are listed first, low priority probes in the second half.
 	Vulkan::BufferCreateInfo list_info = {};
 	list_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-	list_info.size = sizeof(uint32_t) * resolution.x * resolution.y * resolution.z;
+	list_info.size = 2 * sizeof(uint32_t) * resolution.x * resolution.y * resolution.z;
 	list_info.domain = Vulkan::BufferDomain::Device;
 	light.light.set_buffers(device.create_buffer(atomics_info), device.create_buffer(list_info));
 
@@ -620,10 +630,68 @@ TaskGroupHandle VolumetricDiffuseLightManager::create_probe_gbuffer(TaskComposer
 	return probe_composer.get_outgoing_task();
 }
 
+void VolumetricDiffuseLightManager::set_probe_update_budget(unsigned probes_per_frame, float priority_distance)
+{
+	probe_update_budget = probes_per_frame;
+	probe_priority_distance = priority_distance;
+}
+
+void VolumetricDiffuseLightManager::set_sky_update_budget(unsigned faces_per_frame, unsigned blend_frames)
+{
+	sky_faces_per_frame = muglm::min(faces_per_frame, 6u);
+	sky_blend_frames = blend_frames;
+	sky_valid = false;
+}
+
+void VolumetricDiffuseLightManager::invalidate_probe_lighting()
+{
+	lighting_invalidated = true;
+}
+
+void VolumetricDiffuseLightManager::update_relight_state()
+{
+	if (fallback_render_context && fallback_render_context->get_lighting_parameters())
+	{
+		auto &directional = fallback_render_context->get_lighting_parameters()->directional;
+		if (any(notEqual(directional.direction, last_sun_direction)) ||
+		    any(notEqual(directional.color, last_sun_color)))
+		{
+			last_sun_direction = directional.direction;
+			last_sun_color = directional.color;
+			lighting_invalidated = true;
+		}
+	}
+
+	if (lighting_invalidated)
+	{
+		// Every probe must be relit once per accumulation layer to fully converge.
+		unsigned frames = 1;
+		if (probe_update_budget)
+		{
+			for (auto &light_tuple : *volumetric_diffuse)
+			{
+				auto *light = get_component<VolumetricDiffuseLightComponent>(light_tuple);
+				uvec3 res = light->light.get_resolution();
+				unsigned num_probes = res.x * res.y * res.z;
+				frames = muglm::max(frames, (num_probes + probe_update_budget - 1) / probe_update_budget);
+			}
+		}
+
+		relight_all_frames = frames * NumProbeLayers;
+		lighting_invalidated = false;
+	}
+
+	relight_all = relight_all_frames != 0;
+	if (relight_all_frames)
+		relight_all_frames--;
+}
+
 void VolumetricDiffuseLightManager::refresh(const RenderContext &context, TaskComposer &composer)
 {
 	if (!volumetric_diffuse)
 		return;
+
+	update_relight_state();
 	auto &group = composer.begin_pipeline_stage();
 
 	for (auto &light_tuple : *volumetric_diffuse)
@@ -665,6 +733,10 @@ void VolumetricDiffuseLightManager::cull_probe_buffer(Vulkan::CommandBuffer &cmd
 		float radius;
 		uvec3 resolution;
 		uint32_t iteration;
+		vec3 camera_position;
+		float priority_distance;
+		uint32_t relight_all;
+		uint32_t low_priority_offset;
 	};
 	auto *params = cmd.allocate_typed_constant_data<VolumeParameters>(1, 0, 1);
 	memcpy(params->tex_to_world, light.texture_to_world, sizeof(light.texture_to_world));
@@ -683,6 +755,11 @@ void VolumetricDiffuseLightManager::cull_probe_buffer(Vulkan::CommandBuffer &cmd
 	params->radius = length(radius);
 	params->resolution = res;
 	params->iteration = light.update_iteration;
+	params->camera_position = base_render_context->get_render_parameters().camera_position;
+	// Without a budget everything is relit anyway, so there is nothing to prioritize.
+	params->priority_distance = probe_update_budget ? probe_priority_distance : 0.0f;
+	params->relight_all = uint32_t(relight_all);
+	params->low_priority_offset = res.x * res.y * res.z;
 
 	memcpy(cmd.allocate_typed_constant_data<vec4>(1, 1, 6),
 	       base_render_context->get_visibility_frustum().get_planes(),
@@ -691,6 +768,27 @@ void VolumetricDiffuseLightManager::cull_probe_buffer(Vulkan::CommandBuffer &cmd
 	cmd.dispatch((res.x + 3) / 4, (res.y + 3) / 4, (res.z + 3) / 4);
 }
 
+void VolumetricDiffuseLightManager::budget_probe_buffer(Vulkan::CommandBuffer &cmd,
+                                                        VolumetricDiffuseLightComponent &light)
+{
+	cmd.set_storage_buffer(0, 0, *light.light.get_atomic_buffer());
+	cmd.set_storage_buffer(0, 1, *light.light.get_worklist_buffer());
+
+	uvec3 res = light.light.get_resolution();
+	struct Push
+	{
+		uint32_t budget;
+		uint32_t low_priority_offset;
+		uint32_t iteration;
+	} push = {};
+
+	push.budget = probe_update_budget ? probe_update_budget : ~0u;
+	push.low_priority_offset = res.x * res.y * res.z;
+	push.iteration = light.update_iteration;
+	cmd.push_constants(&push, 0, sizeof(push));
+	cmd.dispatch(1, 1, 1);
+}
+
 void VolumetricDiffuseLightManager::update_fallback_volume(Vulkan::CommandBuffer &cmd)
 {
 	cmd.set_program("builtin://shaders/lights/volumetric_light_compute_fallback.comp");
@@ -711,10 +809,11 @@ void VolumetricDiffuseLightManager::update_fallback_volume(Vulkan::CommandBuffer
 	cmd.dispatch(6, 1, 1);
 }
 
-void VolumetricDiffuseLightManager::update_sky_cube(Vulkan::CommandBuffer &cmd)
+void VolumetricDiffuseLightManager::render_sky_faces(Vulkan::CommandBuffer &cmd, const Vulkan::ImageView &view,
+                                                     unsigned base_face, unsigned num_faces)
 {
 	cmd.set_program("builtin://shaders/lights/volumetric_light_setup_sky.comp");
-	cmd.set_storage_texture(0, 0, *sky_light_2d_array);
+	cmd.set_storage_texture(0, 0, view);
 
 	struct Constants
 	{
@@ -722,17 +821,83 @@ void VolumetricDiffuseLightManager::update_sky_cube(Vulkan::CommandBuffer &cmd)
 		alignas(4) float camera_y;
 		alignas(16) vec3 sun_direction;
 		alignas(4) float inv_resolution;
+		alignas(4) uint32_t base_layer;
 	};
 
 	auto *constants = cmd.allocate_typed_constant_data<Constants>(1, 0, 1);
-	constants->sun_color = fallback_render_context->get_lighting_parameters()->directional.color;
-	constants->camera_y = fallback_render_context->get_render_parameters().camera_position.y;
-	constants->sun_direction = fallback_render_context->get_lighting_parameters()->directional.direction;
+	constants->sun_color = sky_sun_color;
+	constants->camera_y = sky_camera_y;
+	constants->sun_direction = sky_sun_direction;
 	constants->inv_resolution = 1.0f / float(sky_light->get_width());
+	constants->base_layer = base_face;
+
+	cmd.dispatch(sky_light->get_width() / 8, sky_light->get_height() / 8, num_faces);
+}
 
+void VolumetricDiffuseLightManager::blend_sky_cube(Vulkan::CommandBuffer &cmd, float lerp)
+{
+	// The next cube was written by an earlier frame.
+	cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	cmd.set_program("builtin://shaders/lights/volumetric_light_blend_sky.comp");
+	cmd.set_storage_texture(0, 0, *sky_light_2d_array);
+	cmd.set_storage_texture(0, 1, *sky_light_next_2d_array);
+	cmd.push_constants(&lerp, 0, sizeof(lerp));
 	cmd.dispatch(sky_light->get_width() / 8, sky_light->get_height() / 8, 6);
 }
 
+void VolumetricDiffuseLightManager::update_sky_cube(Vulkan::CommandBuffer &cmd)
+{
+	auto &directional = fallback_render_context->get_lighting_parameters()->directional;
+	float camera_y = fallback_render_context->get_render_parameters().camera_position.y;
+
+	if (!sky_faces_per_frame || !sky_valid)
+	{
+		sky_sun_color = directional.color;
+		sky_sun_direction = directional.direction;
+		sky_camera_y = camera_y;
+		render_sky_faces(cmd, *sky_light_2d_array, 0, 6);
+		sky_face_cursor = 0;
+		sky_blend_remaining = 0;
+		sky_valid = true;
+		return;
+	}
+
+	// Fading from a to b by 1 / remaining each frame is a linear cross-fade,
+	// without having to keep the old cube around.
+	if (sky_blend_remaining)
+	{
+		blend_sky_cube(cmd, 1.0f / float(sky_blend_remaining));
+		sky_blend_remaining--;
+		return;
+	}
+
+	// Latch the inputs for a full capture so that all faces agree.
+	if (sky_face_cursor == 0)
+	{
+		if (all(equal(directional.color, sky_sun_color)) &&
+		    all(equal(directional.direction, sky_sun_direction)))
+		{
+			return;
+		}
+
+		sky_sun_color = directional.color;
+		sky_sun_direction = directional.direction;
+		sky_camera_y = camera_y;
+	}
+
+	unsigned num_faces = muglm::min(sky_faces_per_frame, 6u - sky_face_cursor);
+	render_sky_faces(cmd, *sky_light_next_2d_array, sky_face_cursor, num_faces);
+	sky_face_cursor += num_faces;
+
+	if (sky_face_cursor == 6)
+	{
+		sky_face_cursor = 0;
+		sky_blend_remaining = muglm::max(sky_blend_frames, 1u);
+	}
+}
+
 const Vulkan::BufferView &VolumetricDiffuseLightManager::get_fallback_volume_view() const
 {
 	return *fallback_volume_view;
@@ -769,6 +934,17 @@ void VolumetricDiffuseLightManager::add_render_passes(RenderGraph &graph)
 			cull_probe_buffer(cmd, *light);
 		}
 
+		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+		// Merge the priority lists and clamp to the budget.
+		cmd.set_program("builtin://shaders/lights/volumetric_light_budget.comp");
+		for (auto &light_tuple : *volumetric_diffuse)
+		{
+			auto *light = get_component<VolumetricDiffuseLightComponent>(light_tuple);
+			budget_probe_buffer(cmd, *light);
+		}
+
 		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
 		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
 		            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
@@ -47,6 +47,20 @@ public:
 
 	const Vulkan::BufferView &get_fallback_volume_view() const;
 
+	// Caps the number of probes relit per frame and volume, 0 means unlimited.
+	// Visible probes within priority_distance of the camera are relit first,
+	// the remaining visible and off-screen probes share what is left round-robin.
+	// A priority_distance of 0 treats every visible probe as high priority.
+	void set_probe_update_budget(unsigned probes_per_frame, float priority_distance);
+
+	// Spreads the sky cube capture over several frames, faces_per_frame of 0 captures
+	// all six faces every frame. A completed capture is cross-faded in over blend_frames.
+	void set_sky_update_budget(unsigned faces_per_frame, unsigned blend_frames);
+
+	// Lights moved or changed, relight every probe over the next frames.
+	// Changes to the directional light are detected automatically.
+	void invalidate_probe_lighting();
+
 private:
 	void refresh(const RenderContext &context_, TaskComposer &composer) override;
 	const ComponentGroupVector<VolumetricDiffuseLightComponent> *volumetric_diffuse = nullptr;
@@ -76,6 +90,18 @@ private:
 	void cull_probe_buffer(Vulkan::CommandBuffer &cmd,
 	                       VolumetricDiffuseLightComponent &light);
 
+	void budget_probe_buffer(Vulkan::CommandBuffer &cmd,
+	                         VolumetricDiffuseLightComponent &light);
+
+	unsigned probe_update_budget = 0;
+	float probe_priority_distance = 0.0f;
+	unsigned relight_all_frames = 0;
+	bool relight_all = false;
+	bool lighting_invalidated = false;
+	vec3 last_sun_direction = vec3(0.0f);
+	vec3 last_sun_color = vec3(0.0f);
+	void update_relight_state();
+
 	void set_base_renderer(const RendererSuite *suite) override;
 	void set_base_render_context(const RenderContext *context) override;
 	void set_scene(Scene *scene) override;
@@ -93,11 +119,25 @@ private:
 
 	Vulkan::ImageHandle sky_light;
 	Vulkan::ImageViewHandle sky_light_2d_array;
+	Vulkan::ImageHandle sky_light_next;
+	Vulkan::ImageViewHandle sky_light_next_2d_array;
 	Vulkan::BufferHandle fallback_volume;
 	Vulkan::BufferViewHandle fallback_volume_view;
 	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
 	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
 	void update_sky_cube(Vulkan::CommandBuffer &cmd);
+	void render_sky_faces(Vulkan::CommandBuffer &cmd, const Vulkan::ImageView &view,
+	                      unsigned base_face, unsigned num_faces);
+	void blend_sky_cube(Vulkan::CommandBuffer &cmd, float lerp);
+
+	unsigned sky_faces_per_frame = 0;
+	unsigned sky_blend_frames = 0;
+	unsigned sky_face_cursor = 0;
+	unsigned sky_blend_remaining = 0;
+	bool sky_valid = false;
+	vec3 sky_sun_direction = vec3(0.0f);
+	vec3 sky_sun_color = vec3(0.0f);
+	float sky_camera_y = 0.0f;
 	void update_fallback_volume(Vulkan::CommandBuffer &cmd);
 };
 }
\ No newline at end of file
@@ -45,6 +45,9 @@ public:
 	void set_z_range(float range);
 	void set_fog_density(float density);
 
+	// Refresh 1 out of 1, 2 or 4 froxel blocks per frame, the rest is reprojected from the previous frame.
+	void set_temporal_update_rate(unsigned rate);
+
 	struct FloorLighting
 	{
 		float position_mod = 0.01f;
@@ -113,6 +116,8 @@ private:
 	void compute_slice_extents();
 	void build_dither_lut(Vulkan::Device &device);
 	unsigned dither_offset = 0;
+	unsigned temporal_update_rate = 1;
+	unsigned temporal_update_phase = 0;
 
 	mat4 old_projection;
 };
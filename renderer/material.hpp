@@ -98,7 +98,11 @@ enum MaterialTextureFlagBits
 	MATERIAL_TEXTURE_EMISSIVE_BIT = 1u << Util::ecast(Material::Textures::Emissive),
 	MATERIAL_EMISSIVE_BIT = 1u << 5,
 	MATERIAL_EMISSIVE_REFRACTION_BIT = 1u << 6,
-	MATERIAL_EMISSIVE_REFLECTION_BIT = 1u << 7
+	MATERIAL_EMISSIVE_REFLECTION_BIT = 1u << 7,
+	MATERIAL_BINDLESS_BIT = 1u << 8,
+	MATERIAL_INDIRECT_INSTANCES_BIT = 1u << 9,
+	MATERIAL_STORAGE_INSTANCES_BIT = 1u << 10,
+	MATERIAL_CACHED_SKINNING_BIT = 1u << 11
 };
 
 enum MaterialShaderVariantFlagBits
@@ -0,0 +1,121 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "material_heap.hpp"
+#include "device.hpp"
+
+using namespace Vulkan;
+
+namespace Granite
+{
+MaterialHeap::MaterialHeap()
+{
+	allocator.reserve_max_resources_per_pool(64, 4096);
+	allocator.set_bindless_resource_type(BindlessResourceType::ImageFP);
+}
+
+int MaterialHeap::get_material_index(const MaterialHandle &material)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	auto itr = indices.find(material.get());
+	if (itr != indices.end())
+		return itr->second < committed_count ? int(itr->second) : -1;
+
+	indices[material.get()] = unsigned(materials.size());
+	materials.push_back(material);
+	return -1;
+}
+
+void MaterialHeap::update(Device &device)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	if (!device.get_device_features().supports_descriptor_indexing || materials.empty())
+	{
+		committed_count = 0;
+		desc_set = VK_NULL_HANDLE;
+		material_buffer.reset();
+		return;
+	}
+
+	// Texture views can change under us with texture streaming, so rebuild the set every frame.
+	// This is just a linear walk over the materials.
+	material_infos.resize(materials.size());
+	allocator.begin();
+
+	unsigned count = 0;
+	for (auto &mat : materials)
+	{
+		unsigned num_textures = 0;
+		for (auto *tex : mat->textures)
+			if (tex)
+				num_textures++;
+
+		if (allocator.get_next_offset() + num_textures > VULKAN_NUM_BINDINGS_BINDLESS_VARYING)
+		{
+			LOGW("Material heap is full, %u materials fall back to regular binding.\n",
+			     unsigned(materials.size()) - count);
+			break;
+		}
+
+		auto &info = material_infos[count++];
+		info.base_color = mat->base_color;
+		info.emissive = vec4(mat->emissive, 0.0f);
+		info.roughness = mat->roughness;
+		info.metallic = mat->metallic;
+		info.normal_scale = mat->normal_scale;
+
+		for (unsigned i = 0; i < Util::ecast(Material::Textures::Count); i++)
+		{
+			if (mat->textures[i])
+				info.textures[i] = allocator.push(mat->textures[i]->get_image()->get_view());
+			else
+				info.textures[i] = UINT32_MAX;
+		}
+	}
+
+	desc_set = allocator.commit(device);
+	if (desc_set == VK_NULL_HANDLE)
+	{
+		committed_count = 0;
+		return;
+	}
+
+	BufferCreateInfo info = {};
+	info.size = count * sizeof(BindlessMaterialInfo);
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	info.domain = BufferDomain::LinkedDeviceHost;
+	material_buffer = device.create_buffer(info, material_infos.data());
+	committed_count = material_buffer ? count : 0;
+}
+
+VkDescriptorSet MaterialHeap::get_descriptor_set() const
+{
+	return desc_set;
+}
+
+const Buffer *MaterialHeap::get_material_buffer() const
+{
+	return material_buffer.get();
+}
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "material.hpp"
+#include "descriptor_set.hpp"
+#include "buffer.hpp"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Granite
+{
+// Mirrors BindlessMaterial in shaders/inc/bindless_material.h.
+struct BindlessMaterialInfo
+{
+	vec4 base_color;
+	vec4 emissive;
+	float roughness;
+	float metallic;
+	float normal_scale;
+	uint32_t textures[Util::ecast(Material::Textures::Count)];
+};
+static_assert(sizeof(BindlessMaterialInfo) == 64, "Unexpected size of BindlessMaterialInfo.");
+
+// Puts every material texture in one bindless heap and every material's parameters in one storage buffer,
+// so static mesh draws only differ by a material index.
+// Materials are registered on first use, and become resident in the heap on the next update().
+class MaterialHeap
+{
+public:
+	MaterialHeap();
+
+	// Thread-safe. Returns -1 if the material is not part of the committed heap yet.
+	int get_material_index(const MaterialHandle &material);
+
+	// Call once per frame before render queues are built.
+	void update(Vulkan::Device &device);
+
+	VkDescriptorSet get_descriptor_set() const;
+	const Vulkan::Buffer *get_material_buffer() const;
+
+private:
+	std::mutex lock;
+	std::unordered_map<const Material *, unsigned> indices;
+	std::vector<MaterialHandle> materials;
+	unsigned committed_count = 0;
+
+	Vulkan::BindlessAllocator allocator;
+	VkDescriptorSet desc_set = VK_NULL_HANDLE;
+	Vulkan::BufferHandle material_buffer;
+	std::vector<BindlessMaterialInfo> material_infos;
+};
+}
@@ -23,6 +23,7 @@
 #include "material_manager.hpp"
 #include "application_wsi_events.hpp"
 #include <string.h>
+#include <algorithm>
 #include "rapidjson_wrapper.hpp"
 #include "scene_formats.hpp"
 
@@ -208,4 +209,63 @@ MaterialHandle MaterialManager::request_material(const std::string &path)
 	else
 		return itr->second;
 }
+
+static Hash hash_material_info(const MaterialInfo &info)
+{
+	Hasher h;
+	h.string(info.base_color.path);
+	h.string(info.normal.path);
+	h.string(info.metallic_roughness.path);
+	h.string(info.occlusion.path);
+	h.string(info.emissive.path);
+	for (unsigned i = 0; i < 4; i++)
+		h.f32(info.uniform_base_color[i]);
+	for (unsigned i = 0; i < 3; i++)
+		h.f32(info.uniform_emissive_color[i]);
+	h.f32(info.uniform_metallic);
+	h.f32(info.uniform_roughness);
+	h.f32(info.normal_scale);
+	h.u32(ecast(info.pipeline));
+	h.u32(ecast(info.sampler));
+	h.u32(info.two_sided);
+	h.u32(info.bandlimited_pixel);
+	return h.get();
+}
+
+MaterialHandle MaterialManager::request_material(const MaterialInfo &info)
+{
+	auto hash = hash_material_info(info);
+
+	std::lock_guard<std::mutex> holder{info_lock};
+	auto itr = info_materials.find(hash);
+	if (itr != end(info_materials))
+		return itr->second;
+
+	if (info_materials.size() >= info_prune_threshold)
+		prune_unused_materials_locked();
+
+	auto handle = Util::make_derived_handle<Material, MaterialFile>(info);
+	info_materials[hash] = handle;
+	return handle;
+}
+
+void MaterialManager::prune_unused_materials_locked()
+{
+	// New references are only handed out under info_lock, so a unique reference is ours to drop.
+	for (auto itr = begin(info_materials); itr != end(info_materials); )
+	{
+		if (itr->second->has_unique_reference())
+			itr = info_materials.erase(itr);
+		else
+			++itr;
+	}
+
+	info_prune_threshold = std::max<size_t>(64, 2 * info_materials.size());
+}
+
+void MaterialManager::prune_unused_materials()
+{
+	std::lock_guard<std::mutex> holder{info_lock};
+	prune_unused_materials_locked();
+}
 }
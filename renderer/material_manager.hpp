@@ -28,6 +28,7 @@
 #include "event.hpp"
 #include "material.hpp"
 #include "scene_formats.hpp"
+#include <mutex>
 
 namespace Granite
 {
@@ -52,10 +53,20 @@ class MaterialManager
 {
 public:
 	MaterialHandle request_material(const std::string &path);
+	// Thread-safe. Materials with identical content share one handle, regardless of which mesh or file they came from.
+	MaterialHandle request_material(const SceneFormats::MaterialInfo &info);
+	// Thread-safe. Drops shared materials which are no longer used by any mesh.
+	// Also happens when the cache has doubled in size since the last prune.
+	void prune_unused_materials();
 	static MaterialManager &get();
 
 private:
 	MaterialManager() = default;
 	std::unordered_map<std::string, MaterialHandle> materials;
+
+	std::mutex info_lock;
+	std::unordered_map<Util::Hash, MaterialHandle> info_materials;
+	size_t info_prune_threshold = 64;
+	void prune_unused_materials_locked();
 };
 }
\ No newline at end of file
@@ -24,6 +24,9 @@
 #include "shader_suite.hpp"
 #include "render_context.hpp"
 #include "renderer.hpp"
+#include "material_heap.hpp"
+#include "impostor.hpp"
+#include "muglm/matrix_helper.hpp"
 #include <string.h>
 
 using namespace Util;
@@ -90,12 +93,22 @@ void mesh_set_state(CommandBuffer &cmd, const StaticMeshInfo &info)
 		if (info.attributes[i].format != VK_FORMAT_UNDEFINED)
 			cmd.set_vertex_attrib(i, i == 0 ? 0 : 1, info.attributes[i].format, info.attributes[i].offset);
 
-	auto &sampler = cmd.get_device().get_stock_sampler(info.sampler);
-	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
-		if (info.views[i])
-			cmd.set_texture(2, i, *info.views[i], sampler);
+	if (info.material_index >= 0)
+	{
+		cmd.set_bindless(2, info.material_heap_set);
+		cmd.set_sampler(3, 4, info.sampler);
+		cmd.set_storage_buffer(3, 5, *info.material_buffer);
+		cmd.push_constants(&info.material_index, 0, sizeof(info.material_index));
+	}
+	else
+	{
+		auto &sampler = cmd.get_device().get_stock_sampler(info.sampler);
+		for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
+			if (info.views[i])
+				cmd.set_texture(2, i, *info.views[i], sampler);
 
-	cmd.push_constants(&info.fragment, 0, sizeof(info.fragment));
+		cmd.push_constants(&info.fragment, 0, sizeof(info.fragment));
+	}
 	cmd.set_primitive_topology(info.topology);
 	cmd.set_primitive_restart(info.primitive_restart);
 
@@ -135,11 +148,127 @@ void debug_mesh_render(CommandBuffer &cmd, const RenderQueueData *infos, unsigne
 	cmd.draw(count);
 }
 
+struct MeshletCullTransform
+{
+	vec4 planes[6];
+	vec3 camera_position;
+	bool cull_backfaces;
+};
+
+static void setup_meshlet_cull_transform(MeshletCullTransform &transform, const MeshletCullInfo &cull, const mat4 &model)
+{
+	// Bring the frustum and camera into model space rather than transforming every meshlet.
+	// Plane normals are left unnormalized, so radius tests scale by the plane length.
+	auto transposed = transpose(model);
+	for (unsigned i = 0; i < 6; i++)
+	{
+		vec4 plane = transposed * cull.planes[i];
+		transform.planes[i] = plane / length(plane.xyz());
+	}
+
+	transform.camera_position = (inverse(model) * vec4(cull.camera_position, 1.0f)).xyz();
+
+	// The cone test only holds for rotations with uniform scale.
+	float scale_x = dot(model[0].xyz(), model[0].xyz());
+	float scale_y = dot(model[1].xyz(), model[1].xyz());
+	float scale_z = dot(model[2].xyz(), model[2].xyz());
+	float max_scale = muglm::max(scale_x, muglm::max(scale_y, scale_z));
+	float min_scale = muglm::min(scale_x, muglm::min(scale_y, scale_z));
+	transform.cull_backfaces = cull.cull_backfaces && min_scale > 0.98f * max_scale;
+}
+
+static bool meshlet_is_visible(const Meshlet &meshlet, const MeshletCullTransform &transform)
+{
+	vec4 center(meshlet.center, 1.0f);
+	for (auto &plane : transform.planes)
+		if (dot(plane, center) < -meshlet.radius)
+			return false;
+
+	if (transform.cull_backfaces)
+	{
+		vec3 view = meshlet.center - transform.camera_position;
+		if (dot(view, meshlet.cone_axis) >= meshlet.cone_cutoff * length(view) + meshlet.radius)
+			return false;
+	}
+
+	return true;
+}
+
+static void static_mesh_draw(CommandBuffer &cmd, const StaticMeshInfo &info, unsigned instances,
+                             uint32_t index_offset, uint32_t index_count)
+{
+	if (info.ibo)
+		cmd.draw_indexed(index_count, instances, info.ibo_offset + index_offset, info.vertex_offset, 0);
+	else
+		cmd.draw(index_count, instances, info.vertex_offset + index_offset, 0);
+}
+
+static void static_mesh_draw_meshlets(CommandBuffer &cmd, const StaticMeshInfo &info,
+                                      const RenderQueueData *infos, unsigned instances)
+{
+	MeshletCullTransform transforms[StaticMeshInfo::MaxMeshletCullInstances];
+	for (unsigned i = 0; i < instances; i++)
+	{
+		setup_meshlet_cull_transform(transforms[i], *info.meshlet_cull,
+		                             static_cast<const StaticMeshInstanceInfo *>(infos[i].instance_data)->vertex.Model);
+	}
+
+	// A meshlet is drawn if any instance can see it. Adjacent visible meshlets are merged into one draw.
+	uint32_t run_offset = 0;
+	uint32_t run_count = 0;
+
+	for (uint32_t i = 0; i < info.meshlet_count; i++)
+	{
+		auto &meshlet = info.meshlets[i];
+		bool visible = false;
+		for (unsigned j = 0; j < instances && !visible; j++)
+			visible = meshlet_is_visible(meshlet, transforms[j]);
+
+		if (visible)
+		{
+			if (!run_count)
+				run_offset = meshlet.index_offset;
+			run_count += meshlet.index_count;
+		}
+		else if (run_count)
+		{
+			static_mesh_draw(cmd, info, instances, run_offset, run_count);
+			run_count = 0;
+		}
+	}
+
+	if (run_count)
+		static_mesh_draw(cmd, info, instances, run_offset, run_count);
+}
+
 void static_mesh_render(CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances)
 {
 	auto *info = static_cast<const StaticMeshInfo *>(infos->render_info);
 	mesh_set_state(cmd, *info);
 
+	// Per-meshlet culling does not pay off when many instances share the draw.
+	bool cull_meshlets = info->meshlet_cull && instances <= StaticMeshInfo::MaxMeshletCullInstances;
+
+	// Large batches go through one draw with transforms in a storage buffer rather than chunks of UBOs.
+	if (instances > StaticMeshVertex::max_instances && info->storage_instances_program)
+	{
+		cmd.set_program(info->storage_instances_program);
+
+		auto *vertex_data = cmd.allocate_typed_storage_data<mat4>(3, 0, instances);
+		for (unsigned i = 0; i < instances; i++)
+			vertex_data[i] = static_cast<const StaticMeshInstanceInfo *>(infos[i].instance_data)->vertex.Model;
+
+		if (static_cast<const StaticMeshInstanceInfo *>(infos->instance_data)->vertex.PrevModel)
+		{
+			vertex_data = cmd.allocate_typed_storage_data<mat4>(3, 2, instances);
+			for (unsigned i = 0; i < instances; i++)
+				vertex_data[i] = *static_cast<const StaticMeshInstanceInfo *>(infos[i].instance_data)->vertex.PrevModel;
+		}
+
+		static_mesh_draw(cmd, *info, instances, 0, info->count);
+		return;
+	}
+
 	unsigned to_render = 0;
 	for (unsigned i = 0; i < instances; i += to_render)
 	{
@@ -156,10 +285,25 @@ void static_mesh_render(CommandBuffer &cmd, const RenderQueueData *infos, unsign
 				vertex_data[j] = *static_cast<const StaticMeshInstanceInfo *>(infos[i + j].instance_data)->vertex.PrevModel;
 		}
 
-		if (info->ibo)
-			cmd.draw_indexed(info->count, to_render, info->ibo_offset, info->vertex_offset, 0);
+		if (cull_meshlets)
+			static_mesh_draw_meshlets(cmd, *info, infos + i, to_render);
 		else
-			cmd.draw(info->count, to_render, info->vertex_offset, 0);
+			static_mesh_draw(cmd, *info, to_render, 0, info->count);
+	}
+}
+
+void static_mesh_render_indirect(CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances)
+{
+	auto *info = static_cast<const StaticMeshInfo *>(infos->render_info);
+	mesh_set_state(cmd, *info);
+
+	for (unsigned i = 0; i < instances; i++)
+	{
+		auto &indirect = *static_cast<const StaticMeshIndirectInfo *>(infos[i].instance_data);
+		cmd.set_storage_buffer(3, 0, *indirect.transforms);
+		cmd.draw_indexed_multi_indirect(*indirect.commands, indirect.commands_offset, indirect.max_draws,
+		                                sizeof(VkDrawIndexedIndirectCommand),
+		                                *indirect.count, indirect.count_offset);
 	}
 }
 
@@ -188,9 +332,32 @@ void skinned_mesh_render(CommandBuffer &cmd, const RenderQueueData *infos, unsig
 			cmd.draw(static_info->count, 1, static_info->vertex_offset, 0);
 	}
 }
+
+void skinned_mesh_render_cached(CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances)
+{
+	auto *static_info = static_cast<const StaticMeshInfo *>(infos->render_info);
+	mesh_set_state(cmd, *static_info);
+
+	// Only motion vector shaders read the previous positions.
+	cmd.set_vertex_attrib(7, 2, VK_FORMAT_R32G32B32_SFLOAT, 0);
+
+	for (unsigned i = 0; i < instances; i++)
+	{
+		auto &cache = *static_cast<const SkinnedVertexCache *>(infos[i].instance_data);
+		cmd.set_vertex_binding(0, *cache.buffer, cache.position_offset, 3 * sizeof(float));
+		if (static_info->vbo_attributes)
+			cmd.set_vertex_binding(1, *cache.buffer, cache.attribute_offset, static_info->attribute_stride);
+		cmd.set_vertex_binding(2, *cache.buffer, cache.prev_position_offset, 3 * sizeof(float));
+
+		if (static_info->ibo)
+			cmd.draw_indexed(static_info->count, 1, static_info->ibo_offset, 0, 0);
+		else
+			cmd.draw(static_info->count, 1, 0, 0);
+	}
+}
 }
 
-void StaticMesh::fill_render_info(StaticMeshInfo &info) const
+void StaticMesh::fill_render_info(StaticMeshInfo &info, MaterialHeap *heap) const
 {
 	info.vbo_attributes = vbo_attributes.get();
 	info.vbo_position = vbo_position.get();
@@ -218,6 +385,18 @@ void StaticMesh::fill_render_info(StaticMeshInfo &info) const
 	memcpy(info.attributes, attributes, sizeof(attributes));
 	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
 		info.views[i] = material->textures[i] ? &material->textures[i]->get_image()->get_view() : nullptr;
+
+	// The band-limited filter takes combined samplers as function arguments, which bindless textures cannot do.
+	bool use_heap = heap && (material->shader_variant & MATERIAL_SHADER_VARIANT_BANDLIMITED_PIXEL_BIT) == 0;
+	info.material_index = use_heap ? heap->get_material_index(material) : -1;
+	info.meshlets = nullptr;
+	info.meshlet_count = 0;
+	info.meshlet_cull = nullptr;
+	if (info.material_index >= 0)
+	{
+		info.material_heap_set = heap->get_descriptor_set();
+		info.material_buffer = heap->get_material_buffer();
+	}
 }
 
 void StaticMesh::bake()
@@ -235,8 +414,82 @@ static Queue material_to_queue(const Material &mat)
 		return Queue::Opaque;
 }
 
+// CPU estimate of the mip levels a material needs for TextureManager mip streaming.
+static void request_material_texture_levels(const Material &mat, const RenderContext &context,
+                                            const RenderInfoComponent *transform)
+{
+	// Only the views which select LODs know their resolution, shadow maps and such do not drive streaming.
+	auto &selection = context.get_lod_selection();
+	if (selection.viewport_height <= 0.0f)
+		return;
+
+	auto &params = context.get_render_parameters();
+	float radius = transform->world_aabb.get_radius();
+	float distance = 1.0f;
+	if (params.projection[3][3] == 0.0f)
+	{
+		distance = length(transform->world_aabb.get_center() - params.camera_position) - radius;
+		distance = muglm::max(distance, params.z_near);
+	}
+
+	float pixels = selection.viewport_height * muglm::abs(params.projection[1][1]) * radius / distance;
+	for (auto *texture : mat.textures)
+		if (texture)
+			texture->request_screen_extent(pixels);
+}
+
+unsigned StaticMesh::select_lod(const RenderContext &context, const RenderInfoComponent *transform) const
+{
+	auto &selection = context.get_lod_selection();
+	if (lods.empty() || selection.pixel_error <= 0.0f)
+		return 0;
+
+	auto &params = context.get_render_parameters();
+	auto &m = transform->transform->world_transform;
+	float world_scale = muglm::max(muglm::max(length(m[0].xyz()), length(m[1].xyz())), length(m[2].xyz()));
+
+	// Orthographic projections have a constant scale, otherwise use the nearest point of the bounds.
+	float distance = 1.0f;
+	if (params.projection[3][3] == 0.0f)
+	{
+		distance = length(transform->world_aabb.get_center() - params.camera_position) -
+		           transform->world_aabb.get_radius();
+		distance = muglm::max(distance, params.z_near);
+	}
+
+	float pixels_per_unit = 0.5f * selection.viewport_height * muglm::abs(params.projection[1][1]);
+	float error_to_pixels = world_scale * pixels_per_unit / distance;
+
+	unsigned parity = unsigned(selection.frame_index & 1);
+	unsigned prev_lod = transform->lod[parity ^ 1];
+
+	// Going coarser than last frame needs some headroom, so meshes do not flicker between LODs at the boundary.
+	constexpr float hysteresis = 0.75f;
+	unsigned lod = 0;
+	for (size_t i = 0; i < lods.size(); i++)
+	{
+		float threshold = selection.pixel_error;
+		if (i >= prev_lod)
+			threshold *= hysteresis;
+		if (lods[i].error * error_to_pixels > threshold)
+			break;
+		lod = unsigned(i + 1);
+	}
+
+	transform->lod[parity] = uint8_t(lod);
+	return lod;
+}
+
 void StaticMesh::get_render_info(const RenderContext &context, const RenderInfoComponent *transform, RenderQueue &queue, bool mv) const
 {
+	// Impostors do not render motion vectors, those pixels keep the cleared value.
+	if (impostor && impostor->is_active(context, transform))
+	{
+		if (!mv)
+			impostor->get_render_info(context, transform, queue);
+		return;
+	}
+
 	auto type = material_to_queue(*material);
 	uint32_t attrs = 0;
 
@@ -254,6 +507,15 @@ void StaticMesh::get_render_info(const RenderContext &context, const RenderInfoC
 	h.u64(vbo_position->get_cookie());
 
 	auto instance_key = get_baked_instance_key();
+	unsigned lod = select_lod(context, transform);
+	if (!mv)
+		request_material_texture_levels(*material, context, transform);
+	if (lod)
+	{
+		Hasher lod_hasher(instance_key);
+		lod_hasher.u32(lod);
+		instance_key = lod_hasher.get();
+	}
 	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->world_aabb.get_center());
 
 	auto *t = transform->transform;
@@ -280,7 +542,99 @@ void StaticMesh::get_render_info(const RenderContext &context, const RenderInfoC
 		if (type == Queue::OpaqueEmissive)
 			textures |= MATERIAL_EMISSIVE_BIT;
 
-		fill_render_info(*mesh_info);
+		fill_render_info(*mesh_info, context.get_material_heap());
+		if (mesh_info->material_index >= 0)
+			textures |= MATERIAL_BINDLESS_BIT;
+
+		if (lod)
+		{
+			mesh_info->ibo_offset += lods[lod - 1].offset;
+			mesh_info->count = lods[lod - 1].count;
+		}
+
+		auto culling = context.get_meshlet_culling();
+		if (culling && !meshlets.empty() && !lod)
+		{
+			auto *cull = queue.allocate_one<MeshletCullInfo>();
+			auto *planes = context.get_visibility_frustum().get_planes();
+			for (unsigned i = 0; i < 6; i++)
+			{
+				// Unbounded planes if frustum culling is not requested.
+				cull->planes[i] = (culling & MESHLET_CULLING_FRUSTUM_BIT) ? planes[i] :
+				                  vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			}
+			cull->camera_position = context.get_render_parameters().camera_position;
+			// Cones are tested against a single camera position, which does not work for several views.
+			cull->cull_backfaces = (culling & MESHLET_CULLING_BACKFACE_BIT) != 0 && !material->two_sided &&
+			                       context.get_view_count() == 1;
+
+			mesh_info->meshlets = meshlets.data();
+			mesh_info->meshlet_count = uint32_t(meshlets.size());
+			mesh_info->meshlet_cull = cull;
+		}
+
+		auto &suite = queue.get_shader_suites()[ecast(RenderableType::Mesh)];
+		mesh_info->program = suite.get_program(material->pipeline, attrs, textures, material->shader_variant);
+		mesh_info->storage_instances_program =
+				suite.get_program(material->pipeline, attrs, textures | MATERIAL_STORAGE_INSTANCES_BIT,
+				                  material->shader_variant);
+	}
+}
+
+const StaticMesh *StaticMesh::get_indirect_mesh() const
+{
+	// Indirect commands are always indexed, and blended geometry needs sorting.
+	if (!ibo || material->pipeline == DrawPipeline::AlphaBlend)
+		return nullptr;
+	return this;
+}
+
+void StaticMesh::get_indirect_render_info(const RenderContext &context, const StaticMeshIndirectInfo &indirect,
+                                          RenderQueue &queue) const
+{
+	auto type = material_to_queue(*material);
+	uint32_t attrs = 0;
+
+	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
+		if (attributes[i].format != VK_FORMAT_UNDEFINED)
+			attrs |= 1u << i;
+
+	Hasher h;
+	h.u32(attrs);
+	h.u32(ecast(material->pipeline));
+	h.u32(material->shader_variant);
+	auto pipe_hash = h.get();
+
+	h.u64(material->get_hash());
+	h.u64(vbo_position->get_cookie());
+	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), vec3(0.0f));
+
+	h.u64(get_baked_instance_key());
+	h.u64(indirect.commands->get_cookie());
+	h.u32(indirect.commands_offset);
+	auto instance_key = h.get();
+
+	auto *instance_data = queue.allocate_one<StaticMeshIndirectInfo>();
+	*instance_data = indirect;
+
+	auto *mesh_info = queue.push<StaticMeshInfo>(type, instance_key, sorting_key,
+	                                             RenderFunctions::static_mesh_render_indirect,
+	                                             instance_data);
+
+	if (mesh_info)
+	{
+		uint32_t textures = MATERIAL_INDIRECT_INSTANCES_BIT;
+		for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
+			if (material->textures[i])
+				textures |= 1u << i;
+
+		if (type == Queue::OpaqueEmissive)
+			textures |= MATERIAL_EMISSIVE_BIT;
+
+		fill_render_info(*mesh_info, context.get_material_heap());
+		if (mesh_info->material_index >= 0)
+			textures |= MATERIAL_BINDLESS_BIT;
+
 		mesh_info->program = queue.get_shader_suites()[ecast(RenderableType::Mesh)].get_program(
 				material->pipeline, attrs,
 				textures, material->shader_variant);
@@ -299,8 +653,72 @@ void StaticMesh::get_motion_vector_render_info(const RenderContext &context, con
 	get_render_info(context, transform, queue, true);
 }
 
+void SkinnedMesh::get_cached_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+                                         RenderQueue &queue) const
+{
+	auto type = material_to_queue(*material);
+	uint32_t attrs = 0;
+	uint32_t textures = MATERIAL_CACHED_SKINNING_BIT;
+
+	// Bones are already applied, so the vertices draw like a static mesh in world space.
+	for (unsigned i = 0; i < ecast(MeshAttribute::Count); i++)
+		if (attributes[i].format != VK_FORMAT_UNDEFINED && i != ecast(MeshAttribute::BoneIndex) && i != ecast(MeshAttribute::BoneWeights))
+			attrs |= 1u << i;
+
+	for (unsigned i = 0; i < ecast(Material::Textures::Count); i++)
+		if (material->textures[i])
+			textures |= 1u << i;
+
+	Hasher h;
+	h.u32(attrs);
+	h.u32(textures);
+	h.u32(ecast(material->pipeline));
+	h.u32(material->shader_variant);
+	auto pipe_hash = h.get();
+
+	h.u64(material->get_hash());
+	h.u64(vbo_position->get_cookie());
+
+	// Every instance reads its own vertices, so they never batch.
+	auto *cache = transform->skinned_vertices;
+	Hasher instance_hasher(get_baked_instance_key());
+	instance_hasher.pointer(cache);
+	auto instance_key = instance_hasher.get();
+	auto sorting_key = RenderInfo::get_sort_key(context, type, pipe_hash, h.get(), transform->world_aabb.get_center());
+
+	auto *instance_data = queue.allocate_one<SkinnedVertexCache>();
+	*instance_data = *cache;
+
+	auto *mesh_info = queue.push<StaticMeshInfo>(type, instance_key, sorting_key,
+	                                             RenderFunctions::skinned_mesh_render_cached,
+	                                             instance_data);
+
+	if (mesh_info)
+	{
+		fill_render_info(*mesh_info);
+		mesh_info->vbo_position = cache->buffer;
+		if (mesh_info->vbo_attributes)
+			mesh_info->vbo_attributes = cache->buffer;
+		mesh_info->position_stride = 3 * sizeof(float);
+		mesh_info->vertex_offset = 0;
+		mesh_info->attributes[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+		mesh_info->attributes[ecast(MeshAttribute::Position)].offset = 0;
+		mesh_info->program = queue.get_shader_suites()[ecast(RenderableType::Mesh)].get_program(material->pipeline, attrs,
+		                                                                                        textures, material->shader_variant);
+	}
+}
+
 void SkinnedMesh::get_render_info(const RenderContext &context, const RenderInfoComponent *transform, RenderQueue &queue, bool mv) const
 {
+	if (transform->skinned_vertices)
+	{
+		get_cached_render_info(context, transform, queue);
+		return;
+	}
+
+	if (!mv)
+		request_material_texture_levels(*material, context, transform);
+
 	auto type = material_to_queue(*material);
 	uint32_t attrs = 0;
 	uint32_t textures = 0;
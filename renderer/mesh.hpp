@@ -29,10 +29,13 @@
 #include "aabb.hpp"
 #include "render_queue.hpp"
 #include "limits.hpp"
+#include <vector>
 
 namespace Granite
 {
 struct RenderQueueData;
+class MaterialHeap;
+struct Impostor;
 
 enum class MeshAttribute : unsigned
 {
@@ -84,6 +87,57 @@ struct StaticMeshFragment
 	float normal_scale;
 };
 
+// A cluster of up to 124 triangles with bounds for culling, see SceneFormats::mesh_build_meshlets().
+// Indices of a meshlet are contiguous in the index buffer, and meshlets are stored in index order.
+struct Meshlet
+{
+	uint32_t index_offset;
+	uint32_t index_count;
+	vec3 center;
+	float radius;
+	vec3 cone_axis;
+	float cone_cutoff;
+};
+
+// A simplified version of a mesh which shares its vertices, see SceneFormats::mesh_build_lods().
+// LODs are ordered from finest to coarsest, and the full mesh is not included.
+struct MeshLod
+{
+	// In indices.
+	uint32_t offset = 0;
+	uint32_t count = 0;
+	// Upper bound of the object space simplification error.
+	float error = 0.0f;
+};
+
+struct MeshletCullInfo
+{
+	vec4 planes[6];
+	vec3 camera_position;
+	bool cull_backfaces;
+};
+
+// Draws with GPU compacted commands. Command i reads its transform from transforms[firstInstance].
+struct StaticMeshIndirectInfo
+{
+	const Vulkan::Buffer *transforms;
+	const Vulkan::Buffer *commands;
+	const Vulkan::Buffer *count;
+	uint32_t commands_offset;
+	uint32_t count_offset;
+	uint32_t max_draws;
+};
+
+// World space vertices of one skinned instance for the current frame, see ComputeSkinning.
+// Attributes keep the mesh layout, positions of this and the previous frame are packed vec3.
+struct SkinnedVertexCache
+{
+	const Vulkan::Buffer *buffer = nullptr;
+	VkDeviceSize position_offset = 0;
+	VkDeviceSize prev_position_offset = 0;
+	VkDeviceSize attribute_offset = 0;
+};
+
 struct DebugMeshInstanceInfo
 {
 	vec3 *positions;
@@ -118,12 +172,26 @@ struct StaticMeshInfo
 	const Vulkan::ImageView *views[Util::ecast(Material::Textures::Count)];
 	Vulkan::StockSampler sampler;
 	Vulkan::Program *program;
+	// Variant which reads instance transforms from a storage buffer,
+	// used to draw batches larger than StaticMeshVertex::max_instances at once.
+	Vulkan::Program *storage_instances_program = nullptr;
 	VkPrimitiveTopology topology;
 
 	MeshAttributeLayout attributes[Util::ecast(MeshAttribute::Count)];
 
 	StaticMeshFragment fragment;
 
+	// Bindless material path, used instead of views[] and fragment when material_index >= 0.
+	int32_t material_index = -1;
+	VkDescriptorSet material_heap_set = VK_NULL_HANDLE;
+	const Vulkan::Buffer *material_buffer = nullptr;
+
+	// If set, meshlets outside the frustum or facing away from the camera are skipped.
+	const Meshlet *meshlets = nullptr;
+	uint32_t meshlet_count = 0;
+	const MeshletCullInfo *meshlet_cull = nullptr;
+	enum { MaxMeshletCullInstances = 8 };
+
 	uint32_t ibo_offset = 0;
 	int32_t vertex_offset = 0;
 	uint32_t count = 0;
@@ -139,9 +207,11 @@ struct StaticMeshInfo
 namespace RenderFunctions
 {
 void static_mesh_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *render, unsigned instances);
+void static_mesh_render_indirect(Vulkan::CommandBuffer &cmd, const RenderQueueData *render, unsigned instances);
 void debug_mesh_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *render, unsigned instances);
 void line_strip_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *render, unsigned instances);
 void skinned_mesh_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *render, unsigned instances);
+void skinned_mesh_render_cached(Vulkan::CommandBuffer &cmd, const RenderQueueData *render, unsigned instances);
 void mesh_set_state(Vulkan::CommandBuffer &cmd, const StaticMeshInfo &info);
 }
 
@@ -163,6 +233,15 @@ struct StaticMesh : AbstractRenderable
 
 	MaterialHandle material;
 
+	// Optional, enables per-meshlet culling when the render context asks for it.
+	std::vector<Meshlet> meshlets;
+
+	// Optional, selected per instance when the render context asks for it. Meshlets only cover the full mesh.
+	std::vector<MeshLod> lods;
+
+	// Optional, set by ImpostorManager. Replaces instances beyond LodSelection::impostor_distance.
+	const Impostor *impostor = nullptr;
+
 	Util::Hash get_instance_key() const;
 	Util::Hash get_baked_instance_key() const;
 
@@ -178,11 +257,15 @@ struct StaticMesh : AbstractRenderable
 		return material->pipeline;
 	}
 
+	const StaticMesh *get_indirect_mesh() const override;
+	void get_indirect_render_info(const RenderContext &context, const StaticMeshIndirectInfo &indirect,
+	                              RenderQueue &queue) const;
+
 	void bake();
 
 protected:
 	void reset();
-	void fill_render_info(StaticMeshInfo &info) const;
+	void fill_render_info(StaticMeshInfo &info, MaterialHeap *heap = nullptr) const;
 	Util::Hash cached_hash = 0;
 
 private:
@@ -198,10 +281,21 @@ private:
 
 	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
 	                     RenderQueue &queue, bool mv) const;
+	unsigned select_lod(const RenderContext &context, const RenderInfoComponent *transform) const;
 };
 
 struct SkinnedMesh : public StaticMesh
 {
+	const StaticMesh *get_indirect_mesh() const override
+	{
+		return nullptr;
+	}
+
+	const SkinnedMesh *get_skinned_mesh() const override
+	{
+		return this;
+	}
+
 	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
 	                     RenderQueue &queue) const override;
 	void get_motion_vector_render_info(const RenderContext &context, const RenderInfoComponent *transform,
@@ -210,5 +304,7 @@ struct SkinnedMesh : public StaticMesh
 private:
 	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
 	                     RenderQueue &queue, bool mv) const;
+	void get_cached_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                            RenderQueue &queue) const;
 };
 }
@@ -29,6 +29,7 @@
 #include "renderer.hpp"
 #include "utils/image_utils.hpp"
 #include "application_events.hpp"
+#include "common_renderer_data.hpp"
 #include "render_graph.hpp"
 #include "simd.hpp"
 #include <string.h>
@@ -53,7 +54,7 @@ ImportedSkinnedMesh::ImportedSkinnedMesh(const Mesh &mesh_, const MaterialInfo &
 	vertex_offset = 0;
 	ibo_offset = 0;
 
-	material = Util::make_derived_handle<Material, MaterialFile>(info);
+	material = MaterialManager::get().request_material(info);
 	static_aabb = mesh.static_aabb;
 
 	EVENT_MANAGER_REGISTER_LATCH(ImportedSkinnedMesh, on_device_created, on_device_destroyed, DeviceCreatedEvent);
@@ -65,7 +66,9 @@ void ImportedSkinnedMesh::on_device_created(const DeviceCreatedEvent &created)
 
 	BufferCreateInfo buffer_info = {};
 	buffer_info.domain = BufferDomain::Device;
-	buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	// ComputeSkinning reads vertices as storage buffers.
+	buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	buffer_info.tag = AllocationTag::Mesh;
 
 	buffer_info.size = mesh.positions.size();
 	vbo_position = device.create_buffer(buffer_info, mesh.positions.data());
@@ -106,6 +109,16 @@ const SceneFormats::MaterialInfo &ImportedSkinnedMesh::get_material_info() const
 ImportedMesh::ImportedMesh(const Mesh &mesh_, const MaterialInfo &info_)
 	: mesh(mesh_), info(info_)
 {
+	// Small meshes gain nothing from meshlet culling.
+	if (mesh.meshlets.empty() && mesh.count >= MinMeshletIndexCount)
+		mesh_build_meshlets(mesh);
+	meshlets = mesh.meshlets;
+
+	// Meshes which were not exported with LODs get them here, distant geometry should not cost as much.
+	if (mesh.lods.empty() && mesh.count >= MinLodIndexCount)
+		mesh_build_lods(mesh);
+	lods = mesh.lods;
+
 	topology = mesh.topology;
 	primitive_restart = mesh.primitive_restart;
 	index_type = mesh.index_type;
@@ -118,12 +131,22 @@ ImportedMesh::ImportedMesh(const Mesh &mesh_, const MaterialInfo &info_)
 	vertex_offset = 0;
 	ibo_offset = 0;
 
-	material = Util::make_derived_handle<Material, MaterialFile>(info);
+	material = MaterialManager::get().request_material(info);
 	static_aabb = mesh.static_aabb;
 
+	// Alpha tested surfaces have holes, and cannot occlude.
+	if (mesh.count <= MaxOccluderIndexCount && !get_shadow_caster_mesh(occluder))
+		occluder = {};
+
 	EVENT_MANAGER_REGISTER_LATCH(ImportedMesh, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 }
 
+ImportedMesh::~ImportedMesh()
+{
+	if (auto *common = GRANITE_COMMON_RENDERER_DATA())
+		common->geometry_pool.free(geometry);
+}
+
 const SceneFormats::Mesh &ImportedMesh::get_mesh() const
 {
 	return mesh;
@@ -134,13 +157,59 @@ const SceneFormats::MaterialInfo &ImportedMesh::get_material_info() const
 	return info;
 }
 
+const SceneFormats::CollisionMesh *ImportedMesh::get_occluder_mesh() const
+{
+	return occluder.indices.empty() ? nullptr : &occluder;
+}
+
+bool ImportedMesh::get_shadow_caster_mesh(CollisionMesh &caster) const
+{
+	// Alpha tested surfaces need their UVs.
+	if (info.pipeline != DrawPipeline::Opaque || mesh.primitive_restart)
+		return false;
+
+	if (!extract_collision_mesh(caster, mesh))
+		return false;
+
+	// Reversed copies of the triangles, so back faces render and occlude as well.
+	size_t num_indices = caster.indices.size();
+	if (info.two_sided)
+	{
+		caster.indices.reserve(2 * num_indices);
+		for (size_t i = 0; i < num_indices; i += 3)
+		{
+			caster.indices.push_back(caster.indices[i + 0]);
+			caster.indices.push_back(caster.indices[i + 2]);
+			caster.indices.push_back(caster.indices[i + 1]);
+		}
+	}
+
+	return true;
+}
+
 void ImportedMesh::on_device_created(const DeviceCreatedEvent &created)
 {
 	auto &device = created.get_device();
 
+	// Shared buffers let draws of meshes with the same vertex format skip rebinding.
+	auto *common = GRANITE_COMMON_RENDERER_DATA();
+	if (common && common->geometry_pool.allocate(device, mesh, geometry))
+	{
+		vbo_position = geometry.vbo_position;
+		vbo_attributes = geometry.vbo_attributes;
+		ibo = geometry.ibo;
+		vertex_offset = geometry.vertex_offset;
+		ibo_offset = geometry.ibo_offset;
+		bake();
+		return;
+	}
+
 	BufferCreateInfo buffer_info = {};
 	buffer_info.domain = BufferDomain::Device;
 	buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	buffer_info.tag = AllocationTag::Mesh;
+	// Only bound for draws, so the device may relocate these when defragmenting.
+	buffer_info.misc = BUFFER_MISC_MOVABLE_BIT;
 
 	buffer_info.size = mesh.positions.size();
 	vbo_position = device.create_buffer(buffer_info, mesh.positions.data());
@@ -163,9 +232,13 @@ void ImportedMesh::on_device_created(const DeviceCreatedEvent &created)
 
 void ImportedMesh::on_device_destroyed(const DeviceCreatedEvent &)
 {
+	if (auto *common = GRANITE_COMMON_RENDERER_DATA())
+		common->geometry_pool.free(geometry);
 	vbo_attributes.reset();
 	vbo_position.reset();
 	ibo.reset();
+	vertex_offset = 0;
+	ibo_offset = 0;
 }
 
 
@@ -550,6 +623,7 @@ void GeneratedMesh::setup_from_generated_mesh(Vulkan::Device &device, const Gene
 	info.size = mesh.positions.size() * sizeof(vec3);
 	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	info.domain = BufferDomain::Device;
+	info.tag = AllocationTag::Mesh;
 	vbo_position = device.create_buffer(info, mesh.positions.data());
 
 	info.size = mesh.attributes.size() * sizeof(GeneratedMeshData::Attribute);
@@ -874,6 +948,7 @@ void CubeMesh::on_device_created(const DeviceCreatedEvent &created)
 	vbo_info.domain = BufferDomain::Device;
 	vbo_info.size = sizeof(CubeData::positions);
 	vbo_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	vbo_info.tag = AllocationTag::Mesh;
 	vbo_position = device.create_buffer(vbo_info, CubeData::positions);
 	position_stride = 4;
 
@@ -895,6 +970,7 @@ void CubeMesh::on_device_created(const DeviceCreatedEvent &created)
 	ibo_info.size = sizeof(CubeData::indices);
 	ibo_info.domain = BufferDomain::Device;
 	ibo_info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	ibo_info.tag = AllocationTag::Mesh;
 	ibo = device.create_buffer(ibo_info, CubeData::indices);
 
 	vertex_offset = 0;
@@ -1013,6 +1089,7 @@ void SkyCylinder::on_device_created(const DeviceCreatedEvent &created)
 	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	info.size = v.size() * sizeof(CylinderVertex);
 	info.domain = BufferDomain::Device;
+	info.tag = AllocationTag::Mesh;
 	vbo = device.create_buffer(info, v.data());
 
 	info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
@@ -27,6 +27,7 @@
 #include "scene_formats.hpp"
 #include "render_components.hpp"
 #include "render_context.hpp"
+#include "geometry_pool.hpp"
 
 namespace Granite
 {
@@ -35,13 +36,24 @@ class ImportedMesh : public StaticMesh, public EventHandler
 {
 public:
 	ImportedMesh(const SceneFormats::Mesh &mesh, const SceneFormats::MaterialInfo &info);
+	~ImportedMesh() override;
 
 	const SceneFormats::Mesh &get_mesh() const;
 	const SceneFormats::MaterialInfo &get_material_info() const;
+	const SceneFormats::CollisionMesh *get_occluder_mesh() const override;
+	bool get_shadow_caster_mesh(SceneFormats::CollisionMesh &caster) const override;
+
+	// Meshes at least this large get meshlets and LODs built on import, unless they already have them.
+	enum { MinMeshletIndexCount = 8 * 124 * 3 };
+	enum { MinLodIndexCount = 1024 * 3 };
 
 private:
 	SceneFormats::Mesh mesh;
 	SceneFormats::MaterialInfo info;
+	SceneFormats::CollisionMesh occluder;
+	GeometryPool::Allocation geometry;
+	// Larger meshes cost more to rasterize on the CPU than they are likely to save.
+	enum { MaxOccluderIndexCount = 4096 * 3 };
 
 	void on_device_created(const Vulkan::DeviceCreatedEvent &event);
 	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &event);
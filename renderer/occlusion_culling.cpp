@@ -0,0 +1,300 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "occlusion_culling.hpp"
+#include "scene.hpp"
+#include "render_context.hpp"
+#include "scene_formats.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <float.h>
+
+namespace Granite
+{
+void OcclusionBuffer::set_resolution(unsigned width, unsigned height)
+{
+	resolution = uvec2((width + 3u) & ~3u, height);
+	num_tiles = (resolution + uvec2(TileWidth - 1, TileHeight - 1)) / uvec2(TileWidth, TileHeight);
+	depth.resize(resolution.x * resolution.y);
+	tile_triangles.resize(num_tiles.x * num_tiles.y);
+	active = false;
+}
+
+uvec2 OcclusionBuffer::get_resolution() const
+{
+	return resolution;
+}
+
+void OcclusionBuffer::begin(const mat4 &view_projection_)
+{
+	view_projection = view_projection_;
+	triangles.clear();
+	for (auto &tile : tile_triangles)
+		tile.clear();
+	active = true;
+}
+
+void OcclusionBuffer::add_occluder(const SceneFormats::CollisionMesh &mesh, const mat4 &world_transform)
+{
+	clip_positions.resize(mesh.positions.size());
+	Rasterizer::transform_vertices(clip_positions.data(), mesh.positions.data(), unsigned(mesh.positions.size()),
+	                               view_projection * world_transform);
+
+	// The rasterizer's winding is flipped relative to Vulkan's in a Y-down framebuffer,
+	// so culling its front faces keeps the counter-clockwise triangles Granite draws.
+	size_t first = triangles.size();
+	Rasterizer::setup_depth_triangles(triangles, clip_positions.data(),
+	                                  mesh.indices.data(), unsigned(mesh.indices.size()),
+	                                  Rasterizer::CullMode::Front);
+
+	vec2 fresolution = vec2(resolution);
+	uvec2 tile_size(TileWidth, TileHeight);
+
+	for (size_t i = first; i < triangles.size(); i++)
+	{
+		auto &tri = triangles[i];
+		uvec2 lo = uvec2(clamp(tri.lo, vec2(0.0f), vec2(1.0f)) * fresolution) / tile_size;
+		uvec2 hi = uvec2(clamp(tri.hi, vec2(0.0f), vec2(1.0f)) * fresolution) / tile_size;
+		hi = min(hi, num_tiles - 1u);
+
+		for (unsigned y = lo.y; y <= hi.y; y++)
+			for (unsigned x = lo.x; x <= hi.x; x++)
+				tile_triangles[y * num_tiles.x + x].push_back(uint32_t(i));
+	}
+}
+
+unsigned OcclusionBuffer::get_triangle_count() const
+{
+	return unsigned(triangles.size());
+}
+
+unsigned OcclusionBuffer::get_num_tiles() const
+{
+	return num_tiles.x * num_tiles.y;
+}
+
+void OcclusionBuffer::rasterize_tile(unsigned tile)
+{
+	uvec2 lo = uvec2(tile % num_tiles.x, tile / num_tiles.x) * uvec2(TileWidth, TileHeight);
+	uvec2 hi = min(lo + uvec2(TileWidth, TileHeight), resolution);
+
+	for (unsigned y = lo.y; y < hi.y; y++)
+		std::fill(depth.data() + y * resolution.x + lo.x, depth.data() + y * resolution.x + hi.x, 1.0f);
+
+	for (auto index : tile_triangles[tile])
+		Rasterizer::rasterize_depth_triangle(depth.data(), resolution, triangles[index], lo, hi);
+}
+
+bool OcclusionBuffer::test_aabb(const AABB &aabb) const
+{
+	if (!active)
+		return true;
+
+	vec2 lo(FLT_MAX);
+	vec2 hi(-FLT_MAX);
+	float nearest = 1.0f;
+
+	for (unsigned i = 0; i < 8; i++)
+	{
+		vec4 clip;
+		SIMD::mul(clip, view_projection, vec4(aabb.get_corner(i), 1.0f));
+
+		// Reaches past the near plane, nothing can be in front of it.
+		if (clip.z < 0.0f)
+			return true;
+
+		float iw = 1.0f / clip.w;
+		vec2 coord = clip.xy() * iw * 0.5f + 0.5f;
+		lo = min(lo, coord);
+		hi = max(hi, coord);
+		nearest = min(nearest, clip.z * iw);
+	}
+
+	// Off screen, frustum culling has the final say.
+	if (any(lessThan(hi, vec2(0.0f))) || any(greaterThan(lo, vec2(1.0f))))
+		return true;
+
+	vec2 fresolution = vec2(resolution);
+	ivec2 start = ivec2(clamp(lo, vec2(0.0f), vec2(1.0f)) * fresolution);
+	ivec2 end = min(ivec2(clamp(hi, vec2(0.0f), vec2(1.0f)) * fresolution), ivec2(resolution) - 1);
+
+#if defined(__SSE__)
+	const __m128 reference = _mm_set1_ps(nearest);
+	const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 first = _mm_set1_ps(float(start.x));
+	const __m128 last = _mm_set1_ps(float(end.x));
+#elif defined(__ARM_NEON)
+	static const float lane_values[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	const float32x4_t reference = vdupq_n_f32(nearest);
+	const float32x4_t lanes = vld1q_f32(lane_values);
+	const float32x4_t first = vdupq_n_f32(float(start.x));
+	const float32x4_t last = vdupq_n_f32(float(end.x));
+#endif
+
+	for (int y = start.y; y <= end.y; y++)
+	{
+		const float *row = depth.data() + y * resolution.x;
+
+#if defined(__SSE__)
+		for (int x = start.x & ~3; x <= end.x; x += 4)
+		{
+			__m128 coord = _mm_add_ps(_mm_set1_ps(float(x)), lanes);
+			__m128 in_range = _mm_and_ps(_mm_cmpge_ps(coord, first), _mm_cmple_ps(coord, last));
+			__m128 visible = _mm_and_ps(in_range, _mm_cmpge_ps(_mm_loadu_ps(row + x), reference));
+			if (_mm_movemask_ps(visible) != 0)
+				return true;
+		}
+#elif defined(__ARM_NEON)
+		for (int x = start.x & ~3; x <= end.x; x += 4)
+		{
+			float32x4_t coord = vaddq_f32(vdupq_n_f32(float(x)), lanes);
+			uint32x4_t in_range = vandq_u32(vcgeq_f32(coord, first), vcleq_f32(coord, last));
+			uint32x4_t visible = vandq_u32(in_range, vcgeq_f32(vld1q_f32(row + x), reference));
+			uint32x2_t merged = vorr_u32(vget_low_u32(visible), vget_high_u32(visible));
+			if ((vget_lane_u32(merged, 0) | vget_lane_u32(merged, 1)) != 0)
+				return true;
+		}
+#else
+		for (int x = start.x; x <= end.x; x++)
+			if (row[x] >= nearest)
+				return true;
+#endif
+	}
+
+	return false;
+}
+
+const float *OcclusionBuffer::get_depth() const
+{
+	return depth.data();
+}
+
+OcclusionCulling::OcclusionCulling(Scene &scene_, const OcclusionCullingConfig &config_)
+	: config(config_), scene(scene_)
+{
+	buffer.set_resolution(config.width, config.height);
+}
+
+OcclusionCulling::Handles OcclusionCulling::add_to_scene(Scene &scene, const OcclusionCullingConfig &config)
+{
+	Handles handles;
+	handles.entity = scene.create_entity();
+
+	auto culling = Util::make_handle<OcclusionCulling>(scene, config);
+
+	auto *update_component = handles.entity->allocate_component<PerFrameUpdateComponent>();
+	update_component->refresh = culling.get();
+
+	auto *renderable = handles.entity->allocate_component<RenderableComponent>();
+	renderable->renderable = culling;
+
+	handles.culling = culling.get();
+	return handles;
+}
+
+const OcclusionBuffer &OcclusionCulling::get_buffer() const
+{
+	return buffer;
+}
+
+unsigned OcclusionCulling::get_occluder_count() const
+{
+	return occluder_count;
+}
+
+void OcclusionCulling::setup_occluders(const RenderContext &context)
+{
+	auto &params = context.get_render_parameters();
+
+	visible.clear();
+	scene.gather_visible_opaque_renderables(context.get_visibility_frustum(), visible);
+
+	candidates.clear();
+	for (auto &info : visible)
+	{
+		if (!info.transform)
+			continue;
+
+		auto *mesh = info.renderable->get_occluder_mesh();
+		if (!mesh)
+			continue;
+
+		auto &aabb = info.transform->world_aabb;
+		float size = aabb.get_radius() / max(distance(aabb.get_center(), params.camera_position), 0.001f);
+		bool flagged = (info.renderable->flags & RENDERABLE_OCCLUDER_BIT) != 0;
+		if (!flagged && size < config.min_occluder_size)
+			continue;
+
+		candidates.push_back({ mesh, &info.transform->transform->world_transform, flagged ? FLT_MAX : size });
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.size > b.size;
+	});
+
+	buffer.begin(params.view_projection);
+	occluder_count = 0;
+
+	unsigned triangle_count = 0;
+	for (auto &candidate : candidates)
+	{
+		auto count = unsigned(candidate.mesh->indices.size() / 3);
+		if (triangle_count + count > config.max_triangles)
+			continue;
+
+		buffer.add_occluder(*candidate.mesh, *candidate.transform);
+		triangle_count += count;
+		occluder_count++;
+	}
+}
+
+void OcclusionCulling::get_render_info(const RenderContext &, const RenderInfoComponent *, RenderQueue &) const
+{
+}
+
+void OcclusionCulling::refresh(const RenderContext &context, TaskComposer &composer)
+{
+	// The buffer is rasterized from one view, and would cull what only the other views see.
+	if (context.get_view_count() != 1)
+	{
+		scene.set_occlusion_buffer(nullptr, nullptr);
+		return;
+	}
+
+	scene.set_occlusion_buffer(&buffer, &context);
+
+	auto &setup = composer.begin_pipeline_stage();
+	setup.set_desc("occlusion-setup");
+	setup.enqueue_task([this, &context]() {
+		setup_occluders(context);
+	});
+
+	auto &rasterize = composer.begin_pipeline_stage();
+	rasterize.set_desc("occlusion-rasterize");
+	for (unsigned i = 0; i < buffer.get_num_tiles(); i++)
+	{
+		rasterize.enqueue_task([this, i]() {
+			buffer.rasterize_tile(i);
+		});
+	}
+}
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "cpu_rasterizer.hpp"
+#include "render_components.hpp"
+#include "render_queue.hpp"
+#include "aabb.hpp"
+#include <vector>
+
+namespace Granite
+{
+class Scene;
+class RenderContext;
+
+// A low resolution depth buffer rasterized on the CPU, for culling where GPU-driven culling is not available.
+// Occluders are binned to screen tiles, which can be rasterized in parallel.
+class OcclusionBuffer
+{
+public:
+	enum { TileWidth = 64, TileHeight = 32 };
+
+	// The width is rounded up to a multiple of 4.
+	void set_resolution(unsigned width, unsigned height);
+	uvec2 get_resolution() const;
+
+	// Clears the buffer. Occluders are projected with view_projection until the next begin().
+	void begin(const mat4 &view_projection);
+	void add_occluder(const SceneFormats::CollisionMesh &mesh, const mat4 &world_transform);
+	unsigned get_triangle_count() const;
+
+	unsigned get_num_tiles() const;
+	void rasterize_tile(unsigned tile);
+
+	// False if the box is entirely hidden behind occluders.
+	// Thread safe once every tile is rasterized, and always true before the first begin().
+	bool test_aabb(const AABB &aabb) const;
+
+	const float *get_depth() const;
+
+private:
+	uvec2 resolution = uvec2(0u);
+	uvec2 num_tiles = uvec2(0u);
+	mat4 view_projection;
+	std::vector<float> depth;
+	std::vector<vec4> clip_positions;
+	std::vector<Rasterizer::TriangleSetup> triangles;
+	std::vector<std::vector<uint32_t>> tile_triangles;
+	bool active = false;
+};
+
+struct OcclusionCullingConfig
+{
+	unsigned width = 320;
+	unsigned height = 192;
+
+	// Visible occluders are picked largest first, by bounding sphere radius over distance,
+	// until the triangle budget is spent. RENDERABLE_OCCLUDER_BIT skips the size threshold.
+	float min_occluder_size = 0.1f;
+	unsigned max_triangles = 64 * 1024;
+};
+
+// Rasterizes occluders from the scene for the main render context each frame.
+// Opaque renderables are then tested against the buffer as they are gathered,
+// see Scene::get_occlusion_buffer(). The scene points to this object, so it must live as long as the scene.
+class OcclusionCulling : public AbstractRenderable, public PerFrameRefreshable
+{
+public:
+	OcclusionCulling(Scene &scene, const OcclusionCullingConfig &config);
+
+	struct Handles
+	{
+		Entity *entity;
+		OcclusionCulling *culling;
+	};
+	static Handles add_to_scene(Scene &scene, const OcclusionCullingConfig &config = {});
+
+	const OcclusionBuffer &get_buffer() const;
+	unsigned get_occluder_count() const;
+
+private:
+	OcclusionCullingConfig config;
+	OcclusionBuffer buffer;
+	Scene &scene;
+	VisibilityList visible;
+
+	struct Candidate
+	{
+		const SceneFormats::CollisionMesh *mesh;
+		const mat4 *transform;
+		float size;
+	};
+	std::vector<Candidate> candidates;
+	unsigned occluder_count = 0;
+
+	void setup_occluders(const RenderContext &context);
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                     RenderQueue &queue) const override;
+	void refresh(const RenderContext &context, TaskComposer &composer) override;
+};
+}
@@ -83,6 +83,16 @@ void Ocean::set_frequency_band_modulation(bool enable)
 	freq_band_modulation = enable;
 }
 
+void Ocean::set_fft_update_interval(unsigned frames)
+{
+	fft_update_interval = std::max(frames, 1u);
+}
+
+bool Ocean::need_fft_update() const
+{
+	return fft_update_frame;
+}
+
 Ocean::Handles Ocean::add_to_scene(Scene &scene, const OceanConfig &config, Scene::NodeHandle node)
 {
 	Handles handles;
@@ -111,6 +121,15 @@ static constexpr double AnimationPeriodScaled = AnimationPeriod / (2.0 * muglm::
 bool Ocean::on_frame_tick(const Granite::FrameTickEvent &e)
 {
 	current_time = muglm::mod(e.get_elapsed_time(), AnimationPeriod);
+	fft_update_frame = (fft_frame_count++ % fft_update_interval) == 0;
+
+	// Maps computed now are displayed for the next N frames, so sample the middle of that window
+	// to halve the worst case temporal error.
+	if (fft_update_frame)
+	{
+		double offset = 0.5 * double(fft_update_interval - 1) * e.get_frame_time();
+		fft_time = muglm::mod(current_time + offset, AnimationPeriod);
+	}
 	return true;
 }
 
@@ -128,6 +147,8 @@ void Ocean::on_device_created(const Vulkan::DeviceCreatedEvent &e)
 	if (!height_fft.plan(&e.get_device(), options))
 		LOGE("Failed to plan FFT!\n");
 
+	// All transforms are inverse, so they can share the largest twiddle table.
+	options.twiddle_source = &height_fft;
 	options.mode = FFT::Mode::InverseComplexToComplex;
 	if (!normal_fft.plan(&e.get_device(), options))
 		LOGE("Failed to plan FFT!\n");
@@ -453,7 +474,7 @@ void Ocean::update_fft_input(Vulkan::CommandBuffer &cmd)
 	};
 	Push push;
 	push.mod = vec2(2.0f * pi<float>()) / heightmap_world_size();
-	push.time = float(current_time);
+	push.time = float(fft_time);
 	push.period = float(AnimationPeriodScaled);
 	push.freq_to_band_mod = (float(FrequencyBands - 1) * 2.0f) / float(config.fft_resolution);
 
@@ -490,48 +511,35 @@ void Ocean::update_fft_input(Vulkan::CommandBuffer &cmd)
 
 void Ocean::compute_fft(Vulkan::CommandBuffer &cmd)
 {
-	unsigned num_iterations = (std::max)((std::max)(height_fft.get_num_iterations(),
-	                                                normal_fft.get_num_iterations()),
-	                                     displacement_fft.get_num_iterations());
-
-	for (unsigned i = 0; i < num_iterations; i++)
-	{
-		if (i < displacement_fft.get_num_iterations())
-		{
-			FFT::Resource src = {}, dst = {};
-			src.buffer.buffer = &graph->get_physical_buffer_resource(*displacement_fft_input);
-			src.buffer.offset = 0;
-			src.buffer.size = src.buffer.buffer->get_create_info().size;
-			src.buffer.row_stride = config.fft_resolution >> config.displacement_downsample;
-			dst.image.view = &graph->get_physical_texture_resource(*displacement_fft_output);
-			displacement_fft.execute_iteration(cmd, dst, src, i);
-		}
-
-		if (i < height_fft.get_num_iterations())
-		{
-			FFT::Resource src = {}, dst = {};
-			src.buffer.buffer = &graph->get_physical_buffer_resource(*height_fft_input);
-			src.buffer.offset = 0;
-			src.buffer.size = src.buffer.buffer->get_create_info().size;
-			src.buffer.row_stride = config.fft_resolution;
-			dst.image.view = &graph->get_physical_texture_resource(*height_fft_output);
-			height_fft.execute_iteration(cmd, dst, src, i);
-		}
-
-		if (i < normal_fft.get_num_iterations())
-		{
-			FFT::Resource src = {}, dst = {};
-			src.buffer.buffer = &graph->get_physical_buffer_resource(*normal_fft_input);
-			src.buffer.offset = 0;
-			src.buffer.size = src.buffer.buffer->get_create_info().size;
-			src.buffer.row_stride = config.fft_resolution;
-			dst.image.view = normal_mip_views.front().get();
-			normal_fft.execute_iteration(cmd, dst, src, i);
-		}
-
-		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
-	}
+	FFT::Batch batches[3] = {};
+
+	auto &displacement = batches[0];
+	displacement.fft = &displacement_fft;
+	displacement.src.buffer.buffer = &graph->get_physical_buffer_resource(*displacement_fft_input);
+	displacement.src.buffer.offset = 0;
+	displacement.src.buffer.size = displacement.src.buffer.buffer->get_create_info().size;
+	displacement.src.buffer.row_stride = config.fft_resolution >> config.displacement_downsample;
+	displacement.dst.image.view = &graph->get_physical_texture_resource(*displacement_fft_output);
+
+	auto &height = batches[1];
+	height.fft = &height_fft;
+	height.src.buffer.buffer = &graph->get_physical_buffer_resource(*height_fft_input);
+	height.src.buffer.offset = 0;
+	height.src.buffer.size = height.src.buffer.buffer->get_create_info().size;
+	height.src.buffer.row_stride = config.fft_resolution;
+	height.dst.image.view = &graph->get_physical_texture_resource(*height_fft_output);
+
+	auto &normal = batches[2];
+	normal.fft = &normal_fft;
+	normal.src.buffer.buffer = &graph->get_physical_buffer_resource(*normal_fft_input);
+	normal.src.buffer.offset = 0;
+	normal.src.buffer.size = normal.src.buffer.buffer->get_create_info().size;
+	normal.src.buffer.row_stride = config.fft_resolution;
+	normal.dst.image.view = normal_mip_views.front().get();
+
+	FFT::execute_batched(cmd, batches, 3);
+	cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
 }
 
 void Ocean::bake_maps(Vulkan::CommandBuffer &cmd)
@@ -728,9 +736,38 @@ void Ocean::update_fft_pass(Vulkan::CommandBuffer &cmd)
 	generate_mipmaps(cmd);
 }
 
+// The FFT maps are only rewritten on update frames.
+// Being conditional keeps the render graph from aliasing them, so they persist in between.
+struct Ocean::FFTPassInterface : RenderPassInterface
+{
+	explicit FFTPassInterface(Ocean &ocean_)
+		: ocean(ocean_)
+	{
+	}
+
+	bool render_pass_is_conditional() const override
+	{
+		return true;
+	}
+
+	bool need_render_pass() const override
+	{
+		return ocean.need_fft_update();
+	}
+
+	void build_render_pass(Vulkan::CommandBuffer &cmd) override
+	{
+		ocean.update_fft_pass(cmd);
+	}
+
+	Ocean &ocean;
+};
+
 void Ocean::add_lod_update_pass(RenderGraph &graph_)
 {
-	auto &update_lod = graph_.add_pass("ocean-update-lods", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	// Neither LOD selection nor the FFT depend on scene geometry,
+	// so they can overlap with shadow and depth rendering on the async queue.
+	auto &update_lod = graph_.add_pass("ocean-update-lods", RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT);
 	AttachmentInfo lod_attachment;
 	lod_attachment.format = VK_FORMAT_R16_SFLOAT;
 	lod_attachment.size_x = float(config.grid_count);
@@ -785,7 +822,7 @@ void Ocean::add_fft_update_pass(RenderGraph &graph_)
 	normal_map.aux_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
 	normal_map.levels = 0;
 
-	auto &update_fft = graph_.add_pass("ocean-update-fft", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &update_fft = graph_.add_pass("ocean-update-fft", RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT);
 
 	height_fft_input = &update_fft.add_storage_output("ocean-height-fft-input",
 	                                                  height_info);
@@ -827,9 +864,7 @@ void Ocean::add_fft_update_pass(RenderGraph &graph_)
 			&update_fft.add_storage_texture_output("ocean-gradient-jacobian-output",
 			                                       height_displacement);
 
-	update_fft.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
-		update_fft_pass(cmd);
-	});
+	update_fft.set_render_pass_interface(Util::make_handle<FFTPassInterface>(*this));
 }
 
 void Ocean::add_render_passes(RenderGraph &graph_)
@@ -839,6 +874,9 @@ void Ocean::add_render_passes(RenderGraph &graph_)
 	fragment_mip_views.clear();
 
 	graph = &graph_;
+	// Freshly baked graphs have no valid FFT maps yet.
+	fft_frame_count = 0;
+	fft_update_frame = true;
 	if (config.heightmap)
 		add_lod_update_pass(graph_);
 	add_fft_update_pass(graph_);
@@ -108,6 +108,10 @@ public:
 	void set_frequency_band_amplitude(unsigned band, float amplitude);
 	void set_frequency_band_modulation(bool enable);
 
+	// Recomputes the FFT maps every N frames, 1 updates every frame.
+	// The spectrum is evaluated at the middle of the interval the maps are displayed for.
+	void set_fft_update_interval(unsigned frames);
+
 private:
 	OceanConfig config;
 
@@ -121,6 +125,13 @@ private:
 	float frequency_bands[FrequencyBands];
 	bool freq_band_modulation = false;
 
+	struct FFTPassInterface;
+	unsigned fft_update_interval = 1;
+	uint64_t fft_frame_count = 0;
+	double fft_time = 0.0;
+	bool fft_update_frame = true;
+	bool need_fft_update() const;
+
 	bool has_static_aabb() const override
 	{
 		return false;
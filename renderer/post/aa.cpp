@@ -24,6 +24,7 @@
 #include "temporal.hpp"
 #include "fxaa.hpp"
 #include "smaa.hpp"
+#include "dynamic_resolution.hpp"
 #include "muglm/muglm_impl.hpp"
 #include <string.h>
 
@@ -71,6 +72,26 @@ static void FsrRcasCon(float *con, float sharpness)
 	con[3] = 0.0f;
 }
 
+static bool fsr_use_fp16(Vulkan::Device &device)
+{
+	bool fp16 = device.get_device_features().float16_int8_features.shaderFloat16;
+	const char *fsr_fp16 = getenv("FIDELITYFX_FSR_FP16");
+	if (fsr_fp16)
+	{
+		fp16 = strtoul(fsr_fp16, nullptr, 0) != 0;
+		static bool logged;
+		if (!logged)
+		{
+			if (fp16)
+				LOGI("Forcing FP16 for FidelityFX FSR path.\n");
+			else
+				LOGI("Forcing FP32 for FidelityFX FSR path.\n");
+			logged = true;
+		}
+	}
+	return fp16;
+}
+
 bool setup_after_post_chain_upscaling(RenderGraph &graph, const std::string &input, const std::string &output, bool use_sharpen)
 {
 	auto &upscale = graph.add_pass(output + "-scale", RenderGraph::get_default_post_graphics_queue());
@@ -114,22 +135,7 @@ bool setup_after_post_chain_upscaling(RenderGraph &graph, const std::string &inp
 		const char *vert = "builtin://shaders/post/ffx-fsr/upscale.vert";
 		const char *frag = "builtin://shaders/post/ffx-fsr/upscale.frag";
 
-		bool fp16 = cmd.get_device().get_device_features().float16_int8_features.shaderFloat16;
-		const char *fsr_fp16 = getenv("FIDELITYFX_FSR_FP16");
-		if (fsr_fp16)
-		{
-			fp16 = strtoul(fsr_fp16, nullptr, 0) != 0;
-			static bool logged;
-			if (!logged)
-			{
-				if (fp16)
-					LOGI("Forcing FP16 for FidelityFX FSR path.\n");
-				else
-					LOGI("Forcing FP32 for FidelityFX FSR path.\n");
-				logged = true;
-			}
-		}
-
+		bool fp16 = fsr_use_fp16(cmd.get_device());
 		Vulkan::CommandBufferUtil::draw_fullscreen_quad(cmd, vert, frag,
 		                                                {{ "TARGET_SRGB", srgb ? 1 : 0 },
 		                                                 {"FP16", fp16 ? 1 : 0 }});
@@ -192,6 +198,12 @@ bool setup_before_post_chain_antialiasing(PostAAType type, RenderGraph &graph, T
                                           const std::string &input_mv,
                                           const std::string &output)
 {
+	if (type == PostAAType::TAA_Upscale)
+	{
+		setup_taa_upscale(graph, jitter, scaling_factor, input, input_depth, input_mv, output);
+		return true;
+	}
+
 	TAAQuality taa_quality;
 	switch (type)
 	{
@@ -249,6 +261,51 @@ bool setup_after_post_chain_antialiasing(PostAAType type, RenderGraph &graph, Te
 	}
 }
 
+void setup_dynamic_resolution_upscaling(RenderGraph &graph, const DynamicResolutionController &controller,
+                                        const std::string &input, const std::string &output)
+{
+	// Same size and format as the input, only the top-left render area of the input is valid.
+	auto info = graph.get_texture_resource(input).get_attachment_info();
+
+	auto &upscale = graph.add_pass(output, RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	upscale.add_color_output(output, info);
+	auto &tex = upscale.add_texture_input(input);
+
+	upscale.set_build_render_pass([&graph, &tex, &controller](Vulkan::CommandBuffer &cmd) {
+		auto &view = graph.get_physical_texture_resource(tex);
+		cmd.set_texture(0, 0, view, Vulkan::StockSampler::NearestClamp);
+
+		struct Constants
+		{
+			float params[4][4];
+		} constants;
+
+		struct Push
+		{
+			float width, height;
+		} push;
+
+		auto width = float(view.get_view_width());
+		auto height = float(view.get_view_height());
+		auto extent = controller.get_render_extent(view.get_view_width(), view.get_view_height());
+
+		auto *params = cmd.allocate_typed_constant_data<Constants>(1, 0, 1);
+		FsrEasuCon(constants.params[0], constants.params[1], constants.params[2], constants.params[3],
+		           float(extent.width), float(extent.height), width, height,
+		           cmd.get_viewport().width, cmd.get_viewport().height);
+		*params = constants;
+
+		push.width = cmd.get_viewport().width;
+		push.height = cmd.get_viewport().height;
+		cmd.push_constants(&push, 0, sizeof(push));
+
+		Vulkan::CommandBufferUtil::draw_fullscreen_quad(cmd, "builtin://shaders/post/ffx-fsr/upscale.vert",
+		                                                "builtin://shaders/post/ffx-fsr/upscale.frag",
+		                                                {{ "TARGET_SRGB", 0 },
+		                                                 { "FP16", fsr_use_fp16(cmd.get_device()) ? 1 : 0 }});
+	});
+}
+
 PostAAType string_to_post_antialiasing_type(const char *type)
 {
 	if (!type)
@@ -274,6 +331,8 @@ PostAAType string_to_post_antialiasing_type(const char *type)
 		return PostAAType::TAA_Medium;
 	else if (strcmp(type, "taaHigh") == 0)
 		return PostAAType::TAA_High;
+	else if (strcmp(type, "taaUpscale") == 0)
+		return PostAAType::TAA_Upscale;
 	else if (strcmp(type, "none") == 0)
 		return PostAAType::None;
 	else
@@ -282,4 +341,35 @@ PostAAType string_to_post_antialiasing_type(const char *type)
 		return PostAAType::None;
 	}
 }
+
+const char *post_antialiasing_type_to_string(PostAAType type)
+{
+	switch (type)
+	{
+	case PostAAType::FXAA:
+		return "fxaa";
+	case PostAAType::FXAA_2Phase:
+		return "fxaa2phase";
+	case PostAAType::SMAA_Low:
+		return "smaaLow";
+	case PostAAType::SMAA_Medium:
+		return "smaaMedium";
+	case PostAAType::SMAA_High:
+		return "smaaHigh";
+	case PostAAType::SMAA_Ultra:
+		return "smaaUltra";
+	case PostAAType::SMAA_Ultra_T2X:
+		return "smaaUltraT2X";
+	case PostAAType::TAA_Low:
+		return "taaLow";
+	case PostAAType::TAA_Medium:
+		return "taaMedium";
+	case PostAAType::TAA_High:
+		return "taaHigh";
+	case PostAAType::TAA_Upscale:
+		return "taaUpscale";
+	default:
+		return "none";
+	}
+}
 }
@@ -28,6 +28,7 @@ namespace Granite
 {
 class RenderGraph;
 class TemporalJitter;
+class DynamicResolutionController;
 enum class PostAAType
 {
 	FXAA,
@@ -40,6 +41,7 @@ enum class PostAAType
 	TAA_Low,
 	TAA_Medium,
 	TAA_High,
+	TAA_Upscale,
 	None
 };
 
@@ -55,5 +57,10 @@ bool setup_after_post_chain_antialiasing(PostAAType type, RenderGraph &graph, Te
 
 bool setup_after_post_chain_upscaling(RenderGraph &graph, const std::string &input, const std::string &output, bool use_sharpen);
 
+// Upscales the current render area of input to the full size of input with FSR1.
+void setup_dynamic_resolution_upscaling(RenderGraph &graph, const DynamicResolutionController &controller,
+                                        const std::string &input, const std::string &output);
+
 PostAAType string_to_post_antialiasing_type(const char *type);
+const char *post_antialiasing_type_to_string(PostAAType type);
 }
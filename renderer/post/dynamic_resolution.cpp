@@ -0,0 +1,153 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dynamic_resolution.hpp"
+#include "render_graph.hpp"
+#include "device.hpp"
+#include "muglm/muglm_impl.hpp"
+
+namespace Granite
+{
+void DynamicResolutionController::set_options(const DynamicResolutionOptions &options_)
+{
+	options = options_;
+	options.max_scale = muglm::clamp(options.max_scale, 0.1f, 1.0f);
+	options.min_scale = muglm::clamp(options.min_scale, 0.1f, options.max_scale);
+	if (options.window_frames == 0)
+		options.window_frames = 1;
+	reset();
+}
+
+const DynamicResolutionOptions &DynamicResolutionController::get_options() const
+{
+	return options;
+}
+
+void DynamicResolutionController::reset()
+{
+	update_thermal_max_scale();
+	scale = thermal_max_scale;
+	gpu_frame_time_ms = 0.0;
+	frame_count = 0;
+	discard_window = true;
+}
+
+void DynamicResolutionController::update(Vulkan::Device &device, RenderGraph &graph)
+{
+	if (++frame_count < options.window_frames)
+		return;
+	frame_count = 0;
+
+	double total_ms = 0.0;
+	device.timestamp_log([&](const std::string &tag, const Vulkan::TimestampIntervalReport &report) {
+		// Merged physical passes are tagged as "a + b".
+		auto end = tag.find(" + ");
+		if (graph.find_pass(end == std::string::npos ? tag : tag.substr(0, end)))
+			total_ms += 1000.0 * report.time_per_frame_context;
+	});
+	device.timestamp_log_reset();
+
+	// Timestamps resolve a few frames late, so the window after a change still has the old scale in it.
+	if (discard_window || total_ms <= 0.0)
+	{
+		discard_window = false;
+		return;
+	}
+
+	gpu_frame_time_ms = total_ms;
+	float new_scale = scale;
+	double target = options.target_frame_time_ms;
+
+	if (gpu_frame_time_ms > target * options.high_threshold)
+	{
+		// Cost is roughly proportional to pixel count. Go down fast, but at least one step.
+		float ideal = scale * muglm::sqrt(float(target * options.high_threshold / gpu_frame_time_ms));
+		new_scale = muglm::min(scale - options.step, ideal);
+	}
+	else if (gpu_frame_time_ms < target * options.low_threshold)
+	{
+		// Go up slowly, so we do not oscillate around the target.
+		new_scale = scale + options.step;
+	}
+
+	new_scale = muglm::clamp(new_scale, options.min_scale, thermal_max_scale);
+	if (new_scale != scale)
+	{
+		scale = new_scale;
+		discard_window = true;
+	}
+}
+
+void DynamicResolutionController::update_thermal_max_scale()
+{
+	float threshold = muglm::clamp(options.thermal_headroom_threshold, 0.0f, 0.99f);
+	float t = muglm::clamp((thermal_headroom - threshold) / (1.0f - threshold), 0.0f, 1.0f);
+	thermal_max_scale = options.max_scale - t * (options.max_scale - options.min_scale);
+}
+
+void DynamicResolutionController::set_thermal_headroom(float headroom)
+{
+	// NaN means the platform has no forecast.
+	thermal_headroom = headroom >= 0.0f ? headroom : 0.0f;
+	update_thermal_max_scale();
+
+	// Takes effect right away rather than waiting for GPU time to go over the target.
+	if (scale > thermal_max_scale)
+	{
+		scale = thermal_max_scale;
+		discard_window = true;
+	}
+}
+
+float DynamicResolutionController::get_thermal_max_scale() const
+{
+	return thermal_max_scale;
+}
+
+float DynamicResolutionController::get_scale() const
+{
+	return scale;
+}
+
+double DynamicResolutionController::get_gpu_frame_time_ms() const
+{
+	return gpu_frame_time_ms;
+}
+
+VkExtent2D DynamicResolutionController::get_render_extent(uint32_t width, uint32_t height) const
+{
+	// Round to 8 pixels to avoid lots of tiny changes in the render area.
+	const auto scale_dim = [this](uint32_t dim) -> uint32_t {
+		auto scaled = uint32_t(muglm::round(float(dim) * scale / 8.0f)) * 8u;
+		return muglm::clamp(scaled, muglm::min(8u, dim), dim);
+	};
+	return { scale_dim(width), scale_dim(height) };
+}
+
+bool DynamicResolutionController::get_render_area(VkRect2D *area) const
+{
+	if (scale >= 1.0f)
+		return false;
+	area->extent = get_render_extent(area->extent.width, area->extent.height);
+	return true;
+}
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_headers.hpp"
+
+namespace Vulkan
+{
+class Device;
+}
+
+namespace Granite
+{
+class RenderGraph;
+
+struct DynamicResolutionOptions
+{
+	float target_frame_time_ms = 16.0f;
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+	// Scale is lowered when GPU time exceeds target * high_threshold,
+	// and raised when it drops below target * low_threshold.
+	float high_threshold = 0.95f;
+	float low_threshold = 0.8f;
+	float step = 0.05f;
+	// Frames of timestamps which are averaged before a decision is made.
+	unsigned window_frames = 16;
+	// Past this thermal headroom, the maximum scale is lowered towards min_scale,
+	// which it reaches at a headroom of 1 (severe throttling).
+	float thermal_headroom_threshold = 0.75f;
+};
+
+// Scales the render area of the main passes to hit a GPU frame time target.
+// GPU time is the sum of all render graph pass timestamps, see RenderGraph::enable_timestamps().
+// The attachments keep their size, so the graph is never baked again when the scale changes.
+class DynamicResolutionController
+{
+public:
+	void set_options(const DynamicResolutionOptions &options);
+	const DynamicResolutionOptions &get_options() const;
+	void reset();
+
+	// Call once per frame before the render graph is enqueued.
+	// Takes over Device::timestamp_log_reset() to get a moving window.
+	void update(Vulkan::Device &device, RenderGraph &graph);
+
+	float get_scale() const;
+	double get_gpu_frame_time_ms() const;
+
+	// From ThermalStateEvent. Lowering resolution before the device throttles keeps the frame rate sustainable.
+	void set_thermal_headroom(float headroom);
+	float get_thermal_max_scale() const;
+
+	VkExtent2D get_render_extent(uint32_t width, uint32_t height) const;
+	// For RenderPass::set_get_render_area().
+	bool get_render_area(VkRect2D *area) const;
+
+private:
+	DynamicResolutionOptions options;
+	float scale = 1.0f;
+	float thermal_max_scale = 1.0f;
+	float thermal_headroom = 0.0f;
+	double gpu_frame_time_ms = 0.0;
+	unsigned frame_count = 0;
+	bool discard_window = true;
+
+	void update_thermal_max_scale();
+};
+}
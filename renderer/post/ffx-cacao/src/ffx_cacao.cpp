@@ -240,9 +240,8 @@ void FFX_CACAO_UpdatePerPassConstants(FFX_CACAO_Constants* consts, const FFX_CAC
 
 	consts->PassIndex = pass;
 
-	//float additionalAngleOffset = settings->temporalSupersamplingAngleOffset;  // if using temporal supersampling approach (like "Progressive Rendering Using Multi-frame Sampling" from GPU Pro 7, etc.)
-	//float additionalRadiusScale = settings->temporalSupersamplingRadiusOffset; // if using temporal supersampling approach (like "Progressive Rendering Using Multi-frame Sampling" from GPU Pro 7, etc.)
-	(void)settings;
+	float additionalAngleOffset = settings->temporalSupersamplingAngleOffset;  // if using temporal supersampling approach (like "Progressive Rendering Using Multi-frame Sampling" from GPU Pro 7, etc.)
+	float additionalRadiusScale = settings->temporalSupersamplingRadiusOffset; // if using temporal supersampling approach (like "Progressive Rendering Using Multi-frame Sampling" from GPU Pro 7, etc.)
 
 	const int subPassCount = 5;
 	for (int subPass = 0; subPass < subPassCount; subPass++)
@@ -255,11 +254,14 @@ void FFX_CACAO_UpdatePerPassConstants(FFX_CACAO_Constants* consts, const FFX_CAC
 
 		float ca, sa;
 		float angle0 = ((float)a + (float)b / (float)subPassCount) * (3.1415926535897932384626433832795f) * 0.5f;
+		angle0 += additionalAngleOffset;
 
 		ca = FFX_CACAO_COS(angle0);
 		sa = FFX_CACAO_SIN(angle0);
 
 		float scale = 1.0f + (a - 1.5f + (b - (subPassCount - 1.0f) * 0.5f) / (float)subPassCount) * 0.07f;
+		// Offset rather than scale, so the default of 0 keeps the untouched pattern.
+		scale *= 1.0f + additionalRadiusScale;
 
 		consts->PatternRotScaleMatrices[subPass][0] = scale * ca;
 		consts->PatternRotScaleMatrices[subPass][1] = scale * -sa;
@@ -21,7 +21,9 @@
  */
 
 #include "hdr.hpp"
+#include "spd.hpp"
 #include "math.hpp"
+#include "bitops.hpp"
 #include "application_events.hpp"
 #include "common_renderer_data.hpp"
 #include "muglm/muglm_impl.hpp"
@@ -181,17 +183,16 @@ static void bloom_downsample_build_compute(Vulkan::CommandBuffer &cmd, RenderGra
 	cmd.dispatch((push.threads.x + 7) / 8, (push.threads.y + 7) / 8, 1);
 }
 
-static void bloom_upsample_build_compute(Vulkan::CommandBuffer &cmd, RenderGraph &graph,
-                                         const RenderTextureResource &output_res, const RenderTextureResource &input_res)
+static void bloom_upsample_dispatch(Vulkan::CommandBuffer &cmd, const Vulkan::ImageView &output,
+                                    const Vulkan::ImageView &input, const Vulkan::ImageView *history)
 {
-	auto &output = graph.get_physical_texture_resource(output_res);
-	auto &input = graph.get_physical_texture_resource(input_res);
-
 	cmd.set_texture(0, 0, input, Vulkan::StockSampler::LinearClamp);
 	cmd.set_storage_texture(0, 1, output);
+	if (history)
+		cmd.set_texture(0, 2, *history, Vulkan::StockSampler::NearestClamp);
 
 	auto *program = cmd.get_device().get_shader_manager().register_compute("builtin://shaders/post/bloom_upsample.comp");
-	auto *variant = program->register_variant({});
+	auto *variant = program->register_variant({{ "FEEDBACK", history ? 1 : 0 }});
 	cmd.set_program(variant->get_program());
 
 	struct Registers
@@ -199,17 +200,27 @@ static void bloom_upsample_build_compute(Vulkan::CommandBuffer &cmd, RenderGraph
 		uvec2 threads;
 		vec2 inv_output_resolution;
 		vec2 inv_input_resolution;
+		float lerp;
 	} push;
-	push.threads.x = output.get_image().get_width();
-	push.threads.y = output.get_image().get_height();
+	push.threads.x = output.get_view_width();
+	push.threads.y = output.get_view_height();
 	push.inv_output_resolution.x = 1.0f / float(push.threads.x);
 	push.inv_output_resolution.y = 1.0f / float(push.threads.y);
-	push.inv_input_resolution.x = 1.0f / float(input.get_image().get_width());
-	push.inv_input_resolution.y = 1.0f / float(input.get_image().get_height());
+	push.inv_input_resolution.x = 1.0f / float(input.get_view_width());
+	push.inv_input_resolution.y = 1.0f / float(input.get_view_height());
+	push.lerp = 1.0f - pow(0.001f, GRANITE_COMMON_RENDERER_DATA()->frame_tick.frame_time);
 	cmd.push_constants(&push, 0, sizeof(push));
 	cmd.dispatch((push.threads.x + 7) / 8, (push.threads.y + 7) / 8, 1);
 }
 
+static void bloom_upsample_build_compute(Vulkan::CommandBuffer &cmd, RenderGraph &graph,
+                                         const RenderTextureResource &output_res, const RenderTextureResource &input_res)
+{
+	auto &output = graph.get_physical_texture_resource(output_res);
+	auto &input = graph.get_physical_texture_resource(input_res);
+	bloom_upsample_dispatch(cmd, output, input, nullptr);
+}
+
 static void bloom_downsample_build_render_pass(RenderPass &pass, Vulkan::CommandBuffer &cmd,
                                                RenderTextureResource &input_res,
                                                RenderTextureResource *feedback_res,
@@ -299,10 +310,167 @@ static void tonemap_build_render_pass(RenderPass &pass, Vulkan::CommandBuffer &c
 	                                                {{ "DYNAMIC_EXPOSURE", ubo ? 1 : 0 }});
 }
 
+struct BloomPyramidState : Util::IntrusivePtrEnabled<BloomPyramidState>
+{
+	const Vulkan::Image *image = nullptr;
+	Util::SmallVector<Vulkan::ImageViewHandle, MaxSPDMips> views;
+	const Vulkan::ImageView *output_mips[MaxSPDMips];
+};
+
+static void setup_hdr_postprocess_single_pass(RenderGraph &graph, const std::string &input, const std::string &output,
+                                              const HDROptions &options,
+                                              const HDRDynamicExposureInterface *iface)
+{
+	BufferInfo buffer_info;
+	buffer_info.size = 3 * sizeof(float);
+	buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+	BufferInfo counter_info;
+	counter_info.size = 4;
+	counter_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	AttachmentInfo threshold_info;
+	threshold_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	threshold_info.size_x = 0.5f;
+	threshold_info.size_y = 0.5f;
+	threshold_info.size_class = SizeClass::InputRelative;
+	threshold_info.size_relative_name = input;
+	threshold_info.aux_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	// Mips 0 to 3 replace downsample-0 to downsample-3.
+	// With dynamic exposure, reduce all the way to 1x1 so the last mip holds the average log luminance.
+	constexpr unsigned BloomLevels = 4;
+	auto pyramid_info = threshold_info;
+	pyramid_info.size_x = 0.25f;
+	pyramid_info.size_y = 0.25f;
+	pyramid_info.levels = BloomLevels;
+
+	auto upsample_info0 = threshold_info;
+	auto upsample_info1 = threshold_info;
+	auto upsample_info2 = threshold_info;
+	upsample_info0.size_x = 0.25f;
+	upsample_info0.size_y = 0.25f;
+	upsample_info1.size_x = 0.125f;
+	upsample_info1.size_y = 0.125f;
+	upsample_info2.size_x = 0.0625f;
+	upsample_info2.size_y = 0.0625f;
+
+	auto &bloom_pass = graph.add_pass("bloom-compute", RenderGraph::get_default_compute_queue());
+	// Bloom is the first thing to go when over budget.
+	bloom_pass.set_optional(0);
+	auto &hdr = bloom_pass.add_texture_input(input);
+
+	if (options.dynamic_exposure)
+	{
+		auto dim = graph.get_resource_dimensions(hdr);
+		unsigned max_dim = std::max(std::max(dim.width / 4, dim.height / 4), 1u);
+		pyramid_info.levels = std::min(std::max(Util::floor_log2(max_dim) + 1, BloomLevels), MaxSPDMips);
+	}
+
+	auto &t = bloom_pass.add_storage_texture_output("threshold", threshold_info);
+	auto &pyramid = bloom_pass.add_storage_texture_output("bloom-pyramid", pyramid_info);
+	auto &u0 = bloom_pass.add_storage_texture_output("upsample-0", upsample_info0);
+	auto &u1 = bloom_pass.add_storage_texture_output("upsample-1", upsample_info1);
+	auto &u2 = bloom_pass.add_storage_texture_output("upsample-2", upsample_info2);
+	auto &counter = bloom_pass.add_storage_output("bloom-pyramid-counter", counter_info);
+
+	const RenderBufferResource *lum = nullptr;
+	if (options.dynamic_exposure)
+		lum = &bloom_pass.add_storage_output("average-luminance", buffer_info);
+
+	// SPD has no temporal feedback, so the first upsample filters against its own history instead.
+	auto &feedback = bloom_pass.add_history_input("upsample-2");
+
+	auto state = Util::make_handle<BloomPyramidState>();
+	bloom_pass.set_build_render_pass([&, ubo = lum, state](Vulkan::CommandBuffer &cmd) {
+		auto &pyramid_view = graph.get_physical_texture_resource(pyramid);
+		if (state->image != &pyramid_view.get_image())
+		{
+			state->image = &pyramid_view.get_image();
+			state->views.clear();
+
+			Vulkan::ImageViewCreateInfo info = {};
+			info.image = state->image;
+			info.levels = 1;
+			info.layers = 1;
+			info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+			info.view_type = VK_IMAGE_VIEW_TYPE_2D;
+
+			unsigned num_mips = state->image->get_create_info().levels;
+			VK_ASSERT(num_mips <= MaxSPDMips);
+			for (unsigned i = 0; i < num_mips; i++)
+			{
+				info.base_level = i;
+				state->views.push_back(cmd.get_device().create_image_view(info));
+				state->output_mips[i] = state->views.back().get();
+			}
+		}
+
+		bloom_threshold_build_compute(cmd, graph, t, hdr, ubo);
+		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		vec4 luminance_params(1.0f - pow(0.5f, GRANITE_COMMON_RENDERER_DATA()->frame_tick.frame_time),
+		                      -3.0f, 2.0f, 0.0f);
+
+		SPDInfo info = {};
+		info.input = &graph.get_physical_texture_resource(t);
+		info.output_mips = state->output_mips;
+		info.num_mips = unsigned(state->views.size());
+		info.counter_buffer = &graph.get_physical_buffer_resource(counter);
+		info.counter_buffer_offset = 0;
+		info.num_components = 4;
+		if (ubo)
+		{
+			info.luminance_buffer = &graph.get_physical_buffer_resource(*ubo);
+			info.luminance_params = &luminance_params;
+		}
+		emit_single_pass_downsample(cmd, info);
+		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		bloom_upsample_dispatch(cmd, graph.get_physical_texture_resource(u2), *state->output_mips[BloomLevels - 1],
+		                        graph.get_physical_history_texture_resource(feedback));
+		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		bloom_upsample_build_compute(cmd, graph, u1, u2);
+		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		bloom_upsample_build_compute(cmd, graph, u0, u1);
+	});
+
+	{
+		AttachmentInfo tonemap_info;
+		tonemap_info.flags |= ATTACHMENT_INFO_SUPPORTS_PREROTATE_BIT;
+		tonemap_info.size_class = SizeClass::InputRelative;
+		tonemap_info.size_relative_name = input;
+		auto &tonemap = graph.add_pass("tonemap", RenderGraph::get_default_post_graphics_queue());
+		tonemap.add_color_output(output, tonemap_info);
+		auto &hdr_res = tonemap.add_texture_input(input);
+		auto &bloom_res = tonemap.add_texture_input("upsample-0");
+
+		const RenderBufferResource *ubo_res = nullptr;
+		if (options.dynamic_exposure)
+			ubo_res = &tonemap.add_uniform_input("average-luminance");
+
+		tonemap.set_build_render_pass([&, iface = iface, ubo = ubo_res](Vulkan::CommandBuffer &cmd)
+		                              {
+			                              tonemap_build_render_pass(tonemap, cmd, hdr_res, bloom_res, ubo, iface);
+		                              });
+	}
+}
+
 void setup_hdr_postprocess_compute(RenderGraph &graph, const std::string &input, const std::string &output,
                                    const HDROptions &options,
                                    const HDRDynamicExposureInterface *iface)
 {
+	if (options.single_pass_bloom &&
+	    supports_single_pass_downsample(graph.get_device(), VK_FORMAT_R16G16B16A16_SFLOAT))
+	{
+		setup_hdr_postprocess_single_pass(graph, input, output, options, iface);
+		return;
+	}
+
 	BufferInfo buffer_info;
 	buffer_info.size = 3 * sizeof(float);
 	buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
@@ -328,6 +496,8 @@ void setup_hdr_postprocess_compute(RenderGraph &graph, const std::string &input,
 	downsample_info3.size_y = 0.03125f;
 
 	auto &bloom_pass = graph.add_pass("bloom-compute", RenderGraph::get_default_compute_queue());
+	// Bloom is the first thing to go when over budget.
+	bloom_pass.set_optional(0);
 	// Workaround a cache invalidation driver bug by not aliasing.
 	auto &t = bloom_pass.add_storage_texture_output("threshold", downsample_info);
 	auto &d0 = bloom_pass.add_storage_texture_output("downsample-0", downsample_info0);
@@ -396,6 +566,13 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
                            const HDROptions &options,
                            const HDRDynamicExposureInterface *iface)
 {
+	if (options.single_pass_bloom &&
+	    supports_single_pass_downsample(graph.get_device(), VK_FORMAT_R16G16B16A16_SFLOAT))
+	{
+		setup_hdr_postprocess_single_pass(graph, input, output, options, iface);
+		return;
+	}
+
 	BufferInfo buffer_info;
 	buffer_info.size = 3 * sizeof(float);
 	buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
@@ -35,6 +35,9 @@ struct HDRDynamicExposureInterface
 struct HDROptions
 {
 	bool dynamic_exposure = true;
+	// Builds the bloom downsample chain in one SPD dispatch, with luminance adaptation fused in.
+	// Falls back to the regular chain if SPD is not supported.
+	bool single_pass_bloom = false;
 };
 
 void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const std::string &output,
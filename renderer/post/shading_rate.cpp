@@ -0,0 +1,84 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "shading_rate.hpp"
+#include "math.hpp"
+
+namespace Granite
+{
+bool setup_shading_rate_pass(RenderGraph &graph, const std::string &input_color, const std::string &input_mv,
+                             const std::string &output, const ShadingRateOptions &options)
+{
+	VkExtent2D texel_size;
+	if (!graph.get_device().get_shading_rate_texel_size(&texel_size))
+		return false;
+
+	AttachmentInfo info;
+	info.format = VK_FORMAT_R8_UINT;
+	info.size_class = SizeClass::InputRelative;
+	info.size_relative_name = input_color;
+	info.size_x = 1.0f / float(texel_size.width);
+	info.size_y = 1.0f / float(texel_size.height);
+
+	auto &pass = graph.add_pass(output, RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &rate = pass.add_storage_texture_output(output, info);
+	auto &color = pass.add_history_input(input_color);
+	auto &mv = pass.add_history_input(input_mv);
+
+	pass.set_build_render_pass([&, options](Vulkan::CommandBuffer &cmd) {
+		auto &output_view = graph.get_physical_texture_resource(rate);
+		auto *color_view = graph.get_physical_history_texture_resource(color);
+		auto *mv_view = graph.get_physical_history_texture_resource(mv);
+		bool has_history = color_view && mv_view;
+
+		cmd.set_storage_texture(0, 2, output_view);
+		if (has_history)
+		{
+			cmd.set_texture(0, 0, *color_view, Vulkan::StockSampler::LinearClamp);
+			cmd.set_texture(0, 1, *mv_view, Vulkan::StockSampler::NearestClamp);
+		}
+
+		cmd.set_program("builtin://shaders/post/shading_rate.comp", {{ "HAS_HISTORY", has_history ? 1 : 0 }});
+
+		struct Registers
+		{
+			uvec2 resolution;
+			vec2 inv_resolution;
+			float contrast_threshold;
+			float motion_threshold;
+			uint32_t max_rate_log2;
+		} push;
+
+		push.resolution.x = output_view.get_image().get_width();
+		push.resolution.y = output_view.get_image().get_height();
+		push.inv_resolution.x = 1.0f / float(push.resolution.x);
+		push.inv_resolution.y = 1.0f / float(push.resolution.y);
+		push.contrast_threshold = options.contrast_threshold;
+		push.motion_threshold = options.motion_threshold;
+		push.max_rate_log2 = std::min(options.max_rate_log2, 2u);
+		cmd.push_constants(&push, 0, sizeof(push));
+		cmd.dispatch((push.resolution.x + 7) / 8, (push.resolution.y + 7) / 8, 1);
+	});
+
+	return true;
+}
+}
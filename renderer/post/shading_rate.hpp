@@ -0,0 +1,43 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+#include "render_graph.hpp"
+
+namespace Granite
+{
+struct ShadingRateOptions
+{
+	// Luminance step between neighbouring samples in a tile above which it keeps full rate.
+	float contrast_threshold = 0.02f;
+	// Motion in pixels per frame above which a tile shades one step coarser.
+	float motion_threshold = 4.0f;
+	// Coarsest fragment size as log2, 1 means up to 2x2.
+	unsigned max_rate_log2 = 1;
+};
+
+// Builds a shading rate image for RenderPass::add_shading_rate_input() from last frame's
+// color and motion vectors, so it does not depend on anything rendered this frame.
+// Returns false without adding a pass if the device does not support shading rate attachments.
+bool setup_shading_rate_pass(RenderGraph &graph, const std::string &input_color, const std::string &input_mv,
+                             const std::string &output, const ShadingRateOptions &options = {});
+}
@@ -28,85 +28,6 @@
 
 namespace Granite
 {
-bool supports_single_pass_downsample(Vulkan::Device &device, VkFormat format)
-{
-	auto &features = device.get_device_features();
-
-	bool supports_full_group =
-			device.supports_subgroup_size_log2(true, 2, 7);
-	bool supports_compute = (features.subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0;
-
-	if (device.get_gpu_properties().limits.maxComputeWorkGroupSize[0] < 256)
-		return false;
-	if (!features.enabled_features.shaderStorageImageArrayDynamicIndexing)
-		return false;
-
-	VkFormatProperties3KHR props3 = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3_KHR };
-	device.get_format_properties(format, &props3);
-	if ((props3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_STORAGE_WRITE_WITHOUT_FORMAT_BIT_KHR) == 0)
-		return false;
-	if ((props3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_STORAGE_READ_WITHOUT_FORMAT_BIT_KHR) == 0)
-		return false;
-
-	constexpr VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_QUAD_BIT;
-	bool supports_quad_basic = (features.subgroup_properties.supportedOperations & required) == required;
-	return supports_full_group && supports_compute && supports_quad_basic;
-}
-
-void emit_single_pass_downsample(Vulkan::CommandBuffer &cmd, const SPDInfo &info)
-{
-	cmd.set_program("builtin://shaders/post/ffx-spd/spd.comp",
-	                {{"SUBGROUP", 1},
-	                 {"SINGLE_INPUT_TAP", 1},
-	                 {"COMPONENTS", int(info.num_components)},
-	                 {"FILTER_MOD", int(info.filter_mod != nullptr)},
-	                 {"Z_TRANSFORM", int(info.z_transform != nullptr)}});
-
-	const Vulkan::StockSampler stock = info.z_transform ?
-			Vulkan::StockSampler::NearestClamp : Vulkan::StockSampler::LinearClamp;
-
-	cmd.set_texture(0, 0, *info.input, stock);
-	cmd.set_storage_buffer(0, 1, *info.counter_buffer, info.counter_buffer_offset, 4);
-	for (unsigned i = 0; i < MaxSPDMips; i++)
-		cmd.set_storage_texture(0, 2 + i, *info.output_mips[std::min(i, info.num_mips - 1)]);
-
-	if (info.filter_mod)
-	{
-		memcpy(cmd.allocate_typed_constant_data<vec4>(1, 0, info.num_mips),
-		       info.filter_mod, info.num_mips * sizeof(*info.filter_mod));
-	}
-
-	if (info.z_transform)
-	{
-		memcpy(cmd.allocate_typed_constant_data<mat2>(1, 1, 1),
-		       info.z_transform, sizeof(*info.z_transform));
-	}
-
-	struct Registers
-	{
-		uint32_t base_image_resolution[2];
-		float inv_resolution[2];
-		uint32_t mips;
-		uint32_t num_workgroups;
-	} push = {};
-
-	push.base_image_resolution[0] = info.output_mips[0]->get_view_width();
-	push.base_image_resolution[1] = info.output_mips[0]->get_view_height();
-	push.inv_resolution[0] = 1.0f / float(info.input->get_view_width());
-	push.inv_resolution[1] = 1.0f / float(info.input->get_view_height());
-	push.mips = info.num_mips;
-
-	uint32_t wg_x = (push.base_image_resolution[0] + 31) / 32;
-	uint32_t wg_y = (push.base_image_resolution[1] + 31) / 32;
-	push.num_workgroups = wg_x * wg_y;
-	cmd.push_constants(&push, 0, sizeof(push));
-
-	cmd.enable_subgroup_size_control(true);
-	cmd.set_subgroup_size_log2(true, 2, 7);
-	cmd.dispatch(wg_x, wg_y, 1);
-	cmd.enable_subgroup_size_control(false);
-}
-
 struct SPDPassState : Util::IntrusivePtrEnabled<SPDPassState>
 {
 	RenderTextureResource *otex;
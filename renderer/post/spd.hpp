@@ -20,10 +20,7 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "device.hpp"
-#include "command_buffer.hpp"
-#include "image.hpp"
-#include "math.hpp"
+#include "single_pass_downsample.hpp"
 #include <string>
 
 namespace Granite
@@ -31,23 +28,6 @@ namespace Granite
 class RenderGraph;
 class RenderContext;
 
-bool supports_single_pass_downsample(Vulkan::Device &device, VkFormat format);
-
-struct SPDInfo
-{
-	const Vulkan::ImageView *input;
-	const Vulkan::ImageView **output_mips;
-	unsigned num_mips;
-	const Vulkan::Buffer *counter_buffer;
-	VkDeviceSize counter_buffer_offset;
-	unsigned num_components;
-	const vec4 *filter_mod;
-	const mat2 *z_transform;
-};
-
-static constexpr unsigned MaxSPDMips = 12;
-void emit_single_pass_downsample(Vulkan::CommandBuffer &cmd, const SPDInfo &info);
-
 void setup_depth_hierarchy_pass(RenderGraph &graph, const RenderContext &context,
                                 const std::string &input, const std::string &output);
 }
@@ -44,35 +44,14 @@ struct CACAOState : Util::IntrusivePtrEnabled<CACAOState>
 	std::unique_ptr<FFX_CACAO_GraniteContext, FFX_CACAO_GraniteContext_Destroyer> context;
 };
 
-void setup_ffx_cacao(RenderGraph &graph, const RenderContext &context,
-                     const string &output, const string &input_depth, const string &input_normal)
+struct CACAOTemporalState : Util::IntrusivePtrEnabled<CACAOTemporalState>
 {
-	AttachmentInfo info;
-	info.format = VK_FORMAT_R8_UNORM;
-	info.size_class = SizeClass::InputRelative;
-	info.size_relative_name = input_depth;
-	info.size_x = 1.0f;
-	info.size_y = 1.0f;
-
-	auto ctx = Util::make_handle<CACAOState>();
-
-	auto &ffx = graph.add_pass(output, RENDER_GRAPH_QUEUE_COMPUTE_BIT);
-	ctx->output = &ffx.add_storage_texture_output(output, info);
-	ctx->depth = &ffx.add_texture_input(input_depth);
-	if (!input_normal.empty())
-		ctx->normal = &ffx.add_texture_input(input_normal);
-
-	FFX_CACAO_GraniteContext *ffx_context = nullptr;
-	FFX_CACAO_GraniteCreateInfo granite_info { &graph.get_device() };
-	if (FFX_CACAO_GraniteAllocContext(&ffx_context, &granite_info) != FFX_CACAO_STATUS_OK)
-	{
-		LOGE("Failed to create CACAO context.\n");
-		return;
-	}
-
-	ctx->context.reset(ffx_context);
+	mat4 prev_view_projection;
+};
 
-	const FFX_CACAO_Settings settings = {
+static FFX_CACAO_Settings get_cacao_settings(bool generate_normals)
+{
+	return {
 		/* radius                            */ 0.6f,
 		/* shadowMultiplier                  */ 1.0f,
 		/* shadowPower                       */ 1.50f,
@@ -87,15 +66,39 @@ void setup_ffx_cacao(RenderGraph &graph, const RenderContext &context,
 		/* temporalSupersamplingAngleOffset  */ 0.0f,
 		/* temporalSupersamplingRadiusOffset */ 0.0f,
 		/* detailShadowStrength              */ 0.5f,
-		/* generateNormals                   */ input_normal.empty() ? FFX_CACAO_TRUE : FFX_CACAO_FALSE,
+		/* generateNormals                   */ generate_normals ? FFX_CACAO_TRUE : FFX_CACAO_FALSE,
 		/* bilateralSigmaSquared             */ 5.0f,
 		/* bilateralSimilarityDistanceSigma  */ 0.1f,
 	};
+}
+
+static void add_cacao_pass(RenderGraph &graph, const RenderContext &context,
+                           const string &output, const AttachmentInfo &info,
+                           const string &input_depth, const string &input_normal, bool temporal)
+{
+	auto ctx = Util::make_handle<CACAOState>();
+
+	auto &ffx = graph.add_pass(output, RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	ffx.set_optional(1);
+	ctx->output = &ffx.add_storage_texture_output(output, info);
+	ctx->depth = &ffx.add_texture_input(input_depth);
+	if (!input_normal.empty())
+		ctx->normal = &ffx.add_texture_input(input_normal);
 
-	//settings.generateNormals = FFX_CACAO_TRUE;
+	FFX_CACAO_GraniteContext *ffx_context = nullptr;
+	FFX_CACAO_GraniteCreateInfo granite_info { &graph.get_device() };
+	if (FFX_CACAO_GraniteAllocContext(&ffx_context, &granite_info) != FFX_CACAO_STATUS_OK)
+	{
+		LOGE("Failed to create CACAO context.\n");
+		return;
+	}
+
+	ctx->context.reset(ffx_context);
+
+	auto settings = get_cacao_settings(input_normal.empty());
 	FFX_CACAO_GraniteUpdateSettings(ffx_context, &settings);
 
-	ffx.set_build_render_pass([ctx, &context, &graph](Vulkan::CommandBuffer &cmd) mutable {
+	ffx.set_build_render_pass([ctx, &context, &graph, settings, temporal, phase = 0u](Vulkan::CommandBuffer &cmd) mutable {
 		auto *depth_view = &graph.get_physical_texture_resource(*ctx->depth);
 		auto *normal_view = ctx->normal ? &graph.get_physical_texture_resource(*ctx->normal) : nullptr;
 		auto *output_view = &graph.get_physical_texture_resource(*ctx->output);
@@ -114,6 +117,18 @@ void setup_ffx_cacao(RenderGraph &graph, const RenderContext &context,
 			FFX_CACAO_GraniteInitScreenSizeDependentResources(ctx->context.get(), &ctx->info);
 		}
 
+		if (temporal)
+		{
+			// Rotate and scale the sample pattern each frame so the accumulation
+			// pass converges towards a denser kernel than one frame can afford.
+			static const float angle_offsets[4] = { 0.0f, 0.5f, 0.25f, 0.75f };
+			static const float radius_offsets[4] = { 0.0f, 0.05f, -0.05f, 0.025f };
+			unsigned index = phase++ & 3;
+			settings.temporalSupersamplingAngleOffset = angle_offsets[index] * (0.25f * pi<float>());
+			settings.temporalSupersamplingRadiusOffset = radius_offsets[index];
+			FFX_CACAO_GraniteUpdateSettings(ctx->context.get(), &settings);
+		}
+
 		auto &proj = context.get_render_parameters().projection;
 		auto &normal_to_view = context.get_render_parameters().view;
 
@@ -122,4 +137,164 @@ void setup_ffx_cacao(RenderGraph &graph, const RenderContext &context,
 		                      reinterpret_cast<const FFX_CACAO_Matrix4x4 *>(&normal_to_view));
 	});
 }
+
+static vec4 get_inv_z_transform(const RenderContext &context)
+{
+	auto &inv_projection = context.get_render_parameters().inv_projection;
+	return vec4(inv_projection[2].zw(), inv_projection[3].zw());
+}
+
+static void setup_ffx_cacao_temporal(RenderGraph &graph, const RenderContext &context,
+                                     const string &output, const string &input_depth, float factor)
+{
+	AttachmentInfo depth_info;
+	depth_info.format = VK_FORMAT_R32_SFLOAT;
+	depth_info.size_class = SizeClass::InputRelative;
+	depth_info.size_relative_name = input_depth;
+	depth_info.size_x = 1.0f / factor;
+	depth_info.size_y = 1.0f / factor;
+
+	auto &down = graph.add_pass(output + "-depth-lowres", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &down_depth = down.add_storage_texture_output(output + "-depth-lowres", depth_info);
+	auto &down_input = down.add_texture_input(input_depth);
+	down.set_build_render_pass([&, factor](Vulkan::CommandBuffer &cmd) {
+		auto &output_view = graph.get_physical_texture_resource(down_depth);
+		auto &input_view = graph.get_physical_texture_resource(down_input);
+		cmd.set_texture(0, 0, input_view, Vulkan::StockSampler::NearestClamp);
+		cmd.set_storage_texture(0, 1, output_view);
+		cmd.set_program("builtin://shaders/post/ssao_downsample_depth.comp");
+
+		struct Registers
+		{
+			uvec2 resolution;
+			uvec2 input_resolution;
+			uint32_t factor;
+		} push;
+
+		push.resolution = uvec2(output_view.get_image().get_width(), output_view.get_image().get_height());
+		push.input_resolution = uvec2(input_view.get_image().get_width(), input_view.get_image().get_height());
+		push.factor = uint32_t(factor);
+		cmd.push_constants(&push, 0, sizeof(push));
+		cmd.dispatch((push.resolution.x + 7) / 8, (push.resolution.y + 7) / 8, 1);
+	});
+
+	AttachmentInfo ao_info;
+	ao_info.format = VK_FORMAT_R8_UNORM;
+	ao_info.size_class = SizeClass::InputRelative;
+	ao_info.size_relative_name = output + "-depth-lowres";
+	add_cacao_pass(graph, context, output + "-lowres", ao_info, output + "-depth-lowres", "", true);
+
+	AttachmentInfo temporal_info = ao_info;
+	temporal_info.format = VK_FORMAT_R16_SFLOAT;
+
+	auto state = Util::make_handle<CACAOTemporalState>();
+	auto &temporal = graph.add_pass(output + "-temporal", RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &temporal_output = temporal.add_storage_texture_output(output + "-temporal", temporal_info);
+	auto &temporal_ao = temporal.add_texture_input(output + "-lowres");
+	auto &temporal_depth = temporal.add_texture_input(output + "-depth-lowres");
+	auto &history = temporal.add_history_input(output + "-temporal");
+	auto &history_depth = temporal.add_history_input(output + "-depth-lowres");
+
+	temporal.set_build_render_pass([&, state](Vulkan::CommandBuffer &cmd) {
+		auto &output_view = graph.get_physical_texture_resource(temporal_output);
+		auto *prev = graph.get_physical_history_texture_resource(history);
+		auto *prev_depth = graph.get_physical_history_texture_resource(history_depth);
+		bool has_history = prev && prev_depth;
+		auto &params = context.get_render_parameters();
+
+		cmd.set_texture(0, 0, graph.get_physical_texture_resource(temporal_ao), Vulkan::StockSampler::NearestClamp);
+		cmd.set_texture(0, 1, graph.get_physical_texture_resource(temporal_depth), Vulkan::StockSampler::NearestClamp);
+		if (has_history)
+		{
+			cmd.set_texture(0, 2, *prev, Vulkan::StockSampler::LinearClamp);
+			cmd.set_texture(0, 3, *prev_depth, Vulkan::StockSampler::NearestClamp);
+		}
+		cmd.set_storage_texture(0, 4, output_view);
+		cmd.set_program("builtin://shaders/post/ssao_temporal.comp", {{ "HAS_HISTORY", has_history ? 1 : 0 }});
+
+		struct Registers
+		{
+			mat4 reproj;
+			vec4 inv_z_transform;
+			uvec2 resolution;
+			vec2 inv_resolution;
+		} push;
+
+		push.reproj =
+				translate(vec3(0.5f, 0.5f, 0.0f)) *
+				scale(vec3(0.5f, 0.5f, 1.0f)) *
+				state->prev_view_projection *
+				params.inv_view_projection;
+		push.inv_z_transform = get_inv_z_transform(context);
+		push.resolution = uvec2(output_view.get_image().get_width(), output_view.get_image().get_height());
+		push.inv_resolution = vec2(1.0f) / vec2(push.resolution);
+		cmd.push_constants(&push, 0, sizeof(push));
+		cmd.dispatch((push.resolution.x + 7) / 8, (push.resolution.y + 7) / 8, 1);
+
+		state->prev_view_projection = params.view_projection;
+	});
+
+	AttachmentInfo info;
+	info.format = VK_FORMAT_R8_UNORM;
+	info.size_class = SizeClass::InputRelative;
+	info.size_relative_name = input_depth;
+
+	auto &upsample = graph.add_pass(output, RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+	auto &upsample_output = upsample.add_storage_texture_output(output, info);
+	auto &upsample_ao = upsample.add_texture_input(output + "-temporal");
+	auto &upsample_lowres_depth = upsample.add_texture_input(output + "-depth-lowres");
+	auto &upsample_depth = upsample.add_texture_input(input_depth);
+
+	upsample.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
+		auto &output_view = graph.get_physical_texture_resource(upsample_output);
+		auto &ao_view = graph.get_physical_texture_resource(upsample_ao);
+
+		cmd.set_texture(0, 0, ao_view, Vulkan::StockSampler::NearestClamp);
+		cmd.set_texture(0, 1, graph.get_physical_texture_resource(upsample_lowres_depth), Vulkan::StockSampler::NearestClamp);
+		cmd.set_texture(0, 2, graph.get_physical_texture_resource(upsample_depth), Vulkan::StockSampler::NearestClamp);
+		cmd.set_storage_texture(0, 3, output_view);
+		cmd.set_program("builtin://shaders/post/ssao_upsample.comp");
+
+		struct Registers
+		{
+			vec4 inv_z_transform;
+			uvec2 resolution;
+			vec2 inv_resolution;
+			vec2 lowres_resolution;
+		} push;
+
+		push.inv_z_transform = get_inv_z_transform(context);
+		push.resolution = uvec2(output_view.get_image().get_width(), output_view.get_image().get_height());
+		push.inv_resolution = vec2(1.0f) / vec2(push.resolution);
+		push.lowres_resolution = vec2(float(ao_view.get_image().get_width()), float(ao_view.get_image().get_height()));
+		cmd.push_constants(&push, 0, sizeof(push));
+		cmd.dispatch((push.resolution.x + 7) / 8, (push.resolution.y + 7) / 8, 1);
+	});
+}
+
+void setup_ffx_cacao(RenderGraph &graph, const RenderContext &context,
+                     const string &output, const string &input_depth, const string &input_normal,
+                     AmbientOcclusionTier tier)
+{
+	switch (tier)
+	{
+	case AmbientOcclusionTier::HalfTemporal:
+		setup_ffx_cacao_temporal(graph, context, output, input_depth, 2.0f);
+		break;
+
+	case AmbientOcclusionTier::QuarterTemporal:
+		setup_ffx_cacao_temporal(graph, context, output, input_depth, 4.0f);
+		break;
+
+	default:
+	{
+		AttachmentInfo info;
+		info.format = VK_FORMAT_R8_UNORM;
+		info.size_class = SizeClass::InputRelative;
+		info.size_relative_name = input_depth;
+		add_cacao_pass(graph, context, output, info, input_depth, input_normal, false);
+		break;
+	}
+	}
+}
 }
@@ -26,6 +26,16 @@
 
 namespace Granite
 {
+// Reduced tiers run CACAO on a checkerboard downsampled depth, accumulate the result over frames
+// and upsample bilaterally against full resolution depth. Input normals are only used at Full.
+enum class AmbientOcclusionTier
+{
+	Full,
+	HalfTemporal,
+	QuarterTemporal
+};
+
 void setup_ffx_cacao(RenderGraph &graph, const RenderContext &context,
-                     const std::string &output, const std::string &input_depth, const std::string &input_normal);
-}
\ No newline at end of file
+                     const std::string &output, const std::string &input_depth, const std::string &input_normal,
+                     AmbientOcclusionTier tier = AmbientOcclusionTier::Full);
+}
@@ -222,6 +222,87 @@ void setup_taa_resolve(RenderGraph &graph, TemporalJitter &jitter, float scaling
 	});
 }
 
+void setup_taa_upscale(RenderGraph &graph, TemporalJitter &jitter, float scaling_factor,
+                       const std::string &input, const std::string &input_depth,
+                       const std::string &input_mv, const std::string &output)
+{
+	jitter.init(TemporalJitter::Type::TAA_16Phase,
+	            vec2(graph.get_backbuffer_dimensions().width,
+	                 graph.get_backbuffer_dimensions().height) * scaling_factor);
+
+	AttachmentInfo taa_output;
+	taa_output.size_class = SizeClass::SwapchainRelative;
+	taa_output.format = graph.get_device().image_format_is_supported(VK_FORMAT_B10G11R11_UFLOAT_PACK32,
+	                                                                 VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) ?
+	                    VK_FORMAT_B10G11R11_UFLOAT_PACK32 : VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	AttachmentInfo taa_history = taa_output;
+	taa_history.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	auto &upscale = graph.add_pass("taa-upscale", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+	upscale.add_color_output(output, taa_output);
+	upscale.add_color_output(output + "-history", taa_history);
+	auto &input_res = upscale.add_texture_input(input);
+	auto &input_res_mv = upscale.add_texture_input(input_mv);
+	auto &input_depth_res = upscale.add_texture_input(input_depth);
+	auto &history = upscale.add_history_input(output + "-history");
+	auto &history_depth = upscale.add_history_input(input_depth);
+
+	upscale.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
+		auto &image = graph.get_physical_texture_resource(input_res);
+		auto &image_mv = graph.get_physical_texture_resource(input_res_mv);
+		auto &depth = graph.get_physical_texture_resource(input_depth_res);
+		auto *prev = graph.get_physical_history_texture_resource(history);
+		auto *prev_depth = graph.get_physical_history_texture_resource(history_depth);
+
+		struct Push
+		{
+			mat4 reproj;
+			vec4 rt_metrics;
+			vec4 input_metrics;
+			vec4 inv_z_transform;
+			vec2 jitter_uv;
+			float upscale_ratio;
+		};
+		Push push;
+
+		push.reproj =
+				translate(vec3(0.5f, 0.5f, 0.0f)) *
+				scale(vec3(0.5f, 0.5f, 1.0f)) *
+				jitter.get_history_view_proj(1) *
+				jitter.get_history_inv_view_proj(0);
+
+		float input_width = float(image.get_image().get_create_info().width);
+		float input_height = float(image.get_image().get_create_info().height);
+		push.rt_metrics = vec4(1.0f / cmd.get_viewport().width, 1.0f / cmd.get_viewport().height,
+		                       cmd.get_viewport().width, cmd.get_viewport().height);
+		push.input_metrics = vec4(1.0f / input_width, 1.0f / input_height, input_width, input_height);
+
+		// The jitter only translates X and Y, Z is the same as the unjittered projection.
+		mat4 inv_projection = inverse(jitter.get_jittered_projection());
+		push.inv_z_transform = vec4(inv_projection[2].zw(), inv_projection[3].zw());
+		push.jitter_uv = 0.5f * jitter.get_jitter_matrix()[3].xy();
+		push.upscale_ratio = cmd.get_viewport().width / input_width;
+
+		cmd.push_constants(&push, 0, sizeof(push));
+
+		cmd.set_texture(0, 0, image, Vulkan::StockSampler::LinearClamp);
+		cmd.set_texture(0, 1, depth, Vulkan::StockSampler::NearestClamp);
+		cmd.set_texture(0, 2, image_mv, Vulkan::StockSampler::NearestClamp);
+		bool reproject = prev && prev_depth;
+		if (reproject)
+		{
+			cmd.set_texture(0, 3, *prev, Vulkan::StockSampler::LinearClamp);
+			cmd.set_texture(0, 4, *prev_depth, Vulkan::StockSampler::NearestClamp);
+		}
+
+		Vulkan::CommandBufferUtil::draw_fullscreen_quad(cmd,
+		                                                "builtin://shaders/quad.vert",
+		                                                "builtin://shaders/post/taa_upscale.frag",
+		                                                {{ "REPROJECTION_HISTORY", reproject ? 1 : 0 }});
+	});
+}
+
 void setup_fxaa_2phase_postprocess(RenderGraph &graph, TemporalJitter &jitter, const std::string &input,
                                    const std::string &input_depth, const std::string &output)
 {
@@ -81,4 +81,10 @@ enum class TAAQuality
 void setup_taa_resolve(RenderGraph &graph, TemporalJitter &jitter, float scaling_factor,
                        const std::string &input, const std::string &input_depth, const std::string &input_mv,
                        const std::string &output, TAAQuality quality);
+
+// Like setup_taa_resolve(), but reconstructs to backbuffer resolution from an input
+// rendered at scaling_factor of it. Also needs the depth history to detect disocclusion.
+void setup_taa_upscale(RenderGraph &graph, TemporalJitter &jitter, float scaling_factor,
+                       const std::string &input, const std::string &input_depth, const std::string &input_mv,
+                       const std::string &output);
 }
@@ -187,6 +187,13 @@ struct RenderInfoComponent : ComponentBase
 	// If set, the transform changed last frame and motion vectors will need to be rendered explicitly.
 	bool requires_motion_vectors = false;
 
+	// LOD picked for a frame, indexed by frame parity, see RenderContext::set_lod_selection().
+	// The previous frame's LOD drives hysteresis.
+	mutable uint8_t lod[2] = {};
+
+	// Set by ComputeSkinning if this frame's skinned vertices are already in a buffer.
+	const SkinnedVertexCache *skinned_vertices = nullptr;
+
 	// Can be used to pass non-spatial transform related data to an AbstractRenderable,
 	// e.g. per instance material information.
 	const void *extra_data = nullptr;
@@ -23,6 +23,8 @@
 #include "render_context.hpp"
 #include "post/temporal.hpp"
 #include "muglm/matrix_helper.hpp"
+#include <algorithm>
+#include <assert.h>
 
 using namespace std;
 using namespace Vulkan;
@@ -40,6 +42,31 @@ void RenderContext::set_shadow_cascades(const mat4 cascades[NumShadowCascades])
 		camera.multiview_view_projection[i] = cascades[i];
 }
 
+void RenderContext::set_multiview_cameras(const mat4 *projections, const mat4 *views, unsigned count)
+{
+	count = std::min<unsigned>(count, NumShadowCascades);
+	assert(count != 0);
+
+	vec3 center = vec3(0.0f);
+	for (unsigned i = 0; i < count; i++)
+		center += inverse(views[i])[3].xyz();
+	center /= float(count);
+
+	mat4 center_view = views[0];
+	center_view[3] = vec4(-(views[0] * vec4(center, 0.0f)).xyz(), 1.0f);
+	set_camera(projections[0], center_view);
+
+	mat4 inv_view_projections[NumShadowCascades];
+	for (unsigned i = 0; i < count; i++)
+	{
+		camera.multiview_view_projection[i] = projections[i] * views[i];
+		inv_view_projections[i] = inverse(camera.multiview_view_projection[i]);
+	}
+
+	frustum.build_planes_enclosing(inv_view_projections, count);
+	view_count = count;
+}
+
 void RenderContext::set_motion_vector_projections(const TemporalJitter &jitter)
 {
 	camera.unjittered_view_projection = jitter.get_history_view_proj(0);
@@ -57,6 +84,7 @@ void RenderContext::set_camera(const mat4 &projection, const mat4 &view)
 	camera.projection = projection;
 	camera.view = view;
 	camera.view_projection = camera.projection * view;
+	view_count = 1;
 	camera.inv_projection = inverse(camera.projection);
 	camera.inv_view = inverse(view);
 	camera.inv_view_projection = inverse(camera.view_projection);
@@ -34,6 +34,26 @@
 namespace Granite
 {
 class TemporalJitter;
+class MaterialHeap;
+
+enum MeshletCullingFlagBits
+{
+	MESHLET_CULLING_FRUSTUM_BIT = 1 << 0,
+	MESHLET_CULLING_BACKFACE_BIT = 1 << 1
+};
+using MeshletCullingFlags = uint32_t;
+
+struct LodSelection
+{
+	// Largest simplification error in pixels which is acceptable, 0 always renders the full mesh.
+	float pixel_error = 0.0f;
+	// Height of the viewport in pixels.
+	float viewport_height = 0.0f;
+	// Contexts rendering the same view in a frame must use the same frame index, so they agree on LODs.
+	uint64_t frame_index = 0;
+	// Meshes with an impostor render it instead beyond this distance, 0 disables impostors.
+	float impostor_distance = 0.0f;
+};
 
 class RenderContext
 {
@@ -46,6 +66,18 @@ public:
 	void set_camera(const mat4 &projection, const mat4 &view);
 	void set_camera(const Camera &camera);
 	void set_shadow_cascades(const mat4 cascades[NumShadowCascades]);
+
+	// For rendering up to NumShadowCascades views in one multiview pass, e.g. both eyes of a stereo camera.
+	// Each view gets its own multiview_view_projection. Everything else follows a camera between the views,
+	// with the orientation and projection of the first view, and the visibility frustum encloses all views
+	// so the scene is culled once. Only renderers with Renderer::MULTIVIEW_BIT project per view.
+	void set_multiview_cameras(const mat4 *projections, const mat4 *views, unsigned count);
+
+	// 1 unless set_multiview_cameras() is used.
+	unsigned get_view_count() const
+	{
+		return view_count;
+	}
 	void set_motion_vector_projections(const TemporalJitter &jitter);
 
 	const RenderParameters &get_render_parameters() const
@@ -75,8 +107,59 @@ public:
 
 	void set_device(Vulkan::Device *device);
 
+	// If set, static meshes fetch their materials from the heap instead of binding textures per draw.
+	void set_material_heap(MaterialHeap *heap_)
+	{
+		material_heap = heap_;
+	}
+
+	MaterialHeap *get_material_heap() const
+	{
+		return material_heap;
+	}
+
+	// Static meshes with meshlets skip the meshlets which are culled for this context.
+	// Backface culling must not be used with contexts which render back faces, e.g. for shadows.
+	void set_meshlet_culling(MeshletCullingFlags flags)
+	{
+		meshlet_culling = flags;
+	}
+
+	MeshletCullingFlags get_meshlet_culling() const
+	{
+		return meshlet_culling;
+	}
+
+	// Static meshes with LODs render the coarsest LOD which stays within the pixel error.
+	void set_lod_selection(const LodSelection &selection)
+	{
+		lod_selection = selection;
+	}
+
+	const LodSelection &get_lod_selection() const
+	{
+		return lod_selection;
+	}
+
+	// Transparent renderables are sorted by state like opaque ones so they can be instanced.
+	// Only valid when the transparent renderer composites order independently.
+	void set_order_independent_transparency(bool enable)
+	{
+		order_independent_transparency = enable;
+	}
+
+	bool get_order_independent_transparency() const
+	{
+		return order_independent_transparency;
+	}
+
 private:
 	Vulkan::Device *device = nullptr;
+	MaterialHeap *material_heap = nullptr;
+	MeshletCullingFlags meshlet_culling = 0;
+	unsigned view_count = 1;
+	bool order_independent_transparency = false;
+	LodSelection lod_selection;
 	const Scene *scene = nullptr;
 	const LightingParameters *lighting = nullptr;
 	RenderParameters camera;
@@ -28,6 +28,7 @@
 #include "thread_group.hpp"
 #include "task_composer.hpp"
 #include "vulkan_prerotate.hpp"
+#include "timer.hpp"
 #include <algorithm>
 
 using namespace std;
@@ -350,6 +351,32 @@ RenderTextureResource &RenderPass::add_blit_texture_read_only_input(const std::s
 	return res;
 }
 
+RenderTextureResource &RenderPass::add_shading_rate_input(const std::string &name)
+{
+	auto &res = graph.get_texture_resource(name);
+	res.add_queue(queue);
+	res.read_in_pass(index);
+
+	// Goes through the generic texture path so dependencies and barriers are handled like any other read.
+	AccessedTextureResource acc;
+	acc.texture = &res;
+#ifdef VK_KHR_fragment_shading_rate
+	res.add_image_usage(VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR);
+	acc.layout = VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR;
+	acc.access = VK_ACCESS_FRAGMENT_SHADING_RATE_ATTACHMENT_READ_BIT_KHR;
+	acc.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR;
+#else
+	res.add_image_usage(VK_IMAGE_USAGE_SAMPLED_BIT);
+	acc.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	acc.access = VK_ACCESS_SHADER_READ_BIT;
+	acc.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+#endif
+
+	generic_texture.push_back(acc);
+	shading_rate_input = &res;
+	return res;
+}
+
 RenderTextureResource &RenderPass::add_blit_texture_output(const std::string &name, const AttachmentInfo &info,
                                                            const std::string &input)
 {
@@ -420,10 +447,7 @@ RenderGraph::RenderGraph()
 
 void RenderGraph::on_swapchain_destroyed(const Vulkan::SwapchainParameterEvent &)
 {
-	physical_image_attachments.clear();
-	physical_history_image_attachments.clear();
-	physical_events.clear();
-	physical_history_events.clear();
+	// Keep attachments around, a rebake after a resize will reuse the ones which keep their size.
 }
 
 void RenderGraph::on_swapchain_changed(const Vulkan::SwapchainParameterEvent &)
@@ -437,6 +461,16 @@ void RenderGraph::on_device_created(const Vulkan::DeviceCreatedEvent &)
 void RenderGraph::on_device_destroyed(const Vulkan::DeviceCreatedEvent &)
 {
 	physical_buffers.clear();
+	physical_image_attachments.clear();
+	physical_history_image_attachments.clear();
+	physical_events.clear();
+	physical_history_events.clear();
+	physical_attachments.clear();
+	memory_alias_blocks.clear();
+	physical_memory_alias_chains.clear();
+	physical_image_memory_sizes.clear();
+	memory_alias_blocks_dirty = true;
+	bake_cache = {};
 }
 
 RenderTextureResource &RenderGraph::get_texture_resource(const std::string &name)
@@ -993,7 +1027,7 @@ void RenderGraph::build_transients()
 			dim.flags |= ATTACHMENT_INFO_INTERNAL_TRANSIENT_BIT;
 
 		auto index = unsigned(&dim - physical_dimensions.data());
-		if (physical_image_has_history[index])
+		if (physical_image_has_history[index] || (dim.flags & ATTACHMENT_INFO_PRESERVE_BIT) != 0)
 			dim.flags &= ~ATTACHMENT_INFO_INTERNAL_TRANSIENT_BIT;
 
 		if (Vulkan::format_has_depth_or_stencil_aspect(dim.format) && !Vulkan::ImplementationQuirks::get().use_transient_depth_stencil)
@@ -1156,12 +1190,15 @@ void RenderGraph::build_render_pass_info()
 			{
 				auto res = add_unique_ds(ds_output->get_physical_index());
 				// If this is the first subpass the attachment is used, we need to either clear or discard.
+				// Preserved attachments are loaded instead of discarded.
 				if (res.second && pass.get_clear_depth_stencil())
 				{
 					rp.op_flags |= Vulkan::RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT;
 					physical_pass.depth_clear_request.pass = &pass;
 					physical_pass.depth_clear_request.target = &rp.clear_depth_stencil;
 				}
+				else if (res.second && (physical_dimensions[res.first].flags & ATTACHMENT_INFO_PRESERVE_BIT) != 0)
+					rp.op_flags |= Vulkan::RENDER_PASS_OP_LOAD_DEPTH_STENCIL_BIT;
 
 				rp.op_flags |= Vulkan::RENDER_PASS_OP_STORE_DEPTH_STENCIL_BIT;
 				physical_pass.subpasses[subpass_index].depth_stencil_mode = Vulkan::RenderPassInfo::DepthStencil::ReadWrite;
@@ -1277,6 +1314,10 @@ void RenderGraph::build_physical_passes()
 		if (!Vulkan::ImplementationQuirks::get().merge_subpasses)
 			return false;
 
+		// The shading rate attachment applies to the whole render pass.
+		if (prev.get_shading_rate_input() != next.get_shading_rate_input())
+			return false;
+
 		for (auto *output : prev.get_color_outputs())
 		{
 			// Need to mip-map after this pass, so cannot merge.
@@ -1542,6 +1583,46 @@ void RenderGraph::log()
 			     Vulkan::stage_flags_to_string(barrier.stages).c_str());
 		}
 	}
+
+	log_memory_usage();
+}
+
+void RenderGraph::log_memory_usage() const
+{
+	const auto image_size = [this](unsigned index) -> VkDeviceSize {
+		if (index < physical_aliases.size() && physical_aliases[index] != RenderResource::Unused)
+			index = physical_aliases[index];
+		return index < physical_image_memory_sizes.size() ? physical_image_memory_sizes[index] : 0;
+	};
+
+	VkDeviceSize allocated = 0;
+	unsigned num_images = std::min<unsigned>(physical_image_memory_sizes.size(), physical_dimensions.size());
+	for (unsigned i = 0; i < num_images; i++)
+	{
+		if (physical_aliases[i] == RenderResource::Unused && !physical_image_memory_aliased[i])
+			allocated += physical_image_memory_sizes[i];
+	}
+
+	for (auto &block : memory_alias_blocks)
+		allocated += block->get_allocation().get_size();
+
+	// Nothing has been allocated yet.
+	if (allocated == 0)
+		return;
+
+	VkDeviceSize peak = 0;
+	for (unsigned pass = 0; pass < physical_passes.size(); pass++)
+	{
+		VkDeviceSize live = 0;
+		for (unsigned i = 0; i < physical_lifetimes.size(); i++)
+			if (physical_lifetimes[i].first <= pass && pass <= physical_lifetimes[i].second)
+				live += image_size(i);
+		peak = std::max(peak, live);
+	}
+
+	LOGI("Render graph image memory: %.3f MiB allocated, %.3f MiB peak live, %u memory alias chains.\n",
+	     double(allocated) / (1024.0 * 1024.0), double(peak) / (1024.0 * 1024.0),
+	     unsigned(physical_memory_alias_chains.size()));
 }
 
 void RenderGraph::enqueue_mipmap_requests(Vulkan::CommandBuffer &cmd, const std::vector<MipmapRequests> &requests)
@@ -1725,14 +1806,14 @@ void RenderGraph::build_aliases()
 		if (physical_dimensions[i].buffer_info.size)
 			continue;
 
-		// No aliases for images with history.
-		if (physical_image_has_history[i])
+		// No aliases for images with history or preserved contents.
+		if (physical_image_has_history[i] || (physical_dimensions[i].flags & ATTACHMENT_INFO_PRESERVE_BIT) != 0)
 			continue;
 
 		// Only try to alias with lower-indexed resources, because we allocate them one-by-one starting from index 0.
 		for (unsigned j = 0; j < i; j++)
 		{
-			if (physical_image_has_history[j])
+			if (physical_image_has_history[j] || (physical_dimensions[j].flags & ATTACHMENT_INFO_PRESERVE_BIT) != 0)
 				continue;
 
 			if (physical_dimensions[i] == physical_dimensions[j])
@@ -1781,6 +1862,119 @@ void RenderGraph::build_aliases()
 				physical_passes[pass_range[chain[i]].last_used_pass()].alias_transfer.push_back(make_pair(chain[i], chain[0]));
 		}
 	}
+
+	physical_lifetimes.resize(physical_dimensions.size());
+	for (unsigned i = 0; i < physical_dimensions.size(); i++)
+	{
+		if (pass_range[i].is_used())
+			physical_lifetimes[i] = { pass_range[i].first_used_pass(), pass_range[i].last_used_pass() };
+		else
+			physical_lifetimes[i] = { ~0u, ~0u };
+	}
+
+	// Images which could not alias exactly may still share memory with images of any format or size,
+	// as long as their lifetimes do not overlap.
+	const auto estimate_size = [this](unsigned index) -> VkDeviceSize {
+		auto &dim = physical_dimensions[index];
+		VkDeviceSize size = Vulkan::format_get_layer_size(dim.format, Vulkan::format_to_aspect_mask(dim.format),
+		                                                  dim.width, dim.height, dim.depth);
+		size *= dim.layers * dim.samples;
+		if (dim.levels > 1)
+			size += size / 3;
+		return size;
+	};
+
+	vector<unsigned> memory_alias_candidates;
+	for (unsigned i = 0; i < physical_dimensions.size(); i++)
+	{
+		auto &dim = physical_dimensions[i];
+		auto &range = pass_range[i];
+
+		if (dim.is_buffer_like() || (dim.flags & ATTACHMENT_INFO_INTERNAL_TRANSIENT_BIT) != 0)
+			continue;
+		if (physical_image_has_history[i] || i == swapchain_physical_index)
+			continue;
+		if ((dim.flags & ATTACHMENT_INFO_PRESERVE_BIT) != 0)
+			continue;
+		if (physical_aliases[i] != RenderResource::Unused || !alias_chains[i].empty())
+			continue;
+		if (!range.is_used() || !range.can_alias())
+			continue;
+		if ((dim.queues & (dim.queues - 1)) != 0)
+			continue;
+		// The alias transfer cannot flush pending writes.
+		if (range.has_writer() && (!range.has_reader() || range.last_read_pass <= range.last_write_pass))
+			continue;
+
+		memory_alias_candidates.push_back(i);
+	}
+
+	sort(begin(memory_alias_candidates), end(memory_alias_candidates), [&](unsigned a, unsigned b) {
+		return pass_range[a].first_used_pass() < pass_range[b].first_used_pass();
+	});
+
+	struct MemoryChain
+	{
+		vector<unsigned> members;
+		VkDeviceSize size;
+	};
+	vector<MemoryChain> memory_chains;
+
+	for (auto index : memory_alias_candidates)
+	{
+		auto size = estimate_size(index);
+		MemoryChain *best_chain = nullptr;
+		VkDeviceSize best_delta = ~VkDeviceSize(0);
+
+		for (auto &chain : memory_chains)
+		{
+			unsigned tail = chain.members.back();
+			if (pass_range[tail].last_used_pass() >= pass_range[index].first_used_pass())
+				continue;
+			if (physical_dimensions[tail].queues != physical_dimensions[index].queues)
+				continue;
+
+			auto delta = chain.size > size ? chain.size - size : size - chain.size;
+			if (delta < best_delta)
+			{
+				best_delta = delta;
+				best_chain = &chain;
+			}
+		}
+
+		if (best_chain)
+		{
+			best_chain->members.push_back(index);
+			best_chain->size = std::max(best_chain->size, size);
+		}
+		else
+			memory_chains.push_back({ { index }, size });
+	}
+
+	auto previous_chains = std::move(physical_memory_alias_chains);
+	physical_memory_alias_chains.clear();
+	physical_image_memory_aliased.clear();
+	physical_image_memory_aliased.resize(physical_dimensions.size());
+
+	for (auto &chain : memory_chains)
+	{
+		auto &members = chain.members;
+		if (members.size() < 2)
+			continue;
+
+		// Members are already in order of use.
+		for (unsigned i = 0; i < members.size(); i++)
+		{
+			physical_image_memory_aliased[members[i]] = true;
+			unsigned next = i + 1 < members.size() ? members[i + 1] : members[0];
+			physical_passes[pass_range[members[i]].last_used_pass()].alias_transfer.push_back(make_pair(members[i], next));
+		}
+
+		physical_memory_alias_chains.push_back(std::move(members));
+	}
+
+	if (previous_chains != physical_memory_alias_chains)
+		memory_alias_blocks_dirty = true;
 }
 
 bool RenderGraph::need_invalidate(const Barrier &barrier, const PipelineEvent &event)
@@ -1861,32 +2055,69 @@ void RenderGraph::PassSubmissionState::emit_pre_pass_barriers()
 {
 	cmd->begin_region("render-graph-sync-pre");
 
-	// Submit barriers.
-	if (!semaphore_handover_barriers.empty() || !immediate_image_barriers.empty())
+	// Without real events, everything goes into one batch, flushed as a single barrier before the pass begins.
+	bool emulated_events = cmd->get_device().get_workarounds().emulate_event_as_pipeline_barrier;
+
+	Util::SmallVector<VkImageMemoryBarrier2KHR, 64> combined_images;
+	combined_images.reserve(semaphore_handover_barriers.size() + immediate_image_barriers.size() +
+	                        (emulated_events ? image_barriers.size() : 0));
+	combined_images.insert(combined_images.end(), semaphore_handover_barriers.begin(), semaphore_handover_barriers.end());
+	combined_images.insert(combined_images.end(), immediate_image_barriers.begin(), immediate_image_barriers.end());
+	if (emulated_events)
+		combined_images.insert(combined_images.end(), image_barriers.begin(), image_barriers.end());
+
+	VkDependencyInfoKHR dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR };
+	dep.imageMemoryBarrierCount = uint32_t(combined_images.size());
+	dep.pImageMemoryBarriers = combined_images.data();
+	if (emulated_events)
 	{
-		Util::SmallVector<VkImageMemoryBarrier, 64> combined_barriers;
-		combined_barriers.reserve(semaphore_handover_barriers.size() + immediate_image_barriers.size());
-		combined_barriers.insert(combined_barriers.end(), semaphore_handover_barriers.begin(), semaphore_handover_barriers.end());
-		combined_barriers.insert(combined_barriers.end(), immediate_image_barriers.begin(), immediate_image_barriers.end());
-
-		auto src = handover_stages;
-		auto dst = handover_stages | immediate_dst_stages;
-		if (!src)
-			src = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-		cmd->barrier(src, dst,
-		             0, nullptr, 0, nullptr,
-		             combined_barriers.size(),
-		             combined_barriers.empty() ? nullptr : combined_barriers.data());
+		dep.bufferMemoryBarrierCount = uint32_t(buffer_barriers.size());
+		dep.pBufferMemoryBarriers = buffer_barriers.data();
 	}
 
-	if (!image_barriers.empty() || !buffer_barriers.empty())
+	if (dep.imageMemoryBarrierCount || dep.bufferMemoryBarrierCount)
+		cmd->barrier(dep);
+
+	if (!emulated_events && (!image_barriers.empty() || !buffer_barriers.empty()))
 	{
+		// vkCmdWaitEvents takes one set of stage masks.
+		Util::SmallVector<VkBufferMemoryBarrier> buffers;
+		Util::SmallVector<VkImageMemoryBarrier, 64> images;
+		buffers.reserve(buffer_barriers.size());
+		images.reserve(image_barriers.size());
+
+		for (auto &b : buffer_barriers)
+		{
+			VkBufferMemoryBarrier legacy = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			legacy.srcAccessMask = VkAccessFlags(b.srcAccessMask);
+			legacy.dstAccessMask = VkAccessFlags(b.dstAccessMask);
+			legacy.srcQueueFamilyIndex = b.srcQueueFamilyIndex;
+			legacy.dstQueueFamilyIndex = b.dstQueueFamilyIndex;
+			legacy.buffer = b.buffer;
+			legacy.offset = b.offset;
+			legacy.size = b.size;
+			buffers.push_back(legacy);
+		}
+
+		for (auto &b : image_barriers)
+		{
+			VkImageMemoryBarrier legacy = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+			legacy.srcAccessMask = VkAccessFlags(b.srcAccessMask);
+			legacy.dstAccessMask = VkAccessFlags(b.dstAccessMask);
+			legacy.oldLayout = b.oldLayout;
+			legacy.newLayout = b.newLayout;
+			legacy.srcQueueFamilyIndex = b.srcQueueFamilyIndex;
+			legacy.dstQueueFamilyIndex = b.dstQueueFamilyIndex;
+			legacy.image = b.image;
+			legacy.subresourceRange = b.subresourceRange;
+			images.push_back(legacy);
+		}
+
 		cmd->wait_events(events.size(), events.data(),
 		                 src_stages, dst_stages,
 		                 0, nullptr,
-		                 buffer_barriers.size(), buffer_barriers.empty() ? nullptr : buffer_barriers.data(),
-		                 image_barriers.size(), image_barriers.empty() ? nullptr : image_barriers.data());
+		                 buffers.size(), buffers.empty() ? nullptr : buffers.data(),
+		                 images.size(), images.empty() ? nullptr : images.data());
 	}
 
 	cmd->end_region();
@@ -1999,9 +2230,11 @@ void RenderGraph::physical_pass_handle_invalidate_barrier(const Barrier &barrier
 		{
 			VK_ASSERT(physical_buffers[barrier.resource_index]);
 			auto &buffer = *physical_buffers[barrier.resource_index];
-			VkBufferMemoryBarrier b = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			VkBufferMemoryBarrier2KHR b = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR };
 
+			b.srcStageMask = event.event->get_stages();
 			b.srcAccessMask = event.to_flush_access;
+			b.dstStageMask = barrier.stages;
 			b.dstAccessMask = barrier.access;
 			b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 			b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -2024,7 +2257,7 @@ void RenderGraph::physical_pass_handle_invalidate_barrier(const Barrier &barrier
 			return;
 		}
 
-		VkImageMemoryBarrier b = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		VkImageMemoryBarrier2KHR b = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR };
 		b.oldLayout = event.layout;
 		b.newLayout = barrier.layout;
 		b.srcAccessMask = event.to_flush_access;
@@ -2050,6 +2283,8 @@ void RenderGraph::physical_pass_handle_invalidate_barrier(const Barrier &barrier
 			if (event.event)
 			{
 				// Either we wait for a VkEvent ...
+				b.srcStageMask = event.event->get_stages();
+				b.dstStageMask = barrier.stages;
 				state.image_barriers.push_back(b);
 				need_event_barrier = true;
 			}
@@ -2060,9 +2295,11 @@ void RenderGraph::physical_pass_handle_invalidate_barrier(const Barrier &barrier
 				{
 					// When the semaphore was signalled, caches were flushed, so we don't need to do that again.
 					// We still need dstAccessMask however, because layout changes may perform writes.
+					// Use srcStage = dstStage to hand over without breaking the pipeline.
 					b.srcAccessMask = 0;
+					b.srcStageMask = barrier.stages;
+					b.dstStageMask = barrier.stages;
 					state.semaphore_handover_barriers.push_back(b);
-					state.handover_stages |= barrier.stages;
 				}
 				// If we don't need a layout transition, signalling and waiting for semaphores satisfies
 				// all requirements we have of srcAccessMask/dstAccessMask.
@@ -2071,10 +2308,11 @@ void RenderGraph::physical_pass_handle_invalidate_barrier(const Barrier &barrier
 			else
 			{
 				// ... or vkCmdPipelineBarrier from TOP_OF_PIPE_BIT if this is the first time we use the resource.
+				b.srcStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+				b.dstStageMask = barrier.stages;
 				state.immediate_image_barriers.push_back(b);
 				if (b.oldLayout != VK_IMAGE_LAYOUT_UNDEFINED)
 					throw logic_error("Cannot do immediate image barriers from a layout other than UNDEFINED.");
-				state.immediate_dst_stages |= barrier.stages;
 			}
 		}
 	}
@@ -2188,15 +2426,37 @@ void RenderGraph::physical_pass_enqueue_graphics_commands(const PhysicalPass &ph
 				physical_pass.depth_clear_request.target);
 	}
 
+	// The name is only consumed by timestamps, GPU scopes and performance regions.
+	string name;
+	if (enabled_timestamps || device->get_gpu_scopes_enabled() || device->get_performance_regions_enabled())
+		name = get_physical_pass_name(physical_pass);
+
 	Vulkan::QueryPoolHandle start_graphics, end_graphics;
 	if (enabled_timestamps)
 		start_graphics = cmd.write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+	cmd.begin_gpu_scope(name.c_str());
+	cmd.begin_performance_region(name.c_str());
 
 	VK_ASSERT(physical_pass.layers != ~0u);
 
 	auto rp_info = physical_pass.render_pass_info;
 	unsigned layer_iterations = 1;
 
+	const Vulkan::ImageView *area_view = rp_info.num_color_attachments ?
+	                                     rp_info.color_attachments[0] : rp_info.depth_stencil;
+	if (area_view)
+	{
+		VkRect2D area = { { 0, 0 }, { area_view->get_view_width(), area_view->get_view_height() } };
+		for (auto pass : physical_pass.passes)
+		{
+			if (passes[pass]->get_render_area(&area))
+			{
+				rp_info.render_area = area;
+				break;
+			}
+		}
+	}
+
 	if (physical_pass.layers > 1)
 	{
 		unsigned multiview_count = 0;
@@ -2254,9 +2514,23 @@ void RenderGraph::physical_pass_enqueue_graphics_commands(const PhysicalPass &ph
 			// due to clearing and so on.
 			// This should be an extremely unlikely scenario.
 			// Either you need all subpasses or none.
+			// Timestamps cannot be written in multiview render passes or when recording secondary command buffers.
+			bool subpass_scope = physical_pass.passes.size() > 1 && rp_info.num_layers <= 1 &&
+			                     state.subpass_contents[subpass_index] == VK_SUBPASS_CONTENTS_INLINE;
+
+			if (subpass_scope)
+				cmd.begin_gpu_scope(pass.get_name().c_str());
 			cmd.begin_region(pass.get_name().c_str());
-			pass.build_render_pass(cmd, layer);
+			if (!pass.pruned)
+			{
+				int64_t start_time = telemetry.enabled ? Util::get_current_time_nsecs() : 0;
+				pass.build_render_pass(cmd, layer);
+				if (telemetry.enabled)
+					pass.record_time_ns += Util::get_current_time_nsecs() - start_time;
+			}
 			cmd.end_region();
+			if (subpass_scope)
+				cmd.end_gpu_scope();
 
 			if (&subpass != &physical_pass.passes.back())
 				cmd.next_subpass(state.subpass_contents[subpass_index + 1]);
@@ -2267,21 +2541,11 @@ void RenderGraph::physical_pass_enqueue_graphics_commands(const PhysicalPass &ph
 		cmd.end_region();
 	}
 
+	cmd.end_performance_region();
+	cmd.end_gpu_scope();
 	if (enabled_timestamps)
 	{
 		end_graphics = cmd.write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
-		string name;
-		if (physical_pass.passes.size() == 1)
-			name = passes[physical_pass.passes.front()]->get_name();
-		else
-		{
-			for (auto &pass : physical_pass.passes)
-			{
-				name += passes[pass]->get_name();
-				if (&pass != &physical_pass.passes.back())
-					name += " + ";
-			}
-		}
 		device->register_time_interval("graphics", std::move(start_graphics), std::move(end_graphics), name.c_str());
 	}
 	enqueue_mipmap_requests(cmd, physical_pass.mipmap_requests);
@@ -2296,9 +2560,19 @@ void RenderGraph::physical_pass_enqueue_compute_commands(const PhysicalPass &phy
 	Vulkan::QueryPoolHandle start_ts, end_ts;
 	if (enabled_timestamps)
 		start_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	cmd.begin_gpu_scope(pass.get_name().c_str());
+	cmd.begin_performance_region(pass.get_name().c_str());
 	cmd.begin_region(pass.get_name().c_str());
-	pass.build_render_pass(cmd, 0);
+	if (!pass.pruned)
+	{
+		int64_t start_time = telemetry.enabled ? Util::get_current_time_nsecs() : 0;
+		pass.build_render_pass(cmd, 0);
+		if (telemetry.enabled)
+			pass.record_time_ns += Util::get_current_time_nsecs() - start_time;
+	}
 	cmd.end_region();
+	cmd.end_performance_region();
+	cmd.end_gpu_scope();
 	if (enabled_timestamps)
 	{
 		end_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
@@ -2355,7 +2629,8 @@ void RenderGraph::physical_pass_handle_cpu_timeline(Vulkan::Device &device_,
 	for (auto &pass : physical_pass.passes)
 	{
 		auto &subpass = *passes[pass];
-		subpass.enqueue_prepare_render_pass(composer);
+		if (!subpass.pruned)
+			subpass.enqueue_prepare_render_pass(composer);
 	}
 
 	state.rendering_dependency = composer.get_outgoing_task();
@@ -2508,6 +2783,11 @@ void RenderGraph::enqueue_swapchain_scale_pass(Vulkan::Device &device_)
 
 void RenderGraph::enqueue_render_passes(Vulkan::Device &device_, TaskComposer &composer)
 {
+	if (async_compute.enabled)
+		update_async_compute_timings(device_);
+	if (telemetry.enabled)
+		update_pass_telemetry(device_);
+
 	pass_submission_state.clear();
 	size_t count = physical_passes.size();
 	pass_submission_state.resize(count);
@@ -2602,14 +2882,9 @@ void RenderGraph::setup_physical_image(Vulkan::Device &device_, unsigned attachm
 	}
 
 	bool need_image = true;
+	auto info = get_physical_image_create_info(attachment);
 	VkImageUsageFlags usage = att.image_usage;
-	Vulkan::ImageMiscFlags misc = 0;
-	VkImageCreateFlags flags = 0;
-
-	if ((att.flags & ATTACHMENT_INFO_UNORM_SRGB_ALIAS_BIT) != 0)
-		misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
-	if (att.is_storage_image())
-		flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+	VkImageCreateFlags flags = info.flags;
 
 	if (physical_image_attachments[attachment])
 	{
@@ -2628,31 +2903,6 @@ void RenderGraph::setup_physical_image(Vulkan::Device &device_, unsigned attachm
 
 	if (need_image)
 	{
-		Vulkan::ImageCreateInfo info;
-		info.format = att.format;
-		info.type = att.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
-		info.width = att.width;
-		info.height = att.height;
-		info.depth = att.depth;
-		info.domain = Vulkan::ImageDomain::Physical;
-		info.levels = att.levels;
-		info.layers = att.layers;
-		info.usage = usage;
-		info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-		info.samples = static_cast<VkSampleCountFlagBits>(att.samples);
-		info.flags = flags;
-
-		if (Vulkan::format_has_depth_or_stencil_aspect(info.format))
-			info.usage &= ~VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-		info.misc = misc;
-		if (att.queues & (RENDER_GRAPH_QUEUE_GRAPHICS_BIT | RENDER_GRAPH_QUEUE_COMPUTE_BIT))
-			info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT;
-		if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT)
-			info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
-		if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT)
-			info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT;
-
 		physical_image_attachments[attachment] = device_.create_image(info, nullptr);
 		physical_image_attachments[attachment]->set_surface_transform(att.transform);
 
@@ -2664,13 +2914,168 @@ void RenderGraph::setup_physical_image(Vulkan::Device &device_, unsigned attachm
 			physical_image_attachments[attachment]->set_layout(Vulkan::Layout::General);
 		device_.set_name(*physical_image_attachments[attachment], att.name.c_str());
 		physical_events[attachment] = {};
+		physical_image_memory_sizes[attachment] = physical_image_attachments[attachment]->get_allocation().get_size();
 	}
 
 	physical_attachments[attachment] = &physical_image_attachments[attachment]->get_view();
 }
 
+Vulkan::ImageCreateInfo RenderGraph::get_physical_image_create_info(unsigned attachment) const
+{
+	auto &att = physical_dimensions[attachment];
+
+	Vulkan::ImageCreateInfo info;
+	info.format = att.format;
+	info.type = att.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+	info.width = att.width;
+	info.height = att.height;
+	info.depth = att.depth;
+	info.domain = Vulkan::ImageDomain::Physical;
+	info.levels = att.levels;
+	info.layers = att.layers;
+	info.usage = att.image_usage;
+	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.samples = static_cast<VkSampleCountFlagBits>(att.samples);
+
+	if (att.is_storage_image())
+		info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+
+	if (Vulkan::format_has_depth_or_stencil_aspect(info.format))
+		info.usage &= ~VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+	if ((att.flags & ATTACHMENT_INFO_UNORM_SRGB_ALIAS_BIT) != 0)
+		info.misc |= Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+	if (att.queues & (RENDER_GRAPH_QUEUE_GRAPHICS_BIT | RENDER_GRAPH_QUEUE_COMPUTE_BIT))
+		info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT;
+	if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT)
+		info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
+	if (att.queues & RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT)
+		info.misc |= Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT;
+
+	return info;
+}
+
+void RenderGraph::setup_memory_aliases(Vulkan::Device &device_)
+{
+	memory_alias_blocks_dirty = false;
+
+	// Images bound to the previous blocks own no memory, and cannot outlive them.
+	for (auto &image : physical_image_attachments)
+	{
+		if (image && image->get_create_info().domain == Vulkan::ImageDomain::Physical &&
+		    !image->get_allocation().get_memory())
+		{
+			auto index = unsigned(&image - physical_image_attachments.data());
+			image.reset();
+			physical_events[index] = {};
+		}
+	}
+	memory_alias_blocks.clear();
+
+	struct ChainPlacement
+	{
+		const std::vector<unsigned> *chain;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	struct Block
+	{
+		VkMemoryRequirements reqs;
+		std::vector<ChainPlacement> chains;
+	};
+	std::vector<Block> blocks;
+
+	for (auto &chain : physical_memory_alias_chains)
+	{
+		VkMemoryRequirements chain_reqs = {};
+		chain_reqs.memoryTypeBits = ~0u;
+		chain_reqs.alignment = 1;
+
+		bool valid = true;
+		for (auto index : chain)
+		{
+			VkMemoryRequirements reqs;
+			if (!device_.get_image_memory_requirements(get_physical_image_create_info(index), &reqs))
+			{
+				valid = false;
+				break;
+			}
+
+			physical_image_memory_sizes[index] = reqs.size;
+			chain_reqs.size = std::max(chain_reqs.size, reqs.size);
+			chain_reqs.alignment = std::max(chain_reqs.alignment, reqs.alignment);
+			chain_reqs.memoryTypeBits &= reqs.memoryTypeBits;
+		}
+
+		// Members of chains we cannot place just get their own memory.
+		if (!valid || chain_reqs.memoryTypeBits == 0)
+			continue;
+
+		auto itr = find_if(begin(blocks), end(blocks), [&](const Block &block) {
+			return block.reqs.memoryTypeBits == chain_reqs.memoryTypeBits;
+		});
+
+		if (itr == end(blocks))
+		{
+			blocks.push_back({});
+			itr = blocks.end() - 1;
+			itr->reqs.memoryTypeBits = chain_reqs.memoryTypeBits;
+			itr->reqs.alignment = 1;
+		}
+
+		VkDeviceSize offset = (itr->reqs.size + chain_reqs.alignment - 1) & ~(chain_reqs.alignment - 1);
+		itr->chains.push_back({ &chain, offset, chain_reqs.size });
+		itr->reqs.size = offset + chain_reqs.size;
+		itr->reqs.alignment = std::max(itr->reqs.alignment, chain_reqs.alignment);
+	}
+
+	for (auto &block : blocks)
+	{
+		Vulkan::MemoryAllocateInfo alloc_info;
+		alloc_info.requirements = block.reqs;
+		alloc_info.required_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		alloc_info.mode = Vulkan::AllocationMode::OptimalRenderTarget;
+
+		auto allocation = device_.allocate_memory(alloc_info);
+		if (!allocation)
+		{
+			LOGW("Failed to allocate %.3f MiB for aliased render graph images.\n",
+			     double(block.reqs.size) / (1024.0 * 1024.0));
+			continue;
+		}
+
+		for (auto &placement : block.chains)
+		{
+			auto alias = Vulkan::DeviceAllocation::make_aliased_allocation(
+					allocation->get_allocation(), uint32_t(placement.offset), uint32_t(placement.size));
+			const Vulkan::DeviceAllocation *aliases[] = { &alias };
+
+			for (auto index : *placement.chain)
+			{
+				auto &att = physical_dimensions[index];
+				auto info = get_physical_image_create_info(index);
+				info.memory_aliases = aliases;
+				info.num_memory_aliases = 1;
+
+				auto image = device_.create_image(info, nullptr);
+				if (!image)
+					continue;
+
+				image->set_surface_transform(att.transform);
+				device_.set_name(*image, att.name.c_str());
+				physical_image_attachments[index] = std::move(image);
+				physical_events[index] = {};
+			}
+		}
+
+		memory_alias_blocks.push_back(std::move(allocation));
+	}
+}
+
 void RenderGraph::setup_attachments(Vulkan::Device &device_, Vulkan::ImageView *swapchain)
 {
+	Vulkan::ScopedAllocationTag tag(Vulkan::AllocationTag::RenderGraph);
 	physical_attachments.clear();
 	physical_attachments.resize(physical_dimensions.size());
 
@@ -2682,9 +3087,34 @@ void RenderGraph::setup_attachments(Vulkan::Device &device_, Vulkan::ImageView *
 	physical_history_image_attachments.resize(physical_dimensions.size());
 	physical_events.resize(physical_dimensions.size());
 	physical_history_events.resize(physical_dimensions.size());
+	physical_image_memory_sizes.resize(physical_dimensions.size());
 
 	swapchain_attachment = swapchain;
 
+	// Dimensions may change without changing the chains, e.g. on resize.
+	for (auto &chain : physical_memory_alias_chains)
+	{
+		for (auto index : chain)
+		{
+			auto &image = physical_image_attachments[index];
+			auto &dim = physical_dimensions[index];
+			if (!image ||
+			    image->get_create_info().format != dim.format ||
+			    image->get_create_info().width != dim.width ||
+			    image->get_create_info().height != dim.height ||
+			    image->get_create_info().depth != dim.depth ||
+			    image->get_create_info().levels != dim.levels ||
+			    image->get_create_info().layers != dim.layers ||
+			    image->get_create_info().samples != dim.samples)
+			{
+				memory_alias_blocks_dirty = true;
+			}
+		}
+	}
+
+	if (memory_alias_blocks_dirty)
+		setup_memory_aliases(device_);
+
 	unsigned num_attachments = physical_dimensions.size();
 	for (unsigned i = 0; i < num_attachments; i++)
 	{
@@ -2708,6 +3138,8 @@ void RenderGraph::setup_attachments(Vulkan::Device &device_, Vulkan::ImageView *
 		{
 			if (att.is_storage_image())
 				setup_physical_image(device_, i);
+			else if (physical_image_memory_aliased[i] && physical_image_attachments[i])
+				physical_attachments[i] = &physical_image_attachments[i]->get_view();
 			else if (i == swapchain_physical_index)
 				physical_attachments[i] = swapchain;
 			else if ((att.flags & ATTACHMENT_INFO_INTERNAL_TRANSIENT_BIT) != 0)
@@ -2746,6 +3178,14 @@ void RenderGraph::setup_attachments(Vulkan::Device &device_, Vulkan::ImageView *
 		else
 			physical_pass.render_pass_info.depth_stencil = nullptr;
 
+		// Subpasses only merge if they share the shading rate image.
+		auto *shading_rate = passes[physical_pass.passes.front()]->get_shading_rate_input();
+		VkExtent2D texel_size;
+		if (shading_rate && device_.get_shading_rate_texel_size(&texel_size))
+			physical_pass.render_pass_info.shading_rate = physical_attachments[shading_rate->get_physical_index()];
+		else
+			physical_pass.render_pass_info.shading_rate = nullptr;
+
 		physical_pass.layers = layers;
 	}
 }
@@ -2925,6 +3365,12 @@ void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 			{
 				overlap_factor = ~0u;
 			}
+			else if (async_compute.enabled &&
+			         passes[unscheduled_passes[i]]->get_queue() == RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT)
+			{
+				// Kick async compute as early as possible, so it overlaps with the graphics work scheduled after it.
+				overlap_factor = ~0u - 1;
+			}
 			else
 			{
 				for (auto itr = flattened_passes.rbegin(); itr != flattened_passes.rend(); ++itr)
@@ -2973,14 +3419,9 @@ bool RenderGraph::depends_on_pass(unsigned dst_pass, unsigned src_pass)
 	return false;
 }
 
-void RenderGraph::bake()
+void RenderGraph::build_pass_dependencies()
 {
-	// First, validate that the graph is sane.
-	validate_passes();
-
 	auto itr = resource_to_index.find(backbuffer_source);
-	if (itr == end(resource_to_index))
-		throw logic_error("Backbuffer source does not exist.");
 
 	pass_stack.clear();
 
@@ -3007,6 +3448,11 @@ void RenderGraph::bake()
 
 	reverse(begin(pass_stack), end(pass_stack));
 	filter_passes(pass_stack);
+}
+
+void RenderGraph::bake_topology()
+{
+	build_pass_dependencies();
 
 	// Now, reorder passes to extract better pipelining.
 	reorder_passes(pass_stack);
@@ -3022,6 +3468,46 @@ void RenderGraph::bake()
 
 	// After merging physical passes and resources, if an image resource is only used in a single physical pass, make it transient.
 	build_transients();
+}
+
+void RenderGraph::bake()
+{
+	// First, validate that the graph is sane.
+	validate_passes();
+
+	auto itr = resource_to_index.find(backbuffer_source);
+	if (itr == end(resource_to_index))
+		throw logic_error("Backbuffer source does not exist.");
+
+	if (async_compute.enabled)
+		schedule_async_compute();
+
+	// Passes are recreated after reset(), carry over which ones were pruned.
+	if (telemetry.frame_budget_ms > 0.0)
+	{
+		for (auto &pass : passes)
+		{
+			auto itr = telemetry.timings.find(pass->get_name());
+			pass->pruned = pass->optional && itr != end(telemetry.timings) && itr->second.pruned;
+		}
+	}
+
+	// If nothing but the backbuffer size changed, the topology can be reused as-is,
+	// and so can any attachment whose dimensions end up the same.
+	Util::Hash hash = hash_declarations();
+	bool cache_hit = bake_cache.valid && bake_cache.hash == hash;
+	if (cache_hit)
+		restore_bake_cache();
+	else
+	{
+		physical_image_attachments.clear();
+		physical_history_image_attachments.clear();
+		physical_events.clear();
+		physical_history_events.clear();
+
+		bake_topology();
+		store_bake_cache(hash);
+	}
 
 	// Now that we are done, we can make render passes.
 	build_render_pass_info();
@@ -3087,6 +3573,553 @@ void RenderGraph::bake()
 	// Figure out which images can alias with each other.
 	// Also build virtual "transfer" barriers. These things only copy events over to other physical resources.
 	build_aliases();
+
+	if (cache_hit)
+		drop_stale_history_attachments();
+}
+
+void RenderGraph::enable_async_compute_scheduling(bool enable, double min_overlap_ms)
+{
+	async_compute.enabled = enable;
+	async_compute.min_overlap_ms = min_overlap_ms;
+	async_compute.stale = false;
+	if (!enable)
+		async_compute.passes.clear();
+}
+
+bool RenderGraph::async_compute_schedule_is_stale() const
+{
+	return async_compute.stale;
+}
+
+void RenderGraph::enable_pass_telemetry(bool enable)
+{
+	telemetry.enabled = enable;
+	if (!enable)
+	{
+		telemetry.frame_budget_ms = 0.0;
+		for (auto &pass : passes)
+			pass->pruned = false;
+	}
+}
+
+void RenderGraph::set_frame_time_budget(double budget_ms)
+{
+	telemetry.frame_budget_ms = budget_ms;
+	if (budget_ms > 0.0)
+		telemetry.enabled = true;
+	else
+		for (auto &pass : passes)
+			pass->pruned = false;
+}
+
+bool RenderGraph::get_pass_timing(const std::string &name, PassTiming *timing) const
+{
+	auto itr = telemetry.timings.find(name);
+	if (itr == end(telemetry.timings))
+		return false;
+	*timing = itr->second;
+	return true;
+}
+
+void RenderGraph::get_pass_timings(std::vector<std::pair<std::string, PassTiming>> &timings) const
+{
+	timings.clear();
+	timings.reserve(telemetry.timings.size());
+	for (auto &timing : telemetry.timings)
+		timings.emplace_back(timing.first, timing.second);
+}
+
+std::string RenderGraph::get_physical_pass_name(const PhysicalPass &physical_pass) const
+{
+	string name;
+	if (physical_pass.passes.size() == 1)
+		name = passes[physical_pass.passes.front()]->get_name();
+	else
+	{
+		for (auto &pass : physical_pass.passes)
+		{
+			name += passes[pass]->get_name();
+			if (&pass != &physical_pass.passes.back())
+				name += " + ";
+		}
+	}
+	return name;
+}
+
+void RenderGraph::update_pass_telemetry(Vulkan::Device &device_)
+{
+	if (!device_.get_gpu_scopes_enabled())
+		device_.set_gpu_scopes_enabled(true);
+
+	device_.get_gpu_scope_events(telemetry.events);
+	telemetry.scope_times.clear();
+	for (auto &event : telemetry.events)
+		telemetry.scope_times[event.name] += event.statistics.avg_ms;
+
+	for (auto &physical_pass : physical_passes)
+	{
+		// Merged render passes only get per-subpass scopes in some cases, otherwise split the total evenly.
+		double split_gpu_ms = 0.0;
+		if (physical_pass.passes.size() > 1)
+		{
+			auto itr = telemetry.scope_times.find(get_physical_pass_name(physical_pass));
+			if (itr != end(telemetry.scope_times))
+				split_gpu_ms = itr->second / double(physical_pass.passes.size());
+		}
+
+		for (auto pass_index : physical_pass.passes)
+		{
+			auto &pass = *passes[pass_index];
+			auto &timing = telemetry.timings[pass.get_name()];
+			timing.pruned = pass.pruned;
+
+			// Pruned passes keep the cost they had when they last ran.
+			if (pass.pruned)
+				continue;
+
+			auto itr = telemetry.scope_times.find(pass.get_name());
+			if (itr != end(telemetry.scope_times))
+				timing.gpu_ms = itr->second;
+			else if (split_gpu_ms != 0.0)
+				timing.gpu_ms = split_gpu_ms;
+
+			double cpu_ms = 1e-6 * double(pass.record_time_ns);
+			timing.cpu_ms = timing.cpu_ms != 0.0 ? (0.9 * timing.cpu_ms + 0.1 * cpu_ms) : cpu_ms;
+			pass.record_time_ns = 0;
+		}
+	}
+
+	// Give the rolling statistics time to settle before deciding again.
+	if (telemetry.frame_budget_ms > 0.0 && ++telemetry.frames_since_update >= 32)
+	{
+		telemetry.frames_since_update = 0;
+		prune_optional_passes();
+	}
+}
+
+void RenderGraph::prune_optional_passes()
+{
+	double cpu_ms = 0.0;
+	double gpu_ms = 0.0;
+	vector<RenderPass *> optional_passes;
+
+	for (auto &physical_pass : physical_passes)
+	{
+		for (auto pass_index : physical_pass.passes)
+		{
+			auto &pass = *passes[pass_index];
+			if (pass.optional)
+				optional_passes.push_back(&pass);
+			if (pass.pruned)
+				continue;
+
+			auto &timing = telemetry.timings[pass.get_name()];
+			cpu_ms += timing.cpu_ms;
+			gpu_ms += timing.gpu_ms;
+		}
+	}
+
+	// Lowest priority first, costliest first among equals.
+	sort(begin(optional_passes), end(optional_passes), [this](const RenderPass *a, const RenderPass *b) {
+		if (a->optional_priority != b->optional_priority)
+			return a->optional_priority < b->optional_priority;
+		auto &timing_a = telemetry.timings[a->get_name()];
+		auto &timing_b = telemetry.timings[b->get_name()];
+		return std::max(timing_a.cpu_ms, timing_a.gpu_ms) > std::max(timing_b.cpu_ms, timing_b.gpu_ms);
+	});
+
+	double budget = telemetry.frame_budget_ms;
+	if (std::max(cpu_ms, gpu_ms) > budget)
+	{
+		for (auto *pass : optional_passes)
+		{
+			if (std::max(cpu_ms, gpu_ms) <= budget)
+				break;
+			if (pass->pruned)
+				continue;
+
+			auto &timing = telemetry.timings[pass->get_name()];
+			cpu_ms -= timing.cpu_ms;
+			gpu_ms -= timing.gpu_ms;
+			pass->pruned = true;
+			LOGI("Render graph over budget, pruning pass %s (%.3f ms).\n",
+			     pass->get_name().c_str(), std::max(timing.cpu_ms, timing.gpu_ms));
+		}
+	}
+	else
+	{
+		// Restore from the highest priority, and leave some headroom so we do not oscillate.
+		for (auto itr = optional_passes.rbegin(); itr != optional_passes.rend(); ++itr)
+		{
+			auto *pass = *itr;
+			if (!pass->pruned)
+				continue;
+
+			auto &timing = telemetry.timings[pass->get_name()];
+			if (std::max(cpu_ms + timing.cpu_ms, gpu_ms + timing.gpu_ms) > 0.9 * budget)
+				break;
+
+			cpu_ms += timing.cpu_ms;
+			gpu_ms += timing.gpu_ms;
+			pass->pruned = false;
+			LOGI("Render graph has headroom, restoring pass %s.\n", pass->get_name().c_str());
+		}
+	}
+}
+
+void RenderGraph::compute_async_compute_schedule(std::unordered_set<std::string> &schedule)
+{
+	schedule.clear();
+
+	const auto get_pass_time = [this](const RenderPass &pass) -> double {
+		auto itr = async_compute.pass_timings.find(pass.get_name());
+		return itr != end(async_compute.pass_timings) ? itr->second : 0.0;
+	};
+
+	for (auto compute_pass : pass_stack)
+	{
+		auto &pass = *passes[compute_pass];
+		bool eligible = pass.get_queue() == RENDER_GRAPH_QUEUE_COMPUTE_BIT ||
+		                (pass.get_queue() == RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT &&
+		                 async_compute.passes.count(pass.get_name()) != 0);
+		if (!eligible)
+			continue;
+
+		double compute_ms = get_pass_time(pass);
+		if (compute_ms < async_compute.min_overlap_ms)
+			continue;
+
+		// Graphics work which neither feeds into nor consumes this pass can run alongside it.
+		double overlap_ms = 0.0;
+		for (auto graphics_pass : pass_stack)
+		{
+			auto &other = *passes[graphics_pass];
+			if ((other.get_queue() & compute_queues) != 0)
+				continue;
+			if (depends_on_pass(graphics_pass, compute_pass) || depends_on_pass(compute_pass, graphics_pass))
+				continue;
+			overlap_ms += get_pass_time(other);
+		}
+
+		if (overlap_ms >= async_compute.min_overlap_ms)
+			schedule.insert(pass.get_name());
+	}
+}
+
+void RenderGraph::rebuild_resource_queues()
+{
+	for (auto &resource : resources)
+		resource->clear_queues();
+
+	for (auto &pass_ptr : passes)
+	{
+		auto &pass = *pass_ptr;
+		auto queue = pass.get_queue();
+
+		const auto add = [queue](RenderResource *resource) {
+			if (resource)
+				resource->add_queue(queue);
+		};
+
+		const auto add_list = [&](const auto &list) {
+			for (auto *resource : list)
+				add(resource);
+		};
+
+		add_list(pass.get_color_outputs());
+		add_list(pass.get_resolve_outputs());
+		add_list(pass.get_color_inputs());
+		add_list(pass.get_color_scale_inputs());
+		add_list(pass.get_storage_texture_outputs());
+		add_list(pass.get_storage_texture_inputs());
+		add_list(pass.get_blit_texture_inputs());
+		add_list(pass.get_blit_texture_outputs());
+		add_list(pass.get_attachment_inputs());
+		add_list(pass.get_history_inputs());
+		add_list(pass.get_storage_inputs());
+		add_list(pass.get_storage_outputs());
+		add_list(pass.get_transfer_outputs());
+		add(pass.get_depth_stencil_input());
+		add(pass.get_depth_stencil_output());
+
+		for (auto &input : pass.get_generic_texture_inputs())
+			add(input.texture);
+		for (auto &input : pass.get_generic_buffer_inputs())
+			add(input.buffer);
+		for (auto &input : pass.get_proxy_inputs())
+			add(input.proxy);
+		for (auto &output : pass.get_proxy_outputs())
+			add(output.proxy);
+		for (auto &alias : pass.get_fake_resource_aliases())
+			add(alias.second);
+	}
+}
+
+void RenderGraph::schedule_async_compute()
+{
+	// Nothing to overlap with unless async compute is a separate queue.
+	if (!device || Vulkan::ImplementationQuirks::get().render_graph_force_single_queue)
+	{
+		async_compute.passes.clear();
+		return;
+	}
+
+	auto &queue_info = device->get_queue_info();
+	if (queue_info.queues[Vulkan::QUEUE_INDEX_GRAPHICS] == queue_info.queues[Vulkan::QUEUE_INDEX_COMPUTE])
+	{
+		async_compute.passes.clear();
+		return;
+	}
+
+	build_pass_dependencies();
+
+	std::unordered_set<std::string> schedule;
+	compute_async_compute_schedule(schedule);
+	async_compute.passes = std::move(schedule);
+	async_compute.stale = false;
+
+	bool moved = false;
+	for (auto &pass : passes)
+	{
+		if (pass->get_queue() == RENDER_GRAPH_QUEUE_COMPUTE_BIT && async_compute.passes.count(pass->get_name()))
+		{
+			pass->set_queue(RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT);
+			moved = true;
+		}
+	}
+
+	if (moved)
+		rebuild_resource_queues();
+}
+
+void RenderGraph::update_async_compute_timings(Vulkan::Device &device_)
+{
+	if (!device_.get_gpu_scopes_enabled())
+		device_.set_gpu_scopes_enabled(true);
+
+	device_.get_gpu_scope_events(async_compute.events);
+	for (auto &event : async_compute.events)
+		if (event.depth <= 1)
+			async_compute.pass_timings[event.name] = event.statistics.avg_ms;
+
+	auto &queue_info = device_.get_queue_info();
+	if (Vulkan::ImplementationQuirks::get().render_graph_force_single_queue ||
+	    queue_info.queues[Vulkan::QUEUE_INDEX_GRAPHICS] == queue_info.queues[Vulkan::QUEUE_INDEX_COMPUTE])
+	{
+		return;
+	}
+
+	// Re-evaluating the schedule walks the dependency graph, so only do it every so often.
+	if (async_compute.stale || ++async_compute.frames_since_update < 64)
+		return;
+	async_compute.frames_since_update = 0;
+
+	std::unordered_set<std::string> schedule;
+	compute_async_compute_schedule(schedule);
+	async_compute.stale = schedule != async_compute.passes;
+}
+
+Util::Hash RenderGraph::hash_declarations() const
+{
+	Util::Hasher h;
+
+	h.string(backbuffer_source);
+	h.u32(swapchain_dimensions.format);
+	h.u32(swapchain_dimensions.transform);
+	h.u32(swapchain_dimensions.flags);
+
+	auto &quirks = Vulkan::ImplementationQuirks::get();
+	h.u32(quirks.merge_subpasses);
+	h.u32(quirks.use_transient_color);
+	h.u32(quirks.use_transient_depth_stencil);
+
+	for (auto &resource : resources)
+	{
+		h.u32(uint32_t(resource->get_type()));
+		h.string(resource->get_name());
+		h.u32(resource->get_used_queues());
+
+		if (resource->get_type() == RenderResource::Type::Texture)
+		{
+			auto &tex = static_cast<const RenderTextureResource &>(*resource);
+			auto &info = tex.get_attachment_info();
+			h.u32(uint32_t(info.size_class));
+			h.f32(info.size_x);
+			h.f32(info.size_y);
+			h.f32(info.size_z);
+			h.u32(info.format);
+			h.string(info.size_relative_name);
+			h.u32(info.samples);
+			h.u32(info.levels);
+			h.u32(info.layers);
+			h.u32(info.aux_usage);
+			h.u32(info.flags);
+			h.u32(tex.get_image_usage());
+			h.u32(tex.get_transient_state());
+			// Subpass merging depends on whether mipmaps have to be generated.
+			h.u32(get_resource_dimensions(tex).levels > 1);
+		}
+		else if (resource->get_type() == RenderResource::Type::Buffer)
+		{
+			auto &buf = static_cast<const RenderBufferResource &>(*resource);
+			auto &info = buf.get_buffer_info();
+			h.u64(info.size);
+			h.u32(info.usage);
+			h.u32(info.flags);
+			h.u32(buf.get_buffer_usage());
+		}
+	}
+
+	const auto hash_resource = [&](const RenderResource *resource) {
+		h.u32(resource ? resource->get_index() : RenderResource::Unused);
+	};
+
+	const auto hash_resources = [&](const auto &list) {
+		h.u32(uint32_t(list.size()));
+		for (auto *resource : list)
+			hash_resource(resource);
+	};
+
+	const auto hash_accessed = [&](const RenderPass::AccessedResource &access) {
+		h.u32(access.stages);
+		h.u32(access.access);
+		h.u32(access.layout);
+	};
+
+	for (auto &pass : passes)
+	{
+		h.string(pass->get_name());
+		h.u32(pass->get_queue());
+
+		hash_resources(pass->get_color_outputs());
+		hash_resources(pass->get_resolve_outputs());
+		hash_resources(pass->get_color_inputs());
+		hash_resources(pass->get_color_scale_inputs());
+		hash_resources(pass->get_storage_texture_outputs());
+		hash_resources(pass->get_storage_texture_inputs());
+		hash_resources(pass->get_blit_texture_inputs());
+		hash_resources(pass->get_blit_texture_outputs());
+		hash_resources(pass->get_attachment_inputs());
+		hash_resources(pass->get_history_inputs());
+		hash_resources(pass->get_storage_inputs());
+		hash_resources(pass->get_storage_outputs());
+		hash_resources(pass->get_transfer_outputs());
+		hash_resource(pass->get_depth_stencil_input());
+		hash_resource(pass->get_depth_stencil_output());
+		hash_resource(pass->get_shading_rate_input());
+
+		for (auto &input : pass->get_generic_texture_inputs())
+		{
+			hash_resource(input.texture);
+			hash_accessed(input);
+		}
+
+		for (auto &input : pass->get_generic_buffer_inputs())
+		{
+			hash_resource(input.buffer);
+			hash_accessed(input);
+		}
+
+		for (auto &input : pass->get_proxy_inputs())
+		{
+			hash_resource(input.proxy);
+			hash_accessed(input);
+		}
+
+		for (auto &output : pass->get_proxy_outputs())
+		{
+			hash_resource(output.proxy);
+			hash_accessed(output);
+		}
+
+		for (auto &alias : pass->get_fake_resource_aliases())
+		{
+			hash_resource(alias.first);
+			hash_resource(alias.second);
+		}
+
+		for (auto &iface : pass->get_lock_interfaces())
+			h.u32(iface.stages);
+	}
+
+	return h.get();
+}
+
+void RenderGraph::store_bake_cache(Util::Hash hash)
+{
+	bake_cache.hash = hash;
+	bake_cache.valid = true;
+	bake_cache.pass_stack = pass_stack;
+
+	bake_cache.physical_passes.clear();
+	bake_cache.physical_passes.reserve(physical_passes.size());
+	for (auto &physical_pass : physical_passes)
+		bake_cache.physical_passes.push_back(physical_pass.passes);
+
+	bake_cache.resource_physical_indices.clear();
+	bake_cache.resource_physical_indices.reserve(resources.size());
+	for (auto &resource : resources)
+		bake_cache.resource_physical_indices.push_back(resource->get_physical_index());
+
+	bake_cache.physical_dimensions = physical_dimensions;
+	bake_cache.physical_image_has_history = physical_image_has_history;
+}
+
+void RenderGraph::restore_bake_cache()
+{
+	pass_stack = bake_cache.pass_stack;
+
+	for (auto &resource : resources)
+		resource->set_physical_index(bake_cache.resource_physical_indices[resource->get_index()]);
+
+	physical_passes.clear();
+	physical_passes.resize(bake_cache.physical_passes.size());
+	for (unsigned i = 0; i < physical_passes.size(); i++)
+	{
+		physical_passes[i].passes = bake_cache.physical_passes[i];
+		for (auto &pass : physical_passes[i].passes)
+			passes[pass]->set_physical_pass_index(i);
+	}
+
+	physical_dimensions = bake_cache.physical_dimensions;
+	physical_image_has_history = bake_cache.physical_image_has_history;
+
+	// Only sizes can differ from the cached bake.
+	for (auto &resource : resources)
+	{
+		unsigned physical_index = resource->get_physical_index();
+		if (physical_index == RenderResource::Unused || resource->get_type() != RenderResource::Type::Texture)
+			continue;
+
+		auto dim = get_resource_dimensions(static_cast<const RenderTextureResource &>(*resource));
+		auto &physical_dim = physical_dimensions[physical_index];
+		physical_dim.width = dim.width;
+		physical_dim.height = dim.height;
+		physical_dim.depth = dim.depth;
+		physical_dim.levels = dim.levels;
+		physical_dim.transform = dim.transform;
+	}
+}
+
+void RenderGraph::drop_stale_history_attachments()
+{
+	// History from before a resize cannot be sampled as-is, so treat it like the first frame.
+	unsigned count = std::min<unsigned>(physical_history_image_attachments.size(), physical_dimensions.size());
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &history = physical_history_image_attachments[i];
+		if (!history)
+			continue;
+
+		auto &create_info = history->get_create_info();
+		auto &dim = physical_dimensions[i];
+		if (create_info.width != dim.width || create_info.height != dim.height || create_info.depth != dim.depth)
+		{
+			history.reset();
+			physical_history_events[i] = {};
+		}
+	}
 }
 
 ResourceDimensions RenderGraph::get_resource_dimensions(const RenderBufferResource &resource) const
@@ -3320,7 +4353,8 @@ void RenderGraph::build_physical_barriers()
 					}
 
 					// We're not reading the resource in this pass, so we might as well transition from UNDEFINED to discard the resource.
-					physical_pass.discards.push_back(flush.resource_index);
+					if ((physical_dimensions[flush.resource_index].flags & ATTACHMENT_INFO_PRESERVE_BIT) == 0)
+						physical_pass.discards.push_back(flush.resource_index);
 				}
 			}
 		}
@@ -3757,10 +4791,9 @@ void RenderGraph::reset()
 	physical_dimensions.clear();
 	physical_attachments.clear();
 	physical_buffers.clear();
-	physical_image_attachments.clear();
-	physical_events.clear();
-	physical_history_events.clear();
-	physical_history_image_attachments.clear();
+
+	// Attachments and their events are kept until the next bake,
+	// which can reuse them if the declared graph turns out to be the same.
 }
 
 }
@@ -32,6 +32,7 @@
 #include "vulkan_headers.hpp"
 #include "device.hpp"
 #include "small_vector.hpp"
+#include "hash.hpp"
 #include "stack_allocator.hpp"
 #include "application_wsi_events.hpp"
 #include "quirks.hpp"
@@ -101,7 +102,10 @@ enum AttachmentInfoFlagBits
 	ATTACHMENT_INFO_PERSISTENT_BIT = 1 << 0,
 	ATTACHMENT_INFO_UNORM_SRGB_ALIAS_BIT = 1 << 1,
 	ATTACHMENT_INFO_SUPPORTS_PREROTATE_BIT = 1 << 2,
-	ATTACHMENT_INFO_MIPGEN_BIT = 1 << 3
+	ATTACHMENT_INFO_MIPGEN_BIT = 1 << 3,
+	// Contents are kept from one frame to the next. A depth output which is not cleared is loaded.
+	// Never aliased or transient.
+	ATTACHMENT_INFO_PRESERVE_BIT = 1 << 4
 };
 
 enum AttachmentInfoInternalFlagBits
@@ -292,6 +296,11 @@ public:
 		used_queues |= queue;
 	}
 
+	void clear_queues()
+	{
+		used_queues = 0;
+	}
+
 	RenderGraphQueueFlags get_used_queues() const
 	{
 		return used_queues;
@@ -454,6 +463,9 @@ public:
 	RenderTextureResource &add_texture_input(const std::string &name,
 	                                         VkPipelineStageFlags stages = 0);
 	RenderTextureResource &add_blit_texture_read_only_input(const std::string &name);
+	// R8_UINT fragment shading rate image, one texel per Device::get_shading_rate_texel_size().
+	// Ignored if the device does not support shading rate attachments. See setup_shading_rate_pass().
+	RenderTextureResource &add_shading_rate_input(const std::string &name);
 	RenderBufferResource &add_uniform_input(const std::string &name,
 	                                        VkPipelineStageFlags stages = 0);
 	RenderBufferResource &add_storage_read_only_input(const std::string &name,
@@ -569,6 +581,11 @@ public:
 		return fake_resource_alias;
 	}
 
+	RenderTextureResource *get_shading_rate_input() const
+	{
+		return shading_rate_input;
+	}
+
 	RenderTextureResource *get_depth_stencil_input() const
 	{
 		return depth_stencil_input;
@@ -633,6 +650,15 @@ public:
 			return false;
 	}
 
+	// area holds the full framebuffer area on input.
+	bool get_render_area(VkRect2D *area) const
+	{
+		if (get_render_area_cb)
+			return get_render_area_cb(area);
+		else
+			return false;
+	}
+
 	void enqueue_prepare_render_pass(TaskComposer &composer)
 	{
 		if (render_pass_handle)
@@ -672,6 +698,14 @@ public:
 		get_clear_color_cb = std::move(func);
 	}
 
+	// Restricts rendering to a sub-rectangle of the attachments, queried every frame.
+	// Lets the render area change without baking the graph again.
+	// For merged render passes, the first subpass which returns true decides.
+	void set_get_render_area(std::function<bool (VkRect2D *)> func)
+	{
+		get_render_area_cb = std::move(func);
+	}
+
 	void set_name(const std::string &name)
 	{
 		pass_name = name;
@@ -687,16 +721,54 @@ public:
 		return lock_interfaces;
 	}
 
+	// Optional passes may be skipped while the graph is over its frame time budget, lowest priority first.
+	// A skipped pass keeps its barriers and load/clear ops, so readers see cleared or previous contents.
+	void set_optional(unsigned priority)
+	{
+		optional = true;
+		optional_priority = priority;
+	}
+
+	bool is_optional() const
+	{
+		return optional;
+	}
+
+	unsigned get_optional_priority() const
+	{
+		return optional_priority;
+	}
+
+	bool is_pruned() const
+	{
+		return pruned;
+	}
+
 private:
+	friend class RenderGraph;
+
 	RenderGraph &graph;
 	unsigned index;
 	unsigned physical_pass = Unused;
 	RenderGraphQueueFlagBits queue;
 
+	// Only used by async compute scheduling, which rebuilds resource queues afterwards.
+	void set_queue(RenderGraphQueueFlagBits queue_)
+	{
+		queue = queue_;
+	}
+
+	bool optional = false;
+	unsigned optional_priority = 0;
+	bool pruned = false;
+	// Written by whichever thread records the pass, collected by the graph next frame.
+	int64_t record_time_ns = 0;
+
 	RenderPassInterfaceHandle render_pass_handle;
 	std::function<void (Vulkan::CommandBuffer &)> build_render_pass_cb;
 	std::function<bool (VkClearDepthStencilValue *)> get_clear_depth_stencil_cb;
 	std::function<bool (unsigned, VkClearColorValue *)> get_clear_color_cb;
+	std::function<bool (VkRect2D *)> get_render_area_cb;
 
 	std::vector<RenderTextureResource *> color_outputs;
 	std::vector<RenderTextureResource *> resolve_outputs;
@@ -717,6 +789,7 @@ private:
 	std::vector<AccessedProxyResource> proxy_outputs;
 	std::vector<AccessedExternalLockInterface> lock_interfaces;
 	RenderTextureResource *depth_stencil_input = nullptr;
+	RenderTextureResource *shading_rate_input = nullptr;
 	RenderTextureResource *depth_stencil_output = nullptr;
 
 	std::vector<std::pair<RenderTextureResource *, RenderTextureResource *>> fake_resource_alias;
@@ -765,6 +838,30 @@ public:
 
 	void enable_timestamps(bool enable);
 
+	// Moves compute passes over to async compute if previous frames show they can overlap with at least
+	// min_overlap_ms of independent graphics work, and schedules them as early as possible.
+	// Timings come from GPU scopes, which get enabled on the device. The schedule is decided in bake(),
+	// so rebuild the graph when async_compute_schedule_is_stale() starts returning true.
+	void enable_async_compute_scheduling(bool enable, double min_overlap_ms = 0.1);
+	bool async_compute_schedule_is_stale() const;
+
+	// Per-pass CPU recording time and GPU time, smoothed over previous frames.
+	// GPU time comes from GPU scopes, which get enabled on the device.
+	struct PassTiming
+	{
+		double cpu_ms = 0.0;
+		double gpu_ms = 0.0;
+		bool pruned = false;
+	};
+	void enable_pass_telemetry(bool enable);
+	bool get_pass_timing(const std::string &name, PassTiming *timing) const;
+	// All passes which have been timed so far, in no particular order.
+	void get_pass_timings(std::vector<std::pair<std::string, PassTiming>> &timings) const;
+
+	// When the costliest of CPU recording and GPU time goes over budget, optional passes get pruned.
+	// They come back once there is headroom. A budget of 0 disables pruning. Implies pass telemetry.
+	void set_frame_time_budget(double budget_ms);
+
 	void bake();
 	void reset();
 	void log();
@@ -949,6 +1046,58 @@ private:
 	void build_render_pass_info();
 	void build_aliases();
 
+	// Topology of the last bake, keyed by a hash of the declared passes and resources.
+	// A rebake with identical declarations, e.g. after a resize, only recomputes dimensions.
+	struct BakeCache
+	{
+		Util::Hash hash = 0;
+		bool valid = false;
+		std::vector<unsigned> pass_stack;
+		std::vector<std::vector<unsigned>> physical_passes;
+		std::vector<unsigned> resource_physical_indices;
+		std::vector<ResourceDimensions> physical_dimensions;
+		std::vector<bool> physical_image_has_history;
+	};
+	BakeCache bake_cache;
+
+	struct AsyncComputeScheduler
+	{
+		bool enabled = false;
+		bool stale = false;
+		double min_overlap_ms = 0.1;
+		unsigned frames_since_update = 0;
+		// Keyed by pass name, so they survive reset().
+		std::unordered_map<std::string, double> pass_timings;
+		std::unordered_set<std::string> passes;
+		std::vector<Vulkan::GpuScopeEvent> events;
+	};
+	AsyncComputeScheduler async_compute;
+
+	struct PassTelemetry
+	{
+		bool enabled = false;
+		double frame_budget_ms = 0.0;
+		unsigned frames_since_update = 0;
+		// Keyed by pass name, so they survive reset().
+		std::unordered_map<std::string, PassTiming> timings;
+		std::unordered_map<std::string, double> scope_times;
+		std::vector<Vulkan::GpuScopeEvent> events;
+	};
+	PassTelemetry telemetry;
+	void update_pass_telemetry(Vulkan::Device &device);
+	void prune_optional_passes();
+	std::string get_physical_pass_name(const PhysicalPass &physical_pass) const;
+	void build_pass_dependencies();
+	void schedule_async_compute();
+	void compute_async_compute_schedule(std::unordered_set<std::string> &schedule);
+	void update_async_compute_timings(Vulkan::Device &device);
+	void rebuild_resource_queues();
+	Util::Hash hash_declarations() const;
+	void bake_topology();
+	void store_bake_cache(Util::Hash hash);
+	void restore_bake_cache();
+	void drop_stale_history_attachments();
+
 	bool enabled_timestamps = false;
 
 	std::vector<ResourceDimensions> physical_dimensions;
@@ -976,6 +1125,14 @@ private:
 	std::vector<bool> physical_image_has_history;
 	std::vector<unsigned> physical_aliases;
 
+	// Images of any format and size which share memory with disjoint lifetimes.
+	std::vector<std::vector<unsigned>> physical_memory_alias_chains;
+	std::vector<bool> physical_image_memory_aliased;
+	std::vector<std::pair<unsigned, unsigned>> physical_lifetimes;
+	std::vector<VkDeviceSize> physical_image_memory_sizes;
+	std::vector<Vulkan::DeviceAllocationOwnerHandle> memory_alias_blocks;
+	bool memory_alias_blocks_dirty = true;
+
 	Vulkan::ImageView *swapchain_attachment = nullptr;
 	unsigned swapchain_physical_index = RenderResource::Unused;
 
@@ -989,6 +1146,9 @@ private:
 
 	void setup_physical_buffer(Vulkan::Device &device, unsigned attachment);
 	void setup_physical_image(Vulkan::Device &device, unsigned attachment);
+	Vulkan::ImageCreateInfo get_physical_image_create_info(unsigned attachment) const;
+	void setup_memory_aliases(Vulkan::Device &device);
+	void log_memory_usage() const;
 
 	void depend_passes_recursive(const RenderPass &pass, const std::unordered_set<unsigned> &passes,
 	                             unsigned stack_count, bool no_check, bool ignore_self, bool merge_dependency);
@@ -1004,26 +1164,25 @@ private:
 
 	struct PassSubmissionState
 	{
-		Util::SmallVector<VkBufferMemoryBarrier> buffer_barriers;
-		Util::SmallVector<VkImageMemoryBarrier> image_barriers;
+		// Each barrier carries its own stage masks, so we only wait for what that resource needs.
+		Util::SmallVector<VkBufferMemoryBarrier2KHR> buffer_barriers;
+		Util::SmallVector<VkImageMemoryBarrier2KHR> image_barriers;
 
 		// Immediate buffer barriers are useless because they don't need any layout transition,
 		// and the API guarantees that submitting a batch makes memory visible to GPU resources.
 		// Immediate image barriers are purely for doing layout transitions without waiting (srcStage = TOP_OF_PIPE).
-		Util::SmallVector<VkImageMemoryBarrier> immediate_image_barriers;
+		Util::SmallVector<VkImageMemoryBarrier2KHR> immediate_image_barriers;
 
 		// Barriers which are used when waiting for a semaphore, and then doing a transition.
 		// We need to use pipeline barriers here so we can have srcStage = dstStage,
 		// and hand over while not breaking the pipeline.
-		Util::SmallVector<VkImageMemoryBarrier> semaphore_handover_barriers;
+		Util::SmallVector<VkImageMemoryBarrier2KHR> semaphore_handover_barriers;
 		Util::SmallVector<VkEvent> events;
 
 		Util::SmallVector<VkSubpassContents> subpass_contents;
 
 		VkPipelineStageFlags dst_stages = 0;
-		VkPipelineStageFlags immediate_dst_stages = 0;
 		VkPipelineStageFlags src_stages = 0;
-		VkPipelineStageFlags handover_stages = 0;
 
 		Util::SmallVector<Vulkan::Semaphore> wait_semaphores;
 		Util::SmallVector<VkPipelineStageFlags> wait_semaphore_stages;
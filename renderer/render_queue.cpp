@@ -35,12 +35,69 @@ namespace Granite
 {
 void RenderQueue::sort()
 {
-	for (auto &queue : queues)
+	for (unsigned i = 0; i < ecast(Queue::Count); i++)
+		sort(static_cast<Queue>(i));
+}
+
+void RenderQueue::sort(Queue queue_type)
+{
+	auto &queue = queues[ecast(queue_type)];
+	size_t count = queue.size();
+
+	// Radix sort has a fixed cost per digit which is not worth it for small queues.
+	if (count < 256)
 	{
 		stable_sort(begin(queue), end(queue), [](const RenderQueueData &a, const RenderQueueData &b) {
 			return a.sorting_key < b.sorting_key;
 		});
+		return;
+	}
+
+	// LSD radix sort over compact key/index pairs, 8 bits per digit.
+	// Each pass is stable, so the result matches stable_sort.
+	auto &scratch = sort_scratch[ecast(queue_type)];
+	scratch.entries.resize(count);
+	scratch.tmp.resize(count);
+
+	uint32_t histograms[8][256] = {};
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = queue[i].sorting_key;
+		scratch.entries[i] = { key, uint32_t(i) };
+		for (unsigned digit = 0; digit < 8; digit++)
+			histograms[digit][(key >> (8 * digit)) & 0xff]++;
 	}
+
+	auto *src = scratch.entries.data();
+	auto *dst = scratch.tmp.data();
+
+	for (unsigned digit = 0; digit < 8; digit++)
+	{
+		auto &histogram = histograms[digit];
+		unsigned shift = 8 * digit;
+
+		// All keys share this digit, e.g. the queue type bits. Nothing to reorder.
+		if (histogram[(src[0].key >> shift) & 0xff] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (auto &h : histogram)
+		{
+			uint32_t c = h;
+			h = offset;
+			offset += c;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+		std::swap(src, dst);
+	}
+
+	scratch.sorted.clear();
+	scratch.sorted.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		scratch.sorted.push_back(queue[src[i].index]);
+	std::swap(queue, scratch.sorted);
 }
 
 void RenderQueue::combine_render_info(const RenderQueue &queue)
@@ -142,6 +199,7 @@ void RenderQueue::reset()
 	for (auto &queue : queues)
 		queue.clear();
 	render_infos.clear();
+	arena = nullptr;
 }
 
 RenderQueue::~RenderQueue()
@@ -153,6 +211,8 @@ void *RenderQueue::allocate(size_t size, size_t alignment)
 {
 	if (size + alignment > BlockSize)
 	{
+		if (arena)
+			return arena->allocate(size, alignment);
 		auto *block = insert_large_block(size, alignment);
 		return allocate_from_block(*block, size, alignment);
 	}
@@ -236,6 +296,9 @@ uint64_t RenderInfo::get_sort_key(const RenderContext &context, Queue queue_type
                                   const vec3 &center, StaticLayer layer)
 {
 	float z = dot(context.get_render_parameters().camera_front, center - context.get_render_parameters().camera_position);
+	// Blending order does not matter, so use the state sorted key.
+	if (queue_type == Queue::Transparent && context.get_order_independent_transparency())
+		queue_type = Queue::Opaque;
 	return get_sprite_sort_key(queue_type, pipeline_hash, draw_hash, z, layer);
 }
 }
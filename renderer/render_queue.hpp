@@ -30,6 +30,7 @@
 #include "hash.hpp"
 #include "enum_cast.hpp"
 #include "intrusive_hash_map.hpp"
+#include "frame_arena.hpp"
 #include "math.hpp"
 
 namespace Granite
@@ -55,6 +56,8 @@ struct PositionalLightInfo
 	PositionalLight *light;
 	const RenderInfoComponent *transform;
 	Util::Hash transform_hash;
+	// Screen height fraction covered by the light's bounds times its peak color intensity.
+	float importance = 0.0f;
 };
 using VisibilityList = std::vector<RenderableInfo>;
 using PositionalLightList = std::vector<PositionalLightInfo>;
@@ -213,6 +216,13 @@ public:
 	void combine_render_info(const RenderQueue &queue);
 	void reset();
 
+	// Allocations larger than a block come from the arena instead of the heap.
+	// The arena is forgotten in reset(), so it has to be set again for every frame.
+	void set_frame_arena(Util::FrameArena *arena_)
+	{
+		arena = arena_;
+	}
+
 	using RenderQueueDataVector = Util::SmallVector<RenderQueueData, 64>;
 
 	const RenderQueueDataVector &get_queue_data(Queue queue) const
@@ -220,7 +230,10 @@ public:
 		return queues[Util::ecast(queue)];
 	}
 
+	// Sorts every queue by sorting_key, stable for equal keys.
 	void sort();
+	// Only touches state for the given queue, so different queues can be sorted concurrently.
+	void sort(Queue queue);
 	void dispatch(Queue queue, Vulkan::CommandBuffer &cmd, const Vulkan::CommandBufferSavedState *state) const;
 	void dispatch_range(Queue queue, Vulkan::CommandBuffer &cmd, const Vulkan::CommandBufferSavedState *state, size_t begin, size_t end) const;
 	void dispatch_subset(Queue queue, Vulkan::CommandBuffer &cmd, const Vulkan::CommandBufferSavedState *state, unsigned index, unsigned num_indices) const;
@@ -282,8 +295,24 @@ private:
 	Block *insert_large_block(size_t size, size_t alignment);
 
 	RenderQueueDataVector queues[static_cast<unsigned>(Queue::Count)];
+
+	struct SortEntry
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	struct SortScratch
+	{
+		std::vector<SortEntry> entries;
+		std::vector<SortEntry> tmp;
+		RenderQueueDataVector sorted;
+	};
+	SortScratch sort_scratch[static_cast<unsigned>(Queue::Count)];
+
 	Util::SmallVector<Block *, 64> blocks;
 	Block *current = nullptr;
+	Util::FrameArena *arena = nullptr;
 
 	ShaderSuite *shader_suites = nullptr;
 	Util::IntrusiveHashMapHolder<QueueDataWrappedErased> render_infos;
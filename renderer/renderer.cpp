@@ -31,6 +31,7 @@
 #include "global_managers.hpp"
 #include "common_renderer_data.hpp"
 #include "rapidjson_wrapper.hpp"
+#include "path_utils.hpp"
 #include <string.h>
 
 using namespace Vulkan;
@@ -67,7 +68,8 @@ enum GlobalDescriptorSetBindings
 	BINDING_GLOBAL_SHADOW_SAMPLER = 15,
 	BINDING_GLOBAL_GEOMETRY_SAMPLER = 16,
 
-	BINDING_GLOBAL_VOLUMETRIC_DIFFUSE_FALLBACK_VOLUME = 17
+	BINDING_GLOBAL_VOLUMETRIC_DIFFUSE_FALLBACK_VOLUME = 17,
+	BINDING_GLOBAL_DIRECTIONAL_SHADOW_PAGES = 18
 };
 
 namespace Granite
@@ -118,7 +120,8 @@ void RendererSuite::update_mesh_rendering_options(const RenderContext &context,
 			(config.cascaded_directional_shadows ? Renderer::MULTIVIEW_BIT : 0) | Renderer::SHADOW_VSM_BIT);
 	get_renderer(Type::ShadowDepthPositionalVSM).set_mesh_renderer_options(
 			Renderer::POSITIONAL_LIGHT_SHADOW_VSM_BIT);
-	get_renderer(Type::PrepassDepth).set_mesh_renderer_options(0);
+	Renderer::RendererOptionFlags multiview_flags = config.multiview ? Renderer::MULTIVIEW_BIT : 0;
+	get_renderer(Type::PrepassDepth).set_mesh_renderer_options(multiview_flags);
 	get_renderer(Type::MotionVector).set_mesh_renderer_options(0);
 
 	Renderer::RendererOptionFlags pcf_flags = 0;
@@ -133,13 +136,17 @@ void RendererSuite::update_mesh_rendering_options(const RenderContext &context,
 	h.u32(uint32_t(config.directional_light_vsm));
 	h.u32(uint32_t(config.forward_z_prepass));
 	h.u32(uint32_t(config.cascaded_directional_shadows));
+	h.u32(uint32_t(config.multiview));
+	h.u32(uint32_t(config.order_independent_transparency));
 	Util::Hash config_hash = h.get();
 
 	get_renderer(Type::Deferred).set_mesh_renderer_options(pcf_flags | (opts & Renderer::POSITIONAL_DECALS_BIT));
 	get_renderer(Type::ForwardOpaque).set_mesh_renderer_options(
-			opts | pcf_flags | (config.forward_z_prepass ? Renderer::ALPHA_TEST_DISABLE_BIT : 0));
+			opts | pcf_flags | multiview_flags | (config.forward_z_prepass ? Renderer::ALPHA_TEST_DISABLE_BIT : 0));
 	opts &= ~Renderer::AMBIENT_OCCLUSION_BIT;
-	get_renderer(Type::ForwardTransparent).set_mesh_renderer_options(opts | pcf_flags);
+	if (config.order_independent_transparency)
+		opts |= Renderer::ORDER_INDEPENDENT_TRANSPARENCY_BIT;
+	get_renderer(Type::ForwardTransparent).set_mesh_renderer_options(opts | pcf_flags | multiview_flags);
 
 	if (config_hash != current_config_hash)
 	{
@@ -149,8 +156,114 @@ void RendererSuite::update_mesh_rendering_options(const RenderContext &context,
 	}
 }
 
+// On-disk layout of a binary variant cache entry.
+struct VariantCacheEntry
+{
+	uint32_t renderer_suite_type;
+	uint32_t renderable_type;
+	uint32_t coverage;
+	uint32_t attribute_mask;
+	uint32_t texture_mask;
+	uint32_t variant_id;
+};
+
+static constexpr uint32_t VariantCacheMagic = 0x52565347u; // 'GSVR'
+
+bool RendererSuite::load_binary_variant_cache(const std::string &path)
+{
+	auto file = GRANITE_FILESYSTEM()->open(path);
+	if (!file)
+		return false;
+
+	size_t size = file->get_size();
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	uint32_t header[3];
+	if (!mapped || size < sizeof(header))
+	{
+		LOGE("Failed to map variant cache %s.\n", path.c_str());
+		return false;
+	}
+
+	memcpy(header, mapped, sizeof(header));
+	if (header[0] != VariantCacheMagic || header[1] != CacheVersion)
+	{
+		LOGE("Mismatch in renderer suite cache version in %s.\n", path.c_str());
+		return false;
+	}
+
+	if (sizeof(header) + size_t(header[2]) * sizeof(VariantCacheEntry) > size)
+	{
+		LOGE("Variant cache %s is truncated.\n", path.c_str());
+		return false;
+	}
+
+	std::vector<VariantCacheEntry> entries(header[2]);
+	memcpy(entries.data(), mapped + sizeof(header), entries.size() * sizeof(VariantCacheEntry));
+
+	variants.reserve(variants.size() + entries.size());
+	for (auto &entry : entries)
+	{
+		Variant variant = {};
+		variant.renderer_suite_type = static_cast<RendererSuite::Type>(entry.renderer_suite_type);
+		variant.renderable_type = static_cast<RenderableType>(entry.renderable_type);
+		variant.key.coverage = static_cast<DrawPipelineCoverage>(entry.coverage);
+		variant.key.attribute_mask = entry.attribute_mask;
+		variant.key.texture_mask = entry.texture_mask;
+		variant.key.variant_id = entry.variant_id;
+		variants.push_back(variant);
+	}
+
+	LOGI("Loaded variant cache from %s.\n", path.c_str());
+	return true;
+}
+
+bool RendererSuite::save_binary_variant_cache(const std::string &path)
+{
+	std::vector<VariantCacheEntry> entries;
+	for (unsigned suite_type = 0; suite_type < Util::ecast(RendererSuite::Type::Count); suite_type++)
+	{
+		for (unsigned renderable_type = 0; renderable_type < Util::ecast(RenderableType::Count); renderable_type++)
+		{
+			auto &suite = handles[suite_type]->get_shader_suites()[renderable_type];
+			auto &signatures = suite.get_variant_signatures().get_thread_unsafe();
+			for (auto &key : signatures)
+			{
+				entries.push_back({ suite_type, renderable_type, uint32_t(key.key.coverage),
+				                    key.key.attribute_mask, key.key.texture_mask, key.key.variant_id });
+			}
+		}
+	}
+
+	const uint32_t header[3] = { VariantCacheMagic, uint32_t(CacheVersion), uint32_t(entries.size()) };
+	size_t size = sizeof(header) + entries.size() * sizeof(VariantCacheEntry);
+
+	auto file = GRANITE_FILESYSTEM()->open(path, Granite::FileMode::WriteOnlyTransactional);
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto *mapped = static_cast<uint8_t *>(file->map_write(size));
+	if (!mapped)
+	{
+		LOGE("Failed to map buffer %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	memcpy(mapped, header, sizeof(header));
+	memcpy(mapped + sizeof(header), entries.data(), entries.size() * sizeof(VariantCacheEntry));
+	file->unmap();
+
+	LOGI("Saved variant cache to %s.\n", path.c_str());
+	return true;
+}
+
 bool RendererSuite::load_variant_cache(const std::string &path)
 {
+	if (Path::ext(path) == "bin")
+		return load_binary_variant_cache(path);
+
 	using namespace rapidjson;
 	std::string json;
 
@@ -182,6 +295,11 @@ bool RendererSuite::load_variant_cache(const std::string &path)
 	for (auto itr = maps.Begin(); itr != maps.End(); ++itr)
 	{
 		auto &value = *itr;
+
+		// Usage recordings may list variants which were never hit.
+		if (value.HasMember("hits") && value["hits"].GetUint() == 0)
+			continue;
+
 		Variant variant = {};
 		variant.renderer_suite_type = static_cast<RendererSuite::Type>(value["rendererSuiteType"].GetUint());
 		variant.renderable_type = static_cast<RenderableType>(value["renderableType"].GetUint());
@@ -197,6 +315,27 @@ bool RendererSuite::load_variant_cache(const std::string &path)
 }
 
 bool RendererSuite::save_variant_cache(const std::string &path)
+{
+	if (Path::ext(path) == "bin")
+		return save_binary_variant_cache(path);
+	else
+		return save_json_variants(path, false);
+}
+
+void RendererSuite::set_variant_usage_recording(bool enable)
+{
+	for (auto &handle : handles)
+		if (handle)
+			for (unsigned i = 0; i < Util::ecast(RenderableType::Count); i++)
+				handle->get_shader_suites()[i].set_usage_recording(enable);
+}
+
+bool RendererSuite::save_variant_usage(const std::string &path)
+{
+	return save_json_variants(path, true);
+}
+
+bool RendererSuite::save_json_variants(const std::string &path, bool usage)
 {
 	using namespace rapidjson;
 	Document doc;
@@ -204,6 +343,8 @@ bool RendererSuite::save_variant_cache(const std::string &path)
 	auto &allocator = doc.GetAllocator();
 
 	doc.AddMember("rendererSuiteCacheVersion", uint32_t(CacheVersion), allocator);
+	if (usage)
+		doc.AddMember("sessions", 1u, allocator);
 
 	Value variants_array(kArrayType);
 
@@ -215,6 +356,10 @@ bool RendererSuite::save_variant_cache(const std::string &path)
 			auto &signatures = suite.get_variant_signatures().get_thread_unsafe();
 			for (auto &key : signatures)
 			{
+				uint32_t hits = key.hits.load(std::memory_order_relaxed);
+				if (usage && !hits)
+					continue;
+
 				Value variant(kObjectType);
 				variant.AddMember("rendererSuiteType", suite_type, allocator);
 				variant.AddMember("renderableType", renderable_type, allocator);
@@ -222,6 +367,8 @@ bool RendererSuite::save_variant_cache(const std::string &path)
 				variant.AddMember("attributeMask", uint32_t(key.key.attribute_mask), allocator);
 				variant.AddMember("textureMask", uint32_t(key.key.texture_mask), allocator);
 				variant.AddMember("variantId", uint32_t(key.key.variant_id), allocator);
+				if (usage)
+					variant.AddMember("hits", hits, allocator);
 				variants_array.PushBack(variant, allocator);
 			}
 		}
@@ -250,7 +397,7 @@ bool RendererSuite::save_variant_cache(const std::string &path)
 	memcpy(mapped, buffer.GetString(), buffer.GetSize());
 	file->unmap();
 
-	LOGI("Saved variant cache to %s.\n", path.c_str());
+	LOGI("Saved variant %s to %s.\n", usage ? "usage" : "cache", path.c_str());
 	return true;
 }
 
@@ -268,8 +415,8 @@ void RendererSuite::register_variants_from_cache()
 	{
 		auto *suites = handles[Util::ecast(variant.renderer_suite_type)]->get_shader_suites();
 		auto &suite = suites[Util::ecast(variant.renderable_type)];
-		suite.get_program(variant.key.coverage, variant.key.attribute_mask,
-		                  variant.key.texture_mask, variant.key.variant_id);
+		suite.warm_program(variant.key.coverage, variant.key.attribute_mask,
+		                   variant.key.texture_mask, variant.key.variant_id);
 	}
 
 	if (e)
@@ -378,6 +525,9 @@ void Renderer::set_mesh_renderer_options_internal(RendererOptionFlags flags)
 	auto &plane = suite[ecast(RenderableType::TexturePlane)];
 	plane.get_base_defines() = global_defines;
 	plane.bake_base_defines();
+	auto &impostor = suite[ecast(RenderableType::Impostor)];
+	impostor.get_base_defines() = global_defines;
+	impostor.bake_base_defines();
 	auto &spot = suite[ecast(RenderableType::SpotLight)];
 	spot.get_base_defines() = global_defines;
 	spot.bake_base_defines();
@@ -442,6 +592,8 @@ vector<pair<string, int>> Renderer::build_defines_from_renderer_options(Renderer
 
 	if (flags & SHADOW_VSM_BIT)
 		global_defines.emplace_back("DIRECTIONAL_SHADOW_VSM", 1);
+	if (flags & SHADOW_VIRTUAL_BIT)
+		global_defines.emplace_back("DIRECTIONAL_SHADOW_VIRTUAL", 1);
 	if (flags & POSITIONAL_LIGHT_SHADOW_VSM_BIT)
 		global_defines.emplace_back("POSITIONAL_SHADOW_VSM", 1);
 	if (flags & (POSITIONAL_LIGHT_SHADOW_VSM_BIT | SHADOW_VSM_BIT))
@@ -459,6 +611,9 @@ vector<pair<string, int>> Renderer::build_defines_from_renderer_options(Renderer
 	if (flags & AMBIENT_OCCLUSION_BIT)
 		global_defines.emplace_back("AMBIENT_OCCLUSION", 1);
 
+	if (flags & ORDER_INDEPENDENT_TRANSPARENCY_BIT)
+		global_defines.emplace_back("OIT_WEIGHTED_BLENDED", 1);
+
 	global_defines.emplace_back(renderer_to_define(type), 1);
 
 	return global_defines;
@@ -475,6 +630,8 @@ Renderer::RendererOptionFlags Renderer::get_mesh_renderer_options_from_lighting(
 			flags |= SHADOW_VSM_BIT;
 		if (lighting.shadows->get_create_info().layers > 1)
 			flags |= SHADOW_CASCADE_ENABLE_BIT;
+		if (lighting.shadow_page_table)
+			flags |= SHADOW_VIRTUAL_BIT;
 	}
 
 	if (lighting.volumetric_fog)
@@ -543,6 +700,8 @@ void Renderer::begin(RenderQueue &queue) const
 {
 	queue.reset();
 	queue.set_shader_suites(suite);
+	if (device)
+		queue.set_frame_arena(&device->get_frame_arena());
 }
 
 static void set_cluster_parameters_legacy(Vulkan::CommandBuffer &cmd, const LightClusterer &cluster)
@@ -656,6 +815,8 @@ void Renderer::bind_lighting_parameters(Vulkan::CommandBuffer &cmd, const Render
 		auto sampler = format_has_depth_or_stencil_aspect(lighting->shadows->get_format()) ? StockSampler::LinearShadow
 		                                                                                   : StockSampler::LinearClamp;
 		cmd.set_texture(0, BINDING_GLOBAL_DIRECTIONAL_SHADOW, *lighting->shadows, sampler);
+		if (lighting->shadow_page_table)
+			cmd.set_storage_buffer(0, BINDING_GLOBAL_DIRECTIONAL_SHADOW_PAGES, *lighting->shadow_page_table);
 	}
 
 	if (lighting->ambient_occlusion)
@@ -770,7 +931,14 @@ void Renderer::flush_subset(Vulkan::CommandBuffer &cmd, const RenderQueue &queue
 		// Forward renderers can also render transparent objects.
 		cmd.restore_state(state);
 		cmd.set_blend_enable(true);
-		cmd.set_blend_factors(VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA);
+		if (renderer_options & ORDER_INDEPENDENT_TRANSPARENCY_BIT)
+		{
+			// Color and weights accumulate, alpha keeps the product of (1 - alpha) as revealage.
+			cmd.set_blend_factors(VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO,
+			                      VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA);
+		}
+		else
+			cmd.set_blend_factors(VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA);
 		cmd.set_blend_op(VK_BLEND_OP_ADD);
 		cmd.set_depth_test(true, false);
 		cmd.save_state(COMMAND_BUFFER_SAVED_SCISSOR_BIT | COMMAND_BUFFER_SAVED_VIEWPORT_BIT | COMMAND_BUFFER_SAVED_RENDER_STATE_BIT, state);
@@ -911,6 +1079,8 @@ void DeferredLightRenderer::render_light(Vulkan::CommandBuffer &cmd, const Rende
 		defines.emplace_back("SHADOWS", 1);
 		if (!format_has_depth_or_stencil_aspect(light.shadows->get_format()))
 			defines.emplace_back("DIRECTIONAL_SHADOW_VSM", 1);
+		else if (light.shadow_page_table)
+			defines.emplace_back("DIRECTIONAL_SHADOW_VIRTUAL", 1);
 		else if (flags & Renderer::SHADOW_PCF_KERNEL_WIDE_BIT)
 			defines.emplace_back("SHADOW_MAP_PCF_KERNEL_WIDE", 1);
 	}
@@ -937,6 +1107,8 @@ void DeferredLightRenderer::render_light(Vulkan::CommandBuffer &cmd, const Rende
 		auto sampler = format_has_depth_or_stencil_aspect(light.shadows->get_format()) ? StockSampler::LinearShadow
 		                                                                               : StockSampler::LinearClamp;
 		cmd.set_texture(0, BINDING_GLOBAL_DIRECTIONAL_SHADOW, *light.shadows, sampler);
+		if (light.shadow_page_table)
+			cmd.set_storage_buffer(0, BINDING_GLOBAL_DIRECTIONAL_SHADOW_PAGES, *light.shadow_page_table);
 	}
 
 	if (light.ambient_occlusion)
@@ -1118,6 +1290,10 @@ void ShaderSuiteResolver::init_shader_suite(Device &device, ShaderSuite &suite,
 			suite.init_graphics(&device.get_shader_manager(), "builtin://shaders/texture_plane.vert", "builtin://shaders/texture_plane.frag");
 			break;
 
+		case RenderableType::Impostor:
+			suite.init_graphics(&device.get_shader_manager(), "builtin://shaders/impostor.vert", "builtin://shaders/impostor.frag");
+			break;
+
 		default:
 			break;
 		}
@@ -1145,6 +1321,12 @@ void ShaderSuiteResolver::init_shader_suite(Device &device, ShaderSuite &suite,
 			suite.init_graphics(&device.get_shader_manager(), "builtin://shaders/texture_plane.vert", "builtin://shaders/dummy_depth.frag");
 			break;
 
+		case RenderableType::Impostor:
+			// Impostors do not render motion vectors, see ImpostorManager.
+			if (renderer == RendererType::DepthOnly)
+				suite.init_graphics(&device.get_shader_manager(), "builtin://shaders/impostor.vert", "builtin://shaders/impostor.frag");
+			break;
+
 		case RenderableType::SpotLight:
 			suite.init_graphics(&device.get_shader_manager(), "builtin://shaders/lights/spot.vert", "builtin://shaders/dummy.frag");
 			break;
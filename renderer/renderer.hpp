@@ -73,7 +73,10 @@ public:
 		POSITIONAL_LIGHT_CLUSTER_BINDLESS_BIT = 1 << 13,
 		MULTIVIEW_BIT = 1 << 14,
 		AMBIENT_OCCLUSION_BIT = 1 << 15,
-		POSITIONAL_DECALS_BIT = 1 << 16
+		POSITIONAL_DECALS_BIT = 1 << 16,
+		SHADOW_VIRTUAL_BIT = 1 << 17,
+		// Transparent draws write weighted blended OIT accumulation targets instead of blending in order.
+		ORDER_INDEPENDENT_TRANSPARENCY_BIT = 1 << 18
 	};
 	using RendererOptionFlags = uint32_t;
 
@@ -191,6 +194,12 @@ public:
 		bool directional_light_vsm = false;
 		bool forward_z_prepass = false;
 		bool cascaded_directional_shadows = false;
+		// Forward and depth pre-pass renderers draw every view of RenderContext::set_multiview_cameras()
+		// in one multiview render pass, e.g. a stereo pair rendered to two layers.
+		bool multiview = false;
+		// The transparent renderer writes weighted blended OIT accumulation targets,
+		// see RenderContext::set_order_independent_transparency().
+		bool order_independent_transparency = false;
 	};
 
 	void update_mesh_rendering_options(const RenderContext &context, const Config &config);
@@ -200,9 +209,17 @@ public:
 	void promote_read_write_cache_to_read_only();
 
 	void register_variants_from_cache();
+	// Paths ending in .bin use a flat binary array which is copied in one go. Other paths use JSON.
 	bool load_variant_cache(const std::string &path);
 	bool save_variant_cache(const std::string &path);
 
+	// Counts which variants are actually requested while rendering, warming does not count.
+	// save_variant_usage() writes the JSON cache format with a hit count per variant, leaving out unused variants.
+	// Recordings from several sessions can be merged with the merge-variant-usage tool,
+	// and the result loads with load_variant_cache() like any other cache.
+	void set_variant_usage_recording(bool enable);
+	bool save_variant_usage(const std::string &path);
+
 private:
 	RendererHandle handles[Util::ecast(Type::Count)];
 
@@ -214,6 +231,10 @@ private:
 	};
 	std::vector<Variant> variants;
 	Util::Hash current_config_hash = 0;
+
+	bool load_binary_variant_cache(const std::string &path);
+	bool save_binary_variant_cache(const std::string &path);
+	bool save_json_variants(const std::string &path, bool usage);
 };
 
 class DeferredLightRenderer
@@ -38,6 +38,7 @@ enum class RenderableType
 	TexturePlane,
 	SpotLight,
 	PointLight,
+	Impostor,
 	Custom,
 	Count
 };
@@ -25,7 +25,9 @@
 #include "lights/lights.hpp"
 #include "simd.hpp"
 #include "task_composer.hpp"
+#include "occlusion_culling.hpp"
 #include <float.h>
+#include <cmath>
 
 using namespace std;
 
@@ -69,8 +71,9 @@ Scene::~Scene()
 }
 
 template <typename T, typename Func>
-static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
-                                       size_t begin_index, size_t end_index, const Func &filter_func)
+static void gather_visible_renderables_components(const Frustum &frustum, VisibilityList &list, const T &objects,
+                                                  size_t begin_index, size_t end_index, const Func &filter_func,
+                                                  const OcclusionBuffer *occlusion)
 {
 	for (size_t i = begin_index; i < end_index; i++)
 	{
@@ -79,7 +82,7 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 
 		auto *renderable = get_component<RenderableComponent>(o);
 		auto flags = renderable->renderable->flags;
-		if (!filter_func(transform, flags))
+		if (!filter_func(flags, transform->requires_motion_vectors))
 			continue;
 
 		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
@@ -91,7 +94,8 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 		if (transform->transform)
 		{
 			if ((flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0 ||
-			    SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
+			    (SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()) &&
+			     (!occlusion || occlusion->test_aabb(transform->world_aabb))))
 			{
 				list.push_back({ renderable->renderable.get(), transform, h.get() });
 			}
@@ -101,6 +105,489 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 	}
 }
 
+static bool aabb_inside_frustum(const AABB &aabb, const vec4 *planes)
+{
+	// The corner furthest behind each plane must still be in front of it.
+	auto &lo = aabb.get_minimum();
+	auto &hi = aabb.get_maximum();
+	for (unsigned i = 0; i < 6; i++)
+	{
+		auto &p = planes[i];
+		vec3 corner(p.x > 0.0f ? lo.x : hi.x, p.y > 0.0f ? lo.y : hi.y, p.z > 0.0f ? lo.z : hi.z);
+		if (dot(p.xyz(), corner) + p.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+template <typename Func>
+static void cull_slot_range(const RenderableCullingArrays &culling, const SIMD::AABBArrays &boxes,
+                            const vec4 *planes, size_t begin_index, size_t end_index, const Func &func)
+{
+	for (size_t i = begin_index; i < end_index; i += SIMD::FrustumCullBatchSize)
+	{
+		uint32_t visible = SIMD::frustum_cull_batch(boxes, i, planes);
+		size_t batch_end = std::min<size_t>(i + SIMD::FrustumCullBatchSize, end_index);
+
+		for (size_t j = i; j < batch_end; j++)
+		{
+			if ((culling.state[j] & RenderableCullingArrays::ALWAYS_VISIBLE_BIT) != 0 ||
+			    (visible & (1u << (j - i))) != 0)
+			{
+				func(j);
+			}
+		}
+	}
+}
+
+// Calls func for every slot in [begin_index, end_index) which may be visible.
+template <typename Func>
+static void cull_slots(const RenderableCullingArrays &culling, const vec4 *planes,
+                       size_t begin_index, size_t end_index, const Func &func,
+                       const OcclusionBuffer *occlusion = nullptr)
+{
+	const SIMD::AABBArrays boxes = {
+		culling.lo_x.data(), culling.lo_y.data(), culling.lo_z.data(),
+		culling.hi_x.data(), culling.hi_y.data(), culling.hi_z.data(),
+	};
+
+	// Subtrees outside the frustum are skipped, and subtrees fully inside need no per-object test.
+	// Depth is bounded by the median split, so a small fixed stack is enough.
+	uint32_t stack[64];
+	unsigned stack_size = 0;
+	if (!culling.nodes.empty())
+		stack[stack_size++] = 0;
+
+	while (stack_size)
+	{
+		uint32_t node_index = stack[--stack_size];
+		auto &node = culling.nodes[node_index];
+		size_t node_begin = std::max<size_t>(node.first, begin_index);
+		size_t node_end = std::min<size_t>(node.first + node.count, end_index);
+		if (node_begin >= node_end || !SIMD::frustum_cull(node.bounds, planes))
+			continue;
+		if (occlusion && !occlusion->test_aabb(node.bounds))
+			continue;
+
+		if (aabb_inside_frustum(node.bounds, planes))
+		{
+			for (size_t j = node_begin; j < node_end; j++)
+				func(j);
+		}
+		else if (!node.right)
+			cull_slot_range(culling, boxes, planes, node_begin, node_end, func);
+		else
+		{
+			stack[stack_size++] = node.right;
+			stack[stack_size++] = node_index + 1;
+		}
+	}
+
+	// Moving and unbounded objects are not in the BVH.
+	cull_slot_range(culling, boxes, planes, std::max(begin_index, culling.static_count), end_index, func);
+}
+
+template <typename T>
+static RenderableInfo get_slot_renderable_info(const T &objects, const RenderableCullingArrays &culling, size_t slot)
+{
+	auto &o = objects[culling.object_index[slot]];
+	auto *transform = get_component<RenderInfoComponent>(o);
+	auto *renderable = get_component<RenderableComponent>(o);
+	auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
+
+	Util::Hasher h;
+	h.u64(timestamp->cookie);
+	h.u32(timestamp->last_timestamp);
+	return { renderable->renderable.get(), transform->transform ? transform : nullptr, h.get() };
+}
+
+template <typename T, typename Func>
+static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
+                                       const RenderableCullingArrays &culling,
+                                       size_t begin_index, size_t end_index, const Func &filter_func,
+                                       const OcclusionBuffer *occlusion = nullptr)
+{
+	// Renderables were added or removed since the arrays were last refreshed.
+	if (culling.count != objects.size())
+	{
+		gather_visible_renderables_components(frustum, list, objects, begin_index, end_index, filter_func, occlusion);
+		return;
+	}
+
+	cull_slots(culling, frustum.get_planes(), begin_index, end_index, [&](size_t slot) {
+		if (!filter_func(culling.flags[slot],
+		                 (culling.state[slot] & RenderableCullingArrays::REQUIRES_MOTION_VECTORS_BIT) != 0))
+		{
+			return;
+		}
+
+		if (occlusion && (culling.state[slot] & RenderableCullingArrays::ALWAYS_VISIBLE_BIT) == 0)
+		{
+			AABB aabb(vec3(culling.lo_x[slot], culling.lo_y[slot], culling.lo_z[slot]),
+			          vec3(culling.hi_x[slot], culling.hi_y[slot], culling.hi_z[slot]));
+			if (!occlusion->test_aabb(aabb))
+				return;
+		}
+
+		list.push_back(get_slot_renderable_info(objects, culling, slot));
+	}, occlusion);
+}
+
+// Lets small camera movements reuse a cached list. A fraction of the frustum diagonal.
+static constexpr float VisibilityCacheMargin = 1.0f / 32.0f;
+
+static bool frustum_inside_planes(const Frustum &frustum, const vec4 *planes)
+{
+	for (unsigned i = 0; i < 8; i++)
+	{
+		vec3 corner = frustum.get_coord(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1));
+		for (unsigned j = 0; j < 6; j++)
+		{
+			// Some slack for rounding, so an unchanged frustum is always accepted. Fails on NaN.
+			auto &p = planes[j];
+			if (!(dot(p.xyz(), corner) + p.w >= -1e-4f * (1.0f + muglm::abs(p.w))))
+				return false;
+		}
+	}
+	return true;
+}
+
+template <typename T, typename Func>
+static void gather_visible_renderables_cached(const Frustum &frustum, VisibilityCache &cache, const T &objects,
+                                              const RenderableCullingArrays &culling,
+                                              size_t begin_index, size_t end_index, const Func &filter_func)
+{
+	if (culling.count != objects.size())
+	{
+		cache.valid = false;
+		cache.list.clear();
+		gather_visible_renderables_components(frustum, cache.list, objects, begin_index, end_index, filter_func, nullptr);
+		return;
+	}
+
+	bool reuse = cache.valid && cache.layout_epoch == culling.layout_epoch &&
+	             cache.begin_slot == begin_index && cache.end_slot == end_index &&
+	             (cache.change_epoch == culling.change_epoch || cache.change_epoch + 1 == culling.change_epoch) &&
+	             frustum_inside_planes(frustum, cache.planes);
+
+	if (reuse)
+	{
+		if (cache.change_epoch == culling.change_epoch)
+			return;
+
+		for (uint32_t slot : culling.changed_slots)
+		{
+			if (slot < begin_index || slot >= end_index)
+				continue;
+
+			bool visible = filter_func(culling.flags[slot],
+			                           (culling.state[slot] & RenderableCullingArrays::REQUIRES_MOTION_VECTORS_BIT) != 0);
+			if (visible && (culling.state[slot] & RenderableCullingArrays::ALWAYS_VISIBLE_BIT) == 0)
+			{
+				AABB aabb(vec3(culling.lo_x[slot], culling.lo_y[slot], culling.lo_z[slot]),
+				          vec3(culling.hi_x[slot], culling.hi_y[slot], culling.hi_z[slot]));
+				visible = SIMD::frustum_cull(aabb, cache.planes);
+			}
+
+			uint32_t &entry = cache.slot_entry[slot - begin_index];
+			if (visible)
+			{
+				// The transform hash changes with the timestamp, so refresh entries which stay visible too.
+				if (entry == UINT32_MAX)
+				{
+					entry = uint32_t(cache.list.size());
+					cache.list.push_back(get_slot_renderable_info(objects, culling, slot));
+					cache.entry_slot.push_back(slot);
+				}
+				else
+					cache.list[entry] = get_slot_renderable_info(objects, culling, slot);
+			}
+			else if (entry != UINT32_MAX)
+			{
+				// Order does not matter, render queues are sorted after pushing.
+				uint32_t last = uint32_t(cache.list.size() - 1);
+				cache.list[entry] = cache.list[last];
+				cache.entry_slot[entry] = cache.entry_slot[last];
+				cache.slot_entry[cache.entry_slot[entry] - begin_index] = entry;
+				cache.list.pop_back();
+				cache.entry_slot.pop_back();
+				entry = UINT32_MAX;
+			}
+		}
+
+		cache.change_epoch = culling.change_epoch;
+		return;
+	}
+
+	float margin = VisibilityCacheMargin * distance(frustum.get_coord(0.0f, 0.0f, 0.0f), frustum.get_coord(1.0f, 1.0f, 1.0f));
+	if (!std::isfinite(margin))
+		margin = 0.0f;
+
+	// Planes are normalized, so pushing them out is a plain offset.
+	auto *planes = frustum.get_planes();
+	for (unsigned i = 0; i < 6; i++)
+	{
+		cache.planes[i] = planes[i];
+		cache.planes[i].w += margin;
+	}
+
+	cache.list.clear();
+	cache.entry_slot.clear();
+	cache.slot_entry.assign(end_index - begin_index, UINT32_MAX);
+
+	cull_slots(culling, cache.planes, begin_index, end_index, [&](size_t slot) {
+		if (!filter_func(culling.flags[slot],
+		                 (culling.state[slot] & RenderableCullingArrays::REQUIRES_MOTION_VECTORS_BIT) != 0))
+		{
+			return;
+		}
+
+		cache.slot_entry[slot - begin_index] = uint32_t(cache.list.size());
+		cache.entry_slot.push_back(uint32_t(slot));
+		cache.list.push_back(get_slot_renderable_info(objects, culling, slot));
+	});
+
+	cache.begin_slot = begin_index;
+	cache.end_slot = end_index;
+	cache.layout_epoch = culling.layout_epoch;
+	cache.change_epoch = culling.change_epoch;
+	cache.valid = true;
+}
+
+struct CullingBuildEntry
+{
+	AABB bounds;
+	vec3 center;
+	uint32_t object;
+	uint32_t timestamp;
+	RenderableFlags flags;
+	uint8_t state;
+	const RenderInfoComponent *identity;
+};
+
+// Two SIMD batches with AVX.
+static constexpr uint32_t CullingLeafSize = 16;
+
+static uint32_t build_culling_bvh(std::vector<RenderableCullingArrays::Node> &nodes, CullingBuildEntry *entries,
+                                  uint32_t first, uint32_t count)
+{
+	uint32_t node_index = uint32_t(nodes.size());
+	nodes.emplace_back();
+
+	AABB bounds(vec3(FLT_MAX), vec3(-FLT_MAX));
+	AABB centers(vec3(FLT_MAX), vec3(-FLT_MAX));
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		bounds.expand(entries[i].bounds);
+		centers.expand(AABB(entries[i].center, entries[i].center));
+	}
+
+	uint32_t right = 0;
+	if (count > CullingLeafSize)
+	{
+		// Median split along the widest axis of the centers.
+		vec3 extent = centers.get_maximum() - centers.get_minimum();
+		unsigned axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		uint32_t half = count / 2;
+		std::nth_element(entries + first, entries + first + half, entries + first + count,
+		                 [axis](const CullingBuildEntry &a, const CullingBuildEntry &b) {
+			                 return a.center[axis] < b.center[axis];
+		                 });
+
+		build_culling_bvh(nodes, entries, first, half);
+		right = build_culling_bvh(nodes, entries, first + half, count - half);
+	}
+
+	auto &node = nodes[node_index];
+	node.bounds = bounds;
+	node.first = first;
+	node.count = count;
+	node.right = right;
+	return node_index;
+}
+
+static void refit_culling_bvh(RenderableCullingArrays &culling)
+{
+	// Children always come after their parent.
+	for (size_t i = culling.nodes.size(); i; i--)
+	{
+		auto &node = culling.nodes[i - 1];
+		if (node.right)
+		{
+			node.bounds = culling.nodes[i].bounds;
+			node.bounds.expand(culling.nodes[node.right].bounds);
+		}
+		else
+		{
+			vec3 lo(FLT_MAX);
+			vec3 hi(-FLT_MAX);
+			for (size_t j = node.first; j < node.first + node.count; j++)
+			{
+				lo = min(lo, vec3(culling.lo_x[j], culling.lo_y[j], culling.lo_z[j]));
+				hi = max(hi, vec3(culling.hi_x[j], culling.hi_y[j], culling.hi_z[j]));
+			}
+			node.bounds = AABB(lo, hi);
+		}
+	}
+}
+
+template <typename T>
+static void rebuild_culling_arrays(RenderableCullingArrays &culling, const T &objects,
+                                   bool force_visible, bool keep_moved)
+{
+	size_t count = objects.size();
+	std::vector<CullingBuildEntry> entries(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &o = objects[i];
+		auto *transform = get_component<RenderInfoComponent>(o);
+		auto flags = get_component<RenderableComponent>(o)->renderable->flags;
+
+		auto &entry = entries[i];
+		entry.bounds = transform->world_aabb;
+		entry.center = transform->world_aabb.get_center();
+		entry.object = uint32_t(i);
+		entry.timestamp = get_component<CachedSpatialTransformTimestampComponent>(o)->last_timestamp;
+		entry.flags = flags;
+		entry.identity = transform;
+		entry.state = 0;
+		if (!transform->transform || (force_visible && (flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0))
+			entry.state |= RenderableCullingArrays::ALWAYS_VISIBLE_BIT;
+		if (transform->requires_motion_vectors)
+			entry.state |= RenderableCullingArrays::REQUIRES_MOTION_VECTORS_BIT;
+	}
+
+	// Objects which moved since the last build stay out of the BVH, so they do not force refits.
+	if (keep_moved)
+		for (size_t slot = 0; slot < count; slot++)
+			entries[culling.object_index[slot]].state |= culling.state[slot] & RenderableCullingArrays::MOVED_BIT;
+
+	auto static_end = std::partition(entries.begin(), entries.end(), [](const CullingBuildEntry &entry) {
+		return (entry.state & (RenderableCullingArrays::ALWAYS_VISIBLE_BIT | RenderableCullingArrays::MOVED_BIT)) == 0;
+	});
+	size_t static_count = size_t(static_end - entries.begin());
+
+	culling.nodes.clear();
+	if (static_count)
+		build_culling_bvh(culling.nodes, entries.data(), 0, uint32_t(static_count));
+
+	size_t padded_count = count + SIMD::FrustumCullBatchSize;
+	for (auto *v : { &culling.lo_x, &culling.lo_y, &culling.lo_z, &culling.hi_x, &culling.hi_y, &culling.hi_z })
+		v->resize(padded_count);
+	culling.flags.resize(count);
+	culling.state.resize(count);
+	culling.timestamps.resize(count);
+	culling.object_index.resize(count);
+	culling.identity.resize(count);
+
+	for (size_t slot = 0; slot < count; slot++)
+	{
+		auto &entry = entries[slot];
+		auto &lo = entry.bounds.get_minimum();
+		auto &hi = entry.bounds.get_maximum();
+		culling.lo_x[slot] = lo.x;
+		culling.lo_y[slot] = lo.y;
+		culling.lo_z[slot] = lo.z;
+		culling.hi_x[slot] = hi.x;
+		culling.hi_y[slot] = hi.y;
+		culling.hi_z[slot] = hi.z;
+		culling.flags[slot] = entry.flags;
+		culling.state[slot] = entry.state & ~RenderableCullingArrays::MOVED_BIT;
+		culling.timestamps[slot] = entry.timestamp;
+		culling.object_index[slot] = entry.object;
+		culling.identity[slot] = entry.identity;
+	}
+
+	culling.static_count = static_count;
+	culling.moved_static_count = 0;
+	culling.count = count;
+	culling.layout_epoch++;
+	culling.change_epoch++;
+	culling.changed_slots.clear();
+}
+
+template <typename T>
+static void update_culling_arrays(RenderableCullingArrays &culling, const T &objects, bool force_visible)
+{
+	size_t count = objects.size();
+	if (count != culling.count)
+	{
+		rebuild_culling_arrays(culling, objects, force_visible, false);
+		return;
+	}
+
+	bool refit = false;
+	std::vector<uint32_t> changed_slots;
+	for (size_t slot = 0; slot < count; slot++)
+	{
+		auto &o = objects[culling.object_index[slot]];
+		auto *transform = get_component<RenderInfoComponent>(o);
+
+		// Objects were both added and removed, the slots no longer map to the same objects.
+		if (transform != culling.identity[slot])
+		{
+			rebuild_culling_arrays(culling, objects, force_visible, false);
+			return;
+		}
+
+		uint8_t state = culling.state[slot];
+		if (transform->requires_motion_vectors)
+			state |= RenderableCullingArrays::REQUIRES_MOTION_VECTORS_BIT;
+		else
+			state &= ~RenderableCullingArrays::REQUIRES_MOTION_VECTORS_BIT;
+
+		uint32_t timestamp = get_component<CachedSpatialTransformTimestampComponent>(o)->last_timestamp;
+		if (timestamp != culling.timestamps[slot])
+		{
+			auto &lo = transform->world_aabb.get_minimum();
+			auto &hi = transform->world_aabb.get_maximum();
+			culling.lo_x[slot] = lo.x;
+			culling.lo_y[slot] = lo.y;
+			culling.lo_z[slot] = lo.z;
+			culling.hi_x[slot] = hi.x;
+			culling.hi_y[slot] = hi.y;
+			culling.hi_z[slot] = hi.z;
+			culling.timestamps[slot] = timestamp;
+
+			if (slot < culling.static_count)
+			{
+				refit = true;
+				if ((state & RenderableCullingArrays::MOVED_BIT) == 0)
+					culling.moved_static_count++;
+			}
+			state |= RenderableCullingArrays::MOVED_BIT;
+			changed_slots.push_back(uint32_t(slot));
+		}
+		else if (state != culling.state[slot])
+			changed_slots.push_back(uint32_t(slot));
+
+		culling.state[slot] = state;
+	}
+
+	if (!changed_slots.empty())
+	{
+		culling.changed_slots = std::move(changed_slots);
+		culling.change_epoch++;
+	}
+
+	// Once enough of the BVH moves, refitting degrades it too much. Rebuild with the movers split out.
+	if (culling.moved_static_count > std::max<size_t>(256, culling.static_count / 8))
+		rebuild_culling_arrays(culling, objects, force_visible, true);
+	else if (refit)
+		refit_culling_bvh(culling);
+}
+
+void Scene::update_culling_arrays()
+{
+	Granite::update_culling_arrays(opaque_culling, opaque, true);
+	Granite::update_culling_arrays(transparent_culling, transparent, true);
+	Granite::update_culling_arrays(static_shadowing_culling, static_shadowing, true);
+	Granite::update_culling_arrays(dynamic_shadowing_culling, dynamic_shadowing, true);
+	// Lights never honored RENDERABLE_FORCE_VISIBLE_BIT.
+	Granite::update_culling_arrays(positional_lights_culling, positional_lights, false);
+}
+
 void Scene::add_render_passes(RenderGraph &graph)
 {
 	for (auto &pass : render_pass_creators)
@@ -241,53 +728,76 @@ void Scene::gather_visible_render_pass_sinks(const vec3 &camera_pos, VisibilityL
 	}
 }
 
-static bool filter_true(const RenderInfoComponent *, RenderableFlags)
+static bool filter_true(RenderableFlags, bool)
 {
 	return true;
 }
 
-void Scene::gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list) const
+void Scene::gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list,
+                                              RenderableFlags skip_flags,
+                                              const OcclusionBuffer *occlusion) const
 {
-	gather_visible_renderables(frustum, list, opaque, 0, opaque.size(), filter_true);
+	gather_visible_renderables(frustum, list, opaque, opaque_culling, 0, opaque.size(),
+	                           [skip_flags](RenderableFlags flags, bool) {
+		                           return (flags & skip_flags) == 0;
+	                           }, occlusion);
 }
 
-void Scene::gather_visible_motion_vector_renderables(const Frustum &frustum, VisibilityList &list) const
+void Scene::gather_visible_motion_vector_renderables(const Frustum &frustum, VisibilityList &list,
+                                                     const OcclusionBuffer *occlusion) const
 {
-	gather_visible_renderables(frustum, list, opaque, 0, opaque.size(),
-	                           [](const RenderInfoComponent *info, RenderableFlags flags) {
+	gather_visible_renderables(frustum, list, opaque, opaque_culling, 0, opaque.size(),
+	                           [](RenderableFlags flags, bool requires_motion_vectors) {
 		                           return (flags & RENDERABLE_IMPLICIT_MOTION_BIT) == 0 &&
-		                                  info->requires_motion_vectors;
-	                           });
+		                                  requires_motion_vectors;
+	                           }, occlusion);
 }
 
 void Scene::gather_visible_opaque_renderables_subset(const Frustum &frustum, VisibilityList &list,
-                                                     unsigned index, unsigned num_indices) const
+                                                     unsigned index, unsigned num_indices,
+                                                     RenderableFlags skip_flags,
+                                                     const OcclusionBuffer *occlusion) const
 {
 	size_t start_index = (index * opaque.size()) / num_indices;
 	size_t end_index = ((index + 1) * opaque.size()) / num_indices;
-	gather_visible_renderables(frustum, list, opaque, start_index, end_index, filter_true);
+	gather_visible_renderables(frustum, list, opaque, opaque_culling, start_index, end_index,
+	                           [skip_flags](RenderableFlags flags, bool) {
+		                           return (flags & skip_flags) == 0;
+	                           }, occlusion);
 }
 
 void Scene::gather_visible_motion_vector_renderables_subset(const Frustum &frustum, VisibilityList &list,
-                                                            unsigned index, unsigned num_indices) const
+                                                            unsigned index, unsigned num_indices,
+                                                            const OcclusionBuffer *occlusion) const
 {
 	size_t start_index = (index * opaque.size()) / num_indices;
 	size_t end_index = ((index + 1) * opaque.size()) / num_indices;
-	gather_visible_renderables(frustum, list, opaque, start_index, end_index,
-	                           [](const RenderInfoComponent *info, RenderableFlags flags) {
+	gather_visible_renderables(frustum, list, opaque, opaque_culling, start_index, end_index,
+	                           [](RenderableFlags flags, bool requires_motion_vectors) {
 		                           return (flags & RENDERABLE_IMPLICIT_MOTION_BIT) == 0 &&
-		                                  info->requires_motion_vectors;
-	                           });
+		                                  requires_motion_vectors;
+	                           }, occlusion);
+}
+
+void Scene::set_occlusion_buffer(const OcclusionBuffer *buffer, const RenderContext *context)
+{
+	occlusion_buffer = buffer;
+	occlusion_context = context;
+}
+
+const OcclusionBuffer *Scene::get_occlusion_buffer(const RenderContext &context) const
+{
+	return occlusion_context == &context ? occlusion_buffer : nullptr;
 }
 
 void Scene::gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, transparent, 0, transparent.size(), filter_true);
+	gather_visible_renderables(frustum, list, transparent, transparent_culling, 0, transparent.size(), filter_true);
 }
 
 void Scene::gather_visible_static_shadow_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, static_shadowing, 0, static_shadowing.size(), filter_true);
+	gather_visible_renderables(frustum, list, static_shadowing, static_shadowing_culling, 0, static_shadowing.size(), filter_true);
 }
 
 void Scene::gather_visible_transparent_renderables_subset(const Frustum &frustum, VisibilityList &list,
@@ -295,7 +805,7 @@ void Scene::gather_visible_transparent_renderables_subset(const Frustum &frustum
 {
 	size_t start_index = (index * transparent.size()) / num_indices;
 	size_t end_index = ((index + 1) * transparent.size()) / num_indices;
-	gather_visible_renderables(frustum, list, transparent, start_index, end_index, filter_true);
+	gather_visible_renderables(frustum, list, transparent, transparent_culling, start_index, end_index, filter_true);
 }
 
 void Scene::gather_visible_static_shadow_renderables_subset(const Frustum &frustum, VisibilityList &list,
@@ -303,12 +813,23 @@ void Scene::gather_visible_static_shadow_renderables_subset(const Frustum &frust
 {
 	size_t start_index = (index * static_shadowing.size()) / num_indices;
 	size_t end_index = ((index + 1) * static_shadowing.size()) / num_indices;
-	gather_visible_renderables(frustum, list, static_shadowing, start_index, end_index, filter_true);
+	gather_visible_renderables(frustum, list, static_shadowing, static_shadowing_culling, start_index, end_index, filter_true);
+}
+
+void Scene::gather_visible_static_shadow_renderables_cached(const Frustum &frustum, VisibilityCache &cache,
+                                                            VisibilityList &list,
+                                                            unsigned index, unsigned num_indices) const
+{
+	size_t start_index = (index * static_shadowing.size()) / num_indices;
+	size_t end_index = ((index + 1) * static_shadowing.size()) / num_indices;
+	gather_visible_renderables_cached(frustum, cache, static_shadowing, static_shadowing_culling,
+	                                  start_index, end_index, filter_true);
+	list.insert(list.end(), cache.list.begin(), cache.list.end());
 }
 
 void Scene::gather_visible_dynamic_shadow_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, dynamic_shadowing, 0, dynamic_shadowing.size(), filter_true);
+	gather_visible_renderables(frustum, list, dynamic_shadowing, dynamic_shadowing_culling, 0, dynamic_shadowing.size(), filter_true);
 	for (auto &object : render_pass_shadowing)
 		list.push_back({ get_component<RenderableComponent>(object)->renderable.get(), nullptr });
 }
@@ -318,52 +839,79 @@ void Scene::gather_visible_dynamic_shadow_renderables_subset(const Frustum &frus
 {
 	size_t start_index = (index * dynamic_shadowing.size()) / num_indices;
 	size_t end_index = ((index + 1) * dynamic_shadowing.size()) / num_indices;
-	gather_visible_renderables(frustum, list, dynamic_shadowing, start_index, end_index, filter_true);
+	gather_visible_renderables(frustum, list, dynamic_shadowing, dynamic_shadowing_culling, start_index, end_index, filter_true);
 
 	if (index == 0)
 		for (auto &object : render_pass_shadowing)
 			list.push_back({ get_component<RenderableComponent>(object)->renderable.get(), nullptr });
 }
 
-static void gather_positional_lights(const Frustum &frustum, VisibilityList &list,
-                                     const ComponentGroupVector<
-		                                     RenderInfoComponent,
-		                                     RenderableComponent,
-		                                     CachedSpatialTransformTimestampComponent,
-		                                     PositionalLightComponent> &positional,
-                                     size_t start_index, size_t end_index)
+void Scene::gather_visible_dynamic_shadow_renderables_cached(const Frustum &frustum, VisibilityCache &cache,
+                                                             VisibilityList &list,
+                                                             unsigned index, unsigned num_indices) const
+{
+	size_t start_index = (index * dynamic_shadowing.size()) / num_indices;
+	size_t end_index = ((index + 1) * dynamic_shadowing.size()) / num_indices;
+	gather_visible_renderables_cached(frustum, cache, dynamic_shadowing, dynamic_shadowing_culling,
+	                                  start_index, end_index, filter_true);
+	list.insert(list.end(), cache.list.begin(), cache.list.end());
+
+	if (index == 0)
+		for (auto &object : render_pass_shadowing)
+			list.push_back({ get_component<RenderableComponent>(object)->renderable.get(), nullptr });
+}
+
+using PositionalLightGroup = ComponentGroupVector<
+		RenderInfoComponent,
+		RenderableComponent,
+		CachedSpatialTransformTimestampComponent,
+		PositionalLightComponent>;
+
+template <typename Func>
+static void cull_positional_lights(const Frustum &frustum, const PositionalLightGroup &positional,
+                                   const RenderableCullingArrays &culling,
+                                   size_t start_index, size_t end_index, const Func &func)
 {
+	if (culling.count == positional.size())
+	{
+		cull_slots(culling, frustum.get_planes(), start_index, end_index, [&](size_t slot) {
+			func(positional[culling.object_index[slot]]);
+		});
+		return;
+	}
+
 	for (size_t i = start_index; i < end_index; i++)
 	{
 		auto &o = positional[i];
 		auto *transform = get_component<RenderInfoComponent>(o);
+		if (!transform->transform || SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
+			func(o);
+	}
+}
+
+static void gather_positional_lights(const Frustum &frustum, VisibilityList &list,
+                                     const PositionalLightGroup &positional, const RenderableCullingArrays &culling,
+                                     size_t start_index, size_t end_index)
+{
+	cull_positional_lights(frustum, positional, culling, start_index, end_index,
+	                       [&](const PositionalLightGroup::value_type &o) {
+		auto *transform = get_component<RenderInfoComponent>(o);
 		auto *renderable = get_component<RenderableComponent>(o);
 		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
 
 		Util::Hasher h;
 		h.u64(timestamp->cookie);
 		h.u32(timestamp->last_timestamp);
-
-		if (transform->transform)
-		{
-			if (SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
-				list.push_back({ renderable->renderable.get(), transform, h.get() });
-		}
-		else
-			list.push_back({ renderable->renderable.get(), nullptr, h.get() });
-	}
+		list.push_back({ renderable->renderable.get(), transform->transform ? transform : nullptr, h.get() });
+	}, occlusion);
 }
 
 static void gather_positional_lights(const Frustum &frustum, PositionalLightList &list,
-                                     const ComponentGroupVector<RenderInfoComponent,
-		                                     RenderableComponent,
-		                                     CachedSpatialTransformTimestampComponent,
-		                                     PositionalLightComponent> &positional,
+                                     const PositionalLightGroup &positional, const RenderableCullingArrays &culling,
                                      size_t start_index, size_t end_index)
 {
-	for (size_t i = start_index; i < end_index; i++)
-	{
-		auto &o = positional[i];
+	cull_positional_lights(frustum, positional, culling, start_index, end_index,
+	                       [&](const PositionalLightGroup::value_type &o) {
 		auto *transform = get_component<RenderInfoComponent>(o);
 		auto *light = get_component<PositionalLightComponent>(o)->light;
 		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
@@ -371,20 +919,13 @@ static void gather_positional_lights(const Frustum &frustum, PositionalLightList
 		Util::Hasher h;
 		h.u64(timestamp->cookie);
 		h.u32(timestamp->last_timestamp);
-
-		if (transform->transform)
-		{
-			if (SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
-				list.push_back({ light, transform, h.get() });
-		}
-		else
-			list.push_back({ light, transform, h.get() });
-	}
+		list.push_back({ light, transform, h.get() });
+	});
 }
 
 void Scene::gather_visible_positional_lights(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_positional_lights(frustum, list, positional_lights, 0, positional_lights.size());
+	gather_positional_lights(frustum, list, positional_lights, positional_lights_culling, 0, positional_lights.size());
 }
 
 void Scene::gather_irradiance_affecting_positional_lights(PositionalLightList &list) const
@@ -404,7 +945,7 @@ void Scene::gather_irradiance_affecting_positional_lights(PositionalLightList &l
 
 void Scene::gather_visible_positional_lights(const Frustum &frustum, PositionalLightList &list) const
 {
-	gather_positional_lights(frustum, list, positional_lights, 0, positional_lights.size());
+	gather_positional_lights(frustum, list, positional_lights, positional_lights_culling, 0, positional_lights.size());
 }
 
 void Scene::gather_visible_volumetric_diffuse_lights(const Frustum &frustum, VolumetricDiffuseLightList &list) const
@@ -472,7 +1013,7 @@ void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, Visi
 {
 	size_t start_index = (index * positional_lights.size()) / num_indices;
 	size_t end_index = ((index + 1) * positional_lights.size()) / num_indices;
-	gather_positional_lights(frustum, list, positional_lights, start_index, end_index);
+	gather_positional_lights(frustum, list, positional_lights, positional_lights_culling, start_index, end_index);
 }
 
 void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, PositionalLightList &list,
@@ -480,7 +1021,7 @@ void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, Posi
 {
 	size_t start_index = (index * positional_lights.size()) / num_indices;
 	size_t end_index = ((index + 1) * positional_lights.size()) / num_indices;
-	gather_positional_lights(frustum, list, positional_lights, start_index, end_index);
+	gather_positional_lights(frustum, list, positional_lights, positional_lights_culling, start_index, end_index);
 }
 
 size_t Scene::get_opaque_renderables_count() const
@@ -576,6 +1117,7 @@ void Scene::update_all_transforms()
 	update_transform_tree();
 	update_transform_listener_components();
 	update_cached_transforms_range(0, spatials.size());
+	update_culling_arrays();
 }
 
 static void perform_update_skinning(Scene::Node * const *updates, size_t count)
@@ -662,6 +1204,7 @@ void Scene::update_transform_tree(TaskComposer *composer)
 				l.clear();
 			pending_node_updates_skin.clear();
 			pending_hierarchy_level_mask.store(0, std::memory_order_relaxed);
+			flattened_pending_nodes.clear();
 		});
 	}
 	else
@@ -671,6 +1214,7 @@ void Scene::update_transform_tree(TaskComposer *composer)
 			l.clear();
 		pending_node_updates_skin.clear();
 		pending_hierarchy_level_mask.store(0, std::memory_order_relaxed);
+		flattened_pending_nodes.clear();
 	}
 }
 
@@ -817,6 +1361,7 @@ void Scene::update_cached_transforms_range(size_t begin_range, size_t end_range)
 			}
 
 			timestamp->last_timestamp = new_timestamp;
+			pool.mark_changed(cached_transform);
 		}
 
 		// The first update won't have valid prev transforms.
@@ -906,9 +1451,47 @@ static void update_transform_tree_node(Scene::Node &node, const mat4 &transform)
 	node.clear_pending_update_no_atomic();
 }
 
+static void update_transform_tree_node(Scene::Node &node, const mat4 &transform, const mat4 &model)
+{
+	node.prev_cached_transform = node.cached_transform;
+	SIMD::mul(node.cached_transform.world_transform, transform, model);
+	node.update_timestamp();
+	node.clear_pending_update_no_atomic();
+}
+
 static void perform_updates(Scene::Node * const *updates, size_t count)
 {
-	for (size_t i = 0; i < count; i++)
+	// Gather local transforms four at a time so the TRS to matrix conversion runs over all lanes at once.
+	// Every node in a level only depends on the previous level, so order within a batch does not matter.
+	constexpr size_t batch_size = 4;
+	size_t i = 0;
+	for (; i + batch_size <= count; i += batch_size)
+	{
+		quat rotations[batch_size];
+		vec3 scales[batch_size];
+		vec3 translations[batch_size];
+		mat4 models[batch_size];
+
+		for (size_t j = 0; j < batch_size; j++)
+		{
+			auto &transform = updates[i + j]->transform;
+			rotations[j] = transform.rotation;
+			scales[j] = transform.scale;
+			translations[j] = transform.translation;
+		}
+
+		SIMD::compute_model_transforms4(models, rotations, scales, translations);
+
+		for (size_t j = 0; j < batch_size; j++)
+		{
+			auto *update = updates[i + j];
+			auto *parent = update->get_parent();
+			auto &transform = parent ? parent->cached_transform.world_transform : identity_transform;
+			update_transform_tree_node(*update, transform, models[j]);
+		}
+	}
+
+	for (; i < count; i++)
 	{
 		auto *update = updates[i];
 		auto *parent = update->get_parent();
@@ -1018,6 +1601,118 @@ Scene::NodeHandle Scene::Node::remove_child(Node *node)
 	return handle;
 }
 
+bool Scene::collect_static_subtree(Node &node, const mat4 &parent_transform,
+                                   vector<pair<NodeHandle, mat4>> &attached,
+                                   vector<Node *> &subtree)
+{
+	if (!node.is_static() || node.get_skin())
+		return false;
+
+	mat4 transform;
+	compute_model_transform(transform, node.transform.scale, node.transform.rotation, node.transform.translation,
+	                        parent_transform);
+
+	subtree.push_back(&node);
+	if (node.is_attached())
+		attached.emplace_back(node.reference_from_this(), transform);
+
+	for (auto &child : node.get_children())
+		if (!collect_static_subtree(*child, transform, attached, subtree))
+			return false;
+
+	return true;
+}
+
+static bool decompose_exact(const mat4 &m, Transform &transform)
+{
+	decompose(m, transform.scale, transform.rotation, transform.translation);
+
+	mat4 recomposed;
+	compute_model_transform(recomposed, transform.scale, transform.rotation, transform.translation, identity_transform);
+
+	// Shear from non-uniform scale under rotation is lost, and so is anything degenerate.
+	float magnitude = 1.0f;
+	for (int i = 0; i < 4; i++)
+		magnitude = std::max(magnitude, length(m[i]));
+
+	for (int i = 0; i < 4; i++)
+	{
+		vec4 diff = abs(recomposed[i] - m[i]);
+		float error = std::max(std::max(diff.x, diff.y), std::max(diff.z, diff.w));
+		if (!(error <= 1e-4f * magnitude))
+			return false;
+	}
+	return true;
+}
+
+size_t Scene::flatten_static_subtrees(Node &anchor)
+{
+	vector<NodeHandle> new_children;
+	vector<pair<NodeHandle, mat4>> attached;
+	vector<Transform> baked;
+	vector<Node *> subtree;
+	size_t removed = 0;
+	bool modified = false;
+
+	new_children.reserve(anchor.children.size());
+
+	for (auto &child : anchor.children)
+	{
+		attached.clear();
+		subtree.clear();
+
+		bool collapsible = collect_static_subtree(*child, identity_transform, attached, subtree);
+
+		// Nothing to gain for a static leaf which is already directly below the anchor.
+		if (collapsible && subtree.size() == 1)
+			collapsible = false;
+
+		if (collapsible)
+		{
+			baked.resize(attached.size());
+			for (size_t i = 0; i < attached.size() && collapsible; i++)
+				collapsible = decompose_exact(attached[i].second, baked[i]);
+		}
+
+		if (!collapsible)
+		{
+			removed += flatten_static_subtrees(*child);
+			new_children.push_back(child);
+			continue;
+		}
+
+		// The subtree nodes still hold references to each other, so tear it down before we drop anything.
+		// The handles in attached keep the nodes we need alive.
+		// Dropped nodes which are still queued for a transform update must live until the queue is drained.
+		child->parent = nullptr;
+		for (auto *node : subtree)
+		{
+			if (!node->is_attached() && node->node_is_pending_update.load(std::memory_order_relaxed))
+				flattened_pending_nodes.push_back(node->reference_from_this());
+
+			for (auto &grandchild : node->children)
+				grandchild->parent = nullptr;
+			node->children.clear();
+		}
+
+		for (size_t i = 0; i < attached.size(); i++)
+		{
+			auto &node = attached[i].first;
+			node->transform = baked[i];
+			node->parent = &anchor;
+			node->invalidate_cached_transform();
+			new_children.push_back(node);
+		}
+
+		removed += subtree.size() - attached.size();
+		modified = true;
+	}
+
+	if (modified)
+		anchor.children = move(new_children);
+	return removed;
+}
+
 Scene::NodeHandle Scene::Node::remove_node_from_hierarchy(Node *node)
 {
 	if (node->parent)
@@ -1059,6 +1754,7 @@ Entity *Scene::create_volumetric_diffuse_light(uvec3 resolution, Node *node)
 	{
 		transform->transform = &node->cached_transform;
 		timestamp->current_timestamp = node->get_timestamp_pointer();
+		node->mark_attached();
 	}
 	timestamp->cookie = transform_cookies.fetch_add(std::memory_order_relaxed);
 
@@ -1081,6 +1777,7 @@ Entity *Scene::create_volumetric_fog_region(Node *node)
 	{
 		transform->transform = &node->cached_transform;
 		timestamp->current_timestamp = node->get_timestamp_pointer();
+		node->mark_attached();
 	}
 	timestamp->cookie = transform_cookies.fetch_add(std::memory_order_relaxed);
 
@@ -1103,6 +1800,7 @@ Entity *Scene::create_volumetric_decal(Node *node)
 	{
 		transform->transform = &node->cached_transform;
 		timestamp->current_timestamp = node->get_timestamp_pointer();
+		node->mark_attached();
 	}
 	timestamp->cookie = transform_cookies.fetch_add(std::memory_order_relaxed);
 
@@ -1121,6 +1819,7 @@ Entity *Scene::create_light(const SceneFormats::LightInfo &light, Node *node)
 		auto *dir = entity->allocate_component<DirectionalLightComponent>();
 		auto *transform = entity->allocate_component<CachedTransformComponent>();
 		transform->transform = &node->cached_transform;
+		node->mark_attached();
 		dir->color = light.color;
 		break;
 	}
@@ -1154,6 +1853,7 @@ Entity *Scene::create_light(const SceneFormats::LightInfo &light, Node *node)
 		{
 			transform->transform = &node->cached_transform;
 			timestamp->current_timestamp = node->get_timestamp_pointer();
+			node->mark_attached();
 		}
 
 		auto *bounded = entity->allocate_component<BoundedComponent>();
@@ -1180,6 +1880,7 @@ Entity *Scene::create_renderable(AbstractRenderableHandle renderable, Node *node
 			transform->transform = &node->cached_transform;
 			transform->prev_transform = &node->prev_cached_transform;
 			timestamp->current_timestamp = node->get_timestamp_pointer();
+			node->mark_attached();
 
 			if (node->get_skin() && !node->get_skin()->cached_skin.empty())
 			{
@@ -35,8 +35,67 @@ namespace Granite
 {
 
 class RenderContext;
+class OcclusionBuffer;
 struct EnvironmentComponent;
 
+// Packed copy of what culling reads from a renderable group, with a BVH over the objects
+// which have not moved since it was built. Slots are in BVH order, object_index maps them back to the group.
+// Culling only touches the components of objects which survive.
+struct RenderableCullingArrays
+{
+	enum StateBits
+	{
+		ALWAYS_VISIBLE_BIT = 1 << 0,
+		REQUIRES_MOTION_VECTORS_BIT = 1 << 1,
+		MOVED_BIT = 1 << 2
+	};
+
+	struct Node
+	{
+		AABB bounds;
+		uint32_t first;
+		uint32_t count;
+		// The left child directly follows its parent. 0 for leaves.
+		uint32_t right;
+	};
+
+	// Padded so a full SIMD batch can be read from any slot.
+	std::vector<float> lo_x, lo_y, lo_z, hi_x, hi_y, hi_z;
+	std::vector<RenderableFlags> flags;
+	std::vector<uint8_t> state;
+	std::vector<uint32_t> timestamps;
+	std::vector<uint32_t> object_index;
+	std::vector<const RenderInfoComponent *> identity;
+
+	// Slots [0, static_count) are covered by nodes, the rest are tested linearly.
+	std::vector<Node> nodes;
+	size_t static_count = 0;
+	size_t moved_static_count = 0;
+	size_t count = 0;
+
+	// layout_epoch changes whenever slots are reassigned. change_epoch changes whenever any slot changes,
+	// and changed_slots lists the slots which changed in the update which produced it.
+	uint64_t layout_epoch = 0;
+	uint64_t change_epoch = 0;
+	std::vector<uint32_t> changed_slots;
+};
+
+// Visibility of one slice of a renderable group for a frustum, kept across frames.
+// The list is a superset of what the frustum sees. It is reused as long as the frustum stays within
+// the slightly enlarged frustum it was culled against, and only objects which moved since are re-tested.
+struct VisibilityCache
+{
+	VisibilityList list;
+	vec4 planes[6];
+	std::vector<uint32_t> slot_entry;
+	std::vector<uint32_t> entry_slot;
+	size_t begin_slot = 0;
+	size_t end_slot = 0;
+	uint64_t layout_epoch = 0;
+	uint64_t change_epoch = 0;
+	bool valid = false;
+};
+
 class Scene
 {
 public:
@@ -54,10 +113,21 @@ public:
 	void update_transform_tree(TaskComposer &composer);
 	void update_transform_listener_components();
 	void update_cached_transforms_subset(unsigned index, unsigned num_indices);
+	void update_cached_transforms_range(size_t start_index, size_t end_index);
 	size_t get_cached_transforms_count() const;
 
-	void gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list) const;
-	void gather_visible_motion_vector_renderables(const Frustum &frustum, VisibilityList &list) const;
+	// Refreshes the packed culling data and BVHs from the cached transforms.
+	// update_all_transforms() and Threaded::scene_update_cached_transforms() call this.
+	// Groups which changed size since the last refresh fall back to culling through the components.
+	void update_culling_arrays();
+
+	// Renderables with any of skip_flags set are left out, e.g. RENDERABLE_GPU_DRIVEN_BIT.
+	// If occlusion is set, renderables hidden behind its occluders are left out as well.
+	void gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list,
+	                                       RenderableFlags skip_flags = 0,
+	                                       const OcclusionBuffer *occlusion = nullptr) const;
+	void gather_visible_motion_vector_renderables(const Frustum &frustum, VisibilityList &list,
+	                                              const OcclusionBuffer *occlusion = nullptr) const;
 	void gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list) const;
 	void gather_visible_static_shadow_renderables(const Frustum &frustum, VisibilityList &list) const;
 	void gather_visible_dynamic_shadow_renderables(const Frustum &frustum, VisibilityList &list) const;
@@ -69,15 +139,26 @@ public:
 	void gather_visible_volumetric_fog_regions(const Frustum &frustum, VolumetricFogRegionList &list) const;
 
 	void gather_visible_opaque_renderables_subset(const Frustum &frustum, VisibilityList &list,
-	                                              unsigned index, unsigned num_indices) const;
+	                                              unsigned index, unsigned num_indices,
+	                                              RenderableFlags skip_flags = 0,
+	                                              const OcclusionBuffer *occlusion = nullptr) const;
 	void gather_visible_motion_vector_renderables_subset(const Frustum &frustum, VisibilityList &list,
-	                                                     unsigned index, unsigned num_indices) const;
+	                                                     unsigned index, unsigned num_indices,
+	                                                     const OcclusionBuffer *occlusion = nullptr) const;
 	void gather_visible_transparent_renderables_subset(const Frustum &frustum, VisibilityList &list,
 	                                                   unsigned index, unsigned num_indices) const;
 	void gather_visible_static_shadow_renderables_subset(const Frustum &frustum, VisibilityList &list,
 	                                                     unsigned index, unsigned num_indices) const;
 	void gather_visible_dynamic_shadow_renderables_subset(const Frustum &frustum, VisibilityList &list,
 	                                                      unsigned index, unsigned num_indices) const;
+	// Like the _subset() variants, but the visibility is kept in cache and updated incrementally
+	// from the previous frame before it is appended to list. Each index needs its own cache.
+	void gather_visible_static_shadow_renderables_cached(const Frustum &frustum, VisibilityCache &cache,
+	                                                     VisibilityList &list,
+	                                                     unsigned index, unsigned num_indices) const;
+	void gather_visible_dynamic_shadow_renderables_cached(const Frustum &frustum, VisibilityCache &cache,
+	                                                      VisibilityList &list,
+	                                                      unsigned index, unsigned num_indices) const;
 	void gather_visible_positional_lights_subset(const Frustum &frustum, VisibilityList &list,
 	                                             unsigned index, unsigned num_indices) const;
 	void gather_visible_positional_lights_subset(const Frustum &frustum, PositionalLightList &list,
@@ -93,6 +174,10 @@ public:
 	void gather_visible_render_pass_sinks(const vec3 &camera_pos, VisibilityList &list) const;
 	void gather_unbounded_renderables(VisibilityList &list) const;
 	void gather_opaque_floating_renderables(VisibilityList &list) const;
+	// Set by OcclusionCulling each frame. Null unless the buffer is rasterized from context's camera.
+	void set_occlusion_buffer(const OcclusionBuffer *buffer, const RenderContext *context);
+	const OcclusionBuffer *get_occlusion_buffer(const RenderContext &context) const;
+
 	EnvironmentComponent *get_environment() const;
 	EntityPool &get_entity_pool();
 
@@ -207,12 +292,39 @@ public:
 			node_is_pending_update.store(false, std::memory_order_relaxed);
 		}
 
+		// Static nodes never have their local transform modified after load,
+		// which allows Scene::flatten_static_subtrees() to collapse them.
+		inline void set_static(bool enable)
+		{
+			node_is_static = enable;
+		}
+
+		inline bool is_static() const
+		{
+			return node_is_static;
+		}
+
+		// Something holds raw pointers into this node (entities, cameras, etc.),
+		// so it must survive flattening.
+		inline void mark_attached()
+		{
+			node_is_attached = true;
+		}
+
+		inline bool is_attached() const
+		{
+			return node_is_attached;
+		}
+
 	private:
+		friend class Scene;
 		std::vector<Util::IntrusivePtr<Node>> children;
 		Skinning *skinning = nullptr;
 		Node *parent = nullptr;
 		uint32_t timestamp = 0;
 		std::atomic<bool> node_is_pending_update;
+		bool node_is_static = false;
+		bool node_is_attached = false;
 	};
 	using NodeHandle = Util::IntrusivePtr<Node>;
 	NodeHandle create_node();
@@ -233,6 +345,15 @@ public:
 		return root_node;
 	}
 
+	// Collapses subtrees below anchor where every node is static.
+	// Attached nodes in such a subtree become direct children of anchor with their transform
+	// relative to anchor baked in, and the other nodes are dropped.
+	// Subtrees containing skins, or transforms which cannot be expressed as scale, rotation and translation,
+	// are left alone, but their static descendants are still considered.
+	// Transform propagation then only walks the dynamic part of the hierarchy.
+	// Returns the number of nodes removed from the hierarchy.
+	size_t flatten_static_subtrees(Node &anchor);
+
 	Entity *create_renderable(AbstractRenderableHandle renderable, Node *node);
 	Entity *create_light(const SceneFormats::LightInfo &light, Node *node);
 	Entity *create_volumetric_diffuse_light(uvec3 resolution, Node *node);
@@ -279,6 +400,7 @@ private:
 			RenderableComponent,
 			CachedSpatialTransformTimestampComponent,
 			PositionalLightComponent> &positional_lights;
+	RenderableCullingArrays positional_lights_culling;
 	const ComponentGroupVector<
 			RenderInfoComponent,
 			PositionalLightComponent,
@@ -294,6 +416,12 @@ private:
 			RenderableComponent,
 			CachedSpatialTransformTimestampComponent,
 			CastsDynamicShadowComponent> &dynamic_shadowing;
+	RenderableCullingArrays opaque_culling;
+	const OcclusionBuffer *occlusion_buffer = nullptr;
+	const RenderContext *occlusion_context = nullptr;
+	RenderableCullingArrays transparent_culling;
+	RenderableCullingArrays static_shadowing_culling;
+	RenderableCullingArrays dynamic_shadowing_culling;
 	const ComponentGroupVector<
 			RenderPassComponent,
 			RenderableComponent,
@@ -340,8 +468,6 @@ private:
 	Util::IntrusiveList<Entity> queued_entities;
 	void destroy_entities(Util::IntrusiveList<Entity> &entity_list);
 
-	void update_cached_transforms_range(size_t start_index, size_t end_index);
-
 	// New transform update system:
 	enum { MaxNodeHierarchyLevels = 32 };
 	void push_pending_node_update(Node *node);
@@ -352,7 +478,12 @@ private:
 	Util::AtomicAppendBuffer<Node *, 8> pending_node_updates_skin;
 	Util::AtomicAppendBuffer<Node *, 8> pending_node_update_per_level[MaxNodeHierarchyLevels];
 	std::atomic<uint32_t> pending_hierarchy_level_mask;
+	std::vector<NodeHandle> flattened_pending_nodes;
 
 	void update_transform_tree(TaskComposer *composer);
+
+	bool collect_static_subtree(Node &node, const mat4 &parent_transform,
+	                            std::vector<std::pair<NodeHandle, mat4>> &attached,
+	                            std::vector<Node *> &subtree);
 };
 }
@@ -22,11 +22,18 @@
 
 #include "scene_loader.hpp"
 #include "gltf.hpp"
+#include "native_scene.hpp"
 #include "scene_formats.hpp"
 #include "rapidjson_wrapper.hpp"
 #include "mesh_util.hpp"
+#include "material_manager.hpp"
 #include "enum_cast.hpp"
 #include "ground.hpp"
+#include "ground_quadtree.hpp"
+#include "thread_group.hpp"
+#include "transforms.hpp"
+#include <algorithm>
+#include <unordered_set>
 
 using namespace std;
 using namespace rapidjson;
@@ -41,6 +48,12 @@ SceneLoader::SceneLoader()
 	animation_system = make_unique<AnimationSystem>();
 }
 
+SceneLoader::~SceneLoader()
+{
+	if (async_load && async_load->task)
+		async_load->task->wait();
+}
+
 unique_ptr<AnimationSystem> SceneLoader::consume_animation_system()
 {
 	return move(animation_system);
@@ -58,6 +71,10 @@ Scene::NodeHandle SceneLoader::load_scene_to_root_node(const std::string &path)
 	{
 		return parse_gltf(path);
 	}
+	else if (ext == "gscene")
+	{
+		return parse_native_scene(path);
+	}
 	else
 	{
 		string json;
@@ -71,17 +88,31 @@ void SceneLoader::load_scene(const std::string &path)
 {
 	auto node = load_scene_to_root_node(path);
 	scene->set_root_node(node);
+	MaterialManager::get().prune_unused_materials();
 }
 
 Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subscene)
 {
-	auto &parser = *subscene.parser;
+	return build_tree_for_parser(*subscene.parser, subscene.meshes);
+}
+
+template <typename Parser>
+Scene::NodeHandle SceneLoader::build_tree_for_parser(const Parser &parser, const std::vector<AbstractRenderableHandle> &meshes,
+                                                     std::vector<PendingRenderable> *pending)
+{
 	std::vector<Scene::NodeHandle> nodes;
 	nodes.reserve(parser.get_nodes().size());
 
 	auto &scene_nodes = parser.get_scenes()[parser.get_default_scene()];
 	auto touched = build_used_nodes_in_scene(scene_nodes, parser.get_nodes());
 
+	// Anything which is not animated never moves after load, so it can be flattened.
+	std::unordered_set<uint32_t> animated;
+	for (auto &animation : parser.get_animations())
+		if (!animation.skinning)
+			for (auto &channel : animation.channels)
+				animated.insert(channel.node_index);
+
 	unsigned node_index = 0;
 	for (auto &node : parser.get_nodes())
 	{
@@ -108,6 +139,7 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 			else
 				nodeptr = scene->create_node();
 
+			nodeptr->set_static(!node.has_skin && !animated.count(node_index));
 			nodes.push_back(nodeptr);
 			nodeptr->transform.translation = node.transform.translation;
 			nodeptr->transform.rotation = node.transform.rotation;
@@ -138,8 +170,17 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 				if (nodes[child])
 					nodes[i]->add_child(nodes[child]);
 
+			// Pending renderables are created later, so pin the node now.
+			if (!node.meshes.empty())
+				nodes[i]->mark_attached();
+
 			for (auto &mesh : node.meshes)
-				scene->create_renderable(subscene.meshes[mesh], nodes[i].get());
+			{
+				if (pending)
+					pending->push_back({ nodes[i], i, mesh, vec3(0.0f) });
+				else
+					scene->create_renderable(meshes[mesh], nodes[i].get());
+			}
 		}
 		i++;
 	}
@@ -158,6 +199,7 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 		{
 			auto *t = cam_entity->allocate_component<CachedTransformComponent>();
 			t->transform = &nodes[camera.node_index]->cached_transform;
+			nodes[camera.node_index]->mark_attached();
 		}
 	}
 
@@ -177,6 +219,10 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 		root->add_child(nodes[scene_node_index]);
 #endif
 
+	size_t flattened = scene->flatten_static_subtrees(*root);
+	if (flattened)
+		LOGI("Flattened %u static nodes.\n", unsigned(flattened));
+
 	return root;
 }
 
@@ -298,6 +344,147 @@ Scene::NodeHandle SceneLoader::parse_gltf(const std::string &path)
 	return build_tree_for_subscene(subscene);
 }
 
+Scene::NodeHandle SceneLoader::load_scene_async(const std::string &path)
+{
+	if (async_load && async_load->task)
+		async_load->task->wait();
+
+	async_load = make_unique<AsyncLoad>();
+	auto &load = *async_load;
+	load.path = path;
+	load.root = scene->create_node();
+	load.parsed = false;
+
+	auto ext = Path::ext(path);
+	bool native = ext == "gscene";
+	if (!native && ext != "gltf" && ext != "glb")
+	{
+		LOGE("Async loading is only supported for glTF and native scenes.\n");
+		load.failed = true;
+		load.parsed = true;
+		return load.root;
+	}
+
+	auto parse = [&load, native]() {
+		try
+		{
+			if (native)
+				load.native = make_unique<SceneFormats::NativeSceneParser>(load.path);
+			else
+				load.gltf = make_unique<GLTF::Parser>(load.path);
+		}
+		catch (const exception &e)
+		{
+			LOGE("Failed to load scene %s: %s\n", load.path.c_str(), e.what());
+			load.failed = true;
+		}
+		load.parsed.store(true, memory_order_release);
+	};
+
+	auto *group = GRANITE_THREAD_GROUP();
+	if (!group)
+	{
+		parse();
+		return load.root;
+	}
+
+	// Suspendable, so the glTF parser can build meshes wide on the same group.
+	load.task = group->create_suspendable_task(move(parse));
+	load.task->set_desc("scene-loader-parse");
+	load.task->set_priority(TaskPriority::Background);
+	load.task->flush();
+
+	return load.root;
+}
+
+template <typename Parser>
+static void compute_node_positions(const Parser &parser, uint32_t index, const mat4 &parent, vector<vec3> &positions)
+{
+	auto &node = parser.get_nodes()[index];
+	mat4 world;
+	compute_model_transform(world, node.transform.scale, node.transform.rotation, node.transform.translation, parent);
+	positions[index] = world[3].xyz();
+	for (auto child : node.children)
+		compute_node_positions(parser, child, world, positions);
+}
+
+template <typename Parser>
+bool SceneLoader::update_async_load(const Parser &parser, const vec3 &camera_position, unsigned max_meshes)
+{
+	auto &load = *async_load;
+
+	if (!load.inserted)
+	{
+		load.meshes.resize(parser.get_meshes().size());
+		load.root->add_child(build_tree_for_parser(parser, load.meshes, &load.pending));
+		load.inserted = true;
+
+		// Node origins are good enough to order meshes, the hierarchy is not animated until it is in the scene.
+		vector<vec3> node_positions(parser.get_nodes().size());
+		for (auto root : parser.get_scenes()[parser.get_default_scene()].node_indices)
+			compute_node_positions(parser, root, mat4(1.0f), node_positions);
+		for (auto &renderable : load.pending)
+			renderable.position = node_positions[renderable.node_index];
+	}
+
+	// Nearest last, so they can be popped off the back.
+	sort(load.pending.begin(), load.pending.end(), [&](const PendingRenderable &a, const PendingRenderable &b) {
+		return distance(a.position, camera_position) > distance(b.position, camera_position);
+	});
+
+	for (unsigned i = 0; i < max_meshes && !load.pending.empty(); i++)
+	{
+		auto &renderable = load.pending.back();
+		auto &mesh = load.meshes[renderable.mesh_index];
+		if (!mesh)
+			mesh = create_imported_mesh(parser.get_meshes()[renderable.mesh_index], parser.get_materials().data());
+		scene->create_renderable(mesh, renderable.node.get());
+		load.pending.pop_back();
+	}
+
+	return !load.pending.empty();
+}
+
+bool SceneLoader::update_async_load(const vec3 &camera_position, unsigned max_meshes)
+{
+	if (!async_load)
+		return false;
+
+	auto &load = *async_load;
+	if (!load.parsed.load(memory_order_acquire))
+		return true;
+
+	bool pending = false;
+	if (!load.failed)
+	{
+		if (load.native)
+			pending = update_async_load(*load.native, camera_position, max_meshes);
+		else
+			pending = update_async_load(*load.gltf, camera_position, max_meshes);
+	}
+
+	if (!pending)
+	{
+		if (load.task)
+			load.task->wait();
+		async_load.reset();
+	}
+
+	return pending;
+}
+
+Scene::NodeHandle SceneLoader::parse_native_scene(const std::string &path)
+{
+	SceneFormats::NativeSceneParser parser(path);
+
+	std::vector<AbstractRenderableHandle> meshes;
+	meshes.reserve(parser.get_meshes().size());
+	for (auto &mesh : parser.get_meshes())
+		meshes.push_back(create_imported_mesh(mesh, parser.get_materials().data()));
+
+	return build_tree_for_parser(parser, meshes);
+}
+
 Scene::NodeHandle SceneLoader::parse_scene_format(const std::string &path, const std::string &json)
 {
 	Document doc;
@@ -591,7 +778,42 @@ Scene::NodeHandle SceneLoader::parse_scene_format(const std::string &path, const
 		}
 	};
 
-	if (doc.HasMember("terrain"))
+	if (doc.HasMember("terrain") && doc["terrain"].HasMember("tileDirectory"))
+	{
+		auto &terrain = doc["terrain"];
+
+		GroundQuadtreeInfo info;
+		info.tile_directory = Path::relpath(path, terrain["tileDirectory"].GetString());
+		info.occlusionmap = Path::relpath(path, terrain["occlusionmap"].GetString());
+		info.base_color = Path::relpath(path, terrain["baseColorTexture"].GetString());
+		info.normalmap_fine = Path::relpath(path, terrain["normalTexture"].GetString());
+		info.splatmap = Path::relpath(path, terrain["splatmapTexture"].GetString());
+
+		if (terrain.HasMember("bandlimitedPixel"))
+			info.bandlimited_pixel = terrain["bandlimitedPixel"].GetBool();
+		if (terrain.HasMember("tilingFactor"))
+			info.tiling_factor = vec2(terrain["tilingFactor"].GetFloat());
+		if (terrain.HasMember("levels"))
+			info.num_levels = terrain["levels"].GetUint();
+		if (terrain.HasMember("residentLevels"))
+			info.resident_levels = terrain["residentLevels"].GetUint();
+		if (terrain.HasMember("tileResolution"))
+			info.tile_resolution = terrain["tileResolution"].GetUint();
+		if (terrain.HasMember("maxResidentTiles"))
+			info.max_resident_tiles = terrain["maxResidentTiles"].GetUint();
+		if (terrain.HasMember("worldSize"))
+			info.world_size = terrain["worldSize"].GetFloat();
+		if (terrain.HasMember("heightScale"))
+			info.height_scale = terrain["heightScale"].GetFloat();
+		if (terrain.HasMember("lodDistance"))
+			info.lod_distance = terrain["lodDistance"].GetFloat();
+
+		auto node = scene->create_node();
+		read_transform(node->transform, terrain);
+		root->add_child(node);
+		GroundQuadtree::add_to_scene(*scene, info, node);
+	}
+	else if (doc.HasMember("terrain"))
 	{
 		auto &terrain = doc["terrain"];
 
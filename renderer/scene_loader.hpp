@@ -24,7 +24,9 @@
 
 #include "scene.hpp"
 #include "gltf.hpp"
+#include "native_scene.hpp"
 #include "animation_system.hpp"
+#include <atomic>
 #include <memory>
 #include <string>
 
@@ -34,6 +36,7 @@ class SceneLoader
 {
 public:
 	SceneLoader();
+	~SceneLoader();
 
 	// Loads scene and sets the root node of the loaded scene.
 	void load_scene(const std::string &path);
@@ -42,6 +45,16 @@ public:
 	// You must insert the node manually into the scene as appropriate.
 	Scene::NodeHandle load_scene_to_root_node(const std::string &path);
 
+	// Parses a glTF, GLB or .gscene file on the thread group and returns an empty root node right away,
+	// which can be inserted into the scene. update_async_load() fills it in as the file is parsed.
+	// Pair with TextureManager::set_load_placeholders_enabled() so textures do not block rendering either.
+	Scene::NodeHandle load_scene_async(const std::string &path);
+
+	// Call once per frame on the main thread. Once parsing completes, the node hierarchy is inserted,
+	// and up to max_meshes meshes are created per call, nearest to camera_position first.
+	// Returns true while the load is still in progress.
+	bool update_async_load(const vec3 &camera_position, unsigned max_meshes = 32);
+
 	Scene &get_scene()
 	{
 		return *scene;
@@ -58,12 +71,42 @@ private:
 	};
 	std::unordered_map<std::string, SubsceneData> subscenes;
 
+	struct PendingRenderable
+	{
+		Scene::NodeHandle node;
+		uint32_t node_index;
+		uint32_t mesh_index;
+		vec3 position;
+	};
+
+	struct AsyncLoad
+	{
+		std::string path;
+		Scene::NodeHandle root;
+		std::unique_ptr<GLTF::Parser> gltf;
+		std::unique_ptr<SceneFormats::NativeSceneParser> native;
+		std::vector<AbstractRenderableHandle> meshes;
+		std::vector<PendingRenderable> pending;
+		TaskGroupHandle task;
+		std::atomic_bool parsed;
+		bool failed = false;
+		bool inserted = false;
+	};
+	std::unique_ptr<AsyncLoad> async_load;
+
+	template <typename Parser>
+	bool update_async_load(const Parser &parser, const vec3 &camera_position, unsigned max_meshes);
+
 	std::unique_ptr<Scene> scene;
 	std::unique_ptr<AnimationSystem> animation_system;
 	Scene::NodeHandle parse_scene_format(const std::string &path, const std::string &json);
 	Scene::NodeHandle parse_gltf(const std::string &path);
+	Scene::NodeHandle parse_native_scene(const std::string &path);
 
 	Scene::NodeHandle build_tree_for_subscene(const SubsceneData &subscene);
+	template <typename Parser>
+	Scene::NodeHandle build_tree_for_parser(const Parser &parser, const std::vector<AbstractRenderableHandle> &meshes,
+	                                        std::vector<PendingRenderable> *pending = nullptr);
 	void load_animation(const std::string &path, SceneFormats::Animation &animation);
 };
 }
\ No newline at end of file
@@ -23,6 +23,7 @@
 #include "scene_renderer.hpp"
 #include "threaded_scene.hpp"
 #include "mesh_util.hpp"
+#include "thread_group.hpp"
 
 namespace Granite
 {
@@ -116,6 +117,12 @@ static RendererSuite::Type get_depth_renderer_type(SceneRendererFlags flags)
 	}
 }
 
+// GPU-driven instances are drawn by the GPUScene renderable, which is gathered along with opaque floating renderables.
+static RenderableFlags get_opaque_skip_flags(SceneRendererFlags flags)
+{
+	return (flags & SCENE_RENDERER_SKIP_OPAQUE_FLOATING_BIT) == 0 ? RENDERABLE_GPU_DRIVEN_BIT : 0;
+}
+
 void RenderPassSceneRenderer::prepare_render_pass()
 {
 	prepare_setup_queues();
@@ -125,6 +132,7 @@ void RenderPassSceneRenderer::prepare_render_pass()
 	auto *context = setup_data.context;
 	auto &frustum = context->get_visibility_frustum();
 	auto *scene = setup_data.scene;
+	auto *occlusion = scene->get_occlusion_buffer(*context);
 
 	auto &queue_transparent = queue_per_task_transparent[0];
 	auto &queue_opaque = queue_per_task_opaque[0];
@@ -133,7 +141,7 @@ void RenderPassSceneRenderer::prepare_render_pass()
 	if (setup_data.flags & (SCENE_RENDERER_FORWARD_OPAQUE_BIT | SCENE_RENDERER_FORWARD_Z_PREPASS_BIT))
 	{
 		scene->gather_visible_render_pass_sinks(context->get_render_parameters().camera_position, visible);
-		scene->gather_visible_opaque_renderables(frustum, visible);
+		scene->gather_visible_opaque_renderables(frustum, visible, get_opaque_skip_flags(setup_data.flags), occlusion);
 		if ((setup_data.flags & SCENE_RENDERER_SKIP_OPAQUE_FLOATING_BIT) == 0)
 			scene->gather_opaque_floating_renderables(visible);
 
@@ -158,7 +166,7 @@ void RenderPassSceneRenderer::prepare_render_pass()
 			scene->gather_opaque_floating_renderables(visible);
 		if ((setup_data.flags & SCENE_RENDERER_SKIP_UNBOUNDED_BIT) == 0)
 			scene->gather_unbounded_renderables(visible);
-		scene->gather_visible_opaque_renderables(frustum, visible);
+		scene->gather_visible_opaque_renderables(frustum, visible, get_opaque_skip_flags(setup_data.flags), occlusion);
 		queue_opaque.push_renderables(*context, visible.data(), visible.size());
 	}
 
@@ -224,6 +232,8 @@ void RenderPassSceneRenderer::prepare_setup_queues()
 
 void RenderPassSceneRenderer::enqueue_prepare_render_pass(TaskComposer &composer)
 {
+	auto *occlusion = setup_data.scene->get_occlusion_buffer(*setup_data.context);
+
 	auto &setup_group = composer.begin_pipeline_stage();
 	setup_group.enqueue_task([this]() {
 		prepare_setup_queues();
@@ -245,9 +255,11 @@ void RenderPassSceneRenderer::enqueue_prepare_render_pass(TaskComposer &composer
 		}
 
 		if (setup_data.flags & (SCENE_RENDERER_FORWARD_OPAQUE_BIT | SCENE_RENDERER_FORWARD_Z_PREPASS_BIT))
-			Threaded::scene_gather_opaque_renderables(*setup_data.scene, composer, setup_data.context->get_visibility_frustum(), visible_per_task, MaxTasks);
+			Threaded::scene_gather_opaque_renderables(*setup_data.scene, composer, setup_data.context->get_visibility_frustum(), visible_per_task, MaxTasks,
+		                                          get_opaque_skip_flags(setup_data.flags), occlusion);
 		else if (setup_data.flags & SCENE_RENDERER_MOTION_VECTOR_BIT)
-			Threaded::scene_gather_motion_vector_renderables(*setup_data.scene, composer, setup_data.context->get_visibility_frustum(), visible_per_task, MaxTasks);
+			Threaded::scene_gather_motion_vector_renderables(*setup_data.scene, composer, setup_data.context->get_visibility_frustum(), visible_per_task, MaxTasks,
+			                                                 occlusion);
 
 		if (setup_data.flags & SCENE_RENDERER_FORWARD_Z_PREPASS_BIT)
 		{
@@ -289,7 +301,8 @@ void RenderPassSceneRenderer::enqueue_prepare_render_pass(TaskComposer &composer
 					setup_data.scene->gather_unbounded_renderables(visible_per_task[0]);
 			});
 		}
-		Threaded::scene_gather_opaque_renderables(*setup_data.scene, composer, setup_data.context->get_visibility_frustum(), visible_per_task, MaxTasks);
+		Threaded::scene_gather_opaque_renderables(*setup_data.scene, composer, setup_data.context->get_visibility_frustum(), visible_per_task, MaxTasks,
+		                                          get_opaque_skip_flags(setup_data.flags), occlusion);
 		Threaded::compose_parallel_push_renderables(composer, *setup_data.context, queue_per_task_opaque,
 		                                            visible_per_task, MaxTasks,
 		                                            Threaded::PushType::Normal);
@@ -305,18 +318,37 @@ void RenderPassSceneRenderer::enqueue_prepare_render_pass(TaskComposer &composer
 
 	if (setup_data.flags & SCENE_RENDERER_DEPTH_BIT)
 	{
+		bool cached = (setup_data.flags & SCENE_RENDERER_CACHED_VISIBILITY_BIT) != 0;
+		auto &frustum = setup_data.context->get_visibility_frustum();
+
 		if (setup_data.flags & SCENE_RENDERER_DEPTH_DYNAMIC_BIT)
 		{
-			Threaded::scene_gather_dynamic_shadow_renderables(*setup_data.scene, composer,
-			                                                  setup_data.context->get_visibility_frustum(),
-			                                                  visible_per_task, nullptr, MaxTasks);
+			if (cached)
+			{
+				Threaded::scene_gather_dynamic_shadow_renderables_cached(*setup_data.scene, composer, frustum,
+				                                                         visible_per_task, dynamic_shadow_cache,
+				                                                         MaxTasks);
+			}
+			else
+			{
+				Threaded::scene_gather_dynamic_shadow_renderables(*setup_data.scene, composer, frustum,
+				                                                  visible_per_task, nullptr, MaxTasks);
+			}
 		}
 
 		if (setup_data.flags & SCENE_RENDERER_DEPTH_STATIC_BIT)
 		{
-			Threaded::scene_gather_static_shadow_renderables(*setup_data.scene, composer,
-			                                                 setup_data.context->get_visibility_frustum(),
-			                                                 visible_per_task, nullptr, MaxTasks);
+			if (cached)
+			{
+				Threaded::scene_gather_static_shadow_renderables_cached(*setup_data.scene, composer, frustum,
+				                                                        visible_per_task, static_shadow_cache,
+				                                                        MaxTasks);
+			}
+			else
+			{
+				Threaded::scene_gather_static_shadow_renderables(*setup_data.scene, composer, frustum,
+				                                                 visible_per_task, nullptr, MaxTasks);
+			}
 		}
 
 		Threaded::compose_parallel_push_renderables(composer, *setup_data.context, queue_per_task_depth,
@@ -422,4 +454,132 @@ bool RenderPassSceneRenderer::get_clear_color(unsigned, VkClearColorValue *value
 		*value = clear_color_value;
 	return true;
 }
+
+void RenderPassShadowCascadesRenderer::init(const Setup &setup)
+{
+	setup_data = setup;
+}
+
+void RenderPassShadowCascadesRenderer::set_refresh_mask(uint32_t mask)
+{
+	refresh_mask = mask;
+}
+
+bool RenderPassShadowCascadesRenderer::cascade_needs_refresh(unsigned cascade) const
+{
+	return !setup_data.preserve_contents || (refresh_mask & (1u << cascade)) != 0;
+}
+
+bool RenderPassShadowCascadesRenderer::render_pass_is_separate_layered() const
+{
+	return true;
+}
+
+bool RenderPassShadowCascadesRenderer::get_clear_depth_stencil(VkClearDepthStencilValue *value) const
+{
+	// Preserved cascades are loaded, and refreshed cascades are cleared in build_render_pass_separate_layer().
+	if (setup_data.preserve_contents)
+		return false;
+
+	if (value)
+		*value = { 1.0f, 0u };
+	return true;
+}
+
+void RenderPassShadowCascadesRenderer::enqueue_prepare_render_pass(TaskComposer &composer)
+{
+	{
+		auto &group = composer.begin_pipeline_stage();
+		group.set_desc("shadow-cascades-setup");
+		group.enqueue_task([this]() {
+			auto &renderer = setup_data.suite->get_renderer(get_depth_renderer_type(setup_data.flags));
+			for (unsigned cascade = 0; cascade < NumShadowCascades; cascade++)
+			{
+				for (auto &visible : visible_per_task[cascade])
+					visible.clear();
+				for (auto &queue : queue_per_task[cascade])
+					renderer.begin(queue);
+			}
+		});
+	}
+
+	auto &per_cascade_stage = composer.begin_pipeline_stage();
+	per_cascade_stage.set_desc("shadow-cascades");
+
+	for (unsigned cascade = 0; cascade < NumShadowCascades; cascade++)
+	{
+		TaskComposer cascade_composer(composer.get_thread_group());
+		cascade_composer.set_incoming_task(composer.get_pipeline_stage_dependency());
+
+		auto &context = setup_data.contexts[cascade];
+		auto refresh = [this, cascade]() { return cascade_needs_refresh(cascade); };
+		bool cached = (setup_data.flags & SCENE_RENDERER_CACHED_VISIBILITY_BIT) != 0;
+
+		if (setup_data.flags & SCENE_RENDERER_DEPTH_DYNAMIC_BIT)
+		{
+			if (cached)
+			{
+				Threaded::scene_gather_dynamic_shadow_renderables_cached(*setup_data.scene, cascade_composer,
+				                                                         context.get_visibility_frustum(),
+				                                                         visible_per_task[cascade],
+				                                                         dynamic_shadow_cache[cascade], MaxTasks,
+				                                                         refresh);
+			}
+			else
+			{
+				Threaded::scene_gather_dynamic_shadow_renderables(*setup_data.scene, cascade_composer,
+				                                                  context.get_visibility_frustum(),
+				                                                  visible_per_task[cascade], nullptr, MaxTasks,
+				                                                  refresh);
+			}
+		}
+
+		if (setup_data.flags & SCENE_RENDERER_DEPTH_STATIC_BIT)
+		{
+			if (cached)
+			{
+				Threaded::scene_gather_static_shadow_renderables_cached(*setup_data.scene, cascade_composer,
+				                                                        context.get_visibility_frustum(),
+				                                                        visible_per_task[cascade],
+				                                                        static_shadow_cache[cascade], MaxTasks,
+				                                                        refresh);
+			}
+			else
+			{
+				Threaded::scene_gather_static_shadow_renderables(*setup_data.scene, cascade_composer,
+				                                                 context.get_visibility_frustum(),
+				                                                 visible_per_task[cascade], nullptr, MaxTasks,
+				                                                 refresh);
+			}
+		}
+
+		Threaded::compose_parallel_push_renderables(cascade_composer, context, queue_per_task[cascade],
+		                                            visible_per_task[cascade], MaxTasks,
+		                                            Threaded::PushType::Depth);
+
+		composer.get_thread_group().add_dependency(per_cascade_stage, *cascade_composer.get_outgoing_task());
+	}
+}
+
+void RenderPassShadowCascadesRenderer::build_render_pass_separate_layer(Vulkan::CommandBuffer &cmd, unsigned layer)
+{
+	if (layer >= NumShadowCascades || !cascade_needs_refresh(layer))
+		return;
+
+	if (setup_data.preserve_contents)
+	{
+		auto &vp = cmd.get_viewport();
+		VkClearRect rect = {};
+		rect.rect.extent.width = uint32_t(vp.width);
+		rect.rect.extent.height = uint32_t(vp.height);
+		rect.layerCount = 1;
+		VkClearValue value = {};
+		value.depthStencil = { 1.0f, 0u };
+		cmd.clear_quad(0, rect, value, VK_IMAGE_ASPECT_DEPTH_BIT);
+	}
+
+	auto type = get_depth_renderer_type(setup_data.flags);
+	setup_data.suite->get_renderer(type).flush(cmd, queue_per_task[layer][0], setup_data.contexts[layer],
+	                                           Renderer::DEPTH_BIAS_BIT | Renderer::SKIP_SORTING_BIT);
+}
 }
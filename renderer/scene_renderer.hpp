@@ -50,7 +50,10 @@ enum SceneRendererFlagBits : uint32_t
 	SCENE_RENDERER_FALLBACK_DEPTH_BIT = 1 << 14,
 	SCENE_RENDERER_MOTION_VECTOR_BIT = 1 << 15,
 	SCENE_RENDERER_SKIP_UNBOUNDED_BIT = 1 << 16,
-	SCENE_RENDERER_SKIP_OPAQUE_FLOATING_BIT = 1 << 17
+	SCENE_RENDERER_SKIP_OPAQUE_FLOATING_BIT = 1 << 17,
+	// Shadow casters for SCENE_RENDERER_DEPTH_BIT are culled through a VisibilityCache, which is reused
+	// while the view barely moves. The cached lists are conservative, so a few more objects may be drawn.
+	SCENE_RENDERER_CACHED_VISIBILITY_BIT = 1 << 18
 };
 using SceneRendererFlags = uint32_t;
 
@@ -90,6 +93,8 @@ protected:
 	RenderQueue queue_per_task_opaque[MaxTasks];
 	RenderQueue queue_per_task_transparent[MaxTasks];
 	mutable RenderQueue queue_non_tasked;
+	VisibilityCache static_shadow_cache[MaxTasks];
+	VisibilityCache dynamic_shadow_cache[MaxTasks];
 
 	void build_render_pass_inner(Vulkan::CommandBuffer &cmd) const;
 	void setup_debug_probes();
@@ -100,4 +105,43 @@ protected:
 
 	void prepare_setup_queues();
 };
+
+// Renders directional shadow cascades as separate layers, each with its own context and render queues.
+// Culling and queue building for the cascades run in parallel.
+// With preserve_contents, the depth output must use ATTACHMENT_INFO_PRESERVE_BIT,
+// and cascades which are not in the refresh mask keep what was rendered in an earlier frame.
+class RenderPassShadowCascadesRenderer : public RenderPassInterface
+{
+public:
+	struct Setup
+	{
+		Scene *scene;
+		// NumShadowCascades contexts, one per layer.
+		const RenderContext *contexts;
+		const RendererSuite *suite;
+		SceneRendererFlags flags;
+		bool preserve_contents;
+	};
+	void init(const Setup &setup);
+
+	// Must be set before the prepare tasks run. Ignored unless preserve_contents is set.
+	void set_refresh_mask(uint32_t mask);
+
+	bool render_pass_is_separate_layered() const override;
+	bool get_clear_depth_stencil(VkClearDepthStencilValue *value) const override;
+	void enqueue_prepare_render_pass(TaskComposer &composer) override;
+	void build_render_pass_separate_layer(Vulkan::CommandBuffer &cmd, unsigned layer) override;
+
+private:
+	Setup setup_data = {};
+	uint32_t refresh_mask = ~0u;
+
+	enum { MaxTasks = 4 };
+	VisibilityList visible_per_task[NumShadowCascades][MaxTasks];
+	RenderQueue queue_per_task[NumShadowCascades][MaxTasks];
+	VisibilityCache static_shadow_cache[NumShadowCascades][MaxTasks];
+	VisibilityCache dynamic_shadow_cache[NumShadowCascades][MaxTasks];
+
+	bool cascade_needs_refresh(unsigned cascade) const;
+};
 }
@@ -0,0 +1,227 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stb_truetype.h"
+#include "sdf_glyph_cache.hpp"
+#include "application_events.hpp"
+#include "device.hpp"
+#include "logging.hpp"
+#include <stdexcept>
+#include <string.h>
+
+using namespace Vulkan;
+using namespace std;
+
+namespace Granite
+{
+struct SDFGlyphCache::FontInfo
+{
+	stbtt_fontinfo info;
+};
+
+SDFGlyphCache::~SDFGlyphCache()
+{
+}
+
+SDFGlyphCache::SDFGlyphCache(const std::string &path, unsigned atlas_size)
+{
+	info.reset(new FontInfo);
+
+	file = GRANITE_FILESYSTEM()->open(path, FileMode::ReadOnly);
+	if (!file)
+		throw runtime_error("Failed to open font.");
+
+	auto *mapped = static_cast<const unsigned char *>(file->map());
+	if (!mapped)
+		throw runtime_error("Failed to map font.");
+
+	if (!stbtt_InitFont(&info->info, mapped, stbtt_GetFontOffsetForIndex(mapped, 0)))
+		throw runtime_error("Failed to parse font.");
+
+	base_scale = stbtt_ScaleForPixelHeight(&info->info, float(BaseSize));
+	cells_per_row = atlas_size / CellSize;
+	num_cells = cells_per_row * cells_per_row;
+	if (!num_cells)
+		throw runtime_error("Glyph atlas is too small.");
+
+	reset_cells();
+
+	EVENT_MANAGER_REGISTER(SDFGlyphCache, on_frame_tick, FrameTickEvent);
+	EVENT_MANAGER_REGISTER_LATCH(SDFGlyphCache, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+}
+
+void SDFGlyphCache::reset_cells()
+{
+	generation++;
+	glyphs.clear();
+	lru.clear();
+	pending_uploads.clear();
+	free_cells.clear();
+	free_cells.reserve(num_cells);
+	for (unsigned i = num_cells; i; i--)
+		free_cells.push_back(i - 1);
+}
+
+bool SDFGlyphCache::on_frame_tick(const FrameTickEvent &)
+{
+	frame_count++;
+	return true;
+}
+
+ivec2 SDFGlyphCache::get_cell_offset(uint32_t cell) const
+{
+	return ivec2(int(cell % cells_per_row), int(cell / cells_per_row)) * int(CellSize);
+}
+
+const SDFGlyphCache::Glyph *SDFGlyphCache::request_glyph(uint32_t codepoint)
+{
+	auto itr = glyphs.find(codepoint);
+	if (itr != glyphs.end())
+	{
+		itr->second.last_used = frame_count;
+		lru.splice(lru.begin(), lru, itr->second.lru);
+		return &itr->second;
+	}
+
+	int glyph_index = stbtt_FindGlyphIndex(&info->info, int(codepoint));
+	int width = 0, height = 0, xoff = 0, yoff = 0;
+	unsigned char *sdf = stbtt_GetGlyphSDF(&info->info, base_scale, glyph_index, Padding, 128,
+	                                       128.0f / float(Padding), &width, &height, &xoff, &yoff);
+
+	// Whitespace has no outline, only an advance.
+	if (!sdf)
+		return nullptr;
+
+	uint32_t cell;
+	if (!free_cells.empty())
+	{
+		cell = free_cells.back();
+		free_cells.pop_back();
+	}
+	else
+	{
+		auto victim = glyphs.find(lru.back());
+		if (victim->second.last_used == frame_count)
+		{
+			LOGW("SDFGlyphCache: all %u cells are in use this frame, dropping glyph U+%04X.\n", num_cells, codepoint);
+			stbtt_FreeSDF(sdf, nullptr);
+			return nullptr;
+		}
+
+		cell = victim->second.cell;
+		generation++;
+		lru.pop_back();
+		glyphs.erase(victim);
+	}
+
+	// Upload the full cell so bilinear taps at the glyph border never see a previous occupant.
+	width = std::min<int>(width, CellSize);
+	height = std::min<int>(height, CellSize);
+	Upload upload;
+	upload.cell = cell;
+	upload.bitmap.resize(CellSize * CellSize);
+	for (int y = 0; y < height; y++)
+		memcpy(upload.bitmap.data() + y * CellSize, sdf + y * width, width);
+	pending_uploads.push_back(std::move(upload));
+	stbtt_FreeSDF(sdf, nullptr);
+
+	lru.push_front(codepoint);
+	auto &glyph = glyphs[codepoint];
+	glyph.codepoint = codepoint;
+	glyph.cell = cell;
+	glyph.offset = ivec2(xoff, yoff);
+	glyph.size = ivec2(width, height);
+	glyph.advance = get_advance(codepoint);
+	glyph.last_used = frame_count;
+	glyph.lru = lru.begin();
+	return &glyph;
+}
+
+float SDFGlyphCache::get_advance(uint32_t codepoint)
+{
+	auto itr = advances.find(codepoint);
+	if (itr != advances.end())
+		return itr->second;
+
+	int advance = 0, left_side_bearing = 0;
+	stbtt_GetCodepointHMetrics(&info->info, int(codepoint), &advance, &left_side_bearing);
+	float scaled = float(advance) * base_scale;
+	advances[codepoint] = scaled;
+	return scaled;
+}
+
+float SDFGlyphCache::get_kerning(uint32_t codepoint, uint32_t next_codepoint) const
+{
+	return float(stbtt_GetCodepointKernAdvance(&info->info, int(codepoint), int(next_codepoint))) * base_scale;
+}
+
+void SDFGlyphCache::flush_uploads()
+{
+	if (pending_uploads.empty() || !device)
+		return;
+
+	auto cmd = device->request_command_buffer();
+	cmd->image_barrier(*atlas, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	for (auto &upload : pending_uploads)
+	{
+		ivec2 offset = get_cell_offset(upload.cell);
+		memcpy(cmd->update_image(*atlas, { offset.x, offset.y, 0 }, { CellSize, CellSize, 1 }, 0, 0,
+		                         { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 }),
+		       upload.bitmap.data(), upload.bitmap.size());
+	}
+
+	cmd->image_barrier(*atlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	device->submit(cmd);
+	pending_uploads.clear();
+}
+
+const ImageView *SDFGlyphCache::get_view() const
+{
+	return atlas ? &atlas->get_view() : nullptr;
+}
+
+void SDFGlyphCache::on_device_created(const DeviceCreatedEvent &created)
+{
+	device = &created.get_device();
+
+	unsigned size = cells_per_row * CellSize;
+	auto image_info = ImageCreateInfo::immutable_2d_image(size, size, VK_FORMAT_R8_UNORM);
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	atlas = device->create_image(image_info);
+	device->set_name(*atlas, "sdf-glyph-atlas");
+
+	// Glyphs rasterized before the device existed were never uploaded.
+	reset_cells();
+}
+
+void SDFGlyphCache::on_device_destroyed(const DeviceCreatedEvent &)
+{
+	atlas.reset();
+	device = nullptr;
+	reset_cells();
+}
+}
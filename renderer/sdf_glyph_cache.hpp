@@ -0,0 +1,111 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "event.hpp"
+#include "image.hpp"
+#include "application_wsi_events.hpp"
+#include "filesystem.hpp"
+#include "math.hpp"
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Granite
+{
+class FrameTickEvent;
+
+// Rasterizes signed distance field glyphs on demand into a fixed cell atlas.
+// One SDF rendition serves every pixel size, so Fonts of different sizes can share a cache.
+// Cells are recycled least recently used first, but never while a glyph is in use by the current frame.
+class SDFGlyphCache : public EventHandler
+{
+public:
+	// Glyphs are rasterized at BaseSize pixels, with Padding pixels of distance falloff on each side.
+	enum { BaseSize = 32, Padding = 6, CellSize = 48 };
+
+	explicit SDFGlyphCache(const std::string &path, unsigned atlas_size = 1024);
+	~SDFGlyphCache();
+
+	struct Glyph
+	{
+		uint32_t codepoint;
+		uint32_t cell;
+		// In BaseSize pixels relative to the pen position on the baseline.
+		ivec2 offset;
+		ivec2 size;
+		float advance;
+		uint64_t last_used;
+		std::list<uint32_t>::iterator lru;
+	};
+
+	// Returns nullptr if the glyph has no outline, or if every cell is in use this frame.
+	const Glyph *request_glyph(uint32_t codepoint);
+	float get_advance(uint32_t codepoint);
+	float get_kerning(uint32_t codepoint, uint32_t next_codepoint) const;
+	ivec2 get_cell_offset(uint32_t cell) const;
+
+	// Uploads glyphs rasterized since the last call. Must happen before the atlas is sampled.
+	void flush_uploads();
+
+	const Vulkan::ImageView *get_view() const;
+
+	// Changes whenever a cell is given to another glyph, which invalidates previously emitted quads.
+	uint64_t get_generation() const
+	{
+		return generation;
+	}
+
+private:
+	struct FontInfo;
+	std::unique_ptr<FontInfo> info;
+	std::unique_ptr<File> file;
+	float base_scale = 0.0f;
+
+	Vulkan::Device *device = nullptr;
+	Vulkan::ImageHandle atlas;
+	unsigned cells_per_row = 0;
+	unsigned num_cells = 0;
+
+	std::unordered_map<uint32_t, Glyph> glyphs;
+	std::unordered_map<uint32_t, float> advances;
+	// Codepoints ordered from most to least recently used.
+	std::list<uint32_t> lru;
+	std::vector<uint32_t> free_cells;
+	uint64_t frame_count = 0;
+	uint64_t generation = 0;
+
+	struct Upload
+	{
+		uint32_t cell;
+		std::vector<uint8_t> bitmap;
+	};
+	std::vector<Upload> pending_uploads;
+
+	void reset_cells();
+	bool on_frame_tick(const FrameTickEvent &e);
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+};
+}
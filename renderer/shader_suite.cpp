@@ -69,18 +69,40 @@ ShaderSuite::get_variant_signatures() const
 	return variant_signature_cache;
 }
 
-void ShaderSuite::register_variant_signature(const VariantSignatureKey &key)
+static Hash hash_variant_signature(const ShaderSuite::VariantSignatureKey &key)
 {
 	Hasher h;
 	h.u32(ecast(key.coverage));
 	h.u32(key.attribute_mask);
 	h.u32(key.texture_mask);
 	h.u32(key.variant_id);
-	variant_signature_cache.emplace_yield(h.get(), key);
+	return h.get();
+}
+
+void ShaderSuite::register_variant_signature(const VariantSignatureKey &key)
+{
+	variant_signature_cache.emplace_yield(hash_variant_signature(key), key);
+}
+
+void ShaderSuite::set_usage_recording(bool enable)
+{
+	record_usage = enable;
 }
 
 Vulkan::Program *ShaderSuite::get_program(DrawPipelineCoverage coverage, uint32_t attribute_mask,
                                           uint32_t texture_mask, uint32_t variant_id)
+{
+	return request_program(coverage, attribute_mask, texture_mask, variant_id, record_usage);
+}
+
+Vulkan::Program *ShaderSuite::warm_program(DrawPipelineCoverage coverage, uint32_t attribute_mask,
+                                           uint32_t texture_mask, uint32_t variant_id)
+{
+	return request_program(coverage, attribute_mask, texture_mask, variant_id, false);
+}
+
+Vulkan::Program *ShaderSuite::request_program(DrawPipelineCoverage coverage, uint32_t attribute_mask,
+                                              uint32_t texture_mask, uint32_t variant_id, bool count_use)
 {
 	if (!program)
 	{
@@ -128,6 +150,14 @@ Vulkan::Program *ShaderSuite::get_program(DrawPipelineCoverage coverage, uint32_
 		defines.emplace_back("HAVE_BONE_INDEX", !!(attribute_mask & MESH_ATTRIBUTE_BONE_INDEX_BIT));
 		defines.emplace_back("HAVE_BONE_WEIGHT", !!(attribute_mask & MESH_ATTRIBUTE_BONE_WEIGHTS_BIT));
 		defines.emplace_back("HAVE_VERTEX_COLOR", !!(attribute_mask & MESH_ATTRIBUTE_VERTEX_COLOR_BIT));
+		if (texture_mask & MATERIAL_BINDLESS_BIT)
+			defines.emplace_back("BINDLESS_MATERIAL", 1);
+		if (texture_mask & MATERIAL_INDIRECT_INSTANCES_BIT)
+			defines.emplace_back("INDIRECT_INSTANCES", 1);
+		if (texture_mask & MATERIAL_STORAGE_INSTANCES_BIT)
+			defines.emplace_back("STORAGE_INSTANCES", 1);
+		if (texture_mask & MATERIAL_CACHED_SKINNING_BIT)
+			defines.emplace_back("CACHED_SKINNING", 1);
 
 		if (attribute_mask & MESH_ATTRIBUTE_UV_BIT)
 		{
@@ -143,6 +173,18 @@ Vulkan::Program *ShaderSuite::get_program(DrawPipelineCoverage coverage, uint32_
 		variant = variants.emplace_yield(hash, program_variant);
 	}
 
+	if (count_use)
+	{
+		VariantSignatureKey signature = {};
+		signature.coverage = coverage;
+		signature.attribute_mask = attribute_mask;
+		signature.texture_mask = texture_mask;
+		signature.variant_id = variant_id;
+		auto *sig = variant_signature_cache.find(hash_variant_signature(signature));
+		if (sig)
+			sig->hits.fetch_add(1, std::memory_order_relaxed);
+	}
+
 	return variant->get()->get_program();
 }
 
@@ -25,6 +25,7 @@
 #include "shader_manager.hpp"
 #include "intrusive_hash_map.hpp"
 #include "mesh.hpp"
+#include <atomic>
 
 namespace Granite
 {
@@ -39,6 +40,12 @@ public:
 
 	Vulkan::Program *get_program(DrawPipelineCoverage coverage, uint32_t attribute_mask, uint32_t texture_mask, uint32_t variant_id = 0);
 
+	// Same as get_program(), but never counts as a use of the variant.
+	Vulkan::Program *warm_program(DrawPipelineCoverage coverage, uint32_t attribute_mask, uint32_t texture_mask, uint32_t variant_id);
+
+	// Counts get_program() calls per variant signature. Costs an extra lookup per call, meant for recording sessions.
+	void set_usage_recording(bool enable);
+
 	std::vector<std::pair<std::string, int>> &get_base_defines()
 	{
 		return base_defines;
@@ -60,6 +67,7 @@ public:
 	{
 		explicit VariantSignature(const VariantSignatureKey &key_) : key(key_) {}
 		VariantSignatureKey key;
+		std::atomic<uint32_t> hits{0};
 	};
 
 	// Can be used for serialization, and the variant map can be pre-warmed using known signatures.
@@ -74,5 +82,9 @@ private:
 
 	Util::ThreadSafeIntrusiveHashMap<VariantSignature> variant_signature_cache;
 	void register_variant_signature(const VariantSignatureKey &key);
+	bool record_usage = false;
+
+	Vulkan::Program *request_program(DrawPipelineCoverage coverage, uint32_t attribute_mask,
+	                                 uint32_t texture_mask, uint32_t variant_id, bool count_use);
 };
 }
\ No newline at end of file
@@ -0,0 +1,537 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sparse_texture.hpp"
+#include "texture_format.hpp"
+#include "format.hpp"
+#include "bitops.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace Granite
+{
+// Keeps buffer offsets valid for any texel size.
+static constexpr VkDeviceSize SparseUploadAlignment = 16;
+
+static VkDeviceSize align_upload_offset(VkDeviceSize offset)
+{
+	return (offset + SparseUploadAlignment - 1) & ~(SparseUploadAlignment - 1);
+}
+
+bool SparseTexture::init(Vulkan::Device &device_, const SparseTextureCreateInfo &info, RegionLoader loader_)
+{
+	device = &device_;
+	loader = std::move(loader_);
+	max_uploads_per_frame = info.max_uploads_per_frame;
+	max_resident_pages = info.max_resident_pages;
+
+	if (!device->supports_sparse_residency())
+	{
+		LOGE("Sparse residency is not supported.\n");
+		return false;
+	}
+
+	if (!Util::is_pow2(info.width) || !Util::is_pow2(info.height) ||
+	    Vulkan::format_compression_type(info.format) != Vulkan::FormatCompressionType::Uncompressed)
+	{
+		LOGE("Sparse textures must be uncompressed with power-of-two dimensions.\n");
+		return false;
+	}
+
+	Vulkan::ImageCreateInfo image_info;
+	image_info.domain = Vulkan::ImageDomain::Physical;
+	image_info.width = info.width;
+	image_info.height = info.height;
+	image_info.levels = info.levels;
+	image_info.format = info.format;
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_info.initial_layout = VK_IMAGE_LAYOUT_GENERAL;
+	image_info.misc = Vulkan::IMAGE_MISC_SPARSE_RESIDENCY_BIT |
+	                  Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+	                  Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT;
+
+	image = device->create_image(image_info);
+	if (!image)
+		return false;
+
+	// Transfers and sampling happen on different queues while pages stream in, so never transition.
+	image->set_layout(Vulkan::Layout::General);
+
+	auto &sparse_reqs = image->get_sparse_requirements();
+	granularity = sparse_reqs.formatProperties.imageGranularity;
+	page_size = image->get_sparse_memory_requirements().alignment;
+	texel_size = Vulkan::TextureFormatLayout::format_block_size(info.format, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	unsigned num_levels = image->get_create_info().levels;
+	num_page_levels = std::min(sparse_reqs.imageMipTailFirstLod, num_levels);
+	if (num_page_levels == num_levels || num_page_levels > MaxSparseTextureLevels)
+	{
+		LOGE("Sparse texture needs a mip tail, and at most %u levels with pages.\n", MaxSparseTextureLevels);
+		return false;
+	}
+
+	unsigned num_pages = 0;
+	for (unsigned level = 0; level < num_page_levels; level++)
+	{
+		Level l = {};
+		l.first_page = num_pages;
+		l.pages_x = (image->get_width(level) + granularity.width - 1) / granularity.width;
+		l.pages_y = (image->get_height(level) + granularity.height - 1) / granularity.height;
+		levels.push_back(l);
+		num_pages += l.pages_x * l.pages_y;
+	}
+
+	pages.resize(num_pages);
+	for (unsigned level = 0; level < num_page_levels; level++)
+	{
+		auto &l = levels[level];
+		for (unsigned y = 0; y < l.pages_y; y++)
+		{
+			for (unsigned x = 0; x < l.pages_x; x++)
+			{
+				auto &page = pages[l.first_page + y * l.pages_x + x];
+				page.level = level;
+				page.x = x;
+				page.y = y;
+			}
+		}
+	}
+
+	// Layout matches SparseFeedback in inc/sparse_feedback.h.
+	feedback_header_size = 16 + 16 * MaxSparseTextureLevels;
+	feedback_bits_size = ((num_pages + 31) / 32) * sizeof(uint32_t);
+	std::vector<uint32_t> initial_feedback((feedback_header_size + feedback_bits_size) / sizeof(uint32_t));
+	initial_feedback[0] = num_page_levels;
+	for (unsigned level = 0; level < num_page_levels; level++)
+	{
+		initial_feedback[4 + 4 * level + 0] = levels[level].first_page;
+		initial_feedback[4 + 4 * level + 1] = levels[level].pages_x;
+		initial_feedback[4 + 4 * level + 2] = levels[level].pages_y;
+	}
+
+	Vulkan::BufferCreateInfo buffer_info;
+	buffer_info.domain = Vulkan::BufferDomain::Device;
+	buffer_info.size = feedback_header_size + feedback_bits_size;
+	buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+	                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+	                    VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	feedback = device->create_buffer(buffer_info, initial_feedback.data());
+
+	buffer_info.domain = Vulkan::BufferDomain::CachedHost;
+	buffer_info.size = feedback_bits_size;
+	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	unsigned num_contexts = device->get_num_frame_contexts();
+	readbacks.clear();
+	for (unsigned i = 0; i < num_contexts; i++)
+		readbacks.push_back(device->create_buffer(buffer_info));
+	readback_valid.assign(num_contexts, false);
+
+	Vulkan::MemoryAllocateInfo alloc_info;
+	alloc_info.requirements.size = page_size * info.max_resident_pages;
+	alloc_info.requirements.alignment = page_size;
+	alloc_info.requirements.memoryTypeBits = image->get_sparse_memory_requirements().memoryTypeBits;
+	alloc_info.required_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	alloc_info.mode = Vulkan::AllocationMode::OptimalResource;
+	pool = device->allocate_memory(alloc_info);
+	if (!pool)
+	{
+		LOGE("Failed to allocate sparse page pool.\n");
+		return false;
+	}
+
+	free_slots.clear();
+	for (unsigned i = info.max_resident_pages; i; i--)
+		free_slots.push_back(i - 1);
+
+	residency.assign(levels.front().pages_x * levels.front().pages_y, uint8_t(num_page_levels));
+	auto map_info = Vulkan::ImageCreateInfo::immutable_2d_image(levels.front().pages_x, levels.front().pages_y,
+	                                                            VK_FORMAT_R8_UINT);
+	map_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	map_info.initial_layout = VK_IMAGE_LAYOUT_GENERAL;
+	map_info.misc = Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+	                Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT;
+	Vulkan::ImageInitialData initial_map = { residency.data(), 0, 0 };
+	residency_map = device->create_image(map_info, &initial_map);
+	if (!residency_map)
+		return false;
+	residency_map->set_layout(Vulkan::Layout::General);
+
+	if (!feedback || !upload_mip_tail())
+		return false;
+
+	device->set_name(*image, "sparse-texture");
+	device->set_name(*residency_map, "sparse-texture-residency");
+	return true;
+}
+
+const Vulkan::Image &SparseTexture::get_image() const
+{
+	return *image;
+}
+
+const Vulkan::Image &SparseTexture::get_residency_map() const
+{
+	return *residency_map;
+}
+
+const Vulkan::Buffer &SparseTexture::get_feedback_buffer() const
+{
+	return *feedback;
+}
+
+unsigned SparseTexture::get_num_resident_pages() const
+{
+	return max_resident_pages - unsigned(free_slots.size());
+}
+
+bool SparseTexture::upload_mip_tail()
+{
+	std::vector<VkBufferImageCopy> copies;
+	VkDeviceSize size = 0;
+
+	for (unsigned level = num_page_levels; level < image->get_create_info().levels; level++)
+	{
+		VkBufferImageCopy copy = {};
+		copy.bufferOffset = align_upload_offset(size);
+		copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		copy.imageExtent = { image->get_width(level), image->get_height(level), 1 };
+		copies.push_back(copy);
+		size = copy.bufferOffset + VkDeviceSize(copy.imageExtent.width) * copy.imageExtent.height * texel_size;
+	}
+
+	Vulkan::BufferCreateInfo staging_info;
+	staging_info.domain = Vulkan::BufferDomain::Host;
+	staging_info.size = size;
+	staging_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	auto staging = device->create_buffer(staging_info);
+	if (!staging)
+		return false;
+
+	auto *ptr = static_cast<uint8_t *>(device->map_host_buffer(*staging, Vulkan::MEMORY_ACCESS_WRITE_BIT));
+	if (!ptr)
+		return false;
+
+	for (auto &copy : copies)
+	{
+		auto &extent = copy.imageExtent;
+		if (!loader(copy.imageSubresource.mipLevel, 0, 0, extent.width, extent.height, ptr + copy.bufferOffset))
+		{
+			LOGW("Failed to load mip tail level %u of sparse texture.\n", copy.imageSubresource.mipLevel);
+			memset(ptr + copy.bufferOffset, 0, VkDeviceSize(extent.width) * extent.height * texel_size);
+		}
+	}
+	device->unmap_host_buffer(*staging, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+
+	auto cmd = device->request_command_buffer(Vulkan::CommandBuffer::Type::AsyncTransfer);
+	cmd->copy_buffer_to_image(*image, *staging, unsigned(copies.size()), copies.data());
+	Vulkan::Semaphore sem;
+	device->submit(cmd, nullptr, 1, &sem);
+	device->add_wait_semaphore(Vulkan::CommandBuffer::Type::Generic, std::move(sem),
+	                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, true);
+	return true;
+}
+
+void SparseTexture::request_page(const Page &page)
+{
+	// Parents must be resident before their children, so the residency map only has to track one level per page.
+	unsigned x = page.x;
+	unsigned y = page.y;
+	for (unsigned level = page.level; level < num_page_levels; level++, x >>= 1, y >>= 1)
+	{
+		auto &l = levels[level];
+		auto &p = pages[l.first_page + std::min(y, l.pages_y - 1) * l.pages_x + std::min(x, l.pages_x - 1)];
+		p.last_requested = frame;
+		if (p.slot < 0)
+			p.wanted = true;
+	}
+}
+
+int SparseTexture::find_parent(unsigned page_index) const
+{
+	auto &page = pages[page_index];
+	if (page.level + 1 >= num_page_levels)
+		return -1;
+
+	auto &l = levels[page.level + 1];
+	unsigned x = std::min(page.x >> 1, l.pages_x - 1);
+	unsigned y = std::min(page.y >> 1, l.pages_y - 1);
+	return int(l.first_page + y * l.pages_x + x);
+}
+
+void SparseTexture::consume_feedback(unsigned context)
+{
+	auto *bits = static_cast<const uint32_t *>(
+			device->map_host_buffer(*readbacks[context], Vulkan::MEMORY_ACCESS_READ_BIT));
+	if (!bits)
+		return;
+
+	unsigned num_words = unsigned(feedback_bits_size / sizeof(uint32_t));
+	for (unsigned word = 0; word < num_words; word++)
+	{
+		Util::for_each_bit(bits[word], [&](unsigned bit) {
+			unsigned index = word * 32 + bit;
+			if (index < pages.size())
+				request_page(pages[index]);
+		});
+	}
+
+	device->unmap_host_buffer(*readbacks[context], Vulkan::MEMORY_ACCESS_READ_BIT);
+}
+
+VkSparseImageMemoryBind SparseTexture::make_bind(unsigned page_index, int slot) const
+{
+	auto &page = pages[page_index];
+	VkSparseImageMemoryBind bind = {};
+	bind.subresource = { VK_IMAGE_ASPECT_COLOR_BIT, page.level, 0 };
+	bind.offset = { int32_t(page.x * granularity.width), int32_t(page.y * granularity.height), 0 };
+	bind.extent.width = std::min(granularity.width, image->get_width(page.level) - uint32_t(bind.offset.x));
+	bind.extent.height = std::min(granularity.height, image->get_height(page.level) - uint32_t(bind.offset.y));
+	bind.extent.depth = 1;
+
+	if (slot >= 0)
+	{
+		auto &alloc = pool->get_allocation();
+		bind.memory = alloc.get_memory();
+		bind.memoryOffset = alloc.get_offset() + VkDeviceSize(slot) * page_size;
+	}
+
+	return bind;
+}
+
+VkBufferImageCopy SparseTexture::make_page_copy(unsigned page_index, VkDeviceSize offset) const
+{
+	auto bind = make_bind(page_index, -1);
+	VkBufferImageCopy copy = {};
+	copy.bufferOffset = offset;
+	copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, bind.subresource.mipLevel, 0, 1 };
+	copy.imageOffset = bind.offset;
+	copy.imageExtent = bind.extent;
+	return copy;
+}
+
+void SparseTexture::update_residency_map()
+{
+	auto &base = levels.front();
+	for (unsigned y = 0; y < base.pages_y; y++)
+	{
+		for (unsigned x = 0; x < base.pages_x; x++)
+		{
+			unsigned finest = num_page_levels;
+			for (unsigned level = num_page_levels; level; level--)
+			{
+				auto &l = levels[level - 1];
+				unsigned px = std::min(x >> (level - 1), l.pages_x - 1);
+				unsigned py = std::min(y >> (level - 1), l.pages_y - 1);
+				if (pages[l.first_page + py * l.pages_x + px].slot < 0)
+					break;
+				finest = level - 1;
+			}
+			residency[y * base.pages_x + x] = uint8_t(finest);
+		}
+	}
+}
+
+void SparseTexture::stream_pages()
+{
+	// Requests which were not repeated for a while are stale.
+	uint64_t stale_frames = 2 * readbacks.size();
+	std::vector<unsigned> wanted;
+	std::vector<unsigned> evictable;
+
+	for (unsigned i = 0; i < pages.size(); i++)
+	{
+		auto &page = pages[i];
+		if (page.wanted && page.last_requested + stale_frames < frame)
+			page.wanted = false;
+
+		if (page.wanted)
+			wanted.push_back(i);
+		else if (page.slot >= 0 && page.resident_children == 0 && page.last_requested < frame)
+			evictable.push_back(i);
+	}
+
+	if (wanted.empty())
+		return;
+
+	// Coarse levels first, so that parents become resident before their children.
+	std::sort(wanted.begin(), wanted.end(), [this](unsigned a, unsigned b) {
+		return pages[a].level > pages[b].level;
+	});
+
+	// Least recently requested pages are evicted first, pop from the back.
+	std::sort(evictable.begin(), evictable.end(), [this](unsigned a, unsigned b) {
+		return pages[a].last_requested > pages[b].last_requested;
+	});
+
+	std::vector<VkSparseImageMemoryBind> unbinds;
+	std::vector<VkSparseImageMemoryBind> binds;
+	std::vector<unsigned> uploads;
+
+	for (auto index : wanted)
+	{
+		if (uploads.size() >= max_uploads_per_frame)
+			break;
+
+		int parent = find_parent(index);
+		if (parent >= 0 && pages[parent].slot < 0)
+			continue;
+
+		int slot = -1;
+		if (!free_slots.empty())
+		{
+			slot = int(free_slots.back());
+			free_slots.pop_back();
+		}
+		else
+		{
+			while (!evictable.empty() && slot < 0)
+			{
+				unsigned victim = evictable.back();
+				evictable.pop_back();
+
+				auto &v = pages[victim];
+				if (v.slot < 0 || v.resident_children != 0)
+					continue;
+
+				slot = v.slot;
+				unbinds.push_back(make_bind(victim, -1));
+				v.slot = -1;
+
+				int victim_parent = find_parent(victim);
+				if (victim_parent >= 0)
+					pages[victim_parent].resident_children--;
+			}
+
+			if (slot < 0)
+				break;
+		}
+
+		auto &page = pages[index];
+		page.slot = slot;
+		page.wanted = false;
+		if (parent >= 0)
+			pages[parent].resident_children++;
+
+		binds.push_back(make_bind(index, slot));
+		uploads.push_back(index);
+	}
+
+	if (uploads.empty() && unbinds.empty())
+		return;
+
+	std::vector<VkBufferImageCopy> copies;
+	VkDeviceSize size = 0;
+	for (auto index : uploads)
+	{
+		auto copy = make_page_copy(index, align_upload_offset(size));
+		copies.push_back(copy);
+		size = copy.bufferOffset + VkDeviceSize(copy.imageExtent.width) * copy.imageExtent.height * texel_size;
+	}
+
+	update_residency_map();
+	VkDeviceSize residency_offset = align_upload_offset(size);
+	size = residency_offset + residency.size();
+
+	Vulkan::BufferCreateInfo staging_info;
+	staging_info.domain = Vulkan::BufferDomain::Host;
+	staging_info.size = size;
+	staging_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	auto staging = device->create_buffer(staging_info);
+	auto *ptr = staging ? static_cast<uint8_t *>(device->map_host_buffer(*staging, Vulkan::MEMORY_ACCESS_WRITE_BIT)) : nullptr;
+	if (!ptr)
+	{
+		LOGE("Failed to allocate sparse texture staging buffer.\n");
+		return;
+	}
+
+	for (auto &copy : copies)
+	{
+		auto &extent = copy.imageExtent;
+		if (!loader(copy.imageSubresource.mipLevel, uint32_t(copy.imageOffset.x), uint32_t(copy.imageOffset.y),
+		            extent.width, extent.height, ptr + copy.bufferOffset))
+		{
+			memset(ptr + copy.bufferOffset, 0, VkDeviceSize(extent.width) * extent.height * texel_size);
+		}
+	}
+	memcpy(ptr + residency_offset, residency.data(), residency.size());
+	device->unmap_host_buffer(*staging, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+
+	// Unbind separately, so a recycled memory page is never bound to two regions in the same batch.
+	if (!unbinds.empty())
+	{
+		VkSparseImageMemoryBindInfo unbind_info = { image->get_image(), uint32_t(unbinds.size()), unbinds.data() };
+		device->bind_sparse_image(&unbind_info, 1, nullptr, 0);
+	}
+
+	if (!binds.empty())
+	{
+		VkSparseImageMemoryBindInfo bind_info = { image->get_image(), uint32_t(binds.size()), binds.data() };
+		device->bind_sparse_image(&bind_info, 1, nullptr, 0);
+	}
+
+	auto cmd = device->request_command_buffer(Vulkan::CommandBuffer::Type::AsyncTransfer);
+	cmd->begin_region("sparse-texture-upload");
+	if (!copies.empty())
+		cmd->copy_buffer_to_image(*image, *staging, unsigned(copies.size()), copies.data());
+	cmd->copy_buffer_to_image(*residency_map, *staging, residency_offset, {},
+	                          { residency_map->get_width(), residency_map->get_height(), 1 },
+	                          0, 0, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
+	cmd->end_region();
+
+	Vulkan::Semaphore sem;
+	device->submit(cmd, nullptr, 1, &sem);
+	device->add_wait_semaphore(Vulkan::CommandBuffer::Type::Generic, std::move(sem),
+	                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, true);
+}
+
+void SparseTexture::update()
+{
+	frame++;
+	unsigned context = device->get_current_frame_context();
+	if (readback_valid[context])
+	{
+		consume_feedback(context);
+		readback_valid[context] = false;
+	}
+	stream_pages();
+}
+
+void SparseTexture::clear_feedback(Vulkan::CommandBuffer &cmd)
+{
+	cmd.fill_buffer(*feedback, 0, feedback_header_size, feedback_bits_size);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void SparseTexture::readback_feedback(Vulkan::CommandBuffer &cmd)
+{
+	unsigned context = device->get_current_frame_context();
+	cmd.barrier(VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	cmd.copy_buffer(*readbacks[context], 0, *feedback, feedback_header_size, feedback_bits_size);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+	readback_valid[context] = true;
+}
+}
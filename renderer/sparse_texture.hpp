@@ -0,0 +1,128 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "image.hpp"
+#include <functional>
+#include <vector>
+
+namespace Granite
+{
+static constexpr unsigned MaxSparseTextureLevels = 16;
+
+struct SparseTextureCreateInfo
+{
+	// Must be powers of two, so that pages of coarser levels cover whole level 0 pages.
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned levels = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	// Size of the physical page pool.
+	unsigned max_resident_pages = 1024;
+	unsigned max_uploads_per_frame = 32;
+};
+
+// Streams pages of a sparse resident image based on GPU feedback.
+// Material shaders include inc/sparse_feedback.h, record page requests in the feedback buffer, and clamp
+// their sampling LOD with the residency map. Requested pages are bound from a fixed pool of memory pages
+// and uploaded on the transfer queue. When the pool is full, the least recently requested pages are evicted.
+// The mip tail is always resident. The image is expected to be sampled on the graphics queue.
+class SparseTexture
+{
+public:
+	// Fills a width x height region of texels at (x, y) in the given level, tightly packed.
+	using RegionLoader = std::function<bool (unsigned level, unsigned x, unsigned y,
+	                                         unsigned width, unsigned height, void *data)>;
+
+	bool init(Vulkan::Device &device, const SparseTextureCreateInfo &info, RegionLoader loader);
+
+	const Vulkan::Image &get_image() const;
+	// R8_UINT with one texel per level 0 page, holding the finest resident level for that page.
+	const Vulkan::Image &get_residency_map() const;
+	const Vulkan::Buffer &get_feedback_buffer() const;
+
+	// Call once per frame after Device::next_frame_context().
+	// Consumes the feedback which was read back the last time this frame context was used,
+	// then evicts, binds and uploads pages.
+	void update();
+
+	// Record before and after the passes which write feedback.
+	void clear_feedback(Vulkan::CommandBuffer &cmd);
+	void readback_feedback(Vulkan::CommandBuffer &cmd);
+
+	unsigned get_num_resident_pages() const;
+
+private:
+	Vulkan::Device *device = nullptr;
+	Vulkan::ImageHandle image;
+	Vulkan::ImageHandle residency_map;
+	Vulkan::BufferHandle feedback;
+	Vulkan::DeviceAllocationOwnerHandle pool;
+	std::vector<Vulkan::BufferHandle> readbacks;
+	std::vector<bool> readback_valid;
+	RegionLoader loader;
+
+	struct Level
+	{
+		unsigned first_page;
+		unsigned pages_x;
+		unsigned pages_y;
+	};
+
+	struct Page
+	{
+		unsigned level = 0;
+		unsigned x = 0;
+		unsigned y = 0;
+		uint64_t last_requested = 0;
+		int slot = -1;
+		unsigned resident_children = 0;
+		bool wanted = false;
+	};
+
+	std::vector<Level> levels;
+	std::vector<Page> pages;
+	std::vector<unsigned> free_slots;
+	std::vector<uint8_t> residency;
+
+	VkExtent3D granularity = {};
+	VkDeviceSize page_size = 0;
+	VkDeviceSize feedback_header_size = 0;
+	VkDeviceSize feedback_bits_size = 0;
+	uint32_t texel_size = 0;
+	unsigned num_page_levels = 0;
+	unsigned max_uploads_per_frame = 0;
+	unsigned max_resident_pages = 0;
+	uint64_t frame = 0;
+
+	void consume_feedback(unsigned context);
+	void request_page(const Page &page);
+	int find_parent(unsigned page_index) const;
+	bool upload_mip_tail();
+	void stream_pages();
+	void update_residency_map();
+	VkSparseImageMemoryBind make_bind(unsigned page_index, int slot) const;
+	VkBufferImageCopy make_page_copy(unsigned page_index, VkDeviceSize offset) const;
+};
+}
@@ -73,9 +73,8 @@ void line_strip_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos,
 	cmd.draw_indexed(count);
 }
 
-void sprite_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned num_instances)
+static void set_sprite_render_state(Vulkan::CommandBuffer &cmd, const SpriteRenderInfo &info)
 {
-	auto &info = *static_cast<const SpriteRenderInfo *>(infos->render_info);
 	cmd.set_program(info.program);
 
 	if (info.textures[0])
@@ -106,6 +105,24 @@ void sprite_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, uns
 
 	cmd.set_primitive_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
 	Vulkan::CommandBufferUtil::set_quad_vertex_state(cmd);
+}
+
+static void set_sprite_instance_attribs(Vulkan::CommandBuffer &cmd, const SpriteRenderInfo &info)
+{
+	cmd.set_vertex_attrib(1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadData, pos_off_x));
+	cmd.set_vertex_attrib(2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadData, tex_off_x));
+	cmd.set_vertex_attrib(3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadData, rotation));
+	cmd.set_vertex_attrib(4, 1, VK_FORMAT_R8G8B8A8_UNORM, offsetof(QuadData, color));
+	cmd.set_vertex_attrib(5, 1, VK_FORMAT_R32_SFLOAT, offsetof(QuadData, layer));
+	if (info.textures[1])
+		cmd.set_vertex_attrib(6, 1, VK_FORMAT_R32_SFLOAT, offsetof(QuadData, blend_factor));
+	cmd.set_vertex_attrib(7, 1, VK_FORMAT_R32_SFLOAT, offsetof(QuadData, array_layer));
+}
+
+void sprite_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned num_instances)
+{
+	auto &info = *static_cast<const SpriteRenderInfo *>(infos->render_info);
+	set_sprite_render_state(cmd, info);
 
 	unsigned quads = 0;
 	for (unsigned i = 0; i < num_instances; i++)
@@ -123,16 +140,42 @@ void sprite_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, uns
 		quads += instance_info.count;
 	}
 
-	cmd.set_vertex_attrib(1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadData, pos_off_x));
-	cmd.set_vertex_attrib(2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadData, tex_off_x));
-	cmd.set_vertex_attrib(3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(QuadData, rotation));
-	cmd.set_vertex_attrib(4, 1, VK_FORMAT_R8G8B8A8_UNORM, offsetof(QuadData, color));
-	cmd.set_vertex_attrib(5, 1, VK_FORMAT_R32_SFLOAT, offsetof(QuadData, layer));
-	if (info.textures[1])
-		cmd.set_vertex_attrib(6, 1, VK_FORMAT_R32_SFLOAT, offsetof(QuadData, blend_factor));
-	cmd.set_vertex_attrib(7, 1, VK_FORMAT_R32_SFLOAT, offsetof(QuadData, array_layer));
+	set_sprite_instance_attribs(cmd, info);
 	cmd.draw(4, quads);
 }
+
+void sprite_render_instances(Vulkan::CommandBuffer &cmd, const SpriteRenderInfo &info,
+                             unsigned first_quad, unsigned num_quads)
+{
+	set_sprite_render_state(cmd, info);
+	set_sprite_instance_attribs(cmd, info);
+	cmd.draw(4, num_quads, 0, first_quad);
+}
+
+void sprite_render_static(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned num_instances)
+{
+	auto &info = *static_cast<const SpriteRenderInfo *>(infos->render_info);
+	set_sprite_render_state(cmd, info);
+	set_sprite_instance_attribs(cmd, info);
+
+	unsigned i = 0;
+	while (i < num_instances)
+	{
+		auto &first = *static_cast<const StaticSpriteInstanceInfo *>(infos[i].instance_data);
+		unsigned count = first.count;
+
+		for (i++; i < num_instances; i++)
+		{
+			auto &next = *static_cast<const StaticSpriteInstanceInfo *>(infos[i].instance_data);
+			if (next.quads != first.quads || next.first_quad != first.first_quad + count)
+				break;
+			count += next.count;
+		}
+
+		cmd.set_vertex_binding(1, *first.quads, 0, sizeof(QuadData), VK_VERTEX_INPUT_RATE_INSTANCE);
+		cmd.draw(4, count, 0, first.first_quad);
+	}
+}
 }
 
 void Sprite::get_sprite_render_info(const SpriteTransformInfo &transform, RenderQueue &queue) const
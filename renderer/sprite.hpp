@@ -58,6 +58,24 @@ struct SpriteRenderInfo
 	ivec4 clip_quad = ivec4(0, 0, 0x4000, 0x4000);
 };
 
+// Quads which live in a persistent buffer of QuadData, e.g. baked tile map chunks.
+struct StaticSpriteInstanceInfo
+{
+	const Vulkan::Buffer *quads;
+	unsigned first_quad;
+	unsigned count;
+};
+
+namespace RenderFunctions
+{
+// Draws quads which the caller already wrote to an instance rate vertex buffer at binding 1.
+void sprite_render_instances(Vulkan::CommandBuffer &cmd, const SpriteRenderInfo &info,
+                             unsigned first_quad, unsigned num_quads);
+
+// Instance data is StaticSpriteInstanceInfo. Adjacent ranges of the same buffer are drawn together.
+void sprite_render_static(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances);
+}
+
 struct Sprite : AbstractRenderable
 {
 	DrawPipeline pipeline = DrawPipeline::Opaque;
@@ -72,7 +90,8 @@ struct Sprite : AbstractRenderable
 		LUMA_TO_ALPHA_BIT = 1 << 2,
 		CLEAR_ALPHA_TO_ZERO_BIT = 1 << 3,
 		ALPHA_TEXTURE_BIT = 1 << 4,
-		ARRAY_TEXTURE_BIT = 1 << 5
+		ARRAY_TEXTURE_BIT = 1 << 5,
+		SDF_TEXTURE_BIT = 1 << 6
 	};
 	using ShaderVariantFlags = uint32_t;
 
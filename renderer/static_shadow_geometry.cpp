@@ -0,0 +1,162 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "static_shadow_geometry.hpp"
+#include "scene.hpp"
+#include "mesh_util.hpp"
+#include "render_components.hpp"
+#include "hash.hpp"
+#include "logging.hpp"
+#include <float.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace Granite
+{
+namespace
+{
+struct ShadowCluster
+{
+	std::vector<vec3> positions;
+	std::vector<uint32_t> indices;
+	AABB aabb = AABB(vec3(FLT_MAX), vec3(-FLT_MAX));
+};
+}
+
+static AbstractRenderableHandle create_cluster_mesh(ShadowCluster &cluster)
+{
+	SceneFormats::Mesh mesh;
+	mesh.positions.resize(cluster.positions.size() * sizeof(vec3));
+	memcpy(mesh.positions.data(), cluster.positions.data(), mesh.positions.size());
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_layout[Util::ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+
+	mesh.indices.resize(cluster.indices.size() * sizeof(uint32_t));
+	memcpy(mesh.indices.data(), cluster.indices.data(), mesh.indices.size());
+	mesh.index_type = VK_INDEX_TYPE_UINT32;
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	mesh.count = uint32_t(cluster.indices.size());
+	mesh.static_aabb = cluster.aabb;
+
+	cluster = {};
+	return Util::make_handle<ImportedMesh>(mesh, SceneFormats::MaterialInfo{});
+}
+
+StaticShadowGeometryStats bake_static_shadow_geometry(Scene &scene, const StaticShadowGeometryOptions &options)
+{
+	StaticShadowGeometryStats stats;
+	auto root = scene.get_root_node();
+	if (!root)
+		return stats;
+
+	// Clusters are attached to the root, so geometry is baked relative to it.
+	scene.update_all_transforms();
+	mat4 inv_root = inverse(root->cached_transform.world_transform);
+
+	// Freeing components below edits the group, so work on a copy.
+	auto entities = scene.get_entity_pool().get_component_entities<
+			RenderInfoComponent, RenderableComponent,
+			CachedSpatialTransformTimestampComponent, CastsStaticShadowComponent>();
+
+	std::unordered_map<const AbstractRenderable *, SceneFormats::CollisionMesh> caster_meshes;
+	std::unordered_map<Util::Hash, unsigned> cell_to_cluster;
+	std::vector<ShadowCluster> clusters;
+	std::vector<AbstractRenderableHandle> cluster_meshes;
+
+	for (auto *entity : entities)
+	{
+		auto *info = entity->get_component<RenderInfoComponent>();
+		auto &renderable = entity->get_component<RenderableComponent>()->renderable;
+		if (!info->transform || info->skin_transform)
+			continue;
+
+		auto itr = caster_meshes.find(renderable.get());
+		if (itr == end(caster_meshes))
+		{
+			SceneFormats::CollisionMesh caster;
+			if (!renderable->get_shadow_caster_mesh(caster))
+				caster = {};
+			itr = caster_meshes.emplace(renderable.get(), std::move(caster)).first;
+		}
+
+		auto &caster = itr->second;
+		if (caster.indices.empty())
+			continue;
+
+		// Winding is kept as is, mirrored transforms rendered with the same culling state before.
+		mat4 transform = inv_root * info->transform->world_transform;
+		AABB aabb = renderable->get_static_aabb().transform(transform);
+		ivec3 cell = ivec3(floor(aabb.get_center() / options.cell_size));
+
+		Util::Hasher h;
+		h.s32(cell.x);
+		h.s32(cell.y);
+		h.s32(cell.z);
+
+		auto cell_itr = cell_to_cluster.find(h.get());
+		if (cell_itr == end(cell_to_cluster))
+		{
+			cell_itr = cell_to_cluster.emplace(h.get(), unsigned(clusters.size())).first;
+			clusters.emplace_back();
+		}
+
+		// Full clusters are uploaded right away and the cell starts over, which keeps the CPU copies bounded.
+		auto &cluster = clusters[cell_itr->second];
+		if (!cluster.positions.empty() &&
+		    cluster.positions.size() + caster.positions.size() > options.max_cluster_vertices)
+		{
+			cluster_meshes.push_back(create_cluster_mesh(cluster));
+		}
+
+		auto base_vertex = uint32_t(cluster.positions.size());
+		cluster.positions.reserve(cluster.positions.size() + caster.positions.size());
+		for (auto &pos : caster.positions)
+			cluster.positions.push_back((transform * vec4(pos.xyz(), 1.0f)).xyz());
+		cluster.indices.reserve(cluster.indices.size() + caster.indices.size());
+		for (auto index : caster.indices)
+			cluster.indices.push_back(base_vertex + index);
+		cluster.aabb.expand(aabb);
+
+		// Dynamic shadows still cull per object.
+		entity->free_component<CastsStaticShadowComponent>();
+		stats.merged_casters++;
+	}
+
+	for (auto &cluster : clusters)
+		if (!cluster.indices.empty())
+			cluster_meshes.push_back(create_cluster_mesh(cluster));
+
+	for (auto &mesh : cluster_meshes)
+	{
+		auto node = scene.create_node();
+		auto *entity = scene.create_renderable(mesh, node.get());
+		entity->free_component<OpaqueComponent>();
+		entity->free_component<CastsDynamicShadowComponent>();
+		root->add_child(std::move(node));
+	}
+
+	stats.clusters = unsigned(cluster_meshes.size());
+	LOGI("Merged %u static shadow casters into %u clusters.\n", stats.merged_casters, stats.clusters);
+	return stats;
+}
+}
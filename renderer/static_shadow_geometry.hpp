@@ -0,0 +1,47 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+namespace Granite
+{
+class Scene;
+
+struct StaticShadowGeometryOptions
+{
+	// Casters are binned by the center of their bounds.
+	float cell_size = 32.0f;
+	unsigned max_cluster_vertices = 1u << 20;
+};
+
+struct StaticShadowGeometryStats
+{
+	unsigned merged_casters = 0;
+	unsigned clusters = 0;
+};
+
+// Merges every static shadow caster which exposes AbstractRenderable::get_shadow_caster_mesh() into
+// position-only meshes, one per grid cell, which only render to static shadow maps.
+// The casters keep rendering normally otherwise. Call once after loading, nodes are assumed not to move.
+StaticShadowGeometryStats bake_static_shadow_geometry(Scene &scene, const StaticShadowGeometryOptions &options = {});
+}
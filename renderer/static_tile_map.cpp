@@ -0,0 +1,213 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "static_tile_map.hpp"
+#include "device.hpp"
+#include "enum_cast.hpp"
+#include <algorithm>
+
+using namespace Vulkan;
+
+namespace Granite
+{
+static QuadData build_tile_quad(const vec2 &offset, const vec2 &tile_size, float depth, float opacity, unsigned tile)
+{
+	QuadData quad = {};
+	quad.pos_off_x = offset.x;
+	quad.pos_off_y = offset.y;
+	quad.pos_scale_x = tile_size.x;
+	quad.pos_scale_y = tile_size.y;
+	quad.tex_scale_x = tile_size.x;
+	quad.tex_scale_y = tile_size.y;
+	quad.rotation[0] = 1.0f;
+	quad.rotation[3] = 1.0f;
+	quantize_color(quad.color, vec4(1.0f, 1.0f, 1.0f, opacity));
+	quad.layer = depth;
+	quad.array_layer = float(tile);
+	return quad;
+}
+
+void StaticTileMap::bake(Device &device, const ImageView &tile_array, uvec2 tile_size_,
+                         const TileInfo *tiles, unsigned num_tiles,
+                         const Layer *layers, unsigned num_layers)
+{
+	baked_layers.clear();
+	animated_tiles.clear();
+	baked_tiles.clear();
+	frames.clear();
+	quads.reset();
+
+	view = &tile_array;
+	tile_size = vec2(tile_size_);
+	chunk_size = tile_size * float(ChunkSize);
+
+	baked_tiles.reserve(num_tiles);
+	for (unsigned i = 0; i < num_tiles; i++)
+	{
+		BakedTile baked = { tiles[i].pipeline, unsigned(frames.size()), tiles[i].num_frames, 0 };
+		for (unsigned j = 0; j < tiles[i].num_frames; j++)
+		{
+			frames.push_back(tiles[i].frames[j]);
+			baked.total_duration_ms += tiles[i].frames[j].duration_ms;
+		}
+		baked_tiles.push_back(baked);
+	}
+
+	std::vector<QuadData> data;
+	baked_layers.resize(num_layers);
+
+	for (unsigned l = 0; l < num_layers; l++)
+	{
+		auto &layer = layers[l];
+		auto &baked = baked_layers[l];
+		baked.num_chunks = (layer.size + uvec2(ChunkSize - 1)) / uvec2(ChunkSize);
+		baked.offset = layer.offset;
+		baked.depth = layer.depth;
+		baked.chunks.resize(baked.num_chunks.x * baked.num_chunks.y);
+
+		vec2 layer_hi = layer.offset + vec2(layer.size) * tile_size;
+
+		// Chunks are stored pipeline by pipeline, so neighbouring chunks of one pipeline are
+		// contiguous in the buffer and can be drawn with a single draw.
+		for (unsigned p = 0; p < NumPipelines; p++)
+		{
+			for (unsigned cy = 0; cy < baked.num_chunks.y; cy++)
+			{
+				for (unsigned cx = 0; cx < baked.num_chunks.x; cx++)
+				{
+					auto &chunk = baked.chunks[cy * baked.num_chunks.x + cx];
+					chunk.lo = layer.offset + vec2(float(cx), float(cy)) * chunk_size;
+					chunk.hi = min(chunk.lo + chunk_size, layer_hi);
+					chunk.first_quad[p] = unsigned(data.size());
+
+					unsigned end_x = std::min<unsigned>((cx + 1) * ChunkSize, layer.size.x);
+					unsigned end_y = std::min<unsigned>((cy + 1) * ChunkSize, layer.size.y);
+
+					for (unsigned y = cy * ChunkSize; y < end_y; y++)
+					{
+						for (unsigned x = cx * ChunkSize; x < end_x; x++)
+						{
+							int tile = layer.tile_indices[y * layer.size.x + x];
+							if (tile < 0 || unsigned(tile) >= num_tiles)
+								continue;
+
+							vec2 offset = layer.offset + vec2(float(x), float(y)) * tile_size;
+							auto &info = baked_tiles[tile];
+
+							if (info.num_frames)
+							{
+								if (p == 0)
+									animated_tiles.push_back({ vec3(offset, layer.depth), layer.opacity, unsigned(tile) });
+								continue;
+							}
+
+							auto pipeline = layer.opacity < 1.0f ? DrawPipeline::AlphaBlend : info.pipeline;
+							if (Util::ecast(pipeline) != p)
+								continue;
+
+							data.push_back(build_tile_quad(offset, tile_size, layer.depth, layer.opacity, unsigned(tile)));
+						}
+					}
+
+					chunk.num_quads[p] = unsigned(data.size()) - chunk.first_quad[p];
+				}
+			}
+		}
+	}
+
+	if (!data.empty())
+	{
+		BufferCreateInfo info = {};
+		info.size = data.size() * sizeof(QuadData);
+		info.domain = BufferDomain::Device;
+		info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+		quads = device.create_buffer(info, data.data());
+		device.set_name(*quads, "static-tile-map");
+	}
+
+	LOGI("Baked %u static tiles and %u animated tiles in %u layers.\n",
+	     unsigned(data.size()), unsigned(animated_tiles.size()), num_layers);
+}
+
+unsigned StaticTileMap::get_animated_tile(const BakedTile &tile, uint64_t time_ms) const
+{
+	auto *tile_frames = frames.data() + tile.first_frame;
+	if (!tile.total_duration_ms)
+		return unsigned(tile_frames[0].tile);
+
+	auto t = unsigned(time_ms % tile.total_duration_ms);
+	for (unsigned i = 0; i < tile.num_frames; i++)
+	{
+		if (t < tile_frames[i].duration_ms)
+			return unsigned(tile_frames[i].tile);
+		t -= tile_frames[i].duration_ms;
+	}
+
+	return unsigned(tile_frames[tile.num_frames - 1].tile);
+}
+
+void StaticTileMap::push(FlatRenderer &renderer, const vec2 &view_lo, const vec2 &view_hi, uint64_t time_ms) const
+{
+	if (!view)
+		return;
+
+	if (quads)
+	{
+		for (auto &layer : baked_layers)
+		{
+			// Chunks form a grid, so only walk the ones which overlap the view.
+			ivec2 lo = max(ivec2(floor((view_lo - layer.offset) / chunk_size)), ivec2(0));
+			ivec2 hi = min(ivec2(ceil((view_hi - layer.offset) / chunk_size)), ivec2(layer.num_chunks));
+
+			for (unsigned p = 0; p < NumPipelines; p++)
+			{
+				for (int cy = lo.y; cy < hi.y; cy++)
+				{
+					for (int cx = lo.x; cx < hi.x; cx++)
+					{
+						auto &chunk = layer.chunks[cy * layer.num_chunks.x + cx];
+						renderer.render_static_quads(*view, *quads, chunk.first_quad[p], chunk.num_quads[p],
+						                             layer.depth, DrawPipeline(p));
+					}
+				}
+			}
+		}
+	}
+
+	for (auto &animated : animated_tiles)
+	{
+		vec2 lo = animated.offset.xy();
+		vec2 hi = lo + tile_size;
+		if (any(greaterThanEqual(lo, view_hi)) || any(lessThanEqual(hi, view_lo)))
+			continue;
+
+		unsigned tile = get_animated_tile(baked_tiles[animated.tile], time_ms);
+		if (tile >= baked_tiles.size())
+			continue;
+
+		auto pipeline = animated.opacity < 1.0f ? DrawPipeline::AlphaBlend : baked_tiles[tile].pipeline;
+		renderer.render_textured_quad(*view, animated.offset, tile_size, vec2(0.0f), tile_size, pipeline,
+		                              vec4(1.0f, 1.0f, 1.0f, animated.opacity),
+		                              StockSampler::NearestClamp, tile);
+	}
+}
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "flat_renderer.hpp"
+#include "sprite.hpp"
+#include "buffer.hpp"
+#include <vector>
+
+namespace Granite
+{
+// Bakes static tile layers into chunks of QuadData in one device local vertex buffer.
+// Visible chunks are drawn through FlatRenderer::render_static_quads(), and neighbouring chunks
+// of a layer end up in one draw. Animated tiles stay dynamic and are pushed every frame.
+class StaticTileMap
+{
+public:
+	enum { ChunkSize = 32 };
+
+	struct AnimationFrame
+	{
+		int tile;
+		unsigned duration_ms;
+	};
+
+	struct TileInfo
+	{
+		DrawPipeline pipeline = DrawPipeline::Opaque;
+		const AnimationFrame *frames = nullptr;
+		unsigned num_frames = 0;
+	};
+
+	struct Layer
+	{
+		// size.x * size.y tile indices, row-major. Negative indices are empty.
+		const int *tile_indices = nullptr;
+		uvec2 size = uvec2(0);
+		vec2 offset = vec2(0.0f);
+		float depth = 0.0f;
+		float opacity = 1.0f;
+	};
+
+	// tile_array holds one tile per array layer, indexed by the tile indices.
+	void bake(Vulkan::Device &device, const Vulkan::ImageView &tile_array, uvec2 tile_size,
+	          const TileInfo *tiles, unsigned num_tiles,
+	          const Layer *layers, unsigned num_layers);
+
+	// Pushes every chunk and animated tile which intersects [view_lo, view_hi).
+	void push(FlatRenderer &renderer, const vec2 &view_lo, const vec2 &view_hi, uint64_t time_ms) const;
+
+private:
+	enum { NumPipelines = 3 };
+
+	struct Chunk
+	{
+		vec2 lo, hi;
+		unsigned first_quad[NumPipelines];
+		unsigned num_quads[NumPipelines];
+	};
+
+	struct BakedLayer
+	{
+		std::vector<Chunk> chunks;
+		uvec2 num_chunks;
+		vec2 offset;
+		float depth;
+	};
+
+	struct AnimatedTile
+	{
+		vec3 offset;
+		float opacity;
+		unsigned tile;
+	};
+
+	struct BakedTile
+	{
+		DrawPipeline pipeline;
+		unsigned first_frame;
+		unsigned num_frames;
+		unsigned total_duration_ms;
+	};
+
+	std::vector<BakedLayer> baked_layers;
+	std::vector<AnimatedTile> animated_tiles;
+	std::vector<BakedTile> baked_tiles;
+	std::vector<AnimationFrame> frames;
+	Vulkan::BufferHandle quads;
+	const Vulkan::ImageView *view = nullptr;
+	vec2 tile_size = vec2(0.0f);
+	vec2 chunk_size = vec2(0.0f);
+
+	unsigned get_animated_tile(const BakedTile &tile, uint64_t time_ms) const;
+};
+}
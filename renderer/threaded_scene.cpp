@@ -29,27 +29,29 @@ namespace Granite
 namespace Threaded
 {
 void scene_gather_opaque_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
-                                     VisibilityList *lists, unsigned num_tasks)
+                                     VisibilityList *lists, unsigned num_tasks, RenderableFlags skip_flags,
+                                     const OcclusionBuffer *occlusion)
 {
 	auto &group = composer.begin_pipeline_stage();
 	group.set_desc("gather-opaque-renderables");
 	for (unsigned i = 0; i < num_tasks; i++)
 	{
-		group.enqueue_task([&frustum, lists, &scene, i, num_tasks]() {
-			scene.gather_visible_opaque_renderables_subset(frustum, lists[i], i, num_tasks);
+		group.enqueue_task([&frustum, lists, &scene, i, num_tasks, skip_flags, occlusion]() {
+			scene.gather_visible_opaque_renderables_subset(frustum, lists[i], i, num_tasks, skip_flags, occlusion);
 		});
 	}
 }
 
 void scene_gather_motion_vector_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
-                                            VisibilityList *lists, unsigned num_tasks)
+                                            VisibilityList *lists, unsigned num_tasks,
+                                            const OcclusionBuffer *occlusion)
 {
 	auto &group = composer.begin_pipeline_stage();
 	group.set_desc("gather-motion-vector-renderables");
 	for (unsigned i = 0; i < num_tasks; i++)
 	{
-		group.enqueue_task([&frustum, lists, &scene, i, num_tasks]() {
-			scene.gather_visible_motion_vector_renderables_subset(frustum, lists[i], i, num_tasks);
+		group.enqueue_task([&frustum, lists, &scene, i, num_tasks, occlusion]() {
+			scene.gather_visible_motion_vector_renderables_subset(frustum, lists[i], i, num_tasks, occlusion);
 		});
 	}
 }
@@ -92,6 +94,36 @@ void scene_gather_static_shadow_renderables(const Scene &scene, TaskComposer &co
 	}
 }
 
+void scene_gather_static_shadow_renderables_cached(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
+                                                   VisibilityList *lists, VisibilityCache *caches,
+                                                   unsigned num_tasks, const std::function<bool ()> &func)
+{
+	auto &group = composer.begin_pipeline_stage();
+	group.set_desc("gather-static-shadow-renderables-cached");
+	for (unsigned i = 0; i < num_tasks; i++)
+	{
+		group.enqueue_task([&frustum, lists, caches, &scene, i, num_tasks, func]() {
+			if (!func || func())
+				scene.gather_visible_static_shadow_renderables_cached(frustum, caches[i], lists[i], i, num_tasks);
+		});
+	}
+}
+
+void scene_gather_dynamic_shadow_renderables_cached(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
+                                                    VisibilityList *lists, VisibilityCache *caches,
+                                                    unsigned num_tasks, const std::function<bool ()> &func)
+{
+	auto &group = composer.begin_pipeline_stage();
+	group.set_desc("gather-dynamic-shadow-renderables-cached");
+	for (unsigned i = 0; i < num_tasks; i++)
+	{
+		group.enqueue_task([&frustum, lists, caches, &scene, i, num_tasks, func]() {
+			if (!func || func())
+				scene.gather_visible_dynamic_shadow_renderables_cached(frustum, caches[i], lists[i], i, num_tasks);
+		});
+	}
+}
+
 void scene_gather_dynamic_shadow_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                              VisibilityList *lists, Util::Hash *transform_hashes, unsigned num_tasks,
                                              const std::function<bool ()> &func)
@@ -130,9 +162,21 @@ void scene_gather_positional_light_renderables(const Scene &scene, TaskComposer
 	}
 }
 
+static float estimate_light_importance(const RenderParameters &params, const PositionalLightInfo &light)
+{
+	auto &aabb = light.transform->world_aabb;
+	float radius = aabb.get_radius();
+	float dist = distance(aabb.get_center(), params.camera_position);
+	float screen_size = dist <= radius ? 1.0f : muglm::min(radius * muglm::abs(params.projection[1][1]) / dist, 1.0f);
+
+	auto &color = light.light->get_color();
+	return screen_size * muglm::max(muglm::max(color.x, color.y), color.z);
+}
+
 void scene_gather_positional_light_renderables_sorted(const Scene &scene, TaskComposer &composer,
                                                       const RenderContext &context,
-                                                      PositionalLightList *lists, unsigned num_tasks)
+                                                      PositionalLightList *lists, unsigned num_tasks,
+                                                      float min_importance)
 {
 	{
 		auto &group = composer.begin_pipeline_stage();
@@ -149,7 +193,7 @@ void scene_gather_positional_light_renderables_sorted(const Scene &scene, TaskCo
 	{
 		auto &group = composer.begin_pipeline_stage();
 		group.set_desc("gather-positional-light-renderables-sort");
-		group.enqueue_task([&context, num_tasks, lists]() {
+		group.enqueue_task([&context, num_tasks, lists, min_importance]() {
 			size_t expected_size = 0;
 			for (unsigned i = 0; i < num_tasks; i++)
 				expected_size += lists[i].size();
@@ -159,16 +203,18 @@ void scene_gather_positional_light_renderables_sorted(const Scene &scene, TaskCo
 				lists[0].insert(lists[0].end(), lists[i].begin(), lists[i].end());
 			auto &lights = lists[0];
 
-			// Prefer lights which are closest to the camera.
-			std::sort(lights.begin(), lights.end(), [&context](const auto &a, const auto &b) -> bool {
-				auto *transform_a = a.transform;
-				auto *transform_b = b.transform;
-				vec3 pos_a = transform_a->transform->world_transform[3].xyz();
-				vec3 pos_b = transform_b->transform->world_transform[3].xyz();
-				float dist_a = dot(pos_a, context.get_render_parameters().camera_front);
-				float dist_b = dot(pos_b, context.get_render_parameters().camera_front);
-				return dist_a < dist_b;
+			for (auto &light : lights)
+				light.importance = estimate_light_importance(context.get_render_parameters(), light);
+
+			// Prefer lights which contribute the most to the screen, so truncating the list drops small, dim lights.
+			std::sort(lights.begin(), lights.end(), [](const auto &a, const auto &b) -> bool {
+				return a.importance > b.importance;
 			});
+
+			auto itr = std::find_if(lights.begin(), lights.end(), [min_importance](const auto &light) {
+				return light.importance < min_importance;
+			});
+			lights.erase(itr, lights.end());
 		});
 	}
 }
@@ -203,31 +249,40 @@ void compose_parallel_push_renderables(TaskComposer &composer, const RenderConte
 
 	{
 		auto &group = composer.begin_pipeline_stage();
-		group.set_desc("parallel-push-renderables-sort");
+		group.set_desc("parallel-push-renderables-combine");
 		group.enqueue_task([=]() {
 			for (unsigned i = 1; i < count; i++)
 				queues[0].combine_render_info(queues[i]);
-			queues[0].sort();
 		});
 	}
+
+	{
+		auto &group = composer.begin_pipeline_stage();
+		group.set_desc("parallel-push-renderables-sort");
+		for (unsigned i = 0; i < Util::ecast(Queue::Count); i++)
+		{
+			group.enqueue_task([=]() {
+				queues[0].sort(static_cast<Queue>(i));
+			});
+		}
+	}
 }
 
-void scene_update_cached_transforms(Scene &scene, TaskComposer &composer, unsigned num_tasks)
+void scene_update_cached_transforms(Scene &scene, TaskComposer &composer, size_t grain)
 {
-	auto &group = composer.begin_pipeline_stage();
+	auto &group = composer.parallel_for(scene.get_cached_transforms_count(), grain, [&scene](size_t begin, size_t end) {
+		scene.update_cached_transforms_range(begin, end);
+	});
 	group.set_desc("parallel-update-cached-transforms");
-	for (unsigned i = 0; i < num_tasks; i++)
-	{
-		group.enqueue_task([&scene, num_tasks, i]() {
-			scene.update_cached_transforms_subset(i, num_tasks);
-		});
-	}
 
 	auto &listener_group = composer.begin_pipeline_stage();
 	listener_group.set_desc("parallel-update-transform-listeners");
 	listener_group.enqueue_task([&scene]() {
 		scene.update_transform_listener_components();
 	});
+	listener_group.enqueue_task([&scene]() {
+		scene.update_culling_arrays();
+	});
 }
 }
 }
@@ -34,21 +34,32 @@ namespace Granite
 namespace Threaded
 {
 void scene_gather_opaque_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
-                                     VisibilityList *lists, unsigned num_tasks);
+                                     VisibilityList *lists, unsigned num_tasks, RenderableFlags skip_flags = 0,
+                                     const OcclusionBuffer *occlusion = nullptr);
 void scene_gather_motion_vector_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
-                                            VisibilityList *lists, unsigned num_tasks);
+                                            VisibilityList *lists, unsigned num_tasks,
+                                            const OcclusionBuffer *occlusion = nullptr);
 void scene_gather_transparent_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                           VisibilityList *lists, unsigned num_tasks);
 void scene_gather_static_shadow_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                             VisibilityList *lists, Util::Hash *transform_hashes,
                                             unsigned num_tasks, const std::function<bool ()> &cond = {});
+// Keep the visibility of each task in caches[i] across frames and append it to lists[i].
+void scene_gather_static_shadow_renderables_cached(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
+                                                   VisibilityList *lists, VisibilityCache *caches,
+                                                   unsigned num_tasks, const std::function<bool ()> &cond = {});
+void scene_gather_dynamic_shadow_renderables_cached(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
+                                                    VisibilityList *lists, VisibilityCache *caches,
+                                                    unsigned num_tasks, const std::function<bool ()> &cond = {});
 void scene_gather_dynamic_shadow_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                              VisibilityList *lists, Util::Hash *transform_hashes,
                                              unsigned num_tasks, const std::function<bool ()> &cond = {});
 void scene_gather_positional_light_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                                VisibilityList *lists, unsigned num_tasks);
+// Lights end up in lists[0], most important first. Lights with importance below min_importance are dropped.
 void scene_gather_positional_light_renderables_sorted(const Scene &scene, TaskComposer &composer, const RenderContext &context,
-                                                      PositionalLightList *lists, unsigned num_tasks);
+                                                      PositionalLightList *lists, unsigned num_tasks,
+                                                      float min_importance = 0.0f);
 
 enum class PushType
 {
@@ -60,6 +71,7 @@ void compose_parallel_push_renderables(TaskComposer &composer, const RenderConte
                                        RenderQueue *queues, VisibilityList *visibility, unsigned count,
                                        PushType type);
 
-void scene_update_cached_transforms(Scene &scene, TaskComposer &composer, unsigned num_tasks);
+// grain is the minimum number of transforms per task, 0 picks a default.
+void scene_update_cached_transforms(Scene &scene, TaskComposer &composer, size_t grain = 0);
 }
 }
\ No newline at end of file
@@ -28,6 +28,7 @@
 #include "muglm/matrix_helper.hpp"
 #include "muglm/muglm_impl.hpp"
 #include "memory_mapped_texture.hpp"
+#include "format.hpp"
 #include <string.h>
 
 using namespace Vulkan;
@@ -259,7 +260,7 @@ ImageReadback save_image_to_cpu_buffer(Vulkan::Device &device, const Vulkan::Ima
 	return readback;
 }
 
-bool save_image_buffer_to_gtx(Vulkan::Device &device, ImageReadback &readback, const char *path)
+static bool setup_readback_texture(const ImageReadback &readback, Vulkan::MemoryMappedTexture &tex)
 {
 	auto &info = readback.create_info;
 	if (info.format == VK_FORMAT_UNDEFINED)
@@ -268,8 +269,6 @@ bool save_image_buffer_to_gtx(Vulkan::Device &device, ImageReadback &readback, c
 		return false;
 	}
 
-	Vulkan::MemoryMappedTexture tex;
-
 	if (info.levels == 1)
 		tex.set_generate_mipmaps_on_load();
 
@@ -294,17 +293,145 @@ bool save_image_buffer_to_gtx(Vulkan::Device &device, ImageReadback &readback, c
 		return false;
 	}
 
+	return true;
+}
+
+static void copy_readback_to_texture(Vulkan::Device &device, ImageReadback &readback, Vulkan::MemoryMappedTexture &tex)
+{
+	readback.fence->wait();
+	void *ptr = device.map_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT);
+	memcpy(tex.get_layout().data(), ptr, tex.get_layout().get_required_size());
+	device.unmap_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT);
+}
+
+bool save_image_buffer_to_gtx(Vulkan::Device &device, ImageReadback &readback, const char *path)
+{
+	Vulkan::MemoryMappedTexture tex;
+	if (!setup_readback_texture(readback, tex))
+		return false;
+
 	if (!tex.map_write(*GRANITE_FILESYSTEM(), path))
 	{
 		LOGE("Failed to save texture to %s\n", path);
 		return false;
 	}
 
+	copy_readback_to_texture(device, readback, tex);
+	return true;
+}
+
+bool save_image_buffer_to_texture(Vulkan::Device &device, ImageReadback &readback, Vulkan::MemoryMappedTexture &tex)
+{
+	if (!setup_readback_texture(readback, tex))
+		return false;
+
+	if (!tex.map_write_scratch())
+	{
+		LOGE("Failed to allocate scratch texture.\n");
+		return false;
+	}
+
+	copy_readback_to_texture(device, readback, tex);
+	return true;
+}
+
+ImageCompareReadback compare_images_on_gpu(CommandBuffer &cmd, const ImageView &a, const ImageView &b)
+{
+	auto &device = cmd.get_device();
+	if (a.get_view_width() != b.get_view_width() || a.get_view_height() != b.get_view_height())
+	{
+		LOGE("Dimension mismatch.\n");
+		return {};
+	}
+
+	if (format_is_srgb(a.get_format()) != format_is_srgb(b.get_format()))
+		LOGW("Comparing sRGB and linear views, errors are measured in encoded space.\n");
+
+	ImageCompareReadback readback;
+	readback.width = a.get_view_width();
+	readback.height = a.get_view_height();
+	readback.tiles_x = (readback.width + ImageCompareReadback::TileSize - 1) / ImageCompareReadback::TileSize;
+	readback.tiles_y = (readback.height + ImageCompareReadback::TileSize - 1) / ImageCompareReadback::TileSize;
+
+	BufferCreateInfo info = {};
+	info.size = 4 * sizeof(uint32_t) + readback.tiles_x * readback.tiles_y * 2 * sizeof(uint32_t);
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	info.domain = BufferDomain::Device;
+	auto result_buffer = device.create_buffer(info, nullptr);
+
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	info.domain = BufferDomain::CachedHost;
+	readback.buffer = device.create_buffer(info, nullptr);
+
+	cmd.fill_buffer(*result_buffer, 0);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	struct Push
+	{
+		int32_t resolution[2];
+		uint32_t tiles_x;
+		uint32_t srgb;
+	} push = {};
+	push.resolution[0] = int32_t(readback.width);
+	push.resolution[1] = int32_t(readback.height);
+	push.tiles_x = readback.tiles_x;
+	push.srgb = uint32_t(format_is_srgb(a.get_format()));
+
+	cmd.set_program("builtin://shaders/util/image_compare.comp");
+	cmd.set_texture(0, 0, a);
+	cmd.set_texture(0, 1, b);
+	cmd.set_storage_buffer(0, 2, *result_buffer);
+	cmd.push_constants(&push, 0, sizeof(push));
+	cmd.dispatch(readback.tiles_x, readback.tiles_y, 1);
+
+	cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	cmd.copy_buffer(*readback.buffer, *result_buffer);
+	cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+	return readback;
+}
+
+bool resolve_image_compare(Device &device, ImageCompareReadback &readback, ImageCompareResult &result)
+{
+	if (!readback.buffer || !readback.fence)
+		return false;
+
 	readback.fence->wait();
-	void *ptr = device.map_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT);
-	memcpy(tex.get_layout().data(), ptr, tex.get_layout().get_required_size());
+	auto *data = static_cast<const uint32_t *>(device.map_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT));
+	if (!data)
+		return false;
+
+	result.max_error = data[0];
+	result.tiles_x = readback.tiles_x;
+	result.tiles_y = readback.tiles_y;
+	result.tile_mse.resize(readback.tiles_x * readback.tiles_y);
+	result.tile_max_error.resize(readback.tiles_x * readback.tiles_y);
+
+	auto *tiles = data + 4;
+	double error_energy = 0.0;
+	for (unsigned y = 0; y < readback.tiles_y; y++)
+	{
+		unsigned tile_height = std::min<unsigned>(ImageCompareReadback::TileSize,
+		                                          readback.height - y * ImageCompareReadback::TileSize);
+		for (unsigned x = 0; x < readback.tiles_x; x++)
+		{
+			unsigned tile_width = std::min<unsigned>(ImageCompareReadback::TileSize,
+			                                         readback.width - x * ImageCompareReadback::TileSize);
+			unsigned index = y * readback.tiles_x + x;
+			double tile_error = double(tiles[2 * index + 0]);
+			error_energy += tile_error;
+			result.tile_mse[index] = float(tile_error / double(3 * tile_width * tile_height));
+			result.tile_max_error[index] = uint8_t(tiles[2 * index + 1]);
+		}
+	}
+
 	device.unmap_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT);
 
+	double samples = 3.0 * double(readback.width) * double(readback.height);
+	result.mse = error_energy / samples;
+	result.psnr = 10.0 * muglm::log10(255.0 * 255.0 / result.mse);
 	return true;
 }
-}
\ No newline at end of file
+}
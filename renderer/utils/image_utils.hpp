@@ -23,6 +23,7 @@
 #pragma once
 
 #include "device.hpp"
+#include "memory_mapped_texture.hpp"
 
 namespace Granite
 {
@@ -39,4 +40,36 @@ struct ImageReadback
 };
 ImageReadback save_image_to_cpu_buffer(Vulkan::Device &device, const Vulkan::Image &image, Vulkan::CommandBuffer::Type type);
 bool save_image_buffer_to_gtx(Vulkan::Device &device, ImageReadback &readback, const char *path);
+// Same as save_image_buffer_to_gtx, but into scratch memory, e.g. as input to compress_texture().
+bool save_image_buffer_to_texture(Vulkan::Device &device, ImageReadback &readback, Vulkan::MemoryMappedTexture &tex);
+
+// GPU equivalent of tools/image_compare, RGB errors are measured in 8-bit units.
+// Views must be 2D, equally sized and in SHADER_READ_ONLY_OPTIMAL, sRGB views are compared in encoded space.
+struct ImageCompareReadback
+{
+	enum { TileSize = 32 };
+	Vulkan::Fence fence;
+	Vulkan::BufferHandle buffer;
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned tiles_x = 0;
+	unsigned tiles_y = 0;
+};
+
+struct ImageCompareResult
+{
+	double psnr = 0.0;
+	double mse = 0.0;
+	unsigned max_error = 0;
+	// Row-major heatmap of mean squared error per TileSize x TileSize tile.
+	unsigned tiles_x = 0;
+	unsigned tiles_y = 0;
+	std::vector<float> tile_mse;
+	std::vector<uint8_t> tile_max_error;
+};
+
+// Records a single dispatch, submit cmd with &readback.fence as the signal fence before resolving.
+ImageCompareReadback compare_images_on_gpu(Vulkan::CommandBuffer &cmd, const Vulkan::ImageView &a, const Vulkan::ImageView &b);
+// Waits for the readback fence.
+bool resolve_image_compare(Vulkan::Device &device, ImageCompareReadback &readback, ImageCompareResult &result);
 }
@@ -31,6 +31,7 @@
 #include "texture_utils.hpp"
 #include "texture_format.hpp"
 #include "stb_image_write.h"
+#include "meshoptimizer.h"
 
 using namespace std;
 using namespace rapidjson;
@@ -48,10 +49,26 @@ struct Remap
 	vector<const T *> info;
 };
 
+enum class MeshoptMode
+{
+	None,
+	Attributes,
+	Triangles,
+	Indices
+};
+
 struct BufferView
 {
 	size_t offset;
 	size_t length;
+
+	// EXT_meshopt_compression. The offset and length are then in the fallback buffer,
+	// which has no data, and the encoded data lives in the GLB buffer.
+	size_t compressed_offset = 0;
+	size_t compressed_length = 0;
+	unsigned stride = 0;
+	unsigned count = 0;
+	MeshoptMode mode = MeshoptMode::None;
 };
 
 struct EmittedMesh
@@ -62,6 +79,13 @@ struct EmittedMesh
 	int attribute_accessor[ecast(MeshAttribute::Count)] = {};
 	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_MAX_ENUM;
 	bool primitive_restart = false;
+
+	struct Lod
+	{
+		unsigned index_accessor;
+		float error;
+	};
+	std::vector<Lod> lods;
 };
 
 struct EmittedEnvironment
@@ -191,6 +215,7 @@ struct RemapState
 	void filter_input(StateType &output, const SceneType &input);
 
 	unsigned emit_buffer(ArrayView<const uint8_t> view);
+	unsigned emit_meshopt_buffer(ArrayView<const uint8_t> view, unsigned stride, MeshoptMode mode);
 
 	unsigned emit_accessor(unsigned view_index, VkFormat format, unsigned offset, unsigned count);
 
@@ -216,6 +241,7 @@ struct RemapState
 	vector<uint8_t> glb_buffer_data;
 	HashMap<unsigned> buffer_hash;
 	vector<BufferView> buffer_views;
+	size_t fallback_buffer_size = 0;
 
 	HashMap<unsigned> accessor_hash;
 	vector<EmittedAccessor> accessor_cache;
@@ -243,7 +269,8 @@ struct RemapState
 	vector<vector<unsigned>> mesh_group_cache;
 };
 
-Hash RemapState::hash(const Mesh &m)
+// Everything but the material, which does not affect mesh processing.
+static Hash hash_mesh_geometry(const Mesh &m)
 {
 	Hasher h;
 
@@ -251,10 +278,7 @@ Hash RemapState::hash(const Mesh &m)
 	h.u32(m.index_type);
 	h.u32(m.attribute_stride);
 	h.u32(m.position_stride);
-	h.u32(m.has_material);
 	h.u32(m.primitive_restart);
-	if (m.has_material)
-		h.u32(material.to_index[m.material_index]);
 	h.data(reinterpret_cast<const uint8_t *>(m.attribute_layout), sizeof(m.attribute_layout));
 
 	auto lo = m.static_aabb.get_minimum();
@@ -280,6 +304,15 @@ Hash RemapState::hash(const Mesh &m)
 	return h.get();
 }
 
+Hash RemapState::hash(const Mesh &m)
+{
+	Hasher h(hash_mesh_geometry(m));
+	h.u32(m.has_material);
+	if (m.has_material)
+		h.u32(material.to_index[m.material_index]);
+	return h.get();
+}
+
 Hash RemapState::hash(const MaterialInfo &mat)
 {
 	Hasher h;
@@ -343,6 +376,92 @@ unsigned RemapState::emit_buffer(ArrayView<const uint8_t> view)
 		return itr->second;
 }
 
+// Geometry goes through meshoptimizer's codecs when compress_geometry is set.
+// Data the codecs cannot take is emitted as is.
+unsigned RemapState::emit_meshopt_buffer(ArrayView<const uint8_t> view, unsigned stride, MeshoptMode mode)
+{
+	if (!options->compress_geometry || view.empty() || stride == 0 || view.size() % stride != 0)
+		return emit_buffer(view);
+
+	// The vertex codec requires 4 byte aligned elements.
+	if (mode == MeshoptMode::Attributes && (stride % 4 != 0 || stride > 256))
+		return emit_buffer(view);
+	if (mode != MeshoptMode::Attributes && stride != 2 && stride != 4)
+		return emit_buffer(view);
+
+	size_t count = view.size() / stride;
+	if (mode == MeshoptMode::Triangles && count % 3 != 0)
+		mode = MeshoptMode::Indices;
+
+	Hasher h;
+	h.u32(uint32_t(mode));
+	h.u32(stride);
+	h.data(view.data(), view.size());
+	auto itr = buffer_hash.find(h.get());
+	if (itr != end(buffer_hash))
+		return itr->second;
+
+	vector<uint8_t> encoded;
+	if (mode == MeshoptMode::Attributes)
+	{
+		encoded.resize(meshopt_encodeVertexBufferBound(count, stride));
+		encoded.resize(meshopt_encodeVertexBuffer(encoded.data(), encoded.size(), view.data(), count, stride));
+	}
+	else
+	{
+		vector<uint32_t> indices(count);
+		if (stride == sizeof(uint16_t))
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				uint16_t index;
+				memcpy(&index, view.data() + i * sizeof(uint16_t), sizeof(uint16_t));
+				indices[i] = index;
+			}
+		}
+		else
+			memcpy(indices.data(), view.data(), view.size());
+
+		uint32_t max_index = 0;
+		for (auto index : indices)
+			max_index = std::max(max_index, index);
+		size_t vertex_count = size_t(max_index) + 1;
+
+		if (mode == MeshoptMode::Triangles)
+		{
+			encoded.resize(meshopt_encodeIndexBufferBound(count, vertex_count));
+			encoded.resize(meshopt_encodeIndexBuffer(encoded.data(), encoded.size(), indices.data(), count));
+		}
+		else
+		{
+			encoded.resize(meshopt_encodeIndexSequenceBound(count, vertex_count));
+			encoded.resize(meshopt_encodeIndexSequence(encoded.data(), encoded.size(), indices.data(), count));
+		}
+	}
+
+	if (encoded.empty())
+		return emit_buffer(view);
+
+	BufferView buffer_view;
+	buffer_view.offset = (fallback_buffer_size + 15) & ~15;
+	buffer_view.length = view.size();
+	fallback_buffer_size = buffer_view.offset + buffer_view.length;
+
+	buffer_view.compressed_offset = (glb_buffer_data.size() + 15) & ~15;
+	buffer_view.compressed_length = encoded.size();
+	glb_buffer_data.resize(buffer_view.compressed_offset + encoded.size());
+	memcpy(glb_buffer_data.data() + buffer_view.compressed_offset, encoded.data(), encoded.size());
+
+	buffer_view.stride = stride;
+	buffer_view.count = unsigned(count);
+	buffer_view.mode = mode;
+
+	unsigned index = buffer_views.size();
+	buffer_views.push_back(buffer_view);
+	buffer_hash[h.get()] = index;
+	return index;
+}
+
 #define GL_BYTE                           0x1400
 #define GL_UNSIGNED_BYTE                  0x1401
 #define GL_SHORT                          0x1402
@@ -883,12 +1002,165 @@ static void extract_attribute(uint8_t *output,
 		memcpy(output + output_stride * i, buffer + i * stride, format_stride);
 }
 
+// Processed meshes are cached as a header followed by positions, attributes, indices, meshlets and LODs.
+static constexpr uint32_t MeshCacheVersion = 1;
+
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t position_stride;
+	uint32_t attribute_stride;
+	MeshAttributeLayout attribute_layout[Util::ecast(MeshAttribute::Count)];
+	uint32_t index_type;
+	uint32_t topology;
+	uint32_t primitive_restart;
+	uint32_t count;
+	float aabb[6];
+	uint64_t positions_size;
+	uint64_t attributes_size;
+	uint64_t indices_size;
+	uint64_t num_meshlets;
+	uint64_t num_lods;
+};
+
+static string get_mesh_cache_path(const ExportOptions &options, const Mesh &mesh)
+{
+	Hasher h(hash_mesh_geometry(mesh));
+	h.u32(MeshCacheVersion);
+	h.u32(options.optimize_meshes);
+	h.u32(options.stripify_meshes);
+	h.u32(options.generate_lods);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(h.get()));
+	return Path::join(options.cache_directory, name);
+}
+
+static bool write_mesh_cache(const string &path, const Mesh &mesh)
+{
+	MeshCacheHeader header = {};
+	memcpy(header.magic, "GMSH", 4);
+	header.version = MeshCacheVersion;
+	header.position_stride = mesh.position_stride;
+	header.attribute_stride = mesh.attribute_stride;
+	memcpy(header.attribute_layout, mesh.attribute_layout, sizeof(mesh.attribute_layout));
+	header.index_type = mesh.index_type;
+	header.topology = mesh.topology;
+	header.primitive_restart = mesh.primitive_restart;
+	header.count = mesh.count;
+	for (unsigned i = 0; i < 3; i++)
+	{
+		header.aabb[i] = mesh.static_aabb.get_minimum()[i];
+		header.aabb[i + 3] = mesh.static_aabb.get_maximum()[i];
+	}
+	header.positions_size = mesh.positions.size();
+	header.attributes_size = mesh.attributes.size();
+	header.indices_size = mesh.indices.size();
+	header.num_meshlets = mesh.meshlets.size();
+	header.num_lods = mesh.lods.size();
+
+	vector<uint8_t> blob(sizeof(header));
+	memcpy(blob.data(), &header, sizeof(header));
+	const auto append = [&](const void *data, size_t size) {
+		blob.insert(blob.end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+	};
+	append(mesh.positions.data(), mesh.positions.size());
+	append(mesh.attributes.data(), mesh.attributes.size());
+	append(mesh.indices.data(), mesh.indices.size());
+	append(mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
+	append(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+
+	return GRANITE_FILESYSTEM()->write_buffer_to_file(path, blob.data(), blob.size());
+}
+
+static bool read_mesh_cache(const string &path, Mesh &mesh)
+{
+	FileStat stat;
+	if (!GRANITE_FILESYSTEM()->stat(path, stat) || stat.type != PathType::File)
+		return false;
+
+	auto file = GRANITE_FILESYSTEM()->open(path);
+	if (!file || file->get_size() < sizeof(MeshCacheHeader))
+		return false;
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		return false;
+
+	MeshCacheHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	if (memcmp(header.magic, "GMSH", 4) != 0 || header.version != MeshCacheVersion)
+		return false;
+
+	size_t payload_size = header.positions_size + header.attributes_size + header.indices_size +
+	                      header.num_meshlets * sizeof(Meshlet) + header.num_lods * sizeof(MeshLod);
+	if (file->get_size() - sizeof(header) < payload_size)
+		return false;
+
+	const uint8_t *ptr = mapped + sizeof(header);
+	const auto consume = [&](size_t size) {
+		auto *ret = ptr;
+		ptr += size;
+		return ret;
+	};
+
+	mesh.position_stride = header.position_stride;
+	mesh.attribute_stride = header.attribute_stride;
+	memcpy(mesh.attribute_layout, header.attribute_layout, sizeof(mesh.attribute_layout));
+	mesh.index_type = VkIndexType(header.index_type);
+	mesh.topology = VkPrimitiveTopology(header.topology);
+	mesh.primitive_restart = header.primitive_restart != 0;
+	mesh.count = header.count;
+	mesh.static_aabb = AABB(vec3(header.aabb[0], header.aabb[1], header.aabb[2]),
+	                        vec3(header.aabb[3], header.aabb[4], header.aabb[5]));
+
+	auto *positions = consume(header.positions_size);
+	mesh.positions.assign(positions, positions + header.positions_size);
+	auto *attributes = consume(header.attributes_size);
+	mesh.attributes.assign(attributes, attributes + header.attributes_size);
+	auto *indices = consume(header.indices_size);
+	mesh.indices.assign(indices, indices + header.indices_size);
+	// The payload is not aligned for the structured tables.
+	mesh.meshlets.resize(header.num_meshlets);
+	if (!mesh.meshlets.empty())
+		memcpy(mesh.meshlets.data(), consume(header.num_meshlets * sizeof(Meshlet)), header.num_meshlets * sizeof(Meshlet));
+	mesh.lods.resize(header.num_lods);
+	if (!mesh.lods.empty())
+		memcpy(mesh.lods.data(), consume(header.num_lods * sizeof(MeshLod)), header.num_lods * sizeof(MeshLod));
+	return true;
+}
+
 void RemapState::emit_mesh(unsigned remapped_index)
 {
+	bool use_new_mesh = options->optimize_meshes || options->generate_lods;
+	auto &input_mesh = *mesh.info[remapped_index];
+
+	string cache_path;
+	if (use_new_mesh && !options->cache_directory.empty())
+		cache_path = get_mesh_cache_path(*options, input_mesh);
+
 	Mesh new_mesh;
-	if (options->optimize_meshes)
-		new_mesh = mesh_optimize_index_buffer(*mesh.info[remapped_index], options->stripify_meshes);
-	auto &output_mesh = options->optimize_meshes ? new_mesh : *mesh.info[remapped_index];
+	if (!cache_path.empty() && read_mesh_cache(cache_path, new_mesh))
+	{
+		new_mesh.material_index = input_mesh.material_index;
+		new_mesh.has_material = input_mesh.has_material;
+	}
+	else if (use_new_mesh)
+	{
+		if (options->optimize_meshes)
+			new_mesh = mesh_optimize_index_buffer(input_mesh, options->stripify_meshes);
+		else
+			new_mesh = input_mesh;
+
+		// Simplify after optimizing, the optimized index buffer does not carry LODs.
+		if (options->generate_lods)
+			mesh_build_lods(new_mesh);
+
+		if (!cache_path.empty() && !write_mesh_cache(cache_path, new_mesh))
+			LOGW("Failed to write mesh cache entry: %s\n", cache_path.c_str());
+	}
+
+	auto &output_mesh = use_new_mesh ? new_mesh : input_mesh;
 
 	mesh_cache.resize(std::max<size_t>(mesh_cache.size(), remapped_index + 1));
 
@@ -899,7 +1171,10 @@ void RemapState::emit_mesh(unsigned remapped_index)
 
 	if (!output_mesh.indices.empty())
 	{
-		unsigned index = emit_buffer(output_mesh.indices);
+		unsigned index_size = output_mesh.index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+		bool triangles = output_mesh.topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST && !output_mesh.primitive_restart;
+		unsigned index = emit_meshopt_buffer(output_mesh.indices, index_size,
+		                                     triangles ? MeshoptMode::Triangles : MeshoptMode::Indices);
 		emit.index_accessor = emit_accessor(index,
 		                                    output_mesh.index_type == VK_INDEX_TYPE_UINT16 ? VK_FORMAT_R16_UINT
 		                                                                            : VK_FORMAT_R32_UINT,
@@ -930,6 +1205,16 @@ void RemapState::emit_mesh(unsigned remapped_index)
 		accessor_cache[emit.index_accessor].use_uint_min_max = true;
 		accessor_cache[emit.index_accessor].uint_min = min_index;
 		accessor_cache[emit.index_accessor].uint_max = max_index;
+
+		// LODs share the index buffer, each one gets an accessor into it.
+		for (auto &lod : output_mesh.lods)
+		{
+			unsigned lod_accessor = emit_accessor(index,
+			                                      output_mesh.index_type == VK_INDEX_TYPE_UINT16 ? VK_FORMAT_R16_UINT
+			                                                                              : VK_FORMAT_R32_UINT,
+			                                      lod.offset * index_size, lod.count);
+			emit.lods.push_back({ lod_accessor, lod.error });
+		}
 	}
 	else
 		emit.index_accessor = -1;
@@ -963,7 +1248,7 @@ void RemapState::emit_mesh(unsigned remapped_index)
 		{
 			vector<uint8_t> output(sizeof(u16vec4) * count);
 			quantize_attribute_fp32_unorm16(output.data(), output_mesh.positions.data(), output_mesh.position_stride, count);
-			buffer_index = emit_buffer(output);
+			buffer_index = emit_meshopt_buffer(output, sizeof(u16vec4), MeshoptMode::Attributes);
 			acc = emit_accessor(buffer_index,
 			                    VK_FORMAT_R16G16B16A16_UNORM,
 			                    0, count);
@@ -974,7 +1259,7 @@ void RemapState::emit_mesh(unsigned remapped_index)
 		{
 			vector<uint8_t> output(sizeof(i16vec4) * count);
 			quantize_attribute_fp32_snorm16(output.data(), output_mesh.positions.data(), output_mesh.position_stride, count);
-			buffer_index = emit_buffer(output);
+			buffer_index = emit_meshopt_buffer(output, sizeof(i16vec4), MeshoptMode::Attributes);
 			acc = emit_accessor(buffer_index,
 			                    VK_FORMAT_R16G16B16A16_SNORM,
 			                    0, count);
@@ -987,14 +1272,14 @@ void RemapState::emit_mesh(unsigned remapped_index)
 
 			quantize_attribute_fp32_fp16(output.data(), output_mesh.positions.data(), output_mesh.position_stride, count);
 
-			buffer_index = emit_buffer(output);
+			buffer_index = emit_meshopt_buffer(output, sizeof(u16vec4), MeshoptMode::Attributes);
 			acc = emit_accessor(buffer_index,
 			                    VK_FORMAT_R16G16B16A16_SFLOAT,
 			                    0, count);
 		}
 		else
 		{
-			buffer_index = emit_buffer(output_mesh.positions);
+			buffer_index = emit_meshopt_buffer(output_mesh.positions, output_mesh.position_stride, MeshoptMode::Attributes);
 			acc = emit_accessor(buffer_index,
 			                    layout[ecast(MeshAttribute::Position)].format,
 			                    0, count);
@@ -1078,7 +1363,7 @@ void RemapState::emit_mesh(unsigned remapped_index)
 				}
 			}
 
-			auto buffer_index = emit_buffer(unpacked_buffer);
+			auto buffer_index = emit_meshopt_buffer(unpacked_buffer, format_size, MeshoptMode::Attributes);
 			emit.attribute_accessor[i] = emit_accessor(buffer_index, remapped_format, 0, attr_count);
 		}
 	}
@@ -1533,7 +1818,7 @@ static shared_ptr<AnalysisResult> analyze_image(ThreadGroup &workers,
 }
 
 static void compress_image(ThreadGroup &workers, const string &target_path, shared_ptr<AnalysisResult> &result,
-                           unsigned quality, TaskSignal *signal)
+                           unsigned quality, const string &cache_directory, TaskSignal *signal)
 {
 	FileStat src_stat, dst_stat;
 	if (GRANITE_FILESYSTEM()->stat(result->src_path, src_stat) && GRANITE_FILESYSTEM()->stat(target_path, dst_stat))
@@ -1553,6 +1838,7 @@ static void compress_image(ThreadGroup &workers, const string &target_path, shar
 	args.quality = quality;
 	args.mode = result->mode;
 	args.output_mapping = result->swizzle;
+	args.cache_directory = cache_directory;
 
 	auto mipgen_task = workers.create_task([=]() {
 		if (result->image->get_layout().get_levels() == 1 && result->mode != TextureMode::HDR)
@@ -1620,6 +1906,23 @@ static void compress_image(ThreadGroup &workers, const string &target_path, shar
 		mipgen_task->set_fence_counter_signal(signal);
 }
 
+static void add_extension(Document &doc, const char *name, bool required)
+{
+	auto &allocator = doc.GetAllocator();
+	const auto add = [&](const char *list) {
+		if (!doc.HasMember(list))
+		{
+			Value extensions(kArrayType);
+			doc.AddMember(StringRef(list), extensions, allocator);
+		}
+		doc[list].PushBack(StringRef(name), allocator);
+	};
+
+	add("extensionsUsed");
+	if (required)
+		add("extensionsRequired");
+}
+
 bool export_scene_to_glb(const SceneInformation &scene, const string &path, const ExportOptions &options)
 {
 	Document doc;
@@ -1638,15 +1941,7 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 	doc.AddMember("asset", asset, allocator);
 
 	if (!scene.lights.empty())
-	{
-		Value req(kArrayType);
-		req.PushBack("KHR_lights_punctual", allocator);
-		doc.AddMember("extensionsRequired", req, allocator);
-
-		Value used(kArrayType);
-		used.PushBack("KHR_lights_punctual", allocator);
-		doc.AddMember("extensionsUsed", used, allocator);
-	}
+		add_extension(doc, "KHR_lights_punctual", true);
 
 	RemapState state;
 	state.options = &options;
@@ -1770,6 +2065,21 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 		doc.AddMember("buffers", buffers, allocator);
 	}
 
+	// Compressed views decode into this buffer, which has no data of its own,
+	// so readers without EXT_meshopt_compression cannot load the file.
+	if (state.fallback_buffer_size)
+	{
+		Value fallback(kObjectType);
+		fallback.AddMember("byteLength", uint32_t(state.fallback_buffer_size), allocator);
+		Value ext(kObjectType);
+		Value meshopt(kObjectType);
+		meshopt.AddMember("fallback", true, allocator);
+		ext.AddMember("EXT_meshopt_compression", meshopt, allocator);
+		fallback.AddMember("extensions", ext, allocator);
+		doc["buffers"].PushBack(fallback, allocator);
+		add_extension(doc, "EXT_meshopt_compression", true);
+	}
+
 	// Buffer Views
 	if (!state.buffer_views.empty())
 	{
@@ -1777,9 +2087,30 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 		for (auto &view : state.buffer_views)
 		{
 			Value v(kObjectType);
-			v.AddMember("buffer", 0, allocator);
+			v.AddMember("buffer", view.mode != MeshoptMode::None ? 1 : 0, allocator);
 			v.AddMember("byteLength", uint32_t(view.length), allocator);
 			v.AddMember("byteOffset", uint32_t(view.offset), allocator);
+
+			if (view.mode != MeshoptMode::None)
+			{
+				Value meshopt(kObjectType);
+				meshopt.AddMember("buffer", 0, allocator);
+				meshopt.AddMember("byteOffset", uint32_t(view.compressed_offset), allocator);
+				meshopt.AddMember("byteLength", uint32_t(view.compressed_length), allocator);
+				meshopt.AddMember("byteStride", view.stride, allocator);
+				meshopt.AddMember("count", view.count, allocator);
+				if (view.mode == MeshoptMode::Attributes)
+					meshopt.AddMember("mode", "ATTRIBUTES", allocator);
+				else if (view.mode == MeshoptMode::Triangles)
+					meshopt.AddMember("mode", "TRIANGLES", allocator);
+				else
+					meshopt.AddMember("mode", "INDICES", allocator);
+
+				Value ext(kObjectType);
+				ext.AddMember("EXT_meshopt_compression", meshopt, allocator);
+				v.AddMember("extensions", ext, allocator);
+			}
+
 			views.PushBack(v, allocator);
 		}
 		doc.AddMember("bufferViews", views, allocator);
@@ -1896,7 +2227,7 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 				signal.wait_until_at_least(max_count - 3);
 
 			compress_image(workers, Path::relpath(path, image.target_relpath),
-			               image.loaded_image, image.compression_quality, &signal);
+			               image.loaded_image, image.compression_quality, options.cache_directory, &signal);
 
 			max_count++;
 		}
@@ -2101,10 +2432,24 @@ bool export_scene_to_glb(const SceneInformation &scene, const string &path, cons
 					break;
 				}
 
-				if (cached_mesh.primitive_restart)
+				if (cached_mesh.primitive_restart || !cached_mesh.lods.empty())
 				{
 					Value extras(kObjectType);
-					extras.AddMember("primitiveRestart", cached_mesh.primitive_restart, allocator);
+					if (cached_mesh.primitive_restart)
+						extras.AddMember("primitiveRestart", cached_mesh.primitive_restart, allocator);
+
+					if (!cached_mesh.lods.empty())
+					{
+						Value lods(kArrayType);
+						for (auto &lod : cached_mesh.lods)
+						{
+							Value l(kObjectType);
+							l.AddMember("indices", lod.index_accessor, allocator);
+							l.AddMember("error", lod.error, allocator);
+							lods.PushBack(l, allocator);
+						}
+						extras.AddMember("lods", lods, allocator);
+					}
 					prim.AddMember("extras", extras, allocator);
 				}
 				prim.AddMember("attributes", attribs, allocator);
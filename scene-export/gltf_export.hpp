@@ -58,6 +58,9 @@ struct ExportOptions
 	TextureCompressionFamily compression = TextureCompressionFamily::Uncompressed;
 	unsigned texcomp_quality = 3;
 	unsigned threads = 0;
+	// Compressed textures and optimized meshes are cached here, keyed by their inputs and the options
+	// which affect them, so re-exports only rebuild what changed. See CompressorArguments::cache_directory.
+	std::string cache_directory;
 
 	struct
 	{
@@ -73,8 +76,11 @@ struct ExportOptions
 	} environment;
 
 	bool quantize_attributes = false;
+	// Encodes vertex and index data with EXT_meshopt_compression.
+	bool compress_geometry = false;
 	bool optimize_meshes = false;
 	bool stripify_meshes = false;
+	bool generate_lods = false;
 	bool gltf = false;
 };
 
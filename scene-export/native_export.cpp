@@ -0,0 +1,283 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "native_export.hpp"
+#include "native_scene.hpp"
+#include "mesh_util.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+namespace Granite
+{
+namespace SceneFormats
+{
+using namespace NativeScene;
+
+struct NativeSceneWriter
+{
+	vector<uint8_t> data;
+	string strings;
+
+	NativeScene::Range append(const void *ptr, size_t size, size_t alignment = BlobAlignment)
+	{
+		data.resize((data.size() + alignment - 1) & ~(alignment - 1));
+		NativeScene::Range range = { data.size(), size };
+		if (size)
+		{
+			data.resize(data.size() + size);
+			memcpy(data.data() + range.offset, ptr, size);
+		}
+		return range;
+	}
+
+	template <typename T>
+	NativeScene::Range append_table(const vector<T> &table)
+	{
+		return append(table.data(), table.size() * sizeof(T));
+	}
+
+	StringRef add_string(const string &str)
+	{
+		StringRef ref = { uint32_t(strings.size()), uint32_t(str.size()) };
+		strings += str;
+		return ref;
+	}
+};
+
+static void copy_floats(float *out, const float *in, unsigned count)
+{
+	memcpy(out, in, count * sizeof(float));
+}
+
+bool export_scene_to_native(const SceneInformation &scene, const string &path)
+{
+	if (!scene.skins.empty() || !scene.animations.empty())
+	{
+		LOGE("Native scenes do not support skins or animations.\n");
+		return false;
+	}
+
+	NativeSceneWriter writer;
+	Header header = {};
+	header.magic = Magic;
+	header.version = Version;
+	writer.data.resize(sizeof(header));
+
+	// Textures, each used path is embedded once.
+	vector<TextureEntry> texture_table;
+	unordered_map<string, uint32_t> texture_indices;
+	const auto add_texture = [&](const MaterialInfo::Texture &tex) -> uint32_t {
+		if (tex.path.empty())
+			return InvalidIndex;
+
+		auto itr = texture_indices.find(tex.path);
+		if (itr != end(texture_indices))
+			return itr->second;
+
+		TextureEntry entry = {};
+		entry.path = writer.add_string(tex.path);
+
+		auto file = GRANITE_FILESYSTEM()->open(tex.path, FileMode::ReadOnly);
+		const void *mapped = file ? file->map() : nullptr;
+		if (mapped)
+			entry.payload = writer.append(mapped, file->get_size(), TextureAlignment);
+		else
+			LOGW("Could not embed texture %s, it will be loaded by path.\n", tex.path.c_str());
+
+		auto index = uint32_t(texture_table.size());
+		texture_table.push_back(entry);
+		texture_indices[tex.path] = index;
+		return index;
+	};
+
+	vector<MaterialEntry> material_table;
+	material_table.reserve(scene.materials.size());
+	for (auto &material : scene.materials)
+	{
+		MaterialEntry entry = {};
+		entry.base_color = add_texture(material.base_color);
+		entry.normal = add_texture(material.normal);
+		entry.metallic_roughness = add_texture(material.metallic_roughness);
+		entry.occlusion = add_texture(material.occlusion);
+		entry.emissive = add_texture(material.emissive);
+		copy_floats(entry.uniform_base_color, material.uniform_base_color.data, 4);
+		copy_floats(entry.uniform_emissive_color, material.uniform_emissive_color.data, 3);
+		entry.uniform_metallic = material.uniform_metallic;
+		entry.uniform_roughness = material.uniform_roughness;
+		entry.normal_scale = material.normal_scale;
+		entry.pipeline = uint32_t(material.pipeline);
+		entry.sampler = uint32_t(material.sampler);
+		entry.flags = (material.two_sided ? MATERIAL_TWO_SIDED_BIT : 0) |
+		              (material.bandlimited_pixel ? MATERIAL_BANDLIMITED_PIXEL_BIT : 0);
+		material_table.push_back(entry);
+	}
+
+	vector<MeshEntry> mesh_table;
+	mesh_table.reserve(scene.meshes.size());
+	for (auto &input_mesh : scene.meshes)
+	{
+		// Bake what ImportedMesh would otherwise build at load time.
+		Mesh mesh = input_mesh;
+		if (mesh.meshlets.empty() && mesh.count >= ImportedMesh::MinMeshletIndexCount)
+			mesh_build_meshlets(mesh);
+		if (mesh.lods.empty() && mesh.count >= ImportedMesh::MinLodIndexCount)
+			mesh_build_lods(mesh);
+
+		MeshEntry entry = {};
+		entry.positions = writer.append_table(mesh.positions);
+		entry.attributes = writer.append_table(mesh.attributes);
+		entry.indices = writer.append_table(mesh.indices);
+		entry.meshlets = writer.append_table(mesh.meshlets);
+		entry.lods = writer.append_table(mesh.lods);
+
+		for (uint32_t attr = 0; attr < Util::ecast(MeshAttribute::Count); attr++)
+		{
+			entry.attribute_formats[attr] = uint32_t(mesh.attribute_layout[attr].format);
+			entry.attribute_offsets[attr] = mesh.attribute_layout[attr].offset;
+		}
+
+		entry.position_stride = mesh.position_stride;
+		entry.attribute_stride = mesh.attribute_stride;
+		entry.index_type = uint32_t(mesh.index_type);
+		entry.topology = uint32_t(mesh.topology);
+		entry.material_index = mesh.material_index;
+		entry.count = mesh.count;
+		entry.flags = (mesh.has_material ? MESH_HAS_MATERIAL_BIT : 0) |
+		              (mesh.primitive_restart ? MESH_PRIMITIVE_RESTART_BIT : 0);
+		copy_floats(entry.aabb_min, mesh.static_aabb.get_minimum().data, 3);
+		copy_floats(entry.aabb_max, mesh.static_aabb.get_maximum().data, 3);
+		mesh_table.push_back(entry);
+	}
+
+	vector<NodeEntry> node_table;
+	vector<uint32_t> node_pool;
+	node_table.reserve(scene.nodes.size());
+	for (auto &node : scene.nodes)
+	{
+		if (node.has_skin)
+		{
+			LOGE("Native scenes do not support skinned nodes.\n");
+			return false;
+		}
+
+		NodeEntry entry = {};
+		copy_floats(entry.scale, node.transform.scale.data, 3);
+		copy_floats(entry.rotation, node.transform.rotation.as_vec4().data, 4);
+		copy_floats(entry.translation, node.transform.translation.data, 3);
+		entry.first_child = uint32_t(node_pool.size());
+		entry.child_count = uint32_t(node.children.size());
+		node_pool.insert(node_pool.end(), node.children.begin(), node.children.end());
+		entry.first_mesh = uint32_t(node_pool.size());
+		entry.mesh_count = uint32_t(node.meshes.size());
+		node_pool.insert(node_pool.end(), node.meshes.begin(), node.meshes.end());
+		node_table.push_back(entry);
+	}
+
+	vector<LightEntry> light_table;
+	light_table.reserve(scene.lights.size());
+	for (auto &light : scene.lights)
+	{
+		LightEntry entry = {};
+		entry.name = writer.add_string(light.name);
+		entry.node_index = light.node_index;
+		entry.type = uint32_t(light.type);
+		entry.flags = light.attached_to_node ? ATTACHED_TO_NODE_BIT : 0;
+		entry.inner_cone = light.inner_cone;
+		entry.outer_cone = light.outer_cone;
+		copy_floats(entry.color, light.color.data, 3);
+		entry.range = light.range;
+		light_table.push_back(entry);
+	}
+
+	vector<CameraEntry> camera_table;
+	camera_table.reserve(scene.cameras.size());
+	for (auto &camera : scene.cameras)
+	{
+		CameraEntry entry = {};
+		entry.name = writer.add_string(camera.name);
+		entry.node_index = camera.node_index;
+		entry.type = uint32_t(camera.type);
+		entry.flags = camera.attached_to_node ? ATTACHED_TO_NODE_BIT : 0;
+		entry.aspect_ratio = camera.aspect_ratio;
+		entry.znear = camera.znear;
+		entry.zfar = camera.zfar;
+		entry.yfov = camera.yfov;
+		entry.xmag = camera.xmag;
+		entry.ymag = camera.ymag;
+		camera_table.push_back(entry);
+	}
+
+	vector<uint32_t> scene_nodes;
+	if (scene.scene_nodes)
+	{
+		scene_nodes = scene.scene_nodes->node_indices;
+		header.scene_name = writer.add_string(scene.scene_nodes->name);
+	}
+	else
+	{
+		// Every node which is not a child of some other node is part of the scene.
+		unordered_set<uint32_t> is_child;
+		for (auto &node : scene.nodes)
+			for (auto &child : node.children)
+				is_child.insert(child);
+
+		for (size_t i = 0; i < scene.nodes.size(); i++)
+			if (!is_child.count(i))
+				scene_nodes.push_back(uint32_t(i));
+	}
+
+	header.textures = writer.append_table(texture_table);
+	header.materials = writer.append_table(material_table);
+	header.meshes = writer.append_table(mesh_table);
+	header.nodes = writer.append_table(node_table);
+	header.node_indices = writer.append_table(node_pool);
+	header.lights = writer.append_table(light_table);
+	header.cameras = writer.append_table(camera_table);
+	header.scene_nodes = writer.append_table(scene_nodes);
+	header.strings = writer.append(writer.strings.data(), writer.strings.size());
+	memcpy(writer.data.data(), &header, sizeof(header));
+
+	auto file = GRANITE_FILESYSTEM()->open(path, FileMode::WriteOnly);
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	void *mapped = file->map_write(writer.data.size());
+	if (!mapped)
+	{
+		LOGE("Failed to map %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	memcpy(mapped, writer.data.data(), writer.data.size());
+	file->unmap();
+	return true;
+}
+}
+}
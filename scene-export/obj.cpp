@@ -25,92 +25,476 @@
 #include "memory_mapped_texture.hpp"
 #include "texture_files.hpp"
 #include "string_helpers.hpp"
+#include "thread_group.hpp"
+#include <exception>
+#include <string.h>
+#include <math.h>
 
 using namespace std;
 using namespace Util;
 
 namespace OBJ
 {
-void Parser::flush_mesh()
+// Indices are 0-based into the merged tables after rebasing.
+// Negative OBJ indices are relative to the current count, so they are chunk local until merged.
+static constexpr int32_t NoIndex = INT32_MIN;
+
+struct Corner
 {
-	if (current_positions.empty())
-		return;
+	int32_t v;
+	int32_t vt;
+	int32_t vn;
+	uint32_t relative_mask;
 
-	Mesh mesh = {};
+	bool operator==(const Corner &other) const
+	{
+		return v == other.v && vt == other.vt && vn == other.vn;
+	}
+};
 
-	if (current_material >= 0)
+struct CornerHash
+{
+	size_t operator()(const Corner &corner) const
 	{
-		mesh.has_material = true;
-		mesh.material_index = unsigned(current_material);
+		Hasher h;
+		h.s32(corner.v);
+		h.s32(corner.vt);
+		h.s32(corner.vn);
+		return size_t(h.get());
 	}
+};
 
-	mesh.positions.resize(current_positions.size() * sizeof(vec3));
-	memcpy(mesh.positions.data(), current_positions.data(), mesh.positions.size());
-	mesh.position_stride = sizeof(vec3);
-	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
-	mesh.count = unsigned(current_positions.size());
-	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+struct MaterialSwitch
+{
+	size_t first_corner;
+	string name;
+};
 
-	vec3 lo = vec3(numeric_limits<float>::max());
-	vec3 hi = vec3(-numeric_limits<float>::max());
-	for (auto &p : current_positions)
+struct ParsedChunk
+{
+	vector<vec3> positions;
+	vector<vec3> normals;
+	vector<vec2> uvs;
+	vector<Corner> corners;
+	vector<MaterialSwitch> material_switches;
+	vector<string> libraries;
+};
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static string parse_token(const char *&p, const char *end)
+{
+	p = skip_space(p, end);
+	const char *begin = p;
+	while (p < end && !is_space(*p))
+		p++;
+	if (begin == p)
+		throw runtime_error("Expected token in OBJ.");
+	return string(begin, p);
+}
+
+static float parse_float_slow(const char *&p, const char *end)
+{
+	char buffer[64];
+	const char *begin = p;
+	while (p < end && !is_space(*p) && size_t(p - begin) < sizeof(buffer) - 1)
+		p++;
+	memcpy(buffer, begin, p - begin);
+	buffer[p - begin] = '\0';
+
+	char *parse_end = nullptr;
+	float value = strtof(buffer, &parse_end);
+	if (parse_end == buffer)
+		throw runtime_error("Failed to parse float in OBJ.");
+	return value;
+}
+
+// Plain decimal notation is all OBJ exporters emit in practice, anything else goes through strtof.
+static float parse_float(const char *&p, const char *end)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	p = skip_space(p, end);
+	const char *begin = p;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	bool any_digits = false;
+
+	while (p < end && is_digit(*p))
 	{
-		lo = min(lo, p);
-		hi = max(hi, p);
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + uint64_t(*p - '0');
+			if (mantissa)
+				digits++;
+		}
+		else
+			exponent++;
+		any_digits = true;
+		p++;
 	}
-	mesh.static_aabb = AABB(lo, hi);
 
-	if (!current_normals.empty() && !current_uvs.empty())
+	if (p < end && *p == '.')
 	{
-		if (current_normals.size() != current_positions.size())
-			throw runtime_error("Normal size != position size.");
-		if (current_uvs.size() != current_positions.size())
-			throw runtime_error("UV size != position size.");
+		p++;
+		while (p < end && is_digit(*p))
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + uint64_t(*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+			any_digits = true;
+			p++;
+		}
+	}
 
-		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
-		mesh.attribute_layout[ecast(MeshAttribute::UV)].offset = sizeof(vec3);
-		static const size_t stride = sizeof(vec3) + sizeof(vec2);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
+	if (!any_digits)
+	{
+		p = begin;
+		return parse_float_slow(p, end);
+	}
 
-		for (size_t i = 0; i < current_positions.size(); i++)
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negative_exp = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative_exp = *p++ == '-';
+		if (p == end || !is_digit(*p))
+			throw runtime_error("Failed to parse float exponent in OBJ.");
+
+		int e = 0;
+		while (p < end && is_digit(*p))
 		{
-			memcpy(mesh.attributes.data() + stride * i, &current_normals[i], sizeof(vec3));
-			memcpy(mesh.attributes.data() + stride * i + sizeof(vec3), &current_uvs[i], sizeof(vec2));
+			if (e < 10000)
+				e = e * 10 + (*p - '0');
+			p++;
 		}
+		exponent += negative_exp ? -e : e;
 	}
-	else if (!current_normals.empty())
+
+	if (p < end && !is_space(*p))
+	{
+		p = begin;
+		return parse_float_slow(p, end);
+	}
+
+	double value = double(mantissa);
+	if (exponent < 0 && exponent >= -22)
+		value /= pow10[-exponent];
+	else if (exponent > 0 && exponent <= 22)
+		value *= pow10[exponent];
+	else if (exponent != 0)
+		value *= pow(10.0, double(exponent));
+
+	return float(negative ? -value : value);
+}
+
+static int32_t parse_index(const char *&p, const char *end, size_t count, uint32_t &relative_mask, uint32_t bit)
+{
+	bool negative = false;
+	if (p < end && *p == '-')
+	{
+		negative = true;
+		p++;
+	}
+
+	if (p == end || !is_digit(*p))
+		throw runtime_error("Failed to parse face index in OBJ.");
+
+	int64_t value = 0;
+	while (p < end && is_digit(*p))
+	{
+		value = value * 10 + (*p - '0');
+		if (value > INT32_MAX)
+			throw runtime_error("Face index out of range in OBJ.");
+		p++;
+	}
+
+	if (value == 0)
+		throw runtime_error("Face index 0 in OBJ.");
+
+	if (negative)
+	{
+		relative_mask |= bit;
+		return int32_t(int64_t(count) - value);
+	}
+	else
+		return int32_t(value - 1);
+}
+
+static Corner parse_corner(const char *&p, const char *end, const ParsedChunk &chunk)
+{
+	Corner corner = { NoIndex, NoIndex, NoIndex, 0 };
+	corner.v = parse_index(p, end, chunk.positions.size(), corner.relative_mask, 1u << 0);
+
+	if (p < end && *p == '/')
+	{
+		p++;
+		if (p < end && *p != '/')
+			corner.vt = parse_index(p, end, chunk.uvs.size(), corner.relative_mask, 1u << 1);
+		if (p < end && *p == '/')
+		{
+			p++;
+			corner.vn = parse_index(p, end, chunk.normals.size(), corner.relative_mask, 1u << 2);
+		}
+	}
+
+	if (p < end && !is_space(*p))
+		throw runtime_error("Unexpected character in OBJ face.");
+
+	return corner;
+}
+
+static void parse_line(const char *p, const char *end, ParsedChunk &chunk)
+{
+	// Comments run to the end of the line.
+	auto *comment = static_cast<const char *>(memchr(p, '#', end - p));
+	if (comment)
+		end = comment;
+
+	p = skip_space(p, end);
+	if (p == end)
+		return;
+
+	const char *ident = p;
+	while (p < end && !is_space(*p))
+		p++;
+	size_t ident_len = p - ident;
+
+	auto is_ident = [&](const char *str) {
+		return strlen(str) == ident_len && memcmp(ident, str, ident_len) == 0;
+	};
+
+	if (is_ident("v"))
+	{
+		vec3 v;
+		v.x = parse_float(p, end);
+		v.y = parse_float(p, end);
+		v.z = parse_float(p, end);
+		chunk.positions.push_back(v);
+	}
+	else if (is_ident("vn"))
+	{
+		vec3 n;
+		n.x = parse_float(p, end);
+		n.y = parse_float(p, end);
+		n.z = parse_float(p, end);
+		chunk.normals.push_back(n);
+	}
+	else if (is_ident("vt"))
+	{
+		vec2 uv;
+		uv.x = parse_float(p, end);
+		uv.y = 1.0f - parse_float(p, end);
+		chunk.uvs.push_back(uv);
+	}
+	else if (is_ident("f"))
+	{
+		// Polygons are fanned, which matches the old quad split.
+		Corner first = {};
+		Corner prev = {};
+		unsigned count = 0;
+
+		for (;;)
+		{
+			p = skip_space(p, end);
+			if (p == end)
+				break;
+
+			auto corner = parse_corner(p, end, chunk);
+			if (count >= 2)
+			{
+				chunk.corners.push_back(first);
+				chunk.corners.push_back(prev);
+				chunk.corners.push_back(corner);
+			}
+			else if (count == 0)
+				first = corner;
+
+			prev = corner;
+			count++;
+		}
+	}
+	else if (is_ident("usemtl"))
+		chunk.material_switches.push_back({ chunk.corners.size(), parse_token(p, end) });
+	else if (is_ident("mtllib"))
+		chunk.libraries.push_back(parse_token(p, end));
+}
+
+static void parse_chunk(const char *p, const char *end, ParsedChunk &chunk)
+{
+	while (p < end)
+	{
+		auto *line_end = static_cast<const char *>(memchr(p, '\n', end - p));
+		if (!line_end)
+			line_end = end;
+		parse_line(p, line_end, chunk);
+		p = line_end + (line_end < end ? 1 : 0);
+	}
+}
+
+static void rebase_index(int32_t &index, bool relative, size_t base, size_t total)
+{
+	if (index == NoIndex)
+		return;
+
+	int64_t global_index = relative ? int64_t(base) + index : int64_t(index);
+	if (global_index < 0 || global_index >= int64_t(total))
+		throw logic_error("Index out of bounds.");
+	index = int32_t(global_index);
+}
+
+// Runs on the calling thread unless we can go wide without stalling a worker.
+template <typename Func>
+static void run_parallel(const char *desc, size_t count, const Func &func)
+{
+	auto *group = GRANITE_THREAD_GROUP();
+	bool parallel = group && count > 1 &&
+	                (!ThreadGroup::current_thread_is_worker() || ThreadGroup::current_task_is_suspendable());
+
+	if (!parallel)
+	{
+		for (size_t i = 0; i < count; i++)
+			func(i);
+		return;
+	}
+
+	vector<exception_ptr> errors(count);
+	auto task = group->create_task();
+	task->set_desc(desc);
+	for (size_t i = 0; i < count; i++)
+	{
+		task->enqueue_task([&func, &errors, i]() {
+			try
+			{
+				func(i);
+			}
+			catch (...)
+			{
+				errors[i] = current_exception();
+			}
+		});
+	}
+	task->wait();
+
+	for (auto &error : errors)
+		if (error)
+			rethrow_exception(error);
+}
+
+struct MaterialRun
+{
+	size_t first_corner;
+	size_t corner_count;
+	int material;
+};
+
+static void build_mesh(const vector<vec3> &positions, const vector<vec3> &normals, const vector<vec2> &uvs,
+                       const Corner *corners, const MaterialRun &run, Mesh &mesh)
+{
+	bool has_uv = corners[0].vt != NoIndex;
+	bool has_normal = corners[0].vn != NoIndex;
+
+	if (run.material >= 0)
+	{
+		mesh.has_material = true;
+		mesh.material_index = unsigned(run.material);
+	}
+
+	mesh.position_stride = sizeof(vec3);
+	mesh.attribute_layout[ecast(MeshAttribute::Position)].format = VK_FORMAT_R32G32B32_SFLOAT;
+	mesh.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	mesh.index_type = VK_INDEX_TYPE_UINT32;
+	mesh.count = unsigned(run.corner_count);
+
+	size_t stride = 0;
+	if (has_normal)
 	{
-		if (current_normals.size() != current_positions.size())
-			throw runtime_error("Normal size != position size.");
 		mesh.attribute_layout[ecast(MeshAttribute::Normal)].format = VK_FORMAT_R32G32B32_SFLOAT;
-		static const size_t stride = sizeof(vec3);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-		for (size_t i = 0; i < current_positions.size(); i++)
-			memcpy(mesh.attributes.data() + stride * i, &current_normals[i], sizeof(vec3));
+		stride += sizeof(vec3);
 	}
-	else if (!current_uvs.empty())
+
+	if (has_uv)
 	{
-		if (current_uvs.size() != current_positions.size())
-			throw runtime_error("UV size != position size.");
 		mesh.attribute_layout[ecast(MeshAttribute::UV)].format = VK_FORMAT_R32G32_SFLOAT;
-		static const size_t stride = sizeof(vec2);
-		mesh.attribute_stride = stride;
-		mesh.attributes.resize(stride * current_positions.size());
-		for (size_t i = 0; i < current_positions.size(); i++)
-			memcpy(mesh.attributes.data() + stride * i, &current_uvs[i], sizeof(vec2));
+		mesh.attribute_layout[ecast(MeshAttribute::UV)].offset = uint32_t(stride);
+		stride += sizeof(vec2);
 	}
+	mesh.attribute_stride = uint32_t(stride);
 
-	current_positions.clear();
-	current_normals.clear();
-	current_uvs.clear();
+	// Every corner is potentially unique, so size for that up front and avoid rehashing.
+	unordered_map<Corner, uint32_t, CornerHash> unique_corners;
+	unique_corners.reserve(run.corner_count);
 
-	mesh_deduplicate_vertices(mesh);
+	vector<uint32_t> indices(run.corner_count);
+	vector<Corner> unique;
+	unique.reserve(run.corner_count);
 
-	root_node.meshes.push_back(meshes.size());
-	meshes.push_back(move(mesh));
+	for (size_t i = 0; i < run.corner_count; i++)
+	{
+		auto &corner = corners[i];
+		if ((corner.vn != NoIndex) != has_normal)
+			throw runtime_error("Normal size != position size.");
+		if ((corner.vt != NoIndex) != has_uv)
+			throw runtime_error("UV size != position size.");
+
+		auto itr = unique_corners.insert({ corner, uint32_t(unique.size()) });
+		if (itr.second)
+			unique.push_back(corner);
+		indices[i] = itr.first->second;
+	}
+
+	mesh.indices.resize(indices.size() * sizeof(uint32_t));
+	memcpy(mesh.indices.data(), indices.data(), mesh.indices.size());
+	mesh.positions.resize(unique.size() * sizeof(vec3));
+	mesh.attributes.resize(unique.size() * stride);
+
+	vec3 lo = vec3(numeric_limits<float>::max());
+	vec3 hi = vec3(-numeric_limits<float>::max());
+
+	for (size_t i = 0; i < unique.size(); i++)
+	{
+		auto &p = positions[unique[i].v];
+		memcpy(mesh.positions.data() + sizeof(vec3) * i, &p, sizeof(vec3));
+		lo = min(lo, p);
+		hi = max(hi, p);
+
+		uint8_t *attr = mesh.attributes.data() + stride * i;
+		if (has_normal)
+			memcpy(attr, &normals[unique[i].vn], sizeof(vec3));
+		if (has_uv)
+			memcpy(attr + mesh.attribute_layout[ecast(MeshAttribute::UV)].offset, &uvs[unique[i].vt], sizeof(vec2));
+	}
+
+	mesh.static_aabb = AABB(lo, hi);
 }
 
 void Parser::emit_gltf_base_color(const std::string &base_color_path, const std::string &alpha_mask_path)
@@ -315,60 +699,6 @@ void Parser::emit_gltf_pbr_metallic_roughness(const std::string &metallic_path,
 	}
 }
 
-void Parser::emit_vertex(const OBJVertex * const *face)
-{
-	// Positions
-	for (unsigned i = 0; i < 3; i++)
-	{
-		auto &p = face[i]->operator[](0);
-
-		if (!p.empty())
-		{
-			int index = stoi(p);
-			if (index < 0)
-				index = int(positions.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(positions.size()))
-				throw logic_error("Index out of bounds.");
-			current_positions.push_back(positions[index]);
-		}
-
-		if (face[i]->size() == 1)
-			continue;
-
-		auto &u = face[i]->operator[](1);
-		auto &n = face[i]->operator[](2);
-
-		if (!u.empty())
-		{
-			int index = stoi(u);
-			if (index < 0)
-				index = int(uvs.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(uvs.size()))
-				throw logic_error("Index out of bounds.");
-			current_uvs.push_back(uvs[index]);
-		}
-
-		if (!n.empty())
-		{
-			int index = stoi(n);
-			if (index < 0)
-				index = int(normals.size()) + index;
-			else
-				index--;
-
-			if (index < 0 || index >= int(normals.size()))
-				throw logic_error("Index out of bounds.");
-			current_normals.push_back(normals[index]);
-		}
-	}
-}
-
 void Parser::load_material_library(const std::string &path)
 {
 	string mtl;
@@ -456,72 +786,130 @@ void Parser::load_material_library(const std::string &path)
 
 Parser::Parser(const std::string &path)
 {
-	string obj;
-	if (!GRANITE_FILESYSTEM()->read_file_to_string(path, obj))
+	auto file = GRANITE_FILESYSTEM()->open(path);
+	if (!file)
 		throw runtime_error("Failed to load OBJ.");
 
-	vector<string> lines = split_no_empty(obj, "\n");
-	for (auto &line : lines)
+	size_t size = file->get_size();
+	const char *data = size ? static_cast<const char *>(file->map()) : nullptr;
+	if (size && !data)
+		throw runtime_error("Failed to map OBJ.");
+
+	// Split into line aligned chunks which are parsed independently.
+	constexpr size_t MinChunkSize = 4 * 1024 * 1024;
+	auto *group = GRANITE_THREAD_GROUP();
+	size_t max_chunks = group ? std::max<size_t>(4 * group->get_num_threads(), 1) : 1;
+	size_t num_chunks = std::min<size_t>(std::max<size_t>(size / MinChunkSize, 1), max_chunks);
+
+	vector<size_t> chunk_offsets = { 0 };
+	for (size_t i = 1; i < num_chunks; i++)
 	{
-		line = strip_whitespace(line);
-		auto comment_index = line.find_first_of('#');
-		if (comment_index != string::npos)
-			line = line.substr(comment_index, string::npos);
+		size_t offset = std::max(size * i / num_chunks, chunk_offsets.back());
+		auto *line_end = static_cast<const char *>(memchr(data + offset, '\n', size - offset));
+		offset = line_end ? size_t(line_end - data) + 1 : size;
+		if (offset > chunk_offsets.back() && offset < size)
+			chunk_offsets.push_back(offset);
+	}
+	chunk_offsets.push_back(size);
+	num_chunks = chunk_offsets.size() - 1;
 
-		auto elements = split_no_empty(line, " ");
-		if (elements.empty())
-			continue;
+	vector<ParsedChunk> chunks(num_chunks);
+	run_parallel("obj-parse", num_chunks, [&](size_t i) {
+		parse_chunk(data + chunk_offsets[i], data + chunk_offsets[i + 1], chunks[i]);
+	});
 
-		auto &ident = elements.front();
-		if (ident == "mtllib")
-			load_material_library(Path::relpath(path, elements.at(1)));
-		else if (ident == "v")
-			positions.push_back(vec3(stof(elements.at(1)), stof(elements.at(2)), stof(elements.at(3))));
-		else if (ident == "vn")
-			normals.push_back(vec3(stof(elements.at(1)), stof(elements.at(2)), stof(elements.at(3))));
-		else if (ident == "vt")
-			uvs.push_back(vec2(stof(elements.at(1)), 1.0f - stof(elements.at(2))));
-		else if (ident == "usemtl")
+	file.reset();
+
+	// Merge the tables. Face indices are rebased with the running counts of earlier chunks.
+	struct ChunkBase
+	{
+		size_t positions, normals, uvs, corners;
+	};
+	vector<ChunkBase> bases(num_chunks);
+	ChunkBase total = {};
+	for (size_t i = 0; i < num_chunks; i++)
+	{
+		bases[i] = total;
+		total.positions += chunks[i].positions.size();
+		total.normals += chunks[i].normals.size();
+		total.uvs += chunks[i].uvs.size();
+		total.corners += chunks[i].corners.size();
+	}
+
+	if (total.positions > size_t(INT32_MAX) || total.normals > size_t(INT32_MAX) || total.uvs > size_t(INT32_MAX))
+		throw runtime_error("OBJ is too large.");
+
+	vector<vec3> positions(total.positions);
+	vector<vec3> normals(total.normals);
+	vector<vec2> uvs(total.uvs);
+	vector<Corner> corners(total.corners);
+
+	run_parallel("obj-merge", num_chunks, [&](size_t i) {
+		auto &chunk = chunks[i];
+		auto &base = bases[i];
+		copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + base.positions);
+		copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + base.normals);
+		copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + base.uvs);
+
+		auto *dst = corners.data() + base.corners;
+		for (auto &corner : chunk.corners)
 		{
-			auto itr = material_library.find(elements.at(1));
+			*dst = corner;
+			rebase_index(dst->v, (corner.relative_mask & (1u << 0)) != 0, base.positions, total.positions);
+			rebase_index(dst->vt, (corner.relative_mask & (1u << 1)) != 0, base.uvs, total.uvs);
+			rebase_index(dst->vn, (corner.relative_mask & (1u << 2)) != 0, base.normals, total.normals);
+			dst->relative_mask = 0;
+			dst++;
+		}
+
+		vector<vec3>().swap(chunk.positions);
+		vector<vec3>().swap(chunk.normals);
+		vector<vec2>().swap(chunk.uvs);
+		vector<Corner>().swap(chunk.corners);
+	});
+
+	for (auto &chunk : chunks)
+		for (auto &lib : chunk.libraries)
+			load_material_library(Path::relpath(path, lib));
+
+	// A new mesh starts whenever the material changes.
+	vector<MaterialRun> runs;
+	int current_material = -1;
+	size_t run_start = 0;
+
+	for (size_t i = 0; i < num_chunks; i++)
+	{
+		for (auto &mtl : chunks[i].material_switches)
+		{
+			auto itr = material_library.find(mtl.name);
 			if (itr == end(material_library))
 			{
-				LOGE("Material %s does not exist!\n",
-				     elements.at(1).c_str());
+				LOGE("Material %s does not exist!\n", mtl.name.c_str());
 				throw runtime_error("Material does not exist.");
 			}
+
 			int index = int(itr->second);
-			if (index != current_material)
-				flush_mesh();
+			if (index == current_material)
+				continue;
+
+			size_t corner = bases[i].corners + mtl.first_corner;
+			if (corner > run_start)
+				runs.push_back({ run_start, corner - run_start, current_material });
+			run_start = corner;
 			current_material = index;
 		}
-		else if (ident == "f")
-		{
-			if (elements.size() == 5)
-			{
-				auto v0 = split(elements.at(1), "/");
-				auto v1 = split(elements.at(2), "/");
-				auto v2 = split(elements.at(3), "/");
-				auto v3 = split(elements.at(4), "/");
-
-				const OBJVertex *f0[3] = { &v0, &v1, &v2 };
-				const OBJVertex *f1[3] = { &v0, &v2, &v3 };
-				emit_vertex(f0);
-				emit_vertex(f1);
-			}
-			else if (elements.size() == 4)
-			{
-				auto v0 = split(elements.at(1), "/");
-				auto v1 = split(elements.at(2), "/");
-				auto v2 = split(elements.at(3), "/");
-				const OBJVertex *f0[3] = { &v0, &v1, &v2 };
-				emit_vertex(f0);
-			}
-		}
 	}
 
-	flush_mesh();
+	if (total.corners > run_start)
+		runs.push_back({ run_start, total.corners - run_start, current_material });
+
+	meshes.resize(runs.size());
+	run_parallel("obj-build-meshes", runs.size(), [&](size_t i) {
+		build_mesh(positions, normals, uvs, corners.data() + runs[i].first_corner, runs[i], meshes[i]);
+	});
+
+	for (size_t i = 0; i < meshes.size(); i++)
+		root_node.meshes.push_back(i);
 	nodes.push_back(move(root_node));
 }
 }
-
@@ -24,6 +24,7 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include "math.hpp"
 #include "scene_formats.hpp"
 
@@ -35,6 +36,7 @@ using namespace Granite::SceneFormats;
 class Parser
 {
 public:
+	// The file is mapped and parsed in line aligned chunks on the global thread group.
 	explicit Parser(const std::string &path);
 
 	const std::vector<Mesh> &get_meshes() const
@@ -58,19 +60,7 @@ private:
 	std::vector<Mesh> meshes;
 	std::unordered_map<std::string, unsigned> material_library;
 
-	std::vector<vec3> positions;
-	std::vector<vec3> normals;
-	std::vector<vec2> uvs;
-	std::vector<vec3> current_positions;
-	std::vector<vec3> current_normals;
-	std::vector<vec2> current_uvs;
-	int current_material = -1;
-
 	void load_material_library(const std::string &path);
-	void flush_mesh();
-
-	using OBJVertex = std::vector<std::string>;
-	void emit_vertex(const OBJVertex * const *face);
 	void emit_gltf_pbr_metallic_roughness(const std::string &metallic, const std::string &roughness);
 	void emit_gltf_base_color(const std::string &metallic, const std::string &roughness);
 	Node root_node;
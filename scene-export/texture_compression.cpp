@@ -23,6 +23,8 @@
 #include "texture_compression.hpp"
 #include "texture_files.hpp"
 #include "format.hpp"
+#include "hash.hpp"
+#include "path_utils.hpp"
 #include "muglm/muglm_impl.hpp"
 #include <vector>
 #include <string.h>
@@ -169,6 +171,7 @@ struct CompressorState : enable_shared_from_this<CompressorState>
 	double total_error[4] = {};
 	mutex lock;
 	TaskSignal *signal = nullptr;
+	string cache_path;
 };
 
 void CompressorState::setup(const CompressorArguments &args)
@@ -939,6 +942,13 @@ void CompressorState::enqueue_compression(ThreadGroup &group, const CompressorAr
 		if (state->total_error[1] != 0.0)
 			LOGI("Green PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[1]));
 
+		if (args.supercompress && !state->output->copy_to_path(*GRANITE_FILESYSTEM(), args.output, true))
+			LOGE("Failed to write supercompressed texture: %s\n", args.output.c_str());
+
+		// Cache entries are always supercompressed, they are mostly read over the network.
+		if (!state->cache_path.empty() && !state->output->copy_to_path(*GRANITE_FILESYSTEM(), state->cache_path, true))
+			LOGW("Failed to write texture cache entry: %s\n", state->cache_path.c_str());
+
 		LOGI("Unmapping %u bytes for texture writing.\n", unsigned(state->output->get_required_size()));
 		LOGI("Unmapping %u bytes for texture reading.\n", unsigned(state->input->get_required_size()));
 
@@ -949,6 +959,61 @@ void CompressorState::enqueue_compression(ThreadGroup &group, const CompressorAr
 	write_task->set_fence_counter_signal(signal);
 }
 
+// Bump when encoder changes should invalidate existing cache entries.
+static constexpr uint32_t CompressorCacheVersion = 1;
+
+static string get_compressor_cache_path(const CompressorArguments &args, const Vulkan::MemoryMappedTexture &input)
+{
+	auto &layout = input.get_layout();
+
+	Util::Hasher h;
+	h.u32(CompressorCacheVersion);
+	h.u32(args.format);
+	h.u32(args.quality);
+	h.u32(uint32_t(args.mode));
+	h.u32(args.output_mapping.r);
+	h.u32(args.output_mapping.g);
+	h.u32(args.output_mapping.b);
+	h.u32(args.output_mapping.a);
+	h.u32(uint32_t(args.deferred_mipgen));
+
+	h.u32(layout.get_format());
+	h.u32(layout.get_image_type());
+	h.u32(layout.get_width());
+	h.u32(layout.get_height());
+	h.u32(layout.get_depth());
+	h.u32(layout.get_layers());
+	h.u32(layout.get_levels());
+	h.u32(input.get_flags());
+
+	// Includes generated mips, so mip settings are covered as well.
+	size_t size = layout.get_required_size();
+	auto *data = static_cast<const uint8_t *>(layout.data());
+	h.data(reinterpret_cast<const uint32_t *>(data), size & ~size_t(3));
+	for (size_t i = size & ~size_t(3); i < size; i++)
+		h.u32(data[i]);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.gtx", static_cast<unsigned long long>(h.get()));
+	return Path::join(args.cache_directory, name);
+}
+
+static bool copy_from_compressor_cache(const string &cache_path, const CompressorArguments &args)
+{
+	FileStat stat;
+	if (!GRANITE_FILESYSTEM()->stat(cache_path, stat) || stat.type != PathType::File)
+		return false;
+
+	Vulkan::MemoryMappedTexture cached;
+	if (!cached.map_read(*GRANITE_FILESYSTEM(), cache_path) || cached.get_layout().get_format() != args.format)
+	{
+		LOGW("Ignoring invalid texture cache entry: %s\n", cache_path.c_str());
+		return false;
+	}
+
+	return cached.copy_to_path(*GRANITE_FILESYSTEM(), args.output, args.supercompress);
+}
+
 bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
                       const shared_ptr<Vulkan::MemoryMappedTexture> &input,
                       TaskGroupHandle &dep, TaskSignal *signal)
@@ -970,6 +1035,19 @@ bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
 	}
 
 	auto setup_task = group.create_task([&group, output, args]() {
+		if (!args.cache_directory.empty())
+		{
+			output->cache_path = get_compressor_cache_path(args, *output->input);
+			if (copy_from_compressor_cache(output->cache_path, args))
+			{
+				LOGI("Texture cache hit: %s -> %s\n", output->cache_path.c_str(), args.output.c_str());
+				output->input.reset();
+				if (output->signal)
+					output->signal->signal_increment();
+				return;
+			}
+		}
+
 		output->output = make_shared<Vulkan::MemoryMappedTexture>();
 		auto &layout = output->input->get_layout();
 
@@ -994,7 +1072,11 @@ bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
 			return;
 		}
 
-		if (!output->output->map_write(*GRANITE_FILESYSTEM(), args.output))
+		// Supercompressed output needs the whole payload before it can be written.
+		bool mapped = args.supercompress ?
+		              output->output->map_write_scratch() :
+		              output->output->map_write(*GRANITE_FILESYSTEM(), args.output);
+		if (!mapped)
 		{
 			LOGE("Failed to map output texture for writing.\n");
 			if (output->signal)
@@ -1007,6 +1089,8 @@ bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
 
 		output->enqueue_compression(group, args);
 	});
+	// Compression tasks spawned by the setup task inherit this priority.
+	setup_task->set_priority(TaskPriority::Background);
 	group.add_dependency(*setup_task, *dep);
 
 	return true;
@@ -55,6 +55,11 @@ struct CompressorArguments
 		VK_COMPONENT_SWIZZLE_A,
 	};
 	bool deferred_mipgen = false;
+	// Writes LZ4 supercompressed chunks, see MemoryMappedTexture::copy_to_path().
+	bool supercompress = false;
+	// Compressed outputs are cached here, keyed by a hash of the input pixels and the arguments which affect
+	// the result. Any filesystem path works, so a shared directory or a netfs mount lets machines share the cache.
+	std::string cache_directory;
 };
 
 VkFormat string_to_format(const std::string &s);
@@ -138,6 +138,11 @@ void TMXParser::parse(const string &base_path, const string &json)
 		out_layer.visible = layer["visible"].GetBool();
 		out_layer.opacity = layer["opacity"].GetFloat();
 		out_layer.id = layer["id"].GetUint();
+		out_layer.offset = muglm::ivec2(0);
+		if (layer.HasMember("offsetx"))
+			out_layer.offset.x = int(layer["offsetx"].GetFloat());
+		if (layer.HasMember("offsety"))
+			out_layer.offset.y = int(layer["offsety"].GetFloat());
 
 		out_layer.tile_indices.reserve(layer["data"].GetArray().Size());
 		for (auto tile_itr = layer["data"].Begin(); tile_itr != layer["data"].End(); ++tile_itr)
@@ -197,6 +202,16 @@ void TMXParser::parse(const string &base_path, const string &json)
 
 				if (tile.HasMember("properties"))
 					tiles[num_tiles + offset].properties = parse_properties(tile["properties"]);
+
+				if (tile.HasMember("animation"))
+				{
+					auto &animation = tiles[num_tiles + offset].animation;
+					for (auto frame_itr = tile["animation"].Begin(); frame_itr != tile["animation"].End(); ++frame_itr)
+					{
+						auto &frame = *frame_itr;
+						animation.push_back({ int(num_tiles + frame["tileid"].GetUint()), frame["duration"].GetUint() });
+					}
+				}
 			}
 		}
 
@@ -87,12 +87,20 @@ public:
 		Value value;
 	};
 
+	struct AnimationFrame
+	{
+		int tile;
+		unsigned duration_ms;
+	};
+
 	struct Tile
 	{
 		// Tile properties go here.
 		Granite::DrawPipeline pipeline = Granite::DrawPipeline::Opaque;
 		int terrain_corners[4] = { -1, -1, -1, -1 };
 		std::vector<Property> properties;
+		// Empty for static tiles. Frames refer to tile indices like Layer::tile_indices.
+		std::vector<AnimationFrame> animation;
 	};
 
 	struct Terrain
@@ -105,6 +113,7 @@ public:
 	{
 		std::vector<int> tile_indices;
 		std::vector<Property> properties;
+		// In pixels.
 		muglm::ivec2 offset;
 		muglm::uvec2 size;
 		unsigned id;
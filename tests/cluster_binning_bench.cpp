@@ -0,0 +1,153 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cluster_binning.hpp"
+#include "render_context.hpp"
+#include "lights.hpp"
+#include "task_composer.hpp"
+#include "thread_group.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "transforms.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+
+struct BinningScene
+{
+	std::vector<PositionalFragmentInfo> lights;
+	std::vector<mat4> models;
+	std::vector<uint32_t> type_mask;
+};
+
+static void build_scene(BinningScene &scene, unsigned count, std::mt19937 &rnd)
+{
+	std::uniform_real_distribution<float> xy_dist(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> z_dist(-100.0f, 5.0f);
+	std::uniform_real_distribution<float> radius_dist(0.5f, 8.0f);
+	std::uniform_real_distribution<float> dir_dist(-1.0f, 1.0f);
+	std::uniform_int_distribution<unsigned> type_dist(0, 3);
+
+	scene.lights.resize(count);
+	scene.models.resize(count);
+	scene.type_mask.assign((count + 31) / 32, 0);
+
+	// Mostly point lights with some spots, which is typical for the bindless path.
+	SpotLight spot;
+	spot.set_spot_parameters(0.8f, 0.6f);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		vec3 pos(xy_dist(rnd), 0.3f * xy_dist(rnd), z_dist(rnd));
+		float radius = radius_dist(rnd);
+
+		if (type_dist(rnd) != 0)
+		{
+			auto &light = scene.lights[i];
+			light = {};
+			light.position = pos;
+			light.inv_radius = 1.0f / radius;
+			scene.models[i][0] = vec4(pos, radius);
+			scene.type_mask[i >> 5] |= 1u << (i & 31);
+		}
+		else
+		{
+			spot.set_range(radius);
+			vec3 dir = normalize(vec3(dir_dist(rnd), dir_dist(rnd), dir_dist(rnd)) + vec3(0.0f, 0.0f, 0.01f));
+			mat4 transform = translate(pos) * mat4_cast(look_at_arbitrary_up(dir));
+			scene.lights[i] = spot.get_shader_info(transform);
+			scene.models[i] = spot.build_model_matrix(transform);
+		}
+	}
+}
+
+static bool outputs_match(const ClusterBinningOutput &a, const ClusterBinningOutput &b)
+{
+	return a.bitmask == b.bitmask && a.z_ranges.size() == b.z_ranges.size() &&
+	       std::equal(a.z_ranges.begin(), a.z_ranges.end(), b.z_ranges.begin(),
+	                  [](const uvec2 &x, const uvec2 &y) { return x.x == y.x && x.y == y.y; });
+}
+
+static void run_bench(ThreadGroup &group, const RenderContext &context, unsigned count)
+{
+	constexpr unsigned Iterations = 20;
+	std::mt19937 rnd(1337);
+	BinningScene scene;
+	build_scene(scene, count, rnd);
+
+	ClusterBinningInput input;
+	input.context = &context;
+	input.lights = scene.lights.data();
+	input.models = scene.models.data();
+	input.type_mask = scene.type_mask.data();
+	input.num_lights = count;
+	input.resolution_x = 64;
+	input.resolution_y = 32;
+	input.resolution_z = 1024;
+
+	ClusterBinningOutput reference, threaded;
+
+	uint64_t single_time = 0;
+	uint64_t threaded_time = 0;
+
+	for (unsigned iter = 0; iter < Iterations; iter++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		ClusterBinning::bin_lights(input, reference);
+		single_time += Util::get_current_time_nsecs() - start;
+
+		start = Util::get_current_time_nsecs();
+		{
+			TaskComposer composer(group);
+			ClusterBinning::compose_bin_lights(composer, input, threaded, group.get_num_threads());
+			composer.get_outgoing_task()->wait();
+		}
+		threaded_time += Util::get_current_time_nsecs() - start;
+	}
+
+	double single_ms = 1e-6 * double(single_time) / Iterations;
+	double threaded_ms = 1e-6 * double(threaded_time) / Iterations;
+
+	LOGI("%5u lights: 1 thread %.3f ms (%.1f lights / ms), %u threads %.3f ms (%.1f lights / ms)%s\n",
+	     count, single_ms, count / single_ms, group.get_num_threads(), threaded_ms, count / threaded_ms,
+	     outputs_match(reference, threaded) ? "" : " (MISMATCH)");
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), {});
+
+	vec3 eye(0.0f, 2.0f, 10.0f);
+	mat4 view = mat4_cast(look_at(normalize(vec3(0.0f, -0.05f, -1.0f)), vec3(0.0f, 1.0f, 0.0f))) * translate(-eye);
+
+	RenderContext context;
+	context.set_camera(projection(half_pi<float>(), 16.0f / 9.0f, 0.1f, 200.0f), view);
+
+	static const unsigned counts[] = { 1024, 4 * 1024, 16 * 1024 };
+	for (auto count : counts)
+		run_bench(group, context, count);
+}
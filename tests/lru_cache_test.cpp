@@ -1,5 +1,7 @@
 #include "lru_cache.hpp"
 #include "logging.hpp"
+#include <thread>
+#include <vector>
 
 using namespace Util;
 
@@ -43,4 +45,37 @@ int main()
 	LOGI("=== Pruned ===\n");
 	for (auto &entry : cache)
 		LOGI("Value: %u\n", entry.t.value);
+
+	ConcurrentLRUCache<unsigned> concurrent;
+	concurrent.set_total_cost(64 * 1024);
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < 4; t++)
+	{
+		threads.emplace_back([&concurrent, t]() {
+			for (unsigned i = 0; i < 100000; i++)
+			{
+				unsigned cookie = (i * 31 + t) & 4095;
+				unsigned value;
+				if (concurrent.find_and_mark_as_recent(cookie, value))
+				{
+					if (value != cookie)
+						LOGE("Mismatch for cookie %u.\n", cookie);
+				}
+				else
+					concurrent.insert(cookie, cookie, 16 + (cookie & 63));
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	auto stats = concurrent.get_statistics();
+	LOGI("=== Concurrent ===\n");
+	LOGI("Hits: %llu, misses: %llu, evictions: %llu, cost: %llu\n",
+	     static_cast<unsigned long long>(stats.hits),
+	     static_cast<unsigned long long>(stats.misses),
+	     static_cast<unsigned long long>(stats.evictions),
+	     static_cast<unsigned long long>(concurrent.get_current_cost()));
 }
\ No newline at end of file
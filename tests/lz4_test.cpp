@@ -0,0 +1,98 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lz4.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Util;
+
+static bool test_round_trip(const std::vector<uint8_t> &input, const char *tag)
+{
+	std::vector<uint8_t> compressed(lz4_compress_bound(input.size()));
+	size_t compressed_size = lz4_compress(input.data(), input.size(), compressed.data(), compressed.size());
+	if (compressed_size == 0)
+	{
+		LOGE("%s: Failed to compress %zu bytes.\n", tag, input.size());
+		return false;
+	}
+
+	std::vector<uint8_t> output(input.size());
+	if (!lz4_decompress(compressed.data(), compressed_size, output.data(), output.size()) || output != input)
+	{
+		LOGE("%s: Round trip of %zu bytes failed.\n", tag, input.size());
+		return false;
+	}
+
+	// Truncated streams and wrong output sizes must fail cleanly.
+	if (compressed_size > 1 && lz4_decompress(compressed.data(), compressed_size - 1, output.data(), output.size()))
+	{
+		LOGE("%s: Truncated stream decoded.\n", tag);
+		return false;
+	}
+
+	if (!input.empty() && lz4_decompress(compressed.data(), compressed_size, output.data(), output.size() - 1))
+	{
+		LOGE("%s: Stream decoded into a smaller buffer.\n", tag);
+		return false;
+	}
+
+	LOGI("%s: %zu -> %zu bytes.\n", tag, input.size(), compressed_size);
+	return true;
+}
+
+int main()
+{
+	std::mt19937 rnd(1234);
+	bool success = true;
+
+	for (size_t size : { 0, 1, 5, 12, 13, 64, 1000, 65536, 300000 })
+	{
+		std::vector<uint8_t> random(size);
+		for (auto &v : random)
+			v = uint8_t(rnd());
+		success = test_round_trip(random, "random") && success;
+
+		std::vector<uint8_t> repeated(size);
+		for (size_t i = 0; i < size; i++)
+			repeated[i] = uint8_t(i % 3);
+		success = test_round_trip(repeated, "repeated") && success;
+
+		// Looks somewhat like block compressed data, with a few distinct blocks.
+		std::vector<uint8_t> blocks(size);
+		uint8_t patterns[4][16];
+		for (auto &pattern : patterns)
+			for (auto &v : pattern)
+				v = uint8_t(rnd());
+		for (size_t i = 0; i < size; i += 16)
+			memcpy(blocks.data() + i, patterns[rnd() & 3], std::min<size_t>(16, size - i));
+		success = test_round_trip(blocks, "blocks") && success;
+	}
+
+	if (!success)
+		return EXIT_FAILURE;
+	LOGI("All tests passed.\n");
+}
@@ -0,0 +1,140 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "message_queue.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <string.h>
+
+using namespace Util;
+
+// Baseline: the SPSC queue with every producer and consumer serialized through a mutex.
+struct LockedQueue
+{
+	LockFreeMessageQueue queue;
+	std::mutex lock;
+
+	MessageQueuePayload allocate_write_payload(size_t size)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		return queue.allocate_write_payload(size);
+	}
+
+	bool push_written_payload(MessageQueuePayload payload)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		return queue.push_written_payload(std::move(payload));
+	}
+
+	MessageQueuePayload read_message()
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		return queue.read_message();
+	}
+
+	void recycle_payload(MessageQueuePayload payload)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		queue.recycle_payload(std::move(payload));
+	}
+};
+
+template <typename Queue>
+static void run_bench(const char *tag, unsigned num_producers, unsigned num_consumers)
+{
+	constexpr uint64_t MessagesPerProducer = 200000;
+	Queue queue;
+	std::atomic<uint64_t> consumed_count{0};
+	std::atomic<uint64_t> consumed_sum{0};
+	const uint64_t total_messages = MessagesPerProducer * num_producers;
+
+	std::vector<std::thread> threads;
+	auto start = get_current_time_nsecs();
+
+	for (unsigned i = 0; i < num_producers; i++)
+	{
+		threads.emplace_back([&queue]() {
+			for (uint64_t j = 1; j <= MessagesPerProducer; j++)
+			{
+				// A payload which fails to push is released, so build a new one on retry.
+				for (;;)
+				{
+					auto payload = queue.allocate_write_payload(sizeof(uint64_t));
+					memcpy(payload.get_payload_data(), &j, sizeof(j));
+					payload.set_size(sizeof(j));
+					if (queue.push_written_payload(std::move(payload)))
+						break;
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	for (unsigned i = 0; i < num_consumers; i++)
+	{
+		threads.emplace_back([&]() {
+			uint64_t local_sum = 0;
+			while (consumed_count.load(std::memory_order_relaxed) < total_messages)
+			{
+				auto payload = queue.read_message();
+				if (!payload)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				uint64_t value;
+				memcpy(&value, payload.get_payload_data(), sizeof(value));
+				local_sum += value;
+				queue.recycle_payload(std::move(payload));
+				consumed_count.fetch_add(1, std::memory_order_relaxed);
+			}
+			consumed_sum.fetch_add(local_sum, std::memory_order_relaxed);
+		});
+	}
+
+	for (auto &thr : threads)
+		thr.join();
+	auto end = get_current_time_nsecs();
+
+	uint64_t expected_sum = num_producers * (MessagesPerProducer * (MessagesPerProducer + 1) / 2);
+	LOGI("%s: %u producers, %u consumers: %.3f M messages / s%s\n", tag, num_producers, num_consumers,
+	     1e-6 * double(total_messages) / (1e-9 * double(end - start)),
+	     consumed_sum.load() == expected_sum ? "" : " (MISMATCH)");
+}
+
+int main()
+{
+	static const unsigned configs[][2] = {
+		{ 1, 1 }, { 2, 1 }, { 4, 1 }, { 8, 1 }, { 4, 4 },
+	};
+
+	for (auto &config : configs)
+	{
+		run_bench<LockedQueue>("mutex", config[0], config[1]);
+		run_bench<LockFreeMPMCMessageQueue>("mpmc ", config[0], config[1]);
+	}
+}
@@ -0,0 +1,129 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "render_queue.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <algorithm>
+#include <vector>
+
+using namespace Granite;
+using namespace Util;
+
+struct DummyInfo
+{
+	uint32_t value;
+};
+
+static void dummy_render(Vulkan::CommandBuffer &, const RenderQueueData *, unsigned)
+{
+}
+
+static void fill_queue(RenderQueue &queue, size_t count, std::mt19937 &rnd)
+{
+	// Roughly what a scene pushes: a few hundred pipeline/material combinations,
+	// with most entries opaque and a small fraction transparent.
+	std::uniform_int_distribution<uint32_t> pipeline_dist(1, 300);
+	std::uniform_int_distribution<uint32_t> draw_dist(1, 1000);
+	std::uniform_real_distribution<float> z_dist(0.1f, 500.0f);
+	std::uniform_int_distribution<unsigned> queue_dist(0, 15);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Hash pipeline_hash = pipeline_dist(rnd) * 0x9e3779b97f4a7c15ull;
+		Hash draw_hash = draw_dist(rnd) * 0xc2b2ae3d27d4eb4full;
+		float z = z_dist(rnd);
+
+		auto queue_type = queue_dist(rnd) == 0 ? Queue::Transparent : Queue::Opaque;
+		uint64_t key = RenderInfo::get_sprite_sort_key(queue_type, pipeline_hash, draw_hash, z);
+		auto *info = queue.push<DummyInfo>(queue_type, draw_hash, key, dummy_render, nullptr);
+		if (info)
+			info->value = uint32_t(i);
+	}
+}
+
+static bool verify(const RenderQueue &queue, Queue queue_type, const std::vector<RenderQueueData> &reference)
+{
+	auto &data = queue.get_queue_data(queue_type);
+	if (data.size() != reference.size())
+		return false;
+
+	for (size_t i = 0; i < reference.size(); i++)
+		if (data[i].sorting_key != reference[i].sorting_key || data[i].render_info != reference[i].render_info)
+			return false;
+	return true;
+}
+
+static void run_bench(size_t count)
+{
+	constexpr unsigned Iterations = 50;
+	std::mt19937 rnd(1337);
+	RenderQueue queue;
+
+	uint64_t radix_time = 0;
+	uint64_t stable_time = 0;
+	bool ok = true;
+
+	for (unsigned iter = 0; iter < Iterations; iter++)
+	{
+		queue.reset();
+		fill_queue(queue, count, rnd);
+
+		std::vector<RenderQueueData> references[2];
+		static const Queue types[2] = { Queue::Opaque, Queue::Transparent };
+		for (unsigned i = 0; i < 2; i++)
+		{
+			auto &data = queue.get_queue_data(types[i]);
+			references[i].assign(data.begin(), data.end());
+		}
+
+		auto start = get_current_time_nsecs();
+		for (auto &reference : references)
+		{
+			std::stable_sort(reference.begin(), reference.end(), [](const RenderQueueData &a, const RenderQueueData &b) {
+				return a.sorting_key < b.sorting_key;
+			});
+		}
+		stable_time += get_current_time_nsecs() - start;
+
+		start = get_current_time_nsecs();
+		queue.sort();
+		radix_time += get_current_time_nsecs() - start;
+
+		for (unsigned i = 0; i < 2; i++)
+			if (!verify(queue, types[i], references[i]))
+				ok = false;
+	}
+
+	LOGI("%7zu entries: stable_sort %.3f ms, RenderQueue::sort %.3f ms%s\n", count,
+	     1e-6 * double(stable_time) / Iterations,
+	     1e-6 * double(radix_time) / Iterations,
+	     ok ? "" : " (MISMATCH)");
+}
+
+int main()
+{
+	static const size_t counts[] = { 100, 1000, 10000, 50000, 100000, 250000 };
+	for (auto count : counts)
+		run_bench(count);
+}
@@ -1,7 +1,14 @@
 #include "dsp/sinc_resampler.hpp"
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include <vector>
 #include "global_managers_init.hpp"
 #include "filesystem.hpp"
+#include "simd_batch.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
 
 using namespace Granite::Audio::DSP;
 
@@ -31,9 +38,172 @@ static void test_reported_sizes()
 	}
 }
 
+static std::vector<float> make_channel(unsigned channel, size_t frames)
+{
+	std::vector<float> samples(frames);
+	for (size_t i = 0; i < frames; i++)
+		samples[i] = float(sin(0.01 * double(i) * (channel + 1)) + 0.25 * sin(0.37 * double(i)));
+	return samples;
+}
+
+// Resamples every channel separately and all channels at once with the current kernel.
+static void resample_both(std::vector<float> *separate, std::vector<float> *planar,
+                          unsigned channels, float out_rate, SincResampler::Quality quality)
+{
+	constexpr size_t frames = 4096;
+	std::vector<float> inputs[SincResampler::MaxChannels];
+	const float *input_ptrs[SincResampler::MaxChannels];
+	float *planar_ptrs[SincResampler::MaxChannels];
+
+	SincResampler multi(out_rate, 1.0f, quality, channels);
+	size_t max_output = multi.get_maximum_output_for_input_frames(frames);
+
+	for (unsigned c = 0; c < channels; c++)
+	{
+		inputs[c] = make_channel(c, frames);
+		input_ptrs[c] = inputs[c].data();
+		separate[c].assign(max_output, 0.0f);
+		planar[c].assign(max_output, 0.0f);
+		planar_ptrs[c] = planar[c].data();
+
+		SincResampler mono(out_rate, 1.0f, quality);
+		size_t rendered = mono.process_input_frames(separate[c].data(), inputs[c].data(), frames);
+		separate[c].resize(rendered);
+	}
+
+	size_t rendered = multi.process_input_frames(planar_ptrs, input_ptrs, frames);
+	for (unsigned c = 0; c < channels; c++)
+		planar[c].resize(rendered);
+}
+
+static bool compare_channels(const std::vector<float> *a, const std::vector<float> *b, unsigned channels)
+{
+	for (unsigned c = 0; c < channels; c++)
+	{
+		if (a[c].size() != b[c].size())
+			return false;
+		for (size_t i = 0; i < a[c].size(); i++)
+			if (fabsf(a[c][i] - b[c][i]) > 1e-4f)
+				return false;
+	}
+	return true;
+}
+
+static void test_multichannel()
+{
+	using namespace Granite::SIMD;
+	const BatchISA isa = get_batch_isa();
+	const SincResampler::Quality qualities[] = {
+		SincResampler::Quality::Low, SincResampler::Quality::Medium, SincResampler::Quality::High,
+	};
+
+	for (auto quality : qualities)
+	{
+		for (unsigned channels : { 1u, 2u, 5u, 8u })
+		{
+			for (float out_rate : { 1.1256523423432f, 0.7878237482374f })
+			{
+				std::vector<float> generic_separate[SincResampler::MaxChannels];
+				std::vector<float> generic_planar[SincResampler::MaxChannels];
+				set_batch_isa(BatchISA::Generic);
+				resample_both(generic_separate, generic_planar, channels, out_rate, quality);
+				if (!compare_channels(generic_separate, generic_planar, channels))
+				{
+					LOGE("Planar resampling does not match, %u channels.\n", channels);
+					exit(EXIT_FAILURE);
+				}
+
+				std::vector<float> wide_separate[SincResampler::MaxChannels];
+				std::vector<float> wide_planar[SincResampler::MaxChannels];
+				set_batch_isa(isa);
+				resample_both(wide_separate, wide_planar, channels, out_rate, quality);
+				if (!compare_channels(generic_planar, wide_separate, channels) ||
+				    !compare_channels(generic_planar, wide_planar, channels))
+				{
+					LOGE("%s resampling does not match generic, %u channels.\n",
+					     get_batch_isa_name(isa), channels);
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+	}
+}
+
+static double time_resampling(unsigned channels, bool planar, const std::vector<float> &input, std::vector<float> &output)
+{
+	constexpr float out_rate = 44100.0f;
+	constexpr float in_rate = 48000.0f;
+	constexpr size_t block = 256;
+
+	std::unique_ptr<SincResampler> resamplers[SincResampler::MaxChannels];
+	unsigned num_resamplers = planar ? 1 : channels;
+	for (unsigned i = 0; i < num_resamplers; i++)
+		resamplers[i].reset(new SincResampler(out_rate, in_rate, SincResampler::Quality::High, planar ? channels : 1));
+
+	float *outputs[SincResampler::MaxChannels];
+	const float *inputs[SincResampler::MaxChannels];
+	for (unsigned c = 0; c < channels; c++)
+		inputs[c] = input.data();
+
+	auto start = Util::get_current_time_nsecs();
+	for (size_t i = 0; i + block <= input.size(); i += block)
+	{
+		for (unsigned c = 0; c < channels; c++)
+			outputs[c] = output.data() + c * block;
+
+		if (planar)
+		{
+			const float *block_inputs[SincResampler::MaxChannels];
+			for (unsigned c = 0; c < channels; c++)
+				block_inputs[c] = inputs[c] + i;
+			resamplers[0]->process_input_frames(outputs, block_inputs, block);
+		}
+		else
+		{
+			for (unsigned c = 0; c < channels; c++)
+				resamplers[c]->process_input_frames(outputs[c], inputs[c] + i, block);
+		}
+	}
+	auto end = Util::get_current_time_nsecs();
+	return 1e-6 * double(end - start);
+}
+
+// Throughput of Quality::High, 48 kHz to 44.1 kHz, separate resamplers per channel against one planar resampler.
+static void run_benchmark()
+{
+	using namespace Granite::SIMD;
+	const BatchISA supported = get_batch_isa();
+	std::vector<float> input = make_channel(0, 48000 * 10);
+	std::vector<float> output(SincResampler::MaxChannels * 256);
+
+	for (auto isa : { BatchISA::Generic, BatchISA::AVX2 })
+	{
+		if (isa > supported)
+			continue;
+		set_batch_isa(isa);
+
+		for (unsigned channels : { 1u, 2u, 6u })
+		{
+			double separate_ms = time_resampling(channels, false, input, output);
+			double planar_ms = time_resampling(channels, true, input, output);
+			LOGI("%s, %u channels, 10 s of audio: separate %.3f ms, planar %.3f ms.\n",
+			     get_batch_isa_name(isa), channels, separate_ms, planar_ms);
+		}
+	}
+	set_batch_isa(supported);
+}
+
 int main(int argc, char **argv)
 {
 	test_reported_sizes();
+	test_multichannel();
+
+	if (argc == 2 && strcmp(argv[1], "--benchmark") == 0)
+	{
+		run_benchmark();
+		return EXIT_SUCCESS;
+	}
+
 	if (argc != 4)
 		return EXIT_FAILURE;
 
@@ -1,11 +1,14 @@
 #include "simd.hpp"
+#include "simd_batch.hpp"
 #include "muglm/muglm_impl.hpp"
 #include "muglm/matrix_helper.hpp"
 #include "logging.hpp"
 #include "transforms.hpp"
 #include "frustum.hpp"
+#include "interpolation.hpp"
 #include <assert.h>
 #include <string.h>
+#include <vector>
 
 using namespace Granite;
 
@@ -71,6 +74,231 @@ static void test_frustum_cull()
 	}
 }
 
+static void test_frustum_cull_batch()
+{
+	mat4 m = projection(0.4f, 1.0f, 0.1f, 5.0f);
+	Frustum frustum;
+	frustum.build_planes(inverse(m));
+
+	std::vector<AABB> boxes;
+	for (int z = -10; z <= 10; z++)
+		for (int y = -10; y <= 10; y++)
+			for (int x = -10; x <= 10; x++)
+				boxes.emplace_back(vec3(x, y, z) * 0.25f - 0.1f, vec3(x, y, z) * 0.25f + 0.1f);
+
+	size_t count = boxes.size();
+	std::vector<float> arrays[6];
+	for (auto &a : arrays)
+		a.resize(count + SIMD::FrustumCullBatchSize);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		for (unsigned c = 0; c < 3; c++)
+		{
+			arrays[c][i] = boxes[i].get_minimum()[c];
+			arrays[c + 3][i] = boxes[i].get_maximum()[c];
+		}
+	}
+
+	SIMD::AABBArrays soa = {
+		arrays[0].data(), arrays[1].data(), arrays[2].data(),
+		arrays[3].data(), arrays[4].data(), arrays[5].data(),
+	};
+
+	for (size_t i = 0; i < count; i += SIMD::FrustumCullBatchSize)
+	{
+		uint32_t mask = SIMD::frustum_cull_batch(soa, i, frustum.get_planes());
+		for (size_t j = i; j < count && j < i + SIMD::FrustumCullBatchSize; j++)
+		{
+			bool batch_test = (mask & (1u << (j - i))) != 0;
+			if (batch_test != SIMD::frustum_cull(boxes[j], frustum.get_planes()))
+			{
+				LOGE("Frustum cull batch mismatch.\n");
+				exit(1);
+			}
+		}
+	}
+}
+
+static void test_frustum_cull_compaction()
+{
+	mat4 m = projection(0.4f, 1.0f, 0.1f, 5.0f);
+	Frustum frustum;
+	frustum.build_planes(inverse(m));
+
+	std::vector<AABB> local_boxes;
+	std::vector<mat4> transforms;
+	for (int z = -10; z <= 10; z++)
+	{
+		for (int y = -10; y <= 10; y++)
+		{
+			for (int x = -10; x <= 10; x++)
+			{
+				local_boxes.emplace_back(vec3(-0.1f), vec3(0.1f));
+				transforms.push_back(translate(vec3(x, y, z) * 0.25f));
+			}
+		}
+	}
+
+	size_t count = local_boxes.size();
+	std::vector<AABB> world_boxes(count);
+	AABB::transform_batch(world_boxes.data(), local_boxes.data(), transforms.data(), count);
+
+	AABBBatch batch;
+	batch.assign_transformed(local_boxes.data(), transforms.data(), count);
+
+	std::vector<uint32_t> ref_indices;
+	for (size_t i = 0; i < count; i++)
+		if (SIMD::frustum_cull(world_boxes[i], frustum.get_planes()))
+			ref_indices.push_back(uint32_t(i));
+
+	std::vector<uint32_t> soa_indices(count);
+	std::vector<uint32_t> aos_indices(count);
+	soa_indices.resize(frustum.cull(batch, soa_indices.data()));
+	aos_indices.resize(frustum.cull(world_boxes.data(), count, aos_indices.data()));
+
+	if (soa_indices != ref_indices || aos_indices != ref_indices)
+	{
+		LOGE("Frustum cull compaction mismatch.\n");
+		exit(1);
+	}
+}
+
+static void test_batch_kernels(SIMD::BatchISA isa)
+{
+	SIMD::set_batch_isa(isa);
+	if (SIMD::get_batch_isa() != isa)
+		return;
+	LOGI("Testing %s batch kernels.\n", SIMD::get_batch_isa_name(isa));
+
+	mat4 m = projection(0.4f, 1.0f, 0.1f, 5.0f);
+	Frustum frustum;
+	frustum.build_planes(inverse(m));
+
+	// Odd counts exercise the tails of the wide paths.
+	std::vector<AABB> boxes;
+	std::vector<mat4> transforms;
+	std::vector<vec4> points;
+	for (int z = -10; z <= 10; z++)
+	{
+		for (int y = -10; y <= 10; y++)
+		{
+			for (int x = -10; x <= 10; x++)
+			{
+				boxes.emplace_back(vec3(x, y, z) * 0.25f - 0.1f, vec3(x, y, z) * 0.25f + 0.1f);
+				mat4 t;
+				compute_model_transform(t, vec3(1.0f, 0.5f, 2.0f), angleAxis(0.1f * float(x), normalize(vec3(0.1f, float(y), 0.3f))),
+				                        vec3(float(z), 1.0f, -0.5f), mat4(1.0f));
+				transforms.push_back(t);
+				points.emplace_back(float(x), float(y), float(z), 1.0f);
+			}
+		}
+	}
+
+	size_t count = boxes.size();
+	std::vector<uint8_t> visible(count);
+	size_t num_visible = SIMD::frustum_cull_aabbs(visible.data(), boxes.data(), count, frustum.get_planes());
+	size_t ref_visible = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		bool ref = SIMD::frustum_cull(boxes[i], frustum.get_planes());
+		ref_visible += ref;
+		if (bool(visible[i]) != ref)
+		{
+			LOGE("Batch frustum cull mismatch.\n");
+			exit(1);
+		}
+	}
+
+	if (num_visible != ref_visible)
+	{
+		LOGE("Batch frustum cull count mismatch.\n");
+		exit(1);
+	}
+
+	std::vector<AABB> transformed(count);
+	SIMD::transform_aabbs(transformed.data(), boxes.data(), transforms.data(), count);
+	for (size_t i = 0; i < count; i++)
+	{
+		AABB ref = boxes[i].transform(transforms[i]);
+		if (distance(ref.get_minimum(), transformed[i].get_minimum()) > 0.0001f ||
+		    distance(ref.get_maximum(), transformed[i].get_maximum()) > 0.0001f)
+		{
+			LOGE("Batch AABB transform mismatch.\n");
+			exit(1);
+		}
+	}
+
+	std::vector<mat4> products(count);
+	SIMD::mul_matrices(products.data(), transforms.data(), transforms.data() + 1, count - 1);
+	for (size_t i = 0; i + 1 < count; i++)
+	{
+		mat4 ref = transforms[i] * transforms[i + 1];
+		for (unsigned col = 0; col < 4; col++)
+		{
+			if (distance(ref[col], products[i][col]) > 0.001f)
+			{
+				LOGE("Batch matrix multiply mismatch.\n");
+				exit(1);
+			}
+		}
+	}
+
+	std::vector<vec4> transformed_points(count);
+	SIMD::transform_points(transformed_points.data(), transforms[5], points.data(), count);
+	for (size_t i = 0; i < count; i++)
+	{
+		if (distance(transforms[5] * points[i], transformed_points[i]) > 0.001f)
+		{
+			LOGE("Batch point transform mismatch.\n");
+			exit(1);
+		}
+	}
+}
+
+static void test_batch_interpolation()
+{
+	std::vector<quat> a, b, result;
+	std::vector<vec3> scales, translations;
+	for (int i = 0; i < 23; i++)
+	{
+		// Mix of close pairs for nlerp, far pairs for the slerp fallback, and flipped hemispheres.
+		a.push_back(angleAxis(0.3f * float(i), normalize(vec3(1.0f, float(i), 0.5f))));
+		quat q = angleAxis(0.3f * float(i) + 0.05f * float(i % 5) * float(i % 5), normalize(vec3(1.0f, float(i), 0.5f)));
+		b.push_back((i & 1) ? quat(-q.as_vec4()) : q);
+		scales.emplace_back(1.0f + 0.1f * float(i), 2.0f, 0.5f);
+		translations.emplace_back(float(i), -1.0f, 3.0f);
+	}
+
+	result.resize(a.size());
+	nlerp_batch(result.data(), a.data(), b.data(), 0.3f, a.size());
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		quat ref = slerp(a[i], b[i], 0.3f);
+		if (muglm::abs(muglm::abs(dot(ref.as_vec4(), result[i].as_vec4())) - 1.0f) > 0.001f)
+		{
+			LOGE("Batch nlerp mismatch.\n");
+			exit(1);
+		}
+	}
+
+	std::vector<mat4> models(a.size());
+	compute_model_transforms(models.data(), a.data(), scales.data(), translations.data(), a.size());
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		mat4 ref;
+		compute_model_transform(ref, scales[i], a[i], translations[i], mat4(1.0f));
+		for (unsigned col = 0; col < 4; col++)
+		{
+			if (distance(ref[col], models[i][col]) > 0.0001f)
+			{
+				LOGE("Batch model transform mismatch.\n");
+				exit(1);
+			}
+		}
+	}
+}
+
 static void test_quat()
 {
 	quat q(-0.91354f, 0.123415f, 0.4325f, -0.8434f);
@@ -102,7 +330,13 @@ int main()
 {
 	test_matrix_multiply();
 	test_frustum_cull();
+	test_frustum_cull_batch();
 	test_aabb_transform();
+	test_frustum_cull_compaction();
+	test_batch_interpolation();
+	test_batch_kernels(SIMD::BatchISA::Generic);
+	test_batch_kernels(SIMD::BatchISA::AVX2);
+	test_batch_kernels(SIMD::BatchISA::AVX512);
 	test_quat();
 	LOGI(":D\n");
 }
\ No newline at end of file
@@ -29,6 +29,7 @@
 #include "muglm/muglm_impl.hpp"
 #include "thread_group.hpp"
 #include <random>
+#include <string.h>
 
 #ifdef HAVE_ASTC_DECODER
 #include "astcenc.h"
@@ -1263,8 +1264,100 @@ static bool test_bc6(Device &device)
 	return true;
 }
 
-int main()
+struct BenchmarkFormat
 {
+	VkFormat format;
+	const char *name;
+};
+
+static const BenchmarkFormat benchmark_formats[] = {
+	{ VK_FORMAT_BC1_RGBA_UNORM_BLOCK, "BC1" },
+	{ VK_FORMAT_BC3_UNORM_BLOCK, "BC3" },
+	{ VK_FORMAT_BC4_UNORM_BLOCK, "BC4" },
+	{ VK_FORMAT_BC5_UNORM_BLOCK, "BC5" },
+	{ VK_FORMAT_BC6H_UFLOAT_BLOCK, "BC6H" },
+	{ VK_FORMAT_BC7_UNORM_BLOCK, "BC7" },
+	{ VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, "ETC2 RGB8" },
+	{ VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK, "ETC2 RGB8A1" },
+	{ VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, "ETC2 RGBA8" },
+	{ VK_FORMAT_EAC_R11_UNORM_BLOCK, "EAC R11" },
+	{ VK_FORMAT_EAC_R11G11_UNORM_BLOCK, "EAC RG11" },
+	{ VK_FORMAT_ASTC_4x4_UNORM_BLOCK, "ASTC 4x4" },
+	{ VK_FORMAT_ASTC_5x5_UNORM_BLOCK, "ASTC 5x5" },
+	{ VK_FORMAT_ASTC_6x6_UNORM_BLOCK, "ASTC 6x6" },
+	{ VK_FORMAT_ASTC_8x8_UNORM_BLOCK, "ASTC 8x8" },
+	{ VK_FORMAT_ASTC_10x10_UNORM_BLOCK, "ASTC 10x10" },
+	{ VK_FORMAT_ASTC_12x12_UNORM_BLOCK, "ASTC 12x12" },
+	{ VK_FORMAT_ASTC_4x4_SFLOAT_BLOCK_EXT, "ASTC 4x4 HDR" },
+	{ VK_FORMAT_ASTC_8x8_SFLOAT_BLOCK_EXT, "ASTC 8x8 HDR" },
+};
+
+// Decodes a batch of full mip chains per format and reports GPU throughput.
+// Payloads are random, so ASTC will hit a fair share of error blocks which decode faster than real content.
+static bool run_benchmark(Device &device)
+{
+	constexpr unsigned Width = 2048;
+	constexpr unsigned Height = 2048;
+	constexpr unsigned NumImages = 8;
+	constexpr unsigned NumIterations = 4;
+	std::mt19937 rnd(1337);
+
+	for (auto &bench : benchmark_formats)
+	{
+		Vulkan::MemoryMappedTexture tex;
+		tex.set_2d(bench.format, Width, Height, 1, 0);
+		if (!tex.map_write_scratch())
+			return false;
+
+		auto &layout = tex.get_layout();
+		auto *d = static_cast<uint32_t *>(layout.data());
+		for (size_t i = 0; i < layout.get_required_size() / sizeof(uint32_t); i++)
+			d[i] = uint32_t(rnd());
+
+		uint64_t texels_per_image = 0;
+		for (unsigned level = 0; level < layout.get_levels(); level++)
+			texels_per_image += uint64_t(layout.get_width(level)) * layout.get_height(level);
+
+		DecodeCompressedImageInfo infos[NumImages];
+		ImageHandle images[NumImages];
+		for (auto &info : infos)
+			info.layout = &layout;
+
+		double total_time = 0.0;
+		for (unsigned iteration = 0; iteration < NumIterations; iteration++)
+		{
+			auto cmd = device.request_command_buffer();
+			auto start_ts = cmd->write_timestamp(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+			bool decoded = decode_compressed_images(*cmd, infos, NumImages, images);
+			auto end_ts = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			if (!decoded)
+			{
+				device.submit_discard(cmd);
+				LOGE("Failed to decode %s.\n", bench.name);
+				return false;
+			}
+
+			device.submit(cmd);
+			device.wait_idle();
+
+			// The first iteration pays for pipeline compilation.
+			if (iteration != 0)
+				total_time += device.convert_device_timestamp_delta(start_ts->get_timestamp_ticks(),
+				                                                    end_ts->get_timestamp_ticks());
+		}
+
+		double texels = double(texels_per_image) * NumImages * (NumIterations - 1);
+		LOGI("%-14s %8.3f GTexels/s (%.3f ms per %ux%u mip chain).\n", bench.name,
+		     texels / total_time * 1e-9,
+		     1000.0 * total_time / double(NumImages * (NumIterations - 1)), Width, Height);
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	bool benchmark = argc >= 2 && strcmp(argv[1], "--benchmark") == 0;
 	Global::init(Global::MANAGER_FEATURE_DEFAULT_BITS, 1);
 
 	if (!Context::init_loader(nullptr))
@@ -1284,6 +1377,9 @@ int main()
 	Device device;
 	device.set_context(ctx);
 
+	if (benchmark)
+		return run_benchmark(device) ? EXIT_SUCCESS : EXIT_FAILURE;
+
 	if (!test_s3tc(device))
 		return EXIT_FAILURE;
 	if (!test_rgtc(device))
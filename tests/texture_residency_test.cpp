@@ -0,0 +1,140 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "device.hpp"
+#include "context.hpp"
+#include "global_managers_init.hpp"
+#include "memory_mapped_texture.hpp"
+#include "filesystem.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <string.h>
+
+using namespace Granite;
+using namespace Vulkan;
+
+static constexpr uint32_t Size = 512;
+static constexpr uint32_t Levels = 10;
+
+static bool write_texture(const std::string &path)
+{
+	MemoryMappedTexture tex;
+	tex.set_2d(VK_FORMAT_R8G8B8A8_UNORM, Size, Size, 1, Levels);
+	if (!tex.map_write_scratch())
+		return false;
+
+	auto &layout = tex.get_layout();
+	for (uint32_t level = 0; level < Levels; level++)
+	{
+		auto &mip = layout.get_mip_info(level);
+		memset(layout.data(0, level), int(level), mip.block_image_height * mip.block_row_length * 4);
+	}
+
+	return tex.copy_to_path(*GRANITE_FILESYSTEM(), path);
+}
+
+static bool test_drop_and_restore(Device &device)
+{
+	const std::string path = "memory://residency-test.gtx";
+	if (!write_texture(path))
+	{
+		LOGE("Failed to write texture.\n");
+		return false;
+	}
+
+	auto &manager = device.get_texture_manager();
+	TextureResidencyOptions opts;
+	opts.budget_threshold = 0.0f;
+	opts.unused_frames = 0;
+	opts.max_dropped_levels = 1;
+	opts.min_extent = 1;
+	opts.stream_skip_levels = 0;
+	manager.set_residency_options(opts);
+	manager.set_residency_enabled(true);
+
+	auto *texture = manager.request_texture(path);
+	if (!texture || texture->get_image()->get_width() != Size)
+	{
+		LOGE("Failed to load texture.\n");
+		return false;
+	}
+
+	// Not used in the frame after, so the top level is dropped.
+	device.next_frame_context();
+	manager.update_residency();
+	device.next_frame_context();
+	manager.update_residency();
+
+	auto *image = texture->get_image();
+	if (image->get_width() != Size / 2 || image->get_create_info().levels != Levels - 1)
+	{
+		LOGE("Expected top level to be dropped, got %u x %u with %u levels.\n",
+		     image->get_width(), image->get_height(), image->get_create_info().levels);
+		return false;
+	}
+
+	// Used again, so it is reloaded at full resolution.
+	device.next_frame_context();
+	manager.update_residency();
+	GRANITE_THREAD_GROUP()->wait_idle();
+	device.next_frame_context();
+
+	image = texture->get_image();
+	if (image->get_width() != Size || image->get_create_info().levels != Levels)
+	{
+		LOGE("Expected texture to be restored, got %u x %u with %u levels.\n",
+		     image->get_width(), image->get_height(), image->get_create_info().levels);
+		return false;
+	}
+
+	manager.set_residency_enabled(false);
+	device.wait_idle();
+	return true;
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_DEFAULT_BITS, 1);
+
+	if (!Context::init_loader(nullptr))
+		return EXIT_FAILURE;
+
+	Context ctx;
+
+	Context::SystemHandles handles;
+	handles.filesystem = GRANITE_FILESYSTEM();
+	handles.thread_group = GRANITE_THREAD_GROUP();
+	ctx.set_system_handles(handles);
+
+	ctx.set_num_thread_indices(2);
+	if (!ctx.init_instance_and_device(nullptr, 0, nullptr, 0))
+		return EXIT_FAILURE;
+
+	Device device;
+	device.set_context(ctx);
+
+	if (!test_drop_and_restore(device))
+		return EXIT_FAILURE;
+
+	LOGI("Texture residency test passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -22,9 +22,44 @@
 
 #include "thread_group.hpp"
 #include "logging.hpp"
+#include "timer.hpp"
 
 using namespace Granite;
 
+static void run_allocation_benchmark(bool thread_local_allocation)
+{
+	ThreadGroup group;
+	group.set_thread_local_allocation(thread_local_allocation);
+	group.start(4, {});
+
+	constexpr unsigned NumIterations = 1000;
+	constexpr unsigned NumFanOut = 64;
+	constexpr unsigned NumTasks = 256;
+
+	auto start = Util::get_current_time_nsecs();
+
+	// Fan out from within workers, which is where thread local allocation kicks in.
+	auto root = group.create_task();
+	for (unsigned i = 0; i < NumFanOut; i++)
+	{
+		root->enqueue_task([&group]() {
+			for (unsigned iter = 0; iter < NumIterations; iter++)
+			{
+				auto task = group.create_task();
+				for (unsigned j = 0; j < NumTasks / NumFanOut; j++)
+					task->enqueue_task([]() {});
+			}
+		});
+	}
+	group.submit(root);
+	group.wait_idle();
+
+	auto end = Util::get_current_time_nsecs();
+	double tasks_per_second = double(NumIterations * NumTasks) / (1e-9 * double(end - start));
+	LOGI("Thread local allocation %s: %.3f M tasks / s.\n",
+	     thread_local_allocation ? "on" : "off", tasks_per_second * 1e-6);
+}
+
 int main()
 {
 	ThreadGroup group;
@@ -53,4 +88,20 @@ int main()
 	group.submit(task3);
 
 	group.wait_idle();
+
+	// A suspendable task waiting on other work does not occupy a worker while waiting.
+	auto outer = group.create_suspendable_task([&group]() {
+		auto inner = group.create_task([]() {
+			LOGI("Inner task.\n");
+		});
+		inner->wait();
+		LOGI("Resumed after inner task.\n");
+	});
+	group.submit(outer);
+
+	group.wait_idle();
+	group.stop();
+
+	run_allocation_benchmark(false);
+	run_allocation_benchmark(true);
 }
@@ -0,0 +1,614 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "intrusive_hash_map.hpp"
+#include "small_vector.hpp"
+#include "object_pool.hpp"
+#include "lru_cache.hpp"
+#include "temporary_hashmap.hpp"
+#include "stack_allocator.hpp"
+#include "hash.hpp"
+#include "timer.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <list>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+using namespace Util;
+
+// Prints one CSV row per measurement:
+// container,operation,size,threads,ns_per_op,p99_ns_per_op,mops_per_sec
+// Operations are timed in batches, p99 is over the per-op time of each batch.
+
+static constexpr size_t BatchSize = 64;
+static constexpr size_t MinOpsPerMeasurement = 1 << 18;
+static constexpr unsigned Repetitions = 5;
+
+struct Samples
+{
+	std::vector<double> batch_ns_per_op;
+	double total_ns = 0.0;
+	size_t ops = 0;
+
+	void add(double ns, size_t n)
+	{
+		batch_ns_per_op.push_back(ns / double(n));
+		total_ns += ns;
+		ops += n;
+	}
+};
+
+template <typename Func>
+static void time_batches(Samples &samples, size_t count, const Func &func)
+{
+	for (size_t i = 0; i < count; i += BatchSize)
+	{
+		size_t n = std::min(BatchSize, count - i);
+		auto start = get_current_time_nsecs();
+		for (size_t j = 0; j < n; j++)
+			func(i + j);
+		samples.add(double(get_current_time_nsecs() - start), n);
+	}
+}
+
+static void report(const char *container, const char *operation, size_t size, unsigned threads,
+                   std::vector<Samples> &repetitions, double wall_ns = 0.0)
+{
+	// The median repetition is stable against the occasional preempted run.
+	std::sort(repetitions.begin(), repetitions.end(), [](const Samples &a, const Samples &b) {
+		return a.total_ns / double(a.ops) < b.total_ns / double(b.ops);
+	});
+	auto &median = repetitions[repetitions.size() / 2];
+	auto &batches = median.batch_ns_per_op;
+	std::sort(batches.begin(), batches.end());
+
+	double ns_per_op = median.total_ns / double(median.ops);
+	double p99 = batches.empty() ? 0.0 : batches[std::min(batches.size() - 1, size_t(0.99 * double(batches.size())))];
+
+	// With multiple threads, throughput is over wall time rather than the sum of thread time.
+	double mops = wall_ns > 0.0 ? 1e3 * double(median.ops) / wall_ns : 1e3 / ns_per_op;
+
+	printf("%s,%s,%zu,%u,%.3f,%.3f,%.3f\n", container, operation, size, threads, ns_per_op, p99, mops);
+	fflush(stdout);
+}
+
+static std::vector<Hash> make_keys(size_t count, uint64_t seed)
+{
+	std::mt19937_64 rnd(seed);
+	std::vector<Hash> keys(count);
+	for (auto &key : keys)
+		key = rnd();
+	return keys;
+}
+
+static size_t iterations_for_size(size_t size)
+{
+	return std::max<size_t>(1, MinOpsPerMeasurement / size);
+}
+
+// Defeats dead code elimination of lookups.
+static volatile uint64_t sink;
+
+static void bench_intrusive_hash_map(size_t size)
+{
+	auto keys = make_keys(size, 1);
+	auto misses = make_keys(size, 2);
+	size_t iterations = iterations_for_size(size);
+	std::vector<Samples> insert(Repetitions), find(Repetitions), find_miss(Repetitions), erase(Repetitions);
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			IntrusiveHashMapWrapper<uint64_t> map;
+			time_batches(insert[rep], size, [&](size_t i) { map.emplace_yield(keys[i], i); });
+			uint64_t sum = 0;
+			time_batches(find[rep], size, [&](size_t i) { sum += map.find(keys[i])->get(); });
+			time_batches(find_miss[rep], size, [&](size_t i) { sum += map.find(misses[i]) != nullptr; });
+			time_batches(erase[rep], size, [&](size_t i) { map.erase(keys[i]); });
+			sink = sum;
+		}
+	}
+
+	report("IntrusiveHashMap", "insert", size, 1, insert);
+	report("IntrusiveHashMap", "find", size, 1, find);
+	report("IntrusiveHashMap", "find_miss", size, 1, find_miss);
+	report("IntrusiveHashMap", "erase", size, 1, erase);
+}
+
+static void bench_std_unordered_map(size_t size)
+{
+	auto keys = make_keys(size, 1);
+	auto misses = make_keys(size, 2);
+	size_t iterations = iterations_for_size(size);
+	std::vector<Samples> insert(Repetitions), find(Repetitions), find_miss(Repetitions), erase(Repetitions);
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			std::unordered_map<Hash, uint64_t> map;
+			time_batches(insert[rep], size, [&](size_t i) { map.emplace(keys[i], i); });
+			uint64_t sum = 0;
+			time_batches(find[rep], size, [&](size_t i) { sum += map.find(keys[i])->second; });
+			time_batches(find_miss[rep], size, [&](size_t i) { sum += map.find(misses[i]) != map.end(); });
+			time_batches(erase[rep], size, [&](size_t i) { map.erase(keys[i]); });
+			sink = sum;
+		}
+	}
+
+	report("std::unordered_map", "insert", size, 1, insert);
+	report("std::unordered_map", "find", size, 1, find);
+	report("std::unordered_map", "find_miss", size, 1, find_miss);
+	report("std::unordered_map", "erase", size, 1, erase);
+}
+
+// Runs func(thread_index, samples) on every thread at once.
+// Returns the wall time from the first thread starting work to the last one finishing, excluding thread creation.
+template <typename Func>
+static double run_threads(unsigned threads, std::vector<Samples> &thread_samples, const Func &func)
+{
+	thread_samples.clear();
+	thread_samples.resize(threads);
+	std::vector<std::thread> workers;
+	std::vector<int64_t> start_times(threads), end_times(threads);
+	std::atomic<unsigned> ready{0};
+
+	for (unsigned t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]() {
+			ready.fetch_add(1, std::memory_order_relaxed);
+			while (ready.load(std::memory_order_relaxed) < threads)
+				std::this_thread::yield();
+			start_times[t] = get_current_time_nsecs();
+			func(t, thread_samples[t]);
+			end_times[t] = get_current_time_nsecs();
+		});
+	}
+	for (auto &worker : workers)
+		worker.join();
+
+	return double(*std::max_element(end_times.begin(), end_times.end()) -
+	              *std::min_element(start_times.begin(), start_times.end()));
+}
+
+static Samples merge(const std::vector<Samples> &thread_samples)
+{
+	Samples merged;
+	for (auto &s : thread_samples)
+	{
+		merged.batch_ns_per_op.insert(merged.batch_ns_per_op.end(), s.batch_ns_per_op.begin(), s.batch_ns_per_op.end());
+		merged.total_ns += s.total_ns;
+		merged.ops += s.ops;
+	}
+	return merged;
+}
+
+// Each thread looks up its own slice of keys, then inserts and erases keys nobody else touches.
+template <typename Map, typename Find, typename Insert, typename Erase>
+static void bench_concurrent_map(const char *name, unsigned threads, size_t size,
+                                 const Find &find_op, const Insert &insert_op, const Erase &erase_op)
+{
+	auto keys = make_keys(size, 1);
+	auto extra = make_keys(size, 3);
+	std::vector<Samples> find(Repetitions), insert(Repetitions), erase(Repetitions);
+	double find_wall = 0.0, insert_wall = 0.0, erase_wall = 0.0;
+	size_t ops = size * iterations_for_size(size) / threads;
+	std::vector<Samples> thread_samples;
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		Map map;
+		for (size_t i = 0; i < size; i++)
+			insert_op(map, keys[i], i);
+
+		find_wall += run_threads(threads, thread_samples, [&](unsigned t, Samples &samples) {
+			uint64_t sum = 0;
+			time_batches(samples, ops, [&](size_t i) { sum += find_op(map, keys[(i * threads + t) % size]); });
+			sink = sum;
+		});
+		find[rep] = merge(thread_samples);
+
+		size_t slice = size / threads;
+		insert_wall += run_threads(threads, thread_samples, [&](unsigned t, Samples &samples) {
+			time_batches(samples, slice, [&](size_t i) { insert_op(map, extra[t * slice + i], i); });
+		});
+		insert[rep] = merge(thread_samples);
+
+		erase_wall += run_threads(threads, thread_samples, [&](unsigned t, Samples &samples) {
+			time_batches(samples, slice, [&](size_t i) { erase_op(map, extra[t * slice + i]); });
+		});
+		erase[rep] = merge(thread_samples);
+	}
+
+	report(name, "find", size, threads, find, find_wall / Repetitions);
+	report(name, "insert", size, threads, insert, insert_wall / Repetitions);
+	report(name, "erase", size, threads, erase, erase_wall / Repetitions);
+}
+
+struct LockedUnorderedMap
+{
+	std::mutex lock;
+	std::unordered_map<Hash, uint64_t> map;
+};
+
+static void bench_thread_safe_hash_map(unsigned threads, size_t size)
+{
+	bench_concurrent_map<ThreadSafeIntrusiveHashMap<IntrusivePODWrapper<uint64_t>>>(
+			"ThreadSafeIntrusiveHashMap", threads, size,
+			[](ThreadSafeIntrusiveHashMap<IntrusivePODWrapper<uint64_t>> &map, Hash key) {
+				return map.find(key)->get();
+			},
+			[](ThreadSafeIntrusiveHashMap<IntrusivePODWrapper<uint64_t>> &map, Hash key, uint64_t value) {
+				map.emplace_yield(key, value);
+			},
+			[](ThreadSafeIntrusiveHashMap<IntrusivePODWrapper<uint64_t>> &map, Hash key) {
+				map.erase(key);
+			});
+
+	bench_concurrent_map<LockedUnorderedMap>(
+			"std::unordered_map+std::mutex", threads, size,
+			[](LockedUnorderedMap &map, Hash key) {
+				std::lock_guard<std::mutex> holder{map.lock};
+				return map.map.find(key)->second;
+			},
+			[](LockedUnorderedMap &map, Hash key, uint64_t value) {
+				std::lock_guard<std::mutex> holder{map.lock};
+				map.map.emplace(key, value);
+			},
+			[](LockedUnorderedMap &map, Hash key) {
+				std::lock_guard<std::mutex> holder{map.lock};
+				map.map.erase(key);
+			});
+}
+
+// Fills a fresh vector with size elements over and over, which is how SmallVector is used on the stack.
+template <typename Vector>
+static void bench_vector(const char *name, size_t size)
+{
+	size_t iterations = iterations_for_size(size);
+	std::vector<Samples> push_back(Repetitions);
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		auto start = get_current_time_nsecs();
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			Vector vec;
+			for (size_t i = 0; i < size; i++)
+				vec.push_back(uint32_t(i));
+			sink = vec[size - 1];
+		}
+		push_back[rep].add(double(get_current_time_nsecs() - start), iterations * size);
+	}
+
+	report(name, "push_back", size, 1, push_back);
+}
+
+struct PoolObject
+{
+	explicit PoolObject(uint64_t value_)
+		: value(value_)
+	{
+	}
+	uint64_t value;
+	uint64_t padding[7];
+};
+
+template <typename Allocate, typename Free>
+static void bench_allocator(const char *name, unsigned threads, size_t size,
+                            const Allocate &allocate, const Free &free_op)
+{
+	size_t iterations = iterations_for_size(size * threads);
+	std::vector<Samples> alloc(Repetitions), release(Repetitions);
+	double alloc_wall = 0.0, release_wall = 0.0;
+	std::vector<Samples> alloc_samples, release_samples;
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		std::vector<std::vector<PoolObject *>> objects(threads);
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			alloc_wall += run_threads(threads, alloc_samples, [&](unsigned t, Samples &samples) {
+				objects[t].resize(size);
+				time_batches(samples, size, [&](size_t i) { objects[t][i] = allocate(i); });
+			});
+			release_wall += run_threads(threads, release_samples, [&](unsigned t, Samples &samples) {
+				time_batches(samples, size, [&](size_t i) { free_op(objects[t][i]); });
+			});
+
+			auto merged_alloc = merge(alloc_samples);
+			auto merged_release = merge(release_samples);
+			alloc[rep].batch_ns_per_op.insert(alloc[rep].batch_ns_per_op.end(),
+			                                  merged_alloc.batch_ns_per_op.begin(), merged_alloc.batch_ns_per_op.end());
+			alloc[rep].total_ns += merged_alloc.total_ns;
+			alloc[rep].ops += merged_alloc.ops;
+			release[rep].batch_ns_per_op.insert(release[rep].batch_ns_per_op.end(),
+			                                    merged_release.batch_ns_per_op.begin(), merged_release.batch_ns_per_op.end());
+			release[rep].total_ns += merged_release.total_ns;
+			release[rep].ops += merged_release.ops;
+		}
+	}
+
+	report(name, "allocate", size, threads, alloc, alloc_wall / Repetitions);
+	report(name, "free", size, threads, release, release_wall / Repetitions);
+}
+
+static void bench_object_pools(size_t size)
+{
+	ObjectPool<PoolObject> pool;
+	bench_allocator("ObjectPool", 1, size,
+	                [&](size_t i) { return pool.allocate(i); },
+	                [&](PoolObject *obj) { pool.free(obj); });
+}
+
+static void bench_thread_safe_object_pools(unsigned threads, size_t size)
+{
+	ThreadSafeObjectPool<PoolObject> pool;
+	bench_allocator("ThreadSafeObjectPool", threads, size,
+	                [&](size_t i) { return pool.allocate(i); },
+	                [&](PoolObject *obj) { pool.free(obj); });
+	bench_allocator("new/delete", threads, size,
+	                [](size_t i) { return new PoolObject(i); },
+	                [](PoolObject *obj) { delete obj; });
+}
+
+// What LRUCache replaces, a list in recency order with a map into it.
+struct StdLRUCache
+{
+	struct Entry
+	{
+		uint64_t cookie;
+		uint64_t value;
+	};
+	std::list<Entry> lru;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> map;
+
+	uint64_t *allocate(uint64_t cookie)
+	{
+		auto itr = map.find(cookie);
+		if (itr != map.end())
+		{
+			lru.splice(lru.begin(), lru, itr->second);
+			return &itr->second->value;
+		}
+		lru.push_front({ cookie, 0 });
+		map[cookie] = lru.begin();
+		return &lru.front().value;
+	}
+
+	uint64_t *find_and_mark_as_recent(uint64_t cookie)
+	{
+		auto itr = map.find(cookie);
+		if (itr == map.end())
+			return nullptr;
+		lru.splice(lru.begin(), lru, itr->second);
+		return &itr->second->value;
+	}
+
+	void erase(uint64_t cookie)
+	{
+		auto itr = map.find(cookie);
+		if (itr != map.end())
+		{
+			lru.erase(itr->second);
+			map.erase(itr);
+		}
+	}
+};
+
+static void bench_lru_cache(size_t size)
+{
+	size_t iterations = iterations_for_size(size);
+	std::vector<Samples> allocate(Repetitions), find(Repetitions), erase(Repetitions);
+	std::vector<Samples> std_allocate(Repetitions), std_find(Repetitions), std_erase(Repetitions);
+
+	// Lookups in shuffled order, so that every hit reorders the list.
+	std::vector<uint64_t> order(size);
+	for (size_t i = 0; i < size; i++)
+		order[i] = i + 1;
+	std::shuffle(order.begin(), order.end(), std::mt19937(4));
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			LRUCache<uint64_t> cache;
+			cache.set_total_cost(size);
+			uint64_t sum = 0;
+			time_batches(allocate[rep], size, [&](size_t i) { *cache.allocate(i + 1, 1) = i; });
+			time_batches(find[rep], size, [&](size_t i) { sum += *cache.find_and_mark_as_recent(order[i]); });
+			time_batches(erase[rep], size, [&](size_t i) { cache.erase(order[i]); });
+
+			StdLRUCache std_cache;
+			time_batches(std_allocate[rep], size, [&](size_t i) { *std_cache.allocate(i + 1) = i; });
+			time_batches(std_find[rep], size, [&](size_t i) { sum += *std_cache.find_and_mark_as_recent(order[i]); });
+			time_batches(std_erase[rep], size, [&](size_t i) { std_cache.erase(order[i]); });
+			sink = sum;
+		}
+	}
+
+	report("LRUCache", "allocate", size, 1, allocate);
+	report("LRUCache", "find", size, 1, find);
+	report("LRUCache", "erase", size, 1, erase);
+	report("std::list+std::unordered_map", "allocate", size, 1, std_allocate);
+	report("std::list+std::unordered_map", "find", size, 1, std_find);
+	report("std::list+std::unordered_map", "erase", size, 1, std_erase);
+}
+
+struct TemporaryNode : TemporaryHashmapEnabled<TemporaryNode>, IntrusiveListEnabled<TemporaryNode>
+{
+	explicit TemporaryNode(uint64_t value_)
+		: value(value_)
+	{
+	}
+	uint64_t value;
+};
+
+// Half of the entries are requested every frame and survive, the other half age out of the ring.
+static void bench_temporary_hashmap(size_t size)
+{
+	constexpr unsigned Frames = 8;
+	auto keys = make_keys(size, 5);
+	size_t iterations = std::max<size_t>(1, iterations_for_size(size) / Frames);
+	std::vector<Samples> emplace(Repetitions), request(Repetitions), begin_frame(Repetitions);
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			TemporaryHashmap<TemporaryNode, 4, true> map;
+			uint64_t sum = 0;
+			for (unsigned frame = 0; frame < Frames; frame++)
+			{
+				time_batches(emplace[rep], size / 2, [&](size_t i) {
+					size_t index = (i * 2 + (frame & 1)) % size;
+					if (!map.request(keys[index]))
+					{
+						auto *node = map.request_vacant(keys[index]);
+						if (!node)
+							node = map.emplace(keys[index], index);
+						node->value = index;
+					}
+				});
+				time_batches(request[rep], size / 2, [&](size_t i) {
+					auto *node = map.request(keys[(i * 2 + (frame & 1)) % size]);
+					sum += node ? node->value : 0;
+				});
+
+				auto start = get_current_time_nsecs();
+				map.begin_frame();
+				begin_frame[rep].add(double(get_current_time_nsecs() - start), 1);
+			}
+			sink = sum;
+		}
+	}
+
+	report("TemporaryHashmap", "request_or_emplace", size, 1, emplace);
+	report("TemporaryHashmap", "request", size, 1, request);
+	report("TemporaryHashmap", "begin_frame", size, 1, begin_frame);
+}
+
+static void bench_stack_allocator(size_t count)
+{
+	constexpr size_t Capacity = 64 * 1024;
+	static StackAllocator<uint32_t, Capacity> stack;
+	size_t allocations = Capacity / count;
+	size_t iterations = iterations_for_size(allocations);
+	std::vector<Samples> stack_alloc(Repetitions), malloc_alloc(Repetitions);
+	std::vector<uint32_t *> pointers(allocations);
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		for (size_t iter = 0; iter < iterations; iter++)
+		{
+			time_batches(stack_alloc[rep], allocations, [&](size_t i) { pointers[i] = stack.allocate(count); });
+			sink = uint64_t(reinterpret_cast<uintptr_t>(pointers.back()));
+			stack.reset();
+
+			time_batches(malloc_alloc[rep], allocations, [&](size_t i) {
+				pointers[i] = static_cast<uint32_t *>(malloc(count * sizeof(uint32_t)));
+			});
+			sink = uint64_t(reinterpret_cast<uintptr_t>(pointers.back()));
+			for (auto *ptr : pointers)
+				free(ptr);
+		}
+	}
+
+	report("StackAllocator", "allocate", count, 1, stack_alloc);
+	report("malloc", "allocate", count, 1, malloc_alloc);
+}
+
+static void bench_hasher(size_t size)
+{
+	std::string data(size, '\0');
+	std::mt19937 rnd(6);
+	for (auto &c : data)
+		c = char(rnd());
+
+	size_t iterations = MinOpsPerMeasurement / 16;
+	std::vector<Samples> hasher(Repetitions), std_hash(Repetitions);
+
+	for (unsigned rep = 0; rep < Repetitions; rep++)
+	{
+		uint64_t sum = 0;
+		time_batches(hasher[rep], iterations, [&](size_t) {
+			Hasher h;
+			h.data(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+			sum += h.get();
+		});
+		time_batches(std_hash[rep], iterations, [&](size_t) {
+			sum += std::hash<std::string>()(data);
+		});
+		sink = sum;
+	}
+
+	report("Hasher", "data", size, 1, hasher);
+	report("std::hash<std::string>", "data", size, 1, std_hash);
+}
+
+int main()
+{
+	const size_t map_sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+	const unsigned thread_counts[] = { 1, 2, 4, 8 };
+
+	printf("container,operation,size,threads,ns_per_op,p99_ns_per_op,mops_per_sec\n");
+
+	for (auto size : map_sizes)
+	{
+		bench_intrusive_hash_map(size);
+		bench_std_unordered_map(size);
+	}
+
+	for (auto threads : thread_counts)
+		bench_thread_safe_hash_map(threads, 16 * 1024);
+
+	for (size_t size : { 4, 8, 64, 1024 })
+	{
+		bench_vector<SmallVector<uint32_t>>("SmallVector", size);
+		bench_vector<std::vector<uint32_t>>("std::vector", size);
+	}
+
+	for (size_t size : { 64, 1024, 16 * 1024 })
+		bench_object_pools(size);
+	for (auto threads : thread_counts)
+		bench_thread_safe_object_pools(threads, 1024);
+
+	for (auto size : map_sizes)
+		bench_lru_cache(size);
+
+	for (size_t size : { 64, 1024, 16 * 1024 })
+		bench_temporary_hashmap(size);
+
+	for (size_t count : { 1, 16, 256 })
+		bench_stack_allocator(count);
+
+	for (size_t size : { 16, 256, 4096 })
+		bench_hasher(size);
+}
@@ -56,7 +56,7 @@ int main()
 	for (auto &img : images)
 	{
 		auto info = Vulkan::ImageCreateInfo::render_target(640, 480, VK_FORMAT_R8G8B8A8_SRGB);
-		info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 		info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 		img = device.create_image(info);
 	}
@@ -0,0 +1,274 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpu_topology.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+namespace Granite
+{
+#if defined(__linux__)
+static bool read_sysfs_uint(const char *path, unsigned &value)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	unsigned long v = 0;
+	bool ret = fscanf(file, "%lu", &v) == 1;
+	fclose(file);
+	if (ret)
+		value = unsigned(v);
+	return ret;
+}
+
+// Parses CPU lists such as "0-7,16-23".
+static bool read_sysfs_cpu_list(const char *path, std::vector<unsigned> &list)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	char buffer[1024];
+	bool ret = fgets(buffer, sizeof(buffer), file) != nullptr;
+	fclose(file);
+	if (!ret)
+		return false;
+
+	const char *str = buffer;
+	while (*str != '\0' && *str != '\n')
+	{
+		char *end = nullptr;
+		unsigned long first = strtoul(str, &end, 10);
+		if (end == str)
+			return false;
+
+		unsigned long last = first;
+		str = end;
+		if (*str == '-')
+		{
+			last = strtoul(str + 1, &end, 10);
+			str = end;
+		}
+
+		for (unsigned long i = first; i <= last; i++)
+			list.push_back(unsigned(i));
+
+		if (*str == ',')
+			str++;
+	}
+
+	return true;
+}
+#endif
+
+bool CPUTopology::detect()
+{
+	cpus.clear();
+
+#if defined(__linux__)
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (num_cpus <= 0)
+		return false;
+
+	// Intel hybrid CPUs expose P-cores and E-cores as separate PMUs.
+	std::vector<unsigned> intel_p_cores;
+	read_sysfs_cpu_list("/sys/devices/cpu_core/cpus", intel_p_cores);
+
+	std::unordered_map<unsigned, unsigned> core_to_first_cpu;
+	char path[256];
+
+	for (long i = 0; i < num_cpus; i++)
+	{
+		LogicalCPU cpu;
+		cpu.index = unsigned(i);
+
+		unsigned core_id = 0, package_id = 0;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/core_id", i);
+		if (!read_sysfs_uint(path, core_id))
+			continue; // Offline CPU.
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/physical_package_id", i);
+		read_sysfs_uint(path, package_id);
+		cpu.core = (package_id << 16) | core_id;
+
+		if (!intel_p_cores.empty())
+		{
+			cpu.performance = std::find(intel_p_cores.begin(), intel_p_cores.end(), cpu.index) !=
+			                  intel_p_cores.end() ? 2 : 1;
+		}
+		else
+		{
+			// cpu_capacity is provided for asymmetric ARM systems, otherwise fall back to max frequency.
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cpu_capacity", i);
+			if (!read_sysfs_uint(path, cpu.performance))
+			{
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cpufreq/cpuinfo_max_freq", i);
+				if (!read_sysfs_uint(path, cpu.performance))
+					cpu.performance = 1;
+			}
+		}
+
+		auto itr = core_to_first_cpu.find(cpu.core);
+		if (itr != core_to_first_cpu.end())
+			cpu.smt_sibling = true;
+		else
+			core_to_first_cpu[cpu.core] = cpu.index;
+
+		cpus.push_back(cpu);
+	}
+#elif defined(_WIN32)
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+	if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || length == 0)
+		return false;
+
+	std::vector<uint8_t> buffer(length);
+	auto *info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data());
+	if (!GetLogicalProcessorInformationEx(RelationProcessorCore, info, &length))
+		return false;
+
+	unsigned core_index = 0;
+	for (DWORD offset = 0; offset < length; core_index++)
+	{
+		auto *entry = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+		offset += entry->Size;
+		if (entry->Relationship != RelationProcessorCore)
+			continue;
+
+		auto &processor = entry->Processor;
+		bool first = true;
+		for (WORD group = 0; group < processor.GroupCount; group++)
+		{
+			auto mask = processor.GroupMask[group].Mask;
+			for (unsigned bit = 0; bit < sizeof(mask) * 8; bit++)
+			{
+				if ((mask & (KAFFINITY(1) << bit)) == 0)
+					continue;
+
+				LogicalCPU cpu;
+				cpu.index = unsigned(processor.GroupMask[group].Group) * 64 + bit;
+				cpu.core = core_index;
+				// Higher efficiency class means higher performance.
+				cpu.performance = unsigned(processor.EfficiencyClass) + 1;
+				cpu.smt_sibling = !first;
+				first = false;
+				cpus.push_back(cpu);
+			}
+		}
+	}
+#endif
+
+	if (cpus.empty())
+		return false;
+
+	finalize();
+	return true;
+}
+
+void CPUTopology::finalize()
+{
+	std::sort(cpus.begin(), cpus.end(), [](const LogicalCPU &a, const LogicalCPU &b) {
+		return a.index < b.index;
+	});
+
+	max_performance = 0;
+	min_performance = ~0u;
+	for (auto &cpu : cpus)
+	{
+		max_performance = std::max(max_performance, cpu.performance);
+		min_performance = std::min(min_performance, cpu.performance);
+	}
+}
+
+const std::vector<LogicalCPU> &CPUTopology::get_logical_cpus() const
+{
+	return cpus;
+}
+
+bool CPUTopology::is_performance_cpu(const LogicalCPU &cpu) const
+{
+	// Allow for some variance, e.g. favored cores which boost slightly higher than their siblings.
+	return uint64_t(cpu.performance) * 100 >= uint64_t(max_performance) * 85;
+}
+
+bool CPUTopology::is_hybrid() const
+{
+	return !cpus.empty() && uint64_t(min_performance) * 100 < uint64_t(max_performance) * 85;
+}
+
+std::vector<LogicalCPU> CPUTopology::get_placement_order() const
+{
+	auto order = cpus;
+	std::stable_sort(order.begin(), order.end(), [this](const LogicalCPU &a, const LogicalCPU &b) {
+		if (a.smt_sibling != b.smt_sibling)
+			return b.smt_sibling;
+		bool perf_a = is_performance_cpu(a);
+		bool perf_b = is_performance_cpu(b);
+		if (perf_a != perf_b)
+			return perf_a;
+		return a.performance > b.performance;
+	});
+	return order;
+}
+
+bool CPUTopology::set_current_thread_affinity(unsigned logical_index)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(logical_index, &set);
+	// On Android, sched_setaffinity is the only option, so use it everywhere.
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+	{
+		LOGW("Failed to set thread affinity to CPU %u.\n", logical_index);
+		return false;
+	}
+	return true;
+#elif defined(_WIN32)
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = WORD(logical_index / 64);
+	affinity.Mask = KAFFINITY(1) << (logical_index % 64);
+	if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr))
+	{
+		LOGW("Failed to set thread affinity to CPU %u.\n", logical_index);
+		return false;
+	}
+	return true;
+#else
+	(void)logical_index;
+	return false;
+#endif
+}
+}
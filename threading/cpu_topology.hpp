@@ -0,0 +1,65 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace Granite
+{
+struct LogicalCPU
+{
+	// OS index of the logical processor.
+	unsigned index = 0;
+	// Logical processors which share a core (SMT siblings) share this identifier.
+	unsigned core = 0;
+	// Relative performance of the core. Only meaningful when compared against other cores.
+	unsigned performance = 0;
+	// Set for every logical processor of a core except the first one.
+	bool smt_sibling = false;
+};
+
+class CPUTopology
+{
+public:
+	// Returns false if topology could not be queried on this platform.
+	bool detect();
+
+	const std::vector<LogicalCPU> &get_logical_cpus() const;
+
+	// True if there are cores with clearly different performance, e.g. P-cores and E-cores.
+	bool is_hybrid() const;
+	bool is_performance_cpu(const LogicalCPU &cpu) const;
+
+	// Preferred order of logical processors for worker threads.
+	// Performance cores come first, then efficiency cores, then SMT siblings of either.
+	std::vector<LogicalCPU> get_placement_order() const;
+
+	static bool set_current_thread_affinity(unsigned logical_index);
+
+private:
+	std::vector<LogicalCPU> cpus;
+	unsigned max_performance = 0;
+	unsigned min_performance = 0;
+	void finalize();
+};
+}
@@ -21,11 +21,12 @@
  */
 
 #include "task_composer.hpp"
+#include <algorithm>
 
 namespace Granite
 {
 TaskComposer::TaskComposer(ThreadGroup &group_)
-	: group(group_)
+	: group(group_), priority(TaskPriority::Normal)
 {
 }
 
@@ -38,6 +39,8 @@ TaskGroup &TaskComposer::begin_pipeline_stage()
 {
 	auto new_group = group.create_task();
 	auto new_deps = group.create_task();
+	if (has_priority)
+		new_group->set_priority(priority);
 	if (current)
 		group.add_dependency(*new_deps, *current);
 	if (next_stage_deps)
@@ -75,7 +78,11 @@ TaskGroupHandle TaskComposer::get_pipeline_stage_dependency()
 TaskGroupHandle TaskComposer::get_deferred_enqueue_handle()
 {
 	if (!next_stage_deps)
+	{
 		next_stage_deps = group.create_task();
+		if (has_priority)
+			next_stage_deps->set_priority(priority);
+	}
 	return next_stage_deps;
 }
 
@@ -84,6 +91,28 @@ ThreadGroup &TaskComposer::get_thread_group()
 	return group;
 }
 
+void TaskComposer::set_priority(TaskPriority priority_)
+{
+	priority = priority_;
+	has_priority = true;
+}
+
+unsigned TaskComposer::compute_parallel_for_tasks(size_t count, size_t grain) const
+{
+	// Enough tasks to load balance, but not so many that task overhead dominates.
+	constexpr size_t DefaultGrainSize = 64;
+	constexpr size_t TasksPerThread = 4;
+
+	if (count == 0)
+		return 0;
+	if (grain == 0)
+		grain = DefaultGrainSize;
+
+	size_t max_tasks = std::max<size_t>(1, group.get_num_threads()) * TasksPerThread;
+	size_t num_tasks = (count + grain - 1) / grain;
+	return unsigned(std::min(num_tasks, max_tasks));
+}
+
 void TaskComposer::add_outgoing_dependency(TaskGroup &task)
 {
 	group.add_dependency(task, *get_outgoing_task());
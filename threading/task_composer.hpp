@@ -23,6 +23,8 @@
 #pragma once
 
 #include "thread_group.hpp"
+#include <memory>
+#include <vector>
 
 // Designed to compose a series of pipelined tasks.
 
@@ -50,8 +52,70 @@ public:
 
 	void add_outgoing_dependency(TaskGroup &task);
 
+	// Applies to all pipeline stages which begin after this call.
+	void set_priority(TaskPriority priority);
+
+	// Begins a new pipeline stage which calls func(begin, end) over sub-ranges of [0, count).
+	// grain is the minimum number of elements per task. If 0, a default is used.
+	// The number of tasks is chosen from the element count and the number of workers.
+	template <typename Func>
+	TaskGroup &parallel_for(size_t count, size_t grain, Func &&func)
+	{
+		auto &stage = begin_pipeline_stage();
+		unsigned num_tasks = compute_parallel_for_tasks(count, grain);
+		for (unsigned i = 0; i < num_tasks; i++)
+		{
+			size_t begin = (count * i) / num_tasks;
+			size_t end = (count * (i + 1)) / num_tasks;
+			stage.enqueue_task([func, begin, end]() {
+				func(begin, end);
+			});
+		}
+		return stage;
+	}
+
+	// Begins two pipeline stages. The first computes func(begin, end) -> T for sub-ranges,
+	// the second combines the partial results with reduce(T, T) -> T and writes to *result.
+	// *result must remain valid until the second stage completes.
+	template <typename T, typename Func, typename Reduce>
+	void parallel_reduce(size_t count, size_t grain, T *result, T identity, Func &&func, Reduce &&reduce)
+	{
+		// Partials are written concurrently. Keeping them apart by a cache line avoids
+		// racing on packed storage like vector<bool>, and false sharing for small T.
+		// Padding rather than alignas, since over-aligned new needs C++17.
+		struct Partial
+		{
+			T value;
+			char padding[64];
+		};
+
+		unsigned num_tasks = compute_parallel_for_tasks(count, grain);
+		auto partials = std::make_shared<std::vector<Partial>>(num_tasks, Partial{ identity, {} });
+
+		auto &stage = begin_pipeline_stage();
+		for (unsigned i = 0; i < num_tasks; i++)
+		{
+			size_t begin = (count * i) / num_tasks;
+			size_t end = (count * (i + 1)) / num_tasks;
+			stage.enqueue_task([func, partials, begin, end, i]() {
+				(*partials)[i].value = func(begin, end);
+			});
+		}
+
+		begin_pipeline_stage().enqueue_task([reduce, partials, result, identity]() {
+			T value = identity;
+			for (auto &partial : *partials)
+				value = reduce(value, partial.value);
+			*result = value;
+		});
+	}
+
+	unsigned compute_parallel_for_tasks(size_t count, size_t grain) const;
+
 private:
 	ThreadGroup &group;
+	TaskPriority priority;
+	bool has_priority = false;
 	TaskGroupHandle current;
 	TaskGroupHandle incoming_deps;
 	TaskGroupHandle next_stage_deps;
@@ -0,0 +1,159 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "task_statistics.hpp"
+#include "bitops.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+unsigned DurationHistogram::bucket_index(uint64_t ns)
+{
+	constexpr uint64_t SubBuckets = 1u << SubBucketBits;
+	if (ns < SubBuckets)
+		return unsigned(ns);
+
+	unsigned msb;
+	if (ns >> 32)
+		msb = 32 + Util::floor_log2(uint32_t(ns >> 32));
+	else
+		msb = Util::floor_log2(uint32_t(ns));
+
+	unsigned sub = unsigned(ns >> (msb - SubBucketBits)) & (SubBuckets - 1);
+	unsigned index = (msb - SubBucketBits + 1) * SubBuckets + sub;
+	return std::min<unsigned>(index, NumBuckets - 1);
+}
+
+uint64_t DurationHistogram::bucket_value(unsigned index)
+{
+	constexpr unsigned SubBuckets = 1u << SubBucketBits;
+	if (index < SubBuckets)
+		return index;
+
+	unsigned msb = index / SubBuckets + SubBucketBits - 1;
+	unsigned sub = index % SubBuckets;
+	return uint64_t(SubBuckets + sub) << (msb - SubBucketBits);
+}
+
+void DurationHistogram::add(uint64_t ns)
+{
+	buckets[bucket_index(ns)]++;
+	count++;
+}
+
+void DurationHistogram::merge(const DurationHistogram &other)
+{
+	for (unsigned i = 0; i < NumBuckets; i++)
+		buckets[i] += other.buckets[i];
+	count += other.count;
+}
+
+uint64_t DurationHistogram::get_count() const
+{
+	return count;
+}
+
+uint64_t DurationHistogram::get_percentile(double percentile) const
+{
+	if (!count)
+		return 0;
+
+	auto target = uint64_t(percentile * double(count - 1));
+	uint64_t accum = 0;
+	for (unsigned i = 0; i < NumBuckets; i++)
+	{
+		accum += buckets[i];
+		if (accum > target)
+			return bucket_value(i);
+	}
+
+	return bucket_value(NumBuckets - 1);
+}
+
+void TaskStatisticsAccumulator::record(Util::Hash desc_hash, const char *desc, uint64_t duration_ns, uint64_t wait_ns)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	auto itr = entries.find(desc_hash);
+	if (itr == entries.end())
+	{
+		itr = entries.insert({ desc_hash, {} }).first;
+		itr->second.desc = desc;
+	}
+
+	auto &entry = itr->second;
+	entry.total_ns += duration_ns;
+	entry.max_ns = std::max(entry.max_ns, duration_ns);
+	entry.total_wait_ns += wait_ns;
+	entry.duration.add(duration_ns);
+	entry.wait.add(wait_ns);
+}
+
+void TaskStatisticsAccumulator::collect(Util::HashMap<Entry> &merged, bool reset)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	for (auto &e : entries)
+	{
+		auto itr = merged.find(e.first);
+		if (itr == merged.end())
+		{
+			merged.insert(e);
+			continue;
+		}
+
+		auto &entry = itr->second;
+		entry.total_ns += e.second.total_ns;
+		entry.max_ns = std::max(entry.max_ns, e.second.max_ns);
+		entry.total_wait_ns += e.second.total_wait_ns;
+		entry.duration.merge(e.second.duration);
+		entry.wait.merge(e.second.wait);
+	}
+
+	if (reset)
+		entries.clear();
+}
+
+void resolve_task_statistics(const Util::HashMap<TaskStatisticsAccumulator::Entry> &entries,
+                             std::vector<TaskStatistics> &stats)
+{
+	stats.clear();
+	stats.reserve(entries.size());
+
+	for (auto &e : entries)
+	{
+		TaskStatistics stat;
+		stat.desc = e.second.desc;
+		stat.count = e.second.duration.get_count();
+		stat.total_ns = e.second.total_ns;
+		stat.max_ns = e.second.max_ns;
+		stat.p50_ns = e.second.duration.get_percentile(0.50);
+		stat.p99_ns = e.second.duration.get_percentile(0.99);
+		stat.total_wait_ns = e.second.total_wait_ns;
+		stat.p50_wait_ns = e.second.wait.get_percentile(0.50);
+		stat.p99_wait_ns = e.second.wait.get_percentile(0.99);
+		stats.push_back(std::move(stat));
+	}
+
+	std::sort(stats.begin(), stats.end(), [](const TaskStatistics &a, const TaskStatistics &b) {
+		return a.total_ns > b.total_ns;
+	});
+}
+}
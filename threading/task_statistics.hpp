@@ -0,0 +1,94 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "hashmap.hpp"
+
+namespace Granite
+{
+// Log-linear histogram of durations in nanoseconds, mergeable across threads.
+// Each power of two is split in four buckets, so percentiles are accurate to within 25%.
+class DurationHistogram
+{
+public:
+	void add(uint64_t ns);
+	void merge(const DurationHistogram &other);
+	uint64_t get_percentile(double percentile) const;
+	uint64_t get_count() const;
+
+private:
+	enum { SubBucketBits = 2, NumBuckets = 256 };
+	uint32_t buckets[NumBuckets] = {};
+	uint64_t count = 0;
+
+	static unsigned bucket_index(uint64_t ns);
+	static uint64_t bucket_value(unsigned index);
+};
+
+struct TaskStatistics
+{
+	std::string desc;
+	uint64_t count = 0;
+	uint64_t total_ns = 0;
+	uint64_t p50_ns = 0;
+	uint64_t p99_ns = 0;
+	uint64_t max_ns = 0;
+
+	// Time from when a task became ready until a worker started executing it.
+	uint64_t total_wait_ns = 0;
+	uint64_t p50_wait_ns = 0;
+	uint64_t p99_wait_ns = 0;
+};
+
+// One accumulator is owned by each worker, so recording only takes an uncontended lock.
+class TaskStatisticsAccumulator
+{
+public:
+	void record(Util::Hash desc_hash, const char *desc, uint64_t duration_ns, uint64_t wait_ns);
+
+	// Merges recorded data into entries, keyed by description hash.
+	// If reset is true, recorded data is cleared afterwards.
+	struct Entry
+	{
+		std::string desc;
+		uint64_t total_ns = 0;
+		uint64_t max_ns = 0;
+		uint64_t total_wait_ns = 0;
+		DurationHistogram duration;
+		DurationHistogram wait;
+	};
+	void collect(Util::HashMap<Entry> &entries, bool reset);
+
+private:
+	std::mutex lock;
+	Util::HashMap<Entry> entries;
+};
+
+// Converts merged entries into sorted statistics, most expensive task groups first.
+void resolve_task_statistics(const Util::HashMap<TaskStatisticsAccumulator::Entry> &entries,
+                             std::vector<TaskStatistics> &stats);
+}
@@ -28,11 +28,55 @@
 #include "string_helpers.hpp"
 #include "timeline_trace_file.hpp"
 #include "thread_name.hpp"
+#include "timer.hpp"
+#include "cpu_topology.hpp"
+#include "libco.h"
 
 using namespace std;
 
 namespace Granite
 {
+// Lets move_to_ready_tasks() know if it's called from one of our own workers,
+// so that newly ready tasks can be pushed to the worker's local queue.
+static thread_local ThreadGroup *current_worker_group;
+static thread_local unsigned current_worker_index;
+// Task groups created from within a task inherit the priority of that task.
+static thread_local TaskPriority current_task_priority = TaskPriority::Normal;
+
+namespace Internal
+{
+struct Fiber
+{
+	cothread_t cothread = nullptr;
+	cothread_t return_context = nullptr;
+	Task *task = nullptr;
+	bool complete = false;
+};
+
+static constexpr unsigned FiberStackSize = 256 * 1024;
+static thread_local Fiber *current_fiber;
+
+static void fiber_entry(void *arg)
+{
+	auto *fiber = static_cast<Fiber *>(arg);
+	for (;;)
+	{
+		fiber->task->func();
+		fiber->complete = true;
+		co_switch(fiber->return_context);
+	}
+}
+
+static void yield_current_fiber()
+{
+	// Fibers never migrate between workers, so the thread local is still valid after we're resumed.
+	auto *fiber = current_fiber;
+	assert(fiber);
+	co_switch(fiber->return_context);
+}
+}
+
+
 namespace Internal
 {
 void TaskDeps::notify_dependees()
@@ -44,11 +88,16 @@ void TaskDeps::notify_dependees()
 		dep->dependency_satisfied();
 	pending.clear();
 
+	Util::SmallVector<Task *> resume_tasks;
 	{
 		lock_guard<mutex> holder{cond_lock};
 		done = true;
 		cond.notify_all();
+		resume_tasks = std::move(suspended_tasks);
 	}
+
+	for (auto *task : resume_tasks)
+		group->resume_suspended_task(task);
 }
 
 void TaskDeps::task_completed()
@@ -106,6 +155,20 @@ void TaskGroup::wait()
 	if (!flushed)
 		flush();
 
+	if (auto *fiber = Internal::current_fiber)
+	{
+		{
+			lock_guard<mutex> holder{deps->cond_lock};
+			if (deps->done)
+				return;
+			deps->suspended_tasks.push_back(fiber->task);
+		}
+
+		// Not resumed until notify_dependees() completes.
+		Internal::yield_current_fiber();
+		return;
+	}
+
 	unique_lock<mutex> holder{deps->cond_lock};
 	deps->cond.wait(holder, [this]() {
 		return deps->done;
@@ -160,12 +223,35 @@ void ThreadGroup::start(unsigned num_threads, const std::function<void ()> &on_t
 	dead = false;
 	active = true;
 
+	if (num_high_priority_only_threads >= num_threads && num_threads != 0)
+	{
+		LOGW("Cannot reserve all worker threads for high priority work, reserving %u.\n", num_threads - 1);
+		num_high_priority_only_threads = num_threads - 1;
+	}
+
 	thread_group.resize(num_threads);
+	worker_queues.resize(num_threads);
+	for (auto &q : worker_queues)
+		q = make_unique<WorkerQueue>();
+	for (unsigned i = 0; i < num_high_priority_only_threads; i++)
+		worker_queues[i]->end_priority = unsigned(TaskPriority::High) + 1;
+
+	if (const char *env = getenv("GRANITE_THREAD_AFFINITY"))
+		topology_aware_placement = strtoul(env, nullptr, 0) != 0;
+	if (topology_aware_placement)
+		assign_worker_placement();
+
+	if (const char *env = getenv("GRANITE_TASK_STATISTICS"))
+		task_statistics_enabled.store(strtoul(env, nullptr, 0) != 0, memory_order_relaxed);
 
 	if (const char *env = getenv("GRANITE_TIMELINE_TRACE"))
 	{
-		LOGI("Enabling JSON timeline tracing to %s.\n", env);
-		timeline_trace_file = std::make_unique<Util::TimelineTraceFile>(env);
+		// A .gtrace extension selects the low-overhead binary format.
+		std::string path = env;
+		bool binary = path.size() >= 7 && path.compare(path.size() - 7, 7, ".gtrace") == 0;
+		LOGI("Enabling %s timeline tracing to %s.\n", binary ? "binary" : "JSON", env);
+		timeline_trace_file = std::make_unique<Util::TimelineTraceFile>(
+				path, binary ? Util::TimelineTraceFile::Format::Binary : Util::TimelineTraceFile::Format::JSON);
 	}
 
 	refresh_global_timeline_trace_file();
@@ -177,6 +263,9 @@ void ThreadGroup::start(unsigned num_threads, const std::function<void ()> &on_t
 		t = make_unique<thread>([this, on_thread_begin, self_index]() {
 			refresh_global_timeline_trace_file();
 			set_worker_thread_name(self_index - 1);
+			int cpu_index = worker_queues[self_index - 1]->cpu_index;
+			if (cpu_index >= 0)
+				CPUTopology::set_current_thread_affinity(unsigned(cpu_index));
 			if (on_thread_begin)
 				on_thread_begin();
 			thread_looper(self_index);
@@ -185,6 +274,61 @@ void ThreadGroup::start(unsigned num_threads, const std::function<void ()> &on_t
 	}
 }
 
+void ThreadGroup::assign_worker_placement()
+{
+	CPUTopology topology;
+	if (!topology.detect())
+	{
+		LOGW("Failed to query CPU topology, cannot pin worker threads.\n");
+		return;
+	}
+
+	auto order = topology.get_placement_order();
+	bool hybrid = topology.is_hybrid();
+	LOGI("Pinning %u worker threads, %u logical CPUs, hybrid: %s.\n",
+	     unsigned(worker_queues.size()), unsigned(order.size()), hybrid ? "yes" : "no");
+
+	for (size_t i = 0; i < worker_queues.size(); i++)
+	{
+		auto &q = *worker_queues[i];
+		auto &cpu = order[i % order.size()];
+		q.cpu_index = int(cpu.index);
+
+		// Latency sensitive work only runs on performance cores.
+		// Performance cores come first in placement order, so at least one worker can still run high priority work.
+		if (hybrid && !topology.is_performance_cpu(cpu) && q.first_priority == 0 &&
+		    q.end_priority == unsigned(NumPriorities))
+		{
+			q.first_priority = unsigned(TaskPriority::High) + 1;
+		}
+	}
+}
+
+void ThreadGroup::set_task_statistics_enabled(bool enable)
+{
+	task_statistics_enabled.store(enable, memory_order_relaxed);
+}
+
+bool ThreadGroup::get_task_statistics_enabled() const
+{
+	return task_statistics_enabled.load(memory_order_relaxed);
+}
+
+void ThreadGroup::get_task_statistics(std::vector<TaskStatistics> &stats, bool reset)
+{
+	Util::HashMap<TaskStatisticsAccumulator::Entry> entries;
+	for (auto &q : worker_queues)
+		q->statistics.collect(entries, reset);
+	resolve_task_statistics(entries, stats);
+}
+
+void ThreadGroup::set_topology_aware_placement(bool enable)
+{
+	if (active)
+		throw logic_error("Cannot change thread placement after starting thread group.");
+	topology_aware_placement = enable;
+}
+
 void ThreadGroup::submit(TaskGroupHandle &group)
 {
 	group->flush();
@@ -204,20 +348,214 @@ void ThreadGroup::add_dependency(TaskGroup &dependee, TaskGroup &dependency)
 
 void ThreadGroup::move_to_ready_tasks(const Util::SmallVector<Internal::Task *> &list)
 {
-	lock_guard<mutex> holder{cond_lock};
+	if (list.empty())
+		return;
+
 	total_tasks.fetch_add(list.size(), memory_order_relaxed);
 
-	for (auto &t : list)
-		ready_tasks.push(t);
+	// All tasks in a list belong to the same task group.
+	auto priority = list.front()->deps->priority;
+	unsigned prio = unsigned(priority);
+
+	if (task_statistics_enabled.load(memory_order_relaxed))
+	{
+		uint64_t ready_ns = Util::get_current_time_nsecs();
+		for (auto &t : list)
+			t->ready_ns = ready_ns;
+	}
+
+	if (current_worker_group == this)
+	{
+		// Keep fan-outs from a worker local. Idle workers will steal if needed.
+		auto &q = *worker_queues[current_worker_index];
+		lock_guard<mutex> holder{q.lock};
+		for (auto &t : list)
+			q.tasks[prio].push_back(t);
+	}
+	else
+	{
+		lock_guard<mutex> holder{ready_tasks_lock};
+		for (auto &t : list)
+			ready_tasks[prio].push(t);
+	}
+
+	if (priority == TaskPriority::High)
+		queued_high_priority_tasks.fetch_add(unsigned(list.size()), memory_order_seq_cst);
+	queued_tasks.fetch_add(unsigned(list.size()), memory_order_seq_cst);
+	wake_threads(list.size(), priority);
+}
+
+void ThreadGroup::resume_suspended_task(Internal::Task *task)
+{
+	auto &q = *worker_queues[task->worker_index];
+	{
+		lock_guard<mutex> holder{q.lock};
+		q.resumable.push_back(task);
+	}
+	q.resumable_count.fetch_add(1, memory_order_seq_cst);
+
+	// We have to wake up one specific worker, so wake up everyone.
+	if (sleeping_threads.load(memory_order_seq_cst) != 0)
+	{
+		lock_guard<mutex> holder{cond_lock};
+		cond.notify_all();
+		high_priority_cond.notify_all();
+		low_priority_cond.notify_all();
+	}
+}
+
+Internal::Task *ThreadGroup::pop_resumable_task(unsigned self_index)
+{
+	auto &q = *worker_queues[self_index];
+	if (q.resumable_count.load(memory_order_relaxed) == 0)
+		return nullptr;
+
+	lock_guard<mutex> holder{q.lock};
+	if (q.resumable.empty())
+		return nullptr;
+
+	auto *task = q.resumable.back();
+	q.resumable.pop_back();
+	q.resumable_count.fetch_sub(1, memory_order_relaxed);
+	return task;
+}
+
+bool ThreadGroup::run_suspendable_task(unsigned self_index, Internal::Task &task)
+{
+	auto &q = *worker_queues[self_index];
+	auto *fiber = static_cast<Internal::Fiber *>(task.fiber);
+
+	if (!fiber)
+	{
+		if (q.fiber_pool.empty())
+		{
+			fiber = new Internal::Fiber;
+			fiber->cothread = co_create(Internal::FiberStackSize, Internal::fiber_entry, fiber);
+			if (!fiber->cothread)
+			{
+				delete fiber;
+				throw bad_alloc();
+			}
+		}
+		else
+		{
+			fiber = static_cast<Internal::Fiber *>(q.fiber_pool.back());
+			q.fiber_pool.pop_back();
+		}
+
+		fiber->task = &task;
+		task.fiber = fiber;
+		task.worker_index = self_index;
+	}
+
+	fiber->return_context = co_active();
+	Internal::current_fiber = fiber;
+	co_switch(fiber->cothread);
+	Internal::current_fiber = nullptr;
+
+	if (!fiber->complete)
+		return false;
 
-	if (list.size() >= thread_group.size())
+	fiber->complete = false;
+	fiber->task = nullptr;
+	task.fiber = nullptr;
+	q.fiber_pool.push_back(fiber);
+	return true;
+}
+
+bool ThreadGroup::current_task_is_suspendable()
+{
+	return Internal::current_fiber != nullptr;
+}
+
+bool ThreadGroup::current_thread_is_worker()
+{
+	return current_worker_group != nullptr;
+}
+
+void ThreadGroup::wake_threads(size_t count, TaskPriority priority)
+{
+	// Pairs with the sleeping_threads increment in thread_looper().
+	if (sleeping_threads.load(memory_order_seq_cst) == 0)
+		return;
+
+	bool high = priority == TaskPriority::High;
+	auto &restricted_cond = high ? high_priority_cond : low_priority_cond;
+
+	lock_guard<mutex> holder{cond_lock};
+	if (count >= thread_group.size())
+	{
 		cond.notify_all();
+		restricted_cond.notify_all();
+	}
 	else
 	{
-		size_t count = list.size();
 		for (size_t i = 0; i < count; i++)
+		{
 			cond.notify_one();
+			restricted_cond.notify_one();
+		}
+	}
+}
+
+Internal::Task *ThreadGroup::pop_ready_task(unsigned self_index, TaskPriority priority)
+{
+	Internal::Task *task = nullptr;
+	unsigned prio = unsigned(priority);
+
+	// LIFO from our own queue for cache locality.
+	{
+		auto &q = *worker_queues[self_index];
+		lock_guard<mutex> holder{q.lock};
+		if (!q.tasks[prio].empty())
+		{
+			task = q.tasks[prio].back();
+			q.tasks[prio].pop_back();
+		}
+	}
+
+	if (!task)
+	{
+		lock_guard<mutex> holder{ready_tasks_lock};
+		if (!ready_tasks[prio].empty())
+		{
+			task = ready_tasks[prio].front();
+			ready_tasks[prio].pop();
+		}
+	}
+
+	// Steal the oldest task from someone else.
+	size_t num_queues = worker_queues.size();
+	for (size_t i = 1; !task && i < num_queues; i++)
+	{
+		auto &q = *worker_queues[(self_index + i) % num_queues];
+		lock_guard<mutex> holder{q.lock};
+		if (!q.tasks[prio].empty())
+		{
+			task = q.tasks[prio].front();
+			q.tasks[prio].pop_front();
+		}
+	}
+
+	return task;
+}
+
+Internal::Task *ThreadGroup::pop_ready_task(unsigned self_index, unsigned first_priority, unsigned end_priority)
+{
+	// Always drain higher priority work before looking at lower priorities.
+	for (unsigned prio = first_priority; prio < end_priority; prio++)
+	{
+		auto *task = pop_ready_task(self_index, TaskPriority(prio));
+		if (task)
+		{
+			if (TaskPriority(prio) == TaskPriority::High)
+				queued_high_priority_tasks.fetch_sub(1, memory_order_relaxed);
+			queued_tasks.fetch_sub(1, memory_order_relaxed);
+			return task;
+		}
 	}
+
+	return nullptr;
 }
 
 void Internal::TaskGroupDeleter::operator()(TaskGroup *group)
@@ -230,26 +568,111 @@ void Internal::TaskDepsDeleter::operator()(Internal::TaskDeps *deps)
 	deps->group->free_task_deps(deps);
 }
 
+ThreadGroup::WorkerQueue *ThreadGroup::get_current_allocation_cache()
+{
+	if (thread_local_allocation && current_worker_group == this)
+		return worker_queues[current_worker_index].get();
+	else
+		return nullptr;
+}
+
+Internal::Task *ThreadGroup::allocate_task(Internal::TaskDepsHandle deps, std::function<void ()> func)
+{
+	if (auto *q = get_current_allocation_cache())
+		return q->task_cache.allocate(task_pool, move(deps), move(func));
+	else
+		return task_pool.allocate(move(deps), move(func));
+}
+
+void ThreadGroup::free_task(Internal::Task *task)
+{
+	if (auto *q = get_current_allocation_cache())
+		q->task_cache.free(task_pool, task);
+	else
+		task_pool.free(task);
+}
+
+TaskGroupHandle ThreadGroup::allocate_task_group()
+{
+	TaskGroupHandle group;
+	if (auto *q = get_current_allocation_cache())
+	{
+		group = TaskGroupHandle(q->task_group_cache.allocate(task_group_pool, this));
+		group->deps = Internal::TaskDepsHandle(q->task_deps_cache.allocate(task_deps_pool, this));
+	}
+	else
+	{
+		group = TaskGroupHandle(task_group_pool.allocate(this));
+		group->deps = Internal::TaskDepsHandle(task_deps_pool.allocate(this));
+	}
+
+	group->deps->priority = current_task_priority;
+	return group;
+}
+
 void ThreadGroup::free_task_group(TaskGroup *group)
 {
-	task_group_pool.free(group);
+	if (auto *q = get_current_allocation_cache())
+		q->task_group_cache.free(task_group_pool, group);
+	else
+		task_group_pool.free(group);
 }
 
 void ThreadGroup::free_task_deps(Internal::TaskDeps *deps)
 {
-	task_deps_pool.free(deps);
+	if (auto *q = get_current_allocation_cache())
+		q->task_deps_cache.free(task_deps_pool, deps);
+	else
+		task_deps_pool.free(deps);
+}
+
+void ThreadGroup::set_thread_local_allocation(bool enable)
+{
+	if (active)
+		throw logic_error("Cannot change allocation mode after starting thread group.");
+	thread_local_allocation = enable;
 }
 
 void TaskSignal::signal_increment()
 {
-	lock_guard<mutex> holder{lock};
-	counter++;
-	cond.notify_all();
+	Util::SmallVector<Internal::Task *> resume_tasks;
+
+	{
+		lock_guard<mutex> holder{lock};
+		counter++;
+		cond.notify_all();
+
+		for (size_t i = 0; i < suspended_tasks.size(); )
+		{
+			if (counter >= suspended_tasks[i].second)
+			{
+				resume_tasks.push_back(suspended_tasks[i].first);
+				suspended_tasks[i] = suspended_tasks.back();
+				suspended_tasks.pop_back();
+			}
+			else
+				i++;
+		}
+	}
+
+	for (auto *task : resume_tasks)
+		task->deps->group->resume_suspended_task(task);
 }
 
 void TaskSignal::wait_until_at_least(uint64_t count)
 {
 	unique_lock<mutex> holder{lock};
+
+	if (auto *fiber = Internal::current_fiber)
+	{
+		if (counter >= count)
+			return;
+		suspended_tasks.push_back({ fiber->task, count });
+		holder.unlock();
+		Internal::yield_current_fiber();
+		return;
+	}
+
 	cond.wait(holder, [&]() -> bool {
 		return counter >= count;
 	});
@@ -257,19 +680,15 @@ void TaskSignal::wait_until_at_least(uint64_t count)
 
 TaskGroupHandle ThreadGroup::create_task(std::function<void()> func)
 {
-	TaskGroupHandle group(task_group_pool.allocate(this));
-
-	group->deps = Internal::TaskDepsHandle(task_deps_pool.allocate(this));
-
-	group->deps->pending_tasks.push_back(task_pool.allocate(group->deps, move(func)));
+	auto group = allocate_task_group();
+	group->deps->pending_tasks.push_back(allocate_task(group->deps, move(func)));
 	group->deps->count.store(1, memory_order_relaxed);
 	return group;
 }
 
 TaskGroupHandle ThreadGroup::create_task()
 {
-	TaskGroupHandle group(task_group_pool.allocate(this));
-	group->deps = Internal::TaskDepsHandle(task_deps_pool.allocate(this));
+	auto group = allocate_task_group();
 	group->deps->count.store(0, memory_order_relaxed);
 	return group;
 }
@@ -292,6 +711,28 @@ void TaskGroup::enqueue_task(std::function<void()> func)
 void TaskGroup::set_desc(const char *desc)
 {
 	snprintf(deps->desc, sizeof(deps->desc), "%s", desc);
+	Util::Hasher h;
+	h.string(deps->desc);
+	deps->desc_hash = h.get();
+}
+
+void TaskGroup::set_priority(TaskPriority priority)
+{
+	if (flushed)
+		throw logic_error("Cannot change priority of a flushed task group.");
+	deps->priority = priority;
+}
+
+TaskPriority TaskGroup::get_priority() const
+{
+	return deps->priority;
+}
+
+void ThreadGroup::set_num_high_priority_only_threads(unsigned count)
+{
+	if (active)
+		throw logic_error("Cannot reserve high priority threads after starting thread group.");
+	num_high_priority_only_threads = count;
 }
 
 void ThreadGroup::enqueue_task(TaskGroup &group, std::function<void()> func)
@@ -299,10 +740,28 @@ void ThreadGroup::enqueue_task(TaskGroup &group, std::function<void()> func)
 	if (group.flushed)
 		throw logic_error("Cannot enqueue work to a flushed task group.");
 
-	group.deps->pending_tasks.push_back(task_pool.allocate(group.deps, move(func)));
+	group.deps->pending_tasks.push_back(allocate_task(group.deps, move(func)));
 	group.deps->count.fetch_add(1, memory_order_relaxed);
 }
 
+void ThreadGroup::enqueue_suspendable_task(TaskGroup &group, std::function<void()> func)
+{
+	enqueue_task(group, move(func));
+	group.deps->pending_tasks.back()->suspendable = true;
+}
+
+TaskGroupHandle ThreadGroup::create_suspendable_task(std::function<void()> func)
+{
+	auto group = create_task(move(func));
+	group->deps->pending_tasks.back()->suspendable = true;
+	return group;
+}
+
+void TaskGroup::enqueue_suspendable_task(std::function<void()> func)
+{
+	group->enqueue_suspendable_task(*this, move(func));
+}
+
 void ThreadGroup::wait_idle()
 {
 	unique_lock<mutex> holder{wait_cond_lock};
@@ -319,33 +778,89 @@ bool ThreadGroup::is_idle()
 void ThreadGroup::thread_looper(unsigned index)
 {
 	Util::register_thread_index(index);
+	current_worker_group = this;
+	current_worker_index = index - 1;
+
+	auto &self_queue = *worker_queues[index - 1];
+	bool high_priority_only = self_queue.end_priority == unsigned(TaskPriority::High) + 1;
+	bool low_priority_only = self_queue.first_priority != 0;
+	auto &sleep_cond = high_priority_only ? high_priority_cond : (low_priority_only ? low_priority_cond : cond);
+
+	// Number of queued tasks this worker is allowed to run.
+	// The subtraction can be transiently off, which only leads to another spin through the loop.
+	auto get_queued_count = [&]() -> unsigned {
+		if (high_priority_only)
+			return queued_high_priority_tasks.load(memory_order_seq_cst);
+		else if (low_priority_only)
+			return queued_tasks.load(memory_order_seq_cst) - queued_high_priority_tasks.load(memory_order_seq_cst);
+		else
+			return queued_tasks.load(memory_order_seq_cst);
+	};
 
 	for (;;)
 	{
-		Internal::Task *task = nullptr;
+		Internal::Task *task = pop_resumable_task(index - 1);
+		if (!task)
+			task = pop_ready_task(index - 1, self_queue.first_priority, self_queue.end_priority);
 
+		if (!task)
 		{
 			unique_lock<mutex> holder{cond_lock};
-			cond.wait(holder, [&]() {
-				return dead || !ready_tasks.empty();
+			sleeping_threads.fetch_add(1, memory_order_seq_cst);
+			sleep_cond.wait(holder, [&]() {
+				return dead || get_queued_count() != 0 ||
+				       self_queue.resumable_count.load(memory_order_seq_cst) != 0;
 			});
+			sleeping_threads.fetch_sub(1, memory_order_relaxed);
 
-			if (dead && ready_tasks.empty())
+			if (dead && get_queued_count() == 0)
 				break;
 
-			task = ready_tasks.front();
-			ready_tasks.pop();
+			// Another worker may still win the race for the task, just go around again.
+			continue;
 		}
 
+		current_task_priority = task->deps->priority;
 		if (task->func)
 		{
 			Util::TimelineTraceFile::Event *e = nullptr;
 			if (*task->deps->desc != '\0' && timeline_trace_file)
 				e = timeline_trace_file->begin_event(task->deps->desc);
-			task->func();
+
+			bool record_statistics = *task->deps->desc != '\0' && task->ready_ns != 0 &&
+			                         task_statistics_enabled.load(memory_order_relaxed);
+			uint64_t start_ns = 0;
+			if (record_statistics)
+			{
+				start_ns = Util::get_current_time_nsecs();
+				// Resumed tasks only count the wait until they first started.
+				if (task->run_ns == 0)
+					task->wait_ns = start_ns - task->ready_ns;
+			}
+
+			bool completed = true;
+			if (task->suspendable)
+				completed = run_suspendable_task(index - 1, *task);
+			else
+				task->func();
+
 			if (e)
 				timeline_trace_file->end_event(e);
 
+			if (record_statistics)
+			{
+				task->run_ns += Util::get_current_time_nsecs() - start_ns;
+				if (completed)
+				{
+					self_queue.statistics.record(task->deps->desc_hash, task->deps->desc,
+					                             task->run_ns, task->wait_ns);
+				}
+			}
+
+			// The task will be resumed on this worker later.
+			if (!completed)
+				continue;
+
 			///
 			//if (*task->deps->desc != '\0')
 			//	LOGI("Running task: %s\n", task->deps->desc);
@@ -353,7 +868,7 @@ void ThreadGroup::thread_looper(unsigned index)
 		}
 
 		task->deps->task_completed();
-		task_pool.free(task);
+		free_task(task);
 
 		{
 			auto completed = completed_tasks.fetch_add(1, memory_order_relaxed) + 1;
@@ -366,6 +881,19 @@ void ThreadGroup::thread_looper(unsigned index)
 			}
 		}
 	}
+
+	for (auto *f : self_queue.fiber_pool)
+	{
+		auto *fiber = static_cast<Internal::Fiber *>(f);
+		co_delete(fiber->cothread);
+		delete fiber;
+	}
+	self_queue.fiber_pool.clear();
+
+	self_queue.task_cache.flush(task_pool);
+	self_queue.task_group_cache.flush(task_group_pool);
+	self_queue.task_deps_cache.flush(task_deps_pool);
+	current_worker_group = nullptr;
 }
 
 ThreadGroup::ThreadGroup()
@@ -375,6 +903,10 @@ ThreadGroup::ThreadGroup()
 #endif
 	total_tasks.store(0);
 	completed_tasks.store(0);
+	queued_tasks.store(0);
+	queued_high_priority_tasks.store(0);
+	sleeping_threads.store(0);
+	task_statistics_enabled.store(false);
 }
 
 ThreadGroup::~ThreadGroup()
@@ -393,6 +925,8 @@ void ThreadGroup::stop()
 		lock_guard<mutex> holder{cond_lock};
 		dead = true;
 		cond.notify_all();
+		high_priority_cond.notify_all();
+		low_priority_cond.notify_all();
 	}
 
 	for (auto &t : thread_group)
@@ -404,6 +938,7 @@ void ThreadGroup::stop()
 		}
 	}
 
+	worker_queues.clear();
 	active = false;
 	dead = false;
 }
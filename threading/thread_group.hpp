@@ -27,6 +27,7 @@
 #include <thread>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <future>
 #include <memory>
 #include <functional>
@@ -36,18 +37,38 @@
 #include "timeline_trace_file.hpp"
 #include "global_managers.hpp"
 #include "small_vector.hpp"
+#include "task_statistics.hpp"
 
 namespace Granite
 {
 class ThreadGroup;
 
+enum class TaskPriority : unsigned
+{
+	// Work on the critical path of a frame, e.g. visibility, render graph recording.
+	High = 0,
+	Normal = 1,
+	// Streaming, decoding, shader compilation and other work which can be delayed.
+	Background = 2,
+	Count
+};
+
+namespace Internal
+{
+struct Task;
+}
+
 struct TaskSignal
 {
 	std::condition_variable cond;
 	std::mutex lock;
 	uint64_t counter = 0;
 
+	// Suspendable tasks waiting for the counter to reach a value.
+	Util::SmallVector<std::pair<Internal::Task *, uint64_t>> suspended_tasks;
+
 	void signal_increment();
+	// If called from a suspendable task, the task yields to the worker instead of blocking it.
 	void wait_until_at_least(uint64_t count);
 };
 
@@ -55,7 +76,6 @@ struct TaskGroup;
 namespace Internal
 {
 struct TaskDeps;
-struct Task;
 
 struct TaskDepsDeleter
 {
@@ -85,6 +105,7 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 	Util::SmallVector<Task *> pending_tasks;
 	TaskSignal *signal = nullptr;
 	std::atomic_uint dependency_count;
+	TaskPriority priority = TaskPriority::Normal;
 
 	void task_completed();
 	void dependency_satisfied();
@@ -93,8 +114,10 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 	std::condition_variable cond;
 	std::mutex cond_lock;
 	bool done = false;
+	Util::SmallVector<Task *> suspended_tasks;
 
 	char desc[64];
+	Util::Hash desc_hash = 0;
 };
 using TaskDepsHandle = Util::IntrusivePtr<TaskDeps>;
 
@@ -109,6 +132,16 @@ struct Task
 
 	TaskDepsHandle deps;
 	std::function<void ()> func;
+
+	// Suspendable tasks run on their own cooperative thread and are pinned to a worker once started.
+	bool suspendable = false;
+	void *fiber = nullptr;
+	unsigned worker_index = 0;
+
+	// Only used when task statistics are enabled.
+	uint64_t ready_ns = 0;
+	uint64_t wait_ns = 0;
+	uint64_t run_ns = 0;
 };
 }
 
@@ -117,6 +150,7 @@ struct TaskGroup : Util::IntrusivePtrEnabled<TaskGroup, Internal::TaskGroupDelet
 	explicit TaskGroup(ThreadGroup *group);
 	~TaskGroup();
 	void flush();
+	// If called from a suspendable task, the task yields to the worker instead of blocking it.
 	void wait();
 
 	void add_flush_dependency();
@@ -125,11 +159,16 @@ struct TaskGroup : Util::IntrusivePtrEnabled<TaskGroup, Internal::TaskGroupDelet
 	ThreadGroup *group;
 	Internal::TaskDepsHandle deps;
 	void enqueue_task(std::function<void ()> func);
+	void enqueue_suspendable_task(std::function<void ()> func);
 	void set_fence_counter_signal(TaskSignal *signal);
 	ThreadGroup *get_thread_group() const;
 
 	void set_desc(const char *desc);
 
+	// Unless set explicitly, a task group inherits the priority of the task which creates it.
+	void set_priority(TaskPriority priority);
+	TaskPriority get_priority() const;
+
 	unsigned id = 0;
 	bool flushed = false;
 };
@@ -146,6 +185,19 @@ public:
 
 	void start(unsigned num_threads, const std::function<void ()> &on_thread_begin) override;
 
+	// The first count workers will only execute TaskPriority::High work.
+	// Must be called before start().
+	void set_num_high_priority_only_threads(unsigned count);
+
+	// Pins workers to logical processors, performance cores first.
+	// On hybrid CPUs, workers on efficiency cores never execute TaskPriority::High work.
+	// Can also be enabled with GRANITE_THREAD_AFFINITY=1. Must be called before start().
+	void set_topology_aware_placement(bool enable);
+
+	// Workers allocate task objects from thread local caches by default.
+	// Disabling this is mostly useful for benchmarking. Must be called before start().
+	void set_thread_local_allocation(bool enable);
+
 	unsigned get_num_threads() const
 	{
 		return unsigned(thread_group.size());
@@ -157,7 +209,16 @@ public:
 	TaskGroupHandle create_task(std::function<void ()> func);
 	TaskGroupHandle create_task();
 
+	// Suspendable tasks can call TaskGroup::wait() and TaskSignal::wait_until_at_least()
+	// without occupying a worker thread while waiting.
+	void enqueue_suspendable_task(TaskGroup &group, std::function<void ()> func);
+	TaskGroupHandle create_suspendable_task(std::function<void ()> func);
+	static bool current_task_is_suspendable();
+	// True when called from one of the worker threads of any ThreadGroup.
+	static bool current_thread_is_worker();
+
 	void move_to_ready_tasks(const Util::SmallVector<Internal::Task *> &list);
+	void resume_suspended_task(Internal::Task *task);
 
 	void add_dependency(TaskGroup &dependee, TaskGroup &dependency);
 
@@ -168,6 +229,13 @@ public:
 	void wait_idle();
 	bool is_idle();
 
+	// Statistics are recorded per task group description, see TaskGroup::set_desc().
+	// Can also be enabled with GRANITE_TASK_STATISTICS=1.
+	void set_task_statistics_enabled(bool enable);
+	bool get_task_statistics_enabled() const;
+	// Gathers statistics since the last reset. Calling this with reset once per frame gives per-frame statistics.
+	void get_task_statistics(std::vector<TaskStatistics> &stats, bool reset);
+
 	Util::TimelineTraceFile *get_timeline_trace_file();
 	void refresh_global_timeline_trace_file();
 
@@ -178,13 +246,62 @@ private:
 	Util::ThreadSafeObjectPool<TaskGroup> task_group_pool;
 	Util::ThreadSafeObjectPool<Internal::TaskDeps> task_deps_pool;
 
-	std::queue<Internal::Task *> ready_tasks;
+	enum { NumPriorities = unsigned(TaskPriority::Count) };
+
+	// Tasks which are made ready from threads outside the thread group are injected here.
+	std::queue<Internal::Task *> ready_tasks[NumPriorities];
+	std::mutex ready_tasks_lock;
+
+	// Each worker owns a deque. The owner pushes and pops at the back, other workers steal from the front.
+	struct alignas(64) WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<Internal::Task *> tasks[NumPriorities];
+
+		// Suspended tasks which are ready to continue. These can only be resumed by the owning worker.
+		std::vector<Internal::Task *> resumable;
+		std::atomic_uint resumable_count{0};
+
+		// Range of priorities this worker may execute.
+		unsigned first_priority = 0;
+		unsigned end_priority = NumPriorities;
+		int cpu_index = -1;
+
+		// Only accessed by the owning worker.
+		std::vector<void *> fiber_pool;
+		Util::ThreadLocalObjectPoolCache<Internal::Task> task_cache;
+		Util::ThreadLocalObjectPoolCache<TaskGroup> task_group_cache;
+		Util::ThreadLocalObjectPoolCache<Internal::TaskDeps> task_deps_cache;
+
+		TaskStatisticsAccumulator statistics;
+	};
+	std::vector<std::unique_ptr<WorkerQueue>> worker_queues;
 
 	std::vector<std::unique_ptr<std::thread>> thread_group;
 	std::mutex cond_lock;
 	std::condition_variable cond;
+	std::condition_variable high_priority_cond;
+	std::condition_variable low_priority_cond;
+	std::atomic_uint queued_tasks;
+	std::atomic_uint queued_high_priority_tasks;
+	std::atomic_uint sleeping_threads;
+	unsigned num_high_priority_only_threads = 0;
+	bool thread_local_allocation = true;
+	bool topology_aware_placement = false;
+	std::atomic_bool task_statistics_enabled;
+	void assign_worker_placement();
+
+	WorkerQueue *get_current_allocation_cache();
+	Internal::Task *allocate_task(Internal::TaskDepsHandle deps, std::function<void ()> func);
+	void free_task(Internal::Task *task);
+	TaskGroupHandle allocate_task_group();
 
 	void thread_looper(unsigned self_index);
+	Internal::Task *pop_ready_task(unsigned self_index, unsigned first_priority, unsigned end_priority);
+	Internal::Task *pop_ready_task(unsigned self_index, TaskPriority priority);
+	Internal::Task *pop_resumable_task(unsigned self_index);
+	bool run_suspendable_task(unsigned self_index, Internal::Task &task);
+	void wake_threads(size_t count, TaskPriority priority);
 
 	bool active = false;
 	bool dead = false;
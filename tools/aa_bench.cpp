@@ -5,15 +5,26 @@
 #include "post/temporal.hpp"
 #include "post/hdr.hpp"
 #include "task_composer.hpp"
+#include "filesystem.hpp"
+#include <algorithm>
 
 using namespace Util;
 using namespace Granite;
 using namespace Vulkan;
 
+// Throughput mode runs every AA method back to back and writes per pass GPU time as CSV.
+struct ThroughputOptions
+{
+	std::string csv_path;
+	unsigned warm_frames = 16;
+	unsigned measure_frames = 64;
+};
+
 class AABenchApplication : public Application, public EventHandler
 {
 public:
-	AABenchApplication(const std::string &input0, const std::string &input1, const char *method, float scale);
+	AABenchApplication(const std::string &input0, const std::string &input1, const char *method, float scale,
+	                   const ThroughputOptions &throughput);
 	void render_frame(double, double) override;
 
 private:
@@ -31,12 +42,43 @@ private:
 	TemporalJitter jitter;
 	bool need_main_pass = false;
 	unsigned input_index = 0;
+
+	ResourceDimensions swapchain_dim;
+	void bake_graph();
+
+	ThroughputOptions throughput;
+	unsigned throughput_method = 0;
+	unsigned throughput_frame = 0;
+	std::string throughput_csv;
+	void step_throughput();
+};
+
+static const PostAAType throughput_methods[] = {
+	PostAAType::None,
+	PostAAType::FXAA,
+	PostAAType::FXAA_2Phase,
+	PostAAType::SMAA_Low,
+	PostAAType::SMAA_Medium,
+	PostAAType::SMAA_High,
+	PostAAType::SMAA_Ultra,
+	PostAAType::SMAA_Ultra_T2X,
+	PostAAType::TAA_Low,
+	PostAAType::TAA_Medium,
+	PostAAType::TAA_High,
+	PostAAType::TAA_Upscale,
 };
 
-AABenchApplication::AABenchApplication(const std::string &input0, const std::string &input1, const char *method, float scale_)
-	: input_path0(input0), input_path1(input1), scale(scale_)
+AABenchApplication::AABenchApplication(const std::string &input0, const std::string &input1, const char *method, float scale_,
+                                       const ThroughputOptions &throughput_)
+	: input_path0(input0), input_path1(input1), scale(scale_), throughput(throughput_)
 {
-	type = string_to_post_antialiasing_type(method);
+	if (throughput.csv_path.empty())
+		type = string_to_post_antialiasing_type(method);
+	else
+	{
+		type = throughput_methods[0];
+		throughput_csv = "width,height,scale,method,pass,gpu_time_ms\n";
+	}
 
 	EVENT_MANAGER_REGISTER_LATCH(AABenchApplication, on_swapchain_changed, on_swapchain_destroyed, SwapchainParameterEvent);
 	EVENT_MANAGER_REGISTER_LATCH(AABenchApplication, on_device_created, on_device_destroyed, DeviceCreatedEvent);
@@ -53,25 +95,89 @@ void AABenchApplication::render_frame(double, double)
 	graph.enqueue_render_passes(device, composer);
 	composer.get_outgoing_task()->wait();
 	//need_main_pass = false;
+
+	if (!throughput.csv_path.empty())
+		step_throughput();
+}
+
+void AABenchApplication::step_throughput()
+{
+	auto &device = get_wsi().get_device();
+	throughput_frame++;
+
+	// Timestamps resolve a few frames late, drain the queue so the window only holds this method.
+	if (throughput_frame == throughput.warm_frames)
+	{
+		device.wait_idle();
+		device.timestamp_log_reset();
+	}
+
+	if (throughput_frame < throughput.warm_frames + throughput.measure_frames)
+		return;
+
+	device.wait_idle();
+	double total_ms = 0.0;
+	char line[512];
+	device.timestamp_log([&](const std::string &tag, const TimestampIntervalReport &report) {
+		// Merged physical passes are tagged as "a + b".
+		auto end = tag.find(" + ");
+		if (!graph.find_pass(end == std::string::npos ? tag : tag.substr(0, end)))
+			return;
+
+		double ms = 1000.0 * report.time_per_frame_context;
+		total_ms += ms;
+		snprintf(line, sizeof(line), "%u,%u,%.3f,%s,%s,%.6f\n",
+		         swapchain_dim.width, swapchain_dim.height, scale,
+		         post_antialiasing_type_to_string(type), tag.c_str(), ms);
+		throughput_csv += line;
+	});
+	device.timestamp_log_reset();
+
+	snprintf(line, sizeof(line), "%u,%u,%.3f,%s,total,%.6f\n",
+	         swapchain_dim.width, swapchain_dim.height, scale,
+	         post_antialiasing_type_to_string(type), total_ms);
+	throughput_csv += line;
+	LOGI("AA method %s: %.3f ms GPU time.\n", post_antialiasing_type_to_string(type), total_ms);
+
+	throughput_frame = 0;
+	if (++throughput_method < sizeof(throughput_methods) / sizeof(throughput_methods[0]))
+	{
+		type = throughput_methods[throughput_method];
+		bake_graph();
+	}
+	else
+	{
+		if (!GRANITE_FILESYSTEM()->write_string_to_file(throughput.csv_path, throughput_csv))
+			LOGE("Failed to write throughput results to %s.\n", throughput.csv_path.c_str());
+		request_shutdown();
+	}
 }
 
 void AABenchApplication::on_swapchain_changed(const SwapchainParameterEvent &swap)
 {
+	swapchain_dim = {};
+	swapchain_dim.width = swap.get_width();
+	swapchain_dim.height = swap.get_height();
+	swapchain_dim.format = swap.get_format();
+	swapchain_dim.transform = swap.get_prerotate();
+	bake_graph();
+}
+
+void AABenchApplication::bake_graph()
+{
+	auto &device = get_wsi().get_device();
+	if (graph.find_pass("main"))
+		device.wait_idle();
+
 	graph.reset();
 	ImplementationQuirks::get().use_async_compute_post = false;
 	ImplementationQuirks::get().render_graph_force_single_queue = true;
-
-	ResourceDimensions dim;
-	dim.width = swap.get_width();
-	dim.height = swap.get_height();
-	dim.format = swap.get_format();
-	dim.transform = swap.get_prerotate();
-	graph.set_backbuffer_dimensions(dim);
+	graph.set_backbuffer_dimensions(swapchain_dim);
 
 	AttachmentInfo main_output;
 	main_output.format = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
 	AttachmentInfo main_depth;
-	main_depth.format = swap.get_device().get_default_depth_format();
+	main_depth.format = device.get_default_depth_format();
 
 	main_output.size_x = scale;
 	main_output.size_y = scale;
@@ -177,6 +283,7 @@ Application *application_create(int argc, char **argv)
 	std::string input_image0;
 	std::string input_image1;
 	float scale = 1.0f;
+	ThroughputOptions throughput;
 
 #ifdef ANDROID
 	input_image0 = "assets://image0.png";
@@ -187,6 +294,9 @@ Application *application_create(int argc, char **argv)
 	cbs.add("--aa-method", [&](CLIParser &parser) { aa_method = parser.next_string(); });
 	cbs.add("--input-images", [&](CLIParser &parser) { input_image0 = parser.next_string(); input_image1 = parser.next_string(); });
 	cbs.add("--scale", [&](CLIParser &parser) { scale = float(parser.next_double()); });
+	cbs.add("--throughput", [&](CLIParser &parser) { throughput.csv_path = parser.next_string(); });
+	cbs.add("--warm-frames", [&](CLIParser &parser) { throughput.warm_frames = std::max(parser.next_uint(), 1u); });
+	cbs.add("--measure-frames", [&](CLIParser &parser) { throughput.measure_frames = parser.next_uint(); });
 
 	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
 	if (!parser.parse())
@@ -194,7 +304,7 @@ Application *application_create(int argc, char **argv)
 
 	try
 	{
-		auto *app = new AABenchApplication(input_image0, input_image1, aa_method, scale);
+		auto *app = new AABenchApplication(input_image0, input_image1, aa_method, scale, throughput);
 		return app;
 	}
 	catch (const std::exception &e)
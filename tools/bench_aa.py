@@ -49,6 +49,23 @@ def run_test(sweep, method, iterations, stat_file, adb):
     avg_bw_write = 0.0 if len(bandwidth_write) == 0 else statistics.mean(bandwidth_write)
     return avg, stddev, gpu, version, avg_gpu_cycles, avg_bw_read, avg_bw_write
 
+def run_throughput(base_sweep, resolutions, csv_file, adb):
+    lines = []
+    for res in resolutions:
+        width, height = res.split('x')
+        sweep = base_sweep + ['--width', width, '--height', height]
+        print('Running AA throughput at {}x{} ...'.format(width, height))
+        subprocess.check_call(sweep)
+
+        if adb:
+            subprocess.check_call(['adb', 'pull', '/data/local/tmp/granite/throughput.csv', csv_file])
+
+        with open(csv_file, 'r') as f:
+            res_lines = f.readlines()
+            # Keep the header from the first run only.
+            lines += res_lines if len(lines) == 0 else res_lines[1:]
+    return lines
+
 def map_result_to_json(result, width, height, gpu, version):
     return { 'method': result[0], 'avg': result[1], 'stdev': result[2], 'width': width, 'height': height, 'gpu': gpu, 'version': version,
             'gpuCycles': result[3], 'bandwidthRead': result[4], 'bandwidthWrite': result[5] }
@@ -86,6 +103,18 @@ def main():
     parser.add_argument('--hw-counter-lib',
                         help = 'Helper library for HW counters',
                         type = str)
+    parser.add_argument('--throughput',
+                        help = 'Run every AA method in one process and store GPU time per pass as CSV',
+                        type = str)
+    parser.add_argument('--resolutions',
+                        help = 'Resolutions to sweep in throughput mode, e.g. 1920x1080',
+                        nargs = '+')
+    parser.add_argument('--warm-frames',
+                        help = 'Frames to run per method before measuring in throughput mode',
+                        type = int)
+    parser.add_argument('--measure-frames',
+                        help = 'Frames to measure per method in throughput mode',
+                        type = int)
 
     args = parser.parse_args()
 
@@ -120,6 +149,43 @@ def main():
 
         subprocess.check_call(['adb', 'push', args.builtin, '/data/local/tmp/granite/'])
 
+    if args.throughput is not None:
+        if args.resolutions is None:
+            sys.stderr.write('Need --resolutions for throughput mode.\n')
+            sys.exit(1)
+
+        warm_frames = args.warm_frames if args.warm_frames is not None else 16
+        measure_frames = args.measure_frames if args.measure_frames is not None else 64
+        # The application shuts down by itself once every method is measured.
+        frames = str(16 * (warm_frames + measure_frames) + 1)
+        bench_args = ['--frames', frames,
+                      '--warm-frames', str(warm_frames), '--measure-frames', str(measure_frames)]
+
+        if args.android_binary is not None:
+            base_sweep = ['adb', 'shell', '/data/local/tmp/granite/aa-bench-headless'] + bench_args + [
+                          '--input-images', '/data/local/tmp/granite/image0.png', '/data/local/tmp/granite/image1.png',
+                          '--throughput', '/data/local/tmp/granite/throughput.csv',
+                          '--fs-builtin /data/local/tmp/granite/assets',
+                          '--fs-assets /data/local/tmp/granite/assets',
+                          '--fs-cache /data/local/tmp/granite/cache']
+            f, csv_file = tempfile.mkstemp()
+            os.close(f)
+        else:
+            binary = args.binary if args.binary is not None else './tools/aa-bench-headless'
+            f, csv_file = tempfile.mkstemp()
+            os.close(f)
+            base_sweep = [binary] + bench_args + ['--input-images', sweep_image0, sweep_image1,
+                                                  '--throughput', csv_file]
+
+        lines = run_throughput(base_sweep, args.resolutions, csv_file, args.android_binary is not None)
+        os.remove(csv_file)
+        with open(args.throughput, 'w') as f:
+            f.writelines(lines)
+
+        if args.cleanup and args.android_binary is not None:
+            subprocess.check_call(['adb', 'shell', 'rm', '-r', '/data/local/tmp/granite'])
+        return
+
     f, stat_file = tempfile.mkstemp()
     f_c, config_file = tempfile.mkstemp()
     os.close(f)
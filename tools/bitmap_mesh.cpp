@@ -38,10 +38,12 @@ static void print_help()
 	     "\t[--input <path>]\n"
 	     "\t[--output <path>]\n"
 	     "\t[--quantize-attributes]\n"
+	     "\t[--compress-geometry]\n"
 	     "\t[--compute-center-of-mass]\n"
 	     "\t[--fixed-center-of-mass x y z]\n"
 	     "\t[--scale x y z]\n"
 	     "\t[--no-depth]\n"
+	     "\t[--no-greedy]\n"
 	     "\t[--flip-winding]\n"
 	     "\t[--node-translate x y z]\n"
 	     "\t[--node-rotate axisX axisY axisZ degrees]\n"
@@ -90,6 +92,7 @@ int main(int argc, char **argv)
 	bool flip_winding = false;
 	bool compute_center_of_mass = false;
 	bool quantize_attributes = false;
+	bool compress_geometry = false;
 	vec3 center_of_mass = vec3(0.0f);
 	SceneFormats::NodeTransform static_transform;
 
@@ -98,8 +101,10 @@ int main(int argc, char **argv)
 	cbs.add("--output", [&](CLIParser &parser) { output = parser.next_string(); });
 	cbs.add("--flip-winding", [&](CLIParser &) { flip_winding = true; });
 	cbs.add("--no-depth", [&](CLIParser &) { options.depth = false; });
+	cbs.add("--no-greedy", [&](CLIParser &) { options.greedy = false; });
 	cbs.add("--compute-center-of-mass", [&](CLIParser &) { compute_center_of_mass = true; });
 	cbs.add("--quantize-attributes", [&](CLIParser &) { quantize_attributes = true; });
+	cbs.add("--compress-geometry", [&](CLIParser &) { quantize_attributes = true; compress_geometry = true; });
 	cbs.add("--fixed-center-of-mass", [&](CLIParser &parser) {
 		for (unsigned i = 0; i < 3; i++)
 			center_of_mass[i] = float(parser.next_double());
@@ -272,6 +277,7 @@ int main(int argc, char **argv)
 	scene.meshes = { &m, 1 };
 	scene.nodes = { &n, 1 };
 	export_options.quantize_attributes = quantize_attributes;
+	export_options.compress_geometry = compress_geometry;
 	export_options.optimize_meshes = true;
 	if (!SceneFormats::export_scene_to_glb(scene, output, export_options))
 	{
@@ -24,6 +24,8 @@
 #include "muglm/muglm_impl.hpp"
 #include "meshoptimizer.h"
 #include "hash.hpp"
+#include "thread_group.hpp"
+#include "global_managers.hpp"
 #include <assert.h>
 #include <list>
 #include <algorithm>
@@ -47,7 +49,6 @@ public:
 		: width(width_), height(height_)
 	{
 		state_bitmap.resize(width * height);
-		state_nodes.resize(width * height);
 		for (auto &b : state_bitmap)
 			b = PixelState::Empty;
 	}
@@ -127,6 +128,9 @@ public:
 
 	void add_pending(unsigned x, unsigned y)
 	{
+		// Only the mipmapped search tracks pending pixels, greedy meshing writes the states directly.
+		if (state_nodes.empty())
+			state_nodes.resize(width * height);
 		auto itr = pending_pixels.insert(pending_pixels.begin(), uvec2(x, y));
 		state_nodes[y * width + x] = itr;
 		assert(at(x, y) != PixelState::Pending);
@@ -298,56 +302,97 @@ static ClaimedRect find_largest_pending_rect(StateBitmap &state, unsigned x, uns
 	return find_largest_pending_rect_backwards(state, rect);
 }
 
-static bool horizontal_overlap(const ClaimedRect &a, const ClaimedRect &b)
+template <typename Func>
+static void run_parallel(const char *desc, unsigned count, const Func &func)
 {
-	if (a.x + a.w <= b.x)
-		return false;
-	if (b.x + b.w <= a.x)
-		return false;
+	auto *group = GRANITE_THREAD_GROUP();
+	if (!group || count <= 1 || ThreadGroup::current_thread_is_worker())
+	{
+		for (unsigned i = 0; i < count; i++)
+			func(i);
+		return;
+	}
 
-	return true;
+	auto task = group->create_task();
+	task->set_desc(desc);
+	for (unsigned i = 0; i < count; i++)
+		task->enqueue_task([&func, i]() { func(i); });
+	task->wait();
 }
 
-static bool vertical_overlap(const ClaimedRect &a, const ClaimedRect &b)
+// Classic greedy meshing: take the longest pending run in a row, then grow it downwards
+// while the rows below have the same run pending. Rects never cross the band, so bands
+// can be meshed concurrently.
+static void claim_greedy_rects(StateBitmap &state, unsigned y_begin, unsigned y_end, vector<ClaimedRect> &rects)
 {
-	if (a.y + a.h <= b.y)
-		return false;
-	if (b.y + b.h <= a.y)
-		return false;
+	unsigned width = state.get_width();
+	for (unsigned y = y_begin; y < y_end; y++)
+	{
+		unsigned x = 0;
+		while (x < width)
+		{
+			if (state.at(x, y) != PixelState::Pending)
+			{
+				x++;
+				continue;
+			}
 
-	return true;
-}
+			ClaimedRect rect;
+			rect.x = x;
+			rect.y = y;
+			rect.w = 1;
+			rect.h = 1;
 
-static bool is_north_neighbor(const ClaimedRect &a, const ClaimedRect &b)
-{
-	// Check for overlap on north edge.
-	if (b.y + b.h != a.y)
-		return false;
-	return horizontal_overlap(a, b);
-}
+			while (rect.x + rect.w < width && state.at(rect.x + rect.w, y) == PixelState::Pending)
+				rect.w++;
 
-static bool is_east_neighbor(const ClaimedRect &a, const ClaimedRect &b)
-{
-	// Check for overlap on east edge.
-	if (a.x + a.w != b.x)
-		return false;
-	return vertical_overlap(a, b);
+			while (rect.y + rect.h < y_end)
+			{
+				unsigned row = rect.y + rect.h;
+				bool full_row = true;
+				for (unsigned i = rect.x; i < rect.x + rect.w && full_row; i++)
+					full_row = state.at(i, row) == PixelState::Pending;
+				if (!full_row)
+					break;
+				rect.h++;
+			}
+
+			for (unsigned j = rect.y; j < rect.y + rect.h; j++)
+				for (unsigned i = rect.x; i < rect.x + rect.w; i++)
+					state.at(i, j) = PixelState::Claimed;
+
+			x += rect.w;
+			rects.push_back(rect);
+		}
+	}
 }
 
-static bool is_south_neighbor(const ClaimedRect &a, const ClaimedRect &b)
+static void add_neighbor(vector<unsigned> &neighbors, unsigned self, unsigned owner)
 {
-	// Check for overlap on south edge.
-	if (a.y + a.h != b.y)
-		return false;
-	return horizontal_overlap(a, b);
+	// Each pair of rects is only linked up once, from the rect with the lower index.
+	// A rect covers a contiguous span of any row or column, so owners never repeat after changing.
+	if (owner != ~0u && owner > self && (neighbors.empty() || neighbors.back() != owner))
+		neighbors.push_back(owner);
 }
 
-static bool is_west_neighbor(const ClaimedRect &a, const ClaimedRect &b)
+static void find_neighbors(ClaimedRect &rect, unsigned index, const vector<unsigned> &owners,
+                           unsigned width, unsigned height)
 {
-	// Check for overlap on west edge.
-	if (b.x + b.w != a.x)
-		return false;
-	return vertical_overlap(a, b);
+	if (rect.y > 0)
+		for (unsigned x = rect.x; x < rect.x + rect.w; x++)
+			add_neighbor(rect.north_neighbors, index, owners[(rect.y - 1) * width + x]);
+
+	if (rect.y + rect.h < height)
+		for (unsigned x = rect.x; x < rect.x + rect.w; x++)
+			add_neighbor(rect.south_neighbors, index, owners[(rect.y + rect.h) * width + x]);
+
+	if (rect.x > 0)
+		for (unsigned y = rect.y; y < rect.y + rect.h; y++)
+			add_neighbor(rect.west_neighbors, index, owners[y * width + rect.x - 1]);
+
+	if (rect.x + rect.w < width)
+		for (unsigned y = rect.y; y < rect.y + rect.h; y++)
+			add_neighbor(rect.east_neighbors, index, owners[y * width + rect.x + rect.w]);
 }
 
 static bool is_degenerate(const vec2 &a, const vec2 &b, const vec2 &c)
@@ -706,9 +751,33 @@ bool voxelize_bitmap(VoxelizedBitmap &bitmap, const uint8_t *components, unsigne
 {
 	bitmap = {};
 
-	vector<StateBitmap> state_mipmap;
+	vector<ClaimedRect> rects;
+	StateBitmap state(width, height);
+
+	if (options.greedy)
+	{
+		// Rects are cut at band edges, so don't go finer than we need to keep the workers busy.
+		auto *group = GRANITE_THREAD_GROUP();
+		unsigned num_threads = group ? std::max(group->get_num_threads(), 1u) : 1u;
+		unsigned band_height = std::max(64u, (height + num_threads - 1) / num_threads);
+		unsigned num_bands = (height + band_height - 1) / band_height;
+		vector<vector<ClaimedRect>> band_rects(num_bands);
+
+		run_parallel("bitmap-mesh-greedy", num_bands, [&](unsigned band) {
+			unsigned y_begin = band * band_height;
+			unsigned y_end = std::min(y_begin + band_height, height);
+			for (unsigned y = y_begin; y < y_end; y++)
+				for (unsigned x = 0; x < width; x++)
+					if (components[component + pixel_stride * x + y * row_stride] >= 128)
+						state.at(x, y) = PixelState::Pending;
+			claim_greedy_rects(state, y_begin, y_end, band_rects[band]);
+		});
+
+		for (auto &band : band_rects)
+			rects.insert(end(rects), begin(band), end(band));
+	}
+	else
 	{
-		StateBitmap state(width, height);
 		for (unsigned y = 0; y < height; y++)
 		{
 			for (unsigned x = 0; x < width; x++)
@@ -718,63 +787,63 @@ bool voxelize_bitmap(VoxelizedBitmap &bitmap, const uint8_t *components, unsigne
 					state.add_pending(x, y);
 			}
 		}
-		state_mipmap.push_back(std::move(state));
-	}
 
-	while (state_mipmap.back().get_width() > 1 || state_mipmap.back().get_height() > 1)
-		state_mipmap.push_back(state_mipmap.back().promote_2x2_quads());
+		// Level N of the mipmap is at state_mipmap[N - 1].
+		vector<StateBitmap> state_mipmap;
+		if (width > 1 || height > 1)
+			state_mipmap.push_back(state.promote_2x2_quads());
+		while (!state_mipmap.empty() && (state_mipmap.back().get_width() > 1 || state_mipmap.back().get_height() > 1))
+			state_mipmap.push_back(state_mipmap.back().promote_2x2_quads());
 
-	// Move frontier checks for larger mipmaps first.
-	for (size_t level = 1; level < state_mipmap.size(); level++)
-	{
-		uvec2 coord;
-		while (state_mipmap[level].get_next_pending(coord))
+		// Move frontier checks for larger mipmaps first.
+		for (size_t level = 1; level <= state_mipmap.size(); level++)
 		{
-			unsigned coord_x = coord.x << level;
-			unsigned coord_y = coord.y << level;
-			unsigned rect_size_x = std::min(1u << level, state_mipmap.front().get_width() - coord_x);
-			unsigned rect_size_y = std::min(1u << level, state_mipmap.front().get_height() - coord_y);
-			for (unsigned y = 0; y < rect_size_y; y++)
-				for (unsigned x = 0; x < rect_size_x; x++)
-					if (x != 0 || y != 0)
-						state_mipmap.front().add_pending(coord_x + x, coord_y + y);
-
-			// Make sure original coordinate is pushed last (first in list).
-			state_mipmap.front().add_pending(coord_x, coord_y);
-			state_mipmap[level].pop_next_pending();
+			uvec2 coord;
+			while (state_mipmap[level - 1].get_next_pending(coord))
+			{
+				unsigned coord_x = coord.x << level;
+				unsigned coord_y = coord.y << level;
+				unsigned rect_size_x = std::min(1u << level, state.get_width() - coord_x);
+				unsigned rect_size_y = std::min(1u << level, state.get_height() - coord_y);
+				for (unsigned y = 0; y < rect_size_y; y++)
+					for (unsigned x = 0; x < rect_size_x; x++)
+						if (x != 0 || y != 0)
+							state.add_pending(coord_x + x, coord_y + y);
+
+				// Make sure original coordinate is pushed last (first in list).
+				state.add_pending(coord_x, coord_y);
+				state_mipmap[level - 1].pop_next_pending();
+			}
 		}
-	}
 
-	// Create all rects which the bitmap is made of.
-	vector<ClaimedRect> rects;
-
-	uvec2 coord;
-	auto &state = state_mipmap.front();
-	while (state.get_next_pending(coord))
-	{
-		ClaimedRect rect = find_largest_pending_rect(state, coord.x, coord.y);
-		state.claim_rect(rect.x, rect.y, rect.w, rect.h);
-		rects.push_back(rect);
+		// Create all rects which the bitmap is made of.
+		uvec2 coord;
+		while (state.get_next_pending(coord))
+		{
+			ClaimedRect rect = find_largest_pending_rect(state, coord.x, coord.y);
+			state.claim_rect(rect.x, rect.y, rect.w, rect.h);
+			rects.push_back(rect);
+		}
 	}
 
 	// Find all adjacent neighbors. We will need to emit degenerate triangles to get water-tight meshes.
-	// FIXME: Slow, O(n^2).
 	unsigned num_rects = rects.size();
+	vector<unsigned> owners(width * height, ~0u);
 	for (unsigned i = 0; i < num_rects; i++)
 	{
-		for (unsigned j = i + 1; j < num_rects; j++)
-		{
-			if (is_north_neighbor(rects[i], rects[j]))
-				rects[i].north_neighbors.push_back(j);
-			else if (is_east_neighbor(rects[i], rects[j]))
-				rects[i].east_neighbors.push_back(j);
-			else if (is_south_neighbor(rects[i], rects[j]))
-				rects[i].south_neighbors.push_back(j);
-			else if (is_west_neighbor(rects[i], rects[j]))
-				rects[i].west_neighbors.push_back(j);
-		}
+		auto &rect = rects[i];
+		for (unsigned y = rect.y; y < rect.y + rect.h; y++)
+			for (unsigned x = rect.x; x < rect.x + rect.w; x++)
+				owners[y * width + x] = i;
 	}
 
+	constexpr unsigned RectsPerTask = 4096;
+	run_parallel("bitmap-mesh-neighbors", (num_rects + RectsPerTask - 1) / RectsPerTask, [&](unsigned chunk) {
+		unsigned end_rect = std::min(num_rects, (chunk + 1) * RectsPerTask);
+		for (unsigned i = chunk * RectsPerTask; i < end_rect; i++)
+			find_neighbors(rects[i], i, owners, width, height);
+	});
+
 	vector<vec3> depth_link_position;
 	unsigned primary_rects = rects.size();
 
@@ -783,7 +852,7 @@ bool voxelize_bitmap(VoxelizedBitmap &bitmap, const uint8_t *components, unsigne
 	{
 		// rects[i] might be invalidated if rects changes, so move into a temporary.
 		auto r = move(rects[i]);
-		emit_depth_links(state_mipmap.front(), depth_link_position, r, rects);
+		emit_depth_links(state, depth_link_position, r, rects);
 		rects[i] = move(r);
 	}
 
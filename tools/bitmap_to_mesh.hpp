@@ -36,6 +36,9 @@ struct VoxelizedBitmap
 struct VoxelizeBitmapOptions
 {
 	bool depth = true;
+	// Greedy quad merging, meshed in parallel bands of rows.
+	// The slower mipmapped search can find larger rects for some bitmaps.
+	bool greedy = true;
 };
 
 bool voxelize_bitmap(VoxelizedBitmap &bitmap, const uint8_t *components, unsigned component, unsigned pixel_stride,
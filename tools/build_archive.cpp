@@ -0,0 +1,334 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "archive_filesystem.hpp"
+#include "os_filesystem.hpp"
+#include "path_utils.hpp"
+#include "cli_parser.hpp"
+#include "logging.hpp"
+#include "lz4.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+using namespace Granite;
+using namespace Util;
+
+static void print_help()
+{
+	LOGI("Usage: \n"
+	     "\t[--compress]\n"
+	     "\t--input <directory or file> <archive path> (can be repeated)\n"
+	     "\t--output <out.gpak>\n");
+}
+
+struct InputFile
+{
+	string source_path;
+	string archive_path;
+};
+
+struct PendingEntry
+{
+	string path;
+	Archive::Entry entry;
+	const InputFile *input;
+};
+
+static uint64_t align(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool collect_inputs(const string &source, const string &archive_base, vector<InputFile> &inputs)
+{
+	FileStat s;
+	OSFilesystem fs(".");
+	if (!fs.stat(source, s))
+	{
+		LOGE("Input %s does not exist.\n", source.c_str());
+		return false;
+	}
+
+	if (s.type == PathType::File)
+	{
+		inputs.push_back({ source, Path::canonicalize_path(archive_base) });
+		return true;
+	}
+
+	OSFilesystem dir(source);
+	for (auto &entry : dir.walk(""))
+		if (entry.type == PathType::File)
+			inputs.push_back({ Path::join(source, entry.path), Path::canonicalize_path(Path::join(archive_base, entry.path)) });
+	return true;
+}
+
+static bool read_file(OSFilesystem &fs, const string &path, vector<uint8_t> &data)
+{
+	auto file = fs.open(path, FileMode::ReadOnly);
+	if (!file)
+		return false;
+
+	data.resize(file->get_size());
+	if (data.empty())
+		return true;
+
+	auto *mapped = file->map();
+	if (!mapped)
+		return false;
+	memcpy(data.data(), mapped, data.size());
+	return true;
+}
+
+static bool write_padded(FILE *file, const void *data, size_t size, uint64_t &offset)
+{
+	static const uint8_t zero[Archive::DataAlignment] = {};
+	if (size && fwrite(data, 1, size, file) != size)
+		return false;
+	offset += size;
+
+	size_t padding = size_t(align(offset, Archive::DataAlignment) - offset);
+	if (padding && fwrite(zero, 1, padding, file) != padding)
+		return false;
+	offset += padding;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	vector<pair<string, string>> input_args;
+	string output_path;
+	bool compress = false;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [&](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--compress", [&](CLIParser &) { compress = true; });
+	cbs.add("--output", [&](CLIParser &parser) { output_path = parser.next_string(); });
+	cbs.add("--input", [&](CLIParser &parser) {
+		string source = parser.next_string();
+		string base = parser.next_string();
+		input_args.emplace_back(move(source), move(base));
+	});
+	cbs.error_handler = []() { print_help(); };
+	CLIParser parser(move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+		return 1;
+	else if (parser.is_ended_state())
+		return 0;
+
+	if (output_path.empty() || input_args.empty())
+	{
+		print_help();
+		return 1;
+	}
+
+	vector<InputFile> inputs;
+	for (auto &input : input_args)
+		if (!collect_inputs(input.first, input.second, inputs))
+			return 1;
+
+	// Directories are implied by file paths.
+	unordered_map<string, const InputFile *> paths;
+	for (auto &input : inputs)
+	{
+		if (input.archive_path.empty())
+		{
+			LOGE("%s maps to the archive root.\n", input.source_path.c_str());
+			return 1;
+		}
+
+		if (!paths.insert({ input.archive_path, &input }).second)
+		{
+			LOGE("Duplicate archive path %s.\n", input.archive_path.c_str());
+			return 1;
+		}
+
+		for (auto dir = input.archive_path.find('/'); dir != string::npos; dir = input.archive_path.find('/', dir + 1))
+			paths.insert({ input.archive_path.substr(0, dir), nullptr });
+	}
+
+	vector<PendingEntry> pending;
+	pending.reserve(paths.size());
+	for (auto &path : paths)
+	{
+		if (path.second == nullptr)
+		{
+			auto itr = find_if(inputs.begin(), inputs.end(), [&](const InputFile &input) {
+				return input.archive_path == path.first;
+			});
+			if (itr != inputs.end())
+			{
+				LOGE("%s is both a file and a directory.\n", path.first.c_str());
+				return 1;
+			}
+		}
+
+		PendingEntry entry = {};
+		entry.path = path.first;
+		entry.input = path.second;
+		entry.entry.hash = Archive::hash_path(path.first);
+		entry.entry.parent = Archive::InvalidIndex;
+		entry.entry.flags = path.second ? 0u : uint32_t(Archive::ENTRY_DIRECTORY_BIT);
+		pending.push_back(move(entry));
+	}
+
+	sort(pending.begin(), pending.end(), [](const PendingEntry &a, const PendingEntry &b) {
+		return a.entry.hash != b.entry.hash ? a.entry.hash < b.entry.hash : a.path < b.path;
+	});
+
+	if (pending.size() >= Archive::InvalidIndex)
+	{
+		LOGE("Too many archive entries.\n");
+		return 1;
+	}
+
+	unordered_map<string, uint32_t> path_to_index;
+	for (size_t i = 0; i < pending.size(); i++)
+		path_to_index[pending[i].path] = uint32_t(i);
+
+	string strings;
+	for (auto &entry : pending)
+	{
+		auto split = entry.path.find_last_of('/');
+		if (split != string::npos)
+			entry.entry.parent = path_to_index[entry.path.substr(0, split)];
+		entry.entry.path_offset = uint32_t(strings.size());
+		entry.entry.path_length = uint32_t(entry.path.size());
+		strings += entry.path;
+	}
+
+	uint32_t bucket_bits = 0;
+	while ((size_t(1) << bucket_bits) < pending.size())
+		bucket_bits++;
+
+	vector<uint32_t> buckets((size_t(1) << bucket_bits) + 1);
+	for (size_t i = 0, bucket = 0; bucket < buckets.size(); bucket++)
+	{
+		while (i < pending.size() && Archive::get_bucket(pending[i].entry.hash, bucket_bits) < bucket)
+			i++;
+		buckets[bucket] = uint32_t(i);
+	}
+	buckets.back() = uint32_t(pending.size());
+
+	// The index size only depends on paths, so payloads can be streamed straight after it.
+	Archive::Header header = {};
+	header.magic = Archive::Magic;
+	header.version = Archive::Version;
+	header.entry_count = uint32_t(pending.size());
+	header.bucket_bits = bucket_bits;
+	header.entries = { align(sizeof(header), alignof(Archive::Entry)), pending.size() * sizeof(Archive::Entry) };
+	header.buckets = { header.entries.offset + header.entries.size, buckets.size() * sizeof(uint32_t) };
+	header.strings = { header.buckets.offset + header.buckets.size, strings.size() };
+
+	FILE *file = fopen(output_path.c_str(), "wb");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", output_path.c_str());
+		return 1;
+	}
+
+	// Payloads are laid out in path order, so related files end up close together.
+	vector<PendingEntry *> by_path;
+	for (auto &entry : pending)
+		if (entry.input)
+			by_path.push_back(&entry);
+	sort(by_path.begin(), by_path.end(), [](const PendingEntry *a, const PendingEntry *b) {
+		return a->path < b->path;
+	});
+
+	// Reserve room for the index, it is filled in once payload offsets are known.
+	vector<uint8_t> index(header.strings.offset + header.strings.size);
+	uint64_t offset = 0;
+	bool success = write_padded(file, index.data(), index.size(), offset);
+
+	OSFilesystem fs(".");
+	uint64_t total_size = 0;
+	uint64_t stored_size = 0;
+	vector<uint8_t> data;
+	vector<uint8_t> compressed;
+
+	for (auto *entry : by_path)
+	{
+		if (!success)
+			break;
+
+		if (!read_file(fs, entry->input->source_path, data))
+		{
+			LOGE("Failed to read %s.\n", entry->input->source_path.c_str());
+			success = false;
+			break;
+		}
+
+		const void *payload = data.data();
+		size_t payload_size = data.size();
+		entry->entry.compression = Archive::Compression::None;
+		entry->entry.uncompressed_size = data.size();
+
+		// Only keep compressed payloads which save a meaningful amount.
+		if (compress && !data.empty())
+		{
+			compressed.resize(lz4_compress_bound(data.size()));
+			size_t compressed_size = lz4_compress(data.data(), data.size(), compressed.data(), compressed.size());
+			if (compressed_size && compressed_size < data.size() - data.size() / 8)
+			{
+				payload = compressed.data();
+				payload_size = compressed_size;
+				entry->entry.compression = Archive::Compression::LZ4;
+			}
+		}
+
+		entry->entry.data = { offset, payload_size };
+		success = write_padded(file, payload, payload_size, offset);
+		total_size += data.size();
+		stored_size += payload_size;
+	}
+
+	if (success)
+	{
+		memcpy(index.data(), &header, sizeof(header));
+		for (size_t i = 0; i < pending.size(); i++)
+			memcpy(index.data() + header.entries.offset + i * sizeof(Archive::Entry), &pending[i].entry, sizeof(Archive::Entry));
+		memcpy(index.data() + header.buckets.offset, buckets.data(), header.buckets.size);
+		if (!strings.empty())
+			memcpy(index.data() + header.strings.offset, strings.data(), strings.size());
+
+		success = fseek(file, 0, SEEK_SET) == 0 && fwrite(index.data(), 1, index.size(), file) == index.size();
+	}
+
+	if (fclose(file) != 0)
+		success = false;
+
+	if (!success)
+	{
+		LOGE("Failed to write %s.\n", output_path.c_str());
+		remove(output_path.c_str());
+		return 1;
+	}
+
+	LOGI("Wrote %zu files (%llu -> %llu bytes) to %s.\n", by_path.size(),
+	     static_cast<unsigned long long>(total_size), static_cast<unsigned long long>(stored_size),
+	     output_path.c_str());
+	return 0;
+}
@@ -26,6 +26,7 @@
 #include "cli_parser.hpp"
 #include "global_managers_init.hpp"
 #include "thread_group.hpp"
+#include "environment_batch.hpp"
 
 using namespace Vulkan;
 using namespace Granite;
@@ -34,7 +35,9 @@ using namespace std;
 
 static void print_help()
 {
-	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] <path.gtx>\n");
+	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] <path.gtx>\n"
+	     "Batch: --batch <directory or list> --output-dir <directory>\n"
+	     "\t[--format <format>] [--quality [1-5]] [--cache <directory>]\n");
 }
 
 int main(int argc, char *argv[])
@@ -45,6 +48,8 @@ int main(int argc, char *argv[])
 		string cube;
 		string reflection;
 		string irradiance;
+		string batch;
+		EnvironmentBatchOptions batch_options;
 	} args;
 
 	Granite::Global::init();
@@ -52,6 +57,11 @@ int main(int argc, char *argv[])
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.add("--reflection", [&](CLIParser &parser) { args.reflection = parser.next_string(); });
 	cbs.add("--irradiance", [&](CLIParser &parser) { args.irradiance = parser.next_string(); });
+	cbs.add("--batch", [&](CLIParser &parser) { args.batch = parser.next_string(); });
+	cbs.add("--output-dir", [&](CLIParser &parser) { args.batch_options.output_directory = parser.next_string(); });
+	cbs.add("--format", [&](CLIParser &parser) { args.batch_options.compression.format = string_to_format(parser.next_string()); });
+	cbs.add("--quality", [&](CLIParser &parser) { args.batch_options.compression.quality = parser.next_uint(); });
+	cbs.add("--cache", [&](CLIParser &parser) { args.batch_options.compression.cache_directory = parser.next_string(); });
 	cbs.default_handler = [&](const char *arg) { args.cube = arg; };
 	cbs.error_handler = [&]() { print_help(); };
 
@@ -61,7 +71,7 @@ int main(int argc, char *argv[])
 	else if (parser.is_ended_state())
 		return 0;
 
-	if (args.cube.empty())
+	if (args.batch.empty() ? args.cube.empty() : args.batch_options.output_directory.empty())
 	{
 		print_help();
 		return 1;
@@ -82,6 +92,14 @@ int main(int argc, char *argv[])
 	device.set_context(context);
 	device.init_external_swapchain({ ImageHandle(nullptr) });
 
+	if (!args.batch.empty())
+	{
+		vector<string> inputs;
+		if (!gather_environment_batch_inputs(args.batch, { "ktx", "ktx2", "gtx" }, inputs))
+			return 1;
+		return run_environment_batch(device, inputs, args.batch_options) ? 0 : 1;
+	}
+
 	auto &textures = device.get_texture_manager();
 	auto *cube = textures.request_texture(args.cube);
 	auto specular = convert_cube_to_ibl_specular(device, cube->get_image()->get_view());
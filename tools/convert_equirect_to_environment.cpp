@@ -26,6 +26,7 @@
 #include "cli_parser.hpp"
 #include "global_managers_init.hpp"
 #include "thread_group.hpp"
+#include "environment_batch.hpp"
 
 using namespace Vulkan;
 using namespace Granite;
@@ -34,7 +35,9 @@ using namespace std;
 
 static void print_help()
 {
-	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] [--cube <path.gtx>] [--cube-scale <scale>] <equirect HDR>\n");
+	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] [--cube <path.gtx>] [--cube-scale <scale>] <equirect HDR>\n"
+	     "Batch: --batch <directory or list> --output-dir <directory> [--write-cube] [--cube-scale <scale>]\n"
+	     "\t[--format <format>] [--quality [1-5]] [--cache <directory>]\n");
 }
 
 int main(int argc, char *argv[])
@@ -47,6 +50,8 @@ int main(int argc, char *argv[])
 		string reflection;
 		string irradiance;
 		float cube_scale = 1.0f;
+		string batch;
+		EnvironmentBatchOptions batch_options;
 	} args;
 
 	Granite::Global::init();
@@ -56,6 +61,12 @@ int main(int argc, char *argv[])
 	cbs.add("--irradiance", [&](CLIParser &parser) { args.irradiance = parser.next_string(); });
 	cbs.add("--cube", [&](CLIParser &parser) { args.cube = parser.next_string(); });
 	cbs.add("--cube-scale", [&](CLIParser &parser) { args.cube_scale = parser.next_double(); });
+	cbs.add("--batch", [&](CLIParser &parser) { args.batch = parser.next_string(); });
+	cbs.add("--output-dir", [&](CLIParser &parser) { args.batch_options.output_directory = parser.next_string(); });
+	cbs.add("--write-cube", [&](CLIParser &) { args.batch_options.write_cube = true; });
+	cbs.add("--format", [&](CLIParser &parser) { args.batch_options.compression.format = string_to_format(parser.next_string()); });
+	cbs.add("--quality", [&](CLIParser &parser) { args.batch_options.compression.quality = parser.next_uint(); });
+	cbs.add("--cache", [&](CLIParser &parser) { args.batch_options.compression.cache_directory = parser.next_string(); });
 	cbs.default_handler = [&](const char *arg) { args.equirect = arg; };
 	cbs.error_handler = [&]() { print_help(); };
 
@@ -65,7 +76,7 @@ int main(int argc, char *argv[])
 	else if (parser.is_ended_state())
 		return 0;
 
-	if (args.equirect.empty())
+	if (args.batch.empty() ? args.equirect.empty() : args.batch_options.output_directory.empty())
 	{
 		print_help();
 		return 1;
@@ -86,6 +97,17 @@ int main(int argc, char *argv[])
 	device.set_context(context);
 	device.init_external_swapchain({ ImageHandle(nullptr) });
 
+	if (!args.batch.empty())
+	{
+		vector<string> inputs;
+		if (!gather_environment_batch_inputs(args.batch, { "hdr", "ktx", "ktx2", "gtx" }, inputs))
+			return 1;
+
+		args.batch_options.equirect = true;
+		args.batch_options.cube_scale = args.cube_scale;
+		return run_environment_batch(device, inputs, args.batch_options) ? 0 : 1;
+	}
+
 	auto &textures = device.get_texture_manager();
 	auto *equirect = textures.request_texture(args.equirect);
 
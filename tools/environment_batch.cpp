@@ -0,0 +1,272 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "environment_batch.hpp"
+#include "utils/image_utils.hpp"
+#include "texture_files.hpp"
+#include "global_managers.hpp"
+#include "string_helpers.hpp"
+#include "path_utils.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <string.h>
+
+using namespace Vulkan;
+using namespace Util;
+using namespace std;
+
+namespace Granite
+{
+bool gather_environment_batch_inputs(const string &path, const vector<string> &extensions, vector<string> &inputs)
+{
+	auto &fs = *GRANITE_FILESYSTEM();
+
+	FileStat s;
+	if (!fs.stat(path, s))
+	{
+		LOGE("Batch input %s does not exist.\n", path.c_str());
+		return false;
+	}
+
+	if (s.type == PathType::Directory)
+	{
+		auto list = fs.list(path);
+		sort(begin(list), end(list), [](const ListEntry &a, const ListEntry &b) {
+			return strcmp(a.path.c_str(), b.path.c_str()) < 0;
+		});
+
+		for (auto &entry : list)
+		{
+			if (entry.type != PathType::File)
+				continue;
+			if (find(begin(extensions), end(extensions), Path::ext(entry.path)) != end(extensions))
+				inputs.push_back(entry.path);
+		}
+	}
+	else
+	{
+		string text;
+		if (!fs.read_file_to_string(path, text))
+		{
+			LOGE("Failed to read batch list %s.\n", path.c_str());
+			return false;
+		}
+
+		for (auto &line : split_no_empty(text, "\n"))
+			inputs.push_back(Path::relpath(path, line));
+	}
+
+	return true;
+}
+
+struct PendingOutput
+{
+	ImageReadback readback;
+	string path;
+};
+
+static string get_output_path(const EnvironmentBatchOptions &options, const string &input, const char *suffix)
+{
+	auto stem = Path::basename(input);
+	auto dot = stem.find_last_of('.');
+	if (dot != string::npos)
+		stem = stem.substr(0, dot);
+	return Path::join(options.output_directory, stem + "." + suffix + ".gtx");
+}
+
+static ImageHandle upload_environment(Device &device, const MemoryMappedTexture &tex)
+{
+	auto info = ImageCreateInfo::immutable_image(tex.get_layout());
+	if (tex.get_flags() & MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT)
+		info.flags |= VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+
+	// The prefilter samples from the mip chain.
+	if (info.levels == 1 && (tex.get_flags() & MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) != 0)
+	{
+		info.levels = 0;
+		info.misc |= IMAGE_MISC_GENERATE_MIPS_BIT;
+	}
+
+	auto staging = device.create_image_staging_buffer(tex.get_layout());
+	return device.create_image_from_staging_buffer(info, &staging);
+}
+
+static bool prefilter_environment(Device &device, const MemoryMappedTexture &tex, const string &input,
+                                  const EnvironmentBatchOptions &options, vector<PendingOutput> &outputs)
+{
+	if (tex.empty())
+	{
+		LOGE("Failed to load %s.\n", input.c_str());
+		return false;
+	}
+
+	auto source = upload_environment(device, tex);
+	if (!source)
+	{
+		LOGE("Failed to upload %s.\n", input.c_str());
+		return false;
+	}
+
+	ImageHandle cube;
+	if (options.equirect)
+		cube = convert_equirect_to_cube(device, source->get_view(), options.cube_scale);
+	else
+		cube = source;
+
+	auto specular = convert_cube_to_ibl_specular(device, cube->get_view());
+	auto diffuse = convert_cube_to_ibl_diffuse(device, cube->get_view());
+
+	auto cmd = device.request_command_buffer();
+	if (options.equirect && options.write_cube)
+	{
+		cmd->image_barrier(*cube, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	}
+
+	cmd->image_barrier(*specular, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	cmd->image_barrier(*diffuse, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	device.submit(cmd);
+
+	if (options.equirect && options.write_cube)
+	{
+		outputs.push_back({ save_image_to_cpu_buffer(device, *cube, CommandBuffer::Type::Generic),
+		                    get_output_path(options, input, "cube") });
+	}
+	outputs.push_back({ save_image_to_cpu_buffer(device, *specular, CommandBuffer::Type::Generic),
+	                    get_output_path(options, input, "reflection") });
+	outputs.push_back({ save_image_to_cpu_buffer(device, *diffuse, CommandBuffer::Type::Generic),
+	                    get_output_path(options, input, "irradiance") });
+	return true;
+}
+
+namespace
+{
+struct OutputWriter
+{
+	Device &device;
+	ThreadGroup &group;
+	const EnvironmentBatchOptions &options;
+	TaskSignal signal;
+	uint64_t launched = 0;
+	bool success = true;
+
+	// Keeps memory bounded if compression falls behind the GPU.
+	enum { MaxPendingCompressions = 8 };
+
+	void write(PendingOutput &output)
+	{
+		if (options.compression.format == VK_FORMAT_UNDEFINED)
+		{
+			if (!save_image_buffer_to_gtx(device, output.readback, output.path.c_str()))
+				success = false;
+			return;
+		}
+
+		auto tex = make_shared<MemoryMappedTexture>();
+		if (!save_image_buffer_to_texture(device, output.readback, *tex))
+		{
+			success = false;
+			return;
+		}
+
+		CompressorArguments args = options.compression;
+		args.output = output.path;
+		if (tex->get_layout().get_format() == VK_FORMAT_R16G16B16A16_SFLOAT)
+			args.mode = TextureMode::HDR;
+
+		if (launched >= MaxPendingCompressions)
+			signal.wait_until_at_least(launched - MaxPendingCompressions + 1);
+
+		auto dep = group.create_task();
+		if (compress_texture(group, args, tex, dep, &signal))
+			launched++;
+		else
+			success = false;
+		dep->flush();
+	}
+
+	void wait()
+	{
+		signal.wait_until_at_least(launched);
+	}
+};
+}
+
+bool run_environment_batch(Device &device, const vector<string> &inputs, const EnvironmentBatchOptions &options)
+{
+	auto &group = *GRANITE_THREAD_GROUP();
+	OutputWriter writer{ device, group, options };
+
+	// Double buffered, the decode for the next input runs while we prefilter the current one.
+	MemoryMappedTexture decoded[2];
+	TaskGroupHandle decode_tasks[2];
+	auto kick_decode = [&](size_t index) {
+		auto &tex = decoded[index & 1];
+		auto &path = inputs[index];
+		decode_tasks[index & 1] = group.create_task([&tex, &path]() {
+			tex = load_texture_from_file(*GRANITE_FILESYSTEM(), path, ColorSpace::Linear);
+		});
+		decode_tasks[index & 1]->set_desc("environment-decode");
+		decode_tasks[index & 1]->flush();
+	};
+
+	if (!inputs.empty())
+		kick_decode(0);
+
+	vector<PendingOutput> previous;
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		LOGI("Processing %s (%u / %u).\n", inputs[i].c_str(), unsigned(i + 1), unsigned(inputs.size()));
+
+		decode_tasks[i & 1]->wait();
+		decode_tasks[i & 1].reset();
+		auto tex = move(decoded[i & 1]);
+		if (i + 1 < inputs.size())
+			kick_decode(i + 1);
+
+		vector<PendingOutput> current;
+		if (!prefilter_environment(device, tex, inputs[i], options, current))
+			writer.success = false;
+
+		// The previous input was submitted a frame ago, write it out while the GPU works on this one.
+		for (auto &output : previous)
+			writer.write(output);
+		previous = move(current);
+
+		device.next_frame_context();
+	}
+
+	for (auto &output : previous)
+		writer.write(output);
+	writer.wait();
+	group.wait_idle();
+
+	return writer.success;
+}
+}
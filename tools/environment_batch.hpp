@@ -0,0 +1,53 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "texture_compression.hpp"
+#include "device.hpp"
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+struct EnvironmentBatchOptions
+{
+	std::string output_directory;
+	// Inputs are equirectangular HDRs, otherwise cube maps.
+	bool equirect = false;
+	bool write_cube = false;
+	float cube_scale = 1.0f;
+	// Outputs are written uncompressed if format is VK_FORMAT_UNDEFINED. output is ignored.
+	CompressorArguments compression;
+};
+
+// path is either a directory, where every file with one of the extensions is used,
+// or a text file with one path per line, relative to the list.
+bool gather_environment_batch_inputs(const std::string &path, const std::vector<std::string> &extensions,
+                                     std::vector<std::string> &inputs);
+
+// Decodes the next input on the thread group and compresses the previous outputs there as well,
+// so only the prefilter runs on the main thread, overlapped with the CPU work for its neighbours.
+// Outputs are <output_directory>/<input stem>.{cube,reflection,irradiance}.gtx.
+bool run_environment_batch(Vulkan::Device &device, const std::vector<std::string> &inputs,
+                           const EnvironmentBatchOptions &options);
+}
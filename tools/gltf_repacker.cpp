@@ -22,6 +22,7 @@
 
 #include "gltf.hpp"
 #include "gltf_export.hpp"
+#include "native_export.hpp"
 #include "logging.hpp"
 #include "cli_parser.hpp"
 #include "rapidjson_wrapper.hpp"
@@ -58,15 +59,19 @@ static void print_help()
 	LOGI("[--extra-lights lights.json]\n");
 	LOGI("[--extra-cameras cameras.json]\n");
 	LOGI("[--texcomp-quality <1 (fast) - 5 (slow)>] input.gltf\n");
+	LOGI("[--cache <directory>]\n");
 	LOGI("[--animate-cameras]\n");
 	LOGI("[--animate-cameras-speed <speed>]\n");
 	LOGI("[--animate-cameras-sharpness <sharp>]\n");
 	LOGI("[--optimize-meshes]\n");
 	LOGI("[--stripify-meshes]\n");
+	LOGI("[--generate-lods]\n");
 	LOGI("[--quantize-attributes]\n");
+	LOGI("[--compress-geometry]\n");
 	LOGI("[--flip-tangent-w]\n");
 	LOGI("[--renormalize-normals]\n");
 	LOGI("[--gltf]\n");
+	LOGI("[--native <out.gscene>]\n");
 }
 
 int main(int argc, char *argv[])
@@ -79,6 +84,7 @@ int main(int argc, char *argv[])
 	{
 		string input;
 		string output;
+		string native_output;
 	} args;
 
 	SceneFormats::ExportOptions options;
@@ -95,6 +101,7 @@ int main(int argc, char *argv[])
 	cbs.add("--output", [&](CLIParser &parser) { args.output = parser.next_string(); });
 	cbs.add("--texcomp", [&](CLIParser &parser) { options.compression = string_to_compression(parser.next_string()); });
 	cbs.add("--texcomp-quality", [&](CLIParser &parser) { options.texcomp_quality = parser.next_uint(); });
+	cbs.add("--cache", [&](CLIParser &parser) { options.cache_directory = parser.next_string(); });
 	cbs.add("--environment-cube", [&](CLIParser &parser) { options.environment.cube = parser.next_string(); });
 	cbs.add("--environment-reflection", [&](CLIParser &parser) { options.environment.reflection = parser.next_string(); });
 	cbs.add("--environment-irradiance", [&](CLIParser &parser) { options.environment.irradiance = parser.next_string(); });
@@ -110,6 +117,7 @@ int main(int argc, char *argv[])
 	cbs.add("--flip-tangent-w", [&](CLIParser &) { flip_tangent_w = true; });
 	cbs.add("--renormalize-normals", [&](CLIParser &) { renormalize_normals = true; });
 	cbs.add("--gltf", [&](CLIParser &) { options.gltf = true; });
+	cbs.add("--native", [&](CLIParser &parser) { args.native_output = parser.next_string(); });
 
 	cbs.add("--fog-color", [&](CLIParser &parser) {
 		for (unsigned i = 0; i < 3; i++)
@@ -128,11 +136,19 @@ int main(int argc, char *argv[])
 		options.optimize_meshes = true;
 	});
 
+	cbs.add("--compress-geometry", [&](CLIParser &) {
+		options.compress_geometry = true;
+	});
+
 	cbs.add("--stripify-meshes", [&](CLIParser &) {
 		options.optimize_meshes = true;
 		options.stripify_meshes = true;
 	});
 
+	cbs.add("--generate-lods", [&](CLIParser &) {
+		options.generate_lods = true;
+	});
+
 	cbs.add("--threads", [&](CLIParser &parser) { options.threads = parser.next_uint(); });
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.default_handler = [&](const char *arg) { args.input = arg; };
@@ -418,5 +434,26 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	// Go through the exported scene so the native scene gets processed meshes and compressed textures.
+	if (!args.native_output.empty())
+	{
+		GLTF::Parser exported(args.output);
+		SceneFormats::SceneInformation native_info;
+		native_info.cameras = exported.get_cameras();
+		native_info.lights = exported.get_lights();
+		native_info.materials = exported.get_materials();
+		native_info.meshes = exported.get_meshes();
+		native_info.nodes = exported.get_nodes();
+		native_info.skins = exported.get_skins();
+		native_info.animations = exported.get_animations();
+		native_info.scene_nodes = &exported.get_scenes()[exported.get_default_scene()];
+
+		if (!SceneFormats::export_scene_to_native(native_info, args.native_output))
+		{
+			LOGE("Failed to export native scene.\n");
+			return 1;
+		}
+	}
+
 	return 0;
 }
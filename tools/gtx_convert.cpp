@@ -45,6 +45,8 @@ static void print_help()
 	     "\t[--swizzle <rgba01>x4]\n"
 	     "\t[--normal-la]\n"
 	     "\t[--mask-la]\n"
+	     "\t[--supercompress]\n"
+	     "\t[--cache <directory>]\n"
 	     "\t--output <out.gtx>\n"
 	     "\t<in.gtx>\n");
 }
@@ -131,6 +133,8 @@ int main(int argc, char *argv[])
 	cbs.add("--mipgen", [&](CLIParser &) { generate_mipmap = true; });
 	cbs.add("--deferred-mipgen", [&](CLIParser &) { deferred_generate_mipmap = true; });
 	cbs.add("--swizzle", [&](CLIParser &parser) { swizzle = parse_swizzle(parser.next_string()); });
+	cbs.add("--supercompress", [&](CLIParser &) { args.supercompress = true; });
+	cbs.add("--cache", [&](CLIParser &parser) { args.cache_directory = parser.next_string(); });
 	cbs.default_handler = [&](const char *arg) { input_path = arg; };
 	cbs.error_handler = []() { print_help(); };
 	CLIParser parser(move(cbs), argc - 1, argv + 1);
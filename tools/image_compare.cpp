@@ -29,6 +29,9 @@
 #include "texture_files.hpp"
 #include "thread_group.hpp"
 #include "global_managers_init.hpp"
+#include "device.hpp"
+#include "context.hpp"
+#include "utils/image_utils.hpp"
 #include <algorithm>
 #include <string.h>
 #include <vector>
@@ -121,6 +124,50 @@ static double compare_images(const MemoryMappedTexture &a, const MemoryMappedTex
 	return 10.0 * muglm::log10(peak_energy / error_energy);
 }
 
+static ImageHandle upload_texture(Device &device, const MemoryMappedTexture &tex)
+{
+	auto info = ImageCreateInfo::immutable_image(tex.get_layout());
+	auto staging = device.create_image_staging_buffer(tex.get_layout());
+	return device.create_image_from_staging_buffer(info, &staging);
+}
+
+static bool compare_images_gpu(Device &device, const MemoryMappedTexture &a, const MemoryMappedTexture &b,
+                               ImageCompareResult &result)
+{
+	if (a.get_layout().get_format() != b.get_layout().get_format())
+	{
+		LOGE("Format mismatch.\n");
+		return false;
+	}
+
+	auto image_a = upload_texture(device, a);
+	auto image_b = upload_texture(device, b);
+	if (!image_a || !image_b)
+		return false;
+
+	auto cmd = device.request_command_buffer(CommandBuffer::Type::Generic);
+	auto readback = compare_images_on_gpu(*cmd, image_a->get_view(), image_b->get_view());
+	device.submit(cmd, &readback.fence);
+	return resolve_image_compare(device, readback, result);
+}
+
+// One pixel per tile, brighter is worse. Scaled like the diff image.
+static void save_heatmap(const string &path, const ImageCompareResult &result)
+{
+	vector<uint8_t> buffer(result.tiles_x * result.tiles_y * 4);
+	for (size_t i = 0; i < result.tile_mse.size(); i++)
+	{
+		auto err = uint8_t(std::min(muglm::sqrt(result.tile_mse[i]) * 16.0f, 255.0f));
+		buffer[4 * i + 0] = err;
+		buffer[4 * i + 1] = uint8_t(std::min(result.tile_max_error[i] * 4u, 255u));
+		buffer[4 * i + 2] = 0;
+		buffer[4 * i + 3] = 255;
+	}
+
+	if (!stbi_write_png(path.c_str(), int(result.tiles_x), int(result.tiles_y), 4, buffer.data(), int(result.tiles_x * 4)))
+		LOGE("Failed to save heatmap to %s.\n", path.c_str());
+}
+
 int main(int argc, char *argv[])
 {
 	Global::init();
@@ -129,7 +176,9 @@ int main(int argc, char *argv[])
 	{
 		vector<string> inputs;
 		string diff;
+		string heatmap;
 		double threshold = -1.0;
+		bool gpu = false;
 	} args;
 	CLICallbacks cbs;
 
@@ -139,6 +188,12 @@ int main(int argc, char *argv[])
 	cbs.add("--diff", [&](CLIParser &parser) {
 		args.diff = parser.next_string();
 	});
+	cbs.add("--heatmap", [&](CLIParser &parser) {
+		args.heatmap = parser.next_string();
+	});
+	cbs.add("--gpu", [&](CLIParser &) {
+		args.gpu = true;
+	});
 	cbs.default_handler = [&](const char *arg) {
 		args.inputs.push_back(arg);
 	};
@@ -153,12 +208,35 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (!args.heatmap.empty())
+		args.gpu = true;
+
 	ThreadGroup workers;
 	workers.start(thread::hardware_concurrency(),
 	              [ctx = std::shared_ptr<Global::GlobalManagers>(Global::create_thread_context())] {
 		              Global::set_thread_context(*ctx);
 	              });
 
+	unique_ptr<Context> context;
+	unique_ptr<Device> device;
+	if (args.gpu)
+	{
+		if (!Context::init_loader(nullptr))
+			return 1;
+
+		context.reset(new Context);
+		Context::SystemHandles handles;
+		handles.filesystem = GRANITE_FILESYSTEM();
+		handles.thread_group = GRANITE_THREAD_GROUP();
+		context->set_system_handles(handles);
+		if (!context->init_instance_and_device(nullptr, 0, nullptr, 0))
+			return 1;
+
+		device.reset(new Device);
+		device->set_context(*context);
+		device->init_external_swapchain({ ImageHandle(nullptr) });
+	}
+
 	FileStat a_stat, b_stat;
 	if (GRANITE_FILESYSTEM()->stat(args.inputs[0], a_stat) && a_stat.type == PathType::Directory &&
 	    GRANITE_FILESYSTEM()->stat(args.inputs[1], b_stat) && b_stat.type == PathType::Directory)
@@ -182,26 +260,62 @@ int main(int argc, char *argv[])
 		vector<double> psnrs(a_list.size());
 		vector<bool> ignore(a_list.size());
 
-		auto task = workers.create_task();
-
-		for (unsigned i = 0; i < a_list.size(); i++)
+		if (args.gpu)
 		{
-			task->enqueue_task([&a_list, &b_list, &psnrs, &ignore, i]() {
-				auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), a_list[i].path);
-				auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), b_list[i].path);
-				if (a.empty() || b.empty())
+			// Decode a batch on the workers, then compare on the GPU.
+			// Images are only released when the frame context ends, so keep batches small.
+			constexpr unsigned BatchSize = 16;
+			vector<MemoryMappedTexture> a_tex(BatchSize), b_tex(BatchSize);
+
+			for (unsigned base = 0; base < a_list.size(); base += BatchSize)
+			{
+				unsigned count = std::min<unsigned>(BatchSize, unsigned(a_list.size()) - base);
+				auto task = workers.create_task();
+				for (unsigned i = 0; i < count; i++)
 				{
-					psnrs[i] = 0.0;
-					ignore[i] = true;
+					task->enqueue_task([&, i]() {
+						a_tex[i] = load_texture_from_file(*GRANITE_FILESYSTEM(), a_list[base + i].path);
+						b_tex[i] = load_texture_from_file(*GRANITE_FILESYSTEM(), b_list[base + i].path);
+					});
 				}
+				task->flush();
+				task->wait();
 
-				psnrs[i] = compare_images(a, b);
+				for (unsigned i = 0; i < count; i++)
+				{
+					ImageCompareResult result;
+					if (a_tex[i].empty() || b_tex[i].empty() || !compare_images_gpu(*device, a_tex[i], b_tex[i], result))
+						ignore[base + i] = true;
+					else
+						psnrs[base + i] = result.psnr;
+				}
 
-			});
+				device->next_frame_context();
+			}
 		}
+		else
+		{
+			auto task = workers.create_task();
 
-		task->flush();
-		task->wait();
+			for (unsigned i = 0; i < a_list.size(); i++)
+			{
+				task->enqueue_task([&a_list, &b_list, &psnrs, &ignore, i]() {
+					auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), a_list[i].path);
+					auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), b_list[i].path);
+					if (a.empty() || b.empty())
+					{
+						psnrs[i] = 0.0;
+						ignore[i] = true;
+					}
+
+					psnrs[i] = compare_images(a, b);
+
+				});
+			}
+
+			task->flush();
+			task->wait();
+		}
 
 		for (unsigned i = 0; i < a_list.size(); i++)
 		{
@@ -242,7 +356,20 @@ int main(int argc, char *argv[])
 			save_diff_image(args.diff, a, b);
 		}
 
-		double psnr = compare_images(a, b);
+		double psnr;
+		if (args.gpu)
+		{
+			ImageCompareResult result;
+			if (!compare_images_gpu(*device, a, b, result))
+				return 1;
+
+			psnr = result.psnr;
+			LOGI("MSE: %.3f, max error: %u\n", result.mse, result.max_error);
+			if (!args.heatmap.empty())
+				save_heatmap(args.heatmap, result);
+		}
+		else
+			psnr = compare_images(a, b);
 		LOGI("PSNR: %.f dB\n", psnr);
 
 		if (args.threshold >= 0.0)
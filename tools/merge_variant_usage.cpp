@@ -0,0 +1,170 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "logging.hpp"
+#include "cli_parser.hpp"
+#include "rapidjson_wrapper.hpp"
+#include "global_managers_init.hpp"
+#include "filesystem.hpp"
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace Granite;
+using namespace Util;
+using namespace rapidjson;
+
+// Merges variant usage recordings from RendererSuite::save_variant_usage().
+// The output has the same format, with hit counts summed per variant,
+// and can be shipped as a variant cache which only warms what sessions actually used.
+
+using VariantKey = std::tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t>;
+
+static void print_help()
+{
+	LOGI("Usage: merge-variant-usage --output <merged.json> [--min-hits <count>] recording.json...\n");
+}
+
+static bool merge_recording(const std::string &path, std::map<VariantKey, uint64_t> &hits,
+                            uint32_t &version, uint32_t &sessions)
+{
+	std::string json;
+	if (!GRANITE_FILESYSTEM()->read_file_to_string(path, json))
+	{
+		LOGE("Failed to read %s.\n", path.c_str());
+		return false;
+	}
+
+	Document doc;
+	doc.Parse(json);
+	if (doc.HasParseError() || !doc.HasMember("rendererSuiteCacheVersion") || !doc.HasMember("variants"))
+	{
+		LOGE("%s is not a variant usage recording.\n", path.c_str());
+		return false;
+	}
+
+	uint32_t file_version = doc["rendererSuiteCacheVersion"].GetUint();
+	if (version && file_version != version)
+	{
+		LOGE("Mismatch in renderer suite cache version in %s, %u != %u.\n", path.c_str(), file_version, version);
+		return false;
+	}
+	version = file_version;
+	sessions += doc.HasMember("sessions") ? doc["sessions"].GetUint() : 1u;
+
+	auto &variants = doc["variants"];
+	for (auto itr = variants.Begin(); itr != variants.End(); ++itr)
+	{
+		auto &value = *itr;
+		VariantKey key{
+			value["rendererSuiteType"].GetUint(),
+			value["renderableType"].GetUint(),
+			value["coverage"].GetUint(),
+			value["attributeMask"].GetUint(),
+			value["textureMask"].GetUint(),
+			value["variantId"].GetUint(),
+		};
+
+		// Plain variant caches carry no counts, every entry in them was seen at least once.
+		hits[key] += value.HasMember("hits") ? value["hits"].GetUint() : 1u;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+
+	std::string output;
+	std::vector<std::string> inputs;
+	uint64_t min_hits = 1;
+
+	CLICallbacks cbs;
+	cbs.add("--output", [&](CLIParser &parser) { output = parser.next_string(); });
+	cbs.add("--min-hits", [&](CLIParser &parser) { min_hits = parser.next_uint(); });
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.default_handler = [&](const char *arg) { inputs.emplace_back(arg); };
+	CLIParser cli_parser(std::move(cbs), argc - 1, argv + 1);
+	if (!cli_parser.parse())
+		return 1;
+	else if (cli_parser.is_ended_state())
+		return 0;
+
+	if (output.empty() || inputs.empty())
+	{
+		print_help();
+		return 1;
+	}
+
+	std::map<VariantKey, uint64_t> hits;
+	uint32_t version = 0;
+	uint32_t sessions = 0;
+	for (auto &input : inputs)
+		if (!merge_recording(input, hits, version, sessions))
+			return 1;
+
+	Document doc;
+	doc.SetObject();
+	auto &allocator = doc.GetAllocator();
+	doc.AddMember("rendererSuiteCacheVersion", version, allocator);
+	doc.AddMember("sessions", sessions, allocator);
+
+	Value variants(kArrayType);
+	unsigned pruned = 0;
+	for (auto &entry : hits)
+	{
+		if (entry.second < min_hits)
+		{
+			pruned++;
+			continue;
+		}
+
+		Value variant(kObjectType);
+		variant.AddMember("rendererSuiteType", std::get<0>(entry.first), allocator);
+		variant.AddMember("renderableType", std::get<1>(entry.first), allocator);
+		variant.AddMember("coverage", std::get<2>(entry.first), allocator);
+		variant.AddMember("attributeMask", std::get<3>(entry.first), allocator);
+		variant.AddMember("textureMask", std::get<4>(entry.first), allocator);
+		variant.AddMember("variantId", std::get<5>(entry.first), allocator);
+		variant.AddMember("hits", uint32_t(std::min<uint64_t>(entry.second, UINT32_MAX)), allocator);
+		variants.PushBack(variant, allocator);
+	}
+	doc.AddMember("variants", variants, allocator);
+
+	StringBuffer buffer;
+	PrettyWriter<StringBuffer> writer(buffer);
+	doc.Accept(writer);
+
+	if (!GRANITE_FILESYSTEM()->write_string_to_file(output, buffer.GetString()))
+	{
+		LOGE("Failed to write %s.\n", output.c_str());
+		return 1;
+	}
+
+	LOGI("Merged %u sessions into %u variants, pruned %u.\n",
+	     sessions, unsigned(hits.size()) - pruned, pruned);
+	return 0;
+}
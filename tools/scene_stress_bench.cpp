@@ -0,0 +1,570 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "application.hpp"
+#include "os_filesystem.hpp"
+#include "cli_parser.hpp"
+#include "scene.hpp"
+#include "mesh_util.hpp"
+#include "mesh_manager.hpp"
+#include "renderer.hpp"
+#include "render_context.hpp"
+#include "render_components.hpp"
+#include "lights/lights.hpp"
+#include "lights/cluster_binning.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "transforms.hpp"
+#include "timer.hpp"
+#include "filesystem.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace Granite;
+using namespace Vulkan;
+
+// Procedurally built scenes for measuring how the CPU side of the renderer scales with scene size.
+// Each step measures a number of frames, then every count is doubled for the next step.
+struct StressOptions
+{
+	unsigned static_instances = 4096;
+	unsigned dynamic_instances = 1024;
+	unsigned skinned_instances = 64;
+	unsigned point_lights = 128;
+	unsigned spot_lights = 128;
+	// Spot lights which also gather and sort a depth queue.
+	unsigned shadow_casters = 4;
+	unsigned warm_frames = 10;
+	unsigned measure_frames = 100;
+	unsigned sweep_steps = 1;
+	// Optional glTF instantiated through MeshManager for the static instances instead of cubes.
+	std::string mesh_path;
+	std::string csv_path;
+};
+
+enum Stage
+{
+	STAGE_UPDATE,
+	STAGE_GATHER,
+	STAGE_PUSH,
+	STAGE_SORT,
+	STAGE_CLUSTER,
+	STAGE_SUBMIT,
+	STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+	"update", "gather", "push", "sort", "cluster", "submit"
+};
+
+// Two-bone cylinder, the upper half bends with bone 1.
+static SceneFormats::Mesh create_skinned_column()
+{
+	auto generated = create_cylinder_mesh(16, 2.0f, 0.3f);
+
+	struct Attribute
+	{
+		vec3 normal;
+		uint8_t bone_indices[4];
+		uint16_t bone_weights[4];
+	};
+
+	SceneFormats::Mesh mesh;
+	mesh.topology = generated.topology;
+	mesh.primitive_restart = generated.primitive_restart;
+	mesh.index_type = VK_INDEX_TYPE_UINT16;
+	mesh.count = uint32_t(generated.indices.size());
+	mesh.indices.resize(generated.indices.size() * sizeof(uint16_t));
+	memcpy(mesh.indices.data(), generated.indices.data(), mesh.indices.size());
+
+	mesh.position_stride = sizeof(vec3);
+	mesh.positions.resize(generated.positions.size() * sizeof(vec3));
+	memcpy(mesh.positions.data(), generated.positions.data(), mesh.positions.size());
+
+	mesh.attribute_stride = sizeof(Attribute);
+	mesh.attribute_layout[Util::ecast(MeshAttribute::Position)] = { VK_FORMAT_R32G32B32_SFLOAT, 0 };
+	mesh.attribute_layout[Util::ecast(MeshAttribute::Normal)] = { VK_FORMAT_R32G32B32_SFLOAT, offsetof(Attribute, normal) };
+	mesh.attribute_layout[Util::ecast(MeshAttribute::BoneIndex)] = { VK_FORMAT_R8G8B8A8_UINT, offsetof(Attribute, bone_indices) };
+	mesh.attribute_layout[Util::ecast(MeshAttribute::BoneWeights)] = { VK_FORMAT_R16G16B16A16_UNORM, offsetof(Attribute, bone_weights) };
+
+	std::vector<Attribute> attributes(generated.positions.size());
+	for (size_t i = 0; i < attributes.size(); i++)
+	{
+		float w = clamp(generated.positions[i].y + 0.5f, 0.0f, 1.0f);
+		auto &attr = attributes[i];
+		attr.normal = generated.attributes[i].normal;
+		attr.bone_indices[0] = 0;
+		attr.bone_indices[1] = 1;
+		attr.bone_indices[2] = 0;
+		attr.bone_indices[3] = 0;
+		attr.bone_weights[0] = uint16_t(::round((1.0f - w) * 65535.0f));
+		attr.bone_weights[1] = uint16_t(65535 - attr.bone_weights[0]);
+		attr.bone_weights[2] = 0;
+		attr.bone_weights[3] = 0;
+	}
+
+	mesh.attributes.resize(attributes.size() * sizeof(Attribute));
+	memcpy(mesh.attributes.data(), attributes.data(), mesh.attributes.size());
+
+	// Leave room for bending.
+	mesh.static_aabb = AABB(vec3(-1.5f, -1.0f, -1.5f), vec3(1.5f, 1.5f, 1.5f));
+	return mesh;
+}
+
+static SceneFormats::Skin create_two_bone_skin()
+{
+	SceneFormats::Skin skin;
+	skin.inverse_bind_pose = { mat4(1.0f), mat4(1.0f) };
+	skin.joint_transforms.resize(2);
+	skin.skeletons.resize(1);
+	skin.skeletons[0].index = 0;
+	skin.skeletons[0].children.resize(1);
+	skin.skeletons[0].children[0].index = 1;
+	skin.skin_compat = 1;
+	return skin;
+}
+
+class SceneStressApplication : public Application, public EventHandler
+{
+public:
+	explicit SceneStressApplication(const StressOptions &options);
+	void render_frame(double frame_time, double elapsed_time) override;
+
+private:
+	StressOptions options;
+	StressOptions counts;
+
+	std::unique_ptr<Scene> scene;
+	MeshManager mesh_manager;
+	AbstractRenderableHandle cube;
+	AbstractRenderableHandle skinned_column;
+	SceneFormats::Skin skin;
+
+	std::vector<Scene::NodeHandle> dynamic_nodes;
+	std::vector<Scene::Node *> bend_bones;
+
+	Renderer renderer;
+	Renderer depth_renderer;
+	RenderContext context;
+	LightingParameters lighting;
+	RenderQueue queue;
+	std::vector<RenderQueue> depth_queues;
+	std::vector<RenderContext> depth_contexts;
+	VisibilityList visible;
+	VisibilityList shadow_visible;
+	PositionalLightList visible_lights;
+
+	std::vector<PositionalFragmentInfo> cluster_lights;
+	std::vector<mat4> cluster_models;
+	std::vector<uint32_t> cluster_type_mask;
+	ClusterBinningOutput cluster_output;
+
+	unsigned step = 0;
+	unsigned frame = 0;
+	uint64_t stage_time[STAGE_COUNT] = {};
+	uint64_t visible_renderables = 0;
+	uint64_t visible_light_count = 0;
+	std::string csv;
+
+	void build_scene();
+	void update_dynamic(double elapsed_time);
+	void gather();
+	void push();
+	void sort();
+	void cluster();
+	void submit();
+	void end_step();
+};
+
+SceneStressApplication::SceneStressApplication(const StressOptions &options_)
+	: options(options_), counts(options_),
+	  renderer(RendererType::GeneralForward, nullptr),
+	  depth_renderer(RendererType::DepthOnly, nullptr)
+{
+	cube = Util::make_handle<CubeMesh>();
+
+	SceneFormats::MaterialInfo material;
+	material.uniform_base_color = vec4(0.8f, 0.5f, 0.3f, 1.0f);
+	material.uniform_roughness = 0.8f;
+	skinned_column = Util::make_handle<ImportedSkinnedMesh>(create_skinned_column(), material);
+	skin = create_two_bone_skin();
+
+	csv = "static,dynamic,skinned,point_lights,spot_lights,shadow_casters,"
+	      "visible_renderables,visible_lights";
+	for (auto *name : stage_names)
+		csv += std::string(",") + name + "_ms";
+	csv += ",total_ms\n";
+
+	build_scene();
+}
+
+void SceneStressApplication::build_scene()
+{
+	scene.reset(new Scene);
+	dynamic_nodes.clear();
+	bend_bones.clear();
+
+	// Constant density, so visible counts grow with the scene rather than overdraw.
+	float total = float(counts.static_instances + counts.dynamic_instances + counts.skinned_instances);
+	float extent = std::max(20.0f, 2.0f * sqrt(total));
+
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> pos_dist(-extent, extent);
+	std::uniform_real_distribution<float> height_dist(0.0f, 8.0f);
+	std::uniform_real_distribution<float> angle_dist(0.0f, 2.0f * pi<float>());
+	auto &root = *scene->get_root_node();
+
+	MeshManager::MeshGroup *group = nullptr;
+	if (!options.mesh_path.empty())
+		group = mesh_manager.register_mesh(options.mesh_path);
+
+	for (unsigned i = 0; i < counts.static_instances; i++)
+	{
+		Scene::NodeHandle node;
+		if (group)
+			node = mesh_manager.instantiate_renderable(*scene, group).root_node;
+		else
+		{
+			node = scene->create_node();
+			scene->create_renderable(cube, node.get());
+		}
+		node->transform.translation = vec3(pos_dist(rnd), height_dist(rnd), pos_dist(rnd));
+		node->transform.rotation = angleAxis(angle_dist(rnd), vec3(0.0f, 1.0f, 0.0f));
+		node->invalidate_cached_transform();
+		root.add_child(node);
+	}
+
+	for (unsigned i = 0; i < counts.dynamic_instances; i++)
+	{
+		auto node = scene->create_node();
+		node->transform.translation = vec3(pos_dist(rnd), height_dist(rnd), pos_dist(rnd));
+		node->transform.scale = vec3(0.5f);
+		node->invalidate_cached_transform();
+		scene->create_renderable(cube, node.get());
+		root.add_child(node);
+		dynamic_nodes.push_back(node);
+	}
+
+	for (unsigned i = 0; i < counts.skinned_instances; i++)
+	{
+		auto node = scene->create_skinned_node(skin);
+		node->transform.translation = vec3(pos_dist(rnd), 1.0f, pos_dist(rnd));
+		node->invalidate_cached_transform();
+		scene->create_renderable(skinned_column, node.get());
+		root.add_child(node);
+		bend_bones.push_back(node->get_children().front()->get_children().front().get());
+	}
+
+	std::uniform_real_distribution<float> color_dist(0.2f, 1.0f);
+	for (unsigned i = 0; i < counts.point_lights + counts.spot_lights; i++)
+	{
+		SceneFormats::LightInfo info;
+		info.type = i < counts.point_lights ? SceneFormats::LightInfo::Type::Point : SceneFormats::LightInfo::Type::Spot;
+		info.color = 4.0f * vec3(color_dist(rnd), color_dist(rnd), color_dist(rnd));
+		info.range = 10.0f;
+
+		auto node = scene->create_node();
+		node->transform.translation = vec3(pos_dist(rnd), 6.0f + height_dist(rnd), pos_dist(rnd));
+		// Spots point down at the instances.
+		node->transform.rotation = angleAxis(-0.5f * pi<float>(), vec3(1.0f, 0.0f, 0.0f));
+		node->invalidate_cached_transform();
+		scene->create_light(info, node.get());
+		root.add_child(node);
+	}
+
+	depth_queues.resize(counts.shadow_casters);
+	depth_contexts.resize(counts.shadow_casters);
+
+	vec3 eye(0.0f, 30.0f, extent + 20.0f);
+	mat4 view = mat4_cast(look_at(normalize(vec3(0.0f, -0.4f, -1.0f)), vec3(0.0f, 1.0f, 0.0f))) * translate(-eye);
+	context.set_camera(projection(0.4f * pi<float>(), 16.0f / 9.0f, 0.1f, 4.0f * extent), view);
+
+	lighting.directional.direction = normalize(vec3(1.0f, 0.5f, 1.0f));
+	lighting.directional.color = vec3(1.0f, 0.8f, 0.6f);
+	renderer.set_mesh_renderer_options_from_lighting(lighting);
+	context.set_lighting_parameters(&lighting);
+
+	LOGI("Scene: %u static, %u dynamic, %u skinned, %u point, %u spot, %u shadow casters.\n",
+	     counts.static_instances, counts.dynamic_instances, counts.skinned_instances,
+	     counts.point_lights, counts.spot_lights, counts.shadow_casters);
+}
+
+void SceneStressApplication::update_dynamic(double elapsed_time)
+{
+	float t = float(elapsed_time);
+	for (size_t i = 0, n = dynamic_nodes.size(); i < n; i++)
+	{
+		auto &node = *dynamic_nodes[i];
+		node.transform.rotation = angleAxis(t + float(i), normalize(vec3(1.0f, 1.0f, 0.0f)));
+		node.invalidate_cached_transform();
+	}
+
+	for (size_t i = 0, n = bend_bones.size(); i < n; i++)
+	{
+		auto &bone = *bend_bones[i];
+		bone.transform.rotation = angleAxis(0.5f * sin(2.0f * t + float(i)), vec3(0.0f, 0.0f, 1.0f));
+		bone.invalidate_cached_transform();
+	}
+
+	scene->update_all_transforms();
+}
+
+void SceneStressApplication::gather()
+{
+	visible.clear();
+	visible_lights.clear();
+	scene->gather_visible_opaque_renderables(context.get_visibility_frustum(), visible);
+	scene->gather_visible_positional_lights(context.get_visibility_frustum(), visible_lights);
+	visible_renderables += visible.size();
+	visible_light_count += visible_lights.size();
+
+	// Shadow frusta follow gather_bindless_spot_shadow_renderables().
+	unsigned shadow_index = 0;
+	shadow_visible.clear();
+	for (auto &light : visible_lights)
+	{
+		if (shadow_index >= counts.shadow_casters)
+			break;
+		if (light.light->get_type() != PositionalLight::Type::Spot)
+			continue;
+
+		auto &spot = static_cast<const SpotLight &>(*light.light);
+		auto info = spot.get_shader_info(light.transform->transform->world_transform);
+		float range = tan(spot.get_xy_range());
+		mat4 view = mat4_cast(look_at_arbitrary_up(info.direction)) * translate(-info.position);
+		mat4 proj = projection(range * 2.0f, 1.0f, 0.005f / info.inv_radius, 1.0f / info.inv_radius);
+		depth_contexts[shadow_index].set_camera(proj, view);
+		shadow_index++;
+	}
+
+	// Not enough visible spots, reuse the main camera so the cost stays comparable.
+	auto &params = context.get_render_parameters();
+	for (unsigned i = shadow_index; i < counts.shadow_casters; i++)
+		depth_contexts[i].set_camera(params.projection, params.view);
+}
+
+void SceneStressApplication::push()
+{
+	renderer.begin(queue);
+	queue.push_renderables(context, visible.data(), visible.size());
+
+	for (unsigned i = 0; i < counts.shadow_casters; i++)
+	{
+		shadow_visible.clear();
+		scene->gather_visible_static_shadow_renderables(depth_contexts[i].get_visibility_frustum(), shadow_visible);
+		scene->gather_visible_dynamic_shadow_renderables(depth_contexts[i].get_visibility_frustum(), shadow_visible);
+		depth_renderer.begin(depth_queues[i]);
+		depth_queues[i].push_depth_renderables(depth_contexts[i], shadow_visible.data(), shadow_visible.size());
+	}
+}
+
+void SceneStressApplication::sort()
+{
+	queue.sort();
+	for (auto &depth_queue : depth_queues)
+		depth_queue.sort();
+}
+
+// Same inputs as LightClusterer::scan_visible_positional_lights() builds for bindless binning.
+void SceneStressApplication::cluster()
+{
+	unsigned count = unsigned(visible_lights.size());
+	cluster_lights.resize(count);
+	cluster_models.resize(count);
+	cluster_type_mask.assign((count + 31) / 32, 0);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &light = *visible_lights[i].light;
+		auto &world = visible_lights[i].transform->transform->world_transform;
+		if (light.get_type() == PositionalLight::Type::Spot)
+		{
+			auto &spot = static_cast<const SpotLight &>(light);
+			cluster_lights[i] = spot.get_shader_info(world);
+			cluster_models[i] = spot.build_model_matrix(world);
+		}
+		else
+		{
+			auto &point = static_cast<const PointLight &>(light);
+			cluster_lights[i] = point.get_shader_info(world);
+			cluster_models[i][0] = vec4(cluster_lights[i].position, 1.0f / cluster_lights[i].inv_radius);
+			cluster_type_mask[i >> 5] |= 1u << (i & 31u);
+		}
+	}
+
+	ClusterBinningInput input;
+	input.context = &context;
+	input.lights = cluster_lights.data();
+	input.models = cluster_models.data();
+	input.type_mask = cluster_type_mask.data();
+	input.num_lights = count;
+	input.resolution_x = 64;
+	input.resolution_y = 32;
+	input.resolution_z = 1024;
+	ClusterBinning::bin_lights(input, cluster_output);
+}
+
+void SceneStressApplication::submit()
+{
+	auto &device = get_wsi().get_device();
+	auto cmd = device.request_command_buffer();
+	auto rp = device.get_swapchain_render_pass(SwapchainRenderPass::Depth);
+	rp.clear_color[0].float32[0] = 0.01f;
+	rp.clear_color[0].float32[1] = 0.02f;
+	rp.clear_color[0].float32[2] = 0.03f;
+	cmd->begin_render_pass(rp);
+	renderer.flush(*cmd, queue, context, Renderer::SKIP_SORTING_BIT);
+	cmd->end_render_pass();
+	device.submit(cmd);
+}
+
+void SceneStressApplication::render_frame(double, double elapsed_time)
+{
+	uint64_t times[STAGE_COUNT + 1];
+	times[0] = Util::get_current_time_nsecs();
+	update_dynamic(elapsed_time);
+	times[1] = Util::get_current_time_nsecs();
+	gather();
+	times[2] = Util::get_current_time_nsecs();
+	push();
+	times[3] = Util::get_current_time_nsecs();
+	sort();
+	times[4] = Util::get_current_time_nsecs();
+	cluster();
+	times[5] = Util::get_current_time_nsecs();
+	submit();
+	times[6] = Util::get_current_time_nsecs();
+
+	frame++;
+	if (frame == options.warm_frames)
+	{
+		memset(stage_time, 0, sizeof(stage_time));
+		visible_renderables = 0;
+		visible_light_count = 0;
+	}
+	else if (frame > options.warm_frames)
+	{
+		for (unsigned i = 0; i < STAGE_COUNT; i++)
+			stage_time[i] += times[i + 1] - times[i];
+		if (frame == options.warm_frames + options.measure_frames)
+			end_step();
+	}
+}
+
+void SceneStressApplication::end_step()
+{
+	double frames = double(options.measure_frames);
+	char line[512];
+	snprintf(line, sizeof(line), "%u,%u,%u,%u,%u,%u,%.1f,%.1f",
+	         counts.static_instances, counts.dynamic_instances, counts.skinned_instances,
+	         counts.point_lights, counts.spot_lights, counts.shadow_casters,
+	         double(visible_renderables) / frames, double(visible_light_count) / frames);
+	csv += line;
+
+	double total_ms = 0.0;
+	for (unsigned i = 0; i < STAGE_COUNT; i++)
+	{
+		double ms = 1e-6 * double(stage_time[i]) / frames;
+		total_ms += ms;
+		snprintf(line, sizeof(line), ",%.4f", ms);
+		csv += line;
+		LOGI("  %-8s %.4f ms\n", stage_names[i], ms);
+	}
+	snprintf(line, sizeof(line), ",%.4f\n", total_ms);
+	csv += line;
+	LOGI("  total    %.4f ms\n", total_ms);
+
+	frame = 0;
+	if (++step < options.sweep_steps)
+	{
+		get_wsi().get_device().wait_idle();
+		counts.static_instances *= 2;
+		counts.dynamic_instances *= 2;
+		counts.skinned_instances *= 2;
+		counts.point_lights *= 2;
+		counts.spot_lights *= 2;
+		counts.shadow_casters *= 2;
+		build_scene();
+		return;
+	}
+
+	if (options.csv_path.empty())
+		LOGI("\n%s", csv.c_str());
+	else if (!GRANITE_FILESYSTEM()->write_string_to_file(options.csv_path, csv))
+		LOGE("Failed to write results to %s.\n", options.csv_path.c_str());
+	request_shutdown();
+}
+
+static void print_help()
+{
+	LOGI("scene-stress-bench\n"
+	     "\t[--static <count>] [--dynamic <count>] [--skinned <count>]\n"
+	     "\t[--point-lights <count>] [--spot-lights <count>] [--shadow-casters <count>]\n"
+	     "\t[--warm-frames <count>] [--measure-frames <count>]\n"
+	     "\t[--sweep <steps>] Doubles every count after each step.\n"
+	     "\t[--mesh <glTF>] Static instances use this mesh instead of cubes.\n"
+	     "\t[--csv <path>]\n");
+}
+
+namespace Granite
+{
+Application *application_create(int argc, char **argv)
+{
+	GRANITE_APPLICATION_SETUP_FILESYSTEM();
+
+	StressOptions options;
+	CLICallbacks cbs;
+	cbs.add("--static", [&](CLIParser &parser) { options.static_instances = parser.next_uint(); });
+	cbs.add("--dynamic", [&](CLIParser &parser) { options.dynamic_instances = parser.next_uint(); });
+	cbs.add("--skinned", [&](CLIParser &parser) { options.skinned_instances = parser.next_uint(); });
+	cbs.add("--point-lights", [&](CLIParser &parser) { options.point_lights = parser.next_uint(); });
+	cbs.add("--spot-lights", [&](CLIParser &parser) { options.spot_lights = parser.next_uint(); });
+	cbs.add("--shadow-casters", [&](CLIParser &parser) { options.shadow_casters = parser.next_uint(); });
+	cbs.add("--warm-frames", [&](CLIParser &parser) { options.warm_frames = std::max(parser.next_uint(), 1u); });
+	cbs.add("--measure-frames", [&](CLIParser &parser) { options.measure_frames = std::max(parser.next_uint(), 1u); });
+	cbs.add("--sweep", [&](CLIParser &parser) { options.sweep_steps = std::max(parser.next_uint(), 1u); });
+	cbs.add("--mesh", [&](CLIParser &parser) { options.mesh_path = parser.next_string(); });
+	cbs.add("--csv", [&](CLIParser &parser) { options.csv_path = parser.next_string(); });
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return nullptr;
+	if (parser.is_ended_state())
+		return nullptr;
+
+	try
+	{
+		auto *app = new SceneStressApplication(options);
+		return app;
+	}
+	catch (const std::exception &e)
+	{
+		LOGE("application_create() threw exception: %s\n", e.what());
+		return nullptr;
+	}
+}
+}
@@ -31,11 +31,15 @@
 #include "thread_group.hpp"
 #include "shader.hpp"
 #include <assert.h>
+#include <string.h>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace Util;
@@ -43,7 +47,7 @@ using namespace Granite;
 
 static void print_help()
 {
-	LOGE("slangmosh <desc.json> [-O] [--strip] [--vk11] [--output header.hpp] [--help]\n");
+	LOGE("slangmosh <desc.json> [-O] [--strip] [--vk11] [--output header.hpp] [--cache cache.bin] [--depfile header.d] [--help]\n");
 }
 
 struct ShaderVariant
@@ -61,8 +65,11 @@ struct Shader
 	std::vector<std::string> include;
 	bool compute = false;
 
+	std::unique_ptr<GLSLCompiler> compiler;
+	std::vector<std::vector<std::pair<std::string, int>>> permutation_defines;
+
 	size_t total_permutations() const;
-	void dispatch_variants(std::vector<uint32_t> *output_spirv, Target target, bool opt, bool strip) const;
+	bool prepare(GLSLIncludeCache &cache, Target target, bool opt, bool strip);
 	int permutation_to_variant_define(size_t permutation, size_t variant_index) const;
 	size_t stride_for_variant_index(size_t variant_index) const;
 };
@@ -83,69 +90,38 @@ int Shader::permutation_to_variant_define(size_t permutation, size_t variant_ind
 	return int(wrapped_index);
 }
 
-void Shader::dispatch_variants(std::vector<uint32_t> *output_spirv, Target target, bool opt, bool strip) const
+bool Shader::prepare(GLSLIncludeCache &cache, Target target, bool opt, bool strip)
 {
-	if (variants.empty())
+	compiler.reset(new GLSLCompiler(*Global::filesystem()));
+	if (!compiler->set_source_from_file(path))
+		return false;
+	compiler->set_target(target);
+	compiler->set_optimization(opt ? GLSLCompiler::Optimization::ForceOn : GLSLCompiler::Optimization::ForceOff);
+	compiler->set_strip(strip);
+	compiler->set_include_directories(&include);
+	compiler->set_include_cache(&cache);
+
+	// Variants only differ in defines, so preprocess once.
+	if (!compiler->preprocess())
 	{
-		GRANITE_THREAD_GROUP()->create_task([=]() {
-			GLSLCompiler comp(*Global::filesystem());
-			comp.set_source_from_file(path);
-			comp.set_target(target);
-			comp.set_optimization(opt ? GLSLCompiler::Optimization::ForceOn : GLSLCompiler::Optimization::ForceOff);
-			comp.set_strip(strip);
-			comp.set_include_directories(&include);
-			if (!comp.preprocess())
-			{
-				LOGE("Failed to preprocess shader: %s.\n", path.c_str());
-				return;
-			}
-
-			std::string error_message;
-			output_spirv[0] = comp.compile(error_message, nullptr);
-			if (output_spirv[0].empty())
-			{
-				LOGE("Failed to compile shader: %s.\n", path.c_str());
-				LOGE("%s\n", error_message.c_str());
-				return;
-			}
-		});
+		LOGE("Failed to preprocess shader: %s.\n", path.c_str());
+		return false;
 	}
-	else
+
+	size_t num_permutations = total_permutations();
+	permutation_defines.resize(num_permutations);
+	if (!variants.empty())
 	{
-		size_t num_permutations = total_permutations();
 		for (size_t perm = 0; perm < num_permutations; perm++)
 		{
-			GRANITE_THREAD_GROUP()->create_task([=]() {
-				GLSLCompiler comp(*Global::filesystem());
-				comp.set_source_from_file(path);
-				comp.set_target(target);
-				comp.set_optimization(opt ? GLSLCompiler::Optimization::ForceOn : GLSLCompiler::Optimization::ForceOff);
-				comp.set_strip(strip);
-				comp.set_include_directories(&include);
-				if (!comp.preprocess())
-				{
-					LOGE("Failed to preprocess shader: %s.\n", path.c_str());
-					return;
-				}
-
-				std::vector<std::pair<std::string, int>> defines;
-				defines.resize(variants.size());
-				for (size_t i = 0; i < defines.size(); i++)
-					defines[i] = { variants[i].define, permutation_to_variant_define(perm, i) };
-
-				std::string error_message;
-				output_spirv[perm] = comp.compile(error_message, &defines);
-				if (output_spirv[perm].empty())
-				{
-					LOGE("Failed to compile shader: %s with defines:\n", path.c_str());
-					for (auto &def : defines)
-						LOGE("  #define %s %d.\n", def.first.c_str(), def.second);
-					LOGE("%s\n", error_message.c_str());
-					return;
-				}
-			});
+			auto &defines = permutation_defines[perm];
+			defines.resize(variants.size());
+			for (size_t i = 0; i < defines.size(); i++)
+				defines[i] = { variants[i].define, permutation_to_variant_define(perm, i) };
 		}
 	}
+
+	return true;
 }
 
 size_t Shader::total_permutations() const
@@ -161,6 +137,113 @@ size_t Shader::total_permutations() const
 	return perm;
 }
 
+// Compiled SPIR-V from earlier runs, keyed by GLSLCompiler::get_compile_hash().
+static constexpr uint32_t SpirvCacheMagic = 0x534c4d43;
+static constexpr uint32_t SpirvCacheVersion = 1;
+
+static std::unordered_map<Hash, std::vector<uint32_t>> load_spirv_cache(const std::string &path)
+{
+	std::unordered_map<Hash, std::vector<uint32_t>> cache;
+	auto file = GRANITE_FILESYSTEM()->open(path);
+	if (!file)
+		return cache;
+
+	auto *data = static_cast<const uint8_t *>(file->map());
+	size_t size = file->get_size();
+	if (!data || size < 3 * sizeof(uint32_t))
+		return cache;
+
+	uint32_t header[3];
+	memcpy(header, data, sizeof(header));
+	if (header[0] != SpirvCacheMagic || header[1] != SpirvCacheVersion)
+		return cache;
+
+	size_t offset = sizeof(header);
+	for (uint32_t i = 0; i < header[2]; i++)
+	{
+		Hash hash;
+		uint32_t word_count;
+		if (offset + sizeof(hash) + sizeof(word_count) > size)
+			break;
+		memcpy(&hash, data + offset, sizeof(hash));
+		memcpy(&word_count, data + offset + sizeof(hash), sizeof(word_count));
+		offset += sizeof(hash) + sizeof(word_count);
+
+		if (offset + word_count * sizeof(uint32_t) > size)
+			break;
+		auto &spirv = cache[hash];
+		spirv.resize(word_count);
+		memcpy(spirv.data(), data + offset, word_count * sizeof(uint32_t));
+		offset += word_count * sizeof(uint32_t);
+	}
+
+	return cache;
+}
+
+static bool save_spirv_cache(const std::string &path, const std::vector<GLSLCompileJob> &jobs)
+{
+	std::vector<uint8_t> buffer(3 * sizeof(uint32_t));
+	std::unordered_set<Hash> seen;
+	uint32_t count = 0;
+
+	for (auto &job : jobs)
+	{
+		auto hash = job.compiler->get_compile_hash(job.defines);
+		if (!seen.insert(hash).second)
+			continue;
+
+		auto word_count = uint32_t(job.spirv.size());
+		size_t offset = buffer.size();
+		buffer.resize(offset + sizeof(hash) + sizeof(word_count) + word_count * sizeof(uint32_t));
+		memcpy(buffer.data() + offset, &hash, sizeof(hash));
+		memcpy(buffer.data() + offset + sizeof(hash), &word_count, sizeof(word_count));
+		memcpy(buffer.data() + offset + sizeof(hash) + sizeof(word_count), job.spirv.data(), word_count * sizeof(uint32_t));
+		count++;
+	}
+
+	const uint32_t header[3] = { SpirvCacheMagic, SpirvCacheVersion, count };
+	memcpy(buffer.data(), header, sizeof(header));
+	return GRANITE_FILESYSTEM()->write_buffer_to_file(path, buffer.data(), buffer.size());
+}
+
+static std::string escape_depfile_path(const std::string &path)
+{
+	std::string escaped;
+	for (auto c : path)
+	{
+		// Backslashes are left alone since they are path separators on Windows.
+		if (c == ' ' || c == '#')
+			escaped += '\\';
+		else if (c == '$')
+			escaped += '$';
+		escaped += c;
+	}
+	return escaped;
+}
+
+static bool write_depfile(const std::string &path, const std::string &target, const std::string &input_path,
+                          const std::vector<Shader> &shaders)
+{
+	std::set<std::string> deps;
+	deps.insert(input_path);
+	for (auto &shader : shaders)
+	{
+		deps.insert(shader.path);
+		for (auto &dep : shader.compiler->get_dependencies())
+			deps.insert(dep);
+	}
+
+	std::string str = escape_depfile_path(target) + ":";
+	for (auto &dep : deps)
+	{
+		str += " \\\n  ";
+		str += escape_depfile_path(dep);
+	}
+	str += "\n";
+
+	return GRANITE_FILESYSTEM()->write_string_to_file(path, str);
+}
+
 static std::vector<Shader> parse_shaders(const std::string &path)
 {
 	std::vector<Shader> parsed_shaders;
@@ -433,6 +516,8 @@ static int main_inner(int argc, char **argv)
 	std::string output_path;
 	std::string input_path;
 	std::string generated_namespace;
+	std::string cache_path;
+	std::string depfile_path;
 	bool strip = false;
 	bool opt = false;
 	bool vk11 = false;
@@ -444,6 +529,8 @@ static int main_inner(int argc, char **argv)
 	cbs.add("--strip", [&](CLIParser &) { strip = true; });
 	cbs.add("--vk11", [&](CLIParser &) { vk11 = true; });
 	cbs.add("--namespace", [&](CLIParser &parser) { generated_namespace = parser.next_string(); });
+	cbs.add("--cache", [&](CLIParser &parser) { cache_path = parser.next_string(); });
+	cbs.add("--depfile", [&](CLIParser &parser) { depfile_path = parser.next_string(); });
 	cbs.default_handler = [&](const char *str) { input_path = str; };
 
 	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
@@ -469,33 +556,105 @@ static int main_inner(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	GLSLIncludeCache include_cache;
+	std::vector<GLSLCompileJob> jobs;
+	for (auto &parsed_shader : parsed_shaders)
+	{
+		if (!parsed_shader.prepare(include_cache, vk11 ? Target::Vulkan11 : Target::Vulkan10, opt, strip))
+			return EXIT_FAILURE;
+
+		for (auto &defines : parsed_shader.permutation_defines)
+			jobs.push_back({ parsed_shader.compiler.get(), parsed_shader.variants.empty() ? nullptr : &defines, {}, {} });
+	}
+
+	// Only compile what the cache from the previous run does not cover.
+	std::vector<GLSLCompileJob> pending_jobs;
+	std::vector<size_t> pending_indices;
+	{
+		auto cache = cache_path.empty() ? std::unordered_map<Hash, std::vector<uint32_t>>() : load_spirv_cache(cache_path);
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			auto itr = cache.find(jobs[i].compiler->get_compile_hash(jobs[i].defines));
+			if (itr != cache.end() && !itr->second.empty())
+				jobs[i].spirv = itr->second;
+			else
+			{
+				pending_jobs.push_back(jobs[i]);
+				pending_indices.push_back(i);
+			}
+		}
+	}
+
+	if (!cache_path.empty())
+		LOGI("Compiling %zu of %zu shader variants.\n", pending_jobs.size(), jobs.size());
+
+	bool compiled = compile_batch(GRANITE_THREAD_GROUP(), pending_jobs.data(), pending_jobs.size());
+	for (size_t i = 0; i < pending_jobs.size(); i++)
+		jobs[pending_indices[i]] = std::move(pending_jobs[i]);
+
+	if (!compiled)
+	{
+		size_t job_index = 0;
+		for (auto &parsed_shader : parsed_shaders)
+		{
+			for (size_t perm = 0; perm < parsed_shader.permutation_defines.size(); perm++, job_index++)
+			{
+				auto &job = jobs[job_index];
+				if (!job.spirv.empty())
+					continue;
+
+				LOGE("Failed to compile shader: %s with defines:\n", parsed_shader.path.c_str());
+				for (auto &def : parsed_shader.permutation_defines[perm])
+					LOGE("  #define %s %d.\n", def.first.c_str(), def.second);
+				LOGE("%s\n", job.error_message.c_str());
+			}
+		}
+		return EXIT_FAILURE;
+	}
+
+	if (!cache_path.empty() && !save_spirv_cache(cache_path, jobs))
+		LOGW("Failed to write SPIR-V cache: %s.\n", cache_path.c_str());
+
 	std::vector<std::vector<std::vector<uint32_t>>> spirv_for_shaders_and_variants;
 	spirv_for_shaders_and_variants.resize(parsed_shaders.size());
-
+	size_t job_index = 0;
 	for (size_t shader_index = 0; shader_index < parsed_shaders.size(); shader_index++)
 	{
 		auto &shader_variants = spirv_for_shaders_and_variants[shader_index];
-		auto &parsed_shader = parsed_shaders[shader_index];
-		shader_variants.resize(parsed_shader.total_permutations());
-		parsed_shader.dispatch_variants(shader_variants.data(), vk11 ? Target::Vulkan11 : Target::Vulkan10, opt, strip);
+		shader_variants.resize(parsed_shaders[shader_index].total_permutations());
+		for (auto &perm : shader_variants)
+			perm = std::move(jobs[job_index++].spirv);
 	}
 
-	GRANITE_THREAD_GROUP()->wait_idle();
-
-	for (auto &shader : spirv_for_shaders_and_variants)
-		for (auto &perm : shader)
-			if (perm.empty())
-				return EXIT_FAILURE;
-
 	auto generated_code = generate_header(parsed_shaders, spirv_for_shaders_and_variants, generated_namespace);
 
 	if (output_path.empty())
 		printf("%s\n", generated_code.c_str());
 	else
 	{
-		if (!GRANITE_FILESYSTEM()->write_string_to_file(output_path, generated_code))
+		// Leave an unchanged header alone so that nothing which includes it is rebuilt.
+		std::string existing_code;
+		if (!GRANITE_FILESYSTEM()->read_file_to_string(output_path, existing_code) || existing_code != generated_code)
+		{
+			if (!GRANITE_FILESYSTEM()->write_string_to_file(output_path, generated_code))
+			{
+				LOGE("Failed to write to file: %s.\n", output_path.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (!depfile_path.empty())
+	{
+		if (output_path.empty())
+		{
+			LOGE("--depfile requires --output.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (!write_depfile(depfile_path, output_path, input_path, parsed_shaders))
 		{
-			LOGE("Failed to write to file: %s.\n", output_path.c_str());
+			LOGE("Failed to write to file: %s.\n", depfile_path.c_str());
 			return EXIT_FAILURE;
 		}
 	}
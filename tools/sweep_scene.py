@@ -67,6 +67,12 @@ def main():
     parser.add_argument('--png-result-dir',
                         help = 'Store frame results in directory',
                         type = str)
+    parser.add_argument('--image-reference-dir',
+                        help = 'Compare the final frame on the GPU against <config>.png in this directory',
+                        type = str)
+    parser.add_argument('--image-reference-threshold',
+                        help = 'Fail if PSNR against the reference is below this, in dB',
+                        type = float)
     parser.add_argument('--results',
                         help = 'Store results JSON',
                         type = str)
@@ -116,6 +122,13 @@ def main():
             sweep.append('--png-reference-path')
             sweep.append(os.path.join(args.png_result_dir, base_config + '.png'))
 
+        if args.image_reference_dir:
+            sweep.append('--image-reference')
+            sweep.append(os.path.join(args.image_reference_dir, base_config + '.png'))
+            if args.image_reference_threshold is not None:
+                sweep.append('--image-reference-threshold')
+                sweep.append(str(args.image_reference_threshold))
+
         avg, stddev, gpu, version, perf = run_test(sweep, base_config, iterations, stat_file)
 
         results.append((base_config, avg, stddev, perf))
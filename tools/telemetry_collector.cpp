@@ -0,0 +1,345 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "network.hpp"
+#include "telemetry.hpp"
+#include "cli_parser.hpp"
+#include "logging.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace Granite;
+using namespace Util;
+using namespace std;
+
+// Watches the telemetry stream of any number of TelemetryServer instances,
+// and prints a summary per device every interval. Devices which go away are reconnected.
+
+struct Device
+{
+	string host;
+	uint16_t port = TELEMETRY_DEFAULT_PORT;
+	string name;
+	bool connected = false;
+	chrono::steady_clock::time_point next_connect = {};
+
+	// Accumulated since the last report.
+	unsigned frames = 0;
+	double frame_time_ms = 0.0;
+	double cpu_time_ms = 0.0;
+	double gpu_time_ms = 0.0;
+	float max_frame_time_ms = 0.0f;
+	uint64_t missed_frames = 0;
+	uint64_t last_frame_index = 0;
+	TelemetryFrameStats last = {};
+
+	vector<TelemetryMemoryTagStats> tags;
+	vector<TelemetryTaskStats> tasks;
+};
+
+struct Options
+{
+	FILE *csv = nullptr;
+	bool verbose = false;
+};
+
+static void handle_frame(Device &device, const Options &options, const TelemetryFrameStats &stats)
+{
+	if (device.last_frame_index && stats.frame_index > device.last_frame_index + 1)
+		device.missed_frames += stats.frame_index - device.last_frame_index - 1;
+	device.last_frame_index = stats.frame_index;
+
+	device.frames++;
+	device.frame_time_ms += stats.frame_time_ms;
+	device.cpu_time_ms += stats.cpu_time_ms;
+	device.gpu_time_ms += stats.gpu_time_ms;
+	device.max_frame_time_ms = std::max(device.max_frame_time_ms, stats.frame_time_ms);
+	device.last = stats;
+
+	if (options.csv)
+	{
+		fprintf(options.csv, "%s,%llu,%llu,%.3f,%.3f,%.3f,%u,%llu,%llu\n",
+		        device.name.c_str(),
+		        static_cast<unsigned long long>(stats.frame_index),
+		        static_cast<unsigned long long>(stats.timestamp_ns),
+		        stats.frame_time_ms, stats.cpu_time_ms, stats.gpu_time_ms, stats.submissions,
+		        static_cast<unsigned long long>(stats.device_memory_usage),
+		        static_cast<unsigned long long>(stats.device_memory_budget));
+	}
+}
+
+template <typename T>
+static bool read_array(vector<T> &entries, const uint8_t *data, uint32_t size)
+{
+	uint32_t count;
+	if (size < sizeof(count))
+		return false;
+	memcpy(&count, data, sizeof(count));
+	if (size - sizeof(count) < uint64_t(count) * sizeof(T))
+		return false;
+
+	entries.resize(count);
+	if (count)
+		memcpy(entries.data(), data + sizeof(count), count * sizeof(T));
+	return true;
+}
+
+struct CollectorHandler : LooperHandler
+{
+	CollectorHandler(Device &device_, const Options &options_, unique_ptr<Socket> socket_)
+		: LooperHandler(move(socket_)), device(device_), options(options_)
+	{
+		device.connected = true;
+	}
+
+	~CollectorHandler() override
+	{
+		device.connected = false;
+		LOGI("%s: disconnected.\n", device.name.c_str());
+	}
+
+	bool handle_packet(const TelemetryPacketHeader &header, const uint8_t *data)
+	{
+		switch (header.type)
+		{
+		case TELEMETRY_HELLO:
+		{
+			TelemetryHello hello;
+			if (header.size < sizeof(hello))
+				return false;
+			memcpy(&hello, data, sizeof(hello));
+			if (hello.magic != TELEMETRY_MAGIC || hello.version != TELEMETRY_VERSION)
+			{
+				LOGE("%s:%u is not a compatible telemetry server.\n", device.host.c_str(), device.port);
+				return false;
+			}
+
+			hello.device_name[sizeof(hello.device_name) - 1] = '\0';
+			if (hello.device_name[0] != '\0')
+				device.name = device.host + " (" + hello.device_name + ")";
+			device.last_frame_index = 0;
+			LOGI("%s: connected.\n", device.name.c_str());
+			return true;
+		}
+
+		case TELEMETRY_FRAME:
+		{
+			TelemetryFrameStats stats;
+			if (header.size < sizeof(stats))
+				return false;
+			memcpy(&stats, data, sizeof(stats));
+			handle_frame(device, options, stats);
+			return true;
+		}
+
+		case TELEMETRY_MEMORY_TAGS:
+			return read_array(device.tags, data, header.size);
+
+		case TELEMETRY_TASKS:
+			return read_array(device.tasks, data, header.size);
+
+		default:
+			// Newer packet types are skipped.
+			return true;
+		}
+	}
+
+	bool handle(Looper &, EventFlags flags) override
+	{
+		if (flags & (EVENT_HANGUP | EVENT_ERROR))
+			return false;
+
+		uint8_t chunk[16 * 1024];
+		int ret = socket->read(chunk, sizeof(chunk));
+		if (ret == Socket::ErrorWouldBlock)
+			return true;
+		else if (ret <= 0)
+			return false;
+
+		buffer.insert(buffer.end(), chunk, chunk + ret);
+
+		size_t offset = 0;
+		TelemetryPacketHeader header;
+		while (buffer.size() - offset >= sizeof(header))
+		{
+			memcpy(&header, buffer.data() + offset, sizeof(header));
+			if (buffer.size() - offset - sizeof(header) < header.size)
+				break;
+
+			if (!handle_packet(header, buffer.data() + offset + sizeof(header)))
+			{
+				LOGE("%s: malformed packet, dropping connection.\n", device.name.c_str());
+				return false;
+			}
+
+			offset += sizeof(header) + header.size;
+		}
+
+		buffer.erase(buffer.begin(), buffer.begin() + offset);
+		return true;
+	}
+
+	Device &device;
+	const Options &options;
+	vector<uint8_t> buffer;
+};
+
+static void report(Device &device, const Options &options)
+{
+	if (!device.connected)
+		return;
+
+	if (!device.frames)
+	{
+		LOGI("%s: no frames.\n", device.name.c_str());
+		return;
+	}
+
+	double inv_frames = 1.0 / double(device.frames);
+	LOGI("%s: %u frames, frame %.3f ms (max %.3f ms), CPU %.3f ms, GPU %.3f ms, %.1f / %.1f MiB, %llu missed.\n",
+	     device.name.c_str(), device.frames,
+	     device.frame_time_ms * inv_frames, device.max_frame_time_ms,
+	     device.cpu_time_ms * inv_frames, device.gpu_time_ms * inv_frames,
+	     double(device.last.device_memory_usage) / double(1024 * 1024),
+	     double(device.last.device_memory_budget) / double(1024 * 1024),
+	     static_cast<unsigned long long>(device.missed_frames));
+
+	if (options.verbose)
+	{
+		for (auto &tag : device.tags)
+		{
+			if (!tag.peak_count)
+				continue;
+			LOGI("  %.*s: %.1f MiB x%u (peak %.1f MiB)\n", int(sizeof(tag.tag)), tag.tag,
+			     double(tag.live_size) / double(1024 * 1024), tag.live_count,
+			     double(tag.peak_size) / double(1024 * 1024));
+		}
+
+		for (auto &task : device.tasks)
+		{
+			LOGI("  %.*s: %u tasks, p50 %u us, p99 %u us, max %u us\n", int(sizeof(task.desc)), task.desc,
+			     task.count, task.p50_us, task.p99_us, task.max_us);
+		}
+	}
+
+	device.frames = 0;
+	device.frame_time_ms = 0.0;
+	device.cpu_time_ms = 0.0;
+	device.gpu_time_ms = 0.0;
+	device.max_frame_time_ms = 0.0f;
+	device.missed_frames = 0;
+}
+
+static void print_help()
+{
+	LOGI("Usage: telemetry-collector [--interval <ms>] [--csv <path>] [--verbose] <host[:port]>...\n");
+}
+
+int main(int argc, char *argv[])
+{
+	vector<Device> devices;
+	Options options;
+	unsigned interval_ms = 1000;
+	string csv_path;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [&](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--interval", [&](CLIParser &parser) { interval_ms = std::max(parser.next_uint(), 1u); });
+	cbs.add("--csv", [&](CLIParser &parser) { csv_path = parser.next_string(); });
+	cbs.add("--verbose", [&](CLIParser &) { options.verbose = true; });
+	cbs.default_handler = [&](const char *arg) {
+		Device device;
+		device.host = arg;
+		auto colon = device.host.find_last_of(':');
+		if (colon != string::npos)
+		{
+			device.port = uint16_t(strtoul(device.host.c_str() + colon + 1, nullptr, 0));
+			device.host.resize(colon);
+		}
+		device.name = device.host;
+		devices.push_back(move(device));
+	};
+	cbs.error_handler = []() { print_help(); };
+	CLIParser parser(move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+		return 1;
+	else if (parser.is_ended_state())
+		return 0;
+
+	if (devices.empty())
+	{
+		print_help();
+		return 1;
+	}
+
+	if (!csv_path.empty())
+	{
+		options.csv = fopen(csv_path.c_str(), "w");
+		if (!options.csv)
+		{
+			LOGE("Failed to open %s.\n", csv_path.c_str());
+			return 1;
+		}
+		fprintf(options.csv, "device,frame,timestamp_ns,frame_ms,cpu_ms,gpu_ms,submissions,memory_usage,memory_budget\n");
+	}
+
+	Looper looper;
+	auto interval = chrono::milliseconds(interval_ms);
+	auto next_report = chrono::steady_clock::now() + interval;
+
+	for (;;)
+	{
+		auto now = chrono::steady_clock::now();
+		for (auto &device : devices)
+		{
+			if (device.connected || now < device.next_connect)
+				continue;
+
+			device.next_connect = now + chrono::seconds(1);
+			auto socket = Socket::connect(device.host.c_str(), device.port);
+			if (socket)
+				looper.register_handler(EVENT_IN, unique_ptr<LooperHandler>(new CollectorHandler(device, options, move(socket))));
+		}
+
+		auto timeout = chrono::duration_cast<chrono::milliseconds>(next_report - now).count();
+		if (looper.wait_idle(int(std::max<long long>(timeout, 0))) < 0)
+			break;
+
+		if (chrono::steady_clock::now() >= next_report)
+		{
+			for (auto &device : devices)
+				report(device, options);
+			if (options.csv)
+				fflush(options.csv);
+			next_report += interval;
+		}
+	}
+
+	if (options.csv)
+		fclose(options.csv);
+}
@@ -0,0 +1,166 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "logging.hpp"
+#include "timeline_trace_file.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace Util;
+using namespace Util::TimelineTraceBinary;
+
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	uint8_t buffer[64 * 1024];
+	size_t read_bytes;
+	while ((read_bytes = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		data.insert(data.end(), buffer, buffer + read_bytes);
+
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		LOGE("Usage: %s <input.gtrace> <output.json>\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<uint8_t> data;
+	if (!read_file(argv[1], data))
+	{
+		LOGE("Failed to open %s.\n", argv[1]);
+		return 1;
+	}
+
+	FileHeader header;
+	if (data.size() < sizeof(header))
+	{
+		LOGE("Trace file is too small.\n");
+		return 1;
+	}
+
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, Magic, sizeof(Magic)) != 0)
+	{
+		LOGE("Invalid magic in trace file.\n");
+		return 1;
+	}
+
+	FILE *file = fopen(argv[2], "w");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", argv[2]);
+		return 1;
+	}
+
+	std::vector<std::string> strings;
+	const auto get_string = [&](uint32_t id) -> const char * {
+		return id < strings.size() ? strings[id].c_str() : "";
+	};
+
+	fputs("[\n", file);
+	bool first = true;
+	uint64_t num_events = 0;
+	uint64_t num_dropped = 0;
+
+	size_t offset = sizeof(header);
+	while (offset + sizeof(BlockHeader) <= data.size())
+	{
+		BlockHeader block;
+		memcpy(&block, data.data() + offset, sizeof(block));
+		offset += sizeof(block);
+
+		if (offset + block.size > data.size())
+		{
+			LOGW("Trace file is truncated.\n");
+			break;
+		}
+
+		const uint8_t *payload = data.data() + offset;
+		offset += block.size;
+
+		switch (block.type)
+		{
+		case BlockType::String:
+		{
+			if (block.size < sizeof(uint32_t))
+				break;
+			uint32_t id;
+			memcpy(&id, payload, sizeof(id));
+			if (id >= strings.size())
+				strings.resize(id + 1);
+			strings[id].assign(reinterpret_cast<const char *>(payload) + sizeof(id), block.size - sizeof(id));
+			break;
+		}
+
+		case BlockType::Events:
+		{
+			size_t count = block.size / sizeof(BinaryEvent);
+			for (size_t i = 0; i < count; i++)
+			{
+				BinaryEvent e;
+				memcpy(&e, payload + i * sizeof(BinaryEvent), sizeof(e));
+
+				auto start_us = int64_t(e.start_ns - header.base_ns) * 1e-3;
+				auto end_us = int64_t(e.end_ns - header.base_ns) * 1e-3;
+				if (start_us > end_us)
+					continue;
+
+				const char *desc = get_string(e.desc_id);
+				const char *tid = get_string(e.tid_id);
+				fprintf(file, "%s{ \"name\": \"%s\", \"ph\": \"B\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %f },\n",
+				        first ? "" : ",\n", desc, tid, e.pid, start_us);
+				fprintf(file, "{ \"name\": \"%s\", \"ph\": \"E\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %f }",
+				        desc, tid, e.pid, end_us);
+				first = false;
+				num_events++;
+			}
+			break;
+		}
+
+		case BlockType::Dropped:
+			if (block.size >= sizeof(uint64_t))
+				memcpy(&num_dropped, payload, sizeof(num_dropped));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	fputs("\n]\n", file);
+	fclose(file);
+
+	LOGI("Converted %llu events.\n", static_cast<unsigned long long>(num_events));
+	if (num_dropped)
+		LOGW("Trace dropped %llu events during capture.\n", static_cast<unsigned long long>(num_dropped));
+	return 0;
+}
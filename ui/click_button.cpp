@@ -57,6 +57,7 @@ void ClickButton::reconfigure_to_canvas(vec2, vec2)
 Widget *ClickButton::on_mouse_button_pressed(vec2)
 {
 	click_held = true;
+	redraw_changed();
 	if (click_cb)
 		click_cb();
 	return this;
@@ -65,6 +66,7 @@ Widget *ClickButton::on_mouse_button_pressed(vec2)
 void ClickButton::on_mouse_button_released(vec2)
 {
 	click_held = false;
+	redraw_changed();
 }
 
 float ClickButton::render(FlatRenderer &renderer, float layer, vec2 offset, vec2 size)
@@ -53,6 +53,11 @@ public:
 
 	void reconfigure() override;
 
+	bool get_retainable() const override
+	{
+		return false;
+	}
+
 private:
 	float render(FlatRenderer &renderer, float layout, vec2 offset, vec2 size) override;
 	void reconfigure_to_canvas(vec2 offset, vec2 size) override;
@@ -57,6 +57,7 @@ public:
 	void set_color(vec4 color_)
 	{
 		color = color_;
+		redraw_changed();
 	}
 
 	vec4 get_color() const
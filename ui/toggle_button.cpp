@@ -57,6 +57,7 @@ void ToggleButton::reconfigure_to_canvas(vec2, vec2)
 Widget *ToggleButton::on_mouse_button_pressed(vec2)
 {
 	click_held = true;
+	redraw_changed();
 	toggled = !toggled;
 	if (toggle_cb)
 		toggle_cb(toggled);
@@ -66,6 +67,7 @@ Widget *ToggleButton::on_mouse_button_pressed(vec2)
 void ToggleButton::on_mouse_button_released(vec2)
 {
 	click_held = false;
+	redraw_changed();
 }
 
 float ToggleButton::render(FlatRenderer &renderer, float layer, vec2 offset, vec2 size)
@@ -31,6 +31,17 @@ namespace UI
 {
 UIManager::UIManager()
 {
+	EVENT_MANAGER_REGISTER_LATCH(UIManager, on_device_created, on_device_destroyed, Vulkan::DeviceCreatedEvent);
+}
+
+void UIManager::on_device_created(const Vulkan::DeviceCreatedEvent &)
+{
+}
+
+void UIManager::on_device_destroyed(const Vulkan::DeviceCreatedEvent &)
+{
+	// Recordings point to font atlases owned by the device.
+	retained.clear();
 }
 
 void UIManager::add_child(WidgetHandle handle)
@@ -41,6 +52,7 @@ void UIManager::add_child(WidgetHandle handle)
 void UIManager::reset_children()
 {
 	widgets.clear();
+	retained.clear();
 }
 
 void UIManager::remove_child(Widget *widget)
@@ -49,6 +61,78 @@ void UIManager::remove_child(Widget *widget)
 		return handle.get() == widget;
 	});
 	widgets.erase(itr, end(widgets));
+	retained.erase(widget);
+}
+
+void UIManager::set_retained_rendering(bool enable)
+{
+	retained_rendering = enable;
+	if (!enable)
+		retained.clear();
+}
+
+static void get_window_canvas(const Vulkan::CommandBuffer &cmd, const Window &window, vec2 &position, vec2 &size)
+{
+	if (window.is_fullscreen())
+	{
+		position = vec2(0.0f);
+		size = vec2(cmd.get_viewport().width, cmd.get_viewport().height);
+	}
+	else
+	{
+		position = window.get_floating_position();
+		size = window.get_minimum_geometry();
+	}
+}
+
+float UIManager::render_window(Vulkan::CommandBuffer &cmd, Widget &widget, float layer)
+{
+	auto &window = static_cast<Window &>(widget);
+	widget.reconfigure_geometry();
+
+	vec2 window_size;
+	vec2 window_pos;
+
+	if (window.is_fullscreen())
+	{
+		window_size.x = cmd.get_viewport().width;
+		window_size.y = cmd.get_viewport().height;
+		widget.reconfigure_geometry_to_canvas(vec2(0.0f),
+		                                      vec2(cmd.get_viewport().width, cmd.get_viewport().height));
+		window_pos = vec2(0.0f);
+	}
+	else
+	{
+		widget.reconfigure_geometry_to_canvas(window.get_floating_position(), window.get_minimum_geometry());
+		window_size = max(widget.get_target_geometry(), widget.get_minimum_geometry());
+		window_pos = window.get_floating_position();
+	}
+
+	renderer.push_scissor(window.get_floating_position(), window_size);
+	float min_layer = widget.render(renderer, layer, window_pos, window_size);
+	renderer.pop_scissor();
+	return min_layer;
+}
+
+void UIManager::record_window(Vulkan::CommandBuffer &cmd, RetainedWindow &window, float layer)
+{
+	if (!window.recording)
+		window.recording.reset(new RenderQueue);
+
+	renderer.begin_recording(*window.recording);
+	window.min_layer = render_window(cmd, *window.widget, layer);
+	renderer.end_recording();
+
+	get_window_canvas(cmd, static_cast<const Window &>(*window.widget), window.position, window.size);
+	window.layer = layer;
+	window.valid = window.widget->get_retainable();
+	window.recorded = true;
+	window.widget->clear_needs_redraw();
+}
+
+uint64_t UIManager::get_glyph_generation() const
+{
+	return glyph_cache ? glyph_cache->get_generation() : 0;
 }
 
 void UIManager::render(Vulkan::CommandBuffer &cmd)
@@ -58,37 +142,68 @@ void UIManager::render(Vulkan::CommandBuffer &cmd)
 	const float max_layers = 20000.0f; // Roughly for D16 with some headroom for quantization errors.
 
 	float minimum_layer = max_layers - 1.0f;
-	for (auto &widget : widgets)
-	{
-		auto *window = static_cast<Window *>(widget.get());
-		if (!window->get_visible())
-			continue;
 
-		widget->reconfigure_geometry();
-
-		vec2 window_size;
-		vec2 window_pos;
-
-		if (window->is_fullscreen())
+	if (!retained_rendering)
+	{
+		for (auto &widget : widgets)
 		{
-			window_size.x = cmd.get_viewport().width;
-			window_size.y = cmd.get_viewport().height;
-			widget->reconfigure_geometry_to_canvas(vec2(0.0f),
-			                                       vec2(cmd.get_viewport().width, cmd.get_viewport().height));
-			window_pos = vec2(0.0f);
+			if (!widget->get_visible())
+				continue;
+			float min_layer = render_window(cmd, *widget, minimum_layer);
+			minimum_layer = min(min_layer, minimum_layer);
 		}
-		else
+	}
+	else
+	{
+		retained_frame.clear();
+		for (auto &widget : widgets)
 		{
-			widget->reconfigure_geometry_to_canvas(window->get_floating_position(), window->get_minimum_geometry());
-			window_size = max(widget->get_target_geometry(), widget->get_minimum_geometry());
-			window_pos = window->get_floating_position();
+			auto *window = static_cast<Window *>(widget.get());
+			if (!window->get_visible())
+				continue;
+
+			auto &cache = retained[window];
+			cache.widget = window;
+
+			vec2 position, size;
+			get_window_canvas(cmd, *window, position, size);
+
+			// Unchanged windows replay what they generated last time without walking the tree.
+			if (cache.valid && !window->get_needs_redraw() &&
+			    all(equal(cache.position, position)) && all(equal(cache.size, size)) &&
+			    cache.layer == minimum_layer)
+			{
+				cache.recorded = false;
+			}
+			else
+				record_window(cmd, cache, minimum_layer);
+
+			retained_frame.push_back(&cache);
+			minimum_layer = min(cache.min_layer, minimum_layer);
 		}
 
-		renderer.push_scissor(window->get_floating_position(), window_size);
-		float min_layer = widget->render(renderer, minimum_layer, window_pos, window_size);
-		renderer.pop_scissor();
+		// Text rasterized this frame may have evicted glyphs which replayed windows point to.
+		// Windows recorded this frame are safe since their glyphs cannot be evicted until the next frame.
+		bool stale = true;
+		while (stale)
+		{
+			stale = false;
+			for (auto *cache : retained_frame)
+			{
+				if (!cache->recorded && cache->glyph_generation != get_glyph_generation())
+				{
+					record_window(cmd, *cache, cache->layer);
+					stale = true;
+				}
+			}
+		}
 
-		minimum_layer = min(min_layer, minimum_layer);
+		for (auto *cache : retained_frame)
+		{
+			if (cache->recorded)
+				cache->glyph_generation = get_glyph_generation();
+			renderer.push_recording(*cache->recording);
+		}
 	}
 
 	renderer.flush(cmd, vec3(0.0f, 0.0f, minimum_layer),
@@ -119,7 +234,9 @@ Font& UIManager::get_font(FontSize size)
 			break;
 		}
 
-		font.reset(new Font("builtin://fonts/font.ttf", pix_size));
+		if (!glyph_cache)
+			glyph_cache.reset(new SDFGlyphCache("builtin://fonts/font.ttf"));
+		font.reset(new Font(*glyph_cache, pix_size));
 	}
 	return *font;
 }
@@ -25,8 +25,10 @@
 #include "event.hpp"
 #include "widget.hpp"
 #include "flat_renderer.hpp"
+#include "sdf_glyph_cache.hpp"
 #include "input.hpp"
 #include "global_managers_interface.hpp"
+#include <unordered_map>
 
 namespace Granite
 {
@@ -61,9 +63,36 @@ public:
 	void reset_children();
 	void remove_child(Widget *widget);
 
+	// Windows keep the geometry they generated until something in them changes. Enabled by default.
+	void set_retained_rendering(bool enable);
+
 private:
 	FlatRenderer renderer;
+
+	struct RetainedWindow
+	{
+		Widget *widget = nullptr;
+		std::unique_ptr<RenderQueue> recording;
+		vec2 position;
+		vec2 size;
+		float layer = 0.0f;
+		float min_layer = 0.0f;
+		uint64_t glyph_generation = 0;
+		bool valid = false;
+		bool recorded = false;
+	};
+	std::unordered_map<const Widget *, RetainedWindow> retained;
+	std::vector<RetainedWindow *> retained_frame;
+	bool retained_rendering = true;
+
+	float render_window(Vulkan::CommandBuffer &cmd, Widget &widget, float layer);
+	void record_window(Vulkan::CommandBuffer &cmd, RetainedWindow &window, float layer);
+	uint64_t get_glyph_generation() const;
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
 	std::vector<WidgetHandle> widgets;
+	// Every font size shares one glyph cache.
+	std::unique_ptr<SDFGlyphCache> glyph_cache;
 	std::unique_ptr<Font> fonts[Util::ecast(FontSize::Count)];
 	//Font::Alignment alignment = Font::Alignment::Center;
 
@@ -109,13 +109,28 @@ bool Widget::get_needs_redraw() const
 
 	for (auto &child : children)
 	{
-		if (child.widget->needs_redraw)
+		if (child.widget->get_needs_redraw())
 			return true;
 	}
 
 	return false;
 }
 
+void Widget::clear_needs_redraw()
+{
+	needs_redraw = false;
+	for (auto &child : children)
+		child.widget->clear_needs_redraw();
+}
+
+bool Widget::get_retainable() const
+{
+	for (auto &child : children)
+		if (child.widget->bg_image || !child.widget->get_retainable())
+			return false;
+	return true;
+}
+
 void Widget::geometry_changed()
 {
 	needs_redraw = true;
@@ -135,7 +135,12 @@ public:
 		needs_redraw = true;
 	}
 
+	// True if anything in this subtree changed since clear_needs_redraw().
 	bool get_needs_redraw() const;
+	void clear_needs_redraw();
+	// Background images may be replaced by the texture manager at any time,
+	// so subtrees which use them are regenerated every frame.
+	virtual bool get_retainable() const;
 	void reconfigure_geometry();
 	void reconfigure_geometry_to_canvas(vec2 offset, vec2 size);
 
@@ -178,6 +183,11 @@ public:
 
 protected:
 	void geometry_changed();
+	// For state which changes how the widget renders, but not its layout.
+	void redraw_changed()
+	{
+		needs_redraw = true;
+	}
 
 	vec2 floating_position = vec2(0.0f);
 	vec4 bg_color = vec4(1.0f, 1.0f, 1.0f, 0.0f);
@@ -44,6 +44,7 @@ void Window::set_title(const std::string &title_)
 void Window::set_title_color(const vec4 &color)
 {
 	title_color = color;
+	redraw_changed();
 }
 
 Widget *Window::on_mouse_button_pressed(vec2 offset)
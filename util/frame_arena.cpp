@@ -0,0 +1,116 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frame_arena.hpp"
+#include "thread_id.hpp"
+#include <algorithm>
+
+namespace Util
+{
+enum { ChunkAlignment = 64 };
+
+FrameArena::FrameArena(unsigned num_threads_, size_t chunk_size_)
+	: num_threads(std::max(num_threads_, 1u)), chunk_size(chunk_size_)
+{
+	// The last arena is the overflow arena.
+	threads.reset(new ThreadArena[num_threads + 1]);
+}
+
+FrameArena::~FrameArena()
+{
+	for (unsigned i = 0; i <= num_threads; i++)
+		for (auto &chunk : threads[i].chunks)
+			memalign_free(chunk.data);
+}
+
+void *FrameArena::allocate_from(ThreadArena &arena, size_t size, size_t alignment)
+{
+	if (size == 0)
+		size = 1;
+
+	while (arena.chunk_index < arena.chunks.size())
+	{
+		auto &chunk = arena.chunks[arena.chunk_index];
+		size_t offset = (arena.offset + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= chunk.size)
+		{
+			arena.offset = offset + size;
+			arena.used += size;
+			return chunk.data + offset;
+		}
+
+		arena.chunk_index++;
+		arena.offset = 0;
+	}
+
+	// Chunks are kept across resets, so after a few frames this path is not hit anymore.
+	Chunk chunk;
+	chunk.size = std::max<size_t>(chunk_size, size + alignment);
+	chunk.data = static_cast<uint8_t *>(memalign_alloc(std::max<size_t>(alignment, ChunkAlignment), chunk.size));
+	if (!chunk.data)
+		throw std::bad_alloc();
+
+	arena.chunks.push_back(chunk);
+	arena.chunk_index = arena.chunks.size() - 1;
+	arena.offset = size;
+	arena.used += size;
+	return chunk.data;
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment)
+{
+	unsigned index = num_threads > 1 ? get_current_thread_index() : 0;
+	if (index < num_threads)
+		return allocate_from(threads[index], size, alignment);
+
+	std::lock_guard<std::mutex> holder{overflow_lock};
+	return allocate_from(threads[num_threads], size, alignment);
+}
+
+void FrameArena::reset()
+{
+	for (unsigned i = 0; i <= num_threads; i++)
+	{
+		auto &arena = threads[i];
+		arena.chunk_index = 0;
+		arena.offset = 0;
+		arena.used = 0;
+	}
+}
+
+size_t FrameArena::get_used_size() const
+{
+	size_t size = 0;
+	for (unsigned i = 0; i <= num_threads; i++)
+		size += threads[i].used;
+	return size;
+}
+
+size_t FrameArena::get_reserved_size() const
+{
+	size_t size = 0;
+	for (unsigned i = 0; i <= num_threads; i++)
+		for (auto &chunk : threads[i].chunks)
+			size += chunk.size;
+	return size;
+}
+}
@@ -0,0 +1,136 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "aligned_alloc.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace Util
+{
+// Growable bump allocator for transient data which lives for one frame context.
+// Every registered thread index bumps through its own chunk list, so allocations do not lock.
+// Threads with an index out of range share an overflow list behind a mutex.
+// reset() rewinds all chunks but keeps them around and must not race with allocations.
+class FrameArena
+{
+public:
+	enum { DefaultChunkSize = 256 * 1024 };
+
+	explicit FrameArena(unsigned num_threads = 1, size_t chunk_size = DefaultChunkSize);
+	~FrameArena();
+	FrameArena(const FrameArena &) = delete;
+	void operator=(const FrameArena &) = delete;
+
+	// Never returns nullptr, throws std::bad_alloc like operator new.
+	void *allocate(size_t size, size_t alignment = alignof(max_align_t));
+
+	template <typename T>
+	T *allocate_array(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Type is not trivially destructible!");
+		auto *t = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+		for (size_t i = 0; i < count; i++)
+			new (&t[i]) T();
+		return t;
+	}
+
+	void reset();
+
+	// Bytes handed out since the last reset() and bytes held in chunks.
+	size_t get_used_size() const;
+	size_t get_reserved_size() const;
+
+private:
+	struct Chunk
+	{
+		uint8_t *data;
+		size_t size;
+	};
+
+	struct alignas(64) ThreadArena : AlignedAllocation<ThreadArena>
+	{
+		std::vector<Chunk> chunks;
+		size_t chunk_index = 0;
+		size_t offset = 0;
+		size_t used = 0;
+	};
+
+	std::unique_ptr<ThreadArena[]> threads;
+	unsigned num_threads;
+	size_t chunk_size;
+	std::mutex overflow_lock;
+
+	void *allocate_from(ThreadArena &arena, size_t size, size_t alignment);
+};
+
+// Allocator adapter for STL containers. Deallocation is a no-op, memory is reclaimed by FrameArena::reset(),
+// so containers must not outlive the frame context of the arena.
+template <typename T>
+struct FrameArenaAllocator
+{
+	using value_type = T;
+
+	explicit FrameArenaAllocator(FrameArena *arena_)
+		: arena(arena_)
+	{
+	}
+
+	template <typename U>
+	FrameArenaAllocator(const FrameArenaAllocator<U> &other)
+		: arena(other.arena)
+	{
+	}
+
+	T *allocate(size_t count)
+	{
+		return static_cast<T *>(arena->allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	void deallocate(T *, size_t)
+	{
+	}
+
+	template <typename U>
+	bool operator==(const FrameArenaAllocator<U> &other) const
+	{
+		return arena == other.arena;
+	}
+
+	template <typename U>
+	bool operator!=(const FrameArenaAllocator<U> &other) const
+	{
+		return arena != other.arena;
+	}
+
+	FrameArena *arena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameArenaAllocator<T>>;
+}
@@ -0,0 +1,130 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hash.hpp"
+#include <string.h>
+
+namespace Util
+{
+namespace Internal
+{
+// XXH64, four independent lanes over 32 byte stripes.
+static constexpr uint64_t Prime1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t Prime2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t Prime3 = 0x165667b19e3779f9ull;
+static constexpr uint64_t Prime4 = 0x85ebca77c2b2ae63ull;
+static constexpr uint64_t Prime5 = 0x27d4eb2f165667c5ull;
+
+static inline uint64_t rotl(uint64_t v, unsigned r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+	acc += input * Prime2;
+	acc = rotl(acc, 31);
+	return acc * Prime1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t v)
+{
+	acc ^= xxh_round(0, v);
+	return acc * Prime1 + Prime4;
+}
+
+Hash hash_bulk(const void *data, size_t size, Hash seed)
+{
+	auto *p = static_cast<const uint8_t *>(data);
+	auto *end = p + size;
+	uint64_t h;
+
+	if (size >= 32)
+	{
+		uint64_t v0 = seed + Prime1 + Prime2;
+		uint64_t v1 = seed + Prime2;
+		uint64_t v2 = seed;
+		uint64_t v3 = seed - Prime1;
+
+		auto *limit = end - 32;
+		do
+		{
+			v0 = xxh_round(v0, read64(p + 0));
+			v1 = xxh_round(v1, read64(p + 8));
+			v2 = xxh_round(v2, read64(p + 16));
+			v3 = xxh_round(v3, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v0, 1) + rotl(v1, 7) + rotl(v2, 12) + rotl(v3, 18);
+		h = merge_round(h, v0);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+	}
+	else
+		h = seed + Prime5;
+
+	h += uint64_t(size);
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= xxh_round(0, read64(p));
+		h = rotl(h, 27) * Prime1 + Prime4;
+	}
+
+	if (p + 4 <= end)
+	{
+		h ^= uint64_t(read32(p)) * Prime1;
+		h = rotl(h, 23) * Prime2 + Prime3;
+		p += 4;
+	}
+
+	for (; p < end; p++)
+	{
+		h ^= uint64_t(*p) * Prime5;
+		h = rotl(h, 11) * Prime1;
+	}
+
+	h ^= h >> 33;
+	h *= Prime2;
+	h ^= h >> 29;
+	h *= Prime3;
+	h ^= h >> 32;
+	return h;
+}
+}
+}
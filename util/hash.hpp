@@ -28,6 +28,12 @@ namespace Util
 {
 using Hash = uint64_t;
 
+namespace Internal
+{
+// Seeded XXH64. Deterministic, so hashes of large blobs are stable across runs and builds.
+Hash hash_bulk(const void *data, size_t size, Hash seed);
+}
+
 class Hasher
 {
 public:
@@ -38,10 +44,19 @@ public:
 
 	Hasher() = default;
 
+	enum { BulkThreshold = 32 };
+
+	// Small inputs use the per-element FNV path, larger ones go through a multi-lane bulk hash.
 	template <typename T>
 	inline void data(const T *data_, size_t size)
 	{
 		size /= sizeof(*data_);
+		if (size * sizeof(*data_) >= BulkThreshold)
+		{
+			h = Internal::hash_bulk(data_, size * sizeof(*data_), h);
+			return;
+		}
+
 		for (size_t i = 0; i < size; i++)
 			h = (h * 0x100000001b3ull) ^ data_[i];
 	}
@@ -43,6 +43,11 @@ public:
 		return --count == 0;
 	}
 
+	inline bool is_unique() const
+	{
+		return count == 1;
+	}
+
 private:
 	size_t count = 1;
 };
@@ -66,6 +71,11 @@ public:
 		return result == 1;
 	}
 
+	inline bool is_unique() const
+	{
+		return count.load(std::memory_order_acquire) == 1;
+	}
+
 private:
 	std::atomic_size_t count;
 };
@@ -93,6 +103,12 @@ public:
 		reference_count.add_ref();
 	}
 
+	// Only stable if nothing else can hand out new references concurrently.
+	bool has_unique_reference() const
+	{
+		return reference_count.is_unique();
+	}
+
 	IntrusivePtrEnabled() = default;
 
 	IntrusivePtrEnabled(const IntrusivePtrEnabled &) = delete;
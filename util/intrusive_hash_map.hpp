@@ -26,9 +26,20 @@
 #include "intrusive_list.hpp"
 #include "object_pool.hpp"
 #include "read_write_lock.hpp"
+#include "bitops.hpp"
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace Util
 {
 template <typename T>
@@ -79,33 +90,84 @@ struct IntrusivePODWrapper : public IntrusiveHashMapEnabled<IntrusivePODWrapper<
 	T value = {};
 };
 
+namespace Internal
+{
+// Swiss table style metadata, one control byte per slot.
+// Full slots hold 7 bits of the hash, empty and deleted slots have the top bit set.
+enum : int8_t
+{
+	HashMapControlEmpty = -128,
+	HashMapControlDeleted = -2
+};
+
+enum { HashMapGroupSize = 16 };
+
+// Groups are picked from the low bits, the tag comes from the high bits which FNV mixes best.
+static inline int8_t hash_map_tag(Hash hash)
+{
+	return int8_t(hash >> 57);
+}
+
+// Bit N is set if control byte N of the group compares equal.
+static inline uint32_t hash_map_group_match(const int8_t *ctrl, int8_t tag)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+	__m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+	return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint8_t bit_weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t eq = vceqq_s8(vld1q_s8(ctrl), vdupq_n_s8(tag));
+	uint8x16_t bits = vandq_u8(eq, vld1q_u8(bit_weights));
+	return uint32_t(vaddv_u8(vget_low_u8(bits))) | (uint32_t(vaddv_u8(vget_high_u8(bits))) << 8);
+#else
+	uint32_t mask = 0;
+	for (unsigned i = 0; i < HashMapGroupSize; i++)
+		if (ctrl[i] == tag)
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+// Empty or deleted slots, i.e. the top bit is set.
+static inline uint32_t hash_map_group_match_free(const int8_t *ctrl)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+	return uint32_t(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint8_t bit_weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t neg = vreinterpretq_u8_s8(vshrq_n_s8(vld1q_s8(ctrl), 7));
+	uint8x16_t bits = vandq_u8(neg, vld1q_u8(bit_weights));
+	return uint32_t(vaddv_u8(vget_low_u8(bits))) | (uint32_t(vaddv_u8(vget_high_u8(bits))) << 8);
+#else
+	uint32_t mask = 0;
+	for (unsigned i = 0; i < HashMapGroupSize; i++)
+		if (ctrl[i] < 0)
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+}
+
 // This HashMap is non-owning. It just arranges a list of pointers.
 // It's kind of special purpose container used by the Vulkan backend.
 // Dealing with memory ownership is done through composition by a different class.
 // T must inherit from IntrusiveHashMapEnabled<T>.
 // Each instance of T can only be part of one hashmap.
 
+// Slots are open addressed in aligned groups of 16 with a control byte each,
+// so a lookup scans a whole group of tags at once and a miss rarely touches anything but the control bytes.
+// Groups are probed in triangular order, which visits every group since the group count is a power of two.
+
 template <typename T>
 class IntrusiveHashMapHolder
 {
 public:
-	enum { InitialSize = 16, InitialLoadCount = 3 };
+	enum { InitialSize = Internal::HashMapGroupSize };
 
 	T *find(Hash hash) const
 	{
-		if (values.empty())
-			return nullptr;
-
-		Hash hash_mask = values.size() - 1;
-		auto masked = hash & hash_mask;
-		for (unsigned i = 0; i < load_count; i++)
-		{
-			if (values[masked] && get_hash(values[masked]) == hash)
-				return values[masked];
-			masked = (masked + 1) & hash_mask;
-		}
-
-		return nullptr;
+		size_t index = find_index(hash);
+		return index != NotFound ? values[index] : nullptr;
 	}
 
 	template <typename P>
@@ -127,83 +189,60 @@ public:
 	// Returns nullptr if nothing was in the hashmap for this key.
 	T *insert_yield(T *&value)
 	{
-		if (values.empty())
-			grow();
-
-		Hash hash_mask = values.size() - 1;
 		auto hash = get_hash(value);
-		auto masked = hash & hash_mask;
-
-		for (unsigned i = 0; i < load_count; i++)
+		size_t index = find_index(hash);
+		if (index != NotFound)
 		{
-			if (values[masked] && get_hash(values[masked]) == hash)
-			{
-				T *ret = value;
-				value = values[masked];
-				return ret;
-			}
-			else if (!values[masked])
-			{
-				values[masked] = value;
-				list.insert_front(value);
-				return nullptr;
-			}
-			masked = (masked + 1) & hash_mask;
+			T *ret = value;
+			value = values[index];
+			return ret;
 		}
 
-		grow();
-		return insert_yield(value);
+		insert_new(value);
+		list.insert_front(value);
+		return nullptr;
 	}
 
 	T *insert_replace(T *value)
 	{
-		if (values.empty())
-			grow();
-
-		Hash hash_mask = values.size() - 1;
 		auto hash = get_hash(value);
-		auto masked = hash & hash_mask;
-
-		for (unsigned i = 0; i < load_count; i++)
+		size_t index = find_index(hash);
+		if (index != NotFound)
 		{
-			if (values[masked] && get_hash(values[masked]) == hash)
-			{
-				std::swap(values[masked], value);
-				list.erase(value);
-				list.insert_front(values[masked]);
-				return value;
-			}
-			else if (!values[masked])
-			{
-				assert(!values[masked]);
-				values[masked] = value;
-				list.insert_front(value);
-				return nullptr;
-			}
-			masked = (masked + 1) & hash_mask;
+			std::swap(values[index], value);
+			list.erase(value);
+			list.insert_front(values[index]);
+			return value;
 		}
 
-		grow();
-		return insert_replace(value);
+		insert_new(value);
+		list.insert_front(value);
+		return nullptr;
 	}
 
 	T *erase(Hash hash)
 	{
-		Hash hash_mask = values.size() - 1;
-		auto masked = hash & hash_mask;
+		size_t index = find_index(hash);
+		if (index == NotFound)
+			return nullptr;
+
+		auto *value = values[index];
+		list.erase(value);
+		values[index] = nullptr;
+		count--;
 
-		for (unsigned i = 0; i < load_count; i++)
+		// If the group still has an empty slot, no probe sequence ever went past it,
+		// so the slot can become empty rather than a tombstone.
+		const int8_t *ctrl = control.data() + (index & ~size_t(Internal::HashMapGroupSize - 1));
+		if (Internal::hash_map_group_match(ctrl, Internal::HashMapControlEmpty))
 		{
-			if (values[masked] && get_hash(values[masked]) == hash)
-			{
-				auto *value = values[masked];
-				list.erase(value);
-				values[masked] = nullptr;
-				return value;
-			}
-			masked = (masked + 1) & hash_mask;
+			control[index] = Internal::HashMapControlEmpty;
+			growth_left++;
 		}
-		return nullptr;
+		else
+			control[index] = Internal::HashMapControlDeleted;
+
+		return value;
 	}
 
 	void erase(T *value)
@@ -215,7 +254,10 @@ public:
 	{
 		list.clear();
 		values.clear();
-		load_count = 0;
+		control.clear();
+		group_mask = 0;
+		count = 0;
+		growth_left = 0;
 	}
 
 	typename IntrusiveList<T>::Iterator begin() const
@@ -239,77 +281,101 @@ public:
 	}
 
 private:
+	enum : size_t { NotFound = ~size_t(0) };
 
-	inline bool compare_key(Hash masked, Hash hash) const
+	inline Hash get_hash(const T *value) const
 	{
-		return get_key_for_index(masked) == hash;
+		return static_cast<const IntrusiveHashMapEnabled<T> *>(value)->get_hash();
 	}
 
-	inline Hash get_hash(const T *value) const
+	inline size_t get_group(Hash hash) const
 	{
-		return static_cast<const IntrusiveHashMapEnabled<T> *>(value)->get_hash();
+		return size_t(hash) & group_mask;
 	}
 
-	inline Hash get_key_for_index(Hash masked) const
+	size_t find_index(Hash hash) const
 	{
-		return get_hash(values[masked]);
+		if (values.empty())
+			return NotFound;
+
+		int8_t tag = Internal::hash_map_tag(hash);
+		size_t group = get_group(hash);
+
+		for (size_t step = 1; ; step++)
+		{
+			const int8_t *ctrl = control.data() + group * Internal::HashMapGroupSize;
+			uint32_t mask = Internal::hash_map_group_match(ctrl, tag);
+			while (mask)
+			{
+				size_t index = group * Internal::HashMapGroupSize + trailing_zeroes(mask);
+				if (get_hash(values[index]) == hash)
+					return index;
+				mask &= mask - 1;
+			}
+
+			if (Internal::hash_map_group_match(ctrl, Internal::HashMapControlEmpty))
+				return NotFound;
+			group = (group + step) & group_mask;
+		}
 	}
 
-	bool insert_inner(T *value)
+	// Caller has verified the hash is not in the map.
+	void insert_new(T *value)
+	{
+		if (growth_left == 0)
+			grow();
+		insert_inner(value);
+		count++;
+	}
+
+	void insert_inner(T *value)
 	{
-		Hash hash_mask = values.size() - 1;
 		auto hash = get_hash(value);
-		auto masked = hash & hash_mask;
+		size_t group = get_group(hash);
 
-		for (unsigned i = 0; i < load_count; i++)
+		for (size_t step = 1; ; step++)
 		{
-			if (!values[masked])
+			const int8_t *ctrl = control.data() + group * Internal::HashMapGroupSize;
+			uint32_t mask = Internal::hash_map_group_match_free(ctrl);
+			if (mask)
 			{
-				values[masked] = value;
-				return true;
+				size_t index = group * Internal::HashMapGroupSize + trailing_zeroes(mask);
+				if (control[index] == Internal::HashMapControlEmpty)
+					growth_left--;
+				control[index] = Internal::hash_map_tag(hash);
+				values[index] = value;
+				return;
 			}
-			masked = (masked + 1) & hash_mask;
+			group = (group + step) & group_mask;
 		}
-		return false;
 	}
 
+	// Keeps load at or below 7/8, so every probe sequence ends at an empty slot.
+	// If most of the used slots are tombstones, rehash in place instead of growing.
 	void grow()
 	{
-		bool success;
-		do
-		{
-			for (auto &v : values)
-				v = nullptr;
+		size_t size = values.empty() ? size_t(InitialSize) : values.size();
+		if (!values.empty() && count >= size * 7 / 16)
+			size *= 2;
 
-			if (values.empty())
-			{
-				values.resize(InitialSize);
-				load_count = InitialLoadCount;
-				//LOGI("Growing hashmap to %u elements.\n", InitialSize);
-			}
-			else
-			{
-				values.resize(values.size() * 2);
-				//LOGI("Growing hashmap to %u elements.\n", unsigned(values.size()));
-				load_count++;
-			}
+		values.clear();
+		values.resize(size);
+		control.clear();
+		control.resize(size, Internal::HashMapControlEmpty);
+		group_mask = size / Internal::HashMapGroupSize - 1;
+		growth_left = size * 7 / 8;
 
-			// Re-insert.
-			success = true;
-			for (auto &t : list)
-			{
-				if (!insert_inner(&t))
-				{
-					success = false;
-					break;
-				}
-			}
-		} while (!success);
+		//LOGI("Growing hashmap to %u elements.\n", unsigned(size));
+		for (auto &t : list)
+			insert_inner(&t);
 	}
 
 	std::vector<T *> values;
+	std::vector<int8_t> control;
 	IntrusiveList<T> list;
-	unsigned load_count = 0;
+	size_t group_mask = 0;
+	size_t count = 0;
+	size_t growth_left = 0;
 };
 
 template <typename T>
@@ -566,12 +632,21 @@ private:
 	mutable RWSpinLock lock;
 };
 
-// A special purpose hashmap which is split into a read-only, immutable portion and a plain thread-safe one.
-// User can move read-write thread-safe portion to read-only portion when user knows it's safe to do so.
+// A special purpose hashmap for caches which are read from many threads and rarely written.
+// Lookups never write shared memory. Writers serialize on a lock and publish each entry through
+// a release store of its control word, so a reader either sees a fully constructed entry or a miss.
+// Missed lookups are retried under the lock, since the control word of a concurrent insert may not be visible yet.
+// Growing publishes a new table. Old tables are retired, since readers may still be probing them,
+// and are freed by move_to_read_only() and clear(). Doubling keeps retired memory below the size of the live table.
+// Entries cannot be erased, and move_to_read_only() and clear() must not race with readers.
 template <typename T>
 class ThreadSafeIntrusiveHashMapReadCached
 {
 public:
+	ThreadSafeIntrusiveHashMapReadCached() = default;
+	ThreadSafeIntrusiveHashMapReadCached(const ThreadSafeIntrusiveHashMapReadCached &) = delete;
+	void operator=(const ThreadSafeIntrusiveHashMapReadCached &) = delete;
+
 	~ThreadSafeIntrusiveHashMapReadCached()
 	{
 		clear();
@@ -579,50 +654,51 @@ public:
 
 	T *find(Hash hash) const
 	{
-		T *t = read_only.find(hash);
+		T *t = find_lock_free(table.load(std::memory_order_acquire), hash);
 		if (t)
 			return t;
 
 		lock.lock_read();
-		t = read_write.find(hash);
+		t = find_lock_free(table.load(std::memory_order_relaxed), hash);
 		lock.unlock_read();
 		return t;
 	}
 
+	// Everything is readable without locks once inserted, so this only reclaims retired tables.
 	void move_to_read_only()
 	{
-		auto &list = read_write.inner_list();
-		auto itr = list.begin();
-		while (itr != list.end())
-		{
-			auto *to_move = itr.get();
-			read_write.erase(to_move);
-			T *to_delete = read_only.insert_yield(to_move);
-			if (to_delete)
-				object_pool.free(to_delete);
-			itr = list.begin();
-		}
+		lock.lock_write();
+		if (tables.size() > 1)
+			tables.erase(tables.begin(), tables.end() - 1);
+		lock.unlock_write();
 	}
 
 	template <typename P>
 	bool find_and_consume_pod(Hash hash, P &p) const
 	{
-		if (read_only.find_and_consume_pod(hash, p))
+		T *t = find(hash);
+		if (t)
+		{
+			p = t->get();
 			return true;
-
-		lock.lock_read();
-		bool ret = read_write.find_and_consume_pod(hash, p);
-		lock.unlock_read();
-		return ret;
+		}
+		else
+			return false;
 	}
 
 	void clear()
 	{
 		lock.lock_write();
-		clear_list(read_only.inner_list());
-		clear_list(read_write.inner_list());
-		read_only.clear();
-		read_write.clear();
+		auto itr = list.begin();
+		while (itr != list.end())
+		{
+			auto *to_free = itr.get();
+			itr = list.erase(itr);
+			object_pool.free(to_free);
+		}
+		table.store(nullptr, std::memory_order_relaxed);
+		tables.clear();
+		growth_left = 0;
 		lock.unlock_write();
 	}
 
@@ -646,9 +722,19 @@ public:
 	{
 		static_cast<IntrusiveHashMapEnabled<T> *>(value)->set_hash(hash);
 		lock.lock_write();
-		T *to_delete = read_write.insert_yield(value);
-		if (to_delete)
-			object_pool.free(to_delete);
+		T *existing = find_lock_free(table.load(std::memory_order_relaxed), hash);
+		if (existing)
+		{
+			object_pool.free(value);
+			value = existing;
+		}
+		else
+		{
+			if (growth_left == 0)
+				grow();
+			insert_inner(*tables.back(), value);
+			list.insert_front(value);
+		}
 		lock.unlock_write();
 		return value;
 	}
@@ -660,31 +746,131 @@ public:
 		return insert_yield(hash, t);
 	}
 
-	IntrusiveHashMapHolder<T> &get_read_only()
+	// Not supposed to be called in racy conditions.
+	typename IntrusiveList<T>::Iterator begin() const
 	{
-		return read_only;
+		return list.begin();
 	}
 
-	IntrusiveHashMapHolder<T> &get_read_write()
+	typename IntrusiveList<T>::Iterator end() const
 	{
-		return read_write;
+		return list.end();
 	}
 
 private:
-	IntrusiveHashMapHolder<T> read_only;
-	IntrusiveHashMapHolder<T> read_write;
+	struct Table
+	{
+		explicit Table(size_t size)
+			: control(size / sizeof(uint64_t)), values(size),
+			  group_mask(size / Internal::HashMapGroupSize - 1)
+		{
+			for (auto &word : control)
+				word.store(ControlEmptyWord, std::memory_order_relaxed);
+		}
+
+		// Control bytes are packed in words, so a group is read with a few atomic loads.
+		std::vector<std::atomic<uint64_t>> control;
+		std::vector<std::atomic<T *>> values;
+		size_t group_mask;
+	};
+
+	std::atomic<const Table *> table { nullptr };
+	std::vector<std::unique_ptr<Table>> tables;
+	IntrusiveList<T> list;
 	ObjectPool<T> object_pool;
+	size_t growth_left = 0;
 	mutable RWSpinLock lock;
 
-	void clear_list(IntrusiveList<T> &list)
+	enum { ControlWordsPerGroup = Internal::HashMapGroupSize / sizeof(uint64_t) };
+	static constexpr uint64_t ControlEmptyWord = 0x8080808080808080ull;
+	static_assert(uint8_t(Internal::HashMapControlEmpty) == 0x80, "Unexpected empty control byte.");
+
+	static inline Hash get_hash(const T *value)
 	{
-		auto itr = list.begin();
-		while (itr != list.end())
+		return static_cast<const IntrusiveHashMapEnabled<T> *>(value)->get_hash();
+	}
+
+	// Acquire pairs with the release in store_control(), so a matching tag implies a visible value.
+	static void load_group(const Table &t, size_t group, int8_t (&ctrl)[Internal::HashMapGroupSize])
+	{
+		uint64_t words[ControlWordsPerGroup];
+		for (unsigned i = 0; i < ControlWordsPerGroup; i++)
+			words[i] = t.control[group * ControlWordsPerGroup + i].load(std::memory_order_acquire);
+		memcpy(ctrl, words, sizeof(words));
+	}
+
+	// Only called with the lock held, so the read-modify-write cannot lose a concurrent update.
+	static void store_control(Table &t, size_t index, int8_t tag)
+	{
+		auto &word = t.control[index / sizeof(uint64_t)];
+		uint64_t value = word.load(std::memory_order_relaxed);
+		uint8_t bytes[sizeof(uint64_t)];
+		memcpy(bytes, &value, sizeof(value));
+		bytes[index % sizeof(uint64_t)] = uint8_t(tag);
+		memcpy(&value, bytes, sizeof(value));
+		word.store(value, std::memory_order_release);
+	}
+
+	static T *find_lock_free(const Table *t, Hash hash)
+	{
+		if (!t)
+			return nullptr;
+
+		int8_t tag = Internal::hash_map_tag(hash);
+		size_t group = size_t(hash) & t->group_mask;
+
+		for (size_t step = 1; ; step++)
 		{
-			auto *to_free = itr.get();
-			itr = list.erase(itr);
-			object_pool.free(to_free);
+			int8_t ctrl[Internal::HashMapGroupSize];
+			load_group(*t, group, ctrl);
+			uint32_t mask = Internal::hash_map_group_match(ctrl, tag);
+			while (mask)
+			{
+				size_t index = group * Internal::HashMapGroupSize + trailing_zeroes(mask);
+				T *value = t->values[index].load(std::memory_order_relaxed);
+				if (value && get_hash(value) == hash)
+					return value;
+				mask &= mask - 1;
+			}
+
+			if (Internal::hash_map_group_match(ctrl, Internal::HashMapControlEmpty))
+				return nullptr;
+			group = (group + step) & t->group_mask;
 		}
 	}
+
+	void insert_inner(Table &t, T *value)
+	{
+		auto hash = get_hash(value);
+		size_t group = size_t(hash) & t.group_mask;
+
+		for (size_t step = 1; ; step++)
+		{
+			int8_t ctrl[Internal::HashMapGroupSize];
+			load_group(t, group, ctrl);
+			uint32_t mask = Internal::hash_map_group_match(ctrl, Internal::HashMapControlEmpty);
+			if (mask)
+			{
+				size_t index = group * Internal::HashMapGroupSize + trailing_zeroes(mask);
+				t.values[index].store(value, std::memory_order_relaxed);
+				store_control(t, index, Internal::hash_map_tag(hash));
+				growth_left--;
+				return;
+			}
+			group = (group + step) & t.group_mask;
+		}
+	}
+
+	void grow()
+	{
+		size_t size = tables.empty() ? size_t(Internal::HashMapGroupSize) : tables.back()->values.size() * 2;
+		tables.emplace_back(new Table(size));
+		growth_left = size * 7 / 8;
+
+		auto &t = *tables.back();
+		for (auto &value : list)
+			insert_inner(t, &value);
+		table.store(&t, std::memory_order_release);
+	}
 };
 }
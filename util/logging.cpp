@@ -21,19 +21,283 @@
  */
 
 #include "logging.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
 
 namespace Util
 {
 static thread_local LoggingInterface *logging_iface;
 
+namespace
+{
+// Single producer, single consumer ring of { tag, length, text } records.
+struct LogRing
+{
+	enum { Size = 64 * 1024 };
+
+	char data[Size];
+	std::atomic<size_t> write_offset{0};
+	std::atomic<size_t> read_offset{0};
+	std::atomic<bool> abandoned{false};
+
+	struct Header
+	{
+		const char *tag;
+		size_t length;
+	};
+
+	void copy_in(size_t offset, const void *src, size_t size)
+	{
+		offset %= Size;
+		size_t first = std::min<size_t>(size, Size - offset);
+		memcpy(data + offset, src, first);
+		memcpy(data, static_cast<const char *>(src) + first, size - first);
+	}
+
+	void copy_out(size_t offset, void *dst, size_t size) const
+	{
+		offset %= Size;
+		size_t first = std::min<size_t>(size, Size - offset);
+		memcpy(dst, data + offset, first);
+		memcpy(static_cast<char *>(dst) + first, data, size - first);
+	}
+
+	bool push(const char *tag, const char *text, size_t length)
+	{
+		size_t write = write_offset.load(std::memory_order_relaxed);
+		size_t read = read_offset.load(std::memory_order_acquire);
+		if (write - read + sizeof(Header) + length > Size)
+			return false;
+
+		Header header = { tag, length };
+		copy_in(write, &header, sizeof(header));
+		copy_in(write + sizeof(header), text, length);
+		write_offset.store(write + sizeof(header) + length, std::memory_order_release);
+		return true;
+	}
+
+	template <typename Func>
+	void drain(char *scratch, const Func &func)
+	{
+		size_t read = read_offset.load(std::memory_order_relaxed);
+		size_t write = write_offset.load(std::memory_order_acquire);
+		while (read != write)
+		{
+			Header header;
+			copy_out(read, &header, sizeof(header));
+			copy_out(read + sizeof(header), scratch, header.length);
+			scratch[header.length] = '\0';
+			func(header.tag, scratch);
+			read += sizeof(header) + header.length;
+		}
+		read_offset.store(read, std::memory_order_release);
+	}
+
+	bool empty() const
+	{
+		return read_offset.load(std::memory_order_acquire) == write_offset.load(std::memory_order_acquire);
+	}
+};
+
+struct AsyncLogState
+{
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<std::unique_ptr<LogRing>> rings;
+	std::thread worker;
+	bool stop = false;
+	std::atomic<bool> sleeping{false};
+	std::atomic<LoggingInterface *> sink{nullptr};
+
+	~AsyncLogState()
+	{
+		set_async_logging(false);
+	}
+};
+
+struct ThreadRing
+{
+	LogRing *ring = nullptr;
+
+	~ThreadRing()
+	{
+		if (ring)
+			ring->abandoned.store(true, std::memory_order_release);
+	}
+};
+
+struct RateLimitEntry
+{
+	const char *fmt;
+	const char *tag;
+	int64_t window_start;
+	unsigned count;
+	unsigned suppressed;
+};
+}
+
+static std::atomic<bool> async_enabled;
+static std::atomic<unsigned> rate_limit{100};
+static thread_local ThreadRing thread_ring;
+static thread_local RateLimitEntry rate_limit_entries[64];
+
+static AsyncLogState &get_async_state()
+{
+	static AsyncLogState state;
+	return state;
+}
+
+static bool sink_log(LoggingInterface *iface, const char *tag, const char *fmt, ...)
+{
+	va_list va;
+	va_start(va, fmt);
+	bool ret = iface->log(tag, fmt, va);
+	va_end(va);
+	return ret;
+}
+
+static void write_message(LoggingInterface *sink, const char *tag, const char *message)
+{
+	if (sink && sink_log(sink, tag, "%s", message))
+		return;
+
+	if (strcmp(tag, "[ERROR]: ") == 0)
+		LOGE_FALLBACK("%s", message);
+	else if (strcmp(tag, "[WARN]: ") == 0)
+		LOGW_FALLBACK("%s", message);
+	else
+		LOGI_FALLBACK("%s", message);
+}
+
+static bool drain_rings(AsyncLogState &state, char *scratch)
+{
+	std::vector<LogRing *> rings;
+	{
+		std::lock_guard<std::mutex> holder{state.lock};
+		for (auto itr = state.rings.begin(); itr != state.rings.end(); )
+		{
+			// Threads which have exited and have nothing left can be retired.
+			if ((*itr)->abandoned.load(std::memory_order_acquire) && (*itr)->empty())
+				itr = state.rings.erase(itr);
+			else
+				rings.push_back((itr++)->get());
+		}
+	}
+
+	auto *sink = state.sink.load(std::memory_order_acquire);
+	bool did_work = false;
+	for (auto *ring : rings)
+	{
+		ring->drain(scratch, [&](const char *tag, const char *message) {
+			write_message(sink, tag, message);
+			did_work = true;
+		});
+	}
+	return did_work;
+}
+
+static void async_log_worker(AsyncLogState *state)
+{
+	std::unique_ptr<char[]> scratch(new char[LogRing::Size]);
+	for (;;)
+	{
+		if (drain_rings(*state, scratch.get()))
+			continue;
+
+		std::unique_lock<std::mutex> holder{state->lock};
+		if (state->stop)
+			break;
+
+		// Producers only notify when we sleep, the timeout covers a notification racing with going to sleep.
+		state->sleeping.store(true, std::memory_order_relaxed);
+		state->cond.wait_for(holder, std::chrono::milliseconds(10));
+		state->sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	drain_rings(*state, scratch.get());
+}
+
+// Returns false if the message should not be logged.
+static bool rate_limit_check(const char *fmt, const char *tag)
+{
+	unsigned limit = rate_limit.load(std::memory_order_relaxed);
+	if (limit == 0)
+		return true;
+
+	auto &entry = rate_limit_entries[(reinterpret_cast<uintptr_t>(fmt) >> 3) & 63];
+	int64_t now = get_current_time_nsecs();
+
+	if (entry.fmt != fmt || now - entry.window_start >= 1000000000)
+	{
+		// Also when another format string takes over the slot, or its suppressed count would be lost.
+		if (entry.suppressed && thread_ring.ring)
+		{
+			size_t fmt_len = strlen(entry.fmt);
+			char summary[256];
+			int len = snprintf(summary, sizeof(summary), "Suppressed %u repeats of: %.128s%s", entry.suppressed, entry.fmt,
+			                   fmt_len && entry.fmt[fmt_len - 1] == '\n' ? "" : "\n");
+			if (len > 0)
+				thread_ring.ring->push(entry.tag, summary, std::min<size_t>(size_t(len), sizeof(summary) - 1));
+		}
+
+		entry.fmt = fmt;
+		entry.tag = tag;
+		entry.window_start = now;
+		entry.count = 0;
+		entry.suppressed = 0;
+	}
+
+	if (++entry.count > limit)
+	{
+		entry.suppressed++;
+		return false;
+	}
+	return true;
+}
+
+static bool async_log(const char *tag, const char *fmt, va_list va)
+{
+	auto &state = get_async_state();
+	if (!thread_ring.ring)
+	{
+		std::unique_ptr<LogRing> ring(new LogRing);
+		thread_ring.ring = ring.get();
+		std::lock_guard<std::mutex> holder{state.lock};
+		state.rings.push_back(std::move(ring));
+	}
+
+	if (!rate_limit_check(fmt, tag))
+		return true;
+
+	char buffer[4 * 1024];
+	int len = vsnprintf(buffer, sizeof(buffer), fmt, va);
+
+	// Long messages and full rings go through the synchronous path.
+	if (len < 0 || size_t(len) >= sizeof(buffer))
+		return false;
+	if (!thread_ring.ring->push(tag, buffer, size_t(len)))
+		return false;
+
+	if (state.sleeping.load(std::memory_order_relaxed))
+		state.cond.notify_one();
+	return true;
+}
+
 bool interface_log(const char *tag, const char *fmt, ...)
 {
-	if (!logging_iface)
+	if (!logging_iface && !async_enabled.load(std::memory_order_acquire))
 		return false;
 
 	va_list va;
 	va_start(va, fmt);
-	bool ret = logging_iface->log(tag, fmt, va);
+	bool ret = logging_iface ? logging_iface->log(tag, fmt, va) : async_log(tag, fmt, va);
 	va_end(va);
 	return ret;
 }
@@ -42,4 +306,58 @@ void set_thread_logging_interface(LoggingInterface *iface)
 {
 	logging_iface = iface;
 }
-}
\ No newline at end of file
+
+void set_async_logging(bool enable)
+{
+	auto &state = get_async_state();
+	std::unique_lock<std::mutex> holder{state.lock};
+
+	if (enable && !state.worker.joinable())
+	{
+		state.stop = false;
+		state.worker = std::thread(async_log_worker, &state);
+		async_enabled.store(true, std::memory_order_release);
+	}
+	else if (!enable && state.worker.joinable())
+	{
+		async_enabled.store(false, std::memory_order_release);
+		state.stop = true;
+		state.cond.notify_one();
+		holder.unlock();
+		state.worker.join();
+	}
+}
+
+void set_async_logging_sink(LoggingInterface *iface)
+{
+	get_async_state().sink.store(iface, std::memory_order_release);
+}
+
+void flush_async_logging()
+{
+	auto &state = get_async_state();
+	for (;;)
+	{
+		bool empty = true;
+		{
+			std::lock_guard<std::mutex> holder{state.lock};
+			if (!state.worker.joinable())
+				return;
+			for (auto &ring : state.rings)
+				if (!ring->empty())
+					empty = false;
+		}
+
+		if (empty)
+			return;
+
+		state.cond.notify_one();
+		std::this_thread::yield();
+	}
+}
+
+void set_log_rate_limit(unsigned messages_per_second)
+{
+	rate_limit.store(messages_per_second, std::memory_order_relaxed);
+}
+}
@@ -37,6 +37,18 @@ public:
 
 bool interface_log(const char *tag, const char *fmt, ...);
 void set_thread_logging_interface(LoggingInterface *iface);
+
+// In async mode, threads without a logging interface format into a per-thread ring buffer
+// and a background thread writes the messages out, to the sink if set, otherwise like the fallbacks.
+// Ordering is only preserved per thread. If a ring is full, the message is logged synchronously.
+void set_async_logging(bool enable);
+void set_async_logging_sink(LoggingInterface *iface);
+// Blocks until all messages logged so far have been written.
+void flush_async_logging();
+
+// In async mode, messages from the same call site beyond this many per second on a thread are dropped
+// and summarized. 0 disables rate limiting.
+void set_log_rate_limit(unsigned messages_per_second);
 }
 
 #if defined(_MSC_VER)
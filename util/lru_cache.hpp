@@ -25,6 +25,8 @@
 #include "object_pool.hpp"
 #include "intrusive_list.hpp"
 #include "intrusive_hash_map.hpp"
+#include <atomic>
+#include <mutex>
 
 namespace Util
 {
@@ -42,6 +44,11 @@ public:
 		return total_cost;
 	}
 
+	size_t get_entry_count() const
+	{
+		return entry_count;
+	}
+
 	T *find_and_mark_as_recent(uint64_t cookie)
 	{
 		auto *entry = hashmap.find(get_hash(cookie));
@@ -67,6 +74,7 @@ public:
 		}
 
 		total_cost += cost;
+		entry_count++;
 
 		auto *entry = pool.allocate();
 		entry->cost = cost;
@@ -81,17 +89,26 @@ public:
 	{
 		uint64_t total_pruned = 0;
 		while (total_cost > total_cost_limit)
-		{
-			auto itr = lru.rbegin();
-			total_cost -= itr->cost;
-			total_pruned += itr->cost;
-			lru.erase(itr);
-			hashmap.erase(itr->hash);
-			pool.free(itr.get());
-		}
+			total_pruned += prune_oldest();
 		return total_pruned;
 	}
 
+	// Removes the least recently used entry and returns its cost.
+	uint64_t prune_oldest()
+	{
+		if (lru.empty())
+			return 0;
+
+		auto itr = lru.rbegin();
+		uint64_t cost = itr->cost;
+		total_cost -= cost;
+		entry_count--;
+		lru.erase(itr);
+		hashmap.erase(itr->hash);
+		pool.free(itr.get());
+		return cost;
+	}
+
 	bool evict(uint64_t cookie)
 	{
 		auto *entry = hashmap.find(get_hash(cookie));
@@ -109,6 +126,8 @@ public:
 		auto *entry = hashmap.find(get_hash(cookie));
 		if (entry)
 		{
+			total_cost -= entry->get()->cost;
+			entry_count--;
 			hashmap.erase(entry);
 			lru.erase(entry->get());
 			pool.free(entry->get().get());
@@ -148,6 +167,7 @@ public:
 private:
 	uint64_t total_cost = 0;
 	uint64_t total_cost_limit = 0;
+	size_t entry_count = 0;
 
 	ObjectPool<CacheEntry> pool;
 	IntrusiveList<CacheEntry> lru;
@@ -160,4 +180,158 @@ private:
 		return h.get();
 	}
 };
+
+struct LRUCacheStatistics
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	uint64_t evicted_cost = 0;
+};
+
+// LRUCache which can be used from many threads. Cookies are spread over shards with a lock each,
+// so threads only contend when they hit the same shard. Recency is tracked per shard, and pruning
+// evicts from the shard being inserted into until the shared cost budget is met, which is an approximate LRU.
+// Values are copied in and out under the lock, so T should be cheap to copy, e.g. a handle.
+template <typename T, unsigned NumShards = 16>
+class ConcurrentLRUCache
+{
+public:
+	static_assert((NumShards & (NumShards - 1)) == 0, "NumShards must be a power of two.");
+
+	void set_total_cost(uint64_t cost)
+	{
+		total_cost_limit.store(cost, std::memory_order_relaxed);
+	}
+
+	uint64_t get_current_cost() const
+	{
+		return total_cost.load(std::memory_order_relaxed);
+	}
+
+	bool find_and_mark_as_recent(uint64_t cookie, T &value)
+	{
+		auto &shard = get_shard(cookie);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		auto *t = shard.cache.find_and_mark_as_recent(cookie);
+		if (t)
+		{
+			shard.stats.hits++;
+			value = *t;
+			return true;
+		}
+		else
+		{
+			shard.stats.misses++;
+			return false;
+		}
+	}
+
+	// Inserts or replaces, and prunes the shard if the cache is over budget.
+	// The inserted entry itself is never pruned here.
+	void insert(uint64_t cookie, T value, uint64_t cost)
+	{
+		auto &shard = get_shard(cookie);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		uint64_t old_cost = shard.cache.get_current_cost();
+		*shard.cache.allocate(cookie, cost) = std::move(value);
+		total_cost.fetch_add(shard.cache.get_current_cost() - old_cost, std::memory_order_relaxed);
+
+		while (total_cost.load(std::memory_order_relaxed) > total_cost_limit.load(std::memory_order_relaxed) &&
+		       shard.cache.get_entry_count() > 1)
+		{
+			prune_oldest_locked(shard);
+		}
+	}
+
+	bool erase(uint64_t cookie)
+	{
+		auto &shard = get_shard(cookie);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		uint64_t old_cost = shard.cache.get_current_cost();
+		bool ret = shard.cache.erase(cookie);
+		total_cost.fetch_sub(old_cost - shard.cache.get_current_cost(), std::memory_order_relaxed);
+		return ret;
+	}
+
+	bool evict(uint64_t cookie)
+	{
+		auto &shard = get_shard(cookie);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		return shard.cache.evict(cookie);
+	}
+
+	// Evicts from all shards in turn until the cache is within budget.
+	uint64_t prune()
+	{
+		uint64_t total_pruned = 0;
+		bool progress = true;
+		while (progress && total_cost.load(std::memory_order_relaxed) > total_cost_limit.load(std::memory_order_relaxed))
+		{
+			progress = false;
+			for (auto &shard : shards)
+			{
+				std::lock_guard<std::mutex> holder{shard.lock};
+				if (shard.cache.get_entry_count() != 0)
+				{
+					total_pruned += prune_oldest_locked(shard);
+					progress = true;
+				}
+			}
+		}
+		return total_pruned;
+	}
+
+	LRUCacheStatistics get_statistics()
+	{
+		LRUCacheStatistics stats;
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			stats.hits += shard.stats.hits;
+			stats.misses += shard.stats.misses;
+			stats.evictions += shard.stats.evictions;
+			stats.evicted_cost += shard.stats.evicted_cost;
+		}
+		return stats;
+	}
+
+	void reset_statistics()
+	{
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			shard.stats = {};
+		}
+	}
+
+private:
+	struct Shard
+	{
+		std::mutex lock;
+		LRUCache<T> cache;
+		LRUCacheStatistics stats;
+	};
+
+	Shard shards[NumShards];
+	std::atomic<uint64_t> total_cost{0};
+	std::atomic<uint64_t> total_cost_limit{0};
+
+	Shard &get_shard(uint64_t cookie)
+	{
+		// Cookies are usually hashes already, but mix anyway so sequential IDs spread out.
+		Hasher h;
+		h.u64(cookie);
+		return shards[(h.get() >> 32) & (NumShards - 1)];
+	}
+
+	uint64_t prune_oldest_locked(Shard &shard)
+	{
+		uint64_t cost = shard.cache.prune_oldest();
+		total_cost.fetch_sub(cost, std::memory_order_relaxed);
+		shard.stats.evictions++;
+		shard.stats.evicted_cost += cost;
+		return cost;
+	}
+};
 }
@@ -0,0 +1,220 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lz4.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace Util
+{
+static constexpr size_t MinMatch = 4;
+// The last match must start this many bytes before the end of the block.
+static constexpr size_t MatchFindLimit = 12;
+// The last bytes of a block are always literals.
+static constexpr size_t LastLiterals = 5;
+static constexpr size_t MaxOffset = 65535;
+static constexpr unsigned HashBits = 16;
+
+static inline uint32_t read32(const uint8_t *ptr)
+{
+	uint32_t v;
+	memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+static inline uint32_t hash_sequence(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HashBits);
+}
+
+static inline uint8_t *write_length(uint8_t *dst, size_t length)
+{
+	while (length >= 255)
+	{
+		*dst++ = 255;
+		length -= 255;
+	}
+	*dst++ = uint8_t(length);
+	return dst;
+}
+
+size_t lz4_compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+static uint8_t *emit_sequence(uint8_t *dst, const uint8_t *dst_end,
+                              const uint8_t *literals, size_t literal_length,
+                              size_t offset, size_t match_length)
+{
+	// Token, length bytes, literals and offset.
+	size_t required = 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+	if (required > size_t(dst_end - dst))
+		return nullptr;
+
+	uint8_t *token = dst++;
+	*token = uint8_t((literal_length >= 15 ? 15 : literal_length) << 4);
+	if (literal_length >= 15)
+		dst = write_length(dst, literal_length - 15);
+	memcpy(dst, literals, literal_length);
+	dst += literal_length;
+
+	// The last sequence only has literals.
+	if (match_length == 0)
+		return dst;
+
+	*dst++ = uint8_t(offset & 0xff);
+	*dst++ = uint8_t(offset >> 8);
+
+	match_length -= MinMatch;
+	*token |= uint8_t(match_length >= 15 ? 15 : match_length);
+	if (match_length >= 15)
+		dst = write_length(dst, match_length - 15);
+	return dst;
+}
+
+size_t lz4_compress(const void *src_, size_t size, void *dst_, size_t dst_capacity)
+{
+	auto *src = static_cast<const uint8_t *>(src_);
+	auto *dst = static_cast<uint8_t *>(dst_);
+	const uint8_t *src_end = src + size;
+	const uint8_t *dst_end = dst + dst_capacity;
+	const uint8_t *anchor = src;
+
+	if (size > MatchFindLimit)
+	{
+		std::vector<uint32_t> table(1u << HashBits, UINT32_MAX);
+		const uint8_t *match_start_limit = src_end - MatchFindLimit;
+		const uint8_t *match_end_limit = src_end - LastLiterals;
+		const uint8_t *ip = src;
+
+		while (ip < match_start_limit)
+		{
+			uint32_t sequence = read32(ip);
+			uint32_t &entry = table[hash_sequence(sequence)];
+			uint32_t candidate = entry;
+			entry = uint32_t(ip - src);
+
+			if (candidate == UINT32_MAX || size_t(ip - src) - candidate > MaxOffset ||
+			    read32(src + candidate) != sequence)
+			{
+				ip++;
+				continue;
+			}
+
+			const uint8_t *ref = src + candidate;
+			size_t match_length = MinMatch;
+			while (ip + match_length < match_end_limit && ip[match_length] == ref[match_length])
+				match_length++;
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+				match_length++;
+			}
+
+			dst = emit_sequence(dst, dst_end, anchor, size_t(ip - anchor), size_t(ip - ref), match_length);
+			if (!dst)
+				return 0;
+
+			ip += match_length;
+			anchor = ip;
+		}
+	}
+
+	dst = emit_sequence(dst, dst_end, anchor, size_t(src_end - anchor), 0, 0);
+	if (!dst)
+		return 0;
+	return size_t(dst - static_cast<uint8_t *>(dst_));
+}
+
+static inline bool read_length(const uint8_t *&src, const uint8_t *src_end, size_t &length)
+{
+	uint8_t v;
+	do
+	{
+		if (src >= src_end)
+			return false;
+		v = *src++;
+		length += v;
+	} while (v == 255);
+	return true;
+}
+
+bool lz4_decompress(const void *src_, size_t src_size, void *dst_, size_t dst_size)
+{
+	auto *src = static_cast<const uint8_t *>(src_);
+	auto *dst = static_cast<uint8_t *>(dst_);
+	const uint8_t *src_end = src + src_size;
+	uint8_t *dst_begin = dst;
+	uint8_t *dst_end = dst + dst_size;
+
+	for (;;)
+	{
+		if (src >= src_end)
+			return false;
+
+		uint8_t token = *src++;
+		size_t literal_length = token >> 4;
+		if (literal_length == 15 && !read_length(src, src_end, literal_length))
+			return false;
+
+		if (literal_length > size_t(src_end - src) || literal_length > size_t(dst_end - dst))
+			return false;
+		memcpy(dst, src, literal_length);
+		src += literal_length;
+		dst += literal_length;
+
+		if (src == src_end)
+			return dst == dst_end;
+
+		if (src_end - src < 2)
+			return false;
+		size_t offset = size_t(src[0]) | (size_t(src[1]) << 8);
+		src += 2;
+		if (offset == 0 || offset > size_t(dst - dst_begin))
+			return false;
+
+		size_t match_length = token & 15;
+		if (match_length == 15 && !read_length(src, src_end, match_length))
+			return false;
+		match_length += MinMatch;
+		if (match_length > size_t(dst_end - dst))
+			return false;
+
+		const uint8_t *ref = dst - offset;
+		if (offset >= match_length)
+		{
+			memcpy(dst, ref, match_length);
+			dst += match_length;
+		}
+		else
+		{
+			// Overlapping copies repeat the pattern.
+			for (size_t i = 0; i < match_length; i++)
+				*dst++ = *ref++;
+		}
+	}
+}
+}
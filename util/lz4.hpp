@@ -0,0 +1,38 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+namespace Util
+{
+// LZ4 block format (no frame), compatible with LZ4_compress_default() and LZ4_decompress_safe().
+// The compressor is a simple greedy one which favors speed over ratio.
+size_t lz4_compress_bound(size_t size);
+
+// Returns the compressed size, or 0 if the output does not fit in dst_capacity.
+size_t lz4_compress(const void *src, size_t size, void *dst, size_t dst_capacity);
+
+// Fails unless the stream decodes to exactly dst_size bytes. Never reads or writes out of bounds.
+bool lz4_decompress(const void *src, size_t src_size, void *dst, size_t dst_size);
+}
@@ -100,6 +100,73 @@ MessageQueuePayload LockFreeMessageQueue::allocate_write_payload(size_t size) no
 	return payload;
 }
 
+LockFreeMPMCMessageQueue::LockFreeMPMCMessageQueue()
+{
+	for (unsigned i = 0; i < 8; i++)
+		payload_capacity[i] = 256u << i;
+	for (unsigned i = 0; i < 8; i++)
+		write_ring[i].reset((16u * 1024u) >> i);
+	read_ring.reset(32 * 1024);
+
+	// Pre-fill the rings.
+	for (unsigned i = 0; i < 8; i++)
+	{
+		unsigned count = 512u >> i;
+		for (unsigned j = 0; j < count; j++)
+		{
+			MessageQueuePayload payload;
+			payload.set_payload_data(memalign_calloc(64, payload_capacity[i]), payload_capacity[i]);
+			recycle_payload(std::move(payload));
+		}
+	}
+}
+
+size_t LockFreeMPMCMessageQueue::available_read_messages() const noexcept
+{
+	return read_ring.read_avail();
+}
+
+MessageQueuePayload LockFreeMPMCMessageQueue::read_message() noexcept
+{
+	MessageQueuePayload payload;
+	read_ring.read_and_move(payload);
+	return payload;
+}
+
+bool LockFreeMPMCMessageQueue::push_written_payload(MessageQueuePayload payload) noexcept
+{
+	return read_ring.write_and_move(std::move(payload));
+}
+
+void LockFreeMPMCMessageQueue::recycle_payload(MessageQueuePayload payload) noexcept
+{
+	for (unsigned i = 0; i < 8; i++)
+	{
+		if (payload.get_capacity() == payload_capacity[i])
+		{
+			write_ring[i].write_and_move(std::move(payload));
+			return;
+		}
+	}
+}
+
+MessageQueuePayload LockFreeMPMCMessageQueue::allocate_write_payload(size_t size) noexcept
+{
+	MessageQueuePayload payload;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		if (size <= payload_capacity[i])
+		{
+			if (!write_ring[i].read_and_move(payload))
+				payload.set_payload_data(memalign_calloc(64, payload_capacity[i]), payload_capacity[i]);
+			return payload;
+		}
+	}
+
+	payload.set_payload_data(memalign_calloc(64, size), size);
+	return payload;
+}
+
 MessageQueue::MessageQueue()
 {
 	corked.store(true);
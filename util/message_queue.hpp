@@ -26,6 +26,7 @@
 #include <vector>
 #include <utility>
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 #include <memory>
 #include <mutex>
@@ -71,8 +72,8 @@ public:
 
 	bool write_and_move(T *values, size_t count) noexcept
 	{
-		size_t current_written = read_count.load(std::memory_order_relaxed);
-		size_t current_read = write_count.load(std::memory_order_acquire);
+		size_t current_written = write_count.load(std::memory_order_relaxed);
+		size_t current_read = read_count.load(std::memory_order_acquire);
 		if (count > ring.size() - (current_written - current_read))
 			return false;
 
@@ -135,6 +136,109 @@ private:
 	std::vector<T> ring;
 };
 
+// Bounded queue which allows any number of concurrent readers and writers.
+// Each cell carries a sequence number which tells producers and consumers whether the slot is free
+// for the current lap of the ring, so both sides only contend on a single fetch position.
+template <typename T>
+class LockFreeMPMCRingBuffer
+{
+public:
+	LockFreeMPMCRingBuffer()
+	{
+		reset(1);
+	}
+
+	// Not thread-safe. Count is rounded up to a power of two.
+	void reset(size_t count)
+	{
+		size_t size = 1;
+		while (size < count)
+			size <<= 1;
+
+		cells.reset(new Cell[size]);
+		mask = size - 1;
+		for (size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		write_count.store(0, std::memory_order_relaxed);
+		read_count.store(0, std::memory_order_relaxed);
+	}
+
+	// Only a snapshot when there are concurrent writers and readers.
+	size_t read_avail() const noexcept
+	{
+		size_t written = write_count.load(std::memory_order_acquire);
+		size_t read = read_count.load(std::memory_order_acquire);
+		return written > read ? written - read : 0;
+	}
+
+	bool write_and_move(T value) noexcept
+	{
+		size_t pos = write_count.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;)
+		{
+			cell = &cells[pos & mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			auto diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0)
+			{
+				if (write_count.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = write_count.load(std::memory_order_relaxed);
+		}
+
+		cell->value = std::move(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool read_and_move(T &value) noexcept
+	{
+		size_t pos = read_count.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;)
+		{
+			cell = &cells[pos & mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			auto diff = intptr_t(seq) - intptr_t(pos + 1);
+			if (diff == 0)
+			{
+				if (read_count.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = read_count.load(std::memory_order_relaxed);
+		}
+
+		value = std::move(cell->value);
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask = 0;
+
+	// Keep the producer and consumer positions on separate cache lines.
+	char pad0[64];
+	std::atomic<size_t> write_count;
+	char pad1[64];
+	std::atomic<size_t> read_count;
+	char pad2[64];
+};
+
 struct MessageQueuePayloadDeleter
 {
 	void operator()(void *ptr);
@@ -215,6 +319,25 @@ private:
 	size_t payload_capacity[8] = {};
 };
 
+// Same API as LockFreeMessageQueue, but any number of threads may allocate, push, read and recycle concurrently.
+class LockFreeMPMCMessageQueue
+{
+public:
+	LockFreeMPMCMessageQueue();
+
+	MessageQueuePayload allocate_write_payload(size_t size) noexcept;
+	bool push_written_payload(MessageQueuePayload payload) noexcept;
+
+	size_t available_read_messages() const noexcept;
+	MessageQueuePayload read_message() noexcept;
+	void recycle_payload(MessageQueuePayload payload) noexcept;
+
+private:
+	LockFreeMPMCRingBuffer<MessageQueuePayload> read_ring;
+	LockFreeMPMCRingBuffer<MessageQueuePayload> write_ring[8];
+	size_t payload_capacity[8] = {};
+};
+
 class MessageQueue final : private LockFreeMessageQueue, public MessageQueueInterface
 {
 public:
@@ -126,7 +126,92 @@ public:
 		ObjectPool<T>::clear();
 	}
 
+	// Batch interface for ThreadLocalObjectPoolCache.
+	// Deals with raw storage, objects are neither constructed nor destroyed here.
+	void allocate_storage(std::vector<T *> &storage, size_t count)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+#ifndef OBJECT_POOL_DEBUG
+		while (this->vacants.size() < count)
+		{
+			unsigned num_objects = 64u << this->memory.size();
+			T *ptr = static_cast<T *>(memalign_alloc(std::max(size_t(64), alignof(T)),
+			                                         num_objects * sizeof(T)));
+			if (!ptr)
+				return;
+
+			for (unsigned i = 0; i < num_objects; i++)
+				this->vacants.push_back(&ptr[i]);
+
+			this->memory.emplace_back(ptr);
+		}
+
+		storage.insert(storage.end(), this->vacants.end() - count, this->vacants.end());
+		this->vacants.resize(this->vacants.size() - count);
+#else
+		for (size_t i = 0; i < count; i++)
+			storage.push_back(static_cast<T *>(::operator new(sizeof(T))));
+#endif
+	}
+
+	void free_storage(T *const *storage, size_t count)
+	{
+#ifndef OBJECT_POOL_DEBUG
+		std::lock_guard<std::mutex> holder{lock};
+		this->vacants.insert(this->vacants.end(), storage, storage + count);
+#else
+		for (size_t i = 0; i < count; i++)
+			::operator delete(storage[i]);
+#endif
+	}
+
 private:
 	std::mutex lock;
 };
+
+// Intended to be owned by a single thread. Objects are moved in and out of the
+// shared pool in batches so the pool lock is rarely taken.
+template<typename T>
+class ThreadLocalObjectPoolCache
+{
+public:
+	enum { BatchSize = 64 };
+
+	template<typename... P>
+	T *allocate(ThreadSafeObjectPool<T> &pool, P &&... p)
+	{
+		if (vacants.empty())
+		{
+			pool.allocate_storage(vacants, BatchSize);
+			if (vacants.empty())
+				return nullptr;
+		}
+
+		T *ptr = vacants.back();
+		vacants.pop_back();
+		new(ptr) T(std::forward<P>(p)...);
+		return ptr;
+	}
+
+	void free(ThreadSafeObjectPool<T> &pool, T *ptr)
+	{
+		ptr->~T();
+		vacants.push_back(ptr);
+
+		if (vacants.size() >= 2 * BatchSize)
+		{
+			pool.free_storage(vacants.data() + BatchSize, vacants.size() - BatchSize);
+			vacants.resize(BatchSize);
+		}
+	}
+
+	void flush(ThreadSafeObjectPool<T> &pool)
+	{
+		pool.free_storage(vacants.data(), vacants.size());
+		vacants.clear();
+	}
+
+private:
+	std::vector<T *> vacants;
+};
 }
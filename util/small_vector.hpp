@@ -24,6 +24,8 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <type_traits>
 #include <utility>
 #include <exception>
 #include <algorithm>
@@ -159,8 +161,7 @@ public:
 	{
 		auto count = size_t(arg_list_end - arg_list_begin);
 		reserve(count);
-		for (size_t i = 0; i < count; i++, arg_list_begin++)
-			new (&this->ptr[i]) T(*arg_list_begin);
+		copy_construct(this->ptr, arg_list_begin, count, Relocatable());
 		this->buffer_size = count;
 	}
 
@@ -193,11 +194,7 @@ public:
 		{
 			// Need to move the stack contents individually.
 			reserve(other.buffer_size);
-			for (size_t i = 0; i < other.buffer_size; i++)
-			{
-				new (&this->ptr[i]) T(std::move(other.ptr[i]));
-				other.ptr[i].~T();
-			}
+			relocate(this->ptr, other.ptr, other.buffer_size, Relocatable());
 			this->buffer_size = other.buffer_size;
 			other.buffer_size = 0;
 		}
@@ -214,8 +211,7 @@ public:
 	{
 		clear();
 		reserve(other.buffer_size);
-		for (size_t i = 0; i < other.buffer_size; i++)
-			new (&this->ptr[i]) T(other.ptr[i]);
+		copy_construct(this->ptr, other.ptr, other.buffer_size, Relocatable());
 		this->buffer_size = other.buffer_size;
 		return *this;
 	}
@@ -291,14 +287,7 @@ public:
 
 			// In case for some reason two allocations both come from same stack.
 			if (new_buffer != this->ptr)
-			{
-				// We don't deal with types which can throw in move constructor.
-				for (size_t i = 0; i < this->buffer_size; i++)
-				{
-					new (&new_buffer[i]) T(std::move(this->ptr[i]));
-					this->ptr[i].~T();
-				}
-			}
+				relocate(new_buffer, this->ptr, this->buffer_size, Relocatable());
 
 			if (this->ptr != stack_storage.data())
 				free(this->ptr);
@@ -313,8 +302,7 @@ public:
 		if (itr == this->end())
 		{
 			reserve(this->buffer_size + count);
-			for (size_t i = 0; i < count; i++, insert_begin++)
-				new (&this->ptr[this->buffer_size + i]) T(*insert_begin);
+			copy_construct(this->ptr + this->buffer_size, insert_begin, count, Relocatable());
 			this->buffer_size += count;
 		}
 		else
@@ -337,42 +325,30 @@ public:
 					std::terminate();
 
 				// First, move elements from source buffer to new buffer.
-				// We don't deal with types which can throw in move constructor.
-				auto *target_itr = new_buffer;
-				auto *original_source_itr = this->begin();
+				auto prefix = size_t(itr - this->begin());
+				auto suffix = size_t(this->end() - itr);
 
 				if (new_buffer != this->ptr)
-				{
-					while (original_source_itr != itr)
-					{
-						new (target_itr) T(std::move(*original_source_itr));
-						original_source_itr->~T();
-						++original_source_itr;
-						++target_itr;
-					}
-				}
+					relocate(new_buffer, this->ptr, prefix, Relocatable());
 
 				// Copy-construct new elements.
-				for (auto *source_itr = insert_begin; source_itr != insert_end; ++source_itr, ++target_itr)
-					new (target_itr) T(*source_itr);
+				copy_construct(new_buffer + prefix, insert_begin, count, Relocatable());
 
 				// Move over the other half.
 				if (new_buffer != this->ptr || insert_begin != insert_end)
-				{
-					while (original_source_itr != this->end())
-					{
-						new (target_itr) T(std::move(*original_source_itr));
-						original_source_itr->~T();
-						++original_source_itr;
-						++target_itr;
-					}
-				}
+					relocate(new_buffer + prefix + count, itr, suffix, Relocatable());
 
 				if (this->ptr != stack_storage.data())
 					free(this->ptr);
 				this->ptr = new_buffer;
 				buffer_capacity = target_capacity;
 			}
+			else if (Relocatable::value)
+			{
+				// Open a gap and fill it in one go.
+				memmove(static_cast<void *>(itr + count), itr, size_t(this->end() - itr) * sizeof(T));
+				memcpy(static_cast<void *>(itr), insert_begin, count * sizeof(T));
+			}
 			else
 			{
 				// Move in place, need to be a bit careful about which elements are constructed and which are not.
@@ -452,5 +428,36 @@ public:
 private:
 	size_t buffer_capacity = 0;
 	AlignedBuffer<T, N> stack_storage;
+
+	// Trivially copyable types like handles and POD structs are relocated with plain memcpy.
+	using Relocatable = std::integral_constant<bool, std::is_trivially_copyable<T>::value>;
+
+	static void relocate(T *dst, T *src, size_t count, std::true_type)
+	{
+		if (count)
+			memcpy(static_cast<void *>(dst), src, count * sizeof(T));
+	}
+
+	// We don't deal with types which can throw in move constructor.
+	static void relocate(T *dst, T *src, size_t count, std::false_type)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			new (&dst[i]) T(std::move(src[i]));
+			src[i].~T();
+		}
+	}
+
+	static void copy_construct(T *dst, const T *src, size_t count, std::true_type)
+	{
+		if (count)
+			memcpy(static_cast<void *>(dst), src, count * sizeof(T));
+	}
+
+	static void copy_construct(T *dst, const T *src, size_t count, std::false_type)
+	{
+		for (size_t i = 0; i < count; i++)
+			new (&dst[i]) T(src[i]);
+	}
 };
 }
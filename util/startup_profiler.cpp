@@ -0,0 +1,98 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "startup_profiler.hpp"
+#include "timeline_trace_file.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <mutex>
+#include <algorithm>
+
+namespace Util
+{
+static struct
+{
+	std::mutex lock;
+	std::vector<StartupPhase> phases;
+	TimelineTraceFile *trace_file = nullptr;
+	bool ended = false;
+} startup;
+
+static void submit_startup_phase(TimelineTraceFile &file, const StartupPhase &phase)
+{
+	auto *e = file.allocate_event();
+	e->set_desc(phase.name.c_str());
+	e->set_tid("startup");
+	e->start_ns = uint64_t(phase.start_ns);
+	e->end_ns = uint64_t(phase.end_ns);
+	file.submit_event(e);
+}
+
+ScopedStartupPhase::ScopedStartupPhase(const char *name_)
+	: name(name_), start_ns(get_current_time_nsecs())
+{
+}
+
+ScopedStartupPhase::~ScopedStartupPhase()
+{
+	record_startup_phase(name, start_ns, get_current_time_nsecs());
+}
+
+void record_startup_phase(const char *name, int64_t start_ns, int64_t end_ns)
+{
+	std::lock_guard<std::mutex> holder{startup.lock};
+	startup.phases.push_back({ name, start_ns, end_ns });
+	if (startup.ended && startup.trace_file)
+		submit_startup_phase(*startup.trace_file, startup.phases.back());
+}
+
+std::vector<StartupPhase> get_startup_phases()
+{
+	std::lock_guard<std::mutex> holder{startup.lock};
+	return startup.phases;
+}
+
+void end_startup(TimelineTraceFile *trace_file)
+{
+	std::lock_guard<std::mutex> holder{startup.lock};
+	if (startup.ended)
+		return;
+
+	startup.ended = true;
+	startup.trace_file = trace_file;
+	if (startup.phases.empty())
+		return;
+
+	int64_t begin_ns = startup.phases.front().start_ns;
+	for (auto &phase : startup.phases)
+		begin_ns = std::min(begin_ns, phase.start_ns);
+	startup.phases.push_back({ "startup-total", begin_ns, get_current_time_nsecs() });
+
+	for (auto &phase : startup.phases)
+	{
+		LOGI("Startup phase %s: %.3f ms (at +%.3f ms).\n", phase.name.c_str(),
+		     1e-6 * double(phase.end_ns - phase.start_ns), 1e-6 * double(phase.start_ns - begin_ns));
+		if (trace_file)
+			submit_startup_phase(*trace_file, phase);
+	}
+}
+}
@@ -0,0 +1,62 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Util
+{
+class TimelineTraceFile;
+
+// Coarse phases from process start to the first frame, to see where cold start time goes.
+struct StartupPhase
+{
+	std::string name;
+	int64_t start_ns;
+	int64_t end_ns;
+};
+
+class ScopedStartupPhase
+{
+public:
+	explicit ScopedStartupPhase(const char *name);
+	~ScopedStartupPhase();
+
+	ScopedStartupPhase(const ScopedStartupPhase &) = delete;
+	void operator=(const ScopedStartupPhase &) = delete;
+
+private:
+	const char *name;
+	int64_t start_ns;
+};
+
+// Thread-safe, phases may run in parallel.
+void record_startup_phase(const char *name, int64_t start_ns, int64_t end_ns);
+std::vector<StartupPhase> get_startup_phases();
+
+// Adds a total phase up to now, logs the breakdown and submits all phases to the trace file if there is one.
+// Only the first call has any effect. Phases recorded afterwards go straight to the trace file.
+void end_startup(TimelineTraceFile *trace_file);
+}
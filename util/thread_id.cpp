@@ -38,6 +38,11 @@ unsigned get_current_thread_index()
 	return ret;
 }
 
+unsigned query_current_thread_index()
+{
+	return thread_id_to_index;
+}
+
 void register_thread_index(unsigned index)
 {
 	thread_id_to_index = index;
@@ -25,5 +25,7 @@
 namespace Util
 {
 unsigned get_current_thread_index();
+// Like get_current_thread_index(), but returns ~0u for unregistered threads instead of logging.
+unsigned query_current_thread_index();
 void register_thread_index(unsigned thread_index);
 }
\ No newline at end of file
@@ -26,15 +26,23 @@
 #include "timer.hpp"
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
+#include <chrono>
 
 namespace Util
 {
 static thread_local char trace_tid[32];
+static thread_local uint32_t trace_tid_generation = 1;
 static thread_local TimelineTraceFile *trace_file;
 
+static std::atomic<uint64_t> trace_file_instance_counter;
+static thread_local uint64_t binary_buffer_owner;
+static thread_local void *binary_buffer;
+
 void TimelineTraceFile::set_tid(const char *tid)
 {
 	snprintf(trace_tid, sizeof(trace_tid), "%s", tid);
+	trace_tid_generation++;
 }
 
 void TimelineTraceFile::set_per_thread(TimelineTraceFile *file)
@@ -57,9 +65,115 @@ void TimelineTraceFile::Event::set_tid(const char *tid_)
 	snprintf(tid, sizeof(tid), "%s", tid_);
 }
 
+TimelineTraceFile::ThreadBuffer &TimelineTraceFile::get_thread_buffer()
+{
+	if (binary_buffer_owner == instance_id)
+		return *static_cast<ThreadBuffer *>(binary_buffer);
+
+	auto buffer = std::make_unique<ThreadBuffer>();
+	auto *ptr = buffer.get();
+	{
+		std::lock_guard<std::mutex> holder{buffer_lock};
+		thread_buffers.push_back(std::move(buffer));
+	}
+
+	binary_buffer_owner = instance_id;
+	binary_buffer = ptr;
+	return *ptr;
+}
+
+uint32_t TimelineTraceFile::intern_string(ThreadBuffer &buffer, const char *str)
+{
+	Hasher h;
+	h.string(str);
+	auto itr = buffer.string_cache.find(h.get());
+	if (itr != buffer.string_cache.end())
+		return itr->second;
+
+	uint32_t id;
+	{
+		std::lock_guard<std::mutex> holder{string_lock};
+		auto global_itr = string_ids.find(str);
+		if (global_itr != string_ids.end())
+		{
+			id = global_itr->second;
+		}
+		else
+		{
+			id = uint32_t(strings.size());
+			strings.emplace_back(str);
+			string_ids[str] = id;
+		}
+	}
+
+	buffer.string_cache[h.get()] = id;
+	return id;
+}
+
+void TimelineTraceFile::push_binary_event(const Event &e, bool use_event_tid)
+{
+	auto &buffer = get_thread_buffer();
+
+	TimelineTraceBinary::BinaryEvent binary = {};
+	binary.desc_id = intern_string(buffer, e.desc);
+	binary.pid = e.pid;
+	binary.start_ns = e.start_ns;
+	binary.end_ns = e.end_ns;
+
+	if (use_event_tid)
+	{
+		binary.tid_id = intern_string(buffer, e.tid);
+	}
+	else
+	{
+		if (buffer.tid_generation != trace_tid_generation)
+		{
+			buffer.tid_id = intern_string(buffer, trace_tid);
+			buffer.tid_generation = trace_tid_generation;
+		}
+		binary.tid_id = buffer.tid_id;
+	}
+
+	uint64_t write_count = buffer.write_count.load(std::memory_order_relaxed);
+	uint64_t read_count = buffer.read_count.load(std::memory_order_acquire);
+	uint64_t pending = write_count - read_count;
+
+	// Never block the producer. If the looper cannot keep up, drop the event.
+	if (pending >= ThreadBuffer::RingSize)
+	{
+		buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	buffer.ring[write_count & (ThreadBuffer::RingSize - 1)] = binary;
+	buffer.write_count.store(write_count + 1, std::memory_order_release);
+
+	if (pending + 1 == ThreadBuffer::RingSize / 2)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		binary_flush_requested = true;
+		cond.notify_one();
+	}
+}
+
+TimelineTraceFile::Format TimelineTraceFile::get_format() const
+{
+	return format;
+}
+
 TimelineTraceFile::Event *TimelineTraceFile::begin_event(const char *desc, uint32_t pid)
 {
-	auto *e = event_pool.allocate();
+	Event *e;
+	if (format == Format::Binary)
+	{
+		e = get_thread_buffer().event_cache.allocate(event_pool);
+		e->pid = pid;
+		e->set_desc(desc);
+		e->start_ns = get_current_time_nsecs();
+		return e;
+	}
+
+	e = event_pool.allocate();
 	e->pid = pid;
 	e->set_tid(trace_tid);
 	e->set_desc(desc);
@@ -80,6 +194,13 @@ TimelineTraceFile::Event *TimelineTraceFile::allocate_event()
 
 void TimelineTraceFile::submit_event(Event *e)
 {
+	if (format == Format::Binary && e)
+	{
+		push_binary_event(*e, true);
+		event_pool.free(e);
+		return;
+	}
+
 	std::lock_guard<std::mutex> holder{lock};
 	queued_events.push(e);
 	cond.notify_one();
@@ -88,12 +209,129 @@ void TimelineTraceFile::submit_event(Event *e)
 void TimelineTraceFile::end_event(Event *e)
 {
 	e->end_ns = get_current_time_nsecs();
-	submit_event(e);
+	if (format == Format::Binary)
+	{
+		push_binary_event(*e, false);
+		get_thread_buffer().event_cache.free(event_pool, e);
+	}
+	else
+		submit_event(e);
+}
+
+TimelineTraceFile::TimelineTraceFile(const std::string &path, Format format_)
+	: format(format_)
+{
+	instance_id = ++trace_file_instance_counter;
+	if (format == Format::Binary)
+		thr = std::thread(&TimelineTraceFile::binary_looper, this, path);
+	else
+		thr = std::thread(&TimelineTraceFile::looper, this, path);
 }
 
-TimelineTraceFile::TimelineTraceFile(const std::string &path)
+void TimelineTraceFile::binary_looper(std::string path)
 {
-	thr = std::thread(&TimelineTraceFile::looper, this, path);
+	using namespace TimelineTraceBinary;
+	set_current_thread_name("bin-trace-io");
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+		LOGE("Failed to open file: %s.\n", path.c_str());
+
+	FileHeader header = {};
+	memcpy(header.magic, Magic, sizeof(Magic));
+	header.base_ns = get_current_time_nsecs();
+	if (file)
+		fwrite(&header, sizeof(header), 1, file);
+
+	const auto write_block = [file](BlockType type, const void *data, size_t size, const void *extra, size_t extra_size) {
+		if (!file)
+			return;
+		BlockHeader block = { type, uint32_t(size + extra_size) };
+		fwrite(&block, sizeof(block), 1, file);
+		if (size)
+			fwrite(data, 1, size, file);
+		if (extra_size)
+			fwrite(extra, 1, extra_size, file);
+	};
+
+	size_t written_strings = 0;
+	uint64_t reported_dropped = 0;
+	std::vector<ThreadBuffer *> buffers;
+	std::vector<std::string> new_strings;
+
+	for (;;)
+	{
+		bool shutdown;
+		{
+			std::unique_lock<std::mutex> holder{lock};
+			cond.wait_for(holder, std::chrono::milliseconds(100), [this]() {
+				return binary_shutdown || binary_flush_requested;
+			});
+			binary_flush_requested = false;
+			shutdown = binary_shutdown;
+		}
+
+		{
+			std::lock_guard<std::mutex> holder{buffer_lock};
+			buffers.clear();
+			for (auto &buf : thread_buffers)
+				buffers.push_back(buf.get());
+		}
+
+		// Strings must be flushed before any events referencing them.
+		// Producers intern strings before publishing the event, so snapshotting here is sufficient.
+		std::vector<uint64_t> write_counts;
+		write_counts.reserve(buffers.size());
+		for (auto *buf : buffers)
+			write_counts.push_back(buf->write_count.load(std::memory_order_acquire));
+
+		{
+			std::lock_guard<std::mutex> holder{string_lock};
+			new_strings.assign(strings.begin() + ptrdiff_t(written_strings), strings.end());
+		}
+
+		for (auto &str : new_strings)
+		{
+			auto id = uint32_t(written_strings++);
+			write_block(BlockType::String, &id, sizeof(id), str.data(), str.size());
+		}
+
+		uint64_t total_dropped = 0;
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			auto *buf = buffers[i];
+			uint64_t read_count = buf->read_count.load(std::memory_order_relaxed);
+			uint64_t write_count = write_counts[i];
+			total_dropped += buf->dropped.load(std::memory_order_relaxed);
+
+			if (read_count == write_count)
+				continue;
+
+			auto start = size_t(read_count & (ThreadBuffer::RingSize - 1));
+			auto count = size_t(write_count - read_count);
+			auto first_count = std::min<size_t>(count, ThreadBuffer::RingSize - start);
+			write_block(BlockType::Events,
+			            buf->ring + start, first_count * sizeof(BinaryEvent),
+			            buf->ring, (count - first_count) * sizeof(BinaryEvent));
+
+			buf->read_count.store(write_count, std::memory_order_release);
+		}
+
+		if (total_dropped != reported_dropped)
+		{
+			write_block(BlockType::Dropped, &total_dropped, sizeof(total_dropped), nullptr, 0);
+			reported_dropped = total_dropped;
+		}
+
+		if (shutdown)
+			break;
+	}
+
+	if (reported_dropped)
+		LOGW("Timeline trace dropped %llu events.\n", static_cast<unsigned long long>(reported_dropped));
+
+	if (file)
+		fclose(file);
 }
 
 void TimelineTraceFile::looper(std::string path)
@@ -145,7 +383,15 @@ void TimelineTraceFile::looper(std::string path)
 
 TimelineTraceFile::~TimelineTraceFile()
 {
-	submit_event(nullptr);
+	if (format == Format::Binary)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		binary_shutdown = true;
+		cond.notify_one();
+	}
+	else
+		submit_event(nullptr);
+
 	if (thr.joinable())
 		thr.join();
 }
@@ -28,14 +28,66 @@
 #include <mutex>
 #include <memory>
 #include <queue>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
 #include "object_pool.hpp"
+#include "hash.hpp"
 
 namespace Util
 {
+// On-disk layout of the binary trace format.
+// A FileHeader is followed by a stream of blocks, each a BlockHeader followed by size bytes of payload.
+// String blocks define an interned string (u32 id followed by the characters without terminator).
+// Event blocks are an array of BinaryEvent which only reference strings defined earlier in the stream.
+namespace TimelineTraceBinary
+{
+static constexpr char Magic[8] = { 'G', 'T', 'R', 'A', 'C', 'E', '0', '1' };
+
+struct FileHeader
+{
+	char magic[8];
+	uint64_t base_ns;
+};
+
+enum class BlockType : uint32_t
+{
+	String = 1,
+	Events = 2,
+	Dropped = 3
+};
+
+struct BlockHeader
+{
+	BlockType type;
+	uint32_t size;
+};
+
+struct BinaryEvent
+{
+	uint32_t desc_id;
+	uint32_t tid_id;
+	uint32_t pid;
+	uint32_t reserved;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+static_assert(sizeof(BinaryEvent) == 32, "Unexpected BinaryEvent size.");
+}
+
 class TimelineTraceFile
 {
 public:
-	explicit TimelineTraceFile(const std::string &path);
+	enum class Format
+	{
+		JSON,
+		// Fixed-size records are appended to per-thread ring buffers and flushed as raw memory.
+		// Use tools/timeline-trace-to-json to convert to Chrome trace JSON.
+		Binary
+	};
+
+	explicit TimelineTraceFile(const std::string &path, Format format = Format::JSON);
 	~TimelineTraceFile();
 
 	static void set_tid(const char *tid);
@@ -58,13 +110,48 @@ public:
 	Event *allocate_event();
 	void submit_event(Event *e);
 
+	Format get_format() const;
+
 private:
 	void looper(std::string path);
+	void binary_looper(std::string path);
 	std::thread thr;
 	std::mutex lock;
 	std::condition_variable cond;
 
 	ThreadSafeObjectPool<Event> event_pool;
 	std::queue<Event *> queued_events;
+
+	Format format;
+
+	// Single producer (owning thread), single consumer (looper) ring of events.
+	struct ThreadBuffer
+	{
+		enum { RingSize = 16 * 1024 };
+		TimelineTraceBinary::BinaryEvent ring[RingSize];
+		std::atomic<uint64_t> write_count{0};
+		std::atomic<uint64_t> read_count{0};
+		std::atomic<uint64_t> dropped{0};
+
+		// Only accessed by owning thread.
+		std::unordered_map<Hash, uint32_t> string_cache;
+		ThreadLocalObjectPoolCache<Event> event_cache;
+		uint32_t tid_id = UINT32_MAX;
+		uint32_t tid_generation = 0;
+	};
+
+	uint64_t instance_id;
+	bool binary_shutdown = false;
+	bool binary_flush_requested = false;
+	std::mutex buffer_lock;
+	std::vector<std::unique_ptr<ThreadBuffer>> thread_buffers;
+
+	std::mutex string_lock;
+	std::vector<std::string> strings;
+	std::unordered_map<std::string, uint32_t> string_ids;
+
+	ThreadBuffer &get_thread_buffer();
+	uint32_t intern_string(ThreadBuffer &buffer, const char *str);
+	void push_binary_event(const Event &e, bool use_event_tid);
 };
 }
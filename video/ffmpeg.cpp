@@ -26,12 +26,17 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 }
 
 #include "ffmpeg.hpp"
+#include "format.hpp"
 #include "logging.hpp"
 #include "thread_latch.hpp"
+#include <stdlib.h>
+#include <string.h>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -41,7 +46,8 @@ extern "C"
 
 namespace Granite
 {
-static constexpr unsigned NumFrames = 4;
+static constexpr unsigned DefaultFrames = 4;
+static constexpr unsigned MaxFrames = 16;
 
 struct CodecStream
 {
@@ -50,6 +56,11 @@ struct CodecStream
 	AVCodecContext *av_ctx = nullptr;
 	AVPacket *av_pkt = nullptr;
 	SwsContext *sws_ctx = nullptr;
+
+	// Set for encoders which take hardware frames, av_frame is uploaded into hw_frame.
+	AVBufferRef *hw_device = nullptr;
+	AVBufferRef *hw_frames = nullptr;
+	AVFrame *hw_frame = nullptr;
 };
 
 struct VideoEncoder::Impl
@@ -76,10 +87,16 @@ struct VideoEncoder::Impl
 		Vulkan::BufferHandle buffer;
 		Vulkan::Fence fence;
 		ThreadLatch latch;
+		// If planar, the GPU wrote YUV planes, otherwise the buffer holds RGBA for swscale.
+		bool planar = false;
 		int stride = 0;
+		int chroma_stride = 0;
+		size_t chroma_offset = 0;
+		size_t chroma_plane_size = 0;
 		std::vector<int16_t> audio_buffer;
 	};
-	Frame frames[NumFrames];
+	Frame frames[MaxFrames];
+	unsigned num_frames = DefaultFrames;
 	unsigned frame_index = 0;
 	std::thread thr;
 
@@ -88,12 +105,25 @@ struct VideoEncoder::Impl
 			Vulkan::CommandBuffer::Type type,
 			const Vulkan::Semaphore &semaphore,
 			Vulkan::Semaphore &release_semaphore);
+	void enqueue_yuv_conversion(
+			Frame &frame, const Vulkan::Image &image, VkImageLayout layout,
+			Vulkan::CommandBuffer::Type type,
+			const Vulkan::Semaphore &semaphore,
+			Vulkan::Semaphore &release_semaphore);
+	void enqueue_rgb_copy(
+			Frame &frame, const Vulkan::Image &image, VkImageLayout layout,
+			Vulkan::CommandBuffer::Type type,
+			const Vulkan::Semaphore &semaphore,
+			Vulkan::Semaphore &release_semaphore);
+	void copy_planes(const Frame &frame, const uint8_t *planes);
 
 	bool drain_packets(CodecStream &stream);
 	void drain();
 	void thread_main();
 
 	bool init_video_codec();
+	bool open_video_codec(Encoder encoder);
+	bool init_vaapi_frames();
 	bool init_audio_codec();
 
 	int64_t audio_pts = 0;
@@ -114,6 +144,10 @@ static void free_av_objects(CodecStream &stream)
 {
 	if (stream.av_frame)
 		av_frame_free(&stream.av_frame);
+	if (stream.hw_frame)
+		av_frame_free(&stream.hw_frame);
+	av_buffer_unref(&stream.hw_frames);
+	av_buffer_unref(&stream.hw_device);
 	if (stream.sws_ctx)
 		sws_freeContext(stream.sws_ctx);
 	if (stream.av_pkt)
@@ -157,25 +191,88 @@ VideoEncoder::Impl::~Impl()
 	drain_codec();
 }
 
-bool VideoEncoder::Impl::enqueue_buffer_readback(
-		const Vulkan::Image &image, VkImageLayout layout,
+void VideoEncoder::Impl::enqueue_yuv_conversion(
+		Frame &frame, const Vulkan::Image &image, VkImageLayout layout,
 		Vulkan::CommandBuffer::Type type,
 		const Vulkan::Semaphore &semaphore,
 		Vulkan::Semaphore &release_semaphore)
 {
-	frame_index = (frame_index + 1) % NumFrames;
-	auto &frame = frames[frame_index];
+	unsigned width = image.get_width();
+	unsigned height = image.get_height();
+	bool nv12 = options.format == Format::NV12;
 
-	if (!frame.latch.wait_latch_cleared())
+	// The shader writes 8x2 blocks. Rows are padded so that every plane row is a whole number of words.
+	unsigned aligned_width = (width + 63) & ~63;
+	unsigned aligned_height = (height + 1) & ~1;
+	frame.planar = true;
+	frame.stride = int(aligned_width);
+	frame.chroma_stride = int(nv12 ? aligned_width : aligned_width / 2);
+	frame.chroma_offset = size_t(aligned_width) * aligned_height;
+	frame.chroma_plane_size = size_t(frame.chroma_stride) * (aligned_height / 2);
+
+	Vulkan::BufferCreateInfo buf;
+	buf.size = frame.chroma_offset + frame.chroma_plane_size * (nv12 ? 1 : 2);
+	buf.domain = Vulkan::BufferDomain::CachedHost;
+	buf.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	if (!frame.buffer || frame.buffer->get_create_info().size != buf.size ||
+	    frame.buffer->get_create_info().usage != buf.usage)
 	{
-		LOGE("Encoding thread died ...\n");
-		return false;
+		frame.buffer = device->create_buffer(buf);
 	}
 
+	Vulkan::OwnershipTransferInfo transfer_info = {};
+	transfer_info.old_queue = type;
+	transfer_info.new_queue = Vulkan::CommandBuffer::Type::AsyncCompute;
+	transfer_info.old_image_layout = layout;
+	transfer_info.new_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	transfer_info.dst_pipeline_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	transfer_info.dst_access = VK_ACCESS_SHADER_READ_BIT;
+
+	auto cmd = Vulkan::request_command_buffer_with_ownership_transfer(
+			*device, image, transfer_info, semaphore);
+
+	cmd->set_program("builtin://shaders/util/rgb_to_yuv.comp",
+	                 {{ "NV12", nv12 ? 1 : 0 },
+	                  { "ENCODE_SRGB", Vulkan::format_is_srgb(image.get_format()) ? 1 : 0 }});
+	cmd->set_texture(0, 0, image.get_view(), Vulkan::StockSampler::NearestClamp);
+	cmd->set_storage_buffer(0, 1, *frame.buffer);
+
+	struct Push
+	{
+		int32_t resolution[2];
+		uint32_t luma_stride;
+		uint32_t chroma_offset;
+		uint32_t chroma_stride;
+		uint32_t chroma_plane_size;
+	} push = {
+		{ int32_t(width), int32_t(height) },
+		uint32_t(frame.stride / 4), uint32_t(frame.chroma_offset / 4),
+		uint32_t(frame.chroma_stride / 4), uint32_t(frame.chroma_plane_size / 4),
+	};
+	cmd->push_constants(&push, 0, sizeof(push));
+
+	unsigned blocks_x = (width + 7) / 8;
+	unsigned blocks_y = (height + 1) / 2;
+	cmd->dispatch((blocks_x + 7) / 8, (blocks_y + 7) / 8, 1);
+
+	cmd->barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+	device->submit(cmd, &frame.fence, 1, &release_semaphore);
+}
+
+void VideoEncoder::Impl::enqueue_rgb_copy(
+		Frame &frame, const Vulkan::Image &image, VkImageLayout layout,
+		Vulkan::CommandBuffer::Type type,
+		const Vulkan::Semaphore &semaphore,
+		Vulkan::Semaphore &release_semaphore)
+{
 	unsigned width = image.get_width();
 	unsigned height = image.get_height();
 	unsigned aligned_width = (width + 63) & ~63;
 	unsigned pix_size = Vulkan::TextureFormatLayout::format_block_size(image.get_format(), VK_IMAGE_ASPECT_COLOR_BIT);
+	frame.planar = false;
 	frame.stride = int(pix_size * aligned_width);
 
 	Vulkan::BufferCreateInfo buf;
@@ -183,8 +280,11 @@ bool VideoEncoder::Impl::enqueue_buffer_readback(
 	buf.domain = Vulkan::BufferDomain::CachedHost;
 	buf.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-	if (!frame.buffer || frame.buffer->get_create_info().size != buf.size)
+	if (!frame.buffer || frame.buffer->get_create_info().size != buf.size ||
+	    frame.buffer->get_create_info().usage != buf.usage)
+	{
 		frame.buffer = device->create_buffer(buf);
+	}
 
 	Vulkan::OwnershipTransferInfo transfer_info = {};
 	transfer_info.old_queue = type;
@@ -205,6 +305,28 @@ bool VideoEncoder::Impl::enqueue_buffer_readback(
 						  VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
 
 	device->submit(transfer_cmd, &frame.fence, 1, &release_semaphore);
+}
+
+bool VideoEncoder::Impl::enqueue_buffer_readback(
+		const Vulkan::Image &image, VkImageLayout layout,
+		Vulkan::CommandBuffer::Type type,
+		const Vulkan::Semaphore &semaphore,
+		Vulkan::Semaphore &release_semaphore)
+{
+	frame_index = (frame_index + 1) % num_frames;
+	auto &frame = frames[frame_index];
+
+	if (!frame.latch.wait_latch_cleared())
+	{
+		LOGE("Encoding thread died ...\n");
+		return false;
+	}
+
+	// Converting on the GPU reads back half the data of RGBA and keeps swscale off the encoder thread.
+	if ((image.get_create_info().usage & VK_IMAGE_USAGE_SAMPLED_BIT) != 0)
+		enqueue_yuv_conversion(frame, image, layout, type, semaphore, release_semaphore);
+	else
+		enqueue_rgb_copy(frame, image, layout, type, semaphore, release_semaphore);
 
 	// Render out audio in the main thread to ensure exact reproducibility across runs.
 	// If we don't care about that, we can render audio directly in the thread worker.
@@ -251,6 +373,33 @@ bool VideoEncoder::Impl::drain_packets(CodecStream &stream)
 	return ret == 0 || ret == AVERROR_EOF || ret == AVERROR(EAGAIN);
 }
 
+void VideoEncoder::Impl::copy_planes(const Frame &frame, const uint8_t *planes)
+{
+	int width = int(options.width);
+	int height = int(options.height);
+	int chroma_width = (width + 1) / 2;
+	int chroma_height = (height + 1) / 2;
+
+	av_image_copy_plane(video.av_frame->data[0], video.av_frame->linesize[0],
+	                    planes, frame.stride, width, height);
+
+	if (options.format == Format::NV12)
+	{
+		av_image_copy_plane(video.av_frame->data[1], video.av_frame->linesize[1],
+		                    planes + frame.chroma_offset, frame.chroma_stride,
+		                    2 * chroma_width, chroma_height);
+	}
+	else
+	{
+		av_image_copy_plane(video.av_frame->data[1], video.av_frame->linesize[1],
+		                    planes + frame.chroma_offset, frame.chroma_stride,
+		                    chroma_width, chroma_height);
+		av_image_copy_plane(video.av_frame->data[2], video.av_frame->linesize[2],
+		                    planes + frame.chroma_offset + frame.chroma_plane_size, frame.chroma_stride,
+		                    chroma_width, chroma_height);
+	}
+}
+
 void VideoEncoder::Impl::thread_main()
 {
 	unsigned index = 0;
@@ -261,7 +410,7 @@ void VideoEncoder::Impl::thread_main()
 
 	for (;;)
 	{
-		index = (index + 1) % NumFrames;
+		index = (index + 1) % num_frames;
 		auto &frame = frames[index];
 		if (!frame.latch.wait_latch_set())
 			return;
@@ -325,22 +474,43 @@ void VideoEncoder::Impl::thread_main()
 			frame.fence.reset();
 		}
 
-		const uint8_t *src_slices[4] = {
-			static_cast<const uint8_t *>(device->map_host_buffer(*frame.buffer, Vulkan::MEMORY_ACCESS_READ_BIT)),
-		};
-
-		const int linesizes[4] = { frame.stride };
+		auto *mapped = static_cast<const uint8_t *>(
+				device->map_host_buffer(*frame.buffer, Vulkan::MEMORY_ACCESS_READ_BIT));
 
-		sws_scale(video.sws_ctx, src_slices, linesizes,
-		          0, int(options.height),
-		          video.av_frame->data, video.av_frame->linesize);
+		if (frame.planar)
+			copy_planes(frame, mapped);
+		else
+		{
+			const uint8_t *src_slices[4] = { mapped };
+			const int linesizes[4] = { frame.stride };
+			sws_scale(video.sws_ctx, src_slices, linesizes,
+			          0, int(options.height),
+			          video.av_frame->data, video.av_frame->linesize);
+		}
 		video.av_frame->pts = encode_video_pts++;
 
 		device->unmap_host_buffer(*frame.buffer, Vulkan::MEMORY_ACCESS_READ_BIT);
 
 		frame.latch.clear_latch();
 
-		ret = avcodec_send_frame(video.av_ctx, video.av_frame);
+		AVFrame *send_frame = video.av_frame;
+		if (video.hw_frames)
+		{
+			if ((ret = av_hwframe_get_buffer(video.hw_frames, video.hw_frame, 0)) < 0 ||
+			    (ret = av_hwframe_transfer_data(video.hw_frame, video.av_frame, 0)) < 0)
+			{
+				LOGE("Failed to upload frame to encoder: %d\n", ret);
+				frame.latch.kill_latch();
+				return;
+			}
+
+			video.hw_frame->pts = video.av_frame->pts;
+			send_frame = video.hw_frame;
+		}
+
+		ret = avcodec_send_frame(video.av_ctx, send_frame);
+		if (video.hw_frames)
+			av_frame_unref(video.hw_frame);
 		if (ret < 0)
 		{
 			LOGE("Failed to send packet to codec: %d\n", ret);
@@ -441,19 +611,48 @@ bool VideoEncoder::Impl::init_audio_codec()
 #endif
 }
 
-bool VideoEncoder::Impl::init_video_codec()
+bool VideoEncoder::Impl::init_vaapi_frames()
 {
-	AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-	if (!codec)
+	// Defaults to the first render node.
+	const char *device_path = getenv("GRANITE_VAAPI_DEVICE");
+	int ret = av_hwdevice_ctx_create(&video.hw_device, AV_HWDEVICE_TYPE_VAAPI, device_path, nullptr, 0);
+	if (ret < 0)
 	{
-		LOGE("Could not find H.264 encoder.\n");
+		LOGW("Failed to create VAAPI device: %d\n", ret);
 		return false;
 	}
 
-	video.av_stream = avformat_new_stream(av_format_ctx, codec);
-	if (!video.av_stream)
+	video.hw_frames = av_hwframe_ctx_alloc(video.hw_device);
+	if (!video.hw_frames)
+		return false;
+
+	auto *frames_ctx = reinterpret_cast<AVHWFramesContext *>(video.hw_frames->data);
+	frames_ctx->format = AV_PIX_FMT_VAAPI;
+	frames_ctx->sw_format = AV_PIX_FMT_NV12;
+	frames_ctx->width = int(options.width);
+	frames_ctx->height = int(options.height);
+
+	if ((ret = av_hwframe_ctx_init(video.hw_frames)) < 0)
 	{
-		LOGE("Failed to add new stream.\n");
+		LOGW("Failed to initialize VAAPI frames: %d\n", ret);
+		return false;
+	}
+
+	return true;
+}
+
+bool VideoEncoder::Impl::open_video_codec(Encoder encoder)
+{
+	const char *name = nullptr;
+	if (encoder == Encoder::VAAPI)
+		name = "h264_vaapi";
+	else if (encoder == Encoder::NVENC)
+		name = "h264_nvenc";
+
+	const AVCodec *codec = name ? avcodec_find_encoder_by_name(name) : avcodec_find_encoder(AV_CODEC_ID_H264);
+	if (!codec)
+	{
+		LOGW("Could not find %s encoder.\n", name ? name : "H.264");
 		return false;
 	}
 
@@ -464,47 +663,144 @@ bool VideoEncoder::Impl::init_video_codec()
 		return false;
 	}
 
+	bool hardware = encoder != Encoder::Software;
+	bool nv12 = hardware || options.format == Format::NV12;
+
 	video.av_ctx->width = options.width;
 	video.av_ctx->height = options.height;
-	video.av_ctx->pix_fmt = AV_PIX_FMT_YUV444P;
+	video.av_ctx->pix_fmt = nv12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+	video.av_ctx->color_range = AVCOL_RANGE_MPEG;
+	video.av_ctx->colorspace = AVCOL_SPC_BT709;
+	video.av_ctx->color_primaries = AVCOL_PRI_BT709;
+	video.av_ctx->color_trc = AVCOL_TRC_IEC61966_2_1;
 	video.av_ctx->framerate = { options.frame_timebase.den, options.frame_timebase.num };
 	video.av_ctx->time_base = { options.frame_timebase.num, options.frame_timebase.den };
 
 	if (av_format_ctx->oformat->flags & AVFMT_GLOBALHEADER)
 		video.av_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
-	video.av_stream->id = 0;
-	video.av_stream->time_base = video.av_ctx->time_base;
-
 	AVDictionary *opts = nullptr;
-	av_dict_set_int(&opts, "crf", 18, 0);
-	av_dict_set(&opts, "preset", "fast", 0);
-	int ret = avcodec_open2(video.av_ctx, codec, &opts);
+	bool success = true;
+
+	if (encoder == Encoder::VAAPI)
+	{
+		success = init_vaapi_frames();
+		if (success)
+		{
+			video.av_ctx->pix_fmt = AV_PIX_FMT_VAAPI;
+			video.av_ctx->hw_frames_ctx = av_buffer_ref(video.hw_frames);
+			video.av_ctx->global_quality = 20;
+			av_dict_set(&opts, "rc_mode", "CQP", 0);
+		}
+	}
+	else if (encoder == Encoder::NVENC)
+	{
+		// NVENC uploads system memory frames itself.
+		av_dict_set(&opts, "rc", "vbr", 0);
+		av_dict_set_int(&opts, "cq", 20, 0);
+	}
+	else
+	{
+		av_dict_set_int(&opts, "crf", 18, 0);
+		av_dict_set(&opts, "preset", "fast", 0);
+	}
+
+	if (success)
+	{
+		int ret = avcodec_open2(video.av_ctx, codec, &opts);
+		if (ret < 0)
+		{
+			LOGW("Could not open %s: %d\n", codec->name, ret);
+			success = false;
+		}
+	}
 	av_dict_free(&opts);
 
-	if (ret < 0)
+	if (!success)
 	{
-		LOGE("Could not open codec: %d\n", ret);
+		avcodec_free_context(&video.av_ctx);
+		av_buffer_unref(&video.hw_frames);
+		av_buffer_unref(&video.hw_device);
+		return false;
+	}
+
+	if (hardware)
+		options.format = Format::NV12;
+	LOGI("Encoding video with %s.\n", codec->name);
+	return true;
+}
+
+bool VideoEncoder::Impl::init_video_codec()
+{
+	video.av_stream = avformat_new_stream(av_format_ctx, nullptr);
+	if (!video.av_stream)
+	{
+		LOGE("Failed to add new stream.\n");
 		return false;
 	}
 
+	Encoder encoder = options.encoder;
+	const char *env = getenv("GRANITE_VIDEO_ENCODER");
+	if (env)
+	{
+		if (strcmp(env, "software") == 0)
+			encoder = Encoder::Software;
+		else if (strcmp(env, "vaapi") == 0)
+			encoder = Encoder::VAAPI;
+		else if (strcmp(env, "nvenc") == 0)
+			encoder = Encoder::NVENC;
+		else if (strcmp(env, "auto") == 0)
+			encoder = Encoder::Auto;
+		else
+			LOGW("Unknown video encoder \"%s\".\n", env);
+	}
+
+	bool opened;
+	if (encoder == Encoder::Auto)
+	{
+		opened = open_video_codec(Encoder::NVENC) ||
+		         open_video_codec(Encoder::VAAPI) ||
+		         open_video_codec(Encoder::Software);
+	}
+	else
+		opened = open_video_codec(encoder);
+
+	if (!opened)
+		return false;
+
+	video.av_stream->id = 0;
+	video.av_stream->time_base = video.av_ctx->time_base;
 	avcodec_parameters_from_context(video.av_stream->codecpar, video.av_ctx);
 
-	video.av_frame = alloc_video_frame(video.av_ctx->pix_fmt, options.width, options.height);
+	AVPixelFormat pix_fmt = options.format == Format::NV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+	if (video.hw_frames)
+	{
+		video.hw_frame = av_frame_alloc();
+		if (!video.hw_frame)
+			return false;
+	}
+
+	video.av_frame = alloc_video_frame(pix_fmt, options.width, options.height);
 	if (!video.av_frame)
 	{
 		LOGE("Failed to allocate AVFrame.\n");
 		return false;
 	}
 
+	// Only used for images which cannot be sampled by the conversion shader.
 	video.sws_ctx = sws_getContext(options.width, options.height,
 	                               AV_PIX_FMT_RGB0,
 	                               options.width, options.height,
-	                               AV_PIX_FMT_YUV444P, SWS_POINT,
+	                               pix_fmt, SWS_BILINEAR,
 	                               nullptr, nullptr, nullptr);
 	if (!video.sws_ctx)
 		return false;
 
+	// Match the BT.709 limited range output of the shader.
+	sws_setColorspaceDetails(video.sws_ctx, sws_getCoefficients(SWS_CS_DEFAULT), 1,
+	                         sws_getCoefficients(SWS_CS_ITU709), 0,
+	                         0, 1 << 16, 1 << 16);
+
 	video.av_pkt = av_packet_alloc();
 	if (!video.av_pkt)
 		return false;
@@ -516,6 +812,9 @@ bool VideoEncoder::Impl::init(Vulkan::Device *device_, const char *path, const O
 	device = device_;
 	options = options_;
 
+	num_frames = options.readback_frames ? options.readback_frames : DefaultFrames;
+	num_frames = std::max(2u, std::min(num_frames, MaxFrames));
+
 	int ret;
 	if ((ret = avformat_alloc_output_context2(&av_format_ctx, nullptr, nullptr, path)) < 0)
 	{
@@ -44,11 +44,31 @@ public:
 		int den;
 	};
 
+	enum class Format
+	{
+		YUV420P,
+		NV12
+	};
+
+	// Hardware encoders always take NV12. GRANITE_VIDEO_ENCODER=software|vaapi|nvenc|auto overrides.
+	enum class Encoder
+	{
+		Software,
+		VAAPI,
+		NVENC,
+		// Tries NVENC, then VAAPI, then falls back to software.
+		Auto
+	};
+
 	struct Options
 	{
 		unsigned width;
 		unsigned height;
 		Timebase frame_timebase;
+		Format format = Format::YUV420P;
+		Encoder encoder = Encoder::Software;
+		// Frames which can be in flight between the GPU and the encoder thread. 0 picks a default.
+		unsigned readback_frames = 0;
 	};
 
 	void set_audio_source(Audio::DumpBackend *backend);
@@ -0,0 +1,599 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define __STDC_LIMIT_MACROS 1
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+#include "ffmpeg_decode.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Granite
+{
+static constexpr unsigned DefaultDecodeFrames = 4;
+static constexpr unsigned MaxDecodeFrames = 16;
+
+struct VideoDecoder::Impl
+{
+	Vulkan::Device *device = nullptr;
+	Options options;
+	~Impl();
+
+	AVFormatContext *av_format_ctx = nullptr;
+	AVStream *av_stream = nullptr;
+	AVCodecContext *av_ctx = nullptr;
+	AVPacket *av_pkt = nullptr;
+	AVFrame *av_frame = nullptr;
+	AVFrame *sw_frame = nullptr;
+	SwsContext *sws_ctx = nullptr;
+	AVBufferRef *hw_device = nullptr;
+	AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
+
+	// Decoded NV12 in host memory, written by the decode thread and copied to the image by the render thread.
+	struct Frame
+	{
+		Vulkan::BufferHandle buffer;
+		// Signalled once the upload from buffer has completed.
+		Vulkan::Fence fence;
+		double pts = 0.0;
+	};
+	Frame frames[MaxDecodeFrames];
+	unsigned num_frames = DefaultDecodeFrames;
+
+	// Frames in [read_count, write_count) are decoded and waiting for acquire_frame().
+	std::mutex lock;
+	std::condition_variable cond;
+	uint64_t read_count = 0;
+	uint64_t write_count = 0;
+	bool eof = false;
+	bool shutdown = false;
+	std::thread thr;
+
+	Vulkan::ImageHandle image;
+	const Vulkan::ImmutableYcbcrConversion *ycbcr = nullptr;
+	const Vulkan::ImmutableSampler *sampler = nullptr;
+	unsigned width = 0;
+	unsigned height = 0;
+	size_t chroma_offset = 0;
+
+	double frame_duration = 0.0;
+	double loop_offset = 0.0;
+	double last_pts = 0.0;
+
+	bool init(Vulkan::Device *device, const char *path, const Options &options);
+	bool init_codec(bool hardware);
+	bool init_ycbcr();
+	bool play();
+	bool acquire_frame(double time);
+
+	void thread_main();
+	bool decode_packet(const AVPacket *pkt);
+	bool write_frame(AVFrame *frame);
+	bool copy_nv12(const AVFrame *frame, uint8_t *mapped);
+	double compute_pts(const AVFrame *frame);
+
+	static AVPixelFormat get_hw_format(AVCodecContext *ctx, const AVPixelFormat *formats);
+};
+
+VideoDecoder::Impl::~Impl()
+{
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		shutdown = true;
+	}
+	cond.notify_all();
+
+	if (thr.joinable())
+		thr.join();
+
+	if (sws_ctx)
+		sws_freeContext(sws_ctx);
+	if (av_frame)
+		av_frame_free(&av_frame);
+	if (sw_frame)
+		av_frame_free(&sw_frame);
+	if (av_pkt)
+		av_packet_free(&av_pkt);
+	if (av_ctx)
+		avcodec_free_context(&av_ctx);
+	if (hw_device)
+		av_buffer_unref(&hw_device);
+	if (av_format_ctx)
+		avformat_close_input(&av_format_ctx);
+}
+
+AVPixelFormat VideoDecoder::Impl::get_hw_format(AVCodecContext *ctx, const AVPixelFormat *formats)
+{
+	auto *impl = static_cast<Impl *>(ctx->opaque);
+	for (const AVPixelFormat *fmt = formats; *fmt != AV_PIX_FMT_NONE; fmt++)
+		if (*fmt == impl->hw_pix_fmt)
+			return *fmt;
+
+	// The decoder cannot use the device for this stream after all, let it pick a software format.
+	LOGW("Hardware decode not supported for this stream, falling back to software.\n");
+	return avcodec_default_get_format(ctx, formats);
+}
+
+bool VideoDecoder::Impl::init_codec(bool hardware)
+{
+	const AVCodec *codec = avcodec_find_decoder(av_stream->codecpar->codec_id);
+	if (!codec)
+	{
+		LOGE("Could not find decoder.\n");
+		return false;
+	}
+
+	av_ctx = avcodec_alloc_context3(codec);
+	if (!av_ctx)
+		return false;
+
+	int ret;
+	if ((ret = avcodec_parameters_to_context(av_ctx, av_stream->codecpar)) < 0)
+	{
+		LOGE("Failed to copy codec parameters: %d\n", ret);
+		return false;
+	}
+
+	// Take the first device type the codec supports which can actually be created on this system.
+	for (int i = 0; hardware; i++)
+	{
+		const AVCodecHWConfig *config = avcodec_get_hw_config(codec, i);
+		if (!config)
+			break;
+		if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) == 0)
+			continue;
+		if (av_hwdevice_ctx_create(&hw_device, config->device_type, nullptr, nullptr, 0) < 0)
+			continue;
+
+		hw_pix_fmt = config->pix_fmt;
+		av_ctx->hw_device_ctx = av_buffer_ref(hw_device);
+		av_ctx->opaque = this;
+		av_ctx->get_format = get_hw_format;
+		LOGI("Using %s for video decode.\n", av_hwdevice_get_type_name(config->device_type));
+		break;
+	}
+
+	if (!hw_device)
+	{
+		if (hardware)
+			LOGW("No hardware decoder available, falling back to software.\n");
+		av_ctx->thread_count = 0;
+	}
+
+	if ((ret = avcodec_open2(av_ctx, codec, nullptr)) < 0)
+	{
+		LOGE("Could not open codec: %d\n", ret);
+		return false;
+	}
+
+	return true;
+}
+
+bool VideoDecoder::Impl::init_ycbcr()
+{
+	if (!device->get_device_features().sampler_ycbcr_conversion_features.samplerYcbcrConversion)
+	{
+		LOGE("YCbCr conversion is not supported.\n");
+		return false;
+	}
+
+	auto *par = av_stream->codecpar;
+	VkSamplerYcbcrConversionCreateInfo conv = { VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO };
+	switch (par->color_space)
+	{
+	case AVCOL_SPC_BT709:
+		conv.ycbcrModel = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_709;
+		break;
+
+	case AVCOL_SPC_BT2020_NCL:
+	case AVCOL_SPC_BT2020_CL:
+		conv.ycbcrModel = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_2020;
+		break;
+
+	case AVCOL_SPC_BT470BG:
+	case AVCOL_SPC_SMPTE170M:
+		conv.ycbcrModel = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601;
+		break;
+
+	default:
+		// Untagged streams are assumed to follow the convention for their resolution.
+		conv.ycbcrModel = par->height > 576 ?
+		                  VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_709 :
+		                  VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601;
+		break;
+	}
+
+	conv.ycbcrRange = par->color_range == AVCOL_RANGE_JPEG ?
+	                  VK_SAMPLER_YCBCR_RANGE_ITU_FULL : VK_SAMPLER_YCBCR_RANGE_ITU_NARROW;
+	conv.chromaFilter = VK_FILTER_LINEAR;
+	conv.xChromaOffset = par->chroma_location == AVCHROMA_LOC_CENTER ||
+	                     par->chroma_location == AVCHROMA_LOC_TOP ||
+	                     par->chroma_location == AVCHROMA_LOC_BOTTOM ?
+	                     VK_CHROMA_LOCATION_MIDPOINT : VK_CHROMA_LOCATION_COSITED_EVEN;
+	conv.yChromaOffset = par->chroma_location == AVCHROMA_LOC_TOPLEFT ||
+	                     par->chroma_location == AVCHROMA_LOC_TOP ?
+	                     VK_CHROMA_LOCATION_COSITED_EVEN : VK_CHROMA_LOCATION_MIDPOINT;
+	conv.format = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+	conv.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	conv.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	conv.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	conv.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	conv.forceExplicitReconstruction = VK_FALSE;
+	ycbcr = device->request_immutable_ycbcr_conversion(conv);
+
+	Vulkan::SamplerCreateInfo samp = {};
+	samp.mag_filter = VK_FILTER_LINEAR;
+	samp.min_filter = VK_FILTER_LINEAR;
+	samp.mipmap_mode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samp.address_mode_u = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samp.address_mode_v = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samp.address_mode_w = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler = device->request_immutable_sampler(samp, ycbcr);
+
+	auto info = Vulkan::ImageCreateInfo::immutable_2d_image(width, height, VK_FORMAT_G8_B8R8_2PLANE_420_UNORM);
+	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	info.ycbcr_conversion = ycbcr;
+	image = device->create_image(info);
+	if (!image)
+	{
+		LOGE("Failed to create YCbCr image.\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool VideoDecoder::Impl::init(Vulkan::Device *device_, const char *path, const Options &options_)
+{
+	device = device_;
+	options = options_;
+
+	num_frames = options.queued_frames ? options.queued_frames : DefaultDecodeFrames;
+	num_frames = std::max(2u, std::min(num_frames, MaxDecodeFrames));
+
+	bool hardware = options.hardware;
+	const char *env = getenv("GRANITE_VIDEO_DECODER");
+	if (env)
+	{
+		if (strcmp(env, "software") == 0)
+			hardware = false;
+		else if (strcmp(env, "hardware") == 0)
+			hardware = true;
+		else
+			LOGW("Unknown video decoder \"%s\".\n", env);
+	}
+
+	int ret;
+	if ((ret = avformat_open_input(&av_format_ctx, path, nullptr, nullptr)) < 0)
+	{
+		LOGE("Failed to open input %s: %d\n", path, ret);
+		return false;
+	}
+
+	if ((ret = avformat_find_stream_info(av_format_ctx, nullptr)) < 0)
+	{
+		LOGE("Failed to find stream info: %d\n", ret);
+		return false;
+	}
+
+	int stream_index = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (stream_index < 0)
+	{
+		LOGE("No video stream in %s.\n", path);
+		return false;
+	}
+	av_stream = av_format_ctx->streams[stream_index];
+
+	if (!init_codec(hardware))
+		return false;
+
+	// 4:2:0 images must have even dimensions, the odd row and column are left undefined.
+	width = (unsigned(av_ctx->width) + 1) & ~1u;
+	height = (unsigned(av_ctx->height) + 1) & ~1u;
+	chroma_offset = (size_t(width) * height + 15) & ~size_t(15);
+
+	AVRational rate = av_guess_frame_rate(av_format_ctx, av_stream, nullptr);
+	frame_duration = rate.num ? av_q2d(av_inv_q(rate)) : (1.0 / 30.0);
+
+	if (!init_ycbcr())
+		return false;
+
+	Vulkan::BufferCreateInfo buf;
+	buf.size = chroma_offset + size_t(width) * (height / 2);
+	buf.domain = Vulkan::BufferDomain::Host;
+	buf.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	for (unsigned i = 0; i < num_frames; i++)
+		frames[i].buffer = device->create_buffer(buf);
+
+	av_frame = av_frame_alloc();
+	sw_frame = av_frame_alloc();
+	av_pkt = av_packet_alloc();
+	if (!av_frame || !sw_frame || !av_pkt)
+		return false;
+
+	return true;
+}
+
+bool VideoDecoder::Impl::play()
+{
+	if (thr.joinable())
+		return false;
+	thr = std::thread(&Impl::thread_main, this);
+	return true;
+}
+
+double VideoDecoder::Impl::compute_pts(const AVFrame *frame)
+{
+	if (frame->best_effort_timestamp == AV_NOPTS_VALUE)
+		return last_pts + frame_duration;
+
+	int64_t ts = frame->best_effort_timestamp;
+	if (av_stream->start_time != AV_NOPTS_VALUE)
+		ts -= av_stream->start_time;
+	return double(ts) * av_q2d(av_stream->time_base) + loop_offset;
+}
+
+bool VideoDecoder::Impl::copy_nv12(const AVFrame *frame, uint8_t *mapped)
+{
+	// Hardware decoders usually hand us NV12 already, anything else goes through swscale.
+	if (frame->format == AV_PIX_FMT_NV12)
+	{
+		av_image_copy_plane(mapped, int(width), frame->data[0], frame->linesize[0],
+		                    frame->width, frame->height);
+		av_image_copy_plane(mapped + chroma_offset, int(width), frame->data[1], frame->linesize[1],
+		                    2 * ((frame->width + 1) / 2), (frame->height + 1) / 2);
+		return true;
+	}
+
+	sws_ctx = sws_getCachedContext(sws_ctx, frame->width, frame->height, AVPixelFormat(frame->format),
+	                               frame->width, frame->height, AV_PIX_FMT_NV12,
+	                               SWS_POINT, nullptr, nullptr, nullptr);
+	if (!sws_ctx)
+	{
+		LOGE("Failed to create scaler for pixel format %d.\n", frame->format);
+		return false;
+	}
+
+	uint8_t *dst_slices[4] = { mapped, mapped + chroma_offset };
+	const int dst_linesizes[4] = { int(width), int(width) };
+	sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, dst_slices, dst_linesizes);
+	return true;
+}
+
+bool VideoDecoder::Impl::write_frame(AVFrame *frame)
+{
+	int ret;
+	const AVFrame *src = frame;
+	if (frame->format == hw_pix_fmt)
+	{
+		if ((ret = av_hwframe_transfer_data(sw_frame, frame, 0)) < 0)
+		{
+			LOGE("Failed to download decoded frame: %d\n", ret);
+			return false;
+		}
+		src = sw_frame;
+	}
+
+	Frame *slot;
+	{
+		std::unique_lock<std::mutex> holder{lock};
+		cond.wait(holder, [this]() {
+			return shutdown || write_count - read_count < num_frames;
+		});
+		if (shutdown)
+			return false;
+		slot = &frames[write_count % num_frames];
+	}
+
+	// The render thread may still be uploading from this buffer.
+	if (slot->fence)
+	{
+		slot->fence->wait();
+		slot->fence.reset();
+	}
+
+	auto *mapped = static_cast<uint8_t *>(device->map_host_buffer(*slot->buffer, Vulkan::MEMORY_ACCESS_WRITE_BIT));
+	bool ok = copy_nv12(src, mapped);
+	device->unmap_host_buffer(*slot->buffer, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+	av_frame_unref(sw_frame);
+	if (!ok)
+		return false;
+
+	last_pts = compute_pts(frame);
+	slot->pts = last_pts;
+
+	std::lock_guard<std::mutex> holder{lock};
+	write_count++;
+	return true;
+}
+
+bool VideoDecoder::Impl::decode_packet(const AVPacket *pkt)
+{
+	int ret = avcodec_send_packet(av_ctx, pkt);
+	if (ret < 0 && ret != AVERROR_EOF)
+	{
+		LOGE("Failed to send packet to decoder: %d\n", ret);
+		return false;
+	}
+
+	for (;;)
+	{
+		ret = avcodec_receive_frame(av_ctx, av_frame);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			return true;
+		if (ret < 0)
+		{
+			LOGE("Failed to receive frame from decoder: %d\n", ret);
+			return false;
+		}
+
+		bool ok = write_frame(av_frame);
+		av_frame_unref(av_frame);
+		if (!ok)
+			return false;
+	}
+}
+
+void VideoDecoder::Impl::thread_main()
+{
+	for (;;)
+	{
+		int ret = av_read_frame(av_format_ctx, av_pkt);
+		if (ret >= 0)
+		{
+			bool ok = true;
+			if (av_pkt->stream_index == av_stream->index)
+				ok = decode_packet(av_pkt);
+			av_packet_unref(av_pkt);
+			if (!ok)
+				break;
+			continue;
+		}
+
+		// Flush out the frames the decoder still holds on to.
+		if (!decode_packet(nullptr) || !options.loop)
+			break;
+
+		int64_t start = av_stream->start_time != AV_NOPTS_VALUE ? av_stream->start_time : 0;
+		if ((ret = av_seek_frame(av_format_ctx, av_stream->index, start, AVSEEK_FLAG_BACKWARD)) < 0)
+		{
+			LOGE("Failed to seek to start of stream: %d\n", ret);
+			break;
+		}
+
+		avcodec_flush_buffers(av_ctx);
+		loop_offset = last_pts + frame_duration;
+	}
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		eof = true;
+	}
+	cond.notify_all();
+}
+
+bool VideoDecoder::Impl::acquire_frame(double time)
+{
+	uint64_t index, count;
+	bool ended;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		index = read_count;
+		count = write_count;
+		ended = eof;
+	}
+
+	// If we fell behind, skip straight to the newest frame which is due.
+	uint64_t upload = UINT64_MAX;
+	while (index < count && frames[index % num_frames].pts <= time)
+		upload = index++;
+
+	if (upload == UINT64_MAX)
+		return !ended || index < count;
+
+	auto &frame = frames[upload % num_frames];
+	auto cmd = device->request_command_buffer();
+
+	// Every texel is overwritten, so the old contents can be discarded.
+	cmd->image_barrier(*image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	cmd->copy_buffer_to_image(*image, *frame.buffer, 0, {}, { width, height, 1 },
+	                          width, height, { VK_IMAGE_ASPECT_PLANE_0_BIT, 0, 0, 1 });
+	cmd->copy_buffer_to_image(*image, *frame.buffer, chroma_offset, {}, { width / 2, height / 2, 1 },
+	                          width / 2, height / 2, { VK_IMAGE_ASPECT_PLANE_1_BIT, 0, 0, 1 });
+	cmd->image_barrier(*image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                   VK_ACCESS_SHADER_READ_BIT);
+
+	Vulkan::Fence fence;
+	device->submit(cmd, &fence);
+
+	// Skipped frames are recycled along with the uploaded one, the decode thread waits for the fence.
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		frame.fence = std::move(fence);
+		read_count = upload + 1;
+	}
+	cond.notify_one();
+	return true;
+}
+
+VideoDecoder::VideoDecoder()
+{
+	impl.reset(new Impl);
+}
+
+VideoDecoder::~VideoDecoder()
+{
+}
+
+bool VideoDecoder::init(Vulkan::Device *device, const char *path, const Options &options)
+{
+	return impl->init(device, path, options);
+}
+
+unsigned VideoDecoder::get_width() const
+{
+	return impl->width;
+}
+
+unsigned VideoDecoder::get_height() const
+{
+	return impl->height;
+}
+
+bool VideoDecoder::play()
+{
+	return impl->play();
+}
+
+bool VideoDecoder::acquire_frame(double time)
+{
+	return impl->acquire_frame(time);
+}
+
+const Vulkan::ImageView *VideoDecoder::get_image_view() const
+{
+	return impl->image ? &impl->image->get_view() : nullptr;
+}
+
+const Vulkan::ImmutableSampler *VideoDecoder::get_sampler() const
+{
+	return impl->sampler;
+}
+}
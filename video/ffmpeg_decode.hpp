@@ -0,0 +1,68 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "image.hpp"
+#include "sampler.hpp"
+
+namespace Granite
+{
+class VideoDecoder
+{
+public:
+	VideoDecoder();
+	~VideoDecoder();
+
+	// GRANITE_VIDEO_DECODER=software|hardware overrides.
+	struct Options
+	{
+		// Tries the hardware decoders the codec supports before falling back to software.
+		bool hardware = true;
+		// Restarts from the beginning at end of stream.
+		bool loop = false;
+		// Decoded frames which can wait for upload. 0 picks a default.
+		unsigned queued_frames = 0;
+	};
+
+	bool init(Vulkan::Device *device, const char *path, const Options &options);
+	unsigned get_width() const;
+	unsigned get_height() const;
+
+	// Starts the decode thread.
+	bool play();
+
+	// Uploads the newest decoded frame which is due at time, in seconds of stream time.
+	// Never waits for the decoder. Returns false once the stream has ended and every frame was acquired.
+	bool acquire_frame(double time);
+
+	// Valid after the first acquired frame. The image has a YCbCr conversion,
+	// so get_sampler() must be used as an immutable sampler when sampling it.
+	const Vulkan::ImageView *get_image_view() const;
+	const Vulkan::ImmutableSampler *get_sampler() const;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
+}
@@ -469,7 +469,9 @@ struct PhysicsSandboxApplication : Application, EventHandler
 			}
 		}
 
-		GRANITE_PHYSICS()->iterate(frame_time);
+		// The step runs while this frame renders, nodes get the results of the previous step.
+		GRANITE_PHYSICS()->end_iterate();
+		GRANITE_PHYSICS()->begin_iterate(frame_time);
 
 		scene.update_all_transforms();
 
@@ -0,0 +1,388 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "async_uploader.hpp"
+#include "device.hpp"
+#include "format.hpp"
+#include <string.h>
+
+namespace Vulkan
+{
+AsyncUploader::AsyncUploader(Device *device_)
+	: device(device_)
+{
+}
+
+AsyncUploader::~AsyncUploader()
+{
+	for (auto &batch : in_flight)
+		batch.fence->wait();
+}
+
+bool AsyncUploader::init(const AsyncUploaderOptions &options_)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	if (!device->get_device_features().timeline_semaphore_features.timelineSemaphore)
+	{
+		LOGE("AsyncUploader requires timeline semaphores.\n");
+		return false;
+	}
+
+	options = options_;
+
+	BufferCreateInfo info;
+	info.domain = BufferDomain::Host;
+	info.size = options.staging_size;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	staging = device->create_buffer(info, nullptr);
+	if (!staging)
+		return false;
+
+	device->set_name(*staging, "async-uploader-staging");
+	staging_mapped = static_cast<uint8_t *>(device->map_host_buffer(*staging, MEMORY_ACCESS_WRITE_BIT));
+	head = 0;
+	tail = 0;
+	staging_live = false;
+	return staging_mapped != nullptr;
+}
+
+bool AsyncUploader::allocate_staging(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset)
+{
+	VkDeviceSize ring_size = options.staging_size;
+	if (!staging_mapped || size > ring_size)
+		return false;
+
+	if (!staging_live)
+	{
+		head = 0;
+		tail = 0;
+	}
+	else if (head == tail)
+		return false;
+
+	VkDeviceSize aligned_head = ((head + alignment - 1) / alignment) * alignment;
+
+	if (!staging_live || head > tail)
+	{
+		if (aligned_head + size <= ring_size)
+			offset = aligned_head;
+		else if (size <= tail)
+			offset = 0;
+		else
+			return false;
+	}
+	else if (aligned_head + size <= tail)
+		offset = aligned_head;
+	else
+		return false;
+
+	head = offset + size;
+	staging_live = true;
+	return true;
+}
+
+bool AsyncUploader::stage_request(Request &req, const void *data)
+{
+	if (req.size > options.staging_size)
+	{
+		BufferCreateInfo info;
+		info.domain = BufferDomain::Host;
+		info.size = req.size;
+		info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		req.dedicated = device->create_buffer(info, data);
+		if (!req.dedicated)
+			return false;
+
+		device->set_name(*req.dedicated, "async-uploader-dedicated-staging");
+		req.staging_offset = 0;
+		req.staged = true;
+		return true;
+	}
+
+	if (!allocate_staging(req.size, req.alignment, req.staging_offset))
+		return false;
+
+	memcpy(staging_mapped + req.staging_offset, data, req.size);
+	device->unmap_host_buffer(*staging, MEMORY_ACCESS_WRITE_BIT, req.staging_offset, req.size);
+	req.staged = true;
+	return true;
+}
+
+uint64_t AsyncUploader::queue_request(Request &req, const void *data)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (!staging)
+		return 0;
+
+	req.ticket = next_ticket++;
+
+	// Ring space is handed out in ticket order, so only stage right away if nothing is waiting for space.
+	bool can_stage = pending.empty() || pending.back().staged;
+	if (!can_stage || !stage_request(req, data))
+	{
+		auto *bytes = static_cast<const uint8_t *>(data);
+		req.data.assign(bytes, bytes + req.size);
+	}
+
+	pending_bytes += req.size;
+	pending.push_back(std::move(req));
+	return pending.back().ticket;
+}
+
+uint64_t AsyncUploader::upload_buffer(const BufferHandle &dst, VkDeviceSize offset, const void *data, VkDeviceSize size)
+{
+	if (!dst || size == 0 || offset + size > dst->get_create_info().size)
+		return 0;
+
+	Request req;
+	req.buffer = dst;
+	req.dst_offset = offset;
+	req.size = size;
+	req.alignment = std::max<VkDeviceSize>(16, device->get_gpu_properties().limits.optimalBufferCopyOffsetAlignment);
+	return queue_request(req, data);
+}
+
+uint64_t AsyncUploader::upload_image(const ImageHandle &dst, const VkImageSubresourceLayers &subresource,
+                                     const VkOffset3D &offset, const VkExtent3D &extent, const void *data,
+                                     VkImageLayout old_layout, VkImageLayout new_layout)
+{
+	if (!dst)
+		return 0;
+
+	VkFormat format = dst->get_format();
+	Request req;
+	req.image = dst;
+	req.subresource = subresource;
+	req.offset = offset;
+	req.extent = extent;
+	req.old_layout = old_layout;
+	req.new_layout = new_layout;
+	req.size = format_get_layer_size(format, subresource.aspectMask, extent.width, extent.height, extent.depth) *
+	           subresource.layerCount;
+	if (req.size == 0)
+		return 0;
+
+	// bufferOffset must be a multiple of the texel block size as well as 4.
+	VkDeviceSize base_alignment =
+			std::max<VkDeviceSize>(16, device->get_gpu_properties().limits.optimalBufferCopyOffsetAlignment);
+	VkDeviceSize block_size = TextureFormatLayout::format_block_size(format, subresource.aspectMask);
+	req.alignment = base_alignment;
+	while (req.alignment % block_size)
+		req.alignment += base_alignment;
+
+	return queue_request(req, data);
+}
+
+void AsyncUploader::record_request(CommandBuffer &cmd, const Request &req)
+{
+	auto &src = req.dedicated ? *req.dedicated : *staging;
+
+	if (req.buffer)
+	{
+		cmd.copy_buffer(*req.buffer, req.dst_offset, src, req.staging_offset, req.size);
+		return;
+	}
+
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.image = req.image->get_image();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = req.subresource.aspectMask;
+	barrier.subresourceRange.baseMipLevel = req.subresource.mipLevel;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = req.subresource.baseArrayLayer;
+	barrier.subresourceRange.layerCount = req.subresource.layerCount;
+
+	barrier.oldLayout = req.old_layout;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	cmd.image_barriers(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 1, &barrier);
+
+	cmd.copy_buffer_to_image(*req.image, src, req.staging_offset, req.offset, req.extent, 0, 0, req.subresource);
+
+	// Consumers synchronize with a semaphore, so no dstAccess is needed.
+	if (req.new_layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+	{
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = req.new_layout;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		cmd.image_barriers(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1, &barrier);
+	}
+}
+
+void AsyncUploader::submit_batch(CommandBufferHandle &cmd, uint64_t ticket, VkDeviceSize staging_end, bool uses_ring)
+{
+	cmd->end_region();
+
+	Batch batch = {};
+	batch.ticket = ticket;
+	batch.staging_end = staging_end;
+	batch.uses_ring = uses_ring;
+	device->submit(cmd, &batch.fence, 1, &batch.semaphore);
+	in_flight.push_back(std::move(batch));
+}
+
+void AsyncUploader::retire_locked()
+{
+	while (!in_flight.empty() && in_flight.front().fence->wait_timeout(0))
+	{
+		auto &batch = in_flight.front();
+		completed_ticket = batch.ticket;
+		if (batch.uses_ring)
+		{
+			tail = batch.staging_end;
+			if (tail == head)
+				staging_live = false;
+		}
+		in_flight.pop_front();
+	}
+}
+
+void AsyncUploader::flush_locked(uint64_t force_ticket)
+{
+	retire_locked();
+
+	CommandBufferHandle cmd;
+	uint64_t batch_ticket = 0;
+	VkDeviceSize batch_end = 0;
+	bool batch_uses_ring = false;
+
+	while (!pending.empty())
+	{
+		auto &req = pending.front();
+		bool forced = req.ticket <= force_ticket;
+
+		// Always let one upload through per frame, so uploads larger than the budget still make progress.
+		if (!forced && frame_bytes != 0 && frame_bytes + req.size > options.bytes_per_frame)
+			break;
+
+		if (!req.staged)
+		{
+			if (stage_request(req, req.data.data()))
+			{
+				req.data.clear();
+				req.data.shrink_to_fit();
+			}
+			else
+			{
+				// The ring is full. Submit what we have, and if we have to make progress, wait for the GPU.
+				if (cmd)
+				{
+					submit_batch(cmd, batch_ticket, batch_end, batch_uses_ring);
+					batch_uses_ring = false;
+				}
+
+				if (!forced || in_flight.empty())
+					break;
+
+				in_flight.front().fence->wait();
+				retire_locked();
+				continue;
+			}
+		}
+
+		if (!cmd)
+		{
+			cmd = device->request_command_buffer(CommandBuffer::Type::AsyncTransfer);
+			cmd->begin_region("async-upload");
+		}
+
+		record_request(*cmd, req);
+		frame_bytes += req.size;
+		pending_bytes -= req.size;
+		batch_ticket = req.ticket;
+		if (!req.dedicated)
+		{
+			batch_end = req.staging_offset + req.size;
+			batch_uses_ring = true;
+		}
+		pending.pop_front();
+	}
+
+	if (cmd)
+		submit_batch(cmd, batch_ticket, batch_end, batch_uses_ring);
+}
+
+void AsyncUploader::flush()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	flush_locked(0);
+}
+
+void AsyncUploader::begin_frame()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	frame_bytes = 0;
+	flush_locked(0);
+}
+
+void AsyncUploader::wait(uint64_t ticket, CommandBuffer::Type type, VkPipelineStageFlags stages)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	if (!pending.empty() && pending.front().ticket <= ticket)
+		flush_locked(ticket);
+	else
+		retire_locked();
+
+	if (ticket <= completed_ticket)
+		return;
+
+	for (auto &batch : in_flight)
+	{
+		if (batch.ticket >= ticket)
+		{
+			auto sem = device->request_timeline_semaphore_as_binary(*batch.semaphore,
+			                                                        batch.semaphore->get_timeline_value());
+			device->add_wait_semaphore(type, std::move(sem), stages, true);
+			return;
+		}
+	}
+}
+
+bool AsyncUploader::is_complete(uint64_t ticket)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	retire_locked();
+	return ticket <= completed_ticket;
+}
+
+uint64_t AsyncUploader::get_completed_ticket()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	retire_locked();
+	return completed_ticket;
+}
+
+AsyncUploaderStats AsyncUploader::get_stats()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	AsyncUploaderStats stats = {};
+	stats.bytes_this_frame = frame_bytes;
+	stats.bytes_pending = pending_bytes;
+	stats.num_pending = unsigned(pending.size());
+	stats.num_batches_in_flight = unsigned(in_flight.size());
+	return stats;
+}
+}
@@ -0,0 +1,147 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "command_buffer.hpp"
+#include "semaphore.hpp"
+#include "fence.hpp"
+#include <deque>
+#include <vector>
+#include <mutex>
+
+namespace Vulkan
+{
+class Device;
+
+struct AsyncUploaderOptions
+{
+	// Persistently mapped staging ring. Larger uploads get a dedicated staging buffer.
+	VkDeviceSize staging_size = 32 * 1024 * 1024;
+	// Uploads beyond this are deferred to later frames, unless something waits for them.
+	VkDeviceSize bytes_per_frame = 8 * 1024 * 1024;
+};
+
+struct AsyncUploaderStats
+{
+	VkDeviceSize bytes_this_frame;
+	VkDeviceSize bytes_pending;
+	unsigned num_pending;
+	unsigned num_batches_in_flight;
+};
+
+// Streams data to buffers and images through the async transfer queue.
+// Uploads are batched, and are only submitted in flush(), begin_frame() or wait().
+// Every upload returns a ticket on the uploader's own timeline, 0 on failure. Tickets complete in order.
+// Requires timeline semaphores. All functions are thread-safe.
+class AsyncUploader
+{
+public:
+	explicit AsyncUploader(Device *device);
+	~AsyncUploader();
+	void operator=(const AsyncUploader &) = delete;
+	AsyncUploader(const AsyncUploader &) = delete;
+
+	bool init(const AsyncUploaderOptions &options = {});
+
+	uint64_t upload_buffer(const BufferHandle &dst, VkDeviceSize offset, const void *data, VkDeviceSize size);
+
+	// data is tightly packed. On devices with a dedicated transfer queue family, the image must be created with
+	// IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT along with the queues which consume it.
+	uint64_t upload_image(const ImageHandle &dst, const VkImageSubresourceLayers &subresource,
+	                      const VkOffset3D &offset, const VkExtent3D &extent, const void *data,
+	                      VkImageLayout old_layout, VkImageLayout new_layout);
+
+	// Submits queued uploads within the frame budget as one batch.
+	void flush();
+
+	// Resets the frame budget, then flushes. Call once per frame.
+	void begin_frame();
+
+	// Makes later submissions to type wait for the ticket.
+	// Uploads up to and including the ticket are submitted right away, ignoring the frame budget.
+	void wait(uint64_t ticket, CommandBuffer::Type type, VkPipelineStageFlags stages);
+
+	bool is_complete(uint64_t ticket);
+	uint64_t get_completed_ticket();
+	AsyncUploaderStats get_stats();
+
+private:
+	Device *device;
+	AsyncUploaderOptions options;
+
+	struct Request
+	{
+		uint64_t ticket = 0;
+		BufferHandle buffer;
+		ImageHandle image;
+		VkDeviceSize dst_offset = 0;
+		VkImageSubresourceLayers subresource = {};
+		VkOffset3D offset = {};
+		VkExtent3D extent = {};
+		VkImageLayout old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout new_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkDeviceSize size = 0;
+		VkDeviceSize alignment = 0;
+
+		// Lives in the ring unless dedicated is set.
+		BufferHandle dedicated;
+		VkDeviceSize staging_offset = 0;
+		bool staged = false;
+
+		// Holds the data until the ring has room for it.
+		std::vector<uint8_t> data;
+	};
+
+	struct Batch
+	{
+		uint64_t ticket;
+		VkDeviceSize staging_end;
+		bool uses_ring;
+		Fence fence;
+		Semaphore semaphore;
+	};
+
+	std::mutex lock;
+	std::deque<Request> pending;
+	std::deque<Batch> in_flight;
+
+	BufferHandle staging;
+	uint8_t *staging_mapped = nullptr;
+	VkDeviceSize head = 0;
+	VkDeviceSize tail = 0;
+	bool staging_live = false;
+
+	uint64_t next_ticket = 1;
+	uint64_t completed_ticket = 0;
+	VkDeviceSize frame_bytes = 0;
+	VkDeviceSize pending_bytes = 0;
+
+	uint64_t queue_request(Request &req, const void *data);
+	bool allocate_staging(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+	bool stage_request(Request &req, const void *data);
+	void record_request(CommandBuffer &cmd, const Request &req);
+	void submit_batch(CommandBufferHandle &cmd, uint64_t ticket, VkDeviceSize staging_end, bool uses_ring);
+	void flush_locked(uint64_t force_ticket);
+	void retire_locked();
+};
+}
@@ -32,10 +32,34 @@ Buffer::Buffer(Device *device_, VkBuffer buffer_, const DeviceAllocation &alloc_
     , alloc(alloc_)
     , info(info_)
 {
+	update_device_address();
+}
+
+void Buffer::update_device_address()
+{
+	if (info.usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+	{
+		VkBufferDeviceAddressInfo address_info = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+		address_info.buffer = buffer;
+		bda = device->get_device_table().vkGetBufferDeviceAddressKHR(device->get_device(), &address_info);
+	}
+}
+
+void Buffer::replace_backing(VkBuffer buffer_, const DeviceAllocation &alloc_)
+{
+	buffer = buffer_;
+	alloc = alloc_;
+	update_device_address();
+	reallocate_cookie(device);
 }
 
 Buffer::~Buffer()
 {
+	if (info.misc & BUFFER_MISC_MOVABLE_BIT)
+		device->unregister_movable_buffer(this);
+	if (info.domain == BufferDomain::LinkedDeviceHostReBAR)
+		device->release_resizable_bar(info.size);
+
 	if (internal_sync)
 	{
 		device->destroy_buffer_nolock(buffer);
@@ -73,6 +73,7 @@ enum class BufferDomain
 	Device, // Device local. Probably not visible from CPU.
 	LinkedDeviceHost, // On desktop, directly mapped VRAM over PCI.
 	LinkedDeviceHostPreferDevice, // Prefer device local of host visible.
+	LinkedDeviceHostReBAR, // Host visible VRAM for direct CPU writes when resizable BAR is available, within the ReBAR budget. Falls back to Device.
 	Host, // Host-only, needs to be synced to GPU. Might be device local as well on iGPUs.
 	CachedHost,
 	CachedCoherentHostPreferCoherent, // Aim for both cached and coherent, but prefer COHERENT
@@ -81,7 +82,12 @@ enum class BufferDomain
 
 enum BufferMiscFlagBits
 {
-	BUFFER_MISC_ZERO_INITIALIZE_BIT = 1 << 0
+	BUFFER_MISC_ZERO_INITIALIZE_BIT = 1 << 0,
+	// Allows Device::defragment_memory() to move the buffer to different memory.
+	// The Buffer object stays valid, but its VkBuffer, allocation, device address and cookie may change
+	// between frames. Only honored for BufferDomain::Device. The buffer must not be written by the GPU
+	// after its initial upload, and must not have BufferViews.
+	BUFFER_MISC_MOVABLE_BIT = 1 << 1
 };
 
 using BufferMiscFlags = uint32_t;
@@ -92,6 +98,7 @@ struct BufferCreateInfo
 	VkDeviceSize size = 0;
 	VkBufferUsageFlags usage = 0;
 	BufferMiscFlags misc = 0;
+	AllocationTag tag = AllocationTag::Untagged;
 };
 
 class Buffer;
@@ -133,14 +140,24 @@ public:
 		return alloc;
 	}
 
+	// Non-zero when the device supports buffer device address.
+	VkDeviceAddress get_device_address() const
+	{
+		return bda;
+	}
+
 private:
 	friend class Util::ObjectPool<Buffer>;
+	friend class Device;
 	Buffer(Device *device, VkBuffer buffer, const DeviceAllocation &alloc, const BufferCreateInfo &info);
+	void replace_backing(VkBuffer buffer, const DeviceAllocation &alloc);
+	void update_device_address();
 
 	Device *device;
 	VkBuffer buffer;
 	DeviceAllocation alloc;
 	BufferCreateInfo info;
+	VkDeviceAddress bda = 0;
 };
 using BufferHandle = Util::IntrusivePtr<Buffer>;
 
@@ -58,13 +58,19 @@ void BufferPool::reset()
 	blocks.clear();
 }
 
+static BufferDomain get_ideal_domain(VkBufferUsageFlags usage, bool need_device_local)
+{
+	// With resizable BAR, device local blocks can be written directly, otherwise they are synced with DMA.
+	return need_device_local ?
+	       BufferDomain::LinkedDeviceHostReBAR :
+	       ((usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) != 0) ? BufferDomain::Host : BufferDomain::LinkedDeviceHost;
+}
+
 BufferBlock BufferPool::allocate_block(VkDeviceSize size)
 {
-	BufferDomain ideal_domain = need_device_local ?
-	                            BufferDomain::Device :
-	                            ((usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) != 0) ? BufferDomain::Host : BufferDomain::LinkedDeviceHost;
+	BufferDomain ideal_domain = get_ideal_domain(usage, need_device_local);
 
-	VkBufferUsageFlags extra_usage = ideal_domain == BufferDomain::Device ? VK_BUFFER_USAGE_TRANSFER_DST_BIT : 0;
+	VkBufferUsageFlags extra_usage = ideal_domain == BufferDomain::LinkedDeviceHostReBAR ? VK_BUFFER_USAGE_TRANSFER_DST_BIT : 0;
 
 	BufferBlock block;
 
@@ -72,6 +78,7 @@ BufferBlock BufferPool::allocate_block(VkDeviceSize size)
 	info.domain = ideal_domain;
 	info.size = size;
 	info.usage = usage | extra_usage;
+	info.tag = AllocationTag::BufferPool;
 
 	block.gpu = device->create_buffer(info, nullptr);
 	device->set_name(*block.gpu, "chain-allocated-block-gpu");
@@ -86,6 +93,7 @@ BufferBlock BufferPool::allocate_block(VkDeviceSize size)
 		cpu_info.domain = BufferDomain::Host;
 		cpu_info.size = size;
 		cpu_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		cpu_info.tag = AllocationTag::BufferPool;
 
 		block.cpu = device->create_buffer(cpu_info, nullptr);
 		block.cpu->set_internal_sync_object();
@@ -129,9 +137,111 @@ void BufferPool::recycle_block(BufferBlock &block)
 		block = {};
 }
 
+bool BufferPool::init_ring(unsigned num_frame_contexts, VkDeviceSize ring_size_)
+{
+	deinit_ring();
+	if (ring_size_ == 0)
+		return true;
+
+	ring_size = (ring_size_ + alignment - 1) & ~(alignment - 1);
+
+	BufferCreateInfo info;
+	info.domain = get_ideal_domain(usage, need_device_local);
+	// Pad with the spill region so padded ranges at the end of the ring stay in bounds.
+	info.size = ring_size + spill_size;
+	info.usage = usage;
+	info.tag = AllocationTag::BufferPool;
+
+	auto &mem_props = device->get_memory_properties();
+
+	for (unsigned i = 0; i < num_frame_contexts; i++)
+	{
+		std::unique_ptr<Ring> ring(new Ring);
+		ring->buffer = device->create_buffer(info, nullptr);
+		if (!ring->buffer)
+			break;
+
+		device->set_name(*ring->buffer, "ring-buffer");
+		ring->buffer->set_internal_sync_object();
+
+		// The ring is never unmapped, so we rely on coherent memory rather than flushing on every submit.
+		uint32_t memory_type = ring->buffer->get_allocation().get_memory_type();
+		if ((mem_props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+			break;
+
+		ring->mapped = static_cast<uint8_t *>(device->map_host_buffer(*ring->buffer, MEMORY_ACCESS_WRITE_BIT));
+		if (!ring->mapped)
+			break;
+
+		ring->offset.store(0, std::memory_order_relaxed);
+		rings.push_back(std::move(ring));
+	}
+
+	if (rings.size() != num_frame_contexts)
+	{
+		LOGW("Ring buffer mode requires host-coherent memory for this pool, falling back to blocks.\n");
+		deinit_ring();
+		return false;
+	}
+
+	return true;
+}
+
+void BufferPool::deinit_ring()
+{
+	rings.clear();
+	ring_size = 0;
+	ring_high_water_mark = 0;
+	ring_last_frame_usage = 0;
+	ring_overflow_count.store(0, std::memory_order_relaxed);
+}
+
+bool BufferPool::allocate_ring(unsigned frame_index, VkDeviceSize size, BufferRingAllocation &alloc)
+{
+	if (frame_index >= rings.size())
+		return false;
+
+	auto &ring = *rings[frame_index];
+	VkDeviceSize aligned_size = (size + alignment - 1) & ~(alignment - 1);
+	VkDeviceSize offset = ring.offset.fetch_add(aligned_size, std::memory_order_relaxed);
+
+	if (offset + size > ring_size)
+	{
+		ring_overflow_count.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	alloc.buffer = ring.buffer.get();
+	alloc.host = ring.mapped + offset;
+	alloc.offset = offset;
+	alloc.padded_size = max(size, spill_size);
+	return true;
+}
+
+void BufferPool::begin_ring(unsigned frame_index)
+{
+	if (frame_index >= rings.size())
+		return;
+
+	auto &ring = *rings[frame_index];
+	ring_last_frame_usage = ring.offset.exchange(0, std::memory_order_relaxed);
+	ring_high_water_mark = max(ring_high_water_mark, ring_last_frame_usage);
+}
+
+BufferPoolRingStats BufferPool::get_ring_stats() const
+{
+	BufferPoolRingStats stats;
+	stats.size = ring_size;
+	stats.high_water_mark = ring_high_water_mark;
+	stats.last_frame_usage = ring_last_frame_usage;
+	stats.overflow_count = ring_overflow_count.load(std::memory_order_relaxed);
+	return stats;
+}
+
 BufferPool::~BufferPool()
 {
 	VK_ASSERT(blocks.empty());
+	VK_ASSERT(rings.empty());
 }
 
 }
@@ -26,6 +26,8 @@
 #include "intrusive.hpp"
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <memory>
 
 namespace Vulkan
 {
@@ -68,6 +70,24 @@ struct BufferBlock
 	}
 };
 
+struct BufferRingAllocation
+{
+	const Buffer *buffer;
+	uint8_t *host;
+	VkDeviceSize offset;
+	VkDeviceSize padded_size;
+};
+
+struct BufferPoolRingStats
+{
+	VkDeviceSize size = 0;
+	// Peak number of bytes requested from a single frame context.
+	// Includes requests which overflowed, so it can be used directly to size the ring.
+	VkDeviceSize high_water_mark = 0;
+	VkDeviceSize last_frame_usage = 0;
+	uint64_t overflow_count = 0;
+};
+
 class BufferPool
 {
 public:
@@ -88,6 +108,21 @@ public:
 	BufferBlock request_block(VkDeviceSize minimum_size);
 	void recycle_block(BufferBlock &block);
 
+	// Ring mode: one persistently mapped buffer per frame context.
+	// allocate_ring() is a single atomic bump and is safe to call from any thread.
+	// If the ring is exhausted (or not enabled), it returns false and regular blocks must be used.
+	bool init_ring(unsigned num_frame_contexts, VkDeviceSize ring_size);
+	void deinit_ring();
+	bool allocate_ring(unsigned frame_index, VkDeviceSize size, BufferRingAllocation &alloc);
+	// Called when the GPU is done with the frame context.
+	void begin_ring(unsigned frame_index);
+	BufferPoolRingStats get_ring_stats() const;
+
+	VkDeviceSize get_ring_size() const
+	{
+		return ring_size;
+	}
+
 private:
 	Device *device = nullptr;
 	VkDeviceSize block_size = 0;
@@ -98,5 +133,17 @@ private:
 	std::vector<BufferBlock> blocks;
 	BufferBlock allocate_block(VkDeviceSize size);
 	bool need_device_local = false;
+
+	struct Ring
+	{
+		Util::IntrusivePtr<Buffer> buffer;
+		uint8_t *mapped = nullptr;
+		std::atomic<VkDeviceSize> offset;
+	};
+	std::vector<std::unique_ptr<Ring>> rings;
+	VkDeviceSize ring_size = 0;
+	VkDeviceSize ring_high_water_mark = 0;
+	VkDeviceSize ring_last_frame_usage = 0;
+	std::atomic<uint64_t> ring_overflow_count{0};
 };
 }
\ No newline at end of file
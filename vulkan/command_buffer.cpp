@@ -65,7 +65,9 @@ CommandBuffer::~CommandBuffer()
 	VK_ASSERT(vbo_block.mapped == nullptr);
 	VK_ASSERT(ibo_block.mapped == nullptr);
 	VK_ASSERT(ubo_block.mapped == nullptr);
+	VK_ASSERT(ssbo_block.mapped == nullptr);
 	VK_ASSERT(staging_block.mapped == nullptr);
+	VK_ASSERT(descriptor_block.mapped == nullptr);
 }
 
 void CommandBuffer::fill_buffer(const Buffer &dst, uint32_t value)
@@ -75,6 +77,7 @@ void CommandBuffer::fill_buffer(const Buffer &dst, uint32_t value)
 
 void CommandBuffer::fill_buffer(const Buffer &dst, uint32_t value, VkDeviceSize offset, VkDeviceSize size)
 {
+	flush_barriers();
 	table.vkCmdFillBuffer(cmd, dst.get_buffer(), offset, size, value);
 }
 
@@ -84,6 +87,7 @@ void CommandBuffer::copy_buffer(const Buffer &dst, VkDeviceSize dst_offset, cons
 	const VkBufferCopy region = {
 		src_offset, dst_offset, size,
 	};
+	flush_barriers();
 	table.vkCmdCopyBuffer(cmd, src.get_buffer(), dst.get_buffer(), 1, &region);
 }
 
@@ -95,6 +99,7 @@ void CommandBuffer::copy_buffer(const Buffer &dst, const Buffer &src)
 
 void CommandBuffer::copy_buffer(const Buffer &dst, const Buffer &src, const VkBufferCopy *copies, size_t count)
 {
+	flush_barriers();
 	table.vkCmdCopyBuffer(cmd, src.get_buffer(), dst.get_buffer(), count, copies);
 }
 
@@ -110,6 +115,7 @@ void CommandBuffer::copy_image(const Vulkan::Image &dst, const Vulkan::Image &sr
 	region.srcSubresource = src_subresource;
 	region.dstSubresource = dst_subresource;
 
+	flush_barriers();
 	table.vkCmdCopyImage(cmd, src.get_image(), src.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	               dst.get_image(), dst.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	               1, &region);
@@ -143,6 +149,7 @@ void CommandBuffer::copy_image(const Image &dst, const Image &src)
 		VK_ASSERT(region.srcSubresource.aspectMask == region.dstSubresource.aspectMask);
 	}
 
+	flush_barriers();
 	table.vkCmdCopyImage(cmd, src.get_image(), src.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                     dst.get_image(), dst.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	                     levels, regions);
@@ -151,6 +158,7 @@ void CommandBuffer::copy_image(const Image &dst, const Image &src)
 void CommandBuffer::copy_buffer_to_image(const Image &image, const Buffer &buffer, unsigned num_blits,
                                          const VkBufferImageCopy *blits)
 {
+	flush_barriers();
 	table.vkCmdCopyBufferToImage(cmd, buffer.get_buffer(),
 	                             image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL), num_blits, blits);
 }
@@ -158,6 +166,7 @@ void CommandBuffer::copy_buffer_to_image(const Image &image, const Buffer &buffe
 void CommandBuffer::copy_image_to_buffer(const Buffer &buffer, const Image &image, unsigned num_blits,
                                          const VkBufferImageCopy *blits)
 {
+	flush_barriers();
 	table.vkCmdCopyImageToBuffer(cmd, image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                             buffer.get_buffer(), num_blits, blits);
 }
@@ -171,6 +180,7 @@ void CommandBuffer::copy_buffer_to_image(const Image &image, const Buffer &src,
 		row_length, slice_height,
 		subresource, offset, extent,
 	};
+	flush_barriers();
 	table.vkCmdCopyBufferToImage(cmd, src.get_buffer(), image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	                             1, &region);
 }
@@ -184,6 +194,7 @@ void CommandBuffer::copy_image_to_buffer(const Buffer &buffer, const Image &imag
 		row_length, slice_height,
 		subresource, offset, extent,
 	};
+	flush_barriers();
 	table.vkCmdCopyImageToBuffer(cmd, image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                             buffer.get_buffer(), 1, &region);
 }
@@ -199,6 +210,8 @@ void CommandBuffer::clear_image(const Image &image, const VkClearValue &value, V
 	VK_ASSERT(!framebuffer);
 	VK_ASSERT(!actual_render_pass);
 
+	flush_barriers();
+
 	VkImageSubresourceRange range = {};
 	range.aspectMask = aspect;
 	range.baseArrayLayer = 0;
@@ -220,7 +233,6 @@ void CommandBuffer::clear_image(const Image &image, const VkClearValue &value, V
 void CommandBuffer::clear_quad(unsigned attachment, const VkClearRect &rect, const VkClearValue &value,
                                VkImageAspectFlags aspect)
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
 	VkClearAttachment att = {};
 	att.clearValue = value;
@@ -231,7 +243,6 @@ void CommandBuffer::clear_quad(unsigned attachment, const VkClearRect &rect, con
 
 void CommandBuffer::clear_quad(const VkClearRect &rect, const VkClearAttachment *attachments, unsigned num_attachments)
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
 	table.vkCmdClearAttachments(cmd, num_attachments, attachments, 1, &rect);
 }
@@ -260,66 +271,338 @@ void CommandBuffer::pixel_barrier()
 	                           VK_DEPENDENCY_BY_REGION_BIT, 1, &barrier, 0, nullptr, 0, nullptr);
 }
 
-static inline void fixup_src_stage(VkPipelineStageFlags &src_stages, bool fixup)
+static inline void fixup_src_stage(VkPipelineStageFlags2KHR &src_stages, bool fixup)
 {
 	// ALL_GRAPHICS_BIT waits for vertex as well which causes performance issues on some drivers.
 	// It shouldn't matter, but hey.
 	//
 	// We aren't using vertex with side-effects on relevant hardware so dropping VERTEX_SHADER_BIT is fine.
-	if ((src_stages & VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT) != 0 && fixup)
+	if ((src_stages & VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR) != 0 && fixup)
+	{
+		src_stages &= ~VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR;
+		src_stages |= VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR |
+		              VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR |
+		              VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+	}
+}
+
+// A source scope implicitly includes logically earlier stages.
+// Expand it so we can tell if a new barrier has to chain with the barriers already batched.
+static VkPipelineStageFlags2KHR expand_src_stages(VkPipelineStageFlags2KHR stages)
+{
+	static const VkPipelineStageFlags2KHR graphics_order[] = {
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR,
+		VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR,
+		VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR,
+		VK_PIPELINE_STAGE_2_TESSELLATION_CONTROL_SHADER_BIT_KHR,
+		VK_PIPELINE_STAGE_2_TESSELLATION_EVALUATION_SHADER_BIT_KHR,
+		VK_PIPELINE_STAGE_2_GEOMETRY_SHADER_BIT_KHR,
+		VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR,
+		VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+		VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+		VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+	};
+
+	// Meta stages and anything only sync2 knows about, just assume the worst.
+	if ((stages >> 32) != 0 ||
+	    (stages & (VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR |
+	               VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR |
+	               VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT_KHR)) != 0)
+	{
+		return ~VkPipelineStageFlags2KHR(0);
+	}
+
+	VkPipelineStageFlags2KHR expanded = stages;
+	VkPipelineStageFlags2KHR earlier = 0;
+	for (auto stage : graphics_order)
 	{
-		src_stages &= ~VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT;
-		src_stages |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-		              VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
-		              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		earlier |= stage;
+		if (stages & stage)
+			expanded |= earlier;
 	}
+
+	if (stages & VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR)
+		expanded |= VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR;
+	return expanded;
+}
+
+static VkPipelineStageFlags2KHR expand_dst_stages(VkPipelineStageFlags2KHR stages)
+{
+	if ((stages >> 32) != 0 ||
+	    (stages & (VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR | VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR)) != 0)
+	{
+		return ~VkPipelineStageFlags2KHR(0);
+	}
+	return stages;
+}
+
+static VkPipelineStageFlags to_legacy_stages(VkPipelineStageFlags2KHR stages)
+{
+	return (stages >> 32) != 0 ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VkPipelineStageFlags(stages);
+}
+
+static VkAccessFlags to_legacy_access(VkAccessFlags2KHR access)
+{
+	return (access >> 32) != 0 ? (VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT) : VkAccessFlags(access);
 }
 
 void CommandBuffer::barrier(VkPipelineStageFlags src_stages, VkAccessFlags src_access, VkPipelineStageFlags dst_stages,
                             VkAccessFlags dst_access)
 {
-	VK_ASSERT(!actual_render_pass);
-	VK_ASSERT(!framebuffer);
 	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
 	barrier.srcAccessMask = src_access;
 	barrier.dstAccessMask = dst_access;
-	fixup_src_stage(src_stages, device->get_workarounds().optimize_all_graphics_barrier);
-	table.vkCmdPipelineBarrier(cmd, src_stages, dst_stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	this->barrier(src_stages, dst_stages, 1, &barrier, 0, nullptr, 0, nullptr);
 }
 
 void CommandBuffer::barrier(VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages, unsigned barriers,
                             const VkMemoryBarrier *globals, unsigned buffer_barriers,
                             const VkBufferMemoryBarrier *buffers, unsigned image_barriers,
                             const VkImageMemoryBarrier *images)
+{
+	Util::SmallVector<VkMemoryBarrier2KHR> memory2;
+	Util::SmallVector<VkBufferMemoryBarrier2KHR> buffers2;
+	Util::SmallVector<VkImageMemoryBarrier2KHR, 16> images2;
+
+	// A barrier without any memory barriers is still an execution dependency.
+	if (!barriers && !buffer_barriers && !image_barriers)
+	{
+		VkMemoryBarrier2KHR b = { VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR };
+		b.srcStageMask = src_stages;
+		b.dstStageMask = dst_stages;
+		memory2.push_back(b);
+	}
+
+	for (unsigned i = 0; i < barriers; i++)
+	{
+		VkMemoryBarrier2KHR b = { VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR };
+		b.srcStageMask = src_stages;
+		b.srcAccessMask = globals[i].srcAccessMask;
+		b.dstStageMask = dst_stages;
+		b.dstAccessMask = globals[i].dstAccessMask;
+		memory2.push_back(b);
+	}
+
+	for (unsigned i = 0; i < buffer_barriers; i++)
+	{
+		VkBufferMemoryBarrier2KHR b = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR };
+		b.srcStageMask = src_stages;
+		b.srcAccessMask = buffers[i].srcAccessMask;
+		b.dstStageMask = dst_stages;
+		b.dstAccessMask = buffers[i].dstAccessMask;
+		b.srcQueueFamilyIndex = buffers[i].srcQueueFamilyIndex;
+		b.dstQueueFamilyIndex = buffers[i].dstQueueFamilyIndex;
+		b.buffer = buffers[i].buffer;
+		b.offset = buffers[i].offset;
+		b.size = buffers[i].size;
+		buffers2.push_back(b);
+	}
+
+	for (unsigned i = 0; i < image_barriers; i++)
+	{
+		VkImageMemoryBarrier2KHR b = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR };
+		b.srcStageMask = src_stages;
+		b.srcAccessMask = images[i].srcAccessMask;
+		b.dstStageMask = dst_stages;
+		b.dstAccessMask = images[i].dstAccessMask;
+		b.oldLayout = images[i].oldLayout;
+		b.newLayout = images[i].newLayout;
+		b.srcQueueFamilyIndex = images[i].srcQueueFamilyIndex;
+		b.dstQueueFamilyIndex = images[i].dstQueueFamilyIndex;
+		b.image = images[i].image;
+		b.subresourceRange = images[i].subresourceRange;
+		images2.push_back(b);
+	}
+
+	VkDependencyInfoKHR dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR };
+	dep.memoryBarrierCount = uint32_t(memory2.size());
+	dep.pMemoryBarriers = memory2.data();
+	dep.bufferMemoryBarrierCount = uint32_t(buffers2.size());
+	dep.pBufferMemoryBarriers = buffers2.data();
+	dep.imageMemoryBarrierCount = uint32_t(images2.size());
+	dep.pImageMemoryBarriers = images2.data();
+	barrier(dep);
+}
+
+bool CommandBuffer::barrier_batch_has_image(VkImage image) const
+{
+	for (auto &b : pending_barriers.images)
+		if (b.image == image)
+			return true;
+	return false;
+}
+
+void CommandBuffer::barrier(const VkDependencyInfoKHR &dep)
 {
 	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(!framebuffer);
-	fixup_src_stage(src_stages, device->get_workarounds().optimize_all_graphics_barrier);
-	table.vkCmdPipelineBarrier(cmd, src_stages, dst_stages, 0, barriers, globals, buffer_barriers, buffers, image_barriers, images);
+
+	bool fixup = device->get_workarounds().optimize_all_graphics_barrier;
+	VkPipelineStageFlags2KHR src_stages = 0;
+	VkPipelineStageFlags2KHR dst_stages = 0;
+	bool touches_batched_image = false;
+
+	for (uint32_t i = 0; i < dep.memoryBarrierCount; i++)
+	{
+		src_stages |= dep.pMemoryBarriers[i].srcStageMask;
+		dst_stages |= dep.pMemoryBarriers[i].dstStageMask;
+	}
+
+	for (uint32_t i = 0; i < dep.bufferMemoryBarrierCount; i++)
+	{
+		src_stages |= dep.pBufferMemoryBarriers[i].srcStageMask;
+		dst_stages |= dep.pBufferMemoryBarriers[i].dstStageMask;
+	}
+
+	for (uint32_t i = 0; i < dep.imageMemoryBarrierCount; i++)
+	{
+		src_stages |= dep.pImageMemoryBarriers[i].srcStageMask;
+		dst_stages |= dep.pImageMemoryBarriers[i].dstStageMask;
+		if (barrier_batch_has_image(dep.pImageMemoryBarriers[i].image))
+			touches_batched_image = true;
+	}
+
+	// Barriers within one batch are unordered, so if this barrier has to chain with a batched one,
+	// or transitions an image again, the batch has to be flushed first.
+	if (barriers_pending &&
+	    (touches_batched_image ||
+	     dep.dependencyFlags != pending_barriers.dependency_flags ||
+	     (expand_src_stages(src_stages) & pending_barriers.dst_stages) != 0))
+	{
+		flush_barrier_batch();
+	}
+
+	for (uint32_t i = 0; i < dep.memoryBarrierCount; i++)
+	{
+		pending_barriers.memory.push_back(dep.pMemoryBarriers[i]);
+		fixup_src_stage(pending_barriers.memory.back().srcStageMask, fixup);
+	}
+
+	for (uint32_t i = 0; i < dep.bufferMemoryBarrierCount; i++)
+	{
+		pending_barriers.buffers.push_back(dep.pBufferMemoryBarriers[i]);
+		fixup_src_stage(pending_barriers.buffers.back().srcStageMask, fixup);
+	}
+
+	for (uint32_t i = 0; i < dep.imageMemoryBarrierCount; i++)
+	{
+		pending_barriers.images.push_back(dep.pImageMemoryBarriers[i]);
+		fixup_src_stage(pending_barriers.images.back().srcStageMask, fixup);
+	}
+
+	pending_barriers.dst_stages |= expand_dst_stages(dst_stages);
+	pending_barriers.dependency_flags = dep.dependencyFlags;
+	barriers_pending = true;
+}
+
+void CommandBuffer::flush_barrier_batch()
+{
+	auto &batch = pending_barriers;
+
+	if (device->get_device_features().sync2_features.synchronization2)
+	{
+		VkDependencyInfoKHR dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR };
+		dep.dependencyFlags = batch.dependency_flags;
+		dep.memoryBarrierCount = uint32_t(batch.memory.size());
+		dep.pMemoryBarriers = batch.memory.data();
+		dep.bufferMemoryBarrierCount = uint32_t(batch.buffers.size());
+		dep.pBufferMemoryBarriers = batch.buffers.data();
+		dep.imageMemoryBarrierCount = uint32_t(batch.images.size());
+		dep.pImageMemoryBarriers = batch.images.data();
+		table.vkCmdPipelineBarrier2KHR(cmd, &dep);
+	}
+	else
+	{
+		// Without synchronization2 the stage masks are merged. This is still correct, just not as tight.
+		VkPipelineStageFlags src_stages = 0;
+		VkPipelineStageFlags dst_stages = 0;
+		Util::SmallVector<VkMemoryBarrier> memory;
+		Util::SmallVector<VkBufferMemoryBarrier> buffers;
+		Util::SmallVector<VkImageMemoryBarrier, 16> images;
+
+		for (auto &b : batch.memory)
+		{
+			src_stages |= to_legacy_stages(b.srcStageMask);
+			dst_stages |= to_legacy_stages(b.dstStageMask);
+			if (b.srcAccessMask == 0 && b.dstAccessMask == 0)
+				continue;
+
+			VkMemoryBarrier legacy = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			legacy.srcAccessMask = to_legacy_access(b.srcAccessMask);
+			legacy.dstAccessMask = to_legacy_access(b.dstAccessMask);
+			memory.push_back(legacy);
+		}
+
+		for (auto &b : batch.buffers)
+		{
+			src_stages |= to_legacy_stages(b.srcStageMask);
+			dst_stages |= to_legacy_stages(b.dstStageMask);
+
+			VkBufferMemoryBarrier legacy = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+			legacy.srcAccessMask = to_legacy_access(b.srcAccessMask);
+			legacy.dstAccessMask = to_legacy_access(b.dstAccessMask);
+			legacy.srcQueueFamilyIndex = b.srcQueueFamilyIndex;
+			legacy.dstQueueFamilyIndex = b.dstQueueFamilyIndex;
+			legacy.buffer = b.buffer;
+			legacy.offset = b.offset;
+			legacy.size = b.size;
+			buffers.push_back(legacy);
+		}
+
+		for (auto &b : batch.images)
+		{
+			src_stages |= to_legacy_stages(b.srcStageMask);
+			dst_stages |= to_legacy_stages(b.dstStageMask);
+
+			VkImageMemoryBarrier legacy = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+			legacy.srcAccessMask = to_legacy_access(b.srcAccessMask);
+			legacy.dstAccessMask = to_legacy_access(b.dstAccessMask);
+			legacy.oldLayout = b.oldLayout;
+			legacy.newLayout = b.newLayout;
+			legacy.srcQueueFamilyIndex = b.srcQueueFamilyIndex;
+			legacy.dstQueueFamilyIndex = b.dstQueueFamilyIndex;
+			legacy.image = b.image;
+			legacy.subresourceRange = b.subresourceRange;
+			images.push_back(legacy);
+		}
+
+		if (!src_stages)
+			src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		if (!dst_stages)
+			dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+		table.vkCmdPipelineBarrier(cmd, src_stages, dst_stages, batch.dependency_flags,
+		                           uint32_t(memory.size()), memory.data(),
+		                           uint32_t(buffers.size()), buffers.data(),
+		                           uint32_t(images.size()), images.data());
+	}
+
+	batch.memory.clear();
+	batch.buffers.clear();
+	batch.images.clear();
+	batch.dst_stages = 0;
+	batch.dependency_flags = 0;
+	barriers_pending = false;
 }
 
 void CommandBuffer::buffer_barrier(const Buffer &buffer, VkPipelineStageFlags src_stages, VkAccessFlags src_access,
                                    VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
 {
-	VK_ASSERT(!actual_render_pass);
-	VK_ASSERT(!framebuffer);
 	VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
 	barrier.srcAccessMask = src_access;
 	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	barrier.buffer = buffer.get_buffer();
 	barrier.offset = 0;
 	barrier.size = buffer.get_create_info().size;
-
-	fixup_src_stage(src_stages, device->get_workarounds().optimize_all_graphics_barrier);
-	table.vkCmdPipelineBarrier(cmd, src_stages, dst_stages, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	this->barrier(src_stages, dst_stages, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
 void CommandBuffer::image_barrier(const Image &image, VkImageLayout old_layout, VkImageLayout new_layout,
                                   VkPipelineStageFlags src_stages, VkAccessFlags src_access,
                                   VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
 {
-	VK_ASSERT(!actual_render_pass);
-	VK_ASSERT(!framebuffer);
 	VK_ASSERT(image.get_create_info().domain != ImageDomain::Transient);
 
 	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
@@ -333,9 +616,7 @@ void CommandBuffer::image_barrier(const Image &image, VkImageLayout old_layout,
 	barrier.subresourceRange.layerCount = image.get_create_info().layers;
 	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-	fixup_src_stage(src_stages, device->get_workarounds().optimize_all_graphics_barrier);
-	table.vkCmdPipelineBarrier(cmd, src_stages, dst_stages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	this->barrier(src_stages, dst_stages, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 void CommandBuffer::buffer_barriers(VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages,
@@ -452,6 +733,8 @@ void CommandBuffer::blit_image(const Image &dst, const Image &src,
 	                     dst.get_image(), dst.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	                     1, &blit, filter);
 #else
+	flush_barriers();
+
 	// RADV workaround.
 	for (unsigned i = 0; i < num_layers; i++)
 	{
@@ -506,13 +789,10 @@ void CommandBuffer::begin_graphics()
 		set_surface_transform_specialization_constants(0);
 }
 
-void CommandBuffer::init_viewport_scissor(const RenderPassInfo &info, const Framebuffer *fb)
+void CommandBuffer::init_viewport_scissor(const RenderPassInfo &info, uint32_t fb_width, uint32_t fb_height)
 {
 	VkRect2D rect = info.render_area;
 
-	uint32_t fb_width = fb->get_width();
-	uint32_t fb_height = fb->get_height();
-
 	rect.offset.x = min(fb_width, uint32_t(rect.offset.x));
 	rect.offset.y = min(fb_height, uint32_t(rect.offset.y));
 	rect.extent.width = min(fb_width - rect.offset.x, rect.extent.width);
@@ -547,7 +827,7 @@ CommandBufferHandle CommandBuffer::request_secondary_command_buffer(Device &devi
 	if (info.depth_stencil)
 		cmd->framebuffer_attachments[i++] = info.depth_stencil;
 
-	cmd->init_viewport_scissor(info, fb);
+	cmd->init_viewport_scissor(info, fb->get_width(), fb->get_height());
 	cmd->pipeline_state.subpass_index = subpass;
 	cmd->current_contents = VK_SUBPASS_CONTENTS_INLINE;
 
@@ -582,6 +862,8 @@ void CommandBuffer::submit_secondary(CommandBufferHandle secondary)
 	VK_ASSERT(pipeline_state.subpass_index == secondary->pipeline_state.subpass_index);
 	VK_ASSERT(current_contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
+	num_draws += secondary->num_draws;
+	num_dispatches += secondary->num_dispatches;
 	device->submit_secondary(*this, *secondary);
 }
 
@@ -651,12 +933,30 @@ void CommandBuffer::begin_render_pass(const RenderPassInfo &info, VkSubpassConte
 	VK_ASSERT(!framebuffer);
 	VK_ASSERT(!pipeline_state.compatible_render_pass);
 	VK_ASSERT(!actual_render_pass);
+	flush_barriers();
+
+	bool dynamic_rendering = can_use_dynamic_rendering(info, contents);
+	uint32_t fb_width, fb_height;
+
+	if (dynamic_rendering)
+	{
+		// No VkRenderPass is begun, the compatible render pass only describes attachment state for pipelines.
+		pipeline_state.compatible_render_pass = &device->request_render_pass(info, true);
+		actual_render_pass = pipeline_state.compatible_render_pass;
+		Framebuffer::compute_dimensions(info, fb_width, fb_height);
+	}
+	else
+	{
+		framebuffer = &device->request_framebuffer(info);
+		pipeline_state.compatible_render_pass = &framebuffer->get_compatible_render_pass();
+		actual_render_pass = &device->request_render_pass(info, false);
+		fb_width = framebuffer->get_width();
+		fb_height = framebuffer->get_height();
+	}
 
-	framebuffer = &device->request_framebuffer(info);
 	init_surface_transform(info);
-	pipeline_state.compatible_render_pass = &framebuffer->get_compatible_render_pass();
-	actual_render_pass = &device->request_render_pass(info, false);
 	pipeline_state.subpass_index = 0;
+	pipeline_state.dynamic_rendering = dynamic_rendering;
 
 	memset(framebuffer_attachments, 0, sizeof(framebuffer_attachments));
 	unsigned att;
@@ -665,7 +965,15 @@ void CommandBuffer::begin_render_pass(const RenderPassInfo &info, VkSubpassConte
 	if (info.depth_stencil)
 		framebuffer_attachments[att++] = info.depth_stencil;
 
-	init_viewport_scissor(info, framebuffer);
+	init_viewport_scissor(info, fb_width, fb_height);
+
+	if (dynamic_rendering)
+	{
+		begin_dynamic_rendering(info);
+		current_contents = contents;
+		begin_graphics();
+		return;
+	}
 
 	VkClearValue clear_values[VULKAN_NUM_ATTACHMENTS + 1];
 	unsigned num_clear_values = 0;
@@ -709,18 +1017,141 @@ void CommandBuffer::begin_render_pass(const RenderPassInfo &info, VkSubpassConte
 
 void CommandBuffer::end_render_pass()
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
 	VK_ASSERT(pipeline_state.compatible_render_pass);
 
-	table.vkCmdEndRenderPass(cmd);
+	if (pipeline_state.dynamic_rendering)
+	{
+#ifdef VK_KHR_dynamic_rendering
+		table.vkCmdEndRenderingKHR(cmd);
+#endif
+	}
+	else
+	{
+		VK_ASSERT(framebuffer);
+		table.vkCmdEndRenderPass(cmd);
+	}
 
 	framebuffer = nullptr;
 	actual_render_pass = nullptr;
 	pipeline_state.compatible_render_pass = nullptr;
+	pipeline_state.dynamic_rendering = false;
 	begin_compute();
 }
 
+bool CommandBuffer::can_use_dynamic_rendering(const RenderPassInfo &info, VkSubpassContents contents) const
+{
+	if (!device->get_dynamic_rendering_enabled())
+		return false;
+
+	// Subpasses are kept on the render pass path since tilers rely on them.
+	// Secondary command buffers inherit a framebuffer, and multiview needs a view mask.
+	if (info.num_subpasses != 0 || info.num_layers != 1 || contents != VK_SUBPASS_CONTENTS_INLINE)
+		return false;
+
+	// Swapchain and transient attachments rely on implicit render pass layout transitions.
+	const auto needs_render_pass = [](const ImageView *view) {
+		auto &image = view->get_image();
+		return image.is_swapchain_image() || image.get_create_info().domain == ImageDomain::Transient;
+	};
+
+	for (unsigned i = 0; i < info.num_color_attachments; i++)
+		if (needs_render_pass(info.color_attachments[i]))
+			return false;
+	if (info.depth_stencil && needs_render_pass(info.depth_stencil))
+		return false;
+
+	return true;
+}
+
+void CommandBuffer::begin_dynamic_rendering(const RenderPassInfo &info)
+{
+#ifdef VK_KHR_dynamic_rendering
+	VkRenderingAttachmentInfoKHR color_attachments[VULKAN_NUM_ATTACHMENTS];
+	VkRenderingAttachmentInfoKHR depth_stencil_attachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR };
+	VkRenderingInfoKHR rendering_info = { VK_STRUCTURE_TYPE_RENDERING_INFO_KHR };
+
+	for (unsigned i = 0; i < info.num_color_attachments; i++)
+	{
+		VK_ASSERT(info.color_attachments[i]);
+		auto &att = color_attachments[i];
+		att = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR };
+		att.imageView = info.color_attachments[i]->get_render_target_view(info.base_layer);
+		att.imageLayout = info.color_attachments[i]->get_image().get_layout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+		if (info.clear_attachments & (1u << i))
+		{
+			att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			att.clearValue.color = info.clear_color[i];
+		}
+		else if (info.load_attachments & (1u << i))
+			att.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		else
+			att.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+		att.storeOp = (info.store_attachments & (1u << i)) != 0 ?
+		              VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	}
+
+	if (info.depth_stencil)
+	{
+		auto &att = depth_stencil_attachment;
+		bool ds_read_only = (info.op_flags & RENDER_PASS_OP_DEPTH_STENCIL_READ_ONLY_BIT) != 0;
+		att.imageView = info.depth_stencil->get_render_target_view(info.base_layer);
+		att.imageLayout = info.depth_stencil->get_image().get_layout(
+				ds_read_only ?
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL :
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+		if (info.op_flags & RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT)
+		{
+			att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			att.clearValue.depthStencil = info.clear_depth_stencil;
+		}
+		else if (info.op_flags & RENDER_PASS_OP_LOAD_DEPTH_STENCIL_BIT)
+			att.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		else
+			att.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+		att.storeOp = (info.op_flags & RENDER_PASS_OP_STORE_DEPTH_STENCIL_BIT) != 0 ?
+		              VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+		auto aspect = format_to_aspect_mask(info.depth_stencil->get_format());
+		if (aspect & VK_IMAGE_ASPECT_DEPTH_BIT)
+			rendering_info.pDepthAttachment = &att;
+		if (aspect & VK_IMAGE_ASPECT_STENCIL_BIT)
+			rendering_info.pStencilAttachment = &att;
+	}
+
+	rendering_info.renderArea = scissor;
+	rendering_info.layerCount = 1;
+	rendering_info.colorAttachmentCount = info.num_color_attachments;
+	rendering_info.pColorAttachments = color_attachments;
+
+#ifdef VK_KHR_fragment_shading_rate
+	// Pipelines only opt into the attachment if the compatible render pass could describe it.
+	VkRenderingFragmentShadingRateAttachmentInfoKHR shading_rate_info =
+			{ VK_STRUCTURE_TYPE_RENDERING_FRAGMENT_SHADING_RATE_ATTACHMENT_INFO_KHR };
+	if (info.shading_rate && pipeline_state.compatible_render_pass->has_shading_rate_attachment() &&
+	    device->get_shading_rate_texel_size(&shading_rate_info.shadingRateAttachmentTexelSize))
+	{
+		shading_rate_info.imageView = info.shading_rate->get_view();
+		shading_rate_info.imageLayout = info.shading_rate->get_image().get_layout(
+				VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR);
+		rendering_info.pNext = &shading_rate_info;
+	}
+#endif
+
+	// Same as render pass path, the render area is expressed in un-rotated coordinates.
+	if (surface_transform_swaps_xy(current_framebuffer_surface_transform))
+		rect2d_swap_xy(rendering_info.renderArea);
+
+	table.vkCmdBeginRenderingKHR(cmd, &rendering_info);
+#else
+	(void)info;
+#endif
+}
+
 VkPipeline CommandBuffer::build_compute_pipeline(Device *device, const DeferredPipelineCompile &compile, bool synchronous)
 {
 	// If we don't have pipeline creation cache control feature,
@@ -801,9 +1232,15 @@ VkPipeline CommandBuffer::build_compute_pipeline(Device *device, const DeferredP
 		}
 	}
 
+#ifdef VK_EXT_descriptor_buffer
+	if (compile.program->get_pipeline_layout()->uses_descriptor_buffer())
+		info.flags |= VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+#endif
+
 	VkPipeline compute_pipeline = VK_NULL_HANDLE;
 #ifdef GRANITE_VULKAN_FOSSILIZE
-	device->register_compute_pipeline(compile.hash, info);
+	if (!compile.program->get_pipeline_layout()->uses_descriptor_buffer())
+		device->register_compute_pipeline(compile.hash, info);
 #endif
 
 #ifdef VULKAN_DEBUG
@@ -823,6 +1260,7 @@ VkPipeline CommandBuffer::build_compute_pipeline(Device *device, const DeferredP
 			LOGE("Failed to create compute pipeline!\n");
 		return VK_NULL_HANDLE;
 	}
+	device->pipeline_compile_count++;
 
 	auto returned_pipeline = compile.program->add_pipeline(compile.hash, compute_pipeline);
 	if (returned_pipeline != compute_pipeline)
@@ -849,27 +1287,53 @@ void CommandBuffer::extract_pipeline_state(DeferredPipelineCompile &compile) con
 	}
 }
 
-VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const DeferredPipelineCompile &compile, bool synchronous)
+struct GraphicsPipelineCreateState
 {
-	// If we don't have pipeline creation cache control feature,
-	// we must assume compilation can be synchronous.
-	if (!synchronous &&
-	    !device->get_device_features().pipeline_creation_cache_control_features.pipelineCreationCacheControl)
-	{
-		return VK_NULL_HANDLE;
-	}
+	VkPipelineViewportStateCreateInfo vp;
+	VkPipelineDynamicStateCreateInfo dyn;
+	VkDynamicState states[7];
+	VkPipelineColorBlendAttachmentState blend_attachments[VULKAN_NUM_ATTACHMENTS];
+	VkPipelineColorBlendStateCreateInfo blend;
+	VkPipelineDepthStencilStateCreateInfo ds;
+	VkPipelineVertexInputStateCreateInfo vi;
+	VkVertexInputAttributeDescription vi_attribs[VULKAN_NUM_VERTEX_ATTRIBS];
+	VkVertexInputBindingDescription vi_bindings[VULKAN_NUM_VERTEX_BUFFERS];
+	VkPipelineInputAssemblyStateCreateInfo ia;
+	VkPipelineMultisampleStateCreateInfo ms;
+	VkPipelineRasterizationStateCreateInfo raster;
+	VkPipelineRasterizationConservativeStateCreateInfoEXT conservative_raster;
+	VkPipelineShaderStageCreateInfo stages[static_cast<unsigned>(ShaderStage::Count)];
+	unsigned num_stages;
+	VkSpecializationInfo spec_info[ecast(ShaderStage::Count)];
+	VkSpecializationMapEntry spec_entries[ecast(ShaderStage::Count)][VULKAN_NUM_SPEC_CONSTANTS];
+	uint32_t spec_constants[static_cast<unsigned>(ShaderStage::Count)][VULKAN_NUM_SPEC_CONSTANTS];
+#ifdef VK_KHR_dynamic_rendering
+	VkPipelineRenderingCreateInfoKHR rendering;
+	VkFormat rendering_color_formats[VULKAN_NUM_ATTACHMENTS];
+#endif
+#ifdef VK_KHR_fragment_shading_rate
+	VkPipelineFragmentShadingRateStateCreateInfoKHR shading_rate;
+#endif
+	VkGraphicsPipelineCreateInfo pipe;
+};
 
+// Fills in everything for a monolithic pipeline. Pipeline library creation picks subsets of this.
+static bool init_graphics_pipeline_create_state(Device *device, const DeferredPipelineCompile &compile,
+                                                GraphicsPipelineCreateState &state)
+{
 	// Viewport state
-	VkPipelineViewportStateCreateInfo vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	auto &vp = state.vp;
+	vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
 	vp.viewportCount = 1;
 	vp.scissorCount = 1;
 
 	// Dynamic state
-	VkPipelineDynamicStateCreateInfo dyn = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	auto &dyn = state.dyn;
+	dyn = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
 	dyn.dynamicStateCount = 2;
-	VkDynamicState states[7] = {
-		VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_VIEWPORT,
-	};
+	auto *states = state.states;
+	states[0] = VK_DYNAMIC_STATE_SCISSOR;
+	states[1] = VK_DYNAMIC_STATE_VIEWPORT;
 	dyn.pDynamicStates = states;
 
 	if (compile.static_state.state.depth_bias_enable)
@@ -882,8 +1346,9 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	}
 
 	// Blend state
-	VkPipelineColorBlendAttachmentState blend_attachments[VULKAN_NUM_ATTACHMENTS];
-	VkPipelineColorBlendStateCreateInfo blend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	auto *blend_attachments = state.blend_attachments;
+	auto &blend = state.blend;
+	blend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
 	blend.attachmentCount = compile.compatible_render_pass->get_num_color_attachments(compile.subpass_index);
 	blend.pAttachments = blend_attachments;
 	for (unsigned i = 0; i < blend.attachmentCount; i++)
@@ -910,7 +1375,8 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	memcpy(blend.blendConstants, compile.potential_static_state.blend_constants, sizeof(blend.blendConstants));
 
 	// Depth state
-	VkPipelineDepthStencilStateCreateInfo ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	auto &ds = state.ds;
+	ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
 	ds.stencilTestEnable = compile.compatible_render_pass->has_stencil(compile.subpass_index) && compile.static_state.state.stencil_test;
 	ds.depthTestEnable = compile.compatible_render_pass->has_depth(compile.subpass_index) && compile.static_state.state.depth_test;
 	ds.depthWriteEnable = compile.compatible_render_pass->has_depth(compile.subpass_index) && compile.static_state.state.depth_write;
@@ -931,8 +1397,9 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	}
 
 	// Vertex input
-	VkPipelineVertexInputStateCreateInfo vi = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
-	VkVertexInputAttributeDescription vi_attribs[VULKAN_NUM_VERTEX_ATTRIBS];
+	auto &vi = state.vi;
+	vi = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	auto *vi_attribs = state.vi_attribs;
 	vi.pVertexAttributeDescriptions = vi_attribs;
 	uint32_t attr_mask = compile.program->get_pipeline_layout()->get_resource_layout().attribute_mask;
 	uint32_t binding_mask = 0;
@@ -945,7 +1412,7 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 		binding_mask |= 1u << attr.binding;
 	});
 
-	VkVertexInputBindingDescription vi_bindings[VULKAN_NUM_VERTEX_BUFFERS];
+	auto *vi_bindings = state.vi_bindings;
 	vi.pVertexBindingDescriptions = vi_bindings;
 	for_each_bit(binding_mask, [&](uint32_t bit) {
 		auto &bind = vi_bindings[vi.vertexBindingDescriptionCount++];
@@ -955,12 +1422,14 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	});
 
 	// Input assembly
-	VkPipelineInputAssemblyStateCreateInfo ia = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+	auto &ia = state.ia;
+	ia = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
 	ia.primitiveRestartEnable = compile.static_state.state.primitive_restart;
 	ia.topology = static_cast<VkPrimitiveTopology>(compile.static_state.state.topology);
 
 	// Multisample
-	VkPipelineMultisampleStateCreateInfo ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+	auto &ms = state.ms;
+	ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
 	ms.rasterizationSamples = static_cast<VkSampleCountFlagBits>(compile.compatible_render_pass->get_sample_count(compile.subpass_index));
 
 	if (compile.compatible_render_pass->get_sample_count(compile.subpass_index) > 1)
@@ -972,16 +1441,16 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	}
 
 	// Raster
-	VkPipelineRasterizationStateCreateInfo raster = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+	auto &raster = state.raster;
+	raster = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
 	raster.cullMode = static_cast<VkCullModeFlags>(compile.static_state.state.cull_mode);
 	raster.frontFace = static_cast<VkFrontFace>(compile.static_state.state.front_face);
 	raster.lineWidth = 1.0f;
 	raster.polygonMode = compile.static_state.state.wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
 	raster.depthBiasEnable = compile.static_state.state.depth_bias_enable != 0;
 
-	VkPipelineRasterizationConservativeStateCreateInfoEXT conservative_raster = {
-		VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT
-	};
+	auto &conservative_raster = state.conservative_raster;
+	conservative_raster = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT };
 	if (compile.static_state.state.conservative_raster)
 	{
 		if (device->get_device_features().supports_conservative_rasterization)
@@ -992,24 +1461,24 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 		else
 		{
 			LOGE("Conservative rasterization is not supported on this device.\n");
-			return VK_NULL_HANDLE;
+			return false;
 		}
 	}
 
 	// Stages
-	VkPipelineShaderStageCreateInfo stages[static_cast<unsigned>(ShaderStage::Count)];
-	unsigned num_stages = 0;
-
-	VkSpecializationInfo spec_info[ecast(ShaderStage::Count)] = {};
-	VkSpecializationMapEntry spec_entries[ecast(ShaderStage::Count)][VULKAN_NUM_SPEC_CONSTANTS];
-	uint32_t spec_constants[static_cast<unsigned>(ShaderStage::Count)][VULKAN_NUM_SPEC_CONSTANTS];
+	auto *stages = state.stages;
+	auto &spec_info = state.spec_info;
+	auto &spec_entries = state.spec_entries;
+	auto &spec_constants = state.spec_constants;
+	state.num_stages = 0;
 
 	for (unsigned i = 0; i < static_cast<unsigned>(ShaderStage::Count); i++)
 	{
+		spec_info[i] = {};
 		auto stage = static_cast<ShaderStage>(i);
 		if (compile.program->get_shader(stage))
 		{
-			auto &s = stages[num_stages++];
+			auto &s = stages[state.num_stages++];
 			s = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
 			s.module = compile.program->get_shader(stage)->get_module();
 			s.pName = "main";
@@ -1037,10 +1506,56 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 		}
 	}
 
-	VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	auto &pipe = state.pipe;
+	pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 	pipe.layout = compile.program->get_pipeline_layout()->get_layout();
-	pipe.renderPass = compile.compatible_render_pass->get_render_pass();
-	pipe.subpass = compile.subpass_index;
+#ifdef VK_EXT_descriptor_buffer
+	if (compile.program->get_pipeline_layout()->uses_descriptor_buffer())
+		pipe.flags |= VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+#endif
+
+#ifdef VK_KHR_dynamic_rendering
+	if (compile.dynamic_rendering)
+	{
+		auto &rp = *compile.compatible_render_pass;
+		auto &rendering = state.rendering;
+		rendering = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR };
+		rendering.colorAttachmentCount = rp.get_num_color_attachments(compile.subpass_index);
+		for (unsigned i = 0; i < rendering.colorAttachmentCount; i++)
+		{
+			auto &ref = rp.get_color_attachment(compile.subpass_index, i);
+			state.rendering_color_formats[i] = ref.attachment != VK_ATTACHMENT_UNUSED ?
+			                                   rp.get_color_attachment_format(ref.attachment) : VK_FORMAT_UNDEFINED;
+		}
+		rendering.pColorAttachmentFormats = state.rendering_color_formats;
+		if (rp.has_depth(compile.subpass_index))
+			rendering.depthAttachmentFormat = rp.get_depth_stencil_format();
+		if (rp.has_stencil(compile.subpass_index))
+			rendering.stencilAttachmentFormat = rp.get_depth_stencil_format();
+		pipe.pNext = &rendering;
+	}
+	else
+#endif
+	{
+		pipe.renderPass = compile.compatible_render_pass->get_render_pass();
+		pipe.subpass = compile.subpass_index;
+	}
+
+#ifdef VK_KHR_fragment_shading_rate
+	// Without combiner ops the attachment is ignored, so let it replace the pipeline rate.
+	if (compile.compatible_render_pass->has_shading_rate_attachment())
+	{
+		auto &shading_rate = state.shading_rate;
+		shading_rate = { VK_STRUCTURE_TYPE_PIPELINE_FRAGMENT_SHADING_RATE_STATE_CREATE_INFO_KHR };
+		shading_rate.fragmentSize = { 1, 1 };
+		shading_rate.combinerOps[0] = VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR;
+		shading_rate.combinerOps[1] = VK_FRAGMENT_SHADING_RATE_COMBINER_OP_REPLACE_KHR;
+		shading_rate.pNext = pipe.pNext;
+		pipe.pNext = &shading_rate;
+		if (compile.dynamic_rendering)
+			pipe.flags |= VK_PIPELINE_CREATE_RENDERING_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR;
+	}
+#endif
 
 	pipe.pViewportState = &vp;
 	pipe.pDynamicState = &dyn;
@@ -1051,11 +1566,29 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	pipe.pMultisampleState = &ms;
 	pipe.pRasterizationState = &raster;
 	pipe.pStages = stages;
-	pipe.stageCount = num_stages;
+	pipe.stageCount = state.num_stages;
+	return true;
+}
+
+VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const DeferredPipelineCompile &compile, bool synchronous)
+{
+	// If we don't have pipeline creation cache control feature,
+	// we must assume compilation can be synchronous.
+	if (!synchronous &&
+	    !device->get_device_features().pipeline_creation_cache_control_features.pipelineCreationCacheControl)
+	{
+		return VK_NULL_HANDLE;
+	}
+
+	GraphicsPipelineCreateState state;
+	if (!init_graphics_pipeline_create_state(device, compile, state))
+		return VK_NULL_HANDLE;
+	auto &pipe = state.pipe;
 
 	VkPipeline pipeline = VK_NULL_HANDLE;
 #ifdef GRANITE_VULKAN_FOSSILIZE
-	device->register_graphics_pipeline(compile.hash, pipe);
+	if (!compile.program->get_pipeline_layout()->uses_descriptor_buffer())
+		device->register_graphics_pipeline(compile.hash, pipe);
 #endif
 
 #ifdef VULKAN_DEBUG
@@ -1074,6 +1607,7 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 			LOGE("Failed to create graphics pipeline!\n");
 		return VK_NULL_HANDLE;
 	}
+	device->pipeline_compile_count++;
 
 	auto returned_pipeline = compile.program->add_pipeline(compile.hash, pipeline);
 	if (returned_pipeline != pipeline)
@@ -1081,6 +1615,314 @@ VkPipeline CommandBuffer::build_graphics_pipeline(Device *device, const Deferred
 	return returned_pipeline;
 }
 
+#ifdef VK_EXT_graphics_pipeline_library
+enum class GraphicsPipelineLibraryType
+{
+	VertexInput,
+	PreRasterization,
+	FragmentShader,
+	FragmentOutput,
+	Count
+};
+
+static void hash_multisample_state(Hasher &h, const DeferredPipelineCompile &compile)
+{
+	h.u32(compile.compatible_render_pass->get_sample_count(compile.subpass_index));
+	h.u32(compile.static_state.state.alpha_to_coverage);
+	h.u32(compile.static_state.state.alpha_to_one);
+	h.u32(compile.static_state.state.sample_shading);
+}
+
+static void hash_stage_spec_constants(Hasher &h, const DeferredPipelineCompile &compile, ShaderStage stage)
+{
+	auto mask = compile.program->get_pipeline_layout()->get_resource_layout().spec_constant_mask[ecast(stage)] &
+	            compile.potential_static_state.spec_constant_mask;
+	h.u32(mask);
+	for_each_bit(mask, [&](uint32_t bit) {
+		h.u32(compile.potential_static_state.spec_constants[bit]);
+	});
+}
+
+// Each library only hashes the subset of state it consumes, so libraries are shared between
+// the many full pipeline states which only differ in other subsets.
+static Hash hash_graphics_pipeline_library(const DeferredPipelineCompile &compile, GraphicsPipelineLibraryType type)
+{
+	Hasher h;
+	h.u32(uint32_t(type));
+	h.u32(compile.dynamic_rendering);
+
+	auto *layout = compile.program->get_pipeline_layout();
+	auto &state = compile.static_state.state;
+
+	switch (type)
+	{
+	case GraphicsPipelineLibraryType::VertexInput:
+	{
+		uint32_t active_vbos = 0;
+		for_each_bit(layout->get_resource_layout().attribute_mask, [&](uint32_t bit) {
+			h.u32(bit);
+			active_vbos |= 1u << compile.attribs[bit].binding;
+			h.u32(compile.attribs[bit].binding);
+			h.u32(compile.attribs[bit].format);
+			h.u32(compile.attribs[bit].offset);
+		});
+
+		for_each_bit(active_vbos, [&](uint32_t bit) {
+			h.u32(compile.input_rates[bit]);
+			h.u32(compile.strides[bit]);
+		});
+
+		h.u32(state.topology);
+		h.u32(state.primitive_restart);
+		break;
+	}
+
+	case GraphicsPipelineLibraryType::PreRasterization:
+		h.u64(layout->get_hash());
+		h.u64(compile.compatible_render_pass->get_hash());
+		h.u32(compile.subpass_index);
+		for (unsigned i = 0; i < ecast(ShaderStage::Count); i++)
+		{
+			auto stage = static_cast<ShaderStage>(i);
+			if (stage == ShaderStage::Fragment)
+				continue;
+			auto *shader = compile.program->get_shader(stage);
+			h.u64(shader ? shader->get_hash() : 0);
+			if (shader)
+				hash_stage_spec_constants(h, compile, stage);
+		}
+		h.u32(state.cull_mode);
+		h.u32(state.front_face);
+		h.u32(state.wireframe);
+		h.u32(state.depth_bias_enable);
+		h.u32(state.conservative_raster);
+		break;
+
+	case GraphicsPipelineLibraryType::FragmentShader:
+	{
+		h.u64(layout->get_hash());
+		h.u64(compile.compatible_render_pass->get_hash());
+		h.u32(compile.subpass_index);
+		auto *shader = compile.program->get_shader(ShaderStage::Fragment);
+		h.u64(shader ? shader->get_hash() : 0);
+		if (shader)
+			hash_stage_spec_constants(h, compile, ShaderStage::Fragment);
+		h.u32(state.depth_write);
+		h.u32(state.depth_test);
+		h.u32(state.depth_compare);
+		h.u32(state.stencil_test);
+		if (state.stencil_test)
+		{
+			h.u32(state.stencil_front_fail);
+			h.u32(state.stencil_front_pass);
+			h.u32(state.stencil_front_depth_fail);
+			h.u32(state.stencil_front_compare_op);
+			h.u32(state.stencil_back_fail);
+			h.u32(state.stencil_back_pass);
+			h.u32(state.stencil_back_depth_fail);
+			h.u32(state.stencil_back_compare_op);
+		}
+		hash_multisample_state(h, compile);
+		break;
+	}
+
+	case GraphicsPipelineLibraryType::FragmentOutput:
+		h.u64(compile.compatible_render_pass->get_hash());
+		h.u32(compile.subpass_index);
+		h.u32(layout->get_resource_layout().render_target_mask);
+		h.u32(state.write_mask);
+		h.u32(state.blend_enable);
+		if (state.blend_enable)
+		{
+			h.u32(state.src_color_blend);
+			h.u32(state.dst_color_blend);
+			h.u32(state.color_blend_op);
+			h.u32(state.src_alpha_blend);
+			h.u32(state.dst_alpha_blend);
+			h.u32(state.alpha_blend_op);
+			h.data(reinterpret_cast<const uint32_t *>(compile.potential_static_state.blend_constants),
+			       sizeof(compile.potential_static_state.blend_constants));
+		}
+		hash_multisample_state(h, compile);
+		break;
+
+	default:
+		break;
+	}
+
+	return h.get();
+}
+
+static VkPipeline build_graphics_pipeline_library(Device *device, const DeferredPipelineCompile &compile,
+                                                  const GraphicsPipelineCreateState &state,
+                                                  GraphicsPipelineLibraryType type)
+{
+	VkGraphicsPipelineLibraryCreateInfoEXT library_info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
+	VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	// Forwards VkPipelineRenderingCreateInfoKHR when rendering dynamically.
+	library_info.pNext = state.pipe.pNext;
+	pipe.pNext = &library_info;
+	pipe.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | state.pipe.flags;
+
+	VkPipelineShaderStageCreateInfo stages[ecast(ShaderStage::Count)];
+
+	switch (type)
+	{
+	case GraphicsPipelineLibraryType::VertexInput:
+		library_info.flags = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+		pipe.pVertexInputState = state.pipe.pVertexInputState;
+		pipe.pInputAssemblyState = state.pipe.pInputAssemblyState;
+		break;
+
+	case GraphicsPipelineLibraryType::PreRasterization:
+	case GraphicsPipelineLibraryType::FragmentShader:
+	{
+		bool fragment = type == GraphicsPipelineLibraryType::FragmentShader;
+		library_info.flags = fragment ?
+				VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT :
+				VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+		pipe.layout = state.pipe.layout;
+		pipe.renderPass = state.pipe.renderPass;
+		pipe.subpass = state.pipe.subpass;
+		pipe.pDynamicState = state.pipe.pDynamicState;
+
+		for (unsigned i = 0; i < state.num_stages; i++)
+			if ((state.stages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT) == fragment)
+				stages[pipe.stageCount++] = state.stages[i];
+		pipe.pStages = stages;
+
+		if (fragment)
+		{
+			pipe.pDepthStencilState = state.pipe.pDepthStencilState;
+			pipe.pMultisampleState = state.pipe.pMultisampleState;
+		}
+		else
+		{
+			pipe.pViewportState = state.pipe.pViewportState;
+			pipe.pRasterizationState = state.pipe.pRasterizationState;
+		}
+		break;
+	}
+
+	case GraphicsPipelineLibraryType::FragmentOutput:
+		library_info.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+		pipe.renderPass = state.pipe.renderPass;
+		pipe.subpass = state.pipe.subpass;
+		pipe.pColorBlendState = state.pipe.pColorBlendState;
+		pipe.pMultisampleState = state.pipe.pMultisampleState;
+		break;
+
+	default:
+		return VK_NULL_HANDLE;
+	}
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	auto &table = device->get_device_table();
+	if (table.vkCreateGraphicsPipelines(device->get_device(), compile.cache, 1, &pipe, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		LOGE("Failed to create graphics pipeline library!\n");
+		return VK_NULL_HANDLE;
+	}
+
+	return pipeline;
+}
+#endif
+
+VkPipeline CommandBuffer::build_fast_linked_graphics_pipeline(Device *device, const DeferredPipelineCompile &compile)
+{
+#ifdef VK_EXT_graphics_pipeline_library
+	if (!device->supports_graphics_pipeline_library_fast_link())
+		return VK_NULL_HANDLE;
+
+	static_assert(ecast(GraphicsPipelineLibraryType::Count) == Device::GraphicsPipelineLibraryCount,
+	              "Mismatch in graphics pipeline library count.");
+
+	auto &gpl = device->graphics_pipeline_library;
+	{
+		std::lock_guard<std::mutex> holder{gpl.lock};
+		auto *linked = gpl.linked.find(compile.hash);
+		if (linked)
+			return linked->pipeline;
+	}
+
+	GraphicsPipelineCreateState state;
+	if (!init_graphics_pipeline_create_state(device, compile, state))
+		return VK_NULL_HANDLE;
+
+	auto &table = device->get_device_table();
+	VkPipeline libraries[ecast(GraphicsPipelineLibraryType::Count)];
+	Hash library_hashes[ecast(GraphicsPipelineLibraryType::Count)];
+
+	// Evicted libraries are destroyed at the end of the frame context, so handles stay valid while linking.
+	for (unsigned i = 0; i < ecast(GraphicsPipelineLibraryType::Count); i++)
+	{
+		auto type = static_cast<GraphicsPipelineLibraryType>(i);
+		Hash hash = hash_graphics_pipeline_library(compile, type);
+		library_hashes[i] = hash;
+
+		{
+			std::lock_guard<std::mutex> holder{gpl.lock};
+			auto *library = gpl.libraries.find(hash);
+			libraries[i] = library ? library->pipeline : VK_NULL_HANDLE;
+		}
+
+		if (libraries[i] == VK_NULL_HANDLE)
+		{
+			VkPipeline pipeline = build_graphics_pipeline_library(device, compile, state, type);
+			if (pipeline == VK_NULL_HANDLE)
+				return VK_NULL_HANDLE;
+
+			std::lock_guard<std::mutex> holder{gpl.lock};
+			auto *library = gpl.libraries.emplace_yield(hash, pipeline);
+			if (library->pipeline != pipeline)
+				table.vkDestroyPipeline(device->get_device(), pipeline, nullptr);
+			libraries[i] = library->pipeline;
+		}
+	}
+
+	VkPipelineLibraryCreateInfoKHR link_info = { VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+	link_info.libraryCount = ecast(GraphicsPipelineLibraryType::Count);
+	link_info.pLibraries = libraries;
+
+	VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipe.pNext = &link_info;
+	pipe.flags = state.pipe.flags;
+	pipe.layout = state.pipe.layout;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	if (table.vkCreateGraphicsPipelines(device->get_device(), VK_NULL_HANDLE, 1, &pipe, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		LOGE("Failed to link graphics pipeline libraries!\n");
+		return VK_NULL_HANDLE;
+	}
+	device->pipeline_compile_count++;
+
+	std::lock_guard<std::mutex> holder{gpl.lock};
+	auto *linked = gpl.linked.emplace_yield(compile.hash, pipeline);
+	if (linked->pipeline != pipeline)
+	{
+		table.vkDestroyPipeline(device->get_device(), pipeline, nullptr);
+		return linked->pipeline;
+	}
+
+	for (unsigned i = 0; i < ecast(GraphicsPipelineLibraryType::Count); i++)
+	{
+		linked->libraries[i] = library_hashes[i];
+		auto *library = gpl.libraries.find(library_hashes[i]);
+		if (library)
+		{
+			library->users++;
+			linked->counted_libraries |= 1u << i;
+		}
+	}
+	return linked->pipeline;
+#else
+	(void)device;
+	(void)compile;
+	return VK_NULL_HANDLE;
+#endif
+}
+
 bool CommandBuffer::flush_compute_pipeline(bool synchronous)
 {
 	update_hash_compute_pipeline(pipeline_state);
@@ -1140,6 +1982,7 @@ void CommandBuffer::update_hash_graphics_pipeline(DeferredPipelineCompile &compi
 
 	h.u64(compile.compatible_render_pass->get_hash());
 	h.u32(compile.subpass_index);
+	h.u32(compile.dynamic_rendering);
 	h.u64(compile.program->get_hash());
 	h.data(compile.static_state.words, sizeof(compile.static_state.words));
 
@@ -1172,11 +2015,55 @@ bool CommandBuffer::flush_graphics_pipeline(bool synchronous)
 {
 	update_hash_graphics_pipeline(pipeline_state, active_vbos);
 	current_pipeline = pipeline_state.program->get_pipeline(pipeline_state.hash);
+	current_pipeline_is_fallback = false;
+
+	if (current_pipeline == VK_NULL_HANDLE && synchronous)
+	{
+		// Fast-link from separately compiled libraries and build the optimized pipeline in the background.
+		// Once it lands in the program cache, it takes precedence over the linked pipeline.
+		current_pipeline = build_fast_linked_graphics_pipeline(device, pipeline_state);
+		if (current_pipeline != VK_NULL_HANDLE)
+		{
+			device->enqueue_graphics_pipeline_compile(pipeline_state);
+			return true;
+		}
+	}
+
+	if (current_pipeline == VK_NULL_HANDLE && synchronous && device->get_asynchronous_pipeline_compile())
+	{
+		// A pipeline cache hit is cheap, so try that before going async.
+		current_pipeline = build_graphics_pipeline(device, pipeline_state, false);
+		if (current_pipeline == VK_NULL_HANDLE && device->enqueue_graphics_pipeline_compile(pipeline_state))
+		{
+			current_pipeline = flush_fallback_graphics_pipeline();
+			current_pipeline_is_fallback = current_pipeline != VK_NULL_HANDLE;
+			return current_pipeline != VK_NULL_HANDLE;
+		}
+	}
+
 	if (current_pipeline == VK_NULL_HANDLE)
 		current_pipeline = build_graphics_pipeline(device, pipeline_state, synchronous);
 	return current_pipeline != VK_NULL_HANDLE;
 }
 
+VkPipeline CommandBuffer::flush_fallback_graphics_pipeline()
+{
+	auto *fallback = pipeline_state.program->get_fallback_program();
+	if (!fallback)
+		return VK_NULL_HANDLE;
+
+	DeferredPipelineCompile fallback_state = pipeline_state;
+	fallback_state.program = fallback;
+	uint32_t fallback_vbos = 0;
+	update_hash_graphics_pipeline(fallback_state, fallback_vbos);
+
+	// The fallback is expected to be shared between many programs, so compiling it synchronously once is fine.
+	VkPipeline pipeline = fallback->get_pipeline(fallback_state.hash);
+	if (pipeline == VK_NULL_HANDLE)
+		pipeline = build_graphics_pipeline(device, fallback_state, true);
+	return pipeline;
+}
+
 bool CommandBuffer::flush_compute_state(bool synchronous)
 {
 	if (!pipeline_state.program)
@@ -1222,7 +2109,8 @@ bool CommandBuffer::flush_render_state(bool synchronous)
 		return false;
 	VK_ASSERT(current_layout);
 
-	if (current_pipeline == VK_NULL_HANDLE)
+	// Keep checking whether the real pipeline is ready.
+	if (current_pipeline == VK_NULL_HANDLE || current_pipeline_is_fallback)
 		set_dirty(COMMAND_BUFFER_DIRTY_PIPELINE_BIT);
 
 	// We've invalidated pipeline state, update the VkPipeline.
@@ -1336,6 +2224,7 @@ void CommandBuffer::wait_events(unsigned num_events, const VkEvent *events,
 	}
 	else
 	{
+		flush_barriers();
 		table.vkCmdWaitEvents(cmd, num_events, events, src_stages, dst_stages,
 		                      barriers, globals, buffer_barriers, buffers, image_barriers, images);
 	}
@@ -1354,13 +2243,16 @@ void CommandBuffer::complete_signal_event(const EventHolder &event)
 	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(event.get_stages() != 0);
 	if (!device->get_workarounds().emulate_event_as_pipeline_barrier)
+	{
+		flush_barriers();
 		table.vkCmdSetEvent(cmd, event.get_event(), event.get_stages());
+	}
 }
 
 void CommandBuffer::set_vertex_attrib(uint32_t attrib, uint32_t binding, VkFormat format, VkDeviceSize offset)
 {
 	VK_ASSERT(attrib < VULKAN_NUM_VERTEX_ATTRIBS);
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 
 	auto &attr = pipeline_state.attribs[attrib];
 
@@ -1393,7 +2285,7 @@ void CommandBuffer::set_vertex_binding(uint32_t binding, const Buffer &buffer, V
                                        VkVertexInputRate step_rate)
 {
 	VK_ASSERT(binding < VULKAN_NUM_VERTEX_BUFFERS);
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 
 	VkBuffer vkbuffer = buffer.get_buffer();
 	if (vbo.buffers[binding] != vkbuffer || vbo.offsets[binding] != offset)
@@ -1409,7 +2301,7 @@ void CommandBuffer::set_vertex_binding(uint32_t binding, const Buffer &buffer, V
 
 void CommandBuffer::set_viewport(const VkViewport &viewport_)
 {
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 	viewport = viewport_;
 	set_dirty(COMMAND_BUFFER_DIRTY_VIEWPORT_BIT);
 }
@@ -1421,7 +2313,7 @@ const VkViewport &CommandBuffer::get_viewport() const
 
 void CommandBuffer::set_scissor(const VkRect2D &rect)
 {
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 	VK_ASSERT(rect.offset.x >= 0);
 	VK_ASSERT(rect.offset.y >= 0);
 	scissor = rect;
@@ -1474,8 +2366,8 @@ void CommandBuffer::set_program(Program *program)
 	if (!program)
 		return;
 
-	VK_ASSERT((framebuffer && pipeline_state.program->get_shader(ShaderStage::Vertex)) ||
-	          (!framebuffer && pipeline_state.program->get_shader(ShaderStage::Compute)));
+	VK_ASSERT((actual_render_pass && pipeline_state.program->get_shader(ShaderStage::Vertex)) ||
+	          (!actual_render_pass && pipeline_state.program->get_shader(ShaderStage::Compute)));
 
 	if (!current_layout)
 	{
@@ -1490,9 +2382,10 @@ void CommandBuffer::set_program(Program *program)
 		auto &new_layout = program->get_pipeline_layout()->get_resource_layout();
 		auto &old_layout = current_layout->get_resource_layout();
 
-		// If the push constant layout changes, all descriptor sets
-		// are invalidated.
-		if (new_layout.push_constant_layout_hash != old_layout.push_constant_layout_hash)
+		// If the push constant layout changes, or we move between descriptor sets and descriptor buffers,
+		// all descriptor sets are invalidated.
+		if (new_layout.push_constant_layout_hash != old_layout.push_constant_layout_hash ||
+		    program->get_pipeline_layout()->uses_descriptor_buffer() != current_layout->uses_descriptor_buffer())
 		{
 			dirty_sets = ~0u;
 			set_dirty(COMMAND_BUFFER_DIRTY_PUSH_CONSTANTS_BIT);
@@ -1518,6 +2411,14 @@ void CommandBuffer::set_program(Program *program)
 void *CommandBuffer::allocate_constant_data(unsigned set, unsigned binding, VkDeviceSize size)
 {
 	VK_ASSERT(size <= VULKAN_MAX_UBO_SIZE);
+
+	BufferRingAllocation ring;
+	if (device->allocate_streaming_ring(StreamingRing::Uniform, size, ring))
+	{
+		set_uniform_buffer(set, binding, *ring.buffer, ring.offset, ring.padded_size);
+		return ring.host;
+	}
+
 	auto data = ubo_block.allocate(size);
 	if (!data.host)
 	{
@@ -1528,8 +2429,27 @@ void *CommandBuffer::allocate_constant_data(unsigned set, unsigned binding, VkDe
 	return data.host;
 }
 
+void *CommandBuffer::allocate_storage_data(unsigned set, unsigned binding, VkDeviceSize size)
+{
+	auto data = ssbo_block.allocate(size);
+	if (!data.host)
+	{
+		device->request_storage_block(ssbo_block, size);
+		data = ssbo_block.allocate(size);
+	}
+	set_storage_buffer(set, binding, *ssbo_block.gpu, data.offset, size);
+	return data.host;
+}
+
 void *CommandBuffer::allocate_index_data(VkDeviceSize size, VkIndexType index_type)
 {
+	BufferRingAllocation ring;
+	if (device->allocate_streaming_ring(StreamingRing::Index, size, ring))
+	{
+		set_index_buffer(*ring.buffer, ring.offset, index_type);
+		return ring.host;
+	}
+
 	auto data = ibo_block.allocate(size);
 	if (!data.host)
 	{
@@ -1607,6 +2527,13 @@ void *CommandBuffer::update_image(const Image &image, uint32_t row_length, uint3
 void *CommandBuffer::allocate_vertex_data(unsigned binding, VkDeviceSize size, VkDeviceSize stride,
                                           VkVertexInputRate step_rate)
 {
+	BufferRingAllocation ring;
+	if (device->allocate_streaming_ring(StreamingRing::Vertex, size, ring))
+	{
+		set_vertex_binding(binding, *ring.buffer, ring.offset, stride, step_rate);
+		return ring.host;
+	}
+
 	auto data = vbo_block.allocate(size);
 	if (!data.host)
 	{
@@ -1638,6 +2565,7 @@ void CommandBuffer::set_uniform_buffer(unsigned set, unsigned binding, const Buf
 	{
 		b.buffer = { buffer.get_buffer(), 0, range };
 		b.dynamic_offset = offset;
+		b.buffer_address = buffer.get_device_address();
 		bindings.cookies[set][binding] = buffer.get_cookie();
 		bindings.secondary_cookies[set][binding] = 0;
 		dirty_sets |= 1u << set;
@@ -1657,6 +2585,7 @@ void CommandBuffer::set_storage_buffer(unsigned set, unsigned binding, const Buf
 
 	b.buffer = { buffer.get_buffer(), offset, range };
 	b.dynamic_offset = 0;
+	b.buffer_address = buffer.get_device_address();
 	bindings.cookies[set][binding] = buffer.get_cookie();
 	bindings.secondary_cookies[set][binding] = 0;
 	dirty_sets |= 1u << set;
@@ -1996,8 +2925,217 @@ void CommandBuffer::flush_descriptor_set(uint32_t set)
 	allocated_sets[set] = allocated.first;
 }
 
+bool CommandBuffer::allocate_descriptor_buffer_sets(uint32_t set_mask, uint8_t **host, VkDeviceSize *offsets)
+{
+	bool success = true;
+	for_each_bit(set_mask, [&](uint32_t set) {
+		auto data = descriptor_block.allocate(current_layout->get_allocator(set)->get_descriptor_buffer_size());
+		host[set] = data.host;
+		offsets[set] = data.offset;
+		if (!data.host)
+			success = false;
+	});
+	return success;
+}
+
+void CommandBuffer::write_descriptor_buffer_set(uint32_t set, uint8_t *host)
+{
+#ifdef VK_EXT_descriptor_buffer
+	auto &set_layout = current_layout->get_resource_layout().sets[set];
+	auto *allocator = current_layout->get_allocator(set);
+	auto &props = device->get_device_features().descriptor_buffer_properties;
+	bool robust = device->get_device_features().enabled_features.robustBufferAccess == VK_TRUE;
+	VkDevice vkdevice = device->get_device();
+
+	VkDescriptorGetInfoEXT info = { VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+	VkDescriptorAddressInfoEXT address = { VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
+
+	const auto get_descriptor = [&](uint32_t binding, VkDeviceSize offset, size_t size) {
+		table.vkGetDescriptorEXT(vkdevice, &info, size,
+		                         host + allocator->get_descriptor_buffer_binding_offset(binding) + offset);
+	};
+
+	// UBOs
+	info.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	info.data.pUniformBuffer = &address;
+	size_t ubo_size = robust ? props.robustUniformBufferDescriptorSize : props.uniformBufferDescriptorSize;
+	for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			auto &b = bindings.bindings[set][binding + i];
+			VK_ASSERT(b.buffer_address != 0);
+			address.address = b.buffer_address + b.buffer.offset + b.dynamic_offset;
+			address.range = b.buffer.range;
+			get_descriptor(binding, i * ubo_size, ubo_size);
+		}
+	});
+
+	// SSBOs
+	info.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	info.data.pStorageBuffer = &address;
+	size_t ssbo_size = robust ? props.robustStorageBufferDescriptorSize : props.storageBufferDescriptorSize;
+	for_each_bit(set_layout.storage_buffer_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			auto &b = bindings.bindings[set][binding + i];
+			VK_ASSERT(b.buffer_address != 0);
+			address.address = b.buffer_address + b.buffer.offset;
+			address.range = b.buffer.range;
+			get_descriptor(binding, i * ssbo_size, ssbo_size);
+		}
+	});
+
+	const auto get_image_info = [&](uint32_t binding) -> const VkDescriptorImageInfo & {
+		auto &b = bindings.bindings[set][binding];
+		VK_ASSERT(b.image.fp.imageView != VK_NULL_HANDLE);
+		return (set_layout.fp_mask & (1u << binding)) != 0 ? b.image.fp : b.image.integer;
+	};
+
+	// Sampled images. Some implementations want arrays split into all images followed by all samplers.
+	for_each_bit(set_layout.sampled_image_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		bool split = array_size > 1 && !props.combinedImageSamplerDescriptorSingleArray;
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			VK_ASSERT(bindings.bindings[set][binding + i].image.fp.sampler != VK_NULL_HANDLE);
+			auto &image_info = get_image_info(binding + i);
+			if (split)
+			{
+				info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				info.data.pSampledImage = &image_info;
+				get_descriptor(binding, i * props.sampledImageDescriptorSize, props.sampledImageDescriptorSize);
+				info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+				info.data.pSampler = &image_info.sampler;
+				get_descriptor(binding, array_size * props.sampledImageDescriptorSize + i * props.samplerDescriptorSize,
+				               props.samplerDescriptorSize);
+			}
+			else
+			{
+				info.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				info.data.pCombinedImageSampler = &image_info;
+				get_descriptor(binding, i * props.combinedImageSamplerDescriptorSize,
+				               props.combinedImageSamplerDescriptorSize);
+			}
+		}
+	});
+
+	// Separate images
+	info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	for_each_bit(set_layout.separate_image_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			info.data.pSampledImage = &get_image_info(binding + i);
+			get_descriptor(binding, i * props.sampledImageDescriptorSize, props.sampledImageDescriptorSize);
+		}
+	});
+
+	// Separate samplers
+	info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	for_each_bit(set_layout.sampler_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			auto &b = bindings.bindings[set][binding + i];
+			VK_ASSERT(b.image.fp.sampler != VK_NULL_HANDLE);
+			info.data.pSampler = &b.image.fp.sampler;
+			get_descriptor(binding, i * props.samplerDescriptorSize, props.samplerDescriptorSize);
+		}
+	});
+
+	// Storage images
+	info.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	for_each_bit(set_layout.storage_image_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			info.data.pStorageImage = &get_image_info(binding + i);
+			get_descriptor(binding, i * props.storageImageDescriptorSize, props.storageImageDescriptorSize);
+		}
+	});
+
+	// Input attachments
+	info.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	for_each_bit(set_layout.input_attachment_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			info.data.pInputAttachmentImage = &get_image_info(binding + i);
+			get_descriptor(binding, i * props.inputAttachmentDescriptorSize, props.inputAttachmentDescriptorSize);
+		}
+	});
+#else
+	(void)set;
+	(void)host;
+#endif
+}
+
+void CommandBuffer::flush_descriptor_buffers()
+{
+#ifdef VK_EXT_descriptor_buffer
+	auto &layout = current_layout->get_resource_layout();
+
+	// There are no dynamic offsets with descriptor buffers, so UBO offset changes rewrite the set as well.
+	// Writing descriptors is plain memory writes, so there is no hashing or caching.
+	uint32_t set_update = layout.descriptor_set_mask & (dirty_sets | dirty_sets_dynamic);
+	if (!set_update)
+		return;
+
+	uint8_t *host[VULKAN_NUM_DESCRIPTOR_SETS];
+	VkDeviceSize offsets[VULKAN_NUM_DESCRIPTOR_SETS];
+
+	if (!descriptor_block.mapped || !allocate_descriptor_buffer_sets(set_update, host, offsets))
+	{
+		// Sets we already pointed to live in the old block, which is about to be unbound,
+		// so all sets need to be written again.
+		set_update = layout.descriptor_set_mask;
+		VkDeviceSize size = 0;
+		for_each_bit(set_update, [&](uint32_t set) {
+			size += current_layout->get_allocator(set)->get_descriptor_buffer_size() +
+			        device->get_device_features().descriptor_buffer_properties.descriptorBufferOffsetAlignment;
+		});
+
+		device->request_descriptor_block(descriptor_block, size);
+		if (!allocate_descriptor_buffer_sets(set_update, host, offsets))
+		{
+			LOGE("Failed to allocate descriptor buffer memory.\n");
+			return;
+		}
+	}
+
+	VkDeviceAddress block_address = descriptor_block.gpu->get_device_address();
+	if (block_address != bound_descriptor_buffer)
+	{
+		VkDescriptorBufferBindingInfoEXT binding_info = { VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
+		binding_info.address = block_address;
+		binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+		                     VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+		table.vkCmdBindDescriptorBuffersEXT(cmd, 1, &binding_info);
+		bound_descriptor_buffer = block_address;
+	}
+
+	for_each_bit(set_update, [&](uint32_t set) {
+		write_descriptor_buffer_set(set, host[set]);
+		uint32_t buffer_index = 0;
+		table.vkCmdSetDescriptorBufferOffsetsEXT(cmd, actual_render_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE,
+		                                         current_pipeline_layout, set, 1, &buffer_index, &offsets[set]);
+	});
+
+	dirty_sets &= ~set_update;
+	dirty_sets_dynamic &= ~set_update;
+#endif
+}
+
 void CommandBuffer::flush_descriptor_sets()
 {
+	if (current_layout->uses_descriptor_buffer())
+	{
+		flush_descriptor_buffers();
+		return;
+	}
+
 	auto &layout = current_layout->get_resource_layout();
 
 	uint32_t set_update = layout.descriptor_set_mask & dirty_sets;
@@ -2019,6 +3157,7 @@ void CommandBuffer::draw(uint32_t vertex_count, uint32_t instance_count, uint32_
 	if (flush_render_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_draws++;
 		table.vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
 	}
 	else
@@ -2033,6 +3172,7 @@ void CommandBuffer::draw_indexed(uint32_t index_count, uint32_t instance_count,
 	if (flush_render_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_draws++;
 		table.vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
 	}
 	else
@@ -2046,6 +3186,7 @@ void CommandBuffer::draw_indirect(const Vulkan::Buffer &buffer,
 	if (flush_render_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_draws++;
 		table.vkCmdDrawIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
 	}
 	else
@@ -2065,6 +3206,7 @@ void CommandBuffer::draw_multi_indirect(const Buffer &buffer, uint32_t offset, u
 	if (flush_render_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_draws++;
 		table.vkCmdDrawIndirectCountKHR(cmd, buffer.get_buffer(), offset,
 		                                count.get_buffer(), count_offset,
 		                                draw_count, stride);
@@ -2086,6 +3228,7 @@ void CommandBuffer::draw_indexed_multi_indirect(const Buffer &buffer, uint32_t o
 	if (flush_render_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_draws++;
 		table.vkCmdDrawIndexedIndirectCountKHR(cmd, buffer.get_buffer(), offset,
 		                                       count.get_buffer(), count_offset,
 		                                       draw_count, stride);
@@ -2100,6 +3243,7 @@ void CommandBuffer::draw_indexed_indirect(const Vulkan::Buffer &buffer,
 	VK_ASSERT(!is_compute);
 	if (flush_render_state(true))
 	{
+		num_draws++;
 		table.vkCmdDrawIndexedIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
 		set_backtrace_checkpoint();
 	}
@@ -2110,9 +3254,11 @@ void CommandBuffer::draw_indexed_indirect(const Vulkan::Buffer &buffer,
 void CommandBuffer::dispatch_indirect(const Buffer &buffer, uint32_t offset)
 {
 	VK_ASSERT(is_compute);
+	flush_barriers();
 	if (flush_compute_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_dispatches++;
 		table.vkCmdDispatchIndirect(cmd, buffer.get_buffer(), offset);
 	}
 	else
@@ -2122,9 +3268,11 @@ void CommandBuffer::dispatch_indirect(const Buffer &buffer, uint32_t offset)
 void CommandBuffer::dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t groups_z)
 {
 	VK_ASSERT(is_compute);
+	flush_barriers();
 	if (flush_compute_state(true))
 	{
 		set_backtrace_checkpoint();
+		num_dispatches++;
 		table.vkCmdDispatch(cmd, groups_x, groups_y, groups_z);
 	}
 	else
@@ -2299,15 +3447,69 @@ void CommandBuffer::save_state(CommandBufferSaveStateFlags flags, CommandBufferS
 	state.flags = flags;
 }
 
+bool CommandBuffer::can_resolve_timestamps() const
+{
+	// Secondary command buffers may end inside a render pass, and query copies need graphics or compute.
+	if (is_secondary)
+		return false;
+
+	auto &info = device->get_queue_info();
+	uint32_t family = info.family_indices[device->get_physical_queue_type(type)];
+	return family == info.family_indices[QUEUE_INDEX_GRAPHICS] || family == info.family_indices[QUEUE_INDEX_COMPUTE];
+}
+
 QueryPoolHandle CommandBuffer::write_timestamp(VkPipelineStageFlagBits stage)
 {
-	return device->write_timestamp(cmd, stage);
+	flush_barriers();
+	auto ts = device->write_timestamp(cmd, stage);
+	if (ts && can_resolve_timestamps())
+		pending_timestamp_resolves.push_back(ts);
+	return ts;
+}
+
+void CommandBuffer::begin_gpu_scope(const char *name)
+{
+	if (!device->get_gpu_scopes_enabled())
+		return;
+	gpu_scope_stack.push_back({ name, write_timestamp(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT) });
+}
+
+void CommandBuffer::end_gpu_scope()
+{
+	if (gpu_scope_stack.empty())
+		return;
+
+	auto scope = std::move(gpu_scope_stack.back());
+	gpu_scope_stack.pop_back();
+	auto end_ts = write_timestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	device->register_gpu_scope(device->get_physical_queue_type(type), unsigned(gpu_scope_stack.size()),
+	                           std::move(scope.name), std::move(scope.start_ts), std::move(end_ts));
+}
+
+void CommandBuffer::begin_performance_region(const char *name)
+{
+	if (profiling || performance_region >= 0)
+		return;
+	flush_barriers();
+	performance_region = device->begin_performance_region(type, cmd, name);
+}
+
+void CommandBuffer::end_performance_region()
+{
+	if (performance_region < 0)
+		return;
+	flush_barriers();
+	device->end_performance_region(type, cmd, performance_region);
+	performance_region = -1;
 }
 
 void CommandBuffer::add_checkpoint(const char *tag)
 {
 	if (device->get_device_features().supports_nv_device_diagnostic_checkpoints)
+	{
+		flush_barriers();
 		table.vkCmdSetCheckpointNV(cmd, tag);
+	}
 }
 
 void CommandBuffer::set_backtrace_checkpoint()
@@ -2333,6 +3535,19 @@ void CommandBuffer::end_threaded_recording()
 	if (is_ended)
 		return;
 
+	flush_barriers();
+
+	// Close any scopes the application left open so timestamps are still paired up.
+	while (!gpu_scope_stack.empty())
+		end_gpu_scope();
+	end_performance_region();
+
+	if (!pending_timestamp_resolves.empty())
+	{
+		QueryPool::resolve_timestamps(table, cmd, pending_timestamp_resolves.data(), pending_timestamp_resolves.size());
+		pending_timestamp_resolves.clear();
+	}
+
 	is_ended = true;
 
 	// We must end a command buffer on the same thread index we started it on.
@@ -2358,8 +3573,12 @@ void CommandBuffer::end()
 		device->request_index_block_nolock(ibo_block, 0);
 	if (ubo_block.mapped)
 		device->request_uniform_block_nolock(ubo_block, 0);
+	if (ssbo_block.mapped)
+		device->request_storage_block_nolock(ssbo_block, 0);
 	if (staging_block.mapped)
 		device->request_staging_block_nolock(staging_block, 0);
+	if (descriptor_block.mapped)
+		device->request_descriptor_block_nolock(descriptor_block, 0);
 }
 
 void CommandBuffer::begin_region(const char *name, const float *color)
@@ -31,6 +31,7 @@
 #include "render_pass.hpp"
 #include "sampler.hpp"
 #include "shader.hpp"
+#include "small_vector.hpp"
 #include "vulkan_common.hpp"
 #include <string.h>
 
@@ -189,6 +190,7 @@ struct DeferredPipelineCompile
 	VkVertexInputRate input_rates[VULKAN_NUM_VERTEX_BUFFERS];
 
 	unsigned subpass_index;
+	bool dynamic_rendering;
 	Util::Hash hash;
 	VkPipelineCache cache;
 	uint32_t subgroup_size_tag;
@@ -250,6 +252,17 @@ public:
 		return thread_index;
 	}
 
+	// Draw and dispatch calls recorded so far, including those of submitted secondaries.
+	uint32_t get_draw_count() const
+	{
+		return num_draws;
+	}
+
+	uint32_t get_dispatch_count() const
+	{
+		return num_dispatches;
+	}
+
 	void set_is_secondary()
 	{
 		is_secondary = true;
@@ -320,6 +333,18 @@ public:
 	void image_barriers(VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages,
 	                    unsigned image_barriers, const VkImageMemoryBarrier *images);
 
+	// Barriers are not recorded right away. They are batched with per-resource stage masks,
+	// and flushed as a single vkCmdPipelineBarrier2 right before the next action command.
+	// Without synchronization2, the batch is flushed as one vkCmdPipelineBarrier with merged stages.
+	void barrier(const VkDependencyInfoKHR &dep);
+
+	// Must be called before recording commands directly into get_command_buffer().
+	inline void flush_barriers()
+	{
+		if (barriers_pending)
+			flush_barrier_batch();
+	}
+
 	void blit_image(const Image &dst,
 	                const Image &src,
 	                const VkOffset3D &dst_offset0, const VkOffset3D &dst_extent,
@@ -388,6 +413,15 @@ public:
 		return static_cast<T *>(allocate_constant_data(set, binding, count * sizeof(T)));
 	}
 
+	// Transient storage buffer data for this frame, without the size limit of constant data.
+	void *allocate_storage_data(unsigned set, unsigned binding, VkDeviceSize size);
+
+	template <typename T>
+	T *allocate_typed_storage_data(unsigned set, unsigned binding, unsigned count)
+	{
+		return static_cast<T *>(allocate_storage_data(set, binding, count * sizeof(T)));
+	}
+
 	void *allocate_vertex_data(unsigned binding, VkDeviceSize size, VkDeviceSize stride,
 	                           VkVertexInputRate step_rate = VK_VERTEX_INPUT_RATE_VERTEX);
 	void *allocate_index_data(VkDeviceSize size, VkIndexType index_type);
@@ -660,6 +694,18 @@ public:
 	}
 
 	QueryPoolHandle write_timestamp(VkPipelineStageFlagBits stage);
+
+	// Nested GPU timing scopes, resolved by Device a few frames later (see Device::get_gpu_scope_events()).
+	// No-ops unless Device::set_gpu_scopes_enabled() is set. Scopes must be balanced within a command buffer,
+	// and are not supported inside multiview render passes.
+	void begin_gpu_scope(const char *name);
+	void end_gpu_scope();
+
+	// Hardware counters, see Device::init_performance_region_counters(). No-ops unless enabled.
+	// Regions cannot nest, and are ignored in command buffers which are profiled as a whole.
+	void begin_performance_region(const char *name);
+	void end_performance_region();
+
 	void add_checkpoint(const char *tag);
 	void set_backtrace_checkpoint();
 
@@ -679,6 +725,8 @@ public:
 	                                          bool synchronous = true);
 	static VkPipeline build_compute_pipeline(Device *device, const DeferredPipelineCompile &compile,
 	                                         bool synchronous = true);
+	// Returns VK_NULL_HANDLE if graphics pipeline libraries with fast linking are not supported.
+	static VkPipeline build_fast_linked_graphics_pipeline(Device *device, const DeferredPipelineCompile &compile);
 
 	bool flush_pipeline_state_without_blocking();
 
@@ -702,6 +750,7 @@ private:
 	VkDescriptorSet allocated_sets[VULKAN_NUM_DESCRIPTOR_SETS] = {};
 
 	VkPipeline current_pipeline = VK_NULL_HANDLE;
+	bool current_pipeline_is_fallback = false;
 	VkPipelineLayout current_pipeline_layout = VK_NULL_HANDLE;
 	PipelineLayout *current_layout = nullptr;
 	VkSubpassContents current_contents = VK_SUBPASS_CONTENTS_INLINE;
@@ -716,9 +765,35 @@ private:
 	uint32_t dirty_vbos = 0;
 	uint32_t active_vbos = 0;
 	VkPipelineStageFlags uses_swapchain_in_stages = 0;
+	uint32_t num_draws = 0;
+	uint32_t num_dispatches = 0;
 	bool is_compute = true;
 	bool is_secondary = false;
 	bool is_ended = false;
+	bool barriers_pending = false;
+
+	struct BarrierBatch
+	{
+		Util::SmallVector<VkMemoryBarrier2KHR> memory;
+		Util::SmallVector<VkBufferMemoryBarrier2KHR> buffers;
+		Util::SmallVector<VkImageMemoryBarrier2KHR, 16> images;
+		VkPipelineStageFlags2KHR dst_stages = 0;
+		VkDependencyFlags dependency_flags = 0;
+	};
+	BarrierBatch pending_barriers;
+	void flush_barrier_batch();
+	bool barrier_batch_has_image(VkImage image) const;
+
+	struct GpuScope
+	{
+		std::string name;
+		QueryPoolHandle start_ts;
+	};
+	std::vector<GpuScope> gpu_scope_stack;
+
+	// Timestamps to copy to their readback buffers when recording ends, see QueryPool::resolve_timestamps().
+	std::vector<QueryPoolHandle> pending_timestamp_resolves;
+	bool can_resolve_timestamps() const;
 
 	void set_dirty(CommandBufferDirtyFlags flags)
 	{
@@ -744,29 +819,39 @@ private:
 	void clear_render_state();
 
 	bool flush_graphics_pipeline(bool synchronous);
+	VkPipeline flush_fallback_graphics_pipeline();
 	bool flush_compute_pipeline(bool synchronous);
 	void flush_descriptor_sets();
 	void begin_graphics();
 	void flush_descriptor_set(uint32_t set);
 	void rebind_descriptor_set(uint32_t set);
+	void flush_descriptor_buffers();
+	bool allocate_descriptor_buffer_sets(uint32_t set_mask, uint8_t **host, VkDeviceSize *offsets);
+	void write_descriptor_buffer_set(uint32_t set, uint8_t *host);
 	void begin_compute();
 	void begin_context();
 
 	BufferBlock vbo_block;
 	BufferBlock ibo_block;
 	BufferBlock ubo_block;
+	BufferBlock ssbo_block;
 	BufferBlock staging_block;
+	BufferBlock descriptor_block;
+	VkDeviceAddress bound_descriptor_buffer = 0;
 
 	void set_texture(unsigned set, unsigned binding, VkImageView float_view, VkImageView integer_view,
 	                 VkImageLayout layout,
 	                 uint64_t cookie);
 	void set_buffer_view_common(unsigned set, unsigned binding, const BufferView &view);
 
-	void init_viewport_scissor(const RenderPassInfo &info, const Framebuffer *framebuffer);
+	void init_viewport_scissor(const RenderPassInfo &info, uint32_t fb_width, uint32_t fb_height);
+	bool can_use_dynamic_rendering(const RenderPassInfo &info, VkSubpassContents contents) const;
+	void begin_dynamic_rendering(const RenderPassInfo &info);
 	void init_surface_transform(const RenderPassInfo &info);
 	VkSurfaceTransformFlagBitsKHR current_framebuffer_surface_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 
 	bool profiling = false;
+	int performance_region = -1;
 	std::string debug_channel_tag;
 	Vulkan::BufferHandle debug_channel_buffer;
 	DebugChannelInterface *debug_channel_interface = nullptr;
@@ -22,6 +22,8 @@
 
 #include "command_pool.hpp"
 #include "device.hpp"
+#include "timer.hpp"
+#include <algorithm>
 
 namespace Vulkan
 {
@@ -57,6 +59,11 @@ CommandPool &CommandPool::operator=(CommandPool &&other) noexcept
 		std::swap(buffers, other.buffers);
 		index = other.index;
 		other.index = 0;
+		stats = other.stats;
+		other.stats = {};
+		window_high_water = other.window_high_water;
+		window_secondary_high_water = other.window_secondary_high_water;
+		window_resets = other.window_resets;
 #ifdef VULKAN_DEBUG
 		in_flight.clear();
 		std::swap(in_flight, other.in_flight);
@@ -89,6 +96,7 @@ VkCommandBuffer CommandPool::request_secondary_command_buffer()
 {
 	VK_ASSERT(pool != VK_NULL_HANDLE);
 
+	stats.secondary_requests++;
 	if (secondary_index < secondary_buffers.size())
 	{
 		auto ret = secondary_buffers[secondary_index++];
@@ -121,6 +129,7 @@ VkCommandBuffer CommandPool::request_command_buffer()
 {
 	VK_ASSERT(pool != VK_NULL_HANDLE);
 
+	stats.primary_requests++;
 	if (index < buffers.size())
 	{
 		auto ret = buffers[index++];
@@ -158,9 +167,53 @@ void CommandPool::begin()
 	VK_ASSERT(in_flight.empty());
 #endif
 	if (index > 0 || secondary_index > 0)
+	{
+		auto start_ns = Util::get_current_time_nsecs();
 		table->vkResetCommandPool(device->get_device(), pool, 0);
+		stats.reset_time_ns += Util::get_current_time_nsecs() - start_ns;
+		stats.resets++;
+	}
+
+	window_high_water = std::max(window_high_water, index);
+	window_secondary_high_water = std::max(window_secondary_high_water, secondary_index);
 	index = 0;
 	secondary_index = 0;
+
+	if (++window_resets >= TrimWindowResets)
+		trim_unused_buffers();
+}
+
+void CommandPool::trim_unused_buffers()
+{
+	// Everything is in the initial state after a reset, so buffers can be freed freely.
+	if (buffers.size() > window_high_water)
+	{
+		table->vkFreeCommandBuffers(device->get_device(), pool, uint32_t(buffers.size() - window_high_water),
+		                            buffers.data() + window_high_water);
+		stats.trimmed_buffers += buffers.size() - window_high_water;
+		buffers.resize(window_high_water);
+	}
+
+	if (secondary_buffers.size() > window_secondary_high_water)
+	{
+		table->vkFreeCommandBuffers(device->get_device(), pool,
+		                            uint32_t(secondary_buffers.size() - window_secondary_high_water),
+		                            secondary_buffers.data() + window_secondary_high_water);
+		stats.trimmed_buffers += secondary_buffers.size() - window_secondary_high_water;
+		secondary_buffers.resize(window_secondary_high_water);
+	}
+
+	window_high_water = 0;
+	window_secondary_high_water = 0;
+	window_resets = 0;
+}
+
+CommandPoolStatistics CommandPool::get_statistics() const
+{
+	auto ret = stats;
+	ret.allocated_buffers = uint32_t(buffers.size() + secondary_buffers.size());
+	ret.high_water_buffers = std::max(window_high_water, index) + std::max(window_secondary_high_water, secondary_index);
+	return ret;
 }
 
 void CommandPool::trim()
@@ -173,8 +226,12 @@ void CommandPool::trim()
 		table->vkFreeCommandBuffers(device->get_device(), pool, buffers.size(), buffers.data());
 	if (!secondary_buffers.empty())
 		table->vkFreeCommandBuffers(device->get_device(), pool, secondary_buffers.size(), secondary_buffers.data());
+	stats.trimmed_buffers += buffers.size() + secondary_buffers.size();
 	buffers.clear();
 	secondary_buffers.clear();
+	window_high_water = 0;
+	window_secondary_high_water = 0;
+	window_resets = 0;
 	table->vkTrimCommandPool(device->get_device(), pool, 0);
 }
 }
@@ -29,6 +29,21 @@
 namespace Vulkan
 {
 class Device;
+
+struct CommandPoolStatistics
+{
+	// Running totals.
+	uint64_t primary_requests = 0;
+	uint64_t secondary_requests = 0;
+	uint64_t resets = 0;
+	uint64_t reset_time_ns = 0;
+	uint64_t trimmed_buffers = 0;
+
+	// Command buffers currently allocated, and the most used between two resets recently.
+	uint32_t allocated_buffers = 0;
+	uint32_t high_water_buffers = 0;
+};
+
 class CommandPool
 {
 public:
@@ -46,6 +61,8 @@ public:
 	VkCommandBuffer request_secondary_command_buffer();
 	void signal_submitted(VkCommandBuffer cmd);
 
+	CommandPoolStatistics get_statistics() const;
+
 private:
 	Device *device;
 	const VolkDeviceTable *table;
@@ -57,5 +74,13 @@ private:
 #endif
 	unsigned index = 0;
 	unsigned secondary_index = 0;
+
+	// Buffers beyond the high water mark of a window are freed when the window ends.
+	enum { TrimWindowResets = 256 };
+	unsigned window_high_water = 0;
+	unsigned window_secondary_high_water = 0;
+	unsigned window_resets = 0;
+	CommandPoolStatistics stats;
+	void trim_unused_buffers();
 };
 }
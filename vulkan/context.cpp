@@ -355,6 +355,17 @@ bool Context::create_instance(const char **instance_ext, uint32_t instance_ext_c
 		ext.supports_surface_capabilities2 = true;
 	}
 
+	// Needed for vblank events on VK_KHR_display.
+	bool has_display_extension = find_if(instance_ext, instance_ext + instance_ext_count, [](const char *name) {
+		return strcmp(name, VK_KHR_DISPLAY_EXTENSION_NAME) == 0;
+	}) != (instance_ext + instance_ext_count);
+
+	if (has_display_extension && has_extension(VK_EXT_DISPLAY_SURFACE_COUNTER_EXTENSION_NAME))
+	{
+		instance_exts.push_back(VK_EXT_DISPLAY_SURFACE_COUNTER_EXTENSION_NAME);
+		ext.supports_display_surface_counter = true;
+	}
+
 #ifdef VULKAN_DEBUG
 	const auto has_layer = [&](const char *name) -> bool {
 		auto layer_itr = find_if(begin(queried_layers), end(queried_layers), [name](const VkLayerProperties &e) -> bool {
@@ -713,6 +724,12 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 		enabled_extensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
 	}
 
+	if (ext.supports_display_surface_counter && has_extension(VK_EXT_DISPLAY_CONTROL_EXTENSION_NAME))
+	{
+		ext.supports_display_control = true;
+		enabled_extensions.push_back(VK_EXT_DISPLAY_CONTROL_EXTENSION_NAME);
+	}
+
 #ifdef _WIN32
 	if (ext.supports_surface_capabilities2 && has_extension(VK_EXT_FULL_SCREEN_EXCLUSIVE_EXTENSION_NAME))
 	{
@@ -818,6 +835,9 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 	ext.float16_int8_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FLOAT16_INT8_FEATURES_KHR };
 	ext.ubo_std430_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_UNIFORM_BUFFER_STANDARD_LAYOUT_FEATURES_KHR };
 	ext.timeline_semaphore_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR };
+#ifdef VK_KHR_dynamic_rendering
+	ext.dynamic_rendering_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR };
+#endif
 	ext.sync2_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
 	ext.present_id_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR };
 	ext.present_wait_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR };
@@ -832,6 +852,22 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 	ext.astc_decode_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ASTC_DECODE_FEATURES_EXT };
 	ext.astc_hdr_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TEXTURE_COMPRESSION_ASTC_HDR_FEATURES_EXT };
 	ext.pipeline_creation_cache_control_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT };
+	ext.buffer_device_address_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR };
+#ifdef VK_EXT_descriptor_buffer
+	ext.descriptor_buffer_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT };
+#endif
+#ifdef VK_EXT_graphics_pipeline_library
+	ext.graphics_pipeline_library_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT };
+#endif
+#ifdef VK_EXT_host_image_copy
+	ext.host_image_copy_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT };
+#endif
+#ifdef VK_KHR_fragment_shading_rate
+	ext.fragment_shading_rate_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR };
+#endif
+#ifdef VK_AMD_anti_lag
+	ext.anti_lag_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ANTI_LAG_FEATURES_AMD };
+#endif
 
 	ext.compute_shader_derivative_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COMPUTE_SHADER_DERIVATIVES_FEATURES_NV };
 
@@ -972,12 +1008,80 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 		ppNext = &ext.pipeline_creation_cache_control_features.pNext;
 	}
 
+	if (has_extension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME))
+	{
+		ext.supports_buffer_device_address = true;
+		enabled_extensions.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+		*ppNext = &ext.buffer_device_address_features;
+		ppNext = &ext.buffer_device_address_features.pNext;
+	}
+
+#ifdef VK_EXT_descriptor_buffer
+	// Descriptor buffers address UBOs and SSBOs through buffer device address.
+	if (ext.supports_buffer_device_address && has_extension(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME))
+	{
+		ext.supports_descriptor_buffer = true;
+		enabled_extensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+		*ppNext = &ext.descriptor_buffer_features;
+		ppNext = &ext.descriptor_buffer_features.pNext;
+	}
+#endif
+
+#ifdef VK_KHR_dynamic_rendering
+	if (has_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME))
+	{
+		ext.supports_dynamic_rendering = true;
+		enabled_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+		*ppNext = &ext.dynamic_rendering_features;
+		ppNext = &ext.dynamic_rendering_features.pNext;
+	}
+#endif
+
+#ifdef VK_EXT_graphics_pipeline_library
+	if (has_extension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+	    has_extension(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME))
+	{
+		ext.supports_graphics_pipeline_library = true;
+		enabled_extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+		enabled_extensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+		*ppNext = &ext.graphics_pipeline_library_features;
+		ppNext = &ext.graphics_pipeline_library_features.pNext;
+	}
+#endif
+
 	if (has_extension(VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME))
 	{
 		ext.supports_format_feature_flags2 = true;
 		enabled_extensions.push_back(VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME);
 	}
 
+#ifdef VK_EXT_host_image_copy
+	// Lets texture uploads bypass staging buffers entirely.
+	if (ext.supports_format_feature_flags2 &&
+	    has_extension(VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME) &&
+	    has_extension(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME))
+	{
+		ext.supports_host_image_copy = true;
+		enabled_extensions.push_back(VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME);
+		enabled_extensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+		*ppNext = &ext.host_image_copy_features;
+		ppNext = &ext.host_image_copy_features.pNext;
+	}
+#endif
+
+#ifdef VK_KHR_fragment_shading_rate
+	// Shading rate attachments can only be expressed through render pass 2 or dynamic rendering.
+	if (has_extension(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME) &&
+	    has_extension(VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME))
+	{
+		ext.supports_fragment_shading_rate = true;
+		enabled_extensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+		enabled_extensions.push_back(VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME);
+		*ppNext = &ext.fragment_shading_rate_features;
+		ppNext = &ext.fragment_shading_rate_features.pNext;
+	}
+#endif
+
 	// Validation layers don't fully support present_id/wait yet.
 	// Ignore this extension for now.
 #ifndef VULKAN_DEBUG
@@ -999,6 +1103,24 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 				ppNext = &ext.present_wait_features.pNext;
 			}
 
+			// Driver assisted low latency, used by WSI::set_low_latency_mode().
+#ifdef VK_NV_low_latency2
+			if (has_extension(VK_NV_LOW_LATENCY_2_EXTENSION_NAME))
+			{
+				ext.supports_low_latency2_nv = true;
+				enabled_extensions.push_back(VK_NV_LOW_LATENCY_2_EXTENSION_NAME);
+			}
+#endif
+
+#ifdef VK_AMD_anti_lag
+			if (has_extension(VK_AMD_ANTI_LAG_EXTENSION_NAME))
+			{
+				enabled_extensions.push_back(VK_AMD_ANTI_LAG_EXTENSION_NAME);
+				*ppNext = &ext.anti_lag_features;
+				ppNext = &ext.anti_lag_features.pNext;
+			}
+#endif
+
 			break;
 		}
 	}
@@ -1006,6 +1128,23 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 
 	vkGetPhysicalDeviceFeatures2(gpu, &features);
 
+#ifdef VK_AMD_anti_lag
+	ext.supports_anti_lag_amd = ext.anti_lag_features.antiLag == VK_TRUE;
+#endif
+#ifdef VK_EXT_host_image_copy
+	if (!ext.host_image_copy_features.hostImageCopy)
+		ext.supports_host_image_copy = false;
+#endif
+#ifdef VK_KHR_fragment_shading_rate
+	if (!ext.fragment_shading_rate_features.attachmentFragmentShadingRate)
+		ext.supports_fragment_shading_rate = false;
+#endif
+#ifdef VK_NV_low_latency2
+	// Latency sleep signals a timeline semaphore.
+	if (!ext.timeline_semaphore_features.timelineSemaphore)
+		ext.supports_low_latency2_nv = false;
+#endif
+
 	// Enable device features we might care about.
 	{
 		VkPhysicalDeviceFeatures enabled_features = *required_features;
@@ -1017,6 +1156,10 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 			enabled_features.textureCompressionASTC_LDR = VK_TRUE;
 		if (features.features.fullDrawIndexUint32)
 			enabled_features.fullDrawIndexUint32 = VK_TRUE;
+		if (features.features.multiDrawIndirect)
+			enabled_features.multiDrawIndirect = VK_TRUE;
+		if (features.features.drawIndirectFirstInstance)
+			enabled_features.drawIndirectFirstInstance = VK_TRUE;
 		if (features.features.imageCubeArray)
 			enabled_features.imageCubeArray = VK_TRUE;
 		if (features.features.fillModeNonSolid)
@@ -1056,6 +1199,11 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 		if (features.features.samplerAnisotropy)
 			enabled_features.samplerAnisotropy = VK_TRUE;
 
+		if (features.features.sparseBinding)
+			enabled_features.sparseBinding = VK_TRUE;
+		if (features.features.sparseResidencyImage2D)
+			enabled_features.sparseResidencyImage2D = VK_TRUE;
+
 		features.features = enabled_features;
 		ext.enabled_features = enabled_features;
 	}
@@ -1087,6 +1235,18 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 	ext.descriptor_indexing_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT };
 	ext.conservative_rasterization_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_CONSERVATIVE_RASTERIZATION_PROPERTIES_EXT };
 	ext.float_control_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FLOAT_CONTROLS_PROPERTIES_KHR };
+#ifdef VK_EXT_descriptor_buffer
+	ext.descriptor_buffer_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT };
+#endif
+#ifdef VK_EXT_graphics_pipeline_library
+	ext.graphics_pipeline_library_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT };
+#endif
+#ifdef VK_EXT_host_image_copy
+	ext.host_image_copy_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT };
+#endif
+#ifdef VK_KHR_fragment_shading_rate
+	ext.fragment_shading_rate_properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_PROPERTIES_KHR };
+#endif
 
 	ppNext = &props.pNext;
 
@@ -1133,8 +1293,64 @@ bool Context::create_device(VkPhysicalDevice gpu_, VkSurfaceKHR surface, const c
 		ppNext = &ext.float_control_properties.pNext;
 	}
 
+#ifdef VK_EXT_descriptor_buffer
+	if (ext.supports_descriptor_buffer)
+	{
+		*ppNext = &ext.descriptor_buffer_properties;
+		ppNext = &ext.descriptor_buffer_properties.pNext;
+	}
+#endif
+
+#ifdef VK_EXT_graphics_pipeline_library
+	if (ext.supports_graphics_pipeline_library)
+	{
+		*ppNext = &ext.graphics_pipeline_library_properties;
+		ppNext = &ext.graphics_pipeline_library_properties.pNext;
+	}
+#endif
+
+#ifdef VK_EXT_host_image_copy
+	if (ext.supports_host_image_copy)
+	{
+		*ppNext = &ext.host_image_copy_properties;
+		ppNext = &ext.host_image_copy_properties.pNext;
+	}
+#endif
+
+#ifdef VK_KHR_fragment_shading_rate
+	if (ext.supports_fragment_shading_rate)
+	{
+		*ppNext = &ext.fragment_shading_rate_properties;
+		ppNext = &ext.fragment_shading_rate_properties.pNext;
+	}
+#endif
+
 	vkGetPhysicalDeviceProperties2(gpu, &props);
 
+#ifdef VK_EXT_host_image_copy
+	if (ext.supports_host_image_copy)
+	{
+		// We only ever copy straight into SHADER_READ_ONLY_OPTIMAL, so require that layout up front.
+		std::vector<VkImageLayout> dst_layouts(ext.host_image_copy_properties.copyDstLayoutCount);
+		VkPhysicalDeviceHostImageCopyPropertiesEXT layout_props = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT };
+		layout_props.copyDstLayoutCount = uint32_t(dst_layouts.size());
+		layout_props.pCopyDstLayouts = dst_layouts.data();
+		VkPhysicalDeviceProperties2 layout_props2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		layout_props2.pNext = &layout_props;
+		vkGetPhysicalDeviceProperties2(gpu, &layout_props2);
+
+		if (std::find(dst_layouts.begin(), dst_layouts.begin() + layout_props.copyDstLayoutCount,
+		              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) == dst_layouts.begin() + layout_props.copyDstLayoutCount)
+		{
+			ext.supports_host_image_copy = false;
+		}
+
+		ext.host_image_copy_properties.pNext = nullptr;
+		ext.host_image_copy_properties.copySrcLayoutCount = 0;
+		ext.host_image_copy_properties.copyDstLayoutCount = 0;
+	}
+#endif
+
 	device_info.enabledExtensionCount = enabled_extensions.size();
 	device_info.ppEnabledExtensionNames = enabled_extensions.empty() ? nullptr : enabled_extensions.data();
 	device_info.enabledLayerCount = enabled_layers.size();
@@ -70,6 +70,16 @@ struct DeviceFeatures
 	bool supports_external = false;
 	bool supports_image_format_list = false;
 	bool supports_shader_float_control = false;
+	bool supports_graphics_pipeline_library = false;
+	bool supports_dynamic_rendering = false;
+	bool supports_buffer_device_address = false;
+	bool supports_descriptor_buffer = false;
+	bool supports_low_latency2_nv = false;
+	bool supports_anti_lag_amd = false;
+	bool supports_display_surface_counter = false;
+	bool supports_display_control = false;
+	bool supports_host_image_copy = false;
+	bool supports_fragment_shading_rate = false;
 
 	// Vulkan 1.1 core
 	VkPhysicalDeviceFeatures enabled_features = {};
@@ -81,6 +91,9 @@ struct DeviceFeatures
 
 	// KHR
 	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore_features = {};
+#ifdef VK_KHR_dynamic_rendering
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {};
+#endif
 	VkPhysicalDevicePerformanceQueryFeaturesKHR performance_query_features = {};
 	VkPhysicalDeviceDriverPropertiesKHR driver_properties = {};
 	VkPhysicalDeviceSynchronization2FeaturesKHR sync2_features = {};
@@ -106,9 +119,29 @@ struct DeviceFeatures
 	VkPhysicalDeviceASTCDecodeFeaturesEXT astc_decode_features = {};
 	VkPhysicalDeviceTextureCompressionASTCHDRFeaturesEXT astc_hdr_features = {};
 	VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT pipeline_creation_cache_control_features = {};
+	VkPhysicalDeviceBufferDeviceAddressFeaturesKHR buffer_device_address_features = {};
+#ifdef VK_EXT_descriptor_buffer
+	VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptor_buffer_features = {};
+	VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptor_buffer_properties = {};
+#endif
+#ifdef VK_EXT_graphics_pipeline_library
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphics_pipeline_library_features = {};
+	VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT graphics_pipeline_library_properties = {};
+#endif
+#ifdef VK_EXT_host_image_copy
+	VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy_features = {};
+	VkPhysicalDeviceHostImageCopyPropertiesEXT host_image_copy_properties = {};
+#endif
+#ifdef VK_KHR_fragment_shading_rate
+	VkPhysicalDeviceFragmentShadingRateFeaturesKHR fragment_shading_rate_features = {};
+	VkPhysicalDeviceFragmentShadingRatePropertiesKHR fragment_shading_rate_properties = {};
+#endif
 
 	// Vendor
 	VkPhysicalDeviceComputeShaderDerivativesFeaturesNV compute_shader_derivative_features = {};
+#ifdef VK_AMD_anti_lag
+	VkPhysicalDeviceAntiLagFeaturesAMD anti_lag_features = {};
+#endif
 };
 
 enum VendorID
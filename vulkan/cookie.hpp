@@ -40,6 +40,11 @@ public:
 		return cookie;
 	}
 
+protected:
+	// For objects whose underlying API handle is replaced in-place,
+	// so that caches keyed on the cookie do not alias the old handle.
+	void reallocate_cookie(Device *device);
+
 private:
 	uint64_t cookie;
 };
@@ -181,6 +181,50 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device_, const
 #ifdef GRANITE_VULKAN_FOSSILIZE
 	device->register_descriptor_set_layout(set_layout, get_hash(), info);
 #endif
+
+	bool has_immutable_samplers = false;
+	for (auto sampler : vk_immutable_samplers)
+		if (sampler != VK_NULL_HANDLE)
+			has_immutable_samplers = true;
+
+	// Texel buffers would need format and range tracking beyond VkBufferView,
+	// and immutable samplers must be embedded, so keep those on descriptor sets.
+	if (device->uses_descriptor_buffer() && !bindless && !has_immutable_samplers &&
+	    (layout.sampled_texel_buffer_mask | layout.storage_texel_buffer_mask) == 0)
+	{
+		init_descriptor_buffer_layout(info, bindings);
+	}
+}
+
+void DescriptorSetAllocator::init_descriptor_buffer_layout(VkDescriptorSetLayoutCreateInfo info,
+                                                           std::vector<VkDescriptorSetLayoutBinding> &bindings)
+{
+#ifdef VK_EXT_descriptor_buffer
+	// Dynamic UBOs are not supported with descriptor buffers, the dynamic offset is baked into the descriptor.
+	for (auto &binding : bindings)
+		if (binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+			binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	info.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+	if (table.vkCreateDescriptorSetLayout(device->get_device(), &info, nullptr,
+	                                      &descriptor_buffer.set_layout) != VK_SUCCESS)
+	{
+		LOGE("Failed to create descriptor buffer set layout.\n");
+		descriptor_buffer.set_layout = VK_NULL_HANDLE;
+		return;
+	}
+
+	table.vkGetDescriptorSetLayoutSizeEXT(device->get_device(), descriptor_buffer.set_layout, &descriptor_buffer.size);
+	for (auto &binding : bindings)
+	{
+		table.vkGetDescriptorSetLayoutBindingOffsetEXT(device->get_device(), descriptor_buffer.set_layout,
+		                                               binding.binding,
+		                                               &descriptor_buffer.binding_offsets[binding.binding]);
+	}
+#else
+	(void)info;
+	(void)bindings;
+#endif
 }
 
 void DescriptorSetAllocator::reset_bindless_pool(VkDescriptorPool pool)
@@ -267,6 +311,8 @@ pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index,
 	if (node)
 		return { node->set, true };
 
+	device->descriptor_set_allocation_count++;
+
 	node = state.set_nodes.request_vacant(hash);
 	if (node)
 		return { node->set, false };
@@ -323,6 +369,8 @@ DescriptorSetAllocator::~DescriptorSetAllocator()
 {
 	if (set_layout != VK_NULL_HANDLE)
 		table.vkDestroyDescriptorSetLayout(device->get_device(), set_layout, nullptr);
+	if (descriptor_buffer.set_layout != VK_NULL_HANDLE)
+		table.vkDestroyDescriptorSetLayout(device->get_device(), descriptor_buffer.set_layout, nullptr);
 	clear();
 }
 
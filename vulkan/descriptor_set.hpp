@@ -132,6 +132,28 @@ public:
 		return bindless;
 	}
 
+	// Only valid when the device uses descriptor buffers, and this layout can be expressed with them.
+	bool supports_descriptor_buffer() const
+	{
+		return descriptor_buffer.set_layout != VK_NULL_HANDLE;
+	}
+
+	VkDescriptorSetLayout get_descriptor_buffer_layout() const
+	{
+		return descriptor_buffer.set_layout;
+	}
+
+	VkDeviceSize get_descriptor_buffer_size() const
+	{
+		return descriptor_buffer.size;
+	}
+
+	VkDeviceSize get_descriptor_buffer_binding_offset(unsigned binding) const
+	{
+		VK_ASSERT(binding < VULKAN_NUM_BINDINGS);
+		return descriptor_buffer.binding_offsets[binding];
+	}
+
 	VkDescriptorPool allocate_bindless_pool(unsigned num_sets, unsigned num_descriptors);
 	VkDescriptorSet allocate_bindless_set(VkDescriptorPool pool, unsigned num_descriptors);
 	void reset_bindless_pool(VkDescriptorPool pool);
@@ -160,6 +182,15 @@ private:
 	std::vector<std::unique_ptr<PerThread>> per_thread;
 	std::vector<VkDescriptorPoolSize> pool_size;
 	bool bindless = false;
+
+	struct
+	{
+		VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		VkDeviceSize binding_offsets[VULKAN_NUM_BINDINGS] = {};
+	} descriptor_buffer;
+	void init_descriptor_buffer_layout(VkDescriptorSetLayoutCreateInfo info,
+	                                   std::vector<VkDescriptorSetLayoutBinding> &bindings);
 };
 
 class BindlessAllocator
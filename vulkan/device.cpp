@@ -27,6 +27,7 @@
 #include "quirks.hpp"
 #include "timer.hpp"
 #include <algorithm>
+#include <limits>
 #include <string.h>
 #include <stdlib.h>
 
@@ -37,6 +38,11 @@
 
 #ifdef GRANITE_VULKAN_FILESYSTEM
 #include "string_helpers.hpp"
+#include "single_pass_downsample.hpp"
+#endif
+
+#ifdef GRANITE_VULKAN_THREAD_GROUP
+#include "thread_group.hpp"
 #endif
 
 #ifdef GRANITE_VULKAN_MT
@@ -97,7 +103,13 @@ Device::Device()
 {
 #ifdef GRANITE_VULKAN_MT
 	cookie.store(0);
+	queue_submission_count.store(0);
+	draw_count.store(0);
+	dispatch_count.store(0);
+	pipeline_compile_count.store(0);
+	descriptor_set_allocation_count.store(0);
 #endif
+	untracked_queue_work.store(false);
 }
 
 Semaphore Device::request_legacy_semaphore()
@@ -115,6 +127,15 @@ Semaphore Device::request_proxy_semaphore()
 	return ptr;
 }
 
+Semaphore Device::request_timeline_semaphore_as_binary(const SemaphoreHolder &holder, uint64_t value)
+{
+	LOCK();
+	VK_ASSERT(holder.get_timeline_value() != 0);
+	VK_ASSERT(value != 0);
+	Semaphore ptr(handle_pool.semaphores.allocate(this, value, holder.get_semaphore()));
+	return ptr;
+}
+
 Semaphore Device::request_external_semaphore(VkSemaphore semaphore, bool signalled)
 {
 	LOCK();
@@ -743,12 +764,41 @@ void Device::set_context(const Context &context)
 	ext = context.get_enabled_device_features();
 	system_handles = context.get_system_handles();
 
+#ifdef VK_EXT_graphics_pipeline_library
+	// Without fast linking, linking is no cheaper than a monolithic compile.
+	graphics_pipeline_library.enabled =
+			ext.supports_graphics_pipeline_library &&
+			ext.graphics_pipeline_library_features.graphicsPipelineLibrary &&
+			ext.graphics_pipeline_library_properties.graphicsPipelineLibraryFastLinking;
+	if (const char *env = getenv("GRANITE_VULKAN_GRAPHICS_PIPELINE_LIBRARY"))
+		graphics_pipeline_library.enabled = graphics_pipeline_library.enabled && strtoul(env, nullptr, 0) != 0;
+#endif
+
+	if (const char *env = getenv("GRANITE_VULKAN_DYNAMIC_RENDERING"))
+		set_dynamic_rendering_enabled(strtoul(env, nullptr, 0) != 0);
+
+#ifdef VK_EXT_descriptor_buffer
+	descriptor_buffer = false;
+	if (const char *env = getenv("GRANITE_VULKAN_DESCRIPTOR_BUFFER"))
+	{
+		descriptor_buffer = strtoul(env, nullptr, 0) != 0 &&
+		                    ext.supports_descriptor_buffer &&
+		                    ext.descriptor_buffer_features.descriptorBuffer &&
+		                    ext.buffer_device_address_features.bufferDeviceAddress;
+	}
+#endif
+
+	init_sparse_queue();
 	init_workarounds();
+	init_resizable_bar();
 
 	init_stock_samplers();
 	init_pipeline_cache();
 
 	init_timeline_semaphores();
+	timeline_wait_idle = ext.timeline_semaphore_features.timelineSemaphore;
+	if (const char *env = getenv("GRANITE_VULKAN_TIMELINE_WAIT_IDLE"))
+		timeline_wait_idle = timeline_wait_idle && strtoul(env, nullptr, 0) != 0;
 	init_bindless();
 
 #ifdef ANDROID
@@ -769,6 +819,9 @@ void Device::set_context(const Context &context)
 	                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 	                  ImplementationQuirks::get().staging_need_device_local);
 	managers.ubo.set_spill_region_size(VULKAN_MAX_UBO_SIZE);
+	managers.ssbo.init(this, 256 * 1024, std::max<VkDeviceSize>(16u, gpu_props.limits.minStorageBufferOffsetAlignment),
+	                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	                   ImplementationQuirks::get().staging_need_device_local);
 	managers.staging.init(this, 64 * 1024, std::max<VkDeviceSize>(16u, gpu_props.limits.optimalBufferCopyOffsetAlignment),
 	                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	                      false);
@@ -776,8 +829,30 @@ void Device::set_context(const Context &context)
 	managers.vbo.set_max_retained_blocks(256);
 	managers.ibo.set_max_retained_blocks(256);
 	managers.ubo.set_max_retained_blocks(64);
+	managers.ssbo.set_max_retained_blocks(64);
 	managers.staging.set_max_retained_blocks(32);
 
+	if (const char *env = getenv("GRANITE_VULKAN_DEFERRED_SUBMIT"))
+		set_deferred_submission_enabled(strtoul(env, nullptr, 0) != 0);
+
+	if (const char *env = getenv("GRANITE_VULKAN_UBO_RING_SIZE"))
+		managers.ubo.init_ring(unsigned(per_frame.size()), strtoul(env, nullptr, 0));
+
+	if (const char *env = getenv("GRANITE_VULKAN_DEFRAGMENT_BUDGET_KB"))
+		movable_buffers.budget_per_frame = VkDeviceSize(strtoul(env, nullptr, 0)) * 1024;
+
+#ifdef VK_EXT_descriptor_buffer
+	if (descriptor_buffer)
+	{
+		managers.descriptor.init(this, 64 * 1024,
+		                         std::max<VkDeviceSize>(16u, ext.descriptor_buffer_properties.descriptorBufferOffsetAlignment),
+		                         VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+		                         VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT,
+		                         false);
+		managers.descriptor.set_max_retained_blocks(64);
+	}
+#endif
+
 	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
 	{
 		if (queue_info.family_indices[i] == VK_QUEUE_FAMILY_IGNORED)
@@ -1015,6 +1090,89 @@ void Device::request_uniform_block_nolock(BufferBlock &block, VkDeviceSize size)
 	request_block(*this, block, size, managers.ubo, &dma.ubo, frame().ubo_blocks);
 }
 
+void Device::request_storage_block(BufferBlock &block, VkDeviceSize size)
+{
+	LOCK();
+	request_storage_block_nolock(block, size);
+}
+
+void Device::request_storage_block_nolock(BufferBlock &block, VkDeviceSize size)
+{
+	request_block(*this, block, size, managers.ssbo, &dma.ssbo, frame().ssbo_blocks);
+}
+
+BufferPool &Device::get_streaming_pool(StreamingRing ring)
+{
+	switch (ring)
+	{
+	case StreamingRing::Vertex:
+		return managers.vbo;
+	case StreamingRing::Index:
+		return managers.ibo;
+	default:
+		return managers.ubo;
+	}
+}
+
+bool Device::allocate_streaming_ring(StreamingRing ring, VkDeviceSize size, BufferRingAllocation &alloc)
+{
+	// No lock needed. The frame context cannot change while a command buffer is being recorded.
+	return get_streaming_pool(ring).allocate_ring(frame_context_index, size, alloc);
+}
+
+bool Device::set_streaming_ring_size(StreamingRing ring, VkDeviceSize size)
+{
+	DRAIN_FRAME_LOCK();
+	wait_idle_nolock();
+	return get_streaming_pool(ring).init_ring(unsigned(per_frame.size()), size);
+}
+
+BufferPoolRingStats Device::get_streaming_ring_stats(StreamingRing ring)
+{
+	LOCK();
+	return get_streaming_pool(ring).get_ring_stats();
+}
+
+uint64_t Device::get_queue_submission_count() const
+{
+	return queue_submission_count;
+}
+
+DeviceStatistics Device::get_statistics() const
+{
+	DeviceStatistics stats;
+	stats.queue_submissions = queue_submission_count;
+	stats.draws = draw_count;
+	stats.dispatches = dispatch_count;
+	stats.pipeline_compiles = pipeline_compile_count;
+	stats.descriptor_set_allocations = descriptor_set_allocation_count;
+	return stats;
+}
+
+CommandPoolStatistics Device::get_command_pool_statistics(unsigned thread_index)
+{
+	LOCK();
+	CommandPoolStatistics stats;
+	if (thread_index >= num_thread_indices)
+		return stats;
+
+	for (auto &frame : per_frame)
+	{
+		for (auto &cmd_pool : frame->cmd_pools)
+		{
+			auto pool_stats = cmd_pool[thread_index].get_statistics();
+			stats.primary_requests += pool_stats.primary_requests;
+			stats.secondary_requests += pool_stats.secondary_requests;
+			stats.resets += pool_stats.resets;
+			stats.reset_time_ns += pool_stats.reset_time_ns;
+			stats.trimmed_buffers += pool_stats.trimmed_buffers;
+			stats.allocated_buffers += pool_stats.allocated_buffers;
+			stats.high_water_buffers += pool_stats.high_water_buffers;
+		}
+	}
+	return stats;
+}
+
 void Device::request_staging_block(BufferBlock &block, VkDeviceSize size)
 {
 	LOCK();
@@ -1026,6 +1184,18 @@ void Device::request_staging_block_nolock(BufferBlock &block, VkDeviceSize size)
 	request_block(*this, block, size, managers.staging, nullptr, frame().staging_blocks);
 }
 
+void Device::request_descriptor_block(BufferBlock &block, VkDeviceSize size)
+{
+	LOCK();
+	request_descriptor_block_nolock(block, size);
+}
+
+void Device::request_descriptor_block_nolock(BufferBlock &block, VkDeviceSize size)
+{
+	// Descriptor buffers are host visible, so there is never a DMA copy.
+	request_block(*this, block, size, managers.descriptor, nullptr, frame().descriptor_blocks);
+}
+
 void Device::submit(CommandBufferHandle &cmd, Fence *fence, unsigned semaphore_count, Semaphore *semaphores)
 {
 	cmd->end_debug_channel();
@@ -1095,6 +1265,8 @@ void Device::submit_nolock(CommandBufferHandle cmd, Fence *fence, unsigned semap
 	}
 
 	cmd->end();
+	draw_count += cmd->get_draw_count();
+	dispatch_count += cmd->get_dispatch_count();
 	submissions.push_back(move(cmd));
 
 	InternalFence signalled_fence;
@@ -1179,6 +1351,8 @@ void Device::submit_empty_inner(QueueIndices physical_type, InternalFence *fence
 
 	auto start_ts = write_calibrated_timestamp_nolock();
 	auto result = submit_batches(composer, queue, cleared_fence);
+	if (fence && deferred_submit.enabled)
+		flush_deferred_submissions_nolock();
 	auto end_ts = write_calibrated_timestamp_nolock();
 	register_time_interval_nolock("CPU", std::move(start_ts), std::move(end_ts), "submit", "");
 
@@ -1530,6 +1704,20 @@ void Device::emit_queue_signals(Helper::BatchComposer &composer,
 VkResult Device::submit_batches(Helper::BatchComposer &composer, VkQueue queue, VkFence fence, int profiling_iteration)
 {
 	auto &submits = composer.bake(profiling_iteration);
+
+	if (deferred_submit.enabled)
+	{
+		// Only defer work which the CPU cannot wait on directly.
+		if (fence == VK_NULL_HANDLE && profiling_iteration < 0)
+		{
+			for (auto &submit : submits)
+				defer_submission(queue, submit);
+			return VK_SUCCESS;
+		}
+
+		flush_deferred_submissions_nolock();
+	}
+
 	if (queue_lock_callback)
 		queue_lock_callback();
 
@@ -1540,12 +1728,16 @@ VkResult Device::submit_batches(Helper::BatchComposer &composer, VkQueue queue,
 		{
 			bool last_submit = &submit == &submits.back();
 			result = table->vkQueueSubmit(queue, 1, &submit, last_submit ? fence : VK_NULL_HANDLE);
+			queue_submission_count++;
 			if (result != VK_SUCCESS)
 				break;
 		}
 	}
 	else
+	{
 		result = table->vkQueueSubmit(queue, submits.size(), submits.data(), fence);
+		queue_submission_count++;
+	}
 
 	if (ImplementationQuirks::get().queue_wait_on_submission)
 		table->vkQueueWaitIdle(queue);
@@ -1640,8 +1832,17 @@ void Device::submit_queue(QueueIndices physical_type, InternalFence *fence,
 	emit_queue_signals(composer, timeline_semaphore, timeline_value,
 	                   fence, semaphore_count, semaphores);
 
+	if (frame_capture.active)
+	{
+		frame_capture.batches.push_back({ physical_type, {} });
+		for (auto &cmd : submissions)
+			frame_capture.batches.back().cmds.push_back(cmd->get_command_buffer());
+	}
+
 	auto start_ts = write_calibrated_timestamp_nolock();
 	auto result = submit_batches(composer, queue, cleared_fence, profiling_iteration);
+	if (fence && deferred_submit.enabled)
+		flush_deferred_submissions_nolock();
 	auto end_ts = write_calibrated_timestamp_nolock();
 	register_time_interval_nolock("CPU", std::move(start_ts), std::move(end_ts), "submit", "");
 
@@ -1667,7 +1868,7 @@ void Device::flush_frame(QueueIndices physical_type)
 
 void Device::sync_buffer_blocks()
 {
-	if (dma.vbo.empty() && dma.ibo.empty() && dma.ubo.empty())
+	if (dma.vbo.empty() && dma.ibo.empty() && dma.ubo.empty() && dma.ssbo.empty())
 		return;
 
 	VkBufferUsageFlags usage = 0;
@@ -1697,9 +1898,17 @@ void Device::sync_buffer_blocks()
 		usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 	}
 
+	for (auto &block : dma.ssbo)
+	{
+		VK_ASSERT(block.offset != 0);
+		cmd->copy_buffer(*block.gpu, 0, *block.cpu, 0, block.offset);
+		usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	}
+
 	dma.vbo.clear();
 	dma.ibo.clear();
 	dma.ubo.clear();
+	dma.ssbo.clear();
 
 	cmd->end_region();
 
@@ -1740,6 +1949,8 @@ void Device::end_frame_nolock()
 			queue_data[i].need_fence = false;
 		}
 	}
+
+	flush_deferred_submissions_nolock();
 }
 
 void Device::flush_frame()
@@ -1800,8 +2011,9 @@ CommandBufferHandle Device::request_command_buffer_nolock(unsigned thread_index,
 		profiled = false;
 	}
 
+	// Captured frames are submitted again.
 	VkCommandBufferBeginInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-	info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	info.flags = frame_capture.active ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	table->vkBeginCommandBuffer(cmd, &info);
 	add_frame_counter_nolock();
 	CommandBufferHandle handle(handle_pool.command_buffers.allocate(this, cmd, pipeline_cache, type));
@@ -1850,7 +2062,9 @@ CommandBufferHandle Device::request_secondary_command_buffer_for_thread(unsigned
 	inherit.renderPass = framebuffer->get_compatible_render_pass().get_render_pass();
 	inherit.subpass = subpass;
 	info.pInheritanceInfo = &inherit;
-	info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	if (!frame_capture.active)
+		info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 	table->vkBeginCommandBuffer(cmd, &info);
 	add_frame_counter_nolock();
@@ -1898,8 +2112,18 @@ bool Device::swapchain_touched() const
 
 Device::~Device()
 {
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	cancel_pipeline_warmup();
+	wait_pipeline_warmup();
+#endif
+	wait_pending_pipeline_compiles();
 	wait_idle();
 
+	for (auto &pipe : graphics_pipeline_library.libraries)
+		table->vkDestroyPipeline(device, pipe.pipeline, nullptr);
+	for (auto &pipe : graphics_pipeline_library.linked)
+		table->vkDestroyPipeline(device, pipe.pipeline, nullptr);
+
 	managers.timestamps.log_simple();
 
 	wsi.acquire.reset();
@@ -1923,6 +2147,10 @@ Device::~Device()
 	framebuffer_allocator.clear();
 	transient_allocator.clear();
 
+	managers.vbo.deinit_ring();
+	managers.ibo.deinit_ring();
+	managers.ubo.deinit_ring();
+
 	deinit_timeline_semaphores();
 }
 
@@ -1953,6 +2181,16 @@ void Device::init_frame_contexts(unsigned count)
 	// Clear out caches which might contain stale data from now on.
 	framebuffer_allocator.clear();
 	transient_allocator.clear();
+
+	// Rings are allocated per frame context, so they have to be recreated.
+	VkDeviceSize ring_sizes[int(StreamingRing::Count)];
+	for (int i = 0; i < int(StreamingRing::Count); i++)
+	{
+		auto &pool = get_streaming_pool(StreamingRing(i));
+		ring_sizes[i] = pool.get_ring_size();
+		pool.deinit_ring();
+	}
+
 	per_frame.clear();
 
 	for (unsigned i = 0; i < count; i++)
@@ -1960,6 +2198,10 @@ void Device::init_frame_contexts(unsigned count)
 		auto frame = unique_ptr<PerFrame>(new PerFrame(this, i));
 		per_frame.emplace_back(move(frame));
 	}
+
+	for (int i = 0; i < int(StreamingRing::Count); i++)
+		if (ring_sizes[i])
+			get_streaming_pool(StreamingRing(i)).init_ring(count, ring_sizes[i]);
 }
 
 void Device::init_external_swapchain(const vector<ImageHandle> &swapchain_images)
@@ -2049,6 +2291,7 @@ Device::PerFrame::PerFrame(Device *device_, unsigned frame_index_)
     , table(device_->get_device_table())
     , managers(device_->managers)
     , query_pool(device_)
+    , arena(device_->num_thread_indices)
 {
 	unsigned count = device_->num_thread_indices;
 	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
@@ -2265,15 +2508,21 @@ void Device::wait_idle_nolock()
 
 	if (device != VK_NULL_HANDLE)
 	{
-		if (queue_lock_callback)
-			queue_lock_callback();
-		auto result = table->vkDeviceWaitIdle(device);
-		if (result != VK_SUCCESS)
-			LOGE("vkDeviceWaitIdle failed with code: %d\n", result);
-		if (result == VK_ERROR_DEVICE_LOST)
-			report_checkpoints();
-		if (queue_unlock_callback)
-			queue_unlock_callback();
+		flush_deferred_submissions_nolock();
+		if (!wait_queue_timelines_nolock())
+		{
+			if (queue_lock_callback)
+				queue_lock_callback();
+			// Cleared before waiting, so a present flagged concurrently is not lost.
+			untracked_queue_work.store(false, std::memory_order_relaxed);
+			auto result = table->vkDeviceWaitIdle(device);
+			if (result != VK_SUCCESS)
+				LOGE("vkDeviceWaitIdle failed with code: %d\n", result);
+			if (result == VK_ERROR_DEVICE_LOST)
+				report_checkpoints();
+			if (queue_unlock_callback)
+				queue_unlock_callback();
+		}
 	}
 
 	clear_wait_semaphores();
@@ -2281,28 +2530,25 @@ void Device::wait_idle_nolock()
 	// Free memory for buffer pools.
 	managers.vbo.reset();
 	managers.ubo.reset();
+	managers.ssbo.reset();
 	managers.ibo.reset();
 	managers.staging.reset();
+	managers.descriptor.reset();
 	for (auto &frame : per_frame)
 	{
 		frame->vbo_blocks.clear();
 		frame->ibo_blocks.clear();
 		frame->ubo_blocks.clear();
+		frame->ssbo_blocks.clear();
 		frame->staging_blocks.clear();
+		frame->descriptor_blocks.clear();
 	}
 
 	framebuffer_allocator.clear();
 	transient_allocator.clear();
 
-#ifdef GRANITE_VULKAN_MT
-	for (auto &allocator : descriptor_set_allocators.get_read_only())
-		allocator.clear();
-	for (auto &allocator : descriptor_set_allocators.get_read_write())
-		allocator.clear();
-#else
 	for (auto &allocator : descriptor_set_allocators)
 		allocator.clear();
-#endif
 
 	for (auto &frame : per_frame)
 	{
@@ -2315,6 +2561,37 @@ void Device::wait_idle_nolock()
 	managers.memory.garbage_collect();
 }
 
+bool Device::wait_queue_timelines_nolock()
+{
+	if (!timeline_wait_idle || untracked_queue_work.load(std::memory_order_relaxed))
+		return false;
+
+	// Aliased queue types have their own timelines, so waiting on all of them covers every VkQueue.
+	VkSemaphoreWaitInfoKHR info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR };
+	VkSemaphore sems[QUEUE_INDEX_COUNT];
+	uint64_t values[QUEUE_INDEX_COUNT];
+	for (auto &data : queue_data)
+	{
+		if (data.current_timeline == 0)
+			continue;
+		sems[info.semaphoreCount] = data.timeline_semaphore;
+		values[info.semaphoreCount] = data.current_timeline;
+		info.semaphoreCount++;
+	}
+
+	if (info.semaphoreCount == 0)
+		return true;
+
+	info.pSemaphores = sems;
+	info.pValues = values;
+	auto result = table->vkWaitSemaphoresKHR(device, &info, UINT64_MAX);
+	if (result != VK_SUCCESS)
+		LOGE("vkWaitSemaphores failed with code: %d\n", result);
+	if (result == VK_ERROR_DEVICE_LOST)
+		report_checkpoints();
+	return result == VK_SUCCESS;
+}
+
 void Device::promote_read_write_caches_to_read_only()
 {
 #ifdef GRANITE_VULKAN_MT
@@ -2322,8 +2599,6 @@ void Device::promote_read_write_caches_to_read_only()
 	descriptor_set_allocators.move_to_read_only();
 	shaders.move_to_read_only();
 	programs.move_to_read_only();
-	for (auto &program : programs.get_read_only())
-		program.promote_read_write_to_read_only();
 	render_passes.move_to_read_only();
 	immutable_samplers.move_to_read_only();
 	immutable_ycbcr_conversions.move_to_read_only();
@@ -2333,169 +2608,866 @@ void Device::promote_read_write_caches_to_read_only()
 #endif
 }
 
-void Device::next_frame_context()
+void Device::set_asynchronous_pipeline_compile(bool enable)
 {
-	DRAIN_FRAME_LOCK();
-
-	if (frame_context_begin_ts)
-	{
-		auto frame_context_end_ts = write_calibrated_timestamp_nolock();
-		register_time_interval_nolock("CPU", std::move(frame_context_begin_ts), std::move(frame_context_end_ts), "command submissions", "");
-		frame_context_begin_ts = {};
-	}
-
-	// Flush the frame here as we might have pending staging command buffers from init stage.
-	end_frame_nolock();
-
-	framebuffer_allocator.begin_frame();
-	transient_allocator.begin_frame();
-
-#ifdef GRANITE_VULKAN_MT
-	for (auto &allocator : descriptor_set_allocators.get_read_only())
-		allocator.begin_frame();
-	for (auto &allocator : descriptor_set_allocators.get_read_write())
-		allocator.begin_frame();
+#if defined(GRANITE_VULKAN_MT) && defined(GRANITE_VULKAN_THREAD_GROUP)
+	if (!enable)
+		wait_pending_pipeline_compiles();
+	async_pipelines.enabled = enable && system_handles.thread_group != nullptr;
 #else
-	for (auto &allocator : descriptor_set_allocators)
-		allocator.begin_frame();
+	(void)enable;
 #endif
-
-	VK_ASSERT(!per_frame.empty());
-	frame_context_index++;
-	if (frame_context_index >= per_frame.size())
-		frame_context_index = 0;
-
-	frame().begin();
-	recalibrate_timestamps();
-	frame_context_begin_ts = write_calibrated_timestamp_nolock();
 }
 
-QueryPoolHandle Device::write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
+bool Device::get_asynchronous_pipeline_compile() const
 {
-	LOCK();
-	return write_timestamp_nolock(cmd, stage);
+	return async_pipelines.enabled;
 }
 
-QueryPoolHandle Device::write_timestamp_nolock(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
+bool Device::supports_graphics_pipeline_library_fast_link() const
 {
-	return frame().query_pool.write_timestamp(cmd, stage);
+	return graphics_pipeline_library.enabled;
 }
 
-QueryPoolHandle Device::write_calibrated_timestamp()
+void Device::set_deferred_submission_enabled(bool enable)
 {
 	LOCK();
-	return write_calibrated_timestamp_nolock();
+	if (!enable)
+		flush_deferred_submissions_nolock();
+
+	// Deferring relies on wait-before-signal, which only timeline semaphores allow.
+	deferred_submit.enabled = enable &&
+	                          ext.timeline_semaphore_features.timelineSemaphore &&
+	                          !workarounds.split_binary_timeline_semaphores &&
+	                          !ImplementationQuirks::get().queue_wait_on_submission;
 }
 
-QueryPoolHandle Device::write_calibrated_timestamp_nolock()
+bool Device::get_deferred_submission_enabled() const
 {
-	if (!system_handles.timeline_trace_file)
-		return {};
-
-	auto handle = QueryPoolHandle(handle_pool.query.allocate(this, false));
-	handle->signal_timestamp_ticks(get_current_time_nsecs());
-	return handle;
+	return deferred_submit.enabled;
 }
 
-void Device::recalibrate_timestamps_fallback()
+void Device::flush_deferred_submissions()
 {
-	wait_idle_nolock();
-	auto cmd = request_command_buffer_nolock(0, CommandBuffer::Type::Generic, false);
-	auto ts = write_timestamp_nolock(cmd->get_command_buffer(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
-	if (!ts)
-	{
-		submit_discard_nolock(cmd);
-		return;
-	}
-	auto start_ts = Util::get_current_time_nsecs();
-	submit_nolock(cmd, nullptr, 0, nullptr);
-	wait_idle_nolock();
-	auto end_ts = Util::get_current_time_nsecs();
-	auto host_ts = (start_ts + end_ts) / 2;
-
-	LOGI("Calibrated timestamps with a fallback method. Uncertainty: %.3f us.\n", 1e-3 * (end_ts - start_ts));
-
-	calibrated_timestamp_host = host_ts;
-	VK_ASSERT(ts->is_signalled());
-	calibrated_timestamp_device = ts->get_timestamp_ticks();
-	calibrated_timestamp_device_accum = calibrated_timestamp_device;
+	LOCK();
+	flush_deferred_submissions_nolock();
 }
 
-void Device::init_calibrated_timestamps()
+void Device::defer_submission(VkQueue queue, const VkSubmitInfo &submit)
 {
-	if (!get_device_features().supports_calibrated_timestamps)
-	{
-		recalibrate_timestamps_fallback();
-		return;
-	}
+	unsigned index = 0;
+	while (index < QUEUE_INDEX_COUNT && queue_info.queues[index] != queue)
+		index++;
+	VK_ASSERT(index < QUEUE_INDEX_COUNT);
 
-	uint32_t count;
-	vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(gpu, &count, nullptr);
-	std::vector<VkTimeDomainEXT> domains(count);
-	if (vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(gpu, &count, domains.data()) != VK_SUCCESS)
-		return;
+	const VkTimelineSemaphoreSubmitInfoKHR *timeline = nullptr;
+	for (auto *pnext = static_cast<const VkBaseInStructure *>(submit.pNext); pnext; pnext = pnext->pNext)
+		if (pnext->sType == VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR)
+			timeline = reinterpret_cast<const VkTimelineSemaphoreSubmitInfoKHR *>(pnext);
 
-	bool supports_device_domain = false;
-	for (auto &domain : domains)
+	const auto signal_value = [&](uint32_t i) -> uint64_t {
+		return timeline && i < timeline->signalSemaphoreValueCount ? timeline->pSignalSemaphoreValues[i] : 0;
+	};
+
+	auto &list = deferred_submit.submissions[index];
+
+	// A submission without waits can be folded into the previous one if its signals supersede the previous signals.
+	// Delaying a signal is safe as the submission has no waits, and a larger timeline value satisfies smaller waits.
+	bool merge = !list.empty() && submit.waitSemaphoreCount == 0;
+	if (merge)
 	{
-		if (domain == VK_TIME_DOMAIN_DEVICE_EXT)
+		auto &prev = list.back();
+		for (size_t i = 0, n = prev.signals.size(); i < n && merge; i++)
 		{
-			supports_device_domain = true;
-			break;
+			bool superseded = false;
+			for (uint32_t j = 0; j < submit.signalSemaphoreCount && !superseded; j++)
+			{
+				superseded = prev.signal_values[i] != 0 &&
+				             submit.pSignalSemaphores[j] == prev.signals[i] &&
+				             signal_value(j) >= prev.signal_values[i];
+			}
+			merge = superseded;
 		}
 	}
 
-	if (!supports_device_domain)
-		return;
-
-	for (auto &domain : domains)
+	if (!merge)
 	{
-#ifdef _WIN32
-		const auto supported_domain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
-#else
-		const auto supported_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_EXT;
-#endif
-		if (domain == supported_domain)
+		list.emplace_back();
+		auto &entry = list.back();
+		for (uint32_t i = 0; i < submit.waitSemaphoreCount; i++)
 		{
-			calibrated_time_domain = domain;
-			break;
+			entry.waits.push_back(submit.pWaitSemaphores[i]);
+			entry.wait_stages.push_back(submit.pWaitDstStageMask[i]);
+			entry.wait_values.push_back(timeline && i < timeline->waitSemaphoreValueCount ?
+			                            timeline->pWaitSemaphoreValues[i] : 0);
 		}
 	}
 
-	if (calibrated_time_domain == VK_TIME_DOMAIN_DEVICE_EXT)
-	{
-		LOGE("Could not find a suitable time domain for calibrated timestamps.\n");
-		return;
-	}
+	auto &entry = list.back();
+	entry.cmds.insert(entry.cmds.end(), submit.pCommandBuffers, submit.pCommandBuffers + submit.commandBufferCount);
 
-	if (!resample_calibrated_timestamps())
+	if (submit.signalSemaphoreCount)
 	{
-		LOGE("Failed to get calibrated timestamps.\n");
-		calibrated_time_domain = VK_TIME_DOMAIN_DEVICE_EXT;
-		return;
+		entry.signals.clear();
+		entry.signal_values.clear();
+		for (uint32_t i = 0; i < submit.signalSemaphoreCount; i++)
+		{
+			entry.signals.push_back(submit.pSignalSemaphores[i]);
+			entry.signal_values.push_back(signal_value(i));
+		}
 	}
 }
 
-bool Device::resample_calibrated_timestamps()
+void Device::flush_deferred_submissions_nolock()
 {
-	VkCalibratedTimestampInfoEXT infos[2] = {};
-	infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
-	infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
-	infos[0].timeDomain = calibrated_time_domain;
-	infos[1].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
-	uint64_t timestamps[2] = {};
-	uint64_t max_deviation;
-
-	if (table->vkGetCalibratedTimestampsEXT(device, 2, infos, timestamps, &max_deviation) != VK_SUCCESS)
+	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
 	{
-		LOGE("Failed to get calibrated timestamps.\n");
-		calibrated_time_domain = VK_TIME_DOMAIN_DEVICE_EXT;
-		return false;
-	}
+		auto &list = deferred_submit.submissions[i];
+		if (list.empty())
+			continue;
 
-	calibrated_timestamp_host = timestamps[0];
-	calibrated_timestamp_device = timestamps[1];
-	calibrated_timestamp_device_accum = calibrated_timestamp_device;
+		std::vector<VkSubmitInfo> submits(list.size());
+		std::vector<VkTimelineSemaphoreSubmitInfoKHR> timelines(list.size());
+
+		for (size_t j = 0, n = list.size(); j < n; j++)
+		{
+			auto &entry = list[j];
+			auto &submit = submits[j];
+			auto &timeline = timelines[j];
+
+			timeline = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR };
+			timeline.waitSemaphoreValueCount = uint32_t(entry.wait_values.size());
+			timeline.pWaitSemaphoreValues = entry.wait_values.data();
+			timeline.signalSemaphoreValueCount = uint32_t(entry.signal_values.size());
+			timeline.pSignalSemaphoreValues = entry.signal_values.data();
+
+			submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+			submit.pNext = &timeline;
+			submit.waitSemaphoreCount = uint32_t(entry.waits.size());
+			submit.pWaitSemaphores = entry.waits.data();
+			submit.pWaitDstStageMask = entry.wait_stages.data();
+			submit.commandBufferCount = uint32_t(entry.cmds.size());
+			submit.pCommandBuffers = entry.cmds.data();
+			submit.signalSemaphoreCount = uint32_t(entry.signals.size());
+			submit.pSignalSemaphores = entry.signals.data();
+		}
+
+		if (queue_lock_callback)
+			queue_lock_callback();
+		auto result = table->vkQueueSubmit(queue_info.queues[i], uint32_t(submits.size()), submits.data(), VK_NULL_HANDLE);
+		queue_submission_count++;
+		if (queue_unlock_callback)
+			queue_unlock_callback();
+
+		if (result != VK_SUCCESS)
+			LOGE("vkQueueSubmit failed (code: %d).\n", int(result));
+		if (result == VK_ERROR_DEVICE_LOST)
+			report_checkpoints();
+
+		list.clear();
+	}
+}
+
+void Device::set_dynamic_rendering_enabled(bool enable)
+{
+#ifdef VK_KHR_dynamic_rendering
+	dynamic_rendering = enable && ext.supports_dynamic_rendering && ext.dynamic_rendering_features.dynamicRendering;
+#else
+	(void)enable;
+#endif
+}
+
+bool Device::get_dynamic_rendering_enabled() const
+{
+	return dynamic_rendering;
+}
+
+bool Device::get_shading_rate_texel_size(VkExtent2D *size) const
+{
+#ifdef VK_KHR_fragment_shading_rate
+	if (!ext.supports_fragment_shading_rate)
+		return false;
+
+	// 16x16 is a good trade-off between precision and bandwidth where it is allowed.
+	auto &props = ext.fragment_shading_rate_properties;
+	size->width = std::max(std::min(16u, props.maxFragmentShadingRateAttachmentTexelSize.width),
+	                       props.minFragmentShadingRateAttachmentTexelSize.width);
+	size->height = std::max(std::min(16u, props.maxFragmentShadingRateAttachmentTexelSize.height),
+	                        props.minFragmentShadingRateAttachmentTexelSize.height);
+	return true;
+#else
+	(void)size;
+	return false;
+#endif
+}
+
+bool Device::uses_descriptor_buffer() const
+{
+	return descriptor_buffer;
+}
+
+void Device::init_sparse_queue()
+{
+	sparse_queue = QUEUE_INDEX_COUNT;
+
+	// Bind sparse requires timeline semaphores here, since binds are ordered against other queues with them.
+	if (!ext.enabled_features.sparseBinding || !ext.enabled_features.sparseResidencyImage2D ||
+	    !ext.timeline_semaphore_features.timelineSemaphore)
+		return;
+
+	uint32_t count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, nullptr);
+	std::vector<VkQueueFamilyProperties> props(count);
+	vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, props.data());
+
+	for (auto type : { QUEUE_INDEX_GRAPHICS, QUEUE_INDEX_TRANSFER, QUEUE_INDEX_COMPUTE })
+	{
+		uint32_t family = queue_info.family_indices[type];
+		if (queue_info.queues[type] != VK_NULL_HANDLE && family < count &&
+		    (props[family].queueFlags & VK_QUEUE_SPARSE_BINDING_BIT) != 0)
+		{
+			sparse_queue = type;
+			break;
+		}
+	}
+}
+
+bool Device::supports_sparse_residency() const
+{
+	return sparse_queue != QUEUE_INDEX_COUNT;
+}
+
+bool Device::bind_sparse_image(const VkSparseImageMemoryBindInfo *image_binds, unsigned num_image_binds,
+                               const VkSparseImageOpaqueMemoryBindInfo *opaque_binds, unsigned num_opaque_binds)
+{
+	LOCK();
+	return bind_sparse_image_nolock(image_binds, num_image_binds, opaque_binds, num_opaque_binds);
+}
+
+bool Device::bind_sparse_image_nolock(const VkSparseImageMemoryBindInfo *image_binds, unsigned num_image_binds,
+                                      const VkSparseImageOpaqueMemoryBindInfo *opaque_binds, unsigned num_opaque_binds)
+{
+	if (!supports_sparse_residency())
+		return false;
+
+	static const QueueIndices queues[] = { QUEUE_INDEX_GRAPHICS, QUEUE_INDEX_COMPUTE, QUEUE_INDEX_TRANSFER };
+
+	// Pages which are unbound may still be read by work which is recorded, but not submitted yet.
+	VkSemaphore wait_semaphores[3];
+	uint64_t wait_values[3];
+	uint32_t wait_count = 0;
+
+	for (auto type : queues)
+	{
+		if (queue_info.queues[type] == VK_NULL_HANDLE)
+			continue;
+
+		flush_frame(type);
+		auto &data = queue_data[type];
+		if (data.current_timeline)
+		{
+			wait_semaphores[wait_count] = data.timeline_semaphore;
+			wait_values[wait_count] = data.current_timeline;
+			wait_count++;
+		}
+	}
+
+	auto &data = queue_data[sparse_queue];
+	uint64_t signal_value = ++data.current_timeline;
+	frame().timeline_fences[sparse_queue] = signal_value;
+
+	VkTimelineSemaphoreSubmitInfo timeline_info = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timeline_info.waitSemaphoreValueCount = wait_count;
+	timeline_info.pWaitSemaphoreValues = wait_values;
+	timeline_info.signalSemaphoreValueCount = 1;
+	timeline_info.pSignalSemaphoreValues = &signal_value;
+
+	VkBindSparseInfo bind_info = { VK_STRUCTURE_TYPE_BIND_SPARSE_INFO };
+	bind_info.pNext = &timeline_info;
+	bind_info.waitSemaphoreCount = wait_count;
+	bind_info.pWaitSemaphores = wait_semaphores;
+	bind_info.signalSemaphoreCount = 1;
+	bind_info.pSignalSemaphores = &data.timeline_semaphore;
+	bind_info.imageBindCount = num_image_binds;
+	bind_info.pImageBinds = image_binds;
+	bind_info.imageOpaqueBindCount = num_opaque_binds;
+	bind_info.pImageOpaqueBinds = opaque_binds;
+
+	// The bind shares timelines with regular submissions, which must reach the queues first.
+	flush_deferred_submissions_nolock();
+
+	if (queue_lock_callback)
+		queue_lock_callback();
+	auto result = table->vkQueueBindSparse(queue_info.queues[sparse_queue], 1, &bind_info, VK_NULL_HANDLE);
+	if (queue_unlock_callback)
+		queue_unlock_callback();
+
+	if (result != VK_SUCCESS)
+	{
+		LOGE("vkQueueBindSparse failed (code: %d).\n", int(result));
+		if (result == VK_ERROR_DEVICE_LOST)
+			report_checkpoints();
+		return false;
+	}
+
+	// Any later work might touch the newly bound pages.
+	for (auto type : queues)
+	{
+		if (queue_info.queues[type] == VK_NULL_HANDLE)
+			continue;
+		Semaphore sem(handle_pool.semaphores.allocate(this, signal_value, data.timeline_semaphore));
+		add_wait_semaphore_nolock(type, std::move(sem), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, false);
+	}
+
+	return true;
+}
+
+bool Device::init_sparse_image_memory(DeviceAllocation *allocation, VkImage image, uint32_t levels, uint32_t layers,
+                                      VkSparseImageMemoryRequirements *sparse_reqs, VkMemoryRequirements *reqs)
+{
+	*allocation = {};
+	table->vkGetImageMemoryRequirements(device, image, reqs);
+
+	uint32_t count = 0;
+	table->vkGetImageSparseMemoryRequirements(device, image, &count, nullptr);
+	std::vector<VkSparseImageMemoryRequirements> all_reqs(count);
+	table->vkGetImageSparseMemoryRequirements(device, image, &count, all_reqs.data());
+
+	auto itr = std::find_if(all_reqs.begin(), all_reqs.end(), [](const VkSparseImageMemoryRequirements &r) {
+		return (r.formatProperties.aspectMask & VK_IMAGE_ASPECT_COLOR_BIT) != 0;
+	});
+
+	if (itr == all_reqs.end())
+	{
+		LOGE("Sparse image has no color aspect.\n");
+		return false;
+	}
+
+	*sparse_reqs = *itr;
+
+	if (sparse_reqs->imageMipTailFirstLod >= levels || sparse_reqs->imageMipTailSize == 0)
+		return true;
+
+	if (layers > 1 && (sparse_reqs->formatProperties.flags & VK_SPARSE_IMAGE_FORMAT_SINGLE_MIPTAIL_BIT) == 0)
+	{
+		LOGE("Sparse image arrays with one mip tail per layer are not supported.\n");
+		return false;
+	}
+
+	uint32_t memory_type = find_memory_type(ImageDomain::Physical, reqs->memoryTypeBits);
+	if (memory_type == UINT32_MAX)
+	{
+		LOGE("Failed to find memory type.\n");
+		return false;
+	}
+
+	if (!managers.memory.allocate(sparse_reqs->imageMipTailSize, reqs->alignment, AllocationMode::OptimalResource,
+	                              memory_type, allocation))
+	{
+		LOGE("Failed to allocate sparse mip tail.\n");
+		return false;
+	}
+
+	VkSparseMemoryBind bind = {};
+	bind.resourceOffset = sparse_reqs->imageMipTailOffset;
+	bind.size = sparse_reqs->imageMipTailSize;
+	bind.memory = allocation->get_memory();
+	bind.memoryOffset = allocation->get_offset();
+
+	VkSparseImageOpaqueMemoryBindInfo opaque = {};
+	opaque.image = image;
+	opaque.bindCount = 1;
+	opaque.pBinds = &bind;
+
+	if (!bind_sparse_image(nullptr, 0, &opaque, 1))
+	{
+		allocation->free_immediate(managers.memory);
+		return false;
+	}
+
+	return true;
+}
+
+unsigned Device::get_num_pending_pipeline_compiles() const
+{
+#ifdef GRANITE_VULKAN_MT
+	std::lock_guard<std::mutex> holder{async_pipelines.lock};
+	return unsigned(async_pipelines.in_flight.size());
+#else
+	return 0;
+#endif
+}
+
+void Device::wait_pending_pipeline_compiles()
+{
+#ifdef GRANITE_VULKAN_MT
+	std::unique_lock<std::mutex> holder{async_pipelines.lock};
+	async_pipelines.cond.wait(holder, [this]() {
+		return async_pipelines.in_flight.empty();
+	});
+#endif
+}
+
+#ifndef GRANITE_VULKAN_FOSSILIZE
+PipelineWarmupProgress Device::get_pipeline_warmup_progress() const
+{
+	return {};
+}
+
+void Device::cancel_pipeline_warmup()
+{
+}
+
+void Device::wait_pipeline_warmup()
+{
+}
+#endif
+
+bool Device::enqueue_graphics_pipeline_compile(const DeferredPipelineCompile &compile)
+{
+#if defined(GRANITE_VULKAN_MT) && defined(GRANITE_VULKAN_THREAD_GROUP)
+	if (!system_handles.thread_group)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> holder{async_pipelines.lock};
+		// Already compiling, don't queue duplicates when many draws miss on the same pipeline.
+		if (!async_pipelines.in_flight.insert(compile.hash).second)
+			return true;
+	}
+
+	auto task = system_handles.thread_group->create_task([this, compile]() {
+		if (CommandBuffer::build_graphics_pipeline(this, compile, true) != VK_NULL_HANDLE)
+			evict_fast_linked_graphics_pipeline(compile.hash);
+		std::lock_guard<std::mutex> holder{async_pipelines.lock};
+		async_pipelines.in_flight.erase(compile.hash);
+		async_pipelines.cond.notify_all();
+	});
+	task->set_desc("vulkan-pipeline-compile");
+	task->set_priority(Granite::TaskPriority::Background);
+	return true;
+#else
+	(void)compile;
+	return false;
+#endif
+}
+
+void Device::evict_fast_linked_graphics_pipeline(Hash hash)
+{
+	VkPipeline pipelines[1 + GraphicsPipelineLibraryCount];
+	unsigned count = 0;
+
+	{
+		auto &gpl = graphics_pipeline_library;
+		std::lock_guard<std::mutex> holder{gpl.lock};
+		auto *linked = gpl.linked.find(hash);
+		if (!linked)
+			return;
+
+		pipelines[count++] = linked->pipeline;
+		for_each_bit(linked->counted_libraries, [&](uint32_t bit) {
+			auto *library = gpl.libraries.find(linked->libraries[bit]);
+			VK_ASSERT(library && library->users);
+			if (--library->users == 0)
+			{
+				pipelines[count++] = library->pipeline;
+				gpl.libraries.erase(library);
+			}
+		});
+		gpl.linked.erase(linked);
+	}
+
+	// Command buffers in the current frame context may still have the pipelines bound.
+	LOCK();
+	for (unsigned i = 0; i < count; i++)
+		destroy_pipeline_nolock(pipelines[i]);
+}
+
+void Device::next_frame_context()
+{
+	DRAIN_FRAME_LOCK();
+
+	if (frame_context_begin_ts)
+	{
+		auto frame_context_end_ts = write_calibrated_timestamp_nolock();
+		register_time_interval_nolock("CPU", std::move(frame_context_begin_ts), std::move(frame_context_end_ts), "command submissions", "");
+		frame_context_begin_ts = {};
+	}
+
+	// Recording has drained, so movable buffers can be relocated. The copies go out with this frame.
+	if (movable_buffers.budget_per_frame)
+		defragment_memory_nolock(movable_buffers.budget_per_frame);
+
+	// Flush the frame here as we might have pending staging command buffers from init stage.
+	end_frame_nolock();
+
+	framebuffer_allocator.begin_frame();
+	transient_allocator.begin_frame();
+
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	// Background pipeline warm-up is torn down once it completes.
+	poll_pipeline_warmup();
+#endif
+
+#if defined(GRANITE_VULKAN_FILESYSTEM) && defined(GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER)
+	// Hot reloaded shaders are swapped in between frame contexts.
+	shader_manager.flush_pending_recompiles();
+#endif
+
+	for (auto &allocator : descriptor_set_allocators)
+		allocator.begin_frame();
+
+	VK_ASSERT(!per_frame.empty());
+	frame_context_index++;
+	if (frame_context_index >= per_frame.size())
+		frame_context_index = 0;
+
+	frame().begin();
+	frame().arena.reset();
+	recalibrate_timestamps();
+	frame_context_begin_ts = write_calibrated_timestamp_nolock();
+
+	// Captured command buffers do not outlive the frame context they were recorded in.
+	frame_capture.batches.clear();
+	frame_capture.intervals.clear();
+	frame_capture.events.clear();
+}
+
+void Device::begin_frame_capture()
+{
+	LOCK();
+	frame_capture.batches.clear();
+	frame_capture.intervals.clear();
+	frame_capture.events.clear();
+	frame_capture.active = true;
+}
+
+void Device::end_frame_capture()
+{
+	LOCK();
+	frame_capture.active = false;
+}
+
+bool Device::replay_frame_capture(unsigned iterations, FrameReplayReport &report)
+{
+	LOCK();
+	return replay_frame_capture_nolock(iterations, report);
+}
+
+bool Device::replay_frame_capture_nolock(unsigned iterations, FrameReplayReport &report)
+{
+	report = {};
+	if (frame_capture.active || frame_capture.batches.empty() || iterations == 0)
+	{
+		LOGE("No frame capture to replay.\n");
+		return false;
+	}
+
+	if (!ext.timeline_semaphore_features.timelineSemaphore || !gpu_props.limits.timestampComputeAndGraphics)
+	{
+		LOGE("Frame replay requires timeline semaphores and timestamps.\n");
+		return false;
+	}
+
+	// The original submissions must be done before their queries are reset.
+	flush_deferred_submissions_nolock();
+	if (queue_lock_callback)
+		queue_lock_callback();
+	table->vkDeviceWaitIdle(device);
+	if (queue_unlock_callback)
+		queue_unlock_callback();
+
+	VkSemaphoreTypeCreateInfoKHR type_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR };
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	VkSemaphoreCreateInfo sem_info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	sem_info.pNext = &type_info;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+
+	VkQueryPoolCreateInfo query_info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	query_info.queryCount = 2;
+	VkQueryPool query_pool = VK_NULL_HANDLE;
+
+	// Frame begin and end timestamps go on the queues of the first and last batch.
+	QueueIndices frame_queues[2] = { frame_capture.batches.front().physical_type,
+	                                 frame_capture.batches.back().physical_type };
+	VkCommandPool cmd_pools[2] = {};
+	VkCommandBuffer frame_cmds[2] = {};
+
+	bool ok = table->vkCreateSemaphore(device, &sem_info, nullptr, &timeline) == VK_SUCCESS &&
+	          table->vkCreateQueryPool(device, &query_info, nullptr, &query_pool) == VK_SUCCESS;
+
+	for (unsigned i = 0; i < 2 && ok; i++)
+	{
+		VkCommandPoolCreateInfo pool_info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+		pool_info.queueFamilyIndex = queue_info.family_indices[frame_queues[i]];
+		VkCommandBufferAllocateInfo alloc_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = 1;
+		VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+
+		ok = table->vkCreateCommandPool(device, &pool_info, nullptr, &cmd_pools[i]) == VK_SUCCESS;
+		alloc_info.commandPool = cmd_pools[i];
+		ok = ok && table->vkAllocateCommandBuffers(device, &alloc_info, &frame_cmds[i]) == VK_SUCCESS;
+		ok = ok && table->vkBeginCommandBuffer(frame_cmds[i], &begin_info) == VK_SUCCESS;
+		if (!ok)
+			break;
+
+		if (i == 0)
+		{
+			table->vkCmdResetQueryPool(frame_cmds[i], query_pool, 0, 2);
+			table->vkCmdWriteTimestamp(frame_cmds[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+		}
+		else
+			table->vkCmdWriteTimestamp(frame_cmds[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+		ok = table->vkEndCommandBuffer(frame_cmds[i]) == VK_SUCCESS;
+	}
+
+	std::unordered_map<std::string, double> pass_ms;
+	std::vector<std::string> pass_order;
+	uint64_t timeline_value = 0;
+	report.min_frame_gpu_ms = (std::numeric_limits<double>::max)();
+
+	for (unsigned iteration = 0; iteration < iterations && ok; iteration++)
+	{
+		for (auto event : frame_capture.events)
+			table->vkResetEvent(device, event);
+
+		// Without host resets, the captured command buffers reset their own queries.
+		if (ext.host_query_reset_features.hostQueryReset)
+		{
+			for (auto &interval : frame_capture.intervals)
+			{
+				QueryPool::reset_timestamp(*table, device, *interval.start_ts);
+				QueryPool::reset_timestamp(*table, device, *interval.end_ts);
+			}
+		}
+
+		// Each batch waits for the previous one, even across queues, which also covers
+		// the semaphores the original submissions waited on.
+		for (size_t i = 0, n = frame_capture.batches.size(); i < n && ok; i++)
+		{
+			auto &batch = frame_capture.batches[i];
+			Util::SmallVector<VkCommandBuffer> cmds;
+			if (i == 0)
+				cmds.push_back(frame_cmds[0]);
+			cmds.insert(cmds.end(), batch.cmds.data(), batch.cmds.data() + batch.cmds.size());
+			if (i + 1 == n)
+				cmds.push_back(frame_cmds[1]);
+
+			uint64_t wait_value = timeline_value;
+			uint64_t signal_value = ++timeline_value;
+			VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+			VkTimelineSemaphoreSubmitInfoKHR timeline_info = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR };
+			timeline_info.waitSemaphoreValueCount = 1;
+			timeline_info.pWaitSemaphoreValues = &wait_value;
+			timeline_info.signalSemaphoreValueCount = 1;
+			timeline_info.pSignalSemaphoreValues = &signal_value;
+
+			VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+			submit.pNext = &timeline_info;
+			submit.waitSemaphoreCount = 1;
+			submit.pWaitSemaphores = &timeline;
+			submit.pWaitDstStageMask = &wait_stage;
+			submit.commandBufferCount = uint32_t(cmds.size());
+			submit.pCommandBuffers = cmds.data();
+			submit.signalSemaphoreCount = 1;
+			submit.pSignalSemaphores = &timeline;
+
+			if (queue_lock_callback)
+				queue_lock_callback();
+			ok = table->vkQueueSubmit(queue_info.queues[batch.physical_type], 1, &submit, VK_NULL_HANDLE) == VK_SUCCESS;
+			queue_submission_count++;
+			if (queue_unlock_callback)
+				queue_unlock_callback();
+		}
+
+		VkSemaphoreWaitInfoKHR wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR };
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &timeline;
+		wait_info.pValues = &timeline_value;
+		ok = ok && table->vkWaitSemaphoresKHR(device, &wait_info, UINT64_MAX) == VK_SUCCESS;
+
+		uint64_t frame_ticks[2] = {};
+		ok = ok && table->vkGetQueryPoolResults(device, query_pool, 0, 2, sizeof(frame_ticks), frame_ticks,
+		                                        sizeof(uint64_t),
+		                                        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS;
+		if (!ok)
+			break;
+
+		double frame_ms = 1e3 * convert_device_timestamp_delta(frame_ticks[0], frame_ticks[1]);
+		report.frame_gpu_ms += frame_ms;
+		report.min_frame_gpu_ms = (std::min)(report.min_frame_gpu_ms, frame_ms);
+
+		for (auto &interval : frame_capture.intervals)
+		{
+			uint64_t start_ticks, end_ticks;
+			if (!QueryPool::read_timestamp(*table, device, *interval.start_ts, start_ticks) ||
+			    !QueryPool::read_timestamp(*table, device, *interval.end_ts, end_ticks))
+				continue;
+
+			auto itr = pass_ms.find(interval.tag);
+			if (itr == pass_ms.end())
+			{
+				itr = pass_ms.insert({ interval.tag, 0.0 }).first;
+				pass_order.push_back(interval.tag);
+			}
+			itr->second += 1e3 * convert_device_timestamp_delta(start_ticks, end_ticks);
+		}
+
+		report.iterations++;
+	}
+
+	if (!ok)
+		LOGE("Frame replay failed.\n");
+
+	for (auto &pool : cmd_pools)
+		if (pool != VK_NULL_HANDLE)
+			table->vkDestroyCommandPool(device, pool, nullptr);
+	if (query_pool != VK_NULL_HANDLE)
+		table->vkDestroyQueryPool(device, query_pool, nullptr);
+	if (timeline != VK_NULL_HANDLE)
+		table->vkDestroySemaphore(device, timeline, nullptr);
+
+	if (!report.iterations)
+	{
+		report.min_frame_gpu_ms = 0.0;
+		return false;
+	}
+
+	report.frame_gpu_ms /= double(report.iterations);
+	for (auto &tag : pass_order)
+		report.passes.push_back({ tag, pass_ms[tag] / double(report.iterations) });
+	return ok;
+}
+
+QueryPoolHandle Device::write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
+{
+	LOCK();
+	return write_timestamp_nolock(cmd, stage);
+}
+
+QueryPoolHandle Device::write_timestamp_nolock(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
+{
+	return frame().query_pool.write_timestamp(cmd, stage);
+}
+
+QueryPoolHandle Device::write_calibrated_timestamp()
+{
+	LOCK();
+	return write_calibrated_timestamp_nolock();
+}
+
+QueryPoolHandle Device::write_calibrated_timestamp_nolock()
+{
+	if (!system_handles.timeline_trace_file)
+		return {};
+
+	auto handle = QueryPoolHandle(handle_pool.query.allocate(this, false));
+	handle->signal_timestamp_ticks(get_current_time_nsecs());
+	return handle;
+}
+
+void Device::recalibrate_timestamps_fallback()
+{
+	wait_idle_nolock();
+	auto cmd = request_command_buffer_nolock(0, CommandBuffer::Type::Generic, false);
+	auto ts = write_timestamp_nolock(cmd->get_command_buffer(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	if (!ts)
+	{
+		submit_discard_nolock(cmd);
+		return;
+	}
+	auto start_ts = Util::get_current_time_nsecs();
+	submit_nolock(cmd, nullptr, 0, nullptr);
+	wait_idle_nolock();
+	auto end_ts = Util::get_current_time_nsecs();
+	auto host_ts = (start_ts + end_ts) / 2;
+
+	LOGI("Calibrated timestamps with a fallback method. Uncertainty: %.3f us.\n", 1e-3 * (end_ts - start_ts));
+
+	calibrated_timestamp_host = host_ts;
+	VK_ASSERT(ts->is_signalled());
+	calibrated_timestamp_device = ts->get_timestamp_ticks();
+	calibrated_timestamp_device_accum = calibrated_timestamp_device;
+}
+
+void Device::init_calibrated_timestamps()
+{
+	if (!get_device_features().supports_calibrated_timestamps)
+	{
+		recalibrate_timestamps_fallback();
+		return;
+	}
+
+	uint32_t count;
+	vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(gpu, &count, nullptr);
+	std::vector<VkTimeDomainEXT> domains(count);
+	if (vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(gpu, &count, domains.data()) != VK_SUCCESS)
+		return;
+
+	bool supports_device_domain = false;
+	for (auto &domain : domains)
+	{
+		if (domain == VK_TIME_DOMAIN_DEVICE_EXT)
+		{
+			supports_device_domain = true;
+			break;
+		}
+	}
+
+	if (!supports_device_domain)
+		return;
+
+	for (auto &domain : domains)
+	{
+#ifdef _WIN32
+		const auto supported_domain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+		const auto supported_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_EXT;
+#endif
+		if (domain == supported_domain)
+		{
+			calibrated_time_domain = domain;
+			break;
+		}
+	}
+
+	if (calibrated_time_domain == VK_TIME_DOMAIN_DEVICE_EXT)
+	{
+		LOGE("Could not find a suitable time domain for calibrated timestamps.\n");
+		return;
+	}
+
+	if (!resample_calibrated_timestamps())
+	{
+		LOGE("Failed to get calibrated timestamps.\n");
+		calibrated_time_domain = VK_TIME_DOMAIN_DEVICE_EXT;
+		return;
+	}
+}
+
+bool Device::resample_calibrated_timestamps()
+{
+	VkCalibratedTimestampInfoEXT infos[2] = {};
+	infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+	infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+	infos[0].timeDomain = calibrated_time_domain;
+	infos[1].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+	uint64_t timestamps[2] = {};
+	uint64_t max_deviation;
+
+	if (table->vkGetCalibratedTimestampsEXT(device, 2, infos, timestamps, &max_deviation) != VK_SUCCESS)
+	{
+		LOGE("Failed to get calibrated timestamps.\n");
+		calibrated_time_domain = VK_TIME_DOMAIN_DEVICE_EXT;
+		return false;
+	}
+
+	calibrated_timestamp_host = timestamps[0];
+	calibrated_timestamp_device = timestamps[1];
+	calibrated_timestamp_device_accum = calibrated_timestamp_device;
 
 #ifdef _WIN32
 	LARGE_INTEGER freq;
@@ -2529,12 +3501,38 @@ void Device::register_time_interval(std::string tid, QueryPoolHandle start_ts, Q
 	register_time_interval_nolock(std::move(tid), std::move(start_ts), std::move(end_ts), std::move(tag), std::move(extra));
 }
 
+void Device::register_gpu_scope(QueueIndices queue, unsigned depth, std::string name,
+                                QueryPoolHandle start_ts, QueryPoolHandle end_ts)
+{
+	LOCK();
+	if (start_ts && end_ts)
+		frame().gpu_scopes.push_back({ std::move(name), std::move(start_ts), std::move(end_ts), queue, depth });
+}
+
+void Device::set_gpu_scopes_enabled(bool enable)
+{
+	gpu_scopes_enabled = enable;
+}
+
+bool Device::get_gpu_scopes_enabled() const
+{
+	return gpu_scopes_enabled;
+}
+
+void Device::get_gpu_scope_events(std::vector<GpuScopeEvent> &events)
+{
+	LOCK();
+	events = managers.gpu_scopes.get_frame_events();
+}
+
 void Device::register_time_interval_nolock(std::string tid, QueryPoolHandle start_ts, QueryPoolHandle end_ts,
                                            std::string tag, std::string extra)
 {
 	if (start_ts && end_ts)
 	{
 		TimestampInterval *timestamp_tag = managers.timestamps.get_timestamp_tag(tag.c_str());
+		if (frame_capture.active && start_ts->is_device_timebase())
+			frame_capture.intervals.push_back({ tag, start_ts, end_ts });
 #ifdef VULKAN_DEBUG
 		if (start_ts->is_signalled() && end_ts->is_signalled())
 			VK_ASSERT(end_ts->get_timestamp_ticks() >= start_ts->get_timestamp_ticks());
@@ -2639,12 +3637,22 @@ void Device::PerFrame::begin()
 		managers.ibo.recycle_block(block);
 	for (auto &block : ubo_blocks)
 		managers.ubo.recycle_block(block);
+	for (auto &block : ssbo_blocks)
+		managers.ssbo.recycle_block(block);
 	for (auto &block : staging_blocks)
 		managers.staging.recycle_block(block);
+	for (auto &block : descriptor_blocks)
+		managers.descriptor.recycle_block(block);
 	vbo_blocks.clear();
 	ibo_blocks.clear();
 	ubo_blocks.clear();
+	ssbo_blocks.clear();
 	staging_blocks.clear();
+	descriptor_blocks.clear();
+
+	managers.vbo.begin_ring(frame_index);
+	managers.ibo.begin_ring(frame_index);
+	managers.ubo.begin_ring(frame_index);
 
 	for (auto &framebuffer : destroyed_framebuffers)
 		table.vkDestroyFramebuffer(vkdevice, framebuffer, nullptr);
@@ -2685,8 +3693,17 @@ void Device::PerFrame::begin()
 	allocations.clear();
 
 	if (!in_destructor)
+	{
 		device.register_time_interval_nolock("CPU", std::move(wait_fence_ts), device.write_calibrated_timestamp_nolock(), "fence + recycle", "");
 
+		if (device.performance_regions_enabled)
+		{
+			for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+				if (&device.get_performance_query_pool(QueueIndices(i)) == &device.queue_data[i].performance_query_pool)
+					device.queue_data[i].performance_query_pool.begin_region_frame(frame_index);
+		}
+	}
+
 	int64_t min_timestamp_us = std::numeric_limits<int64_t>::max();
 	int64_t max_timestamp_us = 0;
 
@@ -2699,7 +3716,7 @@ void Device::PerFrame::begin()
 			int64_t start_ts = ts.start_ts->get_timestamp_ticks();
 			int64_t end_ts = ts.end_ts->get_timestamp_ticks();
 			if (ts.start_ts->is_device_timebase())
-				ts.timestamp_tag->accumulate_time(device.convert_device_timestamp_delta(start_ts, end_ts));
+				ts.timestamp_tag->accumulate_device_time(device.convert_device_timestamp_delta(start_ts, end_ts));
 			else
 				ts.timestamp_tag->accumulate_time(1e-9 * double(end_ts - start_ts));
 
@@ -2734,6 +3751,38 @@ void Device::PerFrame::begin()
 
 	managers.timestamps.mark_end_of_frame_context();
 	timestamp_intervals.clear();
+
+	if (!in_destructor)
+		resolve_gpu_scopes();
+	gpu_scopes.clear();
+}
+
+void Device::PerFrame::resolve_gpu_scopes()
+{
+	if (gpu_scopes.empty())
+		return;
+
+	int64_t base_ts = std::numeric_limits<int64_t>::max();
+	for (auto &scope : gpu_scopes)
+		if (scope.start_ts->is_signalled() && scope.end_ts->is_signalled())
+			base_ts = (std::min)(base_ts, int64_t(scope.start_ts->get_timestamp_ticks()));
+
+	if (base_ts == std::numeric_limits<int64_t>::max())
+		return;
+
+	managers.gpu_scopes.begin_frame();
+	for (auto &scope : gpu_scopes)
+	{
+		if (!scope.start_ts->is_signalled() || !scope.end_ts->is_signalled())
+			continue;
+
+		int64_t start_ts = scope.start_ts->get_timestamp_ticks();
+		int64_t end_ts = scope.end_ts->get_timestamp_ticks();
+		double start_ms = 1e3 * device.convert_device_timestamp_delta(base_ts, start_ts);
+		double end_ms = 1e3 * device.convert_device_timestamp_delta(base_ts, end_ts);
+		managers.gpu_scopes.add_scope(scope.queue, scope.depth, scope.name, start_ms, end_ms);
+	}
+	managers.gpu_scopes.end_frame();
 }
 
 Device::PerFrame::~PerFrame()
@@ -2773,6 +3822,7 @@ uint32_t Device::find_memory_type(BufferDomain domain, uint32_t mask) const
 		break;
 
 	case BufferDomain::LinkedDeviceHostPreferDevice:
+	case BufferDomain::LinkedDeviceHostReBAR:
 		prio[0] = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
 		prio[1] = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 		prio[2] = prio[1];
@@ -3356,6 +4406,7 @@ InitialImageBuffer Device::create_image_staging_buffer(const TextureFormatLayout
 	buffer_info.domain = BufferDomain::Host;
 	buffer_info.size = layout.get_required_size();
 	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	buffer_info.tag = AllocationTag::Staging;
 	result.buffer = create_buffer(buffer_info, nullptr);
 	set_name(*result.buffer, "image-upload-staging-buffer");
 
@@ -3382,105 +4433,449 @@ InitialImageBuffer Device::create_image_staging_buffer(const ImageCreateInfo &in
 	else
 		copy_levels = info.levels;
 
-	switch (info.type)
+	switch (info.type)
+	{
+	case VK_IMAGE_TYPE_1D:
+		layout.set_1d(info.format, info.width, info.layers, copy_levels);
+		break;
+	case VK_IMAGE_TYPE_2D:
+		layout.set_2d(info.format, info.width, info.height, info.layers, copy_levels);
+		break;
+	case VK_IMAGE_TYPE_3D:
+		layout.set_3d(info.format, info.width, info.height, info.depth, copy_levels);
+		break;
+	default:
+		return {};
+	}
+
+	BufferCreateInfo buffer_info = {};
+	buffer_info.domain = BufferDomain::Host;
+	buffer_info.size = layout.get_required_size();
+	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	buffer_info.tag = AllocationTag::Staging;
+	result.buffer = create_buffer(buffer_info, nullptr);
+	set_name(*result.buffer, "image-upload-staging-buffer");
+
+	// And now, do the actual copy.
+	auto *mapped = static_cast<uint8_t *>(map_host_buffer(*result.buffer, MEMORY_ACCESS_WRITE_BIT));
+	unsigned index = 0;
+
+	layout.set_buffer(mapped, layout.get_required_size());
+
+	for (unsigned level = 0; level < copy_levels; level++)
+	{
+		const auto &mip_info = layout.get_mip_info(level);
+		uint32_t dst_height_stride = layout.get_layer_size(level);
+		size_t row_size = layout.get_row_size(level);
+
+		for (unsigned layer = 0; layer < info.layers; layer++, index++)
+		{
+			uint32_t src_row_length =
+					initial[index].row_length ? initial[index].row_length : mip_info.row_length;
+			uint32_t src_array_height =
+					initial[index].image_height ? initial[index].image_height : mip_info.image_height;
+
+			uint32_t src_row_stride = layout.row_byte_stride(src_row_length);
+			uint32_t src_height_stride = layout.layer_byte_stride(src_array_height, src_row_stride);
+
+			uint8_t *dst = static_cast<uint8_t *>(layout.data(layer, level));
+			const uint8_t *src = static_cast<const uint8_t *>(initial[index].data);
+
+			for (uint32_t z = 0; z < mip_info.depth; z++)
+				for (uint32_t y = 0; y < mip_info.block_image_height; y++)
+					memcpy(dst + z * dst_height_stride + y * row_size, src + z * src_height_stride + y * src_row_stride, row_size);
+		}
+	}
+
+	unmap_host_buffer(*result.buffer, MEMORY_ACCESS_WRITE_BIT);
+	layout.build_buffer_image_copies(result.blits);
+	return result;
+}
+
+DeviceAllocationOwnerHandle Device::take_device_allocation_ownership(Image &image)
+{
+	if ((image.get_create_info().misc & IMAGE_MISC_FORCE_NO_DEDICATED_BIT) == 0)
+	{
+		LOGE("Must use FORCE_NO_DEDICATED_BIT to take ownership of memory.\n");
+		return DeviceAllocationOwnerHandle{};
+	}
+
+	if (!image.get_allocation().alloc || !image.get_allocation().base)
+		return DeviceAllocationOwnerHandle{};
+
+	return DeviceAllocationOwnerHandle(handle_pool.allocations.allocate(this, image.take_allocation_ownership()));
+}
+
+DeviceAllocationOwnerHandle Device::allocate_memory(const MemoryAllocateInfo &info)
+{
+	uint32_t index = find_memory_type(info.required_properties, info.requirements.memoryTypeBits);
+	if (index == UINT32_MAX)
+		return {};
+
+	DeviceAllocation alloc = {};
+	if (!managers.memory.allocate(info.requirements.size, info.requirements.alignment, info.mode, index, &alloc, info.tag))
+		return {};
+	return DeviceAllocationOwnerHandle(handle_pool.allocations.allocate(this, alloc));
+}
+
+void Device::get_memory_budget(HeapBudget *budget)
+{
+	managers.memory.get_memory_budget(budget);
+}
+
+void Device::get_memory_fragmentation_stats(uint32_t memory_type, MemoryFragmentationStats &stats)
+{
+	managers.memory.get_fragmentation_stats(memory_type, stats);
+}
+
+void Device::get_allocation_tag_stats(AllocationTagStats *stats)
+{
+	managers.memory.get_allocation_tag_stats(stats);
+}
+
+// Mini-heaps at or below this occupancy are evacuated, and moves must land in a denser heap.
+static constexpr float DefragmentSparseHeapOccupancy = 0.5f;
+
+void Device::init_resizable_bar()
+{
+	// Without resizable BAR, only a 256 MiB window of VRAM is host visible.
+	constexpr VkDeviceSize legacy_bar_size = 256ull * 1024 * 1024;
+
+	VkDeviceSize bar_heap_size = 0;
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++)
+	{
+		const uint32_t required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		if ((mem_props.memoryTypes[i].propertyFlags & required) == required)
+			bar_heap_size = std::max(bar_heap_size, mem_props.memoryHeaps[mem_props.memoryTypes[i].heapIndex].size);
+	}
+
+	// Leave most of VRAM to render targets and textures.
+	resizable_bar.budget = bar_heap_size > legacy_bar_size ? bar_heap_size / 8 : 0;
+	resizable_bar.allocated = 0;
+
+	if (const char *env = getenv("GRANITE_VULKAN_REBAR_BUDGET_MB"))
+		resizable_bar.budget = std::min<VkDeviceSize>(bar_heap_size, VkDeviceSize(strtoul(env, nullptr, 0)) * 1024 * 1024);
+
+	if (resizable_bar.budget)
+		LOGI("Resizable BAR: %u MiB budget for direct CPU writes.\n", unsigned(resizable_bar.budget / (1024 * 1024)));
+}
+
+bool Device::reserve_resizable_bar(VkDeviceSize size)
+{
+#ifdef GRANITE_VULKAN_MT
+	std::lock_guard<std::mutex> holder{resizable_bar.lock};
+#endif
+	if (resizable_bar.allocated + size > resizable_bar.budget)
+		return false;
+	resizable_bar.allocated += size;
+	return true;
+}
+
+void Device::release_resizable_bar(VkDeviceSize size)
+{
+#ifdef GRANITE_VULKAN_MT
+	std::lock_guard<std::mutex> holder{resizable_bar.lock};
+#endif
+	VK_ASSERT(resizable_bar.allocated >= size);
+	resizable_bar.allocated -= size;
+}
+
+void Device::register_movable_buffer(Buffer *buffer)
+{
+#ifdef GRANITE_VULKAN_MT
+	std::lock_guard<std::mutex> holder{movable_buffers.lock};
+#endif
+	movable_buffers.buffers.insert(buffer);
+}
+
+void Device::unregister_movable_buffer(Buffer *buffer)
+{
+#ifdef GRANITE_VULKAN_MT
+	std::lock_guard<std::mutex> holder{movable_buffers.lock};
+#endif
+	movable_buffers.buffers.erase(buffer);
+}
+
+bool Device::move_buffer_nolock(CommandBuffer &cmd, Buffer &buffer)
+{
+	const auto &old_alloc = buffer.alloc;
+
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.size = buffer.info.size;
+	info.usage = buffer.info.usage;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	uint32_t sharing_indices[QUEUE_INDEX_COUNT];
+	fill_buffer_sharing_indices(info, sharing_indices);
+
+	VkBuffer new_buffer;
+	if (table->vkCreateBuffer(device, &info, nullptr, &new_buffer) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements reqs;
+	table->vkGetBufferMemoryRequirements(device, new_buffer, &reqs);
+
+	DeviceAllocation allocation;
+	if ((reqs.memoryTypeBits & (1u << old_alloc.memory_type)) == 0 ||
+	    !managers.memory.allocate(reqs.size, reqs.alignment, old_alloc.mode, old_alloc.memory_type, &allocation,
+	                              old_alloc.tag))
+	{
+		table->vkDestroyBuffer(device, new_buffer, nullptr);
+		return false;
+	}
+
+	// Only worth it if we end up in a dense mini-heap, otherwise we just shuffle fragmentation around.
+	if (!allocation.alloc ||
+	    (allocation.alloc == old_alloc.alloc && allocation.heap == old_alloc.heap) ||
+	    managers.memory.get_heap_occupancy(allocation) <= DefragmentSparseHeapOccupancy)
+	{
+		allocation.free_immediate(managers.memory);
+		table->vkDestroyBuffer(device, new_buffer, nullptr);
+		return false;
+	}
+
+	if (table->vkBindBufferMemory(device, new_buffer, allocation.get_memory(), allocation.get_offset()) != VK_SUCCESS)
+	{
+		allocation.free_immediate(managers.memory);
+		table->vkDestroyBuffer(device, new_buffer, nullptr);
+		return false;
+	}
+
+	VkBufferCopy region = {};
+	region.size = buffer.info.size;
+	cmd.flush_barriers();
+	table->vkCmdCopyBuffer(cmd.get_command_buffer(), buffer.buffer, new_buffer, 1, &region);
+
+	// The old buffer is still in use by in-flight frames, so it goes through deferred destruction.
+	destroy_buffer_nolock(buffer.buffer);
+	free_memory_nolock(buffer.alloc);
+	buffer.replace_backing(new_buffer, allocation);
+	return true;
+}
+
+VkDeviceSize Device::defragment_memory(VkDeviceSize max_bytes)
+{
+	LOCK();
+	return defragment_memory_nolock(max_bytes);
+}
+
+void Device::set_defragmentation_budget(VkDeviceSize bytes_per_frame)
+{
+	LOCK();
+	movable_buffers.budget_per_frame = bytes_per_frame;
+}
+
+VkDeviceSize Device::defragment_memory_nolock(VkDeviceSize max_bytes)
+{
+#ifdef GRANITE_VULKAN_MT
+	std::lock_guard<std::mutex> holder{movable_buffers.lock};
+#endif
+
+	struct Candidate
 	{
-	case VK_IMAGE_TYPE_1D:
-		layout.set_1d(info.format, info.width, info.layers, copy_levels);
-		break;
-	case VK_IMAGE_TYPE_2D:
-		layout.set_2d(info.format, info.width, info.height, info.layers, copy_levels);
-		break;
-	case VK_IMAGE_TYPE_3D:
-		layout.set_3d(info.format, info.width, info.height, info.depth, copy_levels);
-		break;
-	default:
-		return {};
+		Buffer *buffer;
+		float occupancy;
+	};
+	std::vector<Candidate> candidates;
+
+	for (auto *buffer : movable_buffers.buffers)
+	{
+		float occupancy = managers.memory.get_heap_occupancy(buffer->alloc);
+		if (occupancy <= DefragmentSparseHeapOccupancy)
+			candidates.push_back({ buffer, occupancy });
 	}
 
-	BufferCreateInfo buffer_info = {};
-	buffer_info.domain = BufferDomain::Host;
-	buffer_info.size = layout.get_required_size();
-	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	result.buffer = create_buffer(buffer_info, nullptr);
-	set_name(*result.buffer, "image-upload-staging-buffer");
+	if (candidates.empty())
+		return 0;
 
-	// And now, do the actual copy.
-	auto *mapped = static_cast<uint8_t *>(map_host_buffer(*result.buffer, MEMORY_ACCESS_WRITE_BIT));
-	unsigned index = 0;
+	// Evacuate the emptiest mini-heaps first, they are the cheapest to free entirely.
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.occupancy < b.occupancy;
+	});
 
-	layout.set_buffer(mapped, layout.get_required_size());
+	auto cmd = request_command_buffer_nolock(get_thread_index(), CommandBuffer::Type::AsyncTransfer, false);
+	cmd->begin_region("defragment-memory");
 
-	for (unsigned level = 0; level < copy_levels; level++)
+	// Movable buffers are only written by their initial upload, which may have happened on this queue.
+	cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	VkDeviceSize moved = 0;
+	VkBufferUsageFlags usage = 0;
+	for (auto &candidate : candidates)
 	{
-		const auto &mip_info = layout.get_mip_info(level);
-		uint32_t dst_height_stride = layout.get_layer_size(level);
-		size_t row_size = layout.get_row_size(level);
+		VkDeviceSize size = candidate.buffer->info.size;
+		if (moved + size > max_bytes)
+			continue;
 
-		for (unsigned layer = 0; layer < info.layers; layer++, index++)
+		if (move_buffer_nolock(*cmd, *candidate.buffer))
 		{
-			uint32_t src_row_length =
-					initial[index].row_length ? initial[index].row_length : mip_info.row_length;
-			uint32_t src_array_height =
-					initial[index].image_height ? initial[index].image_height : mip_info.image_height;
+			moved += size;
+			usage |= candidate.buffer->info.usage;
+		}
+	}
 
-			uint32_t src_row_stride = layout.row_byte_stride(src_row_length);
-			uint32_t src_height_stride = layout.layer_byte_stride(src_array_height, src_row_stride);
+	cmd->end_region();
 
-			uint8_t *dst = static_cast<uint8_t *>(layout.data(layer, level));
-			const uint8_t *src = static_cast<const uint8_t *>(initial[index].data);
+	if (moved)
+		submit_staging(cmd, usage, true);
+	else
+		submit_discard_nolock(cmd);
 
-			for (uint32_t z = 0; z < mip_info.depth; z++)
-				for (uint32_t y = 0; y < mip_info.block_image_height; y++)
-					memcpy(dst + z * dst_height_stride + y * row_size, src + z * src_height_stride + y * src_row_stride, row_size);
+	return moved;
+}
+
+ImageHandle Device::create_image(const ImageCreateInfo &create_info, const ImageInitialData *initial)
+{
+#ifdef VK_EXT_host_image_copy
+	if (initial && image_supports_host_copy(create_info))
+	{
+		unsigned levels = create_info.levels ? create_info.levels :
+		                  TextureFormatLayout::num_miplevels(create_info.width, create_info.height, create_info.depth);
+		Util::SmallVector<VkMemoryToImageCopyEXT, 32> regions;
+		regions.reserve(levels * create_info.layers);
+		VkImageAspectFlags aspect = format_to_aspect_mask(create_info.format);
+
+		for (unsigned level = 0; level < levels; level++)
+		{
+			for (unsigned layer = 0; layer < create_info.layers; layer++)
+			{
+				auto &initial_data = initial[level * create_info.layers + layer];
+				VkMemoryToImageCopyEXT region = { VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT };
+				region.pHostPointer = initial_data.data;
+				region.memoryRowLength = initial_data.row_length;
+				region.memoryImageHeight = initial_data.image_height;
+				region.imageSubresource = { aspect, level, layer, 1 };
+				region.imageExtent.width = std::max(create_info.width >> level, 1u);
+				region.imageExtent.height = std::max(create_info.height >> level, 1u);
+				region.imageExtent.depth = std::max(create_info.depth >> level, 1u);
+				regions.push_back(region);
+			}
 		}
+
+		auto handle = create_image_host_copy(create_info, regions.data(), uint32_t(regions.size()));
+		if (handle)
+			return handle;
 	}
+#endif
 
-	unmap_host_buffer(*result.buffer, MEMORY_ACCESS_WRITE_BIT);
-	layout.build_buffer_image_copies(result.blits);
-	return result;
+	if (initial)
+	{
+		auto staging_buffer = create_image_staging_buffer(create_info, initial);
+		return create_image_from_staging_buffer(create_info, &staging_buffer);
+	}
+	else
+		return create_image_from_staging_buffer(create_info, nullptr);
 }
 
-DeviceAllocationOwnerHandle Device::take_device_allocation_ownership(Image &image)
+ImageHandle Device::create_image_from_host_copy(const ImageCreateInfo &create_info, const TextureFormatLayout &layout)
 {
-	if ((image.get_create_info().misc & IMAGE_MISC_FORCE_NO_DEDICATED_BIT) == 0)
+#ifdef VK_EXT_host_image_copy
+	if (!image_supports_host_copy(create_info))
+		return ImageHandle(nullptr);
+
+	Util::SmallVector<VkBufferImageCopy, 32> blits;
+	layout.build_buffer_image_copies(blits);
+
+	Util::SmallVector<VkMemoryToImageCopyEXT, 32> regions;
+	regions.reserve(blits.size());
+	for (auto &blit : blits)
 	{
-		LOGE("Must use FORCE_NO_DEDICATED_BIT to take ownership of memory.\n");
-		return DeviceAllocationOwnerHandle{};
+		VkMemoryToImageCopyEXT region = { VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT };
+		region.pHostPointer = static_cast<const uint8_t *>(layout.data()) + blit.bufferOffset;
+		region.memoryRowLength = blit.bufferRowLength;
+		region.memoryImageHeight = blit.bufferImageHeight;
+		region.imageSubresource = blit.imageSubresource;
+		region.imageOffset = blit.imageOffset;
+		region.imageExtent = blit.imageExtent;
+		regions.push_back(region);
 	}
 
-	if (!image.get_allocation().alloc || !image.get_allocation().base)
-		return DeviceAllocationOwnerHandle{};
-
-	return DeviceAllocationOwnerHandle(handle_pool.allocations.allocate(this, image.take_allocation_ownership()));
+	return create_image_host_copy(create_info, regions.data(), uint32_t(regions.size()));
+#else
+	(void)create_info;
+	(void)layout;
+	return ImageHandle(nullptr);
+#endif
 }
 
-DeviceAllocationOwnerHandle Device::allocate_memory(const MemoryAllocateInfo &info)
+#ifdef VK_EXT_host_image_copy
+bool Device::image_supports_host_copy(const ImageCreateInfo &create_info) const
 {
-	uint32_t index = find_memory_type(info.required_properties, info.requirements.memoryTypeBits);
-	if (index == UINT32_MAX)
-		return {};
+	if (!ext.supports_host_image_copy)
+		return false;
 
-	DeviceAllocation alloc = {};
-	if (!managers.memory.allocate(info.requirements.size, info.requirements.alignment, info.mode, index, &alloc))
-		return {};
-	return DeviceAllocationOwnerHandle(handle_pool.allocations.allocate(this, alloc));
-}
+	// Mip generation and exotic images still need a command buffer.
+	if (create_info.domain != ImageDomain::Physical ||
+	    (create_info.misc & (IMAGE_MISC_GENERATE_MIPS_BIT | IMAGE_MISC_SPARSE_RESIDENCY_BIT)) != 0 ||
+	    create_info.num_memory_aliases != 0 ||
+	    create_info.initial_layout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	{
+		return false;
+	}
 
-void Device::get_memory_budget(HeapBudget *budget)
-{
-	managers.memory.get_memory_budget(budget);
+	if (!image_format_is_supported(create_info.format, VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT,
+	                               VK_IMAGE_TILING_OPTIMAL))
+	{
+		return false;
+	}
+
+	// Host transfer usage can disable framebuffer compression on some implementations.
+	// Only take the path if the driver promises it does not hurt device access.
+	VkHostImageCopyDevicePerformanceQueryEXT perf = { VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT };
+	VkImageFormatProperties2 props2 = { VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2 };
+	props2.pNext = &perf;
+	if (!get_image_format_properties(create_info.format, create_info.type, VK_IMAGE_TILING_OPTIMAL,
+	                                 create_info.usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT,
+	                                 create_info.flags, &props2))
+	{
+		return false;
+	}
+
+	return perf.optimalDeviceAccess == VK_TRUE;
 }
 
-ImageHandle Device::create_image(const ImageCreateInfo &create_info, const ImageInitialData *initial)
+ImageHandle Device::create_image_host_copy(const ImageCreateInfo &create_info,
+                                           const VkMemoryToImageCopyEXT *regions, uint32_t count)
 {
-	if (initial)
+	auto info = create_info;
+	info.usage |= VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	auto handle = create_image_from_staging_buffer(info, nullptr);
+	if (!handle)
+		return handle;
+
+	VkHostImageLayoutTransitionInfoEXT transition = { VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT };
+	transition.image = handle->get_image();
+	transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	transition.newLayout = create_info.initial_layout;
+	transition.subresourceRange = {
+		format_to_aspect_mask(create_info.format), 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS,
+	};
+
+	if (table->vkTransitionImageLayoutEXT(device, 1, &transition) != VK_SUCCESS)
 	{
-		auto staging_buffer = create_image_staging_buffer(create_info, initial);
-		return create_image_from_staging_buffer(create_info, &staging_buffer);
+		LOGE("Failed to transition image layout on host.\n");
+		return ImageHandle(nullptr);
 	}
-	else
-		return create_image_from_staging_buffer(create_info, nullptr);
+
+	VkCopyMemoryToImageInfoEXT copy_info = { VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT };
+	copy_info.dstImage = handle->get_image();
+	copy_info.dstImageLayout = create_info.initial_layout;
+	copy_info.regionCount = count;
+	copy_info.pRegions = regions;
+
+	if (table->vkCopyMemoryToImageEXT(device, &copy_info) != VK_SUCCESS)
+	{
+		LOGE("Failed to copy memory to image on host.\n");
+		return ImageHandle(nullptr);
+	}
+
+	// The host writes become visible to the device on the next queue submission.
+	return handle;
 }
+#endif
 
 bool Device::allocate_image_memory(DeviceAllocation *allocation, const ImageCreateInfo &info,
                                    VkImage image, VkImageTiling tiling)
@@ -3593,7 +4988,8 @@ bool Device::allocate_image_memory(DeviceAllocation *allocation, const ImageCrea
 
 		if (!managers.memory.allocate_image_memory(reqs.size, reqs.alignment, mode, memory_type,
 		                                           allocation, image,
-		                                           (info.misc & IMAGE_MISC_FORCE_NO_DEDICATED_BIT) != 0))
+		                                           (info.misc & IMAGE_MISC_FORCE_NO_DEDICATED_BIT) != 0,
+		                                           info.tag))
 		{
 			LOGE("Failed to allocate image memory (type %u, size: %u).\n", unsigned(memory_type), unsigned(reqs.size));
 			return false;
@@ -3620,6 +5016,70 @@ static void add_unique_family(uint32_t *sharing_indices, uint32_t &count, uint32
 	sharing_indices[count++] = family;
 }
 
+bool Device::get_image_memory_requirements(const ImageCreateInfo &create_info, VkMemoryRequirements *reqs)
+{
+	if (create_info.domain != ImageDomain::Physical || (create_info.misc & IMAGE_MISC_SPARSE_RESIDENCY_BIT) != 0)
+		return false;
+
+	// Must mirror what create_image_from_staging_buffer() ends up passing to vkCreateImage.
+	VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	info.format = create_info.format;
+	info.extent = { create_info.width, create_info.height, create_info.depth };
+	info.imageType = create_info.type;
+	info.mipLevels = create_info.levels ? create_info.levels : image_num_miplevels(info.extent);
+	info.arrayLayers = create_info.layers;
+	info.samples = create_info.samples;
+	info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.usage = create_info.usage;
+	info.flags = create_info.flags;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	info.pNext = create_info.pnext;
+
+	VkImageFormatListCreateInfoKHR format_info = { VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO_KHR };
+	VkFormat view_formats[2];
+	format_info.pViewFormats = view_formats;
+	if (create_info.misc & IMAGE_MISC_MUTABLE_SRGB_BIT)
+	{
+		format_info.viewFormatCount = ImageCreateInfo::compute_view_formats(create_info, view_formats);
+		if (format_info.viewFormatCount != 0 && ext.supports_image_format_list)
+		{
+			format_info.pNext = info.pNext;
+			info.pNext = &format_info;
+		}
+	}
+
+	if ((create_info.usage & VK_IMAGE_USAGE_STORAGE_BIT) || (create_info.misc & IMAGE_MISC_MUTABLE_SRGB_BIT))
+		info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+
+	uint32_t sharing_indices[QUEUE_INDEX_COUNT];
+	uint32_t queue_flags = create_info.misc & (IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+	                                           IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT |
+	                                           IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
+	                                           IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT);
+	if (queue_flags & (IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT | IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT))
+		add_unique_family(sharing_indices, info.queueFamilyIndexCount, queue_info.family_indices[QUEUE_INDEX_GRAPHICS]);
+	if (queue_flags & IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT)
+		add_unique_family(sharing_indices, info.queueFamilyIndexCount, queue_info.family_indices[QUEUE_INDEX_COMPUTE]);
+	if (queue_flags & IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT)
+		add_unique_family(sharing_indices, info.queueFamilyIndexCount, queue_info.family_indices[QUEUE_INDEX_TRANSFER]);
+
+	if (info.queueFamilyIndexCount > 1)
+	{
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.pQueueFamilyIndices = sharing_indices;
+	}
+	else
+		info.queueFamilyIndexCount = 0;
+
+	VkImage image;
+	if (table->vkCreateImage(device, &info, nullptr, &image) != VK_SUCCESS)
+		return false;
+	table->vkGetImageMemoryRequirements(device, image, reqs);
+	table->vkDestroyImage(device, image, nullptr);
+	return true;
+}
+
 ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &create_info,
                                                      const InitialImageBuffer *staging_buffer)
 {
@@ -3736,6 +5196,20 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 	if ((create_info.misc & IMAGE_MISC_VERIFY_FORMAT_FEATURE_SAMPLED_LINEAR_FILTER_BIT) != 0)
 		check_extra_features |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
 
+	bool sparse = (create_info.misc & IMAGE_MISC_SPARSE_RESIDENCY_BIT) != 0;
+	if (sparse)
+	{
+		if (!supports_sparse_residency() || staging_buffer || info.tiling != VK_IMAGE_TILING_OPTIMAL ||
+		    info.imageType != VK_IMAGE_TYPE_2D || info.samples != VK_SAMPLE_COUNT_1_BIT ||
+		    create_info.domain != ImageDomain::Physical || create_info.num_memory_aliases != 0)
+		{
+			LOGE("Unsupported sparse image.\n");
+			return ImageHandle(nullptr);
+		}
+
+		info.flags |= VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT;
+	}
+
 	if (info.tiling == VK_IMAGE_TILING_LINEAR)
 	{
 		if (staging_buffer)
@@ -3778,7 +5252,18 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 		return ImageHandle(nullptr);
 	}
 
-	if (!allocate_image_memory(&holder.allocation, create_info, holder.image, info.tiling))
+	VkSparseImageMemoryRequirements sparse_reqs = {};
+	VkMemoryRequirements sparse_memory_reqs = {};
+	if (sparse)
+	{
+		if (!init_sparse_image_memory(&holder.allocation, holder.image, info.mipLevels, info.arrayLayers,
+		                              &sparse_reqs, &sparse_memory_reqs))
+		{
+			LOGE("Failed to initialize sparse image.\n");
+			return ImageHandle(nullptr);
+		}
+	}
+	else if (!allocate_image_memory(&holder.allocation, create_info, holder.image, info.tiling))
 	{
 		LOGE("Failed to allocate memory for image.\n");
 		return ImageHandle(nullptr);
@@ -3806,6 +5291,8 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 	if (handle)
 	{
 		holder.owned = false;
+		if (sparse)
+			handle->set_sparse_requirements(sparse_reqs, sparse_memory_reqs);
 		if (has_view)
 		{
 			handle->get_view().set_alt_views(holder.depth_view, holder.stencil_view);
@@ -3927,6 +5414,62 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 			add_wait_semaphore(CommandBuffer::Type::Generic, sem, dst_stages, true);
 		}
 
+#ifdef GRANITE_VULKAN_FILESYSTEM
+		// Storage capable images get all levels from one SPD dispatch per layer instead of a blit chain.
+		if (generate_mips && (create_info.usage & VK_IMAGE_USAGE_STORAGE_BIT) != 0 &&
+		    Granite::supports_compute_mipmap(*this, handle->get_create_info()))
+		{
+			VkImageMemoryBarrier barriers[2] = {};
+			for (auto &b : barriers)
+			{
+				b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				b.image = handle->get_image();
+				b.subresourceRange.aspectMask = format_to_aspect_mask(info.format);
+				b.subresourceRange.layerCount = info.arrayLayers;
+				b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			}
+
+			// Without the mipmap barrier, ownership of level 0 was acquired straight into TRANSFER_SRC.
+			barriers[0].oldLayout = need_mipmap_barrier ?
+			                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barriers[0].srcAccessMask = prepare_src_access;
+			barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barriers[0].subresourceRange.levelCount = 1;
+
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[1].subresourceRange.baseMipLevel = 1;
+			barriers[1].subresourceRange.levelCount = info.mipLevels - 1;
+
+			graphics_cmd->begin_region("mipgen-compute");
+			graphics_cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			                      0, nullptr, 0, nullptr, 2, barriers);
+
+			const Image *image = handle.get();
+			Granite::emit_compute_mipmaps(*graphics_cmd, &image, 1);
+
+			VkAccessFlags dst_access = handle->get_access_flags() &
+			                           image_layout_to_possible_access(create_info.initial_layout);
+			barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barriers[0].newLayout = create_info.initial_layout;
+			barriers[0].srcAccessMask = 0;
+			barriers[0].dstAccessMask = dst_access;
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barriers[1].newLayout = create_info.initial_layout;
+			barriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[1].dstAccessMask = dst_access;
+			graphics_cmd->barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, handle->get_stage_flags(),
+			                      0, nullptr, 0, nullptr, 2, barriers);
+			graphics_cmd->end_region();
+
+			generate_mips = false;
+			need_initial_barrier = false;
+		}
+#endif
+
 		if (generate_mips)
 		{
 			graphics_cmd->begin_region("mipgen");
@@ -4137,6 +5680,8 @@ BufferHandle Device::create_imported_host_buffer(const BufferCreateInfo &create_
 	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	info.size = create_info.size;
 	info.usage = create_info.usage;
+	if (descriptor_buffer)
+		info.usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	info.pNext = &external_info;
 
@@ -4195,6 +5740,14 @@ BufferHandle Device::create_imported_host_buffer(const BufferCreateInfo &create_
 	import.pHostPointer = host_buffer;
 	alloc_info.pNext = &import;
 
+	VkMemoryAllocateFlagsInfo flags_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO };
+	if (descriptor_buffer)
+	{
+		flags_info.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+		flags_info.pNext = alloc_info.pNext;
+		alloc_info.pNext = &flags_info;
+	}
+
 	VkDeviceMemory memory;
 	if (table->vkAllocateMemory(device, &alloc_info, nullptr, &memory) != VK_SUCCESS)
 	{
@@ -4217,7 +5770,9 @@ BufferHandle Device::create_imported_host_buffer(const BufferCreateInfo &create_
 		return BufferHandle{};
 	}
 
-	BufferHandle handle(handle_pool.buffers.allocate(this, buffer, allocation, create_info));
+	auto tmpinfo = create_info;
+	tmpinfo.usage = info.usage;
+	BufferHandle handle(handle_pool.buffers.allocate(this, buffer, allocation, tmpinfo));
 	return handle;
 }
 
@@ -4237,6 +5792,9 @@ BufferHandle Device::create_buffer(const BufferCreateInfo &create_info, const vo
 	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	info.size = create_info.size;
 	info.usage = create_info.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	// Descriptor buffers bind buffers by address.
+	if (descriptor_buffer)
+		info.usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 	uint32_t sharing_indices[QUEUE_INDEX_COUNT];
@@ -4247,46 +5805,65 @@ BufferHandle Device::create_buffer(const BufferCreateInfo &create_info, const vo
 
 	table->vkGetBufferMemoryRequirements(device, buffer, &reqs);
 
-	uint32_t memory_type = find_memory_type(create_info.domain, reqs.memoryTypeBits);
+	auto domain = create_info.domain;
+	if (domain == BufferDomain::LinkedDeviceHostReBAR && !reserve_resizable_bar(create_info.size))
+		domain = BufferDomain::Device;
+
+	uint32_t memory_type = find_memory_type(domain, reqs.memoryTypeBits);
 	if (memory_type == UINT32_MAX)
 	{
 		LOGE("Failed to find memory type.\n");
+		if (domain == BufferDomain::LinkedDeviceHostReBAR)
+			release_resizable_bar(create_info.size);
 		table->vkDestroyBuffer(device, buffer, nullptr);
 		return BufferHandle(nullptr);
 	}
 
+	if (domain == BufferDomain::LinkedDeviceHostReBAR && !memory_type_is_host_visible(memory_type))
+	{
+		release_resizable_bar(create_info.size);
+		domain = BufferDomain::Device;
+	}
+
 	AllocationMode mode;
-	if (create_info.domain == BufferDomain::Device &&
+	if (domain == BufferDomain::Device &&
 	    (create_info.usage & (VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) != 0)
 		mode = AllocationMode::LinearDeviceHighPriority;
-	else if (create_info.domain == BufferDomain::Device ||
-	         create_info.domain == BufferDomain::LinkedDeviceHostPreferDevice)
+	else if (domain == BufferDomain::Device ||
+	         domain == BufferDomain::LinkedDeviceHostPreferDevice ||
+	         domain == BufferDomain::LinkedDeviceHostReBAR)
 		mode = AllocationMode::LinearDevice;
 	else
 		mode = AllocationMode::LinearHostMappable;
 
-	if (!managers.memory.allocate(reqs.size, reqs.alignment, mode, memory_type, &allocation))
+	if (!managers.memory.allocate(reqs.size, reqs.alignment, mode, memory_type, &allocation, create_info.tag))
 	{
-		auto fallback_domain = create_info.domain;
+		auto fallback_domain = domain;
 
 		// This memory type is rather scarce, so fallback to Host type if we've exhausted this memory.
-		if (create_info.domain == BufferDomain::LinkedDeviceHost)
+		if (domain == BufferDomain::LinkedDeviceHost)
 		{
 			LOGW("Exhausted LinkedDeviceHost memory, falling back to host.\n");
 			fallback_domain = BufferDomain::Host;
 
 		}
-		else if (create_info.domain == BufferDomain::LinkedDeviceHostPreferDevice)
+		else if (domain == BufferDomain::LinkedDeviceHostPreferDevice)
 		{
 			LOGW("Exhausted LinkedDeviceHostPreferDevice memory, falling back to device.\n");
 			fallback_domain = BufferDomain::Device;
 		}
+		else if (domain == BufferDomain::LinkedDeviceHostReBAR)
+		{
+			LOGW("Exhausted LinkedDeviceHostReBAR memory, falling back to device.\n");
+			release_resizable_bar(create_info.size);
+			fallback_domain = BufferDomain::Device;
+		}
 
 		memory_type = find_memory_type(fallback_domain, reqs.memoryTypeBits);
 
 		if (memory_type == UINT32_MAX ||
-		    fallback_domain == create_info.domain ||
-		    !managers.memory.allocate(reqs.size, reqs.alignment, mode, memory_type, &allocation))
+		    fallback_domain == domain ||
+		    !managers.memory.allocate(reqs.size, reqs.alignment, mode, memory_type, &allocation, create_info.tag))
 		{
 			LOGE("Failed to allocate fallback memory.\n");
 			table->vkDestroyBuffer(device, buffer, nullptr);
@@ -4296,22 +5873,32 @@ BufferHandle Device::create_buffer(const BufferCreateInfo &create_info, const vo
 
 	if (table->vkBindBufferMemory(device, buffer, allocation.get_memory(), allocation.get_offset()) != VK_SUCCESS)
 	{
+		if (domain == BufferDomain::LinkedDeviceHostReBAR)
+			release_resizable_bar(create_info.size);
 		allocation.free_immediate(managers.memory);
 		table->vkDestroyBuffer(device, buffer, nullptr);
 		return BufferHandle(nullptr);
 	}
 
 	auto tmpinfo = create_info;
-	tmpinfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	tmpinfo.usage = info.usage;
+	// A ReBAR buffer which fell back reports Device, so callers know to stage their writes.
+	if (create_info.domain == BufferDomain::LinkedDeviceHostReBAR)
+		tmpinfo.domain = domain;
+	if (create_info.domain != BufferDomain::Device)
+		tmpinfo.misc &= ~BUFFER_MISC_MOVABLE_BIT;
 	BufferHandle handle(handle_pool.buffers.allocate(this, buffer, allocation, tmpinfo));
+	if (tmpinfo.misc & BUFFER_MISC_MOVABLE_BIT)
+		register_movable_buffer(handle.get());
 
-	if (create_info.domain == BufferDomain::Device && (initial || zero_initialize) && !memory_type_is_host_visible(memory_type))
+	if (domain == BufferDomain::Device && (initial || zero_initialize) && !memory_type_is_host_visible(memory_type))
 	{
 		CommandBufferHandle cmd;
 		if (initial)
 		{
 			auto staging_info = create_info;
 			staging_info.domain = BufferDomain::Host;
+			staging_info.tag = AllocationTag::Staging;
 			auto staging_buffer = create_buffer(staging_info, initial);
 			set_name(*staging_buffer, "buffer-upload-staging-buffer");
 
@@ -4516,6 +6103,8 @@ const RenderPass &Device::request_render_pass(const RenderPassInfo &info, bool c
 	h.data(formats, info.num_color_attachments * sizeof(VkFormat));
 	h.u32(info.num_color_attachments);
 	h.u32(depth_stencil);
+	h.u32(info.shading_rate ? info.shading_rate->get_format() : VK_FORMAT_UNDEFINED);
+	h.u32(info.shading_rate ? uint32_t(info.shading_rate->get_image().get_layout_type()) : 0u);
 
 	// Compatible render passes do not care about load/store, or image layouts.
 	if (!compatible)
@@ -4581,6 +6170,11 @@ unsigned Device::get_current_frame_context() const
 	return frame_context_index;
 }
 
+Util::FrameArena &Device::get_frame_arena()
+{
+	return frame().arena;
+}
+
 RenderPassInfo Device::get_swapchain_render_pass(SwapchainRenderPass style)
 {
 	RenderPassInfo info;
@@ -4623,6 +6217,12 @@ void Device::set_queue_lock(std::function<void()> lock_callback, std::function<v
 	queue_unlock_callback = move(unlock_callback);
 }
 
+void Device::get_queue_lock(std::function<void()> &lock_callback, std::function<void()> &unlock_callback) const
+{
+	lock_callback = queue_lock_callback;
+	unlock_callback = queue_unlock_callback;
+}
+
 void Device::set_name(const Buffer &buffer, const char *name)
 {
 	if (ext.supports_debug_utils)
@@ -4712,6 +6312,62 @@ bool Device::init_performance_counters(const std::vector<std::string> &names)
 	return true;
 }
 
+bool Device::init_performance_region_counters(const std::vector<std::string> &names)
+{
+	DRAIN_FRAME_LOCK();
+	wait_idle_nolock();
+
+	performance_regions_enabled = false;
+	bool enabled = false;
+	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+		if (&get_performance_query_pool(QueueIndices(i)) == &queue_data[i].performance_query_pool)
+			if (queue_data[i].performance_query_pool.init_region_counters(names))
+				enabled = true;
+
+	performance_regions_enabled = enabled;
+
+	// Prime the current frame context so recording can start right away.
+	if (enabled)
+		for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+			if (&get_performance_query_pool(QueueIndices(i)) == &queue_data[i].performance_query_pool)
+				queue_data[i].performance_query_pool.begin_region_frame(frame_context_index);
+
+	return enabled;
+}
+
+void Device::performance_region_log(const PerformanceRegionReportCallback &cb) const
+{
+	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+	{
+		auto &pool = queue_data[i].performance_query_pool;
+		if (pool.has_region_counters())
+			pool.report_regions(cb);
+	}
+}
+
+void Device::performance_region_log_reset()
+{
+	LOCK();
+	for (auto &data : queue_data)
+		data.performance_query_pool.reset_regions();
+}
+
+int Device::begin_performance_region(CommandBuffer::Type type, VkCommandBuffer cmd, const std::string &name)
+{
+	LOCK();
+	if (!performance_regions_enabled)
+		return -1;
+	auto &pool = get_performance_query_pool(get_physical_queue_type(type));
+	return pool.begin_region(cmd, frame().frame_index, name);
+}
+
+void Device::end_performance_region(CommandBuffer::Type type, VkCommandBuffer cmd, int index)
+{
+	LOCK();
+	auto &pool = get_performance_query_pool(get_physical_queue_type(type));
+	pool.end_region(cmd, frame().frame_index, index);
+}
+
 void Device::release_profiling()
 {
 	table->vkReleaseProfilingLockKHR(device);
@@ -4824,6 +6480,13 @@ PipelineEvent Device::begin_signal_event(VkPipelineStageFlags stages)
 {
 	auto event = request_pipeline_event();
 	event->set_stages(stages);
+
+	// Replays set the event again, so it has to be reset in between.
+	if (frame_capture.active)
+	{
+		LOCK();
+		frame_capture.events.push_back(event->get_event());
+	}
 	return event;
 }
 
@@ -4842,13 +6505,18 @@ ShaderManager &Device::get_shader_manager()
 #ifdef GRANITE_VULKAN_FILESYSTEM
 void Device::init_shader_manager_cache()
 {
-	if (!shader_manager.load_shader_cache("assets://shader_cache.json"))
+	// Prefer the binary caches, they are mapped and used in place.
+	if (!shader_manager.load_shader_cache("assets://shader_cache.bin") &&
+	    !shader_manager.load_shader_cache("cache://shader_cache.bin") &&
+	    !shader_manager.load_shader_cache("assets://shader_cache.json"))
+	{
 		shader_manager.load_shader_cache("cache://shader_cache.json");
+	}
 }
 
 void Device::flush_shader_manager_cache()
 {
-	shader_manager.save_shader_cache("cache://shader_cache.json");
+	shader_manager.save_shader_cache("cache://shader_cache.bin");
 }
 #endif
 
@@ -42,6 +42,7 @@
 #include <vector>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <stdio.h>
 
 #ifdef GRANITE_VULKAN_FILESYSTEM
@@ -49,9 +50,10 @@
 #include "texture_manager.hpp"
 #endif
 
-#ifdef GRANITE_VULKAN_MT
 #include <atomic>
 #include <mutex>
+
+#ifdef GRANITE_VULKAN_MT
 #include <condition_variable>
 #endif
 
@@ -61,6 +63,7 @@
 
 #include "quirks.hpp"
 #include "small_vector.hpp"
+#include "frame_arena.hpp"
 
 namespace Util
 {
@@ -81,12 +84,56 @@ enum class SwapchainRenderPass
 	DepthStencil
 };
 
+enum class StreamingRing
+{
+	Vertex,
+	Index,
+	Uniform,
+	Count
+};
+
 struct InitialImageBuffer
 {
 	BufferHandle buffer;
 	Util::SmallVector<VkBufferImageCopy, 32> blits;
 };
 
+// Running totals since device creation. Sample once per frame and take the difference.
+struct DeviceStatistics
+{
+	uint64_t queue_submissions = 0;
+	// Counted when the recording command buffer is submitted.
+	uint64_t draws = 0;
+	uint64_t dispatches = 0;
+	// Pipelines actually compiled, cache hits in Program are not counted.
+	uint64_t pipeline_compiles = 0;
+	// Descriptor sets which missed the per-frame set cache and had to be written.
+	uint64_t descriptor_set_allocations = 0;
+};
+
+// Fossilize replay of pipelines.json, see Device::get_pipeline_warmup_progress().
+struct PipelineWarmupProgress
+{
+	unsigned completed = 0;
+	unsigned total = 0;
+	bool done = true;
+};
+
+// Results of Device::replay_frame_capture(), in milliseconds of GPU time averaged over every replay.
+struct FrameReplayReport
+{
+	struct Pass
+	{
+		std::string tag;
+		double gpu_ms = 0.0;
+	};
+	// Device timestamps registered while capturing, with times of equal tags summed.
+	std::vector<Pass> passes;
+	double frame_gpu_ms = 0.0;
+	double min_frame_gpu_ms = 0.0;
+	unsigned iterations = 0;
+};
+
 struct HandlePool
 {
 	VulkanObjectPool<Buffer> buffers;
@@ -207,6 +254,7 @@ public:
 	friend class Shader;
 	friend class ImageResourceHolder;
 	friend class DeviceAllocationOwner;
+	friend class DeviceAllocator;
 	friend struct DeviceAllocationDeleter;
 
 	Device();
@@ -235,6 +283,18 @@ public:
 	                                          const VkPerformanceCounterKHR **counters,
 	                                          const VkPerformanceCounterDescriptionKHR **desc);
 
+	// Samples counters around CommandBuffer::begin_performance_region()/end_performance_region(),
+	// which RenderGraph uses for every physical pass. Counter sets which need several passes
+	// are split up and sampled over consecutive frame contexts.
+	// The profiling lock must be held (acquire_profiling()) while regions are recorded and submitted.
+	bool init_performance_region_counters(const std::vector<std::string> &names);
+	void performance_region_log(const PerformanceRegionReportCallback &cb = {}) const;
+	void performance_region_log_reset();
+	bool get_performance_regions_enabled() const
+	{
+		return performance_regions_enabled;
+	}
+
 	ImageView &get_swapchain_view();
 	ImageView &get_swapchain_view(unsigned index);
 	unsigned get_num_swapchain_images() const;
@@ -242,6 +302,10 @@ public:
 	unsigned get_swapchain_index() const;
 	unsigned get_current_frame_context() const;
 
+	// CPU scratch memory which is rewound when this frame context comes around again in next_frame_context().
+	// Allocations must not race with next_frame_context().
+	Util::FrameArena &get_frame_arena();
+
 	size_t get_pipeline_cache_size();
 	bool get_pipeline_cache_data(uint8_t *data, size_t size);
 	bool init_pipeline_cache(const uint8_t *data, size_t size);
@@ -315,6 +379,11 @@ public:
 	BufferHandle create_imported_host_buffer(const BufferCreateInfo &info, VkExternalMemoryHandleTypeFlagBits type, void *host_buffer);
 	ImageHandle create_image(const ImageCreateInfo &info, const ImageInitialData *initial = nullptr);
 	ImageHandle create_image_from_staging_buffer(const ImageCreateInfo &info, const InitialImageBuffer *buffer);
+	// Memory requirements of an optimally tiled image created from info, without allocating anything.
+	// Lets callers pack several images into one allocation through ImageCreateInfo::memory_aliases.
+	bool get_image_memory_requirements(const ImageCreateInfo &info, VkMemoryRequirements *reqs);
+	// Uploads with the CPU through VK_EXT_host_image_copy. Returns null if the image cannot take that path.
+	ImageHandle create_image_from_host_copy(const ImageCreateInfo &info, const TextureFormatLayout &layout);
 	LinearHostImageHandle create_linear_host_image(const LinearHostImageCreateInfo &info);
 	DeviceAllocationOwnerHandle take_device_allocation_ownership(Image &image);
 	DeviceAllocationOwnerHandle allocate_memory(const MemoryAllocateInfo &info);
@@ -365,6 +434,10 @@ public:
 	// For time being however, we'll support moving the payload over to the proxy object.
 	Semaphore request_proxy_semaphore();
 
+	// Creates another waitable handle for a timeline signal, e.g. one returned by submit(),
+	// so the same signal can be waited on by more than one queue.
+	Semaphore request_timeline_semaphore_as_binary(const SemaphoreHolder &holder, uint64_t value);
+
 	VkDevice get_device() const
 	{
 		return device;
@@ -386,6 +459,45 @@ public:
 	}
 
 	void get_memory_budget(HeapBudget *budget);
+	void get_memory_fragmentation_stats(uint32_t memory_type, MemoryFragmentationStats &stats);
+	// Fills in AllocationTag::Count entries.
+	void get_allocation_tag_stats(AllocationTagStats *stats);
+
+	// Incremental defragmentation of buffers created with BUFFER_MISC_MOVABLE_BIT.
+	// Moves up to max_bytes worth of buffers out of sparsely used mini-heaps with copies on the
+	// async transfer queue, so emptied mini-heaps can be returned to the driver over several frames.
+	// Must not race with command buffer recording which uses movable buffers; call it once per frame,
+	// e.g. right before next_frame_context(). Returns the number of bytes moved.
+	VkDeviceSize defragment_memory(VkDeviceSize max_bytes);
+	// With a non-zero budget, next_frame_context() calls defragment_memory() with it every frame.
+	// Disabled by default, GRANITE_VULKAN_DEFRAGMENT_BUDGET_KB sets an initial budget.
+	void set_defragmentation_budget(VkDeviceSize bytes_per_frame);
+
+	// With resizable BAR, (nearly) all of VRAM is host visible, so dynamic buffers can be written by the CPU directly.
+	// Buffers in BufferDomain::LinkedDeviceHostReBAR share this budget, past it they fall back to BufferDomain::Device.
+	// The budget can be overridden with GRANITE_VULKAN_REBAR_BUDGET_MB.
+	bool supports_resizable_bar() const
+	{
+		return resizable_bar.budget != 0;
+	}
+
+	VkDeviceSize get_resizable_bar_budget() const
+	{
+		return resizable_bar.budget;
+	}
+
+	// Ring allocation for CommandBuffer::allocate_{vertex,index,constant}_data.
+	// Each frame context gets one persistently mapped buffer of size bytes which is bumped atomically.
+	// Allocations which do not fit fall back to regular blocks. A size of 0 disables the ring.
+	// Requires host-coherent memory, returns false if the ring could not be enabled.
+	bool set_streaming_ring_size(StreamingRing ring, VkDeviceSize size);
+	BufferPoolRingStats get_streaming_ring_stats(StreamingRing ring);
+
+	// Number of vkQueueSubmit calls made so far. Deferred submissions count once flushed.
+	uint64_t get_queue_submission_count() const;
+	DeviceStatistics get_statistics() const;
+	// Summed over all frame contexts and queue types for one thread index.
+	CommandPoolStatistics get_command_pool_statistics(unsigned thread_index);
 
 	const Sampler &get_stock_sampler(StockSampler sampler) const;
 
@@ -400,6 +512,8 @@ public:
 	// lock the global device and queue.
 	void set_queue_lock(std::function<void ()> lock_callback,
 	                    std::function<void ()> unlock_callback);
+	void get_queue_lock(std::function<void ()> &lock_callback,
+	                    std::function<void ()> &unlock_callback) const;
 
 	const ImplementationWorkarounds &get_workarounds() const
 	{
@@ -428,6 +542,7 @@ public:
 	// - request_shader()
 	// - request_program()
 	// Generally, this should be called before you call next_frame_context().
+	// Cache lookups are lock-free regardless, so this is no longer required for scaling.
 	void promote_read_write_caches_to_read_only();
 
 	const Context::SystemHandles &get_system_handles() const
@@ -446,6 +561,81 @@ public:
 	void timestamp_log_reset();
 	void timestamp_log(const TimestampIntervalReportCallback &cb) const;
 
+	// Capture and replay of a single frame, for GPU benchmarks without CPU induced bubbles.
+	// Command buffers submitted between begin and end are recorded so they can be submitted again,
+	// work submitted before the capture's frame context began is dropped.
+	// A capture can be replayed until the next call to next_frame_context(), which keeps every
+	// resource of the frame alive. Each replay runs the batches in their original order, serialized
+	// across queues, and waits for completion so that device timestamps can be read back.
+	// Requires timeline semaphores and timestamp queries.
+	void begin_frame_capture();
+	void end_frame_capture();
+	bool replay_frame_capture(unsigned iterations, FrameReplayReport &report);
+
+	// Nested GPU scopes from CommandBuffer::begin_gpu_scope(), resolved when a frame context is recycled.
+	// Returns the scopes of the most recently resolved frame context, each with rolling
+	// statistics of its per-frame time.
+	void set_gpu_scopes_enabled(bool enable);
+	bool get_gpu_scopes_enabled() const;
+	void get_gpu_scope_events(std::vector<GpuScopeEvent> &events);
+
+	// When enabled, a graphics pipeline cache miss in CommandBuffer does not compile on the recording thread.
+	// The compile is handed to the thread group, and until it completes, draws use the program's
+	// fallback (Program::set_fallback_program()) or are skipped.
+	// Requires thread group support, otherwise pipelines keep compiling synchronously.
+	void set_asynchronous_pipeline_compile(bool enable);
+	bool get_asynchronous_pipeline_compile() const;
+	unsigned get_num_pending_pipeline_compiles() const;
+	void wait_pending_pipeline_compiles();
+
+	// Pipelines in the Fossilize database are replayed on the thread group, most frequently and
+	// most recently used first. With GRANITE_FOSSILIZE_BACKGROUND=1, device creation does not wait
+	// for the replay and pipelines which are not ready yet compile on demand as usual.
+	// Cancelling skips pipelines which have not started compiling.
+	PipelineWarmupProgress get_pipeline_warmup_progress() const;
+	void cancel_pipeline_warmup();
+	void wait_pipeline_warmup();
+
+	// VK_EXT_graphics_pipeline_library with fast linking. When supported, graphics pipeline misses
+	// link prebuilt vertex input, pre-rasterization, fragment shader and fragment output libraries,
+	// and the optimized monolithic pipeline is compiled on the thread group.
+	bool supports_graphics_pipeline_library_fast_link() const;
+
+	// Opt-in VK_KHR_dynamic_rendering path for CommandBuffer::begin_render_pass().
+	// Render passes with a single subpass skip VkRenderPass and VkFramebuffer creation entirely.
+	// Multi-subpass, multiview, secondary command buffer, swapchain and transient attachment passes
+	// keep using classic render passes, since tilers rely on them. Also enabled with GRANITE_VULKAN_DYNAMIC_RENDERING=1.
+	void set_dynamic_rendering_enabled(bool enable);
+	bool get_dynamic_rendering_enabled() const;
+
+	// Pixels covered by one texel of a RenderPassInfo::shading_rate attachment.
+	// Returns false if VK_KHR_fragment_shading_rate attachments are not supported.
+	bool get_shading_rate_texel_size(VkExtent2D *size) const;
+
+	// Defers vkQueueSubmit until the end of the frame context, or flush_deferred_submissions().
+	// Submissions are merged per VkQueue, so a frame usually ends up with one vkQueueSubmit per queue.
+	// Submissions which hand out a Fence are flushed right away, since the CPU may wait on them.
+	// Semaphores passed to external APIs need an explicit flush first.
+	// Requires timeline semaphores. Also enabled with GRANITE_VULKAN_DEFERRED_SUBMIT=1.
+	void set_deferred_submission_enabled(bool enable);
+	bool get_deferred_submission_enabled() const;
+	void flush_deferred_submissions();
+
+	// VK_EXT_descriptor_buffer backend for descriptor sets. Must be chosen before any layouts are created,
+	// so it is enabled with GRANITE_VULKAN_DESCRIPTOR_BUFFER=1 at device creation.
+	// CommandBuffer writes descriptors straight into per-frame, host-visible descriptor buffers,
+	// skipping descriptor set hashing and pool allocation. Programs with bindless sets, immutable samplers or
+	// texel buffers keep using descriptor sets.
+	bool uses_descriptor_buffer() const;
+
+	// Sparse residency for images created with IMAGE_MISC_SPARSE_RESIDENCY_BIT.
+	// Requires sparseResidencyImage2D, timeline semaphores and a queue with sparse binding support.
+	bool supports_sparse_residency() const;
+	// Changes page bindings on the sparse binding queue. The bind waits for all prior submissions on
+	// graphics, compute and transfer queues, and later submissions on those queues wait for the bind.
+	bool bind_sparse_image(const VkSparseImageMemoryBindInfo *image_binds, unsigned num_image_binds,
+	                       const VkSparseImageOpaqueMemoryBindInfo *opaque_binds, unsigned num_opaque_binds);
+
 private:
 	VkInstance instance = VK_NULL_HANDLE;
 	VkPhysicalDevice gpu = VK_NULL_HANDLE;
@@ -456,8 +646,18 @@ private:
 
 #ifdef GRANITE_VULKAN_MT
 	std::atomic<uint64_t> cookie;
+	std::atomic<uint64_t> queue_submission_count;
+	std::atomic<uint64_t> draw_count;
+	std::atomic<uint64_t> dispatch_count;
+	std::atomic<uint64_t> pipeline_compile_count;
+	std::atomic<uint64_t> descriptor_set_allocation_count;
 #else
 	uint64_t cookie = 0;
+	uint64_t queue_submission_count = 0;
+	uint64_t draw_count = 0;
+	uint64_t dispatch_count = 0;
+	uint64_t pipeline_compile_count = 0;
+	uint64_t descriptor_set_allocation_count = 0;
 #endif
 
 	uint64_t allocate_cookie();
@@ -466,7 +666,9 @@ private:
 	void request_vertex_block(BufferBlock &block, VkDeviceSize size);
 	void request_index_block(BufferBlock &block, VkDeviceSize size);
 	void request_uniform_block(BufferBlock &block, VkDeviceSize size);
+	void request_storage_block(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block(BufferBlock &block, VkDeviceSize size);
+	void request_descriptor_block(BufferBlock &block, VkDeviceSize size);
 
 	QueryPoolHandle write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage);
 
@@ -499,6 +701,13 @@ private:
 	QueryPoolHandle write_timestamp_nolock(VkCommandBuffer cmd, VkPipelineStageFlagBits stage);
 	QueryPoolHandle write_calibrated_timestamp_nolock();
 	void register_time_interval_nolock(std::string tid, QueryPoolHandle start_ts, QueryPoolHandle end_ts, std::string tag, std::string extra);
+	void register_gpu_scope(QueueIndices queue, unsigned depth, std::string name,
+	                        QueryPoolHandle start_ts, QueryPoolHandle end_ts);
+	bool gpu_scopes_enabled = false;
+
+	int begin_performance_region(CommandBuffer::Type type, VkCommandBuffer cmd, const std::string &name);
+	void end_performance_region(CommandBuffer::Type type, VkCommandBuffer cmd, int index);
+	bool performance_regions_enabled = false;
 
 	// Make sure this is deleted last.
 	HandlePool handle_pool;
@@ -522,8 +731,9 @@ private:
 		FenceManager fence;
 		SemaphoreManager semaphore;
 		EventManager event;
-		BufferPool vbo, ibo, ubo, staging;
+		BufferPool vbo, ibo, ubo, ssbo, staging, descriptor;
 		TimestampIntervalManager timestamps;
+		GpuScopeProfiler gpu_scopes;
 	};
 	Managers managers;
 
@@ -536,6 +746,134 @@ private:
 		unsigned counter = 0;
 	} lock;
 
+	struct
+	{
+#ifdef GRANITE_VULKAN_MT
+		mutable std::mutex lock;
+		std::condition_variable cond;
+		std::unordered_set<Util::Hash> in_flight;
+#endif
+		bool enabled = false;
+	} async_pipelines;
+	bool enqueue_graphics_pipeline_compile(const DeferredPipelineCompile &compile);
+
+	enum { GraphicsPipelineLibraryCount = 4 };
+
+	struct GraphicsPipelineLibrary : Util::IntrusiveHashMapEnabled<GraphicsPipelineLibrary>
+	{
+		explicit GraphicsPipelineLibrary(VkPipeline pipeline_)
+			: pipeline(pipeline_)
+		{
+		}
+
+		VkPipeline pipeline;
+		// Linked pipelines built from this library which are still waiting for their optimized variant.
+		unsigned users = 0;
+	};
+
+	struct LinkedGraphicsPipeline : Util::IntrusiveHashMapEnabled<LinkedGraphicsPipeline>
+	{
+		explicit LinkedGraphicsPipeline(VkPipeline pipeline_)
+			: pipeline(pipeline_)
+		{
+		}
+
+		VkPipeline pipeline;
+		Util::Hash libraries[GraphicsPipelineLibraryCount] = {};
+		// Libraries which were counted as users, a library evicted while linking is not.
+		uint32_t counted_libraries = 0;
+	};
+
+	// Linked pipelines only bridge the gap until the optimized pipeline lands in the program,
+	// so they are evicted along with libraries nothing else links against.
+	struct
+	{
+		std::mutex lock;
+		Util::IntrusiveHashMap<GraphicsPipelineLibrary> libraries;
+		Util::IntrusiveHashMap<LinkedGraphicsPipeline> linked;
+		bool enabled = false;
+	} graphics_pipeline_library;
+	void evict_fast_linked_graphics_pipeline(Util::Hash hash);
+	bool dynamic_rendering = false;
+	bool descriptor_buffer = false;
+
+	struct DeferredSubmission
+	{
+		std::vector<VkSemaphore> waits;
+		std::vector<uint64_t> wait_values;
+		std::vector<VkPipelineStageFlags> wait_stages;
+		std::vector<VkCommandBuffer> cmds;
+		std::vector<VkSemaphore> signals;
+		std::vector<uint64_t> signal_values;
+	};
+
+	struct
+	{
+		// Indexed by the first physical queue type which maps to a given VkQueue, so ordering is preserved
+		// when queue types alias.
+		std::vector<DeferredSubmission> submissions[QUEUE_INDEX_COUNT];
+		bool enabled = false;
+	} deferred_submit;
+	void defer_submission(VkQueue queue, const VkSubmitInfo &submit);
+	void flush_deferred_submissions_nolock();
+
+	struct
+	{
+		struct Batch
+		{
+			QueueIndices physical_type;
+			std::vector<VkCommandBuffer> cmds;
+		};
+		std::vector<Batch> batches;
+
+		struct Interval
+		{
+			std::string tag;
+			QueryPoolHandle start_ts;
+			QueryPoolHandle end_ts;
+		};
+		std::vector<Interval> intervals;
+		std::vector<VkEvent> events;
+		bool active = false;
+	} frame_capture;
+	bool replay_frame_capture_nolock(unsigned iterations, FrameReplayReport &report);
+
+	QueueIndices sparse_queue = QUEUE_INDEX_COUNT;
+	void init_sparse_queue();
+	bool bind_sparse_image_nolock(const VkSparseImageMemoryBindInfo *image_binds, unsigned num_image_binds,
+	                              const VkSparseImageOpaqueMemoryBindInfo *opaque_binds, unsigned num_opaque_binds);
+	bool init_sparse_image_memory(DeviceAllocation *allocation, VkImage image, uint32_t levels, uint32_t layers,
+	                              VkSparseImageMemoryRequirements *sparse_reqs, VkMemoryRequirements *reqs);
+
+	struct
+	{
+#ifdef GRANITE_VULKAN_MT
+		std::mutex lock;
+#endif
+		std::unordered_set<Buffer *> buffers;
+		VkDeviceSize budget_per_frame = 0;
+	} movable_buffers;
+	void register_movable_buffer(Buffer *buffer);
+	void unregister_movable_buffer(Buffer *buffer);
+	bool move_buffer_nolock(CommandBuffer &cmd, Buffer &buffer);
+	VkDeviceSize defragment_memory_nolock(VkDeviceSize max_bytes);
+
+	struct
+	{
+#ifdef GRANITE_VULKAN_MT
+		std::mutex lock;
+#endif
+		VkDeviceSize budget = 0;
+		VkDeviceSize allocated = 0;
+	} resizable_bar;
+	void init_resizable_bar();
+#ifdef VK_EXT_host_image_copy
+	bool image_supports_host_copy(const ImageCreateInfo &info) const;
+	ImageHandle create_image_host_copy(const ImageCreateInfo &info, const VkMemoryToImageCopyEXT *regions, uint32_t count);
+#endif
+	bool reserve_resizable_bar(VkDeviceSize size);
+	void release_resizable_bar(VkDeviceSize size);
+
 	struct PerFrame
 	{
 		PerFrame(Device *device, unsigned index);
@@ -556,11 +894,14 @@ private:
 		uint64_t timeline_fences[QUEUE_INDEX_COUNT] = {};
 
 		QueryPool query_pool;
+		Util::FrameArena arena;
 
 		std::vector<BufferBlock> vbo_blocks;
 		std::vector<BufferBlock> ibo_blocks;
 		std::vector<BufferBlock> ubo_blocks;
+		std::vector<BufferBlock> ssbo_blocks;
 		std::vector<BufferBlock> staging_blocks;
+		std::vector<BufferBlock> descriptor_blocks;
 
 		std::vector<VkFence> wait_fences;
 		std::vector<VkFence> recycle_fences;
@@ -598,6 +939,17 @@ private:
 		};
 		std::vector<TimestampIntervalHandles> timestamp_intervals;
 
+		struct GpuScopeHandles
+		{
+			std::string name;
+			QueryPoolHandle start_ts;
+			QueryPoolHandle end_ts;
+			QueueIndices queue;
+			unsigned depth;
+		};
+		std::vector<GpuScopeHandles> gpu_scopes;
+		void resolve_gpu_scopes();
+
 		bool in_destructor = false;
 	};
 	// The per frame structure must be destroyed after
@@ -627,6 +979,13 @@ private:
 		PerformanceQueryPool performance_query_pool;
 	} queue_data[QUEUE_INDEX_COUNT];
 
+	// When every queue operation signals a timeline, wait_idle only has to wait for the last value per queue.
+	// Work the timelines cannot see (presents) forces the next wait_idle through vkDeviceWaitIdle.
+	// Presents are flagged without the device lock, possibly from the WSI present thread.
+	bool timeline_wait_idle = false;
+	std::atomic_bool untracked_queue_work;
+	bool wait_queue_timelines_nolock();
+
 	struct InternalFence
 	{
 		VkFence fence;
@@ -640,6 +999,7 @@ private:
 		std::vector<BufferBlock> vbo;
 		std::vector<BufferBlock> ibo;
 		std::vector<BufferBlock> ubo;
+		std::vector<BufferBlock> ssbo;
 	} dma;
 
 	void submit_queue(QueueIndices physical_type, InternalFence *fence,
@@ -752,7 +1112,11 @@ private:
 	void request_vertex_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_index_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_uniform_block_nolock(BufferBlock &block, VkDeviceSize size);
+	void request_storage_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block_nolock(BufferBlock &block, VkDeviceSize size);
+	void request_descriptor_block_nolock(BufferBlock &block, VkDeviceSize size);
+	BufferPool &get_streaming_pool(StreamingRing ring);
+	bool allocate_streaming_ring(StreamingRing ring, VkDeviceSize size, BufferRingAllocation &alloc);
 
 	CommandBufferHandle request_secondary_command_buffer_for_thread(unsigned thread_index,
 	                                                                const Framebuffer *framebuffer,
@@ -788,6 +1152,7 @@ private:
 	void notify_replayed_resources_for_type() override;
 	VkPipeline fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGraphicsPipelineCreateInfo &info);
 	VkPipeline fossilize_create_compute_pipeline(Fossilize::Hash hash, VkComputePipelineCreateInfo &info);
+	VkPipeline fossilize_add_pipeline(Program *program, Fossilize::Hash hash, VkPipeline pipeline);
 
 	void register_graphics_pipeline(Fossilize::Hash hash, const VkGraphicsPipelineCreateInfo &info);
 	void register_compute_pipeline(Fossilize::Hash hash, const VkComputePipelineCreateInfo &info);
@@ -797,19 +1162,59 @@ private:
 	void register_shader_module(VkShaderModule module, Fossilize::Hash hash, const VkShaderModuleCreateInfo &info);
 	//void register_sampler(VkSampler sampler, Fossilize::Hash hash, const VkSamplerCreateInfo &info);
 
+	struct PendingPipeline
+	{
+		Fossilize::Hash hash;
+		const VkGraphicsPipelineCreateInfo *graphics;
+		const VkComputePipelineCreateInfo *compute;
+	};
+
 	struct
 	{
 		std::unordered_map<VkShaderModule, Shader *> shader_map;
 		std::unordered_map<VkRenderPass, RenderPass *> render_pass_map;
 		const Fossilize::FeatureFilter *feature_filter = nullptr;
+		// Owns the create infos which pending pipelines point into.
+		std::unique_ptr<Fossilize::StateReplayer> replayer;
+		std::vector<PendingPipeline> pending_pipelines;
 #ifdef GRANITE_VULKAN_MT
 		// Need to forward-declare the type, avoid the ref-counted wrapper.
 		Granite::TaskGroup *pipeline_group = nullptr;
 #endif
 	} replayer_state;
 
+	struct
+	{
+#ifdef GRANITE_VULKAN_MT
+		std::atomic_uint completed{0};
+		std::atomic_uint total{0};
+		std::atomic_bool cancel{false};
+#else
+		unsigned completed = 0;
+		unsigned total = 0;
+		bool cancel = false;
+#endif
+	} pipeline_warmup;
+
+	struct PipelineUsage
+	{
+		uint32_t sessions;
+		uint32_t last_session;
+	};
+
+	struct
+	{
+		std::unordered_map<Fossilize::Hash, PipelineUsage> entries;
+		uint32_t session = 0;
+	} pipeline_usage;
+
 	void init_pipeline_state(const Fossilize::FeatureFilter &filter);
 	void flush_pipeline_state();
+	void compile_pending_pipeline(const PendingPipeline &pending);
+	void poll_pipeline_warmup();
+	void end_pipeline_warmup();
+	void load_pipeline_usage();
+	void flush_pipeline_usage();
 #endif
 
 	ImplementationWorkarounds workarounds;
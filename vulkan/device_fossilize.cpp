@@ -23,11 +23,17 @@
 #include "device.hpp"
 #include "timer.hpp"
 #include "thread_group.hpp"
+#include <algorithm>
+#include <stdlib.h>
 
 using namespace std;
 
 namespace Vulkan
 {
+static constexpr uint32_t PipelineUsageMagic = 0x47505553;
+static constexpr uint32_t PipelineUsageVersion = 1;
+static constexpr uint32_t PipelineUsageMaxAge = 64;
+
 #if 0
 void Device::register_sampler(VkSampler sampler, Fossilize::Hash hash, const VkSamplerCreateInfo &info)
 {
@@ -94,14 +100,16 @@ bool Device::enqueue_create_shader_module(Fossilize::Hash hash, const VkShaderMo
 
 void Device::notify_replayed_resources_for_type()
 {
-#ifdef GRANITE_VULKAN_MT
-	if (replayer_state.pipeline_group)
-	{
-		replayer_state.pipeline_group->wait();
-		replayer_state.pipeline_group->release_reference();
-		replayer_state.pipeline_group = nullptr;
-	}
-#endif
+	// Pipelines are deferred until the whole archive is parsed, so they can be compiled in priority order.
+}
+
+VkPipeline Device::fossilize_add_pipeline(Program *program, Fossilize::Hash hash, VkPipeline pipeline)
+{
+	// With background warm-up, the application might have compiled the same pipeline in the meantime.
+	VkPipeline ret = program->add_pipeline(hash, pipeline, false);
+	if (ret != pipeline && pipeline != VK_NULL_HANDLE)
+		table->vkDestroyPipeline(device, pipeline, nullptr);
+	return ret;
 }
 
 VkPipeline Device::fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGraphicsPipelineCreateInfo &info)
@@ -124,6 +132,9 @@ VkPipeline Device::fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGr
 		return VK_NULL_HANDLE;
 
 	auto *ret = request_program(vertex_itr->second, fragment_itr->second);
+	VkPipeline existing = ret->get_pipeline(hash, false);
+	if (existing != VK_NULL_HANDLE)
+		return existing;
 
 	// The layout is dummy, resolve it here.
 	info.layout = ret->get_pipeline_layout()->get_layout();
@@ -138,7 +149,7 @@ VkPipeline Device::fossilize_create_graphics_pipeline(Fossilize::Hash hash, VkGr
 	VkResult res = table->vkCreateGraphicsPipelines(device, pipeline_cache, 1, &info, nullptr, &pipeline);
 	if (res != VK_SUCCESS)
 		LOGE("Failed to create graphics pipeline!\n");
-	return ret->add_pipeline(hash, pipeline);
+	return fossilize_add_pipeline(ret, hash, pipeline);
 }
 
 VkPipeline Device::fossilize_create_compute_pipeline(Fossilize::Hash hash, VkComputePipelineCreateInfo &info)
@@ -149,6 +160,9 @@ VkPipeline Device::fossilize_create_compute_pipeline(Fossilize::Hash hash, VkCom
 		return VK_NULL_HANDLE;
 
 	auto *ret = request_program(itr->second);
+	VkPipeline existing = ret->get_pipeline(hash, false);
+	if (existing != VK_NULL_HANDLE)
+		return existing;
 
 	// The layout is dummy, resolve it here.
 	info.layout = ret->get_pipeline_layout()->get_layout();
@@ -162,7 +176,7 @@ VkPipeline Device::fossilize_create_compute_pipeline(Fossilize::Hash hash, VkCom
 	VkResult res = table->vkCreateComputePipelines(device, pipeline_cache, 1, &info, nullptr, &pipeline);
 	if (res != VK_SUCCESS)
 		LOGE("Failed to create compute pipeline!\n");
-	return ret->add_pipeline(hash, pipeline);
+	return fossilize_add_pipeline(ret, hash, pipeline);
 }
 
 bool Device::enqueue_create_graphics_pipeline(Fossilize::Hash hash,
@@ -172,28 +186,11 @@ bool Device::enqueue_create_graphics_pipeline(Fossilize::Hash hash,
 	if (!replayer_state.feature_filter->graphics_pipeline_is_supported(create_info))
 		return false;
 
-#ifdef GRANITE_VULKAN_MT
-	if (!replayer_state.pipeline_group && get_system_handles().thread_group)
-		replayer_state.pipeline_group = get_system_handles().thread_group->create_task().release();
-
-	if (replayer_state.pipeline_group)
-	{
-		replayer_state.pipeline_group->enqueue_task([this, info = *create_info, hash, pipeline]() mutable {
-			*pipeline = fossilize_create_graphics_pipeline(hash, info);
-		});
-		return true;
-	}
-	else
-	{
-		auto info = *create_info;
-		*pipeline = fossilize_create_graphics_pipeline(hash, info);
-		return *pipeline != VK_NULL_HANDLE;
-	}
-#else
-	auto info = *create_info;
-	*pipeline = fossilize_create_graphics_pipeline(hash, info);
-	return *pipeline != VK_NULL_HANDLE;
-#endif
+	// Create infos are owned by the replayer, which is kept alive until warm-up completes.
+	replayer_state.pending_pipelines.push_back({ hash, create_info, nullptr });
+	// Nothing can derive from our pipelines, emit a dummy handle.
+	*pipeline = (VkPipeline) uint64_t(-1);
+	return true;
 }
 
 bool Device::enqueue_create_compute_pipeline(Fossilize::Hash hash,
@@ -203,28 +200,29 @@ bool Device::enqueue_create_compute_pipeline(Fossilize::Hash hash,
 	if (!replayer_state.feature_filter->compute_pipeline_is_supported(create_info))
 		return false;
 
-#ifdef GRANITE_VULKAN_MT
-	if (!replayer_state.pipeline_group && get_system_handles().thread_group)
-		replayer_state.pipeline_group = get_system_handles().thread_group->create_task().release();
+	replayer_state.pending_pipelines.push_back({ hash, nullptr, create_info });
+	*pipeline = (VkPipeline) uint64_t(-1);
+	return true;
+}
 
-	if (replayer_state.pipeline_group)
-	{
-		replayer_state.pipeline_group->enqueue_task([this, info = *create_info, hash, pipeline]() mutable {
-			*pipeline = fossilize_create_compute_pipeline(hash, info);
-		});
-		return true;
-	}
-	else
+void Device::compile_pending_pipeline(const PendingPipeline &pending)
+{
+	if (!pipeline_warmup.cancel)
 	{
-		auto info = *create_info;
-		*pipeline = fossilize_create_compute_pipeline(hash, info);
-		return *pipeline != VK_NULL_HANDLE;
+		if (pending.graphics)
+		{
+			auto info = *pending.graphics;
+			fossilize_create_graphics_pipeline(pending.hash, info);
+		}
+		else
+		{
+			auto info = *pending.compute;
+			fossilize_create_compute_pipeline(pending.hash, info);
+		}
 	}
-#else
-	auto info = *create_info;
-	*pipeline = fossilize_create_compute_pipeline(hash, info);
-	return *pipeline != VK_NULL_HANDLE;
-#endif
+
+	// Must be the last access to replayer state, poll_pipeline_warmup() tears it down once everything completed.
+	pipeline_warmup.completed++;
 }
 
 bool Device::enqueue_create_render_pass(Fossilize::Hash hash,
@@ -293,28 +291,208 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter)
 		return;
 	}
 
+	load_pipeline_usage();
+
 	LOGI("Replaying cached state.\n");
-	Fossilize::StateReplayer replayer;
+	replayer_state.replayer.reset(new Fossilize::StateReplayer);
 	auto start = Util::get_current_time_nsecs();
-	if (!replayer.parse(*this, nullptr, static_cast<const char *>(mapped), file->get_size()))
+	if (!replayer_state.replayer->parse(*this, nullptr, static_cast<const char *>(mapped), file->get_size()))
 		LOGE("Failed to parse Fossilize archive.\n");
 	auto end = Util::get_current_time_nsecs();
+	LOGI("Completed parsing cached state in %.3f ms.\n", (end - start) * 1e-6);
+
+	// Pipelines used in many sessions come first, ties are broken by how recently they were used.
+	// Pipelines without history keep archive order at the end.
+	auto &pending = replayer_state.pending_pipelines;
+	std::stable_sort(pending.begin(), pending.end(), [this](const PendingPipeline &a, const PendingPipeline &b) {
+		auto a_itr = pipeline_usage.entries.find(a.hash);
+		auto b_itr = pipeline_usage.entries.find(b.hash);
+		PipelineUsage a_usage = a_itr != pipeline_usage.entries.end() ? a_itr->second : PipelineUsage{};
+		PipelineUsage b_usage = b_itr != pipeline_usage.entries.end() ? b_itr->second : PipelineUsage{};
+		if (a_usage.sessions != b_usage.sessions)
+			return a_usage.sessions > b_usage.sessions;
+		return a_usage.last_session > b_usage.last_session;
+	});
+
+	pipeline_warmup.completed = 0;
+	pipeline_warmup.total = unsigned(pending.size());
+	pipeline_warmup.cancel = false;
+
+#ifdef GRANITE_VULKAN_MT
+	auto *thread_group = get_system_handles().thread_group;
+	if (thread_group && !pending.empty())
+	{
+		bool background = false;
+		if (const char *env = getenv("GRANITE_FOSSILIZE_BACKGROUND"))
+			background = strtoul(env, nullptr, 0) != 0;
+
+		auto group = thread_group->create_task();
+		group->set_desc("vulkan-fossilize-warmup");
+		// While loading, warm-up is all we do. In the background it must not compete with frame work.
+		group->set_priority(background ? Granite::TaskPriority::Background : Granite::TaskPriority::Normal);
+		for (auto &p : pending)
+			group->enqueue_task([this, &p]() { compile_pending_pipeline(p); });
+		group->flush();
+		replayer_state.pipeline_group = group.release();
+
+		if (background)
+		{
+			LOGI("Warming up %u pipelines in the background.\n", pipeline_warmup.total.load());
+			return;
+		}
+	}
+	else
+#endif
+	{
+		for (auto &p : pending)
+			compile_pending_pipeline(p);
+	}
+
+	wait_pipeline_warmup();
+	end = Util::get_current_time_nsecs();
 	LOGI("Completed replaying cached state in %.3f ms.\n", (end - start) * 1e-6);
+}
 
+void Device::end_pipeline_warmup()
+{
+#ifdef GRANITE_VULKAN_MT
 	if (replayer_state.pipeline_group)
 	{
 		replayer_state.pipeline_group->wait();
 		replayer_state.pipeline_group->release_reference();
 	}
+#endif
+
+	if (pipeline_warmup.cancel)
+	{
+		LOGI("Pipeline warm-up cancelled after %u of %u pipelines.\n",
+		     unsigned(pipeline_warmup.completed), unsigned(pipeline_warmup.total));
+	}
+
 	replayer_state = {};
 	promote_read_write_caches_to_read_only();
 }
 
+void Device::poll_pipeline_warmup()
+{
+	if (replayer_state.replayer && pipeline_warmup.completed == pipeline_warmup.total)
+		end_pipeline_warmup();
+}
+
+PipelineWarmupProgress Device::get_pipeline_warmup_progress() const
+{
+	PipelineWarmupProgress progress;
+	progress.completed = pipeline_warmup.completed;
+	progress.total = pipeline_warmup.total;
+	progress.done = progress.completed == progress.total;
+	return progress;
+}
+
+void Device::cancel_pipeline_warmup()
+{
+	pipeline_warmup.cancel = true;
+}
+
+void Device::wait_pipeline_warmup()
+{
+	if (replayer_state.replayer)
+		end_pipeline_warmup();
+}
+
+void Device::load_pipeline_usage()
+{
+	auto file = get_system_handles().filesystem->open("cache://pipelines_usage.bin", Granite::FileMode::ReadOnly);
+	if (!file)
+		return;
+
+	auto *mapped = static_cast<const uint32_t *>(file->map());
+	size_t size = file->get_size();
+	if (!mapped || size < 4 * sizeof(uint32_t))
+		return;
+
+	// Header is magic, version, session, count. Entries are a 64-bit hash, sessions used and the last session used.
+	if (mapped[0] != PipelineUsageMagic || mapped[1] != PipelineUsageVersion)
+	{
+		LOGW("Ignoring pipeline usage history with unknown format.\n");
+		return;
+	}
+
+	uint32_t count = mapped[3];
+	if (size < 4 * sizeof(uint32_t) + size_t(count) * 4 * sizeof(uint32_t))
+	{
+		LOGW("Pipeline usage history is truncated.\n");
+		return;
+	}
+
+	pipeline_usage.session = mapped[2];
+	const uint32_t *entry = mapped + 4;
+	for (uint32_t i = 0; i < count; i++, entry += 4)
+	{
+		Fossilize::Hash hash = entry[0] | (uint64_t(entry[1]) << 32);
+		pipeline_usage.entries[hash] = { entry[2], entry[3] };
+	}
+}
+
+void Device::flush_pipeline_usage()
+{
+	uint32_t session = ++pipeline_usage.session;
+
+	std::vector<Util::Hash> used;
+	for (auto &program : programs)
+		program.get_used_pipeline_hashes(used);
+
+	for (auto hash : used)
+	{
+		auto &usage = pipeline_usage.entries[hash];
+		usage.sessions++;
+		usage.last_session = session;
+	}
+
+	// Forget pipelines which have not been seen for a while so the history cannot grow without bounds.
+	for (auto itr = pipeline_usage.entries.begin(); itr != pipeline_usage.entries.end(); )
+	{
+		if (session - itr->second.last_session > PipelineUsageMaxAge)
+			itr = pipeline_usage.entries.erase(itr);
+		else
+			++itr;
+	}
+
+	auto file = get_system_handles().filesystem->open("cache://pipelines_usage.bin",
+	                                                  Granite::FileMode::WriteOnlyTransactional);
+	if (!file)
+		return;
+
+	size_t size = (4 + 4 * pipeline_usage.entries.size()) * sizeof(uint32_t);
+	auto *data = static_cast<uint32_t *>(file->map_write(size));
+	if (!data)
+	{
+		LOGE("Failed to serialize pipeline usage history.\n");
+		return;
+	}
+
+	data[0] = PipelineUsageMagic;
+	data[1] = PipelineUsageVersion;
+	data[2] = session;
+	data[3] = uint32_t(pipeline_usage.entries.size());
+	data += 4;
+	for (auto &entry : pipeline_usage.entries)
+	{
+		data[0] = uint32_t(entry.first);
+		data[1] = uint32_t(entry.first >> 32);
+		data[2] = entry.second.sessions;
+		data[3] = entry.second.last_session;
+		data += 4;
+	}
+	file->unmap();
+}
+
 void Device::flush_pipeline_state()
 {
 	if (!get_system_handles().filesystem)
 		return;
 
+	flush_pipeline_usage();
+
 	uint8_t *serialized = nullptr;
 	size_t serialized_size = 0;
 	if (!state_recorder.serialize(&serialized, &serialized_size))
@@ -50,6 +50,10 @@ static inline VkPipelineStageFlags image_usage_to_possible_stages(VkImageUsageFl
 		flags |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
 	if (usage & VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)
 		flags |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+#ifdef VK_KHR_fragment_shading_rate
+	if (usage & VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR)
+		flags |= VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR;
+#endif
 
 	if (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
 	{
@@ -82,6 +86,10 @@ static inline VkAccessFlags image_layout_to_possible_access(VkImageLayout layout
 		return VK_ACCESS_TRANSFER_READ_BIT;
 	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
 		return VK_ACCESS_TRANSFER_WRITE_BIT;
+#ifdef VK_KHR_fragment_shading_rate
+	case VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR:
+		return VK_ACCESS_FRAGMENT_SHADING_RATE_ATTACHMENT_READ_BIT_KHR;
+#endif
 	default:
 		return ~0u;
 	}
@@ -103,6 +111,10 @@ static inline VkAccessFlags image_usage_to_possible_access(VkImageUsageFlags usa
 		flags |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
 	if (usage & VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)
 		flags |= VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+#ifdef VK_KHR_fragment_shading_rate
+	if (usage & VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR)
+		flags |= VK_ACCESS_FRAGMENT_SHADING_RATE_ATTACHMENT_READ_BIT_KHR;
+#endif
 
 	// Transient attachments can only be attachments, and never other resources.
 	if (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
@@ -132,6 +144,10 @@ static inline VkFormatFeatureFlags image_usage_to_features(VkImageUsageFlags usa
 		flags |= VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
 	if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
 		flags |= VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+#ifdef VK_KHR_fragment_shading_rate
+	if (usage & VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR)
+		flags |= VK_FORMAT_FEATURE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR;
+#endif
 
 	return flags;
 }
@@ -155,7 +171,10 @@ enum ImageMiscFlagBits
 	IMAGE_MISC_VERIFY_FORMAT_FEATURE_SAMPLED_LINEAR_FILTER_BIT = 1 << 7,
 	IMAGE_MISC_LINEAR_IMAGE_IGNORE_DEVICE_LOCAL_BIT = 1 << 8,
 	IMAGE_MISC_FORCE_NO_DEDICATED_BIT = 1 << 9,
-	IMAGE_MISC_NO_DEFAULT_VIEWS_BIT = 1 << 10
+	IMAGE_MISC_NO_DEFAULT_VIEWS_BIT = 1 << 10,
+	// Creates a sparse resident image. Only the mip tail is backed by memory on creation,
+	// other pages are bound with Device::bind_sparse_image().
+	IMAGE_MISC_SPARSE_RESIDENCY_BIT = 1 << 11
 };
 using ImageMiscFlags = uint32_t;
 
@@ -324,6 +343,7 @@ struct ImageCreateInfo
 	unsigned num_memory_aliases = 0;
 	const ImmutableYcbcrConversion *ycbcr_conversion = nullptr;
 	void *pnext = nullptr;
+	AllocationTag tag = AllocationTag::Untagged;
 
 	static ImageCreateInfo immutable_image(const TextureFormatLayout &layout)
 	{
@@ -594,6 +614,28 @@ public:
 		return surface_transform;
 	}
 
+	// Only meaningful for images created with IMAGE_MISC_SPARSE_RESIDENCY_BIT.
+	bool is_sparse() const
+	{
+		return (create_info.misc & IMAGE_MISC_SPARSE_RESIDENCY_BIT) != 0;
+	}
+
+	const VkSparseImageMemoryRequirements &get_sparse_requirements() const
+	{
+		return sparse_requirements;
+	}
+
+	const VkMemoryRequirements &get_sparse_memory_requirements() const
+	{
+		return sparse_memory_requirements;
+	}
+
+	void set_sparse_requirements(const VkSparseImageMemoryRequirements &sparse_reqs, const VkMemoryRequirements &reqs)
+	{
+		sparse_requirements = sparse_reqs;
+		sparse_memory_requirements = reqs;
+	}
+
 private:
 	friend class Util::ObjectPool<Image>;
 
@@ -611,6 +653,8 @@ private:
 	VkAccessFlags access_flags = 0;
 	VkImageLayout swapchain_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 	VkSurfaceTransformFlagBitsKHR surface_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+	VkSparseImageMemoryRequirements sparse_requirements = {};
+	VkMemoryRequirements sparse_memory_requirements = {};
 	bool owns_image = true;
 	bool owns_memory_allocation = true;
 };
@@ -31,6 +31,10 @@
 #include <algorithm>
 #include <cstring>
 
+#ifdef GRANITE_VULKAN_THREAD_GROUP
+#include "thread_group.hpp"
+#endif
+
 using namespace std;
 using namespace Util;
 
@@ -87,6 +91,7 @@ bool ShaderTemplate::init()
 	if (!compiler->set_source_from_file(path))
 		return false;
 	compiler->set_include_directories(&include_directories);
+	compiler->set_include_cache(cache.include_cache.get());
 	if (!compiler->preprocess())
 	{
 		LOGE("Failed to pre-process shader: %s\n", path.c_str());
@@ -129,19 +134,21 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(const std::vector<
 		auto *variant = variants.allocate();
 		variant->hash = complete_hash;
 
-		auto *precompiled_spirv = cache.variant_to_shader.find(complete_hash);
+		Util::Hash precompiled_source_hash = 0;
+		Util::Hash precompiled_shader_hash = 0;
+		bool precompiled_spirv = cache.find_variant(complete_hash, precompiled_source_hash, precompiled_shader_hash);
 
 		if (precompiled_spirv)
 		{
-			if (!device->request_shader_by_hash(precompiled_spirv->shader_hash))
+			if (!device->request_shader_by_hash(precompiled_shader_hash))
 			{
 				LOGW("Got precompiled SPIR-V hash for variant, but it does not exist, is Fossilize archive incomplete?\n");
-				precompiled_spirv = nullptr;
+				precompiled_spirv = false;
 			}
-			else if (source_hash != precompiled_spirv->source_hash)
+			else if (source_hash != precompiled_source_hash)
 			{
 				LOGW("Source hash is invalidated for %s, recompiling.\n", path.c_str());
-				precompiled_spirv = nullptr;
+				precompiled_spirv = false;
 			}
 		}
 
@@ -199,7 +206,7 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(const std::vector<
 #endif
 		}
 		else
-			variant->spirv_hash = precompiled_spirv->shader_hash;
+			variant->spirv_hash = precompiled_shader_hash;
 
 		variant->instance++;
 		if (defines)
@@ -214,21 +221,17 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(const std::vector<
 }
 
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
-void ShaderTemplate::recompile_variant(ShaderTemplateVariant &variant)
+void ShaderTemplate::recompile_variant(Recompile &job, unsigned index) const
 {
+	auto &variant = *job.variants[index];
 	std::string error_message;
-	auto newspirv = compiler->compile(error_message, &variant.defines);
-	if (newspirv.empty())
+	job.spirv[index] = job.compiler->compile(error_message, &variant.defines);
+	if (job.spirv[index].empty())
 	{
 		LOGE("Failed to compile shader: %s\n%s\n", path.c_str(), error_message.c_str());
 		for (auto &define : variant.defines)
 			LOGE("  Define: %s = %d\n", define.first.c_str(), define.second);
-		return;
 	}
-
-	variant.spirv = move(newspirv);
-	variant.instance++;
-	update_variant_cache(variant);
 }
 
 void ShaderTemplate::update_variant_cache(const ShaderTemplateVariant &variant)
@@ -246,33 +249,68 @@ void ShaderTemplate::update_variant_cache(const ShaderTemplateVariant &variant)
 	cache.shader_to_layout.emplace_yield(shader_hash, layout);
 }
 
-void ShaderTemplate::recompile()
+std::unique_ptr<ShaderTemplate::Recompile> ShaderTemplate::prepare_recompile()
 {
-	// Recompile all variants.
 	if (!device->get_system_handles().filesystem)
-		return;
+		return {};
 	auto newcompiler = make_unique<Granite::GLSLCompiler>(*device->get_system_handles().filesystem);
 	newcompiler->set_target(Granite::Target::Vulkan11);
 	if (!newcompiler->set_source_from_file(path))
-		return;
+		return {};
 	newcompiler->set_include_directories(&include_directories);
+	newcompiler->set_include_cache(cache.include_cache.get());
 	if (!newcompiler->preprocess())
 	{
 		LOGE("Failed to preprocess updated shader: %s\n", path.c_str());
-		return;
+		return {};
 	}
-	compiler = move(newcompiler);
-	source_hash = compiler->get_source_hash();
 
-#ifdef GRANITE_VULKAN_MT
-	for (auto &variant : variants.get_read_only())
-		recompile_variant(variant);
-	for (auto &variant : variants.get_read_write())
-		recompile_variant(variant);
-#else
+	auto job = make_unique<Recompile>();
+	job->shader = this;
+	job->generation = ++recompile_generation;
+	job->compiler = move(newcompiler);
+
 	for (auto &variant : variants)
-		recompile_variant(variant);
-#endif
+		job->variants.push_back(&variant);
+
+	job->spirv.resize(job->variants.size());
+	return job;
+}
+
+bool ShaderTemplate::commit_recompile(Recompile &job)
+{
+	// A newer change to the same shader is already on its way.
+	if (job.generation != recompile_generation)
+		return false;
+
+	compiler = move(job.compiler);
+	source_hash = compiler->get_source_hash();
+
+	// Variants which failed to compile keep their old SPIR-V.
+	for (size_t i = 0, n = job.variants.size(); i < n; i++)
+	{
+		if (job.spirv[i].empty())
+			continue;
+
+		auto &variant = *job.variants[i];
+		variant.spirv = move(job.spirv[i]);
+		variant.instance++;
+		update_variant_cache(variant);
+	}
+
+	return true;
+}
+
+void ShaderTemplate::recompile()
+{
+	// Recompile all variants.
+	auto job = prepare_recompile();
+	if (!job)
+		return;
+
+	for (unsigned i = 0, n = unsigned(job->variants.size()); i < n; i++)
+		recompile_variant(*job, i);
+	commit_recompile(*job);
 }
 
 void ShaderTemplate::register_dependencies(ShaderManager &manager)
@@ -510,12 +548,24 @@ ShaderProgram *ShaderManager::register_graphics(const std::string &vertex, const
 	return ret;
 }
 
+ShaderManager::ShaderManager(Device *device_)
+	: device(device_)
+{
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	meta_cache.include_cache.reset(new Granite::GLSLIncludeCache);
+#endif
+}
+
 ShaderManager::~ShaderManager()
 {
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	for (auto &dir : directory_watches)
 		if (dir.second.backend)
 			dir.second.backend->uninstall_notification(dir.second.handle);
+#ifdef GRANITE_VULKAN_MT
+	// Background compiles still reference templates and variants.
+	wait_pending_recompiles();
+#endif
 #endif
 }
 
@@ -538,13 +588,117 @@ void ShaderManager::recompile(const Granite::FileNotifyInfo &info)
 	if (info.type == Granite::FileNotifyType::FileDeleted)
 		return;
 
+	std::vector<std::unique_ptr<ShaderTemplate::Recompile>> jobs;
 	auto &deps = dependees[info.path];
 	for (auto &dep : deps)
+		if (auto job = dep->prepare_recompile())
+			jobs.push_back(move(job));
+
+	if (jobs.empty() || enqueue_recompile(jobs))
+		return;
+
+	// No thread group, compile synchronously like before.
+	for (auto &job : jobs)
+	{
+		for (unsigned i = 0, n = unsigned(job->variants.size()); i < n; i++)
+			job->shader->recompile_variant(*job, i);
+		if (job->shader->commit_recompile(*job))
+			job->shader->register_dependencies(*this);
+	}
+}
+
+bool ShaderManager::enqueue_recompile(std::vector<std::unique_ptr<ShaderTemplate::Recompile>> &jobs)
+{
+#if defined(GRANITE_VULKAN_MT) && defined(GRANITE_VULKAN_THREAD_GROUP)
+	auto *group = device->get_system_handles().thread_group;
+	if (!group)
+		return false;
+
+	auto pending = make_unique<PendingRecompile>();
+	pending->shaders = move(jobs);
+	pending->completed.store(0, std::memory_order_relaxed);
+	for (auto &job : pending->shaders)
+		pending->total += unsigned(job->variants.size());
+
+	LOGI("Recompiling %u shader variants in the background.\n", pending->total);
+
+	auto task = group->create_task();
+	task->set_desc("shader-recompile");
+	task->set_priority(Granite::TaskPriority::Background);
+
+	auto *p = pending.get();
+	for (auto &job : p->shaders)
+	{
+		for (unsigned i = 0, n = unsigned(job->variants.size()); i < n; i++)
+		{
+			auto *j = job.get();
+			task->enqueue_task([this, p, j, i]() {
+				j->shader->recompile_variant(*j, i);
+				std::lock_guard<std::mutex> holder{recompile_lock};
+				p->completed.fetch_add(1, std::memory_order_release);
+				recompile_cond.notify_all();
+			});
+		}
+	}
+
+	pending_recompiles.push_back(move(pending));
+	task->flush();
+	return true;
+#else
+	(void)jobs;
+	return false;
+#endif
+}
+
+void ShaderManager::flush_pending_recompiles()
+{
+#ifdef GRANITE_VULKAN_MT
+	DEPENDENCY_LOCK();
+
+	// Keep changes in order, a later change must not be overwritten by an earlier one.
+	auto itr = pending_recompiles.begin();
+	for (; itr != pending_recompiles.end(); ++itr)
+	{
+		auto &pending = **itr;
+		if (pending.completed.load(std::memory_order_acquire) != pending.total)
+			break;
+
+		for (auto &job : pending.shaders)
+			if (job->shader->commit_recompile(*job))
+				job->shader->register_dependencies(*this);
+
+		LOGI("Swapped in %u recompiled shader variants.\n", pending.total);
+	}
+	pending_recompiles.erase(pending_recompiles.begin(), itr);
+#endif
+}
+
+ShaderRecompileProgress ShaderManager::get_recompile_progress()
+{
+	ShaderRecompileProgress progress = {};
+#ifdef GRANITE_VULKAN_MT
+	DEPENDENCY_LOCK();
+	for (auto &pending : pending_recompiles)
 	{
-		dep->recompile();
-		dep->register_dependencies(*this);
+		progress.pending_variants += pending->total;
+		progress.completed_variants += pending->completed.load(std::memory_order_relaxed);
 	}
+#endif
+	return progress;
+}
+
+#ifdef GRANITE_VULKAN_MT
+void ShaderManager::wait_pending_recompiles()
+{
+	std::unique_lock<std::mutex> holder{recompile_lock};
+	recompile_cond.wait(holder, [this]() {
+		for (auto &pending : pending_recompiles)
+			if (pending->completed.load(std::memory_order_relaxed) != pending->total)
+				return false;
+		return true;
+	});
 }
+#endif
 
 void ShaderManager::add_directory_watch(const std::string &source)
 {
@@ -578,30 +732,65 @@ void ShaderManager::register_shader_from_variant_hash(Hash variant_hash,
 	meta_cache.shader_to_layout.emplace_replace(shader_hash, layout);
 }
 
-bool ShaderManager::get_shader_hash_by_variant_hash(Hash variant_hash, Hash &shader_hash) const
+bool MetaCache::find_variant(Hash variant_hash, Hash &source_hash, Hash &shader_hash) const
 {
-	auto *shader = meta_cache.variant_to_shader.find(variant_hash);
-	if (shader)
+	if (auto *shader = variant_to_shader.find(variant_hash))
 	{
+		source_hash = shader->source_hash;
 		shader_hash = shader->shader_hash;
 		return true;
 	}
+
+	auto *end_variant = mapped_variants + num_mapped_variants;
+	auto *itr = std::lower_bound(mapped_variants, end_variant, variant_hash,
+	                             [](const ShaderCacheVariant &entry, Hash hash) {
+		                             return entry.variant_hash < hash;
+	                             });
+
+	if (itr != end_variant && itr->variant_hash == variant_hash)
+	{
+		source_hash = itr->source_hash;
+		shader_hash = itr->shader_hash;
+		return true;
+	}
 	else
 		return false;
 }
 
-bool ShaderManager::get_resource_layout_by_shader_hash(Util::Hash shader_hash, ResourceLayout &layout) const
+bool MetaCache::find_layout(Hash shader_hash, ResourceLayout &layout) const
 {
-	auto *shader = meta_cache.shader_to_layout.find(shader_hash);
-	if (shader)
+	if (auto *shader = shader_to_layout.find(shader_hash))
 	{
 		layout = shader->get();
 		return true;
 	}
+
+	auto *end_layout = mapped_layouts + num_mapped_layouts;
+	auto *itr = std::lower_bound(mapped_layouts, end_layout, shader_hash,
+	                             [](const ShaderCacheLayout &entry, Hash hash) {
+		                             return entry.shader_hash < hash;
+	                             });
+
+	if (itr != end_layout && itr->shader_hash == shader_hash)
+	{
+		layout = itr->layout;
+		return true;
+	}
 	else
 		return false;
 }
 
+bool ShaderManager::get_shader_hash_by_variant_hash(Hash variant_hash, Hash &shader_hash) const
+{
+	Hash source_hash;
+	return meta_cache.find_variant(variant_hash, source_hash, shader_hash);
+}
+
+bool ShaderManager::get_resource_layout_by_shader_hash(Util::Hash shader_hash, ResourceLayout &layout) const
+{
+	return meta_cache.find_layout(shader_hash, layout);
+}
+
 void ShaderManager::add_include_directory(const string &path)
 {
 	if (find(begin(include_directories), end(include_directories), path) == end(include_directories))
@@ -685,11 +874,125 @@ static rapidjson::Value serialize_resource_layout(const ResourceLayout &layout,
 	return layout_obj;
 }
 
+static constexpr uint32_t ShaderCacheMagic = 0x43485347u; // 'GSHC'
+
+bool ShaderManager::load_binary_shader_cache(const string &path)
+{
+	auto file = device->get_system_handles().filesystem->open(path);
+	if (!file)
+		return false;
+
+	size_t size = file->get_size();
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped || size < sizeof(ShaderCacheHeader))
+	{
+		LOGE("Failed to map shader cache %s.\n", path.c_str());
+		return false;
+	}
+
+	ShaderCacheHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	if (header.magic != ShaderCacheMagic)
+	{
+		LOGE("Invalid shader cache magic in %s.\n", path.c_str());
+		return false;
+	}
+
+	if (header.version != ResourceLayout::Version || header.layout_size != sizeof(ResourceLayout))
+	{
+		LOGE("Incompatible shader cache version %u != %u.\n", header.version, ResourceLayout::Version);
+		return false;
+	}
+
+	size_t variants_size = size_t(header.num_variants) * sizeof(ShaderCacheVariant);
+	size_t layouts_size = size_t(header.num_layouts) * sizeof(ShaderCacheLayout);
+	if (sizeof(header) + variants_size + layouts_size > size)
+	{
+		LOGE("Shader cache %s is truncated.\n", path.c_str());
+		return false;
+	}
+
+	// Only one mapped cache is used at a time.
+	meta_cache.mapped_variants = reinterpret_cast<const ShaderCacheVariant *>(mapped + sizeof(header));
+	meta_cache.mapped_layouts = reinterpret_cast<const ShaderCacheLayout *>(mapped + sizeof(header) + variants_size);
+	meta_cache.num_mapped_variants = header.num_variants;
+	meta_cache.num_mapped_layouts = header.num_layouts;
+	mapped_cache = move(file);
+
+	LOGI("Mapped shader manager cache from %s.\n", path.c_str());
+	return true;
+}
+
+bool ShaderManager::save_binary_shader_cache(const string &path)
+{
+	vector<ShaderCacheVariant> cache_variants;
+	vector<ShaderCacheLayout> cache_layouts;
+
+	// Entries from the hash maps are newer than what we have mapped, so they go first and win on ties.
+	for (auto &entry : meta_cache.variant_to_shader)
+		cache_variants.push_back({ entry.get_hash(), entry.source_hash, entry.shader_hash });
+	for (auto &entry : meta_cache.shader_to_layout)
+		cache_layouts.push_back({ entry.get_hash(), entry.get() });
+	cache_variants.insert(cache_variants.end(), meta_cache.mapped_variants,
+	                      meta_cache.mapped_variants + meta_cache.num_mapped_variants);
+	cache_layouts.insert(cache_layouts.end(), meta_cache.mapped_layouts,
+	                     meta_cache.mapped_layouts + meta_cache.num_mapped_layouts);
+
+	stable_sort(cache_variants.begin(), cache_variants.end(), [](const ShaderCacheVariant &a, const ShaderCacheVariant &b) {
+		return a.variant_hash < b.variant_hash;
+	});
+	cache_variants.erase(unique(cache_variants.begin(), cache_variants.end(), [](const ShaderCacheVariant &a, const ShaderCacheVariant &b) {
+		return a.variant_hash == b.variant_hash;
+	}), cache_variants.end());
+
+	stable_sort(cache_layouts.begin(), cache_layouts.end(), [](const ShaderCacheLayout &a, const ShaderCacheLayout &b) {
+		return a.shader_hash < b.shader_hash;
+	});
+	cache_layouts.erase(unique(cache_layouts.begin(), cache_layouts.end(), [](const ShaderCacheLayout &a, const ShaderCacheLayout &b) {
+		return a.shader_hash == b.shader_hash;
+	}), cache_layouts.end());
+
+	ShaderCacheHeader header = {};
+	header.magic = ShaderCacheMagic;
+	header.version = ResourceLayout::Version;
+	header.layout_size = sizeof(ResourceLayout);
+	header.num_variants = uint32_t(cache_variants.size());
+	header.num_layouts = uint32_t(cache_layouts.size());
+
+	size_t variants_size = cache_variants.size() * sizeof(ShaderCacheVariant);
+	size_t layouts_size = cache_layouts.size() * sizeof(ShaderCacheLayout);
+
+	auto file = device->get_system_handles().filesystem->open(path, Granite::FileMode::WriteOnlyTransactional);
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto *mapped = static_cast<uint8_t *>(file->map_write(sizeof(header) + variants_size + layouts_size));
+	if (!mapped)
+	{
+		LOGE("Failed to map buffer %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	memcpy(mapped, &header, sizeof(header));
+	memcpy(mapped + sizeof(header), cache_variants.data(), variants_size);
+	memcpy(mapped + sizeof(header) + variants_size, cache_layouts.data(), layouts_size);
+	file->unmap();
+
+	LOGI("Saved shader manager cache to %s.\n", path.c_str());
+	return true;
+}
+
 bool ShaderManager::load_shader_cache(const string &path)
 {
 	if (!device->get_system_handles().filesystem)
 		return false;
 
+	if (Granite::Path::ext(path) == "bin")
+		return load_binary_shader_cache(path);
+
 	using namespace rapidjson;
 	string json;
 	if (!device->get_system_handles().filesystem->read_file_to_string(path, json))
@@ -738,6 +1041,9 @@ bool ShaderManager::save_shader_cache(const string &path)
 	if (!device->get_system_handles().filesystem)
 		return false;
 
+	if (Granite::Path::ext(path) == "bin")
+		return save_binary_shader_cache(path);
+
 	using namespace rapidjson;
 	Document doc;
 	doc.SetObject();
@@ -33,11 +33,15 @@
 #include "hash.hpp"
 #ifdef GRANITE_VULKAN_MT
 #include "read_write_lock.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #endif
 
 namespace Granite
 {
 class GLSLCompiler;
+class GLSLIncludeCache;
 }
 
 namespace Vulkan
@@ -55,10 +59,49 @@ struct PrecomputedMeta : Util::IntrusiveHashMapEnabled<PrecomputedMeta>
 using PrecomputedShaderCache = VulkanCacheReadWrite<PrecomputedMeta>;
 using ReflectionCache = VulkanCacheReadWrite<Util::IntrusivePODWrapper<ResourceLayout>>;
 
+// Layout of the binary shader cache. Both tables are sorted by hash,
+// so a memory mapped cache can be searched in place without parsing.
+struct ShaderCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t layout_size;
+	uint32_t num_variants;
+	uint32_t num_layouts;
+	uint32_t padding;
+};
+
+struct ShaderCacheVariant
+{
+	Util::Hash variant_hash;
+	Util::Hash source_hash;
+	Util::Hash shader_hash;
+};
+
+struct ShaderCacheLayout
+{
+	Util::Hash shader_hash;
+	ResourceLayout layout;
+};
+
 struct MetaCache
 {
 	PrecomputedShaderCache variant_to_shader;
 	ReflectionCache shader_to_layout;
+
+	// Entries found in the hash maps take precedence over the mapped cache.
+	const ShaderCacheVariant *mapped_variants = nullptr;
+	const ShaderCacheLayout *mapped_layouts = nullptr;
+	size_t num_mapped_variants = 0;
+	size_t num_mapped_layouts = 0;
+
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	// Shared by all templates, and by compilers on worker threads during hot reload.
+	std::unique_ptr<Granite::GLSLIncludeCache> include_cache;
+#endif
+
+	bool find_variant(Util::Hash variant_hash, Util::Hash &source_hash, Util::Hash &shader_hash) const;
+	bool find_layout(Util::Hash shader_hash, ResourceLayout &layout) const;
 };
 
 class ShaderManager;
@@ -88,6 +131,22 @@ public:
 	void recompile();
 	void register_dependencies(ShaderManager &manager);
 
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	// A recompile is prepared and committed on the thread which owns the template,
+	// while the variants can be compiled from any thread in between.
+	struct Recompile
+	{
+		ShaderTemplate *shader = nullptr;
+		unsigned generation = 0;
+		std::unique_ptr<Granite::GLSLCompiler> compiler;
+		std::vector<ShaderTemplateVariant *> variants;
+		std::vector<std::vector<uint32_t>> spirv;
+	};
+	std::unique_ptr<Recompile> prepare_recompile();
+	void recompile_variant(Recompile &job, unsigned index) const;
+	bool commit_recompile(Recompile &job);
+#endif
+
 	Util::Hash get_path_hash() const
 	{
 		return path_hash;
@@ -102,9 +161,9 @@ private:
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	std::unique_ptr<Granite::GLSLCompiler> compiler;
 	const std::vector<std::string> &include_directories;
-	void recompile_variant(ShaderTemplateVariant &variant);
 	void update_variant_cache(const ShaderTemplateVariant &variant);
 	Util::Hash source_hash = 0;
+	unsigned recompile_generation = 0;
 #endif
 	VulkanCache<ShaderTemplateVariant> variants;
 };
@@ -155,14 +214,20 @@ private:
 	VulkanCacheReadWrite<ShaderProgramVariant> variant_cache;
 };
 
+struct ShaderRecompileProgress
+{
+	// Variants of hot reloaded shaders which have not been swapped in yet.
+	unsigned pending_variants;
+	unsigned completed_variants;
+};
+
 class ShaderManager
 {
 public:
-	explicit ShaderManager(Device *device_)
-		: device(device_)
-	{
-	}
+	explicit ShaderManager(Device *device_);
 
+	// Paths ending in .bin use the binary cache, which is memory mapped and used in place.
+	// Other paths use the JSON format.
 	bool load_shader_cache(const std::string &path);
 	bool save_shader_cache(const std::string &path);
 
@@ -175,6 +240,12 @@ public:
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	void register_dependency(ShaderTemplate *shader, const std::string &dependency);
 	void register_dependency_nolock(ShaderTemplate *shader, const std::string &dependency);
+
+	// On hot reload, variants are compiled in the background while the old SPIR-V keeps being used.
+	// Once every variant affected by a change is done, they are swapped in together.
+	// Called from Device::next_frame_context().
+	void flush_pending_recompiles();
+	ShaderRecompileProgress get_recompile_progress();
 #endif
 
 	bool get_shader_hash_by_variant_hash(Util::Hash variant_hash, Util::Hash &shader_hash) const;
@@ -199,6 +270,10 @@ private:
 
 	ShaderTemplate *get_template(const std::string &source);
 
+	std::unique_ptr<Granite::File> mapped_cache;
+	bool load_binary_shader_cache(const std::string &path);
+	bool save_binary_shader_cache(const std::string &path);
+
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	std::unordered_map<std::string, std::unordered_set<ShaderTemplate *>> dependees;
 #ifdef GRANITE_VULKAN_MT
@@ -213,6 +288,20 @@ private:
 	std::unordered_map<std::string, Notify> directory_watches;
 	void add_directory_watch(const std::string &source);
 	void recompile(const Granite::FileNotifyInfo &info);
+
+#ifdef GRANITE_VULKAN_MT
+	struct PendingRecompile
+	{
+		std::vector<std::unique_ptr<ShaderTemplate::Recompile>> shaders;
+		std::atomic<unsigned> completed;
+		unsigned total = 0;
+	};
+	std::vector<std::unique_ptr<PendingRecompile>> pending_recompiles;
+	std::mutex recompile_lock;
+	std::condition_variable recompile_cond;
+	void wait_pending_recompiles();
+#endif
+	bool enqueue_recompile(std::vector<std::unique_ptr<ShaderTemplate::Recompile>> &shaders);
 #endif
 };
 }
@@ -25,6 +25,10 @@
 #include "memory_mapped_texture.hpp"
 #include "texture_files.hpp"
 #include "texture_decoder.hpp"
+#include "single_pass_downsample.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
 
 #ifdef GRANITE_VULKAN_THREAD_GROUP
 #include "thread_group.hpp"
@@ -71,11 +75,14 @@ void Texture::update(std::unique_ptr<Granite::File> file)
 		void *mapped = updated_file->map();
 		if (size && mapped)
 		{
+			// Supercompressed textures finish on decode tasks, which notify once they are done.
+			bool done = true;
 			if (MemoryMappedTexture::is_header(mapped, size))
-				update_gtx(move(updated_file), mapped);
+				done = update_gtx(move(updated_file), mapped);
 			else
 				update_other(mapped, size);
-			device->get_texture_manager().notify_updated_texture(path, *this);
+			if (done)
+				device->get_texture_manager().notify_updated_texture(path, *this);
 		}
 		else
 		{
@@ -89,6 +96,7 @@ void Texture::update(std::unique_ptr<Granite::File> file)
 	{
 		// Workaround, cannot copy the lambda because of owning a unique_ptr.
 		auto task = group->create_task(move(work));
+		task->set_priority(Granite::TaskPriority::Background);
 		task->flush();
 	}
 	else
@@ -98,11 +106,8 @@ void Texture::update(std::unique_ptr<Granite::File> file)
 #endif
 }
 
-void Texture::update_checkerboard()
+ImageHandle Texture::create_checkerboard()
 {
-	LOGE("Failed to load texture: %s, falling back to a checkerboard.\n",
-	     path.c_str());
-
 	ImageInitialData initial = {};
 	static const uint32_t checkerboard[] = {
 			0xffffffffu, 0xffffffffu, 0xff000000u, 0xff000000u,
@@ -115,11 +120,122 @@ void Texture::update_checkerboard()
 	auto info = ImageCreateInfo::immutable_2d_image(4, 4, VK_FORMAT_R8G8B8A8_UNORM, false);
 	info.misc = IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT | IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
 	            IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
+	info.tag = AllocationTag::Texture;
 
 	auto image = device->create_image(info, &initial);
 	if (image)
 		device->set_name(*image, path.c_str());
-	replace_image(image);
+	return image;
+}
+
+void Texture::update_checkerboard()
+{
+	LOGE("Failed to load texture: %s, falling back to a checkerboard.\n",
+	     path.c_str());
+	replace_image(create_checkerboard());
+}
+
+void Texture::update_placeholder()
+{
+	// Nobody has seen this texture yet, so there is nothing to notify.
+	handle.write_object(create_checkerboard());
+}
+
+static unsigned select_skip_levels(const TextureFormatLayout &layout, VkImageCreateFlags flags,
+                                   unsigned skip_levels, unsigned min_extent)
+{
+	if (layout.get_image_type() != VK_IMAGE_TYPE_2D || layout.get_levels() <= 1 ||
+	    (flags & VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT) != 0)
+		return 0;
+
+	skip_levels = std::min(skip_levels, layout.get_levels() - 1);
+	while (skip_levels && std::max(layout.get_width(skip_levels), layout.get_height(skip_levels)) < min_extent)
+		skip_levels--;
+	return skip_levels;
+}
+
+bool Texture::setup_gtx_upload(const MemoryMappedTexture &mapped_file, ImageCreateInfo &info,
+                               TextureFormatLayout &upload_layout, unsigned &skip_levels) const
+{
+	auto &layout = mapped_file.get_layout();
+	info = ImageCreateInfo::immutable_image(layout);
+	info.swizzle = swizzle;
+	info.flags = (mapped_file.get_flags() & MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT) ?
+	             VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT :
+	             0;
+	info.misc = IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT | IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
+	            IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
+	info.tag = AllocationTag::Texture;
+
+	// Dropping levels copies the remaining ones out of the image.
+	if (device->get_texture_manager().get_residency_enabled())
+		info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	if (info.levels == 1 && (mapped_file.get_flags() & MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) != 0)
+	{
+		// Prefer the single dispatch compute path, blits are only used for formats we cannot store to.
+		if (Granite::supports_compute_mipmap(*device, info))
+		{
+			info.levels = 0;
+			info.misc |= IMAGE_MISC_GENERATE_MIPS_BIT;
+			info.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+			if (format_is_srgb(info.format))
+			{
+				info.misc |= IMAGE_MISC_MUTABLE_SRGB_BIT;
+				info.flags |= VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+			}
+		}
+		else if (device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+		         device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_BLIT_DST_BIT))
+		{
+			info.levels = 0;
+			info.misc |= IMAGE_MISC_GENERATE_MIPS_BIT;
+		}
+	}
+
+	if (!device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+	{
+		LOGE("Format (%u) is not supported!\n", unsigned(info.format));
+		return false;
+	}
+
+	// Mips are laid out sequentially with 16 byte aligned offsets, so the levels we keep
+	// form a valid layout of their own which points straight into the file.
+	upload_layout = layout;
+	skip_levels = select_skip_levels(layout, info.flags,
+	                                 load_skip_levels.load(std::memory_order_relaxed),
+	                                 device->get_texture_manager().get_residency_options().min_extent);
+	if (skip_levels)
+	{
+		upload_layout.set_2d(layout.get_format(), layout.get_width(skip_levels), layout.get_height(skip_levels),
+		                     layout.get_layers(), layout.get_levels() - skip_levels);
+		if (mapped_file.is_supercompressed())
+			upload_layout.set_buffer(nullptr, 0);
+		else
+			upload_layout.set_buffer(layout.data(0, skip_levels), upload_layout.get_required_size());
+
+		info.width = upload_layout.get_width();
+		info.height = upload_layout.get_height();
+		info.levels = upload_layout.get_levels();
+	}
+
+	return true;
+}
+
+void Texture::finish_gtx_upload(ImageHandle image, unsigned skip_levels)
+{
+	if (image)
+		device->set_name(*image, path.c_str());
+
+	// Update notifications may call get_image(), which must not count as a use.
+	uint64_t last_used = last_used_frame.load(std::memory_order_relaxed);
+	bool valid = bool(image);
+	replace_image(move(image));
+	if (valid && skip_levels)
+	{
+		dropped_levels.store(skip_levels, std::memory_order_relaxed);
+		last_used_frame.store(last_used, std::memory_order_relaxed);
+	}
 }
 
 void Texture::update_gtx(const MemoryMappedTexture &mapped_file)
@@ -133,63 +249,161 @@ void Texture::update_gtx(const MemoryMappedTexture &mapped_file)
 	auto &layout = mapped_file.get_layout();
 
 	mapped_file.remap_swizzle(swizzle);
+	full_extent.store(std::max(layout.get_width(), layout.get_height()), std::memory_order_relaxed);
 
-	Vulkan::ImageHandle image;
 	if (!device->image_format_is_supported(layout.get_format(), VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
 	    format_compression_type(layout.get_format()) != FormatCompressionType::Uncompressed)
 	{
 		LOGI("Compressed format #%u is not supported, falling back to compute decode of compressed image.\n",
 		     unsigned(layout.get_format()));
+		ScopedAllocationTag tag(AllocationTag::Texture);
 		auto cmd = device->request_command_buffer(CommandBuffer::Type::AsyncCompute);
-		image = Granite::decode_compressed_image(*cmd, layout, swizzle);
+		ImageHandle image;
+		if (device->get_texture_manager().get_transcode_enabled())
+			image = Granite::transcode_compressed_image(*cmd, layout, swizzle);
+		if (!image)
+			image = Granite::decode_compressed_image(*cmd, layout, swizzle);
 		Semaphore sem;
 		device->submit(cmd, nullptr, 1, &sem);
 		device->add_wait_semaphore(CommandBuffer::Type::Generic, sem, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, true);
+		finish_gtx_upload(move(image), 0);
+		return;
 	}
-	else
-	{
-		ImageCreateInfo info = ImageCreateInfo::immutable_image(layout);
-		info.swizzle = swizzle;
-		info.flags = (mapped_file.get_flags() & MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT) ?
-                         VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT :
-                         0;
-		info.misc = IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT | IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
-		            IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
-
-		if (info.levels == 1 &&
-		    (mapped_file.get_flags() & MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) != 0 &&
-		    device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
-		    device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_BLIT_DST_BIT))
-		{
-			info.levels = 0;
-			info.misc |= IMAGE_MISC_GENERATE_MIPS_BIT;
-		}
 
-		if (!device->image_format_is_supported(info.format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
-		{
-			LOGE("Format (%u) is not supported!\n", unsigned(info.format));
-			return;
-		}
+	ImageCreateInfo info;
+	TextureFormatLayout upload_layout;
+	unsigned skip_levels = 0;
+	if (!setup_gtx_upload(mapped_file, info, upload_layout, skip_levels))
+		return;
 
-		auto staging = device->create_image_staging_buffer(layout);
+	// Write straight from the mapped file if the device lets us, otherwise go through staging.
+	auto image = device->create_image_from_host_copy(info, upload_layout);
+	if (!image)
+	{
+		auto staging = device->create_image_staging_buffer(upload_layout);
 		image = device->create_image_from_staging_buffer(info, &staging);
 	}
 
-	if (image)
-		device->set_name(*image, path.c_str());
-	replace_image(image);
+	finish_gtx_upload(move(image), skip_levels);
 }
 
-void Texture::update_gtx(unique_ptr<Granite::File> file, void *mapped)
+bool Texture::update_gtx_async(std::shared_ptr<MemoryMappedTexture> mapped_file)
 {
-	MemoryMappedTexture mapped_file;
-	if (!mapped_file.map_read(move(file), mapped))
+#ifdef GRANITE_VULKAN_THREAD_GROUP
+	auto *group = device->get_system_handles().thread_group;
+	auto &layout = mapped_file->get_layout();
+	if (!group || mapped_file->empty() ||
+	    !device->image_format_is_supported(layout.get_format(), VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+		return false;
+
+	struct Upload
+	{
+		std::shared_ptr<MemoryMappedTexture> file;
+		ImageCreateInfo info;
+		TextureFormatLayout layout;
+		unsigned skip_levels = 0;
+		size_t base_offset = 0;
+		BufferHandle staging;
+		uint8_t *mapped = nullptr;
+		std::atomic_bool failed{false};
+	};
+
+	auto upload = std::make_shared<Upload>();
+	upload->file = move(mapped_file);
+	upload->file->remap_swizzle(swizzle);
+	full_extent.store(std::max(layout.get_width(), layout.get_height()), std::memory_order_relaxed);
+
+	if (!setup_gtx_upload(*upload->file, upload->info, upload->layout, upload->skip_levels))
+	{
+		device->get_texture_manager().notify_updated_texture(path, *this);
+		return true;
+	}
+
+	if (upload->skip_levels)
+		upload->base_offset = layout.get_mip_info(upload->skip_levels).offset;
+
+	BufferCreateInfo buffer_info = {};
+	buffer_info.domain = BufferDomain::Host;
+	buffer_info.size = upload->layout.get_required_size();
+	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	buffer_info.tag = AllocationTag::Staging;
+	upload->staging = device->create_buffer(buffer_info, nullptr);
+	if (!upload->staging)
+	{
+		update_checkerboard();
+		device->get_texture_manager().notify_updated_texture(path, *this);
+		return true;
+	}
+	device->set_name(*upload->staging, "image-upload-staging-buffer");
+	upload->mapped = static_cast<uint8_t *>(device->map_host_buffer(*upload->staging, MEMORY_ACCESS_WRITE_BIT));
+
+	// Chunks decode straight into staging memory, chunks of skipped levels are never touched.
+	auto decode_task = group->create_task();
+	decode_task->set_desc("texture-decode");
+	decode_task->set_priority(Granite::TaskPriority::Background);
+	for (unsigned i = 0; i < upload->file->get_num_chunks(); i++)
+	{
+		if (upload->file->get_chunk(i).offset < upload->base_offset)
+			continue;
+
+		decode_task->enqueue_task([upload, i]() {
+			auto &chunk = upload->file->get_chunk(i);
+			if (!upload->file->decompress_chunk(i, upload->mapped + (chunk.offset - upload->base_offset)))
+				upload->failed.store(true, std::memory_order_relaxed);
+		});
+	}
+
+	auto upload_task = group->create_task([this, upload]() {
+		device->unmap_host_buffer(*upload->staging, MEMORY_ACCESS_WRITE_BIT);
+		if (upload->failed.load(std::memory_order_relaxed))
+		{
+			LOGE("Failed to decompress texture: %s.\n", path.c_str());
+			update_checkerboard();
+		}
+		else
+		{
+			InitialImageBuffer staging;
+			staging.buffer = upload->staging;
+			upload->layout.build_buffer_image_copies(staging.blits);
+			finish_gtx_upload(device->create_image_from_staging_buffer(upload->info, &staging), upload->skip_levels);
+		}
+		device->get_texture_manager().notify_updated_texture(path, *this);
+	});
+	upload_task->set_desc("texture-upload");
+	upload_task->set_priority(Granite::TaskPriority::Background);
+	group->add_dependency(*upload_task, *decode_task);
+	decode_task->flush();
+	upload_task->flush();
+	return true;
+#else
+	(void)mapped_file;
+	return false;
+#endif
+}
+
+bool Texture::update_gtx(unique_ptr<Granite::File> file, void *mapped)
+{
+	auto mapped_file = std::make_shared<MemoryMappedTexture>();
+	if (!mapped_file->map_read(move(file), mapped, false))
 	{
 		LOGE("Failed to read texture.\n");
-		return;
+		return true;
+	}
+
+	if (mapped_file->is_supercompressed())
+	{
+		if (update_gtx_async(mapped_file))
+			return false;
+
+		if (!mapped_file->decompress())
+		{
+			update_checkerboard();
+			return true;
+		}
 	}
 
-	update_gtx(mapped_file);
+	update_gtx(*mapped_file);
+	return true;
 }
 
 void Texture::update_other(const void *data, size_t size)
@@ -199,7 +413,7 @@ void Texture::update_other(const void *data, size_t size)
 	                                     format == VK_FORMAT_UNDEFINED ||
 	                                     format == VK_FORMAT_B8G8R8A8_SRGB ||
 	                                     format == VK_FORMAT_A8B8G8R8_SRGB_PACK32) ?
-	                                    ColorSpace::sRGB : ColorSpace::Linear);
+	                                    ColorSpace::sRGB : ColorSpace::Linear, device);
 
 	update_gtx(tex);
 }
@@ -218,6 +432,7 @@ void Texture::unload()
 
 void Texture::replace_image(ImageHandle handle_)
 {
+	dropped_levels.store(0, std::memory_order_relaxed);
 	auto old = this->handle.write_object(move(handle_));
 	if (old)
 		device->keep_handle_alive(move(old));
@@ -230,9 +445,123 @@ Image *Texture::get_image()
 {
 	auto ret = handle.get();
 	VK_ASSERT(ret);
+
+	// Avoid dirtying the cache line when a texture is used many times per frame.
+	uint64_t frame = device->get_texture_manager().get_residency_frame();
+	if (last_used_frame.load(std::memory_order_relaxed) != frame)
+		last_used_frame.store(frame, std::memory_order_relaxed);
+
 	return ret;
 }
 
+bool Texture::drop_top_level()
+{
+	auto *image = handle.get_nowait();
+	if (!image)
+		return false;
+
+	const auto &info = image->get_create_info();
+	if (info.levels <= 1 || info.type != VK_IMAGE_TYPE_2D || info.samples != VK_SAMPLE_COUNT_1_BIT ||
+	    info.domain != ImageDomain::Physical || (info.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) == 0)
+		return false;
+
+	auto dropped_info = info;
+	dropped_info.width = image->get_width(1);
+	dropped_info.height = image->get_height(1);
+	dropped_info.levels = info.levels - 1;
+	dropped_info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	dropped_info.misc &= ~IMAGE_MISC_GENERATE_MIPS_BIT;
+	dropped_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	dropped_info.memory_aliases = nullptr;
+	dropped_info.num_memory_aliases = 0;
+	dropped_info.pnext = nullptr;
+
+	auto dropped = device->create_image(dropped_info);
+	if (!dropped)
+		return false;
+	device->set_name(*dropped, path.c_str());
+
+	VkImageAspectFlags aspect = format_to_aspect_mask(info.format);
+	auto cmd = device->request_command_buffer();
+	cmd->begin_region("texture-drop-level");
+
+	cmd->image_barrier(*dropped, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	cmd->image_barrier(*image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	for (unsigned level = 1; level < info.levels; level++)
+	{
+		VkImageSubresourceLayers dst_subresource = { aspect, level - 1, 0, info.layers };
+		VkImageSubresourceLayers src_subresource = { aspect, level, 0, info.layers };
+		cmd->copy_image(*dropped, *image, {}, {},
+		                { image->get_width(level), image->get_height(level), 1 },
+		                dst_subresource, src_subresource);
+	}
+
+	// The old image may still be referenced by command buffers which are not submitted yet.
+	cmd->image_barrier(*image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+	                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_READ_BIT);
+	cmd->image_barrier(*dropped, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	cmd->end_region();
+	device->submit(cmd);
+
+	// Update notifications may call get_image(), which must not count as a use.
+	uint32_t levels = dropped_levels.load(std::memory_order_relaxed) + 1;
+	uint64_t last_used = last_used_frame.load(std::memory_order_relaxed);
+	replace_image(move(dropped));
+	dropped_levels.store(levels, std::memory_order_relaxed);
+	last_used_frame.store(last_used, std::memory_order_relaxed);
+	return true;
+}
+
+bool Texture::restore_levels(unsigned level)
+{
+	if (!fs || path.empty())
+		return false;
+
+	auto file = fs->open(path);
+	if (!file)
+		return false;
+
+	restore_pending = true;
+	load_skip_levels.store(level, std::memory_order_relaxed);
+	update(move(file));
+	return true;
+}
+
+void Texture::request_level(unsigned level)
+{
+	uint64_t frame = device->get_texture_manager().get_residency_frame();
+	if (requested_frame.load(std::memory_order_relaxed) != frame)
+	{
+		requested_level.store(level, std::memory_order_relaxed);
+		requested_frame.store(frame, std::memory_order_relaxed);
+	}
+	else if (level < requested_level.load(std::memory_order_relaxed))
+	{
+		// Racing requests may lose the finest level for a frame, which is harmless.
+		requested_level.store(level, std::memory_order_relaxed);
+	}
+}
+
+void Texture::request_screen_extent(float pixels)
+{
+	uint32_t extent = full_extent.load(std::memory_order_relaxed);
+	if (!extent)
+		return;
+
+	// Be conservative, textures are often tiled or cover only part of a mesh.
+	float level = std::log2(float(extent) / std::max(pixels, 1.0f)) - 1.0f;
+	request_level(level > 0.0f ? unsigned(level) : 0u);
+}
+
 void Texture::set_enable_notification(bool enable)
 {
 	enable_notification = enable;
@@ -241,6 +570,122 @@ void Texture::set_enable_notification(bool enable)
 TextureManager::TextureManager(Device *device_)
 	: device(device_)
 {
+	if (const char *env = getenv("GRANITE_TEXTURE_RESIDENCY"))
+		residency.enabled = strtoul(env, nullptr, 0) != 0;
+	if (const char *env = getenv("GRANITE_TEXTURE_STREAMING"))
+		set_mip_streaming_enabled(strtoul(env, nullptr, 0) != 0);
+	if (const char *env = getenv("GRANITE_TEXTURE_TRANSCODE"))
+		transcode = strtoul(env, nullptr, 0) != 0;
+}
+
+void TextureManager::set_transcode_enabled(bool enable)
+{
+	transcode = enable;
+}
+
+void TextureManager::set_mip_streaming_enabled(bool enable)
+{
+	residency.streaming = enable;
+	if (enable)
+		residency.enabled = true;
+}
+
+void TextureManager::set_residency_enabled(bool enable)
+{
+	residency.enabled = enable;
+}
+
+void TextureManager::set_residency_options(const TextureResidencyOptions &options)
+{
+	residency.options = options;
+}
+
+bool TextureManager::residency_budget_is_critical() const
+{
+	HeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+	device->get_memory_budget(budgets);
+
+	auto &props = device->get_memory_properties();
+	for (uint32_t i = 0; i < props.memoryHeapCount; i++)
+	{
+		if ((props.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0 || budgets[i].budget_size == 0)
+			continue;
+
+		if (double(budgets[i].device_usage) > double(budgets[i].budget_size) * residency.options.budget_threshold)
+			return true;
+	}
+
+	return false;
+}
+
+void TextureManager::update_residency()
+{
+	uint64_t frame = residency.frame.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (!residency.enabled)
+		return;
+
+	auto &opts = residency.options;
+	unsigned operations = 0;
+
+	auto get_wanted_level = [frame](const Texture &texture) -> uint32_t {
+		if (texture.requested_frame.load(std::memory_order_relaxed) + 1 >= frame)
+			return texture.requested_level.load(std::memory_order_relaxed);
+		else
+			return 0;
+	};
+
+	// Textures which were used last frame get back the levels they need.
+	for (auto &texture : textures.get_thread_unsafe())
+	{
+		if (operations >= opts.max_operations_per_frame)
+			break;
+
+		uint32_t dropped = texture.dropped_levels.load(std::memory_order_relaxed);
+		uint32_t wanted = get_wanted_level(texture);
+		if (dropped == 0)
+			texture.restore_pending = false;
+		else if (!texture.restore_pending && dropped > wanted &&
+		         texture.last_used_frame.load(std::memory_order_relaxed) + 1 >= frame)
+		{
+			if (texture.restore_levels(wanted))
+				operations++;
+		}
+	}
+
+	if (operations >= opts.max_operations_per_frame || !residency_budget_is_critical())
+		return;
+
+	std::vector<Texture *> candidates;
+	for (auto &texture : textures.get_thread_unsafe())
+	{
+		if (texture.restore_pending)
+			continue;
+
+		// Textures which are resident at a finer level than anything requests are dropped as well.
+		uint32_t dropped = texture.dropped_levels.load(std::memory_order_relaxed);
+		bool stale = dropped < opts.max_dropped_levels &&
+		             texture.last_used_frame.load(std::memory_order_relaxed) + opts.unused_frames < frame;
+		bool over_resolved = dropped < get_wanted_level(texture);
+		if (!stale && !over_resolved)
+			continue;
+
+		auto *image = texture.handle.get_nowait();
+		if (image && std::max(image->get_width(), image->get_height()) >= opts.min_extent)
+			candidates.push_back(&texture);
+	}
+
+	// Least recently used first.
+	std::sort(candidates.begin(), candidates.end(), [](const Texture *a, const Texture *b) {
+		return a->last_used_frame.load(std::memory_order_relaxed) < b->last_used_frame.load(std::memory_order_relaxed);
+	});
+
+	for (auto *texture : candidates)
+	{
+		if (operations >= opts.max_operations_per_frame)
+			break;
+		if (texture->drop_top_level())
+			operations++;
+	}
 }
 
 Texture *TextureManager::request_texture(const std::string &path, VkFormat format, const VkComponentMapping &mapping)
@@ -264,11 +709,21 @@ Texture *TextureManager::request_texture(const std::string &path, VkFormat forma
 		return ret;
 
 	ret = textures.emplace_yield(hash, device, path, format, mapping);
+	if (residency.streaming)
+		ret->load_skip_levels.store(residency.options.stream_skip_levels, std::memory_order_relaxed);
+	// The placeholder must be in place before loading starts, so the real image always replaces it.
+	if (load_placeholders)
+		ret->update_placeholder();
 	if (!ret->init_texture())
 		ret->update_checkerboard();
 	return ret;
 }
 
+void TextureManager::set_load_placeholders_enabled(bool enable)
+{
+	load_placeholders = enable;
+}
+
 void TextureManager::register_texture_update_notification(const std::string &modified_path,
                                                           std::function<void(Texture &)> func)
 {
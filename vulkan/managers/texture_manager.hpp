@@ -25,10 +25,13 @@
 #include "volatile_source.hpp"
 #include "async_object_sink.hpp"
 #include "image.hpp"
+#include <atomic>
+#include <memory>
 
 namespace Vulkan
 {
 class MemoryMappedTexture;
+class TextureFormatLayout;
 class Texture : public Granite::VolatileSource<Texture>,
                 public Util::IntrusiveHashMapEnabled<Texture>
 {
@@ -43,6 +46,12 @@ public:
 	void replace_image(ImageHandle handle);
 	void set_enable_notification(bool enable);
 
+	// Finest mip level the caller expects to sample this frame, lower is finer.
+	// With mip streaming, levels finer than any requested level are not kept resident.
+	void request_level(unsigned level);
+	// Same, estimated from how many pixels the texture covers on screen along its longest axis.
+	void request_screen_extent(float pixels);
+
 private:
 	Texture(Device *device, const std::string &path, VkFormat format = VK_FORMAT_UNDEFINED,
 	        const VkComponentMapping &swizzle = {
@@ -57,10 +66,30 @@ private:
 	Util::AsyncObjectSink<ImageHandle> handle;
 	VkFormat format;
 	VkComponentMapping swizzle;
+
+	// Residency tracking, see TextureManager::update_residency().
+	std::atomic<uint64_t> last_used_frame{0};
+	std::atomic<uint32_t> dropped_levels{0};
+	std::atomic<uint64_t> requested_frame{0};
+	std::atomic<uint32_t> requested_level{0};
+	// Largest extent of level 0 in the source file, also when levels are not resident.
+	std::atomic<uint32_t> full_extent{0};
+	// Number of top levels the next load leaves out.
+	std::atomic<uint32_t> load_skip_levels{0};
+	bool restore_pending = false;
+	bool drop_top_level();
+	bool restore_levels(unsigned level);
 	void update_other(const void *data, size_t size);
-	void update_gtx(std::unique_ptr<Granite::File> file, void *mapped);
+	// Returns false if the upload completes later on decode tasks.
+	bool update_gtx(std::unique_ptr<Granite::File> file, void *mapped);
 	void update_gtx(const MemoryMappedTexture &texture);
+	bool update_gtx_async(std::shared_ptr<MemoryMappedTexture> texture);
+	bool setup_gtx_upload(const MemoryMappedTexture &texture, ImageCreateInfo &info,
+	                      TextureFormatLayout &upload_layout, unsigned &skip_levels) const;
+	void finish_gtx_upload(ImageHandle image, unsigned skip_levels);
 	void update_checkerboard();
+	void update_placeholder();
+	ImageHandle create_checkerboard();
 
 	void load();
 	void unload();
@@ -68,6 +97,22 @@ private:
 	bool enable_notification = true;
 };
 
+struct TextureResidencyOptions
+{
+	// Start dropping mip levels when a device-local heap exceeds this fraction of its budget.
+	float budget_threshold = 0.9f;
+	// Textures not used for this many frames are candidates for dropping levels.
+	unsigned unused_frames = 120;
+	unsigned max_dropped_levels = 2;
+	// Textures smaller than this are not worth dropping levels from.
+	unsigned min_extent = 256;
+	// Number of drops and restores performed per update_residency().
+	unsigned max_operations_per_frame = 4;
+	// With mip streaming, textures first load without this many top levels,
+	// and higher levels load once they are requested. Never goes below min_extent.
+	unsigned stream_skip_levels = 3;
+};
+
 class TextureManager
 {
 public:
@@ -86,8 +131,64 @@ public:
 
 	void notify_updated_texture(const std::string &path, Vulkan::Texture &texture);
 
+	// Budget-driven residency. Texture::get_image() marks a texture as used in the current frame.
+	// When a device-local heap nears its budget, the top mip level of textures which have not been used
+	// recently is dropped with a GPU copy. Once such a texture is used again, it is reloaded at full resolution.
+	// Application::run_frame() calls it once per frame. Must not race with request_texture().
+	// Enabled with GRANITE_TEXTURE_RESIDENCY=1.
+	void set_residency_enabled(bool enable);
+	void set_residency_options(const TextureResidencyOptions &options);
+	void update_residency();
+
+	bool get_residency_enabled() const
+	{
+		return residency.enabled;
+	}
+
+	const TextureResidencyOptions &get_residency_options() const
+	{
+		return residency.options;
+	}
+
+	// Mip streaming on top of residency. Textures requested from now on only load their smallest levels at first.
+	// Textures which are used are reloaded down to the finest level requested through Texture::request_level(),
+	// or level 0 if nothing requested a level, and under budget pressure levels finer than requested are dropped.
+	// Reloads happen on background tasks, which upload through staging or host image copies.
+	// Enabled with GRANITE_TEXTURE_STREAMING=1, which also enables residency.
+	void set_mip_streaming_enabled(bool enable);
+
+	uint64_t get_residency_frame() const
+	{
+		return residency.frame.load(std::memory_order_relaxed);
+	}
+
+	// Newly requested textures show a checkerboard until their contents are loaded,
+	// instead of get_image() blocking until the background load completes.
+	void set_load_placeholders_enabled(bool enable);
+
+	// Compressed formats the device cannot sample are decoded on the GPU. By default the decoded result
+	// is re-encoded to a BCn format where the device supports one, which keeps 4-8x less memory resident
+	// than the uncompressed fallback. Disabled with GRANITE_TEXTURE_TRANSCODE=0.
+	void set_transcode_enabled(bool enable);
+
+	bool get_transcode_enabled() const
+	{
+		return transcode;
+	}
+
 private:
 	Device *device;
+	bool load_placeholders = false;
+	bool transcode = true;
+
+	struct
+	{
+		TextureResidencyOptions options;
+		std::atomic<uint64_t> frame{0};
+		bool enabled = false;
+		bool streaming = false;
+	} residency;
+	bool residency_budget_is_critical() const;
 
 	VulkanCache<Texture> textures;
 	VulkanCache<Texture> deferred_textures;
@@ -24,6 +24,10 @@
 #include "device.hpp"
 #include <algorithm>
 
+#ifdef GRANITE_VULKAN_MT
+#include "thread_id.hpp"
+#endif
+
 using namespace std;
 
 #ifdef GRANITE_VULKAN_MT
@@ -47,8 +51,52 @@ void DeviceAllocation::free_immediate()
 	offset = 0;
 }
 
+static thread_local AllocationTag scoped_allocation_tag = AllocationTag::Untagged;
+
+ScopedAllocationTag::ScopedAllocationTag(AllocationTag tag)
+	: previous(scoped_allocation_tag)
+{
+	scoped_allocation_tag = tag;
+}
+
+ScopedAllocationTag::~ScopedAllocationTag()
+{
+	scoped_allocation_tag = previous;
+}
+
+AllocationTag ScopedAllocationTag::get_current()
+{
+	return scoped_allocation_tag;
+}
+
+const char *allocation_tag_to_string(AllocationTag tag)
+{
+	switch (tag)
+	{
+	case AllocationTag::Untagged:
+		return "untagged";
+	case AllocationTag::Texture:
+		return "texture";
+	case AllocationTag::Mesh:
+		return "mesh";
+	case AllocationTag::RenderGraph:
+		return "render-graph";
+	case AllocationTag::BufferPool:
+		return "buffer-pool";
+	case AllocationTag::Shadow:
+		return "shadow";
+	case AllocationTag::Staging:
+		return "staging";
+	default:
+		return "unknown";
+	}
+}
+
 void DeviceAllocation::free_immediate(DeviceAllocator &allocator)
 {
+	if (tag != AllocationTag::Count && (alloc || base))
+		allocator.untrack_allocation(*this);
+
 	if (alloc)
 		free_immediate();
 	else if (base)
@@ -117,9 +165,85 @@ void ClassAllocator::suballocate(uint32_t num_blocks, AllocationMode mode, uint3
 	alloc->size = num_blocks << sub_block_size_log2;
 }
 
+#ifdef GRANITE_VULKAN_MT
+ClassAllocator::ThreadCache *ClassAllocator::get_thread_cache()
+{
+	// Unregistered threads might share an index, they have to go through the lock.
+	unsigned index = Util::query_current_thread_index();
+	return index < thread_caches.size() ? &thread_caches[index] : nullptr;
+}
+#endif
+
+void ClassAllocator::set_num_thread_indices(unsigned count)
+{
+#ifdef GRANITE_VULKAN_MT
+	flush_thread_caches();
+	thread_caches.clear();
+	thread_caches.resize(count);
+#else
+	(void)count;
+#endif
+}
+
+void ClassAllocator::flush_thread_caches()
+{
+#ifdef GRANITE_VULKAN_MT
+	ALLOCATOR_LOCK();
+	for (auto &cache : thread_caches)
+	{
+		for (auto &mode_bins : cache.bins)
+		{
+			for (auto &bin : mode_bins)
+			{
+				for (auto &cached : bin)
+					free_nolock(&cached);
+				bin.clear();
+			}
+		}
+	}
+#endif
+}
+
 bool ClassAllocator::allocate(uint32_t size, AllocationMode mode, DeviceAllocation *alloc)
+{
+#ifdef GRANITE_VULKAN_MT
+	unsigned num_blocks = (size + sub_block_size - 1) >> sub_block_size_log2;
+	ThreadCache *cache;
+	if (num_blocks != 0 && num_blocks <= MaxCachedSubBlocks && (cache = get_thread_cache()) != nullptr)
+	{
+		auto &bin = cache->bins[Util::ecast(mode)][num_blocks - 1];
+		if (bin.empty())
+		{
+			ALLOCATOR_LOCK();
+			for (unsigned i = 0; i < CacheBatchSize; i++)
+			{
+				DeviceAllocation cached = {};
+				if (!allocate_nolock(num_blocks << sub_block_size_log2, mode, &cached))
+					break;
+				bin.push_back(cached);
+			}
+
+			if (bin.empty())
+				return false;
+		}
+
+		*alloc = bin.back();
+		bin.pop_back();
+		return true;
+	}
+#endif
+
+	return allocate_locked(size, mode, alloc);
+}
+
+bool ClassAllocator::allocate_locked(uint32_t size, AllocationMode mode, DeviceAllocation *alloc)
 {
 	ALLOCATOR_LOCK();
+	return allocate_nolock(size, mode, alloc);
+}
+
+bool ClassAllocator::allocate_nolock(uint32_t size, AllocationMode mode, DeviceAllocation *alloc)
+{
 	unsigned num_blocks = (size + sub_block_size - 1) >> sub_block_size_log2;
 	uint32_t size_mask = (1u << (num_blocks - 1)) - 1;
 
@@ -170,7 +294,8 @@ bool ClassAllocator::allocate(uint32_t size, AllocationMode mode, DeviceAllocati
 	if (parent)
 	{
 		// We cannot allocate a new block from parent ... This is fatal.
-		if (!parent->allocate(alloc_size, mode, &heap.allocation))
+		// Mini-heaps bypass the parent's thread caches, so empty heaps are released right away.
+		if (!parent->allocate_locked(alloc_size, mode, &heap.allocation))
 		{
 			object_pool.free(node);
 			return false;
@@ -230,8 +355,47 @@ ClassAllocator::~ClassAllocator()
 }
 
 void ClassAllocator::free(DeviceAllocation *alloc)
+{
+#ifdef GRANITE_VULKAN_MT
+	unsigned num_blocks = alloc->size >> sub_block_size_log2;
+	ThreadCache *cache;
+	if (num_blocks != 0 && num_blocks <= MaxCachedSubBlocks && (cache = get_thread_cache()) != nullptr)
+	{
+		// Undo the alignment Allocator::allocate applied, so the entry can be handed out again as is.
+		auto *heap = alloc->heap.get();
+		uint32_t sub_offset = trailing_zeroes(alloc->mask) << sub_block_size_log2;
+		DeviceAllocation cached = *alloc;
+		cached.offset = heap->allocation.offset + sub_offset;
+		cached.host_base = heap->allocation.host_base ? heap->allocation.host_base + sub_offset : nullptr;
+		cached.tag = AllocationTag::Count;
+
+		auto &bin = cache->bins[Util::ecast(alloc->mode)][num_blocks - 1];
+		bin.push_back(cached);
+
+		if (bin.size() > MaxCachedPerBin)
+		{
+			ALLOCATOR_LOCK();
+			while (bin.size() > CacheBatchSize)
+			{
+				free_nolock(&bin.back());
+				bin.pop_back();
+			}
+		}
+		return;
+	}
+#endif
+
+	free_locked(alloc);
+}
+
+void ClassAllocator::free_locked(DeviceAllocation *alloc)
 {
 	ALLOCATOR_LOCK();
+	free_nolock(alloc);
+}
+
+void ClassAllocator::free_nolock(DeviceAllocation *alloc)
+{
 	auto *heap = alloc->heap.get();
 	auto &block = heap->heap;
 	bool was_full = block.full();
@@ -247,7 +411,7 @@ void ClassAllocator::free(DeviceAllocation *alloc)
 	{
 		// Our mini-heap is completely freed, free to higher level allocator.
 		if (parent)
-			heap->allocation.free_immediate();
+			parent->free_locked(&heap->allocation);
 		else
 			heap->allocation.free_global(*global_allocator, sub_block_size * Block::NumSubBlocks, memory_type);
 
@@ -276,6 +440,62 @@ void ClassAllocator::free(DeviceAllocation *alloc)
 	}
 }
 
+float ClassAllocator::get_heap_occupancy(const DeviceAllocation &alloc)
+{
+	ALLOCATOR_LOCK();
+	VK_ASSERT(alloc.alloc == this);
+	return float(alloc.heap->heap.get_num_used_sub_blocks()) / float(Block::NumSubBlocks);
+}
+
+void ClassAllocator::accumulate_fragmentation_stats(MemoryFragmentationStats &stats, VkDeviceSize &heap_size)
+{
+	ALLOCATOR_LOCK();
+	uint32_t num_heaps = 0;
+
+	const auto accumulate = [&](const Util::IntrusiveList<MiniHeap> &list) {
+		for (auto &heap : list)
+		{
+			uint32_t used = heap.heap.get_num_used_sub_blocks();
+			stats.used_size += VkDeviceSize(used) << sub_block_size_log2;
+			if (used < Block::NumSubBlocks / 2)
+				stats.num_sparse_heaps++;
+			num_heaps++;
+		}
+	};
+
+	for (auto &m : mode_heaps)
+	{
+		for (auto &list : m.heaps)
+			accumulate(list);
+		accumulate(m.full_heaps);
+	}
+
+	heap_size = VkDeviceSize(num_heaps) * sub_block_size * Block::NumSubBlocks;
+	if (!parent)
+		stats.num_blocks += num_heaps;
+}
+
+void Allocator::get_fragmentation_stats(MemoryFragmentationStats &stats)
+{
+	stats = {};
+	VkDeviceSize child_heap_size = 0;
+
+	for (auto &c : classes)
+	{
+		VkDeviceSize heap_size = 0;
+		c.accumulate_fragmentation_stats(stats, heap_size);
+
+		// Mini-heaps of a child class are themselves allocations in the parent class,
+		// so they must not count as used memory.
+		if (c.parent)
+			child_heap_size += heap_size;
+		else
+			stats.reserved_size += heap_size;
+	}
+
+	stats.used_size -= child_heap_size;
+}
+
 bool Allocator::allocate_global(uint32_t size, AllocationMode mode, DeviceAllocation *alloc)
 {
 	// Fall back to global allocation, do not recycle.
@@ -319,6 +539,18 @@ DeviceAllocation DeviceAllocation::make_imported_allocation(VkDeviceMemory memor
 	return alloc;
 }
 
+DeviceAllocation DeviceAllocation::make_aliased_allocation(const DeviceAllocation &parent, uint32_t offset,
+                                                           uint32_t size)
+{
+	DeviceAllocation alloc = {};
+	alloc.base = parent.base;
+	alloc.host_base = parent.host_base ? parent.host_base + offset : nullptr;
+	alloc.offset = parent.offset + offset;
+	alloc.size = size;
+	alloc.memory_type = parent.memory_type;
+	return alloc;
+}
+
 bool Allocator::allocate(uint32_t size, uint32_t alignment, AllocationMode mode, DeviceAllocation *alloc)
 {
 	for (auto &c : classes)
@@ -350,6 +582,20 @@ bool Allocator::allocate(uint32_t size, uint32_t alignment, AllocationMode mode,
 	return allocate_global(size, mode, alloc);
 }
 
+Allocator::~Allocator()
+{
+	// Children first, their mini-heaps are allocations in the parent class.
+	for (auto &c : classes)
+		c.flush_thread_caches();
+}
+
+void Allocator::set_num_thread_indices(unsigned count)
+{
+	// Uniform and staging buffers and small textures land in these classes.
+	get_class_allocator(MemoryClass::Small).set_num_thread_indices(count);
+	get_class_allocator(MemoryClass::Medium).set_num_thread_indices(count);
+}
+
 Allocator::Allocator()
 {
 	for (int i = 0; i < Util::ecast(MemoryClass::Count) - 1; i++)
@@ -383,6 +629,7 @@ void DeviceAllocator::init(Device *device_)
 		allocators.emplace_back(new Allocator);
 		allocators.back()->set_memory_type(i);
 		allocators.back()->set_global_allocator(this);
+		allocators.back()->set_num_thread_indices(device->num_thread_indices);
 	}
 
 	HeapBudget budgets[VK_MAX_MEMORY_HEAPS];
@@ -434,18 +681,63 @@ void DeviceAllocator::init(Device *device_)
 	}
 }
 
+template <typename T>
+static void update_peak(std::atomic<T> &peak, T value)
+{
+	T current = peak.load(std::memory_order_relaxed);
+	while (current < value && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		continue;
+}
+
+void DeviceAllocator::track_allocation(DeviceAllocation &alloc, AllocationTag tag)
+{
+	if (tag == AllocationTag::Untagged)
+		tag = ScopedAllocationTag::get_current();
+	alloc.tag = tag;
+
+	auto &stats = tag_stats[Util::ecast(tag)];
+	VkDeviceSize live_size = stats.live_size.fetch_add(alloc.size, std::memory_order_relaxed) + alloc.size;
+	uint32_t live_count = stats.live_count.fetch_add(1, std::memory_order_relaxed) + 1;
+	update_peak(stats.peak_size, live_size);
+	update_peak(stats.peak_count, live_count);
+}
+
+void DeviceAllocator::untrack_allocation(DeviceAllocation &alloc)
+{
+	auto &stats = tag_stats[Util::ecast(alloc.tag)];
+	VK_ASSERT(stats.live_count.load(std::memory_order_relaxed) &&
+	          stats.live_size.load(std::memory_order_relaxed) >= alloc.size);
+	stats.live_size.fetch_sub(alloc.size, std::memory_order_relaxed);
+	stats.live_count.fetch_sub(1, std::memory_order_relaxed);
+	alloc.tag = AllocationTag::Count;
+}
+
+void DeviceAllocator::get_allocation_tag_stats(AllocationTagStats *stats)
+{
+	for (unsigned i = 0; i < Util::ecast(AllocationTag::Count); i++)
+	{
+		stats[i].live_size = tag_stats[i].live_size.load(std::memory_order_relaxed);
+		stats[i].peak_size = tag_stats[i].peak_size.load(std::memory_order_relaxed);
+		stats[i].live_count = tag_stats[i].live_count.load(std::memory_order_relaxed);
+		stats[i].peak_count = tag_stats[i].peak_count.load(std::memory_order_relaxed);
+	}
+}
+
 bool DeviceAllocator::allocate(uint32_t size, uint32_t alignment, AllocationMode mode, uint32_t memory_type,
-                               DeviceAllocation *alloc)
+                               DeviceAllocation *alloc, AllocationTag tag)
 {
-	return allocators[memory_type]->allocate(size, alignment, mode, alloc);
+	if (!allocators[memory_type]->allocate(size, alignment, mode, alloc))
+		return false;
+	track_allocation(*alloc, tag);
+	return true;
 }
 
 bool DeviceAllocator::allocate_image_memory(uint32_t size, uint32_t alignment, AllocationMode mode, uint32_t memory_type,
                                             DeviceAllocation *alloc, VkImage image,
-                                            bool force_no_dedicated)
+                                            bool force_no_dedicated, AllocationTag tag)
 {
 	if (force_no_dedicated)
-		return allocate(size, alignment, mode, memory_type, alloc);
+		return allocate(size, alignment, mode, memory_type, alloc, tag);
 
 	VkImageMemoryRequirementsInfo2 info = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2 };
 	info.image = image;
@@ -456,14 +748,23 @@ bool DeviceAllocator::allocate_image_memory(uint32_t size, uint32_t alignment, A
 	table->vkGetImageMemoryRequirements2(device->get_device(), &info, &mem_req);
 
 	if (dedicated_req.prefersDedicatedAllocation || dedicated_req.requiresDedicatedAllocation)
-		return allocators[memory_type]->allocate_dedicated(size, mode, alloc, image);
+	{
+		if (!allocators[memory_type]->allocate_dedicated(size, mode, alloc, image))
+			return false;
+		track_allocation(*alloc, tag);
+		return true;
+	}
 	else
-		return allocate(size, alignment, mode, memory_type, alloc);
+		return allocate(size, alignment, mode, memory_type, alloc, tag);
 }
 
-bool DeviceAllocator::allocate_global(uint32_t size, AllocationMode mode, uint32_t memory_type, DeviceAllocation *alloc)
+bool DeviceAllocator::allocate_global(uint32_t size, AllocationMode mode, uint32_t memory_type, DeviceAllocation *alloc,
+                                      AllocationTag tag)
 {
-	return allocators[memory_type]->allocate_global(size, mode, alloc);
+	if (!allocators[memory_type]->allocate_global(size, mode, alloc))
+		return false;
+	track_allocation(*alloc, tag);
+	return true;
 }
 
 void DeviceAllocator::Heap::garbage_collect(Device *device_)
@@ -479,6 +780,8 @@ void DeviceAllocator::Heap::garbage_collect(Device *device_)
 
 DeviceAllocator::~DeviceAllocator()
 {
+	// Thread caches hand their memory back here, so they must go before the heaps.
+	allocators.clear();
 	for (auto &heap : heaps)
 		heap.garbage_collect(device);
 }
@@ -606,6 +909,18 @@ void DeviceAllocator::get_memory_budget_nolock(HeapBudget *heap_budgets)
 	}
 }
 
+void DeviceAllocator::get_fragmentation_stats(uint32_t memory_type, MemoryFragmentationStats &stats)
+{
+	allocators[memory_type]->get_fragmentation_stats(stats);
+}
+
+float DeviceAllocator::get_heap_occupancy(const DeviceAllocation &alloc)
+{
+	if (!alloc.alloc)
+		return 1.0f;
+	return alloc.alloc->get_heap_occupancy(alloc);
+}
+
 void DeviceAllocator::get_memory_budget(HeapBudget *heap_budgets)
 {
 	ALLOCATOR_LOCK();
@@ -692,6 +1007,16 @@ bool DeviceAllocator::allocate(uint32_t size, uint32_t memory_type, AllocationMo
 		info.pNext = &dedicated;
 	}
 
+	// Descriptor buffers address every buffer, and buffer blocks are shared, so any of them might need a device address.
+	VkMemoryAllocateFlagsInfo flags_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO };
+	if (device->uses_descriptor_buffer() &&
+	    mode != AllocationMode::OptimalResource && mode != AllocationMode::OptimalRenderTarget)
+	{
+		flags_info.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+		flags_info.pNext = info.pNext;
+		info.pNext = &flags_info;
+	}
+
 	VkMemoryPriorityAllocateInfoEXT priority_info = { VK_STRUCTURE_TYPE_MEMORY_PRIORITY_ALLOCATE_INFO_EXT };
 	if (device->get_device_features().memory_priority_features.memoryPriority)
 	{
@@ -31,6 +31,7 @@
 #include "enum_cast.hpp"
 #include "vulkan_common.hpp"
 #include <assert.h>
+#include <atomic>
 #include <memory>
 #include <stddef.h>
 #include <stdint.h>
@@ -77,6 +78,44 @@ enum MemoryAccessFlag : uint32_t
 };
 using MemoryAccessFlags = uint32_t;
 
+// Which subsystem owns an allocation, see Device::get_allocation_tag_stats().
+enum class AllocationTag : uint8_t
+{
+	// Resolves to the innermost ScopedAllocationTag on the allocating thread.
+	Untagged = 0,
+	Texture,
+	Mesh,
+	RenderGraph,
+	BufferPool,
+	Shadow,
+	Staging,
+	Count
+};
+const char *allocation_tag_to_string(AllocationTag tag);
+
+// Tags allocations made on this thread which do not pick a tag themselves. Scopes nest.
+class ScopedAllocationTag
+{
+public:
+	explicit ScopedAllocationTag(AllocationTag tag);
+	~ScopedAllocationTag();
+	ScopedAllocationTag(const ScopedAllocationTag &) = delete;
+	void operator=(const ScopedAllocationTag &) = delete;
+
+	static AllocationTag get_current();
+
+private:
+	AllocationTag previous;
+};
+
+struct AllocationTagStats
+{
+	VkDeviceSize live_size = 0;
+	VkDeviceSize peak_size = 0;
+	uint32_t live_count = 0;
+	uint32_t peak_count = 0;
+};
+
 struct DeviceAllocation;
 class DeviceAllocator;
 
@@ -120,6 +159,18 @@ public:
 		return longest_run;
 	}
 
+	inline uint32_t get_num_used_sub_blocks() const
+	{
+		uint32_t used = ~free_blocks[0];
+		uint32_t count = 0;
+		while (used)
+		{
+			used &= used - 1;
+			count++;
+		}
+		return count;
+	}
+
 	void allocate(uint32_t num_blocks, DeviceAllocation *block);
 	void free(uint32_t mask);
 
@@ -185,10 +236,23 @@ public:
 		return host_base != nullptr;
 	}
 
+	inline uint32_t get_memory_type() const
+	{
+		return memory_type;
+	}
+
+	// Count for allocations which are not accounted, e.g. imported or aliased memory.
+	inline AllocationTag get_tag() const
+	{
+		return tag;
+	}
+
 	void free_immediate();
 	void free_immediate(DeviceAllocator &allocator);
 
 	static DeviceAllocation make_imported_allocation(VkDeviceMemory memory, VkDeviceSize size, uint32_t memory_type);
+	// Non-owning view of a sub-range, used with ImageCreateInfo::memory_aliases.
+	static DeviceAllocation make_aliased_allocation(const DeviceAllocation &parent, uint32_t offset, uint32_t size);
 
 private:
 	VkDeviceMemory base = VK_NULL_HANDLE;
@@ -201,6 +265,7 @@ private:
 
 	AllocationMode mode = AllocationMode::Count;
 	uint8_t memory_type = 0;
+	AllocationTag tag = AllocationTag::Count;
 
 	void free_global(DeviceAllocator &allocator, uint32_t size, uint32_t memory_type);
 };
@@ -232,6 +297,7 @@ struct MemoryAllocateInfo
 	VkMemoryRequirements requirements = {};
 	VkMemoryPropertyFlags required_properties = 0;
 	AllocationMode mode = {};
+	AllocationTag tag = AllocationTag::Untagged;
 };
 
 struct MiniHeap : Util::IntrusiveListEnabled<MiniHeap>
@@ -242,6 +308,18 @@ struct MiniHeap : Util::IntrusiveListEnabled<MiniHeap>
 
 class Allocator;
 
+struct MemoryFragmentationStats
+{
+	// Bytes of VkDeviceMemory owned by the sub-allocators.
+	VkDeviceSize reserved_size;
+	// Bytes handed out to resources from the reserved memory.
+	VkDeviceSize used_size;
+	// Number of VkDeviceMemory blocks backing the sub-allocators.
+	uint32_t num_blocks;
+	// Number of mini-heaps which are less than half occupied.
+	uint32_t num_sparse_heaps;
+};
+
 class ClassAllocator
 {
 public:
@@ -257,8 +335,22 @@ public:
 	bool allocate(uint32_t size, AllocationMode mode, DeviceAllocation *alloc);
 	void free(DeviceAllocation *alloc);
 
+	// Fraction of sub-blocks in use in the mini-heap which alloc was sub-allocated from.
+	// Sub-blocks held in thread caches count as used.
+	float get_heap_occupancy(const DeviceAllocation &alloc);
+
+	// Enables lock-free per-thread caches of small sub-allocations, one per thread index.
+	void set_num_thread_indices(unsigned count);
+	// Not thread-safe, every thread's cache is returned.
+	void flush_thread_caches();
+
 private:
 	ClassAllocator() = default;
+	bool allocate_locked(uint32_t size, AllocationMode mode, DeviceAllocation *alloc);
+	bool allocate_nolock(uint32_t size, AllocationMode mode, DeviceAllocation *alloc);
+	void free_locked(DeviceAllocation *alloc);
+	void free_nolock(DeviceAllocation *alloc);
+	void accumulate_fragmentation_stats(MemoryFragmentationStats &stats, VkDeviceSize &heap_size);
 	struct AllocationModeHeaps
 	{
 		Util::IntrusiveList<MiniHeap> heaps[Block::NumSubBlocks];
@@ -274,6 +366,15 @@ private:
 	uint32_t memory_type = 0;
 #ifdef GRANITE_VULKAN_MT
 	std::mutex lock;
+
+	// Allocations of up to MaxCachedSubBlocks are refilled and returned CacheBatchSize at a time.
+	enum { MaxCachedSubBlocks = 8, CacheBatchSize = 8, MaxCachedPerBin = 2 * CacheBatchSize };
+	struct ThreadCache
+	{
+		std::vector<DeviceAllocation> bins[Util::ecast(AllocationMode::Count)][MaxCachedSubBlocks];
+	};
+	std::vector<ThreadCache> thread_caches;
+	ThreadCache *get_thread_cache();
 #endif
 	DeviceAllocator *global_allocator = nullptr;
 
@@ -330,6 +431,11 @@ public:
 		global_allocator = allocator;
 	}
 
+	void get_fragmentation_stats(MemoryFragmentationStats &stats);
+	void set_num_thread_indices(unsigned count);
+
+	~Allocator();
+
 private:
 	ClassAllocator classes[Util::ecast(MemoryClass::Count)];
 	DeviceAllocator *global_allocator = nullptr;
@@ -347,16 +453,19 @@ struct HeapBudget
 class DeviceAllocator
 {
 public:
+	friend struct DeviceAllocation;
 	void init(Device *device);
 
 	~DeviceAllocator();
 
 	bool allocate(uint32_t size, uint32_t alignment, AllocationMode mode, uint32_t memory_type,
-	              DeviceAllocation *alloc);
+	              DeviceAllocation *alloc, AllocationTag tag = AllocationTag::Untagged);
 	bool allocate_image_memory(uint32_t size, uint32_t alignment, AllocationMode mode, uint32_t memory_type,
-	                           DeviceAllocation *alloc, VkImage image, bool force_no_dedicated);
+	                           DeviceAllocation *alloc, VkImage image, bool force_no_dedicated,
+	                           AllocationTag tag = AllocationTag::Untagged);
 
-	bool allocate_global(uint32_t size, AllocationMode mode, uint32_t memory_type, DeviceAllocation *alloc);
+	bool allocate_global(uint32_t size, AllocationMode mode, uint32_t memory_type, DeviceAllocation *alloc,
+	                     AllocationTag tag = AllocationTag::Untagged);
 
 	void garbage_collect();
 	void *map_memory(const DeviceAllocation &alloc, MemoryAccessFlags flags, VkDeviceSize offset, VkDeviceSize length);
@@ -370,6 +479,14 @@ public:
 
 	void get_memory_budget(HeapBudget *heaps);
 
+	// Per memory type. Fragmentation is 1 - used_size / reserved_size.
+	void get_fragmentation_stats(uint32_t memory_type, MemoryFragmentationStats &stats);
+	// Returns 1 for allocations which are not sub-allocated, as there is nothing to gain from moving them.
+	float get_heap_occupancy(const DeviceAllocation &alloc);
+
+	// Live and peak usage per tag, AllocationTag::Count entries. Sizes include sub-allocation padding.
+	void get_allocation_tag_stats(AllocationTagStats *stats);
+
 private:
 	std::vector<std::unique_ptr<Allocator>> allocators;
 	Device *device = nullptr;
@@ -398,5 +515,17 @@ private:
 	std::vector<Heap> heaps;
 	bool memory_heap_is_budget_critical[VK_MAX_MEMORY_HEAPS] = {};
 	void get_memory_budget_nolock(HeapBudget *heaps);
+
+	// Updated on every allocation, so keep them out of the lock.
+	struct AtomicTagStats
+	{
+		std::atomic<VkDeviceSize> live_size;
+		std::atomic<VkDeviceSize> peak_size;
+		std::atomic<uint32_t> live_count;
+		std::atomic<uint32_t> peak_count;
+	};
+	AtomicTagStats tag_stats[Util::ecast(AllocationTag::Count)] = {};
+	void track_allocation(DeviceAllocation &alloc, AllocationTag tag);
+	void untrack_allocation(DeviceAllocation &alloc);
 };
 }
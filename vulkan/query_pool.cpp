@@ -22,7 +22,9 @@
 
 #include "query_pool.hpp"
 #include "device.hpp"
+#include "bitops.hpp"
 #include <utility>
+#include <algorithm>
 
 using namespace std;
 
@@ -141,6 +143,7 @@ PerformanceQueryPool::~PerformanceQueryPool()
 {
 	if (pool)
 		device->get_device_table().vkDestroyQueryPool(device->get_device(), pool, nullptr);
+	destroy_region_pools();
 }
 
 void PerformanceQueryPool::begin_command_buffer(VkCommandBuffer cmd)
@@ -309,6 +312,270 @@ bool PerformanceQueryPool::init_counters(const std::vector<std::string> &counter
 	return true;
 }
 
+uint32_t PerformanceQueryPool::get_num_passes(const std::vector<uint32_t> &indices) const
+{
+	VkQueryPoolPerformanceCreateInfoKHR performance_info = { VK_STRUCTURE_TYPE_QUERY_POOL_PERFORMANCE_CREATE_INFO_KHR };
+	performance_info.queueFamilyIndex = queue_family_index;
+	performance_info.counterIndexCount = uint32_t(indices.size());
+	performance_info.pCounterIndices = indices.data();
+
+	uint32_t num_passes = 0;
+	vkGetPhysicalDeviceQueueFamilyPerformanceQueryPassesKHR(device->get_physical_device(),
+	                                                        &performance_info, &num_passes);
+	return num_passes;
+}
+
+void PerformanceQueryPool::destroy_region_pools()
+{
+	if (!device)
+		return;
+
+	auto &table = device->get_device_table();
+	for (auto &region_pool : region_pools)
+		if (region_pool)
+			table.vkDestroyQueryPool(device->get_device(), region_pool, nullptr);
+	region_pools.clear();
+	region_frames.clear();
+}
+
+bool PerformanceQueryPool::init_region_counters(const std::vector<std::string> &counter_names)
+{
+	destroy_region_pools();
+	region_groups.clear();
+	region_counter_indices.clear();
+	region_results.clear();
+	region_group_counter = 0;
+
+	if (!device->get_device_features().performance_query_features.performanceCounterQueryPools)
+	{
+		LOGE("Device does not support VK_KHR_performance_query.\n");
+		return false;
+	}
+
+	if (!device->get_device_features().host_query_reset_features.hostQueryReset)
+	{
+		LOGE("Device does not support host query reset.\n");
+		return false;
+	}
+
+	for (auto &name : counter_names)
+	{
+		auto itr = find_if(begin(counter_descriptions), end(counter_descriptions), [&](const VkPerformanceCounterDescriptionKHR &desc) {
+			return name == desc.name;
+		});
+
+		if (itr == end(counter_descriptions))
+		{
+			LOGW("Performance counter %s does not exist.\n", name.c_str());
+			continue;
+		}
+
+		auto index = uint32_t(itr - begin(counter_descriptions));
+		if (counters[index].scope != VK_PERFORMANCE_COUNTER_SCOPE_COMMAND_KHR)
+		{
+			LOGW("Performance counter %s does not have command scope, cannot sample it per region.\n", name.c_str());
+			continue;
+		}
+
+		if (find(begin(region_counter_indices), end(region_counter_indices), index) != end(region_counter_indices))
+			continue;
+
+		// Greedily pack counters into groups which can be sampled in one pass.
+		if (!region_groups.empty())
+		{
+			auto candidate = region_groups.back();
+			candidate.push_back(index);
+			if (get_num_passes(candidate) == 1)
+			{
+				region_groups.back() = std::move(candidate);
+				region_counter_indices.push_back(index);
+				continue;
+			}
+		}
+
+		if (get_num_passes({ index }) != 1)
+		{
+			LOGW("Performance counter %s requires multiple passes on its own, skipping.\n", name.c_str());
+			continue;
+		}
+
+		region_groups.push_back({ index });
+		region_counter_indices.push_back(index);
+	}
+
+	if (region_groups.empty())
+	{
+		LOGW("No region performance counters were enabled.\n");
+		return false;
+	}
+
+	LOGI("Sampling %u region performance counters in %u groups.\n",
+	     unsigned(region_counter_indices.size()), unsigned(region_groups.size()));
+	return true;
+}
+
+bool PerformanceQueryPool::has_region_counters() const
+{
+	return !region_groups.empty();
+}
+
+VkQueryPool PerformanceQueryPool::get_region_pool(unsigned frame_index, unsigned group)
+{
+	size_t index = frame_index * region_groups.size() + group;
+	if (index >= region_pools.size())
+		region_pools.resize(index + 1);
+
+	if (region_pools[index])
+		return region_pools[index];
+
+	VkQueryPoolPerformanceCreateInfoKHR performance_info = { VK_STRUCTURE_TYPE_QUERY_POOL_PERFORMANCE_CREATE_INFO_KHR };
+	VkQueryPoolCreateInfo info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	info.pNext = &performance_info;
+	info.queryType = VK_QUERY_TYPE_PERFORMANCE_QUERY_KHR;
+	info.queryCount = MaxRegionsPerFrame;
+	performance_info.queueFamilyIndex = queue_family_index;
+	performance_info.counterIndexCount = uint32_t(region_groups[group].size());
+	performance_info.pCounterIndices = region_groups[group].data();
+
+	if (device->get_device_table().vkCreateQueryPool(device->get_device(), &info, nullptr,
+	                                                 &region_pools[index]) != VK_SUCCESS)
+	{
+		LOGE("Failed to create region performance query pool.\n");
+		region_pools[index] = VK_NULL_HANDLE;
+	}
+
+	return region_pools[index];
+}
+
+double PerformanceQueryPool::counter_result_to_double(const VkPerformanceCounterKHR &counter,
+                                                      const VkPerformanceCounterResultKHR &result) const
+{
+	switch (counter.storage)
+	{
+	case VK_PERFORMANCE_COUNTER_STORAGE_INT32_KHR:
+		return double(result.int32);
+	case VK_PERFORMANCE_COUNTER_STORAGE_INT64_KHR:
+		return double(result.int64);
+	case VK_PERFORMANCE_COUNTER_STORAGE_UINT32_KHR:
+		return double(result.uint32);
+	case VK_PERFORMANCE_COUNTER_STORAGE_UINT64_KHR:
+		return double(result.uint64);
+	case VK_PERFORMANCE_COUNTER_STORAGE_FLOAT32_KHR:
+		return double(result.float32);
+	case VK_PERFORMANCE_COUNTER_STORAGE_FLOAT64_KHR:
+		return result.float64;
+	default:
+		return 0.0;
+	}
+}
+
+void PerformanceQueryPool::begin_region_frame(unsigned frame_index)
+{
+	if (region_groups.empty())
+		return;
+
+	if (frame_index >= region_frames.size())
+		region_frames.resize(frame_index + 1);
+
+	auto &table = device->get_device_table();
+	auto &frame = region_frames[frame_index];
+
+	if (frame.pool && !frame.names.empty())
+	{
+		auto &group = region_groups[frame.group];
+		size_t num_counters = group.size();
+		region_readback.resize(num_counters * frame.names.size());
+
+		// The frame context has completed, so the results are available.
+		if (table.vkGetQueryPoolResults(device->get_device(), frame.pool,
+		                                0, uint32_t(frame.names.size()),
+		                                region_readback.size() * sizeof(VkPerformanceCounterResultKHR),
+		                                region_readback.data(),
+		                                num_counters * sizeof(VkPerformanceCounterResultKHR),
+		                                0) == VK_SUCCESS)
+		{
+			for (size_t i = 0; i < frame.names.size(); i++)
+			{
+				auto &accum = region_results[frame.names[i]];
+				accum.resize(region_counter_indices.size());
+
+				for (size_t j = 0; j < num_counters; j++)
+				{
+					auto itr = find(begin(region_counter_indices), end(region_counter_indices), group[j]);
+					auto &a = accum[itr - begin(region_counter_indices)];
+					a.total += counter_result_to_double(counters[group[j]], region_readback[i * num_counters + j]);
+					a.num_samples++;
+				}
+			}
+		}
+		else
+			LOGE("Failed to read back region performance counters.\n");
+	}
+
+	frame.names.clear();
+	frame.group = region_group_counter++ % unsigned(region_groups.size());
+	frame.pool = get_region_pool(frame_index, frame.group);
+	if (frame.pool)
+		table.vkResetQueryPoolEXT(device->get_device(), frame.pool, 0, MaxRegionsPerFrame);
+}
+
+int PerformanceQueryPool::begin_region(VkCommandBuffer cmd, unsigned frame_index, const std::string &name)
+{
+	if (frame_index >= region_frames.size())
+		return -1;
+
+	auto &frame = region_frames[frame_index];
+	if (!frame.pool || frame.names.size() >= MaxRegionsPerFrame)
+		return -1;
+
+	int index = int(frame.names.size());
+	frame.names.push_back(name);
+	device->get_device_table().vkCmdBeginQuery(cmd, frame.pool, uint32_t(index), 0);
+	return index;
+}
+
+void PerformanceQueryPool::end_region(VkCommandBuffer cmd, unsigned frame_index, int index)
+{
+	if (index < 0 || frame_index >= region_frames.size())
+		return;
+
+	auto &frame = region_frames[frame_index];
+	device->get_device_table().vkCmdEndQuery(cmd, frame.pool, uint32_t(index));
+}
+
+void PerformanceQueryPool::report_regions(const PerformanceRegionReportCallback &func) const
+{
+	for (auto &region : region_results)
+	{
+		for (size_t i = 0; i < region.second.size(); i++)
+		{
+			auto &accum = region.second[i];
+			if (!accum.num_samples)
+				continue;
+
+			PerformanceCounterReport report = {};
+			report.counter = &counters[region_counter_indices[i]];
+			report.desc = &counter_descriptions[region_counter_indices[i]];
+			report.average = accum.total / double(accum.num_samples);
+			report.num_samples = accum.num_samples;
+
+			if (func)
+				func(region.first, report);
+			else
+			{
+				LOGI("Region %s: %s = %g %s (%llu samples)\n", region.first.c_str(), report.desc->name,
+				     report.average, unit_to_str(report.counter->unit),
+				     static_cast<unsigned long long>(report.num_samples));
+			}
+		}
+	}
+}
+
+void PerformanceQueryPool::reset_regions()
+{
+	region_results.clear();
+}
+
 QueryPool::QueryPool(Device *device_)
 	: device(device_)
 	, table(device_->get_device_table())
@@ -317,17 +584,28 @@ QueryPool::QueryPool(Device *device_)
 
 	// Ignore timestampValidBits and friends for now.
 	if (supports_timestamp)
-		add_pool();
+		add_pool(64);
 }
 
 QueryPool::~QueryPool()
 {
 	for (auto &pool : pools)
-		table.vkDestroyQueryPool(device->get_device(), pool.pool, nullptr);
+		destroy_pool(pool);
+}
+
+void QueryPool::destroy_pool(Pool &pool)
+{
+	table.vkDestroyQueryPool(device->get_device(), pool.pool, nullptr);
+	if (pool.readback_buffer)
+		table.vkDestroyBuffer(device->get_device(), pool.readback_buffer, nullptr);
+	if (pool.readback_memory)
+		table.vkFreeMemory(device->get_device(), pool.readback_memory, nullptr);
 }
 
 void QueryPool::begin()
 {
+	unsigned used = 0;
+
 	for (unsigned i = 0; i <= pool_index; i++)
 	{
 		if (i >= pools.size())
@@ -337,15 +615,37 @@ void QueryPool::begin()
 		if (pool.index == 0)
 			continue;
 
-		table.vkGetQueryPoolResults(device->get_device(), pool.pool,
-		                            0, pool.index,
-		                            pool.index * sizeof(uint64_t),
-		                            pool.query_results.data(),
-		                            sizeof(uint64_t),
-		                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		used += pool.index;
+
+		// Only fall back to querying the pool if some command buffer could not resolve on the GPU.
+		bool need_query = false;
+		for (unsigned j = 0; j < pool.index && !need_query; j++)
+			need_query = !pool.cookies[j]->gpu_resolved;
+
+		if (need_query)
+		{
+			table.vkGetQueryPoolResults(device->get_device(), pool.pool,
+			                            0, pool.index,
+			                            pool.index * sizeof(uint64_t),
+			                            pool.query_results.data(),
+			                            sizeof(uint64_t),
+			                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		}
+
+		if (pool.readback_mapped && !pool.readback_coherent)
+		{
+			VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+			range.memory = pool.readback_memory;
+			range.size = VK_WHOLE_SIZE;
+			table.vkInvalidateMappedMemoryRanges(device->get_device(), 1, &range);
+		}
 
 		for (unsigned j = 0; j < pool.index; j++)
-			pool.cookies[j]->signal_timestamp_ticks(pool.query_results[j]);
+		{
+			auto &cookie = pool.cookies[j];
+			cookie->signal_timestamp_ticks(cookie->gpu_resolved ? pool.readback_mapped[j] : pool.query_results[j]);
+			cookie.reset();
+		}
 
 		if (device->get_device_features().host_query_reset_features.hostQueryReset)
 			table.vkResetQueryPoolEXT(device->get_device(), pool.pool, 0, pool.index);
@@ -354,13 +654,60 @@ void QueryPool::begin()
 	pool_index = 0;
 	for (auto &pool : pools)
 		pool.index = 0;
+
+	// The frame context is idle here, so pools added to keep up with the last frame
+	// are folded into one persistent pool sized for that usage.
+	if (pools.size() > 1)
+	{
+		for (auto &pool : pools)
+			destroy_pool(pool);
+		pools.clear();
+		add_pool(Util::next_pow2(used));
+	}
+}
+
+void QueryPool::init_readback(Pool &pool)
+{
+	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	info.size = pool.size * sizeof(uint64_t);
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (table.vkCreateBuffer(device->get_device(), &info, nullptr, &pool.readback_buffer) != VK_SUCCESS)
+		return;
+
+	VkMemoryRequirements reqs;
+	table.vkGetBufferMemoryRequirements(device->get_device(), pool.readback_buffer, &reqs);
+	uint32_t memory_type = device->find_memory_type(BufferDomain::CachedHost, reqs.memoryTypeBits);
+
+	VkMemoryAllocateInfo alloc_info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	alloc_info.allocationSize = reqs.size;
+	alloc_info.memoryTypeIndex = memory_type;
+
+	void *mapped = nullptr;
+	if (memory_type == UINT32_MAX ||
+	    table.vkAllocateMemory(device->get_device(), &alloc_info, nullptr, &pool.readback_memory) != VK_SUCCESS ||
+	    table.vkBindBufferMemory(device->get_device(), pool.readback_buffer, pool.readback_memory, 0) != VK_SUCCESS ||
+	    table.vkMapMemory(device->get_device(), pool.readback_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+	{
+		LOGW("Failed to allocate timestamp readback buffer, falling back to vkGetQueryPoolResults.\n");
+		table.vkDestroyBuffer(device->get_device(), pool.readback_buffer, nullptr);
+		if (pool.readback_memory)
+			table.vkFreeMemory(device->get_device(), pool.readback_memory, nullptr);
+		pool.readback_buffer = VK_NULL_HANDLE;
+		pool.readback_memory = VK_NULL_HANDLE;
+		return;
+	}
+
+	pool.readback_mapped = static_cast<const uint64_t *>(mapped);
+	pool.readback_coherent = (device->get_memory_properties().memoryTypes[memory_type].propertyFlags &
+	                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
 }
 
-void QueryPool::add_pool()
+void QueryPool::add_pool(unsigned size)
 {
 	VkQueryPoolCreateInfo pool_info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
 	pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-	pool_info.queryCount = 64;
+	pool_info.queryCount = std::max(size, 64u);
 
 	Pool pool;
 	table.vkCreateQueryPool(device->get_device(), &pool_info, nullptr, &pool.pool);
@@ -368,6 +715,7 @@ void QueryPool::add_pool()
 	pool.index = 0;
 	pool.query_results.resize(pool.size);
 	pool.cookies.resize(pool.size);
+	init_readback(pool);
 
 	if (device->get_device_features().host_query_reset_features.hostQueryReset)
 		table.vkResetQueryPoolEXT(device->get_device(), pool.pool, 0, pool.size);
@@ -387,11 +735,14 @@ QueryPoolHandle QueryPool::write_timestamp(VkCommandBuffer cmd, VkPipelineStageF
 		pool_index++;
 
 	if (pool_index >= pools.size())
-		add_pool();
+		add_pool(pools.back().size);
 
 	auto &pool = pools[pool_index];
 
 	auto cookie = QueryPoolHandle(device->handle_pool.query.allocate(device, true));
+	cookie->pool = pool.pool;
+	cookie->readback_buffer = pool.readback_buffer;
+	cookie->query_index = pool.index;
 	pool.cookies[pool.index] = cookie;
 
 	if (!device->get_device_features().host_query_reset_features.hostQueryReset)
@@ -402,6 +753,64 @@ QueryPoolHandle QueryPool::write_timestamp(VkCommandBuffer cmd, VkPipelineStageF
 	return cookie;
 }
 
+void QueryPool::resolve_timestamps(const VolkDeviceTable &table, VkCommandBuffer cmd,
+                                   QueryPoolHandle *timestamps, size_t count)
+{
+	bool copied = false;
+
+	for (size_t i = 0; i < count; )
+	{
+		auto &ts = *timestamps[i];
+
+		// Timestamps in a command buffer are mostly allocated back to back, copy them in runs.
+		size_t run = 1;
+		while (i + run < count && timestamps[i + run]->pool == ts.pool &&
+		       timestamps[i + run]->query_index == ts.query_index + run)
+		{
+			run++;
+		}
+
+		if (ts.readback_buffer)
+		{
+			table.vkCmdCopyQueryPoolResults(cmd, ts.pool, ts.query_index, uint32_t(run),
+			                                ts.readback_buffer, ts.query_index * sizeof(uint64_t),
+			                                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+			for (size_t j = 0; j < run; j++)
+				timestamps[i + j]->gpu_resolved = true;
+			copied = true;
+		}
+
+		i += run;
+	}
+
+	if (copied)
+	{
+		VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		table.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+		                           0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+}
+
+bool QueryPool::reset_timestamp(const VolkDeviceTable &table, VkDevice device, const QueryPoolResult &timestamp)
+{
+	if (timestamp.pool == VK_NULL_HANDLE)
+		return false;
+	table.vkResetQueryPoolEXT(device, timestamp.pool, timestamp.query_index, 1);
+	return true;
+}
+
+bool QueryPool::read_timestamp(const VolkDeviceTable &table, VkDevice device,
+                               const QueryPoolResult &timestamp, uint64_t &ticks)
+{
+	if (timestamp.pool == VK_NULL_HANDLE)
+		return false;
+	return table.vkGetQueryPoolResults(device, timestamp.pool, timestamp.query_index, 1,
+	                                   sizeof(ticks), &ticks, sizeof(ticks),
+	                                   VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS;
+}
+
 void QueryPoolResultDeleter::operator()(QueryPoolResult *query)
 {
 	query->device->handle_pool.query.free(query);
@@ -434,6 +843,17 @@ void TimestampInterval::accumulate_time(double t)
 	total_accumulations++;
 }
 
+void TimestampInterval::accumulate_device_time(double t)
+{
+	accumulate_time(t);
+	device_timebase = true;
+}
+
+bool TimestampInterval::is_device_timebase() const
+{
+	return device_timebase;
+}
+
 double TimestampInterval::get_time_per_iteration() const
 {
 	if (total_frame_iterations)
@@ -497,6 +917,8 @@ void TimestampIntervalManager::log_simple(const TimestampIntervalReportCallback
 			report.time_per_frame_context = timestamp.get_time_per_iteration();
 			report.accumulations_per_frame_context =
 					double(timestamp.get_total_accumulations()) / double(timestamp.get_total_frame_iterations());
+			report.total_time = timestamp.get_total_time();
+			report.device_timebase = timestamp.is_device_timebase();
 
 			if (func)
 			{
@@ -512,4 +934,84 @@ void TimestampIntervalManager::log_simple(const TimestampIntervalReportCallback
 		}
 	}
 }
-}
\ No newline at end of file
+
+GpuScope::GpuScope(QueueIndices queue_, string name_)
+	: name(move(name_)), queue(queue_)
+{
+}
+
+void GpuScope::accumulate_time(double ms)
+{
+	frame_time += ms;
+	active = true;
+}
+
+void GpuScope::commit_frame()
+{
+	if (!active)
+		return;
+
+	samples[sample_index] = frame_time;
+	sample_index = (sample_index + 1) % NumSamples;
+	num_samples = std::min<unsigned>(num_samples + 1, NumSamples);
+	frame_time = 0.0;
+	active = false;
+
+	double sorted[NumSamples];
+	std::copy(samples, samples + num_samples, sorted);
+	std::sort(sorted, sorted + num_samples);
+
+	double total = 0.0;
+	for (unsigned i = 0; i < num_samples; i++)
+		total += sorted[i];
+
+	statistics.min_ms = sorted[0];
+	statistics.max_ms = sorted[num_samples - 1];
+	statistics.avg_ms = total / double(num_samples);
+	statistics.p99_ms = sorted[(num_samples - 1) * 99 / 100];
+	statistics.num_samples = num_samples;
+}
+
+const GpuScopeStatistics &GpuScope::get_statistics() const
+{
+	return statistics;
+}
+
+void GpuScopeProfiler::begin_frame()
+{
+	frame_events.clear();
+	frame_scopes.clear();
+}
+
+void GpuScopeProfiler::add_scope(QueueIndices queue, unsigned depth, const string &name, double start_ms, double end_ms)
+{
+	Util::Hasher h;
+	h.u32(queue);
+	h.string(name);
+	auto *scope = scopes.emplace_yield(h.get(), queue, name);
+	scope->accumulate_time(end_ms - start_ms);
+
+	frame_events.push_back({ name, queue, depth, start_ms, end_ms, {} });
+	frame_scopes.push_back(scope);
+}
+
+void GpuScopeProfiler::end_frame()
+{
+	for (auto *scope : frame_scopes)
+		scope->commit_frame();
+
+	for (size_t i = 0, n = frame_events.size(); i < n; i++)
+		frame_events[i].statistics = frame_scopes[i]->get_statistics();
+
+	std::stable_sort(frame_events.begin(), frame_events.end(), [](const GpuScopeEvent &a, const GpuScopeEvent &b) {
+		if (a.queue != b.queue)
+			return a.queue < b.queue;
+		return a.start_ms < b.start_ms;
+	});
+}
+
+const vector<GpuScopeEvent> &GpuScopeProfiler::get_frame_events() const
+{
+	return frame_events;
+}
+}
@@ -26,11 +26,25 @@
 #include "vulkan_common.hpp"
 #include "object_pool.hpp"
 #include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 namespace Vulkan
 {
 class Device;
 
+struct PerformanceCounterReport
+{
+	const VkPerformanceCounterKHR *counter;
+	const VkPerformanceCounterDescriptionKHR *desc;
+	double average;
+	uint64_t num_samples;
+};
+
+using PerformanceRegionReportCallback =
+	std::function<void (const std::string &, const PerformanceCounterReport &)>;
+
 class PerformanceQueryPool
 {
 public:
@@ -43,6 +57,20 @@ public:
 
 	void report();
 
+	// Per-region counters, sampled around e.g. render graph passes.
+	// The counter set is split into groups which can be sampled in a single pass,
+	// and one group is sampled per frame context, so multi-pass sets are covered over several frames.
+	// Only counters with command scope can be sampled this way.
+	bool init_region_counters(const std::vector<std::string> &enable_counter_names);
+	bool has_region_counters() const;
+	// Reads back results from the previous use of the frame context, and resets its queries.
+	void begin_region_frame(unsigned frame_index);
+	// Returns a query index to pass to end_region(), or -1.
+	int begin_region(VkCommandBuffer cmd, unsigned frame_index, const std::string &name);
+	void end_region(VkCommandBuffer cmd, unsigned frame_index, int index);
+	void report_regions(const PerformanceRegionReportCallback &func) const;
+	void reset_regions();
+
 	uint32_t get_num_counters() const;
 	const VkPerformanceCounterKHR *get_available_counters() const;
 	const VkPerformanceCounterDescriptionKHR *get_available_counter_descs() const;
@@ -55,6 +83,37 @@ private:
 	std::vector<VkPerformanceCounterKHR> counters;
 	std::vector<VkPerformanceCounterDescriptionKHR> counter_descriptions;
 	std::vector<uint32_t> active_indices;
+
+	enum { MaxRegionsPerFrame = 256 };
+
+	struct RegionFrame
+	{
+		VkQueryPool pool = VK_NULL_HANDLE;
+		unsigned group = 0;
+		std::vector<std::string> names;
+	};
+
+	struct RegionAccumulator
+	{
+		double total = 0.0;
+		uint64_t num_samples = 0;
+	};
+
+	// Counter indices, one set per single pass group.
+	std::vector<std::vector<uint32_t>> region_groups;
+	std::vector<uint32_t> region_counter_indices;
+	// One pool per frame context and group, created on demand.
+	std::vector<VkQueryPool> region_pools;
+	std::vector<RegionFrame> region_frames;
+	std::unordered_map<std::string, std::vector<RegionAccumulator>> region_results;
+	std::vector<VkPerformanceCounterResultKHR> region_readback;
+	unsigned region_group_counter = 0;
+
+	uint32_t get_num_passes(const std::vector<uint32_t> &indices) const;
+	VkQueryPool get_region_pool(unsigned frame_index, unsigned group);
+	void destroy_region_pools();
+	double counter_result_to_double(const VkPerformanceCounterKHR &counter,
+	                                const VkPerformanceCounterResultKHR &result) const;
 };
 
 class QueryPoolResult;
@@ -92,6 +151,7 @@ public:
 
 private:
 	friend class Util::ObjectPool<QueryPoolResult>;
+	friend class QueryPool;
 
 	explicit QueryPoolResult(Device *device_, bool device_timebase_)
 		: device(device_), device_timebase(device_timebase_)
@@ -101,6 +161,12 @@ private:
 	uint64_t timestamp_ticks = 0;
 	bool has_timestamp = false;
 	bool device_timebase = false;
+
+	// Where the query lives, and whether a command buffer copied it to the readback buffer of its pool.
+	VkQueryPool pool = VK_NULL_HANDLE;
+	VkBuffer readback_buffer = VK_NULL_HANDLE;
+	uint32_t query_index = 0;
+	bool gpu_resolved = false;
 };
 
 using QueryPoolHandle = Util::IntrusivePtr<QueryPoolResult>;
@@ -116,6 +182,18 @@ public:
 
 	QueryPoolHandle write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage);
 
+	// Copies timestamps written earlier in cmd to the readback buffers of their pools with
+	// vkCmdCopyQueryPoolResults, so begin() reads them from memory instead of querying the pool.
+	// Must be recorded outside a render pass on a queue with graphics or compute support.
+	static void resolve_timestamps(const VolkDeviceTable &table, VkCommandBuffer cmd,
+	                               QueryPoolHandle *timestamps, size_t count);
+
+	// Host side access to the query behind a device timestamp, for command buffers which are submitted again.
+	// Both return false for host timestamps. Resets need hostQueryReset.
+	static bool reset_timestamp(const VolkDeviceTable &table, VkDevice device, const QueryPoolResult &timestamp);
+	static bool read_timestamp(const VolkDeviceTable &table, VkDevice device,
+	                           const QueryPoolResult &timestamp, uint64_t &ticks);
+
 private:
 	Device *device;
 	const VolkDeviceTable &table;
@@ -127,11 +205,18 @@ private:
 		std::vector<QueryPoolHandle> cookies;
 		unsigned index = 0;
 		unsigned size = 0;
+
+		VkBuffer readback_buffer = VK_NULL_HANDLE;
+		VkDeviceMemory readback_memory = VK_NULL_HANDLE;
+		const uint64_t *readback_mapped = nullptr;
+		bool readback_coherent = false;
 	};
 	std::vector<Pool> pools;
 	unsigned pool_index = 0;
 
-	void add_pool();
+	void add_pool(unsigned size);
+	void init_readback(Pool &pool);
+	void destroy_pool(Pool &pool);
 
 	bool supports_timestamp = false;
 };
@@ -142,6 +227,9 @@ public:
 	explicit TimestampInterval(std::string tag);
 
 	void accumulate_time(double t);
+	// Intervals measured with GPU timestamps rather than CPU clocks.
+	void accumulate_device_time(double t);
+	bool is_device_timebase() const;
 	double get_time_per_iteration() const;
 	double get_time_per_accumulation() const;
 	const std::string &get_tag() const;
@@ -157,6 +245,7 @@ private:
 	double total_time = 0.0;
 	uint64_t total_frame_iterations = 0;
 	uint64_t total_accumulations = 0;
+	bool device_timebase = false;
 };
 
 struct TimestampIntervalReport
@@ -164,6 +253,9 @@ struct TimestampIntervalReport
 	double time_per_accumulation;
 	double time_per_frame_context;
 	double accumulations_per_frame_context;
+	// Since the last reset, which lets callers sample deltas.
+	double total_time;
+	bool device_timebase;
 };
 
 using TimestampIntervalReportCallback = std::function<void (const std::string &, const TimestampIntervalReport &)>;
@@ -179,4 +271,62 @@ public:
 private:
 	Util::IntrusiveHashMap<TimestampInterval> timestamps;
 };
+
+struct GpuScopeStatistics
+{
+	double min_ms = 0.0;
+	double avg_ms = 0.0;
+	double max_ms = 0.0;
+	double p99_ms = 0.0;
+	unsigned num_samples = 0;
+};
+
+struct GpuScopeEvent
+{
+	std::string name;
+	QueueIndices queue;
+	unsigned depth;
+	// Relative to the earliest scope in the frame context.
+	double start_ms;
+	double end_ms;
+	GpuScopeStatistics statistics;
+};
+
+// Rolling statistics over the per-frame total of a scope.
+class GpuScope : public Util::IntrusiveHashMapEnabled<GpuScope>
+{
+public:
+	GpuScope(QueueIndices queue, std::string name);
+
+	void accumulate_time(double ms);
+	void commit_frame();
+	const GpuScopeStatistics &get_statistics() const;
+
+private:
+	enum { NumSamples = 256 };
+	std::string name;
+	QueueIndices queue;
+	double samples[NumSamples] = {};
+	unsigned num_samples = 0;
+	unsigned sample_index = 0;
+	double frame_time = 0.0;
+	bool active = false;
+	GpuScopeStatistics statistics;
+};
+
+class GpuScopeProfiler
+{
+public:
+	void begin_frame();
+	void add_scope(QueueIndices queue, unsigned depth, const std::string &name, double start_ms, double end_ms);
+	void end_frame();
+
+	// Scopes of the most recently resolved frame context, sorted by queue and start time.
+	const std::vector<GpuScopeEvent> &get_frame_events() const;
+
+private:
+	Util::IntrusiveHashMap<GpuScope> scopes;
+	std::vector<GpuScopeEvent> frame_events;
+	std::vector<GpuScope *> frame_scopes;
+};
 }
@@ -805,6 +805,19 @@ RenderPass::RenderPass(Hash hash, Device *device_, const RenderPassInfo &info)
 #ifdef VULKAN_DEBUG
 	LOGI("Creating render pass.\n");
 #endif
+
+	// Shading rate attachments only exist in render pass 2.
+#ifdef VK_KHR_fragment_shading_rate
+	if (info.shading_rate)
+	{
+		auto *view_masks = multiview_info.subpassCount ? multiview_view_mask.data() : nullptr;
+		auto layout = info.shading_rate->get_image().get_layout(VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR);
+		if (create_render_pass2(rp_info, view_masks, info.shading_rate->get_format(), layout))
+			return;
+		LOGW("Failed to create render pass with shading rate attachment, falling back.\n");
+	}
+#endif
+
 	auto &table = device->get_device_table();
 	if (table.vkCreateRenderPass(device->get_device(), &rp_info, nullptr, &render_pass) != VK_SUCCESS)
 		LOGE("Failed to create render pass.");
@@ -814,6 +827,151 @@ RenderPass::RenderPass(Hash hash, Device *device_, const RenderPassInfo &info)
 #endif
 }
 
+bool RenderPass::create_render_pass2(const VkRenderPassCreateInfo &create_info, const uint32_t *view_masks,
+                                     VkFormat shading_rate_format, VkImageLayout shading_rate_layout)
+{
+#ifdef VK_KHR_fragment_shading_rate
+	VkExtent2D texel_size;
+	if (!device->get_shading_rate_texel_size(&texel_size))
+		return false;
+
+	const auto convert_reference = [&](const VkAttachmentReference &ref, bool input) {
+		VkAttachmentReference2KHR ref2 = { VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2_KHR };
+		ref2.attachment = ref.attachment;
+		ref2.layout = ref.layout;
+		// Only input attachments need an aspect.
+		if (input && ref.attachment != VK_ATTACHMENT_UNUSED)
+			ref2.aspectMask = format_to_aspect_mask(create_info.pAttachments[ref.attachment].format);
+		return ref2;
+	};
+
+	// The shading rate attachment goes last, after depth-stencil.
+	vector<VkAttachmentDescription2KHR> attachments(create_info.attachmentCount + 1);
+	for (uint32_t i = 0; i < create_info.attachmentCount; i++)
+	{
+		auto &src = create_info.pAttachments[i];
+		auto &dst = attachments[i];
+		dst = { VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2_KHR };
+		dst.flags = src.flags;
+		dst.format = src.format;
+		dst.samples = src.samples;
+		dst.loadOp = src.loadOp;
+		dst.storeOp = src.storeOp;
+		dst.stencilLoadOp = src.stencilLoadOp;
+		dst.stencilStoreOp = src.stencilStoreOp;
+		dst.initialLayout = src.initialLayout;
+		dst.finalLayout = src.finalLayout;
+	}
+
+	auto &rate = attachments.back();
+	rate = { VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2_KHR };
+	rate.format = shading_rate_format;
+	rate.samples = VK_SAMPLE_COUNT_1_BIT;
+	rate.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	// Must not be discarded, it's reused by later passes and frames.
+	rate.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	rate.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	rate.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	rate.initialLayout = shading_rate_layout;
+	rate.finalLayout = shading_rate_layout;
+
+	VkAttachmentReference2KHR rate_ref = { VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2_KHR };
+	rate_ref.attachment = create_info.attachmentCount;
+	rate_ref.layout = shading_rate_layout;
+
+	VkFragmentShadingRateAttachmentInfoKHR rate_info = { VK_STRUCTURE_TYPE_FRAGMENT_SHADING_RATE_ATTACHMENT_INFO_KHR };
+	rate_info.pFragmentShadingRateAttachment = &rate_ref;
+	rate_info.shadingRateAttachmentTexelSize = texel_size;
+
+	// Keep references in stable storage, the subpasses point into these.
+	vector<VkAttachmentReference2KHR> references;
+	size_t num_references = 0;
+	for (uint32_t i = 0; i < create_info.subpassCount; i++)
+	{
+		auto &subpass = create_info.pSubpasses[i];
+		num_references += subpass.inputAttachmentCount + subpass.colorAttachmentCount + 1;
+		if (subpass.pResolveAttachments)
+			num_references += subpass.colorAttachmentCount;
+	}
+	references.reserve(num_references);
+
+	vector<VkSubpassDescription2KHR> subpasses(create_info.subpassCount);
+	for (uint32_t i = 0; i < create_info.subpassCount; i++)
+	{
+		auto &src = create_info.pSubpasses[i];
+		auto &dst = subpasses[i];
+		dst = { VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2_KHR };
+		dst.pNext = &rate_info;
+		dst.flags = src.flags;
+		dst.pipelineBindPoint = src.pipelineBindPoint;
+		dst.viewMask = view_masks ? view_masks[i] : 0;
+
+		dst.inputAttachmentCount = src.inputAttachmentCount;
+		dst.pInputAttachments = references.data() + references.size();
+		for (uint32_t j = 0; j < src.inputAttachmentCount; j++)
+			references.push_back(convert_reference(src.pInputAttachments[j], true));
+
+		dst.colorAttachmentCount = src.colorAttachmentCount;
+		dst.pColorAttachments = references.data() + references.size();
+		for (uint32_t j = 0; j < src.colorAttachmentCount; j++)
+			references.push_back(convert_reference(src.pColorAttachments[j], false));
+
+		if (src.pResolveAttachments)
+		{
+			dst.pResolveAttachments = references.data() + references.size();
+			for (uint32_t j = 0; j < src.colorAttachmentCount; j++)
+				references.push_back(convert_reference(src.pResolveAttachments[j], false));
+		}
+
+		if (src.pDepthStencilAttachment)
+		{
+			dst.pDepthStencilAttachment = references.data() + references.size();
+			references.push_back(convert_reference(*src.pDepthStencilAttachment, false));
+		}
+
+		dst.preserveAttachmentCount = src.preserveAttachmentCount;
+		dst.pPreserveAttachments = src.pPreserveAttachments;
+	}
+
+	vector<VkSubpassDependency2KHR> dependencies(create_info.dependencyCount);
+	for (uint32_t i = 0; i < create_info.dependencyCount; i++)
+	{
+		auto &src = create_info.pDependencies[i];
+		auto &dst = dependencies[i];
+		dst = { VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2_KHR };
+		dst.srcSubpass = src.srcSubpass;
+		dst.dstSubpass = src.dstSubpass;
+		dst.srcStageMask = src.srcStageMask;
+		dst.dstStageMask = src.dstStageMask;
+		dst.srcAccessMask = src.srcAccessMask;
+		dst.dstAccessMask = src.dstAccessMask;
+		dst.dependencyFlags = src.dependencyFlags;
+	}
+
+	VkRenderPassCreateInfo2KHR info2 = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2_KHR };
+	info2.attachmentCount = uint32_t(attachments.size());
+	info2.pAttachments = attachments.data();
+	info2.subpassCount = uint32_t(subpasses.size());
+	info2.pSubpasses = subpasses.data();
+	info2.dependencyCount = uint32_t(dependencies.size());
+	info2.pDependencies = dependencies.data();
+
+	// Not recorded for Fossilize, which only knows about VkRenderPassCreateInfo here.
+	auto &table = device->get_device_table();
+	if (table.vkCreateRenderPass2KHR(device->get_device(), &info2, nullptr, &render_pass) != VK_SUCCESS)
+		return false;
+
+	shading_rate_attachment = true;
+	return true;
+#else
+	(void)create_info;
+	(void)view_masks;
+	(void)shading_rate_format;
+	(void)shading_rate_layout;
+	return false;
+#endif
+}
+
 RenderPass::~RenderPass()
 {
 	auto &table = device->get_device_table();
@@ -844,6 +1002,10 @@ unsigned Framebuffer::setup_raw_views(VkImageView *views, const RenderPassInfo &
 			views[num_views++] = info.depth_stencil->get_render_target_view(info.base_layer);
 	}
 
+	// Matches the attachment RenderPass::create_render_pass2() appends.
+	if (info.shading_rate)
+		views[num_views++] = info.shading_rate->get_view();
+
 	return num_views;
 }
 
@@ -892,10 +1054,13 @@ Framebuffer::Framebuffer(Device *device_, const RenderPass &rp, const RenderPass
     , info(info_)
 {
 	compute_dimensions(info_, width, height);
-	VkImageView views[VULKAN_NUM_ATTACHMENTS + 1];
+	VkImageView views[VULKAN_NUM_ATTACHMENTS + 2];
 	unsigned num_views = 0;
 
 	num_views = setup_raw_views(views, info_);
+	// The render pass fell back to not using it.
+	if (info_.shading_rate && !rp.has_shading_rate_attachment())
+		num_views--;
 
 	VkFramebufferCreateInfo fb_info = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
 	fb_info.renderPass = rp.get_render_pass();
@@ -950,6 +1115,8 @@ Framebuffer &FramebufferAllocator::request_framebuffer(const RenderPassInfo &inf
 
 	if (info.depth_stencil)
 		h.u64(info.depth_stencil->get_cookie());
+	if (info.shading_rate)
+		h.u64(info.shading_rate->get_cookie());
 
 	// For multiview we bind the whole attachment, and base layer is encoded in the render pass.
 	if (info.num_layers > 1)
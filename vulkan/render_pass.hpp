@@ -49,6 +49,9 @@ struct RenderPassInfo
 {
 	const ImageView *color_attachments[VULKAN_NUM_ATTACHMENTS];
 	const ImageView *depth_stencil = nullptr;
+	// R8_UINT VK_KHR_fragment_shading_rate attachment, one texel per Device::get_shading_rate_texel_size().
+	// Applies to every subpass.
+	const ImageView *shading_rate = nullptr;
 	unsigned num_color_attachments = 0;
 	RenderPassOpFlags op_flags = 0;
 	uint32_t clear_attachments = 0;
@@ -145,6 +148,17 @@ public:
 		return subpasses_info[subpass].input_attachments[index];
 	}
 
+	VkFormat get_color_attachment_format(unsigned attachment) const
+	{
+		VK_ASSERT(attachment < VULKAN_NUM_ATTACHMENTS);
+		return color_attachments[attachment];
+	}
+
+	VkFormat get_depth_stencil_format() const
+	{
+		return depth_stencil;
+	}
+
 	bool has_depth(unsigned subpass) const
 	{
 		VK_ASSERT(subpass < subpasses_info.size());
@@ -159,15 +173,23 @@ public:
 		       format_has_stencil_aspect(depth_stencil);
 	}
 
+	bool has_shading_rate_attachment() const
+	{
+		return shading_rate_attachment;
+	}
+
 private:
 	Device *device;
 	VkRenderPass render_pass = VK_NULL_HANDLE;
+	bool shading_rate_attachment = false;
 
 	VkFormat color_attachments[VULKAN_NUM_ATTACHMENTS] = {};
 	VkFormat depth_stencil = VK_FORMAT_UNDEFINED;
 	std::vector<SubpassInfo> subpasses_info;
 
 	void setup_subpasses(const VkRenderPassCreateInfo &create_info);
+	bool create_render_pass2(const VkRenderPassCreateInfo &create_info, const uint32_t *view_masks,
+	                         VkFormat shading_rate_format, VkImageLayout shading_rate_layout);
 };
 
 class Framebuffer : public Cookie, public NoCopyNoMove, public InternalSyncEnabled
@@ -59,6 +59,7 @@ PipelineLayout::PipelineLayout(Hash hash, Device *device_, const CombinedResourc
 {
 	VkDescriptorSetLayout layouts[VULKAN_NUM_DESCRIPTOR_SETS] = {};
 	unsigned num_sets = 0;
+	descriptor_buffer = device->uses_descriptor_buffer();
 	for (unsigned i = 0; i < VULKAN_NUM_DESCRIPTOR_SETS; i++)
 	{
 		set_allocators[i] = device->request_descriptor_set_allocator(layout.sets[i], layout.stages_for_bindings[i],
@@ -66,8 +67,15 @@ PipelineLayout::PipelineLayout(Hash hash, Device *device_, const CombinedResourc
 		layouts[i] = set_allocators[i]->get_layout();
 		if (layout.descriptor_set_mask & (1u << i))
 			num_sets = i + 1;
+		if (!set_allocators[i]->supports_descriptor_buffer())
+			descriptor_buffer = false;
 	}
 
+	// A pipeline cannot mix descriptor sets and descriptor buffers.
+	if (descriptor_buffer)
+		for (unsigned i = 0; i < VULKAN_NUM_DESCRIPTOR_SETS; i++)
+			layouts[i] = set_allocators[i]->get_descriptor_buffer_layout();
+
 	if (num_sets > device->get_gpu_properties().limits.maxBoundDescriptorSets)
 	{
 		LOGE("Number of sets %u exceeds device limit of %u.\n",
@@ -94,10 +102,13 @@ PipelineLayout::PipelineLayout(Hash hash, Device *device_, const CombinedResourc
 	if (table.vkCreatePipelineLayout(device->get_device(), &info, nullptr, &pipe_layout) != VK_SUCCESS)
 		LOGE("Failed to create pipeline layout.\n");
 #ifdef GRANITE_VULKAN_FOSSILIZE
-	device->register_pipeline_layout(pipe_layout, get_hash(), info);
+	// Descriptor buffer set layouts are not recorded.
+	if (!descriptor_buffer)
+		device->register_pipeline_layout(pipe_layout, get_hash(), info);
 #endif
 
-	create_update_templates();
+	if (!descriptor_buffer)
+		create_update_templates();
 }
 
 void PipelineLayout::create_update_templates()
@@ -600,15 +611,31 @@ Program::Program(Device *device_, Shader *compute_shader)
 	device->bake_program(*this);
 }
 
-VkPipeline Program::get_pipeline(Hash hash) const
+VkPipeline Program::get_pipeline(Hash hash, bool mark_used) const
 {
 	auto *ret = pipelines.find(hash);
-	return ret ? ret->get() : VK_NULL_HANDLE;
+	if (!ret)
+		return VK_NULL_HANDLE;
+
+	// Avoid dirtying the cache line on every lookup.
+	if (mark_used && !ret->used.load(std::memory_order_relaxed))
+		ret->used.store(true, std::memory_order_relaxed);
+	return ret->pipeline;
+}
+
+VkPipeline Program::add_pipeline(Hash hash, VkPipeline pipeline, bool mark_used)
+{
+	auto *ret = pipelines.emplace_yield(hash, pipeline);
+	if (mark_used)
+		ret->used.store(true, std::memory_order_relaxed);
+	return ret->pipeline;
 }
 
-VkPipeline Program::add_pipeline(Hash hash, VkPipeline pipeline)
+void Program::get_used_pipeline_hashes(std::vector<Hash> &hashes) const
 {
-	return pipelines.emplace_yield(hash, pipeline)->get();
+	for (auto &pipe : pipelines)
+		if (pipe.used.load(std::memory_order_relaxed))
+			hashes.push_back(pipe.get_hash());
 }
 
 void Program::destroy_pipeline(VkPipeline pipeline)
@@ -619,23 +646,9 @@ void Program::destroy_pipeline(VkPipeline pipeline)
 		device->destroy_pipeline(pipeline);
 }
 
-void Program::promote_read_write_to_read_only()
-{
-#ifdef GRANITE_VULKAN_MT
-	pipelines.move_to_read_only();
-#endif
-}
-
 Program::~Program()
 {
-#ifdef GRANITE_VULKAN_MT
-	for (auto &pipe : pipelines.get_read_only())
-		destroy_pipeline(pipe.get());
-	for (auto &pipe : pipelines.get_read_write())
-		destroy_pipeline(pipe.get());
-#else
 	for (auto &pipe : pipelines)
-		destroy_pipeline(pipe.get());
-#endif
+		destroy_pipeline(pipe.pipeline);
 }
 }
@@ -29,6 +29,8 @@
 #include "limits.hpp"
 #include "vulkan_headers.hpp"
 #include "enum_cast.hpp"
+#include <atomic>
+#include <vector>
 
 namespace spirv_cross
 {
@@ -93,6 +95,8 @@ struct ResourceBinding
 		VkBufferView buffer_view;
 	};
 	VkDeviceSize dynamic_offset;
+	// For descriptor buffers, which address UBOs and SSBOs directly.
+	VkDeviceAddress buffer_address;
 };
 
 struct ResourceBindings
@@ -136,12 +140,19 @@ public:
 		return update_template[set];
 	}
 
+	// All sets are bound through VK_EXT_descriptor_buffer instead of descriptor sets.
+	bool uses_descriptor_buffer() const
+	{
+		return descriptor_buffer;
+	}
+
 private:
 	Device *device;
 	VkPipelineLayout pipe_layout = VK_NULL_HANDLE;
 	CombinedResourceLayout layout;
 	DescriptorSetAllocator *set_allocators[VULKAN_NUM_DESCRIPTOR_SETS] = {};
 	VkDescriptorUpdateTemplate update_template[VULKAN_NUM_DESCRIPTOR_SETS] = {};
+	bool descriptor_buffer = false;
 	void create_update_templates();
 };
 
@@ -201,17 +212,43 @@ public:
 		return layout;
 	}
 
-	VkPipeline get_pipeline(Util::Hash hash) const;
-	VkPipeline add_pipeline(Util::Hash hash, VkPipeline pipeline);
+	// Pipelines looked up or added with mark_used are recorded in the Fossilize usage history,
+	// which orders warm-up on the next run. Warm-up itself must not count as use.
+	VkPipeline get_pipeline(Util::Hash hash, bool mark_used = true) const;
+	VkPipeline add_pipeline(Util::Hash hash, VkPipeline pipeline, bool mark_used = true);
+	void get_used_pipeline_hashes(std::vector<Util::Hash> &hashes) const;
 
-	void promote_read_write_to_read_only();
+	// Used while asynchronous pipeline compiles for this program are pending, see
+	// Device::set_asynchronous_pipeline_compile(). The fallback must have a compatible pipeline layout
+	// and consume a subset of the vertex attributes, e.g. a shared ubershader variant.
+	void set_fallback_program(Program *fallback)
+	{
+		fallback_program = fallback;
+	}
+
+	Program *get_fallback_program() const
+	{
+		return fallback_program;
+	}
 
 private:
 	void set_shader(ShaderStage stage, Shader *handle);
 	Device *device;
 	Shader *shaders[Util::ecast(ShaderStage::Count)] = {};
 	PipelineLayout *layout = nullptr;
-	VulkanCache<Util::IntrusivePODWrapper<VkPipeline>> pipelines;
+	Program *fallback_program = nullptr;
+
+	struct CachedPipeline : Util::IntrusiveHashMapEnabled<CachedPipeline>
+	{
+		explicit CachedPipeline(VkPipeline pipeline_)
+			: pipeline(pipeline_)
+		{
+		}
+
+		VkPipeline pipeline;
+		mutable std::atomic_bool used{false};
+	};
+	VulkanCache<CachedPipeline> pipelines;
 	void destroy_pipeline(VkPipeline pipeline);
 };
 }
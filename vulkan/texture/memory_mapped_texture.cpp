@@ -21,6 +21,9 @@
  */
 
 #include "memory_mapped_texture.hpp"
+#include "lz4.hpp"
+#include "logging.hpp"
+#include <algorithm>
 #include <string.h>
 #include <stdlib.h>
 
@@ -40,13 +43,17 @@ struct MemoryMappedHeader
 	uint32_t levels;
 	uint32_t flags;
 	uint64_t payload_size;
-	uint64_t reserved1;
+	uint64_t num_chunks;
 };
 static const size_t header_size = 16 + 8 * 4 + 2 * 8;
 static_assert(sizeof(MemoryMappedHeader) == header_size, "Header size is not properly packed.");
 
 static const char MAGIC[16] = "GRANITE TEXFMT1";
 
+static_assert(sizeof(MemoryMappedTextureChunk) == 24, "Chunk size is not properly packed.");
+// Large subresources are split further so a single level still decodes on many threads.
+static const size_t SupercompressedChunkSize = 256 * 1024;
+
 void MemoryMappedTexture::set_generate_mipmaps_on_load(bool enable)
 {
 	mipgen_on_load = enable;
@@ -99,15 +106,94 @@ void MemoryMappedTexture::set_cube(VkFormat format, uint32_t size, uint32_t cube
 	cube = true;
 }
 
-bool MemoryMappedTexture::copy_to_path(Granite::Filesystem &fs, const std::string &path)
+static MemoryMappedHeader build_header(const TextureFormatLayout &layout, MemoryMappedTextureFlags flags)
+{
+	MemoryMappedHeader header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.width = layout.get_width();
+	header.height = layout.get_height();
+	header.depth = layout.get_depth();
+	header.flags = flags;
+	header.layers = layout.get_layers();
+	header.levels = layout.get_levels();
+	header.payload_size = layout.get_required_size();
+	header.type = layout.get_image_type();
+	header.format = layout.get_format();
+	return header;
+}
+
+static bool write_supercompressed(Granite::File &target_file, const TextureFormatLayout &layout,
+                                  MemoryMappedTextureFlags flags)
+{
+	vector<MemoryMappedTextureChunk> table;
+	vector<uint8_t> data;
+	auto *base = static_cast<const uint8_t *>(layout.data());
+
+	for (uint32_t level = 0; level < layout.get_levels(); level++)
+	{
+		size_t subresource_size = layout.get_layer_size(level) * layout.get_depth(level);
+		for (uint32_t layer = 0; layer < layout.get_layers(); layer++)
+		{
+			auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
+			for (size_t offset = 0; offset < subresource_size; offset += SupercompressedChunkSize)
+			{
+				MemoryMappedTextureChunk chunk = {};
+				chunk.offset = uint64_t(src + offset - base);
+				chunk.compressed_offset = data.size();
+				chunk.size = uint32_t(std::min(SupercompressedChunkSize, subresource_size - offset));
+
+				// Store chunks which do not shrink as is.
+				data.resize(data.size() + chunk.size);
+				uint8_t *dst = data.data() + chunk.compressed_offset;
+				size_t compressed_size = chunk.size > 1 ?
+				                         Util::lz4_compress(src + offset, chunk.size, dst, chunk.size - 1) : 0;
+				if (compressed_size)
+				{
+					chunk.compressed_size = uint32_t(compressed_size);
+					data.resize(chunk.compressed_offset + compressed_size);
+				}
+				else
+				{
+					chunk.compressed_size = chunk.size;
+					memcpy(dst, src + offset, chunk.size);
+				}
+
+				table.push_back(chunk);
+			}
+		}
+	}
+
+	size_t table_size = table.size() * sizeof(MemoryMappedTextureChunk);
+	auto header = build_header(layout, flags | MEMORY_MAPPED_TEXTURE_SUPERCOMPRESSED_LZ4_BIT);
+	header.payload_size = table_size + data.size();
+	header.num_chunks = table.size();
+
+	auto *new_mapped = static_cast<uint8_t *>(target_file.map_write(sizeof(header) + header.payload_size));
+	if (!new_mapped)
+		return false;
+
+	memcpy(new_mapped, &header, sizeof(header));
+	memcpy(new_mapped + sizeof(header), table.data(), table_size);
+	memcpy(new_mapped + sizeof(header) + table_size, data.data(), data.size());
+	target_file.unmap();
+
+	LOGI("Supercompressed texture from %zu to %zu bytes.\n",
+	     size_t(layout.get_required_size()), size_t(header.payload_size));
+	return true;
+}
+
+bool MemoryMappedTexture::copy_to_path(Granite::Filesystem &fs, const std::string &path, bool supercompress)
 {
-	if (layout.get_required_size() == 0 || !mapped)
+	if (layout.get_required_size() == 0 || !mapped || is_supercompressed())
 		return false;
 
 	auto target_file = fs.open(path, Granite::FileMode::WriteOnly);
 	if (!target_file)
 		return false;
 
+	if (supercompress)
+		return write_supercompressed(*target_file, layout, get_flags());
+
 	void *new_mapped = target_file->map_write(get_required_size());
 	if (!new_mapped)
 		return false;
@@ -122,17 +208,7 @@ bool MemoryMappedTexture::map_write(unique_ptr<Granite::File> new_file, void *ma
 	file = move(new_file);
 	mapped = static_cast<uint8_t *>(mapped_);
 
-	MemoryMappedHeader header = {};
-	memcpy(header.magic, MAGIC, sizeof(MAGIC));
-	header.width = layout.get_width();
-	header.height = layout.get_height();
-	header.depth = layout.get_depth();
-	header.flags = get_flags();
-	header.layers = layout.get_layers();
-	header.levels = layout.get_levels();
-	header.payload_size = layout.get_required_size();
-	header.type = layout.get_image_type();
-	header.format = layout.get_format();
+	auto header = build_header(layout, get_flags());
 	memcpy(mapped, &header, sizeof(header));
 
 	layout.set_buffer(mapped + sizeof(header), layout.get_required_size());
@@ -196,6 +272,12 @@ void MemoryMappedTexture::make_local_copy()
 	if (empty())
 		return;
 
+	if (is_supercompressed())
+	{
+		decompress();
+		return;
+	}
+
 	auto new_file = make_unique<ScratchFile>(mapped, get_required_size());
 	file = move(new_file);
 	mapped = static_cast<uint8_t *>(file->map());
@@ -282,10 +364,96 @@ bool MemoryMappedTexture::map_copy(const void *mapped_, size_t size)
 	return map_read(move(new_file), new_mapped);
 }
 
-bool MemoryMappedTexture::map_read(unique_ptr<Granite::File> new_file, void *mapped_)
+const MemoryMappedTextureChunk &MemoryMappedTexture::get_chunk(unsigned index) const
+{
+	return chunks[index];
+}
+
+bool MemoryMappedTexture::decompress_chunk(unsigned index, void *dst) const
+{
+	auto &chunk = chunks[index];
+	const uint8_t *src = chunk_data + chunk.compressed_offset;
+	if (chunk.compressed_size == chunk.size)
+	{
+		memcpy(dst, src, chunk.size);
+		return true;
+	}
+	else
+		return Util::lz4_decompress(src, chunk.compressed_size, dst, chunk.size);
+}
+
+bool MemoryMappedTexture::decompress()
+{
+	if (!is_supercompressed())
+		return true;
+
+	auto new_file = make_unique<ScratchFile>(nullptr, get_required_size());
+	auto *new_mapped = static_cast<uint8_t *>(new_file->map());
+	uint8_t *payload = new_mapped + sizeof(MemoryMappedHeader);
+
+	for (unsigned i = 0; i < num_chunks; i++)
+	{
+		if (!decompress_chunk(i, payload + chunks[i].offset))
+		{
+			LOGE("Failed to decompress texture chunk %u.\n", i);
+			return false;
+		}
+	}
+
+	// Keep a plain header around, so the local copy can be written out again.
+	MemoryMappedHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	header.flags &= ~MEMORY_MAPPED_TEXTURE_SUPERCOMPRESSED_LZ4_BIT;
+	header.payload_size = layout.get_required_size();
+	header.num_chunks = 0;
+	memcpy(new_mapped, &header, sizeof(header));
+
+	file = move(new_file);
+	mapped = new_mapped;
+	chunks = nullptr;
+	chunk_data = nullptr;
+	chunk_data_size = 0;
+	num_chunks = 0;
+	layout.set_buffer(payload, layout.get_required_size());
+	return true;
+}
+
+bool MemoryMappedTexture::validate_chunks() const
+{
+	uint32_t level = 0;
+	for (unsigned i = 0; i < num_chunks; i++)
+	{
+		auto &chunk = chunks[i];
+		if (chunk.compressed_size > chunk.size || chunk.compressed_offset > chunk_data_size ||
+		    chunk.compressed_size > chunk_data_size - chunk.compressed_offset)
+			return false;
+
+		// Chunks are ordered and must stay within one level.
+		while (level < layout.get_levels() &&
+		       chunk.offset >= layout.get_mip_info(level).offset +
+		                       layout.get_layer_size(level) * layout.get_depth(level) * layout.get_layers())
+			level++;
+
+		if (level >= layout.get_levels() || chunk.offset < layout.get_mip_info(level).offset)
+			return false;
+
+		uint64_t level_end = layout.get_mip_info(level).offset +
+		                     layout.get_layer_size(level) * layout.get_depth(level) * layout.get_layers();
+		if (chunk.offset + chunk.size > level_end)
+			return false;
+	}
+
+	return true;
+}
+
+bool MemoryMappedTexture::map_read(unique_ptr<Granite::File> new_file, void *mapped_, bool decompress_payload)
 {
 	mapped = static_cast<uint8_t *>(mapped_);
 	file = move(new_file);
+	chunks = nullptr;
+	chunk_data = nullptr;
+	chunk_data_size = 0;
+	num_chunks = 0;
 
 	auto *header = reinterpret_cast<const MemoryMappedHeader *>(mapped);
 	switch (header->type)
@@ -313,6 +481,33 @@ bool MemoryMappedTexture::map_read(unique_ptr<Granite::File> new_file, void *map
 	swizzle.b = static_cast<VkComponentSwizzle>((header->flags >> MEMORY_MAPPED_TEXTURE_SWIZZLE_B_SHIFT) & MEMORY_MAPPED_TEXTURE_SWIZZLE_MASK);
 	swizzle.a = static_cast<VkComponentSwizzle>((header->flags >> MEMORY_MAPPED_TEXTURE_SWIZZLE_A_SHIFT) & MEMORY_MAPPED_TEXTURE_SWIZZLE_MASK);
 
+	if ((header->flags & MEMORY_MAPPED_TEXTURE_SUPERCOMPRESSED_LZ4_BIT) != 0)
+	{
+		if (header->num_chunks == 0 || header->num_chunks > UINT32_MAX ||
+		    header->payload_size + sizeof(MemoryMappedHeader) > file->get_size())
+			return false;
+
+		size_t table_size = header->num_chunks * sizeof(MemoryMappedTextureChunk);
+		if (table_size > header->payload_size)
+			return false;
+
+		// There is no data in the layout until the chunks are decompressed.
+		layout.set_buffer(nullptr, 0);
+		chunks = reinterpret_cast<const MemoryMappedTextureChunk *>(mapped + sizeof(MemoryMappedHeader));
+		chunk_data = mapped + sizeof(MemoryMappedHeader) + table_size;
+		chunk_data_size = header->payload_size - table_size;
+		num_chunks = unsigned(header->num_chunks);
+
+		if (!validate_chunks())
+		{
+			LOGE("Supercompressed texture has an invalid chunk table.\n");
+			num_chunks = 0;
+			return false;
+		}
+
+		return !decompress_payload || decompress();
+	}
+
 	if ((layout.get_required_size() + sizeof(MemoryMappedHeader)) < file->get_size())
 		return false;
 	if (header->payload_size != layout.get_required_size())
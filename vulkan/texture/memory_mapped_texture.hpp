@@ -31,6 +31,8 @@ enum MemoryMappedTextureFlagBits
 {
 	MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT = 1 << 0,
 	MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT = 1 << 1,
+	// Payload is a table of LZ4 compressed chunks, see MemoryMappedTexture::copy_to_path().
+	MEMORY_MAPPED_TEXTURE_SUPERCOMPRESSED_LZ4_BIT = 1 << 2,
 	MEMORY_MAPPED_TEXTURE_SWIZZLE_R_SHIFT = 16,
 	MEMORY_MAPPED_TEXTURE_SWIZZLE_G_SHIFT = 19,
 	MEMORY_MAPPED_TEXTURE_SWIZZLE_B_SHIFT = 22,
@@ -39,6 +41,19 @@ enum MemoryMappedTextureFlagBits
 };
 using MemoryMappedTextureFlags = uint32_t;
 
+// One independently compressed piece of a supercompressed payload.
+// Chunks never cross a mip level or array layer, so they decode in parallel and skipped levels need not decode at all.
+struct MemoryMappedTextureChunk
+{
+	// Where the chunk decodes to in the layout.
+	uint64_t offset;
+	// Relative to the start of the chunk data, which follows the chunk table.
+	uint64_t compressed_offset;
+	uint32_t size;
+	// Equal to size if the chunk is stored uncompressed.
+	uint32_t compressed_size;
+};
+
 class MemoryMappedTexture
 {
 public:
@@ -52,12 +67,31 @@ public:
 	bool map_write(Granite::Filesystem &fs, const std::string &path);
 	bool map_write(std::unique_ptr<Granite::File> file, void *mapped);
 	bool map_read(Granite::Filesystem &fs, const std::string &path);
-	bool map_read(std::unique_ptr<Granite::File> file, void *mapped);
+	// Supercompressed files are decompressed to memory, unless decompress_payload is false.
+	// Then the layout has no data, and the caller decompresses chunks where it wants them.
+	bool map_read(std::unique_ptr<Granite::File> file, void *mapped, bool decompress_payload = true);
 	bool map_copy(const void *mapped, size_t size);
 	bool map_write_scratch();
-	bool copy_to_path(Granite::Filesystem &fs, const std::string &path);
+	// With supercompress, every mip level and layer is split into LZ4 compressed chunks.
+	bool copy_to_path(Granite::Filesystem &fs, const std::string &path, bool supercompress = false);
 	void make_local_copy();
 
+	inline bool is_supercompressed() const
+	{
+		return num_chunks != 0;
+	}
+
+	inline unsigned get_num_chunks() const
+	{
+		return num_chunks;
+	}
+
+	const MemoryMappedTextureChunk &get_chunk(unsigned index) const;
+	// Writes get_chunk(index).size bytes to dst.
+	bool decompress_chunk(unsigned index, void *dst) const;
+	// Decompresses all chunks to memory, after which the layout has data.
+	bool decompress();
+
 	inline const Vulkan::TextureFormatLayout &get_layout() const
 	{
 		return layout;
@@ -79,9 +113,15 @@ public:
 	}
 
 private:
+	bool validate_chunks() const;
+
 	Vulkan::TextureFormatLayout layout;
 	std::unique_ptr<Granite::File> file;
 	uint8_t *mapped = nullptr;
+	const MemoryMappedTextureChunk *chunks = nullptr;
+	const uint8_t *chunk_data = nullptr;
+	size_t chunk_data_size = 0;
+	unsigned num_chunks = 0;
 	bool cube = false;
 	bool mipgen_on_load = false;
 	VkComponentMapping swizzle = {
@@ -0,0 +1,245 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "single_pass_downsample.hpp"
+#include "texture_format.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace Granite
+{
+bool supports_single_pass_downsample(Vulkan::Device &device, VkFormat format)
+{
+	auto &features = device.get_device_features();
+
+	bool supports_full_group =
+			device.supports_subgroup_size_log2(true, 2, 7);
+	bool supports_compute = (features.subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0;
+
+	if (device.get_gpu_properties().limits.maxComputeWorkGroupSize[0] < 256)
+		return false;
+	if (!features.enabled_features.shaderStorageImageArrayDynamicIndexing)
+		return false;
+
+	VkFormatProperties3KHR props3 = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3_KHR };
+	device.get_format_properties(format, &props3);
+	if ((props3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_STORAGE_WRITE_WITHOUT_FORMAT_BIT_KHR) == 0)
+		return false;
+	if ((props3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_STORAGE_READ_WITHOUT_FORMAT_BIT_KHR) == 0)
+		return false;
+
+	constexpr VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_QUAD_BIT;
+	bool supports_quad_basic = (features.subgroup_properties.supportedOperations & required) == required;
+	return supports_full_group && supports_compute && supports_quad_basic;
+}
+
+void emit_single_pass_downsample(Vulkan::CommandBuffer &cmd, const SPDInfo &info)
+{
+	cmd.set_program("builtin://shaders/post/ffx-spd/spd.comp",
+	                {{"SUBGROUP", 1},
+	                 {"SINGLE_INPUT_TAP", 1},
+	                 {"COMPONENTS", int(info.num_components)},
+	                 {"FILTER_MOD", int(info.filter_mod != nullptr)},
+	                 {"Z_TRANSFORM", int(info.z_transform != nullptr)},
+	                 {"Z_REDUCE_MAX", int(info.z_transform != nullptr && info.z_reduce_max)},
+	                 {"LUMINANCE_ADAPT", int(info.luminance_buffer != nullptr)},
+	                 {"SRGB", int(info.srgb)}});
+
+	const Vulkan::StockSampler stock = info.z_transform ?
+			Vulkan::StockSampler::NearestClamp : Vulkan::StockSampler::LinearClamp;
+
+	cmd.set_texture(0, 0, *info.input, stock);
+	cmd.set_storage_buffer(0, 1, *info.counter_buffer, info.counter_buffer_offset, 4);
+	for (unsigned i = 0; i < MaxSPDMips; i++)
+		cmd.set_storage_texture(0, 2 + i, *info.output_mips[std::min(i, info.num_mips - 1)]);
+
+	if (info.filter_mod)
+	{
+		memcpy(cmd.allocate_typed_constant_data<vec4>(1, 0, info.num_mips),
+		       info.filter_mod, info.num_mips * sizeof(*info.filter_mod));
+	}
+
+	if (info.z_transform)
+	{
+		memcpy(cmd.allocate_typed_constant_data<mat2>(1, 1, 1),
+		       info.z_transform, sizeof(*info.z_transform));
+	}
+
+	if (info.luminance_buffer)
+	{
+		cmd.set_storage_buffer(0, 2 + MaxSPDMips, *info.luminance_buffer);
+		*cmd.allocate_typed_constant_data<vec4>(1, 2, 1) = *info.luminance_params;
+	}
+
+	struct Registers
+	{
+		uint32_t base_image_resolution[2];
+		float inv_resolution[2];
+		uint32_t mips;
+		uint32_t num_workgroups;
+	} push = {};
+
+	push.base_image_resolution[0] = info.output_mips[0]->get_view_width();
+	push.base_image_resolution[1] = info.output_mips[0]->get_view_height();
+	push.inv_resolution[0] = 1.0f / float(info.input->get_view_width());
+	push.inv_resolution[1] = 1.0f / float(info.input->get_view_height());
+	push.mips = info.num_mips;
+
+	uint32_t wg_x = (push.base_image_resolution[0] + 31) / 32;
+	uint32_t wg_y = (push.base_image_resolution[1] + 31) / 32;
+	push.num_workgroups = wg_x * wg_y;
+	cmd.push_constants(&push, 0, sizeof(push));
+
+	cmd.enable_subgroup_size_control(true);
+	cmd.set_subgroup_size_log2(true, 2, 7);
+	cmd.dispatch(wg_x, wg_y, 1);
+	cmd.enable_subgroup_size_control(false);
+}
+
+static unsigned mipmap_format_components(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R16_SFLOAT:
+	case VK_FORMAT_R32_SFLOAT:
+		return 1;
+
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R16G16_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
+		return 2;
+
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		return 3;
+
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+	case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 4;
+
+	default:
+		return 0;
+	}
+}
+
+// Storage images cannot be sRGB, so those are written through the UNORM alias.
+static VkFormat mipmap_storage_format(VkFormat format)
+{
+	if (!Vulkan::format_is_srgb(format))
+		return format;
+
+	Vulkan::ImageCreateInfo info = {};
+	info.format = format;
+	info.misc = Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+	VkFormat view_formats[2];
+	if (Vulkan::ImageCreateInfo::compute_view_formats(info, view_formats) != 2)
+		return VK_FORMAT_UNDEFINED;
+	return view_formats[0];
+}
+
+bool supports_compute_mipmap(Vulkan::Device &device, const Vulkan::ImageCreateInfo &info)
+{
+	if (info.type != VK_IMAGE_TYPE_2D || info.depth != 1 || info.samples != VK_SAMPLE_COUNT_1_BIT)
+		return false;
+
+	unsigned levels = Vulkan::TextureFormatLayout::num_miplevels(info.width, info.height);
+	if (levels < 2 || levels - 1 > MaxSPDMips)
+		return false;
+
+	if (mipmap_format_components(info.format) == 0)
+		return false;
+
+	VkFormat storage_format = mipmap_storage_format(info.format);
+	if (storage_format == VK_FORMAT_UNDEFINED)
+		return false;
+
+	return supports_single_pass_downsample(device, storage_format);
+}
+
+void emit_compute_mipmaps(Vulkan::CommandBuffer &cmd, const Vulkan::Image * const *images, unsigned count)
+{
+	auto &device = cmd.get_device();
+
+	unsigned num_slices = 0;
+	for (unsigned i = 0; i < count; i++)
+		num_slices += images[i]->get_create_info().layers;
+
+	// SPD resets its counters once it is done, so they only need clearing here.
+	Vulkan::BufferCreateInfo counter_info = {};
+	counter_info.domain = Vulkan::BufferDomain::Device;
+	counter_info.size = num_slices * sizeof(uint32_t);
+	counter_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	auto counter = device.create_buffer(counter_info);
+	cmd.fill_buffer(*counter, 0);
+	cmd.buffer_barrier(*counter, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	unsigned slice = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &image = *images[i];
+		auto &create_info = image.get_create_info();
+		VK_ASSERT(create_info.levels > 1 && create_info.levels - 1 <= MaxSPDMips);
+
+		Vulkan::ImageViewCreateInfo view_info = {};
+		view_info.image = &image;
+		view_info.view_type = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.levels = 1;
+		view_info.layers = 1;
+
+		for (unsigned layer = 0; layer < create_info.layers; layer++, slice++)
+		{
+			view_info.base_layer = layer;
+			view_info.base_level = 0;
+			view_info.format = create_info.format;
+			auto input = device.create_image_view(view_info);
+
+			Vulkan::ImageViewHandle views[MaxSPDMips];
+			const Vulkan::ImageView *output_mips[MaxSPDMips];
+			view_info.format = mipmap_storage_format(create_info.format);
+			for (unsigned level = 1; level < create_info.levels; level++)
+			{
+				view_info.base_level = level;
+				views[level - 1] = device.create_image_view(view_info);
+				output_mips[level - 1] = views[level - 1].get();
+			}
+
+			SPDInfo info = {};
+			info.input = input.get();
+			info.output_mips = output_mips;
+			info.num_mips = create_info.levels - 1;
+			info.counter_buffer = counter.get();
+			info.counter_buffer_offset = slice * sizeof(uint32_t);
+			info.num_components = mipmap_format_components(create_info.format);
+			info.srgb = Vulkan::format_is_srgb(create_info.format);
+			emit_single_pass_downsample(cmd, info);
+		}
+	}
+}
+}
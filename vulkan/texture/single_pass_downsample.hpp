@@ -0,0 +1,65 @@
+/* Copyright (c) 2017-2022 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "command_buffer.hpp"
+#include "image.hpp"
+#include "math.hpp"
+
+namespace Granite
+{
+bool supports_single_pass_downsample(Vulkan::Device &device, VkFormat format);
+
+struct SPDInfo
+{
+	const Vulkan::ImageView *input;
+	const Vulkan::ImageView **output_mips;
+	unsigned num_mips;
+	const Vulkan::Buffer *counter_buffer;
+	VkDeviceSize counter_buffer_offset;
+	unsigned num_components;
+	const vec4 *filter_mod;
+	const mat2 *z_transform;
+	// With z_transform, keep the farthest rather than the nearest depth, e.g. for occlusion culling.
+	bool z_reduce_max;
+	// Adapts average log luminance like luminance.comp from the alpha of the last mip, which must be 1x1.
+	// x: lerp factor, y: minimum log luminance, z: maximum log luminance.
+	const Vulkan::Buffer *luminance_buffer;
+	const vec4 *luminance_params;
+	// The input is an sRGB view and the outputs are UNORM views of the same sRGB image.
+	bool srgb;
+};
+
+static constexpr unsigned MaxSPDMips = 12;
+void emit_single_pass_downsample(Vulkan::CommandBuffer &cmd, const SPDInfo &info);
+
+// Compute path for Device::create_image() with IMAGE_MISC_GENERATE_MIPS_BIT. The image needs
+// VK_IMAGE_USAGE_STORAGE_BIT, and IMAGE_MISC_MUTABLE_SRGB_BIT with extended usage for sRGB formats.
+bool supports_compute_mipmap(Vulkan::Device &device, const Vulkan::ImageCreateInfo &info);
+
+// Generates the full mip chain of every layer of every image with one SPD dispatch each,
+// without barriers in between. Level 0 must be in SHADER_READ_ONLY_OPTIMAL and the other levels in GENERAL,
+// both visible to compute. On return, the mips are written by compute shader stores.
+void emit_compute_mipmaps(Vulkan::CommandBuffer &cmd, const Vulkan::Image * const *images, unsigned count);
+}
@@ -22,6 +22,8 @@
 
 #include "texture_decoder.hpp"
 #include "logging.hpp"
+#include <algorithm>
+#include <vector>
 
 namespace Granite
 {
@@ -1298,35 +1300,74 @@ static void dispatch_kernel(Vulkan::CommandBuffer &cmd, uint32_t width, uint32_t
 	}
 }
 
-Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vulkan::TextureFormatLayout &layout,
-                                            const VkComponentMapping &swizzle)
+static VkFormat compressed_format_to_transcoded_format(VkFormat format)
 {
-	auto &device = cmd.get_device();
+	switch (format)
+	{
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+		return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
 
-	if (!device.get_device_features().enabled_features.shaderStorageImageWriteWithoutFormat)
+	case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+		return VK_FORMAT_BC3_UNORM_BLOCK;
+	case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+		return VK_FORMAT_BC3_SRGB_BLOCK;
+
+	case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+
+	default:
+		break;
+	}
+
+	if (Vulkan::format_compression_type(format) == Vulkan::FormatCompressionType::ASTC)
 	{
-		LOGE("Require shaderStorageImageWriteWithoutFormat.\n");
-		return {};
+		if (Vulkan::format_is_compressed_hdr(format))
+			return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+		else if (Vulkan::format_is_srgb(format))
+			return VK_FORMAT_BC3_SRGB_BLOCK;
+		else
+			return VK_FORMAT_BC3_UNORM_BLOCK;
 	}
 
-	uint32_t block_width, block_height;
-	Vulkan::TextureFormatLayout::format_block_dim(layout.get_format(), block_width, block_height);
-	if (block_width == 1 || block_height == 1)
+	return VK_FORMAT_UNDEFINED;
+}
+
+// Matches the MODE spec constant in bcn_encode.comp.
+static uint32_t transcoded_format_to_encode_mode(VkFormat format)
+{
+	switch (format)
 	{
-		LOGE("Not a compressed format.\n");
-		return {};
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		return 0;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		return 1;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 2;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return 3;
+	default:
+		return 4;
 	}
+}
+
+static bool upload_payload_images(Vulkan::Device &device, const Vulkan::TextureFormatLayout &layout,
+                                  Util::SmallVector<Vulkan::ImageHandle, 32> &uploaded_images)
+{
+	uint32_t block_width, block_height;
+	Vulkan::TextureFormatLayout::format_block_dim(layout.get_format(), block_width, block_height);
 
 	auto image_info = Vulkan::ImageCreateInfo::immutable_image(layout);
-	image_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-	image_info.format = compressed_format_to_decoded_format(layout.get_format());
-	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
-	                   VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-	image_info.flags = VK_IMAGE_CREATE_EXTENDED_USAGE_BIT | VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
-	image_info.swizzle = swizzle;
+	image_info.format = compressed_format_to_payload_format(layout.get_format());
 	if (image_info.format == VK_FORMAT_UNDEFINED)
-		return {};
-	auto decoded_image = device.create_image(image_info);
+		return false;
 
 	auto staging = device.create_image_staging_buffer(layout);
 	for (auto &blit : staging.blits)
@@ -1342,20 +1383,12 @@ Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vu
 	Vulkan::InitialImageBuffer split_staging;
 	split_staging.buffer = staging.buffer;
 	split_staging.blits.resize(1);
-	Util::SmallVector<Vulkan::ImageHandle, 32> uploaded_images(layout.get_levels());
+	uploaded_images.clear();
+	uploaded_images.resize(layout.get_levels());
 
-	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-	image_info.format = compressed_format_to_payload_format(layout.get_format());
-	if (image_info.format == VK_FORMAT_UNDEFINED)
-		return {};
-	image_info.swizzle = { VK_COMPONENT_SWIZZLE_R,
-	                       VK_COMPONENT_SWIZZLE_G,
-	                       VK_COMPONENT_SWIZZLE_B,
-	                       VK_COMPONENT_SWIZZLE_A };
 	image_info.misc = Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
 	                  Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_GRAPHICS_BIT |
 	                  Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
-	image_info.initial_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	image_info.levels = 1;
 
 	for (auto &blit : staging.blits)
@@ -1369,8 +1402,17 @@ Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vu
 		uploaded_images[level] = device.create_image_from_staging_buffer(image_info, &split_staging);
 	}
 
+	return true;
+}
+
+static void record_decode_dispatches(Vulkan::CommandBuffer &cmd, const Vulkan::TextureFormatLayout &layout,
+                                     const Vulkan::Image &decoded_image,
+                                     const Util::SmallVector<Vulkan::ImageHandle, 32> &uploaded_images)
+{
+	auto &device = cmd.get_device();
+
 	Vulkan::ImageViewCreateInfo view_info;
-	view_info.image = decoded_image.get();
+	view_info.image = &decoded_image;
 	view_info.view_type = VK_IMAGE_VIEW_TYPE_2D;
 	view_info.levels = 1;
 	view_info.layers = 1;
@@ -1382,17 +1424,6 @@ Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vu
 	input_view_info.layers = 1;
 	input_view_info.base_level = 0;
 
-	cmd.image_barrier(*decoded_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
-	                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
-	                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
-
-	if (!set_compute_decoder(cmd, layout.get_format()))
-	{
-		LOGE("Failed to set the compute decoder.\n");
-		return {};
-	}
-
-	auto start_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 	for (unsigned level = 0; level < layout.get_levels(); level++)
 	{
 		uint32_t mip_width = layout.get_width(level);
@@ -1411,14 +1442,329 @@ Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vu
 			dispatch_kernel(cmd, mip_width, mip_height, layout.get_format());
 		}
 	}
+}
+
+// Decodes every level and layer into decoded_image, which is left in GENERAL layout.
+static bool record_decode(Vulkan::CommandBuffer &cmd, const Vulkan::TextureFormatLayout &layout,
+                          const Vulkan::Image &decoded_image)
+{
+	Util::SmallVector<Vulkan::ImageHandle, 32> uploaded_images;
+	if (!upload_payload_images(cmd.get_device(), layout, uploaded_images))
+		return false;
+
+	cmd.image_barrier(decoded_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+	                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+	                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	if (!set_compute_decoder(cmd, layout.get_format()))
+	{
+		LOGE("Failed to set the compute decoder.\n");
+		return false;
+	}
+
+	record_decode_dispatches(cmd, layout, decoded_image, uploaded_images);
+	return true;
+}
+
+static bool validate_decode_layout(Vulkan::Device &device, const Vulkan::TextureFormatLayout &layout)
+{
+	if (!device.get_device_features().enabled_features.shaderStorageImageWriteWithoutFormat)
+	{
+		LOGE("Require shaderStorageImageWriteWithoutFormat.\n");
+		return false;
+	}
+
+	uint32_t block_width, block_height;
+	Vulkan::TextureFormatLayout::format_block_dim(layout.get_format(), block_width, block_height);
+	if (block_width == 1 || block_height == 1)
+	{
+		LOGE("Not a compressed format.\n");
+		return false;
+	}
+
+	return true;
+}
+
+static Vulkan::ImageHandle create_decoded_image(Vulkan::Device &device, const Vulkan::TextureFormatLayout &layout,
+                                                const VkComponentMapping &swizzle)
+{
+	auto image_info = Vulkan::ImageCreateInfo::immutable_image(layout);
+	image_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.format = compressed_format_to_decoded_format(layout.get_format());
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+	                   VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_info.flags = VK_IMAGE_CREATE_EXTENDED_USAGE_BIT | VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+	image_info.swizzle = swizzle;
+	if (image_info.format == VK_FORMAT_UNDEFINED)
+		return {};
+	return device.create_image(image_info);
+}
+
+static VkImageMemoryBarrier decoded_image_barrier(const Vulkan::Image &image,
+                                                  VkImageLayout old_layout, VkImageLayout new_layout,
+                                                  VkAccessFlags src_access, VkAccessFlags dst_access)
+{
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.image = image.get_image();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	return barrier;
+}
+
+bool decode_compressed_images(Vulkan::CommandBuffer &cmd, const DecodeCompressedImageInfo *infos, size_t count,
+                              Vulkan::ImageHandle *images)
+{
+	auto &device = cmd.get_device();
+
+	struct PendingDecode
+	{
+		size_t index;
+		const Vulkan::TextureFormatLayout *layout;
+		Vulkan::ImageHandle image;
+		Util::SmallVector<Vulkan::ImageHandle, 32> uploaded_images;
+	};
+
+	std::vector<PendingDecode> pending;
+	pending.reserve(count);
+	bool all_decoded = true;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		images[i].reset();
+		auto &layout = *infos[i].layout;
+
+		PendingDecode decode;
+		decode.index = i;
+		decode.layout = &layout;
+		if (validate_decode_layout(device, layout))
+			decode.image = create_decoded_image(device, layout, infos[i].swizzle);
+
+		if (!decode.image || !upload_payload_images(device, layout, decode.uploaded_images))
+		{
+			all_decoded = false;
+			continue;
+		}
+
+		pending.push_back(std::move(decode));
+	}
+
+	if (pending.empty())
+		return all_decoded;
+
+	// Each decoder program and its LUTs only need to be bound once per format.
+	std::stable_sort(pending.begin(), pending.end(), [](const PendingDecode &a, const PendingDecode &b) {
+		return a.layout->get_format() < b.layout->get_format();
+	});
+
+	// Every decode writes its own image, so nothing needs to synchronize between the dispatches.
+	std::vector<VkImageMemoryBarrier> barriers;
+	barriers.reserve(pending.size());
+	for (auto &decode : pending)
+	{
+		barriers.push_back(decoded_image_barrier(*decode.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+		                                         0, VK_ACCESS_SHADER_WRITE_BIT));
+	}
+	cmd.image_barriers(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                   unsigned(barriers.size()), barriers.data());
+
+	auto start_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	VkFormat current_format = VK_FORMAT_UNDEFINED;
+	bool decoder_valid = false;
+	for (auto &decode : pending)
+	{
+		if (decode.layout->get_format() != current_format)
+		{
+			current_format = decode.layout->get_format();
+			decoder_valid = set_compute_decoder(cmd, current_format);
+			if (!decoder_valid)
+				LOGE("Failed to set the compute decoder.\n");
+		}
+
+		if (decoder_valid)
+			record_decode_dispatches(cmd, *decode.layout, *decode.image, decode.uploaded_images);
+		else
+		{
+			decode.image.reset();
+			all_decoded = false;
+		}
+	}
+
+	barriers.clear();
+	for (auto &decode : pending)
+	{
+		if (decode.image)
+		{
+			barriers.push_back(decoded_image_barrier(*decode.image,
+			                                         VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			                                         VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+			images[decode.index] = std::move(decode.image);
+		}
+	}
+
+	if (!barriers.empty())
+	{
+		cmd.image_barriers(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		                   unsigned(barriers.size()), barriers.data());
+	}
+
+	auto end_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	device.register_time_interval("GPU", std::move(start_ts), std::move(end_ts), "texture-decode");
+	cmd.set_specialization_constant_mask(0);
+	return all_decoded;
+}
+
+Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vulkan::TextureFormatLayout &layout,
+                                            const VkComponentMapping &swizzle)
+{
+	DecodeCompressedImageInfo info;
+	info.layout = &layout;
+	info.swizzle = swizzle;
+
+	Vulkan::ImageHandle image;
+	decode_compressed_images(cmd, &info, 1, &image);
+	return image;
+}
+
+Vulkan::ImageHandle transcode_compressed_image(Vulkan::CommandBuffer &cmd, const Vulkan::TextureFormatLayout &layout,
+                                               const VkComponentMapping &swizzle)
+{
+	auto &device = cmd.get_device();
+
+	VkFormat target_format = compressed_format_to_transcoded_format(layout.get_format());
+	if (target_format == VK_FORMAT_UNDEFINED || layout.get_image_type() != VK_IMAGE_TYPE_2D)
+		return {};
+	if (!device.image_format_is_supported(target_format,
+	                                      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT))
+		return {};
+	if (!validate_decode_layout(device, layout))
+		return {};
+
+	VkFormat decoded_format = compressed_format_to_decoded_format(layout.get_format());
+	if (decoded_format == VK_FORMAT_UNDEFINED)
+		return {};
+
+	// Full decode first, which is thrown away once the blocks are copied out.
+	auto image_info = Vulkan::ImageCreateInfo::immutable_image(layout);
+	image_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.format = decoded_format;
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+	image_info.flags = VK_IMAGE_CREATE_EXTENDED_USAGE_BIT | VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+	auto decoded_image = device.create_image(image_info);
+
+	image_info.format = target_format;
+	image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_info.flags = 0;
+	image_info.swizzle = swizzle;
+	auto transcoded_image = device.create_image(image_info);
+	if (!decoded_image || !transcoded_image)
+		return {};
+
+	// One block image per level, since block counts do not follow a mip chain.
+	bool wide_blocks = Vulkan::TextureFormatLayout::format_block_size(target_format, VK_IMAGE_ASPECT_COLOR_BIT) == 16;
+	VkFormat block_format = wide_blocks ? VK_FORMAT_R32G32B32A32_UINT : VK_FORMAT_R32G32_UINT;
+	Util::SmallVector<Vulkan::ImageHandle, 32> block_images(layout.get_levels());
+	for (unsigned level = 0; level < layout.get_levels(); level++)
+	{
+		auto block_info = Vulkan::ImageCreateInfo::immutable_2d_image(
+				(layout.get_width(level) + 3) / 4, (layout.get_height(level) + 3) / 4, block_format);
+		block_info.layers = layout.get_layers();
+		block_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		block_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		block_images[level] = device.create_image(block_info);
+		if (!block_images[level])
+			return {};
+	}
+
+	auto start_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	if (!record_decode(cmd, layout, *decoded_image))
+		return {};
 
 	cmd.image_barrier(*decoded_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 	                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	for (auto &block_image : block_images)
+	{
+		cmd.image_barrier(*block_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+		                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	cmd.set_program("builtin://shaders/decode/bcn_encode.comp");
+	cmd.set_specialization_constant_mask(1);
+	cmd.set_specialization_constant(0, transcoded_format_to_encode_mode(target_format));
+
+	// sRGB payloads are encoded as is, the BC format does the conversion when sampled.
+	Vulkan::ImageViewCreateInfo input_view_info;
+	input_view_info.image = decoded_image.get();
+	input_view_info.view_type = VK_IMAGE_VIEW_TYPE_2D;
+	input_view_info.levels = 1;
+	input_view_info.layers = 1;
+	input_view_info.format = decoded_format == VK_FORMAT_R8G8B8A8_SRGB ? VK_FORMAT_R8G8B8A8_UNORM : decoded_format;
+
+	Vulkan::ImageViewCreateInfo block_view_info;
+	block_view_info.view_type = VK_IMAGE_VIEW_TYPE_2D;
+	block_view_info.levels = 1;
+	block_view_info.layers = 1;
+
+	for (unsigned level = 0; level < layout.get_levels(); level++)
+	{
+		struct Push
+		{
+			int32_t width, height;
+		} push;
+
+		push.width = int32_t(layout.get_width(level));
+		push.height = int32_t(layout.get_height(level));
+		cmd.push_constants(&push, 0, sizeof(push));
+
+		for (unsigned layer = 0; layer < layout.get_layers(); layer++)
+		{
+			input_view_info.base_level = level;
+			input_view_info.base_layer = layer;
+			block_view_info.image = block_images[level].get();
+			block_view_info.base_layer = layer;
+			auto input_view = device.create_image_view(input_view_info);
+			auto block_view = device.create_image_view(block_view_info);
+
+			cmd.set_storage_texture(0, 0, *block_view);
+			cmd.set_texture(0, 1, *input_view);
+			cmd.dispatch((block_images[level]->get_width() + 7) / 8, (block_images[level]->get_height() + 7) / 8, 1);
+		}
+	}
+
+	for (auto &block_image : block_images)
+	{
+		cmd.image_barrier(*block_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	}
+	cmd.image_barrier(*transcoded_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+	                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	// Going from uncompressed to compressed, the extent is in texels of the block image.
+	for (unsigned level = 0; level < layout.get_levels(); level++)
+	{
+		auto &block_image = *block_images[level];
+		cmd.copy_image(*transcoded_image, block_image, {}, {},
+		               { block_image.get_width(), block_image.get_height(), 1 },
+		               { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layout.get_layers() },
+		               { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, layout.get_layers() });
+	}
+
+	cmd.image_barrier(*transcoded_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
 	                  VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_READ_BIT);
 
-	auto end_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-	cmd.get_device().register_time_interval("GPU", std::move(start_ts), std::move(end_ts), "texture-decode");
+	auto end_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_TRANSFER_BIT);
+	cmd.get_device().register_time_interval("GPU", std::move(start_ts), std::move(end_ts), "texture-transcode");
 	cmd.set_specialization_constant_mask(0);
-	return decoded_image;
+	return transcoded_image;
+}
 }
-}
\ No newline at end of file
@@ -35,4 +35,32 @@ Vulkan::ImageHandle decode_compressed_image(Vulkan::CommandBuffer &cmd, const Vu
 	                                            VK_COMPONENT_SWIZZLE_B,
 	                                            VK_COMPONENT_SWIZZLE_A,
                                             });
+
+struct DecodeCompressedImageInfo
+{
+	const Vulkan::TextureFormatLayout *layout = nullptr;
+	VkComponentMapping swizzle = {
+		VK_COMPONENT_SWIZZLE_R,
+		VK_COMPONENT_SWIZZLE_G,
+		VK_COMPONENT_SWIZZLE_B,
+		VK_COMPONENT_SWIZZLE_A,
+	};
+};
+
+// Decodes many images in one go. Images are grouped by format so every decoder is bound once,
+// and all images share a single barrier before and after the dispatches.
+// images[i] is a null handle if infos[i] could not be decoded, in which case false is returned.
+bool decode_compressed_images(Vulkan::CommandBuffer &cmd, const DecodeCompressedImageInfo *infos, size_t count,
+                              Vulkan::ImageHandle *images);
+
+// Decodes on the GPU, then re-encodes to a BCn format the device can sample (ETC2 to BC1/BC3, EAC to BC4/BC5,
+// ASTC LDR to BC3, ASTC HDR to BC6H). Returns a null handle if there is no supported target format,
+// in which case decode_compressed_image() is the fallback.
+Vulkan::ImageHandle transcode_compressed_image(Vulkan::CommandBuffer &cmd, const Vulkan::TextureFormatLayout &layout,
+                                               const VkComponentMapping &swizzle = {
+	                                               VK_COMPONENT_SWIZZLE_R,
+	                                               VK_COMPONENT_SWIZZLE_G,
+	                                               VK_COMPONENT_SWIZZLE_B,
+	                                               VK_COMPONENT_SWIZZLE_A,
+                                               });
 }
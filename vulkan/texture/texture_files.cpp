@@ -23,8 +23,15 @@
 #include "texture_files.hpp"
 #include "stb_image.h"
 #include "filesystem.hpp"
+#include "device.hpp"
 #include "muglm/muglm_impl.hpp"
+#include "logging.hpp"
 #include <string.h>
+#include <algorithm>
+#ifdef HAVE_BASISU_TRANSCODER
+#include "basisu_transcoder.h"
+#include <mutex>
+#endif
 
 namespace Vulkan
 {
@@ -69,7 +76,224 @@ static MemoryMappedTexture load_hdr(const void *data, size_t size)
 	return tex;
 }
 
-MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, ColorSpace color)
+static const uint8_t ktx2_magic[] = {
+	0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, 0x0d, 0x0a, 0x1a, 0x0a,
+};
+
+struct KTX2Header
+{
+	uint8_t identifier[12];
+	uint32_t vk_format;
+	uint32_t type_size;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t layer_count;
+	uint32_t face_count;
+	uint32_t level_count;
+	uint32_t supercompression_scheme;
+	uint32_t dfd_byte_offset;
+	uint32_t dfd_byte_length;
+	uint32_t kvd_byte_offset;
+	uint32_t kvd_byte_length;
+	uint64_t sgd_byte_offset;
+	uint64_t sgd_byte_length;
+};
+
+struct KTX2Level
+{
+	uint64_t byte_offset;
+	uint64_t byte_length;
+	uint64_t uncompressed_byte_length;
+};
+
+static_assert(sizeof(KTX2Header) == 80, "Unexpected KTX2 header size.");
+
+#ifdef HAVE_BASISU_TRANSCODER
+struct BasisTarget
+{
+	basist::transcoder_texture_format target;
+	VkFormat unorm;
+	VkFormat srgb;
+};
+
+// UASTC is lossless as ASTC 4x4 and close to it as BC7. ETC1S is a subset of ETC1, so ETC2 is lossless
+// and BC7 is the next best. If the device samples none of them, the first one is decoded by the TextureManager.
+static const BasisTarget basis_uastc_targets[] = {
+	{ basist::transcoder_texture_format::cTFASTC_4x4_RGBA, VK_FORMAT_ASTC_4x4_UNORM_BLOCK, VK_FORMAT_ASTC_4x4_SRGB_BLOCK },
+	{ basist::transcoder_texture_format::cTFBC7_RGBA, VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK },
+	{ basist::transcoder_texture_format::cTFETC2_RGBA, VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK },
+};
+
+static const BasisTarget basis_etc1s_targets[] = {
+	{ basist::transcoder_texture_format::cTFETC1_RGB, VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK },
+	{ basist::transcoder_texture_format::cTFBC7_RGBA, VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK },
+	{ basist::transcoder_texture_format::cTFBC1_RGB, VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGB_SRGB_BLOCK },
+};
+
+static const BasisTarget basis_etc1s_alpha_targets[] = {
+	{ basist::transcoder_texture_format::cTFETC2_RGBA, VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK },
+	{ basist::transcoder_texture_format::cTFBC7_RGBA, VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK },
+	{ basist::transcoder_texture_format::cTFBC3_RGBA, VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK },
+};
+
+template <size_t N>
+static const BasisTarget &select_basis_target(const BasisTarget (&targets)[N], bool srgb, const Device *device)
+{
+	if (device)
+	{
+		for (auto &target : targets)
+			if (device->image_format_is_supported(srgb ? target.srgb : target.unorm, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+				return target;
+	}
+
+	return targets[0];
+}
+
+static MemoryMappedTexture load_ktx2_basis(const void *data, size_t size, const Device *device)
+{
+	static std::once_flag init_flag;
+	std::call_once(init_flag, basist::basisu_transcoder_init);
+
+	basist::ktx2_transcoder transcoder;
+	if (size > UINT32_MAX || !transcoder.init(data, uint32_t(size)) || !transcoder.start_transcoding())
+	{
+		LOGE("KTX2: Failed to parse Basis Universal payload.\n");
+		return {};
+	}
+
+	bool srgb = transcoder.get_dfd_transfer_func() == basist::KTX2_KHR_DF_TRANSFER_SRGB;
+	const BasisTarget *target;
+	if (!transcoder.is_etc1s())
+		target = &select_basis_target(basis_uastc_targets, srgb, device);
+	else if (transcoder.get_has_alpha())
+		target = &select_basis_target(basis_etc1s_alpha_targets, srgb, device);
+	else
+		target = &select_basis_target(basis_etc1s_targets, srgb, device);
+
+	VkFormat format = srgb ? target->srgb : target->unorm;
+	unsigned levels = std::max(transcoder.get_levels(), 1u);
+	unsigned layers = std::max(transcoder.get_layers(), 1u);
+	unsigned faces = transcoder.get_faces();
+
+	MemoryMappedTexture tex;
+	if (faces == 6)
+		tex.set_cube(format, transcoder.get_width(), layers, levels);
+	else
+		tex.set_2d(format, transcoder.get_width(), transcoder.get_height(), layers, levels);
+
+	if (!tex.map_write_scratch())
+		return {};
+
+	auto &layout = tex.get_layout();
+	for (unsigned level = 0; level < levels; level++)
+	{
+		auto num_blocks = uint32_t(layout.get_layer_size(level) / layout.get_block_stride());
+		for (unsigned layer = 0; layer < layers; layer++)
+		{
+			for (unsigned face = 0; face < faces; face++)
+			{
+				if (!transcoder.transcode_image_level(level, layer, face,
+				                                      layout.data(layer * faces + face, level), num_blocks,
+				                                      target->target))
+				{
+					LOGE("KTX2: Failed to transcode level %u, layer %u, face %u.\n", level, layer, face);
+					return {};
+				}
+			}
+		}
+	}
+
+	return tex;
+}
+#endif
+
+// Plain KTX2 containers with a Vulkan format are copied as-is, which is how ASTC and ETC2 packages are commonly shipped.
+// Formats the device cannot sample are transcoded or decoded on the GPU by the TextureManager.
+static MemoryMappedTexture load_ktx2(const void *data, size_t size, const Device *device)
+{
+	if (size < sizeof(KTX2Header))
+		return {};
+
+	KTX2Header header;
+	memcpy(&header, data, sizeof(header));
+
+	// BasisLZ (ETC1S) is flagged through supercompression, UASTC through the data format descriptor
+	// with an undefined vkFormat.
+	if (header.vk_format == VK_FORMAT_UNDEFINED || header.supercompression_scheme == 1)
+	{
+#ifdef HAVE_BASISU_TRANSCODER
+		return load_ktx2_basis(data, size, device);
+#else
+		(void)device;
+		LOGE("KTX2: Basis Universal (UASTC/ETC1S) payloads need GRANITE_BASISU_TRANSCODER.\n");
+		return {};
+#endif
+	}
+
+	if (header.supercompression_scheme != 0)
+	{
+		LOGE("KTX2: Supercompression scheme %u is not supported.\n", header.supercompression_scheme);
+		return {};
+	}
+
+	VkFormat format = VkFormat(header.vk_format);
+	if (TextureFormatLayout::format_block_size(format, VK_IMAGE_ASPECT_COLOR_BIT) == 0)
+	{
+		LOGE("KTX2: Format #%u is not supported.\n", header.vk_format);
+		return {};
+	}
+
+	if (header.pixel_width == 0 || (header.face_count != 1 && header.face_count != 6))
+	{
+		LOGE("KTX2: Invalid dimensions.\n");
+		return {};
+	}
+
+	// A level count of 0 asks the loader to generate the mip chain.
+	unsigned levels = std::max(header.level_count, 1u);
+	unsigned layers = std::max(header.layer_count, 1u);
+	if (size < sizeof(KTX2Header) + levels * sizeof(KTX2Level))
+		return {};
+
+	MemoryMappedTexture tex;
+	if (header.face_count == 6)
+		tex.set_cube(format, header.pixel_width, layers, levels);
+	else if (header.pixel_depth != 0)
+		tex.set_3d(format, header.pixel_width, header.pixel_height, header.pixel_depth, levels);
+	else if (header.pixel_height != 0)
+		tex.set_2d(format, header.pixel_width, header.pixel_height, layers, levels);
+	else
+		tex.set_1d(format, header.pixel_width, layers, levels);
+
+	if (header.level_count == 0)
+		tex.set_generate_mipmaps_on_load(true);
+
+	if (!tex.map_write_scratch())
+		return {};
+
+	auto &layout = tex.get_layout();
+	auto *base = static_cast<const uint8_t *>(data);
+	for (unsigned level = 0; level < levels; level++)
+	{
+		KTX2Level index;
+		memcpy(&index, base + sizeof(KTX2Header) + level * sizeof(KTX2Level), sizeof(index));
+
+		// Levels are tightly packed as layers, then faces, then slices, which matches the layout.
+		size_t level_size = layout.get_layer_size(level) * layout.get_layers() * layout.get_depth(level);
+		if (index.byte_length < level_size || index.byte_offset > size || size - index.byte_offset < level_size)
+		{
+			LOGE("KTX2: Level %u is out of bounds.\n", level);
+			return {};
+		}
+
+		memcpy(layout.data(0, level), base + index.byte_offset, level_size);
+	}
+
+	return tex;
+}
+
+MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, ColorSpace color, const Device *device)
 {
 	static const uint8_t png_magic[] = {
 		0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a,
@@ -89,6 +313,8 @@ MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, Colo
 		return load_stb(data, size, color);
 	else if (size >= sizeof(hdr_magic) && memcmp(data, hdr_magic, sizeof(hdr_magic)) == 0)
 		return load_hdr(data, size);
+	else if (size >= sizeof(ktx2_magic) && memcmp(data, ktx2_magic, sizeof(ktx2_magic)) == 0)
+		return load_ktx2(data, size, device);
 	else if (MemoryMappedTexture::is_header(data, size))
 	{
 		MemoryMappedTexture mapped;
@@ -102,7 +328,8 @@ MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, Colo
 	}
 }
 
-MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path, ColorSpace color)
+MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path, ColorSpace color,
+                                           const Device *device)
 {
 	auto file = fs.open(path, Granite::FileMode::ReadOnly);
 	if (!file)
@@ -119,6 +346,6 @@ MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::s
 		return tex;
 	}
 
-	return load_texture_from_memory(mapped, file->get_size(), color);
+	return load_texture_from_memory(mapped, file->get_size(), color, device);
 }
 }
\ No newline at end of file
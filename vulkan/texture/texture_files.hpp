@@ -32,13 +32,21 @@ class Filesystem;
 
 namespace Vulkan
 {
+class Device;
+
 enum class ColorSpace
 {
 	Linear,
 	sRGB
 };
 
-MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path, ColorSpace color = ColorSpace::sRGB);
+// Loads PNG, JPEG, HDR, GTX and KTX2 files.
+// KTX2 payloads with a Vulkan format must not be supercompressed.
+// Basis Universal (UASTC, ETC1S) payloads are transcoded to the best compressed format the device can sample,
+// or to ASTC and ETC2 without a device, which the TextureManager decodes if needed.
+MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path, ColorSpace color = ColorSpace::sRGB,
+                                           const Device *device = nullptr);
 MemoryMappedTexture load_texture_from_memory(const void *data, size_t size,
-                                             ColorSpace color = ColorSpace::sRGB);
+                                             ColorSpace color = ColorSpace::sRGB,
+                                             const Device *device = nullptr);
 }
\ No newline at end of file
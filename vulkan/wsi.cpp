@@ -22,6 +22,8 @@
 
 #include "wsi.hpp"
 #include "quirks.hpp"
+#include "thread_name.hpp"
+#include <algorithm>
 
 namespace Vulkan
 {
@@ -222,6 +224,7 @@ void WSI::init_surface_and_swapchain(VkSurfaceKHR new_surface)
 
 void WSI::drain_swapchain()
 {
+	drain_present_thread();
 	release_semaphores.clear();
 	device->set_acquire_semaphore(0, Semaphore{});
 	device->consume_release_semaphore();
@@ -242,6 +245,7 @@ void WSI::tear_down_swapchain()
 	has_acquired_swapchain_index = false;
 	present_id = 0;
 	present_last_id = 0;
+	tear_down_low_latency();
 }
 
 void WSI::deinit_surface_and_swapchain()
@@ -317,6 +321,26 @@ bool WSI::begin_frame()
 	LOGI("Waited for vacant frame context for %.3f ms.\n", (next_frame_end - next_frame_start) * 1e-6);
 #endif
 
+	if (present_thread.thread.joinable())
+	{
+		VkResult present_result = wait_present_thread_present();
+		if (present_result == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT)
+			LOGE("Lost exclusive full-screen ...\n");
+
+		if (present_result == VK_SUBOPTIMAL_KHR)
+		{
+#ifdef VULKAN_DEBUG
+			LOGI("QueuePresent is suboptimal, will recreate.\n");
+#endif
+			swapchain_is_suboptimal = true;
+		}
+		else if (present_result < 0)
+		{
+			LOGE("vkQueuePresentKHR failed.\n");
+			tear_down_swapchain();
+		}
+	}
+
 	if (swapchain == VK_NULL_HANDLE || platform->should_resize() || swapchain_is_suboptimal)
 		update_framebuffer(platform->get_surface_width(), platform->get_surface_height());
 
@@ -334,24 +358,34 @@ bool WSI::begin_frame()
 	VkResult result;
 	do
 	{
-		auto acquire = device->request_legacy_semaphore();
-
-		// For adaptive low latency we don't want to observe the time it takes to wait for
-		// WSI semaphore as part of our latency,
-		// which means we will never get sub-frame latency on some implementations,
-		// so block on that first.
+		Semaphore acquire;
 		Fence fence;
-		if (timing.get_options().latency_limiter == LatencyLimiter::AdaptiveLowLatency)
-			fence = device->request_legacy_fence();
 
 #ifdef VULKAN_WSI_TIMING_DEBUG
 		auto acquire_start = Util::get_current_time_nsecs();
 #endif
 
-		auto acquire_ts = device->write_calibrated_timestamp();
-		result = table->vkAcquireNextImageKHR(context->get_device(), swapchain, UINT64_MAX, acquire->get_semaphore(),
-		                                      fence ? fence->get_fence() : VK_NULL_HANDLE, &swapchain_index);
-		device->register_time_interval("WSI", std::move(acquire_ts), device->write_calibrated_timestamp(), "acquire");
+		// An acquire which was started ahead of time is always picked up, even if the thread is no longer used.
+		if (present_thread_acquire || uses_present_thread())
+		{
+			result = wait_present_thread_acquire(acquire, swapchain_index);
+		}
+		else
+		{
+			acquire = device->request_legacy_semaphore();
+
+			// For adaptive low latency we don't want to observe the time it takes to wait for
+			// WSI semaphore as part of our latency,
+			// which means we will never get sub-frame latency on some implementations,
+			// so block on that first.
+			if (timing.get_options().latency_limiter == LatencyLimiter::AdaptiveLowLatency)
+				fence = device->request_legacy_fence();
+
+			auto acquire_ts = device->write_calibrated_timestamp();
+			result = table->vkAcquireNextImageKHR(context->get_device(), swapchain, UINT64_MAX, acquire->get_semaphore(),
+			                                      fence ? fence->get_fence() : VK_NULL_HANDLE, &swapchain_index);
+			device->register_time_interval("WSI", std::move(acquire_ts), device->write_calibrated_timestamp(), "acquire");
+		}
 
 #if defined(ANDROID)
 		// Android 10 can return suboptimal here, only because of pre-transform.
@@ -397,6 +431,10 @@ bool WSI::begin_frame()
 
 			// Poll after acquire as well for optimal latency.
 			platform->poll_input();
+#ifdef VK_NV_low_latency2
+			if (low_latency_mode)
+				set_low_latency_marker(present_id + 1, VK_LATENCY_MARKER_INPUT_SAMPLE_NV);
+#endif
 			platform->event_frame_tick(frame_time, elapsed_time);
 
 			platform->event_swapchain_index(device.get(), swapchain_index);
@@ -447,117 +485,149 @@ bool WSI::end_frame()
 		auto release = device->consume_release_semaphore();
 		VK_ASSERT(release);
 		VK_ASSERT(release->is_signalled());
-		auto release_semaphore = release->get_semaphore();
-		VK_ASSERT(release_semaphore != VK_NULL_HANDLE);
-
-		VkResult result = VK_SUCCESS;
-		VkPresentInfoKHR info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-		info.waitSemaphoreCount = 1;
-		info.pWaitSemaphores = &release_semaphore;
-		info.swapchainCount = 1;
-		info.pSwapchains = &swapchain;
-		info.pImageIndices = &swapchain_index;
-		info.pResults = &result;
-
-		VkPresentTimeGOOGLE present_time;
-		VkPresentTimesInfoGOOGLE present_timing = { VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE };
-
-		if (using_display_timing && timing.fill_present_info_timing(present_time))
+		if (uses_present_thread())
 		{
-			present_timing.swapchainCount = 1;
-			present_timing.pTimes = &present_time;
-			present_timing.pNext = info.pNext;
-			info.pNext = &present_timing;
+			queue_present_thread(std::move(release));
 		}
-
-		VkPresentIdKHR present_id_info = { VK_STRUCTURE_TYPE_PRESENT_ID_KHR };
-		if (device->get_device_features().present_id_features.presentId)
+		else
 		{
-			present_id_info.swapchainCount = 1;
-			present_id_info.pPresentIds = &present_id;
-			present_id++;
-			present_id_info.pNext = info.pNext;
-			info.pNext = &present_id_info;
-		}
+			auto release_semaphore = release->get_semaphore();
+			VK_ASSERT(release_semaphore != VK_NULL_HANDLE);
+
+			VkResult result = VK_SUCCESS;
+			VkPresentInfoKHR info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+			info.waitSemaphoreCount = 1;
+			info.pWaitSemaphores = &release_semaphore;
+			info.swapchainCount = 1;
+			info.pSwapchains = &swapchain;
+			info.pImageIndices = &swapchain_index;
+			info.pResults = &result;
+
+			VkPresentTimeGOOGLE present_time;
+			VkPresentTimesInfoGOOGLE present_timing = { VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE };
+
+			if (using_display_timing && timing.fill_present_info_timing(present_time))
+			{
+				present_timing.swapchainCount = 1;
+				present_timing.pTimes = &present_time;
+				present_timing.pNext = info.pNext;
+				info.pNext = &present_timing;
+			}
+
+			VkPresentIdKHR present_id_info = { VK_STRUCTURE_TYPE_PRESENT_ID_KHR };
+			if (device->get_device_features().present_id_features.presentId)
+			{
+				present_id_info.swapchainCount = 1;
+				present_id_info.pPresentIds = &present_id;
+				present_id++;
+				present_id_info.pNext = info.pNext;
+				info.pNext = &present_id_info;
+			}
 
 #ifdef VULKAN_WSI_TIMING_DEBUG
-		auto present_start = Util::get_current_time_nsecs();
+			auto present_start = Util::get_current_time_nsecs();
+#endif
+
+			if (low_latency_mode)
+			{
+#ifdef VK_NV_low_latency2
+				set_low_latency_marker(present_id, VK_LATENCY_MARKER_PRESENT_START_NV);
 #endif
+#ifdef VK_AMD_anti_lag
+				update_anti_lag(present_id, VK_ANTI_LAG_STAGE_PRESENT_AMD);
+#endif
+			}
 
-		auto present_ts = device->write_calibrated_timestamp();
-		VkResult overall = table->vkQueuePresentKHR(device->get_current_present_queue(), &info);
-		device->register_time_interval("WSI", std::move(present_ts), device->write_calibrated_timestamp(), "present");
+			auto present_ts = device->write_calibrated_timestamp();
+			VkResult overall = table->vkQueuePresentKHR(device->get_current_present_queue(), &info);
+			device->untracked_queue_work.store(true, std::memory_order_relaxed);
+			device->register_time_interval("WSI", std::move(present_ts), device->write_calibrated_timestamp(), "present");
+
+			if (low_latency_mode)
+			{
+#ifdef VK_NV_low_latency2
+				set_low_latency_marker(present_id, VK_LATENCY_MARKER_PRESENT_END_NV);
+#endif
+				auto &begin = low_latency.frame_begin[present_id & LowLatencyState::FrameMask];
+				if (begin)
+				{
+					low_latency.cpu_time[present_id & LowLatencyState::FrameMask] =
+							int64_t(Util::get_current_time_nsecs() - begin);
+				}
+			}
 
 #if defined(ANDROID)
-		// Android 10 can return suboptimal here, only because of pre-transform.
-		// We don't care about that, and treat this as success.
-		if (overall == VK_SUBOPTIMAL_KHR && !support_prerotate)
-			overall = VK_SUCCESS;
-		if (result == VK_SUBOPTIMAL_KHR && !support_prerotate)
-			result = VK_SUCCESS;
+			// Android 10 can return suboptimal here, only because of pre-transform.
+			// We don't care about that, and treat this as success.
+			if (overall == VK_SUBOPTIMAL_KHR && !support_prerotate)
+				overall = VK_SUCCESS;
+			if (result == VK_SUBOPTIMAL_KHR && !support_prerotate)
+				result = VK_SUCCESS;
 #endif
 
-		if (overall == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT ||
-		    result == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT)
-		{
-			LOGE("Lost exclusive full-screen ...\n");
-		}
+			if (overall == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT ||
+			    result == VK_ERROR_FULL_SCREEN_EXCLUSIVE_MODE_LOST_EXT)
+			{
+				LOGE("Lost exclusive full-screen ...\n");
+			}
 
 #ifdef VULKAN_WSI_TIMING_DEBUG
-		auto present_end = Util::get_current_time_nsecs();
-		LOGI("vkQueuePresentKHR took %.3f ms.\n", (present_end - present_start) * 1e-6);
+			auto present_end = Util::get_current_time_nsecs();
+			LOGI("vkQueuePresentKHR took %.3f ms.\n", (present_end - present_start) * 1e-6);
 #endif
 
-		// The presentID only seems to get updated if QueuePresent returns success.
-		// This makes sense I guess. Record the latest present ID which was successfully presented
-		// so we don't risk deadlock.
-		if ((result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) &&
-		    device->get_device_features().present_wait_features.presentWait)
-		{
-			if (present_id > present_frame_latency)
+			// The presentID only seems to get updated if QueuePresent returns success.
+			// This makes sense I guess. Record the latest present ID which was successfully presented
+			// so we don't risk deadlock.
+			if ((result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) &&
+			    device->get_device_features().present_wait_features.presentWait)
 			{
-				uint64_t target = present_id - present_frame_latency;
-				// In case there are weird gaps which present IDs got a successful present.
-				if (target > present_last_id)
-					target = present_last_id;
+				// Low latency pacing waits for this present to complete before the next frame starts instead.
+				if (present_id > present_frame_latency && !uses_present_wait_pacing())
+				{
+					uint64_t target = present_id - present_frame_latency;
+					// In case there are weird gaps which present IDs got a successful present.
+					if (target > present_last_id)
+						target = present_last_id;
 #ifdef VULKAN_WSI_TIMING_DEBUG
-				auto begin_wait = Util::get_current_time_nsecs();
+					auto begin_wait = Util::get_current_time_nsecs();
 #endif
-				auto wait_ts = device->write_calibrated_timestamp();
-				VkResult wait_result = table->vkWaitForPresentKHR(context->get_device(), swapchain,
-				                                                  target, UINT64_MAX);
-				device->register_time_interval("WSI", std::move(wait_ts),
-				                               device->write_calibrated_timestamp(), "wait_frame_latency");
-				if (wait_result != VK_SUCCESS)
-					LOGE("vkWaitForPresentKHR failed, vr %d.\n", wait_result);
+					auto wait_ts = device->write_calibrated_timestamp();
+					VkResult wait_result = table->vkWaitForPresentKHR(context->get_device(), swapchain,
+					                                                  target, UINT64_MAX);
+					device->register_time_interval("WSI", std::move(wait_ts),
+					                               device->write_calibrated_timestamp(), "wait_frame_latency");
+					if (wait_result != VK_SUCCESS)
+						LOGE("vkWaitForPresentKHR failed, vr %d.\n", wait_result);
 #ifdef VULKAN_WSI_TIMING_DEBUG
-				auto end_wait = Util::get_current_time_nsecs();
-				LOGI("WaitForPresentKHR took %.3f ms.\n", 1e-6 * double(end_wait - begin_wait));
+					auto end_wait = Util::get_current_time_nsecs();
+					LOGI("WaitForPresentKHR took %.3f ms.\n", 1e-6 * double(end_wait - begin_wait));
 #endif
+				}
+				present_last_id = present_id;
 			}
-			present_last_id = present_id;
-		}
 
-		if (overall == VK_SUBOPTIMAL_KHR || result == VK_SUBOPTIMAL_KHR)
-		{
+			if (overall == VK_SUBOPTIMAL_KHR || result == VK_SUBOPTIMAL_KHR)
+			{
 #ifdef VULKAN_DEBUG
-			LOGI("QueuePresent is suboptimal, will recreate.\n");
+				LOGI("QueuePresent is suboptimal, will recreate.\n");
 #endif
-			swapchain_is_suboptimal = true;
-		}
+				swapchain_is_suboptimal = true;
+			}
 
-		if (overall < 0 || result < 0)
-		{
-			LOGE("vkQueuePresentKHR failed.\n");
-			tear_down_swapchain();
-			return false;
-		}
-		else
-		{
-			release->wait_external();
-			// Cannot release the WSI wait semaphore until we observe that the image has been
-			// waited on again.
-			release_semaphores[swapchain_index] = release;
+			if (overall < 0 || result < 0)
+			{
+				LOGE("vkQueuePresentKHR failed.\n");
+				tear_down_swapchain();
+				return false;
+			}
+			else
+			{
+				release->wait_external();
+				// Cannot release the WSI wait semaphore until we observe that the image has been
+				// waited on again.
+				release_semaphores[swapchain_index] = release;
+			}
 		}
 
 		// Re-init swapchain.
@@ -628,6 +698,7 @@ void WSI::deinit_external()
 
 	if (context)
 	{
+		stop_present_thread();
 		tear_down_swapchain();
 		platform->event_swapchain_destroyed();
 	}
@@ -1075,12 +1146,25 @@ WSI::SwapchainError WSI::init_swapchain(unsigned width, unsigned height)
 		info.pNext = &exclusive_info;
 #endif
 
+#ifdef VK_NV_low_latency2
+	// Always opt in, so low latency mode can be toggled without recreating the swapchain.
+	VkSwapchainLatencyCreateInfoNV latency_info = { VK_STRUCTURE_TYPE_SWAPCHAIN_LATENCY_CREATE_INFO_NV };
+	if (device->get_device_features().supports_low_latency2_nv)
+	{
+		latency_info.latencyModeEnable = VK_TRUE;
+		latency_info.pNext = info.pNext;
+		info.pNext = &latency_info;
+	}
+#endif
+
 	auto res = table->vkCreateSwapchainKHR(context->get_device(), &info, nullptr, &swapchain);
 	if (old_swapchain != VK_NULL_HANDLE)
 		table->vkDestroySwapchainKHR(context->get_device(), old_swapchain, nullptr);
 	has_acquired_swapchain_index = false;
 	present_id = 0;
 	present_last_id = 0;
+	if (res == VK_SUCCESS)
+		update_low_latency_sleep_mode();
 
 #ifdef _WIN32
 	if (use_application_controlled_exclusive_fullscreen)
@@ -1165,6 +1249,570 @@ WSI::~WSI()
 	deinit_external();
 }
 
+void WSI::set_present_thread(bool enable)
+{
+	present_thread.enabled = enable;
+	if (!enable)
+		stop_present_thread();
+}
+
+bool WSI::uses_present_thread() const
+{
+	return present_thread.enabled && !low_latency_mode &&
+	       timing.get_options().latency_limiter != LatencyLimiter::AdaptiveLowLatency;
+}
+
+void WSI::start_present_thread()
+{
+	// Presents and submissions may now race on the same VkQueue.
+	device->get_queue_lock(present_thread.app_queue_lock, present_thread.app_queue_unlock);
+	device->set_queue_lock([this]() { lock_present_queue(); },
+	                       [this]() { unlock_present_queue(); });
+	present_thread.dead = false;
+	present_thread.thread = std::thread(&WSI::present_thread_loop, this);
+}
+
+void WSI::stop_present_thread()
+{
+	if (!present_thread.thread.joinable())
+		return;
+
+	drain_present_thread();
+	{
+		std::lock_guard<std::mutex> holder{present_thread.lock};
+		present_thread.dead = true;
+		present_thread.cond.notify_one();
+	}
+	present_thread.thread.join();
+	device->set_queue_lock(std::move(present_thread.app_queue_lock), std::move(present_thread.app_queue_unlock));
+	present_thread.app_queue_lock = {};
+	present_thread.app_queue_unlock = {};
+}
+
+void WSI::lock_present_queue()
+{
+	// The application lock is always taken first, so the order is the same on every thread.
+	if (present_thread.app_queue_lock)
+		present_thread.app_queue_lock();
+	present_thread.queue_lock.lock();
+}
+
+void WSI::unlock_present_queue()
+{
+	present_thread.queue_lock.unlock();
+	if (present_thread.app_queue_unlock)
+		present_thread.app_queue_unlock();
+}
+
+void WSI::present_thread_loop()
+{
+	Util::set_current_thread_name("wsi-present");
+	std::unique_lock<std::mutex> holder{present_thread.lock};
+
+	for (;;)
+	{
+		present_thread.cond.wait(holder, [this]() {
+			return present_thread.dead || present_thread.present_pending || present_thread.acquire_pending;
+		});
+
+		// Acquire is always queued after the present of the previous frame.
+		if (present_thread.present_pending)
+		{
+			auto request = present_thread.present;
+			holder.unlock();
+			VkResult result = present_thread_present(request);
+			holder.lock();
+			present_thread.present_result = result;
+			present_thread.present_pending = false;
+			present_thread.cond.notify_all();
+		}
+		else if (present_thread.acquire_pending)
+		{
+			VkSwapchainKHR acquire_swapchain = present_thread.acquire_swapchain;
+			VkSemaphore semaphore = present_thread.acquire_semaphore;
+			holder.unlock();
+			uint32_t index = 0;
+			VkResult result = table->vkAcquireNextImageKHR(context->get_device(), acquire_swapchain, UINT64_MAX,
+			                                               semaphore, VK_NULL_HANDLE, &index);
+			holder.lock();
+			present_thread.acquire_result = result;
+			present_thread.acquire_index = index;
+			present_thread.acquire_pending = false;
+			present_thread.acquire_done = true;
+			present_thread.cond.notify_all();
+		}
+		else
+			break;
+	}
+}
+
+VkResult WSI::present_thread_present(const PresentRequest &request)
+{
+	VkResult result = VK_SUCCESS;
+	VkPresentInfoKHR info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+	info.waitSemaphoreCount = 1;
+	info.pWaitSemaphores = &request.release;
+	info.swapchainCount = 1;
+	info.pSwapchains = &request.swapchain;
+	info.pImageIndices = &request.index;
+	info.pResults = &result;
+
+	VkPresentTimesInfoGOOGLE present_timing = { VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE };
+	if (request.use_present_time)
+	{
+		present_timing.swapchainCount = 1;
+		present_timing.pTimes = &request.present_time;
+		present_timing.pNext = info.pNext;
+		info.pNext = &present_timing;
+	}
+
+	VkPresentIdKHR present_id_info = { VK_STRUCTURE_TYPE_PRESENT_ID_KHR };
+	if (request.use_present_id)
+	{
+		present_id_info.swapchainCount = 1;
+		present_id_info.pPresentIds = &request.present_id;
+		present_id_info.pNext = info.pNext;
+		info.pNext = &present_id_info;
+	}
+
+	auto present_ts = device->write_calibrated_timestamp();
+	lock_present_queue();
+	VkResult overall = table->vkQueuePresentKHR(request.queue, &info);
+	unlock_present_queue();
+	device->register_time_interval("WSI", std::move(present_ts), device->write_calibrated_timestamp(), "present");
+
+#if defined(ANDROID)
+	// Android 10 can return suboptimal here, only because of pre-transform.
+	if (overall == VK_SUBOPTIMAL_KHR && !support_prerotate)
+		overall = VK_SUCCESS;
+	if (result == VK_SUBOPTIMAL_KHR && !support_prerotate)
+		result = VK_SUCCESS;
+#endif
+
+	if (overall < 0)
+		return overall;
+	if (result < 0)
+		return result;
+
+	// Only the present thread touches present_last_id while it is running.
+	if (request.use_present_id && device->get_device_features().present_wait_features.presentWait)
+	{
+		if (request.present_id > request.frame_latency)
+		{
+			uint64_t target = std::min<uint64_t>(request.present_id - request.frame_latency, present_last_id);
+			auto wait_ts = device->write_calibrated_timestamp();
+			VkResult wait_result = table->vkWaitForPresentKHR(context->get_device(), request.swapchain,
+			                                                  target, UINT64_MAX);
+			device->register_time_interval("WSI", std::move(wait_ts),
+			                               device->write_calibrated_timestamp(), "wait_frame_latency");
+			if (wait_result != VK_SUCCESS)
+				LOGE("vkWaitForPresentKHR failed, vr %d.\n", wait_result);
+		}
+		present_last_id = request.present_id;
+	}
+
+	return overall == VK_SUBOPTIMAL_KHR || result == VK_SUBOPTIMAL_KHR ? VK_SUBOPTIMAL_KHR : VK_SUCCESS;
+}
+
+void WSI::queue_present_thread(Semaphore release)
+{
+	if (!present_thread.thread.joinable())
+		start_present_thread();
+
+	PresentRequest request = {};
+	request.queue = device->get_current_present_queue();
+	request.swapchain = swapchain;
+	request.release = release->get_semaphore();
+	request.index = swapchain_index;
+	request.frame_latency = present_frame_latency;
+	request.use_present_time = using_display_timing && timing.fill_present_info_timing(request.present_time);
+	if (device->get_device_features().present_id_features.presentId)
+	{
+		request.use_present_id = true;
+		request.present_id = ++present_id;
+	}
+
+	// Start acquiring the next image as soon as the present is through.
+	present_thread_acquire = device->request_legacy_semaphore();
+
+	{
+		std::lock_guard<std::mutex> holder{present_thread.lock};
+		VK_ASSERT(!present_thread.present_pending && !present_thread.acquire_pending);
+		present_thread.present = request;
+		present_thread.present_pending = true;
+		present_thread.acquire_swapchain = swapchain;
+		present_thread.acquire_semaphore = present_thread_acquire->get_semaphore();
+		present_thread.acquire_pending = true;
+		present_thread.acquire_done = false;
+		present_thread.cond.notify_one();
+	}
+
+	device->untracked_queue_work.store(true, std::memory_order_relaxed);
+	release->wait_external();
+	// Cannot release the WSI wait semaphore until we observe that the image has been
+	// waited on again.
+	release_semaphores[swapchain_index] = std::move(release);
+}
+
+VkResult WSI::wait_present_thread_present()
+{
+	std::unique_lock<std::mutex> holder{present_thread.lock};
+	present_thread.cond.wait(holder, [this]() { return !present_thread.present_pending; });
+	VkResult result = present_thread.present_result;
+	present_thread.present_result = VK_SUCCESS;
+	return result;
+}
+
+VkResult WSI::wait_present_thread_acquire(Semaphore &acquire, uint32_t &index)
+{
+	if (!present_thread.thread.joinable())
+		start_present_thread();
+
+	if (!present_thread_acquire)
+	{
+		present_thread_acquire = device->request_legacy_semaphore();
+		std::lock_guard<std::mutex> holder{present_thread.lock};
+		present_thread.acquire_swapchain = swapchain;
+		present_thread.acquire_semaphore = present_thread_acquire->get_semaphore();
+		present_thread.acquire_pending = true;
+		present_thread.acquire_done = false;
+		present_thread.cond.notify_one();
+	}
+
+	auto acquire_ts = device->write_calibrated_timestamp();
+	VkResult result;
+	{
+		std::unique_lock<std::mutex> holder{present_thread.lock};
+		present_thread.cond.wait(holder, [this]() { return present_thread.acquire_done; });
+		present_thread.acquire_done = false;
+		index = present_thread.acquire_index;
+		result = present_thread.acquire_result;
+	}
+	device->register_time_interval("WSI", std::move(acquire_ts), device->write_calibrated_timestamp(), "acquire");
+
+	acquire = std::move(present_thread_acquire);
+	return result;
+}
+
+void WSI::drain_present_thread()
+{
+	if (!present_thread.thread.joinable())
+		return;
+
+	bool acquired;
+	{
+		std::unique_lock<std::mutex> holder{present_thread.lock};
+		present_thread.cond.wait(holder, [this]() {
+			return !present_thread.present_pending && !present_thread.acquire_pending;
+		});
+		acquired = present_thread.acquire_done && present_thread.acquire_result >= 0;
+		present_thread.acquire_done = false;
+		present_thread.present_result = VK_SUCCESS;
+	}
+
+	// An image acquired ahead of time is never presented,
+	// but its semaphore has to be waited on before it can be recycled.
+	if (acquired && present_thread_acquire)
+	{
+		present_thread_acquire->signal_external();
+		device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(present_thread_acquire),
+		                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, true);
+	}
+	present_thread_acquire.reset();
+}
+
+bool WSI::uses_present_wait_pacing() const
+{
+	auto &features = device->get_device_features();
+	return low_latency_mode && !features.supports_low_latency2_nv && !features.supports_anti_lag_amd &&
+	       !low_latency.vblank_pacing && features.present_wait_features.presentWait;
+}
+
+void WSI::set_present_frame_latency(unsigned latency)
+{
+	present_frame_latency = std::max(latency, 1u);
+}
+
+void WSI::set_low_latency_mode(bool enable)
+{
+	low_latency_mode = enable;
+	low_latency.budget = 0;
+	low_latency.miss_floor = 0;
+	low_latency.miss_hold_frames = 0;
+	if (device)
+		update_low_latency_sleep_mode();
+}
+
+void WSI::update_low_latency_sleep_mode()
+{
+#ifdef VK_NV_low_latency2
+	if (swapchain == VK_NULL_HANDLE || !device->get_device_features().supports_low_latency2_nv)
+		return;
+
+	VkLatencySleepModeInfoNV mode = { VK_STRUCTURE_TYPE_LATENCY_SLEEP_MODE_INFO_NV };
+	mode.lowLatencyMode = low_latency_mode ? VK_TRUE : VK_FALSE;
+	mode.lowLatencyBoost = low_latency_mode ? VK_TRUE : VK_FALSE;
+	if (table->vkSetLatencySleepModeNV(context->get_device(), swapchain, &mode) != VK_SUCCESS)
+		LOGW("Failed to set latency sleep mode.\n");
+#endif
+}
+
+void WSI::set_low_latency_marker(uint64_t frame_id, int marker)
+{
+#ifdef VK_NV_low_latency2
+	if (swapchain == VK_NULL_HANDLE || !device->get_device_features().supports_low_latency2_nv)
+		return;
+
+	VkSetLatencyMarkerInfoNV info = { VK_STRUCTURE_TYPE_SET_LATENCY_MARKER_INFO_NV };
+	info.presentID = frame_id;
+	info.marker = VkLatencyMarkerNV(marker);
+	table->vkSetLatencyMarkerNV(context->get_device(), swapchain, &info);
+#else
+	(void)frame_id;
+	(void)marker;
+#endif
+}
+
+void WSI::update_anti_lag(uint64_t frame_id, int stage)
+{
+#ifdef VK_AMD_anti_lag
+	if (!device->get_device_features().supports_anti_lag_amd)
+		return;
+
+	VkAntiLagPresentationInfoAMD presentation = { VK_STRUCTURE_TYPE_ANTI_LAG_PRESENTATION_INFO_AMD };
+	presentation.stage = VkAntiLagStageAMD(stage);
+	presentation.frameIndex = frame_id;
+
+	VkAntiLagDataAMD data = { VK_STRUCTURE_TYPE_ANTI_LAG_DATA_AMD };
+	data.mode = low_latency_mode ? VK_ANTI_LAG_MODE_ON_AMD : VK_ANTI_LAG_MODE_OFF_AMD;
+	data.pPresentationInfo = &presentation;
+	table->vkAntiLagUpdateAMD(context->get_device(), &data);
+#else
+	(void)frame_id;
+	(void)stage;
+#endif
+}
+
+void WSI::tear_down_low_latency()
+{
+	if (low_latency.sleep_semaphore != VK_NULL_HANDLE)
+		table->vkDestroySemaphore(context->get_device(), low_latency.sleep_semaphore, nullptr);
+
+	auto budget = low_latency.budget;
+	low_latency = {};
+	// Keep what we learned about the frame cost across swapchain recreation.
+	low_latency.budget = budget;
+}
+
+void WSI::begin_low_latency_frame()
+{
+	if (!low_latency_mode || frame_is_external || swapchain == VK_NULL_HANDLE)
+		return;
+
+	// The present ID the upcoming frame will be presented with.
+	uint64_t frame_id = present_id + 1;
+	auto &features = device->get_device_features();
+
+#ifdef VK_NV_low_latency2
+	if (features.supports_low_latency2_nv)
+	{
+		if (low_latency.sleep_semaphore == VK_NULL_HANDLE)
+		{
+			VkSemaphoreTypeCreateInfo type_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+			type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+			VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+			info.pNext = &type_info;
+			if (table->vkCreateSemaphore(context->get_device(), &info, nullptr, &low_latency.sleep_semaphore) != VK_SUCCESS)
+				low_latency.sleep_semaphore = VK_NULL_HANDLE;
+			update_low_latency_sleep_mode();
+		}
+
+		if (low_latency.sleep_semaphore != VK_NULL_HANDLE)
+		{
+			// The driver decides how long to sleep, it signals the semaphore when we should start.
+			VkLatencySleepInfoNV sleep_info = { VK_STRUCTURE_TYPE_LATENCY_SLEEP_INFO_NV };
+			sleep_info.signalSemaphore = low_latency.sleep_semaphore;
+			sleep_info.value = ++low_latency.sleep_value;
+			if (table->vkLatencySleepNV(context->get_device(), swapchain, &sleep_info) == VK_SUCCESS)
+			{
+				VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+				wait_info.semaphoreCount = 1;
+				wait_info.pSemaphores = &low_latency.sleep_semaphore;
+				wait_info.pValues = &low_latency.sleep_value;
+				table->vkWaitSemaphoresKHR(context->get_device(), &wait_info, UINT64_MAX);
+			}
+		}
+
+		low_latency.frame_begin[frame_id & LowLatencyState::FrameMask] = Util::get_current_time_nsecs();
+		set_low_latency_marker(frame_id, VK_LATENCY_MARKER_SIMULATION_START_NV);
+		return;
+	}
+#endif
+
+#ifdef VK_AMD_anti_lag
+	if (features.supports_anti_lag_amd)
+	{
+		// Sleeps in the driver as needed.
+		update_anti_lag(frame_id, VK_ANTI_LAG_STAGE_INPUT_AMD);
+		low_latency.frame_begin[frame_id & LowLatencyState::FrameMask] = Util::get_current_time_nsecs();
+		return;
+	}
+#endif
+
+	// Vblank straight from the display beats inferring it from present completion.
+	if (pace_low_latency_frame_vblank(frame_id))
+		return;
+
+	if (features.present_wait_features.presentWait)
+		pace_low_latency_frame(frame_id);
+	else
+		low_latency.frame_begin[frame_id & LowLatencyState::FrameMask] = Util::get_current_time_nsecs();
+}
+
+bool WSI::pace_low_latency_frame_vblank(uint64_t frame_id)
+{
+	auto &ll = low_latency;
+
+	// The display doesn't tell us which vblank a frame landed in, so budget on CPU time alone,
+	// with a quarter frame of slack for the GPU and heavier than normal frames.
+	if (ll.vblank_pacing && ll.refresh_interval)
+	{
+		int64_t floor_budget = 0;
+		for (auto t : ll.cpu_time)
+			floor_budget = std::max(floor_budget, t);
+		floor_budget += ll.refresh_interval >> 2;
+		ll.budget = std::max(ll.budget - (ll.refresh_interval >> 7), floor_budget);
+	}
+
+	// Heavy frames can't make the next vblank anyway, waiting for it only adds latency.
+	uint64_t target = 0;
+	if (!ll.vblank_pacing || ll.budget <= ll.refresh_interval)
+	{
+		uint64_t vblank = 0;
+		uint64_t refresh_interval = 0;
+		if (!platform->wait_vblank(vblank, refresh_interval) || !refresh_interval)
+		{
+			ll.vblank_pacing = false;
+			return false;
+		}
+
+		ll.vblank_pacing = true;
+		ll.refresh_interval = int64_t(refresh_interval);
+		if (!ll.budget)
+			ll.budget = ll.refresh_interval;
+
+		// Start so that the frame is done just before the vblank after this one.
+		target = vblank + refresh_interval;
+		int64_t sleep_ns = int64_t(target - Util::get_current_time_nsecs()) - ll.budget;
+		if (sleep_ns > 0)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(sleep_ns));
+	}
+
+	auto begin = Util::get_current_time_nsecs();
+	ll.frame_begin[frame_id & LowLatencyState::FrameMask] = begin;
+	ll.frame_target[frame_id & LowLatencyState::FrameMask] = target;
+	if (target)
+		ll.stats.latency = 1e-9 * double(int64_t(target - begin));
+	ll.stats.refresh_interval = 1e-9 * double(ll.refresh_interval);
+	ll.stats.budget = 1e-9 * double(ll.budget);
+	return true;
+}
+
+void WSI::pace_low_latency_frame(uint64_t frame_id)
+{
+	auto &ll = low_latency;
+	uint64_t target = 0;
+
+	// Wait for the frame we presented last to hit the display.
+	// If we actually blocked, the time we wake up is our best estimate of the vblank it was displayed in.
+	uint64_t waited_id = present_last_id;
+	if (waited_id && waited_id != ll.last_waited_id)
+	{
+		auto wait_begin = Util::get_current_time_nsecs();
+		VkResult result = table->vkWaitForPresentKHR(context->get_device(), swapchain, waited_id, 100 * 1000 * 1000);
+		auto display = Util::get_current_time_nsecs();
+		bool blocked = result == VK_SUCCESS && display - wait_begin > 500 * 1000;
+
+		if (result == VK_SUCCESS)
+		{
+			unsigned index = waited_id & LowLatencyState::FrameMask;
+			if (blocked && ll.last_display && waited_id == ll.last_waited_id + 1)
+				ll.display_delta[index] = display - ll.last_display;
+			else
+				ll.display_delta[index] = 0;
+
+			// Displays of back to back presents are a multiple of the refresh interval apart.
+			uint64_t refresh = UINT64_MAX;
+			unsigned valid = 0;
+			for (auto delta : ll.display_delta)
+			{
+				if (delta)
+				{
+					refresh = std::min(refresh, delta);
+					valid++;
+				}
+			}
+			if (valid >= LowLatencyState::NumFrames / 4)
+				ll.refresh_interval = int64_t(refresh);
+
+			if (blocked && ll.frame_begin[index])
+			{
+				int64_t latency = int64_t(display - ll.frame_begin[index]);
+				ll.stats.latency = 1e-9 * double(latency);
+
+				// Landing a whole refresh after the vblank we aimed for means we started too late,
+				// back off and don't dip below this budget again for a while.
+				if (ll.frame_target[index] && int64_t(display - ll.frame_target[index]) > ll.refresh_interval / 2)
+				{
+					ll.miss_floor = ll.budget + (ll.refresh_interval >> 2);
+					ll.miss_hold_frames = 600;
+					ll.budget = std::min(ll.budget + (ll.refresh_interval >> 2), 2 * ll.refresh_interval);
+				}
+				else if (ll.refresh_interval)
+				{
+					// Keep a quarter frame of slack on top of the CPU time in case a frame is heavier than normal.
+					int64_t floor_budget = 0;
+					for (auto t : ll.cpu_time)
+						floor_budget = std::max(floor_budget, t);
+					floor_budget += ll.refresh_interval >> 2;
+					if (ll.miss_hold_frames)
+					{
+						floor_budget = std::max(floor_budget, ll.miss_floor);
+						ll.miss_hold_frames--;
+					}
+
+					if (!ll.budget)
+						ll.budget = ll.refresh_interval;
+					ll.budget = std::max(ll.budget - (ll.refresh_interval >> 7), floor_budget);
+				}
+			}
+
+			ll.last_display = blocked ? display : 0;
+			ll.last_waited_id = waited_id;
+		}
+		else
+			ll.last_display = 0;
+	}
+
+	// Start so that the frame is done just before the next vblank.
+	if (ll.last_display && ll.refresh_interval && ll.budget)
+	{
+		target = ll.last_display + uint64_t(ll.refresh_interval);
+		int64_t sleep_ns = int64_t(target - Util::get_current_time_nsecs()) - ll.budget;
+		if (sleep_ns > 0)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(sleep_ns));
+
+		// Heavy frames can't make the next vblank, don't judge them against it.
+		if (ll.budget > ll.refresh_interval)
+			target = 0;
+	}
+
+	ll.frame_begin[frame_id & LowLatencyState::FrameMask] = Util::get_current_time_nsecs();
+	ll.frame_target[frame_id & LowLatencyState::FrameMask] = target;
+	ll.stats.refresh_interval = 1e-9 * double(ll.refresh_interval);
+	ll.stats.budget = 1e-9 * double(ll.budget);
+}
+
 void WSIPlatform::event_device_created(Device *) {}
 void WSIPlatform::event_device_destroyed() {}
 void WSIPlatform::event_swapchain_created(Device *, unsigned, unsigned, float, size_t, VkFormat, VkSurfaceTransformFlagBitsKHR) {}
@@ -31,6 +31,8 @@
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <mutex>
+#include <condition_variable>
 
 namespace Vulkan
 {
@@ -81,6 +83,13 @@ public:
 		return false;
 	}
 
+	// For platforms which observe the display directly. Blocks until the next vblank and returns
+	// its time in Util::get_current_time_nsecs() time base, along with the refresh interval.
+	virtual bool wait_vblank(uint64_t &, uint64_t &)
+	{
+		return false;
+	}
+
 	virtual void block_until_wsi_forward_progress(Vulkan::WSI &wsi)
 	{
 		get_frame_timer().enter_idle();
@@ -129,6 +138,15 @@ private:
 	Util::FrameTimer timer;
 };
 
+struct LowLatencyStats
+{
+	// Time from frame start to the frame being displayed, in seconds.
+	double latency;
+	double refresh_interval;
+	// Frame start is delayed to this long before the expected vblank.
+	double budget;
+};
+
 enum class PresentMode
 {
 	SyncToVBlank, // Force FIFO
@@ -202,6 +220,40 @@ public:
 		return timing;
 	}
 
+	// Delays the start of CPU work so that input is sampled as late as possible while still hitting vblank.
+	// Uses VK_NV_low_latency2 or VK_AMD_anti_lag if available,
+	// otherwise paces frames by observing present completion with VK_KHR_present_wait.
+	void set_low_latency_mode(bool enable);
+	bool get_low_latency_mode() const
+	{
+		return low_latency_mode;
+	}
+
+	// Call right before begin_frame(), may sleep.
+	void begin_low_latency_frame();
+
+	// Number of presents which may be queued up before the CPU blocks on VK_KHR_present_wait.
+	void set_present_frame_latency(unsigned latency);
+	unsigned get_present_frame_latency() const
+	{
+		return present_frame_latency;
+	}
+	const LowLatencyStats &get_low_latency_stats() const
+	{
+		return low_latency.stats;
+	}
+
+	// Runs vkQueuePresentKHR and vkAcquireNextImageKHR on a dedicated thread. The next image is acquired
+	// right after present, so begin_frame() only blocks if the presentation engine has not released one yet.
+	// Not used with low latency mode or the adaptive latency limiter, which need to observe acquire directly.
+	// WSI installs its own Device::set_queue_lock() callbacks while the thread runs.
+	// They chain to any callbacks the application installed, which are restored when the thread stops.
+	void set_present_thread(bool enable);
+	bool get_present_thread() const
+	{
+		return present_thread.enabled;
+	}
+
 private:
 	void update_framebuffer(unsigned width, unsigned height);
 
@@ -261,6 +313,84 @@ private:
 
 	WSITiming timing;
 
+	bool low_latency_mode = false;
+	struct LowLatencyState
+	{
+		enum { NumFrames = 16, FrameMask = NumFrames - 1 };
+		// Indexed by present ID.
+		uint64_t frame_begin[NumFrames] = {};
+		uint64_t frame_target[NumFrames] = {};
+		int64_t cpu_time[NumFrames] = {};
+		uint64_t display_delta[NumFrames] = {};
+		uint64_t last_waited_id = 0;
+		uint64_t last_display = 0;
+		int64_t refresh_interval = 0;
+		int64_t budget = 0;
+		int64_t miss_floor = 0;
+		unsigned miss_hold_frames = 0;
+		VkSemaphore sleep_semaphore = VK_NULL_HANDLE;
+		uint64_t sleep_value = 0;
+		// Paced on vblank events from the platform rather than present completion.
+		bool vblank_pacing = false;
+		LowLatencyStats stats = {};
+	} low_latency;
+
+	bool uses_present_wait_pacing() const;
+	void pace_low_latency_frame(uint64_t frame_id);
+	bool pace_low_latency_frame_vblank(uint64_t frame_id);
+	void update_low_latency_sleep_mode();
+	void set_low_latency_marker(uint64_t frame_id, int marker);
+	void update_anti_lag(uint64_t frame_id, int stage);
+	void tear_down_low_latency();
+	void lock_present_queue();
+	void unlock_present_queue();
+
+	struct PresentRequest
+	{
+		VkQueue queue;
+		VkSwapchainKHR swapchain;
+		VkSemaphore release;
+		uint32_t index;
+		uint64_t present_id;
+		unsigned frame_latency;
+		bool use_present_id;
+		bool use_present_time;
+		VkPresentTimeGOOGLE present_time;
+	};
+
+	struct
+	{
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable cond;
+		std::mutex queue_lock;
+		std::function<void ()> app_queue_lock;
+		std::function<void ()> app_queue_unlock;
+		PresentRequest present = {};
+		VkSwapchainKHR acquire_swapchain = VK_NULL_HANDLE;
+		VkSemaphore acquire_semaphore = VK_NULL_HANDLE;
+		VkResult acquire_result = VK_SUCCESS;
+		VkResult present_result = VK_SUCCESS;
+		uint32_t acquire_index = 0;
+		bool present_pending = false;
+		bool acquire_pending = false;
+		bool acquire_done = false;
+		bool dead = false;
+		bool enabled = false;
+	} present_thread;
+	// Owned by the main thread, keeps the semaphore of an in-flight acquire alive.
+	Semaphore present_thread_acquire;
+
+	bool uses_present_thread() const;
+	void start_present_thread();
+	void stop_present_thread();
+	void present_thread_loop();
+	VkResult present_thread_present(const PresentRequest &request);
+	void queue_present_thread(Semaphore release);
+	VkResult wait_present_thread_present();
+	VkResult wait_present_thread_acquire(Semaphore &acquire, uint32_t &index);
+	void drain_present_thread();
+
 	void tear_down_swapchain();
 	void drain_swapchain();
 